@@ -0,0 +1,36 @@
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ */
+
+#ifndef __jack_cycles_h__
+#define __jack_cycles_h__
+
+/* ARMv8: the virtual count of the generic timer, which runs at the
+   fixed rate given in CNTFRQ_EL0 and is readable from user space on
+   Linux. The isb keeps the read from being done early.
+ */
+
+typedef unsigned long long cycles_t;
+
+static inline cycles_t get_cycles (void)
+{
+	unsigned long long ret;
+
+	__asm__ __volatile__ ("isb; mrs %0, cntvct_el0" : "=r" (ret) : : "memory");
+	return ret;
+}
+
+#endif /* __jack_cycles_h__ */
@@ -25,10 +25,11 @@ typedef unsigned long long cycles_t;
 
 static inline cycles_t get_cycles (void)
 {
-	unsigned long long ret;
+	unsigned int lo, hi;
 
-	__asm__ __volatile__ ("rdtsc" : "=A" (ret));
-	return ret;
+	/* not "=A", which means only %rax on x86_64 */
+	__asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((unsigned long long)hi << 32) | lo;
 }
 
 #endif /* __jack_cycles_h__ */
@@ -112,6 +112,163 @@ jack_get_microseconds_from_hpet (void)
 
 #endif /* HPET_SUPPORT */
 
+/* the cycle counter clock, see jack_cycles_calibration_t */
+
+#if defined(__gnu_linux__) && (defined(__x86_64__) || defined(__aarch64__)) \
+	&& defined(HAVE_CLOCK_GETTIME)
+#define CYCLES_SUPPORT
+#define CYCLES_CALIBRATION_NSECS        50000000        /* 50 msecs */
+#ifdef __x86_64__
+#include <cpuid.h>
+#endif
+static jack_cycles_calibration_t cycles_cal;
+#endif
+
+#ifdef CYCLES_SUPPORT
+
+/* whether the counter runs at a constant rate in all power states and
+   is in step on all CPUs
+ */
+static int
+jack_cycles_invariant (void)
+{
+#ifdef __x86_64__
+	unsigned int eax, ebx, ecx, edx;
+	char buf[256];
+	FILE *f;
+	int found = 0;
+
+	if (!__get_cpuid (0x80000007, &eax, &ebx, &ecx, &edx)
+	    || !(edx & (1 << 8))) {
+		jack_error ("This CPU has no invariant TSC");
+		return 0;
+	}
+
+	/* the kernel drops the TSC from this list if it finds it out of
+	   step between CPUs, or otherwise unreliable
+	 */
+	f = fopen ("/sys/devices/system/clocksource/clocksource0/available_clocksource", "r");
+	if (f) {
+		if (fgets (buf, sizeof(buf), f)) {
+			char *tok;
+			for (tok = strtok (buf, " \n"); tok; tok = strtok (NULL, " \n")) {
+				if (strcmp (tok, "tsc") == 0) {
+					found = 1;
+				}
+			}
+		}
+		fclose (f);
+		if (!found) {
+			jack_error ("The kernel considers the TSC unstable on this system");
+			return 0;
+		}
+	}
+
+	return 1;
+#else
+	/* the ARMv8 generic timer is invariant by definition */
+	return 1;
+#endif
+}
+
+static uint64_t
+jack_cycles_nsecs (struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+/* read the counter and CLOCK_MONOTONIC as close together as we can */
+static void
+jack_cycles_sample (uint64_t *cycles, uint64_t *nsecs)
+{
+	uint64_t best = UINT64_MAX;
+	struct timespec ts;
+	cycles_t before, after;
+	int i;
+
+	for (i = 0; i < 16; ++i) {
+		before = get_cycles ();
+		clock_gettime (CLOCK_MONOTONIC, &ts);
+		after = get_cycles ();
+
+		if (after - before < best) {
+			best = after - before;
+			*cycles = before + (after - before) / 2;
+			*nsecs = jack_cycles_nsecs (&ts);
+		}
+	}
+}
+
+int
+jack_cycles_calibrate (jack_cycles_calibration_t *cal)
+{
+	struct timespec pause = { 0, CYCLES_CALIBRATION_NSECS };
+	uint64_t cycles0, cycles1, nsecs0, nsecs1;
+
+	memset (cal, 0, sizeof(*cal));
+
+	if (!jack_cycles_invariant ()) {
+		return -1;
+	}
+
+	jack_cycles_sample (&cycles0, &nsecs0);
+	while (nanosleep (&pause, &pause) != 0 && errno == EINTR) {
+		;
+	}
+	jack_cycles_sample (&cycles1, &nsecs1);
+
+	/* anything slower than 1MHz is no better than the system clock */
+
+	if (cycles1 <= cycles0 || nsecs1 <= nsecs0
+	    || (cycles1 - cycles0) * 1000 < nsecs1 - nsecs0) {
+		jack_error ("The cycle counter did not advance properly "
+			    "during calibration");
+		return -1;
+	}
+
+	cal->cycles = cycles1;
+	cal->usecs = nsecs1 / 1000;
+	cal->mult = (uint64_t)(((unsigned __int128)(nsecs1 - nsecs0)
+				<< JACK_CYCLES_SHIFT)
+			       / ((unsigned __int128)(cycles1 - cycles0) * 1000));
+
+	return 0;
+}
+
+void
+jack_set_cycles_calibration (const jack_cycles_calibration_t *cal)
+{
+	cycles_cal = *cal;
+}
+
+static jack_time_t
+jack_get_microseconds_from_cycles (void)
+{
+	/* 128 bits, so that the product does not overflow however long
+	   the server runs
+	 */
+	return cycles_cal.usecs
+	       + (jack_time_t)(((unsigned __int128)(get_cycles () - cycles_cal.cycles)
+				* cycles_cal.mult) >> JACK_CYCLES_SHIFT);
+}
+
+#else
+
+int
+jack_cycles_calibrate (jack_cycles_calibration_t *cal)
+{
+	memset (cal, 0, sizeof(*cal));
+	jack_error ("This version of JACK or this computer cannot use the cycle counter as a clock.\n"
+		    "Please choose a different clock source.");
+	return -1;
+}
+
+void
+jack_set_cycles_calibration (const jack_cycles_calibration_t *cal)
+{
+}
+
+#endif /* CYCLES_SUPPORT */
 
 void
 jack_init_time ()
@@ -131,6 +288,16 @@ jack_set_clock_source (jack_timer_type_t clocksrc)
 		}
 		break;
 
+#ifdef CYCLES_SUPPORT
+	case JACK_TIMER_CYCLE_COUNTER:
+		if (cycles_cal.mult) {
+			_jack_get_microseconds = jack_get_microseconds_from_cycles;
+		} else {
+			_jack_get_microseconds = jack_get_microseconds_from_system;
+		}
+		break;
+#endif
+
 	case JACK_TIMER_SYSTEM_CLOCK:
 	default:
 		_jack_get_microseconds = jack_get_microseconds_from_system;
@@ -39,6 +39,16 @@ void jack_set_clock_source (jack_timer_type_t clocksrc)
 	/* only one clock source for os x */
 }
 
+int jack_cycles_calibrate (jack_cycles_calibration_t *cal)
+{
+	memset (cal, 0, sizeof(*cal));
+	return -1;
+}
+
+void jack_set_cycles_calibration (const jack_cycles_calibration_t *cal)
+{
+}
+
 jack_time_t
 jack_get_microseconds_symbol (void)
 {
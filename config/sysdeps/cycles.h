@@ -15,6 +15,10 @@
 
 #include <config/cpu/i486/cycles.h>
 
+#elif defined(__aarch64__)
+
+#include <config/cpu/aarch64/cycles.h>
+
 #elif defined(__powerpc__) || defined(__ppc__)   /* linux and OSX gcc use different tokens */
 
 #include <config/cpu/powerpc/cycles.h>
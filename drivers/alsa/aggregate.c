@@ -0,0 +1,959 @@
+/* -*- mode: c; c-file-style: "linux"; -*- */
+/*
+    Aggregation of extra ALSA devices under the clock of the one the
+    driver runs on.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ */
+
+/*
+ * The master device drives alsa_driver_wait() as before. Each slave
+ * device runs on its own clock, in a thread of its own that moves
+ * whole device periods between the PCM and a ring buffer. Once per
+ * cycle, alsa_driver_read() and alsa_driver_write() resample between
+ * that ring and the slave's ports. The resampling ratio is the
+ * nominal ratio of the two rates, corrected by a PI controller that
+ * keeps the ring at AGG_TARGET_PERIODS device periods; the correction
+ * is the drift of the slave's clock against the master's.
+ */
+
+#include <config.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <jack/thread.h>
+
+#include "internal.h"
+#include "engine.h"
+
+#include "aggregate.h"
+
+#if HAVE_SAMPLERATE
+
+#define AGG_RING_PERIODS   8
+#define AGG_TARGET_PERIODS 2.0
+#define AGG_KP             2e-4         /* per period of fill error */
+#define AGG_KI             2e-6         /* the same, per cycle */
+#define AGG_SMOOTH         0.05         /* of the fill error */
+#define AGG_MAX_CORRECTION 0.005        /* 5000 ppm */
+
+static int
+alsa_slave_configure_stream (alsa_driver_t *driver, alsa_slave_t *slave,
+			     alsa_slave_stream_t *s, const char *stream_name)
+{
+	static const snd_pcm_format_t formats[] = {
+		SND_PCM_FORMAT_FLOAT,
+		SND_PCM_FORMAT_S32,
+		SND_PCM_FORMAT_S16,
+	};
+	snd_pcm_hw_params_t *hw_params;
+	snd_pcm_sw_params_t *sw_params;
+	snd_pcm_uframes_t period;
+	unsigned int rate, channels, periods = 3, i;
+	size_t max_frames;
+	int err;
+
+	snd_pcm_hw_params_alloca (&hw_params);
+	snd_pcm_sw_params_alloca (&sw_params);
+
+	if ((err = snd_pcm_hw_params_any (s->handle, hw_params)) < 0
+	    || (err = snd_pcm_hw_params_set_access (s->handle, hw_params,
+						    SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
+		jack_error ("ALSA: cannot configure %s for %s (%s)",
+			    slave->name, stream_name, snd_strerror (err));
+		return -1;
+	}
+
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i) {
+		if (snd_pcm_hw_params_set_format (s->handle, hw_params,
+						  formats[i]) == 0) {
+			break;
+		}
+	}
+	if (i == sizeof(formats) / sizeof(formats[0])) {
+		jack_error ("ALSA: %s has no sample format usable for %s",
+			    slave->name, stream_name);
+		return -1;
+	}
+	s->format = formats[i];
+
+	rate = slave->rate ? slave->rate : driver->frame_rate;
+	if ((err = snd_pcm_hw_params_set_rate_near (s->handle, hw_params,
+						    &rate, NULL)) < 0
+	    || (slave->rate && rate != slave->rate)) {
+		jack_error ("ALSA: cannot use the same rate for capture and "
+			    "playback on %s", slave->name);
+		return -1;
+	}
+	slave->rate = rate;
+	slave->nominal = (double)driver->frame_rate / rate;
+
+	if ((channels = s->channels) == 0) {
+		snd_pcm_hw_params_get_channels_max (hw_params, &channels);
+		if (channels > 1024) {
+			/* a plug device */
+			channels = 2;
+		}
+	}
+	if ((err = snd_pcm_hw_params_set_channels_near (s->handle, hw_params,
+							&channels)) < 0) {
+		jack_error ("ALSA: cannot set %u %s channels on %s",
+			    channels, stream_name, slave->name);
+		return -1;
+	}
+	s->channels = channels;
+
+	/* about as long as the master's period */
+	period = (snd_pcm_uframes_t)(driver->frames_per_cycle / slave->nominal);
+	if ((err = snd_pcm_hw_params_set_period_size_near (s->handle, hw_params,
+							   &period, NULL)) < 0
+	    || (err = snd_pcm_hw_params_set_periods_near (s->handle, hw_params,
+							  &periods, NULL)) < 0
+	    || (err = snd_pcm_hw_params (s->handle, hw_params)) < 0) {
+		jack_error ("ALSA: cannot set the %s period of %s (%s)",
+			    stream_name, slave->name, snd_strerror (err));
+		return -1;
+	}
+	snd_pcm_hw_params_get_period_size (hw_params, &period, NULL);
+	s->period = period;
+
+	snd_pcm_sw_params_current (s->handle, sw_params);
+	snd_pcm_sw_params_set_avail_min (s->handle, sw_params, period);
+	snd_pcm_sw_params_set_start_threshold (s->handle, sw_params,
+					       s == &slave->playback ? period : 1);
+	if ((err = snd_pcm_sw_params (s->handle, sw_params)) < 0) {
+		jack_error ("ALSA: cannot set %s software parameters on %s (%s)",
+			    stream_name, slave->name, snd_strerror (err));
+		return -1;
+	}
+
+	/* the most frames the ring side of the resampler handles in
+	   a cycle, with room for the largest correction */
+	max_frames = (size_t)(driver->frames_per_cycle / slave->nominal
+			      * (1.0 + 2 * AGG_MAX_CORRECTION)) + 64;
+
+	free (s->dev_buf);
+	free (s->conv_buf);
+	free (s->src_buf);
+	free (s->ring_buf);
+	if (s->rb) {
+		jack_ringbuffer_free (s->rb);
+	}
+
+	s->dev_buf = malloc (period * channels
+			     * snd_pcm_format_physical_width (s->format) / 8);
+	s->conv_buf = (float*)malloc (period * channels * sizeof(float));
+	s->src_buf = (float*)malloc (driver->frames_per_cycle * channels
+				     * sizeof(float));
+	s->ring_buf = (float*)malloc (max_frames * channels * sizeof(float));
+	s->ring_frames = max_frames;
+	s->rb = jack_ringbuffer_create (AGG_RING_PERIODS
+					* (period > max_frames ? period : max_frames)
+					* channels * sizeof(float));
+
+	if (!s->dev_buf || !s->conv_buf || !s->src_buf || !s->ring_buf || !s->rb) {
+		jack_error ("ALSA: cannot allocate buffers for %s", slave->name);
+		return -1;
+	}
+
+	jack_ringbuffer_mlock (s->rb);
+
+	if (s->src == NULL
+	    && (s->src = src_new (SRC_SINC_FASTEST, channels, &err)) == NULL) {
+		jack_error ("ALSA: cannot create a resampler for %s (%s)",
+			    slave->name, src_strerror (err));
+		return -1;
+	}
+
+	jack_info ("ALSA: %s %s: %u channels at %u Hz, %lu frame periods",
+		   slave->name, stream_name, channels, rate,
+		   (unsigned long)period);
+
+	return 0;
+}
+
+static void
+alsa_slave_free_stream (alsa_slave_stream_t *s)
+{
+	if (s->handle) {
+		snd_pcm_close (s->handle);
+	}
+	if (s->rb) {
+		jack_ringbuffer_free (s->rb);
+	}
+	if (s->src) {
+		src_delete (s->src);
+	}
+	free (s->dev_buf);
+	free (s->conv_buf);
+	free (s->src_buf);
+	free (s->ring_buf);
+	memset (s, 0, sizeof(*s));
+}
+
+/* Parse `devices', a list of PCM names separated by ';', and open
+   each of them for the directions the master uses. */
+int
+alsa_aggregate_open (alsa_driver_t *driver, const char *devices,
+		     int capturing, int playing)
+{
+	char *list, *name, *save;
+	alsa_slave_t *slave;
+	unsigned int n;
+	int err;
+
+	if ((list = strdup (devices)) == NULL) {
+		return -1;
+	}
+
+	for (n = 1, name = list; *name; ++name) {
+		n += (*name == ';');
+	}
+
+	driver->slaves = (alsa_slave_t*)calloc (n, sizeof(alsa_slave_t));
+	driver->nslaves = 0;
+
+	for (name = strtok_r (list, ";", &save); name;
+	     name = strtok_r (NULL, ";", &save)) {
+
+		slave = &driver->slaves[driver->nslaves++];
+		slave->name = strdup (name);
+
+		if (capturing
+		    && (err = snd_pcm_open (&slave->capture.handle, name,
+					    SND_PCM_STREAM_CAPTURE,
+					    SND_PCM_NONBLOCK)) < 0) {
+			jack_error ("ALSA: cannot open %s for capture (%s)",
+				    name, snd_strerror (err));
+			goto fail;
+		}
+
+		if (playing
+		    && (err = snd_pcm_open (&slave->playback.handle, name,
+					    SND_PCM_STREAM_PLAYBACK,
+					    SND_PCM_NONBLOCK)) < 0) {
+			jack_error ("ALSA: cannot open %s for playback (%s)",
+				    name, snd_strerror (err));
+			goto fail;
+		}
+	}
+
+	free (list);
+
+	return alsa_aggregate_configure (driver);
+
+fail:
+	free (list);
+	alsa_aggregate_close (driver);
+	return -1;
+}
+
+void
+alsa_aggregate_close (alsa_driver_t *driver)
+{
+	unsigned int i;
+
+	for (i = 0; i < driver->nslaves; ++i) {
+		alsa_slave_free_stream (&driver->slaves[i].capture);
+		alsa_slave_free_stream (&driver->slaves[i].playback);
+		free (driver->slaves[i].name);
+	}
+
+	free (driver->slaves);
+	driver->slaves = NULL;
+	driver->nslaves = 0;
+}
+
+/* (Re)configure the slaves for the master's rate and period. */
+int
+alsa_aggregate_configure (alsa_driver_t *driver)
+{
+	alsa_slave_t *slave;
+	unsigned int i;
+
+	for (i = 0; i < driver->nslaves; ++i) {
+
+		slave = &driver->slaves[i];
+		slave->rate = 0;
+
+		if (slave->capture.handle
+		    && alsa_slave_configure_stream (driver, slave,
+						    &slave->capture, "capture")) {
+			return -1;
+		}
+
+		if (slave->playback.handle
+		    && alsa_slave_configure_stream (driver, slave,
+						    &slave->playback, "playback")) {
+			return -1;
+		}
+
+		/* with -v, report about every 10 seconds */
+		slave->report_cycles = 10 * driver->frame_rate
+				       / driver->frames_per_cycle;
+		if (slave->report_cycles == 0) {
+			slave->report_cycles = 1;
+		}
+	}
+
+	return 0;
+}
+
+static void
+alsa_slave_to_float (alsa_slave_stream_t *s, snd_pcm_uframes_t frames)
+{
+	unsigned long n = frames * s->channels;
+
+	switch (s->format) {
+	case SND_PCM_FORMAT_S32:
+		sample_move_dS_s32u24 (s->conv_buf, (char*)s->dev_buf, n, 4);
+		break;
+	case SND_PCM_FORMAT_S16:
+		sample_move_dS_s16 (s->conv_buf, (char*)s->dev_buf, n, 2);
+		break;
+	default:
+		memcpy (s->conv_buf, s->dev_buf, n * sizeof(float));
+		break;
+	}
+}
+
+static void
+alsa_slave_from_float (alsa_slave_stream_t *s, snd_pcm_uframes_t frames)
+{
+	unsigned long n = frames * s->channels;
+
+	switch (s->format) {
+	case SND_PCM_FORMAT_S32:
+		sample_move_d32u24_sS ((char*)s->dev_buf, s->conv_buf, n, 4, NULL);
+		break;
+	case SND_PCM_FORMAT_S16:
+		sample_move_d16_sS ((char*)s->dev_buf, s->conv_buf, n, 2, NULL);
+		break;
+	default:
+		memcpy (s->dev_buf, s->conv_buf, n * sizeof(float));
+		break;
+	}
+}
+
+static int
+alsa_slave_recover (alsa_slave_t *slave, alsa_slave_stream_t *s, int err)
+{
+	if (err == -EPIPE || err == -ESTRPIPE) {
+		s->xruns++;
+	}
+
+	if ((err = snd_pcm_recover (s->handle, err, 1)) < 0) {
+		jack_error ("ALSA: cannot recover %s (%s)", slave->name,
+			    snd_strerror (err));
+		return err;
+	}
+
+	if (s == &slave->capture) {
+		snd_pcm_start (s->handle);
+	}
+
+	return 0;
+}
+
+static void *
+alsa_slave_capture_thread (void *arg)
+{
+	alsa_slave_t *slave = (alsa_slave_t*)arg;
+	alsa_slave_stream_t *s = &slave->capture;
+	size_t frame_bytes = s->channels * sizeof(float);
+	snd_pcm_sframes_t n;
+	int err;
+
+	while (slave->running) {
+
+		if ((err = snd_pcm_wait (s->handle, 100)) <= 0) {
+			if (err < 0 && alsa_slave_recover (slave, s, err)) {
+				break;
+			}
+			continue;
+		}
+
+		if ((n = snd_pcm_readi (s->handle, s->dev_buf, s->period)) < 0) {
+			if (n != -EAGAIN && alsa_slave_recover (slave, s, n)) {
+				break;
+			}
+			continue;
+		}
+
+		alsa_slave_to_float (s, n);
+
+		if (jack_ringbuffer_write_space (s->rb) < n * frame_bytes) {
+			s->dropouts++;
+			continue;
+		}
+
+		jack_ringbuffer_write (s->rb, (char*)s->conv_buf, n * frame_bytes);
+	}
+
+	return NULL;
+}
+
+static void *
+alsa_slave_playback_thread (void *arg)
+{
+	alsa_slave_t *slave = (alsa_slave_t*)arg;
+	alsa_slave_stream_t *s = &slave->playback;
+	size_t frame_bytes = s->channels * sizeof(float);
+	size_t have, n = s->period;
+	snd_pcm_sframes_t written;
+	int err;
+
+	while (slave->running) {
+
+		if ((err = snd_pcm_wait (s->handle, 100)) <= 0) {
+			if (err < 0 && alsa_slave_recover (slave, s, err)) {
+				break;
+			}
+			continue;
+		}
+
+		have = jack_ringbuffer_read_space (s->rb) / frame_bytes;
+
+		if (have >= n) {
+			jack_ringbuffer_read (s->rb, (char*)s->conv_buf,
+					      n * frame_bytes);
+		} else {
+			jack_ringbuffer_read (s->rb, (char*)s->conv_buf,
+					      have * frame_bytes);
+			memset (s->conv_buf + have * s->channels, 0,
+				(n - have) * frame_bytes);
+			if (s->primed) {
+				s->dropouts++;
+			}
+		}
+
+		alsa_slave_from_float (s, n);
+
+		if ((written = snd_pcm_writei (s->handle, s->dev_buf, n)) < 0
+		    && written != -EAGAIN
+		    && alsa_slave_recover (slave, s, written)) {
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static void
+alsa_slave_reset_stream (alsa_slave_stream_t *s)
+{
+	jack_ringbuffer_reset (s->rb);
+	src_reset (s->src);
+	s->err = 0;
+	s->integral = 0;
+	s->correction = 0;
+	s->primed = 0;
+	s->drift_ppm = 0;
+	s->drift_min = 0;
+	s->drift_max = 0;
+	s->xruns = 0;
+	s->dropouts = 0;
+}
+
+int
+alsa_aggregate_start (alsa_driver_t *driver)
+{
+	jack_engine_t *engine = driver->engine;
+	alsa_slave_t *slave;
+	alsa_slave_stream_t *s;
+	snd_pcm_uframes_t i;
+	size_t silence;
+	int err;
+
+	for (i = 0; i < driver->nslaves; ++i) {
+
+		slave = &driver->slaves[i];
+		slave->cycles = 0;
+		slave->running = 1;
+
+		if ((s = &slave->capture)->handle) {
+			alsa_slave_reset_stream (s);
+			if ((err = snd_pcm_prepare (s->handle)) < 0
+			    || (err = snd_pcm_start (s->handle)) < 0) {
+				jack_error ("ALSA: cannot start capture on %s (%s)",
+					    slave->name, snd_strerror (err));
+				return -1;
+			}
+			if (jack_client_create_thread (NULL, &s->thread,
+						       engine->rtpriority,
+						       engine->control->real_time,
+						       alsa_slave_capture_thread,
+						       slave)) {
+				jack_error ("ALSA: cannot start the capture "
+					    "thread for %s", slave->name);
+				return -1;
+			}
+		}
+
+		if ((s = &slave->playback)->handle) {
+			alsa_slave_reset_stream (s);
+
+			/* start at the target fill, in silence */
+			silence = (size_t)(AGG_TARGET_PERIODS * s->period)
+				  * s->channels * sizeof(float);
+			memset (s->conv_buf, 0, s->period * s->channels * sizeof(float));
+			while (silence) {
+				size_t chunk = s->period * s->channels * sizeof(float);
+				if (chunk > silence) {
+					chunk = silence;
+				}
+				jack_ringbuffer_write (s->rb, (char*)s->conv_buf, chunk);
+				silence -= chunk;
+			}
+
+			if ((err = snd_pcm_prepare (s->handle)) < 0) {
+				jack_error ("ALSA: cannot start playback on %s (%s)",
+					    slave->name, snd_strerror (err));
+				return -1;
+			}
+			if (jack_client_create_thread (NULL, &s->thread,
+						       engine->rtpriority,
+						       engine->control->real_time,
+						       alsa_slave_playback_thread,
+						       slave)) {
+				jack_error ("ALSA: cannot start the playback "
+					    "thread for %s", slave->name);
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static void
+alsa_slave_report (alsa_slave_t *slave, alsa_slave_stream_t *s,
+		   const char *stream_name)
+{
+	jack_info ("ALSA: %s %s: drift %+.1f ppm (%+.1f to %+.1f), "
+		   "%lu xruns, %lu dropouts", slave->name, stream_name,
+		   s->drift_ppm, s->drift_min, s->drift_max,
+		   s->xruns, s->dropouts);
+}
+
+void
+alsa_aggregate_stop (alsa_driver_t *driver)
+{
+	alsa_slave_t *slave;
+	unsigned int i;
+
+	for (i = 0; i < driver->nslaves; ++i) {
+
+		slave = &driver->slaves[i];
+
+		if (!slave->running) {
+			continue;
+		}
+
+		/* the threads poll with a timeout, so they notice */
+		slave->running = 0;
+
+		if (slave->capture.handle) {
+			pthread_join (slave->capture.thread, NULL);
+			snd_pcm_drop (slave->capture.handle);
+			alsa_slave_report (slave, &slave->capture, "capture");
+		}
+
+		if (slave->playback.handle) {
+			pthread_join (slave->playback.thread, NULL);
+			snd_pcm_drop (slave->playback.handle);
+			alsa_slave_report (slave, &slave->playback, "playback");
+		}
+	}
+}
+
+static int
+alsa_slave_register_ports (alsa_driver_t *driver, alsa_slave_stream_t *s,
+			   const char *prefix, unsigned long *next, int flags)
+{
+	jack_port_t *port;
+	unsigned int chn;
+	char buf[32];
+
+	for (chn = 0; chn < s->channels; chn++) {
+
+		snprintf (buf, sizeof(buf), "%s_%lu", prefix, ++*next);
+
+		if ((port = jack_port_register (driver->client, buf,
+						JACK_DEFAULT_AUDIO_TYPE,
+						flags, 0)) == NULL) {
+			jack_error ("ALSA: cannot register port for %s", buf);
+			return -1;
+		}
+
+		s->ports = jack_slist_append (s->ports, port);
+	}
+
+	return 0;
+}
+
+/* The slaves' ports are numbered on from the master's. */
+int
+alsa_aggregate_attach (alsa_driver_t *driver)
+{
+	unsigned long ncapture = driver->capture_nchannels;
+	unsigned long nplayback = driver->playback_nchannels;
+	unsigned int i;
+
+	for (i = 0; i < driver->nslaves; ++i) {
+
+		alsa_slave_t *slave = &driver->slaves[i];
+
+		if (slave->capture.handle
+		    && alsa_slave_register_ports (driver, &slave->capture,
+						  "capture", &ncapture,
+						  JackPortIsOutput
+						  | JackPortIsPhysical
+						  | JackPortIsTerminal)) {
+			return -1;
+		}
+
+		if (slave->playback.handle
+		    && alsa_slave_register_ports (driver, &slave->playback,
+						  "playback", &nplayback,
+						  JackPortIsInput
+						  | JackPortIsPhysical
+						  | JackPortIsTerminal)) {
+			return -1;
+		}
+	}
+
+	alsa_aggregate_set_latency (driver, JackCaptureLatency);
+	alsa_aggregate_set_latency (driver, JackPlaybackLatency);
+
+	return 0;
+}
+
+void
+alsa_aggregate_detach (alsa_driver_t *driver)
+{
+	JSList *node;
+	unsigned int i;
+
+	for (i = 0; i < driver->nslaves; ++i) {
+
+		alsa_slave_t *slave = &driver->slaves[i];
+
+		for (node = slave->capture.ports; node;
+		     node = jack_slist_next (node))
+			jack_port_unregister (driver->client,
+					      ((jack_port_t*)node->data));
+		jack_slist_free (slave->capture.ports);
+		slave->capture.ports = NULL;
+
+		for (node = slave->playback.ports; node;
+		     node = jack_slist_next (node))
+			jack_port_unregister (driver->client,
+					      ((jack_port_t*)node->data));
+		jack_slist_free (slave->playback.ports);
+		slave->playback.ports = NULL;
+	}
+}
+
+/* The ring adds its target fill, in master frames, to the latency of
+   a slave's ports. */
+void
+alsa_aggregate_set_latency (alsa_driver_t *driver,
+			    jack_latency_callback_mode_t mode)
+{
+	jack_latency_range_t range;
+	alsa_slave_stream_t *s;
+	JSList *node;
+	unsigned int i;
+
+	for (i = 0; i < driver->nslaves; ++i) {
+
+		alsa_slave_t *slave = &driver->slaves[i];
+
+		s = (mode == JackCaptureLatency) ? &slave->capture : &slave->playback;
+
+		if (s->handle == NULL) {
+			continue;
+		}
+
+		range.min = range.max = driver->frames_per_cycle
+					+ (jack_nframes_t)(AGG_TARGET_PERIODS * s->period
+							   * slave->nominal);
+
+		for (node = s->ports; node; node = jack_slist_next (node))
+			jack_port_set_latency_range ((jack_port_t*)node->data,
+						     mode, &range);
+	}
+}
+
+/* Run the controller on the ring's fill, in device frames. */
+static void
+alsa_slave_adjust (alsa_slave_stream_t *s, size_t fill, int sign)
+{
+	double err = ((double)fill - AGG_TARGET_PERIODS * s->period) / s->period;
+	double c;
+
+	s->err += AGG_SMOOTH * (err - s->err);
+
+	s->integral += AGG_KI * s->err;
+	if (s->integral > AGG_MAX_CORRECTION) {
+		s->integral = AGG_MAX_CORRECTION;
+	} else if (s->integral < -AGG_MAX_CORRECTION) {
+		s->integral = -AGG_MAX_CORRECTION;
+	}
+
+	c = AGG_KP * s->err + s->integral;
+	if (c > AGG_MAX_CORRECTION) {
+		c = AGG_MAX_CORRECTION;
+	} else if (c < -AGG_MAX_CORRECTION) {
+		c = -AGG_MAX_CORRECTION;
+	}
+	s->correction = c;
+
+	/* the integral term is the steady-state drift */
+	s->drift_ppm = sign * s->integral * 1e6;
+	if (s->drift_ppm < s->drift_min) {
+		s->drift_min = s->drift_ppm;
+	}
+	if (s->drift_ppm > s->drift_max) {
+		s->drift_max = s->drift_ppm;
+	}
+}
+
+static void
+alsa_slave_read (alsa_slave_t *slave, jack_nframes_t nframes)
+{
+	alsa_slave_stream_t *s = &slave->capture;
+	size_t frame_bytes = s->channels * sizeof(float);
+	size_t fill, target = (size_t)(AGG_TARGET_PERIODS * s->period);
+	jack_default_audio_sample_t *buf;
+	jack_nframes_t i;
+	unsigned int chn;
+	SRC_DATA data;
+	JSList *node;
+
+	fill = jack_ringbuffer_read_space (s->rb) / frame_bytes;
+
+	if (!s->primed) {
+		if (fill < target) {
+			/* not there yet: silence */
+			memset (s->src_buf, 0, nframes * frame_bytes);
+			goto deinterleave;
+		}
+		/* start the controller at rest */
+		jack_ringbuffer_read_advance (s->rb, (fill - target) * frame_bytes);
+		fill = target;
+		s->primed = 1;
+	}
+
+	alsa_slave_adjust (s, fill, 1);
+
+	if (fill > s->ring_frames) {
+		fill = s->ring_frames;
+	}
+
+	jack_ringbuffer_peek (s->rb, (char*)s->ring_buf, fill * frame_bytes);
+
+	data.data_in = s->ring_buf;
+	data.input_frames = fill;
+	data.data_out = s->src_buf;
+	data.output_frames = nframes;
+	data.end_of_input = 0;
+	data.src_ratio = slave->nominal * (1.0 - s->correction);
+
+	if (src_process (s->src, &data) != 0) {
+		data.input_frames_used = 0;
+		data.output_frames_gen = 0;
+	}
+
+	jack_ringbuffer_read_advance (s->rb, data.input_frames_used * frame_bytes);
+
+	if (data.output_frames_gen < (long)nframes) {
+		/* ran dry: fill up again before going on */
+		memset (s->src_buf + data.output_frames_gen * s->channels, 0,
+			(nframes - data.output_frames_gen) * frame_bytes);
+		s->dropouts++;
+		s->primed = 0;
+	}
+
+deinterleave:
+	for (chn = 0, node = s->ports; node;
+	     node = jack_slist_next (node), chn++) {
+
+		jack_port_t *port = (jack_port_t*)node->data;
+
+		if (!jack_port_connected (port)) {
+			continue;
+		}
+
+		buf = jack_port_get_buffer (port, nframes);
+
+		for (i = 0; i < nframes; ++i) {
+			buf[i] = s->src_buf[i * s->channels + chn];
+		}
+	}
+}
+
+static void
+alsa_slave_write (alsa_slave_t *slave, jack_nframes_t nframes)
+{
+	alsa_slave_stream_t *s = &slave->playback;
+	size_t frame_bytes = s->channels * sizeof(float);
+	jack_default_audio_sample_t *buf;
+	jack_nframes_t i;
+	unsigned int chn;
+	SRC_DATA data;
+	JSList *node;
+
+	for (chn = 0, node = s->ports; node;
+	     node = jack_slist_next (node), chn++) {
+
+		/* unconnected ports read as silence */
+		buf = jack_port_get_buffer ((jack_port_t*)node->data, nframes);
+
+		for (i = 0; i < nframes; ++i) {
+			s->src_buf[i * s->channels + chn] = buf[i];
+		}
+	}
+
+	alsa_slave_adjust (s, jack_ringbuffer_read_space (s->rb) / frame_bytes, -1);
+
+	data.data_in = s->src_buf;
+	data.input_frames = nframes;
+	data.data_out = s->ring_buf;
+	data.output_frames = s->ring_frames;
+	data.end_of_input = 0;
+	data.src_ratio = (1.0 - s->correction) / slave->nominal;
+
+	if (src_process (s->src, &data) != 0) {
+		return;
+	}
+
+	if (jack_ringbuffer_write_space (s->rb)
+	    < data.output_frames_gen * frame_bytes) {
+		s->dropouts++;
+		return;
+	}
+
+	jack_ringbuffer_write (s->rb, (char*)s->ring_buf,
+			       data.output_frames_gen * frame_bytes);
+	s->primed = 1;
+}
+
+static void
+alsa_slave_stats (alsa_driver_t *driver, alsa_slave_t *slave)
+{
+	if (++slave->cycles % slave->report_cycles == 0
+	    && driver->engine->verbose) {
+		if (slave->capture.handle) {
+			alsa_slave_report (slave, &slave->capture, "capture");
+		}
+		if (slave->playback.handle) {
+			alsa_slave_report (slave, &slave->playback, "playback");
+		}
+	}
+}
+
+void
+alsa_aggregate_read (alsa_driver_t *driver, jack_nframes_t nframes)
+{
+	unsigned int i;
+
+	for (i = 0; i < driver->nslaves; ++i) {
+		if (driver->slaves[i].capture.handle) {
+			alsa_slave_read (&driver->slaves[i], nframes);
+		}
+	}
+}
+
+void
+alsa_aggregate_write (alsa_driver_t *driver, jack_nframes_t nframes)
+{
+	unsigned int i;
+
+	for (i = 0; i < driver->nslaves; ++i) {
+		if (driver->slaves[i].playback.handle) {
+			alsa_slave_write (&driver->slaves[i], nframes);
+		}
+		alsa_slave_stats (driver, &driver->slaves[i]);
+	}
+}
+
+#else /* !HAVE_SAMPLERATE */
+
+int
+alsa_aggregate_open (alsa_driver_t *driver, const char *devices,
+		     int capturing, int playing)
+{
+	jack_error ("ALSA: aggregating devices needs libsamplerate, which "
+		    "this driver was built without");
+	return -1;
+}
+
+void
+alsa_aggregate_close (alsa_driver_t *driver)
+{
+}
+
+int
+alsa_aggregate_configure (alsa_driver_t *driver)
+{
+	return 0;
+}
+
+int
+alsa_aggregate_start (alsa_driver_t *driver)
+{
+	return 0;
+}
+
+void
+alsa_aggregate_stop (alsa_driver_t *driver)
+{
+}
+
+int
+alsa_aggregate_attach (alsa_driver_t *driver)
+{
+	return 0;
+}
+
+void
+alsa_aggregate_detach (alsa_driver_t *driver)
+{
+}
+
+void
+alsa_aggregate_set_latency (alsa_driver_t *driver,
+			    jack_latency_callback_mode_t mode)
+{
+}
+
+void
+alsa_aggregate_read (alsa_driver_t *driver, jack_nframes_t nframes)
+{
+}
+
+void
+alsa_aggregate_write (alsa_driver_t *driver, jack_nframes_t nframes)
+{
+}
+
+#endif /* HAVE_SAMPLERATE */
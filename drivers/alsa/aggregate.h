@@ -0,0 +1,89 @@
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ */
+
+#ifndef __jack_alsa_aggregate_h__
+#define __jack_alsa_aggregate_h__
+
+#include <pthread.h>
+
+#include <config.h>
+
+#if HAVE_SAMPLERATE
+#include <samplerate.h>
+#endif
+
+#include <jack/ringbuffer.h>
+
+#include "alsa_driver.h"
+
+/* One direction of a slave device. The device thread moves whole
+   device periods between the PCM and `rb'; the driver resamples
+   between `rb' and the port buffers once per cycle. */
+typedef struct {
+	snd_pcm_t *handle;
+	snd_pcm_format_t format;
+	unsigned int channels;
+	snd_pcm_uframes_t period;
+	jack_ringbuffer_t *rb;          /* interleaved float frames */
+	void *dev_buf;                  /* one device period, device format */
+	float *conv_buf;                /* the same, as float */
+	float *src_buf;                 /* one cycle, interleaved */
+	float *ring_buf;                /* the ring side of the resampler */
+	size_t ring_frames;
+#if HAVE_SAMPLERATE
+	SRC_STATE *src;
+#endif
+	double err;                     /* smoothed fill error, in periods */
+	double integral;
+	double correction;              /* current rate correction */
+	int primed;
+	pthread_t thread;
+	JSList *ports;
+
+	/* statistics, since the driver started */
+	double drift_ppm;               /* smoothed, + means device is fast */
+	double drift_min;
+	double drift_max;
+	unsigned long xruns;            /* on the device */
+	unsigned long dropouts;         /* ring buffer ran dry or over */
+} alsa_slave_stream_t;
+
+typedef struct _alsa_slave {
+	char *name;
+	unsigned int rate;
+	double nominal;                 /* engine rate / device rate */
+	volatile int running;
+	alsa_slave_stream_t capture;
+	alsa_slave_stream_t playback;
+	unsigned long cycles;
+	unsigned long report_cycles;
+} alsa_slave_t;
+
+int  alsa_aggregate_open(alsa_driver_t *driver, const char *devices,
+			 int capturing, int playing);
+void alsa_aggregate_close(alsa_driver_t *driver);
+int  alsa_aggregate_configure(alsa_driver_t *driver);
+int  alsa_aggregate_start(alsa_driver_t *driver);
+void alsa_aggregate_stop(alsa_driver_t *driver);
+int  alsa_aggregate_attach(alsa_driver_t *driver);
+void alsa_aggregate_detach(alsa_driver_t *driver);
+void alsa_aggregate_set_latency(alsa_driver_t *driver,
+				jack_latency_callback_mode_t mode);
+void alsa_aggregate_read(alsa_driver_t *driver, jack_nframes_t nframes);
+void alsa_aggregate_write(alsa_driver_t *driver, jack_nframes_t nframes);
+
+#endif /* __jack_alsa_aggregate_h__ */
@@ -18,6 +18,8 @@
 
  */
 
+#include <config.h>
+
 #include <math.h>
 #include <stdio.h>
 #include <memory.h>
@@ -29,11 +31,13 @@
 #include <sys/types.h>
 #include <regex.h>
 #include <string.h>
+#include <sys/timerfd.h>
 
 #include "internal.h"
 #include "engine.h"
 #include "messagebuffer.h"
 #include "libjack/local.h"
+#include "probes.h"
 
 #include <sysdeps/time.h>
 
@@ -43,6 +47,8 @@
 #include "ice1712.h"
 #include "usx2y.h"
 #include "generic.h"
+#include "aggregate.h"
+#include "varispeed.h"
 
 extern void store_work_time(int);
 extern void store_wait_time(int);
@@ -54,6 +60,9 @@ extern void show_work_times();
 /* Delay (in process calls) before jackd will report an xrun */
 #define XRUN_REPORT_DELAY 0
 
+/* Smallest hardware buffer with timer-based wakeups */
+#define ALSA_TSCHED_BUFFER_USECS 100000
+
 static void
 alsa_driver_release_channel_dependent_memory (alsa_driver_t *driver)
 {
@@ -80,6 +89,24 @@ alsa_driver_release_channel_dependent_memory (alsa_driver_t *driver)
 		driver->capture_interleave_skip = NULL;
 	}
 
+	if (driver->playback_bufs) {
+		free (driver->playback_bufs);
+		driver->playback_bufs = NULL;
+	}
+
+	if (driver->capture_bufs) {
+		free (driver->capture_bufs);
+		driver->capture_bufs = NULL;
+	}
+
+	free (driver->playback_plan);
+	driver->playback_plan = NULL;
+	free (driver->passthrough_from);
+	driver->passthrough_from = NULL;
+	free (driver->capture_plan);
+	driver->capture_plan = NULL;
+	driver->plan_valid = 0;
+
 	if (driver->silent) {
 		free (driver->silent);
 		driver->silent = 0;
@@ -89,6 +116,64 @@ alsa_driver_release_channel_dependent_memory (alsa_driver_t *driver)
 		free (driver->dither_state);
 		driver->dither_state = 0;
 	}
+
+	free (driver->monitor_mem);
+	driver->monitor_mem = NULL;
+	free (driver->monitor_src);
+	driver->monitor_src = NULL;
+}
+
+/* the buffers of the monitor routes, for the current period size */
+static int
+alsa_driver_alloc_monitor (alsa_driver_t *driver)
+{
+	size_t frames = driver->frames_per_cycle;
+	unsigned int r;
+
+	free (driver->monitor_mem);
+	driver->monitor_mem = NULL;
+	free (driver->monitor_src);
+	driver->monitor_src = NULL;
+
+	if (driver->nmonitor_routes == 0) {
+		return 0;
+	}
+
+	driver->monitor_mem = (jack_default_audio_sample_t*)
+			      calloc (2 * driver->nmonitor_routes * frames,
+				      sizeof(jack_default_audio_sample_t));
+	driver->monitor_src = (jack_default_audio_sample_t**)
+			      calloc (driver->capture_nchannels,
+				      sizeof(jack_default_audio_sample_t *));
+
+	if (driver->monitor_mem == NULL || driver->monitor_src == NULL) {
+		jack_error ("ALSA: cannot allocate monitor buffers");
+		return -1;
+	}
+
+	for (r = 0; r < driver->nmonitor_routes; r++) {
+		driver->monitor_routes[r].in_buf = driver->monitor_mem + 2 * r * frames;
+		driver->monitor_routes[r].out_buf = driver->monitor_routes[r].in_buf + frames;
+	}
+
+	driver->plan_valid = 0;
+	return 0;
+}
+
+/* the first monitor route from a capture channel, or to a playback
+   channel */
+static alsa_monitor_route_t *
+alsa_driver_monitor_route (alsa_driver_t *driver, channel_t chn, int to)
+{
+	unsigned int r;
+
+	for (r = 0; r < driver->nmonitor_routes; r++) {
+		if ((to ? driver->monitor_routes[r].out
+		     : driver->monitor_routes[r].in) == chn) {
+			return &driver->monitor_routes[r];
+		}
+	}
+	return NULL;
 }
 
 static int
@@ -330,6 +415,27 @@ alsa_driver_setup_io_function_pointers (alsa_driver_t *driver)
 			}
 		}
 	}
+
+	/* swap in vectorized converters where this CPU has them; the
+	   float converters are left alone
+	 */
+
+	if (driver->playback_handle) {
+		WriteCopyFunction func = driver->write_via_copy;
+		driver->write_via_copy = memops_simd_write_function (func);
+		driver->meter_in_copy = (driver->write_via_copy != func);
+		if (driver->meter_in_copy) {
+			jack_info ("%s playback sample conversion", memops_simd_name ());
+		}
+	}
+
+	if (driver->capture_handle) {
+		ReadCopyFunction func = driver->read_via_copy;
+		driver->read_via_copy = memops_simd_read_function (func);
+		if (driver->read_via_copy != func) {
+			jack_info ("%s capture sample conversion", memops_simd_name ());
+		}
+	}
 }
 
 static int
@@ -478,6 +584,16 @@ alsa_driver_configure_stream (alsa_driver_t *driver, char *device_name,
 	if (*nperiodsp < driver->user_nperiods) {
 		*nperiodsp = driver->user_nperiods;
 	}
+	if (driver->tsched) {
+		/* the timer decides when we run, so the hardware buffer
+		   can be large; only user_nperiods of it are kept full */
+		unsigned int tsched_periods = (unsigned int)
+			((uint64_t)ALSA_TSCHED_BUFFER_USECS * frame_rate
+			 / 1000000 / driver->frames_per_cycle);
+		if (*nperiodsp < tsched_periods) {
+			*nperiodsp = tsched_periods;
+		}
+	}
 	if (snd_pcm_hw_params_set_periods_near (handle, hw_params,
 						nperiodsp, NULL) < 0) {
 		jack_error ("ALSA: cannot set number of periods to %u for %s",
@@ -511,6 +627,13 @@ alsa_driver_configure_stream (alsa_driver_t *driver, char *device_name,
 		return -1;
 	}
 
+	if (driver->tsched
+	    && snd_pcm_hw_params_set_period_wakeup (handle, hw_params, 0) < 0) {
+		/* harmless: the interrupts are just not listened to */
+		jack_info ("ALSA: %s cannot turn off period interrupts",
+			   stream_name);
+	}
+
 	if ((err = snd_pcm_hw_params (handle, hw_params)) < 0) {
 		jack_error ("ALSA: cannot set hardware parameters for %s",
 			    stream_name);
@@ -519,6 +642,28 @@ alsa_driver_configure_stream (alsa_driver_t *driver, char *device_name,
 
 	snd_pcm_sw_params_current (handle, sw_params);
 
+#if defined(HAVE_SND_PCM_TSTAMP_TYPE) && HAVE_CLOCK_GETTIME
+	/* stamp hardware pointer updates on CLOCK_MONOTONIC, which is
+	   what jack_get_microseconds() reads with the system clock */
+	if (snd_pcm_sw_params_set_tstamp_mode (handle, sw_params,
+					       SND_PCM_TSTAMP_ENABLE) < 0
+	    || snd_pcm_sw_params_set_tstamp_type (handle, sw_params,
+						  SND_PCM_TSTAMP_TYPE_MONOTONIC) < 0) {
+		driver->hw_tstamp = 0;
+	}
+#else
+	driver->hw_tstamp = 0;
+#endif
+
+	if (driver->tsched && handle == driver->playback_handle) {
+		snd_pcm_uframes_t boundary;
+
+		/* zero what has been played, so that being late plays
+		   silence rather than the buffer's previous contents */
+		snd_pcm_sw_params_get_boundary (sw_params, &boundary);
+		snd_pcm_sw_params_set_silence_size (handle, sw_params, boundary);
+	}
+
 	if ((err = snd_pcm_sw_params_set_start_threshold (handle, sw_params,
 							  0U)) < 0) {
 		jack_error ("ALSA: cannot set start mode for %s", stream_name);
@@ -526,7 +671,9 @@ alsa_driver_configure_stream (alsa_driver_t *driver, char *device_name,
 	}
 
 	stop_th = *nperiodsp * driver->frames_per_cycle;
-	if (driver->soft_mode) {
+	if (driver->soft_mode || driver->fast_xrun) {
+		/* keep running through an xrun; with fast_xrun,
+		   alsa_driver_wait() notices it from the avail count */
 		stop_th = (snd_pcm_uframes_t)-1;
 	}
 
@@ -602,6 +749,7 @@ alsa_driver_set_parameters (alsa_driver_t *driver,
 	driver->frame_rate = rate;
 	driver->frames_per_cycle = frames_per_cycle;
 	driver->user_nperiods = user_nperiods;
+	driver->hw_tstamp = 1;          /* unless a stream can't */
 
 	jack_info ("configuring for %" PRIu32 "Hz, period = %"
 		   PRIu32 " frames (%.1f ms), buffer = %" PRIu32 " periods",
@@ -844,6 +992,10 @@ alsa_driver_set_parameters (alsa_driver_t *driver,
 
 	alsa_driver_setup_io_function_pointers (driver);
 
+	driver->playback_direct = driver->playback_handle
+				  && !driver->playback_interleaved
+				  && driver->playback_sample_format == SND_PCM_FORMAT_FLOAT_LE;
+
 	/* Allocate and initialize structures that rely on the
 	   channels counts.
 
@@ -865,6 +1017,15 @@ alsa_driver_set_parameters (alsa_driver_t *driver,
 						   malloc (sizeof(unsigned long *) * driver->playback_nchannels);
 		memset (driver->playback_interleave_skip, 0,
 			sizeof(unsigned long *) * driver->playback_nchannels);
+		driver->playback_bufs = (jack_default_audio_sample_t**)
+					calloc (driver->playback_nchannels,
+						sizeof(jack_default_audio_sample_t *));
+		driver->playback_plan = (alsa_channel_plan_t*)
+					calloc (driver->playback_nchannels,
+						sizeof(alsa_channel_plan_t));
+		driver->passthrough_from = (channel_t*)
+					   calloc (driver->playback_nchannels,
+						   sizeof(channel_t));
 		driver->silent = (unsigned long*)
 				 malloc (sizeof(unsigned long)
 					 * driver->playback_nchannels);
@@ -889,6 +1050,18 @@ alsa_driver_set_parameters (alsa_driver_t *driver,
 						  malloc (sizeof(unsigned long *) * driver->capture_nchannels);
 		memset (driver->capture_interleave_skip, 0,
 			sizeof(unsigned long *) * driver->capture_nchannels);
+		driver->capture_bufs = (jack_default_audio_sample_t**)
+				       calloc (driver->capture_nchannels,
+					       sizeof(jack_default_audio_sample_t *));
+		driver->capture_plan = (alsa_channel_plan_t*)
+				       calloc (driver->capture_nchannels,
+					       sizeof(alsa_channel_plan_t));
+	}
+
+	driver->plan_valid = 0;
+
+	if (alsa_driver_alloc_monitor (driver)) {
+		return -1;
 	}
 
 	driver->clock_sync_data = (ClockSyncStatus*)
@@ -935,7 +1108,30 @@ alsa_driver_reset_parameters (alsa_driver_t *driver,
 					   user_nperiods, rate);
 }
 
-static int
+/* for interleaved hardware, alsa_driver_read() and alsa_driver_write()
+   convert all channels one tile of frames at a time rather than one
+   channel at a time, so that each part of the mmap area is pulled into
+   the cache once per cycle instead of once per channel. A tile covers
+   about this many bytes of the mmap area.
+ */
+
+#define ALSA_TILE_BYTES 4096
+
+static jack_nframes_t
+alsa_driver_tile_frames (unsigned long frame_bytes)
+{
+	jack_nframes_t frames;
+
+	if (frame_bytes == 0) {
+		return 8;
+	}
+
+	/* keep tiles a multiple of the converters' block size */
+	frames = (ALSA_TILE_BYTES / frame_bytes) & ~7;
+	return frames ? frames : 8;
+}
+
+int
 alsa_driver_get_channel_addresses (alsa_driver_t *driver,
 				   snd_pcm_uframes_t *capture_avail,
 				   snd_pcm_uframes_t *playback_avail,
@@ -943,7 +1139,7 @@ alsa_driver_get_channel_addresses (alsa_driver_t *driver,
 				   snd_pcm_uframes_t *playback_offset)
 {
 	unsigned long err;
-	channel_t chn;
+	channel_t chn, i;
 
 	if (capture_avail) {
 		if ((err = snd_pcm_mmap_begin (
@@ -955,12 +1151,30 @@ alsa_driver_get_channel_addresses (alsa_driver_t *driver,
 			return -1;
 		}
 
-		for (chn = 0; chn < driver->capture_nchannels; chn++) {
-			const snd_pcm_channel_area_t *a =
-				&driver->capture_areas[chn];
-			driver->capture_addr[chn] = (char*)a->addr
-						    + ((a->first + a->step * *capture_offset) / 8);
-			driver->capture_interleave_skip[chn] = (unsigned long )(a->step / 8);
+		if (driver->plan_valid) {
+			/* only the channels that are read */
+			for (i = 0; i < driver->capture_plan_len; i++) {
+				const snd_pcm_channel_area_t *a =
+					&driver->capture_areas[driver->capture_plan[i].chn];
+				driver->capture_addr[driver->capture_plan[i].chn] =
+					(char*)a->addr
+					+ ((a->first + a->step * *capture_offset) / 8);
+				driver->capture_interleave_skip[driver->capture_plan[i].chn] =
+					(unsigned long )(a->step / 8);
+			}
+		} else {
+			for (chn = 0; chn < driver->capture_nchannels; chn++) {
+				const snd_pcm_channel_area_t *a =
+					&driver->capture_areas[chn];
+				driver->capture_addr[chn] = (char*)a->addr
+							    + ((a->first + a->step * *capture_offset) / 8);
+				driver->capture_interleave_skip[chn] = (unsigned long )(a->step / 8);
+			}
+		}
+
+		if (driver->capture_interleaved && driver->capture_nchannels) {
+			driver->capture_tile_frames = alsa_driver_tile_frames (
+				driver->capture_interleave_skip[0]);
 		}
 	}
 
@@ -981,6 +1195,11 @@ alsa_driver_get_channel_addresses (alsa_driver_t *driver,
 						     + ((a->first + a->step * *playback_offset) / 8);
 			driver->playback_interleave_skip[chn] = (unsigned long )(a->step / 8);
 		}
+
+		if (driver->playback_interleaved && driver->playback_nchannels) {
+			driver->playback_tile_frames = alsa_driver_tile_frames (
+				driver->playback_interleave_skip[0]);
+		}
 	}
 
 	return 0;
@@ -1049,7 +1268,9 @@ alsa_driver_start (alsa_driver_t *driver)
 
 	driver->pfd = (struct pollfd*)
 		      malloc (sizeof(struct pollfd) *
-			      (driver->playback_nfds + driver->capture_nfds + 2));
+			      (driver->playback_nfds + driver->capture_nfds + 3));
+
+	driver->tsched_due = 0;
 
 	if (driver->playback_handle) {
 		/* fill playback buffer with zeroes, and mark
@@ -1078,11 +1299,15 @@ alsa_driver_start (alsa_driver_t *driver)
 		   buffer.
 		 */
 
+		/* this leaves every channel known to be silent, so
+		   untouched ones need nothing more after a restart */
 		for (chn = 0; chn < driver->playback_nchannels; chn++) {
-			alsa_driver_silence_on_channel (
+			alsa_driver_silence_on_channel_no_mark (
 				driver, chn,
 				driver->user_nperiods
 				* driver->frames_per_cycle);
+			driver->silent[chn] = driver->user_nperiods
+					      * driver->frames_per_cycle;
 		}
 
 		snd_pcm_mmap_commit (driver->playback_handle, poffset,
@@ -1105,9 +1330,63 @@ alsa_driver_start (alsa_driver_t *driver)
 		}
 	}
 
+	if (driver->varispeed) {
+		alsa_varispeed_start (driver);
+	}
+
+	/* the slaves ride out an xrun of the master on their own */
+	if (driver->nslaves && !driver->xrun_recovery) {
+		return alsa_aggregate_start (driver);
+	}
+
 	return 0;
 }
 
+#define ALSA_PASSTHROUGH_MAX (sizeof(unsigned long) * 8)
+
+static inline int
+alsa_driver_passthrough_on (alsa_driver_t *driver, channel_t chn)
+{
+	return chn < ALSA_PASSTHROUGH_MAX
+	       && (driver->passthrough_mask & (1UL << chn));
+}
+
+/* how many of a capture channel's connections the card plays */
+static int
+alsa_driver_passthrough_count (alsa_driver_t *driver, channel_t in)
+{
+	channel_t chn;
+	int n = 0;
+
+	for (chn = 0; chn < driver->playback_nchannels; chn++) {
+		if (alsa_driver_passthrough_on (driver, chn)
+		    && driver->passthrough_from[chn] == in) {
+			n++;
+		}
+	}
+	return n;
+}
+
+static void
+alsa_driver_clear_passthrough (alsa_driver_t *driver)
+{
+	channel_t chn;
+
+	if (driver->passthrough_mask == 0) {
+		return;
+	}
+
+	for (chn = 0; chn < driver->playback_nchannels; chn++) {
+		if (alsa_driver_passthrough_on (driver, chn)) {
+			driver->hw->set_passthrough (driver->hw,
+						     driver->passthrough_from[chn],
+						     chn, FALSE);
+		}
+	}
+	driver->passthrough_mask = 0;
+	driver->plan_valid = 0;
+}
+
 static int
 alsa_driver_stop (alsa_driver_t *driver)
 {
@@ -1155,6 +1434,12 @@ alsa_driver_stop (alsa_driver_t *driver)
 		driver->hw->set_input_monitor_mask (driver->hw, 0);
 	}
 
+	alsa_driver_clear_passthrough (driver);
+
+	if (driver->nslaves && !driver->xrun_recovery) {
+		alsa_aggregate_stop (driver);
+	}
+
 	return 0;
 }
 
@@ -1176,6 +1461,7 @@ static int
 alsa_driver_xrun_recovery (alsa_driver_t *driver, float *delayed_usecs)
 {
 	snd_pcm_status_t *status;
+	jack_time_t recovery_start;
 	int res;
 
 	snd_pcm_status_alloca (&status);
@@ -1220,28 +1506,167 @@ alsa_driver_xrun_recovery (alsa_driver_t *driver, float *delayed_usecs)
 			 *delayed_usecs / 1000.0);
 	}
 
+	recovery_start = driver->engine->get_microseconds ();
+
 	if (alsa_driver_restart (driver)) {
 		return -1;
 	}
+
+	driver->engine->trace_recovery_usecs +=
+		driver->engine->get_microseconds () - recovery_start;
+
+	return 0;
+}
+
+/* With fast_xrun the PCMs do not stop at an xrun, so the hardware
+   pointer simply runs past ours. Move ours up to it with
+   snd_pcm_forward(), dropping the overwritten capture data, and queue
+   silence for only the part of the playback buffer the hardware will
+   reach before the next cycle writes. */
+static int
+alsa_driver_fast_xrun_recovery (alsa_driver_t *driver,
+				snd_pcm_sframes_t capture_avail,
+				snd_pcm_sframes_t playback_avail,
+				float *delayed_usecs)
+{
+	jack_time_t recovery_start = driver->engine->get_microseconds ();
+	snd_pcm_sframes_t skip, missed = 0;
+	snd_pcm_uframes_t offset, contiguous, nf;
+	channel_t chn;
+
+	if (driver->capture_handle) {
+		/* keep one period to read */
+		skip = capture_avail - driver->frames_per_cycle;
+		if (skip > 0) {
+			if (snd_pcm_forward (driver->capture_handle, skip) < 0) {
+				return -1;
+			}
+			missed = skip;
+		}
+	}
+
+	if (driver->playback_handle) {
+		skip = playback_avail
+		       - driver->frames_per_cycle * driver->playback_nperiods;
+		if (skip > 0) {
+			if (snd_pcm_forward (driver->playback_handle, skip) < 0) {
+				return -1;
+			}
+			if (skip > missed) {
+				missed = skip;
+			}
+		}
+
+		/* leave the usual amount of space for the next write */
+		nf = driver->frames_per_cycle * (driver->user_nperiods - 1);
+		offset = 0;
+		while (nf) {
+			contiguous = nf;
+
+			if (alsa_driver_get_channel_addresses (driver,
+							       0, &contiguous, 0, &offset)) {
+				return -1;
+			}
+
+			for (chn = 0; chn < driver->playback_nchannels; chn++) {
+				alsa_driver_silence_on_channel_no_mark (
+					driver, chn, contiguous);
+			}
+
+			if (snd_pcm_mmap_commit (driver->playback_handle,
+						 offset, contiguous) < 0) {
+				return -1;
+			}
+
+			nf -= contiguous;
+		}
+	}
+
+	if (driver->process_count > XRUN_REPORT_DELAY) {
+		driver->xrun_count++;
+		*delayed_usecs = missed * 1000000.0f / driver->frame_rate;
+		MESSAGE ("\n\n**** alsa_pcm: xrun of %.3f msecs, recovered "
+			 "in place\n\n", *delayed_usecs / 1000.0);
+	}
+
+	driver->engine->trace_recovery_usecs +=
+		driver->engine->get_microseconds () - recovery_start;
+
 	return 0;
 }
 
+static inline int
+alsa_driver_needs_silence (alsa_driver_t *driver, channel_t chn,
+			   jack_nframes_t buffer_frames)
+{
+	return bitset_contains (driver->channels_not_done, chn)
+	       && driver->silent[chn] < buffer_frames;
+}
+
+/* Silence `n' playback channels from `first' on, whose samples lie
+   next to each other in every frame of an interleaved buffer. */
+static void
+alsa_driver_silence_channel_group (alsa_driver_t *driver, channel_t first,
+				   channel_t n, jack_nframes_t nframes)
+{
+	unsigned long group_bytes = n * driver->playback_sample_bytes;
+	unsigned long skip = driver->playback_interleave_skip[first];
+	char *addr = driver->playback_addr[first];
+
+	if (group_bytes == skip) {
+		/* every channel of the frame: the region is contiguous */
+		memset (addr, 0, nframes * skip);
+		return;
+	}
+
+	while (nframes--) {
+		memset (addr, 0, group_bytes);
+		addr += skip;
+	}
+}
+
 void
 alsa_driver_silence_untouched_channels (alsa_driver_t *driver,
 					jack_nframes_t nframes)
 {
-	channel_t chn;
+	channel_t chn, first;
 	jack_nframes_t buffer_frames =
 		driver->frames_per_cycle * driver->playback_nperiods;
 
-	for (chn = 0; chn < driver->playback_nchannels; chn++) {
-		if (bitset_contains (driver->channels_not_done, chn)) {
-			if (driver->silent[chn] < buffer_frames) {
-				alsa_driver_silence_on_channel_no_mark (
-					driver, chn, nframes);
-				driver->silent[chn] += nframes;
+	for (chn = 0; chn < driver->playback_nchannels; ) {
+
+		if (!alsa_driver_needs_silence (driver, chn, buffer_frames)) {
+			chn++;
+			continue;
+		}
+
+		first = chn++;
+
+		if (driver->playback_interleaved) {
+			/* take in the neighbours that need it too */
+			while (chn < driver->playback_nchannels
+			       && alsa_driver_needs_silence (driver, chn,
+							     buffer_frames)
+			       && driver->playback_addr[chn]
+			       == driver->playback_addr[chn - 1]
+			       + driver->playback_sample_bytes
+			       && driver->playback_interleave_skip[chn]
+			       == driver->playback_interleave_skip[first]) {
+				chn++;
 			}
 		}
+
+		if (chn - first > 1) {
+			alsa_driver_silence_channel_group (driver, first,
+							   chn - first, nframes);
+		} else {
+			alsa_driver_silence_on_channel_no_mark (driver, first,
+								nframes);
+		}
+
+		for (; first < chn; first++) {
+			driver->silent[first] += nframes;
+		}
 	}
 }
 
@@ -1255,6 +1680,139 @@ alsa_driver_set_clock_sync_status (alsa_driver_t *driver, channel_t chn,
 
 static int under_gdb = FALSE;
 
+/* With tsched, the period interrupts are off (or ignored) and a timer
+   wakes the driver when the next period should be ready. The
+   position is then asked for, since nothing else updates it. */
+
+static void
+alsa_driver_tsched_arm (alsa_driver_t *driver)
+{
+	jack_time_t now = driver->engine->get_microseconds ();
+	jack_time_t delay;
+	struct itimerspec its;
+
+	/* a zero it_value would disarm the timer */
+	delay = (driver->tsched_due > now) ? driver->tsched_due - now : 1;
+
+	memset (&its, 0, sizeof(its));
+	its.it_value.tv_sec = delay / 1000000;
+	its.it_value.tv_nsec = (delay % 1000000) * 1000;
+
+	timerfd_settime (driver->tsched_fd, 0, &its, NULL);
+}
+
+/* The avail count at which a stream is ready: its avail_min. */
+static snd_pcm_sframes_t
+alsa_driver_ready_threshold (alsa_driver_t *driver, int playback)
+{
+	if (playback) {
+		return driver->frames_per_cycle
+		       * (driver->playback_nperiods - driver->user_nperiods + 1);
+	}
+	return driver->frames_per_cycle;
+}
+
+static jack_time_t
+alsa_driver_frames_to_usecs (alsa_driver_t *driver, snd_pcm_sframes_t frames)
+{
+	return (jack_time_t)frames * 1000000 / driver->frame_rate;
+}
+
+/* Nonzero if the stream is not ready yet; the timer is then due when
+   it should be. */
+static int
+alsa_driver_tsched_short (alsa_driver_t *driver, snd_pcm_t *handle,
+			  snd_pcm_sframes_t threshold, jack_time_t now,
+			  int *xrun_detected)
+{
+	snd_pcm_sframes_t avail;
+
+	if ((avail = snd_pcm_avail (handle)) < 0) {
+		if (avail == -EPIPE) {
+			*xrun_detected = TRUE;
+		}
+		return 0;
+	}
+
+	if (avail >= threshold) {
+		return 0;
+	}
+
+	driver->tsched_due = now + alsa_driver_frames_to_usecs (driver,
+								threshold - avail);
+	return 1;
+}
+
+/* Once `consumed' frames are processed, the next period is ready when
+   the stream furthest from its threshold reaches it. */
+static void
+alsa_driver_tsched_schedule (alsa_driver_t *driver,
+			     snd_pcm_sframes_t capture_avail,
+			     snd_pcm_sframes_t playback_avail,
+			     snd_pcm_sframes_t consumed, jack_time_t now)
+{
+	snd_pcm_sframes_t wait = 0, w;
+
+	if (driver->capture_handle) {
+		w = alsa_driver_ready_threshold (driver, 0)
+		    - (capture_avail - consumed);
+		if (w > wait) {
+			wait = w;
+		}
+	}
+
+	if (driver->playback_handle) {
+		w = alsa_driver_ready_threshold (driver, 1)
+		    - (playback_avail - consumed);
+		if (w > wait) {
+			wait = w;
+		}
+	}
+
+	driver->tsched_due = now + alsa_driver_frames_to_usecs (driver, wait);
+}
+
+/* When the first period of this cycle was complete, worked back from
+   the time the hardware pointer was last updated. That is the period
+   interrupt (or, with tsched, the last position query) rather than our
+   wakeup, so scheduling jitter stays out of the frame timer. */
+static jack_time_t
+alsa_driver_period_time (alsa_driver_t *driver, jack_time_t now)
+{
+	snd_pcm_t *handle;
+	snd_pcm_sframes_t threshold;
+	snd_pcm_uframes_t avail;
+	snd_htimestamp_t tstamp;
+	jack_time_t t, ahead;
+
+	if (driver->capture_handle) {
+		handle = driver->capture_handle;
+		threshold = alsa_driver_ready_threshold (driver, 0);
+	} else {
+		handle = driver->playback_handle;
+		threshold = alsa_driver_ready_threshold (driver, 1);
+	}
+
+	if (snd_pcm_htimestamp (handle, &avail, &tstamp) < 0
+	    || (tstamp.tv_sec == 0 && tstamp.tv_nsec == 0)) {
+		return now;
+	}
+
+	t = (jack_time_t)tstamp.tv_sec * 1000000 + tstamp.tv_nsec / 1000;
+
+	if ((snd_pcm_sframes_t)avail > threshold) {
+		ahead = alsa_driver_frames_to_usecs (driver, avail - threshold);
+		t = (ahead < t) ? t - ahead : t;
+	}
+
+	/* anything else is not a stamp we can use */
+	if (t > now || now - t > driver->period_usecs * driver->user_nperiods) {
+		return now;
+	}
+
+	return t;
+}
+
 static jack_nframes_t
 alsa_driver_wait (alsa_driver_t *driver, int extra_fd, int *status, float
 		  *delayed_usecs)
@@ -1266,6 +1824,7 @@ alsa_driver_wait (alsa_driver_t *driver, int extra_fd, int *status, float
 	int need_capture;
 	int need_playback;
 	unsigned int i;
+	unsigned int ti = 0;
 	jack_time_t poll_enter;
 	jack_time_t poll_ret = 0;
 
@@ -1306,6 +1865,17 @@ again:
 			nfds += driver->capture_nfds;
 		}
 
+		if (driver->tsched) {
+			/* the PCMs only report errors; the timer wakes us */
+			for (i = 0; i < nfds; i++)
+				driver->pfd[i].events = 0;
+
+			alsa_driver_tsched_arm (driver);
+			driver->pfd[nfds].fd = driver->tsched_fd;
+			driver->pfd[nfds].events = POLLIN;
+			ti = nfds++;
+		}
+
 		/* ALSA doesn't set POLLERR in some versions of 0.9.X */
 
 		for (i = 0; i < nfds; i++)
@@ -1441,6 +2011,32 @@ again:
 			return 0;
 		}
 
+		if (driver->tsched && !xrun_detected) {
+			uint64_t expirations;
+
+			if (driver->pfd[ti].revents & POLLIN) {
+				read (driver->tsched_fd, &expirations,
+				      sizeof(expirations));
+			}
+
+			/* the position has to be asked for */
+			if (need_playback) {
+				need_playback = alsa_driver_tsched_short (
+					driver, driver->playback_handle,
+					alsa_driver_ready_threshold (driver, 1),
+					poll_ret, &xrun_detected);
+			}
+			if (need_capture) {
+				need_capture = alsa_driver_tsched_short (
+					driver, driver->capture_handle,
+					alsa_driver_ready_threshold (driver, 0),
+					poll_ret, &xrun_detected);
+			}
+		}
+
+		if (driver->tsched && xrun_detected) {
+			break;
+		}
 	}
 
 	if (driver->capture_handle) {
@@ -1473,16 +2069,45 @@ again:
 		playback_avail = INT_MAX;
 	}
 
+	if (driver->fast_xrun && !xrun_detected
+	    && ((driver->capture_handle
+		 && capture_avail > (snd_pcm_sframes_t)(driver->frames_per_cycle
+							* driver->capture_nperiods))
+		|| (driver->playback_handle
+		    && playback_avail > (snd_pcm_sframes_t)(driver->frames_per_cycle
+							    * driver->playback_nperiods)))) {
+		if (alsa_driver_fast_xrun_recovery (driver, capture_avail,
+						    playback_avail,
+						    delayed_usecs) == 0) {
+			*status = 0;
+			return 0;
+		}
+		xrun_detected = TRUE;
+	}
+
 	if (xrun_detected) {
 		*status = alsa_driver_xrun_recovery (driver, delayed_usecs);
+		JACK_PROBE4 (driver_wait, 0, *status, driver->last_wait_ust,
+			     (int64_t)*delayed_usecs);
 		return 0;
 	}
 
 	*status = 0;
 	driver->last_wait_ust = poll_ret;
 
+	if (driver->hw_tstamp
+	    && driver->engine->control->clock_source == JACK_TIMER_SYSTEM_CLOCK) {
+		driver->last_wait_ust = alsa_driver_period_time (driver, poll_ret);
+	}
+
 	avail = capture_avail < playback_avail ? capture_avail : playback_avail;
 
+	if (driver->tsched) {
+		alsa_driver_tsched_schedule (driver, capture_avail, playback_avail,
+					     avail - (avail % driver->frames_per_cycle),
+					     poll_ret);
+	}
+
 #ifdef DEBUG_WAKEUP
 	fprintf (stderr, "wakeup complete, avail = %lu, pavail = %lu "
 		 "cavail = %lu\n",
@@ -1497,7 +2122,12 @@ again:
 	   periods.
 	 */
 
-	return avail - (avail % driver->frames_per_cycle);
+	avail -= avail % driver->frames_per_cycle;
+
+	JACK_PROBE4 (driver_wait, avail, 0, driver->last_wait_ust,
+		     (int64_t)*delayed_usecs);
+
+	return avail;
 }
 
 static int
@@ -1512,6 +2142,12 @@ alsa_driver_null_cycle (alsa_driver_t* driver, jack_nframes_t nframes)
 		return -1;
 	}
 
+	if (driver->varispeed) {
+		/* the device was serviced by alsa_varispeed_run_cycle() */
+		alsa_varispeed_null_cycle (driver, nframes);
+		return 0;
+	}
+
 	if (driver->capture_handle) {
 		nf = nframes;
 		offset = 0;
@@ -1543,9 +2179,11 @@ alsa_driver_null_cycle (alsa_driver_t* driver, jack_nframes_t nframes)
 				return -1;
 			}
 
-			for (chn = 0; chn < driver->playback_nchannels; chn++)
-				alsa_driver_silence_on_channel (driver, chn,
-								contiguous);
+			for (chn = 0; chn < driver->playback_nchannels; chn++) {
+				alsa_driver_silence_on_channel_no_mark (
+					driver, chn, contiguous);
+				driver->silent[chn] += contiguous;
+			}
 
 			if (snd_pcm_mmap_commit (driver->playback_handle,
 						 offset, contiguous) < 0) {
@@ -1562,9 +2200,383 @@ alsa_driver_null_cycle (alsa_driver_t* driver, jack_nframes_t nframes)
 static int
 alsa_driver_bufsize (alsa_driver_t* driver, jack_nframes_t nframes)
 {
-	return alsa_driver_reset_parameters (driver, nframes,
-					     driver->user_nperiods,
-					     driver->frame_rate);
+	if (alsa_driver_reset_parameters (driver, nframes,
+					  driver->user_nperiods,
+					  driver->frame_rate)) {
+		return -1;
+	}
+
+	if (driver->varispeed) {
+		return alsa_varispeed_configure (driver);
+	}
+
+	if (driver->nslaves) {
+		return alsa_aggregate_configure (driver);
+	}
+
+	return 0;
+}
+
+static int
+alsa_driver_samplerate (alsa_driver_t* driver, jack_nframes_t rate)
+{
+	/* set_parameters() falls back to the old configuration if the
+	   card refuses the new rate, and then succeeds */
+	if (alsa_driver_reset_parameters (driver, driver->frames_per_cycle,
+					  driver->user_nperiods, rate)
+	    || driver->frame_rate != rate) {
+		jack_error ("ALSA: cannot change sample rate to %" PRIu32,
+			    rate);
+		return -1;
+	}
+
+	if (driver->varispeed) {
+		return alsa_varispeed_configure (driver);
+	}
+
+	if (driver->nslaves) {
+		return alsa_aggregate_configure (driver);
+	}
+
+	return 0;
+}
+
+void
+alsa_driver_read_channels (alsa_driver_t *driver, jack_nframes_t offset,
+			   jack_nframes_t nframes)
+{
+	alsa_channel_plan_t *p, *end = driver->capture_plan
+				       + driver->capture_plan_len;
+	jack_nframes_t tile, done, n;
+
+	tile = driver->capture_interleaved ? driver->capture_tile_frames : nframes;
+
+	for (done = 0; done < nframes; done += n) {
+		n = nframes - done;
+		if (n > tile) {
+			n = tile;
+		}
+		for (p = driver->capture_plan; p < end; p++) {
+			driver->read_via_copy (p->buf + offset + done,
+					       driver->capture_addr[p->chn]
+					       + done * driver->capture_interleave_skip[p->chn],
+					       n,
+					       driver->capture_interleave_skip[p->chn]);
+		}
+	}
+}
+
+void
+alsa_driver_write_channels (alsa_driver_t *driver, jack_nframes_t offset,
+			    jack_nframes_t nframes)
+{
+	alsa_channel_plan_t *p, *end = driver->playback_plan
+				       + driver->playback_plan_len;
+	jack_nframes_t tile, done, n;
+
+	tile = driver->playback_interleaved ? driver->playback_tile_frames : nframes;
+
+	for (done = 0; done < nframes; done += n) {
+		n = nframes - done;
+		if (n > tile) {
+			n = tile;
+		}
+		for (p = driver->playback_plan; p < end; p++) {
+			dither_state_t *state = driver->dither_state + p->chn;
+			jack_default_audio_sample_t *src =
+				(p->monitor ? p->monitor : p->buf) + offset + done;
+
+			if (p->monitor == NULL
+			    && (char*)p->buf == driver->playback_addr[p->chn]) {
+				/* mixed in place, see alsa_driver_mix_playback() */
+				if (state->meter) {
+					memops_meter (state, src, n);
+				}
+				continue;
+			}
+			if (state->meter && !driver->meter_in_copy) {
+				memops_meter (state, src, n);
+			}
+			driver->write_via_copy (driver->playback_addr[p->chn]
+						+ done * driver->playback_interleave_skip[p->chn],
+						src,
+						n,
+						driver->playback_interleave_skip[p->chn],
+						state);
+		}
+	}
+
+	for (p = driver->playback_plan; p < end; p++) {
+		alsa_driver_mark_channel_done (driver, p->chn);
+	}
+}
+
+/* With hwthru, a playback port whose only connection comes straight
+   from one of our capture ports is played by the card's mixer instead:
+   the channel is left out of the playback plan, and so played as
+   silence, and the capture channel is not copied either unless
+   something else reads it.  This saves the period of latency and the
+   two conversions the trip through the graph costs. */
+static void
+alsa_driver_plan_passthrough (alsa_driver_t *driver)
+{
+	jack_hardware_t *hw = driver->hw;
+	channel_t from[ALSA_PASSTHROUGH_MAX];
+	unsigned long want = 0, bit;
+	jack_port_t *port, *source;
+	JSList *node, *cnode;
+	channel_t chn, in;
+
+	if (!driver->hw_passthrough) {
+		return;
+	}
+
+	if (driver->capture_handle && !driver->with_monitor_ports) {
+		for (chn = 0, node = driver->playback_ports;
+		     node && chn < driver->playback_nchannels
+		     && chn < ALSA_PASSTHROUGH_MAX;
+		     node = jack_slist_next (node), chn++) {
+
+			port = (jack_port_t*)node->data;
+
+			if (jack_port_connected (port) != 1
+			    || port->connections == NULL
+			    || alsa_driver_monitor_route (driver, chn, TRUE)) {
+				continue;
+			}
+
+			source = (jack_port_t*)port->connections->data;
+
+			for (in = 0, cnode = driver->capture_ports;
+			     cnode && in < driver->capture_nchannels;
+			     cnode = jack_slist_next (cnode), in++) {
+				if (((jack_port_t*)cnode->data)->shared->id
+				    == source->shared->id) {
+					want |= 1UL << chn;
+					from[chn] = in;
+					break;
+				}
+			}
+		}
+	}
+
+	for (chn = 0; chn < driver->playback_nchannels
+	     && chn < ALSA_PASSTHROUGH_MAX; chn++) {
+
+		bit = 1UL << chn;
+
+		if ((driver->passthrough_mask & bit)
+		    && (!(want & bit) || from[chn] != driver->passthrough_from[chn])) {
+			hw->set_passthrough (hw, driver->passthrough_from[chn],
+					     chn, FALSE);
+			driver->passthrough_mask &= ~bit;
+		}
+
+		if ((want & bit) && !(driver->passthrough_mask & bit)
+		    && hw->set_passthrough (hw, from[chn], chn, TRUE) == 0) {
+			driver->passthrough_mask |= bit;
+			driver->passthrough_from[chn] = from[chn];
+		}
+	}
+}
+
+/* Work out which channels are connected, and where their buffers
+   are, only when the graph has changed since the last cycle. The
+   buffers are kept in capture_bufs and playback_bufs as well, for
+   the monitor ports. */
+void
+alsa_driver_update_plan (alsa_driver_t *driver, jack_nframes_t nframes)
+{
+	alsa_channel_plan_t *p;
+	jack_port_t *port;
+	JSList *node;
+	channel_t chn;
+	alsa_monitor_route_t *route;
+	int needed;
+
+	if (driver->plan_valid
+	    && driver->plan_generation == driver->engine->graph_generation) {
+
+		/* mixdowns still have to be done every cycle; for
+		   direct playback alsa_driver_write() does them */
+		for (p = driver->playback_plan;
+		     p < driver->playback_plan + driver->playback_plan_len; p++) {
+			if (p->mix_port && driver->playback_direct) {
+				continue;
+			} else if (p->mix_port) {
+				p->buf = jack_port_get_buffer (p->mix_port, nframes);
+				driver->playback_bufs[p->chn] = p->buf;
+			} else if (p->source) {
+				p->buf = jack_output_port_source (p->source);
+				driver->playback_bufs[p->chn] = p->buf;
+			}
+		}
+		return;
+	}
+
+	driver->plan_valid = 0;
+	driver->capture_plan_len = 0;
+	driver->playback_plan_len = 0;
+
+	alsa_driver_plan_passthrough (driver);
+
+	if (driver->capture_handle) {
+		memset (driver->capture_bufs, 0,
+			sizeof(jack_default_audio_sample_t *)
+			* driver->capture_nchannels);
+
+		for (chn = 0, node = driver->capture_ports;
+		     node && chn < driver->capture_nchannels;
+		     node = jack_slist_next (node), chn++) {
+
+			port = (jack_port_t*)node->data;
+			route = alsa_driver_monitor_route (driver, chn, FALSE);
+			needed = jack_port_connected (port)
+				 > alsa_driver_passthrough_count (driver, chn);
+
+			if (driver->monitor_src) {
+				driver->monitor_src[chn] = NULL;
+			}
+
+			if (!needed && route == NULL) {
+				/* no-copy optimization */
+				continue;
+			}
+
+			p = &driver->capture_plan[driver->capture_plan_len++];
+			p->chn = chn;
+			p->mix_port = NULL;
+			p->source = NULL;
+			p->monitor = NULL;
+			if (needed) {
+				p->buf = jack_port_get_buffer (port, nframes);
+				driver->capture_bufs[chn] = p->buf;
+			} else {
+				p->buf = route->in_buf;
+			}
+			if (route) {
+				driver->monitor_src[chn] = p->buf;
+			}
+		}
+	}
+
+	if (driver->playback_handle) {
+		memset (driver->playback_bufs, 0,
+			sizeof(jack_default_audio_sample_t *)
+			* driver->playback_nchannels);
+
+		for (chn = 0, node = driver->playback_ports;
+		     node && chn < driver->playback_nchannels;
+		     node = jack_slist_next (node), chn++) {
+
+			port = (jack_port_t*)node->data;
+			route = alsa_driver_monitor_route (driver, chn, TRUE);
+
+			if ((!jack_port_connected (port) && route == NULL)
+			    || alsa_driver_passthrough_on (driver, chn)) {
+				continue;
+			}
+
+			p = &driver->playback_plan[driver->playback_plan_len++];
+			p->chn = chn;
+			p->monitor = route ? route->out_buf : NULL;
+
+			if (!jack_port_connected (port)) {
+				/* only monitored */
+				p->mix_port = NULL;
+				p->source = NULL;
+				p->buf = NULL;
+				continue;
+			}
+
+			if (port->domain_buffer) {
+				/* in a clock domain of our own: the engine
+				   puts what the graph plays there */
+				p->mix_port = NULL;
+				p->source = NULL;
+			} else {
+				p->mix_port = (jack_port_connected (port) > 1) ? port : NULL;
+				p->source = (p->mix_port || port->connections == NULL) ? NULL :
+					    (jack_port_t*)port->connections->data;
+			}
+			p->buf = jack_port_get_buffer (port, nframes);
+			driver->playback_bufs[chn] = p->buf;
+		}
+	}
+
+	driver->plan_generation = driver->engine->graph_generation;
+	driver->plan_valid = 1;
+}
+
+/* Mix the captures of the monitor routes (-R) into their playback
+   channels, on top of whatever the graph plays there.  The captures
+   are this cycle's, converted along with the rest by
+   alsa_driver_read_channels(), so monitoring never waits for a client
+   and stays the same whatever the graph does. */
+void
+alsa_driver_mix_monitor (alsa_driver_t *driver, jack_nframes_t nframes)
+{
+	alsa_channel_plan_t *p, *end = driver->playback_plan
+				       + driver->playback_plan_len;
+	alsa_monitor_route_t *r, *rend = driver->monitor_routes
+					 + driver->nmonitor_routes;
+	jack_default_audio_sample_t *src;
+	jack_nframes_t i;
+
+	for (p = driver->playback_plan; p < end; p++) {
+
+		if (p->monitor == NULL) {
+			continue;
+		}
+
+		if (p->buf) {
+			memcpy (p->monitor, p->buf,
+				nframes * sizeof(jack_default_audio_sample_t));
+		} else {
+			memset (p->monitor, 0,
+				nframes * sizeof(jack_default_audio_sample_t));
+		}
+
+		for (r = driver->monitor_routes; r < rend; r++) {
+			if (r->out != p->chn
+			    || (src = driver->monitor_src[r->in]) == NULL) {
+				continue;
+			}
+			for (i = 0; i < nframes; i++) {
+				p->monitor[i] += src[i];
+			}
+		}
+	}
+}
+
+/* Non-interleaved float playback: mix the channels fed by more than
+   one port straight into the mmap area, when the whole period is
+   contiguous there and aligned for the mixdown code, rather than into
+   the port's mix buffer and then copying.  The mmap area stands in for
+   the mix buffer only while the mixdown runs. */
+static void
+alsa_driver_mix_playback (alsa_driver_t *driver, jack_nframes_t nframes,
+			  int in_place)
+{
+	alsa_channel_plan_t *p, *end = driver->playback_plan
+				       + driver->playback_plan_len;
+	void *mix_buffer;
+
+	for (p = driver->playback_plan; p < end; p++) {
+		if (p->mix_port == NULL) {
+			continue;
+		}
+		if (in_place && ((uintptr_t)driver->playback_addr[p->chn]
+				 % JACK_PORT_BUFFER_ALIGN) == 0) {
+			mix_buffer = p->mix_port->mix_buffer;
+			p->mix_port->mix_buffer = driver->playback_addr[p->chn];
+			p->buf = jack_port_get_buffer (p->mix_port, nframes);
+			p->mix_port->mix_buffer = mix_buffer;
+		} else {
+			p->buf = jack_port_get_buffer (p->mix_port, nframes);
+		}
+		driver->playback_bufs[p->chn] = p->buf;
+	}
 }
 
 static int
@@ -1574,10 +2586,6 @@ alsa_driver_read (alsa_driver_t *driver, jack_nframes_t nframes)
 	snd_pcm_sframes_t nread;
 	snd_pcm_uframes_t offset;
 	jack_nframes_t orig_nframes;
-	jack_default_audio_sample_t* buf;
-	channel_t chn;
-	JSList *node;
-	jack_port_t* port;
 	int err;
 
 	if (nframes > driver->frames_per_cycle) {
@@ -1588,6 +2596,15 @@ alsa_driver_read (alsa_driver_t *driver, jack_nframes_t nframes)
 		return 0;
 	}
 
+	if (driver->varispeed) {
+		alsa_varispeed_read (driver, nframes);
+		return 0;
+	}
+
+	if (driver->nslaves) {
+		alsa_aggregate_read (driver, nframes);
+	}
+
 	if (!driver->capture_handle) {
 		return 0;
 	}
@@ -1596,6 +2613,8 @@ alsa_driver_read (alsa_driver_t *driver, jack_nframes_t nframes)
 	contiguous = 0;
 	orig_nframes = nframes;
 
+	alsa_driver_update_plan (driver, orig_nframes);
+
 	while (nframes) {
 
 		contiguous = nframes;
@@ -1608,19 +2627,7 @@ alsa_driver_read (alsa_driver_t *driver, jack_nframes_t nframes)
 			return -1;
 		}
 
-		for (chn = 0, node = driver->capture_ports; node;
-		     node = jack_slist_next (node), chn++) {
-
-			port = (jack_port_t*)node->data;
-
-			if (!jack_port_connected (port)) {
-				/* no-copy optimization */
-				continue;
-			}
-			buf = jack_port_get_buffer (port, orig_nframes);
-			alsa_driver_read_from_channel (driver, chn,
-						       buf + nread, contiguous);
-		}
+		alsa_driver_read_channels (driver, nread, contiguous);
 
 		if ((err = snd_pcm_mmap_commit (driver->capture_handle,
 						offset, contiguous)) < 0) {
@@ -1637,7 +2644,7 @@ alsa_driver_read (alsa_driver_t *driver, jack_nframes_t nframes)
 }
 
 static int
-alsa_driver_write (alsa_driver_t* driver, jack_nframes_t nframes)
+alsa_driver_write_cycle (alsa_driver_t* driver, jack_nframes_t nframes)
 {
 	channel_t chn;
 	JSList *node;
@@ -1653,7 +2660,20 @@ alsa_driver_write (alsa_driver_t* driver, jack_nframes_t nframes)
 
 	driver->process_count++;
 
-	if (!driver->playback_handle || driver->engine->freewheeling) {
+	if (driver->engine->freewheeling) {
+		return 0;
+	}
+
+	if (driver->varispeed) {
+		alsa_varispeed_write (driver, nframes);
+		return 0;
+	}
+
+	if (driver->nslaves) {
+		alsa_aggregate_write (driver, nframes);
+	}
+
+	if (!driver->playback_handle) {
 		return 0;
 	}
 	if (nframes > driver->frames_per_cycle) {
@@ -1684,6 +2704,8 @@ alsa_driver_write (alsa_driver_t* driver, jack_nframes_t nframes)
 		}
 	}
 
+	alsa_driver_update_plan (driver, orig_nframes);
+
 	while (nframes) {
 
 		contiguous = nframes;
@@ -1696,18 +2718,24 @@ alsa_driver_write (alsa_driver_t* driver, jack_nframes_t nframes)
 			return -1;
 		}
 
+		if (driver->playback_direct && nwritten == 0) {
+			alsa_driver_mix_playback (driver, orig_nframes,
+						  contiguous == orig_nframes);
+		}
+
+		if (driver->monitor_src && nwritten == 0) {
+			alsa_driver_mix_monitor (driver, orig_nframes);
+		}
+
+		alsa_driver_write_channels (driver, nwritten, contiguous);
+
 		for (chn = 0, node = driver->playback_ports, mon_node = driver->monitor_ports;
-		     node;
+		     node && chn < driver->playback_nchannels;
 		     node = jack_slist_next (node), chn++) {
 
-			port = (jack_port_t*)node->data;
-
-			if (!jack_port_connected (port)) {
+			if ((buf = driver->playback_bufs[chn]) == NULL) {
 				continue;
 			}
-			buf = jack_port_get_buffer (port, orig_nframes);
-			alsa_driver_write_to_channel (driver, chn,
-						      buf + nwritten, contiguous);
 
 			if (mon_node) {
 				port = (jack_port_t*)mon_node->data;
@@ -1742,6 +2770,60 @@ alsa_driver_write (alsa_driver_t* driver, jack_nframes_t nframes)
 	return 0;
 }
 
+/* Have the converters measure what they play this cycle, for the
+ * engine's port meters; the playback ports are inputs, which the engine
+ * does not measure itself.
+ */
+static void
+alsa_driver_meter_begin (alsa_driver_t *driver)
+{
+	int meter = (driver->engine->meters != NULL);
+	channel_t chn;
+
+	for (chn = 0; chn < driver->playback_nchannels; chn++) {
+		driver->dither_state[chn].meter = meter;
+	}
+}
+
+static void
+alsa_driver_meter_end (alsa_driver_t *driver)
+{
+	dither_state_t *state;
+	JSList *node;
+	channel_t chn;
+
+	for (chn = 0, node = driver->playback_ports;
+	     node && chn < driver->playback_nchannels;
+	     node = jack_slist_next (node), chn++) {
+		state = driver->dither_state + chn;
+		if (!state->meter) {
+			continue;
+		}
+		jack_port_meter_driver (driver->engine,
+					((jack_port_t*)node->data)->shared->id,
+					state->peak, state->sumsq, state->overs);
+		state->peak = 0.0f;
+		state->sumsq = 0.0f;
+		state->overs = 0;
+	}
+}
+
+static int
+alsa_driver_write (alsa_driver_t* driver, jack_nframes_t nframes)
+{
+	int ret;
+
+	if (driver->engine->freewheeling || !driver->playback_handle) {
+		return alsa_driver_write_cycle (driver, nframes);
+	}
+
+	alsa_driver_meter_begin (driver);
+	ret = alsa_driver_write_cycle (driver, nframes);
+	alsa_driver_meter_end (driver);
+
+	return ret;
+}
+
 static inline int
 alsa_driver_run_cycle (alsa_driver_t *driver)
 {
@@ -1769,6 +2851,10 @@ alsa_driver_run_cycle (alsa_driver_t *driver)
 		return 0;
 	}
 
+	if (driver->varispeed) {
+		return alsa_varispeed_run_cycle (driver, nframes, delayed_usecs);
+	}
+
 	return engine->run_cycle (engine, nframes, delayed_usecs);
 }
 
@@ -1786,8 +2872,17 @@ alsa_driver_latency_callback (jack_latency_callback_mode_t mode, void* arg)
 		range.min = range.max = driver->frames_per_cycle + driver->capture_frame_latency;
 	}
 
+	if (driver->varispeed) {
+		range.min += alsa_varispeed_latency (driver, mode);
+		range.max += alsa_varispeed_latency (driver, mode);
+	}
+
 	for (node = client->ports; node; node = jack_slist_next (node))
 		jack_port_set_latency_range ((jack_port_t*)node->data, mode, &range);
+
+	if (driver->nslaves) {
+		alsa_aggregate_set_latency (driver, mode);
+	}
 }
 
 static int
@@ -1870,6 +2965,14 @@ alsa_driver_attach (alsa_driver_t *driver)
 		}
 	}
 
+	if (driver->nslaves && alsa_aggregate_attach (driver)) {
+		return -1;
+	}
+
+	if (driver->varispeed && alsa_varispeed_attach (driver)) {
+		return -1;
+	}
+
 	return jack_activate (driver->client);
 }
 
@@ -1882,6 +2985,16 @@ alsa_driver_detach (alsa_driver_t *driver)
 		return 0;
 	}
 
+	if (driver->nslaves) {
+		alsa_aggregate_detach (driver);
+	}
+
+	if (driver->varispeed) {
+		alsa_varispeed_detach (driver);
+	}
+
+	driver->plan_valid = 0;
+
 	for (node = driver->capture_ports; node;
 	     node = jack_slist_next (node))
 		jack_port_unregister (driver->client,
@@ -1975,6 +3088,12 @@ alsa_driver_delete (alsa_driver_t *driver)
 		free (node->data);
 	jack_slist_free (driver->clock_sync_listeners);
 
+	if (driver->nslaves) {
+		alsa_aggregate_close (driver);
+	}
+
+	alsa_varispeed_close (driver);
+
 	if (driver->ctl_handle) {
 		snd_ctl_close (driver->ctl_handle);
 		driver->ctl_handle = 0;
@@ -2014,6 +3133,10 @@ alsa_driver_delete (alsa_driver_t *driver)
 		free (driver->pfd);
 	}
 
+	if (driver->tsched_fd >= 0) {
+		close (driver->tsched_fd);
+	}
+
 	if (driver->hw) {
 		driver->hw->release (driver->hw);
 		driver->hw = 0;
@@ -2023,10 +3146,72 @@ alsa_driver_delete (alsa_driver_t *driver)
 	free (driver->alsa_driver);
 
 	alsa_driver_release_channel_dependent_memory (driver);
+	free (driver->monitor_routes);
 	jack_driver_nt_finish ((jack_driver_nt_t*)driver);
 	free (driver);
 }
 
+/* -R: "in:out[,in:out...]", channels numbered from 1 */
+static int
+alsa_driver_set_monitor_routes (alsa_driver_t *driver, const char *spec)
+{
+	alsa_monitor_route_t *routes;
+	unsigned long in, out;
+	unsigned int n, i;
+	const char *s;
+	char *end;
+
+	if (!driver->capture_handle || !driver->playback_handle) {
+		jack_error ("ALSA: monitor routes need both capture and playback");
+		return -1;
+	}
+
+	for (n = 1, s = spec; *s; s++) {
+		if (*s == ',') {
+			n++;
+		}
+	}
+
+	if ((routes = (alsa_monitor_route_t*)calloc (n, sizeof(alsa_monitor_route_t))) == NULL) {
+		return -1;
+	}
+
+	for (i = 0, s = spec; i < n; i++) {
+		in = strtoul (s, &end, 10);
+		if (end == s || *end != ':') {
+			goto bad;
+		}
+		s = end + 1;
+		out = strtoul (s, &end, 10);
+		if (end == s || (*end != ',' && *end != '\0')) {
+			goto bad;
+		}
+		s = *end ? end + 1 : end;
+
+		if (in < 1 || in > driver->capture_nchannels
+		    || out < 1 || out > driver->playback_nchannels) {
+			jack_error ("ALSA: no channels for monitor route %lu:%lu",
+				    in, out);
+			free (routes);
+			return -1;
+		}
+
+		routes[i].in = in - 1;
+		routes[i].out = out - 1;
+	}
+
+	driver->monitor_routes = routes;
+	driver->nmonitor_routes = n;
+
+	return alsa_driver_alloc_monitor (driver);
+
+bad:
+	jack_error ("ALSA: bad monitor routes \"%s\" (use in:out[,in:out...])",
+		    spec);
+	free (routes);
+	return -1;
+}
+
 static char*
 discover_alsa_using_apps ()
 {
@@ -2141,12 +3326,15 @@ alsa_driver_new (char *name, char *playback_alsa_device,
 		 int playing,
 		 DitherAlgorithm dither,
 		 int soft_mode,
+		 int fast_xrun,
+		 int tsched,
 		 int monitor,
 		 int user_capture_nchnls,
 		 int user_playback_nchnls,
 		 int shorts_first,
 		 jack_nframes_t capture_latency,
-		 jack_nframes_t playback_latency
+		 jack_nframes_t playback_latency,
+		 const char *aggregate
 		 )
 {
 	int err;
@@ -2175,6 +3363,7 @@ alsa_driver_new (char *name, char *playback_alsa_device,
 	driver->null_cycle =
 		(JackDriverNullCycleFunction)alsa_driver_null_cycle;
 	driver->nt_bufsize = (JackDriverNTBufSizeFunction)alsa_driver_bufsize;
+	driver->nt_samplerate = (JackDriverNTSampleRateFunction)alsa_driver_samplerate;
 	driver->nt_start = (JackDriverNTStartFunction)alsa_driver_start;
 	driver->nt_stop = (JackDriverNTStopFunction)alsa_driver_stop;
 	driver->nt_run_cycle = (JackDriverNTRunCycleFunction)alsa_driver_run_cycle;
@@ -2197,6 +3386,10 @@ alsa_driver_new (char *name, char *playback_alsa_device,
 	driver->capture_addr = 0;
 	driver->playback_interleave_skip = NULL;
 	driver->capture_interleave_skip = NULL;
+	driver->playback_bufs = NULL;
+	driver->capture_bufs = NULL;
+	driver->playback_tile_frames = alsa_driver_tile_frames (0);
+	driver->capture_tile_frames = alsa_driver_tile_frames (0);
 	driver->previously_successfully_configured = FALSE;
 
 	driver->silent = 0;
@@ -2216,6 +3409,17 @@ alsa_driver_new (char *name, char *playback_alsa_device,
 
 	driver->dither = dither;
 	driver->soft_mode = soft_mode;
+	driver->fast_xrun = fast_xrun && !soft_mode;
+	driver->tsched = tsched;
+	driver->tsched_fd = -1;
+
+	if (tsched
+	    && (driver->tsched_fd = timerfd_create (CLOCK_MONOTONIC,
+						    TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+		jack_error ("ALSA: cannot create wakeup timer (%s), using "
+			    "period interrupts", strerror (errno));
+		driver->tsched = 0;
+	}
 
 	driver->quirk_bswap = 0;
 
@@ -2413,6 +3617,12 @@ alsa_driver_new (char *name, char *playback_alsa_device,
 		return NULL;
 	}
 
+	if (aggregate
+	    && alsa_aggregate_open (driver, aggregate, capturing, playing)) {
+		alsa_driver_delete (driver);
+		return NULL;
+	}
+
 	driver->capture_and_playback_not_synced = FALSE;
 
 	if (driver->capture_handle && driver->playback_handle) {
@@ -2532,7 +3742,7 @@ driver_get_descriptor ()
 	desc = calloc (1, sizeof(jack_driver_desc_t));
 
 	strcpy (desc->name, "alsa");
-	desc->nparams = 18;
+	desc->nparams = 24;
 
 	params = calloc (desc->nparams, sizeof(jack_driver_param_desc_t));
 
@@ -2602,6 +3812,26 @@ driver_get_descriptor ()
 	strcpy (params[i].short_desc, "Hardware metering, if available");
 	strcpy (params[i].long_desc, params[i].short_desc);
 
+	i++;
+	strcpy (params[i].name, "hwthru");
+	params[i].character  = 't';
+	params[i].type       = JackDriverParamBool;
+	params[i].value.i    = 0;
+	strcpy (params[i].short_desc, "Let the card's mixer play capture->playback connections, if it can");
+	strcpy (params[i].long_desc, "A playback port connected only to a capture port of the same card is then played by the card's matrix mixer (RME Hammerfall and HDSP), without the period of latency and the conversions of the trip through the graph.");
+
+	i++;
+	strcpy (params[i].name, "monitor-routes");
+	params[i].character  = 'R';
+	params[i].type       = JackDriverParamString;
+	strcpy (params[i].value.str,  "none");
+	strcpy (params[i].short_desc, "Capture channels the driver plays back itself");
+	strcpy (params[i].long_desc,
+		"A list of in:out pairs of channel numbers, from 1, separated "
+		"by ','. Each capture channel is mixed into the playback "
+		"channel by the driver in the same cycle, before and whatever "
+		"the clients do, on top of what the graph plays there");
+
 	i++;
 	strcpy (params[i].name, "duplex");
 	params[i].character  = 'D';
@@ -2619,6 +3849,26 @@ driver_get_descriptor ()
 	strcpy (params[i].short_desc, "Soft-mode, no xrun handling");
 	strcpy (params[i].long_desc,  params[i].short_desc);
 
+	i++;
+	strcpy (params[i].name, "fastxrun");
+	params[i].character  = 'F';
+	params[i].type       = JackDriverParamBool;
+	params[i].value.i    = 0;
+	strcpy (params[i].short_desc, "Recover from xruns without restarting the device");
+	strcpy (params[i].long_desc,
+		"Keep the device running through an xrun and skip past the "
+		"lost frames, instead of stopping and restarting it");
+
+	i++;
+	strcpy (params[i].name, "tsched");
+	params[i].character  = 'T';
+	params[i].type       = JackDriverParamBool;
+	params[i].value.i    = 0;
+	strcpy (params[i].short_desc, "Wake up on a timer instead of period interrupts");
+	strcpy (params[i].long_desc,
+		"Use a large hardware buffer with period interrupts turned "
+		"off, and wake up on a timer once per period instead");
+
 	i++;
 	strcpy (params[i].name, "monitor");
 	params[i].character  = 'm';
@@ -2691,6 +3941,28 @@ driver_get_descriptor ()
 	strcpy (params[i].short_desc, "legacy");
 	strcpy (params[i].long_desc, "legacy option - do not use");
 
+	i++;
+	strcpy (params[i].name, "aggregate");
+	params[i].character  = 'A';
+	params[i].type       = JackDriverParamString;
+	strcpy (params[i].value.str,  "none");
+	strcpy (params[i].short_desc, "Extra devices to run as slaves");
+	strcpy (params[i].long_desc,
+		"A list of ALSA devices, separated by ';', whose ports are "
+		"added to the driver's. Each runs on its own clock and is "
+		"resampled to follow the main device");
+
+	i++;
+	strcpy (params[i].name, "varispeed");
+	params[i].character  = 'V';
+	params[i].type       = JackDriverParamString;
+	strcpy (params[i].value.str,  "none");
+	strcpy (params[i].short_desc, "Run the device at this times the rate");
+	strcpy (params[i].long_desc,
+		"A ratio from 0.5 to 2. The graph runs at the nominal rate and "
+		"the driver resamples to and from the device. A client may "
+		"change the ratio every period through the varispeed port");
+
 	desc->params = params;
 
 	return desc;
@@ -2705,10 +3977,14 @@ driver_initialize (jack_client_t *client, const JSList * params)
 	char *playback_pcm_name = "hw:0";
 	char *capture_pcm_name = "hw:0";
 	int hw_monitoring = FALSE;
+	int hw_passthrough = FALSE;
 	int hw_metering = FALSE;
+	jack_driver_t *driver;
 	int capture = FALSE;
 	int playback = FALSE;
 	int soft_mode = FALSE;
+	int fast_xrun = FALSE;
+	int tsched = FALSE;
 	int monitor = FALSE;
 	DitherAlgorithm dither = None;
 	int user_capture_nchnls = 0;
@@ -2716,6 +3992,9 @@ driver_initialize (jack_client_t *client, const JSList * params)
 	int shorts_first = FALSE;
 	jack_nframes_t systemic_input_latency = 0;
 	jack_nframes_t systemic_output_latency = 0;
+	char *aggregate = NULL;
+	const char *monitor_routes = NULL;
+	double varispeed = 0;
 	const JSList * node;
 	const jack_driver_param_t * param;
 
@@ -2752,6 +4031,10 @@ driver_initialize (jack_client_t *client, const JSList * params)
 			hw_monitoring = param->value.i;
 			break;
 
+		case 't':
+			hw_passthrough = param->value.i;
+			break;
+
 		case 'm':
 			monitor = param->value.i;
 			break;
@@ -2780,6 +4063,14 @@ driver_initialize (jack_client_t *client, const JSList * params)
 			soft_mode = param->value.i;
 			break;
 
+		case 'F':
+			fast_xrun = param->value.i;
+			break;
+
+		case 'T':
+			tsched = param->value.i;
+			break;
+
 		case 'z':
 			if (dither_opt (param->value.c, &dither)) {
 				return NULL;
@@ -2809,6 +4100,24 @@ driver_initialize (jack_client_t *client, const JSList * params)
 			/* ignored, legacy option */
 			break;
 
+		case 'A':
+			if (strcmp (param->value.str, "none") != 0) {
+				aggregate = strdup (param->value.str);
+			}
+			break;
+
+		case 'R':
+			if (strcmp (param->value.str, "none") != 0) {
+				monitor_routes = param->value.str;
+			}
+			break;
+
+		case 'V':
+			if (strcmp (param->value.str, "none") != 0) {
+				varispeed = atof (param->value.str);
+			}
+			break;
+
 		}
 	}
 
@@ -2818,16 +4127,42 @@ driver_initialize (jack_client_t *client, const JSList * params)
 		playback = TRUE;
 	}
 
-	return alsa_driver_new ("alsa_pcm", playback_pcm_name,
-				capture_pcm_name, client,
-				frames_per_interrupt,
-				user_nperiods, srate, hw_monitoring,
-				hw_metering, capture, playback, dither,
-				soft_mode, monitor,
-				user_capture_nchnls, user_playback_nchnls,
-				shorts_first,
-				systemic_input_latency,
-				systemic_output_latency);
+	driver = alsa_driver_new ("alsa_pcm", playback_pcm_name,
+				  capture_pcm_name, client,
+				  frames_per_interrupt,
+				  user_nperiods, srate, hw_monitoring,
+				  hw_metering, capture, playback, dither,
+				  soft_mode, fast_xrun, tsched, monitor,
+				  user_capture_nchnls, user_playback_nchnls,
+				  shorts_first,
+				  systemic_input_latency,
+				  systemic_output_latency,
+				  aggregate);
+
+	if (driver && monitor_routes
+	    && alsa_driver_set_monitor_routes ((alsa_driver_t*)driver,
+					       monitor_routes)) {
+		alsa_driver_delete ((alsa_driver_t*)driver);
+		return NULL;
+	}
+
+	if (driver && hw_passthrough) {
+		alsa_driver_t *alsa = (alsa_driver_t*)driver;
+		if (alsa->hw && alsa->hw->set_passthrough) {
+			alsa->hw_passthrough = TRUE;
+		} else {
+			jack_info ("ALSA: hardware passthrough is not "
+				   "available on this card");
+		}
+	}
+
+	if (driver && varispeed
+	    && alsa_varispeed_open ((alsa_driver_t*)driver, varispeed)) {
+		alsa_driver_delete ((alsa_driver_t*)driver);
+		return NULL;
+	}
+
+	return driver;
 }
 
 void
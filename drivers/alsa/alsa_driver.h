@@ -45,6 +45,26 @@ typedef void (*WriteCopyFunction)(char *dst, jack_default_audio_sample_t *src,
 				  unsigned long src_bytes,
 				  unsigned long dst_skip_bytes,
 				  dither_state_t *state);
+/* A connected channel. The buffer of a playback port with several
+   connections is mixed down every cycle, so it is looked up then, as
+   is that of a single connection, which may be silent this cycle. */
+typedef struct {
+	channel_t chn;
+	jack_port_t *mix_port;
+	jack_port_t *source;
+	jack_default_audio_sample_t *buf;
+	jack_default_audio_sample_t *monitor;   /* played instead of buf */
+} alsa_channel_plan_t;
+
+/* A capture channel the driver itself mixes into a playback channel,
+   see alsa_driver_mix_monitor(). */
+typedef struct {
+	channel_t in;
+	channel_t out;
+	jack_default_audio_sample_t *in_buf;    /* if no port reads it */
+	jack_default_audio_sample_t *out_buf;   /* mix for out */
+} alsa_monitor_route_t;
+
 typedef struct _alsa_driver {
 
 	JACK_DRIVER_NT_DECL
@@ -62,6 +82,22 @@ typedef struct _alsa_driver {
 	unsigned long interleave_unit;
 	unsigned long                *capture_interleave_skip;
 	unsigned long                *playback_interleave_skip;
+	jack_default_audio_sample_t **capture_bufs;
+	jack_default_audio_sample_t **playback_bufs;
+	alsa_channel_plan_t          *capture_plan;
+	alsa_channel_plan_t          *playback_plan;
+	channel_t capture_plan_len;
+	channel_t playback_plan_len;
+	unsigned long plan_generation;  /* of the engine's graph */
+	int plan_valid;
+	unsigned long passthrough_mask; /* playback channels the card plays */
+	channel_t *passthrough_from;    /* and the capture channel of each */
+	alsa_monitor_route_t *monitor_routes;
+	unsigned int nmonitor_routes;
+	jack_default_audio_sample_t *monitor_mem;
+	jack_default_audio_sample_t **monitor_src; /* per capture channel */
+	jack_nframes_t capture_tile_frames;
+	jack_nframes_t playback_tile_frames;
 	channel_t max_nchannels;
 	channel_t user_nchannels;
 	channel_t playback_nchannels;
@@ -104,17 +140,25 @@ typedef struct _alsa_driver {
 	unsigned long input_monitor_mask;
 
 	char soft_mode;
+	char fast_xrun;                 /* recover without a restart */
+	char tsched;                    /* wake on a timer, not interrupts */
+	int tsched_fd;                  /* timerfd, -1 unless tsched */
+	jack_time_t tsched_due;         /* next timer wakeup */
+	char hw_tstamp;                 /* PCM timestamps are on our clock */
 	char hw_monitoring;
+	char hw_passthrough;            /* card plays capture->playback */
 	char hw_metering;
 	char all_monitor_in;
 	char capture_and_playback_not_synced;
 	char playback_interleaved;
 	char capture_interleaved;
+	char playback_direct;           /* non-interleaved FLOAT_LE */
 	char with_monitor_ports;
 	char has_clock_sync_reporting;
 	char has_hw_monitoring;
 	char has_hw_metering;
 	char quirk_bswap;
+	char meter_in_copy;             /* write_via_copy does the port meters */
 
 	ReadCopyFunction read_via_copy;
 	WriteCopyFunction write_via_copy;
@@ -137,6 +181,11 @@ typedef struct _alsa_driver {
 	int xrun_recovery;
 	int previously_successfully_configured;
 
+	struct _alsa_slave *slaves;     /* see aggregate.c */
+	unsigned int nslaves;
+
+	struct _alsa_varispeed *varispeed; /* see varispeed.c */
+
 } alsa_driver_t;
 
 static inline void
@@ -207,6 +256,20 @@ alsa_driver_write_to_channel (alsa_driver_t *driver,
 
 void  alsa_driver_silence_untouched_channels(alsa_driver_t *driver,
 					     jack_nframes_t nframes);
+
+/* The channel plan and the all-channels conversion passes, for the
+   drivers that bring their own channel addresses (usx2y.c). */
+void  alsa_driver_update_plan(alsa_driver_t *driver, jack_nframes_t nframes);
+void  alsa_driver_read_channels(alsa_driver_t *driver, jack_nframes_t offset,
+				jack_nframes_t nframes);
+void  alsa_driver_write_channels(alsa_driver_t *driver, jack_nframes_t offset,
+				 jack_nframes_t nframes);
+void  alsa_driver_mix_monitor(alsa_driver_t *driver, jack_nframes_t nframes);
+int   alsa_driver_get_channel_addresses(alsa_driver_t *driver,
+					snd_pcm_uframes_t *capture_avail,
+					snd_pcm_uframes_t *playback_avail,
+					snd_pcm_uframes_t *capture_offset,
+					snd_pcm_uframes_t *playback_offset);
 void  alsa_driver_set_clock_sync_status(alsa_driver_t *driver, channel_t chn,
 					ClockSyncStatus status);
 int alsa_driver_listen_for_clock_sync_status (alsa_driver_t *,
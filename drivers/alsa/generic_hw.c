@@ -50,6 +50,7 @@ jack_alsa_generic_hw_new (alsa_driver_t *driver)
 	hw->set_input_monitor_mask = generic_set_input_monitor_mask;
 	hw->change_sample_clock = generic_change_sample_clock;
 	hw->release = generic_release;
+	hw->set_passthrough = NULL;
 
 	return hw;
 }
@@ -131,7 +131,7 @@ hammerfall_check_sync (hammerfall_t *h, snd_ctl_elem_value_t *ctl)
 #endif /* HAMMERFALL_MONITOR_CONTROLS */
 
 static int
-hammerfall_set_input_monitor_mask (jack_hardware_t *hw, unsigned long mask)
+hammerfall_set_channels_thru (jack_hardware_t *hw, unsigned long mask)
 {
 	hammerfall_t *h = (hammerfall_t*)hw->private;
 	snd_ctl_elem_value_t *ctl;
@@ -152,11 +152,47 @@ hammerfall_set_input_monitor_mask (jack_hardware_t *hw, unsigned long mask)
 		return -1;
 	}
 
+	return 0;
+}
+
+static int
+hammerfall_set_input_monitor_mask (jack_hardware_t *hw, unsigned long mask)
+{
+	hammerfall_t *h = (hammerfall_t*)hw->private;
+
+	if (hammerfall_set_channels_thru (hw, mask | h->passthrough_mask)) {
+		return -1;
+	}
+
 	hw->input_monitor_mask = mask;
 
 	return 0;
 }
 
+/* The card can only put input n through to output n. */
+static int
+hammerfall_set_passthrough (jack_hardware_t *hw, unsigned long input,
+			    unsigned long output, int on)
+{
+	hammerfall_t *h = (hammerfall_t*)hw->private;
+	unsigned long mask;
+
+	if (input != output || input >= 26) {
+		return -1;
+	}
+
+	mask = on ? (h->passthrough_mask | (1 << input))
+	       : (h->passthrough_mask & ~(1 << input));
+
+	if (hammerfall_set_channels_thru (hw, hw->input_monitor_mask | mask)) {
+		return -1;
+	}
+
+	h->passthrough_mask = mask;
+
+	return 0;
+}
+
 static int
 hammerfall_change_sample_clock (jack_hardware_t *hw, SampleClockMode mode)
 {
@@ -267,13 +303,14 @@ jack_alsa_hammerfall_hw_new (alsa_driver_t *driver)
 
 	hw = (jack_hardware_t*)malloc (sizeof(jack_hardware_t));
 
-	hw->capabilities = Cap_HardwareMonitoring | Cap_AutoSync | Cap_WordClock | Cap_ClockMaster | Cap_ClockLockReporting;
+	hw->capabilities = Cap_HardwareMonitoring | Cap_AutoSync | Cap_WordClock | Cap_ClockMaster | Cap_ClockLockReporting | Cap_HardwarePassthrough;
 	hw->input_monitor_mask = 0;
 	hw->private = 0;
 
 	hw->set_input_monitor_mask = hammerfall_set_input_monitor_mask;
 	hw->change_sample_clock = hammerfall_change_sample_clock;
 	hw->release = hammerfall_release;
+	hw->set_passthrough = hammerfall_set_passthrough;
 
 	h = (hammerfall_t*)malloc (sizeof(hammerfall_t));
 
@@ -285,6 +322,7 @@ jack_alsa_hammerfall_hw_new (alsa_driver_t *driver)
 	h->sync_status[2] = FALSE;
 	h->said_that_spdif_is_fine = FALSE;
 	h->driver = driver;
+	h->passthrough_mask = 0;
 
 	h->monitor_interval.tv_sec = 1;
 	h->monitor_interval.tv_nsec = 0;
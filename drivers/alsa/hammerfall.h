@@ -29,6 +29,7 @@ typedef struct {
 	pthread_t monitor_thread;
 	alsa_driver_t *driver;
 	struct timespec monitor_interval;
+	unsigned long passthrough_mask; /* channels through by passthrough */
 } hammerfall_t;
 
 jack_hardware_t *jack_alsa_hammerfall_hw_new(alsa_driver_t *driver);
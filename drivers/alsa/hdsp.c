@@ -128,6 +128,7 @@ static int hdsp_set_mixer_gain (jack_hardware_t *hw, int input_channel,
 
 static int hdsp_set_input_monitor_mask (jack_hardware_t *hw, unsigned long mask)
 {
+	hdsp_t *h = (hdsp_t*)hw->private;
 	int i;
 
 	/* For each input channel */
@@ -152,7 +153,7 @@ static int hdsp_set_input_monitor_mask (jack_hardware_t *hw, unsigned long mask)
 			}
 #endif
 
-		} else {
+		} else if (h->passthrough_from[i] != i) {
 			/* No.  Disconnect physical input from output */
 			if (hdsp_set_mixer_gain (hw, hdsp_physical_input_index[i],
 						 hdsp_physical_output_index[i],
@@ -177,6 +178,36 @@ static int hdsp_set_input_monitor_mask (jack_hardware_t *hw, unsigned long mask)
 }
 
 
+/* Play a physical input straight out of a physical output, in place
+ * of a capture->playback connection in the graph.  The software
+ * stream to that output is left alone; the driver plays silence on
+ * it while this is on.
+ */
+static int hdsp_set_passthrough (jack_hardware_t *hw, unsigned long input,
+				 unsigned long output, int on)
+{
+	hdsp_t *h = (hdsp_t*)hw->private;
+
+	if (input >= 26 || output >= HDSP_NUM_OUTPUTS) {
+		return -1;
+	}
+
+	if (!on && input == output && (hw->input_monitor_mask & (1 << input))) {
+		/* still monitored, see hdsp_set_input_monitor_mask() */
+		h->passthrough_from[output] = -1;
+		return 0;
+	}
+
+	if (hdsp_set_mixer_gain (hw, hdsp_physical_input_index[input],
+				 hdsp_physical_output_index[output],
+				 on ? HDSP_UNITY_GAIN : HDSP_MINUS_INFINITY_GAIN) != 0) {
+		return -1;
+	}
+
+	h->passthrough_from[output] = on ? (int)input : -1;
+	return 0;
+}
+
 static int hdsp_change_sample_clock (jack_hardware_t *hw, SampleClockMode mode)
 {
 	// Empty for now, until Dave understands more about clock sync so
@@ -211,13 +242,15 @@ jack_alsa_hdsp_hw_new (alsa_driver_t *driver)
 {
 	jack_hardware_t *hw;
 	hdsp_t *h;
+	int i;
 
 	hw = (jack_hardware_t*)malloc (sizeof(jack_hardware_t));
 
 	/* Not using clock lock-sync-whatever in home hardware setup */
 	/* yet.  Will write this code when can test it. */
 	/* hw->capabilities = Cap_HardwareMonitoring|Cap_AutoSync|Cap_WordClock|Cap_ClockMaster|Cap_ClockLockReporting; */
-	hw->capabilities = Cap_HardwareMonitoring | Cap_HardwareMetering;
+	hw->capabilities = Cap_HardwareMonitoring | Cap_HardwareMetering
+			   | Cap_HardwarePassthrough;
 	hw->input_monitor_mask = 0;
 	hw->private = 0;
 
@@ -226,9 +259,13 @@ jack_alsa_hdsp_hw_new (alsa_driver_t *driver)
 	hw->release = hdsp_release;
 	hw->get_hardware_peak = hdsp_get_hardware_peak;
 	hw->get_hardware_power = hdsp_get_hardware_power;
+	hw->set_passthrough = hdsp_set_passthrough;
 
 	h = (hdsp_t*)malloc (sizeof(hdsp_t));
 	h->driver = driver;
+	for (i = 0; i < HDSP_NUM_OUTPUTS; i++) {
+		h->passthrough_from[i] = -1;
+	}
 	hw->private = h;
 
 	return hw;
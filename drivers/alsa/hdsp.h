@@ -22,8 +22,11 @@
 
 #include <sys/time.h>
 
+#define HDSP_NUM_OUTPUTS 28
+
 typedef struct {
 	alsa_driver_t *driver;
+	int passthrough_from[HDSP_NUM_OUTPUTS];   /* input, or -1 */
 } hdsp_t;
 
 jack_hardware_t *
@@ -116,6 +116,7 @@ jack_alsa_ice1712_hw_new (alsa_driver_t *driver)
 	hw->set_input_monitor_mask = ice1712_set_input_monitor_mask;
 	hw->change_sample_clock = ice1712_change_sample_clock;
 	hw->release = ice1712_release;
+	hw->set_passthrough = NULL;
 
 	h = (ice1712_t*)malloc (sizeof(ice1712_t));
 
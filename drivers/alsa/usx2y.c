@@ -215,6 +215,43 @@ usx2y_driver_get_channel_addresses_capture (alsa_driver_t *driver,
 	return 0;
 }
 
+/* The playback channels are interleaved in one run of frames, so a
+   fragment is silenced with a single memset. */
+static void
+usx2y_driver_silence_playback (alsa_driver_t *driver, snd_pcm_uframes_t nframes)
+{
+	char *start = driver->playback_addr[0];
+	channel_t chn;
+
+	for (chn = 1; chn < driver->playback_nchannels; chn++) {
+		if (driver->playback_addr[chn] < start) {
+			start = driver->playback_addr[chn];
+		}
+	}
+
+	memset (start, 0, nframes * driver->playback_interleave_skip[0]);
+}
+
+/* The iso ring is not the ALSA buffer, so the main driver's count of
+   how long a channel has been silent doesn't apply: silence every
+   channel nothing was written to, every time. */
+static void
+usx2y_driver_silence_untouched (alsa_driver_t *driver, snd_pcm_uframes_t nframes)
+{
+	channel_t chn;
+
+	if (driver->playback_plan_len == 0) {
+		usx2y_driver_silence_playback (driver, nframes);
+		return;
+	}
+
+	for (chn = 0; chn < driver->playback_nchannels; chn++) {
+		if (bitset_contains (driver->channels_not_done, chn)) {
+			alsa_driver_silence_on_channel_no_mark (driver, chn, nframes);
+		}
+	}
+}
+
 static int
 usx2y_driver_start (alsa_driver_t *driver)
 {
@@ -399,7 +436,6 @@ usx2y_driver_null_cycle (alsa_driver_t* driver, jack_nframes_t nframes)
 	jack_nframes_t nf;
 	snd_pcm_uframes_t offset;
 	snd_pcm_uframes_t contiguous, contiguous_;
-	int chn;
 
 	VERBOSE (driver->engine,
 		 "usx2y_driver_null_cycle (%p, %i)", driver, nframes);
@@ -459,8 +495,7 @@ usx2y_driver_null_cycle (alsa_driver_t* driver, jack_nframes_t nframes)
 					if (usx2y_driver_get_channel_addresses_playback (driver, &frag) < 0) {
 						return -1;
 					}
-					for (chn = 0; chn < driver->playback_nchannels; chn++)
-						alsa_driver_silence_on_channel (driver, chn, frag);
+					usx2y_driver_silence_playback (driver, frag);
 					nframes -= frag;
 				}
 			}
@@ -483,10 +518,6 @@ usx2y_driver_read (alsa_driver_t *driver, jack_nframes_t nframes)
 	snd_pcm_uframes_t contiguous;
 	snd_pcm_sframes_t nread;
 	snd_pcm_uframes_t offset;
-	jack_default_audio_sample_t* buf[4];
-	channel_t chn;
-	JSList *node;
-	jack_port_t* port;
 	int err;
 	snd_pcm_uframes_t nframes_ = nframes;
 
@@ -504,14 +535,8 @@ usx2y_driver_read (alsa_driver_t *driver, jack_nframes_t nframes)
 		return -1;
 	}
 
-	for (chn = 0, node = driver->capture_ports;
-	     node; node = jack_slist_next (node), chn++) {
-		port = (jack_port_t*)node->data;
-		if (!jack_port_connected (port)) {
-			continue;
-		}
-		buf[chn] = jack_port_get_buffer (port, nframes_);
-	}
+	/* only the connected ports, looked up when the graph changes */
+	alsa_driver_update_plan (driver, nframes);
 
 	while (nframes) {
 
@@ -520,21 +545,7 @@ usx2y_driver_read (alsa_driver_t *driver, jack_nframes_t nframes)
 			    driver, &contiguous) < 0) {
 			return -1;
 		}
-		for (chn = 0, node = driver->capture_ports;
-		     node; node = jack_slist_next (node), chn++) {
-			port = (jack_port_t*)node->data;
-			if (!jack_port_connected (port)) {
-				/* no-copy optimization */
-				continue;
-			}
-			alsa_driver_read_from_channel (driver, chn,
-						       buf[chn] + nread,
-						       contiguous);
-/*                      sample_move_dS_s24(buf[chn] + nread, */
-/*                                         driver->capture_addr[chn], */
-/*                                         contiguous, */
-/*                                         driver->capture_interleave_skip); */
-		}
+		alsa_driver_read_channels (driver, nread, contiguous);
 		nread += contiguous;
 		nframes -= contiguous;
 	}
@@ -554,11 +565,9 @@ usx2y_driver_write (alsa_driver_t* driver, jack_nframes_t nframes)
 {
 	channel_t chn;
 	JSList *node;
-	jack_default_audio_sample_t* buf[2];
 	snd_pcm_sframes_t nwritten;
 	snd_pcm_uframes_t contiguous;
 	snd_pcm_uframes_t offset;
-	jack_port_t *port;
 	int err;
 	snd_pcm_uframes_t nframes_ = nframes;
 
@@ -598,10 +607,10 @@ usx2y_driver_write (alsa_driver_t* driver, jack_nframes_t nframes)
 		return -1;
 	}
 
-	for (chn = 0, node = driver->playback_ports;
-	     node; node = jack_slist_next (node), chn++) {
-		port = (jack_port_t*)node->data;
-		buf[chn] = jack_port_get_buffer (port, nframes_);
+	alsa_driver_update_plan (driver, nframes);
+
+	if (driver->monitor_src) {
+		alsa_driver_mix_monitor (driver, nframes);
 	}
 
 	while (nframes) {
@@ -611,13 +620,8 @@ usx2y_driver_write (alsa_driver_t* driver, jack_nframes_t nframes)
 			    driver, &contiguous) < 0) {
 			return -1;
 		}
-		for (chn = 0, node = driver->playback_ports;
-		     node; node = jack_slist_next (node), chn++) {
-			port = (jack_port_t*)node->data;
-			alsa_driver_write_to_channel (driver, chn,
-						      buf[chn] + nwritten,
-						      contiguous);
-		}
+		alsa_driver_write_channels (driver, nwritten, contiguous);
+		usx2y_driver_silence_untouched (driver, contiguous);
 		nwritten += contiguous;
 		nframes -= contiguous;
 	}
@@ -667,6 +671,7 @@ jack_alsa_usx2y_hw_new (alsa_driver_t *driver)
 	hw->set_input_monitor_mask = usx2y_set_input_monitor_mask;
 	hw->change_sample_clock = usx2y_change_sample_clock;
 	hw->release = usx2y_release;
+	hw->set_passthrough = NULL;
 
 	/* Derive the special USB US-X2Y hwdep pcm device name from
 	 * the playback one, thus allowing the use of the "rawusb"
@@ -0,0 +1,655 @@
+/* -*- mode: c; c-file-style: "linux"; -*- */
+/*
+    Varispeed: the graph runs at the nominal rate, the device at that
+    rate times a ratio.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ */
+
+/*
+ * The device keeps its period and wakes alsa_driver_wait() as before,
+ * but a device period of N frames stands for N * ratio frames of the
+ * graph: played faster than recorded for a ratio above 1, slower below.
+ * alsa_varispeed_run_cycle() moves a device period through a resampler
+ * for all the channels of each direction at once, and runs the engine
+ * for as many whole cycles as the graph frames add up to, none or
+ * several; alsa_driver_read() and alsa_driver_write() then only move
+ * frames between the ports and the two FIFOs.
+ *
+ * The ratio is the last sample a client wrote to the "varispeed" port
+ * in the cycle before, or the one the driver was started with when
+ * nothing is connected to it. libsamplerate ramps between the ratio of
+ * one call and the next over the call's frames, so the ratio may
+ * change every period without a click.
+ */
+
+#include <config.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "internal.h"
+#include "engine.h"
+
+#include "varispeed.h"
+
+#if HAVE_SAMPLERATE
+
+#define VS_MIN_RATIO 0.5
+#define VS_MAX_RATIO 2.0
+#define VS_PAD       64         /* frames, more than the filter's delay */
+
+static int
+alsa_varispeed_configure_stream (alsa_driver_t *driver,
+				 alsa_varispeed_stream_t *s)
+{
+	jack_nframes_t nframes = driver->frames_per_cycle;
+	size_t frame_bytes = s->channels * sizeof(float);
+
+	free (s->planar);
+	free (s->hw);
+	free (s->fifo);
+
+	s->size = (size_t)((VS_MAX_RATIO + 4) * nframes) + 2 * VS_PAD;
+	s->planar = (float*)malloc (nframes * frame_bytes);
+	s->hw = (float*)malloc (nframes * frame_bytes);
+	s->fifo = (float*)malloc (s->size * frame_bytes);
+	s->fill = 0;
+
+	if (!s->planar || !s->hw || !s->fifo) {
+		jack_error ("ALSA: cannot allocate varispeed buffers");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+alsa_varispeed_free_stream (alsa_varispeed_stream_t *s)
+{
+	if (s->src) {
+		src_delete (s->src);
+	}
+	free (s->planar);
+	free (s->hw);
+	free (s->fifo);
+	memset (s, 0, sizeof(*s));
+}
+
+static int
+alsa_varispeed_open_stream (alsa_varispeed_stream_t *s, unsigned int channels,
+			    const char *stream_name)
+{
+	int err;
+
+	s->channels = channels;
+
+	if (channels == 0) {
+		return 0;
+	}
+
+	if ((s->src = src_new (SRC_SINC_FASTEST, channels, &err)) == NULL) {
+		jack_error ("ALSA: cannot create a %s resampler (%s)",
+			    stream_name, src_strerror (err));
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+alsa_varispeed_open (alsa_driver_t *driver, double ratio)
+{
+	alsa_varispeed_t *vs;
+
+	if (ratio < VS_MIN_RATIO || ratio > VS_MAX_RATIO) {
+		jack_error ("ALSA: varispeed ratio %g is not between %g and %g",
+			    ratio, VS_MIN_RATIO, VS_MAX_RATIO);
+		return -1;
+	}
+
+	if (driver->nslaves || driver->nmonitor_routes || driver->hw_passthrough) {
+		jack_error ("ALSA: varispeed cannot be combined with aggregate "
+			    "devices, monitor routes or hwthru");
+		return -1;
+	}
+
+	if ((vs = (alsa_varispeed_t*)calloc (1, sizeof(*vs))) == NULL) {
+		return -1;
+	}
+
+	vs->ratio = ratio;
+	vs->current = ratio;
+	driver->varispeed = vs;
+
+	if (alsa_varispeed_open_stream (&vs->capture,
+					driver->capture_handle ?
+					driver->capture_nchannels : 0,
+					"capture")
+	    || alsa_varispeed_open_stream (&vs->playback,
+					   driver->playback_handle ?
+					   driver->playback_nchannels : 0,
+					   "playback")
+	    || alsa_varispeed_configure (driver)) {
+		alsa_varispeed_close (driver);
+		return -1;
+	}
+
+	jack_info ("ALSA: varispeed, starting at a ratio of %g", ratio);
+
+	return 0;
+}
+
+void
+alsa_varispeed_close (alsa_driver_t *driver)
+{
+	alsa_varispeed_t *vs = driver->varispeed;
+
+	if (vs == NULL) {
+		return;
+	}
+
+	if (vs->dropouts) {
+		jack_info ("ALSA: varispeed ran dry or over %lu times",
+			   vs->dropouts);
+	}
+
+	alsa_varispeed_free_stream (&vs->capture);
+	alsa_varispeed_free_stream (&vs->playback);
+	free (vs);
+	driver->varispeed = NULL;
+}
+
+int
+alsa_varispeed_configure (alsa_driver_t *driver)
+{
+	alsa_varispeed_t *vs = driver->varispeed;
+
+	if (vs->capture.channels
+	    && alsa_varispeed_configure_stream (driver, &vs->capture)) {
+		return -1;
+	}
+
+	if (vs->playback.channels
+	    && alsa_varispeed_configure_stream (driver, &vs->playback)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Enough capture frames that a cycle never waits on the resampler's
+   delay, and a period more of playback frames since the cycles that
+   fill it are whole ones. */
+void
+alsa_varispeed_start (alsa_driver_t *driver)
+{
+	alsa_varispeed_t *vs = driver->varispeed;
+	alsa_varispeed_stream_t *s;
+
+	vs->credit = 0;
+
+	s = &vs->capture;
+	if (s->channels) {
+		src_reset (s->src);
+		s->fill = VS_PAD;
+		memset (s->fifo, 0, s->fill * s->channels * sizeof(float));
+	}
+
+	s = &vs->playback;
+	if (s->channels) {
+		src_reset (s->src);
+		s->fill = driver->frames_per_cycle + VS_PAD;
+		memset (s->fifo, 0, s->fill * s->channels * sizeof(float));
+	}
+}
+
+int
+alsa_varispeed_attach (alsa_driver_t *driver)
+{
+	alsa_varispeed_t *vs = driver->varispeed;
+
+	if ((vs->port = jack_port_register (driver->client, "varispeed",
+					    JACK_DEFAULT_AUDIO_TYPE,
+					    JackPortIsInput
+					    | JackPortIsTerminal, 0)) == NULL) {
+		jack_error ("ALSA: cannot register the varispeed port");
+		return -1;
+	}
+
+	return 0;
+}
+
+void
+alsa_varispeed_detach (alsa_driver_t *driver)
+{
+	alsa_varispeed_t *vs = driver->varispeed;
+
+	if (vs->port) {
+		jack_port_unregister (driver->client, vs->port);
+		vs->port = NULL;
+	}
+}
+
+/* What the FIFOs add, as primed by alsa_varispeed_start(). */
+jack_nframes_t
+alsa_varispeed_latency (alsa_driver_t *driver,
+			jack_latency_callback_mode_t mode)
+{
+	if (mode == JackCaptureLatency) {
+		return VS_PAD;
+	}
+	return driver->frames_per_cycle + VS_PAD;
+}
+
+static void
+alsa_varispeed_consume (alsa_varispeed_stream_t *s, size_t frames)
+{
+	s->fill -= frames;
+	memmove (s->fifo, s->fifo + frames * s->channels,
+		 s->fill * s->channels * sizeof(float));
+}
+
+static double
+alsa_varispeed_ratio (alsa_varispeed_t *vs, jack_nframes_t nframes)
+{
+	jack_default_audio_sample_t *buf;
+	double ratio = vs->ratio;
+
+	if (vs->port && jack_port_connected (vs->port)) {
+		buf = (jack_default_audio_sample_t*)
+		      jack_port_get_buffer (vs->port, nframes);
+		ratio = buf[nframes - 1];
+		if (isnan (ratio)) {
+			ratio = vs->current;
+		}
+	}
+
+	if (ratio < VS_MIN_RATIO) {
+		ratio = VS_MIN_RATIO;
+	} else if (ratio > VS_MAX_RATIO) {
+		ratio = VS_MAX_RATIO;
+	}
+
+	vs->current = ratio;
+	return ratio;
+}
+
+/* One device period from the device into the capture FIFO. */
+static int
+alsa_varispeed_capture (alsa_driver_t *driver, alsa_varispeed_t *vs,
+			double ratio)
+{
+	alsa_varispeed_stream_t *s = &vs->capture;
+	jack_nframes_t nframes = driver->frames_per_cycle;
+	jack_nframes_t nread, i;
+	snd_pcm_uframes_t contiguous;
+	snd_pcm_uframes_t offset;
+	unsigned int chn;
+	SRC_DATA data;
+	int err;
+
+	for (nread = 0; nread < nframes; nread += contiguous) {
+
+		contiguous = nframes - nread;
+
+		if (alsa_driver_get_channel_addresses (driver, &contiguous, 0,
+						       &offset, 0) < 0) {
+			return -1;
+		}
+
+		for (chn = 0; chn < s->channels; ++chn) {
+			driver->read_via_copy (s->planar + chn * nframes + nread,
+					       driver->capture_addr[chn],
+					       contiguous,
+					       driver->capture_interleave_skip[chn]);
+		}
+
+		if ((err = snd_pcm_mmap_commit (driver->capture_handle,
+						offset, contiguous)) < 0) {
+			jack_error ("ALSA: could not complete read of %"
+				    PRIu32 " frames: error = %d",
+				    (jack_nframes_t)contiguous, err);
+			return -1;
+		}
+	}
+
+	for (i = 0; i < nframes; ++i) {
+		for (chn = 0; chn < s->channels; ++chn) {
+			s->hw[i * s->channels + chn] = s->planar[chn * nframes + i];
+		}
+	}
+
+	data.data_in = s->hw;
+	data.input_frames = nframes;
+	data.data_out = s->fifo + s->fill * s->channels;
+	data.output_frames = s->size - s->fill;
+	data.end_of_input = 0;
+	data.src_ratio = ratio;
+
+	if (src_process (s->src, &data) != 0) {
+		vs->dropouts++;
+		return 0;
+	}
+
+	s->fill += data.output_frames_gen;
+
+	if (data.input_frames_used < (long)nframes) {
+		vs->dropouts++;
+	}
+
+	return 0;
+}
+
+/* One device period from the playback FIFO to the device. */
+static int
+alsa_varispeed_playback (alsa_driver_t *driver, alsa_varispeed_t *vs,
+			 double ratio)
+{
+	alsa_varispeed_stream_t *s = &vs->playback;
+	jack_nframes_t nframes = driver->frames_per_cycle;
+	jack_nframes_t nwritten, i;
+	snd_pcm_uframes_t contiguous;
+	snd_pcm_uframes_t offset;
+	unsigned int chn;
+	SRC_DATA data;
+	int err;
+
+	data.data_in = s->fifo;
+	data.input_frames = s->fill;
+	data.data_out = s->hw;
+	data.output_frames = nframes;
+	data.end_of_input = 0;
+	data.src_ratio = 1.0 / ratio;
+
+	if (src_process (s->src, &data) != 0) {
+		data.input_frames_used = 0;
+		data.output_frames_gen = 0;
+	}
+
+	alsa_varispeed_consume (s, data.input_frames_used);
+
+	if (data.output_frames_gen < (long)nframes) {
+		memset (s->hw + data.output_frames_gen * s->channels, 0,
+			(nframes - data.output_frames_gen) * s->channels
+			* sizeof(float));
+		vs->dropouts++;
+	}
+
+	for (i = 0; i < nframes; ++i) {
+		for (chn = 0; chn < s->channels; ++chn) {
+			s->planar[chn * nframes + i] = s->hw[i * s->channels + chn];
+		}
+	}
+
+	for (nwritten = 0; nwritten < nframes; nwritten += contiguous) {
+
+		contiguous = nframes - nwritten;
+
+		if (alsa_driver_get_channel_addresses (driver, 0, &contiguous,
+						       0, &offset) < 0) {
+			return -1;
+		}
+
+		for (chn = 0; chn < s->channels; ++chn) {
+			if (driver->dither_state[chn].meter && !driver->meter_in_copy) {
+				memops_meter (driver->dither_state + chn,
+					      s->planar + chn * nframes + nwritten,
+					      contiguous);
+			}
+			driver->write_via_copy (driver->playback_addr[chn],
+						s->planar + chn * nframes + nwritten,
+						contiguous,
+						driver->playback_interleave_skip[chn],
+						driver->dither_state + chn);
+		}
+
+		if ((err = snd_pcm_mmap_commit (driver->playback_handle,
+						offset, contiguous)) < 0) {
+			jack_error ("ALSA: could not complete playback of %"
+				    PRIu32 " frames: error = %d",
+				    (jack_nframes_t)contiguous, err);
+			if (err != -EPIPE && err != -ESTRPIPE) {
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+int
+alsa_varispeed_run_cycle (alsa_driver_t *driver, jack_nframes_t avail,
+			  float delayed_usecs)
+{
+	alsa_varispeed_t *vs = driver->varispeed;
+	jack_engine_t *engine = driver->engine;
+	jack_nframes_t nframes = driver->frames_per_cycle;
+	jack_nframes_t done;
+	double ratio;
+
+	for (done = 0; done + nframes <= avail; done += nframes) {
+
+		ratio = alsa_varispeed_ratio (vs, nframes);
+
+		if (vs->capture.channels
+		    && alsa_varispeed_capture (driver, vs, ratio)) {
+			return -1;
+		}
+
+		vs->credit += nframes * ratio;
+
+		while (vs->credit >= nframes) {
+			vs->credit -= nframes;
+			if (engine->run_cycle (engine, nframes, delayed_usecs)) {
+				return -1;
+			}
+			delayed_usecs = 0;
+		}
+
+		if (vs->playback.channels
+		    && alsa_varispeed_playback (driver, vs, ratio)) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void
+alsa_varispeed_read (alsa_driver_t *driver, jack_nframes_t nframes)
+{
+	alsa_varispeed_t *vs = driver->varispeed;
+	alsa_varispeed_stream_t *s = &vs->capture;
+	jack_default_audio_sample_t *buf;
+	jack_nframes_t n, i;
+	unsigned int chn;
+	JSList *node;
+
+	if (s->channels == 0) {
+		return;
+	}
+
+	n = s->fill < nframes ? s->fill : nframes;
+
+	for (chn = 0, node = driver->capture_ports;
+	     node && chn < s->channels;
+	     node = jack_slist_next (node), chn++) {
+
+		jack_port_t *port = (jack_port_t*)node->data;
+
+		if (!jack_port_connected (port)) {
+			continue;
+		}
+
+		buf = jack_port_get_buffer (port, nframes);
+
+		for (i = 0; i < n; ++i) {
+			buf[i] = s->fifo[i * s->channels + chn];
+		}
+		if (n < nframes) {
+			memset (buf + n, 0, (nframes - n) * sizeof(*buf));
+		}
+	}
+
+	if (n < nframes) {
+		vs->dropouts++;
+	}
+
+	alsa_varispeed_consume (s, n);
+}
+
+void
+alsa_varispeed_write (alsa_driver_t *driver, jack_nframes_t nframes)
+{
+	alsa_varispeed_t *vs = driver->varispeed;
+	alsa_varispeed_stream_t *s = &vs->playback;
+	jack_default_audio_sample_t *buf;
+	jack_default_audio_sample_t *monbuf;
+	float *dst;
+	jack_nframes_t i;
+	unsigned int chn;
+	JSList *node;
+	JSList *mon_node;
+	jack_port_t *port;
+
+	if (s->channels == 0) {
+		return;
+	}
+
+	if (s->size - s->fill < nframes) {
+		vs->dropouts++;
+		return;
+	}
+
+	dst = s->fifo + s->fill * s->channels;
+	memset (dst, 0, nframes * s->channels * sizeof(float));
+
+	for (chn = 0, node = driver->playback_ports,
+	     mon_node = driver->monitor_ports;
+	     node && chn < s->channels;
+	     node = jack_slist_next (node), chn++) {
+
+		/* unconnected ports read as silence */
+		buf = jack_port_get_buffer ((jack_port_t*)node->data, nframes);
+
+		for (i = 0; i < nframes; ++i) {
+			dst[i * s->channels + chn] = buf[i];
+		}
+
+		if (mon_node) {
+			port = (jack_port_t*)mon_node->data;
+			if (jack_port_connected (port)) {
+				monbuf = jack_port_get_buffer (port, nframes);
+				memcpy (monbuf, buf, nframes * sizeof(*buf));
+			}
+			mon_node = jack_slist_next (mon_node);
+		}
+	}
+
+	s->fill += nframes;
+}
+
+/* A cycle the engine did not run still moves graph time on. */
+void
+alsa_varispeed_null_cycle (alsa_driver_t *driver, jack_nframes_t nframes)
+{
+	alsa_varispeed_t *vs = driver->varispeed;
+	alsa_varispeed_stream_t *s;
+
+	s = &vs->capture;
+	if (s->channels) {
+		alsa_varispeed_consume (s, s->fill < nframes ? s->fill : nframes);
+	}
+
+	s = &vs->playback;
+	if (s->channels && s->size - s->fill >= nframes) {
+		memset (s->fifo + s->fill * s->channels, 0,
+			nframes * s->channels * sizeof(float));
+		s->fill += nframes;
+	}
+}
+
+#else /* !HAVE_SAMPLERATE */
+
+int
+alsa_varispeed_open (alsa_driver_t *driver, double ratio)
+{
+	jack_error ("ALSA: varispeed needs libsamplerate, which this "
+		    "driver was built without");
+	return -1;
+}
+
+void
+alsa_varispeed_close (alsa_driver_t *driver)
+{
+}
+
+int
+alsa_varispeed_configure (alsa_driver_t *driver)
+{
+	return 0;
+}
+
+void
+alsa_varispeed_start (alsa_driver_t *driver)
+{
+}
+
+int
+alsa_varispeed_attach (alsa_driver_t *driver)
+{
+	return 0;
+}
+
+void
+alsa_varispeed_detach (alsa_driver_t *driver)
+{
+}
+
+jack_nframes_t
+alsa_varispeed_latency (alsa_driver_t *driver,
+			jack_latency_callback_mode_t mode)
+{
+	return 0;
+}
+
+int
+alsa_varispeed_run_cycle (alsa_driver_t *driver, jack_nframes_t avail,
+			  float delayed_usecs)
+{
+	return 0;
+}
+
+void
+alsa_varispeed_read (alsa_driver_t *driver, jack_nframes_t nframes)
+{
+}
+
+void
+alsa_varispeed_write (alsa_driver_t *driver, jack_nframes_t nframes)
+{
+}
+
+void
+alsa_varispeed_null_cycle (alsa_driver_t *driver, jack_nframes_t nframes)
+{
+}
+
+#endif /* HAVE_SAMPLERATE */
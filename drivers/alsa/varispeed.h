@@ -0,0 +1,69 @@
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ */
+
+#ifndef __jack_alsa_varispeed_h__
+#define __jack_alsa_varispeed_h__
+
+#include <config.h>
+
+#if HAVE_SAMPLERATE
+#include <samplerate.h>
+#endif
+
+#include "alsa_driver.h"
+
+/* One direction of the main device. `fifo' holds graph frames:
+   for capture those resampled from the device and not yet read by a
+   cycle, for playback those written by cycles and not yet resampled
+   to the device. */
+typedef struct {
+	unsigned int channels;
+	float *planar;                  /* one device period, per channel */
+	float *hw;                      /* the same, interleaved */
+	float *fifo;                    /* interleaved */
+	size_t fill;
+	size_t size;
+#if HAVE_SAMPLERATE
+	SRC_STATE *src;
+#endif
+} alsa_varispeed_stream_t;
+
+typedef struct _alsa_varispeed {
+	double ratio;                   /* when nothing drives the port */
+	double current;
+	double credit;                  /* graph frames not yet cycled */
+	jack_port_t *port;
+	alsa_varispeed_stream_t capture;
+	alsa_varispeed_stream_t playback;
+	unsigned long dropouts;
+} alsa_varispeed_t;
+
+int  alsa_varispeed_open(alsa_driver_t *driver, double ratio);
+void alsa_varispeed_close(alsa_driver_t *driver);
+int  alsa_varispeed_configure(alsa_driver_t *driver);
+void alsa_varispeed_start(alsa_driver_t *driver);
+int  alsa_varispeed_attach(alsa_driver_t *driver);
+void alsa_varispeed_detach(alsa_driver_t *driver);
+jack_nframes_t alsa_varispeed_latency(alsa_driver_t *driver,
+				      jack_latency_callback_mode_t mode);
+int  alsa_varispeed_run_cycle(alsa_driver_t *driver, jack_nframes_t avail,
+			      float delayed_usecs);
+void alsa_varispeed_read(alsa_driver_t *driver, jack_nframes_t nframes);
+void alsa_varispeed_write(alsa_driver_t *driver, jack_nframes_t nframes);
+void alsa_varispeed_null_cycle(alsa_driver_t *driver, jack_nframes_t nframes);
+
+#endif /* __jack_alsa_varispeed_h__ */
@@ -38,6 +38,10 @@
 #define PORT_HASH_BITS 4
 #define PORT_HASH_SIZE (1 << PORT_HASH_BITS)
 
+/* the port thread's index, see port_hash.c */
+#define PORT_INDEX_BITS 8
+#define PORT_INDEX_SIZE (1 << PORT_INDEX_BITS)
+
 /* Beside enum use, these are indeces for (struct a2j).stream array */
 #define A2J_PORT_CAPTURE   0    // ALSA playback port -> JACK capture port
 #define A2J_PORT_PLAYBACK  1    // JACK playback port -> ALSA capture port
@@ -48,8 +52,10 @@ struct alsa_midi_driver;
 
 struct a2j_port {
 	struct a2j_port * next;         /* hash - jack */
-	struct list_head siblings;      /* list - main loop */
+	struct a2j_port * addr_next;    /* index - port thread */
+	struct a2j_port * name_next;    /* index - port thread */
 	struct alsa_midi_driver * driver_ptr;
+	int dir;                        /* A2J_PORT_CAPTURE or A2J_PORT_PLAYBACK */
 	bool is_dead;
 	char name[64];
 	snd_seq_addr_t remote;
@@ -67,7 +73,11 @@ struct a2j_stream {
 	jack_ringbuffer_t *new_ports;
 
 	a2j_port_hash_t port_hash;
-	struct list_head list;
+
+	/* every port of the stream, by ALSA address and by JACK port
+	   name, under the driver's port_lock */
+	struct a2j_port * addr_index[PORT_INDEX_SIZE];
+	struct a2j_port * name_index[PORT_INDEX_SIZE];
 };
 
 typedef struct alsa_midi_driver {
@@ -85,11 +95,20 @@ typedef struct alsa_midi_driver {
 	bool running;
 	bool finishing;
 
+	pthread_mutex_t port_lock;              // for the stream indexes
 	jack_ringbuffer_t* port_del;            // struct a2j_port*
 	jack_ringbuffer_t* outbound_events;     // struct a2j_delivery_event
 	jack_nframes_t cycle_start;
 
 	sem_t output_semaphore;
+	int64_t output_wake_at;                 // see a2j_output_wants_wakeup()
+
+	/* owned by the output thread: events taken from outbound_events,
+	   as a binary min-heap on (time, seq) */
+	struct a2j_delivery_event* out_heap;
+	size_t out_heap_len;
+	size_t out_heap_size;
+	uint32_t out_seq;
 
 	struct a2j_stream stream[2];
 
@@ -105,14 +124,13 @@ struct a2j_alsa_midi_event {
 #define MAX_JACKMIDI_EV_SIZE 64
 
 struct a2j_delivery_event {
-	struct list_head siblings;
-
 	/* a jack MIDI event, plus the port its destined for: everything
 	   the ALSA output thread needs to deliver the event. time is
 	   part of the jack_event.
 	 */
 	jack_midi_event_t jack_event;
 	jack_nframes_t time; /* realtime, not offset time */
+	uint32_t seq;        /* keeps events with the same time in order */
 	struct a2j_port* port;
 	char midistring[MAX_JACKMIDI_EV_SIZE];
 };
@@ -23,6 +23,7 @@
 #include <stdbool.h>
 #include <stdarg.h>
 #include <string.h>
+#include <errno.h>
 #include <time.h>
 #include <alsa/asoundlib.h>
 #include <jack/jack.h>
@@ -35,6 +36,11 @@
 #include "port.h"
 #include "port_thread.h"
 
+/* from libjack/thread.c; internal.h is not included here because its
+ * DEBUG macro would change the port capabilities below */
+extern int jack_thread_set_cpus (pthread_t thread, const char *cpus);
+extern const char *jack_realtime_cpus (void);
+
 #ifdef A2J_DEBUG
 bool a2j_do_debug = false;
 
@@ -70,7 +76,6 @@ a2j_stream_init (alsa_midi_driver_t* driver, int which)
 	}
 
 	snd_midi_event_new (MAX_EVENT_SIZE, &str->codec);
-	INIT_LIST_HEAD (&str->list);
 
 	return true;
 }
@@ -79,18 +84,18 @@ static void
 a2j_stream_detach (struct a2j_stream * stream_ptr)
 {
 	struct a2j_port * port_ptr;
-	struct list_head * node_ptr;
+	int i;
 
 	if (!stream_ptr) {
 		return;
 	}
 
-	while (!list_empty (&stream_ptr->list)) {
-		node_ptr = stream_ptr->list.next;
-		list_del (node_ptr);
-		port_ptr = list_entry (node_ptr, struct a2j_port, siblings);
-		a2j_debug ("port deleted: %s", port_ptr->name);
-		a2j_port_free (port_ptr);
+	for (i = 0; i < PORT_INDEX_SIZE; i++) {
+		while ((port_ptr = stream_ptr->addr_index[i]) != NULL) {
+			a2j_port_index_remove (stream_ptr, port_ptr);
+			a2j_debug ("port deleted: %s", port_ptr->name);
+			a2j_port_free (port_ptr);
+		}
 	}
 }
 
@@ -156,16 +161,19 @@ a2j_port_event (alsa_midi_driver_t* driver, snd_seq_event_t * ev)
 		return;
 	}
 
+	/* the announce names the one port that changed, so look at just
+	   that port rather than rescanning its client */
+
 	if (ev->type == SND_SEQ_EVENT_PORT_START) {
 		a2j_debug ("port_event: add %d:%d", addr.client, addr.port);
-		a2j_new_ports (driver, addr);
+		a2j_update_ports (driver, addr);
 	} else if (ev->type == SND_SEQ_EVENT_PORT_CHANGE) {
 		a2j_debug ("port_event: change %d:%d", addr.client, addr.port);
 		a2j_update_ports (driver, addr);
 	} else if (ev->type == SND_SEQ_EVENT_PORT_EXIT) {
 		a2j_debug ("port_event: del %d:%d", addr.client, addr.port);
-		a2j_port_setdead (driver->stream[A2J_PORT_CAPTURE].port_hash, addr);
-		a2j_port_setdead (driver->stream[A2J_PORT_PLAYBACK].port_hash, addr);
+		a2j_port_setdead (driver, A2J_PORT_CAPTURE, addr);
+		a2j_port_setdead (driver, A2J_PORT_PLAYBACK, addr);
 	}
 }
 
@@ -182,7 +190,14 @@ a2j_input_event (alsa_midi_driver_t* driver, snd_seq_event_t * alsa_event)
 
 	now = jack_frame_time (driver->jack_client);
 
-	if ((port = a2j_port_get (str->port_hash, alsa_event->source)) == NULL) {
+	/* hold port_lock until we are done with the port, so that the
+	   output thread cannot free it under us */
+
+	pthread_mutex_lock (&driver->port_lock);
+
+	if ((port = a2j_port_index_by_addr (str, alsa_event->source)) == NULL ||
+	    port->inbound_events == NULL) {
+		pthread_mutex_unlock (&driver->port_lock);
 		return;
 	}
 
@@ -192,6 +207,7 @@ a2j_input_event (alsa_midi_driver_t* driver, snd_seq_event_t * alsa_event)
 	 */
 	snd_midi_event_reset_decode (str->codec);
 	if ((size = snd_midi_event_decode (str->codec, data, sizeof(data), alsa_event)) < 0) {
+		pthread_mutex_unlock (&driver->port_lock);
 		return;
 	}
 
@@ -246,6 +262,7 @@ a2j_input_event (alsa_midi_driver_t* driver, snd_seq_event_t * alsa_event)
 		a2j_error ("MIDI data lost (incoming event buffer full): %ld bytes lost", size);
 	}
 
+	pthread_mutex_unlock (&driver->port_lock);
 }
 
 static int
@@ -371,10 +388,40 @@ alsa_input_thread (void* arg)
 
 /* --- OUTBOUND FROM JACK TO ALSA ---- */
 
+/* The output thread sleeps until the earliest event it holds is due,
+ * or until the JACK thread queues an event that is due even earlier.
+ * output_wake_at says which: A2J_OUTPUT_AWAKE while it is looking at
+ * the FIFO, A2J_OUTPUT_IDLE when it holds nothing, or else the frame
+ * time it will wake at. Each side writes its own part (the FIFO, or
+ * output_wake_at) before reading the other's, so either the JACK
+ * thread sees that a wakeup is needed or the output thread sees the
+ * new events before it goes to sleep.
+ */
+#define A2J_OUTPUT_AWAKE ((int64_t)-1)
+#define A2J_OUTPUT_IDLE  ((int64_t)-2)
+
+static int
+a2j_output_wants_wakeup (alsa_midi_driver_t* driver, jack_nframes_t earliest)
+{
+	int64_t wake_at;
+
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	wake_at = __atomic_load_n (&driver->output_wake_at, __ATOMIC_SEQ_CST);
+
+	if (wake_at == A2J_OUTPUT_AWAKE) {
+		return 0;
+	}
+	if (wake_at == A2J_OUTPUT_IDLE) {
+		return 1;
+	}
+	return (int32_t)(earliest - (jack_nframes_t)wake_at) < 0;
+}
+
 int
 a2j_process_outgoing (
 	alsa_midi_driver_t* driver,
-	struct a2j_port * port)
+	struct a2j_port * port,
+	jack_nframes_t * earliest)
 {
 	/* collect data from JACK port buffer and queue it for delivery by ALSA output thread */
 
@@ -394,13 +441,21 @@ a2j_process_outgoing (
 
 	a2j_debug ("alsa_out: port has %d events for delivery\n", nevents);
 
+	/* events come in time order, so the first one we write is the
+	   earliest from this port. times are absolute from here on, so
+	   that it does not matter which cycle the output thread reads
+	   them in. */
+
 	for (i = 0; (i < nevents) && (written < limit); ++i) {
 
 		jack_midi_event_get (&dev->jack_event, port->jack_buf, i);
 		if (dev->jack_event.size <= MAX_JACKMIDI_EV_SIZE) {
-			dev->time = dev->jack_event.time;
+			dev->time = driver->cycle_start + dev->jack_event.time;
 			dev->port = port;
 			memcpy ( dev->midistring, dev->jack_event.buffer, dev->jack_event.size );
+			if (written == 0 && (int32_t)(dev->time - *earliest) < 0) {
+				*earliest = dev->time;
+			}
 			written++;
 			++dev;
 		}
@@ -420,9 +475,12 @@ a2j_process_outgoing (
 		while ((i < nevents) && (written < limit)) {
 			jack_midi_event_get (&dev->jack_event, port->jack_buf, i);
 			if (dev->jack_event.size <= MAX_JACKMIDI_EV_SIZE) {
-				dev->time = dev->jack_event.time;
+				dev->time = driver->cycle_start + dev->jack_event.time;
 				dev->port = port;
 				memcpy (dev->midistring, dev->jack_event.buffer, dev->jack_event.size);
+				if (written == 0 && (int32_t)(dev->time - *earliest) < 0) {
+					*earliest = dev->time;
+				}
 				written++;
 				++dev;
 			}
@@ -435,18 +493,134 @@ a2j_process_outgoing (
 
 	jack_ringbuffer_write_advance (driver->outbound_events, written * sizeof(struct a2j_delivery_event) + gap);
 
-	return nevents;
+	return written;
 }
 
-static int
-time_sorter (struct a2j_delivery_event * a, struct a2j_delivery_event * b)
+static inline int
+a2j_delivery_before (const struct a2j_delivery_event * a, const struct a2j_delivery_event * b)
 {
-	if (a->time < b->time) {
-		return -1;
-	} else if (a->time > b->time) {
-		return 1;
+	int32_t d = (int32_t)(a->time - b->time);
+
+	return d < 0 || (d == 0 && (int32_t)(a->seq - b->seq) < 0);
+}
+
+static void
+a2j_heap_push (alsa_midi_driver_t* driver, const struct a2j_delivery_event * ev)
+{
+	struct a2j_delivery_event* heap = driver->out_heap;
+	size_t i = driver->out_heap_len++;
+
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		if (!a2j_delivery_before (ev, &heap[parent])) {
+			break;
+		}
+		heap[i] = heap[parent];
+		i = parent;
 	}
-	return 0;
+
+	heap[i] = *ev;
+}
+
+static void
+a2j_heap_pop (alsa_midi_driver_t* driver)
+{
+	struct a2j_delivery_event* heap = driver->out_heap;
+	size_t len = --driver->out_heap_len;
+	size_t i = 0;
+	size_t child;
+
+	while ((child = 2 * i + 1) < len) {
+		if (child + 1 < len && a2j_delivery_before (&heap[child + 1], &heap[child])) {
+			child++;
+		}
+		if (!a2j_delivery_before (&heap[child], &heap[len])) {
+			break;
+		}
+		heap[i] = heap[child];
+		i = child;
+	}
+
+	heap[i] = heap[len];
+}
+
+/* move what the JACK thread has queued into the heap, as far as it
+   has room. The writer pads the end of the first part of the FIFO
+   rather than split an event, so that part is consumed whole. */
+
+static void
+a2j_fetch_outbound (alsa_midi_driver_t* driver)
+{
+	jack_ringbuffer_data_t vec[2];
+	struct a2j_delivery_event* ev;
+	size_t consumed = 0;
+	int part;
+
+	jack_ringbuffer_get_read_vector (driver->outbound_events, vec);
+
+	for (part = 0; part < 2; ++part) {
+		size_t limit = vec[part].len / sizeof(struct a2j_delivery_event);
+		size_t i;
+
+		ev = (struct a2j_delivery_event*)vec[part].buf;
+
+		for (i = 0; i < limit && driver->out_heap_len < driver->out_heap_size; ++i, ++ev) {
+			ev->seq = driver->out_seq++;
+			a2j_heap_push (driver, ev);
+		}
+
+		if (i < limit) {
+			consumed += i * sizeof(struct a2j_delivery_event);
+			break;
+		}
+
+		consumed += vec[part].len;
+	}
+
+	jack_ringbuffer_read_advance (driver->outbound_events, consumed);
+}
+
+/* sleep until `wake_at', or until the JACK thread has something
+   earlier for us. without a deadline, until it has anything. */
+
+static void
+a2j_output_wait (alsa_midi_driver_t* driver, int64_t wake_at)
+{
+	struct timespec ts;
+	jack_time_t then, now;
+
+	__atomic_store_n (&driver->output_wake_at, wake_at, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+
+	if (jack_ringbuffer_read_space (driver->outbound_events) >= sizeof(struct a2j_delivery_event)) {
+		goto done;
+	}
+
+	if (wake_at == A2J_OUTPUT_IDLE) {
+		a2j_debug ("alsa_out: output thread: wait for events");
+		sem_wait (&driver->output_semaphore);
+		goto done;
+	}
+
+	then = jack_frames_to_time (driver->jack_client, (jack_nframes_t)wake_at);
+	now = jack_get_time ();
+
+	if (then > now) {
+		clock_gettime (CLOCK_REALTIME, &ts);
+		ts.tv_sec += (then - now) / 1000000;
+		ts.tv_nsec += ((then - now) % 1000000) * 1000;
+		if (ts.tv_nsec >= NSEC_PER_SEC) {
+			ts.tv_sec++;
+			ts.tv_nsec -= NSEC_PER_SEC;
+		}
+
+		a2j_debug ("alsa_out: output thread sleeps for %.2f msec", (double)(then - now) / 1000.0);
+
+		while (sem_timedwait (&driver->output_semaphore, &ts) < 0 && errno == EINTR) ;
+	}
+
+done:
+	__atomic_store_n (&driver->output_wake_at, A2J_OUTPUT_AWAKE, __ATOMIC_SEQ_CST);
 }
 
 static void*
@@ -454,68 +628,46 @@ alsa_output_thread (void * arg)
 {
 	alsa_midi_driver_t * driver = (alsa_midi_driver_t*)arg;
 	struct a2j_stream *str = &driver->stream[A2J_PORT_PLAYBACK];
-	int i;
-	struct list_head evlist;
-	struct list_head * node_ptr;
-	jack_ringbuffer_data_t vec[2];
 	snd_seq_event_t alsa_event;
 	struct a2j_delivery_event* ev;
-	float sr;
 	jack_nframes_t now;
-	int limit;
+	jack_nframes_t slack;
+	int queued;
 
 	while (driver->running) {
 		/* pre-first, handle port deletion requests */
 
 		a2j_free_ports (driver);
 
-		/* first, make a list of all events in the outbound_events FIFO */
-
-		INIT_LIST_HEAD (&evlist);
-
-		jack_ringbuffer_get_read_vector (driver->outbound_events, vec);
-
-		a2j_debug ("alsa_out: output thread: got %d+%d events",
-			   (vec[0].len / sizeof(struct a2j_delivery_event)),
-			   (vec[1].len / sizeof(struct a2j_delivery_event)));
+		/* first, take all events from the outbound_events FIFO */
 
-		ev = (struct a2j_delivery_event*)vec[0].buf;
-		limit = vec[0].len / sizeof(struct a2j_delivery_event);
-		for (i = 0; i < limit; ++i) {
-			list_add_tail (&ev->siblings, &evlist);
-			ev++;
-		}
-
-		ev = (struct a2j_delivery_event*)vec[1].buf;
-		limit = vec[1].len / sizeof(struct a2j_delivery_event);
-		for (i = 0; i < limit; ++i) {
-			list_add_tail (&ev->siblings, &evlist);
-			ev++;
-		}
+		a2j_fetch_outbound (driver);
 
-		if (vec[0].len < sizeof(struct a2j_delivery_event) && (vec[1].len == 0)) {
+		if (driver->out_heap_len == 0) {
 			/* no events: wait for some */
-			a2j_debug ("alsa_out: output thread: wait for events");
-			sem_wait (&driver->output_semaphore);
-			a2j_debug ("alsa_out: output thread: AWAKE ... loop back for events");
+			a2j_output_wait (driver, A2J_OUTPUT_IDLE);
 			continue;
 		}
 
-		/* now sort this list by time */
+		/* now deliver, in time order, everything that is due (or
+		   due within a millisecond) with a single drain */
 
-		list_sort (&evlist, struct a2j_delivery_event, siblings, time_sorter);
+		slack = jack_get_sample_rate (driver->jack_client) / 1000;
+		now = jack_frame_time (driver->jack_client);
+		queued = 0;
 
-		/* now deliver */
+		while (driver->out_heap_len > 0) {
+			ev = &driver->out_heap[0];
 
-		sr = jack_get_sample_rate (driver->jack_client);
-
-		list_for_each (node_ptr, &evlist){
-			ev = list_entry (node_ptr, struct a2j_delivery_event, siblings);
+			if ((int32_t)(ev->time - (now + slack)) > 0) {
+				break;
+			}
 
 			snd_seq_ev_clear (&alsa_event);
 			snd_midi_event_reset_encode (str->codec);
 			if (!snd_midi_event_encode (str->codec, (const unsigned char*)ev->midistring, ev->jack_event.size, &alsa_event)) {
 				a2j_debug ("alsa_out: invalid event of size %d, ignored\n", ev->jack_event.size);
+				a2j_heap_pop (driver);
 				continue; // invalid event
 			}
 
@@ -523,47 +675,31 @@ alsa_output_thread (void * arg)
 			snd_seq_ev_set_dest (&alsa_event, ev->port->remote.client, ev->port->remote.port);
 			snd_seq_ev_set_direct (&alsa_event);
 
-			now = jack_frame_time (driver->jack_client);
-
-			ev->time += driver->cycle_start;
-
-			a2j_debug ("alsa_out:@ %d, next event @ %d", now, ev->time);
-
-			/* do we need to wait a while before delivering? */
-
-			if (ev->time > now) {
-				struct timespec nanoseconds;
-				jack_nframes_t sleep_frames = ev->time - now;
-				float seconds = sleep_frames / sr;
+			a2j_debug ("alsa_out:@ %d, event @ %d, %d bytes to %s", now, ev->time,
+				   ev->jack_event.size, ev->port->name);
 
-				/* if the gap is long enough, sleep */
+			if (snd_seq_event_output (driver->seq, &alsa_event) < 0) {
+				a2j_debug ("alsa_out: cannot queue event for %s", ev->port->name);
+			} else {
+				queued++;
+			}
 
-				if (seconds > 0.001) {
-					nanoseconds.tv_sec = (time_t)seconds;
-					nanoseconds.tv_nsec = (long)NSEC_PER_SEC * (seconds - nanoseconds.tv_sec);
+			a2j_heap_pop (driver);
+		}
 
-					a2j_debug ("alsa_out: output thread sleeps for %.2f msec", ((double)nanoseconds.tv_nsec / NSEC_PER_SEC) * 1000.0);
+		/* its time to deliver */
 
-					if (nanosleep (&nanoseconds, NULL) < 0) {
-						fprintf (stderr, "BAD SLEEP\n");
-						/* do something ? */
-					}
-				}
-			}
-
-			/* its time to deliver */
-			snd_seq_event_output (driver->seq, &alsa_event);
+		if (queued) {
 			snd_seq_drain_output (driver->seq);
-			now = jack_frame_time (driver->jack_client);
-			a2j_debug ("alsa_out: written %d bytes to %s at %d, DELTA = %d", ev->jack_event.size, ev->port->name, now,
-				   (int32_t)(now - ev->time));
+			a2j_debug ("alsa_out: delivered %d events, DELTA = %d", queued,
+				   (int32_t)(jack_frame_time (driver->jack_client) - now));
 		}
 
-		/* free up space in the FIFO */
-
-		jack_ringbuffer_read_advance (driver->outbound_events, vec[0].len + vec[1].len);
+		/* and sleep until the next one is due, unless more arrive */
 
-		/* and head back for more */
+		if (driver->out_heap_len > 0) {
+			a2j_output_wait (driver, (int64_t)(driver->out_heap[0].time - slack));
+		}
 	}
 
 	return (void*)0;
@@ -582,6 +718,8 @@ a2j_jack_process_internal (alsa_midi_driver_t* driver, int dir, jack_nframes_t n
 	struct a2j_port ** port_ptr_ptr;
 	struct a2j_port * port_ptr;
 	int nevents = 0;
+	int ndeleted = 0;
+	jack_nframes_t earliest = driver->cycle_start + nframes;
 
 	stream_ptr = &driver->stream[dir];
 	a2j_add_ports (stream_ptr);
@@ -598,7 +736,7 @@ a2j_jack_process_internal (alsa_midi_driver_t* driver, int dir, jack_nframes_t n
 				if (dir == A2J_PORT_CAPTURE) {
 					a2j_process_incoming (driver, port_ptr, nframes);
 				} else {
-					nevents += a2j_process_outgoing (driver, port_ptr);
+					nevents += a2j_process_outgoing (driver, port_ptr, &earliest);
 				}
 
 			} else if (jack_ringbuffer_write_space (driver->port_del) >= sizeof(port_ptr)) {
@@ -606,7 +744,7 @@ a2j_jack_process_internal (alsa_midi_driver_t* driver, int dir, jack_nframes_t n
 				a2j_debug ("jack: removed port %s", port_ptr->name);
 				*port_ptr_ptr = port_ptr->next;
 				jack_ringbuffer_write (driver->port_del, (char*)&port_ptr, sizeof(port_ptr));
-				nevents += 1; /* wake up output thread, see: a2j_free_ports */
+				ndeleted += 1; /* wake up output thread, see: a2j_free_ports */
 				continue;
 
 			}
@@ -615,14 +753,13 @@ a2j_jack_process_internal (alsa_midi_driver_t* driver, int dir, jack_nframes_t n
 		}
 	}
 
-	if (dir == A2J_PORT_PLAYBACK &&  nevents > 0) {
-		int sv;
+	if (dir == A2J_PORT_PLAYBACK &&
+	    (ndeleted > 0 || (nevents > 0 && a2j_output_wants_wakeup (driver, earliest)))) {
 
-		/* if we queued up anything for output, tell the output thread in
-		   case its waiting for us.
+		/* if we queued up anything for output that is due before the
+		   output thread would wake up by itself, tell it.
 		 */
 
-		sem_getvalue (&driver->output_semaphore, &sv);
 		sem_post (&driver->output_semaphore);
 	}
 }
@@ -663,6 +800,7 @@ alsa_midi_start (alsa_midi_driver_t* driver)
 		a2j_error ("cannot start ALSA input thread");
 		return -1;
 	}
+	jack_thread_set_cpus (driver->alsa_input_thread, jack_realtime_cpus ());
 
 	/* wake the poll loop in the alsa input thread so initial ports are fetched */
 	if ((error = snd_seq_connect_from (driver->seq, driver->port_id, SND_SEQ_CLIENT_SYSTEM, SND_SEQ_PORT_SYSTEM_ANNOUNCE)) < 0) {
@@ -674,6 +812,7 @@ alsa_midi_start (alsa_midi_driver_t* driver)
 		a2j_error ("cannot start ALSA output thread");
 		return -1;
 	}
+	jack_thread_set_cpus (driver->alsa_output_thread, jack_realtime_cpus ());
 
 	return 0;
 }
@@ -702,6 +841,14 @@ alsa_midi_attach (alsa_midi_driver_t* driver, jack_engine_t* engine)
 		return -1;
 	}
 
+	driver->out_heap_size = MAX_EVENT_SIZE * 16;
+	driver->out_heap_len = 0;
+	driver->out_heap = malloc (driver->out_heap_size * sizeof(struct a2j_delivery_event));
+	if (driver->out_heap == NULL) {
+		return -1;
+	}
+	driver->output_wake_at = A2J_OUTPUT_AWAKE;
+
 	if (!a2j_stream_init (driver, A2J_PORT_CAPTURE)) {
 		return -1;
 	}
@@ -781,6 +928,9 @@ alsa_midi_driver_new (jack_client_t *client, const char *name)
 	driver->start = (JackDriverStartFunction)alsa_midi_start;
 	driver->stop = (JackDriverStartFunction)alsa_midi_stop;
 
+	/* read and write only touch our own ports and ringbuffers */
+	driver->parallel_io = 1;
+
 	driver->jack_client = client;
 
 	if (sem_init (&driver->output_semaphore, 0, 0) < 0) {
@@ -789,6 +939,8 @@ alsa_midi_driver_new (jack_client_t *client, const char *name)
 		return NULL;
 	}
 
+	pthread_mutex_init (&driver->port_lock, NULL);
+
 	return (jack_driver_t*)driver;
 }
 
@@ -801,9 +953,11 @@ alsa_midi_driver_delete (alsa_midi_driver_t* driver)
 	a2j_stream_close (driver, A2J_PORT_PLAYBACK);
 
 	sem_destroy (&driver->output_semaphore);
+	pthread_mutex_destroy (&driver->port_lock);
 
 	jack_ringbuffer_free (driver->outbound_events);
 	jack_ringbuffer_free (driver->port_del);
+	free (driver->out_heap);
 }
 
 /* DRIVER "PLUGIN" INTERFACE */
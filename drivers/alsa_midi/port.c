@@ -70,15 +70,21 @@ a2j_alsa_connect_from (alsa_midi_driver_t * driver, int client, int port)
 }
 
 void
-a2j_port_setdead (a2j_port_hash_t hash, snd_seq_addr_t addr)
+a2j_port_setdead (alsa_midi_driver_t * driver, int dir, snd_seq_addr_t addr)
 {
-	struct a2j_port *port = a2j_port_get (hash, addr);
+	struct a2j_port *port;
+
+	pthread_mutex_lock (&driver->port_lock);
+
+	port = a2j_port_index_by_addr (&driver->stream[dir], addr);
 
 	if (port) {
 		port->is_dead = true; // see jack_process_internal
 	} else {
 		a2j_debug ("port_setdead: not found (%d:%d)", addr.client, addr.port);
 	}
+
+	pthread_mutex_unlock (&driver->port_lock);
 }
 
 void
@@ -184,13 +190,16 @@ a2j_port_create (alsa_midi_driver_t * driver, int dir, snd_seq_addr_t addr, cons
 	}
 
 	port->driver_ptr = driver;
+	port->dir = dir;
 	port->jack_port = JACK_INVALID_PORT;
 	port->remote = addr;
 
 	a2j_port_fill_name (port, dir, client_info_ptr, info, false);
 
-	/* Add port to list early, before registering to JACK, so map functionality is guaranteed to work during port registration */
-	list_add_tail (&port->siblings, &stream_ptr->list);
+	/* Add port to the index early, before registering to JACK, so map functionality is guaranteed to work during port registration */
+	pthread_mutex_lock (&driver->port_lock);
+	a2j_port_index_insert (stream_ptr, port);
+	pthread_mutex_unlock (&driver->port_lock);
 
 	if (dir == A2J_PORT_CAPTURE) {
 		jack_caps = JackPortIsOutput;
@@ -226,7 +235,9 @@ a2j_port_create (alsa_midi_driver_t * driver, int dir, snd_seq_addr_t addr, cons
 	return port;
 
 fail_free_port:
-	list_del (&port->siblings);
+	pthread_mutex_lock (&driver->port_lock);
+	a2j_port_index_remove (stream_ptr, port);
+	pthread_mutex_unlock (&driver->port_lock);
 
 	a2j_port_free (port);
 
@@ -23,7 +23,7 @@
 #define PORT_H__757ADD0F_5E53_41F7_8B7F_8119C5E8A9F1__INCLUDED
 
 struct a2j_port* a2j_port_create(alsa_midi_driver_t* driver, int dir, snd_seq_addr_t addr, const snd_seq_port_info_t * info);
-void a2j_port_setdead(a2j_port_hash_t hash, snd_seq_addr_t addr);
+void a2j_port_setdead(alsa_midi_driver_t* driver, int dir, snd_seq_addr_t addr);
 void a2j_port_free(struct a2j_port * port);
 
 #endif /* #ifndef PORT_H__757ADD0F_5E53_41F7_8B7F_8119C5E8A9F1__INCLUDED */
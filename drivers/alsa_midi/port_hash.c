@@ -20,6 +20,7 @@
  */
 
 #include <stdbool.h>
+#include <string.h>
 #include <semaphore.h>
 #include <alsa/asoundlib.h>
 #include <jack/jack.h>
@@ -64,3 +65,108 @@ a2j_port_insert (
 	port->next = *pport;
 	*pport = port;
 }
+
+/*
+ * The port thread's index: each stream's ports hashed on their ALSA
+ * address and on their JACK port name, so that port updates, input
+ * events and port removal find a port without walking every port of
+ * the stream. Callers hold the driver's port_lock.
+ */
+
+static inline
+unsigned int
+a2j_port_index_addr_hash (
+	snd_seq_addr_t addr)
+{
+	unsigned int key = ((unsigned int)addr.client << 8) | addr.port;
+
+	return (key * 2654435761u) >> (32 - PORT_INDEX_BITS);
+}
+
+static inline
+unsigned int
+a2j_port_index_name_hash (
+	const char * name)
+{
+	unsigned int h = 2166136261u;
+
+	while (*name) {
+		h = (h ^ (unsigned char)*name++) * 16777619u;
+	}
+	return h & (PORT_INDEX_SIZE - 1);
+}
+
+void
+a2j_port_index_insert (
+	struct a2j_stream * stream_ptr,
+	struct a2j_port * port)
+{
+	struct a2j_port **pport;
+
+	pport = &stream_ptr->addr_index[a2j_port_index_addr_hash (port->remote)];
+	port->addr_next = *pport;
+	*pport = port;
+
+	pport = &stream_ptr->name_index[a2j_port_index_name_hash (port->name)];
+	port->name_next = *pport;
+	*pport = port;
+}
+
+void
+a2j_port_index_remove (
+	struct a2j_stream * stream_ptr,
+	struct a2j_port * port)
+{
+	struct a2j_port **pport;
+
+	pport = &stream_ptr->addr_index[a2j_port_index_addr_hash (port->remote)];
+	while (*pport) {
+		if (*pport == port) {
+			*pport = port->addr_next;
+			break;
+		}
+		pport = &(*pport)->addr_next;
+	}
+
+	pport = &stream_ptr->name_index[a2j_port_index_name_hash (port->name)];
+	while (*pport) {
+		if (*pport == port) {
+			*pport = port->name_next;
+			break;
+		}
+		pport = &(*pport)->name_next;
+	}
+}
+
+/* a port that is dead but not yet freed may share its address with
+   the one that replaced it, so only live ports are found */
+
+struct a2j_port *
+a2j_port_index_by_addr (
+	struct a2j_stream * stream_ptr,
+	snd_seq_addr_t addr)
+{
+	struct a2j_port *port = stream_ptr->addr_index[a2j_port_index_addr_hash (addr)];
+
+	for (; port; port = port->addr_next) {
+		if (port->remote.client == addr.client && port->remote.port == addr.port && !port->is_dead) {
+			return port;
+		}
+	}
+	return NULL;
+}
+
+struct a2j_port *
+a2j_port_index_by_name (
+	struct a2j_stream * stream_ptr,
+	const char * name)
+{
+	struct a2j_port *port = stream_ptr->name_index[a2j_port_index_name_hash (name)];
+
+	for (; port; port = port->name_next) {
+		if (strcmp (port->name, name) == 0 && !port->is_dead) {
+			return port;
+		}
+	}
+	return NULL;
+}
@@ -32,4 +32,24 @@ a2j_port_get(
 	a2j_port_hash_t hash,
 	snd_seq_addr_t addr);
 
+void
+a2j_port_index_insert(
+	struct a2j_stream * stream_ptr,
+	struct a2j_port * port);
+
+void
+a2j_port_index_remove(
+	struct a2j_stream * stream_ptr,
+	struct a2j_port * port);
+
+struct a2j_port *
+a2j_port_index_by_addr(
+	struct a2j_stream * stream_ptr,
+	snd_seq_addr_t addr);
+
+struct a2j_port *
+a2j_port_index_by_name(
+	struct a2j_stream * stream_ptr,
+	const char * name);
+
 #endif /* #ifndef PORT_HASH_H__A44CBCD6_E075_49CB_8F73_DF9772511D55__INCLUDED */
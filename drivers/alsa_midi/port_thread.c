@@ -31,22 +31,14 @@
 #include "port_hash.h"
 #include "port_thread.h"
 
+/* the caller holds driver->port_lock */
+
 struct a2j_port *
 a2j_find_port_by_addr (
 	struct a2j_stream * stream_ptr,
 	snd_seq_addr_t addr)
 {
-	struct list_head * node_ptr;
-	struct a2j_port * port_ptr;
-
-	list_for_each (node_ptr, &stream_ptr->list){
-		port_ptr = list_entry (node_ptr, struct a2j_port, siblings);
-		if (port_ptr->remote.client == addr.client && port_ptr->remote.port == addr.port) {
-			return port_ptr;
-		}
-	}
-
-	return NULL;
+	return a2j_port_index_by_addr (stream_ptr, addr);
 }
 
 struct a2j_port *
@@ -54,17 +46,7 @@ a2j_find_port_by_jack_port_name (
 	struct a2j_stream * stream_ptr,
 	const char * jack_port)
 {
-	struct list_head * node_ptr;
-	struct a2j_port * port_ptr;
-
-	list_for_each (node_ptr, &stream_ptr->list){
-		port_ptr = list_entry (node_ptr, struct a2j_port, siblings);
-		if (strcmp (port_ptr->name, jack_port) == 0) {
-			return port_ptr;
-		}
-	}
-
-	return NULL;
+	return a2j_port_index_by_name (stream_ptr, jack_port);
 }
 
 /*
@@ -82,7 +64,6 @@ a2j_update_port_type (alsa_midi_driver_t * driver, int dir, snd_seq_addr_t addr,
 	a2j_debug ("update_port_type(%d:%d)", addr.client, addr.port);
 
 	stream_ptr = &driver->stream[dir];
-	port_ptr = a2j_find_port_by_addr (stream_ptr, addr);
 
 	if (dir == A2J_PORT_CAPTURE) {
 		alsa_mask = SND_SEQ_PORT_CAP_SUBS_READ;
@@ -90,11 +71,20 @@ a2j_update_port_type (alsa_midi_driver_t * driver, int dir, snd_seq_addr_t addr,
 		alsa_mask = SND_SEQ_PORT_CAP_SUBS_WRITE;
 	}
 
+	pthread_mutex_lock (&driver->port_lock);
+
+	port_ptr = a2j_find_port_by_addr (stream_ptr, addr);
+
 	if (port_ptr != NULL && (caps & alsa_mask) != alsa_mask) {
 		a2j_debug ("setdead: %s", port_ptr->name);
 		port_ptr->is_dead = true;
 	}
 
+	pthread_mutex_unlock (&driver->port_lock);
+
+	/* only this thread creates ports, so nobody can have added
+	   one since we looked */
+
 	if (port_ptr == NULL && (caps & alsa_mask) == alsa_mask) {
 		if (jack_ringbuffer_write_space (stream_ptr->new_ports) >= sizeof(port_ptr)) {
 			port_ptr = a2j_port_create (driver, dir, addr, info);
@@ -200,7 +190,9 @@ a2j_free_ports (alsa_midi_driver_t * driver)
 	while ((sz = jack_ringbuffer_read (driver->port_del, (char*)&port, sizeof(port)))) {
 		assert (sz == sizeof(port));
 		a2j_debug ("port deleted: %s", port->name);
-		list_del (&port->siblings);
+		pthread_mutex_lock (&driver->port_lock);
+		a2j_port_index_remove (&driver->stream[port->dir], port);
+		pthread_mutex_unlock (&driver->port_lock);
 		a2j_port_free (port);
 	}
 }
@@ -220,8 +212,8 @@ a2j_update_ports (alsa_midi_driver_t * driver, snd_seq_addr_t addr)
 		a2j_update_port (driver, addr, info);
 	} else {
 		a2j_debug ("setting dead: %d:%d", addr.client, addr.port);
-		a2j_port_setdead (driver->stream[A2J_PORT_CAPTURE].port_hash, addr);
-		a2j_port_setdead (driver->stream[A2J_PORT_PLAYBACK].port_hash, addr);
+		a2j_port_setdead (driver, A2J_PORT_CAPTURE, addr);
+		a2j_port_setdead (driver, A2J_PORT_PLAYBACK, addr);
 	}
 }
 
@@ -18,8 +18,12 @@
  *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
  */
 
+#include <config.h>
+
 /* Required for clock_nanosleep(). Thanks, Nedko */
+#ifndef _GNU_SOURCE
 #define _GNU_SOURCE
+#endif
 
 #include "alsa_midi.h"
 #include <stdlib.h>
@@ -29,6 +33,7 @@
 #include <time.h>
 #include <limits.h>
 #include <ctype.h>
+#include <sys/inotify.h>
 #include <alsa/asoundlib.h>
 #include <jack/thread.h>
 #include <jack/ringbuffer.h>
@@ -43,6 +48,9 @@
 #include "messagebuffer.h"
 #endif
 
+/* in libjack/ringbuffer.c, until <jack/ringbuffer.h> has it */
+extern jack_ringbuffer_t *jack_ringbuffer_create_mirrored (size_t sz);
+
 #define info_log(...)  MESSAGE (__VA_ARGS__)
 #define error_log(...) MESSAGE (__VA_ARGS__)
 
@@ -90,6 +98,12 @@ typedef struct {
 } alsa_id_t;
 
 
+/*
+ * Input events carry the time the bytes arrived, in usecs on the
+ * jack_get_time() clock; the jack thread maps it to a frame offset
+ * once it knows where the cycle falls. Output events carry the frame
+ * time they are due at.
+ */
 typedef struct {
 	jack_time_t time;
 	int size;
@@ -123,8 +137,15 @@ typedef struct input_port_t {
 	// jack
 	midi_unpack_t unpack;
 
+	int late;               // events clamped to the start of the cycle
+	int early;              // events clamped to its end
+
 	// midi
 	int overruns;
+	int tstamp;             // reads come with kernel timestamps
+	unsigned long events;
+	jack_time_t delay_sum;  // between arrival and our read, usecs
+	jack_time_t delay_max;
 } input_port_t;
 
 typedef struct output_port_t {
@@ -146,6 +167,11 @@ typedef struct {
 	void *buffer;
 	jack_time_t frame_time;
 	jack_nframes_t nframes;
+
+	// where this cycle falls on the jack_get_time() clock
+	jack_nframes_t cycle_frames;
+	jack_time_t cycle_usecs;
+	jack_time_t next_usecs;
 } process_jack_t;
 
 typedef struct {
@@ -495,7 +521,9 @@ int midi_port_open (const alsa_rawmidi_t *midi, midi_port_t *port)
 	if ((port->event_ring = jack_ringbuffer_create (MAX_EVENTS * sizeof(event_head_t))) == NULL) {
 		return 3;
 	}
-	if ((port->data_ring = jack_ringbuffer_create (MAX_DATA)) == NULL) {
+	/* mirrored, so that ALSA reads and writes whole spans at once */
+	if ((port->data_ring = jack_ringbuffer_create_mirrored (MAX_DATA)) == NULL
+	    && (port->data_ring = jack_ringbuffer_create (MAX_DATA)) == NULL) {
 		return 4;
 	}
 
@@ -578,30 +606,25 @@ void scan_cleanup (alsa_rawmidi_t *midi)
 static void scan_card(scan_t *scan);
 static midi_port_t** scan_port_open(alsa_rawmidi_t *midi, midi_port_t **list);
 
-void scan_cycle (alsa_rawmidi_t *midi)
+static
+void scan_card_ports (scan_t *scan, int card)
 {
-	int card = -1, err;
-	scan_t scan;
-	midi_port_t **ports;
-
-	//debug_log("scan: cleanup");
-	scan_cleanup (midi);
-
-	scan.midi = midi;
-	scan.iterator = &midi->scan.ports;
-	snd_rawmidi_info_alloca (&scan.info);
+	char name[32];
+	int err;
 
-	//debug_log("scan: rescan");
-	while ((err = snd_card_next (&card)) >= 0 && card >= 0) {
-		char name[32];
-		snprintf (name, sizeof(name), "hw:%d", card);
-		if ((err = snd_ctl_open (&scan.ctl, name, SND_CTL_NONBLOCK)) >= 0) {
-			scan_card (&scan);
-			snd_ctl_close (scan.ctl);
-		} else {
-			alsa_error ("scan: snd_ctl_open", err);
-		}
+	snprintf (name, sizeof(name), "hw:%d", card);
+	if ((err = snd_ctl_open (&scan->ctl, name, SND_CTL_NONBLOCK)) >= 0) {
+		scan_card (scan);
+		snd_ctl_close (scan->ctl);
+	} else {
+		alsa_error ("scan: snd_ctl_open", err);
 	}
+}
+
+static
+void scan_open_ports (alsa_rawmidi_t *midi)
+{
+	midi_port_t **ports;
 
 	// delayed open to workaround alsa<1.0.14 bug (can't open more than 1 subdevice if ctl is opened).
 	ports = &midi->scan.ports;
@@ -615,6 +638,47 @@ void scan_cycle (alsa_rawmidi_t *midi)
 	}
 }
 
+void scan_cycle (alsa_rawmidi_t *midi)
+{
+	int card = -1;
+	scan_t scan;
+
+	//debug_log("scan: cleanup");
+	scan_cleanup (midi);
+
+	scan.midi = midi;
+	scan.iterator = &midi->scan.ports;
+	snd_rawmidi_info_alloca (&scan.info);
+
+	//debug_log("scan: rescan");
+	while (snd_card_next (&card) >= 0 && card >= 0) {
+		scan_card_ports (&scan, card);
+	}
+
+	scan_open_ports (midi);
+}
+
+/* Rescan one card only: the port list is sorted by card, so the ports
+ * of the others are simply skipped.
+ */
+static
+void scan_cycle_card (alsa_rawmidi_t *midi, int card)
+{
+	scan_t scan;
+
+	scan_cleanup (midi);
+
+	scan.midi = midi;
+	scan.iterator = &midi->scan.ports;
+	snd_rawmidi_info_alloca (&scan.info);
+
+	while (*scan.iterator && (*scan.iterator)->id.id[0] < card)
+		scan.iterator = &(*scan.iterator)->next;
+
+	scan_card_ports (&scan, card);
+	scan_open_ports (midi);
+}
+
 static void scan_device(scan_t *scan);
 
 static
@@ -762,24 +826,102 @@ midi_port_t** scan_port_del (alsa_rawmidi_t *midi, midi_port_t **list)
 	}
 }
 
+/* The cards whose device nodes in /dev/snd were added or changed:
+ * udev creates them on hotplug, and then fixes up their permissions.
+ */
+static
+uint64_t scan_notify_cards (int fd)
+{
+	char buf[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+	const struct inotify_event *ev;
+	uint64_t cards = 0;
+	ssize_t len;
+	char *p;
+	int card, dev;
+
+	while ((len = read (fd, buf, sizeof(buf))) > 0) {
+		for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event*)p;
+			if (!ev->len || (ev->mask & IN_DELETE)) {
+				/* removed ports are noticed by the midi
+				   threads, and come back through the
+				   wake pipe */
+				continue;
+			}
+			if ((sscanf (ev->name, "midiC%dD%d", &card, &dev) == 2
+			     || sscanf (ev->name, "controlC%d", &card) == 1)
+			    && card >= 0 && card < 64) {
+				cards |= (uint64_t)1 << card;
+			}
+		}
+	}
+	return cards;
+}
+
 void* scan_thread (void *arg)
 {
 	alsa_rawmidi_t *midi = arg;
-	struct pollfd wakeup;
+	struct pollfd pfds[2];
+	uint64_t cards;
+	int notify, card;
+
+	/* without inotify, fall back to rescanning everything every
+	   couple of seconds */
+	notify = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+	if (notify >= 0 && inotify_add_watch (notify, "/dev/snd",
+					      IN_CREATE | IN_ATTRIB | IN_DELETE) < 0) {
+		close (notify);
+		notify = -1;
+	}
+	if (notify < 0) {
+		error_log ("scan: cannot watch /dev/snd (%s), polling for devices", strerror (errno));
+	}
+
+	pfds[0].fd = midi->scan.wake_pipe[0];
+	pfds[0].events = POLLIN | POLLERR | POLLNVAL;
+	pfds[1].fd = notify;
+	pfds[1].events = POLLIN;
+	pfds[1].revents = 0;
+
+	scan_cycle (midi);
 
-	wakeup.fd = midi->scan.wake_pipe[0];
-	wakeup.events = POLLIN | POLLERR | POLLNVAL;
 	while (midi->keep_walking) {
 		int res;
-		//error_log("scanning....");
-		scan_cycle (midi);
-		res = poll (&wakeup, 1, 2000);
-		if (res > 0) {
-			char c;
-			read (wakeup.fd, &c, 1);
-		} else if (res < 0 && errno != EINTR) {
+
+		res = poll (pfds, notify >= 0 ? 2 : 1, notify >= 0 ? -1 : 2000);
+		if (res < 0 && errno != EINTR) {
+			break;
+		}
+		if (!midi->keep_walking) {
 			break;
 		}
+		if (notify < 0) {
+			if (res > 0) {
+				char c;
+				read (pfds[0].fd, &c, 1);
+			}
+			scan_cycle (midi);
+			continue;
+		}
+
+		if (res > 0 && (pfds[0].revents & POLLIN)) {
+			/* a port was removed from jack, free it */
+			char c;
+			read (pfds[0].fd, &c, 1);
+			scan_cleanup (midi);
+		}
+		if (res > 0 && (pfds[1].revents & POLLIN)) {
+			cards = scan_notify_cards (notify);
+			for (card = 0; cards; ++card, cards >>= 1) {
+				if (cards & 1) {
+					scan_cycle_card (midi, card);
+				}
+			}
+		}
+	}
+
+	if (notify >= 0) {
+		close (notify);
 	}
 	return NULL;
 }
@@ -823,6 +965,21 @@ void jack_process (midi_stream_t *str, jack_nframes_t nframes)
 		debug_log ("xrun detected: %d periods lost", periods_lost);
 	}
 
+	if (str->mode == POLLIN) {
+		float period_usecs;
+
+		if (jack_get_cycle_times (proc.midi->client, &proc.cycle_frames,
+					  &proc.cycle_usecs, &proc.next_usecs,
+					  &period_usecs)
+		    || proc.next_usecs <= proc.cycle_usecs) {
+			/* no filtered timer yet; map through the nominal rate */
+			proc.cycle_usecs = jack_get_time ();
+			proc.cycle_frames = jack_time_to_frames (proc.midi->client, proc.cycle_usecs);
+			proc.next_usecs = proc.cycle_usecs
+					  + (jack_time_t)nframes * 1000000 / jack_get_sample_rate (proc.midi->client);
+		}
+	}
+
 	// process existing ports
 	for (r = 0, w = 0; r < str->jack.nports; ++r) {
 		midi_port_t *port = str->jack.ports[r];
@@ -837,6 +994,7 @@ void jack_process (midi_stream_t *str, jack_nframes_t nframes)
 
 		if (port->state == PORT_REMOVED_FROM_MIDI) {
 			port->state = PORT_REMOVED_FROM_JACK;   // this signals to scan thread
+			write (str->owner->scan.wake_pipe[1], &r, 1);
 			continue;                               // this effectively removes port from the midi->in.jack.ports[]
 		}
 
@@ -1034,18 +1192,66 @@ int input_port_init (alsa_rawmidi_t *midi, midi_port_t *port)
 	input_port_t *in = (input_port_t*)port;
 
 	midi_unpack_init (&in->unpack);
+	in->tstamp = 0;
+
+#ifdef HAVE_SND_RAWMIDI_TREAD
+	{
+		snd_rawmidi_params_t *params;
+
+		/* let the kernel stamp each byte as it arrives, rather than
+		   us stamping whole reads when the thread gets around to them */
+		snd_rawmidi_params_alloca (&params);
+		if (snd_rawmidi_params_current (port->rawmidi, params) == 0
+		    && snd_rawmidi_params_set_read_mode (port->rawmidi, params, SND_RAWMIDI_READ_TSTAMP) == 0
+		    && snd_rawmidi_params_set_clock_type (port->rawmidi, params, SND_RAWMIDI_CLOCK_MONOTONIC) == 0
+		    && snd_rawmidi_params (port->rawmidi, params) == 0) {
+			in->tstamp = 1;
+		} else {
+			debug_log ("midi_in: no kernel timestamps on %s", port->name);
+		}
+	}
+#endif
 	return 0;
 }
 
 static
 void input_port_close (alsa_rawmidi_t *midi, midi_port_t *port)
 {
+	input_port_t *in = (input_port_t*)port;
+
+	if (in->events == 0) {
+		return;
+	}
+	info_log ("midi_in: %s: %lu events, %s timestamps, read delay avg %d max %d usecs, %d late, %d early",
+		  port->name, in->events, in->tstamp ? "kernel" : "read",
+		  (int)(in->delay_sum / in->events), (int)in->delay_max,
+		  in->late, in->early);
 }
 
 /*
  * Jack-level input.
  */
 
+/*
+ * Place an arrival time within the cycle being processed, which covers
+ * the nframes before p->frame_time. The usecs are turned into frames
+ * along the engine's filtered frame timer, so the offset follows the
+ * actual rate of the card rather than its nominal one. The result
+ * is negative for events that arrived before the cycle, and nframes or
+ * more for any that look to have arrived after it.
+ */
+static inline
+int64_t input_event_offset (const process_jack_t *p, jack_time_t usecs)
+{
+	int64_t frames;
+
+	frames = ((int64_t)usecs - (int64_t)p->cycle_usecs) * p->nframes
+		 / (int64_t)(p->next_usecs - p->cycle_usecs);
+	frames += (int32_t)(p->cycle_frames - (jack_nframes_t)p->frame_time);
+
+	return frames + p->nframes;
+}
+
 static
 void do_jack_input (process_jack_t *p)
 {
@@ -1055,16 +1261,19 @@ void do_jack_input (process_jack_t *p)
 	while (jack_ringbuffer_read_space (port->base.event_ring) >= sizeof(event)) {
 		jack_ringbuffer_data_t vec[2];
 		jack_nframes_t time;
+		int64_t offset;
 		int i, todo;
 
 		jack_ringbuffer_read (port->base.event_ring, (char*)&event, sizeof(event));
-		// TODO: take into account possible warping
-		if ((event.time + p->nframes) < p->frame_time) {
+		offset = input_event_offset (p, event.time);
+		if (offset < 0) {
+			port->late++;
 			time = 0;
-		} else if (event.time >= p->frame_time) {
+		} else if (offset >= p->nframes) {
+			port->early++;
 			time = p->nframes - 1;
 		} else {
-			time = event.time + p->nframes - p->frame_time;
+			time = (jack_nframes_t)offset;
 		}
 
 		jack_ringbuffer_get_read_vector (port->base.data_ring, vec);
@@ -1091,6 +1300,79 @@ void do_jack_input (process_jack_t *p)
 /*
  * Low level input.
  */
+
+/* Hand `size' bytes already in the data ring, which arrived at `time',
+   to the jack thread. */
+static
+void input_port_queue (input_port_t *port, int size, jack_time_t time, jack_time_t now)
+{
+	event_head_t event;
+	jack_time_t delay = now > time ? now - time : 0;
+
+	event.time = time;
+	event.size = size;
+	event.overruns = port->overruns;
+	port->overruns = 0;
+	debug_log ("midi_in: read %d bytes at %d", (int)event.size, (int)event.time);
+	jack_ringbuffer_write_advance (port->base.data_ring, event.size);
+	jack_ringbuffer_write (port->base.event_ring, (char*)&event, sizeof(event));
+
+	port->events++;
+	port->delay_sum += delay;
+	if (delay > port->delay_max) {
+		port->delay_max = delay;
+	}
+}
+
+#ifdef HAVE_SND_RAWMIDI_TREAD
+/*
+ * Read everything pending, one kernel-stamped chunk at a time. Each
+ * chunk shares a timestamp, so it becomes one event. The stamps are on
+ * CLOCK_MONOTONIC; they are moved onto the jack_get_time() clock by the
+ * difference between the two, taken once per call.
+ */
+static
+int midi_tread (input_port_t *port)
+{
+	struct timespec mono;
+	jack_time_t now, mono_now;
+
+	clock_gettime (CLOCK_MONOTONIC, &mono);
+	now = jack_get_time ();
+	mono_now = (jack_time_t)mono.tv_sec * 1000000 + mono.tv_nsec / 1000;
+
+	for (;;) {
+		jack_ringbuffer_data_t vec[2];
+		struct timespec ts;
+		jack_time_t stamp;
+		ssize_t res;
+
+		jack_ringbuffer_get_write_vector (port->base.data_ring, vec);
+		if (jack_ringbuffer_write_space (port->base.event_ring) < sizeof(event_head_t) || vec[0].len < 1) {
+			port->overruns++;
+			port->base.npfds = 0;
+			return 1;
+		}
+
+		res = snd_rawmidi_tread (port->base.rawmidi, &ts, vec[0].buf, vec[0].len);
+		if (res == -EWOULDBLOCK || res == -EAGAIN || res == 0) {
+			return 1;
+		} else if (res < 0) {
+			error_log ("midi_in: reading from port %s failed: %s", port->base.name, snd_strerror (res));
+			return 0;
+		}
+
+		stamp = (jack_time_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+		if (stamp == 0 || stamp > mono_now) {
+			stamp = now;            /* not stamped, or stamped oddly */
+		} else {
+			stamp = now - (mono_now - stamp);
+		}
+		input_port_queue (port, res, stamp, now);
+	}
+}
+#endif
+
 static
 int do_midi_input (process_midi_t *proc)
 {
@@ -1114,23 +1396,28 @@ int do_midi_input (process_midi_t *proc)
 			port->base.npfds = 0;
 			return 1;
 		}
+#ifdef HAVE_SND_RAWMIDI_TREAD
+		if (port->tstamp) {
+			if (!midi_tread (port)) {
+				return 0;
+			}
+			port->base.is_ready = 0;
+			goto done;
+		}
+#endif
 		res = snd_rawmidi_read (port->base.rawmidi, vec[0].buf, vec[0].len);
 		if (res < 0 && res != -EWOULDBLOCK) {
 			error_log ("midi_in: reading from port %s failed: %s", port->base.name, snd_strerror (res));
 			return 0;
 		} else if (res > 0) {
-			event_head_t event;
-			event.time = proc->cur_time;
-			event.size = res;
-			event.overruns = port->overruns;
-			port->overruns = 0;
-			debug_log ("midi_in: read %d bytes at %d", (int)event.size, (int)event.time);
-			jack_ringbuffer_write_advance (port->base.data_ring, event.size);
-			jack_ringbuffer_write (port->base.event_ring, (char*)&event, sizeof(event));
+			input_port_queue (port, res, jack_get_time (), jack_get_time ());
 		}
 		port->base.is_ready = 0;
 	}
 
+#ifdef HAVE_SND_RAWMIDI_TREAD
+done:
+#endif
 	if (!midi_update_pfds (proc)) {
 		return 0;
 	}
@@ -306,6 +306,7 @@ static OSStatus render (void *inRefCon,
 {
 	int res, i;
 	JSList *node;
+	jack_port_t *port;
 	coreaudio_driver_t* ca_driver = (coreaudio_driver_t*)inRefCon;
 
 	AudioUnitRender (ca_driver->au_hal, ioActionFlags, inTimeStamp, 1, inNumberFrames, ca_driver->input_list);
@@ -324,15 +325,24 @@ static OSStatus render (void *inRefCon,
 		res = ca_driver->engine->run_cycle (ca_driver->engine, inNumberFrames, 0);
 	}
 
+	/* hand the port buffers themselves to the output unit instead of
+	   copying them into the ones it offered; unconnected channels and
+	   null cycles get the shared silent buffer */
 	if (ca_driver->null_cycle_occured) {
 		ca_driver->null_cycle_occured = 0;
-		for (i = 0; i < ca_driver->playback_nchannels; i++)
-			memset ((float*)ioData->mBuffers[i].mData, 0, sizeof(float) * inNumberFrames);
+		for (i = 0; i < ca_driver->playback_nchannels; i++) {
+			ioData->mBuffers[i].mData = ca_driver->silence_buffer;
+			ioData->mBuffers[i].mDataByteSize = sizeof(float) * inNumberFrames;
+		}
 	} else {
 		for (i = 0, node = ca_driver->playback_ports; i < ca_driver->playback_nchannels; i++, node = jack_slist_next (node)) {
-			memcpy ((float*)ioData->mBuffers[i].mData,
-				(jack_default_audio_sample_t*)jack_port_get_buffer (((jack_port_t*)node->data), inNumberFrames),
-				sizeof(float) * inNumberFrames);
+			port = (jack_port_t*)node->data;
+			if (jack_port_connected (port)) {
+				ioData->mBuffers[i].mData = jack_port_get_buffer (port, inNumberFrames);
+			} else {
+				ioData->mBuffers[i].mData = ca_driver->silence_buffer;
+			}
+			ioData->mBuffers[i].mDataByteSize = sizeof(float) * inNumberFrames;
 		}
 	}
 
@@ -599,13 +609,51 @@ coreaudio_driver_write (coreaudio_driver_t * driver, jack_nframes_t nframes)
 	return 0;
 }
 
+/* Hand the device's IO workgroup to the threads that work in the
+ * cycle besides ours, see libjack/workgroup.c; none while stopped.
+ */
+static void coreaudio_driver_publish_workgroup (coreaudio_driver_t * driver, int running)
+{
+#ifdef JACK_USE_OS_WORKGROUP
+	if (driver->engine == 0) {
+		return;
+	}
+
+	if (__builtin_available (macOS 11.0, *)) {
+		os_workgroup_t workgroup = NULL;
+		AudioObjectPropertyAddress address = {
+			kAudioDevicePropertyIOThreadOSWorkgroup,
+			kAudioObjectPropertyScopeGlobal,
+			kAudioObjectPropertyElementMaster
+		};
+		UInt32 size = sizeof(workgroup);
+
+		if (running && AudioObjectGetPropertyData (driver->device_id, &address, 0, NULL, &size, &workgroup) != noErr) {
+			JCALog ("AudioObjectGetPropertyData kAudioDevicePropertyIOThreadOSWorkgroup error \n");
+			workgroup = NULL;
+		}
+
+		jack_workgroup_publish (driver->engine->control, workgroup);
+
+		if (workgroup) {
+			os_release (workgroup);
+		}
+	}
+#endif
+}
+
 static int coreaudio_driver_audio_start (coreaudio_driver_t * driver)
 {
-	return (AudioOutputUnitStart (driver->au_hal) == noErr) ? 0 : -1;
+	if (AudioOutputUnitStart (driver->au_hal) != noErr) {
+		return -1;
+	}
+	coreaudio_driver_publish_workgroup (driver, TRUE);
+	return 0;
 }
 
 static int coreaudio_driver_audio_stop (coreaudio_driver_t * driver)
 {
+	coreaudio_driver_publish_workgroup (driver, FALSE);
 	return (AudioOutputUnitStop (driver->au_hal) == noErr) ? 0 : -1;
 }
 
@@ -969,6 +1017,13 @@ static jack_driver_t *coreaudio_driver_new (char* name,
 		}
 	}
 
+	if (playing && outchannels > 0) {
+		driver->silence_buffer = (float*)calloc (nframes, sizeof(float));
+		if (driver->silence_buffer == 0) {
+			goto error;
+		}
+	}
+
 	if (capturing && inchannels > 0) {
 		driver->input_list = (AudioBufferList*)malloc (sizeof(UInt32) + inchannels * sizeof(AudioBuffer));
 		if (driver->input_list == 0) {
@@ -1013,6 +1068,7 @@ static void coreaudio_driver_delete (coreaudio_driver_t * driver)
 {
 	AudioDeviceRemovePropertyListener (driver->device_id, 0, true, kAudioDeviceProcessorOverload, notification);
 	free (driver->input_list);
+	free (driver->silence_buffer);
 	AudioUnitUninitialize (driver->au_hal);
 	CloseComponent (driver->au_hal);
 	free (driver);
@@ -61,6 +61,7 @@ typedef struct {
 
 	AudioUnit au_hal;
 	AudioBufferList* input_list;
+	float* silence_buffer;
 	AudioDeviceID device_id;
 	int state;
 
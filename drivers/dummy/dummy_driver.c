@@ -19,6 +19,8 @@
 
  */
 
+#include <config.h>
+
 #include <math.h>
 #include <stdio.h>
 #include <memory.h>
@@ -26,7 +28,11 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <string.h>
 #include <sys/mman.h>
+#ifdef HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#endif
 
 #include <jack/types.h>
 #include "internal.h"
@@ -88,21 +94,122 @@ static inline struct timespec nsec_to_ts (unsigned long long nsecs)
 	return ts;
 }
 
-static inline struct timespec add_ts (struct timespec ts, unsigned int usecs)
+static inline unsigned long long dummy_now (void)
 {
-	unsigned long long nsecs = ts_to_nsec (ts);
+	struct timespec now;
 
-	nsecs += usecs * 1000LL;
-	return nsec_to_ts (nsecs);
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return ts_to_nsec (now);
 }
 
-static inline int cmp_lt_ts (struct timespec ts1, struct timespec ts2)
+/* when cycle number driver->cycles should start */
+static unsigned long long
+dummy_driver_deadline (dummy_driver_t *driver)
 {
-	if (ts1.tv_sec < ts2.tv_sec) {
-		return 1;
-	} else if (ts1.tv_sec == ts2.tv_sec && ts1.tv_nsec < ts2.tv_nsec) {
-		return 1;
-	} else { return 0; }
+	unsigned long long frames;
+
+	if (driver->wait_time_set) {
+		return driver->start_nsecs + driver->cycles * driver->wait_time * 1000LL;
+	}
+
+	/* split, so that this does not overflow in a long run */
+	frames = driver->cycles * driver->period_size;
+	return driver->start_nsecs
+	       + (frames / driver->sample_rate) * 1000000000LL
+	       + (frames % driver->sample_rate) * 1000000000LL / driver->sample_rate;
+}
+
+static int
+dummy_driver_sleep (dummy_driver_t *driver, unsigned long long deadline)
+{
+	struct timespec ts = nsec_to_ts (deadline);
+	int err;
+
+#ifdef HAVE_SYS_TIMERFD_H
+	if (driver->wait_mode == DUMMY_WAIT_TIMERFD) {
+		struct itimerspec its;
+		uint64_t expirations;
+
+		memset (&its, 0, sizeof(its));
+		its.it_value = ts;
+
+		if (timerfd_settime (driver->timer_fd, TFD_TIMER_ABSTIME, &its, NULL)) {
+			return errno;
+		}
+
+		while (read (driver->timer_fd, &expirations, sizeof(expirations)) < 0) {
+			if (errno != EINTR) {
+				return errno;
+			}
+		}
+
+		return 0;
+	}
+#endif
+
+	while ((err = clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)) == EINTR) {
+		;
+	}
+
+	return err;
+}
+
+static void
+dummy_jitter_add (dummy_jitter_t *j, unsigned long long nsecs)
+{
+	if (j->cycles == 0 || nsecs < j->min) {
+		j->min = nsecs;
+	}
+	if (nsecs > j->max) {
+		j->max = nsecs;
+	}
+	j->sum += nsecs;
+	j->sum_sq += (double)nsecs * nsecs;
+	j->cycles++;
+}
+
+static void
+dummy_jitter_report (dummy_driver_t *driver, dummy_jitter_t *j,
+		     const char *what)
+{
+	double mean, var;
+
+	if (j->cycles == 0) {
+		return;
+	}
+
+	mean = j->sum / j->cycles;
+	var = j->sum_sq / j->cycles - mean * mean;
+
+	if (driver->wait_mode == DUMMY_WAIT_NONE) {
+		jack_info ("dummy: %s %lu cycles of %.1f usecs on average "
+			   "(min %.1f max %.1f stddev %.1f), %.1fx realtime",
+			   what, j->cycles, mean / 1000.0, j->min / 1000.0,
+			   j->max / 1000.0, var > 0 ? sqrt (var) / 1000.0 : 0.0,
+			   (driver->period_size * 1000000000.0
+			    / driver->sample_rate) / mean);
+	} else {
+		jack_info ("dummy: %s %lu wakeups late by %.1f usecs on average "
+			   "(min %.1f max %.1f stddev %.1f)",
+			   what, j->cycles, mean / 1000.0, j->min / 1000.0,
+			   j->max / 1000.0, var > 0 ? sqrt (var) / 1000.0 : 0.0);
+	}
+}
+
+static void
+dummy_driver_stats (dummy_driver_t *driver, unsigned long long nsecs)
+{
+	dummy_jitter_add (&driver->jitter, nsecs);
+	dummy_jitter_add (&driver->jitter_total, nsecs);
+
+	/* with -v, report about every 10 seconds of audio */
+
+	if (driver->jitter.cycles >= driver->report_cycles) {
+		if (driver->engine->verbose) {
+			dummy_jitter_report (driver, &driver->jitter, "last");
+		}
+		memset (&driver->jitter, 0, sizeof(driver->jitter));
+	}
 }
 
 static jack_nframes_t
@@ -110,44 +217,71 @@ dummy_driver_wait (dummy_driver_t *driver, int extra_fd, int *status,
 		   float *delayed_usecs)
 {
 	jack_nframes_t nframes = driver->period_size;
-	struct timespec now;
+	unsigned long long now, deadline;
+	int err;
 
 	*status = 0;
 	/* this driver doesn't work so well if we report a delay */
 	*delayed_usecs = 0;             /* lie about it */
 
-	clock_gettime (CLOCK_REALTIME, &now);
+	now = dummy_now ();
 
-	if (cmp_lt_ts (driver->next_wakeup, now)) {
-		if (driver->next_wakeup.tv_sec == 0) {
-			/* first time through */
-			clock_gettime (CLOCK_REALTIME, &driver->next_wakeup);
-		} else if ((ts_to_nsec (now) - ts_to_nsec (driver->next_wakeup)) / 1000LL
-			   > (PRETEND_BUFFER_SIZE * 1000000LL
-			      / driver->sample_rate)) {
-			/* xrun */
-			jack_error ("**** dummy: xrun of %ju usec",
-				    (uintmax_t)(ts_to_nsec (now) - ts_to_nsec (driver->next_wakeup)) / 1000LL);
-			nframes = 0;
-			driver->next_wakeup.tv_sec = 0;
-		} else {
-			/* late, but handled by our "buffer"; try to
-			 * get back on track */
+	if (driver->start_nsecs == 0) {
+		/* first time through, or after an xrun */
+		driver->start_nsecs = now;
+		driver->cycles = 0;
+		driver->last_wakeup = 0;
+	}
+
+	if (driver->wait_mode == DUMMY_WAIT_NONE) {
+
+		/* run as fast as the graph allows, but still as a
+		   driver: no freewheel state, and a full period each
+		   time */
+
+		if (driver->last_wakeup) {
+			dummy_driver_stats (driver, now - driver->last_wakeup);
 		}
-		driver->next_wakeup = add_ts (driver->next_wakeup, driver->wait_time);
+
 	} else {
-		if (clock_nanosleep (CLOCK_REALTIME, TIMER_ABSTIME, &driver->next_wakeup, NULL)) {
-			jack_error ("error while sleeping");
+
+		if (driver->idle_periods > 1) {
+			/* one wakeup for all of them */
+			driver->cycles += driver->idle_periods - 1;
+			nframes *= driver->idle_periods;
+		}
+
+		deadline = dummy_driver_deadline (driver);
+
+		if (now > deadline) {
+			if ((now - deadline) / 1000LL
+			    > (PRETEND_BUFFER_SIZE * 1000000LL
+			       / driver->sample_rate)) {
+				/* xrun */
+				jack_error ("**** dummy: xrun of %ju usec",
+					    (uintmax_t)(now - deadline) / 1000LL);
+				driver->start_nsecs = 0;
+				nframes = 0;
+				goto done;
+			}
+			/* late, but handled by our "buffer"; try to
+			 * get back on track */
+		} else if ((err = dummy_driver_sleep (driver, deadline)) != 0) {
+			jack_error ("error while sleeping (%s)", strerror (err));
 			*status = -1;
 		} else {
-			clock_gettime (CLOCK_REALTIME, &now);
-			// guaranteed to sleep long enough for this to be correct
-			*delayed_usecs = (ts_to_nsec (now) - ts_to_nsec (driver->next_wakeup));
-			*delayed_usecs /= 1000.0;
+			now = dummy_now ();
+		}
+
+		if (now >= deadline) {
+			dummy_driver_stats (driver, now - deadline);
 		}
-		driver->next_wakeup = add_ts (driver->next_wakeup, driver->wait_time);
 	}
 
+	driver->last_wakeup = now;
+	driver->cycles++;
+
+done:
 	driver->last_wait_ust = driver->engine->get_microseconds ();
 	driver->engine->transport_cycle_start (driver->engine,
 					       driver->last_wait_ust);
@@ -157,7 +291,33 @@ dummy_driver_wait (dummy_driver_t *driver, int extra_fd, int *status,
 
 static int dummy_driver_nt_start (dummy_driver_t *drv)
 {
-	drv->next_wakeup.tv_sec = 0;
+	drv->start_nsecs = 0;
+	memset (&drv->jitter, 0, sizeof(drv->jitter));
+	memset (&drv->jitter_total, 0, sizeof(drv->jitter_total));
+	return 0;
+}
+
+static unsigned long
+dummy_report_cycles (dummy_driver_t *driver)
+{
+	unsigned long n = 10 * driver->sample_rate / driver->period_size;
+
+	return n ? n : 1;
+}
+
+static int dummy_driver_nt_stop (dummy_driver_t *drv)
+{
+	dummy_jitter_report (drv, &drv->jitter_total, "ran");
+	return 0;
+}
+
+static int
+dummy_driver_idle (dummy_driver_t *driver, unsigned int periods)
+{
+	/* busy waiting is not worth saving */
+	if (driver->wait_mode != DUMMY_WAIT_NONE) {
+		driver->idle_periods = periods;
+	}
 	return 0;
 }
 
@@ -253,6 +413,11 @@ dummy_driver_bufsize (dummy_driver_t* driver, jack_nframes_t nframes)
 	driver->period_usecs = driver->wait_time =
 				       (jack_time_t)floor ((((float)nframes) / driver->sample_rate)
 							   * 1000000.0f);
+#ifdef HAVE_CLOCK_GETTIME
+	driver->wait_time_set = 0;
+	driver->start_nsecs = 0;
+	driver->report_cycles = dummy_report_cycles (driver);
+#endif
 
 	/* tell the engine to change its buffer size */
 	if (driver->engine->set_buffer_size (driver->engine, nframes)) {
@@ -355,6 +520,11 @@ dummy_driver_detach (dummy_driver_t *driver)
 static void
 dummy_driver_delete (dummy_driver_t *driver)
 {
+#ifdef HAVE_CLOCK_GETTIME
+	if (driver->timer_fd >= 0) {
+		close (driver->timer_fd);
+	}
+#endif
 	jack_driver_nt_finish ((jack_driver_nt_t*)driver);
 	free (driver);
 }
@@ -366,13 +536,15 @@ dummy_driver_new (jack_client_t * client,
 		  unsigned int playback_ports,
 		  jack_nframes_t sample_rate,
 		  jack_nframes_t period_size,
-		  unsigned long wait_time)
+		  unsigned long wait_time,
+		  int wait_time_set,
+		  const char *mode)
 {
 	dummy_driver_t * driver;
 
 	jack_info ("creating dummy driver ... %s|%" PRIu32 "|%" PRIu32
-		   "|%lu|%u|%u", name, sample_rate, period_size, wait_time,
-		   capture_ports, playback_ports);
+		   "|%lu|%u|%u|%s", name, sample_rate, period_size, wait_time,
+		   capture_ports, playback_ports, mode);
 
 	driver = (dummy_driver_t*)calloc (1, sizeof(dummy_driver_t));
 
@@ -382,6 +554,10 @@ dummy_driver_new (jack_client_t * client,
 	driver->null_cycle    = (JackDriverNullCycleFunction)dummy_driver_null_cycle;
 	driver->nt_attach     = (JackDriverNTAttachFunction)dummy_driver_attach;
 	driver->nt_start      = (JackDriverNTStartFunction)dummy_driver_nt_start;
+#ifdef HAVE_CLOCK_GETTIME
+	driver->nt_stop       = (JackDriverNTStopFunction)dummy_driver_nt_stop;
+	driver->idle          = (JackDriverIdleFunction)dummy_driver_idle;
+#endif
 	driver->nt_detach     = (JackDriverNTDetachFunction)dummy_driver_detach;
 	driver->nt_bufsize    = (JackDriverNTBufSizeFunction)dummy_driver_bufsize;
 	driver->nt_run_cycle  = (JackDriverNTRunCycleFunction)dummy_driver_run_cycle;
@@ -392,6 +568,7 @@ dummy_driver_new (jack_client_t * client,
 	driver->sample_rate = sample_rate;
 	driver->period_size = period_size;
 	driver->wait_time   = wait_time;
+	driver->wait_time_set = wait_time_set;
 	//driver->next_time   = 0; // not needed since calloc clears the memory
 	driver->last_wait_ust = 0;
 
@@ -400,6 +577,33 @@ dummy_driver_new (jack_client_t * client,
 	driver->playback_channels = playback_ports;
 	driver->playback_ports    = NULL;
 
+#ifdef HAVE_CLOCK_GETTIME
+	driver->timer_fd = -1;
+	driver->report_cycles = dummy_report_cycles (driver);
+
+	if (strcmp (mode, "max") == 0) {
+		driver->wait_mode = DUMMY_WAIT_NONE;
+	} else if (strcmp (mode, "timerfd") == 0) {
+#ifdef HAVE_SYS_TIMERFD_H
+		if ((driver->timer_fd = timerfd_create (CLOCK_MONOTONIC, TFD_CLOEXEC)) >= 0) {
+			driver->wait_mode = DUMMY_WAIT_TIMERFD;
+		} else {
+			jack_error ("dummy: cannot create timer (%s), "
+				    "sleeping instead", strerror (errno));
+			driver->wait_mode = DUMMY_WAIT_SLEEP;
+		}
+#else
+		jack_error ("dummy: no timerfd on this system, sleeping instead");
+		driver->wait_mode = DUMMY_WAIT_SLEEP;
+#endif
+	} else {
+		if (strcmp (mode, "sleep") != 0) {
+			jack_error ("dummy: unknown mode \"%s\", sleeping", mode);
+		}
+		driver->wait_mode = DUMMY_WAIT_SLEEP;
+	}
+#endif
+
 	driver->client = client;
 	driver->engine = NULL;
 
@@ -418,7 +622,7 @@ driver_get_descriptor ()
 
 	desc = calloc (1, sizeof(jack_driver_desc_t));
 	strcpy (desc->name, "dummy");
-	desc->nparams = 5;
+	desc->nparams = 6;
 
 	params = calloc (desc->nparams, sizeof(jack_driver_param_desc_t));
 
@@ -463,6 +667,17 @@ driver_get_descriptor ()
 		"Number of usecs to wait between engine processes");
 	strcpy (params[i].long_desc, params[i].short_desc);
 
+	i++;
+	strcpy (params[i].name, "mode");
+	params[i].character  = 'm';
+	params[i].type       = JackDriverParamString;
+	strcpy (params[i].value.str, "sleep");
+	strcpy (params[i].short_desc,
+		"How to pace cycles: sleep, timerfd or max");
+	strcpy (params[i].long_desc,
+		"How to pace cycles: sleep (clock_nanosleep), timerfd, or "
+		"max to run them back to back as fast as the clients allow");
+
 	desc->params = params;
 
 	return desc;
@@ -479,6 +694,7 @@ driver_initialize (jack_client_t *client, const JSList * params)
 	unsigned int playback_ports = 2;
 	int wait_time_set = 0;
 	unsigned long wait_time = 0;
+	const char *mode = "sleep";
 	const JSList * node;
 	const jack_driver_param_t * param;
 
@@ -508,6 +724,10 @@ driver_initialize (jack_client_t *client, const JSList * params)
 			wait_time_set = 1;
 			break;
 
+		case 'm':
+			mode = param->value.str;
+			break;
+
 		}
 	}
 
@@ -517,7 +737,7 @@ driver_initialize (jack_client_t *client, const JSList * params)
 
 	return dummy_driver_new (client, "dummy_pcm", capture_ports,
 				 playback_ports, sample_rate, period_size,
-				 wait_time);
+				 wait_time, wait_time_set, mode);
 }
 
 void
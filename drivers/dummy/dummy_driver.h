@@ -36,15 +36,44 @@
 
 typedef struct _dummy_driver dummy_driver_t;
 
+typedef enum {
+	DUMMY_WAIT_SLEEP,       /* clock_nanosleep */
+	DUMMY_WAIT_TIMERFD,     /* a CLOCK_MONOTONIC timerfd */
+	DUMMY_WAIT_NONE,        /* cycles back to back */
+} dummy_wait_mode_t;
+
+/* how late each wakeup was, or with DUMMY_WAIT_NONE, how long each
+   cycle took; all in nsecs */
+typedef struct {
+	unsigned long cycles;
+	unsigned long long min;
+	unsigned long long max;
+	double sum;
+	double sum_sq;
+} dummy_jitter_t;
+
 struct _dummy_driver {
 	JACK_DRIVER_NT_DECL;
 
 	jack_nframes_t sample_rate;
 	jack_nframes_t period_size;
 	unsigned long wait_time;
+	int wait_time_set;              /* else cycles follow the sample clock */
 
 #ifdef HAVE_CLOCK_GETTIME
-	struct timespec next_wakeup;
+	dummy_wait_mode_t wait_mode;
+	int timer_fd;
+
+	/* wakeups are scheduled from these, rather than by adding the
+	   period to the last one, so that rounding does not accumulate */
+	unsigned long long start_nsecs;         /* 0 to start over */
+	unsigned long long cycles;              /* since start_nsecs */
+	unsigned long long last_wakeup;
+	unsigned int idle_periods;              /* per wakeup, 0 unless idle */
+
+	dummy_jitter_t jitter;                  /* since the last report */
+	dummy_jitter_t jitter_total;
+	unsigned long report_cycles;
 #else
 	jack_time_t next_time;
 #endif
@@ -0,0 +1,1028 @@
+/* -*- mode: c; c-file-style: "linux"; -*- */
+/*
+    Offline rendering driver: capture ports are fed from an audio file
+    and playback ports are written to one, as fast as the graph runs.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ */
+
+/*
+ * Cycles are not paced: each one starts as soon as the last is done,
+ * and the only waits are for the disk. A reader thread keeps the
+ * capture queue topped up from the input file, and a writer thread
+ * drains the playback queue into the output file, so the driver
+ * thread itself only copies between the queues and the port buffers.
+ * Whatever part of the queue has piled up is read or written with one
+ * libsndfile call.
+ *
+ * Rendering ends once the input has run out and --tail more frames
+ * have been written, or after --length frames; the driver then stops,
+ * which makes jackd exit. Without either it goes on until the server
+ * is stopped. Either way the output file is finished off when the
+ * driver is detached.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include <jack/types.h>
+#include <jack/thread.h>
+#include "internal.h"
+#include "engine.h"
+
+#include "file_driver.h"
+
+static int
+file_queue_init (file_queue_t *q, unsigned int depth, jack_nframes_t period,
+		 unsigned int channels)
+{
+	memset (q, 0, sizeof(*q));
+
+	if (channels == 0) {
+		return 0;
+	}
+
+	q->buf = (float*)calloc ((size_t)depth * period * channels,
+				 sizeof(float));
+	q->frames = (jack_nframes_t*)calloc (depth, sizeof(jack_nframes_t));
+
+	if (q->buf == NULL || q->frames == NULL) {
+		free (q->buf);
+		free (q->frames);
+		q->buf = NULL;
+		q->frames = NULL;
+		return -1;
+	}
+
+	q->depth = depth;
+	q->period = period;
+	q->channels = channels;
+
+	pthread_mutex_init (&q->lock, NULL);
+	pthread_cond_init (&q->cond, NULL);
+
+	return 0;
+}
+
+static void
+file_queue_free (file_queue_t *q)
+{
+	if (q->buf == NULL) {
+		return;
+	}
+
+	pthread_mutex_destroy (&q->lock);
+	pthread_cond_destroy (&q->cond);
+	free (q->buf);
+	free (q->frames);
+	q->buf = NULL;
+	q->frames = NULL;
+}
+
+static inline float *
+file_queue_block (file_queue_t *q, unsigned long n)
+{
+	return q->buf + (size_t)(n % q->depth) * q->period * q->channels;
+}
+
+/* Wait for room in the queue and return how many free blocks follow
+   q->tail without wrapping, or 0 once the consumer has stopped. Only
+   the producer moves q->tail, so it may read it without the lock. */
+static unsigned int
+file_queue_wait_free (file_queue_t *q)
+{
+	unsigned int n, slot;
+
+	pthread_mutex_lock (&q->lock);
+
+	while (!q->stop && q->tail - q->head == q->depth) {
+		pthread_cond_wait (&q->cond, &q->lock);
+	}
+
+	if (q->stop) {
+		n = 0;
+	} else {
+		n = q->depth - (q->tail - q->head);
+		slot = q->tail % q->depth;
+		if (n > q->depth - slot) {
+			n = q->depth - slot;
+		}
+	}
+
+	pthread_mutex_unlock (&q->lock);
+
+	return n;
+}
+
+/* Wait for blocks to consume and return how many follow q->head
+   without wrapping, or 0 once the producer is done and they have all
+   been consumed. */
+static unsigned int
+file_queue_wait_full (file_queue_t *q)
+{
+	unsigned int n, slot;
+
+	pthread_mutex_lock (&q->lock);
+
+	while (!q->eof && q->head == q->tail) {
+		pthread_cond_wait (&q->cond, &q->lock);
+	}
+
+	n = q->tail - q->head;
+	slot = q->head % q->depth;
+	if (n > q->depth - slot) {
+		n = q->depth - slot;
+	}
+
+	pthread_mutex_unlock (&q->lock);
+
+	return n;
+}
+
+static void
+file_queue_produce (file_queue_t *q, unsigned int n)
+{
+	pthread_mutex_lock (&q->lock);
+	q->tail += n;
+	pthread_cond_signal (&q->cond);
+	pthread_mutex_unlock (&q->lock);
+}
+
+static void
+file_queue_consume (file_queue_t *q, unsigned int n)
+{
+	pthread_mutex_lock (&q->lock);
+	q->head += n;
+	pthread_cond_signal (&q->cond);
+	pthread_mutex_unlock (&q->lock);
+}
+
+static void
+file_queue_end (file_queue_t *q, int consumer)
+{
+	pthread_mutex_lock (&q->lock);
+	if (consumer) {
+		q->stop = 1;
+	} else {
+		q->eof = 1;
+	}
+	pthread_cond_signal (&q->cond);
+	pthread_mutex_unlock (&q->lock);
+}
+
+static void *
+file_driver_reader_thread (void *arg)
+{
+	file_driver_t *driver = (file_driver_t*)arg;
+	file_queue_t *q = &driver->capture;
+	unsigned int n, i, full;
+	jack_nframes_t rem;
+	sf_count_t want, got;
+	float *buf;
+
+	while ((n = file_queue_wait_free (q)) > 0) {
+
+		buf = file_queue_block (q, q->tail);
+		want = (sf_count_t)n * q->period;
+
+		if ((got = sf_readf_float (driver->input, buf, want)) < 0) {
+			got = 0;
+		}
+
+		full = got / q->period;
+		rem = got % q->period;
+
+		for (i = 0; i < full; ++i) {
+			q->frames[(q->tail + i) % q->depth] = q->period;
+		}
+
+		if (rem) {
+			/* the last, short, block of the file */
+			memset (buf + ((size_t)full * q->period + rem) * q->channels,
+				0, (size_t)(q->period - rem) * q->channels * sizeof(float));
+			q->frames[(q->tail + full) % q->depth] = rem;
+			full++;
+		}
+
+		file_queue_produce (q, full);
+
+		if (got < want) {
+			if (sf_error (driver->input)) {
+				jack_error ("file: cannot read input (%s)",
+					    sf_strerror (driver->input));
+			}
+			break;
+		}
+	}
+
+	file_queue_end (q, 0);
+
+	return NULL;
+}
+
+static void *
+file_driver_writer_thread (void *arg)
+{
+	file_driver_t *driver = (file_driver_t*)arg;
+	file_queue_t *q = &driver->playback;
+	unsigned int n, i;
+	jack_nframes_t f;
+	sf_count_t frames;
+	int failed = 0;
+
+	while ((n = file_queue_wait_full (q)) > 0) {
+
+		/* only the last block can be short, but stop at one
+		   anyway, as the blocks must be back to back */
+		for (i = 0, frames = 0; i < n; ) {
+			f = q->frames[(q->head + i++) % q->depth];
+			frames += f;
+			if (f < q->period) {
+				break;
+			}
+		}
+
+		if (!failed && sf_writef_float (driver->output,
+						file_queue_block (q, q->head),
+						frames) != frames) {
+			/* keep draining the queue, so that the
+			   graph does not stall */
+			jack_error ("file: cannot write to %s (%s)",
+				    driver->output_path,
+				    sf_strerror (driver->output));
+			failed = 1;
+		}
+
+		file_queue_consume (q, i);
+	}
+
+	return NULL;
+}
+
+/* The input has ended, `frames' into the current period. */
+static void
+file_driver_input_ended (file_driver_t *driver, jack_nframes_t frames)
+{
+	if (!driver->length_known) {
+		driver->length = driver->frames_done + frames + driver->tail;
+		driver->length_known = 1;
+	}
+}
+
+/* The next block of input, with *frames set to how much of it came
+   from the file, or NULL if there is none. Hand it back with
+   file_queue_consume(). */
+static float *
+file_driver_next_input (file_driver_t *driver, jack_nframes_t *frames)
+{
+	file_queue_t *q = &driver->capture;
+
+	*frames = 0;
+
+	if (driver->input == NULL) {
+		return NULL;
+	}
+
+	if (file_queue_wait_full (q) == 0) {
+		/* it ended on a block boundary */
+		file_driver_input_ended (driver, 0);
+		return NULL;
+	}
+
+	*frames = q->frames[q->head % q->depth];
+
+	if (*frames < q->period) {
+		file_driver_input_ended (driver, *frames);
+	}
+
+	return file_queue_block (q, q->head);
+}
+
+/* A block to write the output of this cycle to, with *frames set to
+   how much of it will go to the file, or NULL if none will. Pass it
+   on with file_queue_produce(). */
+static float *
+file_driver_next_output (file_driver_t *driver, jack_nframes_t nframes,
+			 jack_nframes_t *frames)
+{
+	file_queue_t *q = &driver->playback;
+
+	*frames = nframes;
+
+	if (driver->length_known) {
+		if (driver->frames_done >= driver->length) {
+			*frames = 0;
+		} else if (driver->length - driver->frames_done < nframes) {
+			*frames = driver->length - driver->frames_done;
+		}
+	}
+
+	if (driver->output == NULL || *frames == 0
+	    || file_queue_wait_free (q) == 0) {
+		return NULL;
+	}
+
+	q->frames[q->tail % q->depth] = *frames;
+
+	return file_queue_block (q, q->tail);
+}
+
+static int
+file_driver_read (file_driver_t *driver, jack_nframes_t nframes)
+{
+	unsigned int chn, channels = driver->capture.channels;
+	jack_nframes_t frames, i;
+	jack_default_audio_sample_t *buf;
+	float *block;
+	JSList *node;
+
+	block = file_driver_next_input (driver, &frames);
+
+	if (frames > nframes) {
+		frames = nframes;
+	}
+
+	for (chn = 0, node = driver->capture_ports; node;
+	     node = jack_slist_next (node), chn++) {
+
+		jack_port_t *port = (jack_port_t*)node->data;
+
+		if (!jack_port_connected (port)) {
+			continue;
+		}
+
+		buf = jack_port_get_buffer (port, nframes);
+
+		if (block == NULL || chn >= channels) {
+			memset (buf, 0, nframes * sizeof(jack_default_audio_sample_t));
+			continue;
+		}
+
+		for (i = 0; i < frames; ++i) {
+			buf[i] = block[i * channels + chn];
+		}
+
+		if (frames < nframes) {
+			memset (buf + frames, 0,
+				(nframes - frames) * sizeof(jack_default_audio_sample_t));
+		}
+	}
+
+	if (block) {
+		file_queue_consume (&driver->capture, 1);
+	}
+
+	return 0;
+}
+
+static int
+file_driver_write (file_driver_t *driver, jack_nframes_t nframes)
+{
+	unsigned int chn, channels = driver->playback_channels;
+	jack_nframes_t frames, i;
+	jack_default_audio_sample_t *buf;
+	float *block;
+	JSList *node;
+
+	if ((block = file_driver_next_output (driver, nframes, &frames)) != NULL) {
+
+		for (chn = 0, node = driver->playback_ports; node;
+		     node = jack_slist_next (node), chn++) {
+
+			/* unconnected ports read as silence */
+			buf = jack_port_get_buffer ((jack_port_t*)node->data,
+						    nframes);
+
+			for (i = 0; i < frames; ++i) {
+				block[i * channels + chn] = buf[i];
+			}
+		}
+
+		file_queue_produce (&driver->playback, 1);
+	}
+
+	driver->frames_done += nframes;
+
+	return 0;
+}
+
+static int
+file_driver_null_cycle (file_driver_t *driver, jack_nframes_t nframes)
+{
+	jack_nframes_t frames;
+	float *block;
+
+	/* keep the files in step with the timeline */
+
+	if (file_driver_next_input (driver, &frames)) {
+		file_queue_consume (&driver->capture, 1);
+	}
+
+	if ((block = file_driver_next_output (driver, nframes, &frames)) != NULL) {
+		memset (block, 0, (size_t)frames * driver->playback_channels
+			* sizeof(float));
+		file_queue_produce (&driver->playback, 1);
+	}
+
+	driver->frames_done += nframes;
+
+	return 0;
+}
+
+static int
+file_driver_run_cycle (file_driver_t *driver)
+{
+	jack_engine_t *engine = driver->engine;
+
+	if (driver->length_known && driver->frames_done >= driver->length) {
+		/* done: stopping the driver stops the server */
+		VERBOSE (engine, "file: rendered %" PRIu64 " frames",
+			 driver->frames_done);
+		return -1;
+	}
+
+	driver->last_wait_ust = engine->get_microseconds ();
+	engine->transport_cycle_start (engine, driver->last_wait_ust);
+
+	return engine->run_cycle (engine, driver->period_size, 0.0f);
+}
+
+static int
+file_driver_nt_start (file_driver_t *driver)
+{
+	if (driver->started_at == 0) {
+		driver->started_at = driver->engine->get_microseconds ();
+	}
+	return 0;
+}
+
+static int
+file_driver_bufsize (file_driver_t *driver, jack_nframes_t nframes)
+{
+	/* the queues are laid out in periods */
+	if (nframes != driver->period_size) {
+		jack_error ("file: the period cannot be changed while rendering");
+		return -1;
+	}
+	return 0;
+}
+
+static void
+file_driver_stop_threads (file_driver_t *driver)
+{
+	if (!driver->threads_running) {
+		return;
+	}
+
+	if (driver->input) {
+		file_queue_end (&driver->capture, 1);
+		pthread_join (driver->reader_thread, NULL);
+	}
+
+	if (driver->output) {
+		/* the writer drains the queue before it exits */
+		file_queue_end (&driver->playback, 0);
+		pthread_join (driver->writer_thread, NULL);
+	}
+
+	driver->threads_running = 0;
+}
+
+static int
+file_driver_attach (file_driver_t *driver)
+{
+	jack_port_t * port;
+	char buf[32];
+	unsigned int chn, in_channels = 0;
+	int port_flags;
+	SF_INFO info;
+
+	if (driver->engine->set_buffer_size (driver->engine, driver->period_size)) {
+		jack_error ("file: cannot set engine buffer size to %d (check MIDI)", driver->period_size);
+		return -1;
+	}
+	driver->engine->set_sample_rate (driver->engine, driver->sample_rate);
+
+	if (driver->input) {
+		sf_command (driver->input, SFC_GET_CURRENT_SF_INFO, &info,
+			    sizeof(info));
+		in_channels = info.channels;
+	}
+
+	if (file_queue_init (&driver->capture, driver->queue_depth,
+			     driver->period_size, in_channels)
+	    || file_queue_init (&driver->playback, driver->queue_depth,
+				driver->period_size,
+				driver->output ? driver->playback_channels : 0)) {
+		jack_error ("file: cannot allocate a queue of %u periods",
+			    driver->queue_depth);
+		return -1;
+	}
+
+	if (driver->input
+	    && jack_client_create_thread (NULL, &driver->reader_thread, 0, FALSE,
+					  file_driver_reader_thread, driver)) {
+		jack_error ("file: cannot create reader thread");
+		return -1;
+	}
+
+	if (driver->output
+	    && jack_client_create_thread (NULL, &driver->writer_thread, 0, FALSE,
+					  file_driver_writer_thread, driver)) {
+		jack_error ("file: cannot create writer thread");
+		if (driver->input) {
+			file_queue_end (&driver->capture, 1);
+			pthread_join (driver->reader_thread, NULL);
+		}
+		return -1;
+	}
+
+	driver->threads_running = 1;
+
+	port_flags = JackPortIsOutput | JackPortIsPhysical | JackPortIsTerminal;
+
+	for (chn = 0; chn < driver->capture_channels; chn++) {
+		snprintf (buf, sizeof(buf) - 1, "capture_%u", chn + 1);
+
+		port = jack_port_register (driver->client, buf,
+					   JACK_DEFAULT_AUDIO_TYPE,
+					   port_flags, 0);
+		if (!port) {
+			jack_error ("file: cannot register port for %s", buf);
+			break;
+		}
+
+		driver->capture_ports =
+			jack_slist_append (driver->capture_ports, port);
+	}
+
+	port_flags = JackPortIsInput | JackPortIsPhysical | JackPortIsTerminal;
+
+	for (chn = 0; chn < driver->playback_channels; chn++) {
+		snprintf (buf, sizeof(buf) - 1, "playback_%u", chn + 1);
+
+		port = jack_port_register (driver->client, buf,
+					   JACK_DEFAULT_AUDIO_TYPE,
+					   port_flags, 0);
+
+		if (!port) {
+			jack_error ("file: cannot register port for %s", buf);
+			break;
+		}
+
+		driver->playback_ports =
+			jack_slist_append (driver->playback_ports, port);
+	}
+
+	jack_activate (driver->client);
+
+	return 0;
+}
+
+static int
+file_driver_detach (file_driver_t *driver)
+{
+	JSList * node;
+	jack_time_t elapsed;
+
+	if (driver->engine == 0) {
+		return 0;
+	}
+
+	file_driver_stop_threads (driver);
+
+	if (driver->started_at) {
+		elapsed = driver->engine->get_microseconds () - driver->started_at;
+		jack_info ("file: rendered %.1f seconds of audio in %.1f "
+			   "seconds, %.1fx realtime",
+			   (double)driver->frames_done / driver->sample_rate,
+			   elapsed / 1000000.0,
+			   elapsed ? ((double)driver->frames_done * 1000000.0
+				      / driver->sample_rate) / elapsed : 0.0);
+	}
+
+	for (node = driver->capture_ports; node; node = jack_slist_next (node))
+		jack_port_unregister (driver->client,
+				      ((jack_port_t*)node->data));
+
+	jack_slist_free (driver->capture_ports);
+	driver->capture_ports = NULL;
+
+
+	for (node = driver->playback_ports; node; node = jack_slist_next (node))
+		jack_port_unregister (driver->client,
+				      ((jack_port_t*)node->data));
+
+	jack_slist_free (driver->playback_ports);
+	driver->playback_ports = NULL;
+
+	return 0;
+}
+
+
+static void
+file_driver_delete (file_driver_t *driver)
+{
+	file_driver_stop_threads (driver);
+	file_queue_free (&driver->capture);
+	file_queue_free (&driver->playback);
+
+	if (driver->input) {
+		sf_close (driver->input);
+	}
+	if (driver->output) {
+		/* this is what writes the final header */
+		sf_close (driver->output);
+	}
+
+	jack_driver_nt_finish ((jack_driver_nt_t*)driver);
+	free (driver);
+}
+
+/* The libsndfile format for `name', or if that is empty, for the
+   extension of `path'; 0 if there is none. */
+static int
+file_driver_format (const char *name, const char *path, unsigned int bits)
+{
+	const char *ext;
+	int major, subtype;
+
+	if (*name == '\0') {
+		name = ((ext = strrchr (path, '.')) != NULL) ? ext + 1 : "wav";
+	}
+
+	if (strcasecmp (name, "wav") == 0) {
+		major = SF_FORMAT_WAV;
+	} else if (strcasecmp (name, "rf64") == 0) {
+		major = SF_FORMAT_RF64;
+	} else if (strcasecmp (name, "flac") == 0) {
+		major = SF_FORMAT_FLAC;
+	} else if (strcasecmp (name, "caf") == 0) {
+		major = SF_FORMAT_CAF;
+	} else {
+		jack_error ("file: unknown output format \"%s\"", name);
+		return 0;
+	}
+
+	switch (bits) {
+	case 0:
+		subtype = (major == SF_FORMAT_FLAC) ? SF_FORMAT_PCM_24 : SF_FORMAT_FLOAT;
+		break;
+	case 16:
+		subtype = SF_FORMAT_PCM_16;
+		break;
+	case 24:
+		subtype = SF_FORMAT_PCM_24;
+		break;
+	case 32:
+		subtype = SF_FORMAT_FLOAT;
+		break;
+	default:
+		jack_error ("file: cannot write %u bit samples", bits);
+		return 0;
+	}
+
+	return major | subtype;
+}
+
+static jack_driver_t *
+file_driver_new (jack_client_t * client,
+		 char *name,
+		 const char *input_path,
+		 const char *output_path,
+		 const char *format,
+		 unsigned int bits,
+		 int capture_ports,
+		 unsigned int playback_ports,
+		 jack_nframes_t sample_rate,
+		 int sample_rate_set,
+		 jack_nframes_t period_size,
+		 unsigned int queue_depth,
+		 jack_nframes_t length,
+		 jack_nframes_t tail)
+{
+	file_driver_t * driver;
+	SF_INFO info;
+
+	jack_info ("creating file driver ... %s|%s|%s|%" PRIu32 "|%" PRIu32
+		   "|%u|%u", name, input_path, output_path, sample_rate,
+		   period_size, playback_ports, queue_depth);
+
+	if (period_size == 0 || queue_depth < 2) {
+		jack_error ("file: the period must be at least 1 frame and "
+			    "the queue at least 2 periods");
+		return NULL;
+	}
+
+	driver = (file_driver_t*)calloc (1, sizeof(file_driver_t));
+
+	jack_driver_nt_init ((jack_driver_nt_t*)driver);
+
+	driver->read          = (JackDriverReadFunction)file_driver_read;
+	driver->write         = (JackDriverReadFunction)file_driver_write;
+	driver->null_cycle    = (JackDriverNullCycleFunction)file_driver_null_cycle;
+	driver->nt_attach     = (JackDriverNTAttachFunction)file_driver_attach;
+	driver->nt_start      = (JackDriverNTStartFunction)file_driver_nt_start;
+	driver->nt_detach     = (JackDriverNTDetachFunction)file_driver_detach;
+	driver->nt_bufsize    = (JackDriverNTBufSizeFunction)file_driver_bufsize;
+	driver->nt_run_cycle  = (JackDriverNTRunCycleFunction)file_driver_run_cycle;
+
+	if (*input_path) {
+		memset (&info, 0, sizeof(info));
+		if ((driver->input = sf_open (input_path, SFM_READ, &info)) == NULL) {
+			jack_error ("file: cannot open %s (%s)", input_path,
+				    sf_strerror (NULL));
+			goto fail;
+		}
+		if (sample_rate_set && (jack_nframes_t)info.samplerate != sample_rate) {
+			jack_error ("file: %s is at %d Hz, not %" PRIu32,
+				    input_path, info.samplerate, sample_rate);
+			goto fail;
+		}
+		sample_rate = info.samplerate;
+		if (capture_ports < 0) {
+			capture_ports = info.channels;
+		}
+	}
+
+	if (capture_ports < 0) {
+		capture_ports = 2;
+	}
+
+	if (*output_path && playback_ports) {
+		memset (&info, 0, sizeof(info));
+		info.samplerate = sample_rate;
+		info.channels = playback_ports;
+		if ((info.format = file_driver_format (format, output_path, bits)) == 0) {
+			goto fail;
+		}
+		if (!sf_format_check (&info)) {
+			jack_error ("file: cannot write %u channels at %" PRIu32
+				    " Hz in that format", playback_ports,
+				    sample_rate);
+			goto fail;
+		}
+		if ((driver->output = sf_open (output_path, SFM_WRITE, &info)) == NULL) {
+			jack_error ("file: cannot create %s (%s)", output_path,
+				    sf_strerror (NULL));
+			goto fail;
+		}
+		/* clip rather than wrap when writing integer samples */
+		sf_command (driver->output, SFC_SET_CLIPPING, NULL, SF_TRUE);
+		snprintf (driver->output_path, sizeof(driver->output_path),
+			  "%s", output_path);
+	}
+
+	driver->period_usecs =
+		(jack_time_t)floor ((((float)period_size) / sample_rate)
+				    * 1000000.0f);
+	driver->sample_rate = sample_rate;
+	driver->period_size = period_size;
+	driver->last_wait_ust = 0;
+
+	driver->capture_channels  = capture_ports;
+	driver->capture_ports     = NULL;
+	driver->playback_channels = playback_ports;
+	driver->playback_ports    = NULL;
+
+	driver->queue_depth = queue_depth;
+	driver->length = length;
+	driver->length_known = (length != 0);
+	driver->tail = tail;
+
+	driver->client = client;
+	driver->engine = NULL;
+
+	return (jack_driver_t*)driver;
+
+fail:
+	file_driver_delete (driver);
+	return NULL;
+}
+
+
+/* DRIVER "PLUGIN" INTERFACE */
+
+jack_driver_desc_t *
+driver_get_descriptor ()
+{
+	jack_driver_desc_t * desc;
+	jack_driver_param_desc_t * params;
+	unsigned int i;
+
+	desc = calloc (1, sizeof(jack_driver_desc_t));
+	strcpy (desc->name, "file");
+	desc->nparams = 11;
+
+	params = calloc (desc->nparams, sizeof(jack_driver_param_desc_t));
+
+	i = 0;
+	strcpy (params[i].name, "input");
+	params[i].character  = 'i';
+	params[i].type       = JackDriverParamString;
+	strcpy (params[i].value.str, "");
+	strcpy (params[i].short_desc, "File to feed the capture ports from");
+	strcpy (params[i].long_desc,
+		"File to feed the capture ports from, one channel per port, "
+		"in any format libsndfile reads");
+
+	i++;
+	strcpy (params[i].name, "output");
+	params[i].character  = 'o';
+	params[i].type       = JackDriverParamString;
+	strcpy (params[i].value.str, "");
+	strcpy (params[i].short_desc, "File to write the playback ports to");
+	strcpy (params[i].long_desc, params[i].short_desc);
+
+	i++;
+	strcpy (params[i].name, "format");
+	params[i].character  = 'f';
+	params[i].type       = JackDriverParamString;
+	strcpy (params[i].value.str, "");
+	strcpy (params[i].short_desc, "Output format: wav, rf64, flac or caf");
+	strcpy (params[i].long_desc,
+		"Output format: wav, rf64, flac or caf; by default, taken "
+		"from the extension of the output file");
+
+	i++;
+	strcpy (params[i].name, "bits");
+	params[i].character  = 'b';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 0U;
+	strcpy (params[i].short_desc, "Output sample size: 16, 24 or 32 (float)");
+	strcpy (params[i].long_desc,
+		"Output sample size: 16, 24 or 32 (float); by default, "
+		"24 for FLAC and 32 otherwise");
+
+	i++;
+	strcpy (params[i].name, "capture");
+	params[i].character  = 'C';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 2U;
+	strcpy (params[i].short_desc, "Number of capture ports");
+	strcpy (params[i].long_desc,
+		"Number of capture ports; by default, one for each "
+		"channel of the input file, or 2 without one");
+
+	i++;
+	strcpy (params[i].name, "playback");
+	params[i].character  = 'P';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 2U;
+	strcpy (params[i].short_desc, "Number of playback ports");
+	strcpy (params[i].long_desc,
+		"Number of playback ports, and of channels in the output file");
+
+	i++;
+	strcpy (params[i].name, "rate");
+	params[i].character  = 'r';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 48000U;
+	strcpy (params[i].short_desc, "Sample rate");
+	strcpy (params[i].long_desc,
+		"Sample rate; by default, that of the input file, or 48000 "
+		"without one");
+
+	i++;
+	strcpy (params[i].name, "period");
+	params[i].character  = 'p';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 4096U;
+	strcpy (params[i].short_desc, "Frames per period");
+	strcpy (params[i].long_desc, params[i].short_desc);
+
+	i++;
+	strcpy (params[i].name, "queue");
+	params[i].character  = 'q';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 16U;
+	strcpy (params[i].short_desc, "Periods queued for disk I/O");
+	strcpy (params[i].long_desc,
+		"Periods queued between the graph and each of the reader "
+		"and writer threads");
+
+	i++;
+	strcpy (params[i].name, "length");
+	params[i].character  = 'l';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 0U;
+	strcpy (params[i].short_desc, "Frames to render");
+	strcpy (params[i].long_desc,
+		"Frames to render; by default, up to the end of the input "
+		"and the tail, or until the server is stopped");
+
+	i++;
+	strcpy (params[i].name, "tail");
+	params[i].character  = 't';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 0U;
+	strcpy (params[i].short_desc, "Frames to render after the input ends");
+	strcpy (params[i].long_desc, params[i].short_desc);
+
+	desc->params = params;
+
+	return desc;
+}
+
+const char driver_client_name[] = "file_pcm";
+
+jack_driver_t *
+driver_initialize (jack_client_t *client, const JSList * params)
+{
+	jack_nframes_t sample_rate = 48000;
+	jack_nframes_t period_size = 4096;
+	int sample_rate_set = 0;
+	int capture_ports = -1;
+	unsigned int playback_ports = 2;
+	unsigned int queue_depth = 16;
+	unsigned int bits = 0;
+	jack_nframes_t length = 0;
+	jack_nframes_t tail = 0;
+	const char *input = "";
+	const char *output = "";
+	const char *format = "";
+	const JSList * node;
+	const jack_driver_param_t * param;
+
+	for (node = params; node; node = jack_slist_next (node)) {
+		param = (const jack_driver_param_t*)node->data;
+
+		switch (param->character) {
+
+		case 'i':
+			input = param->value.str;
+			break;
+
+		case 'o':
+			output = param->value.str;
+			break;
+
+		case 'f':
+			format = param->value.str;
+			break;
+
+		case 'b':
+			bits = param->value.ui;
+			break;
+
+		case 'C':
+			capture_ports = param->value.ui;
+			break;
+
+		case 'P':
+			playback_ports = param->value.ui;
+			break;
+
+		case 'r':
+			sample_rate = param->value.ui;
+			sample_rate_set = 1;
+			break;
+
+		case 'p':
+			period_size = param->value.ui;
+			break;
+
+		case 'q':
+			queue_depth = param->value.ui;
+			break;
+
+		case 'l':
+			length = param->value.ui;
+			break;
+
+		case 't':
+			tail = param->value.ui;
+			break;
+
+		}
+	}
+
+	return file_driver_new (client, "file_pcm", input, output, format,
+				bits, capture_ports, playback_ports,
+				sample_rate, sample_rate_set, period_size,
+				queue_depth, length, tail);
+}
+
+void
+driver_finish (jack_driver_t *driver)
+{
+	file_driver_delete ((file_driver_t*)driver);
+}
@@ -0,0 +1,85 @@
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+#ifndef __JACK_FILE_DRIVER_H__
+#define __JACK_FILE_DRIVER_H__
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <sndfile.h>
+
+#include <jack/types.h>
+#include <jack/jslist.h>
+#include <jack/jack.h>
+#include "driver.h"
+#include <config.h>
+
+typedef struct _file_driver file_driver_t;
+
+/* A ring of `depth' blocks of `period' interleaved frames, between
+   one producer and one consumer. The reader thread fills the capture
+   queue and the driver empties it; the driver fills the playback
+   queue and the writer thread empties it. Blocks that are next to
+   each other in the ring are read or written with a single call. */
+typedef struct {
+	float *buf;
+	jack_nframes_t *frames;         /* valid frames in each block */
+	unsigned int depth;
+	unsigned int channels;
+	jack_nframes_t period;
+	unsigned long head;             /* next block to consume */
+	unsigned long tail;             /* next block to produce */
+	int eof;                        /* producer is done */
+	int stop;                       /* consumer is done */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} file_queue_t;
+
+struct _file_driver {
+	JACK_DRIVER_NT_DECL;
+
+	jack_nframes_t sample_rate;
+	jack_nframes_t period_size;
+
+	unsigned int capture_channels;
+	unsigned int playback_channels;
+
+	JSList         *capture_ports;
+	JSList         *playback_ports;
+
+	SNDFILE        *input;          /* NULL: capture is silent */
+	SNDFILE        *output;         /* NULL: playback is discarded */
+	char            output_path[JACK_DRIVER_PARAM_STRING_MAX + 1];
+
+	unsigned int queue_depth;
+	file_queue_t capture;
+	file_queue_t playback;
+	pthread_t reader_thread;
+	pthread_t writer_thread;
+	int threads_running;
+
+	uint64_t length;                /* frames to render */
+	int length_known;               /* else until the server stops */
+	jack_nframes_t tail;            /* rendered after the input ends */
+	uint64_t frames_done;
+	jack_time_t started_at;
+
+	jack_client_t  *client;
+};
+
+#endif /* __JACK_FILE_DRIVER_H__ */
@@ -175,6 +175,7 @@ ffado_driver_attach (ffado_driver_t *driver)
 			}
 			driver->capture_ports =
 				jack_slist_append (driver->capture_ports, port);
+			driver->capture_channels[chn].port = port;
 			// setup port parameters
 			if (ffado_streaming_set_capture_stream_buffer (driver->dev, chn, NULL)) {
 				printError (" cannot configure initial port buffer for %s", buf2);
@@ -193,6 +194,7 @@ ffado_driver_attach (ffado_driver_t *driver)
 			}
 			driver->capture_ports =
 				jack_slist_append (driver->capture_ports, port);
+			driver->capture_channels[chn].port = port;
 			// setup port parameters
 			if (ffado_streaming_set_capture_stream_buffer (driver->dev, chn, NULL)) {
 				printError (" cannot configure initial port buffer for %s", buf2);
@@ -238,6 +240,7 @@ ffado_driver_attach (ffado_driver_t *driver)
 			}
 			driver->playback_ports =
 				jack_slist_append (driver->playback_ports, port);
+			driver->playback_channels[chn].port = port;
 
 			// setup port parameters
 			if (ffado_streaming_set_playback_stream_buffer (driver->dev, chn, NULL)) {
@@ -257,6 +260,7 @@ ffado_driver_attach (ffado_driver_t *driver)
 			}
 			driver->playback_ports =
 				jack_slist_append (driver->playback_ports, port);
+			driver->playback_channels[chn].port = port;
 
 			// setup port parameters
 			if (ffado_streaming_set_playback_stream_buffer (driver->dev, chn, NULL)) {
@@ -269,6 +273,8 @@ ffado_driver_attach (ffado_driver_t *driver)
 			midi_pack_reset (&driver->playback_channels[chn].midi_pack);
 			// setup the midi buffer
 			driver->playback_channels[chn].midi_buffer = calloc (driver->period_size, sizeof(uint32_t));
+			driver->playback_channels[chn].midi_slots = calloc (driver->period_size / 8 + 1, sizeof(uint32_t));
+			driver->playback_channels[chn].nb_midi_slots = 0;
 		} else {
 			printMessage ("Don't register playback port %s", buf);
 
@@ -283,6 +289,8 @@ ffado_driver_attach (ffado_driver_t *driver)
 		return -1;
 	}
 
+	ffado_driver_reset_streams (driver);
+
 	return jack_activate (driver->client);
 }
 
@@ -319,6 +327,7 @@ ffado_driver_detach (ffado_driver_t *driver)
 
 	jack_slist_free (driver->playback_ports);
 	driver->playback_ports = 0;
+	driver->plan_valid = 0;
 
 	ffado_streaming_finish (driver->dev);
 	driver->dev = NULL;
@@ -329,10 +338,14 @@ ffado_driver_detach (ffado_driver_t *driver)
 		}
 	free (driver->capture_channels);
 
-	for (chn = 0; chn < driver->playback_nchannels; chn++)
+	for (chn = 0; chn < driver->playback_nchannels; chn++) {
 		if (driver->playback_channels[chn].midi_buffer) {
 			free (driver->playback_channels[chn].midi_buffer);
 		}
+		if (driver->playback_channels[chn].midi_slots) {
+			free (driver->playback_channels[chn].midi_slots);
+		}
+	}
 	free (driver->playback_channels);
 
 	free (driver->nullbuffer);
@@ -340,42 +353,163 @@ ffado_driver_detach (ffado_driver_t *driver)
 	return 0;
 }
 
+/* FFADO keeps the buffer and on/off state of each stream between
+ * cycles, so they are only passed on when they differ from what the
+ * library was given last.
+ */
+static inline void
+ffado_driver_set_capture_stream (ffado_driver_t *driver, channel_t chn,
+				 void *buf, int on)
+{
+	ffado_capture_channel_t *c = &driver->capture_channels[chn];
+
+	if (c->stream_buffer != buf) {
+		ffado_streaming_set_capture_stream_buffer (driver->dev, chn, (char*)buf);
+		c->stream_buffer = buf;
+	}
+	if (c->stream_on != on) {
+		ffado_streaming_capture_stream_onoff (driver->dev, chn, on);
+		c->stream_on = on;
+	}
+}
+
+static inline void
+ffado_driver_set_playback_stream (ffado_driver_t *driver, channel_t chn,
+				  void *buf, int on)
+{
+	ffado_playback_channel_t *c = &driver->playback_channels[chn];
+
+	if (c->stream_buffer != buf) {
+		ffado_streaming_set_playback_stream_buffer (driver->dev, chn, (char*)buf);
+		c->stream_buffer = buf;
+	}
+	if (c->stream_on != on) {
+		ffado_streaming_playback_stream_onoff (driver->dev, chn, on);
+		c->stream_on = on;
+	}
+}
+
+/* forget what FFADO was told, so that the next cycle tells it again */
+static void
+ffado_driver_reset_streams (ffado_driver_t *driver)
+{
+	channel_t chn;
+
+	for (chn = 0; chn < driver->capture_nchannels; chn++) {
+		driver->capture_channels[chn].stream_buffer = NULL;
+		driver->capture_channels[chn].stream_on = -1;
+	}
+	for (chn = 0; chn < driver->playback_nchannels; chn++) {
+		driver->playback_channels[chn].stream_buffer = NULL;
+		driver->playback_channels[chn].stream_on = -1;
+	}
+	driver->plan_valid = 0;
+}
+
+/* Look up the connections and port buffers of every channel, but only
+ * when the graph or the period has changed since the last cycle.
+ * Playback ports with more than one connection are mixed down into
+ * their own buffer, which still has to happen every cycle.
+ */
+static void
+ffado_driver_update_plan (ffado_driver_t *driver, jack_nframes_t nframes)
+{
+	ffado_capture_channel_t *cc;
+	ffado_playback_channel_t *pc;
+	channel_t chn;
+
+	if (driver->plan_valid
+	    && driver->plan_generation == driver->engine->graph_generation
+	    && driver->plan_nframes == nframes) {
+		return;
+	}
+
+	for (chn = 0; chn < driver->capture_nchannels; chn++) {
+		cc = &driver->capture_channels[chn];
+		if (cc->port == NULL) {
+			cc->connections = 0;
+			cc->buffer = NULL;
+			continue;
+		}
+		cc->connections = jack_port_connected (cc->port);
+		cc->buffer = jack_port_get_buffer (cc->port, nframes);
+	}
+
+	for (chn = 0; chn < driver->playback_nchannels; chn++) {
+		pc = &driver->playback_channels[chn];
+		if (pc->port == NULL) {
+			pc->connections = 0;
+			pc->buffer = NULL;
+			continue;
+		}
+		pc->connections = jack_port_connected (pc->port);
+		pc->buffer = pc->connections ?
+			     jack_port_get_buffer (pc->port, nframes) : NULL;
+	}
+
+	driver->plan_generation = driver->engine->graph_generation;
+	driver->plan_nframes = nframes;
+	driver->plan_valid = 1;
+}
+
+/* libffado puts capture MIDI bytes on every 8th word, and almost all
+ * of those are empty. Test eight of them (64 frames) with one OR and
+ * only look at single words once a group has something in it.
+ */
+static inline jack_nframes_t
+ffado_midi_next (const uint32_t *midi_buffer, jack_nframes_t i,
+		 jack_nframes_t nframes)
+{
+	while (i + 64 <= nframes) {
+		if ((midi_buffer[i] | midi_buffer[i + 8] |
+		     midi_buffer[i + 16] | midi_buffer[i + 24] |
+		     midi_buffer[i + 32] | midi_buffer[i + 40] |
+		     midi_buffer[i + 48] | midi_buffer[i + 56]) & 0xFF000000) {
+			break;
+		}
+		i += 64;
+	}
+	return i;
+}
+
+/* put one MIDI byte into a playback slot and remember the slot, so the
+ * next period can clear just the slots it used */
+static inline void
+ffado_midi_put (ffado_playback_channel_t *c, int pos, unsigned char byte)
+{
+	c->midi_buffer[pos] = 0x01000000 | byte;
+	c->midi_slots[c->nb_midi_slots++] = pos;
+}
+
 static int
 ffado_driver_read (ffado_driver_t * driver, jack_nframes_t nframes)
 {
+	ffado_capture_channel_t *c;
 	channel_t chn;
-	int nb_connections;
-	JSList *node;
-	jack_port_t* port;
 
 	printEnter ();
-	for (chn = 0, node = driver->capture_ports; node; node = jack_slist_next (node), chn++) {
-		if (driver->capture_channels[chn].stream_type == ffado_stream_type_audio) {
-			port = (jack_port_t*)node->data;
-			nb_connections = jack_port_connected (port);
 
+	ffado_driver_update_plan (driver, nframes);
+
+	for (chn = 0; chn < driver->capture_nchannels; chn++) {
+		c = &driver->capture_channels[chn];
+
+		if (c->port == NULL) {
+			/* ensure a valid buffer */
+			ffado_driver_set_capture_stream (driver, chn, driver->scratchbuffer, 0);
+		} else if (c->stream_type == ffado_stream_type_audio) {
 			/* if there are no connections, use the dummy buffer and disable the stream */
-			if (nb_connections) {
-				ffado_streaming_capture_stream_onoff (driver->dev, chn, 1);
-				ffado_streaming_set_capture_stream_buffer (driver->dev, chn, (char*)(jack_port_get_buffer (port, nframes)));
+			if (c->connections) {
+				ffado_driver_set_capture_stream (driver, chn, c->buffer, 1);
 			} else {
-				ffado_streaming_capture_stream_onoff (driver->dev, chn, 0);
-				ffado_streaming_set_capture_stream_buffer (driver->dev, chn, (char*)(driver->scratchbuffer));
-			}
-		} else if (driver->capture_channels[chn].stream_type == ffado_stream_type_midi) {
-			port = (jack_port_t*)node->data;
-			nb_connections = jack_port_connected (port);
-			if (nb_connections) {
-				ffado_streaming_capture_stream_onoff (driver->dev, chn, 1);
-			} else {
-				ffado_streaming_capture_stream_onoff (driver->dev, chn, 0);
+				ffado_driver_set_capture_stream (driver, chn, driver->scratchbuffer, 0);
 			}
+		} else if (c->stream_type == ffado_stream_type_midi) {
 			/* always set a buffer */
-			ffado_streaming_set_capture_stream_buffer (driver->dev, chn,
-								   (char*)(driver->capture_channels[chn].midi_buffer));
-		} else { /* ensure a valid buffer */
-			ffado_streaming_set_capture_stream_buffer (driver->dev, chn, (char*)(driver->scratchbuffer));
-			ffado_streaming_capture_stream_onoff (driver->dev, chn, 0);
+			ffado_driver_set_capture_stream (driver, chn, c->midi_buffer,
+							 c->connections ? 1 : 0);
+		} else {
+			ffado_driver_set_capture_stream (driver, chn, driver->scratchbuffer, 0);
 		}
 	}
 
@@ -383,28 +517,29 @@ ffado_driver_read (ffado_driver_t * driver, jack_nframes_t nframes)
 	ffado_streaming_transfer_capture_buffers (driver->dev);
 
 	/* process the midi data */
-	for (chn = 0, node = driver->capture_ports; node; node = jack_slist_next (node), chn++) {
-		if (driver->capture_channels[chn].stream_type == ffado_stream_type_midi) {
+	for (chn = 0; chn < driver->capture_nchannels; chn++) {
+		c = &driver->capture_channels[chn];
+
+		if (c->port != NULL && c->stream_type == ffado_stream_type_midi) {
 			jack_default_audio_sample_t* buf;
 			int i;
 			int done;
-			uint32_t *midi_buffer = driver->capture_channels[chn].midi_buffer;
-			midi_unpack_t *midi_unpack = &driver->capture_channels[chn].midi_unpack;
-			port = (jack_port_t*)node->data;
-			nb_connections = jack_port_connected (port);
-			buf = jack_port_get_buffer (port, nframes);
+			uint32_t *midi_buffer = c->midi_buffer;
+			midi_unpack_t *midi_unpack = &c->midi_unpack;
+			buf = jack_port_get_buffer (c->port, nframes);
 
 			/* if the returned buffer is invalid, discard the midi data */
 			jack_midi_clear_buffer (buf);
 
 			/* no connections means no processing */
-			if (nb_connections == 0) {
+			if (c->connections == 0) {
 				continue;
 			}
 
 			/* else unpack
 			   note that libffado guarantees that midi bytes are on 8-byte aligned indexes */
-			for (i = 0; i < nframes; i += 8) {
+			for (i = ffado_midi_next (midi_buffer, 0, nframes); i < nframes;
+			     i = ffado_midi_next (midi_buffer, i + 8, nframes)) {
 				if (midi_buffer[i] & 0xFF000000) {
 					done = midi_unpack_buf (midi_unpack, (unsigned char*)(midi_buffer + i), 1, buf, i);
 					if (done != 1) {
@@ -423,10 +558,8 @@ ffado_driver_read (ffado_driver_t * driver, jack_nframes_t nframes)
 static int
 ffado_driver_write (ffado_driver_t * driver, jack_nframes_t nframes)
 {
+	ffado_playback_channel_t *c;
 	channel_t chn;
-	int nb_connections;
-	JSList *node;
-	jack_port_t *port;
 
 	printEnter ();
 
@@ -435,55 +568,59 @@ ffado_driver_write (ffado_driver_t * driver, jack_nframes_t nframes)
 		return 0;
 	}
 
-	for (chn = 0, node = driver->playback_ports; node; node = jack_slist_next (node), chn++) {
-		if (driver->playback_channels[chn].stream_type == ffado_stream_type_audio) {
-			port = (jack_port_t*)node->data;
-			nb_connections = jack_port_connected (port);
+	ffado_driver_update_plan (driver, nframes);
+
+	for (chn = 0; chn < driver->playback_nchannels; chn++) {
+		c = &driver->playback_channels[chn];
 
+		if (c->port == NULL) {
+			/* ensure a valid buffer */
+			ffado_driver_set_playback_stream (driver, chn, driver->nullbuffer, 0);
+		} else if (c->stream_type == ffado_stream_type_audio) {
 			/* use the silent buffer + disable if there are no connections */
-			if (nb_connections) {
-				ffado_streaming_playback_stream_onoff (driver->dev, chn, 1);
-				ffado_streaming_set_playback_stream_buffer (driver->dev, chn, (char*)(jack_port_get_buffer (port, nframes)));
+			if (c->connections > 1) {
+				c->buffer = jack_port_get_buffer (c->port, nframes);
+			}
+			if (c->connections) {
+				ffado_driver_set_playback_stream (driver, chn, c->buffer, 1);
 			} else {
-				ffado_streaming_playback_stream_onoff (driver->dev, chn, 0);
-				ffado_streaming_set_playback_stream_buffer (driver->dev, chn, (char*)(driver->nullbuffer));
+				ffado_driver_set_playback_stream (driver, chn, driver->nullbuffer, 0);
 			}
-		} else if (driver->playback_channels[chn].stream_type == ffado_stream_type_midi) {
+		} else if (c->stream_type == ffado_stream_type_midi) {
 			jack_default_audio_sample_t* buf;
 			int nevents;
 			int i;
-			midi_pack_t *midi_pack = &driver->playback_channels[chn].midi_pack;
-			uint32_t *midi_buffer = driver->playback_channels[chn].midi_buffer;
+			midi_pack_t *midi_pack = &c->midi_pack;
+			uint32_t *midi_buffer = c->midi_buffer;
 			int min_next_pos = 0;
 
-			port = (jack_port_t*)node->data;
-			nb_connections = jack_port_connected (port);
-
 			/* skip if no connections */
-			if (nb_connections == 0) {
-				ffado_streaming_set_playback_stream_buffer (driver->dev, chn, (char*)(driver->nullbuffer));
-				ffado_streaming_playback_stream_onoff (driver->dev, chn, 0);
+			if (c->connections == 0) {
+				ffado_driver_set_playback_stream (driver, chn, driver->nullbuffer, 0);
 				continue;
 			}
 
-			memset (midi_buffer, 0, nframes * sizeof(uint32_t));
-			ffado_streaming_set_playback_stream_buffer (driver->dev, chn, (char*)(midi_buffer));
-			ffado_streaming_playback_stream_onoff (driver->dev, chn, 1);
+			/* the rest of the buffer is still zero from before */
+			for (i = 0; i < c->nb_midi_slots; i++) {
+				midi_buffer[c->midi_slots[i]] = 0;
+			}
+			c->nb_midi_slots = 0;
+			ffado_driver_set_playback_stream (driver, chn, midi_buffer, 1);
 
 			/* check if we still have to process bytes from the previous period */
 			/*
-			   if(driver->playback_channels[chn].nb_overflow_bytes) {
-			        printMessage("have to process %d bytes from previous period", driver->playback_channels[chn].nb_overflow_bytes);
+			   if(c->nb_overflow_bytes) {
+			        printMessage("have to process %d bytes from previous period", c->nb_overflow_bytes);
 			   }
 			 */
-			for (i = 0; i < driver->playback_channels[chn].nb_overflow_bytes; ++i) {
-				midi_buffer[min_next_pos] = 0x01000000 | (driver->playback_channels[chn].overflow_buffer[i] & 0xFF);
+			for (i = 0; i < c->nb_overflow_bytes; ++i) {
+				ffado_midi_put (c, min_next_pos, c->overflow_buffer[i]);
 				min_next_pos += 8;
 			}
-			driver->playback_channels[chn].nb_overflow_bytes = 0;
+			c->nb_overflow_bytes = 0;
 
 			/* process the events in this period */
-			buf = jack_port_get_buffer (port, nframes);
+			buf = jack_port_get_buffer (c->port, nframes);
 			nevents = jack_midi_get_event_count (buf);
 
 			for (i = 0; i < nevents; ++i) {
@@ -504,14 +641,14 @@ ffado_driver_write (ffado_driver_t * driver, jack_nframes_t nframes)
 					if (pos >= nframes) {
 						int f;
 						/* printMessage("midi message crosses period boundary"); */
-						driver->playback_channels[chn].nb_overflow_bytes = event.size - j;
-						if (driver->playback_channels[chn].nb_overflow_bytes > MIDI_OVERFLOW_BUFFER_SIZE) {
+						c->nb_overflow_bytes = event.size - j;
+						if (c->nb_overflow_bytes > MIDI_OVERFLOW_BUFFER_SIZE) {
 							printError ("too much midi bytes cross period boundary");
-							driver->playback_channels[chn].nb_overflow_bytes = MIDI_OVERFLOW_BUFFER_SIZE;
+							c->nb_overflow_bytes = MIDI_OVERFLOW_BUFFER_SIZE;
 						}
 						/* save the bytes that still have to be transmitted in the next period */
-						for (f = 0; f < driver->playback_channels[chn].nb_overflow_bytes; f++)
-							driver->playback_channels[chn].overflow_buffer[f] = event.buffer[j + f];
+						for (f = 0; f < c->nb_overflow_bytes; f++)
+							c->overflow_buffer[f] = event.buffer[j + f];
 						 /* exit since we can't transmit anything anymore.
 						    the rate should be controlled */
 						if (i < nevents - 1) {
@@ -519,15 +656,14 @@ ffado_driver_write (ffado_driver_t * driver, jack_nframes_t nframes)
 						}
 						break;
 					} else {
-						midi_buffer[pos] = 0x01000000 | (event.buffer[j] & 0xFF);
+						ffado_midi_put (c, pos, event.buffer[j]);
 						pos += 8;
 						min_next_pos = pos;
 					}
 				}
 			}
 		} else { /* ensure a valid buffer */
-			ffado_streaming_set_playback_stream_buffer (driver->dev, chn, (char*)(driver->nullbuffer));
-			ffado_streaming_playback_stream_onoff (driver->dev, chn, 0);
+			ffado_driver_set_playback_stream (driver, chn, driver->nullbuffer, 0);
 		}
 	}
 
@@ -640,8 +776,6 @@ static int
 ffado_driver_null_cycle (ffado_driver_t* driver, jack_nframes_t nframes)
 {
 	channel_t chn;
-	JSList *node;
-	ffado_streaming_stream_type stream_type;
 
 	printEnter ();
 
@@ -650,20 +784,19 @@ ffado_driver_null_cycle (ffado_driver_t* driver, jack_nframes_t nframes)
 	}
 
 	// write silence to buffer
-	for (chn = 0, node = driver->playback_ports; node; node = jack_slist_next (node), chn++) {
-		stream_type = ffado_streaming_get_playback_stream_type (driver->dev, chn);
-
-		if (stream_type == ffado_stream_type_audio) {
-			ffado_streaming_set_playback_stream_buffer (driver->dev, chn, (char*)(driver->nullbuffer));
+	for (chn = 0; chn < driver->playback_nchannels; chn++) {
+		if (driver->playback_channels[chn].stream_type == ffado_stream_type_audio) {
+			ffado_driver_set_playback_stream (driver, chn, driver->nullbuffer,
+							  driver->playback_channels[chn].stream_on);
 		}
 	}
 	ffado_streaming_transfer_playback_buffers (driver->dev);
 
 	// read & discard from input ports
-	for (chn = 0, node = driver->capture_ports; node; node = jack_slist_next (node), chn++) {
-		stream_type = ffado_streaming_get_capture_stream_type (driver->dev, chn);
-		if (stream_type == ffado_stream_type_audio) {
-			ffado_streaming_set_capture_stream_buffer (driver->dev, chn, (char*)(driver->scratchbuffer));
+	for (chn = 0; chn < driver->capture_nchannels; chn++) {
+		if (driver->capture_channels[chn].stream_type == ffado_stream_type_audio) {
+			ffado_driver_set_capture_stream (driver, chn, driver->scratchbuffer,
+							 driver->capture_channels[chn].stream_on);
 		}
 	}
 	ffado_streaming_transfer_capture_buffers (driver->dev);
@@ -677,6 +810,8 @@ ffado_driver_start (ffado_driver_t *driver)
 {
 	int retval = 0;
 
+	ffado_driver_reset_streams (driver);
+
 	if ((retval = ffado_streaming_start (driver->dev))) {
 		printError ("Could not start streaming threads: %d", retval);
 		return retval;
@@ -718,6 +853,8 @@ ffado_driver_bufsize (ffado_driver_t* driver, jack_nframes_t nframes)
 				    * 1000000.0f);
 
 	// Reallocate the null and scratch buffers.
+	free (driver->nullbuffer);
+	free (driver->scratchbuffer);
 	driver->nullbuffer = calloc (driver->period_size, sizeof(ffado_sample_t));
 	if (driver->nullbuffer == NULL) {
 		printError ("could not allocate memory for null buffer");
@@ -744,7 +881,12 @@ ffado_driver_bufsize (ffado_driver_t* driver, jack_nframes_t nframes)
 			if (driver->playback_channels[chn].midi_buffer != NULL) {
 				free (driver->playback_channels[chn].midi_buffer);
 			}
+			if (driver->playback_channels[chn].midi_slots != NULL) {
+				free (driver->playback_channels[chn].midi_slots);
+			}
 			driver->playback_channels[chn].midi_buffer = calloc (driver->period_size, sizeof(uint32_t));
+			driver->playback_channels[chn].midi_slots = calloc (driver->period_size / 8 + 1, sizeof(uint32_t));
+			driver->playback_channels[chn].nb_midi_slots = 0;
 		}
 	}
 
@@ -758,6 +900,8 @@ ffado_driver_bufsize (ffado_driver_t* driver, jack_nframes_t nframes)
 	// properly update to the changes.
 	sleep (1);
 
+	ffado_driver_reset_streams (driver);
+
 	/* tell the engine to change its buffer size */
 	if (driver->engine->set_buffer_size (driver->engine, nframes)) {
 		jack_error ("FFADO: cannot set engine buffer size to %d (check MIDI)", nframes);
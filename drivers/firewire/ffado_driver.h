@@ -143,6 +143,13 @@ typedef struct _ffado_capture_channel {
 	ffado_streaming_stream_type stream_type;
 	midi_unpack_t midi_unpack;
 	uint32_t *midi_buffer;
+	jack_port_t *port;              // NULL if no port was registered
+	// as of the last graph change
+	int connections;
+	void *buffer;
+	// what FFADO was last told, -1/NULL if unknown
+	int stream_on;
+	void *stream_buffer;
 } ffado_capture_channel_t;
 
 #define MIDI_OVERFLOW_BUFFER_SIZE 4
@@ -150,10 +157,20 @@ typedef struct _ffado_playback_channel {
 	ffado_streaming_stream_type stream_type;
 	midi_pack_t midi_pack;
 	uint32_t *midi_buffer;
+	// the words of midi_buffer written this period
+	uint32_t *midi_slots;
+	unsigned int nb_midi_slots;
 	// to hold the midi bytes that couldn't be transferred
 	// during the previous period
 	char overflow_buffer[MIDI_OVERFLOW_BUFFER_SIZE];
 	unsigned int nb_overflow_bytes;
+	jack_port_t *port;              // NULL if no port was registered
+	// as of the last graph change
+	int connections;
+	void *buffer;
+	// what FFADO was last told, -1/NULL if unknown
+	int stream_on;
+	void *stream_buffer;
 } ffado_playback_channel_t;
 
 /*
@@ -195,6 +212,11 @@ struct _ffado_driver {
 	ffado_playback_channel_t *playback_channels;
 	ffado_capture_channel_t  *capture_channels;
 
+	// the graph and period the channels' connections were looked up for
+	unsigned long plan_generation;
+	jack_nframes_t plan_nframes;
+	int plan_valid;
+
 	jack_nframes_t playback_frame_latency;
 	jack_nframes_t capture_frame_latency;
 
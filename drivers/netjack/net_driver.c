@@ -78,6 +78,37 @@ net_driver_wait (net_driver_t *driver, int extra_fd, int *status, float *delayed
 	return netj->period_size;
 }
 
+static int net_driver_send (net_driver_t* driver, jack_nframes_t nframes);
+
+// A cycle of the network thread while we follow the local clock: the
+// packet in goes to the capture ring, the packet out comes from the
+// playback ring, and the engine runs on its own.
+static int
+net_driver_local_cycle (net_driver_t *driver)
+{
+	netjack_driver_state_t *netj = &(driver->netj);
+	jacknet_packet_header *pkthdr;
+
+	netjack_wait (netj, driver->engine->get_microseconds);
+
+	if (netj->running_free) {
+		return 0;
+	}
+
+	if (netj->packet_data_valid) {
+		pkthdr = (jacknet_packet_header*)netj->rx_buf;
+		netj->reply_port = pkthdr->reply_port;
+		netj->latency = pkthdr->latency;
+
+		netjack_local_receive (netj, (char*)netj->rx_buf + sizeof(jacknet_packet_header));
+		packet_cache_release_packet (netj->packcache, netj->expected_framecnt);
+	} else {
+		netjack_local_receive (netj, NULL);
+	}
+
+	return net_driver_send (driver, netj->period_size);
+}
+
 static int
 net_driver_run_cycle (net_driver_t *driver)
 {
@@ -86,6 +117,10 @@ net_driver_run_cycle (net_driver_t *driver)
 	int wait_status = -1;
 	float delayed_usecs;
 
+	if (driver->netj.local) {
+		return net_driver_local_cycle (driver);
+	}
+
 	jack_nframes_t nframes = net_driver_wait (driver, -1, &wait_status,
 						  &delayed_usecs);
 
@@ -131,6 +166,32 @@ net_driver_bufsize (net_driver_t* driver, jack_nframes_t nframes)
 	return 0;
 }
 
+// Link loss and jitter for the server's --metrics. The counters are
+// read without a lock; at worst a scrape lands between the periodic
+// report folding them into the totals and clearing them.
+static int
+net_driver_metrics (net_driver_t* driver, char *buf, size_t size)
+{
+	netjack_driver_state_t *netj = &(driver->netj);
+
+	return snprintf (buf, size,
+			 "# TYPE jack_netjack_lost_packets counter\n"
+			 "# HELP jack_netjack_lost_packets Periods whose packet did not arrive in time.\n"
+			 "jack_netjack_lost_packets_total %u\n"
+			 "# TYPE jack_netjack_resyncs counter\n"
+			 "jack_netjack_resyncs_total %u\n"
+			 "# TYPE jack_netjack_jitter_seconds gauge\n"
+			 "# UNIT jack_netjack_jitter_seconds seconds\n"
+			 "jack_netjack_jitter_seconds %g\n"
+			 "# TYPE jack_netjack_playout_target_seconds gauge\n"
+			 "# UNIT jack_netjack_playout_target_seconds seconds\n"
+			 "jack_netjack_playout_target_seconds %g\n",
+			 netj->stats_lost_total + netj->stats_lost,
+			 netj->stats_resyncs_total + netj->stats_resyncs,
+			 netj->jitter_usecs * 1e-6,
+			 netj->target_usecs * 1e-6);
+}
+
 static int
 net_driver_read (net_driver_t* driver, jack_nframes_t nframes)
 {
@@ -141,8 +202,13 @@ net_driver_read (net_driver_t* driver, jack_nframes_t nframes)
 
 	unsigned int *packet_buf, *packet_bufX;
 
+	if (netj->local) {
+		netjack_local_read (netj, nframes, driver->engine->control->frame_timer.period_usecs);
+		return 0;
+	}
+
 	if ( !netj->packet_data_valid ) {
-		render_payload_to_jack_ports (netj->bitdepth, NULL, netj->net_period_down, netj->capture_ports, netj->capture_srcs, nframes, netj->dont_htonl_floats );
+		render_payload_to_jack_ports (netj->bitdepth, NULL, netj->net_period_down, netj->capture_plan, nframes, netj->dont_htonl_floats );
 		return 0;
 	}
 	packet_buf = netj->rx_buf;
@@ -212,14 +278,14 @@ net_driver_read (net_driver_t* driver, jack_nframes_t nframes)
 		}
 	}
 
-	render_payload_to_jack_ports (netj->bitdepth, packet_bufX, netj->net_period_down, netj->capture_ports, netj->capture_srcs, nframes, netj->dont_htonl_floats );
+	render_payload_to_jack_ports (netj->bitdepth, packet_bufX, netj->net_period_down, netj->capture_plan, nframes, netj->dont_htonl_floats );
 	packet_cache_release_packet (netj->packcache, netj->expected_framecnt );
 
 	return 0;
 }
 
 static int
-net_driver_write (net_driver_t* driver, jack_nframes_t nframes)
+net_driver_send (net_driver_t* driver, jack_nframes_t nframes)
 {
 	netjack_driver_state_t *netj = &(driver->netj);
 
@@ -228,6 +294,7 @@ net_driver_write (net_driver_t* driver, jack_nframes_t nframes)
 	uint32_t *packet_buf, *packet_bufX;
 
 	int packet_size = get_sample_size (netj->bitdepth) * netj->playback_channels * netj->net_period_up + sizeof(jacknet_packet_header);
+	int data_size;
 	jacknet_packet_header *pkthdr;
 
 	packet_buf = alloca (packet_size);
@@ -260,10 +327,17 @@ net_driver_write (net_driver_t* driver, jack_nframes_t nframes)
 	pkthdr->framecnt = netj->expected_framecnt;
 
 
-	render_jack_ports_to_payload (netj->bitdepth, netj->playback_ports, netj->playback_srcs, nframes, packet_bufX, netj->net_period_up, netj->dont_htonl_floats );
+	if (netj->local) {
+		data_size = sizeof(jacknet_packet_header) + netjack_local_send (netj, packet_bufX);
+	} else {
+		data_size = sizeof(jacknet_packet_header) +
+			    render_jack_ports_to_payload (netj->bitdepth, netj->playback_plan, nframes, packet_bufX, netj->net_period_up, netj->dont_htonl_floats, netj->codec_pool );
+	}
 
 	packet_header_hton (pkthdr);
-	if (netj->srcaddress_valid) {
+	if (netj->shm) {
+		netjack_shm_send (netj->shm, (char*)packet_buf, packet_size);
+	} else if (netj->srcaddress_valid) {
 		int r;
 
 #ifndef MSG_CONFIRM
@@ -276,20 +350,58 @@ net_driver_write (net_driver_t* driver, jack_nframes_t nframes)
 			netj->syncsource_address.sin_port = htons (netj->reply_port);
 		}
 
-		for ( r = 0; r < netj->redundancy; r++ )
-			netjack_sendto (netj->sockfd, (char*)packet_buf, packet_size,
-					flag, (struct sockaddr*)&(netj->syncsource_address), sizeof(struct sockaddr_in), netj->mtu);
+		for ( r = 0; r < netj->redundancy; r++ ) {
+			netjack_sendto (netj->sockfd, (char*)packet_buf, packet_size, data_size,
+					flag, (struct sockaddr*)&(netj->syncsource_address), sizeof(struct sockaddr_in), netj->mtu, netj->fec);
+			if (netj->redundant_master.s_addr != htonl (INADDR_ANY)) {
+				struct sockaddr_in second = netj->syncsource_address;
+
+				second.sin_addr = netj->redundant_master;
+				netjack_sendto (netj->sockfd, (char*)packet_buf, packet_size, data_size,
+						flag, (struct sockaddr*)&second, sizeof(struct sockaddr_in), netj->mtu, netj->fec);
+			}
+		}
 	}
 
 	return 0;
 }
 
+static int
+net_driver_write (net_driver_t* driver, jack_nframes_t nframes)
+{
+	netjack_driver_state_t *netj = &(driver->netj);
+
+	if (netj->local) {
+		netjack_local_write (netj, nframes);
+		return 0;
+	}
+
+	return net_driver_send (driver, nframes);
+}
+
 
 static int
 net_driver_attach (net_driver_t *driver)
 {
 	netjack_driver_state_t *netj = &( driver->netj );
 
+	if (driver->engine->driver != (jack_driver_t*)driver
+	    && !driver->engine->backup_attach && !driver->engine->domain_attach) {
+		// loaded as a slave: the master driver's clock runs the
+		// cycles, and we resample to it
+		if (jack_get_sample_rate (netj->client) != netj->sample_rate) {
+			jack_error ("netjack: the master runs at %" PRIu32 " Hz, the local clock at %" PRIu32 " Hz",
+				    netj->sample_rate, jack_get_sample_rate (netj->client));
+			return -1;
+		}
+		netjack_attach ( netj );
+		if (netjack_local_start (netj, driver->engine->control->buffer_size)) {
+			netjack_detach ( netj );
+			return -1;
+		}
+		return 0;
+	}
+
 	if (driver->engine->set_buffer_size (driver->engine, netj->period_size)) {
 		jack_error ("netjack: cannot set engine buffer size to %d (check MIDI)", netj->period_size);
 		return -1;
@@ -309,6 +421,7 @@ net_driver_detach (net_driver_t *driver)
 		return 0;
 	}
 
+	netjack_local_stop ( netj );
 	netjack_detach ( netj );
 	return 0;
 }
@@ -336,13 +449,28 @@ net_driver_new (jack_client_t * client,
 		unsigned int transport_sync,
 		unsigned int resample_factor,
 		unsigned int resample_factor_up,
+		unsigned int resample_quality,
 		unsigned int bitdepth,
 		unsigned int use_autoconfig,
 		unsigned int latency,
 		unsigned int redundancy,
 		int dont_htonl_floats,
 		int always_deadline,
-		int jitter_val)
+		int jitter_val,
+		unsigned int encoder_threads,
+		unsigned int adaptive,
+		unsigned int fec,
+		unsigned int midi_packed,
+		const char *multicast_group,
+		const char *packet_ring,
+		const char *local_socket,
+		unsigned int busy_poll,
+		unsigned int socket_priority,
+		unsigned int dscp,
+		unsigned int rcvbuf,
+		unsigned int sndbuf,
+		unsigned int spin_usecs,
+		const char *redundant_master)
 {
 	net_driver_t * driver;
 
@@ -361,13 +489,14 @@ net_driver_new (jack_client_t * client,
 	driver->nt_detach     = (JackDriverNTDetachFunction)net_driver_detach;
 	driver->nt_bufsize    = (JackDriverNTBufSizeFunction)net_driver_bufsize;
 	driver->nt_run_cycle  = (JackDriverNTRunCycleFunction)net_driver_run_cycle;
+	driver->metrics       = (JackDriverMetricsFunction)net_driver_metrics;
 
 	driver->last_wait_ust = 0;
 	driver->engine = NULL;
 
 	netjack_driver_state_t *netj = &(driver->netj);
 
-	netjack_init ( netj,
+	if ( !netjack_init ( netj,
 		       client,
 		       name,
 		       capture_ports,
@@ -380,13 +509,32 @@ net_driver_new (jack_client_t * client,
 		       transport_sync,
 		       resample_factor,
 		       resample_factor_up,
+		       resample_quality,
 		       bitdepth,
 		       use_autoconfig,
 		       latency,
 		       redundancy,
 		       dont_htonl_floats,
 		       always_deadline,
-		       jitter_val      );
+		       jitter_val,
+		       encoder_threads,
+		       adaptive,
+		       fec,
+		       midi_packed,
+		       multicast_group,
+		       packet_ring,
+		       local_socket,
+		       busy_poll,
+		       socket_priority,
+		       dscp,
+		       rcvbuf,
+		       sndbuf,
+		       spin_usecs,
+		       redundant_master ) ) {
+		jack_driver_nt_finish ((jack_driver_nt_t*)driver);
+		free (driver);
+		return NULL;
+	}
 
 	netjack_startup ( netj );
 
@@ -411,7 +559,7 @@ driver_get_descriptor ()
 
 	desc = calloc (1, sizeof(jack_driver_desc_t));
 	strcpy (desc->name, "net");
-	desc->nparams = 18;
+	desc->nparams = 34;
 
 	params = calloc (desc->nparams, sizeof(jack_driver_param_desc_t));
 
@@ -499,6 +647,18 @@ driver_get_descriptor ()
 		"Factor for sample rate reduction on the upstream (deprecated)");
 	strcpy (params[i].long_desc, params[i].short_desc);
 
+	i++;
+	strcpy (params[i].name, "resample-quality");
+	params[i].character  = 'q';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 2U;
+	strcpy (params[i].short_desc,
+		"Resampler quality (0 libsamplerate, 1-3 built-in)");
+	strcpy (params[i].long_desc,
+		"Resampler used when a factor reduces the sample rate: 0 uses "
+		"libsamplerate's linear converter, 1 to 3 use the built-in "
+		"polyphase filter with increasing length (defaults to 2)");
+
 	i++;
 	strcpy (params[i].name, "celt");
 	params[i].character  = 'c';
@@ -508,6 +668,24 @@ driver_get_descriptor ()
 		"sets celt encoding and kbits value one channel is encoded at");
 	strcpy (params[i].long_desc, params[i].short_desc);
 
+	i++;
+	strcpy (params[i].name, "opus");
+	params[i].character  = 'P';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 0U;
+	strcpy (params[i].short_desc,
+		"sets opus encoding and kbits value one channel is encoded at");
+	strcpy (params[i].long_desc, params[i].short_desc);
+
+	i++;
+	strcpy (params[i].name, "encoder-threads");
+	params[i].character  = 'T';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 0U;
+	strcpy (params[i].short_desc,
+		"Extra threads encoding opus channels in parallel");
+	strcpy (params[i].long_desc, params[i].short_desc);
+
 	i++;
 	strcpy (params[i].name, "bit-depth");
 	params[i].character  = 'b';
@@ -543,6 +721,131 @@ driver_get_descriptor ()
 		"Send packets N times");
 	strcpy (params[i].long_desc, params[i].short_desc);
 
+	i++;
+	strcpy (params[i].name, "fec");
+	params[i].character  = 'F';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 0U;
+	strcpy (params[i].short_desc,
+		"Send a parity fragment with fragmented packets");
+	strcpy (params[i].long_desc, params[i].short_desc);
+
+	i++;
+	strcpy (params[i].name, "midi-packed");
+	params[i].character  = 'm';
+	params[i].type       = JackDriverParamBool;
+	params[i].value.i    = 0;
+	strcpy (params[i].short_desc,
+		"Pack MIDI events after the audio instead of in per-port slots");
+	strcpy (params[i].long_desc, params[i].short_desc);
+
+	i++;
+	strcpy (params[i].name, "multicast-group");
+	params[i].character  = 'M';
+	params[i].type       = JackDriverParamString;
+	strcpy (params[i].value.str, "none");
+	strcpy (params[i].short_desc,
+		"Multicast group the master sends its periods to");
+	strcpy (params[i].long_desc, params[i].short_desc);
+
+	i++;
+	strcpy (params[i].name, "packet-ring");
+	params[i].character  = 'x';
+	params[i].type       = JackDriverParamString;
+	strcpy (params[i].value.str, "none");
+	strcpy (params[i].short_desc,
+		"Interface to receive on through a packet ring");
+	strcpy (params[i].long_desc,
+		"Receive through an AF_PACKET memory mapped ring on this "
+		"interface (\"any\" for all) instead of the UDP socket, "
+		"polled by the driver thread. Needs CAP_NET_RAW.");
+
+	i++;
+	strcpy (params[i].name, "local-socket");
+	params[i].character  = 'L';
+	params[i].type       = JackDriverParamString;
+	strcpy (params[i].value.str, "none");
+	strcpy (params[i].short_desc,
+		"Unix socket for a master on the same host");
+	strcpy (params[i].long_desc,
+		"Take periods from a master on the same host through shared "
+		"memory handed over on this unix socket path, instead of "
+		"the network.");
+
+	i++;
+	strcpy (params[i].name, "busy-poll");
+	params[i].character  = 'B';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 0U;
+	strcpy (params[i].short_desc,
+		"SO_BUSY_POLL budget in usecs (0 off)");
+	strcpy (params[i].long_desc,
+		"Let blocking reads on the sockets busy poll the device queue "
+		"for this many microseconds (SO_BUSY_POLL). Raising it above "
+		"net.core.busy_read needs CAP_NET_ADMIN.");
+
+	i++;
+	strcpy (params[i].name, "socket-priority");
+	params[i].character  = 'y';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 0U;
+	strcpy (params[i].short_desc,
+		"SO_PRIORITY of the sockets (0 default)");
+	strcpy (params[i].long_desc,
+		"Queueing priority of the sent packets (SO_PRIORITY). Values "
+		"above 6 need CAP_NET_ADMIN.");
+
+	i++;
+	strcpy (params[i].name, "dscp");
+	params[i].character  = 'd';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 0U;
+	strcpy (params[i].short_desc,
+		"DSCP of the sent packets (46 for EF)");
+	strcpy (params[i].long_desc, params[i].short_desc);
+
+	i++;
+	strcpy (params[i].name, "rcvbuf");
+	params[i].character  = 'k';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 0U;
+	strcpy (params[i].short_desc,
+		"Socket receive buffer in bytes (0 default)");
+	strcpy (params[i].long_desc, params[i].short_desc);
+
+	i++;
+	strcpy (params[i].name, "sndbuf");
+	params[i].character  = 'K';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 0U;
+	strcpy (params[i].short_desc,
+		"Socket send buffer in bytes (0 default)");
+	strcpy (params[i].long_desc, params[i].short_desc);
+
+	i++;
+	strcpy (params[i].name, "spin");
+	params[i].character  = 'S';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 0U;
+	strcpy (params[i].short_desc,
+		"Busy wait this many usecs before the deadline");
+	strcpy (params[i].long_desc,
+		"Instead of sleeping until the receive deadline, stop sleeping "
+		"this many microseconds before it and busy wait for the packet. "
+		"Only worth it with a core isolated for the driver thread.");
+
+	i++;
+	strcpy (params[i].name, "redundant-master");
+	params[i].character  = 'Y';
+	params[i].type       = JackDriverParamString;
+	strcpy (params[i].value.str, "none");
+	strcpy (params[i].short_desc,
+		"Master's address on a second, redundant network");
+	strcpy (params[i].long_desc,
+		"The master sends every period over both networks, and the "
+		"copy that arrives first is used. Replies go out on both. "
+		"Per path arrival statistics are reported every 10 seconds.");
+
 	i++;
 	strcpy (params[i].name, "native-endian");
 	params[i].character  = 'e';
@@ -569,6 +872,15 @@ driver_get_descriptor ()
 	strcpy (params[i].short_desc,
 		"Always wait until deadline");
 	strcpy (params[i].long_desc, params[i].short_desc);
+
+	i++;
+	strcpy (params[i].name, "adaptive");
+	params[i].character  = 'A';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 0U;
+	strcpy (params[i].short_desc,
+		"Adapt the deadline margin to the measured jitter");
+	strcpy (params[i].long_desc, params[i].short_desc);
 	desc->params = params;
 
 	return desc;
@@ -588,6 +900,7 @@ driver_initialize (jack_client_t *client, const JSList * params)
 	unsigned int playback_ports_midi = 1;
 	unsigned int listen_port = 3000;
 	unsigned int resample_factor_up = 0;
+	unsigned int resample_quality = 2;
 	unsigned int bitdepth = 0;
 	unsigned int handle_transport_sync = 1;
 	unsigned int use_autoconfig = 1;
@@ -596,6 +909,20 @@ driver_initialize (jack_client_t *client, const JSList * params)
 	int dont_htonl_floats = 0;
 	int always_deadline = 0;
 	int jitter_val = 0;
+	unsigned int encoder_threads = 0;
+	unsigned int adaptive = 0;
+	unsigned int fec = 0;
+	unsigned int midi_packed = 0;
+	const char *multicast_group = NULL;
+	const char *packet_ring = NULL;
+	const char *local_socket = NULL;
+	unsigned int busy_poll = 0;
+	unsigned int socket_priority = 0;
+	unsigned int dscp = 0;
+	unsigned int rcvbuf = 0;
+	unsigned int sndbuf = 0;
+	unsigned int spin_usecs = 0;
+	const char *redundant_master = NULL;
 	const JSList * node;
 	const jack_driver_param_t * param;
 
@@ -633,21 +960,15 @@ driver_initialize (jack_client_t *client, const JSList * params)
 			break;
 
 		case 'f':
-#if HAVE_SAMPLERATE
 			resample_factor = param->value.ui;
-#else
-			printf ( "not built with libsamplerate support\n" );
-			exit (10);
-#endif
 			break;
 
 		case 'u':
-#if HAVE_SAMPLERATE
 			resample_factor_up = param->value.ui;
-#else
-			printf ( "not built with libsamplerate support\n" );
-			exit (10);
-#endif
+			break;
+
+		case 'q':
+			resample_quality = param->value.ui;
 			break;
 
 		case 'b':
@@ -664,6 +985,20 @@ driver_initialize (jack_client_t *client, const JSList * params)
 #endif
 			break;
 
+		case 'P':
+#if HAVE_OPUS
+			bitdepth = 999;
+			resample_factor = param->value.ui;
+#else
+			printf ( "not built with opus support\n" );
+			exit (10);
+#endif
+			break;
+
+		case 'T':
+			encoder_threads = param->value.ui;
+			break;
+
 		case 't':
 			handle_transport_sync = param->value.ui;
 			break;
@@ -680,6 +1015,54 @@ driver_initialize (jack_client_t *client, const JSList * params)
 			redundancy = param->value.ui;
 			break;
 
+		case 'F':
+			fec = param->value.ui;
+			break;
+
+		case 'm':
+			midi_packed = param->value.i;
+			break;
+
+		case 'M':
+			multicast_group = param->value.str;
+			break;
+
+		case 'x':
+			packet_ring = param->value.str;
+			break;
+
+		case 'L':
+			local_socket = param->value.str;
+			break;
+
+		case 'B':
+			busy_poll = param->value.ui;
+			break;
+
+		case 'y':
+			socket_priority = param->value.ui;
+			break;
+
+		case 'd':
+			dscp = param->value.ui;
+			break;
+
+		case 'k':
+			rcvbuf = param->value.ui;
+			break;
+
+		case 'K':
+			sndbuf = param->value.ui;
+			break;
+
+		case 'S':
+			spin_usecs = param->value.ui;
+			break;
+
+		case 'Y':
+			redundant_master = param->value.str;
+			break;
+
 		case 'e':
 			dont_htonl_floats = param->value.ui;
 			break;
@@ -689,6 +1072,9 @@ driver_initialize (jack_client_t *client, const JSList * params)
 		case 'D':
 			always_deadline = param->value.ui;
 			break;
+		case 'A':
+			adaptive = param->value.ui;
+			break;
 		}
 	}
 
@@ -696,9 +1082,14 @@ driver_initialize (jack_client_t *client, const JSList * params)
 			       capture_ports_midi, playback_ports_midi,
 			       sample_rate, period_size,
 			       listen_port, handle_transport_sync,
-			       resample_factor, resample_factor_up, bitdepth,
+			       resample_factor, resample_factor_up, resample_quality, bitdepth,
 			       use_autoconfig, latency, redundancy,
-			       dont_htonl_floats, always_deadline, jitter_val);
+			       dont_htonl_floats, always_deadline, jitter_val,
+			       encoder_threads, adaptive, fec, midi_packed,
+			       multicast_group, packet_ring, local_socket,
+			       busy_poll, socket_priority, dscp,
+			       rcvbuf, sndbuf, spin_usecs,
+			       redundant_master);
 }
 
 void
@@ -39,6 +39,7 @@
 #include "internal.h"
 
 #include "jack/jslist.h"
+#include <jack/ringbuffer.h>
 
 #include <sys/types.h>
 
@@ -48,6 +49,7 @@
 #else
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #endif
 
 #include "config.h"
@@ -63,14 +65,23 @@
 #include <celt/celt.h>
 #endif
 
+#if HAVE_OPUS
+#include <opus/opus.h>
+#include <opus/opus_custom.h>
+#endif
+
 #include "netjack.h"
 #include "netjack_packet.h"
+#include "netjack_resample.h"
 
 // JACK2
 //#include "jack/control.h"
 
 #define MIN(x, y) ((x) < (y) ? (x) : (y))
 
+// How often the link statistics are reported, in usecs.
+#define NETJACK_STATS_INTERVAL 10000000
+
 static int sync_state = 1;
 static jack_transport_state_t last_transport_state;
 
@@ -88,6 +99,536 @@ net_driver_sync_cb (jack_transport_state_t state, jack_position_t *pos, void *da
 	return retval;
 }
 
+// Adaptive playout.
+//
+// The arrival jitter is estimated like RFC 3550 does it: a running
+// mean of how far each inter-arrival time strays from the nominal
+// spacing of the packets.  The deadline margin we ask the master for
+// is a few times that, approached quickly when the link gets worse
+// and slowly when it gets better.  A cycle without data bumps the
+// margin right away.
+
+static void
+netjack_adapt_arrival ( netjack_driver_state_t *netj, jack_nframes_t framecnt, jack_time_t arrival )
+{
+	if ( netj->last_arrival_valid && framecnt > netj->last_arrival_framecnt
+	     && (framecnt - netj->last_arrival_framecnt) < 16 ) {
+		float expected = (float)(framecnt - netj->last_arrival_framecnt) * (float)netj->period_usecs;
+		float d = (float)(int64_t)(arrival - netj->last_arrival) - expected;
+
+		netj->jitter_usecs += (fabsf (d) - netj->jitter_usecs) / 16.0f;
+	}
+
+	netj->last_arrival = arrival;
+	netj->last_arrival_framecnt = framecnt;
+	netj->last_arrival_valid = 1;
+}
+
+static float
+netjack_adapt_max_target ( netjack_driver_state_t *netj )
+{
+	return (float)(netj->latency > 1 ? netj->latency : 1) * (float)netj->period_usecs;
+}
+
+static int
+netjack_adapt_target ( netjack_driver_state_t *netj )
+{
+	float goal = 4.0f * netj->jitter_usecs + (float)netj->period_usecs / 8.0f;
+
+	if ( goal > netjack_adapt_max_target (netj) ) {
+		goal = netjack_adapt_max_target (netj);
+	}
+
+	if ( goal > netj->target_usecs ) {
+		netj->target_usecs += (goal - netj->target_usecs) / 8.0f;
+	} else {
+		netj->target_usecs += (goal - netj->target_usecs) / 256.0f;
+	}
+
+	return (int)netj->target_usecs;
+}
+
+static void
+netjack_adapt_miss ( netjack_driver_state_t *netj )
+{
+	netj->target_usecs += (float)netj->period_usecs / 8.0f;
+	if ( netj->target_usecs > netjack_adapt_max_target (netj) ) {
+		netj->target_usecs = netjack_adapt_max_target (netj);
+	}
+}
+
+// Local clock.
+//
+// Loaded as a slave driver, we do not run the cycles; the master
+// driver's sound card does. The network thread then only moves
+// packets: the audio of each one it gets goes into a ring for the
+// engine, and the answer it sends back comes out of another ring the
+// engine fills. Whoever reads a ring resamples it to their own clock
+// with the built-in drift resampler.
+//
+// The ratio of the two clocks comes from a DLL on the packet arrival
+// times, which gives the master's period in our microseconds, and the
+// engine's own estimate of its period. A PI controller on the ring
+// fill, as the ALSA driver's aggregate devices use it, takes out what
+// the estimates miss, so that the rings neither run dry nor fill up.
+
+#define NETJACK_LOCAL_RING_PERIODS   8
+#define NETJACK_LOCAL_TARGET_PERIODS 2.0
+#define NETJACK_LOCAL_KP             2e-4         // per period of fill error
+#define NETJACK_LOCAL_KI             2e-6         // the same, per period
+#define NETJACK_LOCAL_SMOOTH         0.05         // of the fill error
+#define NETJACK_LOCAL_MAX_CORRECTION 0.002
+#define NETJACK_LOCAL_DLL_BANDWIDTH  0.1          // Hz
+
+// One direction. Written a period of `period' frames at a time by one
+// side, read and resampled by the other.
+typedef struct {
+	unsigned int channels;
+	jack_nframes_t period;
+	jack_ringbuffer_t *rb;          // interleaved float frames
+	netjack_drift_t *drift;         // the reading side's
+	float *buf;                     // interleaved, for either side
+	float *chan_buf;                // one channel of a packet
+	size_t target;                  // fill the controller keeps rb at
+	double err;
+	double integral;
+	int primed;
+	unsigned long dropouts;
+} netjack_local_stream_t;
+
+struct _netjack_local {
+	netjack_local_stream_t capture;         // network thread to engine
+	netjack_local_stream_t playback;        // engine to network thread
+	jack_nframes_t nframes;                 // of the engine
+
+	// DLL on the packet arrivals, in usecs
+	int dll_valid;
+	jack_nframes_t dll_framecnt;
+	double dll_next;                        // when the next packet is due
+	double dll_period;
+	double dll_nominal;
+	double dll_b;
+	double dll_c;
+
+	// usecs per frame of either clock, each written by its own thread
+	volatile float master_frame_usecs;
+	volatile float local_frame_usecs;
+};
+
+static void
+netjack_local_stream_free ( netjack_local_stream_t *s )
+{
+	if ( s->rb ) {
+		jack_ringbuffer_free ( s->rb );
+	}
+	netjack_drift_free ( s->drift );
+	free ( s->buf );
+	free ( s->chan_buf );
+}
+
+static int
+netjack_local_stream_init ( netjack_local_stream_t *s, unsigned int channels,
+			    jack_nframes_t period, jack_nframes_t draw,
+			    jack_nframes_t packet, int quality )
+{
+	size_t frames;
+
+	s->channels = channels;
+	s->period = period;
+	s->target = (size_t)(NETJACK_LOCAL_TARGET_PERIODS * period) + draw;
+
+	if ( channels == 0 ) {
+		return 0;
+	}
+
+	s->drift = netjack_drift_new ( channels, draw, quality );
+	if ( s->drift == NULL ) {
+		return -1;
+	}
+
+	frames = NETJACK_LOCAL_RING_PERIODS * period + 2 * draw;
+	s->rb = jack_ringbuffer_create ( frames * channels * sizeof(float) );
+
+	frames = period > netjack_drift_max_need ( s->drift ) ? period : netjack_drift_max_need ( s->drift );
+	s->buf = malloc ( frames * channels * sizeof(float) );
+	s->chan_buf = malloc ( packet * sizeof(float) );
+
+	if ( !s->rb || !s->buf || !s->chan_buf ) {
+		return -1;
+	}
+	return 0;
+}
+
+int
+netjack_local_start ( netjack_driver_state_t *netj, jack_nframes_t nframes )
+{
+	struct _netjack_local *l;
+	double omega;
+
+	if ( netj->bitdepth == CELT_MODE || netj->bitdepth == OPUS_MODE ) {
+		jack_error ( "netjack: the codecs cannot follow the local clock" );
+		return -1;
+	}
+	if ( netj->capture_channels_midi || netj->playback_channels_midi ) {
+		jack_info ( "netjack: MIDI does not follow the local clock, its ports stay empty" );
+	}
+	if ( netj->net_period_down != netj->period_size || netj->net_period_up != netj->period_size ) {
+		jack_error ( "netjack: the network period has to be the master's to follow the local clock" );
+		return -1;
+	}
+
+	l = calloc ( 1, sizeof(struct _netjack_local) );
+	if ( l == NULL ) {
+		return -1;
+	}
+	l->nframes = nframes;
+
+	if ( netjack_local_stream_init ( &l->capture, netj->capture_channels_audio,
+					 netj->period_size, nframes, netj->period_size,
+					 netj->resample_quality )
+	     || netjack_local_stream_init ( &l->playback, netj->playback_channels_audio,
+					    nframes, netj->period_size, netj->period_size,
+					    netj->resample_quality ) ) {
+		jack_error ( "netjack: cannot set up the local clock" );
+		netjack_local_stream_free ( &l->capture );
+		netjack_local_stream_free ( &l->playback );
+		free ( l );
+		return -1;
+	}
+
+	l->dll_nominal = (double)netj->period_size * 1000000.0 / netj->sample_rate;
+	l->dll_period = l->dll_nominal;
+	omega = 2.0 * M_PI * NETJACK_LOCAL_DLL_BANDWIDTH * l->dll_nominal / 1000000.0;
+	l->dll_b = sqrt (2.0) * omega;
+	l->dll_c = omega * omega;
+	l->master_frame_usecs = 1000000.0f / netj->sample_rate;
+	l->local_frame_usecs = 1000000.0f / netj->sample_rate;
+
+	netj->local = l;
+
+	jack_info ( "netjack: following the local clock" );
+	return 0;
+}
+
+void
+netjack_local_stop ( netjack_driver_state_t *netj )
+{
+	struct _netjack_local *l = netj->local;
+
+	if ( l == NULL ) {
+		return;
+	}
+	netj->local = NULL;
+
+	if ( l->capture.dropouts || l->playback.dropouts ) {
+		jack_info ( "netjack: local clock dropouts: capture %lu, playback %lu",
+			    l->capture.dropouts, l->playback.dropouts );
+	}
+	netjack_local_stream_free ( &l->capture );
+	netjack_local_stream_free ( &l->playback );
+	free ( l );
+}
+
+static void
+netjack_local_arrival ( netjack_driver_state_t *netj, jack_nframes_t framecnt, jack_time_t arrival )
+{
+	struct _netjack_local *l = netj->local;
+
+	if ( l->dll_valid && framecnt > l->dll_framecnt
+	     && (framecnt - l->dll_framecnt) < 16 ) {
+		double e;
+
+		// lost packets were due all the same
+		l->dll_next += (framecnt - l->dll_framecnt - 1) * l->dll_period;
+		e = (double)arrival - l->dll_next;
+
+		l->dll_next += l->dll_b * e + l->dll_period;
+		l->dll_period += l->dll_c * e;
+
+		if ( l->dll_period < l->dll_nominal * (1.0 - NETJACK_DRIFT_MAX) ) {
+			l->dll_period = l->dll_nominal * (1.0 - NETJACK_DRIFT_MAX);
+		} else if ( l->dll_period > l->dll_nominal * (1.0 + NETJACK_DRIFT_MAX) ) {
+			l->dll_period = l->dll_nominal * (1.0 + NETJACK_DRIFT_MAX);
+		}
+	} else {
+		// (re)start from here, with the period we had
+		l->dll_next = (double)arrival + l->dll_period;
+	}
+
+	l->dll_framecnt = framecnt;
+	l->dll_valid = 1;
+	l->master_frame_usecs = l->dll_period / netj->period_size;
+}
+
+// Run the controller on the fill of a ring, in frames. Returns the
+// correction to the ratio of the reading side.
+static double
+netjack_local_adjust ( netjack_local_stream_t *s, size_t fill )
+{
+	double err = ((double)fill - s->target) / s->period;
+	double c;
+
+	s->err += NETJACK_LOCAL_SMOOTH * (err - s->err);
+
+	s->integral += NETJACK_LOCAL_KI * s->err;
+	if ( s->integral > NETJACK_LOCAL_MAX_CORRECTION ) {
+		s->integral = NETJACK_LOCAL_MAX_CORRECTION;
+	} else if ( s->integral < -NETJACK_LOCAL_MAX_CORRECTION ) {
+		s->integral = -NETJACK_LOCAL_MAX_CORRECTION;
+	}
+
+	c = NETJACK_LOCAL_KP * s->err + s->integral;
+	if ( c > NETJACK_LOCAL_MAX_CORRECTION ) {
+		c = NETJACK_LOCAL_MAX_CORRECTION;
+	} else if ( c < -NETJACK_LOCAL_MAX_CORRECTION ) {
+		c = -NETJACK_LOCAL_MAX_CORRECTION;
+	}
+	return c;
+}
+
+// Resample the next period out of a ring, at `ratio' of its writer's
+// frames to ours. Returns 0, and leaves the ring alone, until it has
+// filled up to the target the first time, or again after running dry.
+static int
+netjack_local_pull ( netjack_local_stream_t *s, double ratio )
+{
+	size_t frame_bytes = s->channels * sizeof(float);
+	size_t fill = jack_ringbuffer_read_space ( s->rb ) / frame_bytes;
+	jack_nframes_t need, got, i;
+	unsigned int chn;
+
+	if ( !s->primed ) {
+		if ( fill < s->target ) {
+			return 0;
+		}
+		// start the controller at rest
+		jack_ringbuffer_read_advance ( s->rb, (fill - s->target) * frame_bytes );
+		fill = s->target;
+		s->primed = 1;
+	}
+
+	ratio *= 1.0 + netjack_local_adjust ( s, fill );
+
+	need = netjack_drift_need ( s->drift, ratio );
+	got = need < fill ? need : fill;
+	jack_ringbuffer_read ( s->rb, (char*)s->buf, got * frame_bytes );
+
+	if ( got < need ) {
+		// ran dry: fill up again before going on
+		memset ( s->buf + got * s->channels, 0, (need - got) * frame_bytes );
+		s->dropouts++;
+		s->primed = 0;
+	}
+
+	for ( chn = 0; chn < s->channels; chn++ ) {
+		float *in = netjack_drift_input ( s->drift, chn );
+
+		for ( i = 0; i < need; i++ ) {
+			in[i] = s->buf[i * s->channels + chn];
+		}
+	}
+	netjack_drift_process ( s->drift, ratio );
+
+	return 1;
+}
+
+static void
+netjack_local_push ( netjack_local_stream_t *s )
+{
+	size_t bytes = s->period * s->channels * sizeof(float);
+
+	if ( jack_ringbuffer_write_space ( s->rb ) < bytes ) {
+		s->dropouts++;
+		return;
+	}
+	jack_ringbuffer_write ( s->rb, (char*)s->buf, bytes );
+}
+
+// Network thread: the audio of the packet just waited for, or NULL if
+// it did not come, into the capture ring.
+void
+netjack_local_receive ( netjack_driver_state_t *netj, void *packet_payload )
+{
+	netjack_local_stream_t *s = &netj->local->capture;
+	unsigned int chn;
+	jack_nframes_t i;
+
+	if ( s->channels == 0 ) {
+		return;
+	}
+
+	if ( packet_payload == NULL ) {
+		// its period passed all the same
+		memset ( s->buf, 0, s->period * s->channels * sizeof(float) );
+	} else {
+		for ( chn = 0; chn < s->channels; chn++ ) {
+			netjack_payload_to_float ( netj->bitdepth, packet_payload, s->period, chn,
+						   s->chan_buf, netj->dont_htonl_floats );
+			for ( i = 0; i < s->period; i++ ) {
+				s->buf[i * s->channels + chn] = s->chan_buf[i];
+			}
+		}
+	}
+
+	netjack_local_push ( s );
+}
+
+// Network thread: the packet to send back. Returns how many bytes of
+// the payload that is; the MIDI slots are sent empty.
+int
+netjack_local_send ( netjack_driver_state_t *netj, void *packet_payload )
+{
+	struct _netjack_local *l = netj->local;
+	netjack_local_stream_t *s = &l->playback;
+	int size = netj->playback_channels * get_sample_size ( netj->bitdepth ) * netj->net_period_up;
+	unsigned int chn;
+
+	memset ( packet_payload, 0, size );
+
+	if ( s->channels && netjack_local_pull ( s, l->master_frame_usecs / l->local_frame_usecs ) ) {
+		for ( chn = 0; chn < s->channels; chn++ ) {
+			netjack_float_to_payload ( netj->bitdepth, packet_payload, netj->net_period_up, chn,
+						   netjack_drift_output ( s->drift, chn ), netj->dont_htonl_floats );
+		}
+	}
+
+	return size;
+}
+
+// Engine thread: the capture ports of a cycle. period_usecs is the
+// engine's estimate of how long its cycles take.
+void
+netjack_local_read ( netjack_driver_state_t *netj, jack_nframes_t nframes, float period_usecs )
+{
+	struct _netjack_local *l = netj->local;
+	netjack_local_stream_t *s = &l->capture;
+	unsigned int chn;
+	JSList *node;
+	int have;
+
+	if ( period_usecs > 0.0f ) {
+		l->local_frame_usecs = period_usecs / nframes;
+	}
+
+	// the resampler's period is fixed when we start
+	have = nframes == l->nframes && s->channels
+	       && netjack_local_pull ( s, l->local_frame_usecs / l->master_frame_usecs );
+
+	for ( chn = 0, node = netj->capture_ports; node;
+	      chn++, node = jack_slist_next (node) ) {
+		jack_default_audio_sample_t *buf = jack_port_get_buffer ( (jack_port_t*)node->data, nframes );
+
+		if ( chn >= s->channels ) {
+			jack_midi_clear_buffer ( buf );
+		} else if ( have ) {
+			memcpy ( buf, netjack_drift_output ( s->drift, chn ), nframes * sizeof(float) );
+		} else {
+			memset ( buf, 0, nframes * sizeof(float) );
+		}
+	}
+}
+
+// Engine thread: the playback ports of a cycle.
+void
+netjack_local_write ( netjack_driver_state_t *netj, jack_nframes_t nframes )
+{
+	netjack_local_stream_t *s = &netj->local->playback;
+	unsigned int chn;
+	jack_nframes_t i;
+	JSList *node;
+
+	if ( s->channels == 0 || nframes != s->period ) {
+		return;
+	}
+
+	for ( chn = 0, node = netj->playback_ports; chn < s->channels && node;
+	      chn++, node = jack_slist_next (node) ) {
+		jack_default_audio_sample_t *buf = jack_port_get_buffer ( (jack_port_t*)node->data, nframes );
+
+		for ( i = 0; i < nframes; i++ ) {
+			s->buf[i * s->channels + chn] = buf[i];
+		}
+	}
+
+	netjack_local_push ( s );
+}
+
+// What the rings and the resampler add to the port latencies, in
+// frames of the engine.
+static jack_nframes_t
+netjack_local_latency ( netjack_driver_state_t *netj, jack_latency_callback_mode_t mode )
+{
+	netjack_local_stream_t *s;
+
+	if ( netj->local == NULL ) {
+		return 0;
+	}
+	s = (mode == JackCaptureLatency) ? &netj->local->capture : &netj->local->playback;
+	if ( s->channels == 0 ) {
+		return 0;
+	}
+	return s->target + netjack_drift_latency ( s->drift );
+}
+
+static void
+netjack_report_stats ( netjack_driver_state_t *netj )
+{
+	netj->stats_lost_total += netj->stats_lost;
+	netj->stats_resyncs_total += netj->stats_resyncs;
+
+	jack_info ( "netjack: depth %d packets, jitter %.0f us, target %.0f us, "
+		    "lost %u (%u total), resyncs %u (%u total)",
+		    packet_cache_get_depth ( netj->packcache, netj->expected_framecnt ),
+		    netj->jitter_usecs, netj->adaptive ? netj->target_usecs : 0.0f,
+		    netj->stats_lost, netj->stats_lost_total,
+		    netj->stats_resyncs, netj->stats_resyncs_total );
+
+	netj->stats_lost = 0;
+	netj->stats_resyncs = 0;
+
+	if ( netj->packcache->redundant_address.s_addr != htonl (INADDR_ANY) ) {
+		int p;
+
+		for ( p = 0; p < NETJACK_PATHS; p++ ) {
+			netjack_path_stats_t *s = &netj->packcache->path_stats[p];
+
+			jack_info ( "netjack: path %d: %u fragments, %u used, %u late, "
+				    "first for %u packets by %.0f us (max %u us)",
+				    p, s->fragments, s->used, s->late, s->ahead,
+				    s->ahead ? (float)s->lead_sum / s->ahead : 0.0f,
+				    (unsigned int)s->lead_max );
+			memset ( s, 0, sizeof(*s) );
+		}
+	}
+}
+
+static void
+netjack_drain ( netjack_driver_state_t *netj, jack_time_t (*get_microseconds)(void) )
+{
+	if ( netj->shm ) {
+		packet_cache_drain_shm ( netj->packcache, netj->shm, get_microseconds );
+	} else if ( netj->ring ) {
+		packet_cache_drain_ring ( netj->packcache, netj->ring, get_microseconds );
+	} else {
+		packet_cache_drain_socket ( netj->packcache, netj->sockfd, get_microseconds );
+	}
+}
+
+static int
+netjack_wait_deadline ( netjack_driver_state_t *netj, jack_time_t (*get_microseconds)(void) )
+{
+	if ( netj->shm ) {
+		return netjack_poll_deadline ( netjack_shm_fd ( netj->shm ), netj->next_deadline, get_microseconds );
+	}
+	if ( netj->ring ) {
+		return netjack_ring_poll_deadline ( netj->ring, netj->next_deadline, get_microseconds );
+	}
+	if ( netj->spin_usecs ) {
+		return netjack_poll_deadline_spin ( netj->sockfd, netj->next_deadline, netj->spin_usecs, get_microseconds );
+	}
+	return netjack_poll_deadline ( netj->sockfd, netj->next_deadline, get_microseconds );
+}
+
 int netjack_wait ( netjack_driver_state_t *netj, jack_time_t (*get_microseconds)(void) )
 {
 	int we_have_the_expected_frame = 0;
@@ -106,7 +647,7 @@ int netjack_wait ( netjack_driver_state_t *netj, jack_time_t (*get_microseconds)
 		netj->expected_framecnt += 1;
 	} else {
 		// starting up.... lets look into the packetcache, and fetch the highest packet.
-		packet_cache_drain_socket ( netj->packcache, netj->sockfd, get_microseconds );
+		netjack_drain ( netj, get_microseconds );
 		if ( packet_cache_get_highest_available_framecnt ( netj->packcache, &next_frame_avail ) ) {
 			netj->expected_framecnt = next_frame_avail;
 			netj->expected_framecnt_valid = 1;
@@ -131,11 +672,11 @@ int netjack_wait ( netjack_driver_state_t *netj, jack_time_t (*get_microseconds)
 				}
 			}
 		}
-		if ( !netjack_poll_deadline ( netj->sockfd, netj->next_deadline, get_microseconds ) ) {
+		if ( !netjack_wait_deadline ( netj, get_microseconds ) ) {
 			break;
 		}
 
-		packet_cache_drain_socket ( netj->packcache, netj->sockfd, get_microseconds );
+		netjack_drain ( netj, get_microseconds );
 	}
 
 	// check if we know who to send our packets too.
@@ -171,9 +712,16 @@ int netjack_wait ( netjack_driver_state_t *netj, jack_time_t (*get_microseconds)
 		netj->deadline_goodness = (int)pkthdr->sync_state;
 		netj->packet_data_valid = 1;
 
+		netjack_adapt_arrival ( netj, netj->expected_framecnt, packet_recv_time_stamp );
+		if ( netj->local ) {
+			netjack_local_arrival ( netj, netj->expected_framecnt, packet_recv_time_stamp );
+		}
+
 		int want_deadline;
 		if ( netj->jitter_val != 0 ) {
 			want_deadline = netj->jitter_val;
+		} else if ( netj->adaptive ) {
+			want_deadline = netjack_adapt_target ( netj );
 		} else if ( netj->latency < 4 ) {
 			want_deadline = -netj->period_usecs / 2;
 		} else {
@@ -241,6 +789,8 @@ int netjack_wait ( netjack_driver_state_t *netj, jack_time_t (*get_microseconds)
 				netj->deadline_goodness = (int)pkthdr->sync_state - (int)netj->period_usecs * offset;
 				netj->next_deadline_valid = 0;
 				netj->packet_data_valid = 1;
+				netj->last_arrival_valid = 0;
+				netj->stats_resyncs++;
 			}
 
 		} else {
@@ -291,6 +841,8 @@ int netjack_wait ( netjack_driver_state_t *netj, jack_time_t (*get_microseconds)
 					netj->next_deadline_valid = 0;
 					netj->packet_data_valid = 1;
 					netj->running_free = 0;
+					netj->last_arrival_valid = 0;
+					netj->stats_resyncs++;
 					jack_info ( "resync after freerun... %d", netj->expected_framecnt );
 				} else {
 					if ( netj->num_lost_packets == 101 ) {
@@ -319,6 +871,12 @@ int netjack_wait ( netjack_driver_state_t *netj, jack_time_t (*get_microseconds)
 		if ( netj->num_lost_packets == 1 ) {
 			retval = netj->period_usecs;
 		}
+		if ( !netj->running_free ) {
+			netj->stats_lost++;
+			if ( netj->adaptive ) {
+				netjack_adapt_miss ( netj );
+			}
+		}
 	} else {
 		if ( (netj->num_lost_packets > 1) && !netj->running_free ) {
 			retval = (netj->num_lost_packets - 1) * netj->period_usecs;
@@ -327,6 +885,16 @@ int netjack_wait ( netjack_driver_state_t *netj, jack_time_t (*get_microseconds)
 		netj->num_lost_packets = 0;
 	}
 
+	jack_time_t now = get_microseconds ();
+	if ( now >= netj->stats_next_report ) {
+		if ( netj->stats_next_report
+		     && (netj->adaptive || netj->stats_lost || netj->stats_resyncs
+			 || netj->packcache->redundant_address.s_addr != htonl (INADDR_ANY)) ) {
+			netjack_report_stats ( netj );
+		}
+		netj->stats_next_report = now + NETJACK_STATS_INTERVAL;
+	}
+
 	return retval;
 }
 
@@ -354,19 +922,97 @@ void netjack_send_silence ( netjack_driver_state_t *netj, int syncstate )
 	memset (packet_bufX, 0, payload_size);
 
 	packet_header_hton (tx_pkthdr);
-	if (netj->srcaddress_valid) {
+	if (netj->shm) {
+		netjack_shm_send (netj->shm, (char*)packet_buf, tx_size);
+	} else if (netj->srcaddress_valid) {
 		int r;
 		if (netj->reply_port) {
 			netj->syncsource_address.sin_port = htons (netj->reply_port);
 		}
 
-		for ( r = 0; r < netj->redundancy; r++ )
-			netjack_sendto (netj->outsockfd, (char*)packet_buf, tx_size,
-					0, (struct sockaddr*)&(netj->syncsource_address), sizeof(struct sockaddr_in), netj->mtu);
+		for ( r = 0; r < netj->redundancy; r++ ) {
+			netjack_sendto (netj->outsockfd, (char*)packet_buf, tx_size, tx_size,
+					0, (struct sockaddr*)&(netj->syncsource_address), sizeof(struct sockaddr_in), netj->mtu, netj->fec);
+			if (netj->redundant_master.s_addr != htonl (INADDR_ANY)) {
+				struct sockaddr_in second = netj->syncsource_address;
+
+				second.sin_addr = netj->redundant_master;
+				netjack_sendto (netj->outsockfd, (char*)packet_buf, tx_size, tx_size,
+						0, (struct sockaddr*)&second, sizeof(struct sockaddr_in), netj->mtu, netj->fec);
+			}
+		}
 	}
 }
 
 
+#if HAVE_OPUS
+static OpusCustomEncoder *
+netjack_opus_encoder_new ( netjack_driver_state_t *netj )
+{
+	OpusCustomEncoder *encoder = opus_custom_encoder_create ( netj->opus_mode, 1, NULL );
+
+	if ( encoder == NULL ) {
+		return NULL;
+	}
+
+	// net_period_up is the byte budget of one channel per period,
+	// minus the length prefix.  Use it all, at a constant rate.
+	opus_custom_encoder_ctl ( encoder, OPUS_SET_BITRATE ( (netj->net_period_up - 2) * 8 * netj->sample_rate / netj->period_size ) );
+	opus_custom_encoder_ctl ( encoder, OPUS_SET_VBR ( 0 ) );
+	opus_custom_encoder_ctl ( encoder, OPUS_SET_COMPLEXITY ( 10 ) );
+	opus_custom_encoder_ctl ( encoder, OPUS_SET_SIGNAL ( OPUS_SIGNAL_MUSIC ) );
+
+	return encoder;
+}
+#endif
+
+// Port latencies.
+//
+// The master counts netj->latency periods from sending a cycle to
+// getting the answer back.  Of those, the capture side takes the one
+// period the data spends on the wire before we process it, and the
+// playback side the rest; codecs and the resampler add their own delay
+// in the direction they run.  A host running part of a session this
+// way then shows up in the graph's latencies like any sound card.
+
+static jack_nframes_t
+netjack_codec_latency ( netjack_driver_state_t *netj, jack_latency_callback_mode_t mode )
+{
+	if ( netj->bitdepth == CELT_MODE || netj->bitdepth == OPUS_MODE ) {
+		// one lookahead each way
+		return netj->codec_latency / 2;
+	}
+	if ( mode == JackCaptureLatency ) {
+		return netj->capture_resampler ? netjack_resampler_latency ( netj->capture_resampler ) : 0;
+	}
+	return netj->playback_resampler ?
+	       netjack_resampler_latency ( netj->playback_resampler ) * netj->period_size / netj->net_period_up : 0;
+}
+
+static void
+netjack_latency_callback ( jack_latency_callback_mode_t mode, void *arg )
+{
+	netjack_driver_state_t *netj = (netjack_driver_state_t*)arg;
+	jack_latency_range_t range;
+	JSList *node;
+
+	if ( mode == JackCaptureLatency ) {
+		range.min = range.max = netj->period_size + netjack_codec_latency ( netj, mode );
+		node = netj->capture_ports;
+	} else {
+		range.min = range.max = netj->period_size * (netj->latency > 1 ? netj->latency - 1 : 0)
+					+ netjack_codec_latency ( netj, mode );
+		node = netj->playback_ports;
+	}
+
+	range.min += netjack_local_latency ( netj, mode );
+	range.max = range.min;
+
+	for ( ; node; node = jack_slist_next (node) ) {
+		jack_port_set_latency_range ( (jack_port_t*)node->data, mode, &range );
+	}
+}
+
 void netjack_attach ( netjack_driver_state_t *netj )
 {
 	//puts ("net_driver_attach");
@@ -390,10 +1036,41 @@ void netjack_attach ( netjack_driver_state_t *netj )
 #endif
 	}
 
+	if ( netj->bitdepth == OPUS_MODE ) {
+#if HAVE_OPUS
+		opus_int32 lookahead = 0;
+		netj->opus_mode = opus_custom_mode_create ( netj->sample_rate, netj->period_size, NULL );
+		OpusCustomEncoder *encoder = netjack_opus_encoder_new ( netj );
+		if ( encoder ) {
+			opus_custom_encoder_ctl ( encoder, OPUS_GET_LOOKAHEAD ( &lookahead ) );
+			opus_custom_encoder_destroy ( encoder );
+		}
+		netj->codec_latency = 2 * lookahead;
+#endif
+	}
+
 	if (netj->handle_transport_sync) {
 		jack_set_sync_callback (netj->client, (JackSyncCallback)net_driver_sync_cb, NULL);
 	}
 
+	// The built-in resampler takes over from libsamplerate for the
+	// directions that are rate reduced. Its delay counts like a codec's.
+	if ( netj->bitdepth != CELT_MODE && netj->bitdepth != OPUS_MODE && netj->resample_quality != NETJACK_RESAMPLE_SRC ) {
+		netj->codec_latency = 0;
+		if ( netj->net_period_down != netj->period_size ) {
+			netj->capture_resampler = netjack_resampler_new ( netj->capture_channels_audio, netj->net_period_down, netj->period_size, netj->resample_quality );
+			if ( netj->capture_resampler ) {
+				netj->codec_latency += netjack_resampler_latency ( netj->capture_resampler );
+			}
+		}
+		if ( netj->net_period_up != netj->period_size ) {
+			netj->playback_resampler = netjack_resampler_new ( netj->playback_channels_audio, netj->period_size, netj->net_period_up, netj->resample_quality );
+			if ( netj->playback_resampler ) {
+				netj->codec_latency += netjack_resampler_latency ( netj->playback_resampler ) * netj->period_size / netj->net_period_up;
+			}
+		}
+	}
+
 	port_flags = JackPortIsOutput | JackPortIsPhysical | JackPortIsTerminal;
 
 	for (chn = 0; chn < netj->capture_channels_audio; chn++) {
@@ -418,7 +1095,11 @@ void netjack_attach ( netjack_driver_state_t *netj )
 			netj->capture_srcs = jack_slist_append (netj->capture_srcs, celt_decoder_create ( netj->celt_mode ) );
 #endif
 #endif
-		} else {
+		} else if ( netj->bitdepth == OPUS_MODE ) {
+#if HAVE_OPUS
+			netj->capture_srcs = jack_slist_append (netj->capture_srcs, opus_custom_decoder_create ( netj->opus_mode, 1, NULL ) );
+#endif
+		} else if ( netj->capture_resampler == NULL ) {
 #if HAVE_SAMPLERATE
 			netj->capture_srcs = jack_slist_append (netj->capture_srcs, src_new (SRC_LINEAR, 1, NULL));
 #endif
@@ -466,7 +1147,11 @@ void netjack_attach ( netjack_driver_state_t *netj )
 			netj->playback_srcs = jack_slist_append (netj->playback_srcs, celt_encoder_create ( celt_mode ) );
 #endif
 #endif
-		} else {
+		} else if ( netj->bitdepth == OPUS_MODE ) {
+#if HAVE_OPUS
+			netj->playback_srcs = jack_slist_append (netj->playback_srcs, netjack_opus_encoder_new ( netj ) );
+#endif
+		} else if ( netj->playback_resampler == NULL ) {
 #if HAVE_SAMPLERATE
 			netj->playback_srcs = jack_slist_append (netj->playback_srcs, src_new (SRC_LINEAR, 1, NULL));
 #endif
@@ -488,6 +1173,24 @@ void netjack_attach ( netjack_driver_state_t *netj )
 			jack_slist_append (netj->playback_ports, port);
 	}
 
+#if HAVE_OPUS
+	// The driver thread encodes too, so one channel less is enough.
+	if ( netj->bitdepth == OPUS_MODE && netj->encoder_threads && netj->playback_channels_audio > 1 ) {
+		netj->codec_pool = netjack_codec_pool_new ( netj->client, MIN ( netj->encoder_threads, netj->playback_channels_audio - 1 ) );
+	}
+#endif
+
+	netj->capture_plan = netjack_port_plan_new (netj->capture_ports, netj->capture_srcs, netj->capture_resampler);
+	netj->playback_plan = netjack_port_plan_new (netj->playback_ports, netj->playback_srcs, netj->playback_resampler);
+	if (netj->midi_packed) {
+		netjack_port_plan_pack_midi (netj->capture_plan);
+		netjack_port_plan_pack_midi (netj->playback_plan);
+	}
+
+	netjack_latency_callback ( JackCaptureLatency, netj );
+	netjack_latency_callback ( JackPlaybackLatency, netj );
+	jack_set_latency_callback ( netj->client, netjack_latency_callback, netj );
+
 	jack_activate (netj->client);
 }
 
@@ -496,6 +1199,20 @@ void netjack_detach ( netjack_driver_state_t *netj )
 {
 	JSList * node;
 
+#if HAVE_OPUS
+	netjack_codec_pool_free (netj->codec_pool);
+	netj->codec_pool = NULL;
+#endif
+
+	free (netj->capture_plan);
+	netj->capture_plan = NULL;
+	free (netj->playback_plan);
+	netj->playback_plan = NULL;
+	netjack_resampler_free (netj->capture_resampler);
+	netj->capture_resampler = NULL;
+	netjack_resampler_free (netj->playback_resampler);
+	netj->playback_resampler = NULL;
+
 	for (node = netj->capture_ports; node; node = jack_slist_next (node))
 		jack_port_unregister (netj->client,
 				      ((jack_port_t*)node->data));
@@ -509,6 +1226,12 @@ void netjack_detach ( netjack_driver_state_t *netj )
 			CELTDecoder * decoder = node->data;
 			celt_decoder_destroy (decoder);
 		} else
+#endif
+#if HAVE_OPUS
+		if ( netj->bitdepth == OPUS_MODE ) {
+			OpusCustomDecoder * decoder = node->data;
+			opus_custom_decoder_destroy (decoder);
+		} else
 #endif
 		{
 #if HAVE_SAMPLERATE
@@ -533,6 +1256,12 @@ void netjack_detach ( netjack_driver_state_t *netj )
 			CELTEncoder * encoder = node->data;
 			celt_encoder_destroy (encoder);
 		} else
+#endif
+#if HAVE_OPUS
+		if ( netj->bitdepth == OPUS_MODE ) {
+			OpusCustomEncoder * encoder = node->data;
+			opus_custom_encoder_destroy (encoder);
+		} else
 #endif
 		{
 #if HAVE_SAMPLERATE
@@ -549,6 +1278,11 @@ void netjack_detach ( netjack_driver_state_t *netj )
 		celt_mode_destroy (netj->celt_mode);
 	}
 #endif
+#if HAVE_OPUS
+	if ( netj->bitdepth == OPUS_MODE ) {
+		opus_custom_mode_destroy (netj->opus_mode);
+	}
+#endif
 }
 
 
@@ -565,13 +1299,28 @@ netjack_driver_state_t *netjack_init (netjack_driver_state_t *netj,
 				      unsigned int transport_sync,
 				      unsigned int resample_factor,
 				      unsigned int resample_factor_up,
+				      unsigned int resample_quality,
 				      unsigned int bitdepth,
 				      unsigned int use_autoconfig,
 				      unsigned int latency,
 				      unsigned int redundancy,
 				      int dont_htonl_floats,
 				      int always_deadline,
-				      int jitter_val )
+				      int jitter_val,
+				      unsigned int encoder_threads,
+				      unsigned int adaptive,
+				      unsigned int fec,
+				      unsigned int midi_packed,
+				      const char *multicast_group,
+				      const char *packet_ring,
+				      const char *local_socket,
+				      unsigned int busy_poll,
+				      unsigned int socket_priority,
+				      unsigned int dscp,
+				      unsigned int rcvbuf,
+				      unsigned int sndbuf,
+				      unsigned int spin_usecs,
+				      const char *redundant_master )
 {
 
 	// Fill in netj values.
@@ -593,20 +1342,67 @@ netjack_driver_state_t *netjack_init (netjack_driver_state_t *netj,
 	netj->playback_channels_audio = playback_ports;
 	netj->playback_channels_midi = playback_ports_midi;
 	netj->playback_ports    = NULL;
+	netj->capture_plan      = NULL;
+	netj->playback_plan     = NULL;
+	netj->capture_resampler = NULL;
+	netj->playback_resampler = NULL;
 	netj->codec_latency = 0;
 
 	netj->handle_transport_sync = transport_sync;
 	netj->mtu = 1400;
 	netj->latency = latency;
 	netj->redundancy = redundancy;
+	netj->fec = fec;
+	netj->midi_packed = midi_packed;
+
+	netj->multicast_group.s_addr = htonl (INADDR_ANY);
+	if (multicast_group && strcmp (multicast_group, "none") != 0) {
+		netj->multicast_group.s_addr = inet_addr (multicast_group);
+		if (!IN_MULTICAST (ntohl (netj->multicast_group.s_addr))) {
+			jack_info ("Invalid multicast group: %s", multicast_group);
+			return NULL;
+		}
+	}
+	netj->redundant_master.s_addr = htonl (INADDR_ANY);
+	if (redundant_master && strcmp (redundant_master, "none") != 0) {
+		netj->redundant_master.s_addr = inet_addr (redundant_master);
+		if (netj->redundant_master.s_addr == htonl (INADDR_NONE)
+		    || netj->redundant_master.s_addr == htonl (INADDR_ANY)) {
+			jack_info ("Invalid redundant master address: %s", redundant_master);
+			return NULL;
+		}
+	}
+	netj->ring = NULL;
+	netj->ring_interface = NULL;
+	if (packet_ring && strcmp (packet_ring, "none") != 0) {
+		netj->ring_interface = strdup (packet_ring);
+	}
+	netj->shm = NULL;
+	netj->shm_path = NULL;
+	if (local_socket && strcmp (local_socket, "none") != 0) {
+		netj->shm_path = strdup (local_socket);
+	}
+	if (dscp > 63) {
+		jack_info ("Invalid DSCP: %d (0 to 63) !!!", dscp);
+		return NULL;
+	}
+	netj->busy_poll = busy_poll;
+	netj->socket_priority = socket_priority;
+	netj->dscp = dscp;
+	netj->rcvbuf = rcvbuf;
+	netj->sndbuf = sndbuf;
+	netj->spin_usecs = spin_usecs;
 	netj->use_autoconfig = use_autoconfig;
 	netj->always_deadline = always_deadline;
+	netj->encoder_threads = encoder_threads;
+	netj->codec_pool = NULL;
+	netj->adaptive = adaptive;
 
 
 	netj->client = client;
 
 
-	if ((bitdepth != 0) && (bitdepth != 8) && (bitdepth != 16) && (bitdepth != CELT_MODE)) {
+	if ((bitdepth != 0) && (bitdepth != 8) && (bitdepth != 16) && (bitdepth != CELT_MODE) && (bitdepth != OPUS_MODE)) {
 		jack_info ("Invalid bitdepth: %d (8, 16 or 0 for float) !!!", bitdepth);
 		return NULL;
 	}
@@ -620,6 +1416,17 @@ netjack_driver_state_t *netjack_init (netjack_driver_state_t *netj,
 	netj->resample_factor = resample_factor;
 	netj->resample_factor_up = resample_factor_up;
 
+#if !HAVE_SAMPLERATE
+	if (resample_quality == NETJACK_RESAMPLE_SRC) {
+		resample_quality = NETJACK_RESAMPLE_MEDIUM;
+	}
+#endif
+	if (resample_quality > NETJACK_RESAMPLE_BEST) {
+		jack_info ("Invalid resample quality: %d (0 to %d) !!!", resample_quality, NETJACK_RESAMPLE_BEST);
+		return NULL;
+	}
+	netj->resample_quality = resample_quality;
+
 	netj->jitter_val = jitter_val;
 
 	return netj;
@@ -627,11 +1434,158 @@ netjack_driver_state_t *netjack_init (netjack_driver_state_t *netj,
 
 void netjack_release ( netjack_driver_state_t *netj )
 {
-	close ( netj->sockfd );
-	close ( netj->outsockfd );
+	if ( netj->sockfd >= 0 ) {
+		close ( netj->sockfd );
+	}
+	if ( netj->outsockfd >= 0 ) {
+		close ( netj->outsockfd );
+	}
 
 	packet_cache_free ( netj->packcache );
 	netj->packcache = NULL;
+
+	netjack_ring_free ( netj->ring );
+	netj->ring = NULL;
+	free ( netj->ring_interface );
+	netj->ring_interface = NULL;
+
+	netjack_shm_free ( netj->shm );
+	netj->shm = NULL;
+	free ( netj->shm_path );
+	netj->shm_path = NULL;
+}
+
+// Apply the socket options asked for. None of them is essential, so
+// failures (mostly missing privileges) are only reported.
+static void
+netjack_tune_socket ( netjack_driver_state_t *netj, int fd )
+{
+#ifndef WIN32
+	int val;
+
+#ifdef SO_BUSY_POLL
+	if ( netj->busy_poll ) {
+		val = netj->busy_poll;
+		if ( setsockopt ( fd, SOL_SOCKET, SO_BUSY_POLL, &val, sizeof(val) ) < 0 ) {
+			jack_info ( "netjack: cannot set SO_BUSY_POLL (%s)", strerror (errno) );
+		}
+	}
+#endif
+#ifdef SO_PRIORITY
+	if ( netj->socket_priority ) {
+		val = netj->socket_priority;
+		if ( setsockopt ( fd, SOL_SOCKET, SO_PRIORITY, &val, sizeof(val) ) < 0 ) {
+			jack_info ( "netjack: cannot set SO_PRIORITY (%s)", strerror (errno) );
+		}
+	}
+#endif
+	if ( netj->dscp ) {
+		val = netj->dscp << 2;
+		if ( setsockopt ( fd, IPPROTO_IP, IP_TOS, &val, sizeof(val) ) < 0 ) {
+			jack_info ( "netjack: cannot set DSCP (%s)", strerror (errno) );
+		}
+	}
+	if ( netj->rcvbuf ) {
+		val = netj->rcvbuf;
+		if ( setsockopt ( fd, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val) ) < 0 ) {
+			jack_info ( "netjack: cannot set SO_RCVBUF (%s)", strerror (errno) );
+		}
+	}
+	if ( netj->sndbuf ) {
+		val = netj->sndbuf;
+		if ( setsockopt ( fd, SOL_SOCKET, SO_SNDBUF, &val, sizeof(val) ) < 0 ) {
+			jack_info ( "netjack: cannot set SO_SNDBUF (%s)", strerror (errno) );
+		}
+	}
+#endif
+}
+
+// Take over the settings of the master from the header of its first
+// packet.
+static void
+netjack_autoconfig ( netjack_driver_state_t *netj, jacknet_packet_header *first_packet )
+{
+	packet_header_ntoh (first_packet);
+
+	jack_info ("AutoConfig Override !!!");
+	if (netj->sample_rate != first_packet->sample_rate) {
+		jack_info ("AutoConfig Override: Master JACK sample rate = %d", first_packet->sample_rate);
+		netj->sample_rate = first_packet->sample_rate;
+	}
+
+	if (netj->period_size != first_packet->period_size) {
+		jack_info ("AutoConfig Override: Master JACK period size is %d", first_packet->period_size);
+		netj->period_size = first_packet->period_size;
+	}
+	if (netj->capture_channels_audio != first_packet->capture_channels_audio) {
+		jack_info ("AutoConfig Override: capture_channels_audio = %d", first_packet->capture_channels_audio);
+		netj->capture_channels_audio = first_packet->capture_channels_audio;
+	}
+	if (netj->capture_channels_midi != first_packet->capture_channels_midi) {
+		jack_info ("AutoConfig Override: capture_channels_midi = %d", first_packet->capture_channels_midi);
+		netj->capture_channels_midi = first_packet->capture_channels_midi;
+	}
+	if (netj->playback_channels_audio != first_packet->playback_channels_audio) {
+		jack_info ("AutoConfig Override: playback_channels_audio = %d", first_packet->playback_channels_audio);
+		netj->playback_channels_audio = first_packet->playback_channels_audio;
+	}
+	if (netj->playback_channels_midi != first_packet->playback_channels_midi) {
+		jack_info ("AutoConfig Override: playback_channels_midi = %d", first_packet->playback_channels_midi);
+		netj->playback_channels_midi = first_packet->playback_channels_midi;
+	}
+
+	netj->mtu = first_packet->mtu;
+	jack_info ("MTU is set to %d bytes", first_packet->mtu);
+	netj->latency = first_packet->latency;
+}
+
+// Local transport: wait for the master to hand us its shared memory,
+// then for its first packet if we autoconfigure.
+static int
+netjack_startup_shm ( netjack_driver_state_t *netj )
+{
+	int listen_fd;
+
+	netj->sockfd = -1;
+	netj->outsockfd = -1;
+
+	listen_fd = netjack_shm_listen ( netj->shm_path );
+	if ( listen_fd < 0 ) {
+		return -1;
+	}
+
+	jack_info ( "netjack: waiting for the master on %s", netj->shm_path );
+	while ( netj->shm == NULL ) {
+		if ( !netjack_poll ( listen_fd, 1000 ) ) {
+			jack_info ("Waiting aborted");
+			close ( listen_fd );
+			unlink ( netj->shm_path );
+			return -1;
+		}
+		netj->shm = netjack_shm_accept ( listen_fd );
+	}
+	close ( listen_fd );
+	unlink ( netj->shm_path );
+
+	// Replies always go back through the segment.
+	netj->srcaddress_valid = 1;
+
+	if ( netj->use_autoconfig ) {
+		jacknet_packet_header first_packet;
+
+		while ( 1 ) {
+			if ( !netjack_poll ( netjack_shm_fd ( netj->shm ), 1000 ) ) {
+				jack_info ("Waiting aborted");
+				return -1;
+			}
+			if ( netjack_shm_recv ( netj->shm, (char*)&first_packet, sizeof(first_packet) ) == sizeof(first_packet) ) {
+				break;
+			}
+		}
+		netjack_autoconfig ( netj, &first_packet );
+	}
+
+	return 0;
 }
 
 int
@@ -640,6 +1594,13 @@ netjack_startup ( netjack_driver_state_t *netj )
 	int first_pack_len;
 	struct sockaddr_in address;
 
+	if ( netj->shm_path ) {
+		if ( netjack_startup_shm ( netj ) ) {
+			return -1;
+		}
+		goto configured;
+	}
+
 	// Now open the socket, and wait for the first packet to arrive...
 	netj->sockfd = socket (AF_INET, SOCK_DGRAM, 0);
 #ifdef WIN32
@@ -654,11 +1615,33 @@ netjack_startup ( netjack_driver_state_t *netj )
 	address.sin_family = AF_INET;
 	address.sin_port = htons (netj->listen_port);
 	address.sin_addr.s_addr = htonl (INADDR_ANY);
+
+	// Several slaves on one host may listen to the same group.
+	if (netj->multicast_group.s_addr != htonl (INADDR_ANY)) {
+		int reuse = 1;
+		setsockopt (netj->sockfd, SOL_SOCKET, SO_REUSEADDR, (char*)&reuse, sizeof(reuse));
+	}
+
 	if (bind (netj->sockfd, (struct sockaddr*)&address, sizeof(address)) < 0) {
 		jack_info ("bind error");
 		return -1;
 	}
 
+	// With a multicast group the master sends every period once to
+	// the group.  Packets still come from the master's own address,
+	// so our replies keep going to it by unicast.
+	if (netj->multicast_group.s_addr != htonl (INADDR_ANY)) {
+		struct ip_mreq mreq;
+
+		mreq.imr_multiaddr = netj->multicast_group;
+		mreq.imr_interface.s_addr = htonl (INADDR_ANY);
+		if (setsockopt (netj->sockfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char*)&mreq, sizeof(mreq)) < 0) {
+			jack_info ("cannot join multicast group %s", inet_ntoa (netj->multicast_group));
+			return -1;
+		}
+		jack_info ("netjack: listening to multicast group %s", inet_ntoa (netj->multicast_group));
+	}
+
 	netj->outsockfd = socket (AF_INET, SOCK_DGRAM, 0);
 #ifdef WIN32
 	if (netj->outsockfd == INVALID_SOCKET)
@@ -669,6 +1652,8 @@ netjack_startup ( netjack_driver_state_t *netj )
 		jack_info ("socket error");
 		return -1;
 	}
+	netjack_tune_socket ( netj, netj->sockfd );
+	netjack_tune_socket ( netj, netj->outsockfd );
 	netj->srcaddress_valid = 0;
 	if (netj->use_autoconfig) {
 		jacknet_packet_header *first_packet = alloca (sizeof(jacknet_packet_header));
@@ -700,40 +1685,11 @@ netjack_startup ( netjack_driver_state_t *netj )
 		netj->srcaddress_valid = 1;
 
 		if (first_pack_len == sizeof(jacknet_packet_header)) {
-			packet_header_ntoh (first_packet);
-
-			jack_info ("AutoConfig Override !!!");
-			if (netj->sample_rate != first_packet->sample_rate) {
-				jack_info ("AutoConfig Override: Master JACK sample rate = %d", first_packet->sample_rate);
-				netj->sample_rate = first_packet->sample_rate;
-			}
-
-			if (netj->period_size != first_packet->period_size) {
-				jack_info ("AutoConfig Override: Master JACK period size is %d", first_packet->period_size);
-				netj->period_size = first_packet->period_size;
-			}
-			if (netj->capture_channels_audio != first_packet->capture_channels_audio) {
-				jack_info ("AutoConfig Override: capture_channels_audio = %d", first_packet->capture_channels_audio);
-				netj->capture_channels_audio = first_packet->capture_channels_audio;
-			}
-			if (netj->capture_channels_midi != first_packet->capture_channels_midi) {
-				jack_info ("AutoConfig Override: capture_channels_midi = %d", first_packet->capture_channels_midi);
-				netj->capture_channels_midi = first_packet->capture_channels_midi;
-			}
-			if (netj->playback_channels_audio != first_packet->playback_channels_audio) {
-				jack_info ("AutoConfig Override: playback_channels_audio = %d", first_packet->playback_channels_audio);
-				netj->playback_channels_audio = first_packet->playback_channels_audio;
-			}
-			if (netj->playback_channels_midi != first_packet->playback_channels_midi) {
-				jack_info ("AutoConfig Override: playback_channels_midi = %d", first_packet->playback_channels_midi);
-				netj->playback_channels_midi = first_packet->playback_channels_midi;
-			}
-
-			netj->mtu = first_packet->mtu;
-			jack_info ("MTU is set to %d bytes", first_packet->mtu);
-			netj->latency = first_packet->latency;
+			netjack_autoconfig ( netj, first_packet );
 		}
 	}
+
+configured:
 	netj->capture_channels  = netj->capture_channels_audio + netj->capture_channels_midi;
 	netj->playback_channels = netj->playback_channels_audio + netj->playback_channels_midi;
 
@@ -769,8 +1725,8 @@ netjack_startup ( netjack_driver_state_t *netj )
 		netj->deadline_offset = netj->period_usecs + 10 * netj->latency * netj->period_usecs / 100;
 	}
 
-	if ( netj->bitdepth == CELT_MODE ) {
-		// celt mode.
+	if ( netj->bitdepth == CELT_MODE || netj->bitdepth == OPUS_MODE ) {
+		// celt or opus mode.
 		// TODO: this is a hack. But i dont want to change the packet header.
 		netj->resample_factor = (netj->resample_factor * netj->period_size * 1024 / netj->sample_rate / 8) & (~1);
 		netj->resample_factor_up = (netj->resample_factor_up * netj->period_size * 1024 / netj->sample_rate / 8) & (~1);
@@ -783,7 +1739,34 @@ netjack_startup ( netjack_driver_state_t *netj )
 	}
 
 	netj->rx_bufsize = sizeof(jacknet_packet_header) + netj->net_period_down * netj->capture_channels * get_sample_size(netj->bitdepth);
+
+	if ( netj->shm ) {
+		// Whole packets, so the cache sees one fragment each.
+		int tx_size = sizeof(jacknet_packet_header) + netj->net_period_up * netj->playback_channels * get_sample_size(netj->bitdepth);
+
+		netj->mtu = netjack_shm_slot_size ( netj->shm );
+		if ( netj->rx_bufsize > netj->mtu || tx_size > netj->mtu ) {
+			jack_error ( "packets do not fit the master's shared memory slots... bailing out" );
+			exit (1);
+		}
+	}
 	netj->packcache = packet_cache_new (netj->latency + 50, netj->rx_bufsize, netj->mtu);
+	if ( !netj->shm ) {
+		netj->packcache->redundant_address = netj->redundant_master;
+	}
+
+	if ( netj->ring_interface && !netj->shm ) {
+		netj->ring = netjack_ring_new ( netj->ring_interface, netj->listen_port, netj->mtu );
+		if ( netj->ring ) {
+			// Everything is read from the ring now; let the
+			// socket drop its copies early.
+			int rcvbuf = 0;
+			setsockopt ( netj->sockfd, SOL_SOCKET, SO_RCVBUF, (char*)&rcvbuf, sizeof(rcvbuf) );
+			jack_info ( "netjack: receiving through the packet ring on %s", netj->ring_interface );
+		} else {
+			jack_error ( "netjack: packet ring unavailable, reading the socket" );
+		}
+	}
 
 	netj->expected_framecnt_valid = 0;
 	netj->num_lost_packets = 0;
@@ -791,6 +1774,16 @@ netjack_startup ( netjack_driver_state_t *netj )
 	netj->deadline_goodness = 0;
 	netj->time_to_deadline = 0;
 
+	// Start adapting from the margin the fixed rule would pick.
+	netj->last_arrival_valid = 0;
+	netj->jitter_usecs = 0.0f;
+	netj->target_usecs = netj->period_usecs / 4 + 10 * netj->period_usecs * netj->latency / 100;
+	netj->stats_lost = 0;
+	netj->stats_resyncs = 0;
+	netj->stats_lost_total = 0;
+	netj->stats_resyncs_total = 0;
+	netj->stats_next_report = 0;
+
 	// Special handling for latency=0
 	if ( netj->latency == 0 ) {
 		netj->resync_threshold = 0;
@@ -35,12 +35,22 @@
 #include <celt/celt.h>
 #endif
 
+#if HAVE_OPUS
+#include <opus/opus_custom.h>
+#endif
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
 struct _packet_cache;
+struct _netjack_codec_pool;
+struct _netjack_port_plan;
+struct _netjack_resampler;
+struct _netjack_ring;
+struct _netjack_local;
+struct _netjack_shm;
 
 typedef struct _netjack_driver_state netjack_driver_state_t;
 
@@ -70,6 +80,10 @@ struct _netjack_driver_state {
 	JSList          *playback_ports;
 	JSList          *playback_srcs;
 	JSList          *capture_srcs;
+	struct _netjack_port_plan *capture_plan;   // see netjack_port_plan_new()
+	struct _netjack_port_plan *playback_plan;
+	struct _netjack_resampler *capture_resampler;   // NULL: not resampling, or libsamplerate
+	struct _netjack_resampler *playback_resampler;
 
 	jack_client_t   *client;
 
@@ -95,6 +109,10 @@ struct _netjack_driver_state {
 	unsigned int mtu;
 	unsigned int latency;
 	unsigned int redundancy;
+	unsigned int fec;
+	unsigned int midi_packed;       // midi events packed after the audio
+	struct in_addr multicast_group;   // INADDR_ANY: unicast only
+	struct in_addr redundant_master;  // master's second path, INADDR_ANY: none
 
 	jack_nframes_t expected_framecnt;
 	int expected_framecnt_valid;
@@ -110,11 +128,49 @@ struct _netjack_driver_state {
 	unsigned int use_autoconfig;
 	unsigned int resample_factor;
 	unsigned int resample_factor_up;
+	unsigned int resample_quality;
 	int jitter_val;
 	struct _packet_cache * packcache;
+	char *ring_interface;               // NULL: read the UDP socket
+	struct _netjack_ring *ring;
+	char *shm_path;                     // NULL: talk to the master over the network
+	struct _netjack_shm *shm;
+
+	// Socket tuning; 0 leaves the system default.
+	unsigned int busy_poll;             // SO_BUSY_POLL, usecs
+	unsigned int socket_priority;       // SO_PRIORITY
+	unsigned int dscp;                  // IP_TOS = dscp << 2
+	unsigned int rcvbuf;                // bytes
+	unsigned int sndbuf;
+	unsigned int spin_usecs;            // busy wait this long before the deadline
+
+	// Set while we follow the local clock as a slave driver, see
+	// netjack_local_start().
+	struct _netjack_local *local;
 #if HAVE_CELT
 	CELTMode       *celt_mode;
 #endif
+#if HAVE_OPUS
+	OpusCustomMode *opus_mode;
+#endif
+	unsigned int encoder_threads;
+	struct _netjack_codec_pool *codec_pool;
+
+	// Adaptive playout: the deadline margin follows the measured
+	// arrival jitter instead of a value derived from the latency.
+	unsigned int adaptive;
+	jack_time_t last_arrival;
+	jack_nframes_t last_arrival_framecnt;
+	int last_arrival_valid;
+	float jitter_usecs;
+	float target_usecs;
+
+	// Link statistics, reported every NETJACK_STATS_INTERVAL.
+	unsigned int stats_lost;
+	unsigned int stats_resyncs;
+	unsigned int stats_lost_total;
+	unsigned int stats_resyncs_total;
+	jack_time_t stats_next_report;
 };
 
 int netjack_wait ( netjack_driver_state_t * netj, jack_time_t (*get_microseconds)(void) );
@@ -124,6 +180,13 @@ void netjack_write( netjack_driver_state_t *netj, jack_nframes_t nframes, int sy
 void netjack_attach( netjack_driver_state_t *netj );
 void netjack_detach( netjack_driver_state_t *netj );
 
+int netjack_local_start( netjack_driver_state_t *netj, jack_nframes_t nframes );
+void netjack_local_stop( netjack_driver_state_t *netj );
+void netjack_local_receive( netjack_driver_state_t *netj, void *packet_payload );
+int netjack_local_send( netjack_driver_state_t *netj, void *packet_payload );
+void netjack_local_read( netjack_driver_state_t *netj, jack_nframes_t nframes, float period_usecs );
+void netjack_local_write( netjack_driver_state_t *netj, jack_nframes_t nframes );
+
 netjack_driver_state_t *netjack_init(netjack_driver_state_t *netj,
 				     jack_client_t * client,
 				     const char *name,
@@ -137,13 +200,28 @@ netjack_driver_state_t *netjack_init(netjack_driver_state_t *netj,
 				     unsigned int transport_sync,
 				     unsigned int resample_factor,
 				     unsigned int resample_factor_up,
+				     unsigned int resample_quality,
 				     unsigned int bitdepth,
 				     unsigned int use_autoconfig,
 				     unsigned int latency,
 				     unsigned int redundancy,
 				     int dont_htonl_floats,
 				     int always_deadline,
-				     int jitter_val );
+				     int jitter_val,
+				     unsigned int encoder_threads,
+				     unsigned int adaptive,
+				     unsigned int fec,
+				     unsigned int midi_packed,
+				     const char *multicast_group,
+				     const char *packet_ring,
+				     const char *local_socket,
+				     unsigned int busy_poll,
+				     unsigned int socket_priority,
+				     unsigned int dscp,
+				     unsigned int rcvbuf,
+				     unsigned int sndbuf,
+				     unsigned int spin_usecs,
+				     const char *redundant_master );
 
 void netjack_release( netjack_driver_state_t *netj );
 int netjack_startup( netjack_driver_state_t *netj );
@@ -32,13 +32,14 @@
 #define _DARWIN_C_SOURCE
 #endif
 
-#if HAVE_PPOLL
+#if HAVE_PPOLL || defined(HAVE_SENDMMSG) || defined(HAVE_RECVMMSG) || defined(HAVE_MEMFD_CREATE)
 #define _GNU_SOURCE
 #endif
 
 #include <math.h>
 #include <stdio.h>
 #include <memory.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -48,6 +49,7 @@
 
 // for jack_error in jack1
 #include "internal.h"
+#include "cpufeatures.h"
 
 #include <sys/types.h>
 
@@ -57,6 +59,8 @@
 #else
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/uio.h>
 #include <poll.h>
 #endif
 
@@ -71,7 +75,32 @@
 #include <celt/celt.h>
 #endif
 
+#if HAVE_OPUS
+#include <pthread.h>
+#include <semaphore.h>
+#include <opus/opus.h>
+#include <opus/opus_custom.h>
+#endif
+
 #include "netjack_packet.h"
+#include "netjack_resample.h"
+
+#if defined(HAVE_LINUX_IF_PACKET_H) && !defined(WIN32)
+#define NETJACK_RING
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#endif
+
+#if defined(HAVE_SYS_EVENTFD_H) && defined(HAVE_MEMFD_CREATE) && !defined(WIN32)
+#define NETJACK_SHM
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#endif
 
 // JACK2 specific.
 //#include "jack/control.h"
@@ -133,6 +162,9 @@ int get_sample_size (int bitdepth)
 	if ( bitdepth == CELT_MODE ) {
 		return sizeof( unsigned char );
 	}
+	if ( bitdepth == OPUS_MODE ) {
+		return sizeof( unsigned char );
+	}
 	return sizeof(int32_t);
 }
 
@@ -147,6 +179,23 @@ int jack_port_is_midi (const char *porttype)
 }
 
 
+#if !defined(WIN32) && (defined(HAVE_SENDMMSG) || defined(HAVE_RECVMMSG))
+// Number of datagrams handed to the kernel per sendmmsg()/recvmmsg() call.
+#define NETJACK_MMSG_BATCH 32
+#endif
+
+#ifdef HAVE_RECVMMSG
+#ifndef WIN32
+#define NETJACK_RX_BATCH
+typedef struct {
+	struct mmsghdr msgs[NETJACK_MMSG_BATCH];
+	struct iovec iov[NETJACK_MMSG_BATCH];
+	struct sockaddr_in addrs[NETJACK_MMSG_BATCH];
+	char bufs[0];
+} netjack_rx_batch_t;
+#endif
+#endif
+
 // fragment management functions.
 
 packet_cache
@@ -170,8 +219,11 @@ packet_cache
 	pcache->size = num_packets;
 	pcache->packets = malloc (sizeof(cache_packet) * num_packets);
 	pcache->master_address_valid = 0;
+	pcache->redundant_address.s_addr = htonl (INADDR_ANY);
+	memset (pcache->path_stats, 0, sizeof(pcache->path_stats));
 	pcache->last_framecnt_retreived = 0;
 	pcache->last_framecnt_retreived_valid = 0;
+	pcache->rx_batch = NULL;
 
 	if (pcache->packets == NULL) {
 		jack_error ("could not allocate packet cache (2)");
@@ -184,15 +236,40 @@ packet_cache
 		pcache->packets[i].packet_size = pkt_size;
 		pcache->packets[i].mtu = mtu;
 		pcache->packets[i].framecnt = 0;
-		pcache->packets[i].fragment_array = malloc (sizeof(char) * fragment_number);
+		pcache->packets[i].num_received = 0;
+		pcache->packets[i].fragment_bits = calloc ((fragment_number + 31) / 32, sizeof(uint32_t));
 		pcache->packets[i].packet_buf = malloc (pkt_size);
-		if ((pcache->packets[i].fragment_array == NULL) || (pcache->packets[i].packet_buf == NULL)) {
+		pcache->packets[i].has_parity = 0;
+		pcache->packets[i].parity_buf = NULL;
+		if (fragment_number > 1) {
+			pcache->packets[i].parity_buf = malloc (fragment_payload_size);
+		}
+		if ((pcache->packets[i].fragment_bits == NULL) || (pcache->packets[i].packet_buf == NULL)
+		    || (fragment_number > 1 && pcache->packets[i].parity_buf == NULL)) {
 			jack_error ("could not allocate packet cache (3)");
 			return NULL;
 		}
 	}
 	pcache->mtu = mtu;
 
+#ifdef NETJACK_RX_BATCH
+	// Receive buffers for draining the socket with one recvmmsg()
+	// per NETJACK_MMSG_BATCH fragments.  Without them we simply
+	// fall back to one recvfrom() per fragment.
+	netjack_rx_batch_t *batch = malloc (sizeof(netjack_rx_batch_t) + (size_t)NETJACK_MMSG_BATCH * mtu);
+	if (batch != NULL) {
+		for (i = 0; i < NETJACK_MMSG_BATCH; i++) {
+			batch->iov[i].iov_base = batch->bufs + (size_t)i * mtu;
+			batch->iov[i].iov_len = mtu;
+			memset (&batch->msgs[i], 0, sizeof(struct mmsghdr));
+			batch->msgs[i].msg_hdr.msg_iov = &batch->iov[i];
+			batch->msgs[i].msg_hdr.msg_iovlen = 1;
+			batch->msgs[i].msg_hdr.msg_name = &batch->addrs[i];
+		}
+		pcache->rx_batch = batch;
+	}
+#endif
+
 	return pcache;
 }
 
@@ -206,108 +283,144 @@ packet_cache_free (packet_cache *pcache)
 	}
 
 	for (i = 0; i < pcache->size; i++) {
-		free (pcache->packets[i].fragment_array);
+		free (pcache->packets[i].fragment_bits);
+		free (pcache->packets[i].parity_buf);
 		free (pcache->packets[i].packet_buf);
 	}
 
 	free (pcache->packets);
+	free (pcache->rx_batch);
 	free (pcache);
 }
 
+// Returns the slot for framecnt, claiming it if it holds an older
+// packet.  Returns NULL when the slot is taken by a newer packet,
+// i.e. the fragment is too late to be of any use.
+
 cache_packet
 *packet_cache_get_packet (packet_cache *pcache, jack_nframes_t framecnt)
 {
-	int i;
-	cache_packet *retval;
+	cache_packet *cpack = &(pcache->packets[framecnt % pcache->size]);
 
-	for (i = 0; i < pcache->size; i++)
-		if (pcache->packets[i].valid && (pcache->packets[i].framecnt == framecnt)) {
-			return &(pcache->packets[i]);
+	if (cpack->valid) {
+		if (cpack->framecnt == framecnt) {
+			return cpack;
 		}
-
-	// The Packet is not in the packet cache.
-	// find a free packet.
-
-	retval = packet_cache_get_free_packet (pcache);
-	if (retval != NULL) {
-		cache_packet_set_framecnt (retval, framecnt);
-		return retval;
+		if (cpack->framecnt > framecnt) {
+			return NULL;
+		}
+		//printf( "Dropping %d from Cache :S\n", cpack->framecnt );
 	}
 
-	// No Free Packet available
-	// Get The Oldest packet and reset it.
-
-	retval = packet_cache_get_oldest_packet (pcache);
-	//printf( "Dropping %d from Cache :S\n", retval->framecnt );
-	cache_packet_reset (retval);
-	cache_packet_set_framecnt (retval, framecnt);
+	cache_packet_set_framecnt (cpack, framecnt);
 
-	return retval;
+	return cpack;
 }
 
-// TODO: fix wrapping case... need to pass
-//       current expected frame here.
-//
-//       or just save framecount into packet_cache.
+// Returns the cached packet for framecnt, or NULL.
 
 cache_packet
-*packet_cache_get_oldest_packet (packet_cache *pcache)
+*packet_cache_find_packet (packet_cache *pcache, jack_nframes_t framecnt)
 {
-	jack_nframes_t minimal_frame = JACK_MAX_FRAMES;
-	cache_packet *retval = &(pcache->packets[0]);
-	int i;
+	cache_packet *cpack = &(pcache->packets[framecnt % pcache->size]);
 
-	for (i = 0; i < pcache->size; i++) {
-		if (pcache->packets[i].valid && (pcache->packets[i].framecnt < minimal_frame)) {
-			minimal_frame = pcache->packets[i].framecnt;
-			retval = &(pcache->packets[i]);
-		}
+	if (cpack->valid && (cpack->framecnt == framecnt)) {
+		return cpack;
 	}
 
-	return retval;
+	return NULL;
 }
 
-cache_packet
-*packet_cache_get_free_packet (packet_cache *pcache)
+static void
+cache_packet_clear_fragments (cache_packet *pack)
 {
-	int i;
+	memset (pack->fragment_bits, 0, ((pack->num_fragments + 31) / 32) * sizeof(uint32_t));
+	pack->num_received = 0;
+	pack->has_parity = 0;
+	memset (pack->path_seen, 0, sizeof(pack->path_seen));
+}
+
+static void
+cache_packet_mark_fragment (cache_packet *pack, jack_nframes_t fragment_nr)
+{
+	uint32_t bit = 1U << (fragment_nr & 31);
+
+	if ((pack->fragment_bits[fragment_nr >> 5] & bit) == 0) {
+		pack->fragment_bits[fragment_nr >> 5] |= bit;
+		pack->num_received++;
+	}
+}
+
+// Rebuild the one missing fragment from the parity and the others.
+static void
+cache_packet_fec_recover (cache_packet *pack)
+{
+	int fragment_payload_size = pack->mtu - sizeof(jacknet_packet_header);
+	int data_size = pack->packet_size - sizeof(jacknet_packet_header);
+	char *packet_bufX = pack->packet_buf + sizeof(jacknet_packet_header);
+	int missing, missing_len, i, j;
+	char *dst;
+
+	if (!pack->has_parity || pack->num_received != pack->num_fragments - 1) {
+		return;
+	}
 
-	for (i = 0; i < pcache->size; i++)
-		if (pcache->packets[i].valid == 0) {
-			return &(pcache->packets[i]);
+	for (missing = 0; missing < pack->num_fragments; missing++) {
+		if ((pack->fragment_bits[missing >> 5] & (1U << (missing & 31))) == 0) {
+			break;
 		}
+	}
 
-	return NULL;
+	dst = packet_bufX + missing * fragment_payload_size;
+	missing_len = data_size - missing * fragment_payload_size;
+	if (missing_len > fragment_payload_size) {
+		missing_len = fragment_payload_size;
+	}
+
+	memcpy (dst, pack->parity_buf, missing_len);
+	for (i = 0; i < pack->num_fragments; i++) {
+		char *src = packet_bufX + i * fragment_payload_size;
+		int len = data_size - i * fragment_payload_size;
+
+		if (i == missing) {
+			continue;
+		}
+		if (len > missing_len) {
+			len = missing_len;
+		}
+		for (j = 0; j < len; j++) {
+			dst[j] ^= src[j];
+		}
+	}
+
+	cache_packet_mark_fragment (pack, missing);
 }
 
 void
 cache_packet_reset (cache_packet *pack)
 {
-	int i;
-
 	pack->valid = 0;
 
 	// XXX: i dont think this is necessary here...
-	//      fragement array is cleared in _set_framecnt()
+	//      fragement bits are cleared in _set_framecnt()
 
-	for (i = 0; i < pack->num_fragments; i++)
-		pack->fragment_array[i] = 0;
+	cache_packet_clear_fragments (pack);
 }
 
 void
 cache_packet_set_framecnt (cache_packet *pack, jack_nframes_t framecnt)
 {
-	int i;
-
 	pack->framecnt = framecnt;
 
-	for (i = 0; i < pack->num_fragments; i++)
-		pack->fragment_array[i] = 0;
+	cache_packet_clear_fragments (pack);
 
 	pack->valid = 1;
 }
 
-void
+// Returns 1 if the fragment was new, 0 if we already had it (from
+// another path, a redundant send, or FEC) or could not use it.
+
+int
 cache_packet_add_fragment (cache_packet *pack, char *packet_buf, int rcv_len)
 {
 	jacknet_packet_header *pkthdr = (jacknet_packet_header*)packet_buf;
@@ -320,38 +433,71 @@ cache_packet_add_fragment (cache_packet *pack, char *packet_buf, int rcv_len)
 
 	if (framecnt != pack->framecnt) {
 		jack_error ("errror. framecnts dont match");
-		return;
+		return 0;
 	}
 
+	if ((fragment_nr < pack->num_fragments)
+	    && (pack->fragment_bits[fragment_nr >> 5] & (1U << (fragment_nr & 31)))) {
+		return 0;
+	}
 
+	// A fragment may be short of its slot when the sender trimmed
+	// unused space off the end of the packet; the rest reads as
+	// zeroes, as the parity was worked out.
 	if (fragment_nr == 0) {
+		int slot_end = pack->mtu < pack->packet_size ? pack->mtu : pack->packet_size;
+
 		memcpy (pack->packet_buf, packet_buf, rcv_len);
-		pack->fragment_array[0] = 1;
+		if (rcv_len < slot_end) {
+			memset (pack->packet_buf + rcv_len, 0, slot_end - rcv_len);
+		}
+		cache_packet_mark_fragment (pack, 0);
+		cache_packet_fec_recover (pack);
 
-		return;
+		return 1;
 	}
 
 	if ((fragment_nr < pack->num_fragments) && (fragment_nr > 0)) {
 		if ((fragment_nr * fragment_payload_size + rcv_len - sizeof(jacknet_packet_header)) <= (pack->packet_size - sizeof(jacknet_packet_header))) {
+			int data_size = pack->packet_size - sizeof(jacknet_packet_header);
+			int got_end = fragment_nr * fragment_payload_size + rcv_len - sizeof(jacknet_packet_header);
+			int slot_end = (fragment_nr + 1) * fragment_payload_size;
+
+			if (slot_end > data_size) {
+				slot_end = data_size;
+			}
 			memcpy (packet_bufX + fragment_nr * fragment_payload_size, dataX, rcv_len - sizeof(jacknet_packet_header));
-			pack->fragment_array[fragment_nr] = 1;
-		} else {
-			jack_error ("too long packet received...");
+			if (got_end < slot_end) {
+				memset (packet_bufX + got_end, 0, slot_end - got_end);
+			}
+			cache_packet_mark_fragment (pack, fragment_nr);
+			cache_packet_fec_recover (pack);
+			return 1;
+		}
+		jack_error ("too long packet received...");
+		return 0;
+	}
+
+	if ((fragment_nr == pack->num_fragments) && pack->parity_buf
+	    && (rcv_len == pack->mtu) && !pack->has_parity) {
+		memcpy (pack->parity_buf, dataX, fragment_payload_size);
+		pack->has_parity = 1;
+
+		// The header normally comes with fragment 0.
+		if ((pack->fragment_bits[0] & 1) == 0) {
+			memcpy (pack->packet_buf, packet_buf, sizeof(jacknet_packet_header));
 		}
+		cache_packet_fec_recover (pack);
+		return 1;
 	}
+
+	return 0;
 }
 
 int
 cache_packet_is_complete (cache_packet *pack)
 {
-	int i;
-
-	for (i = 0; i < pack->num_fragments; i++)
-		if (pack->fragment_array[i] == 0) {
-			return 0;
-		}
-
-	return 1;
+	return pack->num_received == pack->num_fragments;
 }
 
 #ifndef WIN32
@@ -417,6 +563,37 @@ netjack_poll_deadline (int sockfd, jack_time_t deadline, jack_time_t (*get_micro
 	return poll_err;
 }
 
+// Sleep until spin usecs before the deadline, then keep checking the
+// socket without sleeping. For hosts with a core to spare for the
+// driver thread: it trades that core for the wakeup latency.
+int
+netjack_poll_deadline_spin (int sockfd, jack_time_t deadline, jack_time_t spin, jack_time_t (*get_microseconds)(void))
+{
+	struct pollfd fds;
+	int poll_err;
+
+	if ( get_microseconds () + spin < deadline ) {
+		poll_err = netjack_poll_deadline (sockfd, deadline - spin, get_microseconds);
+		if (poll_err != 0) {
+			return poll_err;
+		}
+	}
+
+	fds.fd = sockfd;
+	fds.events = POLLIN;
+
+	while ( get_microseconds () < deadline ) {
+		poll_err = poll (&fds, 1, 0);
+		if (poll_err != 0) {
+			return poll_err;
+		}
+#if defined(__i386__) || defined(__x86_64__)
+		__builtin_ia32_pause ();
+#endif
+	}
+	return 0;
+}
+
 int
 netjack_poll (int sockfd, int timeout)
 {
@@ -482,6 +659,11 @@ netjack_poll (int sockfd, int timeout)
 	return 0;
 }
 int
+netjack_poll_deadline_spin (int sockfd, jack_time_t deadline, jack_time_t spin, jack_time_t (*get_microseconds)(void))
+{
+	return netjack_poll_deadline (sockfd, deadline, get_microseconds);
+}
+int
 netjack_poll_deadline (int sockfd, jack_time_t deadline, jack_time_t (*get_microseconds)(void))
 {
 	fd_set fds;
@@ -511,6 +693,74 @@ netjack_poll_deadline (int sockfd, jack_time_t deadline, jack_time_t (*get_micro
 	return 0;
 }
 #endif
+// Hand one received fragment to the cache.
+
+static void
+packet_cache_receive_fragment (packet_cache *pcache, char *rx_packet, int rcv_len,
+			       struct sockaddr_in *sender_address, int senderlen,
+			       jack_time_t (*get_microseconds)(void))
+{
+	jacknet_packet_header *pkthdr = (jacknet_packet_header*)rx_packet;
+	jack_nframes_t framecnt;
+	cache_packet *cpack;
+	netjack_path_stats_t *stats;
+	jack_time_t now;
+	int path = 0;
+
+	if (pcache->redundant_address.s_addr != htonl (INADDR_ANY)
+	    && sender_address->sin_addr.s_addr == pcache->redundant_address.s_addr) {
+		// The second copy; it never becomes the master.
+		path = 1;
+	} else if (pcache->master_address_valid) {
+		// Verify its from our master.
+		if (memcmp (sender_address, &(pcache->master_address), senderlen) != 0) {
+			return;
+		}
+	} else {
+		// Setup this one as master
+		//printf( "setup master...\n" );
+		memcpy ( &(pcache->master_address), sender_address, senderlen );
+		pcache->master_address_valid = 1;
+	}
+
+	stats = &pcache->path_stats[path];
+	stats->fragments++;
+
+	framecnt = ntohl (pkthdr->framecnt);
+	if ( pcache->last_framecnt_retreived_valid && (framecnt <= pcache->last_framecnt_retreived )) {
+		stats->late++;
+		return;
+	}
+
+	cpack = packet_cache_get_packet (pcache, framecnt);
+	if (cpack == NULL) {
+		stats->late++;
+		return;
+	}
+
+	now = get_microseconds ();
+	if (cpack->path_seen[path] == 0) {
+		cpack->path_seen[path] = now;
+		if (cpack->path_seen[!path]) {
+			netjack_path_stats_t *other = &pcache->path_stats[!path];
+			jack_time_t lead = now - cpack->path_seen[!path];
+
+			other->ahead++;
+			other->lead_sum += lead;
+			if (lead > other->lead_max) {
+				other->lead_max = lead;
+			}
+		}
+	}
+
+	// The packet is complete when its last new fragment is in; later
+	// duplicates do not make it any later.
+	if (cache_packet_add_fragment (cpack, rx_packet, rcv_len)) {
+		stats->used++;
+		cpack->recv_timestamp = now;
+	}
+}
+
 // This now reads all a socket has into the cache.
 // replacing netjack_recv functions.
 
@@ -518,10 +768,7 @@ void
 packet_cache_drain_socket ( packet_cache *pcache, int sockfd, jack_time_t (*get_microseconds)(void) )
 {
 	char *rx_packet = alloca (pcache->mtu);
-	jacknet_packet_header *pkthdr = (jacknet_packet_header*)rx_packet;
 	int rcv_len;
-	jack_nframes_t framecnt;
-	cache_packet *cpack;
 	struct sockaddr_in sender_address;
 
 #ifdef WIN32
@@ -531,11 +778,48 @@ packet_cache_drain_socket ( packet_cache *pcache, int sockfd, jack_time_t (*get_
 #else
 	socklen_t senderlen = sizeof( struct sockaddr_in );
 #endif
+
+#ifdef NETJACK_RX_BATCH
+	netjack_rx_batch_t *batch = pcache->rx_batch;
+
+	while (batch != NULL) {
+		int i, n;
+
+		for (i = 0; i < NETJACK_MMSG_BATCH; i++) {
+			batch->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		}
+
+		n = recvmmsg (sockfd, batch->msgs, NETJACK_MMSG_BATCH, MSG_DONTWAIT, NULL);
+		if (n < 0) {
+			if (errno == ENOSYS) {
+				// Kernel without recvmmsg(), use recvfrom() from now on.
+				free (batch);
+				pcache->rx_batch = NULL;
+				break;
+			}
+			return;
+		}
+
+		for (i = 0; i < n; i++) {
+			packet_cache_receive_fragment (pcache, batch->iov[i].iov_base,
+						       batch->msgs[i].msg_len, &batch->addrs[i],
+						       batch->msgs[i].msg_hdr.msg_namelen,
+						       get_microseconds);
+		}
+
+		// A short batch means the socket has been emptied.
+		if (n < NETJACK_MMSG_BATCH) {
+			return;
+		}
+	}
+#endif
+
 	while (1) {
 #ifdef WIN32
 		rcv_len = recvfrom (sockfd, rx_packet, pcache->mtu, 0,
 				    (struct sockaddr*)&sender_address, &senderlen);
 #else
+		senderlen = sizeof( struct sockaddr_in );
 		rcv_len = recvfrom (sockfd, rx_packet, pcache->mtu, MSG_DONTWAIT,
 				    (struct sockaddr*)&sender_address, &senderlen);
 #endif
@@ -543,117 +827,748 @@ packet_cache_drain_socket ( packet_cache *pcache, int sockfd, jack_time_t (*get_
 			return;
 		}
 
-		if (pcache->master_address_valid) {
-			// Verify its from our master.
-			if (memcmp (&sender_address, &(pcache->master_address), senderlen) != 0) {
-				continue;
-			}
-		} else {
-			// Setup this one as master
-			//printf( "setup master...\n" );
-			memcpy ( &(pcache->master_address), &sender_address, senderlen );
-			pcache->master_address_valid = 1;
-		}
-
-		framecnt = ntohl (pkthdr->framecnt);
-		if ( pcache->last_framecnt_retreived_valid && (framecnt <= pcache->last_framecnt_retreived )) {
-			continue;
-		}
-
-		cpack = packet_cache_get_packet (pcache, framecnt);
-		cache_packet_add_fragment (cpack, rx_packet, rcv_len);
-		cpack->recv_timestamp = get_microseconds ();
+		packet_cache_receive_fragment (pcache, rx_packet, rcv_len,
+					       &sender_address, senderlen,
+					       get_microseconds);
 	}
 }
 
-void
-packet_cache_reset_master_address ( packet_cache *pcache )
+// Receive ring.
+//
+// An AF_PACKET socket with a PACKET_MMAP (TPACKET_V2) receive ring
+// sees our datagrams as soon as the driver of the interface hands them
+// up, before the UDP stack and the socket wakeup. A classic BPF filter
+// lets only unfragmented UDP to the listen port into the ring, and the
+// driver thread reads the frames straight out of the mapping. The UDP
+// socket stays bound, so the port is still ours and autoconfig and
+// sending work as before.
+
+#ifdef NETJACK_RING
+struct _netjack_ring {
+	int fd;
+	char *map;
+	size_t map_size;
+	unsigned int frame_size;
+	unsigned int frame_nr;
+	unsigned int next;
+};
+
+// Below this much time to the deadline, spin on the ring instead of
+// sleeping in poll().
+#define NETJACK_RING_SPIN_USECS 200
+#define NETJACK_RING_FRAMES     256
+#define NETJACK_RING_BLOCK_SIZE (1 << 16)
+
+netjack_ring_t *
+netjack_ring_new (const char *ifname, int port, int mtu)
 {
-	pcache->master_address_valid = 0;
-	pcache->last_framecnt_retreived = 0;
-	pcache->last_framecnt_retreived_valid = 0;
-}
+	struct sock_filter code[] = {
+		BPF_STMT (BPF_LD + BPF_B + BPF_ABS, 9),                 // ip protocol
+		BPF_JUMP (BPF_JMP + BPF_JEQ + BPF_K, IPPROTO_UDP, 0, 6),
+		BPF_STMT (BPF_LD + BPF_H + BPF_ABS, 6),                 // flags and fragment offset
+		BPF_JUMP (BPF_JMP + BPF_JSET + BPF_K, 0x3fff, 4, 0),
+		BPF_STMT (BPF_LDX + BPF_B + BPF_MSH, 0),                // ip header length
+		BPF_STMT (BPF_LD + BPF_H + BPF_IND, 2),                 // udp destination port
+		BPF_JUMP (BPF_JMP + BPF_JEQ + BPF_K, port, 0, 1),
+		BPF_STMT (BPF_RET + BPF_K, 0xffff),
+		BPF_STMT (BPF_RET + BPF_K, 0),
+	};
+	struct sock_fprog filter = { sizeof(code) / sizeof(code[0]), code };
+	struct sockaddr_ll addr;
+	struct tpacket_req req;
+	netjack_ring_t *ring;
+	int version = TPACKET_V2;
+	unsigned int need;
+
+	ring = calloc (1, sizeof(netjack_ring_t));
+	if (ring == NULL) {
+		return NULL;
+	}
 
-void
-packet_cache_clear_old_packets (packet_cache *pcache, jack_nframes_t framecnt )
-{
-	int i;
+	// tpacket header, address and the ip and udp headers in front
+	// of up to one mtu of netjack data
+	need = TPACKET_ALIGN (TPACKET2_HDRLEN) + 16 + 60 + 8 + mtu;
+	for (ring->frame_size = TPACKET_ALIGNMENT; ring->frame_size < need; ring->frame_size <<= 1) ;
+	if (ring->frame_size > NETJACK_RING_BLOCK_SIZE) {
+		jack_error ("netjack: mtu %d too large for the receive ring", mtu);
+		free (ring);
+		return NULL;
+	}
 
-	for (i = 0; i < pcache->size; i++) {
-		if (pcache->packets[i].valid && (pcache->packets[i].framecnt < framecnt)) {
-			cache_packet_reset (&(pcache->packets[i]));
+	memset (&req, 0, sizeof(req));
+	req.tp_block_size = NETJACK_RING_BLOCK_SIZE;
+	req.tp_frame_size = ring->frame_size;
+	req.tp_block_nr = (NETJACK_RING_FRAMES * ring->frame_size + NETJACK_RING_BLOCK_SIZE - 1) / NETJACK_RING_BLOCK_SIZE;
+	req.tp_frame_nr = req.tp_block_nr * (NETJACK_RING_BLOCK_SIZE / ring->frame_size);
+
+	memset (&addr, 0, sizeof(addr));
+	addr.sll_family = AF_PACKET;
+	addr.sll_protocol = htons (ETH_P_IP);
+	if (ifname && strcmp (ifname, "any") != 0) {
+		addr.sll_ifindex = if_nametoindex (ifname);
+		if (addr.sll_ifindex == 0) {
+			jack_error ("netjack: no interface %s for the receive ring", ifname);
+			free (ring);
+			return NULL;
 		}
 	}
-}
-
-int
-packet_cache_retreive_packet_pointer ( packet_cache *pcache, jack_nframes_t framecnt, char **packet_buf, int pkt_size, jack_time_t *timestamp )
-{
-	int i;
-	cache_packet *cpack = NULL;
 
+	ring->fd = socket (AF_PACKET, SOCK_DGRAM, htons (ETH_P_IP));
+	if (ring->fd < 0) {
+		jack_error ("netjack: cannot open packet socket (%s); the receive ring needs CAP_NET_RAW",
+			    strerror (errno));
+		free (ring);
+		return NULL;
+	}
 
-	for (i = 0; i < pcache->size; i++) {
-		if (pcache->packets[i].valid && (pcache->packets[i].framecnt == framecnt)) {
-			cpack = &(pcache->packets[i]);
-			break;
-		}
+	if (setsockopt (ring->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0
+	    || setsockopt (ring->fd, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) < 0
+	    || setsockopt (ring->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+		jack_error ("netjack: cannot set up the receive ring (%s)", strerror (errno));
+		close (ring->fd);
+		free (ring);
+		return NULL;
 	}
 
-	if ( cpack == NULL ) {
-		//printf( "retreive packet: %d....not found\n", framecnt );
-		return -1;
+	ring->frame_nr = req.tp_frame_nr;
+	ring->map_size = (size_t)req.tp_block_size * req.tp_block_nr;
+	ring->map = mmap (NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, ring->fd, 0);
+	if (ring->map == MAP_FAILED) {
+		// Not allowed to lock it, have it unlocked then.
+		ring->map = mmap (NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+	}
+	if (ring->map == MAP_FAILED) {
+		jack_error ("netjack: cannot map the receive ring (%s)", strerror (errno));
+		close (ring->fd);
+		free (ring);
+		return NULL;
 	}
 
-	if ( !cache_packet_is_complete ( cpack ) ) {
-		return -1;
+	if (bind (ring->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		jack_error ("netjack: cannot bind the receive ring (%s)", strerror (errno));
+		netjack_ring_free (ring);
+		return NULL;
 	}
 
-	// ok. cpack is the one we want and its complete.
-	*packet_buf = cpack->packet_buf;
-	if ( timestamp ) {
-		*timestamp = cpack->recv_timestamp;
+	return ring;
+}
+
+void
+netjack_ring_free (netjack_ring_t *ring)
+{
+	if (ring == NULL) {
+		return;
 	}
+	munmap (ring->map, ring->map_size);
+	close (ring->fd);
+	free (ring);
+}
 
-	pcache->last_framecnt_retreived_valid = 1;
-	pcache->last_framecnt_retreived = framecnt;
+static inline struct tpacket2_hdr *
+netjack_ring_frame (netjack_ring_t *ring)
+{
+	// frames never straddle blocks, so they are evenly spaced
+	return (struct tpacket2_hdr*)(ring->map + (size_t)ring->next * ring->frame_size);
+}
 
-	return pkt_size;
+static inline int
+netjack_ring_ready (netjack_ring_t *ring)
+{
+	return __atomic_load_n (&netjack_ring_frame (ring)->tp_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER;
 }
 
 int
-packet_cache_release_packet ( packet_cache *pcache, jack_nframes_t framecnt )
+netjack_ring_poll_deadline (netjack_ring_t *ring, jack_time_t deadline, jack_time_t (*get_microseconds)(void))
 {
-	int i;
-	cache_packet *cpack = NULL;
-
+	while (!netjack_ring_ready (ring)) {
+		jack_time_t now = get_microseconds ();
 
-	for (i = 0; i < pcache->size; i++) {
-		if (pcache->packets[i].valid && (pcache->packets[i].framecnt == framecnt)) {
-			cpack = &(pcache->packets[i]);
-			break;
+		if (now >= deadline) {
+			return 0;
+		}
+		if (deadline - now > NETJACK_RING_SPIN_USECS) {
+			netjack_poll_deadline (ring->fd, deadline - NETJACK_RING_SPIN_USECS, get_microseconds);
+		} else {
+#if defined(__i386__) || defined(__x86_64__)
+			__builtin_ia32_pause ();
+#endif
 		}
 	}
+	return 1;
+}
 
-	if ( cpack == NULL ) {
-		//printf( "retreive packet: %d....not found\n", framecnt );
-		return -1;
-	}
+void
+packet_cache_drain_ring (packet_cache *pcache, netjack_ring_t *ring, jack_time_t (*get_microseconds)(void))
+{
+	while (netjack_ring_ready (ring)) {
+		struct tpacket2_hdr *hdr = netjack_ring_frame (ring);
+		struct sockaddr_ll *sll = (struct sockaddr_ll*)((char*)hdr + TPACKET_ALIGN (sizeof(struct tpacket2_hdr)));
+		unsigned char *ip = (unsigned char*)hdr + hdr->tp_net;
+		unsigned int len = hdr->tp_snaplen;
+		unsigned int ihl = (ip[0] & 0x0f) * 4;
+
+		// the ring also sees what this host sends
+		if (sll->sll_pkttype != PACKET_OUTGOING && len >= ihl + 8) {
+			unsigned char *udp = ip + ihl;
+			unsigned int udp_len = (udp[4] << 8) | udp[5];
+			struct sockaddr_in sender_address;
+
+			// the same address recvfrom() would have given
+			memset (&sender_address, 0, sizeof(sender_address));
+			sender_address.sin_family = AF_INET;
+			memcpy (&sender_address.sin_port, udp, 2);
+			memcpy (&sender_address.sin_addr, ip + 12, 4);
+
+			if (udp_len > len - ihl) {
+				udp_len = len - ihl;
+			}
+			if (udp_len >= 8 && udp_len - 8 <= pcache->mtu) {
+				packet_cache_receive_fragment (pcache, (char*)udp + 8, udp_len - 8,
+							       &sender_address, sizeof(sender_address),
+							       get_microseconds);
+			}
+		}
 
-	if ( !cache_packet_is_complete ( cpack ) ) {
-		return -1;
+		__atomic_store_n (&hdr->tp_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+		ring->next = (ring->next + 1) % ring->frame_nr;
 	}
+}
 
-	cache_packet_reset (cpack);
-	packet_cache_clear_old_packets ( pcache, framecnt );
-
-	return 0;
+#else
+netjack_ring_t *
+netjack_ring_new (const char *ifname, int port, int mtu)
+{
+	jack_error ("netjack: not built with packet ring support");
+	return NULL;
 }
-float
-packet_cache_get_fill ( packet_cache *pcache, jack_nframes_t expected_framecnt )
+
+void
+netjack_ring_free (netjack_ring_t *ring)
 {
-	int num_packets_before_us = 0;
-	int i;
+}
+
+int
+netjack_ring_poll_deadline (netjack_ring_t *ring, jack_time_t deadline, jack_time_t (*get_microseconds)(void))
+{
+	return 0;
+}
+
+void
+packet_cache_drain_ring (packet_cache *pcache, netjack_ring_t *ring, jack_time_t (*get_microseconds)(void))
+{
+}
+#endif
+
+// Shared memory transport.
+//
+// For a master and slave on the same host. The master creates a memfd
+// with one ring of packet slots per direction and an eventfd for each,
+// and passes the three descriptors to the slave over its unix socket.
+// Every packet goes whole into a slot, in whatever byte order the two
+// ends agreed on, and the eventfd of the direction is bumped. The
+// packet headers are the same as on the network, so sync and latency
+// work unchanged. A reader that falls more than a ring behind loses
+// the oldest packets, as it would on the network.
+
+#ifdef NETJACK_SHM
+#define NETJACK_SHM_MAGIC 0x6e6a736d    // "njsm"
+#define NETJACK_SHM_SLOTS 64
+#define NETJACK_SHM_DOWN  0             // master to slave
+#define NETJACK_SHM_UP    1
+
+typedef struct {
+	uint32_t seq;                   // 2 * n + 2 once packet n is in, odd while written
+	uint32_t len;
+	char data[0];
+} netjack_shm_slot_t;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t slots;
+	uint32_t slot_size;             // bytes of data per slot
+	uint32_t stride;
+	struct {
+		uint32_t head;          // packets written in this direction
+		char pad[60];
+	} dir[2];
+} netjack_shm_header_t;
+
+struct _netjack_shm {
+	netjack_shm_header_t *hdr;
+	size_t map_size;
+	int efd[2];
+	int tx, rx;                     // directions, by role
+	uint32_t tail;                  // next packet to read
+};
+
+static size_t
+netjack_shm_size (uint32_t slots, uint32_t stride)
+{
+	return sizeof(netjack_shm_header_t) + 2 * (size_t)slots * stride;
+}
+
+static netjack_shm_slot_t *
+netjack_shm_slot (netjack_shm_t *shm, int dir, uint32_t n)
+{
+	return (netjack_shm_slot_t*)((char*)(shm->hdr + 1)
+				     + ((size_t)dir * shm->hdr->slots + n % shm->hdr->slots) * shm->hdr->stride);
+}
+
+void
+netjack_shm_free (netjack_shm_t *shm)
+{
+	if (shm == NULL) {
+		return;
+	}
+	munmap (shm->hdr, shm->map_size);
+	close (shm->efd[0]);
+	close (shm->efd[1]);
+	free (shm);
+}
+
+int
+netjack_shm_listen (const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen (path) >= sizeof(addr.sun_path)) {
+		jack_error ("netjack: socket path %s too long", path);
+		return -1;
+	}
+
+	fd = socket (AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		jack_error ("netjack: cannot create socket (%s)", strerror (errno));
+		return -1;
+	}
+
+	memset (&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy (addr.sun_path, path);
+	unlink (path);
+
+	if (bind (fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen (fd, 1) < 0) {
+		jack_error ("netjack: cannot listen on %s (%s)", path, strerror (errno));
+		close (fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+netjack_shm_t *
+netjack_shm_accept (int listen_fd)
+{
+	char control[CMSG_SPACE(3 * sizeof(int))];
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	netjack_shm_header_t hdr;
+	netjack_shm_t *shm;
+	int fds[3];
+	int conn;
+	ssize_t n;
+
+	conn = accept (listen_fd, NULL, NULL);
+	if (conn < 0) {
+		jack_error ("netjack: accept failed (%s)", strerror (errno));
+		return NULL;
+	}
+
+	memset (&msg, 0, sizeof(msg));
+	iov.iov_base = &hdr;
+	iov.iov_len = sizeof(hdr.magic);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	n = recvmsg (conn, &msg, MSG_CMSG_CLOEXEC);
+	close (conn);
+
+	cmsg = CMSG_FIRSTHDR (&msg);
+	if (n != sizeof(hdr.magic) || hdr.magic != NETJACK_SHM_MAGIC || cmsg == NULL
+	    || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN (3 * sizeof(int))) {
+		jack_error ("netjack: bad shared memory handshake");
+		return NULL;
+	}
+	memcpy (fds, CMSG_DATA (cmsg), sizeof(fds));
+
+	shm = calloc (1, sizeof(netjack_shm_t));
+	if (shm == NULL) {
+		goto fail;
+	}
+
+	if (pread (fds[0], &hdr, sizeof(hdr), 0) != sizeof(hdr) || hdr.magic != NETJACK_SHM_MAGIC) {
+		jack_error ("netjack: bad shared memory segment");
+		goto fail;
+	}
+
+	shm->map_size = netjack_shm_size (hdr.slots, hdr.stride);
+	shm->hdr = mmap (NULL, shm->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+	if (shm->hdr == MAP_FAILED) {
+		jack_error ("netjack: cannot map shared memory (%s)", strerror (errno));
+		goto fail;
+	}
+	close (fds[0]);
+
+	shm->efd[NETJACK_SHM_DOWN] = fds[1];
+	shm->efd[NETJACK_SHM_UP] = fds[2];
+	fcntl (fds[1], F_SETFL, O_NONBLOCK);
+	fcntl (fds[2], F_SETFL, O_NONBLOCK);
+	shm->rx = NETJACK_SHM_DOWN;
+	shm->tx = NETJACK_SHM_UP;
+	shm->tail = 0;
+
+	return shm;
+
+fail:
+	free (shm);
+	close (fds[0]);
+	close (fds[1]);
+	close (fds[2]);
+	return NULL;
+}
+
+netjack_shm_t *
+netjack_shm_connect (const char *path, int slot_size)
+{
+	char control[CMSG_SPACE(3 * sizeof(int))];
+	struct sockaddr_un addr;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	netjack_shm_t *shm;
+	uint32_t magic = NETJACK_SHM_MAGIC;
+	uint32_t stride;
+	int fds[3];
+	int memfd, conn;
+
+	if (strlen (path) >= sizeof(addr.sun_path)) {
+		jack_error ("netjack: socket path %s too long", path);
+		return NULL;
+	}
+
+	shm = calloc (1, sizeof(netjack_shm_t));
+	if (shm == NULL) {
+		return NULL;
+	}
+
+	stride = (sizeof(netjack_shm_slot_t) + slot_size + 63) & ~63;
+	shm->map_size = netjack_shm_size (NETJACK_SHM_SLOTS, stride);
+
+	memfd = memfd_create ("netjack-shm", MFD_CLOEXEC);
+	if (memfd < 0 || ftruncate (memfd, shm->map_size) < 0) {
+		jack_error ("netjack: cannot create shared memory (%s)", strerror (errno));
+		goto fail;
+	}
+	shm->hdr = mmap (NULL, shm->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+	if (shm->hdr == MAP_FAILED) {
+		jack_error ("netjack: cannot map shared memory (%s)", strerror (errno));
+		goto fail;
+	}
+	shm->hdr->slots = NETJACK_SHM_SLOTS;
+	shm->hdr->slot_size = slot_size;
+	shm->hdr->stride = stride;
+	shm->hdr->magic = NETJACK_SHM_MAGIC;
+
+	shm->efd[NETJACK_SHM_DOWN] = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+	shm->efd[NETJACK_SHM_UP] = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (shm->efd[NETJACK_SHM_DOWN] < 0 || shm->efd[NETJACK_SHM_UP] < 0) {
+		jack_error ("netjack: cannot create eventfd (%s)", strerror (errno));
+		goto fail;
+	}
+	shm->rx = NETJACK_SHM_UP;
+	shm->tx = NETJACK_SHM_DOWN;
+
+	memset (&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy (addr.sun_path, path);
+
+	conn = socket (AF_UNIX, SOCK_STREAM, 0);
+	if (conn < 0 || connect (conn, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		jack_error ("netjack: cannot connect to %s (%s)", path, strerror (errno));
+		if (conn >= 0) {
+			close (conn);
+		}
+		goto fail;
+	}
+
+	fds[0] = memfd;
+	fds[1] = shm->efd[NETJACK_SHM_DOWN];
+	fds[2] = shm->efd[NETJACK_SHM_UP];
+
+	memset (&msg, 0, sizeof(msg));
+	iov.iov_base = &magic;
+	iov.iov_len = sizeof(magic);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsg = CMSG_FIRSTHDR (&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN (sizeof(fds));
+	memcpy (CMSG_DATA (cmsg), fds, sizeof(fds));
+
+	if (sendmsg (conn, &msg, 0) != sizeof(magic)) {
+		jack_error ("netjack: cannot hand over shared memory (%s)", strerror (errno));
+		close (conn);
+		goto fail;
+	}
+	close (conn);
+	close (memfd);
+
+	return shm;
+
+fail:
+	if (memfd >= 0) {
+		close (memfd);
+	}
+	if (shm->hdr && shm->hdr != MAP_FAILED) {
+		munmap (shm->hdr, shm->map_size);
+	}
+	if (shm->efd[0] > 0) {
+		close (shm->efd[0]);
+	}
+	if (shm->efd[1] > 0) {
+		close (shm->efd[1]);
+	}
+	free (shm);
+	return NULL;
+}
+
+int
+netjack_shm_fd (netjack_shm_t *shm)
+{
+	return shm->efd[shm->rx];
+}
+
+int
+netjack_shm_slot_size (netjack_shm_t *shm)
+{
+	return shm->hdr->slot_size;
+}
+
+void
+netjack_shm_send (netjack_shm_t *shm, char *packet_buf, int pkt_size)
+{
+	uint32_t n = shm->hdr->dir[shm->tx].head;
+	netjack_shm_slot_t *slot = netjack_shm_slot (shm, shm->tx, n);
+	uint64_t one = 1;
+
+	if (pkt_size > shm->hdr->slot_size) {
+		jack_error ("netjack: packet of %d bytes does not fit a slot", pkt_size);
+		return;
+	}
+
+	__atomic_store_n (&slot->seq, 2 * n + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+	memcpy (slot->data, packet_buf, pkt_size);
+	slot->len = pkt_size;
+	__atomic_store_n (&slot->seq, 2 * n + 2, __ATOMIC_RELEASE);
+	__atomic_store_n (&shm->hdr->dir[shm->tx].head, n + 1, __ATOMIC_RELEASE);
+
+	if (write (shm->efd[shm->tx], &one, sizeof(one)) < 0) {
+		// counter full; the reader is long gone
+	}
+}
+
+// Next complete packet in the receive direction, or NULL.
+static netjack_shm_slot_t *
+netjack_shm_next (netjack_shm_t *shm)
+{
+	uint32_t head = __atomic_load_n (&shm->hdr->dir[shm->rx].head, __ATOMIC_ACQUIRE);
+	netjack_shm_slot_t *slot;
+
+	while (shm->tail != head) {
+		uint32_t n;
+
+		if (head - shm->tail > shm->hdr->slots) {
+			shm->tail = head - shm->hdr->slots;
+		}
+		n = shm->tail++;
+		slot = netjack_shm_slot (shm, shm->rx, n);
+		if (__atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE) == 2 * n + 2
+		    && slot->len <= shm->hdr->slot_size) {
+			return slot;
+		}
+	}
+	return NULL;
+}
+
+int
+netjack_shm_recv (netjack_shm_t *shm, char *packet_buf, int pkt_size)
+{
+	netjack_shm_slot_t *slot;
+	uint64_t count;
+
+	if (read (shm->efd[shm->rx], &count, sizeof(count)) < 0) {
+		// nothing signalled, there may still be slots
+	}
+
+	slot = netjack_shm_next (shm);
+	if (slot == NULL) {
+		return -1;
+	}
+	if (pkt_size > slot->len) {
+		pkt_size = slot->len;
+	}
+	memcpy (packet_buf, slot->data, pkt_size);
+	return pkt_size;
+}
+
+void
+packet_cache_drain_shm (packet_cache *pcache, netjack_shm_t *shm, jack_time_t (*get_microseconds)(void))
+{
+	struct sockaddr_in peer;
+	netjack_shm_slot_t *slot;
+	uint64_t count;
+
+	// The cache wants a sender; the peer has no address, so all
+	// packets come from the same made-up one.
+	memset (&peer, 0, sizeof(peer));
+	peer.sin_family = AF_INET;
+
+	if (read (shm->efd[shm->rx], &count, sizeof(count)) < 0) {
+		// nothing signalled, there may still be slots
+	}
+
+	while ((slot = netjack_shm_next (shm)) != NULL) {
+		if (slot->len <= pcache->mtu) {
+			packet_cache_receive_fragment (pcache, slot->data, slot->len,
+						       &peer, sizeof(peer), get_microseconds);
+		}
+	}
+}
+
+#else
+int
+netjack_shm_listen (const char *path)
+{
+	jack_error ("netjack: not built with shared memory transport support");
+	return -1;
+}
+
+netjack_shm_t *
+netjack_shm_accept (int listen_fd)
+{
+	return NULL;
+}
+
+netjack_shm_t *
+netjack_shm_connect (const char *path, int slot_size)
+{
+	jack_error ("netjack: not built with shared memory transport support");
+	return NULL;
+}
+
+void
+netjack_shm_free (netjack_shm_t *shm)
+{
+}
+
+int
+netjack_shm_fd (netjack_shm_t *shm)
+{
+	return -1;
+}
+
+int
+netjack_shm_slot_size (netjack_shm_t *shm)
+{
+	return 0;
+}
+
+void
+netjack_shm_send (netjack_shm_t *shm, char *packet_buf, int pkt_size)
+{
+}
+
+int
+netjack_shm_recv (netjack_shm_t *shm, char *packet_buf, int pkt_size)
+{
+	return -1;
+}
+
+void
+packet_cache_drain_shm (packet_cache *pcache, netjack_shm_t *shm, jack_time_t (*get_microseconds)(void))
+{
+}
+#endif
+
+void
+packet_cache_reset_master_address ( packet_cache *pcache )
+{
+	pcache->master_address_valid = 0;
+	pcache->last_framecnt_retreived = 0;
+	pcache->last_framecnt_retreived_valid = 0;
+}
+
+void
+packet_cache_clear_old_packets (packet_cache *pcache, jack_nframes_t framecnt )
+{
+	int i;
+
+	for (i = 0; i < pcache->size; i++) {
+		if (pcache->packets[i].valid && (pcache->packets[i].framecnt < framecnt)) {
+			cache_packet_reset (&(pcache->packets[i]));
+		}
+	}
+}
+
+int
+packet_cache_retreive_packet_pointer ( packet_cache *pcache, jack_nframes_t framecnt, char **packet_buf, int pkt_size, jack_time_t *timestamp )
+{
+	cache_packet *cpack = packet_cache_find_packet (pcache, framecnt);
+
+	if ( cpack == NULL ) {
+		//printf( "retreive packet: %d....not found\n", framecnt );
+		return -1;
+	}
+
+	if ( !cache_packet_is_complete ( cpack ) ) {
+		return -1;
+	}
+
+	// ok. cpack is the one we want and its complete.
+	*packet_buf = cpack->packet_buf;
+	if ( timestamp ) {
+		*timestamp = cpack->recv_timestamp;
+	}
+
+	pcache->last_framecnt_retreived_valid = 1;
+	pcache->last_framecnt_retreived = framecnt;
+
+	return pkt_size;
+}
+
+int
+packet_cache_release_packet ( packet_cache *pcache, jack_nframes_t framecnt )
+{
+	cache_packet *cpack = packet_cache_find_packet (pcache, framecnt);
+
+	if ( cpack == NULL ) {
+		//printf( "retreive packet: %d....not found\n", framecnt );
+		return -1;
+	}
+
+	if ( !cache_packet_is_complete ( cpack ) ) {
+		return -1;
+	}
+
+	cache_packet_reset (cpack);
+	packet_cache_clear_old_packets ( pcache, framecnt );
+
+	return 0;
+}
+// Number of complete packets at or after expected_framecnt.
+int
+packet_cache_get_depth ( packet_cache *pcache, jack_nframes_t expected_framecnt )
+{
+	int num_packets_before_us = 0;
+	int i;
 
 	for (i = 0; i < pcache->size; i++) {
 		cache_packet *cpack = &(pcache->packets[i]);
@@ -664,10 +1579,18 @@ packet_cache_get_fill ( packet_cache *pcache, jack_nframes_t expected_framecnt )
 		}
 	}
 
-	return 100.0 * (float)num_packets_before_us / (float)( pcache->size );
+	return num_packets_before_us;
+}
+
+float
+packet_cache_get_fill ( packet_cache *pcache, jack_nframes_t expected_framecnt )
+{
+	return 100.0 * (float)packet_cache_get_depth ( pcache, expected_framecnt ) / (float)( pcache->size );
 }
 
 // Returns 0 when no valid packet is inside the cache.
+// Walks the ring starting at expected_framecnt, so the common case
+// of the expected packet being there costs a single lookup.
 int
 packet_cache_get_next_available_framecnt ( packet_cache *pcache, jack_nframes_t expected_framecnt, jack_nframes_t *framecnt )
 {
@@ -676,7 +1599,7 @@ packet_cache_get_next_available_framecnt ( packet_cache *pcache, jack_nframes_t
 	int retval = 0;
 
 	for (i = 0; i < pcache->size; i++) {
-		cache_packet *cpack = &(pcache->packets[i]);
+		cache_packet *cpack = &(pcache->packets[(expected_framecnt + i) % pcache->size]);
 		//printf( "p%d: valid=%d, frame %d\n", i, cpack->valid, cpack->framecnt );
 
 		if (!cpack->valid || !cache_packet_is_complete ( cpack )) {
@@ -695,7 +1618,8 @@ packet_cache_get_next_available_framecnt ( packet_cache *pcache, jack_nframes_t
 		best_offset = cpack->framecnt - expected_framecnt;
 		retval = 1;
 
-		if ( best_offset == 0 ) {
+		// Nothing closer can follow in the ring.
+		if ( best_offset == (jack_nframes_t)i ) {
 			break;
 		}
 	}
@@ -772,54 +1696,228 @@ packet_cache_find_latency ( packet_cache *pcache, jack_nframes_t expected_framec
 	return retval;
 }
 // fragmented packet IO
-void
-netjack_sendto (int sockfd, char *packet_buf, int pkt_size, int flags, struct sockaddr *addr, int addr_size, int mtu)
-{
-	int frag_cnt = 0;
-	char *tx_packet, *dataX;
-	jacknet_packet_header *pkthdr;
 
-	tx_packet = alloca (mtu + 10);
-	dataX = tx_packet + sizeof(jacknet_packet_header);
-	pkthdr = (jacknet_packet_header*)tx_packet;
+#if defined(HAVE_SENDMMSG) && !defined(WIN32)
 
-	int fragment_payload_size = mtu - sizeof(jacknet_packet_header);
+#ifdef __linux__
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+// The kernel refuses GSO sends with more segments than this.
+#define NETJACK_GSO_MAX_SEGS 64
+// Largest UDP payload that fits in a single IPv4 datagram.
+#define NETJACK_GSO_MAX_BYTES 65507
 
-	if (pkt_size <= mtu) {
-		int err;
-		pkthdr = (jacknet_packet_header*)packet_buf;
-		pkthdr->fragment_nr = htonl (0);
-		err = sendto (sockfd, packet_buf, pkt_size, flags, addr, addr_size);
-		if ( err < 0 ) {
-			//printf( "error in send\n" );
-			perror ( "send" );
+// Cleared the first time the kernel or the NIC driver rejects UDP_SEGMENT.
+static int netjack_use_gso = 1;
+#endif
+
+// Send a packet larger than the mtu without copying its payload:
+// every fragment is described by an iovec pair pointing at its own
+// copy of the header and at its slice of packet_buf.  With UDP GSO
+// the whole packet leaves in a single sendmsg(), otherwise batches
+// of NETJACK_MMSG_BATCH fragments go out with sendmmsg().
+//
+// The parity fragment, if any, goes out just before the last data
+// fragment, since GSO only allows the final segment to be short.
+static void
+netjack_sendto_batched (int sockfd, char *packet_buf, int pkt_size, int data_size, int flags, struct sockaddr *addr, int addr_size, int mtu, char *parity)
+{
+	int hdr_size = sizeof(jacknet_packet_header);
+	int fragment_payload_size = mtu - hdr_size;
+	int frag_total = (pkt_size - hdr_size - 1) / fragment_payload_size + 1;
+	int msg_total = frag_total + (parity ? 1 : 0);
+	jacknet_packet_header *headers = alloca (msg_total * sizeof(jacknet_packet_header));
+	struct iovec *iov = alloca (2 * msg_total * sizeof(struct iovec));
+	char *packet_bufX = packet_buf + hdr_size;
+	int remaining = data_size - hdr_size;
+	int total_bytes = 0;
+	int i, sent;
+
+	for (i = 0; i < frag_total; i++) {
+		int payload = remaining < fragment_payload_size ? remaining : fragment_payload_size;
+		int m = (parity && i == frag_total - 1) ? frag_total : i;
+
+		if (payload < 0) {
+			payload = 0;
 		}
-	} else {
+		memcpy (&headers[m], packet_buf, hdr_size);
+		headers[m].fragment_nr = htonl (i);
+		iov[2 * m].iov_base = &headers[m];
+		iov[2 * m].iov_len = hdr_size;
+		iov[2 * m + 1].iov_base = packet_bufX;
+		iov[2 * m + 1].iov_len = payload;
+		packet_bufX += payload;
+		remaining -= payload;
+		total_bytes += hdr_size + payload;
+	}
+
+	if (parity) {
+		int m = frag_total - 1;
+
+		memcpy (&headers[m], packet_buf, hdr_size);
+		headers[m].fragment_nr = htonl (frag_total);
+		iov[2 * m].iov_base = &headers[m];
+		iov[2 * m].iov_len = hdr_size;
+		iov[2 * m + 1].iov_base = parity;
+		iov[2 * m + 1].iov_len = fragment_payload_size;
+		total_bytes += mtu;
+	}
+
+#ifdef __linux__
+	if (netjack_use_gso && msg_total <= NETJACK_GSO_MAX_SEGS
+	    && total_bytes <= NETJACK_GSO_MAX_BYTES && data_size == pkt_size) {
+		struct msghdr msg;
+		struct cmsghdr *cmsg;
+		char control[CMSG_SPACE (sizeof(uint16_t))];
+
+		memset (&msg, 0, sizeof(msg));
+		memset (control, 0, sizeof(control));
+		msg.msg_name = addr;
+		msg.msg_namelen = addr_size;
+		msg.msg_iov = iov;
+		msg.msg_iovlen = 2 * msg_total;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		cmsg = CMSG_FIRSTHDR (&msg);
+		cmsg->cmsg_level = SOL_UDP;
+		cmsg->cmsg_type = UDP_SEGMENT;
+		cmsg->cmsg_len = CMSG_LEN (sizeof(uint16_t));
+		*((uint16_t*)CMSG_DATA (cmsg)) = mtu;
+
+		if (sendmsg (sockfd, &msg, flags) >= 0) {
+			return;
+		}
+		if (errno == EINVAL || errno == EIO || errno == ENOPROTOOPT
+		    || errno == EOPNOTSUPP) {
+			jack_error ("netjack: UDP segmentation offload unavailable (%s), "
+				    "falling back to sendmmsg()", strerror (errno));
+			netjack_use_gso = 0;
+		}
+	}
+#endif
+
+	struct mmsghdr *msgs = alloca (msg_total * sizeof(struct mmsghdr));
+
+	memset (msgs, 0, msg_total * sizeof(struct mmsghdr));
+	for (i = 0; i < msg_total; i++) {
+		msgs[i].msg_hdr.msg_name = addr;
+		msgs[i].msg_hdr.msg_namelen = addr_size;
+		msgs[i].msg_hdr.msg_iov = &iov[2 * i];
+		msgs[i].msg_hdr.msg_iovlen = 2;
+	}
+
+	sent = 0;
+	while (sent < msg_total) {
+		int batch = msg_total - sent;
 		int err;
-		// Copy the packet header to the tx pack first.
-		memcpy (tx_packet, packet_buf, sizeof(jacknet_packet_header));
 
-		// Now loop and send all
-		char *packet_bufX = packet_buf + sizeof(jacknet_packet_header);
+		if (batch > NETJACK_MMSG_BATCH) {
+			batch = NETJACK_MMSG_BATCH;
+		}
+		err = sendmmsg (sockfd, msgs + sent, batch, flags);
+		if (err < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror ( "send" );
+			return;
+		}
+		sent += err;
+	}
+}
+#endif
 
-		while (packet_bufX < (packet_buf + pkt_size - fragment_payload_size)) {
-			pkthdr->fragment_nr = htonl (frag_cnt++);
-			memcpy (dataX, packet_bufX, fragment_payload_size);
-			sendto (sockfd, tx_packet, mtu, flags, addr, addr_size);
-			packet_bufX += fragment_payload_size;
+// XOR of the payloads of all fragments, each padded with zeroes to
+// the full fragment payload size.  Any one missing fragment is the
+// XOR of the parity with all the others.
+static void
+netjack_fec_parity (char *parity, char *packet_buf, int pkt_size, int mtu)
+{
+	int fragment_payload_size = mtu - sizeof(jacknet_packet_header);
+	char *packet_bufX = packet_buf + sizeof(jacknet_packet_header);
+	int remaining = pkt_size - sizeof(jacknet_packet_header);
+	int i;
+
+	memset (parity, 0, fragment_payload_size);
+	while (remaining > 0) {
+		int payload = remaining < fragment_payload_size ? remaining : fragment_payload_size;
+		for (i = 0; i < payload; i++) {
+			parity[i] ^= packet_bufX[i];
 		}
+		packet_bufX += payload;
+		remaining -= payload;
+	}
+}
+
+// Only the first data_size bytes of the packet hold anything.  The
+// packet still goes out in as many fragments as pkt_size takes, which
+// is what the receiver waits for, but the fragments carry no more
+// than data_size between them.
 
-		int last_payload_size = packet_buf + pkt_size - packet_bufX;
-		memcpy (dataX, packet_bufX, last_payload_size);
-		pkthdr->fragment_nr = htonl (frag_cnt);
-		//jack_log("last fragment_count = %d, payload_size = %d\n", fragment_count, last_payload_size);
+void
+netjack_sendto (int sockfd, char *packet_buf, int pkt_size, int data_size, int flags, struct sockaddr *addr, int addr_size, int mtu, int fec)
+{
+	jacknet_packet_header *pkthdr;
+	char *parity = NULL;
 
-		// sendto(last_pack_size);
-		err = sendto (sockfd, tx_packet, last_payload_size + sizeof(jacknet_packet_header), flags, addr, addr_size);
+	if (pkt_size <= mtu) {
+		int err;
+		pkthdr = (jacknet_packet_header*)packet_buf;
+		pkthdr->fragment_nr = htonl (0);
+		err = sendto (sockfd, packet_buf, data_size, flags, addr, addr_size);
 		if ( err < 0 ) {
 			//printf( "error in send\n" );
 			perror ( "send" );
 		}
+	} else {
+		if (fec) {
+			parity = alloca (mtu - sizeof(jacknet_packet_header));
+			netjack_fec_parity (parity, packet_buf, data_size, mtu);
+		}
+#if defined(HAVE_SENDMMSG) && !defined(WIN32)
+		netjack_sendto_batched (sockfd, packet_buf, pkt_size, data_size, flags, addr, addr_size, mtu, parity);
+#else
+		int err;
+		int frag_cnt = 0;
+		int fragment_payload_size = mtu - sizeof(jacknet_packet_header);
+		int frag_total = (pkt_size - sizeof(jacknet_packet_header) - 1) / fragment_payload_size + 1;
+		int remaining = data_size - sizeof(jacknet_packet_header);
+		char *tx_packet, *dataX;
+
+		tx_packet = alloca (mtu + 10);
+		dataX = tx_packet + sizeof(jacknet_packet_header);
+		pkthdr = (jacknet_packet_header*)tx_packet;
+
+		// Copy the packet header to the tx pack first.
+		memcpy (tx_packet, packet_buf, sizeof(jacknet_packet_header));
+
+		// Now loop and send all
+		char *packet_bufX = packet_buf + sizeof(jacknet_packet_header);
+
+		for (frag_cnt = 0; frag_cnt < frag_total; frag_cnt++) {
+			int payload = remaining < fragment_payload_size ? remaining : fragment_payload_size;
+
+			if (payload < 0) {
+				payload = 0;
+			}
+			pkthdr->fragment_nr = htonl (frag_cnt);
+			memcpy (dataX, packet_bufX, payload);
+			err = sendto (sockfd, tx_packet, payload + sizeof(jacknet_packet_header), flags, addr, addr_size);
+			if ( err < 0 ) {
+				//printf( "error in send\n" );
+				perror ( "send" );
+			}
+			packet_bufX += payload;
+			remaining -= payload;
+		}
+
+		if (parity) {
+			memcpy (dataX, parity, fragment_payload_size);
+			pkthdr->fragment_nr = htonl (frag_cnt);
+			sendto (sockfd, tx_packet, mtu, flags, addr, addr_size);
+		}
+#endif
 	}
 }
 
@@ -851,53 +1949,601 @@ decode_midi_buffer (uint32_t *buffer_uint32, unsigned int buffer_size_uint32, ja
 }
 
 void
-encode_midi_buffer (uint32_t *buffer_uint32, unsigned int buffer_size_uint32, jack_default_audio_sample_t* buf)
+encode_midi_buffer (uint32_t *buffer_uint32, unsigned int buffer_size_uint32, jack_default_audio_sample_t* buf)
+{
+	int i;
+	unsigned int written = 0;
+	// midi port, encode midi events
+	unsigned int nevents = jack_midi_get_event_count (buf);
+
+	for (i = 0; i < nevents; ++i) {
+		jack_midi_event_t event;
+		jack_midi_event_get (&event, buf, i);
+		unsigned int nb_data_quads = (((event.size - 1) & ~0x3) >> 2) + 1;
+		unsigned int payload_size = 3 + nb_data_quads;
+		// only write if we have sufficient space for the event
+		// otherwise drop it
+		if (written + payload_size < buffer_size_uint32 - 1) {
+			// write header
+			buffer_uint32[written] = htonl (payload_size);
+			written++;
+			buffer_uint32[written] = htonl (event.time);
+			written++;
+			buffer_uint32[written] = htonl (event.size);
+			written++;
+
+			// write data
+			jack_midi_data_t* tmpbuff = (jack_midi_data_t*)(&(buffer_uint32[written]));
+			memcpy (tmpbuff, event.buffer, event.size);
+			written += nb_data_quads;
+		} else {
+			// buffer overflow
+			jack_error ("midi buffer overflow");
+			break;
+		}
+	}
+	// now put a netjack_midi 'no-payload' event, signaling EOF
+	buffer_uint32[written] = 0;
+}
+
+// Packed midi.
+//
+// With packed midi the midi ports of a packet do not each get a slot
+// the size of an audio channel.  Their events follow the audio
+// channels back to back, each port as an event count and then the
+// events as time, size and data padded to 32 bits, so the packet only
+// holds as much midi as there is.  The space reserved for it is still
+// what the slots would have taken; the sender just leaves the unused
+// end of it off the wire.
+
+void
+netjack_port_plan_pack_midi (netjack_port_plan_t *plan)
+{
+	for (; plan->port != NULL; plan++) {
+		if (plan->kind == NETJACK_PORT_MIDI) {
+			plan->kind = NETJACK_PORT_MIDI_PACKED;
+		}
+	}
+}
+
+// Where the packed midi of a packet starts, and how much room it has.
+// Returns 0 if the plan has no packed midi ports.
+static int
+netjack_midi_packed_section (int bitdepth, netjack_port_plan_t *plan, jack_nframes_t net_period, unsigned int *offset, unsigned int *size)
+{
+	unsigned int slot = get_sample_size (bitdepth) * net_period;
+	unsigned int nports = 0;
+	unsigned int npacked = 0;
+
+	for (; plan->port != NULL; plan++) {
+		nports++;
+		if (plan->kind == NETJACK_PORT_MIDI_PACKED) {
+			npacked++;
+		}
+	}
+	if (npacked == 0) {
+		return 0;
+	}
+
+	// the midi ports come after the audio ports
+	*offset = ((nports - npacked) * slot + 3) & ~3U;
+	*size = nports * slot - *offset;
+
+	return 1;
+}
+
+static void
+netjack_decode_midi_packed (int bitdepth, void *packet_payload, jack_nframes_t net_period_down, netjack_port_plan_t *plan, jack_nframes_t nframes)
+{
+	unsigned int offset, size;
+	uint32_t *section;
+	unsigned int i = 0, n;
+
+	if (!netjack_midi_packed_section (bitdepth, plan, net_period_down, &offset, &size)) {
+		return;
+	}
+	section = (uint32_t*)((char*)packet_payload + offset);
+	size /= sizeof(uint32_t);
+
+	for (; plan->port != NULL; plan++) {
+		void *buf;
+		uint32_t nevents;
+
+		if (plan->kind != NETJACK_PORT_MIDI_PACKED) {
+			continue;
+		}
+
+		buf = jack_port_get_buffer (plan->port, nframes);
+		jack_midi_clear_buffer (buf);
+
+		if (packet_payload == NULL || i >= size) {
+			continue;
+		}
+
+		nevents = ntohl (section[i++]);
+		for (n = 0; n < nevents && i + 2 <= size; n++) {
+			jack_nframes_t event_time = ntohl (section[i]);
+			uint32_t event_size = ntohl (section[i + 1]);
+			unsigned int nb_data_quads = (event_size + 3) / 4;
+
+			if (event_size == 0 || i + 2 + nb_data_quads > size) {
+				// damaged; nothing after it can be trusted
+				i = size;
+				break;
+			}
+			jack_midi_event_write (buf, event_time, (jack_midi_data_t*)&section[i + 2], event_size);
+			i += 2 + nb_data_quads;
+		}
+	}
+}
+
+// Returns how many bytes of the payload hold midi or audio.
+static int
+netjack_encode_midi_packed (int bitdepth, netjack_port_plan_t *plan, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up)
+{
+	unsigned int offset, size;
+	uint32_t *section;
+	unsigned int i = 0;
+
+	if (!netjack_midi_packed_section (bitdepth, plan, net_period_up, &offset, &size)) {
+		return -1;
+	}
+	section = (uint32_t*)((char*)packet_payload + offset);
+	size /= sizeof(uint32_t);
+
+	for (; plan->port != NULL; plan++) {
+		void *buf;
+		unsigned int count_at, nevents, n, written = 0;
+
+		if (plan->kind != NETJACK_PORT_MIDI_PACKED || i >= size) {
+			continue;
+		}
+
+		buf = jack_port_get_buffer (plan->port, nframes);
+		nevents = jack_midi_get_event_count (buf);
+		count_at = i++;
+
+		for (n = 0; n < nevents; n++) {
+			jack_midi_event_t event;
+			unsigned int nb_data_quads;
+
+			jack_midi_event_get (&event, buf, n);
+			nb_data_quads = (event.size + 3) / 4;
+			if (event.size == 0) {
+				continue;
+			}
+			if (i + 2 + nb_data_quads > size) {
+				jack_error ("midi buffer overflow");
+				break;
+			}
+			section[i] = htonl (event.time);
+			section[i + 1] = htonl (event.size);
+			section[i + 1 + nb_data_quads] = 0;
+			memcpy (&section[i + 2], event.buffer, event.size);
+			i += 2 + nb_data_quads;
+			written++;
+		}
+		section[count_at] = htonl (written);
+	}
+
+	return offset + i * sizeof(uint32_t);
+}
+
+// Port plans.
+//
+// Which ports are audio and which are midi, and which resampler or
+// codec state goes with each audio port, is worked out once here when
+// the ports are set up, instead of every cycle from the type strings.
+
+netjack_port_plan_t *
+netjack_port_plan_new (JSList *ports, JSList *srcs, netjack_resampler_t *resampler)
+{
+	netjack_port_plan_t *plan;
+	JSList *node;
+	int n = 0;
+	int chn = 0;
+
+	plan = calloc (jack_slist_length (ports) + 1, sizeof(netjack_port_plan_t));
+	if (plan == NULL) {
+		return NULL;
+	}
+
+	for (node = ports; node; node = jack_slist_next (node), n++) {
+		const char *porttype = jack_port_type ((jack_port_t*)node->data);
+
+		plan[n].port = (jack_port_t*)node->data;
+		if (jack_port_is_audio (porttype)) {
+			plan[n].kind = NETJACK_PORT_AUDIO;
+			plan[n].chn = chn++;
+			plan[n].resampler = resampler;
+			if (srcs) {
+				plan[n].src = srcs->data;
+				srcs = jack_slist_next (srcs);
+			}
+		} else if (jack_port_is_midi (porttype)) {
+			plan[n].kind = NETJACK_PORT_MIDI;
+		}
+	}
+
+	return plan;
+}
+
+int
+netjack_port_plan_audio (netjack_port_plan_t *plan)
+{
+	int n = 0;
+
+	for (; plan->port != NULL; plan++) {
+		if (plan->kind == NETJACK_PORT_AUDIO) {
+			n++;
+		}
+	}
+
+	return n;
+}
+
+// The built-in resampler converts all audio ports of a plan in one
+// pass. On the way in, every port is decoded into its resampler input
+// first and handed to jack afterwards; on the way out, the ports are
+// resampled before the encoders read the results.
+
+static void
+netjack_resample_to_ports (netjack_port_plan_t *plan, jack_nframes_t nframes)
+{
+	netjack_port_plan_t *p;
+
+	for (p = plan; p->port != NULL; p++) {
+		if (p->resampler) {
+			netjack_resampler_process (p->resampler);
+			break;
+		}
+	}
+	if (p->port == NULL) {
+		return;
+	}
+
+	for (; p->port != NULL; p++) {
+		if (p->resampler) {
+			memcpy (jack_port_get_buffer (p->port, nframes),
+				netjack_resampler_output (p->resampler, p->chn),
+				nframes * sizeof(jack_default_audio_sample_t));
+		}
+	}
+}
+
+static void
+netjack_resample_from_ports (netjack_port_plan_t *plan, jack_nframes_t nframes)
+{
+	netjack_resampler_t *resampler = NULL;
+
+	for (; plan->port != NULL; plan++) {
+		if (plan->resampler) {
+			resampler = plan->resampler;
+			memcpy (netjack_resampler_input (resampler, plan->chn),
+				jack_port_get_buffer (plan->port, nframes),
+				nframes * sizeof(jack_default_audio_sample_t));
+		}
+	}
+	if (resampler) {
+		netjack_resampler_process (resampler);
+	}
+}
+
+// Sample conversion kernels.
+//
+// Each turns a period of one channel into its wire format or back:
+// 32 bit floats and 16 bit integers in network byte order, 8 bit
+// integers as they are. The SSSE3 and NEON versions do the byte swap
+// with a shuffle (pshufb / vrev) along with the conversion, and leave
+// the last few samples to the plain loops. Source and destination may
+// be the same buffer for the 32 bit ones.
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define NETJACK_X86_SIMD 1
+#include <immintrin.h>
+
+__attribute__ ((target ("ssse3"))) static int
+netjack_swap32_ssse3 (uint32_t *dst, const uint32_t *src, int n)
+{
+	const __m128i swap = _mm_setr_epi8 (3, 2, 1, 0, 7, 6, 5, 4,
+					    11, 10, 9, 8, 15, 14, 13, 12);
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128i v = _mm_loadu_si128 ((const __m128i*)(src + i));
+		_mm_storeu_si128 ((__m128i*)(dst + i), _mm_shuffle_epi8 (v, swap));
+	}
+	return i;
+}
+
+__attribute__ ((target ("ssse3"))) static int
+netjack_float_to_net16_ssse3 (uint16_t *dst, const float *src, int n)
+{
+	const __m128i swap = _mm_setr_epi8 (1, 0, 3, 2, 5, 4, 7, 6,
+					    9, 8, 11, 10, 13, 12, 15, 14);
+	const __m128 one = _mm_set1_ps (1.0f);
+	const __m128 scale = _mm_set1_ps (32767.0f);
+	const __m128i bias = _mm_set1_epi32 (32768);
+	const __m128i flip = _mm_set1_epi16 ((short)0x8000);
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m128 a = _mm_mul_ps (_mm_add_ps (_mm_loadu_ps (src + i), one), scale);
+		__m128 b = _mm_mul_ps (_mm_add_ps (_mm_loadu_ps (src + i + 4), one), scale);
+		/* there is no unsigned pack before SSE4.1: pack signed
+		   around 0 and flip the top bit back */
+		__m128i ia = _mm_sub_epi32 (_mm_cvttps_epi32 (a), bias);
+		__m128i ib = _mm_sub_epi32 (_mm_cvttps_epi32 (b), bias);
+		__m128i v = _mm_xor_si128 (_mm_packs_epi32 (ia, ib), flip);
+		_mm_storeu_si128 ((__m128i*)(dst + i), _mm_shuffle_epi8 (v, swap));
+	}
+	return i;
+}
+
+__attribute__ ((target ("ssse3"))) static int
+netjack_net16_to_float_ssse3 (float *dst, const uint16_t *src, int n)
+{
+	const __m128i swap = _mm_setr_epi8 (1, 0, 3, 2, 5, 4, 7, 6,
+					    9, 8, 11, 10, 13, 12, 15, 14);
+	const __m128 scale = _mm_set1_ps (1.0f / 32768.0f);
+	const __m128 one = _mm_set1_ps (1.0f);
+	const __m128i zero = _mm_setzero_si128 ();
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m128i v = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i*)(src + i)), swap);
+		__m128 lo = _mm_cvtepi32_ps (_mm_unpacklo_epi16 (v, zero));
+		__m128 hi = _mm_cvtepi32_ps (_mm_unpackhi_epi16 (v, zero));
+		_mm_storeu_ps (dst + i, _mm_sub_ps (_mm_mul_ps (lo, scale), one));
+		_mm_storeu_ps (dst + i + 4, _mm_sub_ps (_mm_mul_ps (hi, scale), one));
+	}
+	return i;
+}
+
+__attribute__ ((target ("ssse3"))) static int
+netjack_float_to_int8_ssse3 (int8_t *dst, const float *src, int n)
+{
+	const __m128 scale = _mm_set1_ps (127.0f);
+	int i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m128i a = _mm_cvttps_epi32 (_mm_mul_ps (_mm_loadu_ps (src + i), scale));
+		__m128i b = _mm_cvttps_epi32 (_mm_mul_ps (_mm_loadu_ps (src + i + 4), scale));
+		__m128i c = _mm_cvttps_epi32 (_mm_mul_ps (_mm_loadu_ps (src + i + 8), scale));
+		__m128i d = _mm_cvttps_epi32 (_mm_mul_ps (_mm_loadu_ps (src + i + 12), scale));
+		__m128i v = _mm_packs_epi16 (_mm_packs_epi32 (a, b), _mm_packs_epi32 (c, d));
+		_mm_storeu_si128 ((__m128i*)(dst + i), v);
+	}
+	return i;
+}
+
+__attribute__ ((target ("ssse3"))) static int
+netjack_int8_to_float_ssse3 (float *dst, const int8_t *src, int n)
+{
+	const __m128 scale = _mm_set1_ps (127.0f);
+	int i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128 ((const __m128i*)(src + i));
+		/* sign extend by unpacking into the high half and
+		   shifting back down */
+		__m128i lo = _mm_srai_epi16 (_mm_unpacklo_epi8 (v, v), 8);
+		__m128i hi = _mm_srai_epi16 (_mm_unpackhi_epi8 (v, v), 8);
+		__m128i w0 = _mm_srai_epi32 (_mm_unpacklo_epi16 (lo, lo), 16);
+		__m128i w1 = _mm_srai_epi32 (_mm_unpackhi_epi16 (lo, lo), 16);
+		__m128i w2 = _mm_srai_epi32 (_mm_unpacklo_epi16 (hi, hi), 16);
+		__m128i w3 = _mm_srai_epi32 (_mm_unpackhi_epi16 (hi, hi), 16);
+		_mm_storeu_ps (dst + i, _mm_div_ps (_mm_cvtepi32_ps (w0), scale));
+		_mm_storeu_ps (dst + i + 4, _mm_div_ps (_mm_cvtepi32_ps (w1), scale));
+		_mm_storeu_ps (dst + i + 8, _mm_div_ps (_mm_cvtepi32_ps (w2), scale));
+		_mm_storeu_ps (dst + i + 12, _mm_div_ps (_mm_cvtepi32_ps (w3), scale));
+	}
+	return i;
+}
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define NETJACK_NEON_SIMD 1
+#include <arm_neon.h>
+
+static int
+netjack_swap32_neon (uint32_t *dst, const uint32_t *src, int n)
+{
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		uint8x16_t v = vreinterpretq_u8_u32 (vld1q_u32 (src + i));
+		vst1q_u32 (dst + i, vreinterpretq_u32_u8 (vrev32q_u8 (v)));
+	}
+	return i;
+}
+
+static int
+netjack_float_to_net16_neon (uint16_t *dst, const float *src, int n)
+{
+	const float32x4_t one = vdupq_n_f32 (1.0f);
+	const float32x4_t scale = vdupq_n_f32 (32767.0f);
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		uint32x4_t a = vcvtq_u32_f32 (vmulq_f32 (vaddq_f32 (vld1q_f32 (src + i), one), scale));
+		uint32x4_t b = vcvtq_u32_f32 (vmulq_f32 (vaddq_f32 (vld1q_f32 (src + i + 4), one), scale));
+		uint16x8_t v = vcombine_u16 (vqmovn_u32 (a), vqmovn_u32 (b));
+		vst1q_u16 (dst + i, vreinterpretq_u16_u8 (vrev16q_u8 (vreinterpretq_u8_u16 (v))));
+	}
+	return i;
+}
+
+static int
+netjack_net16_to_float_neon (float *dst, const uint16_t *src, int n)
+{
+	const float32x4_t scale = vdupq_n_f32 (1.0f / 32768.0f);
+	const float32x4_t one = vdupq_n_f32 (1.0f);
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		uint16x8_t v = vreinterpretq_u16_u8 (vrev16q_u8 (vreinterpretq_u8_u16 (vld1q_u16 (src + i))));
+		float32x4_t lo = vcvtq_f32_u32 (vmovl_u16 (vget_low_u16 (v)));
+		float32x4_t hi = vcvtq_f32_u32 (vmovl_u16 (vget_high_u16 (v)));
+		vst1q_f32 (dst + i, vsubq_f32 (vmulq_f32 (lo, scale), one));
+		vst1q_f32 (dst + i + 4, vsubq_f32 (vmulq_f32 (hi, scale), one));
+	}
+	return i;
+}
+#endif
+
+static void
+netjack_float_to_net (uint32_t *dst, const float *src, int n)
+{
+	int_float_t val;
+	int i = 0;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#if NETJACK_X86_SIMD
+	if (jack_cpu_has (JACK_CPU_SSSE3)) {
+		i = netjack_swap32_ssse3 (dst, (const uint32_t*)src, n);
+	}
+#elif NETJACK_NEON_SIMD
+	i = netjack_swap32_neon (dst, (const uint32_t*)src, n);
+#endif
+#endif
+	for (; i < n; i++) {
+		val.f = src[i];
+		dst[i] = htonl (val.i);
+	}
+}
+
+static void
+netjack_net_to_float (float *dst, const uint32_t *src, int n)
+{
+	int_float_t val;
+	int i = 0;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#if NETJACK_X86_SIMD
+	if (jack_cpu_has (JACK_CPU_SSSE3)) {
+		i = netjack_swap32_ssse3 ((uint32_t*)dst, src, n);
+	}
+#elif NETJACK_NEON_SIMD
+	i = netjack_swap32_neon ((uint32_t*)dst, src, n);
+#endif
+#endif
+	for (; i < n; i++) {
+		val.i = ntohl (src[i]);
+		dst[i] = val.f;
+	}
+}
+
+static void
+netjack_float_to_net16 (uint16_t *dst, const float *src, int n)
+{
+	int i = 0;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#if NETJACK_X86_SIMD
+	if (jack_cpu_has (JACK_CPU_SSSE3)) {
+		i = netjack_float_to_net16_ssse3 (dst, src, n);
+	}
+#elif NETJACK_NEON_SIMD
+	i = netjack_float_to_net16_neon (dst, src, n);
+#endif
+#endif
+	for (; i < n; i++) {
+		dst[i] = htons (((uint16_t)((src[i] + 1.0) * 32767.0)));
+	}
+}
+
+static void
+netjack_net16_to_float (float *dst, const uint16_t *src, int n)
+{
+	int i = 0;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#if NETJACK_X86_SIMD
+	if (jack_cpu_has (JACK_CPU_SSSE3)) {
+		i = netjack_net16_to_float_ssse3 (dst, src, n);
+	}
+#elif NETJACK_NEON_SIMD
+	i = netjack_net16_to_float_neon (dst, src, n);
+#endif
+#endif
+	for (; i < n; i++) {
+		dst[i] = ((float)ntohs (src[i])) / 32768.0 - 1.0;
+	}
+}
+
+static void
+netjack_float_to_int8 (int8_t *dst, const float *src, int n)
+{
+	int i = 0;
+
+#if NETJACK_X86_SIMD
+	if (jack_cpu_has (JACK_CPU_SSSE3)) {
+		i = netjack_float_to_int8_ssse3 (dst, src, n);
+	}
+#endif
+	for (; i < n; i++) {
+		dst[i] = src[i] * 127.0;
+	}
+}
+
+static void
+netjack_int8_to_float (float *dst, const int8_t *src, int n)
+{
+	int i = 0;
+
+#if NETJACK_X86_SIMD
+	if (jack_cpu_has (JACK_CPU_SSSE3)) {
+		i = netjack_int8_to_float_ssse3 (dst, src, n);
+	}
+#endif
+	for (; i < n; i++) {
+		dst[i] = ((float)src[i]) / 127.0;
+	}
+}
+
+// One audio channel of a payload to floats and back, for the local
+// clock mode, which does its own resampling outside the port plans.
+// The audio channels come first in a payload, one slot each; codecs
+// are not handled.
+
+void
+netjack_payload_to_float (int bitdepth, void *packet_payload, jack_nframes_t net_period, unsigned int chn, float *dst, int dont_htonl_floats)
 {
-	int i;
-	unsigned int written = 0;
-	// midi port, encode midi events
-	unsigned int nevents = jack_midi_get_event_count (buf);
+	char *src = (char*)packet_payload + chn * get_sample_size (bitdepth) * net_period;
 
-	for (i = 0; i < nevents; ++i) {
-		jack_midi_event_t event;
-		jack_midi_event_get (&event, buf, i);
-		unsigned int nb_data_quads = (((event.size - 1) & ~0x3) >> 2) + 1;
-		unsigned int payload_size = 3 + nb_data_quads;
-		// only write if we have sufficient space for the event
-		// otherwise drop it
-		if (written + payload_size < buffer_size_uint32 - 1) {
-			// write header
-			buffer_uint32[written] = htonl (payload_size);
-			written++;
-			buffer_uint32[written] = htonl (event.time);
-			written++;
-			buffer_uint32[written] = htonl (event.size);
-			written++;
+	if (bitdepth == 8) {
+		netjack_int8_to_float (dst, (int8_t*)src, net_period);
+	} else if (bitdepth == 16) {
+		netjack_net16_to_float (dst, (uint16_t*)src, net_period);
+	} else if (dont_htonl_floats) {
+		memcpy (dst, src, net_period * sizeof(float));
+	} else {
+		netjack_net_to_float (dst, (uint32_t*)src, net_period);
+	}
+}
 
-			// write data
-			jack_midi_data_t* tmpbuff = (jack_midi_data_t*)(&(buffer_uint32[written]));
-			memcpy (tmpbuff, event.buffer, event.size);
-			written += nb_data_quads;
-		} else {
-			// buffer overflow
-			jack_error ("midi buffer overflow");
-			break;
-		}
+void
+netjack_float_to_payload (int bitdepth, void *packet_payload, jack_nframes_t net_period, unsigned int chn, const float *src, int dont_htonl_floats)
+{
+	char *dst = (char*)packet_payload + chn * get_sample_size (bitdepth) * net_period;
+
+	if (bitdepth == 8) {
+		netjack_float_to_int8 ((int8_t*)dst, src, net_period);
+	} else if (bitdepth == 16) {
+		netjack_float_to_net16 ((uint16_t*)dst, src, net_period);
+	} else if (dont_htonl_floats) {
+		memcpy (dst, src, net_period * sizeof(float));
+	} else {
+		netjack_float_to_net ((uint32_t*)dst, src, net_period);
 	}
-	// now put a netjack_midi 'no-payload' event, signaling EOF
-	buffer_uint32[written] = 0;
 }
 
 // render functions for float
 void
-render_payload_to_jack_ports_float ( void *packet_payload, jack_nframes_t net_period_down, JSList *capture_ports, JSList *capture_srcs, jack_nframes_t nframes, int dont_htonl_floats)
+render_payload_to_jack_ports_float ( void *packet_payload, jack_nframes_t net_period_down, netjack_port_plan_t *ports, jack_nframes_t nframes, int dont_htonl_floats)
 {
+	netjack_port_plan_t *plan;
 	int chn = 0;
-	JSList *node = capture_ports;
-
-#if HAVE_SAMPLERATE
-	JSList *src_node = capture_srcs;
-#endif
 
 	uint32_t *packet_bufX = (uint32_t*)packet_payload;
 
@@ -905,25 +2551,28 @@ render_payload_to_jack_ports_float ( void *packet_payload, jack_nframes_t net_pe
 		return;
 	}
 
-	while (node != NULL) {
-		int i;
-		int_float_t val;
+	for (plan = ports; plan->port != NULL; plan++) {
 #if HAVE_SAMPLERATE
 		SRC_DATA src;
 #endif
 
-		jack_port_t *port = (jack_port_t*)node->data;
+		jack_port_t *port = plan->port;
 		jack_default_audio_sample_t* buf = jack_port_get_buffer (port, nframes);
 
-		const char *porttype = jack_port_type (port);
-
-		if (jack_port_is_audio (porttype)) {
+		if (plan->kind == NETJACK_PORT_AUDIO) {
+			if (plan->resampler) {
+				float *in = netjack_resampler_input (plan->resampler, plan->chn);
+				if ( dont_htonl_floats ) {
+					memcpy ( in, packet_bufX, net_period_down * sizeof(float));
+				} else {
+					netjack_net_to_float (in, packet_bufX, net_period_down);
+				}
+			} else
 #if HAVE_SAMPLERATE
 			// audio port, resample if necessary
 			if (net_period_down != nframes) {
-				SRC_STATE *src_state = src_node->data;
-				for (i = 0; i < net_period_down; i++)
-					packet_bufX[i] = ntohl (packet_bufX[i]);
+				SRC_STATE *src_state = plan->src;
+				netjack_net_to_float ((float*)packet_bufX, packet_bufX, net_period_down);
 
 				src.data_in = (float*)packet_bufX;
 				src.input_frames = net_period_down;
@@ -936,21 +2585,16 @@ render_payload_to_jack_ports_float ( void *packet_payload, jack_nframes_t net_pe
 
 				src_set_ratio (src_state, src.src_ratio);
 				src_process (src_state, &src);
-				src_node = jack_slist_next (src_node);
 			} else
 #endif
 			{
 				if ( dont_htonl_floats ) {
 					memcpy ( buf, packet_bufX, net_period_down * sizeof(jack_default_audio_sample_t));
 				} else {
-					for (i = 0; i < net_period_down; i++) {
-						val.i = packet_bufX[i];
-						val.i = ntohl (val.i);
-						buf[i] = val.f;
-					}
+					netjack_net_to_float (buf, packet_bufX, net_period_down);
 				}
 			}
-		} else if (jack_port_is_midi (porttype)) {
+		} else if (plan->kind == NETJACK_PORT_MIDI) {
 			// midi port, decode midi events
 			// convert the data buffer to a standard format (uint32_t based)
 			unsigned int buffer_size_uint32 = net_period_down;
@@ -958,40 +2602,46 @@ render_payload_to_jack_ports_float ( void *packet_payload, jack_nframes_t net_pe
 			decode_midi_buffer (buffer_uint32, buffer_size_uint32, buf);
 		}
 		packet_bufX = (packet_bufX + net_period_down);
-		node = jack_slist_next (node);
 		chn++;
 	}
+
+	if (net_period_down != nframes) {
+		netjack_resample_to_ports (ports, nframes);
+	}
 }
 
 void
-render_jack_ports_to_payload_float (JSList *playback_ports, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up, int dont_htonl_floats )
+render_jack_ports_to_payload_float (netjack_port_plan_t *plan, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up, int dont_htonl_floats )
 {
 	int chn = 0;
-	JSList *node = playback_ports;
-
-#if HAVE_SAMPLERATE
-	JSList *src_node = playback_srcs;
-#endif
 
 	uint32_t *packet_bufX = (uint32_t*)packet_payload;
 
-	while (node != NULL) {
+	if (net_period_up != nframes) {
+		netjack_resample_from_ports (plan, nframes);
+	}
+
+	for (; plan->port != NULL; plan++) {
 #if HAVE_SAMPLERATE
 		SRC_DATA src;
 #endif
-		int i;
-		int_float_t val;
-		jack_port_t *port = (jack_port_t*)node->data;
+		jack_port_t *port = plan->port;
 		jack_default_audio_sample_t* buf = jack_port_get_buffer (port, nframes);
 
-		const char *porttype = jack_port_type (port);
-
-		if (jack_port_is_audio (porttype)) {
+		if (plan->kind == NETJACK_PORT_AUDIO) {
+			if (plan->resampler) {
+				float *out = netjack_resampler_output (plan->resampler, plan->chn);
+				if ( dont_htonl_floats ) {
+					memcpy ( packet_bufX, out, net_period_up * sizeof(float));
+				} else {
+					netjack_float_to_net (packet_bufX, out, net_period_up);
+				}
+			} else
 			// audio port, resample if necessary
 
 #if HAVE_SAMPLERATE
 			if (net_period_up != nframes) {
-				SRC_STATE *src_state = src_node->data;
+				SRC_STATE *src_state = plan->src;
 				src.data_in = buf;
 				src.input_frames = nframes;
 
@@ -1004,23 +2654,17 @@ render_jack_ports_to_payload_float (JSList *playback_ports, JSList *playback_src
 				src_set_ratio (src_state, src.src_ratio);
 				src_process (src_state, &src);
 
-				for (i = 0; i < net_period_up; i++)
-					packet_bufX[i] = htonl (packet_bufX[i]);
-				src_node = jack_slist_next (src_node);
+				netjack_float_to_net (packet_bufX, (float*)packet_bufX, net_period_up);
 			} else
 #endif
 			{
 				if ( dont_htonl_floats ) {
 					memcpy ( packet_bufX, buf, net_period_up * sizeof(jack_default_audio_sample_t) );
 				} else {
-					for (i = 0; i < net_period_up; i++) {
-						val.f = buf[i];
-						val.i = htonl (val.i);
-						packet_bufX[i] = val.i;
-					}
+					netjack_float_to_net (packet_bufX, buf, net_period_up);
 				}
 			}
-		} else if (jack_port_is_midi (porttype)) {
+		} else if (plan->kind == NETJACK_PORT_MIDI) {
 			// encode midi events from port to packet
 			// convert the data buffer to a standard format (uint32_t based)
 			unsigned int buffer_size_uint32 = net_period_up;
@@ -1028,21 +2672,16 @@ render_jack_ports_to_payload_float (JSList *playback_ports, JSList *playback_src
 			encode_midi_buffer (buffer_uint32, buffer_size_uint32, buf);
 		}
 		packet_bufX = (packet_bufX + net_period_up);
-		node = jack_slist_next (node);
 		chn++;
 	}
 }
 
 // render functions for 16bit
 void
-render_payload_to_jack_ports_16bit (void *packet_payload, jack_nframes_t net_period_down, JSList *capture_ports, JSList *capture_srcs, jack_nframes_t nframes)
+render_payload_to_jack_ports_16bit (void *packet_payload, jack_nframes_t net_period_down, netjack_port_plan_t *ports, jack_nframes_t nframes)
 {
+	netjack_port_plan_t *plan;
 	int chn = 0;
-	JSList *node = capture_ports;
-
-#if HAVE_SAMPLERATE
-	JSList *src_node = capture_srcs;
-#endif
 
 	uint16_t *packet_bufX = (uint16_t*)packet_payload;
 
@@ -1050,27 +2689,25 @@ render_payload_to_jack_ports_16bit (void *packet_payload, jack_nframes_t net_per
 		return;
 	}
 
-	while (node != NULL) {
-		int i;
-		//uint32_t val;
+	for (plan = ports; plan->port != NULL; plan++) {
 #if HAVE_SAMPLERATE
 		SRC_DATA src;
+		int i;
 #endif
 
-		jack_port_t *port = (jack_port_t*)node->data;
+		jack_port_t *port = plan->port;
 		jack_default_audio_sample_t* buf = jack_port_get_buffer (port, nframes);
 
-#if HAVE_SAMPLERATE
-		float *floatbuf = alloca (sizeof(float) * net_period_down);
-#endif
-		const char *porttype = jack_port_type (port);
-
-		if (jack_port_is_audio (porttype)) {
+		if (plan->kind == NETJACK_PORT_AUDIO) {
+			if (plan->resampler) {
+				netjack_net16_to_float (netjack_resampler_input (plan->resampler, plan->chn), packet_bufX, net_period_down);
+			} else
 			// audio port, resample if necessary
 
 #if HAVE_SAMPLERATE
 			if (net_period_down != nframes) {
-				SRC_STATE *src_state = src_node->data;
+				SRC_STATE *src_state = plan->src;
+				float *floatbuf = alloca (sizeof(float) * net_period_down);
 				for (i = 0; i < net_period_down; i++)
 					floatbuf[i] = ((float)ntohs (packet_bufX[i])) / 32767.0 - 1.0;
 
@@ -1085,12 +2722,10 @@ render_payload_to_jack_ports_16bit (void *packet_payload, jack_nframes_t net_per
 
 				src_set_ratio (src_state, src.src_ratio);
 				src_process (src_state, &src);
-				src_node = jack_slist_next (src_node);
 			} else
 #endif
-			for (i = 0; i < net_period_down; i++)
-				buf[i] = ((float)ntohs (packet_bufX[i])) / 32768.0 - 1.0;
-		} else if (jack_port_is_midi (porttype)) {
+			netjack_net16_to_float (buf, packet_bufX, net_period_down);
+		} else if (plan->kind == NETJACK_PORT_MIDI) {
 			// midi port, decode midi events
 			// convert the data buffer to a standard format (uint32_t based)
 			unsigned int buffer_size_uint32 = net_period_down / 2;
@@ -1098,38 +2733,41 @@ render_payload_to_jack_ports_16bit (void *packet_payload, jack_nframes_t net_per
 			decode_midi_buffer (buffer_uint32, buffer_size_uint32, buf);
 		}
 		packet_bufX = (packet_bufX + net_period_down);
-		node = jack_slist_next (node);
 		chn++;
 	}
+
+	if (net_period_down != nframes) {
+		netjack_resample_to_ports (ports, nframes);
+	}
 }
 
 void
-render_jack_ports_to_payload_16bit (JSList *playback_ports, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up)
+render_jack_ports_to_payload_16bit (netjack_port_plan_t *plan, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up)
 {
 	int chn = 0;
-	JSList *node = playback_ports;
-
-#if HAVE_SAMPLERATE
-	JSList *src_node = playback_srcs;
-#endif
 
 	uint16_t *packet_bufX = (uint16_t*)packet_payload;
 
-	while (node != NULL) {
+	if (net_period_up != nframes) {
+		netjack_resample_from_ports (plan, nframes);
+	}
+
+	for (; plan->port != NULL; plan++) {
 #if HAVE_SAMPLERATE
 		SRC_DATA src;
 #endif
-		int i;
-		jack_port_t *port = (jack_port_t*)node->data;
+		jack_port_t *port = plan->port;
 		jack_default_audio_sample_t* buf = jack_port_get_buffer (port, nframes);
-		const char *porttype = jack_port_type (port);
 
-		if (jack_port_is_audio (porttype)) {
+		if (plan->kind == NETJACK_PORT_AUDIO) {
+			if (plan->resampler) {
+				netjack_float_to_net16 (packet_bufX, netjack_resampler_output (plan->resampler, plan->chn), net_period_up);
+			} else
 			// audio port, resample if necessary
 
 #if HAVE_SAMPLERATE
 			if (net_period_up != nframes) {
-				SRC_STATE *src_state = src_node->data;
+				SRC_STATE *src_state = plan->src;
 
 				float *floatbuf = alloca (sizeof(float) * net_period_up);
 
@@ -1145,14 +2783,11 @@ render_jack_ports_to_payload_16bit (JSList *playback_ports, JSList *playback_src
 				src_set_ratio (src_state, src.src_ratio);
 				src_process (src_state, &src);
 
-				for (i = 0; i < net_period_up; i++)
-					packet_bufX[i] = htons (((uint16_t)((floatbuf[i] + 1.0) * 32767.0)));
-				src_node = jack_slist_next (src_node);
+				netjack_float_to_net16 (packet_bufX, floatbuf, net_period_up);
 			} else
 #endif
-			for (i = 0; i < net_period_up; i++)
-				packet_bufX[i] = htons (((uint16_t)((buf[i] + 1.0) * 32767.0)));
-		} else if (jack_port_is_midi (porttype)) {
+			netjack_float_to_net16 (packet_bufX, buf, net_period_up);
+		} else if (plan->kind == NETJACK_PORT_MIDI) {
 			// encode midi events from port to packet
 			// convert the data buffer to a standard format (uint32_t based)
 			unsigned int buffer_size_uint32 = net_period_up / 2;
@@ -1160,21 +2795,16 @@ render_jack_ports_to_payload_16bit (JSList *playback_ports, JSList *playback_src
 			encode_midi_buffer (buffer_uint32, buffer_size_uint32, buf);
 		}
 		packet_bufX = (packet_bufX + net_period_up);
-		node = jack_slist_next (node);
 		chn++;
 	}
 }
 
 // render functions for 8bit
 void
-render_payload_to_jack_ports_8bit (void *packet_payload, jack_nframes_t net_period_down, JSList *capture_ports, JSList *capture_srcs, jack_nframes_t nframes)
+render_payload_to_jack_ports_8bit (void *packet_payload, jack_nframes_t net_period_down, netjack_port_plan_t *ports, jack_nframes_t nframes)
 {
+	netjack_port_plan_t *plan;
 	int chn = 0;
-	JSList *node = capture_ports;
-
-#if HAVE_SAMPLERATE
-	JSList *src_node = capture_srcs;
-#endif
 
 	int8_t *packet_bufX = (int8_t*)packet_payload;
 
@@ -1182,28 +2812,24 @@ render_payload_to_jack_ports_8bit (void *packet_payload, jack_nframes_t net_peri
 		return;
 	}
 
-	while (node != NULL) {
-		int i;
-		//uint32_t val;
+	for (plan = ports; plan->port != NULL; plan++) {
 #if HAVE_SAMPLERATE
 		SRC_DATA src;
 #endif
 
-		jack_port_t *port = (jack_port_t*)node->data;
+		jack_port_t *port = plan->port;
 		jack_default_audio_sample_t* buf = jack_port_get_buffer (port, nframes);
 
-#if HAVE_SAMPLERATE
-		float *floatbuf = alloca (sizeof(float) * net_period_down);
-#endif
-		const char *porttype = jack_port_type (port);
-
-		if (jack_port_is_audio (porttype)) {
+		if (plan->kind == NETJACK_PORT_AUDIO) {
+			if (plan->resampler) {
+				netjack_int8_to_float (netjack_resampler_input (plan->resampler, plan->chn), packet_bufX, net_period_down);
+			} else
 #if HAVE_SAMPLERATE
 			// audio port, resample if necessary
 			if (net_period_down != nframes) {
-				SRC_STATE *src_state = src_node->data;
-				for (i = 0; i < net_period_down; i++)
-					floatbuf[i] = ((float)packet_bufX[i]) / 127.0;
+				SRC_STATE *src_state = plan->src;
+				float *floatbuf = alloca (sizeof(float) * net_period_down);
+				netjack_int8_to_float (floatbuf, packet_bufX, net_period_down);
 
 				src.data_in = floatbuf;
 				src.input_frames = net_period_down;
@@ -1216,12 +2842,10 @@ render_payload_to_jack_ports_8bit (void *packet_payload, jack_nframes_t net_peri
 
 				src_set_ratio (src_state, src.src_ratio);
 				src_process (src_state, &src);
-				src_node = jack_slist_next (src_node);
 			} else
 #endif
-			for (i = 0; i < net_period_down; i++)
-				buf[i] = ((float)packet_bufX[i]) / 127.0;
-		} else if (jack_port_is_midi (porttype)) {
+			netjack_int8_to_float (buf, packet_bufX, net_period_down);
+		} else if (plan->kind == NETJACK_PORT_MIDI) {
 			// midi port, decode midi events
 			// convert the data buffer to a standard format (uint32_t based)
 			unsigned int buffer_size_uint32 = net_period_down / 4;
@@ -1229,39 +2853,42 @@ render_payload_to_jack_ports_8bit (void *packet_payload, jack_nframes_t net_peri
 			decode_midi_buffer (buffer_uint32, buffer_size_uint32, buf);
 		}
 		packet_bufX = (packet_bufX + net_period_down);
-		node = jack_slist_next (node);
 		chn++;
 	}
+
+	if (net_period_down != nframes) {
+		netjack_resample_to_ports (ports, nframes);
+	}
 }
 
 void
-render_jack_ports_to_payload_8bit (JSList *playback_ports, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up)
+render_jack_ports_to_payload_8bit (netjack_port_plan_t *plan, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up)
 {
 	int chn = 0;
-	JSList *node = playback_ports;
-
-#if HAVE_SAMPLERATE
-	JSList *src_node = playback_srcs;
-#endif
 
 	int8_t *packet_bufX = (int8_t*)packet_payload;
 
-	while (node != NULL) {
+	if (net_period_up != nframes) {
+		netjack_resample_from_ports (plan, nframes);
+	}
+
+	for (; plan->port != NULL; plan++) {
 #if HAVE_SAMPLERATE
 		SRC_DATA src;
 #endif
-		int i;
-		jack_port_t *port = (jack_port_t*)node->data;
+		jack_port_t *port = plan->port;
 
 		jack_default_audio_sample_t* buf = jack_port_get_buffer (port, nframes);
-		const char *porttype = jack_port_type (port);
 
-		if (jack_port_is_audio (porttype)) {
+		if (plan->kind == NETJACK_PORT_AUDIO) {
+			if (plan->resampler) {
+				netjack_float_to_int8 (packet_bufX, netjack_resampler_output (plan->resampler, plan->chn), net_period_up);
+			} else
 #if HAVE_SAMPLERATE
 			// audio port, resample if necessary
 			if (net_period_up != nframes) {
 
-				SRC_STATE *src_state = src_node->data;
+				SRC_STATE *src_state = plan->src;
 
 				float *floatbuf = alloca (sizeof(float) * net_period_up);
 
@@ -1277,14 +2904,11 @@ render_jack_ports_to_payload_8bit (JSList *playback_ports, JSList *playback_srcs
 				src_set_ratio (src_state, src.src_ratio);
 				src_process (src_state, &src);
 
-				for (i = 0; i < net_period_up; i++)
-					packet_bufX[i] = floatbuf[i] * 127.0;
-				src_node = jack_slist_next (src_node);
+				netjack_float_to_int8 (packet_bufX, floatbuf, net_period_up);
 			} else
 #endif
-			for (i = 0; i < net_period_up; i++)
-				packet_bufX[i] = buf[i] * 127.0;
-		} else if (jack_port_is_midi (porttype)) {
+			netjack_float_to_int8 (packet_bufX, buf, net_period_up);
+		} else if (plan->kind == NETJACK_PORT_MIDI) {
 			// encode midi events from port to packet
 			// convert the data buffer to a standard format (uint32_t based)
 			unsigned int buffer_size_uint32 = net_period_up / 4;
@@ -1292,7 +2916,6 @@ render_jack_ports_to_payload_8bit (JSList *playback_ports, JSList *playback_srcs
 			encode_midi_buffer (buffer_uint32, buffer_size_uint32, buf);
 		}
 		packet_bufX = (packet_bufX + net_period_up);
-		node = jack_slist_next (node);
 		chn++;
 	}
 }
@@ -1300,24 +2923,20 @@ render_jack_ports_to_payload_8bit (JSList *playback_ports, JSList *playback_srcs
 #if HAVE_CELT
 // render functions for celt.
 void
-render_payload_to_jack_ports_celt (void *packet_payload, jack_nframes_t net_period_down, JSList *capture_ports, JSList *capture_srcs, jack_nframes_t nframes)
+render_payload_to_jack_ports_celt (void *packet_payload, jack_nframes_t net_period_down, netjack_port_plan_t *plan, jack_nframes_t nframes)
 {
 	int chn = 0;
-	JSList *node = capture_ports;
-	JSList *src_node = capture_srcs;
 
 	unsigned char *packet_bufX = (unsigned char*)packet_payload;
 
-	while (node != NULL) {
-		jack_port_t *port = (jack_port_t*)node->data;
+	for (; plan->port != NULL; plan++) {
+		jack_port_t *port = plan->port;
 		jack_default_audio_sample_t* buf = jack_port_get_buffer (port, nframes);
 
-		const char *porttype = jack_port_type (port);
-
-		if (jack_port_is_audio (porttype)) {
+		if (plan->kind == NETJACK_PORT_AUDIO) {
 			// audio port, decode celt data.
 
-			CELTDecoder *decoder = src_node->data;
+			CELTDecoder *decoder = plan->src;
 #if HAVE_CELT_API_0_8
 			if ( !packet_payload ) {
 				celt_decode_float ( decoder, NULL, net_period_down, buf, nframes );
@@ -1332,8 +2951,7 @@ render_payload_to_jack_ports_celt (void *packet_payload, jack_nframes_t net_peri
 			}
 #endif
 
-			src_node = jack_slist_next (src_node);
-		} else if (jack_port_is_midi (porttype)) {
+		} else if (plan->kind == NETJACK_PORT_MIDI) {
 			// midi port, decode midi events
 			// convert the data buffer to a standard format (uint32_t based)
 			unsigned int buffer_size_uint32 = net_period_down / 2;
@@ -1343,32 +2961,28 @@ render_payload_to_jack_ports_celt (void *packet_payload, jack_nframes_t net_peri
 			}
 		}
 		packet_bufX = (packet_bufX + net_period_down);
-		node = jack_slist_next (node);
 		chn++;
 	}
 }
 
 void
-render_jack_ports_to_payload_celt (JSList *playback_ports, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up)
+render_jack_ports_to_payload_celt (netjack_port_plan_t *plan, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up)
 {
 	int chn = 0;
-	JSList *node = playback_ports;
-	JSList *src_node = playback_srcs;
 
 	unsigned char *packet_bufX = (unsigned char*)packet_payload;
 
-	while (node != NULL) {
-		jack_port_t *port = (jack_port_t*)node->data;
+	for (; plan->port != NULL; plan++) {
+		jack_port_t *port = plan->port;
 		jack_default_audio_sample_t* buf = jack_port_get_buffer (port, nframes);
-		const char *porttype = jack_port_type (port);
 
-		if (jack_port_is_audio (porttype)) {
+		if (plan->kind == NETJACK_PORT_AUDIO) {
 			// audio port, encode celt data.
 
 			int encoded_bytes;
 			float *floatbuf = alloca (sizeof(float) * nframes );
 			memcpy ( floatbuf, buf, nframes * sizeof(float) );
-			CELTEncoder *encoder = src_node->data;
+			CELTEncoder *encoder = plan->src;
 #if HAVE_CELT_API_0_8
 			encoded_bytes = celt_encode_float ( encoder, floatbuf, nframes, packet_bufX, net_period_up );
 #else
@@ -1377,8 +2991,7 @@ render_jack_ports_to_payload_celt (JSList *playback_ports, JSList *playback_srcs
 			if ( encoded_bytes != net_period_up ) {
 				printf ( "something in celt changed. netjack needs to be changed to handle this.\n" );
 			}
-			src_node = jack_slist_next ( src_node );
-		} else if (jack_port_is_midi (porttype)) {
+		} else if (plan->kind == NETJACK_PORT_MIDI) {
 			// encode midi events from port to packet
 			// convert the data buffer to a standard format (uint32_t based)
 			unsigned int buffer_size_uint32 = net_period_up / 2;
@@ -1386,45 +2999,336 @@ render_jack_ports_to_payload_celt (JSList *playback_ports, JSList *playback_srcs
 			encode_midi_buffer (buffer_uint32, buffer_size_uint32, buf);
 		}
 		packet_bufX = (packet_bufX + net_period_up);
-		node = jack_slist_next (node);
 		chn++;
 	}
 }
 
+#endif
+
+#if HAVE_OPUS
+// The codec pool.
+//
+// Each cycle the driver thread posts one start token per worker, then
+// all of them -- driver thread included -- claim channels from a
+// shared counter until none are left.  The driver thread returns once
+// every worker has posted its done token, so the jobs never outlive
+// the cycle's port buffers.
+
+struct _netjack_codec_pool {
+	int nthreads;
+	pthread_t *threads;
+	sem_t start;
+	sem_t done;
+	volatile int quit;
+
+	void (*job)(void *arg, int n);
+	void *arg;
+	int njobs;
+	int next;
+};
+
+static void
+netjack_codec_pool_run (netjack_codec_pool_t *pool)
+{
+	int n;
+
+	while ((n = __sync_fetch_and_add (&pool->next, 1)) < pool->njobs) {
+		pool->job (pool->arg, n);
+	}
+}
+
+static void
+netjack_codec_pool_sem_wait (sem_t *sem)
+{
+	while (sem_wait (sem) != 0 && errno == EINTR) {
+		;
+	}
+}
+
+static void *
+netjack_codec_pool_thread (void *arg)
+{
+	netjack_codec_pool_t *pool = (netjack_codec_pool_t*)arg;
+
+	while (1) {
+		netjack_codec_pool_sem_wait (&pool->start);
+		if (pool->quit) {
+			break;
+		}
+		netjack_codec_pool_run (pool);
+		sem_post (&pool->done);
+	}
+
+	return NULL;
+}
+
+netjack_codec_pool_t *
+netjack_codec_pool_new (jack_client_t *client, int nthreads)
+{
+	netjack_codec_pool_t *pool;
+	int i;
+
+	if (nthreads <= 0) {
+		return NULL;
+	}
+
+	pool = calloc (1, sizeof(netjack_codec_pool_t));
+	if (pool == NULL) {
+		jack_error ("could not allocate codec pool");
+		return NULL;
+	}
+	pool->threads = calloc (nthreads, sizeof(pthread_t));
+	if (pool->threads == NULL) {
+		jack_error ("could not allocate codec pool");
+		free (pool);
+		return NULL;
+	}
+
+	sem_init (&pool->start, 0, 0);
+	sem_init (&pool->done, 0, 0);
+
+	for (i = 0; i < nthreads; i++) {
+		if (jack_client_create_thread (client, &pool->threads[i],
+					       jack_client_real_time_priority (client),
+					       jack_is_realtime (client),
+					       netjack_codec_pool_thread, pool)) {
+			jack_error ("netjack: could only start %d of %d codec threads",
+				    i, nthreads);
+			break;
+		}
+	}
+	pool->nthreads = i;
+
+	if (pool->nthreads == 0) {
+		netjack_codec_pool_free (pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+void
+netjack_codec_pool_free (netjack_codec_pool_t *pool)
+{
+	int i;
+
+	if (pool == NULL) {
+		return;
+	}
+
+	pool->quit = 1;
+	for (i = 0; i < pool->nthreads; i++) {
+		sem_post (&pool->start);
+	}
+	for (i = 0; i < pool->nthreads; i++) {
+		pthread_join (pool->threads[i], NULL);
+	}
+
+	sem_destroy (&pool->start);
+	sem_destroy (&pool->done);
+	free (pool->threads);
+	free (pool);
+}
+
+// Runs job(arg, 0 .. njobs-1), spread across the pool if there is one.
+static void
+netjack_codec_pool_dispatch (netjack_codec_pool_t *pool, void (*job)(void *arg, int n), void *arg, int njobs)
+{
+	int i, nwake;
+
+	if (pool == NULL || njobs < 2) {
+		for (i = 0; i < njobs; i++) {
+			job (arg, i);
+		}
+		return;
+	}
+
+	pool->job = job;
+	pool->arg = arg;
+	pool->njobs = njobs;
+	pool->next = 0;
+	__sync_synchronize ();
+
+	// The driver thread takes a share too.
+	nwake = pool->nthreads < njobs - 1 ? pool->nthreads : njobs - 1;
+	for (i = 0; i < nwake; i++) {
+		sem_post (&pool->start);
+	}
+	netjack_codec_pool_run (pool);
+	for (i = 0; i < nwake; i++) {
+		netjack_codec_pool_sem_wait (&pool->done);
+	}
+}
+
+// Every opus channel slot starts with the big-endian length of the
+// encoded frame; a length of zero marks a frame to be concealed.
+#define OPUS_LENGTH_SIZE 2
+
+// render functions for opus.
+void
+render_payload_to_jack_ports_opus (void *packet_payload, jack_nframes_t net_period_down, netjack_port_plan_t *plan, jack_nframes_t nframes)
+{
+	int chn = 0;
+
+	unsigned char *packet_bufX = (unsigned char*)packet_payload;
+
+	for (; plan->port != NULL; plan++) {
+		jack_port_t *port = plan->port;
+		jack_default_audio_sample_t* buf = jack_port_get_buffer (port, nframes);
+
+		if (plan->kind == NETJACK_PORT_AUDIO) {
+			// audio port, decode opus data.
+
+			OpusCustomDecoder *decoder = plan->src;
+			unsigned int len = 0;
+
+			if ( packet_payload ) {
+				len = (packet_bufX[0] << 8) | packet_bufX[1];
+			}
+			if ( len == 0 || len > net_period_down - OPUS_LENGTH_SIZE ) {
+				opus_custom_decode_float ( decoder, NULL, 0, buf, nframes );
+			} else {
+				opus_custom_decode_float ( decoder, packet_bufX + OPUS_LENGTH_SIZE, len, buf, nframes );
+			}
+
+		} else if (plan->kind == NETJACK_PORT_MIDI) {
+			// midi port, decode midi events
+			// convert the data buffer to a standard format (uint32_t based)
+			unsigned int buffer_size_uint32 = net_period_down / 4;
+			uint32_t * buffer_uint32 = (uint32_t*)packet_bufX;
+			if ( packet_payload ) {
+				decode_midi_buffer (buffer_uint32, buffer_size_uint32, buf);
+			}
+		}
+		packet_bufX = (packet_bufX + net_period_down);
+		chn++;
+	}
+}
+
+typedef struct {
+	OpusCustomEncoder *encoder;
+	jack_default_audio_sample_t *buf;
+	unsigned char *packet_bufX;
+} netjack_opus_job_t;
+
+typedef struct {
+	netjack_opus_job_t *jobs;
+	jack_nframes_t nframes;
+	jack_nframes_t net_period_up;
+} netjack_opus_cycle_t;
+
+static void
+netjack_opus_encode_channel (void *arg, int n)
+{
+	netjack_opus_cycle_t *cycle = (netjack_opus_cycle_t*)arg;
+	netjack_opus_job_t *job = &cycle->jobs[n];
+	int encoded_bytes;
+
+	encoded_bytes = opus_custom_encode_float ( job->encoder, job->buf, cycle->nframes,
+						   job->packet_bufX + OPUS_LENGTH_SIZE,
+						   cycle->net_period_up - OPUS_LENGTH_SIZE );
+	if ( encoded_bytes < 0 ) {
+		encoded_bytes = 0;
+	}
+	job->packet_bufX[0] = (encoded_bytes >> 8) & 0xff;
+	job->packet_bufX[1] = encoded_bytes & 0xff;
+}
+
+void
+render_jack_ports_to_payload_opus (netjack_port_plan_t *plan, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up, netjack_codec_pool_t *pool)
+{
+	netjack_opus_cycle_t cycle;
+	int njobs = 0;
+
+	unsigned char *packet_bufX = (unsigned char*)packet_payload;
+
+	cycle.jobs = alloca (sizeof(netjack_opus_job_t) * netjack_port_plan_audio (plan));
+	cycle.nframes = nframes;
+	cycle.net_period_up = net_period_up;
+
+	// Collect the audio channels first, midi is cheap enough to
+	// render right away.
+	for (; plan->port != NULL; plan++) {
+		jack_port_t *port = plan->port;
+		jack_default_audio_sample_t* buf = jack_port_get_buffer (port, nframes);
+
+		if (plan->kind == NETJACK_PORT_AUDIO) {
+			cycle.jobs[njobs].encoder = plan->src;
+			cycle.jobs[njobs].buf = buf;
+			cycle.jobs[njobs].packet_bufX = packet_bufX;
+			njobs++;
+		} else if (plan->kind == NETJACK_PORT_MIDI) {
+			// encode midi events from port to packet
+			// convert the data buffer to a standard format (uint32_t based)
+			unsigned int buffer_size_uint32 = net_period_up / 4;
+			uint32_t * buffer_uint32 = (uint32_t*)packet_bufX;
+			encode_midi_buffer (buffer_uint32, buffer_size_uint32, buf);
+		}
+		packet_bufX = (packet_bufX + net_period_up);
+	}
+
+	netjack_codec_pool_dispatch (pool, netjack_opus_encode_channel, &cycle, njobs);
+}
+
 #endif
 /* Wrapper functions with bitdepth argument... */
 void
-render_payload_to_jack_ports (int bitdepth, void *packet_payload, jack_nframes_t net_period_down, JSList *capture_ports, JSList *capture_srcs, jack_nframes_t nframes, int dont_htonl_floats)
+render_payload_to_jack_ports (int bitdepth, void *packet_payload, jack_nframes_t net_period_down, netjack_port_plan_t *plan, jack_nframes_t nframes, int dont_htonl_floats)
 {
 	if (bitdepth == 8) {
-		render_payload_to_jack_ports_8bit (packet_payload, net_period_down, capture_ports, capture_srcs, nframes);
+		render_payload_to_jack_ports_8bit (packet_payload, net_period_down, plan, nframes);
 	} else if (bitdepth == 16) {
-		render_payload_to_jack_ports_16bit (packet_payload, net_period_down, capture_ports, capture_srcs, nframes);
+		render_payload_to_jack_ports_16bit (packet_payload, net_period_down, plan, nframes);
 	}
 #if HAVE_CELT
 	else if (bitdepth == CELT_MODE) {
-		render_payload_to_jack_ports_celt (packet_payload, net_period_down, capture_ports, capture_srcs, nframes);
+		render_payload_to_jack_ports_celt (packet_payload, net_period_down, plan, nframes);
+	}
+#endif
+#if HAVE_OPUS
+	else if (bitdepth == OPUS_MODE) {
+		render_payload_to_jack_ports_opus (packet_payload, net_period_down, plan, nframes);
 	}
 #endif
 	else {
-		render_payload_to_jack_ports_float (packet_payload, net_period_down, capture_ports, capture_srcs, nframes, dont_htonl_floats);
+		render_payload_to_jack_ports_float (packet_payload, net_period_down, plan, nframes, dont_htonl_floats);
 	}
+
+	netjack_decode_midi_packed (bitdepth, packet_payload, net_period_down, plan, nframes);
 }
 
-void
-render_jack_ports_to_payload (int bitdepth, JSList *playback_ports, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up, int dont_htonl_floats)
+int
+render_jack_ports_to_payload (int bitdepth, netjack_port_plan_t *plan, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up, int dont_htonl_floats, netjack_codec_pool_t *pool)
 {
+	int used;
+
 	if (bitdepth == 8) {
-		render_jack_ports_to_payload_8bit (playback_ports, playback_srcs, nframes, packet_payload, net_period_up);
+		render_jack_ports_to_payload_8bit (plan, nframes, packet_payload, net_period_up);
 	} else if (bitdepth == 16) {
-		render_jack_ports_to_payload_16bit (playback_ports, playback_srcs, nframes, packet_payload, net_period_up);
+		render_jack_ports_to_payload_16bit (plan, nframes, packet_payload, net_period_up);
 	}
 #if HAVE_CELT
 	else if (bitdepth == CELT_MODE) {
-		render_jack_ports_to_payload_celt (playback_ports, playback_srcs, nframes, packet_payload, net_period_up);
+		render_jack_ports_to_payload_celt (plan, nframes, packet_payload, net_period_up);
+	}
+#endif
+#if HAVE_OPUS
+	else if (bitdepth == OPUS_MODE) {
+		render_jack_ports_to_payload_opus (plan, nframes, packet_payload, net_period_up, pool);
 	}
 #endif
 	else {
-		render_jack_ports_to_payload_float (playback_ports, playback_srcs, nframes, packet_payload, net_period_up, dont_htonl_floats);
+		render_jack_ports_to_payload_float (plan, nframes, packet_payload, net_period_up, dont_htonl_floats);
+	}
+
+	used = netjack_encode_midi_packed (bitdepth, plan, nframes, packet_payload, net_period_up);
+	if (used < 0) {
+		netjack_port_plan_t *p;
+
+		for (used = 0, p = plan; p->port != NULL; p++) {
+			used += get_sample_size (bitdepth) * net_period_up;
+		}
 	}
+
+	return used;
 }
@@ -42,8 +42,13 @@ extern "C"
 // The Packet Header.
 
 #define CELT_MODE 1000   // Magic bitdepth value that indicates CELT compression
+#define OPUS_MODE 999    // Magic bitdepth value that indicates OPUS compression
 #define MASTER_FREEWHEELS 0x80000000
 
+// With FEC a fragmented packet of N fragments is followed by an extra
+// fragment N carrying the XOR of the N payloads.  Receivers that do
+// not know about it drop it as out of range.
+
 typedef struct _jacknet_packet_header jacknet_packet_header;
 
 struct _jacknet_packet_header {
@@ -76,6 +81,20 @@ union _int_float {
 	float f;
 };
 
+// Redundant paths: the master sends every period to both of our
+// networks, the copy of each fragment that comes in first is used,
+// and the other one is dropped. Path 0 is the master's first address.
+#define NETJACK_PATHS 2
+
+typedef struct {
+	unsigned int fragments;         // received on this path
+	unsigned int used;              // of those, the first copy
+	unsigned int late;              // after the packet was gone
+	unsigned int ahead;             // packets this path started first
+	jack_time_t lead_sum;           // by how much, over the ahead packets
+	jack_time_t lead_max;
+} netjack_path_stats_t;
+
 // fragment reorder cache.
 typedef struct _cache_packet cache_packet;
 
@@ -86,20 +105,29 @@ struct _cache_packet {
 	int mtu;
 	jack_time_t recv_timestamp;
 	jack_nframes_t framecnt;
-	char *          fragment_array;
+	int             num_received;   // bits set in fragment_bits
+	uint32_t *      fragment_bits;
 	char *          packet_buf;
+	int             has_parity;
+	char *          parity_buf;     // FEC fragment payload, if fragmented
+	jack_time_t     path_seen[NETJACK_PATHS];       // first fragment per path, 0: none yet
 };
 
 typedef struct _packet_cache packet_cache;
 
+// The cache is a ring indexed by framecnt: packet framecnt always
+// lives in packets[framecnt % size].
 struct _packet_cache {
 	int size;
 	cache_packet *packets;
 	int mtu;
 	struct sockaddr_in master_address;
 	int master_address_valid;
+	struct in_addr redundant_address;       // INADDR_ANY: single path
+	netjack_path_stats_t path_stats[NETJACK_PATHS];
 	jack_nframes_t last_framecnt_retreived;
 	int last_framecnt_retreived_valid;
+	void *rx_batch;		// recvmmsg() buffers, NULL if unused
 };
 
 // fragment cache function prototypes
@@ -108,37 +136,95 @@ packet_cache *packet_cache_new(int num_packets, int pkt_size, int mtu);
 void          packet_cache_free(packet_cache *pkt_cache);
 
 cache_packet *packet_cache_get_packet(packet_cache *pkt_cache, jack_nframes_t framecnt);
-cache_packet *packet_cache_get_oldest_packet(packet_cache *pkt_cache);
-cache_packet *packet_cache_get_free_packet(packet_cache *pkt_cache);
+cache_packet *packet_cache_find_packet(packet_cache *pkt_cache, jack_nframes_t framecnt);
 
 void    cache_packet_reset(cache_packet *pack);
 void    cache_packet_set_framecnt(cache_packet *pack, jack_nframes_t framecnt);
-void    cache_packet_add_fragment(cache_packet *pack, char *packet_buf, int rcv_len);
+int     cache_packet_add_fragment(cache_packet *pack, char *packet_buf, int rcv_len);
 int     cache_packet_is_complete(cache_packet *pack);
 
 void packet_cache_drain_socket ( packet_cache * pcache, int sockfd, jack_time_t (*get_microseconds)(void) );
 void packet_cache_reset_master_address( packet_cache *pcache );
 float packet_cache_get_fill( packet_cache *pcache, jack_nframes_t expected_framecnt );
+int packet_cache_get_depth( packet_cache *pcache, jack_nframes_t expected_framecnt );
 int packet_cache_retreive_packet_pointer( packet_cache *pcache, jack_nframes_t framecnt, char **packet_buf, int pkt_size, jack_time_t *timestamp );
 int packet_cache_release_packet( packet_cache *pcache, jack_nframes_t framecnt );
 int packet_cache_get_next_available_framecnt( packet_cache *pcache, jack_nframes_t expected_framecnt, jack_nframes_t *framecnt );
 int packet_cache_get_highest_available_framecnt( packet_cache *pcache, jack_nframes_t *framecnt );
 int packet_cache_find_latency( packet_cache *pcache, jack_nframes_t expected_framecnt, jack_nframes_t *framecnt );
+// Optional AF_PACKET receive ring in place of reading the UDP socket
+// (Linux only). ifname "any" listens on all interfaces.
+typedef struct _netjack_ring netjack_ring_t;
+
+netjack_ring_t *netjack_ring_new(const char *ifname, int port, int mtu);
+void netjack_ring_free(netjack_ring_t *ring);
+int netjack_ring_poll_deadline(netjack_ring_t *ring, jack_time_t deadline, jack_time_t (*get_microseconds)(void));
+void packet_cache_drain_ring(packet_cache *pcache, netjack_ring_t *ring, jack_time_t (*get_microseconds)(void));
+
+// Shared memory transport between a master and a slave on one host.
+// The slave listens on a unix socket path and accepts the master's
+// segment; the master connects with the largest packet it will send.
+// Packets are whole and never fragmented; netjack_shm_fd() becomes
+// readable when the peer has sent something.
+typedef struct _netjack_shm netjack_shm_t;
+
+int netjack_shm_listen(const char *path);
+netjack_shm_t *netjack_shm_accept(int listen_fd);
+netjack_shm_t *netjack_shm_connect(const char *path, int slot_size);
+void netjack_shm_free(netjack_shm_t *shm);
+int netjack_shm_fd(netjack_shm_t *shm);
+int netjack_shm_slot_size(netjack_shm_t *shm);
+void netjack_shm_send(netjack_shm_t *shm, char *packet_buf, int pkt_size);
+int netjack_shm_recv(netjack_shm_t *shm, char *packet_buf, int pkt_size);
+void packet_cache_drain_shm(packet_cache *pcache, netjack_shm_t *shm, jack_time_t (*get_microseconds)(void));
+
 // Function Prototypes
 
 int netjack_poll_deadline (int sockfd, jack_time_t deadline, jack_time_t (*get_microseconds)(void));
+int netjack_poll_deadline_spin (int sockfd, jack_time_t deadline, jack_time_t spin, jack_time_t (*get_microseconds)(void));
 
-void netjack_sendto(int sockfd, char *packet_buf, int pkt_size, int flags, struct sockaddr *addr, int addr_size, int mtu);
+void netjack_sendto(int sockfd, char *packet_buf, int pkt_size, int data_size, int flags, struct sockaddr *addr, int addr_size, int mtu, int fec);
 
 
 int get_sample_size(int bitdepth);
+void netjack_payload_to_float(int bitdepth, void *packet_payload, jack_nframes_t net_period, unsigned int chn, float *dst, int dont_htonl_floats);
+void netjack_float_to_payload(int bitdepth, void *packet_payload, jack_nframes_t net_period, unsigned int chn, const float *src, int dont_htonl_floats);
 void packet_header_hton(jacknet_packet_header *pkthdr);
 
 void packet_header_ntoh(jacknet_packet_header *pkthdr);
 
-void render_payload_to_jack_ports(int bitdepth, void *packet_payload, jack_nframes_t net_period_down, JSList *capture_ports, JSList *capture_srcs, jack_nframes_t nframes, int dont_htonl_floats );
-
-void render_jack_ports_to_payload(int bitdepth, JSList *playback_ports, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up, int dont_htonl_floats );
+// What the render functions need to know of each port, worked out
+// once by netjack_port_plan_new() from a port list and the resampler
+// or codec states of its audio ports. Audio ports are numbered in chn
+// as the channels of the built-in resampler, if there is one. The
+// array ends at a NULL port and is freed with free().
+#define NETJACK_PORT_OTHER 0
+#define NETJACK_PORT_AUDIO 1
+#define NETJACK_PORT_MIDI  2
+#define NETJACK_PORT_MIDI_PACKED 3  // see netjack_port_plan_pack_midi()
+
+typedef struct _netjack_port_plan {
+	jack_port_t *port;
+	int kind;
+	int chn;
+	void *src;
+	struct _netjack_resampler *resampler;
+} netjack_port_plan_t;
+
+netjack_port_plan_t *netjack_port_plan_new(JSList *ports, JSList *srcs, struct _netjack_resampler *resampler);
+int netjack_port_plan_audio(netjack_port_plan_t *plan);
+void netjack_port_plan_pack_midi(netjack_port_plan_t *plan);
+
+void render_payload_to_jack_ports(int bitdepth, void *packet_payload, jack_nframes_t net_period_down, netjack_port_plan_t *plan, jack_nframes_t nframes, int dont_htonl_floats );
+
+// Worker threads that share the per-channel encoding work of a cycle.
+typedef struct _netjack_codec_pool netjack_codec_pool_t;
+
+netjack_codec_pool_t *netjack_codec_pool_new(jack_client_t *client, int nthreads);
+void netjack_codec_pool_free(netjack_codec_pool_t *pool);
+
+// Returns how many bytes at the start of the payload hold anything.
+int render_jack_ports_to_payload(int bitdepth, netjack_port_plan_t *plan, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up, int dont_htonl_floats, netjack_codec_pool_t *pool );
 
 
 // XXX: This is sort of deprecated:
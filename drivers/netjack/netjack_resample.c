@@ -0,0 +1,457 @@
+
+/*
+ * NetJack - built-in polyphase resampler
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "netjack_resample.h"
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+// The rate changes by up/down (out_frames/in_frames reduced by their
+// gcd). Output frame j sits at input position j * down / up, so it
+// takes its samples from input frame first[j] on and its coefficients
+// from filter row phase[j]; both are worked out once here. Every
+// channel keeps taps - 1 frames of history in front of its input, and
+// each output frame runs the same coefficient row over all channels.
+
+struct _netjack_resampler {
+	int channels;
+	int taps;               // coefficients per row, a multiple of 4
+	int up, down;
+	jack_nframes_t in_frames;
+	jack_nframes_t out_frames;
+
+	float *filter;          // up rows of taps coefficients
+	int *first;             // per output frame
+	int *phase;             // per output frame
+
+	int hist_stride;        // taps - 1 + in_frames
+	float *hist;            // channels rows of hist_stride
+	float *out;             // channels rows of out_frames
+};
+
+static const struct {
+	int taps;
+	float beta;             // kaiser window
+	float rolloff;          // passband edge relative to nyquist
+} netjack_resample_quality[] = {
+	{  0, 0.0f, 0.0f },     // NETJACK_RESAMPLE_SRC, not ours
+	{  8, 5.0f, 0.85f },
+	{ 24, 7.0f, 0.92f },
+	{ 48, 9.0f, 0.96f },
+};
+
+static int
+gcd (int a, int b)
+{
+	while (b) {
+		int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+static double
+bessel_i0 (double x)
+{
+	double sum = 1.0, term = 1.0;
+	int k;
+
+	for (k = 1; k < 50; k++) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+		if (term < sum * 1e-12) {
+			break;
+		}
+	}
+	return sum;
+}
+
+// rows rows of taps coefficients; row p is for output positions p / up
+// of an input frame past the start of the window. fc is the cutoff
+// relative to the input rate.
+static void
+netjack_resample_design (float *filter, int rows, int up, int taps, double fc, double beta)
+{
+	double half = taps / 2.0;
+	int p, k;
+
+	for (p = 0; p < rows; p++) {
+		float *row = filter + p * taps;
+		double sum = 0.0;
+
+		for (k = 0; k < taps; k++) {
+			// distance of input tap k from the output position
+			double d = half - 1 - k + (double)p / up;
+			double x = d / half;
+			double w = (fabs (x) < 1.0) ? bessel_i0 (beta * sqrt (1.0 - x * x)) / bessel_i0 (beta) : 0.0;
+			double s = (d == 0.0) ? 1.0 : sin (2.0 * M_PI * fc * d) / (2.0 * M_PI * fc * d);
+
+			row[k] = 2.0 * fc * s * w;
+			sum += row[k];
+		}
+
+		// unity gain at DC for every phase
+		for (k = 0; k < taps; k++) {
+			row[k] /= sum;
+		}
+	}
+}
+
+netjack_resampler_t *
+netjack_resampler_new (int channels, jack_nframes_t in_frames, jack_nframes_t out_frames, int quality)
+{
+	netjack_resampler_t *rs;
+	int g, j, stretch;
+	double fc;
+
+	if (channels <= 0 || in_frames == 0 || out_frames == 0 ||
+	    quality <= NETJACK_RESAMPLE_SRC || quality > NETJACK_RESAMPLE_BEST) {
+		return NULL;
+	}
+
+	rs = calloc (1, sizeof(netjack_resampler_t));
+	if (rs == NULL) {
+		return NULL;
+	}
+
+	g = gcd (in_frames, out_frames);
+	rs->channels = channels;
+	rs->in_frames = in_frames;
+	rs->out_frames = out_frames;
+	rs->up = out_frames / g;
+	rs->down = in_frames / g;
+
+	// when decimating, the cutoff drops by up/down, and the filter
+	// has to get that much longer to keep its transition band
+	stretch = (rs->down + rs->up - 1) / rs->up;
+	rs->taps = (netjack_resample_quality[quality].taps * stretch + 3) & ~3;
+
+	rs->hist_stride = rs->taps - 1 + in_frames;
+	rs->filter = malloc (sizeof(float) * rs->up * rs->taps);
+	rs->first = malloc (sizeof(int) * out_frames);
+	rs->phase = malloc (sizeof(int) * out_frames);
+	rs->hist = calloc (channels * rs->hist_stride, sizeof(float));
+	rs->out = calloc (channels * out_frames, sizeof(float));
+
+	if (!rs->filter || !rs->first || !rs->phase || !rs->hist || !rs->out) {
+		netjack_resampler_free (rs);
+		return NULL;
+	}
+
+	fc = 0.5 * netjack_resample_quality[quality].rolloff;
+	if (rs->down > rs->up) {
+		fc = fc * rs->up / rs->down;
+	}
+	netjack_resample_design (rs->filter, rs->up, rs->up, rs->taps, fc,
+				 netjack_resample_quality[quality].beta);
+
+	for (j = 0; j < out_frames; j++) {
+		rs->first[j] = ((long long)j * rs->down) / rs->up;
+		rs->phase[j] = ((long long)j * rs->down) % rs->up;
+	}
+
+	return rs;
+}
+
+void
+netjack_resampler_free (netjack_resampler_t *rs)
+{
+	if (rs == NULL) {
+		return;
+	}
+	free (rs->filter);
+	free (rs->first);
+	free (rs->phase);
+	free (rs->hist);
+	free (rs->out);
+	free (rs);
+}
+
+float *
+netjack_resampler_input (netjack_resampler_t *rs, int chn)
+{
+	return rs->hist + chn * rs->hist_stride + rs->taps - 1;
+}
+
+float *
+netjack_resampler_output (netjack_resampler_t *rs, int chn)
+{
+	return rs->out + chn * rs->out_frames;
+}
+
+jack_nframes_t
+netjack_resampler_latency (netjack_resampler_t *rs)
+{
+	return (rs->taps / 2) * rs->out_frames / rs->in_frames;
+}
+
+static inline float
+netjack_resample_dot (const float *h, const float *x, int taps)
+{
+#if defined(__SSE__)
+	__m128 a0 = _mm_setzero_ps ();
+	__m128 a1 = _mm_setzero_ps ();
+	float r[4];
+	int k = 0;
+
+	for (; k + 8 <= taps; k += 8) {
+		a0 = _mm_add_ps (a0, _mm_mul_ps (_mm_loadu_ps (h + k), _mm_loadu_ps (x + k)));
+		a1 = _mm_add_ps (a1, _mm_mul_ps (_mm_loadu_ps (h + k + 4), _mm_loadu_ps (x + k + 4)));
+	}
+	if (k < taps) {
+		a0 = _mm_add_ps (a0, _mm_mul_ps (_mm_loadu_ps (h + k), _mm_loadu_ps (x + k)));
+	}
+	_mm_storeu_ps (r, _mm_add_ps (a0, a1));
+	return (r[0] + r[1]) + (r[2] + r[3]);
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	float32x4_t a0 = vdupq_n_f32 (0.0f);
+	float32x4_t a1 = vdupq_n_f32 (0.0f);
+	float32x2_t s;
+	int k = 0;
+
+	for (; k + 8 <= taps; k += 8) {
+		a0 = vmlaq_f32 (a0, vld1q_f32 (h + k), vld1q_f32 (x + k));
+		a1 = vmlaq_f32 (a1, vld1q_f32 (h + k + 4), vld1q_f32 (x + k + 4));
+	}
+	if (k < taps) {
+		a0 = vmlaq_f32 (a0, vld1q_f32 (h + k), vld1q_f32 (x + k));
+	}
+	a0 = vaddq_f32 (a0, a1);
+	s = vadd_f32 (vget_low_f32 (a0), vget_high_f32 (a0));
+	return vget_lane_f32 (vpadd_f32 (s, s), 0);
+#else
+	float sum = 0.0f;
+	int k;
+
+	for (k = 0; k < taps; k++) {
+		sum += h[k] * x[k];
+	}
+	return sum;
+#endif
+}
+
+void
+netjack_resampler_process (netjack_resampler_t *rs)
+{
+	int taps = rs->taps;
+	int chn;
+	jack_nframes_t j;
+
+	for (j = 0; j < rs->out_frames; j++) {
+		const float *h = rs->filter + rs->phase[j] * taps;
+		const float *x = rs->hist + rs->first[j];
+		float *out = rs->out + j;
+
+		for (chn = 0; chn < rs->channels; chn++) {
+			*out = netjack_resample_dot (h, x, taps);
+			x += rs->hist_stride;
+			out += rs->out_frames;
+		}
+	}
+
+	// the end of this period is the history of the next one
+	for (chn = 0; chn < rs->channels; chn++) {
+		float *row = rs->hist + chn * rs->hist_stride;
+		memmove (row, row + rs->in_frames, sizeof(float) * (taps - 1));
+	}
+}
+
+// The drift resampler keeps the input of every channel in a row of
+// hist, hist_fill frames of it so far, and the position of the next
+// output frame in there as a fraction. An output frame at position p
+// runs the window from frame (int)p on through the two filter rows on
+// either side of the fraction and interpolates between the results;
+// with NETJACK_DRIFT_PHASES rows that is as good as the filter for the
+// small ratios this sees. After a period the frames no later output
+// can reach are dropped from the front.
+
+#define NETJACK_DRIFT_PHASES 32
+
+struct _netjack_drift {
+	int channels;
+	int taps;
+	jack_nframes_t out_frames;
+
+	float *filter;          // NETJACK_DRIFT_PHASES + 1 rows of taps
+
+	int hist_stride;
+	float *hist;            // channels rows of hist_stride
+	jack_nframes_t hist_fill;
+	jack_nframes_t pending; // asked for by the last netjack_drift_need()
+	double pos;
+
+	float *out;             // channels rows of out_frames
+};
+
+static double
+netjack_drift_clamp (double ratio)
+{
+	if (ratio < 1.0 - NETJACK_DRIFT_MAX) {
+		return 1.0 - NETJACK_DRIFT_MAX;
+	}
+	if (ratio > 1.0 + NETJACK_DRIFT_MAX) {
+		return 1.0 + NETJACK_DRIFT_MAX;
+	}
+	return ratio;
+}
+
+netjack_drift_t *
+netjack_drift_new (int channels, jack_nframes_t out_frames, int quality)
+{
+	netjack_drift_t *d;
+
+	if (quality <= NETJACK_RESAMPLE_SRC || quality > NETJACK_RESAMPLE_BEST) {
+		quality = NETJACK_RESAMPLE_MEDIUM;
+	}
+	if (channels <= 0 || out_frames == 0) {
+		return NULL;
+	}
+
+	d = calloc (1, sizeof(netjack_drift_t));
+	if (d == NULL) {
+		return NULL;
+	}
+
+	d->channels = channels;
+	d->out_frames = out_frames;
+	d->taps = (netjack_resample_quality[quality].taps + 3) & ~3;
+
+	d->hist_stride = 2 * d->taps + netjack_drift_max_need (d);
+	d->filter = malloc (sizeof(float) * (NETJACK_DRIFT_PHASES + 1) * d->taps);
+	d->hist = calloc (channels * d->hist_stride, sizeof(float));
+	d->out = calloc (channels * out_frames, sizeof(float));
+
+	if (!d->filter || !d->hist || !d->out) {
+		netjack_drift_free (d);
+		return NULL;
+	}
+
+	// the cutoff leaves room for the input running fast
+	netjack_resample_design (d->filter, NETJACK_DRIFT_PHASES + 1, NETJACK_DRIFT_PHASES, d->taps,
+				 0.5 * netjack_resample_quality[quality].rolloff / (1.0 + NETJACK_DRIFT_MAX),
+				 netjack_resample_quality[quality].beta);
+
+	// start on a window of silence
+	d->hist_fill = d->taps - 1;
+
+	return d;
+}
+
+void
+netjack_drift_free (netjack_drift_t *d)
+{
+	if (d == NULL) {
+		return;
+	}
+	free (d->filter);
+	free (d->hist);
+	free (d->out);
+	free (d);
+}
+
+jack_nframes_t
+netjack_drift_max_need (netjack_drift_t *d)
+{
+	return (jack_nframes_t)ceil (d->out_frames * (1.0 + NETJACK_DRIFT_MAX)) + 4;
+}
+
+jack_nframes_t
+netjack_drift_need (netjack_drift_t *d, double ratio)
+{
+	double last = d->pos + (d->out_frames - 1) * netjack_drift_clamp (ratio);
+	long end = (long)last + d->taps;
+
+	d->pending = end > (long)d->hist_fill ? end - d->hist_fill : 0;
+	return d->pending;
+}
+
+float *
+netjack_drift_input (netjack_drift_t *d, int chn)
+{
+	return d->hist + chn * d->hist_stride + d->hist_fill;
+}
+
+float *
+netjack_drift_output (netjack_drift_t *d, int chn)
+{
+	return d->out + chn * d->out_frames;
+}
+
+jack_nframes_t
+netjack_drift_latency (netjack_drift_t *d)
+{
+	return d->taps / 2;
+}
+
+void
+netjack_drift_process (netjack_drift_t *d, double ratio)
+{
+	int taps = d->taps;
+	jack_nframes_t j, drop;
+	int chn;
+
+	ratio = netjack_drift_clamp (ratio);
+	d->hist_fill += d->pending;
+	d->pending = 0;
+
+	for (j = 0; j < d->out_frames; j++) {
+		double p = d->pos + j * ratio;
+		int first = (int)p;
+		double f = (p - first) * NETJACK_DRIFT_PHASES;
+		int row = (int)f;
+		float a = (float)(f - row);
+		const float *h0 = d->filter + row * taps;
+		const float *h1 = h0 + taps;
+		const float *x = d->hist + first;
+		float *out = d->out + j;
+
+		for (chn = 0; chn < d->channels; chn++) {
+			float y0 = netjack_resample_dot (h0, x, taps);
+			float y1 = netjack_resample_dot (h1, x, taps);
+
+			*out = y0 + a * (y1 - y0);
+			x += d->hist_stride;
+			out += d->out_frames;
+		}
+	}
+
+	d->pos += d->out_frames * ratio;
+	drop = (jack_nframes_t)d->pos;
+	if (drop > d->hist_fill) {
+		drop = d->hist_fill;
+	}
+	d->pos -= drop;
+	d->hist_fill -= drop;
+
+	for (chn = 0; chn < d->channels; chn++) {
+		float *row = d->hist + chn * d->hist_stride;
+		memmove (row, row + drop, sizeof(float) * d->hist_fill);
+	}
+}
@@ -0,0 +1,92 @@
+
+/*
+ * NetJack - built-in polyphase resampler
+ *
+ * Converts the audio ports of one direction between the jack period
+ * and the (reduced) network period. The ratio never changes while the
+ * driver runs, so the filter is designed once, and every period
+ * consumes exactly in_frames and produces exactly out_frames.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef __JACK_NET_RESAMPLE_H__
+#define __JACK_NET_RESAMPLE_H__
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <jack/types.h>
+
+// Values of the resample-quality driver parameter. 0 keeps using
+// libsamplerate's linear converter, the others pick the built-in
+// filter length.
+#define NETJACK_RESAMPLE_SRC    0
+#define NETJACK_RESAMPLE_FAST   1
+#define NETJACK_RESAMPLE_MEDIUM 2
+#define NETJACK_RESAMPLE_BEST   3
+
+typedef struct _netjack_resampler netjack_resampler_t;
+
+netjack_resampler_t *netjack_resampler_new(int channels, jack_nframes_t in_frames, jack_nframes_t out_frames, int quality);
+void netjack_resampler_free(netjack_resampler_t *rs);
+
+// Where a period of channel chn goes in (in_frames samples), and where
+// it comes out after netjack_resampler_process() (out_frames samples).
+float *netjack_resampler_input(netjack_resampler_t *rs, int chn);
+float *netjack_resampler_output(netjack_resampler_t *rs, int chn);
+
+void netjack_resampler_process(netjack_resampler_t *rs);
+
+// Delay added by the filter, in output frames.
+jack_nframes_t netjack_resampler_latency(netjack_resampler_t *rs);
+
+// Drift resampler
+//
+// Converts between two clocks of the same nominal rate whose ratio is
+// only known as it goes, as when the driver follows the local clock.
+// Every period produces exactly out_frames and consumes however many
+// input frames the ratio (input frames per output frame) asks for;
+// netjack_drift_need() says how many, and they go to
+// netjack_drift_input() of each channel before netjack_drift_process()
+// is called with the same ratio. Ratios further than NETJACK_DRIFT_MAX
+// from 1 are clamped.
+
+#define NETJACK_DRIFT_MAX 0.01
+
+typedef struct _netjack_drift netjack_drift_t;
+
+netjack_drift_t *netjack_drift_new(int channels, jack_nframes_t out_frames, int quality);
+void netjack_drift_free(netjack_drift_t *d);
+
+jack_nframes_t netjack_drift_need(netjack_drift_t *d, double ratio);
+float *netjack_drift_input(netjack_drift_t *d, int chn);
+float *netjack_drift_output(netjack_drift_t *d, int chn);
+
+void netjack_drift_process(netjack_drift_t *d, double ratio);
+
+// The most netjack_drift_need() ever asks for.
+jack_nframes_t netjack_drift_max_need(netjack_drift_t *d);
+
+// Delay added by the filter, in input frames.
+jack_nframes_t netjack_drift_latency(netjack_drift_t *d);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -55,6 +55,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/soundcard.h>
 
 #include <jack/types.h>
@@ -62,6 +63,7 @@
 
 #include "internal.h"
 #include "engine.h"
+#include "atomicity.h"
 
 #include <sysdeps/time.h>
 
@@ -77,7 +79,7 @@
 #endif  /* _SIOWR */
 #endif  /* SNDCTL_DSP_COOKEDMODE */
 
-#define OSS_DRIVER_N_PARAMS     11
+#define OSS_DRIVER_N_PARAMS     14
 const static jack_driver_param_desc_t oss_params[OSS_DRIVER_N_PARAMS] = {
 	{ "rate",
 	    'r',
@@ -155,7 +157,34 @@ const static jack_driver_param_desc_t oss_params[OSS_DRIVER_N_PARAMS] = {
 	    { .ui = 0 },
 	    NULL,
 	    "system output latency",
-	    "system output latency" }
+	    "system output latency" },
+	{ "dither",
+	    'z',
+	    JackDriverParamChar,
+	    { .c = 'n' },
+	    NULL,
+	    "dithering mode",
+	    "dithering mode:\n"
+	    "  n - none\n"
+	    "  r - rectangular\n"
+	    "  s - shaped\n"
+	    "  t - triangular" },
+	{ "direct",
+	    'd',
+	    JackDriverParamBool,
+	    { },
+	    NULL,
+	    "run the cycle in the I/O thread",
+	    "read, process and write in one thread when capture and\n"
+	    "playback periods line up, instead of one thread for each" },
+	{ "mmap",
+	    'm',
+	    JackDriverParamBool,
+	    { },
+	    NULL,
+	    "use the DMA buffer directly",
+	    "map the device's DMA buffer and follow its pointer instead\n"
+	    "of using read()/write(), where the device supports it" }
 };
 
 
@@ -204,101 +233,85 @@ static inline void driver_cycle (oss_driver_t *driver)
 }
 
 
-static void copy_and_convert_in (jack_sample_t *dst, void *src,
-				 size_t nframes, int channel, int chcount, int bits)
+static void oss_driver_setup_io_function_pointers (oss_driver_t *driver)
 {
-	int srcidx;
-	int dstidx;
-	signed short *s16src = (signed short*)src;
-	signed int *s32src = (signed int*)src;
-	double *f64src = (double*)src;
-	jack_sample_t scale;
-
-	srcidx = channel;
-	switch (bits) {
-	case 16:
-		scale = 1.0f / 0x7fff;
-		for (dstidx = 0; dstidx < nframes; dstidx++) {
-			dst[dstidx] = (jack_sample_t)
-				      s16src[srcidx] * scale;
-			srcidx += chcount;
-		}
-		break;
+	MemopsReadFunction read_func;
+	MemopsWriteFunction write_func;
+
+	switch (driver->bits) {
 	case 24:
-		scale = 1.0f / 0x7fffff;
-		for (dstidx = 0; dstidx < nframes; dstidx++) {
-			dst[dstidx] = (jack_sample_t)
-				      s32src[srcidx] * scale;
-			srcidx += chcount;
-		}
+		driver->sample_bytes = sizeof(int32_t);
+		driver->read_via_copy = sample_move_dS_s32l24;
+		driver->write_via_copy = sample_move_d32l24_sS;
 		break;
 	case 32:
-		scale = 1.0f / 0x7fffffff;
-		for (dstidx = 0; dstidx < nframes; dstidx++) {
-			dst[dstidx] = (jack_sample_t)
-				      s32src[srcidx] * scale;
-			srcidx += chcount;
-		}
+		driver->sample_bytes = sizeof(int32_t);
+		driver->read_via_copy = sample_move_dS_s32u24;
+		driver->write_via_copy = sample_move_d32u24_sS;
 		break;
 	case 64:
-		for (dstidx = 0; dstidx < nframes; dstidx++) {
-			dst[dstidx] = (jack_sample_t)f64src[srcidx];
-			srcidx += chcount;
+		driver->sample_bytes = sizeof(double);
+		driver->read_via_copy = sample_move_dS_sdouble;
+		driver->write_via_copy = sample_move_ddouble_sS;
+		break;
+	case 16:
+	default:
+		driver->sample_bytes = sizeof(int16_t);
+		driver->read_via_copy = sample_move_dS_s16;
+		switch (driver->dither) {
+		case Rectangular:
+			jack_info ("OSS: rectangular dithering at 16 bits");
+			driver->write_via_copy = sample_move_dither_rect_d16_sS;
+			break;
+		case Triangular:
+			jack_info ("OSS: triangular dithering at 16 bits");
+			driver->write_via_copy = sample_move_dither_tri_d16_sS;
+			break;
+		case Shaped:
+			jack_info ("OSS: noise-shaped dithering at 16 bits");
+			driver->write_via_copy = sample_move_dither_shaped_d16_sS;
+			break;
+		default:
+			driver->write_via_copy = sample_move_d16_sS;
+			break;
 		}
 		break;
 	}
+
+	/* swap in vectorized converters where this CPU has them */
+
+	read_func = driver->read_via_copy;
+	driver->read_via_copy = memops_simd_read_function (read_func);
+	write_func = driver->write_via_copy;
+	driver->write_via_copy = memops_simd_write_function (write_func);
+	if (driver->read_via_copy != read_func ||
+	    driver->write_via_copy != write_func) {
+		jack_info ("OSS: %s sample conversion", memops_simd_name ());
+	}
 }
 
 
-static void copy_and_convert_out (void *dst, jack_sample_t *src,
-				  size_t nframes, int channel, int chcount, int bits)
+static int dither_opt (char c, DitherAlgorithm *dither)
 {
-	int srcidx;
-	int dstidx;
-	signed short *s16dst = (signed short*)dst;
-	signed int *s32dst = (signed int*)dst;
-	double *f64dst = (double*)dst;
-	jack_sample_t scale;
-
-	dstidx = channel;
-	switch (bits) {
-	case 16:
-		scale = 0x7fff;
-		for (srcidx = 0; srcidx < nframes; srcidx++) {
-			s16dst[dstidx] = (signed short)
-					 (src[srcidx] >= 0.0f) ?
-					 (src[srcidx] * scale + 0.5f) :
-					 (src[srcidx] * scale - 0.5f);
-			dstidx += chcount;
-		}
+	switch (c) {
+	case '-':
+	case 'n':
+		*dither = None;
 		break;
-	case 24:
-		scale = 0x7fffff;
-		for (srcidx = 0; srcidx < nframes; srcidx++) {
-			s32dst[dstidx] = (signed int)
-					 (src[srcidx] >= 0.0f) ?
-					 (src[srcidx] * scale + 0.5f) :
-					 (src[srcidx] * scale - 0.5f);
-			dstidx += chcount;
-		}
+	case 'r':
+		*dither = Rectangular;
 		break;
-	case 32:
-		scale = 0x7fffffff;
-		for (srcidx = 0; srcidx < nframes; srcidx++) {
-			s32dst[dstidx] = (signed int)
-					 (src[srcidx] >= 0.0f) ?
-					 (src[srcidx] * scale + 0.5f) :
-					 (src[srcidx] * scale - 0.5f);
-			dstidx += chcount;
-		}
+	case 's':
+		*dither = Shaped;
 		break;
-	case 64:
-		for (srcidx = 0; srcidx < nframes; srcidx++) {
-			f64dst[dstidx] = (double)src[srcidx];
-			dstidx += chcount;
-		}
+	case 't':
+		*dither = Triangular;
 		break;
+	default:
+		jack_error ("OSS: illegal dithering mode %c", c);
+		return -1;
 	}
+	return 0;
 }
 
 
@@ -330,6 +343,356 @@ static int get_fragment (int fd)
 
 
 static void *io_thread(void *);
+static void *mmap_thread(void *);
+
+
+/* mmap mode.  the device runs through its DMA buffers on its own once
+   triggered, and SNDCTL_DSP_GETIPTR/GETOPTR tell how far it has got.
+   one thread waits on those pointers and runs the cycle, and the engine
+   converts each period straight between the ports and the DMA buffer.
+   nperiods periods are kept queued for playback, as with write(). */
+
+
+static void oss_driver_mmap_free (oss_driver_t *driver)
+{
+	if (driver->inmap != NULL) {
+		munmap (driver->inmap, driver->inmapsize);
+		driver->inmap = NULL;
+	}
+	if (driver->outmap != NULL) {
+		munmap (driver->outmap, driver->outmapsize);
+		driver->outmap = NULL;
+	}
+	driver->mmapped = 0;
+}
+
+
+static void *oss_driver_mmap_buffer (int fd, int input, size_t *size)
+{
+	audio_buf_info info;
+	void *map;
+
+	if (ioctl (fd, input ? SNDCTL_DSP_GETISPACE : SNDCTL_DSP_GETOSPACE,
+		   &info) < 0) {
+		jack_error ("OSS: failed to get buffer size: %s@%i, errno=%d",
+			    __FILE__, __LINE__, errno);
+		return NULL;
+	}
+	*size = (size_t)info.fragstotal * info.fragsize;
+	map = mmap (NULL, *size, input ? PROT_READ : PROT_WRITE,
+		    MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+	return map;
+}
+
+
+static int oss_driver_mmap_setup (oss_driver_t *driver)
+{
+	int caps;
+	int trigger = 0;
+
+	if (driver->infd >= 0) {
+		if (ioctl (driver->infd, SNDCTL_DSP_GETCAPS, &caps) < 0 ||
+		    !(caps & DSP_CAP_MMAP) || !(caps & DSP_CAP_TRIGGER)) {
+			return -1;
+		}
+		driver->inmap = oss_driver_mmap_buffer (driver->infd, 1,
+							&driver->inmapsize);
+		if (driver->inmap == NULL ||
+		    driver->inmapsize < 2 * driver->indevbufsize) {
+			goto fail;
+		}
+	}
+
+	if (driver->outfd >= 0) {
+		if (ioctl (driver->outfd, SNDCTL_DSP_GETCAPS, &caps) < 0 ||
+		    !(caps & DSP_CAP_MMAP) || !(caps & DSP_CAP_TRIGGER)) {
+			goto fail;
+		}
+		driver->outmap = oss_driver_mmap_buffer (driver->outfd, 0,
+							 &driver->outmapsize);
+		if (driver->outmap == NULL ||
+		    driver->outmapsize <
+		    driver->nperiods * driver->outdevbufsize) {
+			goto fail;
+		}
+	}
+
+	/* stopped until the mmap thread starts them */
+	if (driver->infd >= 0) {
+		ioctl (driver->infd, SNDCTL_DSP_SETTRIGGER, &trigger);
+	}
+	if (driver->outfd >= 0 && driver->outfd != driver->infd) {
+		ioctl (driver->outfd, SNDCTL_DSP_SETTRIGGER, &trigger);
+	}
+
+	driver->mmapped = 1;
+	jack_info ("oss_driver: inmap %zd B, outmap %zd B",
+		   driver->inmapsize, driver->outmapsize);
+
+	return 0;
+
+fail:
+	/* capture and playback both mapped or neither */
+	oss_driver_mmap_free (driver);
+	return -1;
+}
+
+
+static int oss_driver_mmap_pointer (int fd, int input, count_info *ptr)
+{
+	if (ioctl (fd, input ? SNDCTL_DSP_GETIPTR : SNDCTL_DSP_GETOPTR,
+		   ptr) < 0) {
+		jack_error ("OSS: failed to get DMA pointer: %s@%i, errno=%d",
+			    __FILE__, __LINE__, errno);
+		return -1;
+	}
+	return 0;
+}
+
+
+/* silence the playback buffer and start both directions, with nperiods
+   periods queued for playback and nothing to capture */
+static int oss_driver_mmap_trigger (oss_driver_t *driver)
+{
+	count_info ptr;
+	size_t prime;
+	int trigger;
+
+	if (driver->outmap != NULL) {
+		memset (driver->outmap, 0x00, driver->outmapsize);
+		prime = driver->nperiods * driver->outdevbufsize;
+		if (oss_driver_mmap_pointer (driver->outfd, 0, &ptr) < 0) {
+			return -1;
+		}
+		driver->out_pos = (uint32_t)ptr.bytes + prime;
+		driver->out_ofs = (ptr.ptr + prime) % driver->outmapsize;
+	}
+	if (driver->inmap != NULL) {
+		if (oss_driver_mmap_pointer (driver->infd, 1, &ptr) < 0) {
+			return -1;
+		}
+		driver->in_pos = (uint32_t)ptr.bytes;
+		driver->in_ofs = ptr.ptr;
+	}
+
+	if (driver->infd >= 0 && driver->infd == driver->outfd) {
+		trigger = PCM_ENABLE_INPUT | PCM_ENABLE_OUTPUT;
+		return ioctl (driver->infd, SNDCTL_DSP_SETTRIGGER, &trigger);
+	}
+	if (driver->outfd >= 0) {
+		trigger = PCM_ENABLE_OUTPUT;
+		if (ioctl (driver->outfd, SNDCTL_DSP_SETTRIGGER, &trigger) < 0) {
+			return -1;
+		}
+	}
+	if (driver->infd >= 0) {
+		trigger = PCM_ENABLE_INPUT;
+		if (ioctl (driver->infd, SNDCTL_DSP_SETTRIGGER, &trigger) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+
+/* sleep until a period can be captured and no more than nperiods - 1
+   are queued for playback, catching up after xruns */
+static int oss_driver_mmap_wait (oss_driver_t *driver)
+{
+	count_info ptr;
+	struct timespec ts;
+	jack_time_t wait_enter;
+	jack_nframes_t need, frames;
+	uint32_t queued, avail;
+	size_t limit;
+
+	wait_enter = driver->engine->get_microseconds ();
+
+	while (driver->run) {
+		need = 0;
+
+		if (driver->outmap != NULL) {
+			if (oss_driver_mmap_pointer (driver->outfd, 0, &ptr) < 0) {
+				return -1;
+			}
+			queued = driver->out_pos - (uint32_t)ptr.bytes;
+			limit = (driver->nperiods - 1) * driver->outdevbufsize;
+			if ((int32_t)queued < 0) {
+				/* the DMA has run past what we wrote and is
+				   replaying old data.  silence the buffer and
+				   queue from where it is now. */
+				frames = ((uint32_t)ptr.bytes - driver->out_pos) /
+					 (driver->playback_channels *
+					  driver->sample_bytes);
+				jack_error ("OSS: playback xrun of %u frames",
+					    frames);
+				memset (driver->outmap, 0x00,
+					driver->outmapsize);
+				driver->out_pos = (uint32_t)ptr.bytes + limit;
+				driver->out_ofs = (ptr.ptr + limit) %
+						  driver->outmapsize;
+			} else if (queued > limit) {
+				need = (queued - limit) /
+				       (driver->playback_channels *
+					driver->sample_bytes);
+			}
+		}
+
+		if (driver->inmap != NULL) {
+			if (oss_driver_mmap_pointer (driver->infd, 1, &ptr) < 0) {
+				return -1;
+			}
+			avail = (uint32_t)ptr.bytes - driver->in_pos;
+			if (avail > driver->inmapsize - driver->indevbufsize) {
+				/* the DMA has recorded over what we had not
+				   read yet.  take the newest period. */
+				frames = (avail - driver->indevbufsize) /
+					 (driver->capture_channels *
+					  driver->sample_bytes);
+				jack_error ("OSS: capture xrun of %u frames",
+					    frames);
+				driver->in_pos = (uint32_t)ptr.bytes -
+						 driver->indevbufsize;
+				driver->in_ofs = (ptr.ptr + driver->inmapsize -
+						  driver->indevbufsize) %
+						 driver->inmapsize;
+			} else if (avail < driver->indevbufsize) {
+				frames = (driver->indevbufsize - avail) /
+					 (driver->capture_channels *
+					  driver->sample_bytes);
+				if (frames > need) {
+					need = frames;
+				}
+			}
+		}
+
+		if (need == 0) {
+			return 0;
+		}
+
+		if (driver->engine->get_microseconds () - wait_enter >
+		    4 * driver->period_usecs) {
+			jack_error ("OSS: DMA pointer stalled: %s@%i",
+				    __FILE__, __LINE__);
+			return -1;
+		}
+
+		ts.tv_sec = need / driver->sample_rate;
+		ts.tv_nsec = ((uint64_t)(need % driver->sample_rate) *
+			      1000000000) / driver->sample_rate;
+		nanosleep (&ts, NULL);
+	}
+
+	return -1;
+}
+
+
+/* convert between the ports and a period of DMA buffer, which may wrap.
+   ports that are not connected play silence. */
+static void oss_driver_mmap_read (oss_driver_t *driver,
+				  jack_nframes_t nframes)
+{
+	size_t frame_bytes;
+	jack_nframes_t done, frames;
+	int channel;
+	char *src;
+	jack_sample_t *portbuf;
+	JSList *node;
+	jack_port_t *port;
+
+	frame_bytes = driver->capture_channels * driver->sample_bytes;
+
+	for (done = 0; done < nframes; done += frames) {
+		frames = (driver->inmapsize - driver->in_ofs) / frame_bytes;
+		if (frames > nframes - done) {
+			frames = nframes - done;
+		}
+		src = (char*)driver->inmap + driver->in_ofs;
+
+		node = driver->capture_ports;
+		channel = 0;
+		while (node != NULL) {
+			port = (jack_port_t*)node->data;
+
+			if (jack_port_connected (port)) {
+				portbuf = jack_port_get_buffer (port, nframes);
+				driver->read_via_copy (portbuf + done,
+						       src + channel *
+						       driver->sample_bytes,
+						       frames, frame_bytes);
+			}
+
+			node = jack_slist_next (node);
+			channel++;
+		}
+
+		driver->in_pos += frames * frame_bytes;
+		driver->in_ofs = (driver->in_ofs + frames * frame_bytes) %
+				 driver->inmapsize;
+	}
+}
+
+
+static void oss_driver_mmap_skip (oss_driver_t *driver,
+				  jack_nframes_t nframes)
+{
+	size_t nbytes;
+
+	nbytes = nframes * driver->capture_channels * driver->sample_bytes;
+	driver->in_pos += nbytes;
+	driver->in_ofs = (driver->in_ofs + nbytes) % driver->inmapsize;
+}
+
+
+static void oss_driver_mmap_write (oss_driver_t *driver,
+				   jack_nframes_t nframes, int silence)
+{
+	size_t frame_bytes;
+	jack_nframes_t done, frames;
+	int channel;
+	char *dst;
+	jack_sample_t *portbuf;
+	JSList *node;
+	jack_port_t *port;
+
+	frame_bytes = driver->playback_channels * driver->sample_bytes;
+
+	for (done = 0; done < nframes; done += frames) {
+		frames = (driver->outmapsize - driver->out_ofs) / frame_bytes;
+		if (frames > nframes - done) {
+			frames = nframes - done;
+		}
+		dst = (char*)driver->outmap + driver->out_ofs;
+
+		memset (dst, 0x00, frames * frame_bytes);
+
+		node = silence ? NULL : driver->playback_ports;
+		channel = 0;
+		while (node != NULL) {
+			port = (jack_port_t*)node->data;
+
+			if (jack_port_connected (port)) {
+				portbuf = jack_port_get_buffer (port, nframes);
+				driver->write_via_copy (dst + channel *
+							driver->sample_bytes,
+							portbuf + done, frames,
+							frame_bytes,
+							driver->dither_state +
+							channel);
+			}
+
+			node = jack_slist_next (node);
+			channel++;
+		}
+
+		driver->out_pos += frames * frame_bytes;
+		driver->out_ofs = (driver->out_ofs + frames * frame_bytes) %
+				  driver->outmapsize;
+	}
+}
 
 
 /* jack driver interface */
@@ -436,28 +799,20 @@ static int oss_driver_start (oss_driver_t *driver)
 	int infd = driver->infd;
 	int outfd = driver->outfd;
 	unsigned int period_size;
+	unsigned int in_period = 0;
+	unsigned int out_period = 0;
 	size_t samplesize;
 	size_t fragsize;
 	const char *indev = driver->indev;
 	const char *outdev = driver->outdev;
 
-	switch (driver->bits) {
-	case 24:
-	case 32:
-		samplesize = sizeof(int);
-		break;
-	case 64:
-		samplesize = sizeof(double);
-		break;
-	case 16:
-	default:
-		samplesize = sizeof(short);
-		break;
-	}
+	samplesize = driver->sample_bytes;
 	driver->trigger = 0;
 	if (strcmp (indev, outdev) != 0) {
 		if (driver->capture_channels > 0) {
-			infd = open (indev, O_RDONLY | O_EXCL);
+			/* OSS maps only devices open for both */
+			infd = open (indev, (driver->use_mmap ?
+					     O_RDWR : O_RDONLY) | O_EXCL);
 			if (infd < 0) {
 				jack_error (
 					"OSS: failed to open input device %s: %s@%i, errno=%d",
@@ -472,7 +827,8 @@ static int oss_driver_start (oss_driver_t *driver)
 		} else { infd = -1; }
 
 		if (driver->playback_channels > 0) {
-			outfd = open (outdev, O_WRONLY | O_EXCL);
+			outfd = open (outdev, (driver->use_mmap ?
+					       O_RDWR : O_WRONLY) | O_EXCL);
 			if (outfd < 0) {
 				jack_error (
 					"OSS: failed to open output device %s: %s@%i, errno=%d",
@@ -573,6 +929,7 @@ static int oss_driver_start (oss_driver_t *driver)
 			   format, channels, samplerate, get_fragment (infd));
 
 		period_size = get_fragment (infd) / samplesize / channels;
+		in_period = period_size;
 		if (period_size != driver->period_size &&
 		    !driver->ignorehwbuf) {
 			jack_info ("oss_driver: period size update: %u",
@@ -613,6 +970,7 @@ static int oss_driver_start (oss_driver_t *driver)
 			   get_fragment (outfd));
 
 		period_size = get_fragment (outfd) / samplesize / channels;
+		out_period = period_size;
 		if (period_size != driver->period_size &&
 		    !driver->ignorehwbuf) {
 			jack_info ("oss_driver: period size update: %u",
@@ -629,63 +987,96 @@ static int oss_driver_start (oss_driver_t *driver)
 		}
 	}
 
+	/* each direction has two period buffers: the engine works on one
+	   while the I/O threads move the other to or from the device, and
+	   they are swapped between cycles */
+
 	if (driver->capture_channels > 0) {
 		driver->indevbufsize = driver->period_size *
 				       driver->capture_channels * samplesize;
-		driver->indevbuf = malloc (driver->indevbufsize);
+		driver->indevbuf = calloc (2, driver->indevbufsize);
 		if (driver->indevbuf == NULL) {
 			jack_error ( "OSS: malloc() failed: %s@%i",
 				     __FILE__, __LINE__);
 			return -1;
 		}
-		memset (driver->indevbuf, 0x00, driver->indevbufsize);
+		driver->inbackbuf = (char*)driver->indevbuf +
+				    driver->indevbufsize;
 	} else {
 		driver->indevbufsize = 0;
 		driver->indevbuf = NULL;
+		driver->inbackbuf = NULL;
 	}
 
 	if (driver->playback_channels > 0) {
 		driver->outdevbufsize = driver->period_size *
 					driver->playback_channels * samplesize;
-		driver->outdevbuf = malloc (driver->outdevbufsize);
+		driver->outdevbuf = calloc (2, driver->outdevbufsize);
 		if (driver->outdevbuf == NULL) {
 			jack_error ("OSS: malloc() failed: %s@%i",
 				    __FILE__, __LINE__);
 			return -1;
 		}
-		memset (driver->outdevbuf, 0x00, driver->outdevbufsize);
+		driver->outbackbuf = (char*)driver->outdevbuf +
+				     driver->outdevbufsize;
 	} else {
 		driver->outdevbufsize = 0;
 		driver->outdevbuf = NULL;
+		driver->outbackbuf = NULL;
 	}
+	driver->inbufs = driver->indevbuf;
+	driver->outbufs = driver->outdevbuf;
 
 	jack_info ("oss_driver: indevbuf %zd B, outdevbuf %zd B",
 		   driver->indevbufsize, driver->outdevbufsize);
 
-	pthread_mutex_init (&driver->mutex_in, NULL);
-	pthread_mutex_init (&driver->mutex_out, NULL);
-#       ifdef USE_BARRIER
-	puts ("oss_driver: using barrier mode, (dual thread)");
-	pthread_barrier_init (&driver->barrier, NULL, 2);
-#       else
-	puts ("oss_driver: not using barrier mode, (single thread)");
-#       endif
+	if (driver->use_mmap && oss_driver_mmap_setup (driver) < 0) {
+		jack_info ("oss_driver: cannot map the DMA buffers, "
+			   "using read() and write()");
+	}
+
+	driver->arrivals = 0;
+	driver->handoff = 0;
+	sem_init (&driver->sem_handoff, 0, 0);
 	sem_init (&driver->sem_start, 0, 0);
 	driver->run = 1;
 	driver->threads = 0;
-	if (infd >= 0) {
+
+	/* with both directions open, either run one thread per direction
+	   that meet once per period, or read, process and write in a
+	   single thread, which needs the two fragment sizes to agree */
+
+	if (driver->mmapped) {
+		jack_info ("oss_driver: mmap I/O");
 		if (jack_client_create_thread (NULL, &driver->thread_in,
 					       driver->engine->rtpriority,
 					       driver->engine->control->real_time,
-					       io_thread, driver) < 0) {
+					       mmap_thread, driver) < 0) {
 			jack_error ("OSS: jack_client_create_thread() failed: %s@%i",
 				    __FILE__, __LINE__);
 			return -1;
 		}
 		driver->threads |= 1;
 	}
+
 #       ifdef USE_BARRIER
-	if (outfd >= 0) {
+	if (!driver->mmapped && infd >= 0 && outfd >= 0 &&
+	    !(driver->direct && (infd == outfd || in_period == out_period))) {
+		if (driver->direct) {
+			jack_info ("oss_driver: capture and playback periods "
+				   "differ (%u/%u), not running direct",
+				   in_period, out_period);
+		}
+		jack_info ("oss_driver: dual thread I/O");
+		if (jack_client_create_thread (NULL, &driver->thread_in,
+					       driver->engine->rtpriority,
+					       driver->engine->control->real_time,
+					       io_thread, driver) < 0) {
+			jack_error ("OSS: jack_client_create_thread() failed: %s@%i",
+				    __FILE__, __LINE__);
+			return -1;
+		}
+		driver->threads |= 1;
 		if (jack_client_create_thread (NULL, &driver->thread_out,
 					       driver->engine->rtpriority,
 					       driver->engine->control->real_time,
@@ -697,6 +1088,18 @@ static int oss_driver_start (oss_driver_t *driver)
 		driver->threads |= 2;
 	}
 #       endif
+	if (driver->threads == 0 && (infd >= 0 || outfd >= 0)) {
+		jack_info ("oss_driver: single thread I/O");
+		if (jack_client_create_thread (NULL, &driver->thread_in,
+					       driver->engine->rtpriority,
+					       driver->engine->control->real_time,
+					       io_thread, driver) < 0) {
+			jack_error ("OSS: jack_client_create_thread() failed: %s@%i",
+				    __FILE__, __LINE__);
+			return -1;
+		}
+		driver->threads |= 1;
+	}
 
 	if (driver->threads & 1) {
 		sem_post (&driver->sem_start);
@@ -718,6 +1121,10 @@ static int oss_driver_stop (oss_driver_t *driver)
 	void *retval;
 
 	driver->run = 0;
+	if (driver->threads == 3 && !jack_wakeup_supported ()) {
+		/* release a thread waiting for the other one */
+		sem_post (&driver->sem_handoff);
+	}
 	if (driver->threads & 1) {
 		if (pthread_join (driver->thread_in, &retval) < 0) {
 			jack_error ("OSS: pthread_join() failed: %s@%i",
@@ -732,12 +1139,11 @@ static int oss_driver_stop (oss_driver_t *driver)
 			return -1;
 		}
 	}
+	driver->threads = 0;
 	sem_destroy (&driver->sem_start);
-#       ifdef USE_BARRIER
-	pthread_barrier_destroy (&driver->barrier);
-#       endif
-	pthread_mutex_destroy (&driver->mutex_in);
-	pthread_mutex_destroy (&driver->mutex_out);
+	sem_destroy (&driver->sem_handoff);
+
+	oss_driver_mmap_free (driver);
 
 	if (driver->outfd >= 0 && driver->outfd != driver->infd) {
 		close (driver->outfd);
@@ -748,14 +1154,16 @@ static int oss_driver_stop (oss_driver_t *driver)
 		driver->infd = -1;
 	}
 
-	if (driver->indevbuf != NULL) {
-		free (driver->indevbuf);
-		driver->indevbuf = NULL;
+	if (driver->inbufs != NULL) {
+		free (driver->inbufs);
+		driver->inbufs = NULL;
 	}
-	if (driver->outdevbuf != NULL) {
-		free (driver->outdevbuf);
-		driver->outdevbuf = NULL;
+	driver->indevbuf = driver->inbackbuf = NULL;
+	if (driver->outbufs != NULL) {
+		free (driver->outbufs);
+		driver->outbufs = NULL;
 	}
+	driver->outdevbuf = driver->outbackbuf = NULL;
 
 	return 0;
 }
@@ -778,7 +1186,10 @@ static int oss_driver_read (oss_driver_t *driver, jack_nframes_t nframes)
 		return -1;
 	}
 
-	pthread_mutex_lock (&driver->mutex_in);
+	if (driver->mmapped) {
+		oss_driver_mmap_read (driver, nframes);
+		return 0;
+	}
 
 	node = driver->capture_ports;
 	channel = 0;
@@ -787,18 +1198,18 @@ static int oss_driver_read (oss_driver_t *driver, jack_nframes_t nframes)
 
 		if (jack_port_connected (port)) {
 			portbuf = jack_port_get_buffer (port, nframes);
-			copy_and_convert_in (portbuf, driver->indevbuf,
-					     nframes, channel,
-					     driver->capture_channels,
-					     driver->bits);
+			driver->read_via_copy (portbuf,
+					       (char*)driver->indevbuf +
+					       channel * driver->sample_bytes,
+					       nframes,
+					       driver->capture_channels *
+					       driver->sample_bytes);
 		}
 
 		node = jack_slist_next (node);
 		channel++;
 	}
 
-	pthread_mutex_unlock (&driver->mutex_in);
-
 	return 0;
 }
 
@@ -820,7 +1231,10 @@ static int oss_driver_write (oss_driver_t *driver, jack_nframes_t nframes)
 		return -1;
 	}
 
-	pthread_mutex_lock (&driver->mutex_out);
+	if (driver->mmapped) {
+		oss_driver_mmap_write (driver, nframes, 0);
+		return 0;
+	}
 
 	node = driver->playback_ports;
 	channel = 0;
@@ -829,31 +1243,40 @@ static int oss_driver_write (oss_driver_t *driver, jack_nframes_t nframes)
 
 		if (jack_port_connected (port)) {
 			portbuf = jack_port_get_buffer (port, nframes);
-			copy_and_convert_out (driver->outdevbuf, portbuf,
-					      nframes, channel,
-					      driver->playback_channels,
-					      driver->bits);
+			driver->write_via_copy ((char*)driver->outdevbuf +
+						channel * driver->sample_bytes,
+						portbuf, nframes,
+						driver->playback_channels *
+						driver->sample_bytes,
+						driver->dither_state + channel);
 		}
 
 		node = jack_slist_next (node);
 		channel++;
 	}
 
-	pthread_mutex_unlock (&driver->mutex_out);
-
 	return 0;
 }
 
 
 static int oss_driver_null_cycle (oss_driver_t *driver, jack_nframes_t nframes)
 {
-	pthread_mutex_lock (&driver->mutex_in);
-	memset (driver->indevbuf, 0x00, driver->indevbufsize);
-	pthread_mutex_unlock (&driver->mutex_in);
+	if (driver->mmapped) {
+		if (driver->outmap != NULL) {
+			oss_driver_mmap_write (driver, nframes, 1);
+		}
+		if (driver->inmap != NULL) {
+			oss_driver_mmap_skip (driver, nframes);
+		}
+		return 0;
+	}
 
-	pthread_mutex_lock (&driver->mutex_out);
-	memset (driver->outdevbuf, 0x00, driver->outdevbufsize);
-	pthread_mutex_unlock (&driver->mutex_out);
+	if (driver->indevbuf != NULL) {
+		memset (driver->indevbuf, 0x00, driver->indevbufsize);
+	}
+	if (driver->outdevbuf != NULL) {
+		memset (driver->outdevbuf, 0x00, driver->outdevbufsize);
+	}
 
 	return 0;
 }
@@ -879,147 +1302,175 @@ static int oss_driver_bufsize (oss_driver_t *driver, jack_nframes_t nframes)
 /* internal driver thread */
 
 
-#ifdef USE_BARRIER
-static inline void synchronize (oss_driver_t *driver)
+/* hand the periods just read and written over to the engine, and the
+   ones it used last cycle back to the I/O threads */
+static inline void swap_buffers (oss_driver_t *driver)
 {
-	if (driver->threads == 3) {
-		if (pthread_barrier_wait (&driver->barrier) ==
-		    PTHREAD_BARRIER_SERIAL_THREAD) {
-			driver_cycle (driver);
+	void *tmp;
+
+	tmp = driver->indevbuf;
+	driver->indevbuf = driver->inbackbuf;
+	driver->inbackbuf = tmp;
+
+	tmp = driver->outdevbuf;
+	driver->outdevbuf = driver->outbackbuf;
+	driver->outbackbuf = tmp;
+}
+
+
+static inline void handoff_wait (oss_driver_t *driver)
+{
+	if (jack_wakeup_supported ()) {
+		while (driver->run &&
+		       jack_wakeup_wait (&driver->handoff,
+					 4 * driver->period_usecs) == 0) {
 		}
 	} else {
-		driver_cycle (driver);
+		sem_wait (&driver->sem_handoff);
 	}
 }
-#endif
 
 
-static void *io_thread (void *param)
+static inline void handoff_post (oss_driver_t *driver)
 {
-	size_t localsize;
-	ssize_t io_res;
-	void *localbuf;
-	oss_driver_t *driver = (oss_driver_t*)param;
+	if (jack_wakeup_supported ()) {
+		jack_wakeup_post (&driver->handoff, JACK_WAKEUP_PROCESS);
+	} else {
+		sem_post (&driver->sem_handoff);
+	}
+}
 
-	sem_wait (&driver->sem_start);
 
-#       ifdef USE_BARRIER
-	if (pthread_self () == driver->thread_in) {
-		localsize = driver->indevbufsize;
-		localbuf = malloc (localsize);
-		if (localbuf == NULL) {
-			jack_error ("OSS: malloc() failed: %s@%i",
-				    __FILE__, __LINE__);
-			return NULL;
+/* Called by each I/O thread once its period is done. With two threads
+   the first to arrive sleeps; the second swaps the buffers, wakes it
+   and runs the cycle, so the other thread is back at its device while
+   the graph runs. */
+static inline void synchronize (oss_driver_t *driver)
+{
+	if (driver->threads == 3) {
+		if (exchange_and_add (&driver->arrivals, 1) == 0) {
+			handoff_wait (driver);
+			return;
 		}
+		driver->arrivals = 0;
+		swap_buffers (driver);
+		handoff_post (driver);
+	} else {
+		swap_buffers (driver);
+	}
+	driver_cycle (driver);
+}
 
-		while (driver->run) {
-			io_res = read (driver->infd, localbuf, localsize);
-			if (io_res < (ssize_t)localsize) {
-				jack_error (
-					"OSS: read() failed: %s@%i, count=%d/%d, errno=%d",
-					__FILE__, __LINE__, io_res, localsize,
-					errno);
-				break;
-			}
 
-			pthread_mutex_lock (&driver->mutex_in);
-			memcpy (driver->indevbuf, localbuf, localsize);
-			pthread_mutex_unlock (&driver->mutex_in);
+static int io_write (oss_driver_t *driver)
+{
+	ssize_t io_res;
 
-			synchronize (driver);
-		}
+	io_res = write (driver->outfd, driver->outbackbuf,
+			driver->outdevbufsize);
+	if (io_res < (ssize_t)driver->outdevbufsize) {
+		jack_error (
+			"OSS: write() failed: %s@%i, count=%d/%d, errno=%d",
+			__FILE__, __LINE__, io_res,
+			driver->outdevbufsize, errno);
+		return -1;
+	}
+	return 0;
+}
 
-		free (localbuf);
-	} else if (pthread_self () == driver->thread_out) {
-		localsize = driver->outdevbufsize;
-		localbuf = malloc (localsize);
-		if (localbuf == NULL) {
-			jack_error ("OSS: malloc() failed: %s@%i",
-				    __FILE__, __LINE__);
-			return NULL;
-		}
-		if (driver->trigger) {
-			/* don't care too much if this fails */
-			memset (localbuf, 0x00, localsize);
-			write (driver->outfd, localbuf, localsize);
-			ioctl (driver->outfd, SNDCTL_DSP_SETTRIGGER, &driver->trigger);
-		}
 
-		while (driver->run) {
-			pthread_mutex_lock (&driver->mutex_out);
-			memcpy (localbuf, driver->outdevbuf, localsize);
-			pthread_mutex_unlock (&driver->mutex_out);
+static int io_read (oss_driver_t *driver)
+{
+	ssize_t io_res;
 
-			io_res = write (driver->outfd, localbuf, localsize);
-			if (io_res < (ssize_t)localsize) {
-				jack_error (
-					"OSS: write() failed: %s@%i, count=%d/%d, errno=%d",
-					__FILE__, __LINE__, io_res, localsize,
-					errno);
-				break;
-			}
+	io_res = read (driver->infd, driver->inbackbuf,
+		       driver->indevbufsize);
+	if (io_res < (ssize_t)driver->indevbufsize) {
+		jack_error (
+			"OSS: read() failed: %s@%i, count=%d/%d, errno=%d",
+			__FILE__, __LINE__, io_res,
+			driver->indevbufsize, errno);
+		return -1;
+	}
+	return 0;
+}
 
-			synchronize (driver);
-		}
 
-		free (localbuf);
-	}
-#       else
-	localsize = (driver->indevbufsize >= driver->outdevbufsize) ?
-		    driver->indevbufsize : driver->outdevbufsize;
-	localbuf = malloc (localsize);
-	if (localbuf == NULL) {
-		jack_error ("OSS: malloc() failed: %s@%i", __FILE__, __LINE__);
-		return NULL;
-	}
+static void io_trigger (oss_driver_t *driver)
+{
 	if (driver->trigger) {
 		/* don't care too much if this fails */
-		memset (localbuf, 0x00, localsize);
-		write (driver->outfd, localbuf, driver->outdevbufsize);
+		write (driver->outfd, driver->outbackbuf,
+		       driver->outdevbufsize);
 		ioctl (driver->outfd, SNDCTL_DSP_SETTRIGGER, &driver->trigger);
 	}
+}
 
-	while (driver->run) {
-		if (driver->playback_channels > 0) {
-			pthread_mutex_lock (&driver->mutex_out);
-			memcpy (localbuf, driver->outdevbuf,
-				driver->outdevbufsize);
-			pthread_mutex_unlock (&driver->mutex_out);
-
-			io_res = write (driver->outfd, localbuf,
-					driver->outdevbufsize);
-			if (io_res < (ssize_t)driver->outdevbufsize) {
-				jack_error (
-					"OSS: write() failed: %s@%i, count=%d/%d, errno=%d",
-					__FILE__, __LINE__, io_res,
-					driver->outdevbufsize, errno);
-				break;
+
+static void *io_thread (void *param)
+{
+	oss_driver_t *driver = (oss_driver_t*)param;
+
+	sem_wait (&driver->sem_start);
+
+	if (driver->threads == 3) {
+		if (pthread_self () == driver->thread_in) {
+			while (driver->run) {
+				if (io_read (driver) < 0) {
+					break;
+				}
+				synchronize (driver);
+			}
+		} else {
+			io_trigger (driver);
+			while (driver->run) {
+				if (io_write (driver) < 0) {
+					break;
+				}
+				synchronize (driver);
 			}
 		}
+		return NULL;
+	}
 
-		if (driver->capture_channels > 0) {
-			io_res = read (driver->infd, localbuf,
-				       driver->indevbufsize);
-			if (io_res < (ssize_t)driver->indevbufsize) {
-				jack_error (
-					"OSS: read() failed: %s@%i, count=%d/%d, errno=%d",
-					__FILE__, __LINE__, io_res,
-					driver->indevbufsize, errno);
-				break;
-			}
+	if (driver->playback_channels > 0) {
+		io_trigger (driver);
+	}
 
-			pthread_mutex_lock (&driver->mutex_in);
-			memcpy (driver->indevbuf, localbuf,
-				driver->indevbufsize);
-			pthread_mutex_unlock (&driver->mutex_in);
+	while (driver->run) {
+		if (driver->playback_channels > 0 &&
+		    io_write (driver) < 0) {
+			break;
+		}
+		if (driver->capture_channels > 0 &&
+		    io_read (driver) < 0) {
+			break;
 		}
+		synchronize (driver);
+	}
 
-		driver_cycle (driver);
+	return NULL;
+}
+
+
+static void *mmap_thread (void *param)
+{
+	oss_driver_t *driver = (oss_driver_t*)param;
+
+	sem_wait (&driver->sem_start);
+
+	if (oss_driver_mmap_trigger (driver) < 0) {
+		jack_error ("OSS: failed to start DMA: %s@%i, errno=%d",
+			    __FILE__, __LINE__, errno);
+		return NULL;
 	}
 
-	free (localbuf);
-#       endif
+	while (driver->run) {
+		if (oss_driver_mmap_wait (driver) < 0) {
+			break;
+		}
+		driver_cycle (driver);
+	}
 
 	return NULL;
 }
@@ -1073,6 +1524,7 @@ jack_driver_t * driver_initialize (jack_client_t *client,
 	unsigned int nperiods = OSS_DRIVER_DEF_NPERIODS;
 	unsigned int capture_channels = OSS_DRIVER_DEF_INS;
 	unsigned int playback_channels = OSS_DRIVER_DEF_OUTS;
+	DitherAlgorithm dither = None;
 	const JSList *pnode;
 	const jack_driver_param_t *param;
 	oss_driver_t *driver;
@@ -1133,12 +1585,24 @@ jack_driver_t * driver_initialize (jack_client_t *client,
 		case 'b':
 			driver->ignorehwbuf = 1;
 			break;
+		case 'd':
+			driver->direct = 1;
+			break;
+		case 'm':
+			driver->use_mmap = 1;
+			break;
 		case 'I':
 			in_latency = param->value.ui;
 			break;
 		case 'O':
 			out_latency = param->value.ui;
 			break;
+		case 'z':
+			if (dither_opt (param->value.c, &dither)) {
+				free (driver);
+				return NULL;
+			}
+			break;
 		}
 		pnode = jack_slist_next (pnode);
 	}
@@ -1151,8 +1615,22 @@ jack_driver_t * driver_initialize (jack_client_t *client,
 	driver->playback_channels = playback_channels;
 	driver->sys_in_latency = in_latency;
 	driver->sys_out_latency = out_latency;
+	driver->dither = dither;
 	/* setting driver->period_usecs & co is delayed until attach */
 
+	if (playback_channels > 0) {
+		driver->dither_state = (dither_state_t*)
+				       calloc (playback_channels,
+					       sizeof(dither_state_t));
+		if (driver->dither_state == NULL) {
+			jack_error ("OSS: calloc() failed: %s@%i, errno=%d",
+				    __FILE__, __LINE__, errno);
+			free (driver);
+			return NULL;
+		}
+	}
+	oss_driver_setup_io_function_pointers (driver);
+
 	driver->finish = driver_finish;
 
 	if (driver->indev == NULL) {
@@ -1238,6 +1716,9 @@ void driver_finish (jack_driver_t *driver)
 	if (oss_driver->outdev != NULL) {
 		free (oss_driver->outdev);
 	}
+	if (oss_driver->dither_state != NULL) {
+		free (oss_driver->dither_state);
+	}
 	free (driver);
 }
 
@@ -32,7 +32,11 @@
 #include <jack/jslist.h>
 #include <jack/jack.h>
 
+#include <sysdeps/atomicity.h>
+
 #include "driver.h"
+#include "memops.h"
+#include "wakeup.h"
 
 
 #define OSS_DRIVER_DEF_DEV      "/dev/dsp"
@@ -53,6 +57,7 @@ typedef struct _oss_driver {
 	jack_nframes_t period_size;
 	unsigned int nperiods;
 	int bits;
+	int sample_bytes;
 	unsigned int capture_channels;
 	unsigned int playback_channels;
 
@@ -63,12 +68,33 @@ typedef struct _oss_driver {
 	int format;
 	int ignorehwbuf;
 	int trigger;
+	int direct;
+	int use_mmap;
+	int mmapped;
 
 	size_t indevbufsize;
 	size_t outdevbufsize;
 	size_t portbufsize;
-	void *indevbuf;
+	void *inbufs;                   /* both capture periods */
+	void *outbufs;                  /* both playback periods */
+	void *indevbuf;                 /* the engine's halves */
 	void *outdevbuf;
+	void *inbackbuf;                /* the I/O threads' halves */
+	void *outbackbuf;
+
+	void *inmap;                    /* the DMA buffers, in mmap mode */
+	void *outmap;
+	size_t inmapsize;
+	size_t outmapsize;
+	size_t in_ofs;                  /* where we are in them */
+	size_t out_ofs;
+	uint32_t in_pos;                /* and in the device's byte counts */
+	uint32_t out_pos;
+
+	MemopsReadFunction read_via_copy;
+	MemopsWriteFunction write_via_copy;
+	DitherAlgorithm dither;
+	dither_state_t *dither_state;
 
 	float iodelay;
 	jack_time_t last_periodtime;
@@ -86,11 +112,9 @@ typedef struct _oss_driver {
 	volatile int threads;
 	pthread_t thread_in;
 	pthread_t thread_out;
-	pthread_mutex_t mutex_in;
-	pthread_mutex_t mutex_out;
-#       ifdef USE_BARRIER
-	pthread_barrier_t barrier;
-#       endif
+	volatile _Atomic_word arrivals; /* I/O threads done with this period */
+	jack_wakeup_word_t handoff;
+	sem_t sem_handoff;              /* stands in for handoff without futexes */
 	sem_t sem_start;
 } oss_driver_t;
 
@@ -101,6 +101,11 @@ static OSStatus get_device_id_from_uid (char* UID, AudioDeviceID* id)
 typedef unsigned int AudioDeviceID;
 #endif
 
+#if HAVE_PORTAUDIO_V19
+/* V19 has no catch-all host error for a missing device */
+#define paHostError paInvalidDevice
+#endif
+
 #define PRINTDEBUG 1
 
 void PALog (char *fmt, ...)
@@ -114,6 +119,37 @@ void PALog (char *fmt, ...)
 #endif
 }
 
+#if HAVE_PORTAUDIO_V19
+
+/* The engine cycle runs straight from the PortAudio callback, on the
+   host API's own audio thread. With framesPerBuffer fixed to the JACK
+   period the buffer processor only adapts when the host API cannot
+   deliver that size itself. */
+static int
+paCallback (const void *inputBuffer, void *outputBuffer,
+	    unsigned long framesPerBuffer,
+	    const PaStreamCallbackTimeInfo *timeInfo,
+	    PaStreamCallbackFlags statusFlags, void *userData)
+{
+	portaudio_driver_t * driver = (portaudio_driver_t*)userData;
+	jack_engine_t *engine = driver->engine;
+	jack_time_t now = engine->get_microseconds ();
+
+	driver->in_buffers = (float* const*)inputBuffer;
+	driver->out_buffers = (float**)outputBuffer;
+
+	if (statusFlags & (paInputOverflow | paOutputUnderflow)) {
+		engine->delay (engine, now - (driver->last_wait_ust
+					      + driver->period_usecs));
+	}
+
+	driver->last_wait_ust = now;
+	return engine->run_cycle (engine, framesPerBuffer, 0) ?
+	       paAbort : paContinue;
+}
+
+#else
+
 static int
 paCallback (void *inputBuffer, void *outputBuffer,
 	    unsigned long framesPerBuffer,
@@ -127,6 +163,27 @@ paCallback (void *inputBuffer, void *outputBuffer,
 	return driver->engine->run_cycle (driver->engine, framesPerBuffer, 0);
 }
 
+#endif
+
+static void
+portaudio_latency_callback (jack_latency_callback_mode_t mode, void* arg)
+{
+	portaudio_driver_t* driver = (portaudio_driver_t*)arg;
+	jack_latency_range_t range;
+	JSList* node;
+
+	if (mode == JackCaptureLatency) {
+		range.min = range.max = driver->capture_frame_latency;
+		node = driver->capture_ports;
+	} else {
+		range.min = range.max = driver->playback_frame_latency;
+		node = driver->playback_ports;
+	}
+
+	for (; node; node = jack_slist_next (node))
+		jack_port_set_latency_range ((jack_port_t*)node->data, mode, &range);
+}
+
 static int
 portaudio_driver_attach (portaudio_driver_t *driver, jack_engine_t *engine)
 {
@@ -161,10 +218,7 @@ portaudio_driver_attach (portaudio_driver_t *driver, jack_engine_t *engine)
 			break;
 		}
 
-		/* XXX fix this so that it can handle: systemic (external) latency
-		 */
-
-		range.min = range.max = driver->frames_per_cycle;
+		range.min = range.max = driver->capture_frame_latency;
 		jack_port_set_latency_range (port, JackCaptureLatency, &range);
 		driver->capture_ports = jack_slist_append (driver->capture_ports, port);
 	}
@@ -180,10 +234,7 @@ portaudio_driver_attach (portaudio_driver_t *driver, jack_engine_t *engine)
 			break;
 		}
 
-		/* XXX fix this so that it can handle: systemic (external) latency
-		 */
-
-		range.min = range.max = driver->frames_per_cycle;
+		range.min = range.max = driver->playback_frame_latency;
 		jack_port_set_latency_range (port, JackPlaybackLatency, &range);
 		driver->playback_ports = jack_slist_append (driver->playback_ports, port);
 	}
@@ -217,6 +268,75 @@ portaudio_driver_detach (portaudio_driver_t *driver, jack_engine_t *engine)
 	return 0;
 }
 
+#if HAVE_PORTAUDIO_V19
+
+/* The stream is opened non-interleaved, so every channel moves with a
+   single copy between its PortAudio buffer and its port buffer. */
+
+static int
+portaudio_driver_null_cycle (portaudio_driver_t* driver, jack_nframes_t nframes)
+{
+	channel_t chn;
+
+	for (chn = 0; chn < driver->playback_nchannels; chn++)
+		memset (driver->out_buffers[chn], 0, nframes * sizeof(float));
+	return 0;
+}
+
+static int
+portaudio_driver_read (portaudio_driver_t *driver, jack_nframes_t nframes)
+{
+	channel_t chn;
+	jack_port_t *port;
+	JSList *node;
+
+	if (driver->in_buffers != NULL) {
+		for (chn = 0, node = driver->capture_ports; node; node = jack_slist_next (node), chn++) {
+			port = (jack_port_t*)node->data;
+			if (jack_port_connected (port)) {
+				memcpy (jack_port_get_buffer (port, nframes),
+					driver->in_buffers[chn],
+					nframes * sizeof(float));
+			}
+		}
+	}
+
+	driver->engine->transport_cycle_start (driver->engine,
+					       driver->engine->get_microseconds ());
+	return 0;
+}
+
+static int
+portaudio_driver_write (portaudio_driver_t *driver, jack_nframes_t nframes)
+{
+	channel_t chn;
+	jack_port_t *port;
+	JSList *node;
+	size_t bytes = nframes * sizeof(float);
+
+	if (driver->out_buffers == NULL) {
+		return 0;
+	}
+
+	for (chn = 0, node = driver->playback_ports; node; node = jack_slist_next (node), chn++) {
+		port = (jack_port_t*)node->data;
+		if (jack_port_connected (port)) {
+			memcpy (driver->out_buffers[chn],
+				jack_port_get_buffer (port, nframes), bytes);
+		} else {
+			memset (driver->out_buffers[chn], 0, bytes);
+		}
+	}
+
+	/* channels whose port could not be registered */
+	for (; chn < driver->playback_nchannels; chn++)
+		memset (driver->out_buffers[chn], 0, bytes);
+
+	return 0;
+}
+
+#else
+
 static int
 portaudio_driver_null_cycle (portaudio_driver_t* driver, jack_nframes_t nframes)
 {
@@ -279,6 +399,8 @@ portaudio_driver_write (portaudio_driver_t *driver, jack_nframes_t nframes)
 	return 0;
 }
 
+#endif
+
 static int
 portaudio_driver_audio_start (portaudio_driver_t *driver)
 {
@@ -295,11 +417,78 @@ portaudio_driver_audio_stop (portaudio_driver_t *driver)
 	return (err != paNoError) ? -1 : 0;
 }
 
+#if HAVE_PORTAUDIO_V19
+
+/* Open the stream non-interleaved at the device's low latency, and
+   take the latencies PortAudio actually settled on for the ports. */
+static PaError
+portaudio_driver_open_stream (portaudio_driver_t* driver,
+			      jack_nframes_t nframes,
+			      jack_nframes_t rate)
+{
+	PaStreamParameters input, output;
+	const PaStreamInfo *info;
+	PaError err;
+
+	if (driver->capture_nchannels > 0) {
+		input.device = driver->input_device;
+		input.channelCount = driver->capture_nchannels;
+		input.sampleFormat = paFloat32 | paNonInterleaved;
+		input.suggestedLatency =
+			Pa_GetDeviceInfo (driver->input_device)->defaultLowInputLatency;
+		input.hostApiSpecificStreamInfo = NULL;
+	}
+
+	if (driver->playback_nchannels > 0) {
+		output.device = driver->output_device;
+		output.channelCount = driver->playback_nchannels;
+		output.sampleFormat = paFloat32 | paNonInterleaved;
+		output.suggestedLatency =
+			Pa_GetDeviceInfo (driver->output_device)->defaultLowOutputLatency;
+		output.hostApiSpecificStreamInfo = NULL;
+	}
+
+	err = Pa_OpenStream (&driver->stream,
+			     (driver->capture_nchannels > 0) ? &input : NULL,
+			     (driver->playback_nchannels > 0) ? &output : NULL,
+			     rate,
+			     nframes,           /* frames per buffer */
+			     paClipOff | paDitherOff,
+			     paCallback,
+			     driver);
+
+	if (err != paNoError) {
+		return err;
+	}
+
+	info = Pa_GetStreamInfo (driver->stream);
+	driver->capture_frame_latency = nframes;
+	driver->playback_frame_latency = nframes;
+
+	if (info && info->inputLatency > 0) {
+		driver->capture_frame_latency =
+			(jack_nframes_t)(info->inputLatency * rate + 0.5);
+	}
+	if (info && info->outputLatency > 0) {
+		driver->playback_frame_latency =
+			(jack_nframes_t)(info->outputLatency * rate + 0.5);
+	}
+
+	PALog ("latency: capture %" PRIu32 " playback %" PRIu32 " frames\n",
+	       driver->capture_frame_latency, driver->playback_frame_latency);
+	return paNoError;
+}
+
+#endif
+
 static int
 portaudio_driver_set_parameters (portaudio_driver_t* driver,
 				 jack_nframes_t nframes,
 				 jack_nframes_t rate)
 {
+#if HAVE_PORTAUDIO_V19
+	PaError err = portaudio_driver_open_stream (driver, nframes, rate);
+#else
 	int capturing = driver->capturing;
 	int playing = driver->playing;
 
@@ -322,12 +511,16 @@ portaudio_driver_set_parameters (portaudio_driver_t* driver,
 		paCallback,
 		driver);
 
+	driver->capture_frame_latency = nframes;
+	driver->playback_frame_latency = nframes;
+#endif
+
 	if (err == paNoError) {
 
-		driver->period_usecs = (((float)driver->frames_per_cycle)
-					/ driver->frame_rate) * 1000000.0f;
 		driver->frame_rate = rate;
 		driver->frames_per_cycle = nframes;
+		driver->period_usecs = (((float)driver->frames_per_cycle)
+					/ driver->frame_rate) * 1000000.0f;
 
 		/* tell engine about buffer size */
 		if (driver->engine) {
@@ -393,6 +586,102 @@ portaudio_driver_bufsize (portaudio_driver_t* driver, jack_nframes_t nframes)
 
 //== instance creation/destruction =============================================
 
+#if HAVE_PORTAUDIO_V19
+
+static void portaudio_log_device (int i, const PaDeviceInfo *pdi)
+{
+	PALog ("---------------------------------------------- #%d\n", i);
+	PALog ("\nName         = %s\n", pdi->name);
+	PALog ("Host API     = %s\n", Pa_GetHostApiInfo (pdi->hostApi)->name);
+	PALog ("Max Inputs = %d ", pdi->maxInputChannels);
+	PALog ("Max Outputs = %d\n", pdi->maxOutputChannels);
+	PALog ("Default Sample Rate = %8.2f\n", pdi->defaultSampleRate);
+	PALog ("Low Latency = %f in, %f out\n",
+	       pdi->defaultLowInputLatency, pdi->defaultLowOutputLatency);
+}
+
+static int portaudio_load_default (portaudio_driver_t *driver,
+				   int numDevices,
+				   int capturing,
+				   int playing,
+				   int* inputDeviceID,
+				   int* outputDeviceID)
+{
+	const PaDeviceInfo *pdi;
+	int i;
+	int found = 0;
+
+	PALog ("Look for default driver\n");
+
+	*inputDeviceID = Pa_GetDefaultInputDevice ();
+	*outputDeviceID = Pa_GetDefaultOutputDevice ();
+
+	for (i = 0; i < numDevices; i++) {
+		pdi = Pa_GetDeviceInfo (i);
+
+		if (i == *inputDeviceID) {
+			driver->capture_nchannels = (capturing) ? pdi->maxInputChannels : 0;
+			strcpy (driver->driver_name, pdi->name);
+			found = 1;
+		}
+
+		if (i == *outputDeviceID) {
+			driver->playback_nchannels = (playing) ? pdi->maxOutputChannels : 0;
+			strcpy (driver->driver_name, pdi->name);
+			found = 1;
+		}
+
+		portaudio_log_device (i, pdi);
+	}
+
+	return found;
+}
+
+static int portaudio_load_driver (portaudio_driver_t *driver,
+				  int numDevices,
+				  int capturing,
+				  int playing,
+				  int* inputDeviceID,
+				  int* outputDeviceID,
+				  char* driver_name)
+{
+	const PaDeviceInfo *pdi;
+	int found = 0;
+	int i;
+
+	PALog ("Look for %s driver\n", driver_name);
+
+	for (i = 0; i < numDevices; i++) {
+		pdi = Pa_GetDeviceInfo (i);
+
+		if (strncmp (driver_name, pdi->name,
+			     JACK_DRIVER_PARAM_STRING_MAX) == 0) {
+			if (pdi->maxInputChannels > 0) {
+				*inputDeviceID = i;
+				driver->capture_nchannels =
+					(capturing) ? pdi->maxInputChannels : 0;
+				strcpy (driver->driver_name, pdi->name);
+				PALog ("Found input driver = %s\n", driver_name);
+				found = 1;
+			}
+			if (pdi->maxOutputChannels > 0) {
+				*outputDeviceID = i;
+				driver->playback_nchannels =
+					(playing) ? pdi->maxOutputChannels : 0;
+				strcpy (driver->driver_name, pdi->name);
+				PALog ("Found output driver = %s\n", driver_name);
+				found = 1;
+			}
+		}
+
+		portaudio_log_device (i, pdi);
+	}
+
+	return found;
+}
+
+#else
+
 static int portaudio_load_default (portaudio_driver_t *driver,
 				   int numDevices,
 				   int capturing,
@@ -548,6 +837,8 @@ static int portaudio_load_driver (portaudio_driver_t *driver,
 	return found;
 }
 
+#endif
+
 /** create a new driver instance
  */
 static jack_driver_t *
@@ -565,7 +856,7 @@ portaudio_driver_new (char *name,
 	portaudio_driver_t *driver;
 	PaError err = paNoError;
 	int numDevices;
-	int inputDeviceID, outputDeviceID;
+	int inputDeviceID = paNoDevice, outputDeviceID = paNoDevice;
 	int found;
 
 	PALog ("portaudio driver version : %d\n", kVersion);
@@ -619,7 +910,11 @@ portaudio_driver_new (char *name,
 	PALog ("Pa_Initialize OK \n");
 
 	PALog ("Driver name required %s\n", driver->driver_name);
+#if HAVE_PORTAUDIO_V19
+	numDevices = Pa_GetDeviceCount ();
+#else
 	numDevices = Pa_CountDevices ();
+#endif
 
 	if ( numDevices < 0 ) {
 		PALog ("ERROR: Pa_CountDevices returned 0x%x\n", numDevices);
@@ -649,8 +944,10 @@ portaudio_driver_new (char *name,
 		goto error;
 	}
 
+#if !HAVE_PORTAUDIO_V19
 	PALog ("Pa_GetDefaultOutputDeviceID() %ld\n", (long)Pa_GetDefaultOutputDeviceID ());
 	PALog ("Pa_GetDefaultInputDeviceID() %ld\n",  (long)Pa_GetDefaultInputDeviceID ());
+#endif
 
 	PALog ("--------------------------------------------------\n");
 	PALog ("CoreAudio driver %s will be loaded\n", driver->driver_name);
@@ -672,6 +969,18 @@ portaudio_driver_new (char *name,
 	PALog ("driver->capture_nchannels %ld\n", driver->capture_nchannels);
 	PALog ("driver->playback_nchannels %ld\n", driver->playback_nchannels);
 
+#if HAVE_PORTAUDIO_V19
+	if (!capturing || inputDeviceID == paNoDevice) {
+		driver->capture_nchannels = 0;
+	}
+	if (!playing || outputDeviceID == paNoDevice) {
+		driver->playback_nchannels = 0;
+	}
+	driver->input_device = inputDeviceID;
+	driver->output_device = outputDeviceID;
+
+	err = portaudio_driver_open_stream (driver, frames_per_cycle, rate);
+#else
 	err = Pa_OpenStream (&driver->stream,
 			     ((capturing && (driver->capture_nchannels > 0)) ? inputDeviceID : paNoDevice),
 			     ((capturing) ? driver->capture_nchannels : 0),
@@ -688,11 +997,16 @@ portaudio_driver_new (char *name,
 			     paCallback,
 			     driver);
 
+	driver->capture_frame_latency = frames_per_cycle;
+	driver->playback_frame_latency = frames_per_cycle;
+#endif
+
 	if (err != paNoError) {
 		goto error;
 	}
 
 	driver->client = client;
+	jack_set_latency_callback (client, portaudio_latency_callback, driver);
 	driver->period_usecs = (((float)driver->frames_per_cycle) / driver->frame_rate) * 1000000.0f;
 	return (jack_driver_t*)driver;
 
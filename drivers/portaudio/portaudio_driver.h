@@ -23,6 +23,7 @@
 #define __jack_portaudio_driver_h__
 
 
+#include <config.h>
 #include <portaudio.h>
 
 #include <jack/jack.h>
@@ -52,10 +53,22 @@ typedef struct {
 	JSList   *capture_ports;
 	JSList   *playback_ports;
 
+	jack_nframes_t capture_frame_latency;
+	jack_nframes_t playback_frame_latency;
+
+	char driver_name[256];
+#if HAVE_PORTAUDIO_V19
+	/* one buffer per channel, valid for the current callback */
+	float * const *in_buffers;
+	float **out_buffers;
+	PaDeviceIndex input_device;
+	PaDeviceIndex output_device;
+	PaStream *stream;
+#else
 	float *inPortAudio;
 	float *outPortAudio;
-	char driver_name[256];
 	PortAudioStream*   stream;
+#endif
 
 } portaudio_driver_t;
 
@@ -0,0 +1,1242 @@
+/* -*- mode: c; c-file-style: "linux"; -*- */
+/*
+    Replay driver for JACK
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ */
+
+/*
+ * Plays back a file that jackd --record wrote, so that the same
+ * session can be run through a graph again and again and timed: the
+ * capture ports get the recorded buffers, cycle by cycle, and the
+ * recorded transport changes and connections are made again before
+ * the cycle they came ahead of. Cycles that the recorder lost are
+ * replayed as silence, to keep the timeline.
+ *
+ * In max mode the cycles run back to back, and the driver waits for
+ * the connections of a cycle to be made before running it, so that
+ * two runs over the same graph do the same work. In realtime mode the
+ * cycles start when they did in the recording, and connections are
+ * made when the graph thread gets to them.
+ *
+ * A reader thread keeps a queue of cycles topped up from the file. The
+ * connections are few, so they are all read when the file is opened,
+ * and made from a thread of our own: the driver thread only says how
+ * far it has got. Transport commands take effect at the end of the
+ * cycle they are given in, so they are given one cycle ahead.
+ *
+ * With --timings, the time each cycle took to run is written to a
+ * file, one "cycle usecs" line each; the server's --cycle-trace ring
+ * has the details of each client.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include <jack/types.h>
+#include <jack/thread.h>
+#include "internal.h"
+#include "engine.h"
+
+#include "replay_driver.h"
+
+#define REPLAY_GRAPH_WAIT_SECS 1
+#define REPLAY_TIMINGS 65536
+
+static int
+replay_queue_init (replay_queue_t *q, unsigned int depth,
+		   jack_nframes_t period, unsigned int channels)
+{
+	unsigned int i;
+	size_t frames = (size_t)period * (channels ? channels : 1);
+
+	memset (q, 0, sizeof(*q));
+
+	if ((q->blocks = calloc (depth, sizeof(replay_block_t))) == NULL) {
+		return -1;
+	}
+	for (i = 0; i < depth; i++) {
+		if ((q->blocks[i].buf = calloc (frames, sizeof(float))) == NULL) {
+			while (i--) {
+				free (q->blocks[i].buf);
+			}
+			free (q->blocks);
+			q->blocks = NULL;
+			return -1;
+		}
+	}
+
+	q->depth = depth;
+	pthread_mutex_init (&q->lock, NULL);
+	pthread_cond_init (&q->cond, NULL);
+
+	return 0;
+}
+
+static void
+replay_queue_free (replay_queue_t *q)
+{
+	unsigned int i;
+
+	if (q->blocks == NULL) {
+		return;
+	}
+
+	pthread_mutex_destroy (&q->lock);
+	pthread_cond_destroy (&q->cond);
+	for (i = 0; i < q->depth; i++) {
+		free (q->blocks[i].buf);
+	}
+	free (q->blocks);
+	q->blocks = NULL;
+}
+
+/* Wait for a free block and return it, or NULL once the driver has
+   stopped. */
+static replay_block_t *
+replay_queue_wait_free (replay_queue_t *q)
+{
+	replay_block_t *block = NULL;
+
+	pthread_mutex_lock (&q->lock);
+
+	while (!q->stop && q->tail - q->head == q->depth) {
+		pthread_cond_wait (&q->cond, &q->lock);
+	}
+	if (!q->stop) {
+		block = &q->blocks[q->tail % q->depth];
+	}
+
+	pthread_mutex_unlock (&q->lock);
+
+	return block;
+}
+
+/* Wait for block `n' past the head and return it, or NULL if the
+   reader ended before it. */
+static replay_block_t *
+replay_queue_peek (replay_queue_t *q, unsigned int n)
+{
+	replay_block_t *block = NULL;
+
+	pthread_mutex_lock (&q->lock);
+
+	while (!q->eof && q->tail - q->head <= n) {
+		pthread_cond_wait (&q->cond, &q->lock);
+	}
+	if (q->tail - q->head > n) {
+		block = &q->blocks[(q->head + n) % q->depth];
+	}
+
+	pthread_mutex_unlock (&q->lock);
+
+	return block;
+}
+
+static void
+replay_queue_produce (replay_queue_t *q)
+{
+	pthread_mutex_lock (&q->lock);
+	q->tail++;
+	pthread_cond_signal (&q->cond);
+	pthread_mutex_unlock (&q->lock);
+}
+
+static void
+replay_queue_consume (replay_queue_t *q)
+{
+	pthread_mutex_lock (&q->lock);
+	q->head++;
+	pthread_cond_signal (&q->cond);
+	pthread_mutex_unlock (&q->lock);
+}
+
+static void
+replay_queue_end (replay_queue_t *q, int consumer)
+{
+	pthread_mutex_lock (&q->lock);
+	if (consumer) {
+		q->stop = 1;
+	} else {
+		q->eof = 1;
+	}
+	pthread_cond_signal (&q->cond);
+	pthread_mutex_unlock (&q->lock);
+}
+
+static int
+replay_skip (FILE *file, uint64_t bytes)
+{
+	return fseeko (file, (off_t)bytes, SEEK_CUR);
+}
+
+static void
+replay_driver_write_timings (replay_driver_t *driver)
+{
+	replay_timing_t t;
+
+	if (driver->timings == NULL) {
+		return;
+	}
+
+	while (jack_ringbuffer_read_space (driver->timing_rb) >= sizeof(t)) {
+		jack_ringbuffer_read (driver->timing_rb, (char*)&t, sizeof(t));
+		fprintf (driver->timings, "%" PRIu64 " %" PRIu32 "\n",
+			 t.cycle, t.usecs);
+	}
+}
+
+/* Read the next cycle record into `block'; 0 at the end of the file. */
+static int
+replay_driver_read_cycle (replay_driver_t *driver, replay_block_t *block)
+{
+	jack_capture_record_t rec;
+	jack_nframes_t period = driver->period_size;
+	jack_nframes_t frames;
+	uint64_t left;
+	unsigned int chn;
+	float *buf;
+
+	while (fread (&rec, sizeof(rec), 1, driver->file) == 1) {
+
+		if (rec.type != JACK_CAPTURE_CYCLE) {
+			/* the connections were read when we opened it */
+			if (replay_skip (driver->file, rec.size)) {
+				return 0;
+			}
+			continue;
+		}
+
+		if (rec.size < sizeof(block->cyc)
+		    || fread (&block->cyc, sizeof(block->cyc), 1, driver->file) != 1) {
+			return 0;
+		}
+		block->cycle = rec.cycle;
+		left = rec.size - sizeof(block->cyc);
+
+		if (left != (uint64_t)block->cyc.channels * block->cyc.nframes
+		    * sizeof(float)) {
+			jack_error ("replay: cycle %" PRIu64 " of %s is "
+				    "damaged", rec.cycle, driver->path);
+			return 0;
+		}
+
+		if (block->cyc.nframes != period) {
+			driver->mismatched++;
+		}
+		frames = block->cyc.nframes < period ? block->cyc.nframes : period;
+
+		for (chn = 0; chn < driver->capture_channels; chn++) {
+			buf = block->buf + (size_t)chn * period;
+
+			if (chn >= block->cyc.channels) {
+				memset (buf, 0, period * sizeof(float));
+				continue;
+			}
+			if (fread (buf, sizeof(float), frames, driver->file) != frames) {
+				return 0;
+			}
+			left -= frames * sizeof(float);
+			if (frames < period) {
+				memset (buf + frames, 0,
+					(period - frames) * sizeof(float));
+			}
+			if (block->cyc.nframes > frames) {
+				if (replay_skip (driver->file, (uint64_t)
+						 (block->cyc.nframes - frames)
+						 * sizeof(float))) {
+					return 0;
+				}
+				left -= (uint64_t)(block->cyc.nframes - frames)
+					* sizeof(float);
+			}
+		}
+
+		/* channels we have no port for */
+		if (left && replay_skip (driver->file, left)) {
+			return 0;
+		}
+
+		return 1;
+	}
+
+	return 0;
+}
+
+static void *
+replay_driver_reader_thread (void *arg)
+{
+	replay_driver_t *driver = (replay_driver_t*)arg;
+	replay_block_t *block;
+
+	while ((block = replay_queue_wait_free (&driver->queue)) != NULL) {
+
+		replay_driver_write_timings (driver);
+
+		if (!replay_driver_read_cycle (driver, block)) {
+			if (ferror (driver->file)) {
+				jack_error ("replay: cannot read %s (%s)",
+					    driver->path, strerror (errno));
+			}
+			break;
+		}
+
+		replay_queue_produce (&driver->queue);
+	}
+
+	replay_queue_end (&driver->queue, 0);
+
+	return NULL;
+}
+
+/* Whether `text' has the line `line' of `len' bytes, newline included. */
+static int
+replay_graph_has (const replay_graph_t *graph, const char *line, size_t len)
+{
+	const char *p, *end;
+
+	if (graph == NULL) {
+		return 0;
+	}
+
+	for (p = graph->text, end = graph->text + graph->len; p < end; ) {
+		const char *nl = memchr (p, '\n', end - p);
+		size_t n = nl ? (size_t)(nl - p) + 1 : (size_t)(end - p);
+
+		if (n == len && memcmp (p, line, len) == 0) {
+			return 1;
+		}
+		p += n;
+	}
+
+	return 0;
+}
+
+/* Make, or with `connect' 0 break, the connections of `graph' that
+   `other' does not have. */
+static void
+replay_graph_apply (replay_driver_t *driver, const replay_graph_t *graph,
+		    const replay_graph_t *other, int connect)
+{
+	char line[2 * JACK_PORT_NAME_SIZE + 2];
+	const char *p, *end;
+	char *tab;
+	int err;
+
+	if (graph == NULL) {
+		return;
+	}
+
+	for (p = graph->text, end = graph->text + graph->len; p < end; ) {
+		const char *nl = memchr (p, '\n', end - p);
+		size_t n = nl ? (size_t)(nl - p) + 1 : (size_t)(end - p);
+		const char *start = p;
+
+		p += n;
+
+		if (n >= sizeof(line) || replay_graph_has (other, start, n)) {
+			continue;
+		}
+
+		memcpy (line, start, n);
+		line[n - 1] = '\0';
+		if ((tab = strchr (line, '\t')) == NULL) {
+			continue;
+		}
+		*tab++ = '\0';
+
+		if (connect) {
+			err = jack_connect (driver->client, line, tab);
+		} else {
+			err = jack_disconnect (driver->client, line, tab);
+		}
+
+		/* the other end may not be there this time */
+		if (err && err != EEXIST) {
+			VERBOSE (driver->engine, "replay: cannot %s %s and %s",
+				 connect ? "connect" : "disconnect", line, tab);
+		}
+	}
+}
+
+static void *
+replay_driver_graph_thread (void *arg)
+{
+	replay_driver_t *driver = (replay_driver_t*)arg;
+	const replay_graph_t *from, *to;
+	unsigned int due;
+
+	while (1) {
+		if (sem_wait (&driver->graph_sem) < 0) {
+			continue;
+		}
+		if (!driver->graph_run) {
+			break;
+		}
+
+		due = driver->graph_due;
+		if (due > driver->graph_done) {
+			/* straight to the newest, from what we made last */
+			from = driver->graph_done ?
+			       &driver->graphs[driver->graph_done - 1] : NULL;
+			to = &driver->graphs[due - 1];
+
+			replay_graph_apply (driver, from, to, 0);
+			replay_graph_apply (driver, to, from, 1);
+
+			__sync_synchronize ();
+			driver->graph_done = due;
+		}
+
+		sem_post (&driver->graph_applied);
+	}
+
+	return NULL;
+}
+
+/* Whether the ports of every connection in `graph' are there. */
+static int
+replay_graph_ready (replay_driver_t *driver, const replay_graph_t *graph)
+{
+	char line[2 * JACK_PORT_NAME_SIZE + 2];
+	const char *p, *end;
+	char *tab;
+
+	for (p = graph->text, end = graph->text + graph->len; p < end; ) {
+		const char *nl = memchr (p, '\n', end - p);
+		size_t n = nl ? (size_t)(nl - p) + 1 : (size_t)(end - p);
+
+		if (n < sizeof(line)) {
+			memcpy (line, p, n);
+			line[n - 1] = '\0';
+			if ((tab = strchr (line, '\t')) != NULL) {
+				*tab++ = '\0';
+				if (jack_port_by_name (driver->client, line) == NULL
+				    || jack_port_by_name (driver->client, tab) == NULL) {
+					return 0;
+				}
+			}
+		}
+		p += n;
+	}
+
+	return 1;
+}
+
+/* Before the first cycle, give the clients of the recording up to
+   --wait seconds to register the ports it connects. */
+static void
+replay_driver_wait_ports (replay_driver_t *driver, uint64_t cycle)
+{
+	const replay_graph_t *graph = NULL;
+	jack_time_t deadline;
+	unsigned int i;
+
+	for (i = 0; i < driver->ngraphs && driver->graphs[i].cycle <= cycle; i++) {
+		graph = &driver->graphs[i];
+	}
+	if (graph == NULL || driver->wait_secs == 0) {
+		return;
+	}
+
+	deadline = driver->engine->get_microseconds ()
+		   + driver->wait_secs * 1000000LL;
+
+	while (!replay_graph_ready (driver, graph)) {
+		if (driver->engine->get_microseconds () > deadline) {
+			jack_error ("replay: some of the recorded ports are "
+				    "missing, starting without them");
+			break;
+		}
+		usleep (10000);
+	}
+}
+
+/* Have the connections made that were there before cycle `cycle', and
+   in max mode wait for them. */
+static void
+replay_driver_graph_to (replay_driver_t *driver, uint64_t cycle)
+{
+	struct timespec ts;
+	unsigned int due = driver->next_graph;
+
+	while (due < driver->ngraphs && driver->graphs[due].cycle <= cycle) {
+		due++;
+	}
+	if (due == driver->next_graph) {
+		return;
+	}
+	driver->next_graph = due;
+
+	if (!driver->graph_running) {
+		return;
+	}
+
+	driver->graph_due = due;
+	sem_post (&driver->graph_sem);
+
+	if (driver->realtime) {
+		return;
+	}
+
+	clock_gettime (CLOCK_REALTIME, &ts);
+	ts.tv_sec += REPLAY_GRAPH_WAIT_SECS;
+
+	while (driver->graph_done < due) {
+		if (sem_timedwait (&driver->graph_applied, &ts) < 0
+		    && errno == ETIMEDOUT) {
+			jack_error ("replay: the connections of cycle %" PRIu64
+				    " are late", cycle);
+			break;
+		}
+	}
+}
+
+/* Give the transport commands that make the next cycle look like
+   `next' did, after `cur'. */
+static void
+replay_driver_transport (replay_driver_t *driver,
+			 const jack_capture_cycle_t *cur,
+			 const jack_capture_cycle_t *next)
+{
+	int rolling = cur->transport_state != JackTransportStopped;
+	int next_rolling = next->transport_state != JackTransportStopped;
+
+	if (next->transport_frame != cur->transport_frame
+	    + (rolling ? cur->nframes : 0)) {
+		jack_transport_locate (driver->client, next->transport_frame);
+	}
+
+	if (next_rolling && !rolling) {
+		jack_transport_start (driver->client);
+	} else if (!next_rolling && rolling) {
+		jack_transport_stop (driver->client);
+	}
+}
+
+static int
+replay_driver_read (replay_driver_t *driver, jack_nframes_t nframes)
+{
+	jack_default_audio_sample_t *buf;
+	unsigned int chn;
+	JSList *node;
+
+	for (chn = 0, node = driver->capture_ports; node;
+	     node = jack_slist_next (node), chn++) {
+
+		jack_port_t *port = (jack_port_t*)node->data;
+
+		if (!jack_port_connected (port)) {
+			continue;
+		}
+
+		buf = jack_port_get_buffer (port, nframes);
+
+		if (driver->current == NULL || driver->silent_left) {
+			memset (buf, 0, nframes * sizeof(jack_default_audio_sample_t));
+		} else {
+			memcpy (buf, driver->current->buf + (size_t)chn * driver->period_size,
+				nframes * sizeof(jack_default_audio_sample_t));
+		}
+	}
+
+	return 0;
+}
+
+static int
+replay_driver_write (replay_driver_t *driver, jack_nframes_t nframes)
+{
+	/* the playback ports are there to be connected to */
+	return 0;
+}
+
+static int
+replay_driver_null_cycle (replay_driver_t *driver, jack_nframes_t nframes)
+{
+	/* the cycle still counts: run_cycle moves on */
+	return 0;
+}
+
+static void
+replay_driver_report (replay_driver_t *driver)
+{
+	jack_time_t elapsed;
+	double played;
+
+	if (driver->cycles == 0) {
+		return;
+	}
+
+	elapsed = driver->engine->get_microseconds () - driver->start_usecs;
+	played = (double)driver->cycles * driver->period_size
+		 / driver->sample_rate;
+
+	jack_info ("replay: %" PRIu64 " cycles of %.1f usecs on average "
+		   "(min %" PRIu64 " max %" PRIu64 "), %.1f seconds of audio "
+		   "in %.1f seconds, %.1fx realtime", driver->cycles,
+		   driver->run_sum / driver->cycles, driver->run_min,
+		   driver->run_max, played, elapsed / 1000000.0,
+		   elapsed ? played * 1000000.0 / elapsed : 0.0);
+
+	if (driver->mismatched) {
+		jack_info ("replay: %u cycles were recorded with another "
+			   "buffer size, and cut or padded to %" PRIu32,
+			   driver->mismatched, driver->period_size);
+	}
+	if (driver->timings_lost) {
+		jack_info ("replay: the timings of %" PRIu32 " cycles were lost",
+			   driver->timings_lost);
+	}
+}
+
+static int
+replay_driver_run_cycle (replay_driver_t *driver)
+{
+	jack_engine_t *engine = driver->engine;
+	replay_block_t *next;
+	jack_time_t now, deadline, ran;
+	uint64_t cycle;
+	int ret;
+
+	if (driver->current == NULL) {
+		if ((driver->current = replay_queue_peek (&driver->queue, 0)) == NULL) {
+			/* done: stopping the driver stops the server */
+			VERBOSE (engine, "replay: played %s", driver->path);
+			return -1;
+		}
+		driver->silent_left = driver->current->cyc.dropped;
+	}
+
+	/* the cycle of the recording this one plays */
+	cycle = driver->current->cycle - driver->silent_left;
+
+	if (driver->connections && driver->start_usecs == 0 && driver->cycles == 0) {
+		replay_driver_wait_ports (driver, cycle);
+	}
+
+	if (driver->connections) {
+		replay_driver_graph_to (driver, cycle);
+	}
+
+	if (driver->transport) {
+		jack_capture_cycle_t live, *cur = &driver->current->cyc;
+
+		if (driver->cycles == 0) {
+			/* this one runs with the transport as it is */
+			jack_position_t pos;
+
+			live.transport_state = jack_transport_query (driver->client, &pos);
+			live.transport_frame = pos.frame;
+			live.nframes = driver->period_size;
+			cur = &live;
+		}
+
+		next = driver->silent_left ? driver->current
+		       : replay_queue_peek (&driver->queue, 1);
+		if (next) {
+			replay_driver_transport (driver, cur, &next->cyc);
+		}
+	}
+
+	now = engine->get_microseconds ();
+
+	if (driver->start_usecs == 0) {
+		driver->start_usecs = now;
+		driver->first_usecs = driver->current->cyc.usecs
+				      - driver->silent_left * driver->period_usecs;
+	}
+
+	if (driver->realtime) {
+		deadline = driver->start_usecs + driver->current->cyc.usecs
+			   - driver->first_usecs
+			   - driver->silent_left * driver->period_usecs;
+		if (deadline > now) {
+			usleep (deadline - now);
+			now = engine->get_microseconds ();
+		}
+	}
+
+	driver->last_wait_ust = now;
+	engine->transport_cycle_start (engine, now);
+
+	ret = engine->run_cycle (engine, driver->period_size, 0.0f);
+
+	ran = engine->get_microseconds () - now;
+	if (driver->cycles == 0 || ran < driver->run_min) {
+		driver->run_min = ran;
+	}
+	if (ran > driver->run_max) {
+		driver->run_max = ran;
+	}
+	driver->run_sum += ran;
+	driver->cycles++;
+
+	if (driver->timing_rb) {
+		replay_timing_t t;
+
+		t.cycle = cycle;
+		t.usecs = (uint32_t)ran;
+		if (jack_ringbuffer_write_space (driver->timing_rb) >= sizeof(t)) {
+			jack_ringbuffer_write (driver->timing_rb, (char*)&t,
+					       sizeof(t));
+		} else {
+			driver->timings_lost++;
+		}
+	}
+
+	if (driver->silent_left) {
+		driver->silent_left--;
+	} else {
+		driver->current = NULL;
+		replay_queue_consume (&driver->queue);
+	}
+
+	return ret;
+}
+
+static int
+replay_driver_nt_start (replay_driver_t *driver)
+{
+	driver->start_usecs = 0;
+	return 0;
+}
+
+static int
+replay_driver_bufsize (replay_driver_t *driver, jack_nframes_t nframes)
+{
+	/* the queue is laid out in recorded periods */
+	if (nframes != driver->period_size) {
+		jack_error ("replay: the period cannot be changed while replaying");
+		return -1;
+	}
+	return 0;
+}
+
+static void
+replay_driver_stop_threads (replay_driver_t *driver)
+{
+	if (driver->reader_running) {
+		replay_queue_end (&driver->queue, 1);
+		pthread_join (driver->reader_thread, NULL);
+		driver->reader_running = 0;
+	}
+
+	if (driver->graph_running) {
+		driver->graph_run = 0;
+		sem_post (&driver->graph_sem);
+		pthread_join (driver->graph_thread, NULL);
+		driver->graph_running = 0;
+	}
+
+	replay_driver_write_timings (driver);
+}
+
+static int
+replay_driver_attach (replay_driver_t *driver)
+{
+	jack_port_t * port;
+	char buf[32];
+	unsigned int chn;
+	int port_flags;
+
+	if (driver->engine->set_buffer_size (driver->engine, driver->period_size)) {
+		jack_error ("replay: cannot set engine buffer size to %d (check MIDI)", driver->period_size);
+		return -1;
+	}
+	driver->engine->set_sample_rate (driver->engine, driver->sample_rate);
+
+	if (replay_queue_init (&driver->queue, driver->queue_depth,
+			       driver->period_size, driver->capture_channels)) {
+		jack_error ("replay: cannot allocate a queue of %u periods",
+			    driver->queue_depth);
+		return -1;
+	}
+
+	if (fseeko (driver->file, driver->data_start, SEEK_SET)) {
+		jack_error ("replay: cannot rewind %s (%s)", driver->path,
+			    strerror (errno));
+		return -1;
+	}
+
+	if (jack_client_create_thread (NULL, &driver->reader_thread, 0, FALSE,
+				       replay_driver_reader_thread, driver)) {
+		jack_error ("replay: cannot create reader thread");
+		return -1;
+	}
+	driver->reader_running = 1;
+
+	if (driver->connections && driver->ngraphs) {
+		driver->graph_run = 1;
+		if (jack_client_create_thread (NULL, &driver->graph_thread, 0, FALSE,
+					       replay_driver_graph_thread, driver)) {
+			jack_error ("replay: cannot create graph thread, "
+				    "the connections will not be replayed");
+		} else {
+			driver->graph_running = 1;
+		}
+	}
+
+	port_flags = JackPortIsOutput | JackPortIsPhysical | JackPortIsTerminal;
+
+	for (chn = 0; chn < driver->capture_channels; chn++) {
+		snprintf (buf, sizeof(buf) - 1, "capture_%u", chn + 1);
+
+		port = jack_port_register (driver->client, buf,
+					   JACK_DEFAULT_AUDIO_TYPE,
+					   port_flags, 0);
+		if (!port) {
+			jack_error ("replay: cannot register port for %s", buf);
+			break;
+		}
+
+		driver->capture_ports =
+			jack_slist_append (driver->capture_ports, port);
+	}
+
+	port_flags = JackPortIsInput | JackPortIsPhysical | JackPortIsTerminal;
+
+	for (chn = 0; chn < driver->playback_channels; chn++) {
+		snprintf (buf, sizeof(buf) - 1, "playback_%u", chn + 1);
+
+		port = jack_port_register (driver->client, buf,
+					   JACK_DEFAULT_AUDIO_TYPE,
+					   port_flags, 0);
+
+		if (!port) {
+			jack_error ("replay: cannot register port for %s", buf);
+			break;
+		}
+
+		driver->playback_ports =
+			jack_slist_append (driver->playback_ports, port);
+	}
+
+	jack_activate (driver->client);
+
+	return 0;
+}
+
+static int
+replay_driver_detach (replay_driver_t *driver)
+{
+	JSList * node;
+
+	if (driver->engine == 0) {
+		return 0;
+	}
+
+	replay_driver_stop_threads (driver);
+	replay_driver_report (driver);
+
+	for (node = driver->capture_ports; node; node = jack_slist_next (node))
+		jack_port_unregister (driver->client,
+				      ((jack_port_t*)node->data));
+
+	jack_slist_free (driver->capture_ports);
+	driver->capture_ports = NULL;
+
+
+	for (node = driver->playback_ports; node; node = jack_slist_next (node))
+		jack_port_unregister (driver->client,
+				      ((jack_port_t*)node->data));
+
+	jack_slist_free (driver->playback_ports);
+	driver->playback_ports = NULL;
+
+	return 0;
+}
+
+static void
+replay_driver_delete (replay_driver_t *driver)
+{
+	unsigned int i;
+
+	replay_driver_stop_threads (driver);
+	replay_queue_free (&driver->queue);
+
+	for (i = 0; i < driver->ngraphs; i++) {
+		free (driver->graphs[i].text);
+	}
+	free (driver->graphs);
+
+	if (driver->file) {
+		fclose (driver->file);
+	}
+	if (driver->timings && fclose (driver->timings) != 0) {
+		jack_error ("replay: cannot write the timings (%s)",
+			    strerror (errno));
+	}
+	if (driver->timing_rb) {
+		jack_ringbuffer_free (driver->timing_rb);
+	}
+
+	sem_destroy (&driver->graph_sem);
+	sem_destroy (&driver->graph_applied);
+
+	jack_driver_nt_finish ((jack_driver_nt_t*)driver);
+	free (driver);
+}
+
+/* Check the file, note the format of its first cycle, count its
+   cycles and keep its connections. */
+static int
+replay_driver_scan (replay_driver_t *driver)
+{
+	jack_capture_header_t header;
+	jack_capture_record_t rec;
+	jack_capture_cycle_t cyc;
+	replay_graph_t *graphs;
+	uint64_t size;
+
+	if (fread (&header, sizeof(header), 1, driver->file) != 1
+	    || memcmp (header.magic, JACK_CAPTURE_MAGIC,
+		       sizeof(JACK_CAPTURE_MAGIC)) != 0) {
+		jack_error ("replay: %s is not a jackd recording", driver->path);
+		return -1;
+	}
+	if (header.version != JACK_CAPTURE_VERSION
+	    || header.record_size != sizeof(jack_capture_record_t)) {
+		jack_error ("replay: %s was recorded by another version of "
+			    "jackd (%" PRIu32 ")", driver->path, header.version);
+		return -1;
+	}
+
+	driver->data_start = ftello (driver->file);
+
+	while (fread (&rec, sizeof(rec), 1, driver->file) == 1) {
+		size = rec.size;
+
+		if (rec.type == JACK_CAPTURE_CYCLE) {
+			if (size < sizeof(cyc)
+			    || fread (&cyc, sizeof(cyc), 1, driver->file) != 1) {
+				break;
+			}
+			size -= sizeof(cyc);
+			if (driver->recorded == 0) {
+				driver->sample_rate = cyc.frame_rate;
+				driver->period_size = cyc.nframes;
+				driver->capture_channels = cyc.channels;
+				driver->first_usecs = cyc.usecs;
+			}
+			driver->recorded++;
+
+		} else if (rec.type == JACK_CAPTURE_GRAPH) {
+			graphs = realloc (driver->graphs, (driver->ngraphs + 1)
+					  * sizeof(replay_graph_t));
+			if (graphs == NULL) {
+				return -1;
+			}
+			driver->graphs = graphs;
+			graphs += driver->ngraphs;
+			graphs->cycle = rec.cycle;
+			graphs->len = size;
+			if ((graphs->text = malloc (size + 1)) == NULL) {
+				return -1;
+			}
+			if (size && fread (graphs->text, size, 1, driver->file) != 1) {
+				free (graphs->text);
+				break;
+			}
+			graphs->text[size] = '\0';
+			driver->ngraphs++;
+			size = 0;
+		}
+
+		if (size && replay_skip (driver->file, size)) {
+			break;
+		}
+	}
+
+	if (driver->recorded == 0 || driver->period_size == 0
+	    || driver->sample_rate == 0) {
+		jack_error ("replay: %s has no cycles in it", driver->path);
+		return -1;
+	}
+
+	return 0;
+}
+
+static jack_driver_t *
+replay_driver_new (jack_client_t * client,
+		   char *name,
+		   const char *path,
+		   const char *mode,
+		   const char *timings,
+		   unsigned int playback_ports,
+		   unsigned int queue_depth,
+		   int connections,
+		   int transport,
+		   unsigned int wait_secs)
+{
+	replay_driver_t * driver;
+
+	jack_info ("creating replay driver ... %s|%s|%s|%u|%u", name, path,
+		   mode, playback_ports, queue_depth);
+
+	if (queue_depth < 2) {
+		jack_error ("replay: the queue must be at least 2 periods");
+		return NULL;
+	}
+
+	driver = (replay_driver_t*)calloc (1, sizeof(replay_driver_t));
+
+	jack_driver_nt_init ((jack_driver_nt_t*)driver);
+
+	driver->read          = (JackDriverReadFunction)replay_driver_read;
+	driver->write         = (JackDriverReadFunction)replay_driver_write;
+	driver->null_cycle    = (JackDriverNullCycleFunction)replay_driver_null_cycle;
+	driver->nt_attach     = (JackDriverNTAttachFunction)replay_driver_attach;
+	driver->nt_start      = (JackDriverNTStartFunction)replay_driver_nt_start;
+	driver->nt_detach     = (JackDriverNTDetachFunction)replay_driver_detach;
+	driver->nt_bufsize    = (JackDriverNTBufSizeFunction)replay_driver_bufsize;
+	driver->nt_run_cycle  = (JackDriverNTRunCycleFunction)replay_driver_run_cycle;
+
+	sem_init (&driver->graph_sem, 0, 0);
+	sem_init (&driver->graph_applied, 0, 0);
+
+	if (strcmp (mode, "max") == 0) {
+		driver->realtime = 0;
+	} else if (strcmp (mode, "realtime") == 0) {
+		driver->realtime = 1;
+	} else {
+		jack_error ("replay: unknown mode \"%s\"", mode);
+		goto fail;
+	}
+
+	if (*path == '\0') {
+		jack_error ("replay: no recording to play (-f)");
+		goto fail;
+	}
+	snprintf (driver->path, sizeof(driver->path), "%s", path);
+
+	if ((driver->file = fopen (path, "r")) == NULL) {
+		jack_error ("replay: cannot open %s (%s)", path,
+			    strerror (errno));
+		goto fail;
+	}
+	if (replay_driver_scan (driver)) {
+		goto fail;
+	}
+
+	if (*timings) {
+		if ((driver->timings = fopen (timings, "w")) == NULL) {
+			jack_error ("replay: cannot create %s (%s)", timings,
+				    strerror (errno));
+			goto fail;
+		}
+		if ((driver->timing_rb = jack_ringbuffer_create (
+			     REPLAY_TIMINGS * sizeof(replay_timing_t))) == NULL) {
+			goto fail;
+		}
+	}
+
+	jack_info ("replay: %s has %" PRIu64 " cycles of %" PRIu32
+		   " frames at %" PRIu32 " Hz, %u capture ports, %u graph "
+		   "changes", path, driver->recorded, driver->period_size,
+		   driver->sample_rate, driver->capture_channels,
+		   driver->ngraphs);
+
+	driver->period_usecs =
+		(jack_time_t)floor ((((float)driver->period_size)
+				     / driver->sample_rate) * 1000000.0f);
+	driver->last_wait_ust = 0;
+
+	driver->playback_channels = playback_ports;
+	driver->queue_depth = queue_depth;
+	driver->connections = connections;
+	driver->transport = transport;
+	driver->wait_secs = wait_secs;
+
+	driver->client = client;
+	driver->engine = NULL;
+
+	return (jack_driver_t*)driver;
+
+fail:
+	replay_driver_delete (driver);
+	return NULL;
+}
+
+
+/* DRIVER "PLUGIN" INTERFACE */
+
+jack_driver_desc_t *
+driver_get_descriptor ()
+{
+	jack_driver_desc_t * desc;
+	jack_driver_param_desc_t * params;
+	unsigned int i;
+
+	desc = calloc (1, sizeof(jack_driver_desc_t));
+	strcpy (desc->name, "replay");
+	desc->nparams = 8;
+
+	params = calloc (desc->nparams, sizeof(jack_driver_param_desc_t));
+
+	i = 0;
+	strcpy (params[i].name, "file");
+	params[i].character  = 'f';
+	params[i].type       = JackDriverParamString;
+	strcpy (params[i].value.str, "");
+	strcpy (params[i].short_desc, "Recording to play, from jackd --record");
+	strcpy (params[i].long_desc, params[i].short_desc);
+
+	i++;
+	strcpy (params[i].name, "mode");
+	params[i].character  = 'm';
+	params[i].type       = JackDriverParamString;
+	strcpy (params[i].value.str, "max");
+	strcpy (params[i].short_desc, "How to pace cycles: max or realtime");
+	strcpy (params[i].long_desc,
+		"How to pace cycles: max to run them back to back, waiting "
+		"for the recorded connections, or realtime to start them "
+		"when they started in the recording");
+
+	i++;
+	strcpy (params[i].name, "timings");
+	params[i].character  = 't';
+	params[i].type       = JackDriverParamString;
+	strcpy (params[i].value.str, "");
+	strcpy (params[i].short_desc, "File to write the time of each cycle to");
+	strcpy (params[i].long_desc,
+		"File to write the time each cycle took to run to, one "
+		"\"cycle usecs\" line each");
+
+	i++;
+	strcpy (params[i].name, "playback");
+	params[i].character  = 'P';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 2U;
+	strcpy (params[i].short_desc, "Number of playback ports");
+	strcpy (params[i].long_desc,
+		"Number of playback ports, for the recorded connections to "
+		"them; what they get is discarded");
+
+	i++;
+	strcpy (params[i].name, "queue");
+	params[i].character  = 'q';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 16U;
+	strcpy (params[i].short_desc, "Periods read ahead from the file");
+	strcpy (params[i].long_desc, params[i].short_desc);
+
+	i++;
+	strcpy (params[i].name, "connections");
+	params[i].character  = 'c';
+	params[i].type       = JackDriverParamBool;
+	params[i].value.i    = 1;
+	strcpy (params[i].short_desc, "Replay the recorded connections");
+	strcpy (params[i].long_desc,
+		"Make and break connections as they were in the recording, "
+		"when the ports are there");
+
+	i++;
+	strcpy (params[i].name, "transport");
+	params[i].character  = 'T';
+	params[i].type       = JackDriverParamBool;
+	params[i].value.i    = 1;
+	strcpy (params[i].short_desc, "Replay the recorded transport");
+	strcpy (params[i].long_desc,
+		"Start, stop and locate the transport as it was in the "
+		"recording");
+
+	i++;
+	strcpy (params[i].name, "wait");
+	params[i].character  = 'w';
+	params[i].type       = JackDriverParamUInt;
+	params[i].value.ui   = 10U;
+	strcpy (params[i].short_desc, "Seconds to wait for the recorded ports");
+	strcpy (params[i].long_desc,
+		"Seconds to wait, before the first cycle, for the clients to "
+		"register the ports that the recording connects");
+
+	desc->params = params;
+
+	return desc;
+}
+
+const char driver_client_name[] = "replay_pcm";
+
+jack_driver_t *
+driver_initialize (jack_client_t *client, const JSList * params)
+{
+	unsigned int playback_ports = 2;
+	unsigned int queue_depth = 16;
+	int connections = 1;
+	int transport = 1;
+	unsigned int wait_secs = 10;
+	const char *path = "";
+	const char *mode = "max";
+	const char *timings = "";
+	const JSList * node;
+	const jack_driver_param_t * param;
+
+	for (node = params; node; node = jack_slist_next (node)) {
+		param = (const jack_driver_param_t*)node->data;
+
+		switch (param->character) {
+
+		case 'f':
+			path = param->value.str;
+			break;
+
+		case 'm':
+			mode = param->value.str;
+			break;
+
+		case 't':
+			timings = param->value.str;
+			break;
+
+		case 'P':
+			playback_ports = param->value.ui;
+			break;
+
+		case 'q':
+			queue_depth = param->value.ui;
+			break;
+
+		case 'c':
+			connections = param->value.i;
+			break;
+
+		case 'T':
+			transport = param->value.i;
+			break;
+
+		case 'w':
+			wait_secs = param->value.ui;
+			break;
+
+		}
+	}
+
+	return replay_driver_new (client, "replay_pcm", path, mode, timings,
+				  playback_ports, queue_depth, connections,
+				  transport, wait_secs);
+}
+
+void
+driver_finish (jack_driver_t *driver)
+{
+	replay_driver_delete ((replay_driver_t*)driver);
+}
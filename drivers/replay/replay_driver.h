@@ -0,0 +1,125 @@
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+#ifndef __JACK_REPLAY_DRIVER_H__
+#define __JACK_REPLAY_DRIVER_H__
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include <jack/types.h>
+#include <jack/jslist.h>
+#include <jack/jack.h>
+#include <jack/ringbuffer.h>
+#include "driver.h"
+#include "capturefile.h"
+#include <config.h>
+
+typedef struct _replay_driver replay_driver_t;
+
+/* The connections as they were before cycle `cycle'. */
+typedef struct {
+	uint64_t cycle;
+	char *text;
+	size_t len;
+} replay_graph_t;
+
+/* One recorded cycle; `buf' holds `period' frames of each channel. */
+typedef struct {
+	jack_capture_cycle_t cyc;
+	uint64_t cycle;
+	float *buf;
+} replay_block_t;
+
+/* A ring of `depth' blocks between the reader thread and the driver. */
+typedef struct {
+	replay_block_t *blocks;
+	unsigned int depth;
+	unsigned long head;             /* next block to consume */
+	unsigned long tail;             /* next block to produce */
+	int eof;                        /* reader is done */
+	int stop;                       /* driver is done */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} replay_queue_t;
+
+typedef struct {
+	uint64_t cycle;
+	uint32_t usecs;
+} replay_timing_t;
+
+struct _replay_driver {
+	JACK_DRIVER_NT_DECL;
+
+	jack_nframes_t sample_rate;
+	jack_nframes_t period_size;
+
+	unsigned int capture_channels;
+	unsigned int playback_channels;
+
+	JSList         *capture_ports;
+	JSList         *playback_ports;
+
+	FILE           *file;
+	char            path[JACK_DRIVER_PARAM_STRING_MAX + 1];
+	off_t           data_start;     /* the first record */
+	uint64_t        recorded;       /* cycle records in the file */
+	jack_time_t     first_usecs;    /* when the first one began */
+
+	int realtime;                   /* else as fast as possible */
+	int transport;                  /* replay the transport */
+	int connections;                /* replay the connections */
+	unsigned int wait_secs;         /* for their ports, at the start */
+
+	unsigned int queue_depth;
+	replay_queue_t queue;
+	pthread_t reader_thread;
+	int reader_running;
+	unsigned int mismatched;        /* cycles of another length */
+
+	/* cycle being played, and silent ones to play before it */
+	replay_block_t *current;
+	uint32_t silent_left;
+
+	/* read ahead from the file, applied by the graph thread */
+	replay_graph_t *graphs;
+	unsigned int ngraphs;
+	unsigned int next_graph;        /* driver: the next one due */
+	volatile unsigned int graph_due;        /* driver: apply up to it */
+	volatile unsigned int graph_done;       /* graph thread: applied */
+	pthread_t graph_thread;
+	sem_t graph_sem;
+	sem_t graph_applied;
+	volatile int graph_run;
+	int graph_running;
+
+	/* per-cycle timings, written out by the reader thread */
+	FILE           *timings;
+	jack_ringbuffer_t *timing_rb;
+	uint32_t timings_lost;
+
+	uint64_t cycles;                /* run, silent ones included */
+	jack_time_t start_usecs;
+	jack_time_t run_min, run_max;
+	double run_sum;
+
+	jack_client_t  *client;
+};
+
+#endif /* __JACK_REPLAY_DRIVER_H__ */
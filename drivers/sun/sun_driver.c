@@ -36,6 +36,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/audioio.h>
 
 #include <poll.h>
@@ -60,7 +61,7 @@
 #include "sun_driver.h"
 
 
-#define SUN_DRIVER_N_PARAMS     11
+#define SUN_DRIVER_N_PARAMS     13
 const static jack_driver_param_desc_t sun_params[SUN_DRIVER_N_PARAMS] = {
 	{ "rate",
 	    'r',
@@ -127,7 +128,24 @@ const static jack_driver_param_desc_t sun_params[SUN_DRIVER_N_PARAMS] = {
 	    JackDriverParamUInt,
 	    { .ui = 0 },
 	    "system output latency",
-	    "system output latency" }
+	    "system output latency" },
+	{ "dither",
+	    'z',
+	    JackDriverParamChar,
+	    { .c = 'n' },
+	    "dithering mode",
+	    "dithering mode:\n"
+	    "  n - none\n"
+	    "  r - rectangular\n"
+	    "  s - shaped\n"
+	    "  t - triangular" },
+	{ "mmap",
+	    'm',
+	    JackDriverParamBool,
+	    { },
+	    "use the device's buffer directly",
+	    "map the device's ring buffer instead of using read()/write(),\n"
+	    "where the system supports it" }
 };
 
 
@@ -199,6 +217,373 @@ sun_driver_read_silence (sun_driver_t *driver, jack_nframes_t nframes)
 }
 
 
+/* mmap mode.  the device plays from and records into its ring buffers
+ * on its own, and AUDIO_GETOOFFS/AUDIO_GETIOFFS tell us how far it has
+ * got, so each period is converted straight between the ports and the
+ * ring with no read()/write().  the byte counts the device reports
+ * advance a block (one period) at a time.  we keep nperiods periods
+ * queued for playback, as the read()/write() mode does.
+ */
+
+#if defined(AUDIO_GETOOFFS) && defined(AUDIO_GETIOFFS)
+
+static void
+sun_driver_mmap_free (sun_driver_t *driver)
+{
+	if (driver->inmap != NULL) {
+		munmap (driver->inmap, driver->inmapsize);
+		driver->inmap = NULL;
+	}
+	if (driver->outmap != NULL) {
+		munmap (driver->outmap, driver->outmapsize);
+		driver->outmap = NULL;
+	}
+	driver->mmapped = 0;
+}
+
+
+static int
+sun_driver_mmap_setup (sun_driver_t *driver)
+{
+	audio_info_t auinfo;
+	void *map;
+
+	if (driver->infd >= 0) {
+		if (ioctl (driver->infd, AUDIO_GETINFO, &auinfo) < 0) {
+			jack_error ("sun_driver: AUDIO_GETINFO failed: %s: "
+				    "%s@%i", strerror (errno), __FILE__, __LINE__);
+			return -1;
+		}
+		driver->inmapsize = auinfo.record.buffer_size;
+		if (driver->inmapsize < 2 * driver->indevbufsize) {
+			goto fail;
+		}
+		map = mmap (NULL, driver->inmapsize, PROT_READ, MAP_SHARED,
+			    driver->infd, 0);
+		if (map == MAP_FAILED) {
+			goto fail;
+		}
+		driver->inmap = map;
+	}
+
+	if (driver->outfd >= 0) {
+		if (ioctl (driver->outfd, AUDIO_GETINFO, &auinfo) < 0) {
+			jack_error ("sun_driver: AUDIO_GETINFO failed: %s: "
+				    "%s@%i", strerror (errno), __FILE__, __LINE__);
+			sun_driver_mmap_free (driver);
+			return -1;
+		}
+		driver->outmapsize = auinfo.play.buffer_size;
+		if (driver->outmapsize <
+		    (driver->nperiods + 1) * driver->outdevbufsize) {
+			goto fail;
+		}
+		map = mmap (NULL, driver->outmapsize, PROT_READ | PROT_WRITE,
+			    MAP_SHARED, driver->outfd, 0);
+		if (map == MAP_FAILED) {
+			goto fail;
+		}
+		driver->outmap = map;
+	}
+
+	driver->mmapped = 1;
+
+	printf ("sun_driver: mmap mode, inmap %zd B, outmap %zd B\n",
+		driver->inmapsize, driver->outmapsize);
+
+	return 0;
+
+fail:
+	/* capture and playback both mapped or neither */
+	sun_driver_mmap_free (driver);
+	return -1;
+}
+
+
+static int
+sun_driver_mmap_position (int fd, unsigned long request,
+			  struct audio_offset *ofs)
+{
+	if (ioctl (fd, request, ofs) < 0) {
+		jack_error ("sun_driver: %s failed: %s: %s@%i",
+			    request == AUDIO_GETOOFFS ?
+			    "AUDIO_GETOOFFS" : "AUDIO_GETIOFFS",
+			    strerror (errno), __FILE__, __LINE__);
+		return -1;
+	}
+	return 0;
+}
+
+
+/* start over with nperiods periods of silence queued for playback and
+ * nothing to capture.  called with the device paused, and on xruns.
+ */
+static int
+sun_driver_mmap_reset (sun_driver_t *driver)
+{
+	struct audio_offset ofs;
+	size_t prime;
+
+	if (driver->inmap != NULL) {
+		if (sun_driver_mmap_position (driver->infd, AUDIO_GETIOFFS,
+					      &ofs) < 0) {
+			return -1;
+		}
+		driver->in_pos = ofs.samples;
+		driver->in_ofs = ofs.offset;
+	}
+
+	if (driver->outmap != NULL) {
+		if (sun_driver_mmap_position (driver->outfd, AUDIO_GETOOFFS,
+					      &ofs) < 0) {
+			return -1;
+		}
+		prime = driver->nperiods * driver->outdevbufsize;
+		bzero (driver->outmap, driver->outmapsize);
+		driver->out_pos = ofs.samples + prime;
+		driver->out_ofs = (ofs.offset + prime) % driver->outmapsize;
+	}
+
+	return 0;
+}
+
+
+static int
+sun_driver_mmap_wait (sun_driver_t *driver)
+{
+	struct audio_offset ofs;
+	struct timespec ts;
+	jack_time_t wait_enter;
+	jack_nframes_t need, frames;
+	uint32_t queued, avail, lost;
+	size_t limit;
+	float delay;
+
+	wait_enter = driver->engine->get_microseconds ();
+
+	while (1) {
+		need = 0;
+
+		if (driver->outmap != NULL) {
+			if (sun_driver_mmap_position (driver->outfd,
+						      AUDIO_GETOOFFS, &ofs) < 0) {
+				return -3;
+			}
+			queued = driver->out_pos - ofs.samples;
+			limit = (driver->nperiods - 1) * driver->outdevbufsize;
+			if ((int32_t)queued < 0) {
+				/* the device has gone past what we wrote and
+				 * replayed old data.  silence the ring and
+				 * queue from where the device is now.
+				 */
+				lost = ofs.samples - driver->out_pos;
+				frames = lost / (driver->playback_channels *
+						 driver->sample_bytes);
+				delay = (frames * 1000.0) / driver->sample_rate;
+				printf ("sun_driver: playback xrun of %d frames "
+					"(%f msec)\n", frames, delay);
+				bzero (driver->outmap, driver->outmapsize);
+				driver->out_pos = ofs.samples + limit;
+				driver->out_ofs = (ofs.offset + limit) %
+						  driver->outmapsize;
+			} else if (queued > limit) {
+				need = (queued - limit) /
+				       (driver->playback_channels *
+					driver->sample_bytes);
+			}
+		}
+
+		if (driver->inmap != NULL) {
+			if (sun_driver_mmap_position (driver->infd,
+						      AUDIO_GETIOFFS, &ofs) < 0) {
+				return -3;
+			}
+			avail = ofs.samples - driver->in_pos;
+			if (avail > driver->inmapsize - driver->indevbufsize) {
+				/* the device has recorded over what we had
+				 * not read yet.  take the newest period.
+				 */
+				frames = (avail - driver->indevbufsize) /
+					 (driver->capture_channels *
+					  driver->sample_bytes);
+				delay = (frames * 1000.0) / driver->sample_rate;
+				printf ("sun_driver: capture xrun of %d frames "
+					"(%f msec)\n", frames, delay);
+				driver->in_pos = ofs.samples -
+						 driver->indevbufsize;
+				driver->in_ofs = (ofs.offset +
+						  driver->inmapsize -
+						  driver->indevbufsize) %
+						 driver->inmapsize;
+			} else if (avail < driver->indevbufsize) {
+				frames = (driver->indevbufsize - avail) /
+					 (driver->capture_channels *
+					  driver->sample_bytes);
+				if (frames > need) {
+					need = frames;
+				}
+			}
+		}
+
+		if (need == 0) {
+			return 0;
+		}
+
+		/* same limit as poll_timeout, without rounding to msecs */
+		if (driver->engine->get_microseconds () - wait_enter >
+		    (driver->period_usecs * 3) / 2) {
+			jack_error ("sun_driver: mmap wait timeout: %s@%i",
+				    __FILE__, __LINE__);
+			return -5;
+		}
+
+		/* the device reports positions a block at a time, so
+		 * sleep until the block we need should be done.
+		 */
+		ts.tv_sec = need / driver->sample_rate;
+		ts.tv_nsec = ((uint64_t)(need % driver->sample_rate) *
+			      1000000000) / driver->sample_rate;
+		nanosleep (&ts, NULL);
+	}
+}
+
+
+/* convert between the ports and nframes of ring buffer, which may wrap.
+ * ports that are not connected play silence.
+ */
+static void
+sun_driver_mmap_read (sun_driver_t *driver, jack_nframes_t nframes)
+{
+	size_t frame_bytes;
+	jack_nframes_t done, frames;
+	int channel;
+	char *src;
+	jack_sample_t *portbuf;
+	JSList *node;
+	jack_port_t *port;
+
+	frame_bytes = driver->capture_channels * driver->sample_bytes;
+
+	for (done = 0; done < nframes; done += frames) {
+		frames = (driver->inmapsize - driver->in_ofs) / frame_bytes;
+		if (frames > nframes - done) {
+			frames = nframes - done;
+		}
+		src = (char*)driver->inmap + driver->in_ofs;
+
+		node = driver->capture_ports;
+		channel = 0;
+		while (node != NULL) {
+			port = (jack_port_t*)node->data;
+
+			if (jack_port_connected (port)) {
+				portbuf = jack_port_get_buffer (port, nframes);
+				driver->read_via_copy (portbuf + done,
+						       src + channel *
+						       driver->sample_bytes,
+						       frames, frame_bytes);
+			}
+
+			node = jack_slist_next (node);
+			channel++;
+		}
+
+		driver->in_pos += frames * frame_bytes;
+		driver->in_ofs = (driver->in_ofs + frames * frame_bytes) %
+				 driver->inmapsize;
+	}
+}
+
+
+static void
+sun_driver_mmap_write (sun_driver_t *driver, jack_nframes_t nframes,
+		       int silence)
+{
+	size_t frame_bytes;
+	jack_nframes_t done, frames;
+	int channel;
+	char *dst;
+	jack_sample_t *portbuf;
+	JSList *node;
+	jack_port_t *port;
+
+	frame_bytes = driver->playback_channels * driver->sample_bytes;
+
+	for (done = 0; done < nframes; done += frames) {
+		frames = (driver->outmapsize - driver->out_ofs) / frame_bytes;
+		if (frames > nframes - done) {
+			frames = nframes - done;
+		}
+		dst = (char*)driver->outmap + driver->out_ofs;
+
+		bzero (dst, frames * frame_bytes);
+
+		node = silence ? NULL : driver->playback_ports;
+		channel = 0;
+		while (node != NULL) {
+			port = (jack_port_t*)node->data;
+
+			if (jack_port_connected (port)) {
+				portbuf = jack_port_get_buffer (port, nframes);
+				driver->write_via_copy (dst + channel *
+							driver->sample_bytes,
+							portbuf + done, frames,
+							frame_bytes,
+							driver->dither_state +
+							channel);
+			}
+
+			node = jack_slist_next (node);
+			channel++;
+		}
+
+		driver->out_pos += frames * frame_bytes;
+		driver->out_ofs = (driver->out_ofs + frames * frame_bytes) %
+				  driver->outmapsize;
+	}
+}
+
+#else   // AUDIO_GETOOFFS && AUDIO_GETIOFFS
+
+/* no position queries, so read()/write() only */
+
+static void
+sun_driver_mmap_free (sun_driver_t *driver)
+{
+}
+
+static int
+sun_driver_mmap_setup (sun_driver_t *driver)
+{
+	return -1;
+}
+
+static int
+sun_driver_mmap_reset (sun_driver_t *driver)
+{
+	return -1;
+}
+
+static int
+sun_driver_mmap_wait (sun_driver_t *driver)
+{
+	return -1;
+}
+
+static void
+sun_driver_mmap_read (sun_driver_t *driver, jack_nframes_t nframes)
+{
+}
+
+static void
+sun_driver_mmap_write (sun_driver_t *driver, jack_nframes_t nframes,
+		       int silence)
+{
+}
+
+#endif  // AUDIO_GETOOFFS && AUDIO_GETIOFFS
+
+
 static jack_nframes_t
 sun_driver_wait (sun_driver_t *driver, int *status, float *iodelay)
 {
@@ -236,6 +621,14 @@ sun_driver_wait (sun_driver_t *driver, int *status, float *iodelay)
 		driver->poll_next = 0;
 	}
 
+	if (driver->mmapped) {
+		need_capture = need_playback = 0;
+		*status = sun_driver_mmap_wait (driver);
+		if (*status < 0) {
+			return 0;
+		}
+	}
+
 	while (need_capture || need_playback) {
 		nfds = poll (pfd, 2, driver->poll_timeout);
 		if ( nfds == -1 ||
@@ -284,9 +677,10 @@ sun_driver_wait (sun_driver_t *driver, int *status, float *iodelay)
 	 * for example, playback will continuously underrun if it underruns
 	 * and we have to wait for capture data to become available
 	 * before we can write enough playback data to catch up.
+	 * mmap mode finds its xruns from the positions instead.
 	 */
 
-	if (driver->infd >= 0) {
+	if (driver->infd >= 0 && !driver->mmapped) {
 		if (ioctl (driver->infd, AUDIO_RERROR, &capture_errors) < 0) {
 			jack_error ("sun_driver: AUDIO_RERROR failed: %s: %s@%i",
 				    strerror (errno), __FILE__, __LINE__);
@@ -301,7 +695,7 @@ sun_driver_wait (sun_driver_t *driver, int *status, float *iodelay)
 			capture_errors, delay);
 	}
 
-	if (driver->outfd >= 0) {
+	if (driver->outfd >= 0 && !driver->mmapped) {
 		if (ioctl (driver->outfd, AUDIO_PERROR, &playback_errors) < 0) {
 			jack_error ("sun_driver: AUDIO_PERROR failed: %s: %s@%i",
 				    strerror (errno), __FILE__, __LINE__);
@@ -410,103 +804,85 @@ sun_driver_run_cycle (sun_driver_t *driver)
 }
 
 
-static void
-copy_and_convert_in (jack_sample_t *dst, void *src,
-		     size_t nframes, int channel, int chcount, int bits)
+static int
+sun_driver_setup_io_function_pointers (sun_driver_t *driver)
 {
-	int srcidx;
-	int dstidx;
-	signed short *s16src = (signed short*)src;
-	signed int *s32src = (signed int*)src;
-	double *f64src = (double*)src;
-	jack_sample_t scale;
-
-	srcidx = channel;
-	switch (bits) {
+	MemopsReadFunction read_func;
+	MemopsWriteFunction write_func;
+
+	switch (driver->bits) {
 	case 16:
-		scale = 1.0f / 0x7fff;
-		for (dstidx = 0; dstidx < nframes; dstidx++) {
-			dst[dstidx] = (jack_sample_t)
-				      s16src[srcidx] * scale;
-			srcidx += chcount;
+		driver->read_via_copy = sample_move_dS_s16;
+		switch (driver->dither) {
+		case Rectangular:
+			jack_info ("sun_driver: rectangular dithering at 16 bits");
+			driver->write_via_copy = sample_move_dither_rect_d16_sS;
+			break;
+		case Triangular:
+			jack_info ("sun_driver: triangular dithering at 16 bits");
+			driver->write_via_copy = sample_move_dither_tri_d16_sS;
+			break;
+		case Shaped:
+			jack_info ("sun_driver: noise-shaped dithering at 16 bits");
+			driver->write_via_copy = sample_move_dither_shaped_d16_sS;
+			break;
+		default:
+			driver->write_via_copy = sample_move_d16_sS;
+			break;
 		}
 		break;
 	case 24:
-		scale = 1.0f / 0x7fffff;
-		for (dstidx = 0; dstidx < nframes; dstidx++) {
-			dst[dstidx] = (jack_sample_t)
-				      s32src[srcidx] * scale;
-			srcidx += chcount;
-		}
+		driver->read_via_copy = sample_move_dS_s24;
+		driver->write_via_copy = sample_move_d24_sS;
 		break;
 	case 32:
-		scale = 1.0f / 0x7fffffff;
-		for (dstidx = 0; dstidx < nframes; dstidx++) {
-			dst[dstidx] = (jack_sample_t)
-				      s32src[srcidx] * scale;
-			srcidx += chcount;
-		}
-		break;
-	case 64:
-		for (dstidx = 0; dstidx < nframes; dstidx++) {
-			dst[dstidx] = (jack_sample_t)f64src[srcidx];
-			srcidx += chcount;
-		}
+		driver->read_via_copy = sample_move_dS_s32u24;
+		driver->write_via_copy = sample_move_d32u24_sS;
 		break;
+	default:
+		jack_error ("sun_driver: unsupported word length %d: %s@%i",
+			    driver->bits, __FILE__, __LINE__);
+		return -1;
 	}
+
+	/* swap in vectorized converters where this CPU has them */
+
+	read_func = driver->read_via_copy;
+	driver->read_via_copy = memops_simd_read_function (read_func);
+	write_func = driver->write_via_copy;
+	driver->write_via_copy = memops_simd_write_function (write_func);
+	if (driver->read_via_copy != read_func ||
+	    driver->write_via_copy != write_func) {
+		jack_info ("sun_driver: %s sample conversion",
+			   memops_simd_name ());
+	}
+
+	return 0;
 }
 
 
-static void
-copy_and_convert_out (void *dst, jack_sample_t *src,
-		      size_t nframes, int channel, int chcount, int bits)
+static int
+dither_opt (char c, DitherAlgorithm *dither)
 {
-	int srcidx;
-	int dstidx;
-	signed short *s16dst = (signed short*)dst;
-	signed int *s32dst = (signed int*)dst;
-	double *f64dst = (double*)dst;
-	jack_sample_t scale;
-
-	dstidx = channel;
-	switch (bits) {
-	case 16:
-		scale = 0x7fff;
-		for (srcidx = 0; srcidx < nframes; srcidx++) {
-			s16dst[dstidx] = (signed short)
-					 (src[srcidx] >= 0.0f) ?
-					 (src[srcidx] * scale + 0.5f) :
-					 (src[srcidx] * scale - 0.5f);
-			dstidx += chcount;
-		}
+	switch (c) {
+	case '-':
+	case 'n':
+		*dither = None;
 		break;
-	case 24:
-		scale = 0x7fffff;
-		for (srcidx = 0; srcidx < nframes; srcidx++) {
-			s32dst[dstidx] = (signed int)
-					 (src[srcidx] >= 0.0f) ?
-					 (src[srcidx] * scale + 0.5f) :
-					 (src[srcidx] * scale - 0.5f);
-			dstidx += chcount;
-		}
+	case 'r':
+		*dither = Rectangular;
 		break;
-	case 32:
-		scale = 0x7fffffff;
-		for (srcidx = 0; srcidx < nframes; srcidx++) {
-			s32dst[dstidx] = (signed int)
-					 (src[srcidx] >= 0.0f) ?
-					 (src[srcidx] * scale + 0.5f) :
-					 (src[srcidx] * scale - 0.5f);
-			dstidx += chcount;
-		}
+	case 's':
+		*dither = Shaped;
 		break;
-	case 64:
-		for (srcidx = 0; srcidx < nframes; srcidx++) {
-			f64dst[dstidx] = (double)src[srcidx];
-			dstidx += chcount;
-		}
+	case 't':
+		*dither = Triangular;
 		break;
+	default:
+		jack_error ("sun_driver: illegal dithering mode %c", c);
+		return -1;
 	}
+	return 0;
 }
 
 
@@ -643,7 +1019,12 @@ sun_driver_start (sun_driver_t *driver)
 	/* AUDIO_FLUSH resets the counters these work with */
 	driver->playback_drops = driver->capture_drops = 0;
 
-	if (driver->outfd >= 0) {
+	if (driver->mmapped) {
+		/* the playback ring starts out silent */
+		if (sun_driver_mmap_reset (driver) < 0) {
+			return -1;
+		}
+	} else if (driver->outfd >= 0) {
 		/* "prime" the playback buffer.  if we don't do this, we'll
 		 * end up underrunning.  it would get really ugly in duplex
 		 * mode, for example, where we have to wait for a period to
@@ -719,6 +1100,7 @@ sun_driver_set_parameters (sun_driver_t *driver)
 	const char *indev = driver->indev;
 	const char *outdev = driver->outdev;
 
+	sun_driver_mmap_free (driver);
 	driver->indevbuf = NULL;
 	driver->outdevbuf = NULL;
 	driver->sample_bytes = driver->bits / 8;
@@ -971,6 +1353,11 @@ sun_driver_set_parameters (sun_driver_t *driver)
 	printf ("sun_driver: indevbuf %zd B, outdevbuf %zd B\n",
 		driver->indevbufsize, driver->outdevbufsize);
 
+	if (driver->use_mmap && sun_driver_mmap_setup (driver) < 0) {
+		jack_info ("sun_driver: cannot map the device buffers, "
+			   "using read() and write()");
+	}
+
 	return 0;
 }
 
@@ -1028,6 +1415,11 @@ sun_driver_read (sun_driver_t *driver, jack_nframes_t nframes)
 		return -1;
 	}
 
+	if (driver->mmapped) {
+		sun_driver_mmap_read (driver, nframes);
+		return 0;
+	}
+
 	node = driver->capture_ports;
 	channel = 0;
 	while (node != NULL) {
@@ -1035,10 +1427,12 @@ sun_driver_read (sun_driver_t *driver, jack_nframes_t nframes)
 
 		if (jack_port_connected (port)) {
 			portbuf = jack_port_get_buffer (port, nframes);
-			copy_and_convert_in (portbuf, driver->indevbuf,
-					     nframes, channel,
-					     driver->capture_channels,
-					     driver->bits);
+			driver->read_via_copy (portbuf,
+					       (char*)driver->indevbuf +
+					       channel * driver->sample_bytes,
+					       nframes,
+					       driver->capture_channels *
+					       driver->sample_bytes);
 		}
 
 		node = jack_slist_next (node);
@@ -1084,6 +1478,11 @@ sun_driver_write (sun_driver_t *driver, jack_nframes_t nframes)
 		return -1;
 	}
 
+	if (driver->mmapped) {
+		sun_driver_mmap_write (driver, nframes, 0);
+		return 0;
+	}
+
 	bzero (driver->outdevbuf, driver->outdevbufsize);
 
 	node = driver->playback_ports;
@@ -1093,10 +1492,12 @@ sun_driver_write (sun_driver_t *driver, jack_nframes_t nframes)
 
 		if (jack_port_connected (port)) {
 			portbuf = jack_port_get_buffer (port, nframes);
-			copy_and_convert_out (driver->outdevbuf, portbuf,
-					      nframes, channel,
-					      driver->playback_channels,
-					      driver->bits);
+			driver->write_via_copy ((char*)driver->outdevbuf +
+						channel * driver->sample_bytes,
+						portbuf, nframes,
+						driver->playback_channels *
+						driver->sample_bytes,
+						driver->dither_state + channel);
 		}
 
 		node = jack_slist_next (node);
@@ -1132,6 +1533,21 @@ sun_driver_null_cycle (sun_driver_t *driver, jack_nframes_t nframes)
 
 	printf ("sun_driver: running null cycle\n");
 
+	if (driver->mmapped) {
+		if (driver->outmap != NULL) {
+			sun_driver_mmap_write (driver, nframes, 1);
+		}
+		if (driver->inmap != NULL) {
+			driver->in_pos += nframes * driver->capture_channels *
+					  driver->sample_bytes;
+			driver->in_ofs = (driver->in_ofs + nframes *
+					  driver->capture_channels *
+					  driver->sample_bytes) %
+					 driver->inmapsize;
+		}
+		return 0;
+	}
+
 	if (driver->outfd >= 0) {
 		sun_driver_write_silence (driver, nframes);
 	}
@@ -1154,6 +1570,8 @@ sun_driver_bufsize (sun_driver_t *driver, jack_nframes_t nframes)
 static void
 sun_driver_delete (sun_driver_t *driver)
 {
+	sun_driver_mmap_free (driver);
+
 	if (driver->outfd >= 0 && driver->outfd != driver->infd) {
 		close (driver->outfd);
 		driver->outfd = -1;
@@ -1180,6 +1598,10 @@ sun_driver_delete (sun_driver_t *driver)
 		free (driver->outdev);
 	}
 
+	if (driver->dither_state != NULL) {
+		free (driver->dither_state);
+	}
+
 	jack_driver_nt_finish ((jack_driver_nt_t*)driver);
 
 	free (driver);
@@ -1199,7 +1621,7 @@ sun_driver_new (char *indev, char *outdev, jack_client_t *client,
 		jack_nframes_t nperiods, int bits,
 		int capture_channels, int playback_channels,
 		jack_nframes_t in_latency, jack_nframes_t out_latency,
-		int ignorehwbuf)
+		int ignorehwbuf, DitherAlgorithm dither, int use_mmap)
 {
 	sun_driver_t *driver;
 
@@ -1240,6 +1662,8 @@ sun_driver_new (char *indev, char *outdev, jack_client_t *client,
 	driver->playback_channels = playback_channels;
 	driver->sys_in_latency = in_latency;
 	driver->sys_out_latency = out_latency;
+	driver->dither = dither;
+	driver->dither_state = NULL;
 
 	set_period_size (driver, period_size);
 
@@ -1257,6 +1681,10 @@ sun_driver_new (char *indev, char *outdev, jack_client_t *client,
 	driver->format = AUDIO_ENCODING_LINEAR;
 #endif
 	driver->indevbuf = driver->outdevbuf = NULL;
+	driver->use_mmap = use_mmap;
+	driver->mmapped = 0;
+	driver->inmap = driver->outmap = NULL;
+	driver->inmapsize = driver->outmapsize = 0;
 
 	driver->capture_ports = NULL;
 	driver->playback_ports = NULL;
@@ -1269,6 +1697,23 @@ sun_driver_new (char *indev, char *outdev, jack_client_t *client,
 		return NULL;
 	}
 
+	if (sun_driver_setup_io_function_pointers (driver) < 0) {
+		sun_driver_delete (driver);
+		return NULL;
+	}
+
+	if (driver->playback_channels > 0) {
+		driver->dither_state = (dither_state_t*)
+				       calloc (driver->playback_channels,
+					       sizeof(dither_state_t));
+		if (driver->dither_state == NULL) {
+			jack_error ("sun_driver: calloc() failed: %s: %s@%i",
+				    strerror (errno), __FILE__, __LINE__);
+			sun_driver_delete (driver);
+			return NULL;
+		}
+	}
+
 	driver->client = client;
 
 	return (jack_driver_t*)driver;
@@ -1326,6 +1771,8 @@ driver_initialize (jack_client_t *client, JSList * params)
 	char *indev;
 	char *outdev;
 	int ignorehwbuf = 0;
+	int use_mmap = 0;
+	DitherAlgorithm dither = None;
 
 	indev = strdup (SUN_DRIVER_DEF_DEV);
 	outdev = strdup (SUN_DRIVER_DEF_DEV);
@@ -1368,11 +1815,19 @@ driver_initialize (jack_client_t *client, JSList * params)
 		case 'O':
 			out_latency = param->value.ui;
 			break;
+		case 'z':
+			if (dither_opt (param->value.c, &dither)) {
+				return NULL;
+			}
+			break;
+		case 'm':
+			use_mmap = 1;
+			break;
 		}
 		pnode = jack_slist_next (pnode);
 	}
 
 	return sun_driver_new (indev, outdev, client, sample_rate, period_size,
 			       nperiods, bits, capture_channels, playback_channels, in_latency,
-			       out_latency, ignorehwbuf);
+			       out_latency, ignorehwbuf, dither, use_mmap);
 }
@@ -37,6 +37,7 @@
 #include <jack/jack.h>
 
 #include "driver.h"
+#include "memops.h"
 
 #define SUN_DRIVER_DEF_DEV      "/dev/audio"
 #define SUN_DRIVER_DEF_FS       48000
@@ -73,6 +74,25 @@ typedef struct _sun_driver {
 	void *indevbuf;
 	void *outdevbuf;
 
+	/* mmap mode: the device's own ring buffers, and where in them
+	 * (ofs) and in the device's byte counts (pos) we are.
+	 */
+	int use_mmap;
+	int mmapped;
+	void *inmap;
+	void *outmap;
+	size_t inmapsize;
+	size_t outmapsize;
+	size_t in_ofs;
+	size_t out_ofs;
+	uint32_t in_pos;
+	uint32_t out_pos;
+
+	MemopsReadFunction read_via_copy;
+	MemopsWriteFunction write_via_copy;
+	DitherAlgorithm dither;
+	dither_state_t *dither_state;
+
 	int poll_timeout;
 	jack_time_t poll_last;
 	jack_time_t poll_next;
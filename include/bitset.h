@@ -35,6 +35,8 @@
 
 #include <inttypes.h>                   /* POSIX standard fixed-size types */
 #include <assert.h>                     /* `#define NDEBUG' to disable */
+#include <stdlib.h>
+#include <string.h>
 
 /* On some 64-bit machines, this implementation may be slightly
  * inefficient, depending on how compilers allocate space for
@@ -57,6 +59,12 @@ bitset_add (bitset_t set, unsigned int element)
 	set[WORD_INDEX (element)] |= (1 << BIT_INDEX (element));
 }
 
+static inline void
+bitset_clear (bitset_t set)
+{
+	memset (&set[1], 0, BYTE_SIZE (set[0]) - sizeof(_bitset_word_t));
+}
+
 static inline void
 bitset_copy (bitset_t to_set, bitset_t from_set)
 {
@@ -101,6 +109,19 @@ bitset_contains (bitset_t set, unsigned int element)
 	return 0 != (set[WORD_INDEX (element)] & (1 << BIT_INDEX (element)));
 }
 
+static inline int
+bitset_intersects (bitset_t set, bitset_t other)
+{
+	int i;
+	int nwords = WORD_SIZE (set[0]);
+
+	assert (set[0] == other[0]);
+	for (i = 1; i < nwords; i++)
+		if (set[i] & other[i])
+			return 1;
+	return 0;
+}
+
 static inline void
 bitset_remove (bitset_t set, unsigned int element)
 {
@@ -108,4 +129,15 @@ bitset_remove (bitset_t set, unsigned int element)
 	set[WORD_INDEX (element)] &= ~(1 << BIT_INDEX (element));
 }
 
+static inline void
+bitset_union (bitset_t to_set, bitset_t from_set)
+{
+	int i;
+	int nwords = WORD_SIZE (to_set[0]);
+
+	assert (to_set[0] == from_set[0]);
+	for (i = 1; i < nwords; i++)
+		to_set[i] |= from_set[i];
+}
+
 #endif /* __bitset_h__ */
@@ -0,0 +1,67 @@
+/*
+ * capturefile.h -- the format of jackd --record files.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation; either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __jack_capturefile_h__
+#define __jack_capturefile_h__
+
+#include <inttypes.h>
+#include <jack/types.h>
+
+/* With --record, the server writes what its master driver captured,
+ * cycle by cycle, to a file that the replay driver plays back into
+ * the same graph.  The file is a jack_capture_header_t followed by
+ * records, each a jack_capture_record_t and `size' bytes of payload,
+ * in host byte order; it is not meant to travel between machines.
+ *
+ * A JACK_CAPTURE_CYCLE payload is a jack_capture_cycle_t and then
+ * `nframes' samples for each of `channels' capture ports, one port
+ * after the other.  A JACK_CAPTURE_GRAPH payload is the text of every
+ * connection in the graph, one "source\tdestination\n" line each,
+ * as it was before cycle `cycle' ran.
+ */
+
+#define JACK_CAPTURE_MAGIC      "JACKREC"
+#define JACK_CAPTURE_VERSION    1
+
+#define JACK_CAPTURE_CYCLE      1
+#define JACK_CAPTURE_GRAPH      2
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;           /* sizeof (jack_capture_record_t) */
+} jack_capture_header_t;
+
+typedef struct {
+	uint32_t type;
+	uint32_t size;                  /* bytes of payload that follow */
+	uint64_t cycle;                 /* cycles recorded before this one */
+} jack_capture_record_t;
+
+typedef struct {
+	jack_nframes_t nframes;
+	jack_nframes_t frame_rate;
+	uint32_t channels;
+	uint32_t dropped;               /* cycles lost just before this one */
+	uint32_t transport_state;       /* a jack_transport_state_t */
+	jack_nframes_t transport_frame;
+	jack_time_t usecs;              /* when the cycle began */
+} jack_capture_cycle_t;
+
+#endif /* __jack_capturefile_h__ */
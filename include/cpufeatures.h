@@ -0,0 +1,55 @@
+/*
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+ */
+
+#ifndef __jack_cpufeatures_h__
+#define __jack_cpufeatures_h__
+
+/* What the CPU, and the OS's saving of its registers, allow, found
+   once per process; see libjack/cpufeatures.c.  Every kernel family
+   picks its versions from these, not from checks of its own. */
+
+#define JACK_CPU_SSE            (1 << 0)
+#define JACK_CPU_SSE2           (1 << 1)
+#define JACK_CPU_SSE3           (1 << 2)
+#define JACK_CPU_SSSE3          (1 << 3)
+#define JACK_CPU_AVX            (1 << 4)
+#define JACK_CPU_AVX2           (1 << 5)
+#define JACK_CPU_AVX512F        (1 << 6)
+#define JACK_CPU_3DNOW          (1 << 7)
+#define JACK_CPU_DAZ            (1 << 8)        /* MXCSR takes DAZ */
+#define JACK_CPU_FMA            (1 << 9)
+#define JACK_CPU_NEON           (1 << 16)
+#define JACK_CPU_SVE            (1 << 17)
+
+unsigned int jack_cpu_features(void);
+const char * jack_cpu_features_name(void);
+
+static inline int
+jack_cpu_has (unsigned int features)
+{
+	return (jack_cpu_features () & features) == features;
+}
+
+/* Fill the function tables of the kernels in libjack; more than once
+   does no harm. */
+void jack_cpu_dispatch_init(void);
+
+/* Put the calling thread's floating point unit in the mode of the
+   denormal policy, see jack_set_denormal_policy(). */
+void jack_denormals_apply(void);
+
+#endif /* __jack_cpufeatures_h__ */
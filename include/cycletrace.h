@@ -0,0 +1,95 @@
+/*
+ * cycletrace.h -- per-cycle timing records in shared memory.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation; either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __jack_cycletrace_h__
+#define __jack_cycletrace_h__
+
+#include <inttypes.h>
+#include <jack/types.h>
+
+/* When jackd runs with --cycle-trace, the engine appends one record
+ * per process cycle to a ring in its own shared memory segment; the
+ * segment's registry index is in jack_control_t.trace_shm_index (-1
+ * when tracing is off). Readers attach to the segment read-only and
+ * never interact with the engine.
+ *
+ * The engine bumps a record's seq to an odd value before writing it
+ * and to the next even value afterwards. A reader copies a record and
+ * keeps it only if seq was the same even value before and after the
+ * copy. write_count is the total number of records written; the
+ * newest one is records[(write_count - 1) % nrecords].
+ *
+ * All times are in microseconds on the server's clock (jack_get_time()).
+ * Client times are relative to cycle_start, JACK_CYCLE_TRACE_NONE
+ * meaning that the client did not get that far this cycle.
+ *
+ * With --perf-counters, each client also has the page faults and
+ * involuntary context switches its process callback took, capped at
+ * the size of the field; they are zero for a client that did not
+ * finish, and without --perf-counters.
+ */
+
+#define JACK_CYCLE_TRACE_VERSION        3
+#define JACK_CYCLE_TRACE_MAX_CLIENTS    64
+#define JACK_CYCLE_TRACE_NONE           0xffffffff
+
+#define JACK_CYCLE_TRACE_XRUN           0x1     /* xrun since the previous record */
+#define JACK_CYCLE_TRACE_FAILED         0x2     /* some client failed or timed out */
+#define JACK_CYCLE_TRACE_TRUNCATED      0x4     /* more clients than entries */
+
+typedef struct {
+	jack_uuid_t uuid;
+	uint32_t signalled;
+	uint32_t awake;
+	uint32_t finished;
+	uint16_t minor_faults;
+	uint8_t major_faults;
+	uint8_t involuntary_switches;
+} jack_cycle_trace_client_t;
+
+typedef struct {
+	volatile uint32_t seq;
+	uint32_t flags;
+	uint64_t cycle;                 /* cycle number since trace start */
+	jack_time_t cycle_start;        /* driver wakeup */
+	jack_time_t cycle_end;          /* after the driver write */
+	float driver_wait_usecs;        /* previous cycle end to wakeup */
+	float delayed_usecs;            /* as reported by the driver */
+	float recovery_usecs;           /* driver's xrun recovery since the
+	                                   previous record */
+	jack_nframes_t nframes;
+	uint32_t nclients;
+	jack_cycle_trace_client_t clients[JACK_CYCLE_TRACE_MAX_CLIENTS];
+} jack_cycle_trace_record_t;
+
+typedef struct {
+	uint32_t version;
+	uint32_t nrecords;
+	uint32_t record_size;           /* sizeof (jack_cycle_trace_record_t) */
+	uint32_t max_clients;
+	volatile uint64_t write_count;
+	jack_cycle_trace_record_t records[0];
+} jack_cycle_trace_t;
+
+/* Attach a client to the server's trace ring; NULL if tracing is off.
+ * The mapping is released by jack_client_close().
+ */
+extern const jack_cycle_trace_t *jack_cycle_trace_attach(jack_client_t *client);
+
+#endif /* __jack_cycletrace_h__ */
@@ -61,6 +61,12 @@ typedef int (*JackDriverStopFunction)(struct _jack_driver *);
 typedef int (*JackDriverStartFunction)(struct _jack_driver *);
 typedef int (*JackDriverBufSizeFunction)(struct _jack_driver *,
 					 jack_nframes_t nframes);
+typedef int (*JackDriverMetricsFunction)(struct _jack_driver *,
+					 char *buf, size_t size);
+typedef int (*JackDriverIdleFunction)(struct _jack_driver *,
+				      unsigned int periods);
+typedef int (*JackDriverSampleRateFunction)(struct _jack_driver *,
+					    jack_nframes_t rate);
 /*
    Call sequence summary:
 
@@ -206,6 +212,39 @@ typedef struct _jack_driver {
    prior to this, and the start function after this one has returned.
 
     JackDriverBufSizeFunction bufsize;
+
+   A slave driver sets this if its read and write functions only touch
+   its own ports and state, so that the engine may call them on a
+   thread of their own, at the same time as those of the other
+   drivers.  jack_driver_init() leaves it clear.
+
+    int parallel_io;
+
+   Optional. With --metrics, the engine calls this from a non-realtime
+   thread, holding the graph read lock, to add the driver's own
+   metrics to what it serves: OpenMetrics text lines ("# TYPE" lines
+   included, no "# EOF"), at most size bytes of them with the nul.
+   Returns what snprintf() would.
+
+    JackDriverMetricsFunction metrics;
+
+
+   Optional. With --idle, the engine calls this from the thread that
+   calls `wait' when the graph has nothing to run, with the number of
+   periods (more than one) the driver may let pass between wakeups, and
+   with 0 when the graph needs every period again.  A driver that can
+   should then wake up less often and return all the frames that
+   passed; the engine runs a null cycle for each period of them.
+
+    JackDriverIdleFunction idle;
+
+   Optional. The engine calls this when a client asks for a new
+   sample rate, between a stop and a start as for bufsize.  The driver
+   reconfigures its device for the new rate, keeping its buffer size
+   and ports, and returns 0; or leaves the old rate in place and
+   returns non-zero.
+
+    JackDriverSampleRateFunction samplerate;
  */
 
 /* define the fields here... */
@@ -222,7 +261,11 @@ typedef struct _jack_driver {
 	JackDriverNullCycleFunction null_cycle;	\
 	JackDriverStopFunction stop; \
 	JackDriverStartFunction start; \
-	JackDriverBufSizeFunction bufsize;
+	JackDriverBufSizeFunction bufsize; \
+	int parallel_io; \
+	JackDriverMetricsFunction metrics; \
+	JackDriverIdleFunction idle; \
+	JackDriverSampleRateFunction samplerate;
 
 	JACK_DRIVER_DECL                /* expand the macro */
 
@@ -273,6 +316,8 @@ typedef int (*JackDriverNTStopFunction)(struct _jack_driver_nt *);
 typedef int (*JackDriverNTStartFunction)(struct _jack_driver_nt *);
 typedef int (*JackDriverNTBufSizeFunction)(struct _jack_driver_nt *,
 					   jack_nframes_t nframes);
+typedef int (*JackDriverNTSampleRateFunction)(struct _jack_driver_nt *,
+					      jack_nframes_t rate);
 typedef int (*JackDriverNTRunCycleFunction)(struct _jack_driver_nt *);
 
 typedef struct _jack_driver_nt {
@@ -288,6 +333,7 @@ typedef struct _jack_driver_nt {
 	JackDriverNTStopFunction nt_stop; \
 	JackDriverNTStartFunction nt_start; \
 	JackDriverNTBufSizeFunction nt_bufsize;	\
+	JackDriverNTSampleRateFunction nt_samplerate; \
 	JackDriverNTRunCycleFunction nt_run_cycle;
 #define nt_read read
 #define nt_write write
@@ -24,11 +24,40 @@
 #include <jack/jack.h>
 #include "internal.h"
 #include "driver_interface.h"
+#include "bitset.h"
+#include "cycletrace.h"
+#include "portmeter.h"
 
 struct _jack_driver;
 struct _jack_client_internal;
 struct _jack_port_internal;
 
+typedef struct _jack_dag jack_dag_t;
+typedef struct _jack_query_pool jack_query_pool_t;
+
+/* One step of the serial schedule: an internal client to run, or the
+ * head of a chain of external clients to wake up and wait for.
+ */
+typedef struct {
+	struct _jack_client_internal *client;
+	jack_client_control_t *control;
+	int internal;
+} jack_schedule_step_t;
+
+/* The clients in the order the engine thread runs them, published for
+ * cycles that cannot take the graph lock, and compiled into the steps
+ * a serial cycle takes. Never changed once published, see
+ * jack_graph_change_begin().
+ */
+typedef struct _jack_graph_snapshot {
+	unsigned long generation;
+	unsigned int nclients;
+	unsigned int nsteps;
+	jack_client_control_t **controls;       /* all nclients, to reset */
+	jack_schedule_step_t *steps;
+	struct _jack_client_internal *clients[0];
+} jack_graph_snapshot_t;
+
 /* Structures is allocated by the engine in local memory to keep track
  * of port buffers and connections.
  */
@@ -42,12 +71,17 @@ typedef struct _jack_port_internal {
 	struct _jack_port_shared *shared;
 	JSList                   *connections;
 	jack_port_buffer_info_t  *buffer_info;
+	jack_port_buffer_info_t  *delayed_info; /* see jack_async_copy() */
+	jack_port_buffer_info_t  *sum_info;     /* see jack_plan_sums() */
 } jack_port_internal_t;
 
-/* The engine's internal port type structure. */
+/* The engine's internal port type structure. Bit n of `free_map' is
+ * set while info[n] is free.
+ */
 typedef struct _jack_port_buffer_list {
 	pthread_mutex_t lock;                   /* only lock within server */
-	JSList                  *freelist;      /* list of free buffers */
+	uint64_t                *free_map;      /* one bit per buffer */
+	uint32_t                 nbuffers;
 	jack_port_buffer_info_t *info;          /* jack_buffer_info_t array */
 } jack_port_buffer_list_t;
 
@@ -56,8 +90,37 @@ typedef struct _jack_reserved_name {
 	char name[JACK_CLIENT_NAME_SIZE];
 } jack_reserved_name_t;
 
+#define JACK_CLIENT_INDEX_SIZE 256      /* buckets, a power of two */
+
 #define JACKD_WATCHDOG_TIMEOUT 10000
 #define JACKD_CLIENT_EVENT_TIMEOUT 2000
+#define JACKD_SESSION_SAVE_TIMEOUT 30000        /* msecs per client */
+
+/* frame timer DLL bandwidth in Hz, see --dll-bandwidth */
+#define JACK_DLL_DEFAULT_BANDWIDTH 0.125f
+#define JACK_DLL_MAX_OMEGA 0.5f
+
+/* engine->numa_node, when not a node */
+#define JACK_NUMA_NONE (-1)
+#define JACK_NUMA_INTERLEAVE (-2)
+
+/* why a cycle went wrong, for the --metrics xrun counts */
+typedef enum {
+	JACK_XRUN_DRIVER,       /* the driver reported one */
+	JACK_XRUN_WAKEUP,       /* the engine woke up too late to run */
+	JACK_XRUN_CLIENT,       /* a subgraph did not finish in time */
+	JACK_XRUN_CAUSES
+} jack_xrun_cause_t;
+
+/* request duration histogram buckets, see metrics.c */
+#define JACK_REQUEST_HIST_BUCKETS 8
+
+/* trace ring kept for --metrics and --xrun-dump when --cycle-trace
+ * is not given */
+#define JACK_CYCLE_TRACE_DEFAULT_RECORDS 4096
+
+typedef struct _jack_xrun_dump jack_xrun_dump_t;
+typedef struct _jack_capture jack_capture_t;
 
 /* The main engine structure in local memory. */
 struct _jack_engine {
@@ -69,6 +132,26 @@ struct _jack_engine {
 	JSList                *driver_params;
 
 	JSList                *slave_drivers;
+	struct _jack_slave_io *slave_io;  /* NULL unless a slave has parallel_io */
+
+	/* a second master driver, opened and running null cycles until
+	   it takes over from `driver'; see jack_engine_load_backup_driver() */
+	struct _jack_driver   *backup_driver;
+	JSList                *retired_drivers;  /* unloaded at exit */
+	pthread_t master_thread;                  /* w: driver, without a backup */
+	pthread_t backup_thread;                  /* w: driver */
+	volatile int backup_state;                /* JACK_BACKUP_* */
+	int backup_attach;                        /* see jack_driver_buffer_size */
+	pthread_mutex_t backup_lock;              /* held across a hand over */
+	struct _jack_driver   *failed_driver;     /* for the server thread */
+
+	/* drivers on clocks of their own, bridged into the graph through
+	   resampling rings; see jack_engine_load_clock_domain() */
+	JSList                *clock_domains;
+	struct _jack_clock_domain *domain_starting; /* until its thread runs */
+	int domain_attach;                        /* see jack_driver_buffer_size */
+	jack_nframes_t domain_nframes;            /* asked for while attaching */
+	jack_nframes_t domain_rate;
 
 	/* these are "callbacks" made by the driver backend */
 	int (*set_buffer_size)(struct _jack_engine *, jack_nframes_t frames);
@@ -82,7 +165,7 @@ struct _jack_engine {
 	/* "private" sections starts here */
 
 	/* engine serialization -- use precedence for deadlock avoidance */
-	pthread_mutex_t request_lock; /* precedes client_lock */
+	pthread_mutex_t request_lock; /* precedes client_lock; not for queries */
 	pthread_rwlock_t client_lock;
 	pthread_mutex_t port_lock;
 	pthread_mutex_t problem_lock; /* must hold write lock on client_lock */
@@ -102,19 +185,34 @@ struct _jack_engine {
 	 */
 	jack_port_buffer_list_t port_buffers[JACK_MAX_PORT_TYPES];
 	jack_shm_info_t port_segment[JACK_MAX_PORT_TYPES];
+	jack_shmsize_t port_segment_size[JACK_MAX_PORT_TYPES];
+
+	/* NUMA placement of the port segments (--numa): a node,
+	   JACK_NUMA_INTERLEAVE or JACK_NUMA_NONE, and the node's CPUs */
+	int numa_node;
+	char numa_cpus[JACK_CPU_LIST_SIZE];
 
 	unsigned int port_max;
 	pthread_t server_thread;
 
 	int fds[2];
 	int cleanup_fifo[2];
+	pthread_t supervisor_thread;
+	int supervisor_fifo[2];         /* see jack_supervisor_thread() */
 	size_t pfd_size;
 	size_t pfd_max;
 	struct pollfd  *pfd;
+	int epoll_fd;                   /* -1 if the server thread uses poll */
 	char fifo_prefix[PATH_MAX + 1];
 	int            *fifo;
 	unsigned long fifo_size;
 
+	/* connection bookkeeping, reported at shutdown */
+	unsigned long client_connects;
+	jack_time_t client_connect_usecs;
+	unsigned long client_removals;
+	jack_time_t client_removal_usecs;
+
 	/* session handling */
 	int session_reply_fd;
 	int session_pending_replies;
@@ -124,6 +222,16 @@ struct _jack_engine {
 	volatile char freewheeling;
 	volatile char stop_freewheeling;
 	jack_uuid_t fwclient;
+	/* a bounded freewheel, see jack_set_freewheel_range() */
+	char freewheel_bounded;
+	char freewheel_in_range;        /* rolled inside the range yet */
+	volatile char freewheel_done;
+	jack_nframes_t freewheel_start;
+	jack_nframes_t freewheel_end;
+	/* the graph's period while freewheeling, 0 for the driver's, and
+	   the driver's while it is switched */
+	jack_nframes_t freewheel_nframes;
+	jack_nframes_t freewheel_saved_nframes;
 	pthread_t freewheel_thread;
 	char verbose;
 	char do_munlock;
@@ -131,12 +239,34 @@ struct _jack_engine {
 	char temporary;
 	int reordered;
 	int feedbackcount;
+	int graph_batch;                /* open connection batches */
+	int graph_sort_pending;         /* re-sort deferred by a batch */
+	int event_batch;                /* open event batches, see do_request() */
+	pthread_t event_batch_thread;
+
+	/* reach[client->sort_index] is the set of clients a client feeds
+	   through sortfeeds, directly or not. Rebuilt when reach_valid
+	   is cleared, see jack_client_feeds_transitive() */
+	bitset_t *reach;
+	unsigned int reach_size;
+	int reach_valid;
+	int latency_all_dirty;          /* next latency wave must reach everyone */
 	int removing_clients;
 	pid_t wait_pid;
 	int nozombies;
 	int timeout_count_threshold;
 	volatile int problems;
 	volatile int timeout_count;
+	volatile int late_clients;      /* clients flagged late */
+	int muted_clients;              /* see jack_mute_late_client() */
+	int fifos_dirty;                /* a late wakeup may be left over */
+	struct _jack_client_internal *async_head; /* see jack_async_start() */
+	int async_running;
+	int async_due;                  /* a history block is ready */
+	uint32_t history_phase;         /* period of the block being filled */
+	jack_shm_info_t history_shm;
+	float                   *history;
+	JSList *delayed_ports;          /* outputs with a delayed buffer */
 	volatile int new_clients_allowed;
 
 	/* these lists are protected by `client_lock' */
@@ -144,11 +274,51 @@ struct _jack_engine {
 	JSList         *clients_waiting;
 	JSList         *reserved_client_names;
 
+	/* hash indexes of `clients' and `reserved_client_names', see
+	   jack_client_index_add(); same protection as the lists */
+	JSList         *client_by_name[JACK_CLIENT_INDEX_SIZE];
+	JSList         *client_by_uuid[JACK_CLIENT_INDEX_SIZE];
+	JSList         *reserved_by_name[JACK_CLIENT_INDEX_SIZE];
+
 	jack_port_internal_t    *internal_ports;
+
+	/* name index in the control segment (see internal.h); protected
+	   by `port_lock' */
+	uint32_t                 port_hash_used;
+	int                     *port_hash_slot;
+
+	/* released port IDs, reused before control->port_high is
+	   advanced; protected by `port_lock' */
+	jack_port_id_t          *port_free;
+	uint32_t                 port_free_cnt;
 	jack_client_internal_t  *timebase_client;
+	int                      sync_prepare_pending; /* see jack_transport_sync_prepare() */
 	jack_port_buffer_info_t *silent_buffer;
 	jack_client_internal_t  *current_client;
 
+	/* parallel graph execution, NULL if disabled (see dagengine.c) */
+	jack_dag_t              *dag;
+
+	/* threads answering query requests, NULL if the server thread
+	   answers them itself */
+	jack_query_pool_t       *query_pool;
+
+	/* the thread answering requests put in shared memory, see
+	   jack_set_shm_requests() */
+	pthread_t shm_request_thread;
+	int shm_request_running;
+	volatile int shm_request_stop;
+
+	/* graph snapshot, NULL while the graph is being changed */
+	jack_graph_snapshot_t * volatile graph_snapshot;
+	jack_graph_snapshot_t * volatile cycle_snapshot;        /* in use by a cycle */
+	unsigned int graph_changes;                             /* nesting depth */
+	unsigned long graph_generation;
+
+	/* --idle: nothing would run or be connected, see jack_graph_idle() */
+	volatile int graph_idle;
+	int driver_idle;                /* engine thread: running null cycles */
+
 #define JACK_ENGINE_ROLLING_COUNT 32
 #define JACK_ENGINE_ROLLING_INTERVAL 1024
 
@@ -159,8 +329,54 @@ struct _jack_engine {
 	float max_usecs;
 	float spare_usecs;
 
+	/* SCHED_DEADLINE budget of the driver thread, see --deadline */
+	jack_deadline_t deadline;
+
 	int first_wakeup;
 
+	/* per-cycle timing records, NULL unless --cycle-trace */
+	jack_shm_info_t trace_shm;
+	jack_cycle_trace_t      *trace;
+	jack_time_t trace_last_end;
+	int trace_xrun;
+	float trace_recovery_usecs;     /* w: driver, see jack_cycle_trace_t */
+
+	/* per-port levels, NULL unless --port-meters */
+	jack_shm_info_t meter_shm;
+	jack_port_meters_t      *meters;
+	float *meter_peak;              /* per port, since the last publish */
+	float *meter_sumsq;
+	uint32_t *meter_overs;
+	jack_nframes_t meter_frames;
+
+	/* counters and service for --metrics, see metrics.c */
+	uint64_t xruns[JACK_XRUN_CAUSES];
+	uint64_t request_hist[JACK_REQUEST_HIST_BUCKETS + 1];
+	jack_time_t request_usecs;      /* sum over all requests */
+	int metrics_fd;
+	volatile int metrics_run;
+	pthread_t metrics_thread;
+
+	/* flight recorder, NULL unless --xrun-dump, see xrundump.c */
+	jack_xrun_dump_t *xrun_dump;
+
+	/* NULL unless --record, see capture.c */
+	jack_capture_t *capture;
+
+	/* --buffer-governor, see jack_buffer_governor() */
+	jack_nframes_t governor_min;    /* 0 when off */
+	jack_nframes_t governor_max;
+	uint64_t governor_xruns;        /* total at the last look */
+	int governor_strikes;           /* looks in a row with xruns */
+	int governor_calm;              /* looks in a row without */
+	int governor_hold;              /* looks left before another change */
+	jack_time_t governor_last;
+
+	/* --standby: the driver is started when the first client connects */
+	pthread_mutex_t standby_lock;
+	pthread_cond_t standby_cond;
+	int standby_state;              /* JACK_STANDBY_* */
+
 #ifdef JACK_USE_MACH_THREADS
 	/* specific resources for server/client real-time thread communication */
 	mach_port_t servertask, bp;
@@ -174,6 +390,14 @@ struct _jack_engine {
 	int midi_in_cnt;
 };
 
+#define JACK_BACKUP_IDLE    0    /* null cycles only */
+#define JACK_BACKUP_PROMOTE 1    /* take over at the master's next cycle */
+#define JACK_BACKUP_ACTIVE  2    /* has taken over */
+
+#define JACK_STANDBY_OFF      0 /* the driver is running */
+#define JACK_STANDBY_WAITING  1 /* no client has connected yet */
+#define JACK_STANDBY_STARTING 2 /* standby_start has been called */
+
 /* public functions */
 
 jack_engine_t  *jack_engine_new(int real_time, int real_time_priority,
@@ -193,21 +417,61 @@ int             jack_engine_load_driver(jack_engine_t *engine,
 int             jack_engine_load_slave_driver(jack_engine_t *engine,
 					      jack_driver_desc_t * driver_desc,
 					      JSList * driver_params);
+int             jack_engine_load_backup_driver(jack_engine_t *engine,
+					       jack_driver_desc_t * driver_desc,
+					       JSList * driver_params);
+int             jack_engine_switch_to_backup(jack_engine_t *engine);
+int             jack_engine_load_clock_domain(jack_engine_t *engine,
+					      jack_driver_desc_t * driver_desc,
+					      JSList * driver_params);
 void            jack_dump_configuration(jack_engine_t *engine, int take_lock);
+void            jack_engine_standby_done(jack_engine_t *engine);
+int             jack_socket_activated(void);
 
 /* private engine functions */
 void            jack_engine_reset_rolling_usecs(jack_engine_t *engine);
+void            jack_engine_standby_wait(jack_engine_t *engine);
 int             internal_client_request(void* ptr, jack_request_t *request);
 int             jack_get_fifo_fd(jack_engine_t *engine,
 				 unsigned int which_fifo);
+int             jack_run_internal_client(jack_engine_t *engine,
+					 jack_client_internal_t *client,
+					 jack_nframes_t nframes);
+int             jack_run_external_subgraph(jack_engine_t *engine,
+					   jack_client_internal_t *client);
+void            jack_external_subgraph_late(jack_engine_t *engine);
+void            jack_dag_quiesce(jack_engine_t *engine);
 
 extern jack_timer_type_t clock_source;
+extern unsigned int dag_threads;
+extern jack_wakeup_method_t wakeup_method;
+extern unsigned int cycle_trace_records;
+extern unsigned int port_meter_msecs;
+extern unsigned int async_history;
+extern const char *metrics_address;
+extern const char *xrun_dump_dir;
+extern const char *record_path;
+extern const char *buffer_governor;
+extern const char *rt_cpus;
+extern const char *server_cpus;
+extern const char *client_cpus;
+extern const char *numa_policy;
+extern void (*standby_start)(jack_engine_t *engine);
+extern int use_deadline;
+extern int use_perf_counters;
+extern int idle_cycles;
+extern float dll_bandwidth;
+extern int group_port_buffers;
+extern jack_nframes_t max_buffer_size;
+extern unsigned int late_mute_percent;
+extern unsigned int admission_percent;
+extern int skip_dead_clients;
 
 extern jack_client_internal_t *
 jack_client_internal_by_id(jack_engine_t *engine, jack_uuid_t id);
 
 #define jack_rdlock_graph(e) { DEBUG ("acquiring graph read lock"); if (pthread_rwlock_rdlock (&e->client_lock)) { abort (); } }
-#define jack_lock_graph(e) { DEBUG ("acquiring graph write lock"); if (pthread_rwlock_wrlock (&e->client_lock)) { abort (); } }
+#define jack_lock_graph(e) { DEBUG ("acquiring graph write lock"); if (pthread_rwlock_wrlock (&e->client_lock)) { abort (); } if ((e)->dag) { jack_dag_quiesce (e); } }
 #define jack_try_rdlock_graph(e) pthread_rwlock_tryrdlock (&e->client_lock)
 #define jack_unlock_graph(e) { DEBUG ("release graph lock"); if (pthread_rwlock_unlock (&e->client_lock)) { abort (); } }
 
@@ -252,6 +516,8 @@ void    jack_port_clear_connections(jack_engine_t *engine,
 void jack_port_registration_notify (jack_engine_t *, jack_port_id_t, int);
 void    jack_port_release(jack_engine_t *engine, jack_port_internal_t *);
 void    jack_sort_graph(jack_engine_t *engine);
+void    jack_port_meter_driver(jack_engine_t *engine, jack_port_id_t id,
+			       float peak, float sumsq, uint32_t overs);
 int     jack_stop_freewheeling(jack_engine_t* engine, int engine_exiting);
 jack_client_internal_t *
 jack_client_by_name(jack_engine_t *engine, const char *name);
@@ -260,6 +526,14 @@ int  jack_deliver_event(jack_engine_t *, jack_client_internal_t *, const jack_ev
 
 void
 jack_engine_signal_problems(jack_engine_t* engine);
+void
+jack_wake_server_thread(jack_engine_t* engine);
+void
+jack_engine_watch_client(jack_engine_t *engine, jack_client_internal_t *client);
+void
+jack_graph_change_begin(jack_engine_t *engine);
+void
+jack_graph_change_end(jack_engine_t *engine);
 int
 jack_use_driver(jack_engine_t *engine, struct _jack_driver *driver);
 int
@@ -0,0 +1,78 @@
+/*
+ * graphsnap.h -- binary snapshots of the port graph.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation; either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __jack_graphsnap_h__
+#define __jack_graphsnap_h__
+
+#include <inttypes.h>
+#include <jack/types.h>
+#include <jack/uuid.h>
+
+/* What jack_graph_snapshot_save() writes: a header, then nclients
+ * client records, nports port records, nconnections connection
+ * records and nproperties property records, in that order, with no
+ * padding in between.  Only ports that have connections are kept, and
+ * the metadata of those ports and of their clients.  Connections refer
+ * to ports, ports to clients and properties to either, by their index
+ * in the snapshot, so that they can be found again after a restart,
+ * when their ids and UUIDs have changed.  Integers are in the byte
+ * order of the machine that saved them.
+ */
+
+#define JACK_GRAPH_SNAPSHOT_MAGIC   0x4a47534e  /* "JGSN" */
+#define JACK_GRAPH_SNAPSHOT_VERSION 2
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nclients;
+	uint32_t nports;
+	uint32_t nconnections;
+	uint32_t nproperties;
+} POST_PACKED_STRUCTURE jack_graph_snapshot_header_t;
+
+typedef struct {
+	jack_uuid_t uuid;
+	char name[JACK_CLIENT_NAME_SIZE];
+} POST_PACKED_STRUCTURE jack_graph_snapshot_client_t;
+
+typedef struct {
+	uint32_t client;                /* index of its client record */
+	uint32_t flags;                 /* JackPortFlags */
+	char type[JACK_PORT_TYPE_SIZE];
+	/* without the client name, but as long as a full port name can be */
+	char name[JACK_CLIENT_NAME_SIZE + JACK_PORT_NAME_SIZE];
+} POST_PACKED_STRUCTURE jack_graph_snapshot_port_t;
+
+typedef struct {
+	uint32_t source;                /* index of a port record */
+	uint32_t destination;
+} POST_PACKED_STRUCTURE jack_graph_snapshot_connection_t;
+
+/* Followed by the key, the value and the type, if any, each with its
+ * terminating NUL. */
+typedef struct {
+	uint32_t subject;               /* index of a client record, or nclients
+					   plus the index of a port record */
+	uint32_t key_size;
+	uint32_t value_size;
+	uint32_t type_size;             /* 0 if it has no type */
+} POST_PACKED_STRUCTURE jack_graph_snapshot_property_t;
+
+#endif /* __jack_graphsnap_h__ */
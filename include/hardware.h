@@ -34,7 +34,8 @@ typedef enum {
 	Cap_WordClock = 0x4,
 	Cap_ClockMaster = 0x8,
 	Cap_ClockLockReporting = 0x10,
-	Cap_HardwareMetering = 0x20
+	Cap_HardwareMetering = 0x20,
+	Cap_HardwarePassthrough = 0x40
 } Capabilities;
 
 struct _jack_hardware;
@@ -44,6 +45,8 @@ typedef int (*JackHardwareSetInputMonitorMaskFunction)(struct _jack_hardware *,
 typedef int (*JackHardwareChangeSampleClockFunction)(struct _jack_hardware *, SampleClockMode);
 typedef double (*JackHardwareGetHardwarePeak)(jack_port_t *port, jack_nframes_t frames);
 typedef double (*JackHardwareGetHardwarePower)(jack_port_t *port, jack_nframes_t frames);
+typedef int (*JackHardwareSetPassthroughFunction)(struct _jack_hardware *, unsigned long input,
+						  unsigned long output, int on);
 
 
 typedef struct _jack_hardware {
@@ -56,6 +59,7 @@ typedef struct _jack_hardware {
 	JackHardwareReleaseFunction release;
 	JackHardwareGetHardwarePeak get_hardware_peak;
 	JackHardwareGetHardwarePower get_hardware_power;
+	JackHardwareSetPassthroughFunction set_passthrough;     /* may be NULL */
 	void *private;
 
 } jack_hardware_t;
@@ -33,6 +33,7 @@
 #include <pthread.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 
 /* Needed by <sysdeps/time.h> */
 extern void jack_error(const char *fmt, ...);
@@ -45,6 +46,8 @@ extern void jack_info(const char *fmt, ...);
 #include <jack/session.h>
 #include <jack/thread.h>
 #include <jack/metadata.h>
+#include <jack/ringbuffer.h>
+#include <jack/midiport.h>
 
 #include "port.h"
 
@@ -53,11 +56,29 @@ extern jack_thread_creator_t jack_thread_creator;
 typedef enum {
 	JACK_TIMER_SYSTEM_CLOCK,
 	JACK_TIMER_HPET,
+	JACK_TIMER_CYCLE_COUNTER,       /* invariant TSC or CNTVCT */
 } jack_timer_type_t;
 
+/* The cycle counter clock is calibrated once, by the server, against
+ * CLOCK_MONOTONIC; clients use the server's calibration from
+ * jack_control_t so that every process computes the same time from
+ * the same counter value:
+ *
+ *	usecs + ((counter - cycles) * mult) >> JACK_CYCLES_SHIFT
+ */
+#define JACK_CYCLES_SHIFT 40
+
+typedef struct {
+	uint64_t cycles;
+	uint64_t usecs;
+	uint64_t mult;                  /* 0 if not calibrated */
+} POST_PACKED_STRUCTURE jack_cycles_calibration_t;
+
 void        jack_init_time();
 void jack_set_clock_source (jack_timer_type_t);
 const char* jack_clock_source_name (jack_timer_type_t);
+int  jack_cycles_calibrate (jack_cycles_calibration_t *cal);
+void jack_set_cycles_calibration (const jack_cycles_calibration_t *cal);
 
 #include <sysdeps/time.h>
 #include <sysdeps/atomicity.h>
@@ -67,6 +88,7 @@ const char* jack_clock_source_name (jack_timer_type_t);
 #endif
 
 #include "messagebuffer.h"
+#include "wakeup.h"
 
 #ifndef PATH_MAX
     #ifdef MAXPATHLEN
@@ -115,6 +137,26 @@ const char* jack_clock_source_name (jack_timer_type_t);
 #define CHECK_PREEMPTION(engine, onoff)
 #endif
 
+/* Enable checking for calls that are not realtime safe, such as
+ * malloc() or pthread_mutex_lock(), in process callbacks.
+ *
+ * libjack built with --enable-rt-check, and run with JACK_RT_CHECK
+ * set, records such calls from a process thread during a cycle and
+ * reports them with backtraces from a thread of its own; see
+ * libjack/rtcheck.c.  glibc only.
+ */
+#if defined(JACK_RT_CHECK) && defined(__GLIBC__)
+extern void jack_rt_check_init(void);
+extern void jack_rt_check_enter(jack_client_t *client);
+extern void jack_rt_check_leave(jack_client_t *client);
+#define CHECK_RT_SAFETY_INIT()		jack_rt_check_init ()
+#define CHECK_RT_SAFETY(client, onoff)	\
+	if (onoff) jack_rt_check_enter (client); else jack_rt_check_leave (client)
+#else
+#define CHECK_RT_SAFETY_INIT()
+#define CHECK_RT_SAFETY(client, onoff)
+#endif
+
 #ifndef FALSE
 #define FALSE   (0)
 #endif
@@ -128,12 +170,45 @@ typedef struct _jack_request jack_request_t;
 
 typedef void * dlhandle;
 
+/* CPU lists use the kernel's cpulist format, such as "2,3,6-7" */
+#define JACK_CPU_LIST_SIZE 64
+
 typedef enum {
 	TransportCommandNone = 0,
 	TransportCommandStart = 1,
 	TransportCommandStop = 2,
 } transport_command_t;
 
+/* What jack_transport_query() returns, published by the engine into
+ * one of two slots of jack_control_t; see transengine.c.
+ */
+typedef struct {
+	jack_position_t position;
+	jack_transport_state_t state;
+} POST_PACKED_STRUCTURE jack_transport_snapshot_t;
+
+/* One segment of a tempo map: from `frame', which must fall on a bar
+ * line, up to the next segment, the meter and tempo are constant. The
+ * first segment starts at frame 0. This belongs in <jack/transport.h>.
+ */
+#define JACK_TEMPO_MAP_MAX 64           /* segments in a map */
+
+typedef struct {
+	jack_nframes_t frame;
+	float beats_per_bar;
+	float beat_type;
+	double ticks_per_beat;
+	double beats_per_minute;
+} POST_PACKED_STRUCTURE jack_tempo_segment_t;
+
+/* The tempo map the engine keeps, published like the transport
+ * snapshot into one of two slots of jack_control_t.
+ */
+typedef struct {
+	uint32_t count;                 /* 0 if there is no map */
+	jack_tempo_segment_t segment[JACK_TEMPO_MAP_MAX];
+} POST_PACKED_STRUCTURE jack_tempo_map_t;
+
 typedef struct {
 
 	volatile uint32_t guard1;
@@ -151,17 +226,54 @@ typedef struct {
 
 } POST_PACKED_STRUCTURE jack_frame_timer_t;
 
+/* Shared memory fields that are written every cycle, by the engine
+ * and by clients running on other CPUs, start on a cache line of their
+ * own, so that writing them does not take the line away from readers
+ * of unrelated fields. The blocks they are in are allocated on a cache
+ * line boundary.
+ */
+#define JACK_CACHE_LINE 64
+#ifdef __GNUC__
+#define JACK_CACHE_ALIGNED __attribute__((aligned (JACK_CACHE_LINE)))
+#else
+#define JACK_CACHE_ALIGNED
+#endif
+
+/* how the server and its realtime clients lock down memory */
+#define JACK_MLOCK_NONE         0
+#define JACK_MLOCK_ALL          1       /* mlockall() */
+#define JACK_MLOCK_SELECTIVE    2       /* only what the cycle touches */
+
 /* JACK engine shared memory data structure. */
 typedef struct {
 
-	jack_transport_state_t transport_state;
-	volatile transport_command_t transport_cmd;
-	transport_command_t previous_cmd;       /* previous transport_cmd */
+	/* first, so that futex(2) gets the alignment it needs */
+	jack_wakeup_word_t graph_wakeup[JACK_GRAPH_WAKEUPS];
+
+	/* w: clients, after putting a request in their control block,
+	   see jack_set_shm_requests(); waited on by the engine */
+	jack_wakeup_word_t request_wakeup;
+
+	/* w: engine every cycle, r: clients */
+	jack_frame_timer_t frame_timer JACK_CACHE_ALIGNED;
 	jack_position_t current_time;           /* position for current cycle */
-	jack_position_t pending_time;           /* position for next cycle */
+	jack_transport_snapshot_t snapshot[2];  /* current_time as published */
+	volatile uint32_t snapshot_seq;         /* snapshot[snapshot_seq & 1] is valid */
+	volatile uint32_t cycle_seq;            /* bumped every cycle, never 0 */
+	jack_transport_state_t transport_state;
+	float cpu_load;
+	float xrun_delayed_usecs;
+	float max_delayed_usecs;
+
+	/* w: clients, at any time */
+	volatile transport_command_t transport_cmd JACK_CACHE_ALIGNED;
 	jack_position_t request_time;           /* latest requested position */
-	jack_unique_t prev_request;             /* previous request unique ID */
 	volatile _Atomic_word seq_number;       /* unique ID sequence number */
+
+	/* the engine's side of the transport */
+	transport_command_t previous_cmd JACK_CACHE_ALIGNED; /* previous transport_cmd */
+	jack_position_t pending_time;           /* position for next cycle */
+	jack_unique_t prev_request;             /* previous request unique ID */
 	int8_t new_pos;                         /* new position this cycle */
 	int8_t pending_pos;                     /* new position request pending */
 	jack_nframes_t pending_frame;           /* pending frame number */
@@ -169,21 +281,43 @@ typedef struct {
 	int32_t sync_remain;                    /* number of them with sync_poll */
 	jack_time_t sync_timeout;
 	jack_time_t sync_time_left;
-	jack_frame_timer_t frame_timer;
-	int32_t internal;
+
+	/* rarely changed */
+	int32_t internal JACK_CACHE_ALIGNED;
 	jack_timer_type_t clock_source;
+	jack_cycles_calibration_t cycles_calibration;
+	jack_wakeup_method_t wakeup_method;
+	volatile uint32_t fifo_generation;      /* bumped by jack_clear_fifos() */
 	pid_t engine_pid;
 	jack_nframes_t buffer_size;
+	jack_nframes_t max_buffer_size;         /* -b, 0 if not given */
 	int8_t real_time;
-	int8_t do_mlock;
+	int8_t do_mlock;                        /* JACK_MLOCK_* */
 	int8_t do_munlock;
 	int32_t client_priority;
 	int32_t max_client_priority;
 	int32_t has_capabilities;
-	float cpu_load;
-	float xrun_delayed_usecs;
-	float max_delayed_usecs;
 	uint32_t port_max;
+	volatile uint32_t port_high;            /* ports[port_high] on have never been used */
+	uint32_t port_hash_size;                /* power of two, see below */
+	volatile uint32_t port_sorted_cnt;      /* entries in the sorted index */
+	volatile uint32_t port_sorted_seq;      /* odd while it is being changed */
+	jack_shm_registry_index_t trace_shm_index; /* see cycletrace.h */
+	jack_shm_registry_index_t meter_shm_index; /* see portmeter.h */
+	jack_shm_registry_index_t history_shm_index; /* see jack_port_get_history() */
+	uint32_t history_periods;               /* most periods in a block */
+	jack_nframes_t history_frames;          /* most frames in a period */
+	volatile uint32_t async_decimation;     /* periods per async stage run */
+	volatile uint32_t history_block;        /* the block the stage reads */
+	jack_shm_registry_index_t property_shm_index; /* see propertystore.h */
+	jack_tempo_map_t tempo_map[2];          /* see jack_tempo_map_set() */
+	volatile uint32_t tempo_map_seq;        /* tempo_map[tempo_map_seq & 1] is valid */
+	char client_cpus[JACK_CPU_LIST_SIZE];   /* for process threads, may be empty */
+	int8_t deadline;                        /* try SCHED_DEADLINE, see thread.c */
+	int8_t perf_counters;                   /* count cycles etc., see thread.c */
+	int8_t shm_requests;                    /* see jack_set_shm_requests() */
+	volatile uint32_t workgroup_seq;        /* see workgroup.c */
+	char workgroup_name[64];                /* its bootstrap service, or empty */
 	int32_t engine_ok;
 	jack_port_type_id_t n_port_types;
 	jack_port_type_info_t port_types[JACK_MAX_PORT_TYPES];
@@ -191,6 +325,96 @@ typedef struct {
 
 } POST_PACKED_STRUCTURE jack_control_t;
 
+/* The control segment ends with an open-addressed index of port IDs
+ * keyed by port name, port_hash_size entries long, placed right after
+ * ports[port_max]. Only the server writes it; readers must check any
+ * ID they find against the port itself and fall back to a full scan
+ * on a miss, since aliases are not indexed and the table may be
+ * rebuilt underneath them.
+ */
+#define JACK_PORT_HASH_EMPTY    ((jack_port_id_t)-1)
+#define JACK_PORT_HASH_DELETED  ((jack_port_id_t)-2)
+#define jack_port_hash_table(control) \
+	((jack_port_id_t*)&(control)->ports[(control)->port_max])
+
+/* After the hash comes a second index: the IDs of all named ports,
+ * port_sorted_cnt of them, ordered by strcmp() of their names, so that
+ * a name prefix selects a contiguous range. The server bumps
+ * port_sorted_seq before and after every change; a reader that sees
+ * it odd, or changed by the time it is done, must fall back to a full
+ * scan.
+ */
+#define jack_port_sorted_table(control) \
+	(jack_port_hash_table (control) + (control)->port_hash_size)
+
+/* Last come the fields that port scans test, copied out of ports[]
+ * into one array each, so that a scan reads a few bytes per port
+ * rather than a whole jack_port_shared_t: a bitmap of the ports in
+ * use, then, port_max entries each, the owning client, the flags, the
+ * name hash (see jack_port_name_hash()) and the type. The server fills
+ * in a port's entries before it sets its in-use bit, and clears the
+ * bit first when the port goes away; the name hash also changes on a
+ * rename. Readers must still check what they find against ports[].
+ */
+#define JACK_PORT_COLUMNS_ALIGN 64
+#define JACK_PORT_MAP_WORDS(n) (((n) + 63) / 64)
+#define jack_port_columns_size(port_max) \
+	(JACK_PORT_COLUMNS_ALIGN + \
+	 sizeof(uint64_t) * JACK_PORT_MAP_WORDS (port_max) + \
+	 (sizeof(jack_uuid_t) + 2 * sizeof(uint32_t) + \
+	  sizeof(jack_port_type_id_t)) * (port_max))
+#define jack_port_in_use_map(control) \
+	((uint64_t*)(((uintptr_t)(jack_port_sorted_table (control) + (control)->port_max) \
+		      + JACK_PORT_COLUMNS_ALIGN - 1) & ~(uintptr_t)(JACK_PORT_COLUMNS_ALIGN - 1)))
+#define jack_port_client_column(control) \
+	((jack_uuid_t*)(jack_port_in_use_map (control) + JACK_PORT_MAP_WORDS ((control)->port_max)))
+#define jack_port_flags_column(control) \
+	((uint32_t*)(jack_port_client_column (control) + (control)->port_max))
+#define jack_port_hash_column(control) \
+	(jack_port_flags_column (control) + (control)->port_max)
+#define jack_port_type_column(control) \
+	((jack_port_type_id_t*)(jack_port_hash_column (control) + (control)->port_max))
+
+/* And after those, a bitmap of port IDs per port, its row set for
+ * every port it is connected to, so that a client can test a pair of
+ * ports, or list the peers of any port, without asking the server or
+ * comparing names. Only the server writes it, under the graph lock.
+ */
+#define jack_port_connections_size(port_max) \
+	(JACK_PORT_COLUMNS_ALIGN + \
+	 sizeof(uint64_t) * JACK_PORT_MAP_WORDS (port_max) * (port_max))
+#define jack_port_connection_map(control, id) \
+	((uint64_t*)(((uintptr_t)(jack_port_type_column (control) + (control)->port_max) \
+		      + JACK_PORT_COLUMNS_ALIGN - 1) & ~(uintptr_t)(JACK_PORT_COLUMNS_ALIGN - 1)) \
+	 + JACK_PORT_MAP_WORDS ((control)->port_max) * (id))
+
+/* The first port in use with an ID in [id, limit), or limit. */
+static inline uint32_t
+jack_port_next_in_use (jack_control_t *control, uint32_t id, uint32_t limit)
+{
+	uint64_t *map = jack_port_in_use_map (control);
+	uint64_t bits;
+	uint32_t w;
+
+	if (id >= limit) {
+		return limit;
+	}
+
+	w = id >> 6;
+	bits = __atomic_load_n (&map[w], __ATOMIC_ACQUIRE) & (~(uint64_t)0 << (id & 63));
+
+	while (bits == 0) {
+		if ((++w << 6) >= limit) {
+			return limit;
+		}
+		bits = __atomic_load_n (&map[w], __ATOMIC_ACQUIRE);
+	}
+
+	id = (w << 6) + __builtin_ctzll (bits);
+
+	return id < limit ? id : limit;
+}
+
 typedef enum  {
 	BufferSizeChange,
 	SampleRateChange,
@@ -208,13 +432,19 @@ typedef enum  {
 	SaveSession,
 	LatencyCallback,
 	PropertyChange,
-	PortRename
+	PortRename,
+	SyncPrepare,
+	ProcessSkipped,
+	PortGainChanged
 } JackEventType;
 
 const char* jack_event_type_name (JackEventType);
 
+#define JACK_EVENT_NO_REPLY     0x1     /* part of a batch, see jack_event_batch_queue() */
+
 typedef struct {
 	JackEventType type;
+	uint32_t flags;
 	union {
 		uint32_t n;
 		char name[JACK_PORT_NAME_SIZE];
@@ -231,6 +461,12 @@ typedef struct {
 	union {
 		char other_name[JACK_PORT_NAME_SIZE];
 		jack_property_change_t property_change;
+		jack_position_t position;
+		float gain;     /* PortGainChanged */
+		struct {
+			uint32_t word;  /* GraphReordered: the client's own wakeup word */
+			uint32_t next;  /* and the one it hands the cycle on to */
+		} wakeup;
 	} z;
 } POST_PACKED_STRUCTURE jack_event_t;
 
@@ -250,27 +486,44 @@ typedef enum {
 /* JACK client shared memory data structure. */
 typedef volatile struct {
 
-	jack_uuid_t uuid;                       /* w: engine r: engine and client */
-	volatile jack_client_state_t state;     /* w: engine and client r: engine */
+	/* per-cycle status, first and on a cache line of its own */
+	volatile jack_client_state_t state JACK_CACHE_ALIGNED; /* w: engine and client r: engine */
+	volatile int8_t timed_out;              /* r/w: engine */
+	volatile int32_t last_status;           /* w: client, r: engine and client */
+	volatile uint64_t signalled_at;
+	volatile uint64_t awake_at;
+	volatile uint64_t finished_at;
+
+	/* w: client, r and cleared: engine; what the last process cycle
+	   used, when jack_control_t.perf_counters is set, see thread.c */
+	volatile uint64_t perf_cycles;
+	volatile uint64_t perf_instructions;
+	volatile uint64_t perf_llc_misses;
+
+	/* w: client, r: engine; page faults and involuntary context
+	   switches of the last process cycle, likewise, valid once
+	   fault_counts is set */
+	volatile uint32_t minor_faults;
+	volatile uint32_t major_faults;
+	volatile uint32_t involuntary_switches;
+	volatile int8_t fault_counts;
+
+	jack_uuid_t uuid JACK_CACHE_ALIGNED;    /* w: engine r: engine and client */
 	volatile char name[JACK_CLIENT_NAME_SIZE];
 	volatile char session_command[JACK_PORT_NAME_SIZE];
 	volatile jack_session_flags_t session_flags;
 	volatile ClientType type;               /* w: engine r: engine and client */
 	volatile int8_t active;                 /* w: engine r: engine and client */
 	volatile int8_t dead;                   /* r/w: engine */
-	volatile int8_t timed_out;              /* r/w: engine */
 	volatile int8_t is_timebase;            /* w: engine, r: engine and client */
 	volatile int8_t timebase_new;           /* w: engine and client, r: engine */
 	volatile int8_t is_slowsync;            /* w: engine, r: engine and client */
 	volatile int8_t active_slowsync;        /* w: engine, r: engine and client */
 	volatile int8_t sync_poll;              /* w: engine and client, r: engine */
 	volatile int8_t sync_new;               /* w: engine and client, r: engine */
+	volatile jack_unique_t sync_prepared;   /* w: client, r: engine; see transengine.c */
 	volatile pid_t pid;                     /* w: client r: engine; client pid */
 	volatile pid_t pgrp;                    /* w: client r: engine; client pgrp */
-	volatile uint64_t signalled_at;
-	volatile uint64_t awake_at;
-	volatile uint64_t finished_at;
-	volatile int32_t last_status;        /* w: client, r: engine and client */
 
 	/* indicators for whether callbacks have been set for this client.
 	   We do not include ptrs to the callbacks here (or their arguments)
@@ -296,6 +549,42 @@ typedef volatile struct {
 	volatile uint8_t latency_cbset;
 	volatile uint8_t property_cbset;
 	volatile uint8_t port_rename_cbset;
+	volatile uint8_t sync_prepare_cbset;
+	volatile uint8_t skip_cbset;
+
+	/* informational events need not be acknowledged */
+	volatile uint8_t async_events;
+
+	/* w: client, r: engine; see dagengine.c */
+	volatile uint8_t pipelined;
+
+	/* w: client, r: engine; see jack_set_process_async() */
+	volatile uint8_t async;
+
+	/* w: client, r: engine; see jack_set_process_decimation() */
+	volatile uint8_t decimation;
+
+	/* w: client, r: engine; see jack_set_graph_mirror() */
+	volatile uint8_t graph_mirror;
+
+	/* w: engine, r: client; set while the client runs in the async
+	   stage, a period behind the rest of the graph */
+	volatile uint8_t delayed;
+
+	/* w: client, r: engine; see jack_publish_latency(). Bit n is set
+	   while latency_added[n] stands in for the latency callback in
+	   mode n (a jack_latency_callback_mode_t) */
+	volatile uint8_t latency_published;
+	jack_latency_range_t latency_added[2];
+
+	/* the shared memory request channel, see jack_set_shm_requests().
+	   The client puts a request after the block and bumps
+	   request_seq; the engine answers it in place, sets reply_seq to
+	   match and posts request_done. */
+	jack_wakeup_word_t request_done JACK_CACHE_ALIGNED;
+	volatile uint32_t request_seq;          /* w: client, r: engine */
+	volatile uint32_t reply_seq;            /* w: engine, r: client */
+	volatile uint8_t shm_requests;          /* w: client, r: engine */
 
 } POST_PACKED_STRUCTURE jack_client_control_t;
 
@@ -313,6 +602,11 @@ typedef struct {
 
 } POST_PACKED_STRUCTURE jack_client_connect_request_t;
 
+/* jack_client_connect_request_t.load: TRUE opens a client, FALSE
+   closes an internal client, and JACK_CONNECT_STATS asks for a
+   jack_server_stats_t, which is the whole reply */
+#define JACK_CONNECT_STATS 2
+
 typedef struct {
 
 	jack_status_t status;
@@ -383,9 +677,120 @@ typedef enum {
 	SessionReply = 31,
 	SessionHasCallback = 32,
 	PropertyChangeNotify = 33,
-	PortNameChanged = 34
+	PortNameChanged = 34,
+	GraphBatchBegin = 35,
+	GraphBatchEnd = 36,
+	GetClientLoad = 37,
+	PropertySet = 38,
+	PropertyRemove = 39,
+	PropertyRemoveAll = 40,
+	ConnectBatch = 41,
+	PortBatch = 42,
+	SetSampleRate = 43,
+	SetTempoMap = 44,
+	FreeWheelRange = 45,
+	PortTypeRegister = 46,
+	SetFreeWheelBufferSize = 47,
+	SetConnectionGain = 48,
+	PropertyBatch = 49
 } RequestType;
 
+/* Process callback execution times (awake_at to finished_at) of one
+ * client over the last JACK_CLIENT_LOAD_WINDOW cycles it ran in.
+ */
+#define JACK_CLIENT_LOAD_WINDOW 1024    /* power of two */
+
+typedef struct {
+	uint32_t cycles;                /* samples in the window */
+	float p50_usecs;
+	float p99_usecs;
+	float max_usecs;
+
+	/* with --perf-counters, from the cycles that have samples:
+	   instructions per cycle and last level cache misses */
+	uint32_t perf_cycles;
+	float p50_ipc;
+	float p1_ipc;                   /* the worst 1% */
+	float p50_llc_misses;
+	float p99_llc_misses;
+
+	/* likewise, page faults and involuntary context switches: a
+	   process thread that is locked in memory, with its stack
+	   touched, takes none */
+	uint32_t fault_cycles;
+	float p99_minor_faults;
+	float max_minor_faults;
+	uint32_t major_faults;          /* over the window */
+	uint32_t preempted_cycles;      /* with an involuntary switch */
+} POST_PACKED_STRUCTURE jack_client_load_t;
+
+/* A snapshot of the server's statistics, for supervisors that poll
+ * it without joining the graph: jackctl_server_get_stats() in the
+ * server's process, jack_server_stats_query() from any other. It is
+ * one block, which the caller releases with jack_free(): the fixed
+ * part, the loads of the active clients, then the text the driver
+ * adds to --metrics, if any, at driver_metrics bytes from the start.
+ */
+#define JACK_SERVER_STATS_VERSION 1
+#define JACK_SERVER_STATS_XRUN_CAUSES 3 /* driver, wakeup, client */
+#define JACK_SERVER_STATS_MAX (16 * 1024 * 1024)
+
+typedef struct {
+	char name[JACK_CLIENT_NAME_SIZE];
+	jack_client_load_t load;
+} POST_PACKED_STRUCTURE jack_server_client_stats_t;
+
+typedef struct {
+	uint32_t version;
+	uint32_t size;                  /* of the whole block */
+	float cpu_load;                 /* percent, smoothed */
+	float max_delayed_usecs;
+	jack_nframes_t buffer_size;
+	jack_nframes_t sample_rate;
+	uint64_t xruns[JACK_SERVER_STATS_XRUN_CAUSES];
+
+	/* cycle times over the cycle trace ring, none without one */
+	uint32_t cycles;
+	float p50_cycle_usecs;
+	float p90_cycle_usecs;
+	float p99_cycle_usecs;
+	float max_cycle_usecs;
+
+	uint32_t driver_metrics;        /* offset of the driver's text, 0 if none */
+	uint32_t nclients;
+	jack_server_client_stats_t clients[0];
+} POST_PACKED_STRUCTURE jack_server_stats_t;
+
+/* One change of a ConnectBatch request. The server applies them in
+ * order and fills in status as jack_connect() or jack_disconnect()
+ * would have returned it. A change with an empty source_port names
+ * its ports by id instead, see jack_graph_snapshot_restore().
+ */
+#define JACK_CONNECT_BATCH_MAX 1024     /* changes per request */
+
+typedef struct {
+	char source_port[JACK_PORT_NAME_SIZE];
+	char destination_port[JACK_PORT_NAME_SIZE];
+	int32_t connect;                /* 0 to disconnect */
+	int32_t status;
+	jack_port_id_t source_id;
+	jack_port_id_t destination_id;
+} POST_PACKED_STRUCTURE jack_connection_op_t;
+
+/* One registration or removal of a PortBatch request. The server
+ * fills in status, and port_id for a registration.
+ */
+#define JACK_PORT_BATCH_MAX 1024        /* changes per request */
+
+typedef struct {
+	char name[JACK_PORT_NAME_SIZE];
+	char type[JACK_PORT_TYPE_SIZE];
+	uint32_t flags;
+	jack_port_id_t port_id;         /* the port to remove */
+	int32_t reg;                    /* 0 to remove */
+	int32_t status;
+} POST_PACKED_STRUCTURE jack_port_op_t;
+
 struct _jack_request {
 
 	//RequestType type;
@@ -403,6 +808,25 @@ struct _jack_request {
 			char source_port[JACK_PORT_NAME_SIZE];
 			char destination_port[JACK_PORT_NAME_SIZE];
 		} POST_PACKED_STRUCTURE connect;
+		struct {
+			char source_port[JACK_PORT_NAME_SIZE];
+			char destination_port[JACK_PORT_NAME_SIZE];
+			float gain;
+		} POST_PACKED_STRUCTURE connection_gain;
+		struct {
+			uint32_t count;
+			jack_connection_op_t *ops; /* not delivered inline, see oop_client_deliver_request() */
+		} POST_PACKED_STRUCTURE connect_batch;
+		struct {
+			uint32_t count;
+			jack_uuid_t client_id;
+			jack_port_op_t *ops; /* not delivered inline either */
+		} POST_PACKED_STRUCTURE port_batch;
+		struct {
+			uint32_t count;
+			uint32_t size;
+			const char *data; /* nor this, see jack_property_batch_unpack() */
+		} POST_PACKED_STRUCTURE property_batch;
 		struct {
 			char path[JACK_PORT_NAME_SIZE];
 			jack_session_event_type_t type;
@@ -429,6 +853,10 @@ struct _jack_request {
 			char name[JACK_CLIENT_NAME_SIZE];
 			jack_uuid_t uuid;
 		} POST_PACKED_STRUCTURE reservename;
+		struct {
+			char name[JACK_CLIENT_NAME_SIZE];
+			jack_client_load_t load;
+		} POST_PACKED_STRUCTURE client_load;
 		struct {
 			//jack_options_t options;
 			uint32_t options;
@@ -443,6 +871,27 @@ struct _jack_request {
 			size_t keylen;
 			const char* key; /* not delivered inline to server, see oop_client_deliver_request() */
 		} POST_PACKED_STRUCTURE property;
+		struct {
+			jack_uuid_t uuid;
+			size_t keylen;
+			size_t valuelen;
+			size_t typelen;         /* 0 if there is no type */
+			const char* key;        /* none of these delivered inline either */
+			const char* value;
+			const char* type;
+		} POST_PACKED_STRUCTURE property_set;
+		jack_tempo_map_t tempo_map;
+		struct {
+			jack_uuid_t client_id;
+			jack_nframes_t start;
+			jack_nframes_t end;
+		} POST_PACKED_STRUCTURE freewheel_range;
+		struct {
+			char type[JACK_PORT_TYPE_SIZE];
+			jack_shmsize_t buffer_size;
+			uint32_t nbuffers;
+			uint32_t flags;
+		} POST_PACKED_STRUCTURE port_type;
 		jack_uuid_t client_id;
 		jack_nframes_t nframes;
 		jack_time_t timeout;
@@ -452,10 +901,45 @@ struct _jack_request {
 	int32_t status;
 } POST_PACKED_STRUCTURE;
 
+/* On the request socket, a request and its reply are each a
+ * jack_request_header_t followed by the first `size' bytes of the x
+ * union, only as many as jack_request_size() says the type uses, then
+ * whatever the type carries out of line.
+ */
+typedef struct {
+	uint32_t type;
+	uint32_t size;
+	int32_t status;
+} POST_PACKED_STRUCTURE jack_request_header_t;
+
+/* the most out of line pieces jack_request_send() takes */
+#define JACK_REQUEST_IOV_MAX 4
+
+/* An external client's control block is followed by the request slot
+ * of its shared memory request channel, see jack_set_shm_requests().
+ */
+#define JACK_CLIENT_CONTROL_SIZE \
+	(sizeof(jack_client_control_t) + sizeof(jack_request_t))
+#define jack_client_shm_request(ctl) \
+	((volatile jack_request_t*)((jack_client_control_t*)(ctl) + 1))
+
 /* Per-client structure allocated in the server's address space.
  * It's here because its not part of the engine structure.
  */
 
+/* one cycle's hardware counter readings, see jack_perf_counters_t */
+typedef struct {
+	float ipc;                      /* instructions per CPU cycle */
+	uint32_t llc_misses;
+} jack_client_perf_sample_t;
+
+/* and its page faults and involuntary context switches */
+typedef struct {
+	uint32_t minor_faults;
+	uint16_t major_faults;
+	uint16_t involuntary_switches;
+} jack_client_fault_sample_t;
+
 typedef struct _jack_client_internal {
 
 	jack_client_control_t *control;
@@ -464,20 +948,59 @@ typedef struct _jack_client_internal {
 	int event_fd;
 	int subgraph_start_fd;
 	int subgraph_wait_fd;
+	int subgraph_start_slot;        /* FIFO/wakeup word numbers */
+	int subgraph_wait_slot;
+	int wait_slot;                  /* execution order as last sent */
+	int wait_upstream;              /* upstream_is_jackd as last sent */
+	int wake_word;                  /* its own wakeup word, or -1 */
+	int wake_next;                  /* the word it hands on to, as last sent */
+	int graph_batch;                /* open jack_graph_batch_begin()s */
+	char *event_queue;              /* events held back by an event batch */
+	size_t event_queue_len;
+	size_t event_queue_size;
+	size_t event_queue_last;        /* offset of the last queued event */
 	JSList    *ports;       /* protected by engine->client_lock */
 	JSList    *truefeeds;   /* protected by engine->client_lock */
 	JSList    *sortfeeds;   /* protected by engine->client_lock */
 	int fedcount;
 	int tfedcount;
+	int sort_pending;                       /* scratch for the graph sort */
+	int latency_dirty;                      /* see jack_compute_new_latency() */
+	unsigned int sort_index;                /* see engine->reach */
 	jack_shm_info_t control_shm;
 	unsigned long execution_order;
 	struct  _jack_client_internal *next_client;     /* not a linked list! */
 	dlhandle handle;
 	int (*initialize)(jack_client_t*, const char*); /* int. clients only */
 	void (*finish)(void *);                         /* internal clients only */
+	int embedded;                   /* see jackctl_server_open_client() */
 	int error;
+	volatile int late;              /* see jack_client_clear_late() */
+	int skipped;                    /* see jack_mark_live_clients() */
+	int live;                       /* scratch for the same */
+	int muted;                      /* see jack_mute_late_client() */
 
 	int session_reply_pending;
+	jack_time_t session_deadline;   /* see jack_check_session_deadlines() */
+
+	/* ring of recent execution times, see jack_client_load_sample() */
+	uint32_t *load_usecs;
+	unsigned int load_next;
+	unsigned int load_count;
+
+	/* and of counter readings, with --perf-counters */
+	jack_client_perf_sample_t *perf_samples;
+	unsigned int perf_next;
+	unsigned int perf_count;
+	jack_client_fault_sample_t *fault_samples;
+	unsigned int fault_next;
+	unsigned int fault_count;
+
+	/* p99 process times of this client, of the subgraph it heads and
+	   of the clients after that, see jack_client_update_budgets() */
+	uint32_t p99_usecs;
+	volatile uint32_t subgraph_p99_usecs;
+	volatile uint32_t after_p99_usecs;
 
 #ifdef JACK_USE_MACH_THREADS
 	/* specific resources for server/client real-time thread communication */
@@ -497,14 +1020,113 @@ typedef struct _jack_thread_arg {
 	int realtime;
 	void* arg;
 	pid_t cap_pid;
+	int workgroup;                  /* join the audio device's, see below */
 } jack_thread_arg_t;
 
+/* On macOS, realtime threads join the audio device's IO workgroup, so
+ * that the scheduler knows their deadline and keeps them off the
+ * efficiency cores of Apple Silicon. The CoreAudio driver publishes
+ * the workgroup with jack_workgroup_publish(). Threads from
+ * jack_client_create_thread() join it as they start; the process
+ * threads, DAG workers and slave I/O threads follow it when the driver
+ * changes through JACK_WORKGROUP_UPDATE(), once a cycle.
+ */
+#if defined(JACK_USE_MACH_THREADS) && defined(HAVE_OS_WORKGROUP_H)
+#define JACK_USE_OS_WORKGROUP 1
+#include <os/workgroup.h>
+extern void jack_workgroup_publish(jack_control_t *control,
+				   os_workgroup_t workgroup);
+extern void jack_workgroup_update(jack_control_t *control);
+extern void jack_workgroup_join(jack_client_t *client);
+#define JACK_WORKGROUP_UPDATE(control)	jack_workgroup_update (control)
+#else
+#define JACK_WORKGROUP_UPDATE(control)
+#endif
+
+/* CPU affinity, in libjack/thread.c. Realtime threads created by
+ * jack_client_create_thread() are placed on the CPUs given to the
+ * server with --rt-cpus, or for an external client, on those given
+ * to jack_set_process_thread_cpus(), $JACK_PROCESS_CPUS or the
+ * server's --client-cpus, in that order.
+ */
+extern int jack_thread_set_cpus(pthread_t thread, const char *cpus);
+extern int jack_cpu_list_nth(const char *cpus, unsigned int n);
+extern const char *jack_isolated_cpus(void);
+extern void jack_set_realtime_cpus(const char *cpus);
+extern const char *jack_realtime_cpus(void);
+
+/* SCHED_DEADLINE, in libjack/thread.c. A realtime thread starts out
+ * under SCHED_FIFO; when jack_control_t.deadline is set, the thread
+ * running cycles feeds its execution time of each cycle to
+ * jack_deadline_sample(), which every JACK_DEADLINE_WINDOW cycles
+ * moves the thread to SCHED_DEADLINE with a budget derived from the
+ * longest of them. If the kernel refuses, the thread stays on FIFO.
+ */
+#define JACK_DEADLINE_WINDOW 256
+
+typedef struct {
+	jack_time_t period;             /* 0 while not under SCHED_DEADLINE */
+	jack_time_t runtime;
+	jack_time_t max_usecs;          /* longest cycle in this window */
+	unsigned int cycles;
+	int refused;
+} jack_deadline_t;
+
+extern int jack_acquire_deadline_scheduling(jack_time_t runtime,
+					    jack_time_t period);
+extern void jack_deadline_sample(jack_deadline_t *dl, jack_time_t usecs,
+				 jack_time_t period);
+
+/* Hardware performance counters, in libjack/thread.c. When
+ * jack_control_t.perf_counters is set, each thread that runs process
+ * callbacks opens a perf_event group counting CPU cycles, instructions
+ * and last level cache misses in user space, and reads it around
+ * every callback into the client's jack_client_control_t; the engine
+ * keeps them in the client's load window beside its execution times.
+ * A thread the kernel refuses counters to (perf_event_paranoid, no
+ * PMU in a VM) goes without. Linux only.
+ *
+ * Every such thread also counts its minor and major page faults and
+ * involuntary context switches with getrusage (RUSAGE_THREAD), which
+ * needs no permission, whether it got hardware counters or not.
+ */
+#define JACK_PERF_COUNTERS 3
+#define JACK_PERF_RUSAGE   3    /* minor, major faults, involuntary switches */
+
+typedef struct {
+	int fd[JACK_PERF_COUNTERS];     /* fd[0] leads the group, -1 if none */
+	uint64_t start[JACK_PERF_COUNTERS];
+	int refused;
+	long rusage_start[JACK_PERF_RUSAGE];
+} jack_perf_counters_t;
+
+extern void jack_perf_counters_init(jack_perf_counters_t *pc);
+extern int  jack_perf_counters_open(jack_perf_counters_t *pc);
+extern void jack_perf_counters_close(jack_perf_counters_t *pc);
+extern void jack_perf_counters_start(jack_perf_counters_t *pc);
+extern void jack_perf_counters_stop(jack_perf_counters_t *pc,
+				    jack_client_control_t *ctl);
+
 extern int  jack_client_handle_port_connection(jack_client_t *client,
 					       jack_event_t *event);
+extern int  jack_client_handle_port_gain(jack_client_t *client,
+					 const jack_event_t *event);
+extern void jack_graph_mirror_event(jack_client_t *client,
+				    const jack_event_t *event);
 extern jack_client_t *jack_driver_client_new(jack_engine_t *,
 					     const char *client_name);
 extern jack_client_t *jack_client_alloc_internal(jack_client_control_t*,
 						 jack_engine_t*);
+extern void jack_client_regex_free(jack_client_t *client);
+
+extern size_t jack_request_size(uint32_t type);
+extern int  jack_request_send(int fd, jack_request_t *req,
+			      const struct iovec *extra, int nextra);
+extern int  jack_request_recv(int fd, jack_request_t *req);
+extern int  jack_request_shm_ok(uint32_t type);
+extern void jack_request_copy(jack_request_t *dst, const jack_request_t *src);
+extern int  jack_request_readv(int fd, struct iovec *iov, int iovcnt);
+extern int  jack_request_writev(int fd, struct iovec *iov, int iovcnt);
 
 /* internal clients call this. it's defined in jack/engine.c */
 void handle_internal_client_request(jack_control_t*, jack_request_t*);
@@ -518,6 +1140,7 @@ extern char *jack_server_dir(const char *server_name, char *server_dir);
 extern void *jack_zero_filled_buffer;
 
 extern jack_port_functions_t jack_builtin_audio_functions;
+extern jack_port_functions_t jack_builtin_NULL_functions;
 
 extern jack_port_type_info_t jack_builtin_port_types[];
 
@@ -527,6 +1150,65 @@ extern void jack_transport_copy_position(jack_position_t *from,
 					 jack_position_t *to);
 extern void jack_call_sync_client(jack_client_t *client);
 
+extern void jack_call_sync_prepare(jack_client_t *client,
+				   const jack_event_t *event);
+
+/* A sync prepare callback hears about a transport relocation as soon
+ * as the server sees the request, before the process cycle in which
+ * slow-sync clients are first polled, so that every client can start
+ * seeking (reading ahead from disk, say) at the same time. It runs in
+ * the client's event thread, which in this implementation is also its
+ * process thread, so it must not block: hand the work to another
+ * thread. Returning non-zero says the client is already ready to roll
+ * at `pos', and its JackSyncCallback is then not waited for when the
+ * transport starts there. These belong in <jack/transport.h>.
+ */
+typedef int (*JackSyncPrepareCallback)(const jack_position_t *pos, void *arg);
+
+extern int jack_set_sync_prepare_callback(jack_client_t *client,
+					  JackSyncPrepareCallback prepare_callback,
+					  void *arg);
+
+/* Like jack_transport_query(), but only the frame number at the start
+ * of the current cycle, without copying the whole position. This
+ * belongs in <jack/transport.h>.
+ */
+extern jack_transport_state_t jack_transport_query_frame(const jack_client_t *client,
+							 jack_nframes_t *frame);
+
+/* Give the server a tempo map of count segments (see
+ * jack_tempo_segment_t), replacing any it had; a count of 0 removes
+ * it. While there is a map and no timebase master, the server fills
+ * in the BBT fields of the transport position itself every cycle.
+ * Returns zero, or EINVAL if the segments are out of order or out of
+ * range. These belong in <jack/transport.h>.
+ */
+extern int jack_transport_set_tempo_map(jack_client_t *client,
+					const jack_tempo_segment_t *segments,
+					uint32_t count);
+
+/* Convert between a frame and BBT time with the server's tempo map,
+ * from any thread, without asking the server. jack_transport_frame_to_bbt()
+ * fills in the BBT fields of `pos' and sets JackPositionBBT in its
+ * valid mask, jack_transport_bbt_to_frame() reads bar, beat and tick.
+ * Both return zero, ENOENT if there is no map, or ERANGE.
+ */
+extern int jack_transport_frame_to_bbt(const jack_client_t *client,
+				       jack_nframes_t frame,
+				       jack_position_t *pos);
+extern int jack_transport_bbt_to_frame(const jack_client_t *client,
+				       const jack_position_t *pos,
+				       jack_nframes_t *frame);
+
+/* the conversions themselves, shared with the engine */
+extern int jack_tempo_map_to_bbt(const jack_tempo_map_t *map,
+				 jack_nframes_t frame_rate,
+				 jack_nframes_t frame, jack_position_t *pos);
+extern int jack_tempo_map_to_frame(const jack_tempo_map_t *map,
+				   jack_nframes_t frame_rate,
+				   const jack_position_t *pos,
+				   jack_nframes_t *frame);
+
 extern void jack_call_timebase_master(jack_client_t *client);
 
 extern char *jack_default_server_name(void);
@@ -537,15 +1219,548 @@ void silent_jack_error_callback(const char *desc);
 extern jack_port_t *jack_port_by_id_int(const jack_client_t *client,
 					jack_port_id_t id, int* free);
 
+/* Connection changes made between these are applied to the process
+ * graph with a single re-sort when the outermost batch ends. They
+ * belong in <jack/jack.h>, which comes from the shared headers.
+ */
+extern int jack_graph_batch_begin(jack_client_t *client);
+extern int jack_graph_batch_end(jack_client_t *client);
+
+/* Declare the latency a client adds between its inputs and outputs in
+ * one mode, instead of answering latency callbacks for it: the server
+ * then works out the client's port latencies itself, as the default
+ * latency handling would plus `range', without asking the client. A
+ * NULL range goes back to the callback (or the default). Also belongs
+ * in <jack/jack.h>.
+ */
+extern int jack_publish_latency(jack_client_t *client,
+				jack_latency_callback_mode_t mode,
+				const jack_latency_range_t *range);
+
+/* Apply count connections and disconnections with as few server round
+ * trips as possible (one per JACK_CONNECT_BATCH_MAX changes) and a
+ * single re-sort of the graph. Each change's status is set to what
+ * jack_connect() or jack_disconnect() would have returned; the result
+ * is non-zero only if the server could not be asked. Also belongs in
+ * <jack/jack.h>.
+ */
+typedef struct {
+	const char *source_port;
+	const char *destination_port;
+	int connect;                    /* 0 to disconnect */
+	int status;
+} jack_connection_change_t;
+
+extern int jack_change_connections(jack_client_t *client,
+				   jack_connection_change_t *changes,
+				   uint32_t count);
+
+/* Render the transport range [start, end) in freewheel mode: locate
+ * the transport to start, roll it, and freewheel until it gets to
+ * end, after which the server stops the transport and goes back to
+ * the driver on its own; clients see the usual freewheel callbacks.
+ * With the session preloaded on several servers, a controller can
+ * give each a part of the timeline, or of the stems, and merge what
+ * they write. Returns non-zero if the server is freewheeling already,
+ * or start is not before end. Also belongs in <jack/jack.h>.
+ */
+extern int jack_set_freewheel_range(jack_client_t *client,
+				    jack_nframes_t start, jack_nframes_t end);
+
+/* Have the server run the graph in blocks of nframes, a power of two
+ * up to JACK_FREEWHEEL_MAX_BUFFER_SIZE, whenever it freewheels, and go
+ * back to the driver's period when it stops; 0, the default, keeps
+ * the driver's period. Every cycle costs the same wakeups and
+ * bookkeeping whatever its length, so an offline render in blocks of
+ * thousands of frames is bounded by its DSP rather than by those.
+ * Clients see the change through their buffer size callbacks, before
+ * the freewheel callback on the way in and after it on the way out.
+ * The server keeps the driver's period if a backup driver or a clock
+ * domain is loaded. Takes effect at the next start of freewheeling.
+ * Also belongs in <jack/jack.h>.
+ */
+#define JACK_FREEWHEEL_MAX_BUFFER_SIZE 16384
+extern int jack_set_freewheel_buffer_size(jack_client_t *client,
+					  jack_nframes_t nframes);
+
+/* Save the whole port graph in a compact binary form (see graphsnap.h)
+ * in a buffer allocated with malloc(), for
+ * jack_graph_snapshot_restore() to make its connections again later,
+ * typically from a session save and load. Returns zero on success.
+ * Also belongs in <jack/jack.h>.
+ */
+extern int jack_graph_snapshot_save(jack_client_t *client,
+				    void **data, size_t *size);
+
+/* Make the connections of a snapshot, in bulk: ports are found by
+ * their client's UUID, or its name if no client has that UUID any
+ * more, and their own name; the connections then go to the server by
+ * port id, in as few requests as jack_change_connections() would need,
+ * with a single re-sort of the graph. The metadata saved with them is
+ * set again on those clients and ports with jack_set_properties_bulk().
+ * Returns the number of connections and properties that could not be
+ * made, or -1 if the snapshot is not valid. Also belongs in
+ * <jack/jack.h>.
+ */
+extern int jack_graph_snapshot_restore(jack_client_t *client,
+				       const void *data, size_t size);
+
+/* Register or remove many ports of this client with as few server
+ * round trips as possible (one per JACK_PORT_BATCH_MAX ports), and
+ * one batch of registration events per client for each. Each
+ * registration's port is set as jack_port_register() would have
+ * returned it, NULL if it failed; jack_port_unregister_many() fails
+ * if any of the ports could not be removed. Also belong in
+ * <jack/jack.h>.
+ */
+typedef struct {
+	const char *port_name;
+	const char *port_type;
+	unsigned long flags;
+	unsigned long buffer_size;
+	jack_port_t *port;
+} jack_port_registration_t;
+
+extern int jack_port_register_many(jack_client_t *client,
+				   jack_port_registration_t *ports,
+				   uint32_t count);
+extern int jack_port_unregister_many(jack_client_t *client,
+				     jack_port_t **ports, uint32_t count);
+
+/* Add a port type for data that is not a period of audio or MIDI,
+ * video frames or spectra, say. Its ports have buffers of buffer_size
+ * bytes whatever the period, in a segment of the type's own with room
+ * for nports output ports, or one per port the server allows if
+ * nports is 0. Large segments are backed by huge pages where the
+ * system has them. An input port of the type with several connections
+ * has them mixed by mixdown, or cannot have several if mixdown is NULL.
+ *
+ * Every client that uses the type registers it with the same size,
+ * number of ports and with or without a mixdown; the first one adds it
+ * to the server, the others find it there and set their own mixdown.
+ * Only JACK_MAX_PORT_TYPES types fit, the builtin ones included, and
+ * they last as long as the server. Returns 0, or -1 if the type is
+ * registered differently already or there is no room for it. Also
+ * belongs in <jack/jack.h>.
+ */
+extern int jack_port_type_register(jack_client_t *client,
+				   const char *port_type,
+				   size_t buffer_size, uint32_t nports,
+				   JackPortTypeMixdownCallback mixdown,
+				   void *arg);
+
+/* Let the server deliver port and client registration, graph order,
+ * property and port rename notifications without waiting for this
+ * client to handle them. Also belongs in <jack/jack.h>.
+ */
+extern int jack_set_async_notifications(jack_client_t *client, int onoff);
+
+/* Say that this client's output in one cycle does not depend on its
+ * own output in the cycle before, so that while freewheeling with
+ * parallel (DAG) execution the server may start the next cycle before
+ * this client has finished the current one. Its output then reaches
+ * clients downstream of it no later than usual, but the server does
+ * not wait for it to end a cycle. Has no effect otherwise. Also
+ * belongs in <jack/jack.h>.
+ */
+extern int jack_set_process_pipelined(jack_client_t *client, int onoff);
+
+/* Say that this client does not need same-cycle results, as for
+ * metering, analysis or recording. The server then runs it alongside
+ * the next cycle, off the chain the other clients wait on, from what
+ * its inputs held at the end of the last one; what it writes reaches
+ * other clients a cycle later too. The port latencies it sees include
+ * the extra period. Must be called before jack_activate(), and has no
+ * effect with parallel (DAG) execution. Also belongs in <jack/jack.h>.
+ */
+extern int jack_set_process_async(jack_client_t *client, int onoff);
+
+/* Run this client in the async stage (see jack_set_process_async())
+ * only once every `periods' cycles, if the server keeps a port history
+ * (jackd --async-history). The stage then runs as often as its most
+ * frequent client asks for. The process callback still gets one
+ * period; jack_port_get_history() gives the whole block since the
+ * last run. Must be called before jack_activate(). Also belongs in
+ * <jack/jack.h>.
+ */
+extern int jack_set_process_decimation(jack_client_t *client,
+				       unsigned int periods);
+
+/* In the process callback of a client in the async stage, the audio
+ * that the output connected to input `port' wrote in the periods since
+ * the stage last ran, oldest first, as one contiguous block. Sets
+ * *nframes to its length, a whole number of periods. NULL unless the
+ * stage runs less often than every cycle, and the port has exactly
+ * one connection, to an output the server keeps history for. Also
+ * belongs in <jack/jack.h>.
+ */
+extern const jack_default_audio_sample_t *
+jack_port_get_history(jack_client_t *client, jack_port_t *port,
+		      jack_nframes_t *nframes);
+
+/* Keep a copy of the port graph in this client, built from shared
+ * memory when the mirror is turned on and again on activation, and
+ * kept up to date from the port registration and connection events
+ * the server then sends whether or not the client has callbacks for
+ * them. jack_port_by_id(), jack_port_by_name() and
+ * jack_port_get_all_connections() are then answered without asking
+ * the server or allocating a port handle per call. Must be called
+ * before jack_activate(). Also belongs in <jack/jack.h>.
+ */
+extern int jack_set_graph_mirror(jack_client_t *client, int onoff);
+
+/* Send this client's requests through shared memory instead of its
+ * socket, with a futex to wake the server and another to wake the
+ * client for the reply, when the server supports it; those that carry
+ * data out of line still use the socket. Setting JACK_SHM_REQUESTS=1
+ * in the environment turns it on when the client is opened. Also
+ * belongs in <jack/jack.h>.
+ */
+extern int jack_set_shm_requests(jack_client_t *client, int onoff);
+
+/* Connection queries by port ID (see jack_port_id_t), answered from
+ * shared memory without allocating or comparing names.
+ * jack_port_ids_connected() tells whether two ports are connected to
+ * each other. jack_port_get_connection_ids() stores the IDs of up to
+ * `max' ports connected to `port_id' in `ids', in ID order, and
+ * returns how many there are in all, which may be more than `max'.
+ * Both may be called for ports of any client. Also belong in
+ * <jack/jack.h>.
+ */
+extern int jack_port_ids_connected(jack_client_t *client,
+				   jack_port_id_t a, jack_port_id_t b);
+extern int jack_port_get_connection_ids(jack_client_t *client,
+					jack_port_id_t port_id,
+					jack_port_id_t *ids, int max);
+
+/* Place this client's process thread on the given CPUs, now if it is
+ * running and whenever it is started. An empty list lets it run
+ * anywhere. Also belongs in <jack/jack.h>.
+ */
+extern int jack_set_process_thread_cpus(jack_client_t *client, const char *cpus);
+
+/* Allocation from a per-client, pre-faulted and locked pool that is
+ * safe to use from the process thread. Requests above 4096 bytes, or
+ * made when the pool is exhausted, return NULL. The pool is created
+ * by jack_activate(); its size defaults to $JACK_RT_POOL_SIZE or
+ * 256kB and can only be changed before activation. These also belong
+ * in <jack/jack.h>.
+ */
+extern int jack_rt_pool_set_size(jack_client_t *client, size_t bytes);
+extern void *jack_rt_alloc(jack_client_t *client, size_t bytes);
+extern void jack_rt_free(jack_client_t *client, void *ptr);
+
+/* Before a client first goes live, jack_activate() can have its
+ * process thread call process() a number of times, so that the code
+ * and data it touches and its port buffers are faulted in and its
+ * first cycles in the graph do not xrun. The ports are not connected
+ * yet: inputs are silent and outputs are heard by no one. The number
+ * defaults to $JACK_WARMUP_CYCLES or 0 and can only be set before
+ * the first activation. jack_is_warming_up() tells process() that it
+ * is running such a cycle, e.g. to leave transport or other state
+ * alone. These also belong in <jack/jack.h>.
+ */
+#define JACK_WARMUP_MAX 64
+extern int jack_set_warmup_cycles(jack_client_t *client, int cycles);
+extern int jack_is_warming_up(const jack_client_t *client);
+
+/* What every thread made by jack_client_create_thread(), the process
+ * thread among them, does about denormal floats before running any
+ * client code: flush results to zero (FTZ), treat inputs as zero
+ * (DAZ), or with 0, leave the mode it inherited alone. On ARM both
+ * set the one flush-to-zero mode there is. The policy is process
+ * wide, applies to threads created after it is set, and defaults to
+ * $JACK_DENORMALS ("ftz", "daz", "ftz,daz" or "none") or both. These
+ * also belong in <jack/jack.h>.
+ */
+#define JACK_DENORMALS_FTZ 0x1
+#define JACK_DENORMALS_DAZ 0x2
+extern int jack_set_denormal_policy(int policy);
+extern int jack_get_denormal_policy(void);
+
+/* When the server runs with --selective-mlock, realtime clients lock
+ * only their shared memory, the stacks of their realtime threads and
+ * their RT pool and mixdown memory, not the whole process.  Code the
+ * process callback calls into must then be registered, e.g. with the
+ * bounds of a section the client places its DSP code in; this is a
+ * no-op otherwise.  jack_get_locked_footprint() gives the bytes of the
+ * process that are locked in memory.  These also belong in
+ * <jack/jack.h>.
+ */
+extern int jack_lock_code_region(jack_client_t *client, const void *start,
+				 size_t len);
+extern size_t jack_get_locked_footprint(jack_client_t *client);
+
+/* Ask the server to run its driver at another sample rate, without
+ * restarting: clients, ports and connections all stay, and every
+ * client's sample rate callback runs with the new rate.  Returns
+ * ENOSYS if the driver cannot do this, EBUSY while a backup or slave
+ * driver is loaded.  Also belongs in <jack/jack.h>.
+ */
+extern int jack_change_sample_rate(jack_client_t *client,
+				   jack_nframes_t rate);
+
+/* With --skip-dead, the server does not run clients whose output does
+ * not reach a driver, a terminal input port or the timebase master.
+ * A skip callback hears, in the client's event thread, when the
+ * client stops being run (`skipped' non-zero) and when it is run
+ * again, so that it can reset its state. Also belongs in
+ * <jack/jack.h>.
+ */
+typedef int (*JackProcessSkipCallback)(int skipped, void *arg);
+
+extern int jack_set_process_skip_callback(jack_client_t *client,
+					  JackProcessSkipCallback callback,
+					  void *arg);
+
+/* Say, from the process callback, that an output port carries silence
+ * this cycle; its buffer need not be written then. Clients reading it
+ * get a zero buffer, and multiple inputs are mixed without it.
+ * jack_port_is_silent() tells whether an output port was marked, or
+ * whether all that is connected to an input port is silent, so that
+ * DSP can be skipped. Marks last for one cycle. Also belong in
+ * <jack/jack.h>.
+ */
+extern void jack_port_mark_silent(jack_port_t *port);
+extern int jack_port_is_silent(jack_port_t *port);
+
+/* Say, from the process callback, that output port `output' carries
+ * exactly what input port `input' of the same client receives this
+ * cycle, as a bypassed effect or a routing matrix would.  Readers of
+ * `output' then get the buffer `input' resolves to, with no copy; the
+ * owner need not write its own buffer.  An input with several
+ * connections has only a private mix, so it is copied instead.  Like
+ * marks of silence, lasts for one cycle.  Returns 0, or -1 if the
+ * ports are not an output and an input of the same type and client.
+ * Also belongs in <jack/jack.h>.
+ */
+extern int jack_port_forward(jack_port_t *output, jack_port_t *input);
+
+/* jack_port_get_buffer() of ports[n] into buffers[n], for n up to
+ * nports, with the mixdowns of multiply connected inputs done together
+ * after the rest.  Returns 0, or -1 if any of the ports has no buffer
+ * (its entry is then NULL).  Also belongs in <jack/jack.h>.
+ */
+extern int jack_port_get_buffers(jack_port_t * const *ports, void **buffers,
+				 unsigned int nports, jack_nframes_t nframes);
+
+/* Scale what the connection from source_port to destination_port, two
+ * audio ports, contributes to the destination by gain: the owner of
+ * the destination applies it while it sums its inputs, in place of a
+ * client that does nothing but scale a signal.  A change ramps in
+ * over the destination's next cycle.  Connections start at 1.0, and a
+ * new connection between the same ports does again.  Returns 0, or
+ * non-zero if the ports are not connected.  Also belongs in
+ * <jack/jack.h>.
+ */
+extern int jack_set_connection_gain(jack_client_t *client,
+				    const char *source_port,
+				    const char *destination_port,
+				    float gain);
+
+/* The gain, as last set, of the connection from source to an input
+ * port of the calling client; 1.0 if there is none.  Also belongs in
+ * <jack/jack.h>.
+ */
+extern float jack_port_get_connection_gain(const jack_port_t *port,
+					   const jack_port_t *source);
+
+/* Fill in *load for the named client; non-zero if there is no such
+ * client. Also a candidate for <jack/jack.h>.
+ */
+extern int jack_get_client_load(jack_client_t *client, const char *client_name,
+				jack_client_load_t *load);
+
+/* The statistics of the named server (NULL for the default), asked
+ * for on its socket without opening a client; NULL if it cannot be
+ * reached. Release with jack_free(). Also a candidate for
+ * <jack/jack.h>.
+ */
+extern jack_server_stats_t *jack_server_stats_query(const char *server_name);
+
+/* The same from the control API, for the server it runs; NULL if it
+ * is not running. Belongs in <jack/control.h>.
+ */
+struct jackctl_server;
+extern jack_server_stats_t *jackctl_server_get_stats(struct jackctl_server *server);
+
+/* A client of a server started with jackctl_server_start() in the
+ * calling process, made as an internal client with nothing to load:
+ * the usual API works on it, and its process callback runs in the
+ * engine's thread with the drivers and the other internal clients,
+ * with no FIFOs, sockets or wakeups between them.  So it must keep to
+ * what is safe in a realtime thread, and never block.  External
+ * clients still connect as usual.  Close it with
+ * jackctl_server_close_client(), not jack_client_close(), before the
+ * server stops.  NULL on failure, with the reason in *status if that
+ * is not NULL.  Belong in <jack/control.h>.
+ */
+extern jack_client_t *jackctl_server_open_client(struct jackctl_server *server,
+						 const char *client_name,
+						 jack_options_t options,
+						 jack_status_t *status);
+extern int jackctl_server_close_client(struct jackctl_server *server,
+				       jack_client_t *client);
+
+/* Fill in descs[n] with the properties of subjects[n], all taken from
+ * the same state of the server's metadata. Returns the total number
+ * of properties, or -1; free each description with
+ * jack_free_description (&descs[n], 0). Belongs in <jack/metadata.h>.
+ */
+extern int jack_get_properties_bulk(const jack_uuid_t *subjects,
+				    uint32_t nsubjects,
+				    jack_description_t *descs);
+
+/* One change of jack_set_properties_bulk(): set key of subject to
+ * value, with an optional type, or if value is NULL remove key, or
+ * every property of subject if key is NULL too.
+ */
+typedef struct {
+	jack_uuid_t subject;
+	const char *key;
+	const char *value;
+	const char *type;
+} jack_property_op_t;
+
+#define JACK_PROPERTY_BATCH_MAX         4096            /* changes per call */
+#define JACK_PROPERTY_BATCH_MAX_SIZE    (1024 * 1024)   /* their keys, values and types */
+
+/* Make nops changes to the metadata in one request: other clients see
+ * either none of them or all of them, and get one property change
+ * callback for the lot, with an empty subject and a NULL key, which
+ * means that anything may have changed (a batch of one change is
+ * reported as that change).  Removing what is not there is not an
+ * error.  Returns 0, or -1 if any change is malformed or there is no
+ * room for them all, in which case none is made.  Belongs in
+ * <jack/metadata.h>.
+ */
+extern int jack_set_properties_bulk(jack_client_t *client,
+				    const jack_property_op_t *ops,
+				    uint32_t nops);
+
+/* A jack_ringbuffer_t whose pages are mapped twice, back to back, so
+ * that the first segment of its read and write vectors is all there
+ * is; NULL where that cannot be done. Belongs in <jack/ringbuffer.h>.
+ */
+extern jack_ringbuffer_t *jack_ringbuffer_create_mirrored(size_t sz);
+
+/* A variant of jack_ringbuffer_t for a writer and a reader on
+ * different cores: each side's position is on its own cache line,
+ * with ordered atomic access, so that they do not contend. The calls
+ * mirror the jack_ringbuffer_*() ones, except that the whole buffer
+ * can be filled, and add bulk calls for records of a fixed size,
+ * which move as many whole records as fit in one step. Only the
+ * writer may call the write calls and only the reader the read
+ * calls; see libjack/spscring.c. These belong in <jack/ringbuffer.h>.
+ */
+typedef struct _jack_spsc_ringbuffer jack_spsc_ringbuffer_t;
+
+extern jack_spsc_ringbuffer_t *jack_spsc_ringbuffer_create(size_t sz);
+extern void jack_spsc_ringbuffer_free(jack_spsc_ringbuffer_t *rb);
+extern int jack_spsc_ringbuffer_mlock(jack_spsc_ringbuffer_t *rb);
+extern void jack_spsc_ringbuffer_reset(jack_spsc_ringbuffer_t *rb);
+
+extern size_t jack_spsc_ringbuffer_write_space(jack_spsc_ringbuffer_t *rb);
+extern size_t jack_spsc_ringbuffer_write(jack_spsc_ringbuffer_t *rb,
+					 const char *src, size_t cnt);
+extern size_t jack_spsc_ringbuffer_write_records(jack_spsc_ringbuffer_t *rb,
+						 const void *src,
+						 size_t size, size_t n);
+extern void jack_spsc_ringbuffer_write_advance(jack_spsc_ringbuffer_t *rb,
+					       size_t cnt);
+extern void jack_spsc_ringbuffer_get_write_vector(jack_spsc_ringbuffer_t *rb,
+						  jack_ringbuffer_data_t *vec);
+
+extern size_t jack_spsc_ringbuffer_read_space(jack_spsc_ringbuffer_t *rb);
+extern size_t jack_spsc_ringbuffer_read(jack_spsc_ringbuffer_t *rb,
+					char *dest, size_t cnt);
+extern size_t jack_spsc_ringbuffer_peek(jack_spsc_ringbuffer_t *rb,
+					char *dest, size_t cnt);
+extern size_t jack_spsc_ringbuffer_read_records(jack_spsc_ringbuffer_t *rb,
+						void *dest,
+						size_t size, size_t n);
+extern void jack_spsc_ringbuffer_read_advance(jack_spsc_ringbuffer_t *rb,
+					      size_t cnt);
+extern void jack_spsc_ringbuffer_get_read_vector(jack_spsc_ringbuffer_t *rb,
+						 jack_ringbuffer_data_t *vec);
+
+/* The same for a writer and a reader in two processes. The buffer is
+ * in a shared memory file: the creator passes jack_shm_ringbuffer_fd()
+ * to the other process, over a unix socket or across fork(), and that
+ * one attaches to it. The data is mapped twice back to back, so the
+ * vectors always come in vec[0] alone and can be handed to read() or
+ * write() as they are. See libjack/shmring.c. These belong in
+ * <jack/ringbuffer.h>.
+ */
+typedef struct _jack_shm_ringbuffer jack_shm_ringbuffer_t;
+
+extern jack_shm_ringbuffer_t *jack_shm_ringbuffer_create(size_t sz);
+extern jack_shm_ringbuffer_t *jack_shm_ringbuffer_attach(int fd);
+extern int jack_shm_ringbuffer_fd(const jack_shm_ringbuffer_t *rb);
+extern void jack_shm_ringbuffer_free(jack_shm_ringbuffer_t *rb);
+extern int jack_shm_ringbuffer_mlock(jack_shm_ringbuffer_t *rb);
+
+extern size_t jack_shm_ringbuffer_write_space(jack_shm_ringbuffer_t *rb);
+extern size_t jack_shm_ringbuffer_write(jack_shm_ringbuffer_t *rb,
+					const char *src, size_t cnt);
+extern void jack_shm_ringbuffer_write_advance(jack_shm_ringbuffer_t *rb,
+					      size_t cnt);
+extern void jack_shm_ringbuffer_get_write_vector(jack_shm_ringbuffer_t *rb,
+						 jack_ringbuffer_data_t *vec);
+
+extern size_t jack_shm_ringbuffer_read_space(jack_shm_ringbuffer_t *rb);
+extern size_t jack_shm_ringbuffer_read(jack_shm_ringbuffer_t *rb,
+				       char *dest, size_t cnt);
+extern size_t jack_shm_ringbuffer_peek(jack_shm_ringbuffer_t *rb,
+				       char *dest, size_t cnt);
+extern void jack_shm_ringbuffer_read_advance(jack_shm_ringbuffer_t *rb,
+					     size_t cnt);
+extern void jack_shm_ringbuffer_get_read_vector(jack_shm_ringbuffer_t *rb,
+						jack_ringbuffer_data_t *vec);
+
+/* A bounded queue of fixed-size elements for any number of threads
+ * on either side, such as worker threads feeding the process thread
+ * or the other way round; see libjack/mpmcqueue.c. push and pop are
+ * lock-free. A thread that is the only one on its side can use the
+ * _single calls, which are wait-free and meant for realtime threads.
+ * All return 0, or -1 if the queue is full or empty. These belong in
+ * <jack/ringbuffer.h>.
+ */
+typedef struct _jack_mpmc_queue jack_mpmc_queue_t;
+
+extern jack_mpmc_queue_t *jack_mpmc_queue_create(size_t elem_size,
+						 size_t count);
+extern void jack_mpmc_queue_free(jack_mpmc_queue_t *q);
+extern int jack_mpmc_queue_mlock(jack_mpmc_queue_t *q);
+extern int jack_mpmc_queue_push(jack_mpmc_queue_t *q, const void *elem);
+extern int jack_mpmc_queue_pop(jack_mpmc_queue_t *q, void *elem);
+extern int jack_mpmc_queue_push_single(jack_mpmc_queue_t *q,
+				       const void *elem);
+extern int jack_mpmc_queue_pop_single(jack_mpmc_queue_t *q, void *elem);
+
 extern jack_port_t *jack_port_by_name_int(jack_client_t *client,
                                           const char *port_name, int* free);
 extern int jack_port_name_equals(jack_port_shared_t* port, const char* target);
+extern uint32_t jack_port_name_hash(const char *name);
+extern jack_port_id_t jack_port_hash_lookup(jack_control_t *control,
+					    const char *name);
 
 /** Get the size (in bytes) of the data structure used to store
  *  MIDI events internally.
  */
 extern size_t jack_midi_internal_event_size();
 
+/* Write count events to a MIDI port buffer at once, in any order:
+ * they are sorted by time (events with the same time keep their
+ * order, after any already in the buffer) and merged with what the
+ * buffer holds. Either all of them are written or, if they do not fit
+ * or one is invalid, none, and ENOBUFS or EINVAL is returned and all
+ * count as lost. This belongs in <jack/midiport.h>.
+ */
+extern int jack_midi_event_write_batch(void *port_buffer,
+				       const jack_midi_event_t *events,
+				       uint32_t count);
+
 extern int jack_client_handle_latency_callback(jack_client_t *client, jack_event_t *event, int is_driver);
 
 #ifdef __GNUC__
@@ -20,37 +20,77 @@
 #ifndef __jack_intsimd_h__
 #define __jack_intsimd_h__
 
+#include <jack/types.h>
+
 #ifdef USE_DYNSIMD
 #if (defined(__i386__) || defined(__x86_64__))
 #define ARCH_X86
+#elif (defined(__arm__) || defined(__aarch64__))
+#define ARCH_ARM
 #endif  /* __i386__ || __x86_64__ */
 #endif  /* USE_DYNSIMD */
 
 #ifdef ARCH_X86
 #define ARCH_X86_SSE(x)         ((x) & 0xff)
 #define ARCH_X86_HAVE_SSE2(x)   (ARCH_X86_SSE (x) >= 2)
-#define ARCH_X86_3DNOW(x)       ((x) >> 8)
+#define ARCH_X86_3DNOW(x)       (((x) >> 8) & 0xff)
 #define ARCH_X86_HAVE_3DNOW(x)  (ARCH_X86_3DNOW (x))
+#define ARCH_X86_AVX(x)         (((x) >> 16) & 0xff)
+#define ARCH_X86_HAVE_AVX(x)    (ARCH_X86_AVX (x) >= 1)
+#define ARCH_X86_HAVE_AVX512(x) (ARCH_X86_AVX (x) >= 2)
+#define ARCH_X86_HAVE_FMA(x)    (((x) >> 24) & 0x1)
 
 typedef float v2sf __attribute__((vector_size (8)));
 typedef float v4sf __attribute__((vector_size (16)));
 typedef v2sf * pv2sf;
 typedef v4sf * pv4sf;
 
+/* from the features in cpufeatures.h, see jack_cpu_dispatch_init() */
 extern int cpu_type;
 
-int have_3dnow(void);
-int have_sse(void);
 void x86_3dnow_copyf(float *, const float *, int);
 void x86_3dnow_add2f(float *, const float *, int);
 void x86_sse_copyf(float *, const float *, int);
 void x86_sse_add2f(float *, const float *, int);
+void x86_sse_mixnf(float *, const float * const *, int, int);
+void x86_sse_meterf(const float *, int, float *, float *);
 void x86_sse_f2i(int *, const float *, int, float);
 void x86_sse_i2f(float *, const int *, int, float);
+void x86_avx_copyf(float *, const float *, int);
+void x86_avx_add2f(float *, const float *, int);
+void x86_avx_mixnf(float *, const float * const *, int, int);
+void x86_avx_meterf(const float *, int, float *, float *);
+void x86_avx512_copyf(float *, const float *, int);
+void x86_avx512_add2f(float *, const float *, int);
+void x86_avx512_mixnf(float *, const float * const *, int, int);
+void x86_fma_mixgainf(float *, const float * const *, const float *,
+		      const float *, int, int);
 
 #endif /* ARCH_X86 */
 
+#ifdef ARCH_ARM
+#define ARCH_ARM_HAVE_NEON(x)   ((x) & 0x1)
+
+extern int cpu_type;
+
+void arm_neon_copyf(float *, const float *, int);
+void arm_neon_add2f(float *, const float *, int);
+void arm_neon_mixnf(float *, const float * const *, int, int);
+void arm_neon_meterf(const float *, int, float *, float *);
+void arm_neon_mixgainf(float *, const float * const *, const float *,
+		       const float *, int, int);
+
+#endif /* ARCH_ARM */
+
+/* The mixnf functions set dest to the sum of the nsrc (>= 1) buffers
+ * in src, reading each of them once. dest may be the same buffer as
+ * src[0], which is how a long list of inputs is summed in batches.
+ * The mixgainf functions do the same with a gain ramp per input, see
+ * gen_mixgainf() in port.c.
+ */
+
 void jack_port_set_funcs(void);
+void jack_port_set_period(jack_nframes_t nframes);
 
 #endif /* __jack_intsimd_h__ */
 
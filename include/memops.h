@@ -31,21 +31,39 @@ typedef enum  {
 
 #define DITHER_BUF_SIZE 8
 #define DITHER_BUF_MASK 7
+#define DITHER_RNG_LANES 8
 
 typedef struct {
 	unsigned int depth;
 	float rm1;
 	unsigned int idx;
 	float e[DITHER_BUF_SIZE];
+	uint32_t rng[DITHER_RNG_LANES]; /* xorshift state of the vectorized dithers, 0 until used */
+
+	/* levels of the samples converted while meter is set, for the
+	   driver to take and clear; see memops_meter() */
+	int meter;
+	float peak;
+	float sumsq;
+	uint32_t overs;                 /* samples beyond full scale */
 } dither_state_t;
 
+typedef void (*MemopsReadFunction)(jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip);
+typedef void (*MemopsWriteFunction)(char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state);
+
 /* float functions */
 void sample_move_floatLE_sSs(jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long dst_skip);
 void sample_move_dS_floatLE(char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state);
 
+/* double functions */
+void sample_move_dS_sdouble(jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip);
+void sample_move_ddouble_sS(char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state);
+
 /* integer functions */
 void sample_move_d32u24_sSs(char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state);
 void sample_move_d32u24_sS(char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state);
+void sample_move_d32l24_sSs(char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state);
+void sample_move_d32l24_sS(char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state);
 void sample_move_d24_sSs(char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state);
 void sample_move_d24_sS(char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state);
 void sample_move_d16_sSs(char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state);
@@ -72,6 +90,8 @@ void sample_move_dither_shaped_d16_sS(char *dst, jack_default_audio_sample_t *sr
 
 void sample_move_dS_s32u24s(jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip);
 void sample_move_dS_s32u24(jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip);
+void sample_move_dS_s32l24s(jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip);
+void sample_move_dS_s32l24(jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip);
 void sample_move_dS_s24s(jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip);
 void sample_move_dS_s24(jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip);
 void sample_move_dS_s16s(jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip);
@@ -98,6 +118,19 @@ sample_memcpy (jack_default_audio_sample_t *dst, jack_default_audio_sample_t *sr
 	memcpy (dst, src, cnt * sizeof(jack_default_audio_sample_t));
 }
 
+/* vectorized converters: given one of the plain integer converters
+   or 16 bit dithering converters above, return the fastest equivalent
+   for this CPU, or the function itself if there is none.
+ */
+MemopsWriteFunction memops_simd_write_function(MemopsWriteFunction func);
+
+/* Add nsamples to the levels in state, as the vectorized write
+   converters do themselves while state->meter is set; for drivers
+   whose converter is not one of those. */
+void memops_meter(dither_state_t *state, const jack_default_audio_sample_t *src, unsigned long nsamples);
+MemopsReadFunction memops_simd_read_function(MemopsReadFunction func);
+const char *memops_simd_name(void);
+
 void memset_interleave(char *dst, char val, unsigned long bytes, unsigned long unit_bytes, unsigned long skip_bytes);
 void memcpy_fake(char *dst, char *src, unsigned long src_bytes, unsigned long foo, unsigned long bar);
 
@@ -21,8 +21,38 @@
 #define __jack_pool_h__
 
 #include <sys/types.h>
+#include <jack/jslist.h>
 
 void * jack_pool_alloc(size_t bytes);
 void   jack_pool_release(void *);
 
+/* RT-safe size-class allocator, see libjack/pool.c */
+
+#define JACK_RT_POOL_DEFAULT_SIZE (256 * 1024)
+
+typedef struct _jack_rt_pool jack_rt_pool_t;
+
+size_t jack_rt_pool_default_size(void);
+jack_rt_pool_t * jack_rt_pool_new(size_t bytes);
+void   jack_rt_pool_destroy(jack_rt_pool_t *pool);
+void * jack_rt_pool_alloc(jack_rt_pool_t *pool, size_t bytes);
+void   jack_rt_pool_free(jack_rt_pool_t *pool, void *ptr);
+
+/* Pooled JSList nodes for the lists the control path builds and tears
+   down on every connection change, see libjack/pool.c.  A list made
+   with these must only be grown, shrunk and freed with these. */
+
+typedef struct {
+	unsigned long in_use;           /* nodes on some list */
+	unsigned long pooled;           /* free nodes kept for reuse */
+	unsigned long chunks;           /* times the pool grew */
+} jack_slist_pool_stats_t;
+
+JSList * jack_pool_slist_prepend(JSList *list, void *data);
+JSList * jack_pool_slist_append(JSList *list, void *data);
+JSList * jack_pool_slist_remove(JSList *list, void *data);
+void     jack_pool_slist_free(JSList *list);
+void     jack_pool_slist_free_1(JSList *node);
+void     jack_pool_slist_stats(jack_slist_pool_stats_t *stats);
+
 #endif /* __jack_pool_h__ */
@@ -89,8 +89,21 @@ typedef struct _jack_port_type_info {
 
 	jack_shmsize_t zero_buffer_offset;
 
+	/* buffers in the type's segment, the empty one included; 0 for
+	 * one per port, as the builtin types have */
+	uint32_t nbuffers;
+
+	uint32_t flags;                 /* JACK_PORT_TYPE_* */
+
 } POST_PACKED_STRUCTURE jack_port_type_info_t;
 
+/* jack_port_type_info_t.flags */
+#define JACK_PORT_TYPE_RUNTIME    0x1   /* see jack_port_type_register() */
+#define JACK_PORT_TYPE_NO_MIXDOWN 0x2   /* one connection per input port */
+
+/* sum_port of an input port that mixes for itself */
+#define JACK_NO_SUM ((jack_port_id_t)-1)
+
 /* Allocated by the engine in shared memory. */
 typedef struct _jack_port_shared {
 
@@ -113,9 +126,30 @@ typedef struct _jack_port_shared {
 	char has_mixdown;               /* port has a mixdown function */
 	char in_use;
 	char unused;                    /* legacy locked field */
+	volatile char muted;            /* readers get silence, see --late-mute */
+	volatile uint32_t silent_cycle; /* see jack_port_mark_silent() */
+	volatile char delayed;          /* owner runs in the async stage */
+	jack_shmsize_t delayed_offset;  /* last cycle's buffer, or 0 */
+	volatile uint32_t forward_cycle; /* see jack_port_forward() */
+	jack_shmsize_t forward_offset;  /* the buffer readers get instead */
+	volatile jack_port_id_t sum_port; /* leader of our summing node */
+	jack_shmsize_t sum_offset;      /* leader: the node's buffer, or 0 */
+	volatile uint32_t sum_claimed;  /* leader: cycle being summed */
+	volatile uint32_t sum_ready;    /* leader: cycle summed */
+	int32_t history_slot;           /* see jack_async_history_write() */
 
 } POST_PACKED_STRUCTURE jack_port_shared_t;
 
+/* Mixes nsources buffers of size bytes into buffer, which it
+ * overwrites. With many sources it is called more than once, and
+ * sources[0] is then buffer itself, holding the mix so far. Also
+ * belongs in <jack/types.h>, see jack_port_type_register().
+ */
+typedef void (*JackPortTypeMixdownCallback)(void *buffer,
+					    const void * const *sources,
+					    int nsources, size_t size,
+					    void *arg);
+
 typedef struct _jack_port_functions {
 
 	/* Function to initialize port buffer. Cannot be NULL.
@@ -132,6 +166,10 @@ typedef struct _jack_port_functions {
 	 */
 	void (*mixdown)(jack_port_t *, jack_nframes_t);
 
+	/* what mixdown calls for a type registered at run time */
+	JackPortTypeMixdownCallback type_mixdown;
+	void *type_mixdown_arg;
+
 } jack_port_functions_t;
 
 /**
@@ -154,8 +192,33 @@ struct _jack_port {
 	jack_port_functions_t fptr;
 	pthread_mutex_t connection_lock;
 	JSList                   *connections;
+	volatile uint32_t        *cycle;        /* the engine's cycle_seq */
+	void                     *engine;       /* the engine's jack_control_t */
+	volatile uint8_t         *delayed;      /* our client's control->delayed */
+	void                     *domain_buffer; /* see jack_port_get_graph_buffer() */
+
+	/* what jack_port_get_buffer() resolved to in cycle cached_cycle */
+	void                     *cached_buffer;
+	void                     *cached_base;  /* *client_segment_base then */
+	jack_nframes_t            cached_nframes;
+	uint32_t                  cached_cycle;
+
+	/* of a connection, on the source port objects in the
+	   connections list of an input: the gain mixdown applies, and
+	   the one it ramps to over the next cycle */
+	float                     gain;
+	float                     gain_target;
+	/* of an input: how many of its connections are not at unity */
+	uint32_t                  gained;
 };
 
+#define jack_port_gain_unity(p) \
+	((p)->gain == 1.0f && (p)->gain_target == 1.0f)
+
+/* for whatever changes what a port resolves to between two cycles:
+ * its connections, its mixdown buffer, its tie */
+#define jack_port_buffer_invalidate(p) ((p)->cached_buffer = NULL)
+
 /*  Inline would be cleaner, but it needs to be fast even in
  *  non-optimized code.  jack_output_port_buffer() only handles output
  *  ports.  jack_port_buffer() works for both input and output ports.
@@ -165,9 +228,56 @@ struct _jack_port {
 		 *(p)->client_segment_base + (p)->shared->offset))
 #define jack_output_port_buffer(p) \
 	((void*)(*(p)->client_segment_base + (p)->shared->offset))
+/* an output port on the other side of the async stage from its
+ * reader is read from the copy the engine made of it at the end of the
+ * last cycle, see jack_set_process_async().
+ */
+#define jack_output_port_delayed(p) \
+	((p)->shared->delayed != *(p)->delayed && (p)->shared->delayed_offset)
+/* an output port is silent this cycle if its owner said so, see
+ * jack_port_mark_silent(), or if the engine has muted it.  Its
+ * readers then get the zero buffer instead of its buffer; the owner
+ * keeps writing to its own buffer either way.  A delayed copy already
+ * holds the silence.
+ */
+#define jack_output_port_silent(p) \
+	(!jack_output_port_delayed (p) && \
+	 ((p)->shared->muted || (p)->shared->silent_cycle == *(p)->cycle))
+/* an output port forwards an input of its owner this cycle if the
+ * owner said so, see jack_port_forward().  Its readers then get the
+ * buffer that input resolved to instead of its own.
+ */
+#define jack_output_port_forwarded(p) \
+	((p)->shared->forward_cycle == *(p)->cycle)
+#define jack_output_port_source_offset(p) \
+	(jack_output_port_delayed (p) ? (p)->shared->delayed_offset : \
+	 jack_output_port_silent (p) ? (p)->type_info->zero_buffer_offset : \
+	 jack_output_port_forwarded (p) ? (p)->shared->forward_offset : \
+	 (p)->shared->offset)
+#define jack_output_port_source(p) \
+	((void*)(*(p)->client_segment_base + jack_output_port_source_offset (p)))
+
+/* Port buffers in the shared segments start on this boundary, so the
+ * mixdown and sample conversion code may use aligned vector loads.
+ */
+#define JACK_PORT_BUFFER_ALIGN 64
 
 /* not for use by JACK applications */
 size_t jack_port_type_buffer_size(jack_port_type_info_t* port_type_info, jack_nframes_t nframes);
 
+/* The buffer of a port in the graph.  jack_port_get_buffer() returns
+ * the same, unless the server has given the port a buffer of its own:
+ * the ports of a driver in a clock domain of its own are read and
+ * written by the driver in its own cycle, and by the engine through
+ * this in the graph's.
+ */
+void *jack_port_get_graph_buffer(jack_port_t *port, jack_nframes_t nframes);
+
+/* The peak magnitude and the sum of squares of an audio buffer, with
+ * the same SIMD dispatch as mixdown; for the server's port meters.
+ */
+void jack_port_meter_buffer(const float *buf, jack_nframes_t nframes,
+			    float *peak, float *sumsq);
+
 #endif /* __jack_port_h__ */
 
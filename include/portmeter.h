@@ -0,0 +1,82 @@
+/*
+ * portmeter.h -- per-port levels measured by the server.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation; either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __jack_portmeter_h__
+#define __jack_portmeter_h__
+
+#include <inttypes.h>
+#include <jack/types.h>
+
+/* When jackd runs with --port-meters, the engine measures every audio
+ * output port once all clients have run, and publishes the peak and
+ * RMS level of each over the last metering interval in a shared
+ * memory segment; the segment's registry index is in
+ * jack_control_t.meter_shm_index (-1 when metering is off).  Meters
+ * read it instead of connecting ports of their own to everything, so
+ * they add nothing to the process graph.
+ *
+ * ports[] is indexed by port id.  The engine makes seq odd while it
+ * publishes an interval and even again afterwards; a reader copies
+ * what it needs and keeps it only if seq was the same even value
+ * before and after.  Levels are linear, 1.0 being full scale.  A port
+ * that is muted or silent counts as silence, one that is not in use
+ * reads zero.
+ *
+ * Hardware playback ports are inputs, and are measured by the driver
+ * instead, as it converts their buffers to the device's format.  For
+ * those, overs counts the samples beyond full scale that the
+ * conversion had to clip during the interval; it is always zero for
+ * other ports, and for drivers that do not measure.
+ */
+
+#define JACK_PORT_METER_VERSION 2
+
+typedef struct {
+	float peak;
+	float rms;
+	uint32_t overs;
+} jack_port_meter_t;
+
+typedef struct {
+	uint32_t version;
+	uint32_t nports;                /* the server's port_max */
+	uint32_t interval_msecs;
+	volatile uint32_t seq;
+	volatile uint64_t intervals;    /* published so far */
+	jack_port_meter_t ports[0];
+} jack_port_meters_t;
+
+/* Attach a client to the server's meters; NULL if metering is off.
+ * The mapping is released by jack_client_close().
+ */
+extern const jack_port_meters_t *jack_port_meters_attach(jack_client_t *client);
+
+/* The levels of `port' over the last interval. Returns -1 if metering
+ * is off.
+ */
+extern int jack_port_meter_read(jack_client_t *client, const jack_port_t *port,
+				float *peak, float *rms);
+
+/* The number of clipped samples on `port' over the last interval.
+ * Returns -1 if metering is off.
+ */
+extern int jack_port_meter_read_overs(jack_client_t *client, const jack_port_t *port,
+				      uint32_t *overs);
+
+#endif /* __jack_portmeter_h__ */
@@ -0,0 +1,73 @@
+/*
+ * probes.h -- static tracepoints for bpftrace, perf and SystemTap.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation; either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __jack_probes_h__
+#define __jack_probes_h__
+
+/* When configured with USDT support (sys/sdt.h, --enable-usdt), each
+ * JACK_PROBE is a single nop in the code and a note in the ELF file
+ * that tracers patch at run time, e.g.
+ *
+ *   bpftrace -e 'usdt:/usr/bin/jackd:jack:cycle_start { @[arg1] = count(); }'
+ *   perf probe -x libjack.so sdt_jack:client_wake
+ *
+ * Otherwise the probes compile to nothing.  Arguments must not cost
+ * anything to compute: they are values the code already has at hand,
+ * and times are those the code already took, in microseconds on the
+ * server clock.  The tracer's own clock timestamps the event itself.
+ * Clients are identified by their uuid.
+ *
+ * Probes (provider "jack"):
+ *
+ *   jackd:
+ *     cycle_start (seq, nframes, wakeup_usecs, delayed_usecs)
+ *     cycle_end (seq, status)
+ *     client_signal (uuid, signalled_usecs)    server starts a subgraph
+ *     client_finish (uuid, status, usecs)      ... and sees it finish
+ *     xrun (delayed_usecs)
+ *     graph_reorder (generation)
+ *   libjack:
+ *     client_wake (uuid, awake_usecs)
+ *     client_done (uuid, finished_usecs, status)
+ *     mixdown (port id, client uuid, nframes)
+ *   ALSA driver:
+ *     driver_wait (nframes, status, wakeup_usecs, delayed_usecs)
+ *
+ * delayed_usecs are truncated to whole microseconds.
+ */
+
+#ifdef USE_USDT
+
+#include <sys/sdt.h>
+
+#define JACK_PROBE1(name, a)                    DTRACE_PROBE1 (jack, name, a)
+#define JACK_PROBE2(name, a, b)                 DTRACE_PROBE2 (jack, name, a, b)
+#define JACK_PROBE3(name, a, b, c)              DTRACE_PROBE3 (jack, name, a, b, c)
+#define JACK_PROBE4(name, a, b, c, d)           DTRACE_PROBE4 (jack, name, a, b, c, d)
+
+#else
+
+#define JACK_PROBE1(name, a)                    do { } while (0)
+#define JACK_PROBE2(name, a, b)                 do { } while (0)
+#define JACK_PROBE3(name, a, b, c)              do { } while (0)
+#define JACK_PROBE4(name, a, b, c, d)           do { } while (0)
+
+#endif /* USE_USDT */
+
+#endif /* __jack_probes_h__ */
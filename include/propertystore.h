@@ -0,0 +1,111 @@
+/*
+ * propertystore.h -- the server's metadata in shared memory.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation; either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __jack_propertystore_h__
+#define __jack_propertystore_h__
+
+#include <inttypes.h>
+#include <jack/types.h>
+#include <jack/metadata.h>
+
+#include "shm.h"
+
+/* The server keeps all metadata in one shared memory segment whose
+ * registry index is in jack_control_t.property_shm_index (-1 if the
+ * server could not create it). Only the server writes to it; clients
+ * send PropertySet and PropertyRemove requests and read the segment
+ * directly, without a round trip or a Berkeley DB lookup. The DB is
+ * still written through by the server so that metadata survives a
+ * restart, unless $JACK_METADATA_DB is set to 0.
+ *
+ * Entries are appended to the arena and chained from a bucket chosen
+ * by the subject UUID alone, so all properties of one subject are
+ * found by walking a single chain. Removed entries are unlinked and
+ * their space is reclaimed by compacting the arena when it fills up.
+ *
+ * The server bumps seq to an odd value before changing anything and
+ * to the next even value afterwards. A reader copies what it needs
+ * and keeps the copy only if seq was the same even value before and
+ * after. Since a reader may see a half-written arena, every offset
+ * and length it follows is bounds-checked before use.
+ */
+
+#define JACK_PROPERTY_STORE_VERSION     1
+#define JACK_PROPERTY_STORE_SIZE        (4 * 1024 * 1024)       /* whole segment */
+#define JACK_PROPERTY_STORE_BUCKETS     1024                    /* power of two */
+#define JACK_PROPERTY_STORE_NIL         0xffffffff
+
+typedef struct {
+	uint32_t next;          /* arena offset of the next entry in the chain */
+	uint32_t size;          /* of the whole entry, a multiple of 8 */
+	uint32_t live;          /* 0 once unlinked */
+	uint32_t key_len;       /* all lengths include the terminating null */
+	uint32_t value_len;
+	uint32_t type_len;      /* 0 if no type was given */
+	jack_uuid_t subject;
+	char data[0];           /* key, value, type */
+} jack_property_entry_t;
+
+typedef struct {
+	uint32_t version;
+	uint32_t nbuckets;
+	uint32_t arena_size;
+	volatile uint32_t seq;
+	uint32_t used;          /* arena bytes up to the last entry */
+	uint32_t dead;          /* bytes in unlinked entries below used */
+	uint32_t count;         /* live entries */
+	uint32_t pad;
+	uint32_t buckets[JACK_PROPERTY_STORE_BUCKETS];
+	char arena[0];
+} jack_property_store_t;
+
+/* server side, in libjack/metadata.c */
+
+int  jack_property_store_new (const char *server_name,
+			      jack_shm_registry_index_t *index);
+void jack_property_store_delete (void);
+int  jack_property_store_set (jack_uuid_t subject, const char *key,
+			      const char *value, const char *type,
+			      jack_property_change_t *change);
+int  jack_property_store_remove (jack_uuid_t subject, const char *key);
+int  jack_property_store_clear (void);
+int  jack_property_store_apply (const jack_property_op_t *ops, uint32_t nops,
+				jack_property_change_t *change);
+
+/* A PropertyBatch request is followed by its changes, each a record
+ * and then its key, value and type, with their nulls, padded to a
+ * multiple of 8 bytes.
+ */
+typedef struct {
+	jack_uuid_t subject;
+	uint32_t key_len;       /* 0 for none */
+	uint32_t value_len;     /* 0 for a removal */
+	uint32_t type_len;
+	uint32_t pad;
+} jack_property_record_t;
+
+int  jack_property_batch_unpack (const char *data, uint32_t size,
+				 uint32_t count, jack_property_op_t *ops);
+
+/* client side */
+
+void jack_property_store_attach (jack_shm_registry_index_t index);
+void jack_property_store_detach (void);
+
+#endif /* __jack_propertystore_h__ */
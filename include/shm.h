@@ -6,11 +6,18 @@
 #include <jack/types.h>
 
 #define MAX_SERVERS 8                   /* maximum concurrent servers */
-#define MAX_SHM_ID 256                  /* generally about 16 per server */
+#define MAX_SHM_ID 4096                 /* a few per client, used lazily */
 #define JACK_SERVER_NAME_SIZE 256       /* maximum length of server name */
 #define JACK_SHM_MAGIC 0x4a41434b       /* shm magic number: "JACK" */
 #define JACK_SHM_NULL_INDEX -1          /* NULL SHM index */
 #define JACK_SHM_REGISTRY_INDEX -2      /* pseudo SHM index for registry */
+#define JACK_SHM_LOCK_SIZE 64           /* room for the registry lock */
+
+/* Servers carve segments of up to JACK_SHM_POOL_MAX bytes out of one
+ * shared pool instead of creating a new shm object for each. */
+#define JACK_SHM_POOL_SIZE (1024 * 1024)
+#define JACK_SHM_POOL_BLOCK 4096
+#define JACK_SHM_POOL_MAX (64 * 1024)
 
 
 /* On Mac OS X, SHM_NAME_MAX is the maximum length of a shared memory
@@ -43,6 +50,9 @@ typedef int16_t jack_shm_registry_index_t;
  *
  * The registry consists of two parts: a header including an array of
  * server names, followed by an array of segment registry entries.
+ * Entries past high_water have never been used, so their pages are
+ * not touched until they are needed; free entries below it are kept
+ * on a list linked through next_free.
  */
 typedef struct _jack_shm_server {
 	pid_t pid;                      /* process ID */
@@ -56,13 +66,20 @@ typedef struct _jack_shm_header {
 	jack_shmsize_t size;                    /* total registry segment size */
 	jack_shmsize_t hdr_len;                 /* size of header */
 	jack_shmsize_t entry_len;               /* size of registry entry */
+	char lock[JACK_SHM_LOCK_SIZE];          /* robust mutex, 8 byte aligned */
+	uint32_t lock_len;                      /* its size, 0 if unused */
+	int32_t free_head;                      /* first free entry */
+	int32_t high_water;                     /* entries ever used */
 	jack_shm_server_t server[MAX_SERVERS];  /* current server array */
 } jack_shm_header_t;
 
 typedef struct _jack_shm_registry {
 	jack_shm_registry_index_t index;        /* offset into the registry */
+	jack_shm_registry_index_t next_free;    /* free list link */
+	jack_shm_registry_index_t parent;       /* pool it lives in, or NULL */
 	pid_t allocator;                        /* PID that created shm segment */
 	jack_shmsize_t size;                    /* for POSIX unattach */
+	jack_shmsize_t offset;                  /* into the parent pool */
 	jack_shm_id_t id;                       /* API specific, see above */
 } jack_shm_registry_t;
 
@@ -107,5 +124,6 @@ extern void jack_release_shm(jack_shm_info_t*);
 extern void jack_destroy_shm(jack_shm_info_t*);
 extern int  jack_attach_shm(jack_shm_info_t*);
 extern int  jack_resize_shm(jack_shm_info_t*, jack_shmsize_t size);
+extern jack_shmsize_t jack_shm_size(jack_shm_info_t*);
 
 #endif /* __jack_shm_h__ */
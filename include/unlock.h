@@ -21,6 +21,16 @@
 #ifndef __jack_mlock_h__
 #define __jack_mlock_h__
 
+#include <stddef.h>
+
+#include "shm.h"
+
+extern int jack_mlock_mode;
+
 extern void cleanup_mlock(void);
+extern int jack_mlock_rt_region(const void *addr, size_t len, const char *what);
+extern int jack_mlock_rt_shm(jack_shm_info_t *si, const char *what);
+extern int jack_mlock_thread_stack(void);
+extern size_t jack_mlock_footprint(void);
 
 #endif /* __jack_mlock_h__ */
@@ -0,0 +1,54 @@
+/*
+ * wakeup.h -- passing control along the process graph without FIFOs.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation; either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __jack_wakeup_h__
+#define __jack_wakeup_h__
+
+typedef enum {
+	JACK_WAKEUP_FIFO,       /* one byte through a named FIFO per handoff */
+	JACK_WAKEUP_FUTEX,      /* wakeup words in the engine control block */
+} jack_wakeup_method_t;
+
+/* The engine control block holds one wakeup word for each FIFO the
+ * engine would otherwise have created, using the same numbering, and
+ * above those one word for each external client, which is the only
+ * word that client ever sleeps on.  The engine waits on the first
+ * kind and every client on its own, so a graph reorder never moves a
+ * thread that is asleep, and only one thread ever waits on a given
+ * word.  A word counts pending process() handoffs in its low bits and
+ * pending server events in its high bits.
+ */
+#define JACK_GRAPH_WAKEUPS        4096
+#define JACK_CLIENT_WAKEUPS       (JACK_GRAPH_WAKEUPS / 2)  /* the top words */
+
+#define JACK_WAKEUP_PROCESS       0x00000001
+#define JACK_WAKEUP_EVENT         0x00010000
+#define JACK_WAKEUP_PROCESS_MASK  0x0000ffff
+#define JACK_WAKEUP_EVENT_MASK    0x3fff0000
+#define JACK_WAKEUP_WAITING       0x40000000
+
+typedef volatile _Atomic_word jack_wakeup_word_t;
+
+int         jack_wakeup_supported(void);
+const char* jack_wakeup_method_name(jack_wakeup_method_t);
+void        jack_wakeup_post(jack_wakeup_word_t *word, int what);
+int         jack_wakeup_wait(jack_wakeup_word_t *word, jack_time_t usecs);
+void        jack_wakeup_clear(jack_wakeup_word_t *word);
+
+#endif /* __jack_wakeup_h__ */
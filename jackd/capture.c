@@ -0,0 +1,422 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    Capture recorder -- runs in the server process.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ */
+
+/*
+ * With --record file, the server writes everything the master driver
+ * captured to file, with the transport state of each cycle and the
+ * connections of the graph whenever they change, for the replay
+ * driver to play back the same session, as fast as it can or at the
+ * pace it was recorded at.  The format is in capturefile.h.
+ *
+ * After the driver has been read, the realtime thread copies the
+ * buffers of the driver's capture ports into a ring and posts a
+ * semaphore; a thread of our own writes the ring to the file.  When
+ * the ring is full the cycle is not recorded, and the next record
+ * says how many were lost.
+ *
+ * The server thread hands over the connections after each sort of
+ * the graph, tagged with the number of cycles recorded so far; the
+ * writer puts them in the file before the cycle they came ahead of.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <jack/ringbuffer.h>
+
+#include "internal.h"
+#include "engine.h"
+#include "driver.h"
+#include "capturefile.h"
+#include "capture.h"
+
+#define JACK_CAPTURE_RING_SIZE (16 * 1024 * 1024)
+
+typedef struct {
+	uint64_t cycle;
+	size_t len;
+	char text[0];
+} jack_capture_graph_t;
+
+struct _jack_capture {
+	FILE *file;
+	char *path;
+	jack_ringbuffer_t *rb;
+	pthread_t thread;
+	sem_t sem;
+	volatile int run;
+	int failed;
+
+	/* w: RT thread */
+	volatile uint64_t cycles;       /* recorded or lost */
+	uint32_t dropped;               /* lost since the last record */
+	uint64_t total_dropped;
+
+	/* w: server thread, r: writer thread, under lock */
+	pthread_mutex_t lock;
+	JSList *graphs;
+
+	/* server thread */
+	int have_graph;
+	char *last_graph;
+	size_t last_graph_len;
+};
+
+static void
+jack_capture_write (jack_capture_t *capture, const void *buf, size_t len)
+{
+	if (capture->failed || len == 0) {
+		return;
+	}
+
+	if (fwrite (buf, 1, len, capture->file) != len) {
+		/* keep draining the ring, so that the cycles go on */
+		jack_error ("cannot write to %s (%s), recording stopped",
+			    capture->path, strerror (errno));
+		capture->failed = 1;
+	}
+}
+
+/* the next complete cycle record in the ring, if there is one */
+static int
+jack_capture_peek (jack_capture_t *capture, jack_capture_record_t *rec)
+{
+	size_t avail = jack_ringbuffer_read_space (capture->rb);
+
+	if (avail < sizeof(*rec)) {
+		return 0;
+	}
+	jack_ringbuffer_peek (capture->rb, (char*)rec, sizeof(*rec));
+
+	return avail >= sizeof(*rec) + rec->size;
+}
+
+static void
+jack_capture_drain (jack_capture_t *capture)
+{
+	jack_capture_record_t rec;
+	jack_capture_graph_t *graph;
+	JSList *link;
+	jack_ringbuffer_data_t vec[2];
+	size_t len, n;
+	int have_cycle;
+
+	while (1) {
+		have_cycle = jack_capture_peek (capture, &rec);
+
+		pthread_mutex_lock (&capture->lock);
+		graph = capture->graphs ? capture->graphs->data : NULL;
+		if (graph && have_cycle && graph->cycle > rec.cycle) {
+			graph = NULL;
+		}
+		if (graph) {
+			link = capture->graphs;
+			capture->graphs = jack_slist_remove_link (capture->graphs, link);
+			jack_slist_free_1 (link);
+		}
+		pthread_mutex_unlock (&capture->lock);
+
+		if (graph) {
+			/* the cycles before it are all in the ring by now */
+			jack_capture_record_t grec;
+
+			grec.type = JACK_CAPTURE_GRAPH;
+			grec.size = graph->len;
+			grec.cycle = graph->cycle;
+			jack_capture_write (capture, &grec, sizeof(grec));
+			jack_capture_write (capture, graph->text, graph->len);
+			free (graph);
+			continue;
+		}
+
+		if (!have_cycle) {
+			break;
+		}
+
+		len = sizeof(rec) + rec.size;
+		jack_ringbuffer_get_read_vector (capture->rb, vec);
+		n = vec[0].len < len ? vec[0].len : len;
+		jack_capture_write (capture, vec[0].buf, n);
+		jack_capture_write (capture, vec[1].buf, len - n);
+		jack_ringbuffer_read_advance (capture->rb, len);
+	}
+}
+
+static void *
+jack_capture_thread (void *arg)
+{
+	jack_capture_t *capture = (jack_capture_t*)arg;
+
+	while (1) {
+		if (sem_wait (&capture->sem) < 0) {
+			continue;
+		}
+		jack_capture_drain (capture);
+		if (!capture->run) {
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+int
+jack_capture_init (jack_engine_t *engine, const char *path)
+{
+	jack_capture_t *capture;
+	jack_capture_header_t header;
+	int err;
+
+	engine->capture = NULL;
+
+	if ((capture = calloc (1, sizeof(jack_capture_t))) == NULL) {
+		return -1;
+	}
+	if ((capture->path = strdup (path)) == NULL
+	    || (capture->rb = jack_ringbuffer_create (JACK_CAPTURE_RING_SIZE)) == NULL) {
+		goto fail;
+	}
+	if ((capture->file = fopen (path, "w")) == NULL) {
+		jack_error ("cannot record to %s (%s)", path, strerror (errno));
+		goto fail;
+	}
+
+	memset (&header, 0, sizeof(header));
+	memcpy (header.magic, JACK_CAPTURE_MAGIC, sizeof(JACK_CAPTURE_MAGIC));
+	header.version = JACK_CAPTURE_VERSION;
+	header.record_size = sizeof(jack_capture_record_t);
+	jack_capture_write (capture, &header, sizeof(header));
+	if (capture->failed) {
+		goto fail;
+	}
+
+	if (engine->control->real_time) {
+		jack_ringbuffer_mlock (capture->rb);
+	}
+	pthread_mutex_init (&capture->lock, NULL);
+	if (sem_init (&capture->sem, 0, 0) < 0) {
+		pthread_mutex_destroy (&capture->lock);
+		goto fail;
+	}
+
+	capture->run = 1;
+
+	if ((err = pthread_create (&capture->thread, NULL, jack_capture_thread,
+				   capture)) != 0) {
+		jack_error ("cannot start the recorder thread (%s)", strerror (err));
+		sem_destroy (&capture->sem);
+		pthread_mutex_destroy (&capture->lock);
+		goto fail;
+	}
+
+	engine->capture = capture;
+
+	VERBOSE (engine, "recording the capture to %s", path);
+	return 0;
+
+fail:
+	if (capture->file) {
+		fclose (capture->file);
+	}
+	if (capture->rb) {
+		jack_ringbuffer_free (capture->rb);
+	}
+	free (capture->path);
+	free (capture);
+	return -1;
+}
+
+void
+jack_capture_close (jack_engine_t *engine)
+{
+	jack_capture_t *capture = engine->capture;
+	JSList *node;
+
+	if (capture == NULL) {
+		return;
+	}
+
+	engine->capture = NULL;
+
+	/* the writer drains what is left before it exits */
+	capture->run = 0;
+	sem_post (&capture->sem);
+	pthread_join (capture->thread, NULL);
+	sem_destroy (&capture->sem);
+	pthread_mutex_destroy (&capture->lock);
+
+	if (fclose (capture->file) != 0 && !capture->failed) {
+		jack_error ("cannot write to %s (%s)", capture->path,
+			    strerror (errno));
+	}
+
+	jack_info ("recorded %" PRIu64 " cycles to %s, %" PRIu64 " lost",
+		   capture->cycles - capture->total_dropped, capture->path,
+		   capture->total_dropped);
+
+	for (node = capture->graphs; node; node = jack_slist_next (node)) {
+		free (node->data);
+	}
+	jack_slist_free (capture->graphs);
+	jack_ringbuffer_free (capture->rb);
+	free (capture->last_graph);
+	free (capture->path);
+	free (capture);
+}
+
+/* Add `len' zero bytes to the ring, which has room for them. */
+static void
+jack_capture_write_silence (jack_ringbuffer_t *rb, size_t len)
+{
+	jack_ringbuffer_data_t vec[2];
+	size_t n;
+
+	jack_ringbuffer_get_write_vector (rb, vec);
+	n = vec[0].len < len ? vec[0].len : len;
+	memset (vec[0].buf, 0, n);
+	memset (vec[1].buf, 0, len - n);
+	jack_ringbuffer_write_advance (rb, len);
+}
+
+/* Called by the realtime thread once the drivers have been read, with
+ * the graph lock or a snapshot of it held. */
+void
+jack_capture_cycle (jack_engine_t *engine, jack_nframes_t nframes)
+{
+	jack_capture_t *capture = engine->capture;
+	jack_control_t *control = engine->control;
+	jack_client_internal_t *driver_client = engine->driver->internal_client;
+	uint32_t high = control->port_high;
+	uint32_t seq = control->cycle_seq;
+	jack_capture_record_t rec;
+	jack_capture_cycle_t cyc;
+	size_t bytes = nframes * sizeof(jack_default_audio_sample_t);
+	char *base;
+	uint32_t i;
+
+	base = (char*)jack_shm_addr (&engine->port_segment[JACK_AUDIO_PORT_TYPE]);
+
+	/* the capture ports, in the order the driver registered them */
+	cyc.channels = 0;
+	for (i = 0; i < high && i < engine->port_max; i++) {
+		jack_port_shared_t *shared = &control->ports[i];
+
+		if (shared->in_use && shared->ptype_id == JACK_AUDIO_PORT_TYPE
+		    && (shared->flags & (JackPortIsOutput | JackPortIsPhysical))
+		    == (JackPortIsOutput | JackPortIsPhysical)
+		    && jack_uuid_compare (shared->client_id,
+					  driver_client->control->uuid) == 0) {
+			cyc.channels++;
+		}
+	}
+
+	rec.type = JACK_CAPTURE_CYCLE;
+	rec.size = sizeof(cyc) + cyc.channels * bytes;
+	rec.cycle = capture->cycles;
+
+	if (jack_ringbuffer_write_space (capture->rb) < sizeof(rec) + rec.size) {
+		capture->dropped++;
+		capture->total_dropped++;
+		capture->cycles++;
+		sem_post (&capture->sem);
+		return;
+	}
+
+	cyc.nframes = nframes;
+	cyc.frame_rate = control->current_time.frame_rate;
+	cyc.dropped = capture->dropped;
+	cyc.transport_state = control->transport_state;
+	cyc.transport_frame = control->current_time.frame;
+	cyc.usecs = engine->driver->last_wait_ust;
+
+	jack_ringbuffer_write (capture->rb, (char*)&rec, sizeof(rec));
+	jack_ringbuffer_write (capture->rb, (char*)&cyc, sizeof(cyc));
+
+	for (i = 0; i < high && i < engine->port_max; i++) {
+		jack_port_shared_t *shared = &control->ports[i];
+
+		if (!shared->in_use || shared->ptype_id != JACK_AUDIO_PORT_TYPE
+		    || (shared->flags & (JackPortIsOutput | JackPortIsPhysical))
+		    != (JackPortIsOutput | JackPortIsPhysical)
+		    || jack_uuid_compare (shared->client_id,
+					  driver_client->control->uuid) != 0) {
+			continue;
+		}
+
+		if (shared->silent_cycle == seq) {
+			jack_capture_write_silence (capture->rb, bytes);
+		} else {
+			jack_ringbuffer_write (capture->rb, base + shared->offset,
+					       bytes);
+		}
+	}
+
+	/* the record is in the ring before the count that the server
+	   thread tags the graph with */
+	__sync_synchronize ();
+	capture->dropped = 0;
+	capture->cycles++;
+
+	sem_post (&capture->sem);
+}
+
+/* Record the connections, `len' bytes of text allocated with malloc()
+ * that become ours; called by the server thread with the graph lock
+ * held. */
+void
+jack_capture_graph (jack_engine_t *engine, char *text, size_t len)
+{
+	jack_capture_t *capture = engine->capture;
+	jack_capture_graph_t *graph;
+
+	if (capture->have_graph && capture->last_graph_len == len
+	    && (len == 0 || memcmp (capture->last_graph, text, len) == 0)) {
+		/* sorted again, with the same connections */
+		free (text);
+		return;
+	}
+
+	if ((graph = malloc (sizeof(jack_capture_graph_t) + len)) == NULL) {
+		free (text);
+		return;
+	}
+	graph->cycle = capture->cycles;
+	graph->len = len;
+	if (len) {
+		memcpy (graph->text, text, len);
+	}
+
+	free (capture->last_graph);
+	capture->have_graph = 1;
+	capture->last_graph = text;
+	capture->last_graph_len = len;
+
+	pthread_mutex_lock (&capture->lock);
+	capture->graphs = jack_slist_append (capture->graphs, graph);
+	pthread_mutex_unlock (&capture->lock);
+
+	sem_post (&capture->sem);
+}
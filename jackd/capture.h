@@ -0,0 +1,23 @@
+/*
+ *  Recording of the driver's capture for the replay driver.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+int     jack_capture_init(jack_engine_t *engine, const char *path);
+void    jack_capture_close(jack_engine_t *engine);
+void    jack_capture_cycle(jack_engine_t *engine, jack_nframes_t nframes);
+void    jack_capture_graph(jack_engine_t *engine, char *text, size_t len);
@@ -30,6 +30,7 @@
 #include <signal.h>
 
 #include "internal.h"
+#include "pool.h"
 #include "engine.h"
 #include "messagebuffer.h"
 #include "version.h"
@@ -39,12 +40,16 @@
 
 #include "clientengine.h"
 #include "transengine.h"
+#include "xrundump.h"
+#include "metrics.h"
 
 #include <jack/uuid.h>
 #include <jack/metadata.h>
 
 #include "libjack/local.h"
 
+static void jack_client_index_remove(jack_engine_t *engine, jack_client_internal_t *client);
+
 static void
 jack_client_disconnect_ports (jack_engine_t *engine,
 			      jack_client_internal_t *client)
@@ -62,11 +67,12 @@ jack_client_disconnect_ports (jack_engine_t *engine,
 	}
 
 	jack_slist_free (client->ports);
-	jack_slist_free (client->truefeeds);
-	jack_slist_free (client->sortfeeds);
+	jack_pool_slist_free (client->truefeeds);
+	jack_pool_slist_free (client->sortfeeds);
 	client->truefeeds = 0;
 	client->sortfeeds = 0;
 	client->ports = 0;
+	engine->reach_valid = FALSE;
 }
 
 int
@@ -80,6 +86,18 @@ jack_client_do_deactivate (jack_engine_t *engine,
 
 	client->control->active = FALSE;
 
+	if (client->wait_slot >= 0) {
+		/* an inactive client does not sleep on its wakeup word,
+		   so get it off the word now */
+		if (engine->control->wakeup_method == JACK_WAKEUP_FUTEX
+		    && client->wake_word >= 0) {
+			jack_wakeup_post (&engine->control->graph_wakeup[client->wake_word],
+					  JACK_WAKEUP_EVENT);
+		}
+		client->wait_slot = -1;
+	}
+	client->wait_upstream = -1;
+
 	jack_transport_client_exit (engine, client);
 
 	if (!jack_client_is_internal (client) &&
@@ -169,6 +187,16 @@ jack_zombify_client (jack_engine_t *engine, jack_client_internal_t *client)
 
 	jack_client_disconnect_ports (engine, client);
 	jack_client_do_deactivate (engine, client, FALSE);
+
+	/* a batch left open by a dead client must not hold up everyone
+	   else's connection changes */
+	if (client->graph_batch) {
+		engine->graph_batch -= client->graph_batch;
+		client->graph_batch = 0;
+		if (engine->graph_batch == 0 && engine->graph_sort_pending) {
+			jack_sort_graph (engine);
+		}
+	}
 }
 
 void
@@ -176,12 +204,16 @@ jack_remove_client (jack_engine_t *engine, jack_client_internal_t *client)
 {
 	JSList *node;
 	jack_uuid_t finalizer = JACK_UUID_EMPTY_INITIALIZER;
+	jack_time_t start = jack_get_microseconds ();
 
 	jack_uuid_clear (&finalizer);
 
 	/* caller must write-hold the client lock */
 
 	VERBOSE (engine, "removing client \"%s\"", client->control->name);
+	jack_xrun_dump_graph_event (engine, "remove %s", client->control->name);
+
+	jack_graph_change_begin (engine);
 
 	if (client->control->type == ClientInternal) {
 		/* unload it while its still a regular client */
@@ -221,8 +253,10 @@ jack_remove_client (jack_engine_t *engine, jack_client_internal_t *client)
 
 	for (node = engine->clients; node; node = jack_slist_next (node)) {
 		if (jack_uuid_compare (((jack_client_internal_t*)node->data)->control->uuid, client->control->uuid) == 0) {
+			jack_client_index_remove (engine, (jack_client_internal_t*)node->data);
 			engine->clients = jack_slist_remove_link (engine->clients, node);
 			jack_slist_free_1 (node);
+			engine->reach_valid = FALSE;
 			VERBOSE (engine, "removed from client list, via matching UUID");
 			break;
 		}
@@ -230,8 +264,19 @@ jack_remove_client (jack_engine_t *engine, jack_client_internal_t *client)
 
 	VERBOSE (engine, "after: client list contains %d", jack_slist_length (engine->clients));
 
+	if (engine->async_head == client) {
+		/* no async stage until the next graph sort */
+		engine->async_head = NULL;
+		engine->async_running = 0;
+	}
+
 	jack_client_delete (engine, client);
 
+	jack_graph_change_end (engine);
+
+	engine->client_removals++;
+	engine->client_removal_usecs += jack_get_microseconds () - start;
+
 	if (engine->temporary) {
 		int external_clients = 0;
 
@@ -266,70 +311,43 @@ jack_remove_client (jack_engine_t *engine, jack_client_internal_t *client)
 }
 
 int
-jack_check_clients (jack_engine_t* engine, int with_timeout_check)
+jack_check_clients (jack_engine_t* engine)
 {
-	/* CALLER MUST HOLD graph read lock */
+	/* called by the supervisor thread, see jack_supervisor_thread() */
 
 	JSList* node;
 	jack_client_internal_t* client;
 	int errs = 0;
 
+	jack_rdlock_graph (engine);
+
 	for (node = engine->clients; node; node = jack_slist_next (node)) {
 
 		client = (jack_client_internal_t*)node->data;
 
 		if (client->error) {
 			VERBOSE (engine, "client %s already marked with error = %d\n", client->control->name, client->error);
+			jack_client_clear_late (engine, client);
 			errs++;
 			continue;
 		}
 
-		if (with_timeout_check) {
-
-			/* we can only consider the timeout a client error if
-			 * it actually woke up.  its possible that the kernel
-			 * scheduler screwed us up and never woke up the
-			 * client in time. sigh.
-			 */
+		/* the engine thread flagged this client when it woke up
+		 * but did not finish a cycle in time, and clears the
+		 * flag again as soon as it finishes one.  it has had
+		 * its grace period by now, so it's not coming back.
+		 */
 
-			VERBOSE (engine, "checking client %s: awake at %" PRIu64 " finished at %" PRIu64,
-				 client->control->name,
-				 client->control->awake_at,
-				 client->control->finished_at);
-
-			if (client->control->awake_at > 0) {
-				if (client->control->finished_at == 0) {
-					jack_time_t now = jack_get_microseconds ();
-
-					if ((now - client->control->awake_at) < engine->driver->period_usecs) {
-						/* we give the client a bit of time, to finish the cycle
-						 * we assume here, that we dont get signals delivered to this thread.
-						 */
-						struct timespec wait_time;
-						wait_time.tv_sec = 0;
-						wait_time.tv_nsec = (engine->driver->period_usecs - (now - client->control->awake_at)) * 1000;
-						VERBOSE (engine, "client %s seems to have timed out. we may have mercy of %d ns.", client->control->name, (int)wait_time.tv_nsec );
-						nanosleep (&wait_time, NULL);
-					}
-
-					if (client->control->finished_at == 0) {
-						client->control->timed_out++;
-						client->error++;
-						errs++;
-						VERBOSE (engine, "client %s has timed out", client->control->name);
-					} else {
-						/*
-						 * the client recovered. if this is a single occurence, thats probably fine.
-						 * however, we increase the continuous_stream flag.
-						 */
-
-						engine->timeout_count += 1;
-					}
-				}
-			}
+		if (jack_client_clear_late (engine, client)) {
+			client->control->timed_out++;
+			client->error++;
+			errs++;
+			VERBOSE (engine, "client %s has timed out", client->control->name);
 		}
 	}
 
+	jack_unlock_graph (engine);
+
 	if (errs) {
 		jack_engine_signal_problems (engine);
 	}
@@ -348,6 +366,8 @@ jack_remove_clients (jack_engine_t* engine, int* exit_freewheeling_when_done)
 
 	VERBOSE (engine, "++ Removing failed clients ...");
 
+	jack_graph_change_begin (engine);
+
 	/* remove all dead clients */
 
 	for (node = engine->clients; node; ) {
@@ -409,50 +429,454 @@ jack_remove_clients (jack_engine_t* engine, int* exit_freewheeling_when_done)
 
 	jack_engine_reset_rolling_usecs (engine);
 
+	jack_graph_change_end (engine);
+
 	VERBOSE (engine, "-- Removing failed clients ...");
 }
 
-jack_client_internal_t *
-jack_client_by_name (jack_engine_t *engine, const char *name)
+static int
+jack_load_compare (const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+
+	return (x > y) - (x < y);
+}
+
+static int
+jack_float_compare (const void *a, const void *b)
+{
+	float x = *(const float*)a;
+	float y = *(const float*)b;
+
+	return (x > y) - (x < y);
+}
+
+void
+jack_client_load_stats (jack_client_internal_t *client, jack_client_load_t *load)
+{
+	uint32_t sorted[JACK_CLIENT_LOAD_WINDOW];
+	unsigned int n = client->load_count;
+
+	memset (load, 0, sizeof(*load));
+
+	if (client->load_usecs == NULL || n == 0) {
+		return;
+	}
+
+	/* the engine thread keeps writing while we copy; a sample from
+	   the next cycle sneaking in does no harm
+	 */
+	memcpy (sorted, client->load_usecs, n * sizeof(uint32_t));
+	qsort (sorted, n, sizeof(uint32_t), jack_load_compare);
+
+	load->cycles = n;
+	load->p50_usecs = sorted[(n - 1) * 50 / 100];
+	load->p99_usecs = sorted[(n - 1) * 99 / 100];
+	load->max_usecs = sorted[n - 1];
+
+	if (client->perf_samples && (n = client->perf_count) > 0) {
+		float ipc[JACK_CLIENT_LOAD_WINDOW];
+		unsigned int i;
+
+		for (i = 0; i < n; i++) {
+			ipc[i] = client->perf_samples[i].ipc;
+			sorted[i] = client->perf_samples[i].llc_misses;
+		}
+		qsort (ipc, n, sizeof(float), jack_float_compare);
+		qsort (sorted, n, sizeof(uint32_t), jack_load_compare);
+
+		load->perf_cycles = n;
+		load->p50_ipc = ipc[(n - 1) * 50 / 100];
+		load->p1_ipc = ipc[(n - 1) * 1 / 100];
+		load->p50_llc_misses = sorted[(n - 1) * 50 / 100];
+		load->p99_llc_misses = sorted[(n - 1) * 99 / 100];
+	}
+
+	if (client->fault_samples && (n = client->fault_count) > 0) {
+		unsigned int i;
+
+		for (i = 0; i < n; i++) {
+			const jack_client_fault_sample_t *s = &client->fault_samples[i];
+			sorted[i] = s->minor_faults;
+			load->major_faults += s->major_faults;
+			if (s->involuntary_switches) {
+				load->preempted_cycles++;
+			}
+		}
+		qsort (sorted, n, sizeof(uint32_t), jack_load_compare);
+
+		load->fault_cycles = n;
+		load->p99_minor_faults = sorted[(n - 1) * 99 / 100];
+		load->max_minor_faults = sorted[n - 1];
+	}
+}
+
+/* Recompute the p99 budgets the engine thread uses to time out
+ * subgraphs, see jack_subgraph_timeout().  A subgraph with a member
+ * that has no history yet gets no budget.  Called by the supervisor
+ * thread.
+ */
+void
+jack_client_update_budgets (jack_engine_t *engine)
 {
-	jack_client_internal_t *client = NULL;
 	JSList *node;
+	jack_client_internal_t *client, *member;
+	jack_client_load_t load;
+	uint32_t total = 0, before = 0, chain;
+	int known;
 
 	jack_rdlock_graph (engine);
 
 	for (node = engine->clients; node; node = jack_slist_next (node)) {
-		if (strcmp ((const char*)((jack_client_internal_t*)
-					  node->data)->control->name,
-			    name) == 0) {
-			client = (jack_client_internal_t*)node->data;
+		client = (jack_client_internal_t*)node->data;
+		client->p99_usecs = 0;
+		if (client->control->active && client->load_count) {
+			jack_client_load_stats (client, &load);
+			client->p99_usecs = (uint32_t)load.p99_usecs;
+			total += client->p99_usecs;
+		}
+	}
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t*)node->data;
+
+		chain = 0;
+		known = 1;
+		for (member = client; member; member = member->next_client) {
+			if (member != client && jack_client_is_internal (member)) {
+				break;
+			}
+			if (member->control->active && member->load_count == 0) {
+				known = 0;
+			}
+			chain += member->p99_usecs;
+		}
+
+		client->subgraph_p99_usecs = known ? chain : 0;
+		client->after_p99_usecs = total - before > chain ?
+					  total - before - chain : 0;
+		before += client->p99_usecs;
+	}
+
+	jack_unlock_graph (engine);
+}
+
+/* Admission control, see --admission.
+ *
+ * Before a client is activated, or two clients are connected, the
+ * engine predicts how long the cycle's critical path would take
+ * afterwards, from the p99 execution time of each client in its load
+ * window.  A client with no history yet is taken to cost as much as
+ * the median of those that have one.  In serial mode every active
+ * client is on the path, except those in the async stage; in DAG mode
+ * the path is the longest chain through the dependencies.  A change
+ * that would take the path over admission_percent of the period, and
+ * make it longer than it already is, is refused with EBUSY.
+ */
+
+typedef struct {
+	jack_client_internal_t **clients;
+	uint32_t *usecs;
+	uint32_t *longest;              /* from here on plus 1, 0 if not known */
+	unsigned int n;
+	int from, to;                   /* an extra dependency, or -1 */
+} jack_admission_graph_t;
+
+static int
+jack_admission_index (jack_admission_graph_t *g, jack_client_internal_t *client)
+{
+	unsigned int i;
+
+	for (i = 0; i < g->n; i++) {
+		if (g->clients[i] == client) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* the longest chain starting at node i; the dependencies are acyclic
+   (sortfeeds has feedback connections reversed) */
+static uint32_t
+jack_admission_longest (jack_admission_graph_t *g, int i)
+{
+	JSList *node;
+	uint32_t most = 0, len;
+	int j;
+
+	if (g->longest[i]) {
+		return g->longest[i] - 1;
+	}
+
+	for (node = g->clients[i]->sortfeeds; node; node = jack_slist_next (node)) {
+		if ((j = jack_admission_index (g, (jack_client_internal_t*)node->data)) >= 0
+		    && j != i && (len = jack_admission_longest (g, j)) > most) {
+			most = len;
+		}
+	}
+	if (i == g->from && g->to >= 0 && g->to != i
+	    && (len = jack_admission_longest (g, g->to)) > most) {
+		most = len;
+	}
+
+	g->longest[i] = most + g->usecs[i] + 1;
+	return most + g->usecs[i];
+}
+
+/* the predicted critical path in usecs, with `extra' active too and
+   with a dependency from `from' to `to' if they are given */
+static uint32_t
+jack_admission_predict (jack_engine_t *engine, jack_client_internal_t *extra,
+			jack_client_internal_t *from, jack_client_internal_t *to)
+{
+	jack_admission_graph_t g;
+	jack_client_load_t load;
+	JSList *node;
+	unsigned int i, n = 0, known = 0;
+	uint32_t median = 0, path = 0, *sorted;
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		n++;
+	}
+	g.clients = (jack_client_internal_t**)calloc (n ? n : 1, sizeof(jack_client_internal_t*));
+	g.usecs = (uint32_t*)calloc (n ? n : 1, sizeof(uint32_t));
+	g.longest = (uint32_t*)calloc (n ? n : 1, sizeof(uint32_t));
+	sorted = (uint32_t*)calloc (n ? n : 1, sizeof(uint32_t));
+	g.n = 0;
+
+	if (g.clients == NULL || g.usecs == NULL || g.longest == NULL || sorted == NULL) {
+		goto out;
+	}
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client = (jack_client_internal_t*)node->data;
+		jack_client_control_t *ctl = client->control;
+
+		if (!ctl->active && client != extra) {
+			continue;
+		}
+		if (!engine->dag && ctl->async && !jack_client_is_internal (client)) {
+			continue;       /* off the path in the async stage */
+		}
+
+		g.clients[g.n] = client;
+		if (client->load_count) {
+			jack_client_load_stats (client, &load);
+			g.usecs[g.n] = (uint32_t)load.p99_usecs;
+			sorted[known++] = g.usecs[g.n];
+		} else {
+			g.usecs[g.n] = UINT32_MAX;      /* filled in below */
+		}
+		g.n++;
+	}
+
+	if (known) {
+		qsort (sorted, known, sizeof(uint32_t), jack_load_compare);
+		median = sorted[known / 2];
+	}
+	for (i = 0; i < g.n; i++) {
+		if (g.usecs[i] == UINT32_MAX) {
+			g.usecs[i] = median;
+		}
+	}
+
+	if (!engine->dag) {
+		for (i = 0; i < g.n; i++) {
+			path += g.usecs[i];
+		}
+		goto out;
+	}
+
+	g.from = from ? jack_admission_index (&g, from) : -1;
+	g.to = to ? jack_admission_index (&g, to) : -1;
+
+	for (i = 0; i < g.n; i++) {
+		uint32_t len = jack_admission_longest (&g, i);
+		if (len > path) {
+			path = len;
+		}
+	}
+
+out:
+	free (sorted);
+	free (g.longest);
+	free (g.usecs);
+	free (g.clients);
+	return path;
+}
+
+/* Zero if activating `extra', or adding a dependency from `from' to
+   `to', is admitted, EBUSY if not.  The caller holds the graph lock. */
+int
+jack_admission_check (jack_engine_t *engine, jack_client_internal_t *extra,
+		      jack_client_internal_t *from, jack_client_internal_t *to)
+{
+	jack_time_t period;
+	uint32_t limit, before, after;
+
+	if (admission_percent == 0 || engine->freewheeling || engine->driver == NULL
+	    || (period = engine->driver->period_usecs) == 0) {
+		return 0;
+	}
+	limit = (uint32_t)(period * admission_percent / 100);
+
+	after = jack_admission_predict (engine, extra, from, to);
+	if (after <= limit) {
+		return 0;
+	}
+	before = jack_admission_predict (engine, NULL, NULL, NULL);
+	if (after <= before) {
+		return 0;       /* no worse than it is */
+	}
+
+	if (extra) {
+		jack_error ("refusing to activate \"%s\": the critical path "
+			    "would take %" PRIu32 " usecs, over the %" PRIu32
+			    " usecs (%u%% of the period) admitted",
+			    extra->control->name, after, limit, admission_percent);
+	} else {
+		jack_error ("refusing to connect \"%s\" to \"%s\": the critical "
+			    "path would take %" PRIu32 " usecs, over the %" PRIu32
+			    " usecs (%u%% of the period) admitted",
+			    from->control->name, to->control->name, after, limit,
+			    admission_percent);
+	}
+	return EBUSY;
+}
+
+void
+jack_client_load_request (jack_engine_t *engine, jack_request_t *req)
+{
+	JSList *node;
+
+	req->status = -1;
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client = (jack_client_internal_t*)node->data;
+		if (strcmp ((const char*)client->control->name,
+			    req->x.client_load.name) == 0) {
+			jack_client_load_stats (client, &req->x.client_load.load);
+			req->status = 0;
 			break;
 		}
 	}
+}
+
+/* Clients are found by name and UUID through chained hash tables
+ * kept next to engine->clients, and reserved names through one kept
+ * next to engine->reserved_client_names, so that neither request
+ * handling nor picking a unique name walks the lists.
+ */
+static inline JSList **
+jack_client_name_bucket (JSList **index, const char *name)
+{
+	return &index[jack_port_name_hash (name) & (JACK_CLIENT_INDEX_SIZE - 1)];
+}
+
+static inline JSList **
+jack_client_uuid_bucket (JSList **index, jack_uuid_t uuid)
+{
+	uint64_t h = (uint64_t)uuid * 0x9E3779B97F4A7C15ULL;
+
+	return &index[(h >> 32) & (JACK_CLIENT_INDEX_SIZE - 1)];
+}
+
+static void
+jack_client_index_add (jack_engine_t *engine, jack_client_internal_t *client)
+{
+	/* caller must write-hold the client lock */
+	JSList **bucket;
+
+	bucket = jack_client_name_bucket (engine->client_by_name,
+					  (const char*)client->control->name);
+	*bucket = jack_slist_prepend (*bucket, client);
+	bucket = jack_client_uuid_bucket (engine->client_by_uuid,
+					  client->control->uuid);
+	*bucket = jack_slist_prepend (*bucket, client);
+}
 
+static void
+jack_client_index_remove (jack_engine_t *engine, jack_client_internal_t *client)
+{
+	/* caller must write-hold the client lock */
+	JSList **bucket;
+
+	bucket = jack_client_name_bucket (engine->client_by_name,
+					  (const char*)client->control->name);
+	*bucket = jack_slist_remove (*bucket, client);
+	bucket = jack_client_uuid_bucket (engine->client_by_uuid,
+					  client->control->uuid);
+	*bucket = jack_slist_remove (*bucket, client);
+}
+
+void
+jack_reserved_name_add (jack_engine_t *engine, jack_reserved_name_t *reservation)
+{
+	JSList **bucket;
+
+	engine->reserved_client_names =
+		jack_slist_append (engine->reserved_client_names, reservation);
+	bucket = jack_client_name_bucket (engine->reserved_by_name,
+					  reservation->name);
+	*bucket = jack_slist_prepend (*bucket, reservation);
+}
+
+static void
+jack_reserved_name_remove (jack_engine_t *engine, jack_reserved_name_t *reservation)
+{
+	JSList **bucket;
+
+	engine->reserved_client_names =
+		jack_slist_remove (engine->reserved_client_names, reservation);
+	bucket = jack_client_name_bucket (engine->reserved_by_name,
+					  reservation->name);
+	*bucket = jack_slist_remove (*bucket, reservation);
+}
+
+jack_client_internal_t *
+jack_client_by_name_locked (jack_engine_t *engine, const char *name)
+{
+	JSList *node;
+
+	/* caller must hold the client lock, or be the server thread */
+
+	for (node = *jack_client_name_bucket (engine->client_by_name, name);
+	     node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client = (jack_client_internal_t*)node->data;
+		if (strcmp ((const char*)client->control->name, name) == 0) {
+			return client;
+		}
+	}
+
+	return NULL;
+}
+
+jack_client_internal_t *
+jack_client_by_name (jack_engine_t *engine, const char *name)
+{
+	jack_client_internal_t *client;
+
+	jack_rdlock_graph (engine);
+	client = jack_client_by_name_locked (engine, name);
 	jack_unlock_graph (engine);
+
 	return client;
 }
 
 static int
 jack_client_id_by_name (jack_engine_t *engine, const char *name, jack_uuid_t id)
 {
-	JSList *node;
+	jack_client_internal_t *client;
 	int ret = -1;
 
 	jack_uuid_clear (&id);
 
 	jack_rdlock_graph (engine);
 
-	for (node = engine->clients; node; node = jack_slist_next (node)) {
-		if (strcmp ((const char*)((jack_client_internal_t*)
-					  node->data)->control->name,
-			    name) == 0) {
-			jack_client_internal_t *client =
-				(jack_client_internal_t*)node->data;
-			jack_uuid_copy (&id, client->control->uuid);
-			ret = 0;
-			break;
-		}
+	if ((client = jack_client_by_name_locked (engine, name)) != NULL) {
+		jack_uuid_copy (&id, client->control->uuid);
+		ret = 0;
 	}
 
 	jack_unlock_graph (engine);
@@ -462,20 +886,19 @@ jack_client_id_by_name (jack_engine_t *engine, const char *name, jack_uuid_t id)
 jack_client_internal_t *
 jack_client_internal_by_id (jack_engine_t *engine, jack_uuid_t id)
 {
-	jack_client_internal_t *client = NULL;
 	JSList *node;
 
 	/* call tree ***MUST HOLD*** the graph lock */
 
-	for (node = engine->clients; node; node = jack_slist_next (node)) {
-
-		if (jack_uuid_compare (((jack_client_internal_t*)node->data)->control->uuid, id) == 0) {
-			client = (jack_client_internal_t*)node->data;
-			break;
+	for (node = *jack_client_uuid_bucket (engine->client_by_uuid, id);
+	     node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client = (jack_client_internal_t*)node->data;
+		if (jack_uuid_compare (client->control->uuid, id) == 0) {
+			return client;
 		}
 	}
 
-	return client;
+	return NULL;
 }
 
 int
@@ -483,7 +906,8 @@ jack_client_name_reserved ( jack_engine_t *engine, const char *name )
 {
 	JSList *node;
 
-	for (node = engine->reserved_client_names; node; node = jack_slist_next (node)) {
+	for (node = *jack_client_name_bucket (engine->reserved_by_name, name);
+	     node; node = jack_slist_next (node)) {
 		jack_reserved_name_t *reservation = (jack_reserved_name_t*)node->data;
 		if (!strcmp (reservation->name, name)) {
 			return 1;
@@ -580,21 +1004,50 @@ jack_setup_client_control (jack_engine_t *engine, int fd, ClientType type, const
 	client->execution_order = UINT_MAX;
 	client->next_client = NULL;
 	client->handle = NULL;
+	client->initialize = NULL;
 	client->finish = NULL;
+	client->embedded = FALSE;
 	client->error = 0;
+	client->late = 0;
+	client->skipped = 0;
 	client->private_client = NULL;
+	client->load_usecs = (uint32_t*)calloc (JACK_CLIENT_LOAD_WINDOW, sizeof(uint32_t));
+	client->load_next = 0;
+	client->load_count = 0;
+	client->perf_samples = engine->control->perf_counters ?
+			       calloc (JACK_CLIENT_LOAD_WINDOW, sizeof(jack_client_perf_sample_t)) : NULL;
+	client->perf_next = 0;
+	client->perf_count = 0;
+	client->fault_samples = engine->control->perf_counters ?
+				calloc (JACK_CLIENT_LOAD_WINDOW, sizeof(jack_client_fault_sample_t)) : NULL;
+	client->fault_next = 0;
+	client->fault_count = 0;
+	client->p99_usecs = 0;
+	client->subgraph_p99_usecs = 0;
+	client->after_p99_usecs = 0;
+	client->event_queue = NULL;
+	client->event_queue_len = 0;
+	client->event_queue_size = 0;
+	client->event_queue_last = 0;
 
 	if (type != ClientExternal) {
 
-		client->control = (jack_client_control_t*)
-				  malloc (sizeof(jack_client_control_t));
+		/* a cache line apart from its neighbours, see
+		   JACK_CACHE_ALIGNED */
+		if (posix_memalign ((void**)&client->control, JACK_CACHE_LINE,
+				    sizeof(jack_client_control_t))) {
+			client->control = NULL;
+		}
 
 	} else {
 
-		if (jack_shmalloc (sizeof(jack_client_control_t),
+		if (jack_shmalloc (JACK_CLIENT_CONTROL_SIZE,
 				   &client->control_shm)) {
 			jack_error ("cannot create client control block for %s",
 				    name);
+			free (client->load_usecs);
+			free (client->perf_samples);
+			free (client->fault_samples);
 			free (client);
 			return 0;
 		}
@@ -603,6 +1056,9 @@ jack_setup_client_control (jack_engine_t *engine, int fd, ClientType type, const
 			jack_error ("cannot attach to client control block "
 				    "for %s (%s)", name, strerror (errno));
 			jack_destroy_shm (&client->control_shm);
+			free (client->load_usecs);
+			free (client->perf_samples);
+			free (client->fault_samples);
 			free (client);
 			return 0;
 		}
@@ -625,8 +1081,14 @@ jack_setup_client_control (jack_engine_t *engine, int fd, ClientType type, const
 	strcpy ((char*)client->control->name, name);
 	client->subgraph_start_fd = -1;
 	client->subgraph_wait_fd = -1;
+	client->subgraph_start_slot = -1;
+	client->subgraph_wait_slot = -1;
+	client->wait_slot = -1;
+	client->wake_word = -1;
+	client->wake_next = -1;
 
 	client->session_reply_pending = FALSE;
+	client->latency_dirty = 0;
 
 	client->control->process_cbset = FALSE;
 	client->control->bufsize_cbset = FALSE;
@@ -639,7 +1101,17 @@ jack_setup_client_control (jack_engine_t *engine, int fd, ClientType type, const
 	client->control->thread_cb_cbset = FALSE;
 	client->control->session_cbset = FALSE;
 	client->control->property_cbset = FALSE;
+	client->control->skip_cbset = FALSE;
+	client->control->async_events = FALSE;
+	client->control->async = FALSE;
+	client->control->graph_mirror = FALSE;
+	client->control->delayed = FALSE;
 	client->control->latency_cbset = FALSE;
+	client->control->latency_published = 0;
+	client->control->request_done = 0;
+	client->control->request_seq = 0;
+	client->control->reply_seq = 0;
+	client->control->shm_requests = FALSE;
 
 #if 0
 	if (type != ClientExternal) {
@@ -720,8 +1192,9 @@ setup_client (jack_engine_t *engine, ClientType type, char *name,
 		return NULL;
 	}
 
-	/* only for internal clients, driver is already loaded */
-	if (type == ClientInternal) {
+	/* only for internal clients, driver is already loaded, and an
+	   embedded client is part of the server's own program */
+	if (type == ClientInternal && object_path) {
 		if (jack_load_client (engine, client, object_path)) {
 			jack_error ("cannot dynamically load client from"
 				    " \"%s\"", object_path);
@@ -760,8 +1233,12 @@ setup_client (jack_engine_t *engine, ClientType type, char *name,
 
 	/* add new client to the clients list */
 	jack_lock_graph (engine);
+	jack_graph_change_begin (engine);
 	engine->clients = jack_slist_prepend (engine->clients, client);
+	jack_client_index_add (engine, client);
+	engine->reach_valid = FALSE;
 	jack_engine_reset_rolling_usecs (engine);
+	jack_graph_change_end (engine);
 
 	if (jack_client_is_internal (client)) {
 
@@ -771,7 +1248,8 @@ setup_client (jack_engine_t *engine, ClientType type, char *name,
 		/* Call its initialization function.  This function
 		 * may make requests of its own, so we temporarily
 		 * release and then reacquire the request_lock.  */
-		if (client->control->type == ClientInternal) {
+		if (client->control->type == ClientInternal &&
+		    client->initialize) {
 
 			pthread_mutex_unlock (&engine->request_lock);
 			if (client->initialize (client->private_client,
@@ -822,6 +1300,56 @@ jack_create_driver_client (jack_engine_t *engine, char *name)
 	return client;
 }
 
+/* An internal client of the program the server runs in, see
+ * jackctl_server_open_client().  It is set up like a loaded one, with
+ * no object to load or initialize.
+ */
+jack_client_internal_t *
+jack_create_embedded_client (jack_engine_t *engine, const char *name,
+			     jack_options_t options, jack_status_t *status)
+{
+	jack_client_internal_t *client;
+	jack_uuid_t empty_uuid = JACK_UUID_EMPTY_INITIALIZER;
+	char buf[JACK_CLIENT_NAME_SIZE];
+
+	snprintf (buf, sizeof(buf), "%s", name);
+	jack_uuid_clear (&empty_uuid);
+	*status = 0;
+
+	pthread_mutex_lock (&engine->request_lock);
+	client = setup_client (engine, ClientInternal, buf, empty_uuid,
+			       options, status, -1, NULL, NULL);
+	if (client) {
+		client->embedded = TRUE;
+	}
+	pthread_mutex_unlock (&engine->request_lock);
+
+	return client;
+}
+
+int
+jack_remove_embedded_client (jack_engine_t *engine, jack_uuid_t id)
+{
+	/* called *without* the request_lock */
+	jack_client_internal_t *client;
+	int ret = -1;
+
+	pthread_mutex_lock (&engine->request_lock);
+	jack_lock_graph (engine);
+
+	if ((client = jack_client_internal_by_id (engine, id)) && client->embedded) {
+		VERBOSE (engine, "closing embedded client \"%s\"",
+			 client->control->name);
+		jack_remove_client (engine, client);
+		ret = 0;
+	}
+
+	jack_unlock_graph (engine);
+	pthread_mutex_unlock (&engine->request_lock);
+
+	return ret;
+}
+
 static jack_status_t
 handle_unload_client (jack_engine_t *engine, jack_uuid_t id)
 {
@@ -834,7 +1362,7 @@ handle_unload_client (jack_engine_t *engine, jack_uuid_t id)
 	if ((client = jack_client_internal_by_id (engine, id))) {
 		VERBOSE (engine, "unloading client \"%s\"",
 			 client->control->name);
-		if (client->control->type != ClientInternal) {
+		if (client->control->type != ClientInternal || client->embedded) {
 			status = JackFailure | JackInvalidOption;
 		} else {
 			jack_remove_client (engine, client);
@@ -856,9 +1384,8 @@ jack_get_reserved_name (jack_engine_t *engine, jack_uuid_t uuid)
 		jack_reserved_name_t *reservation = (jack_reserved_name_t*)node->data;
 		if (jack_uuid_compare (reservation->uuid, uuid) != 0) {
 			char *retval = strdup (reservation->name);
+			jack_reserved_name_remove (engine, reservation);
 			free (reservation);
-			engine->reserved_client_names =
-				jack_slist_remove (engine->reserved_client_names, reservation);
 			return retval;
 		}
 	}
@@ -899,6 +1426,13 @@ jack_client_create (jack_engine_t *engine, int client_fd)
 		return -1;
 	}
 
+	if (req.load == JACK_CONNECT_STATS) {
+		/* a supervisor polling, see jack_server_stats_query() */
+		jack_server_stats_send (engine, client_fd);
+		close (client_fd);
+		return 1;
+	}
+
 	if (!req.load) {                /* internal client close? */
 
 		int rc = -1;
@@ -955,6 +1489,9 @@ jack_client_create (jack_engine_t *engine, int client_fd)
 		strcpy (res.fifo_prefix, engine->fifo_prefix);
 	}
 
+	/* with --standby, the driver may still be starting */
+	jack_engine_standby_wait (engine);
+
 	if (write (client_fd, &res, sizeof(res)) != sizeof(res)) {
 		jack_error ("cannot write connection response to client");
 		jack_lock_graph (engine);
@@ -966,6 +1503,8 @@ jack_client_create (jack_engine_t *engine, int client_fd)
 
 	if (jack_client_is_internal (client)) {
 		close (client_fd);
+	} else {
+		jack_engine_watch_client (engine, client);
 	}
 
 	jack_client_registration_notify (engine, (const char*)client->control->name, 1);
@@ -986,7 +1525,16 @@ jack_client_activate (jack_engine_t *engine, jack_uuid_t id)
 
 	jack_lock_graph (engine);
 
-	if ((client = jack_client_internal_by_id (engine, id))) {
+	client = jack_client_internal_by_id (engine, id);
+
+	if (client && !client->control->active
+	    && jack_admission_check (engine, client, NULL, NULL)) {
+		jack_unlock_graph (engine);
+		return EBUSY;
+	}
+
+	if (client) {
+		jack_graph_change_begin (engine);
 		client->control->active = TRUE;
 
 		jack_transport_activate (engine, client);
@@ -1000,6 +1548,9 @@ jack_client_activate (jack_engine_t *engine, jack_uuid_t id)
 		jack_get_fifo_fd (engine,
 				  ++engine->external_client_cnt);
 		jack_sort_graph (engine);
+		jack_graph_change_end (engine);
+		jack_xrun_dump_graph_event (engine, "activate %s",
+					    client->control->name);
 
 
 		for (i = 0; i < engine->control->n_port_types; ++i) {
@@ -1044,6 +1595,8 @@ jack_client_deactivate (jack_engine_t *engine, jack_uuid_t id)
 			JSList *portnode;
 			jack_port_internal_t *port;
 
+			jack_graph_change_begin (engine);
+
 			for (portnode = client->ports; portnode;
 			     portnode = jack_slist_next (portnode)) {
 				port = (jack_port_internal_t*)portnode->data;
@@ -1051,6 +1604,10 @@ jack_client_deactivate (jack_engine_t *engine, jack_uuid_t id)
 			}
 
 			ret = jack_client_do_deactivate (engine, client, TRUE);
+
+			jack_graph_change_end (engine);
+			jack_xrun_dump_graph_event (engine, "deactivate %s",
+						    client->control->name);
 			break;
 		}
 	}
@@ -1108,8 +1665,12 @@ jack_client_delete (jack_engine_t *engine, jack_client_internal_t *client)
 	 */
 	jack_property_change_notify (engine, PropertyDeleted, uuid, NULL);
 
+	jack_client_clear_late (engine, client);
+
 	if (jack_client_is_internal (client)) {
 
+		jack_client_regex_free (client->private_client);
+		jack_graph_mirror_free (client->private_client);
 		free (client->private_client);
 		free ((void*)client->control);
 
@@ -1124,6 +1685,10 @@ jack_client_delete (jack_engine_t *engine, jack_client_internal_t *client)
 		jack_destroy_shm (&client->control_shm);
 	}
 
+	free (client->event_queue);
+	free (client->load_usecs);
+	free (client->perf_samples);
+	free (client->fault_samples);
 	free (client);
 
 }
@@ -40,6 +40,65 @@ jack_client_state_name (jack_client_internal_t *client)
 	return client_state_names[client->control->state];
 }
 
+/* called for every client at the end of each cycle */
+static inline void
+jack_client_load_sample (jack_client_internal_t *client)
+{
+	jack_client_control_t *ctl = client->control;
+
+	if (client->load_usecs == NULL || ctl->awake_at == 0
+	    || ctl->finished_at < ctl->awake_at) {
+		return;                 /* did not run, or did not finish */
+	}
+
+	client->load_usecs[client->load_next] =
+		(uint32_t)(ctl->finished_at - ctl->awake_at);
+	client->load_next = (client->load_next + 1) & (JACK_CLIENT_LOAD_WINDOW - 1);
+	if (client->load_count < JACK_CLIENT_LOAD_WINDOW) {
+		client->load_count++;
+	}
+
+	if (client->perf_samples && ctl->perf_cycles) {
+		jack_client_perf_sample_t *s = &client->perf_samples[client->perf_next];
+
+		s->ipc = (float)ctl->perf_instructions / (float)ctl->perf_cycles;
+		s->llc_misses = ctl->perf_llc_misses > UINT32_MAX ?
+				UINT32_MAX : (uint32_t)ctl->perf_llc_misses;
+		ctl->perf_cycles = 0;
+		client->perf_next = (client->perf_next + 1) & (JACK_CLIENT_LOAD_WINDOW - 1);
+		if (client->perf_count < JACK_CLIENT_LOAD_WINDOW) {
+			client->perf_count++;
+		}
+	}
+
+	if (client->fault_samples && ctl->fault_counts) {
+		jack_client_fault_sample_t *s = &client->fault_samples[client->fault_next];
+
+		s->minor_faults = ctl->minor_faults;
+		s->major_faults = ctl->major_faults > UINT16_MAX ?
+				  UINT16_MAX : (uint16_t)ctl->major_faults;
+		s->involuntary_switches = ctl->involuntary_switches > UINT16_MAX ?
+					  UINT16_MAX : (uint16_t)ctl->involuntary_switches;
+		client->fault_next = (client->fault_next + 1) & (JACK_CLIENT_LOAD_WINDOW - 1);
+		if (client->fault_count < JACK_CLIENT_LOAD_WINDOW) {
+			client->fault_count++;
+		}
+	}
+}
+
+/* a client that timed out is flagged late until it finishes a cycle
+   again, or the supervisor thread gives up on it.  returns non-zero
+   if the caller was the one to clear the flag. */
+static inline int
+jack_client_clear_late (jack_engine_t *engine, jack_client_internal_t *client)
+{
+	if (!__sync_bool_compare_and_swap (&client->late, 1, 0)) {
+		return 0;
+	}
+	__sync_sub_and_fetch (&engine->late_clients, 1);
+	return 1;
+}
+
 #define JACK_ERROR_WITH_SOCKETS 10000000
 
 int     jack_client_activate(jack_engine_t *engine, jack_uuid_t id);
@@ -50,6 +109,10 @@ void    jack_client_delete(jack_engine_t *engine,
 int     jack_mark_client_socket_error(jack_engine_t *engine, int fd);
 jack_client_internal_t *
 jack_create_driver_client(jack_engine_t *engine, char *name);
+jack_client_internal_t *
+jack_create_embedded_client(jack_engine_t *engine, const char *name,
+			    jack_options_t options, jack_status_t *status);
+int     jack_remove_embedded_client(jack_engine_t *engine, jack_uuid_t id);
 void    jack_intclient_handle_request(jack_engine_t *engine,
 				      jack_request_t *req);
 void    jack_intclient_load_request(jack_engine_t *engine,
@@ -58,10 +121,18 @@ void    jack_intclient_name_request(jack_engine_t *engine,
 				    jack_request_t *req);
 void    jack_intclient_unload_request(jack_engine_t *engine,
 				      jack_request_t *req);
-int     jack_check_clients(jack_engine_t* engine, int with_timeout_check);
+int     jack_check_clients(jack_engine_t* engine);
 void    jack_remove_clients(jack_engine_t* engine, int* exit_freewheeling);
 void    jack_client_registration_notify(jack_engine_t *engine,
 					const char* name, int yn);
 void jack_property_change_notify(jack_engine_t *engine, jack_property_change_t change, jack_uuid_t uuid, const char* key);
 
 void jack_remove_client(jack_engine_t *engine, jack_client_internal_t *client);
+void jack_reserved_name_add(jack_engine_t *engine, jack_reserved_name_t *reservation);
+jack_client_internal_t *
+jack_client_by_name_locked(jack_engine_t *engine, const char *name);
+void jack_client_load_stats(jack_client_internal_t *client, jack_client_load_t *load);
+void jack_client_update_budgets(jack_engine_t *engine);
+void jack_client_load_request(jack_engine_t *engine, jack_request_t *req);
+int jack_admission_check(jack_engine_t *engine, jack_client_internal_t *extra,
+			 jack_client_internal_t *from, jack_client_internal_t *to);
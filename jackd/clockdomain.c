@@ -0,0 +1,779 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    Clock domains -- runs in the server process.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ */
+
+/*
+ * A clock domain is a driver that runs its device on a clock of its
+ * own, next to the master driver, where a slave driver would run in
+ * lockstep with it.  Its thread calls run_cycle as any driver's does,
+ * at its own period, and the engine hands those cycles to
+ * jack_clock_domain_run().
+ *
+ * The driver reads and writes buffers of the domain's own, which
+ * jack_port_get_buffer() returns for its ports instead of their
+ * buffers in the graph.  A cycle of the domain reads the device into
+ * them, pushes the capture ports into a ring, resamples the next
+ * period of the playback ports out of another ring, and writes the
+ * device.  The graph's cycle does the other end of both rings with
+ * the graph's buffers of the same ports.  Clients see and connect the
+ * ports of a domain like any others, and still all run in the one
+ * process cycle of the master.
+ *
+ * Whoever reads a ring resamples it to their own clock.  The ratio of
+ * the two clocks comes from the engine's DLL on the graph's side and a
+ * DLL of our own on the domain's wakeups; a PI controller on the ring
+ * fill, as in the ALSA driver's aggregate devices, takes out what the
+ * two miss.  The resampler is the drift resampler of netjack's local
+ * clock: a Kaiser windowed sinc in JACK_DOMAIN_PHASES phases,
+ * interpolated between the two nearest, with SSE or NEON for the dot
+ * products.
+ *
+ * Only audio crosses.  Ports of other types get empty buffers on
+ * either side.
+ */
+
+#include <config.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <jack/ringbuffer.h>
+
+#include "internal.h"
+#include "engine.h"
+#include "driver.h"
+#include "clockdomain.h"
+
+#include "libjack/local.h"
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#define JACK_DOMAIN_RING_PERIODS   8
+#define JACK_DOMAIN_TARGET_PERIODS 2.0
+#define JACK_DOMAIN_KP             2e-4 /* per period of fill error */
+#define JACK_DOMAIN_KI             2e-6 /* the same, per period */
+#define JACK_DOMAIN_SMOOTH         0.05 /* of the fill error */
+#define JACK_DOMAIN_MAX_CORRECTION 0.002
+#define JACK_DOMAIN_DLL_BANDWIDTH  0.1  /* Hz */
+#define JACK_DOMAIN_MAX_DRIFT      0.01 /* ratios are clamped to 1 +- this */
+#define JACK_DOMAIN_PHASES         32
+#define JACK_DOMAIN_TAPS           24
+#define JACK_DOMAIN_BETA           7.0
+#define JACK_DOMAIN_ROLLOFF        0.92 /* passband edge, of nyquist */
+
+/* The resampler keeps the input of every channel in a row of hist,
+ * hist_fill frames of it so far, and the position of the next output
+ * frame in there as a fraction.  After a period the frames no later
+ * output can reach are dropped from the front.
+ */
+typedef struct {
+	int channels;
+	jack_nframes_t out_frames;
+	float *filter;                  /* JACK_DOMAIN_PHASES + 1 rows */
+	int hist_stride;
+	float *hist;                    /* channels rows of hist_stride */
+	jack_nframes_t hist_fill;
+	jack_nframes_t pending;         /* asked for by jack_domain_need() */
+	double pos;
+	float *out;                     /* channels rows of out_frames */
+} jack_domain_drift_t;
+
+/* One direction: written a period of `period' frames at a time by one
+ * side, read and resampled to `draw' frames by the other.
+ */
+typedef struct {
+	int channels;
+	jack_port_t **ports;
+	jack_nframes_t period;
+	jack_nframes_t draw;
+	jack_ringbuffer_t *rb;          /* interleaved float frames */
+	jack_domain_drift_t drift;      /* the reading side's */
+	float *buf;                     /* interleaved, for either side */
+	size_t target;                  /* fill the controller keeps rb at */
+	double err;
+	double integral;
+	int primed;
+	unsigned long dropouts;
+} jack_domain_stream_t;
+
+struct _jack_clock_domain {
+	jack_engine_t *engine;
+	jack_driver_t *driver;
+	pthread_t thread;
+	jack_nframes_t nframes;
+	jack_nframes_t graph_nframes;
+	volatile int failed;            /* 2 once the graph has gone silent */
+
+	jack_domain_stream_t capture;   /* domain to graph */
+	jack_domain_stream_t playback;  /* graph to domain */
+
+	/* everything but audio, emptied every cycle */
+	int nother;
+	jack_port_t **other;
+	size_t *other_size;
+
+	/* DLL on the domain's wakeups, in usecs */
+	int dll_valid;
+	double dll_next;
+	double dll_period;
+	double dll_nominal;
+	double dll_b;
+	double dll_c;
+
+	/* usecs per frame of either clock, each written by its own thread */
+	volatile float domain_frame_usecs;
+	volatile float graph_frame_usecs;
+
+	unsigned long skipped;          /* cycles not of our period */
+};
+
+static double
+jack_domain_bessel_i0 (double x)
+{
+	double sum = 1.0, term = 1.0;
+	int k;
+
+	for (k = 1; k < 50; k++) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+		if (term < sum * 1e-12) {
+			break;
+		}
+	}
+	return sum;
+}
+
+/* JACK_DOMAIN_PHASES + 1 rows; row p is for an output position p /
+ * JACK_DOMAIN_PHASES of a frame past the start of the window.  The
+ * cutoff leaves room for the input running fast.
+ */
+static void
+jack_domain_design (float *filter)
+{
+	double fc = 0.5 * JACK_DOMAIN_ROLLOFF / (1.0 + JACK_DOMAIN_MAX_DRIFT);
+	double half = JACK_DOMAIN_TAPS / 2.0;
+	int p, k;
+
+	for (p = 0; p <= JACK_DOMAIN_PHASES; p++) {
+		float *row = filter + p * JACK_DOMAIN_TAPS;
+		double sum = 0.0;
+
+		for (k = 0; k < JACK_DOMAIN_TAPS; k++) {
+			double d = half - 1 - k + (double)p / JACK_DOMAIN_PHASES;
+			double x = d / half;
+			double w = (fabs (x) < 1.0)
+				   ? jack_domain_bessel_i0 (JACK_DOMAIN_BETA * sqrt (1.0 - x * x))
+				   / jack_domain_bessel_i0 (JACK_DOMAIN_BETA) : 0.0;
+			double s = (d == 0.0) ? 1.0
+				   : sin (2.0 * M_PI * fc * d) / (2.0 * M_PI * fc * d);
+
+			row[k] = 2.0 * fc * s * w;
+			sum += row[k];
+		}
+
+		/* unity gain at DC for every phase */
+		for (k = 0; k < JACK_DOMAIN_TAPS; k++) {
+			row[k] /= sum;
+		}
+	}
+}
+
+static inline float
+jack_domain_dot (const float *h, const float *x)
+{
+#if defined(__SSE__)
+	__m128 a0 = _mm_setzero_ps ();
+	__m128 a1 = _mm_setzero_ps ();
+	float r[4];
+	int k;
+
+	for (k = 0; k + 8 <= JACK_DOMAIN_TAPS; k += 8) {
+		a0 = _mm_add_ps (a0, _mm_mul_ps (_mm_loadu_ps (h + k), _mm_loadu_ps (x + k)));
+		a1 = _mm_add_ps (a1, _mm_mul_ps (_mm_loadu_ps (h + k + 4), _mm_loadu_ps (x + k + 4)));
+	}
+	_mm_storeu_ps (r, _mm_add_ps (a0, a1));
+	return (r[0] + r[1]) + (r[2] + r[3]);
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	float32x4_t a0 = vdupq_n_f32 (0.0f);
+	float32x4_t a1 = vdupq_n_f32 (0.0f);
+	float32x2_t s;
+	int k;
+
+	for (k = 0; k + 8 <= JACK_DOMAIN_TAPS; k += 8) {
+		a0 = vmlaq_f32 (a0, vld1q_f32 (h + k), vld1q_f32 (x + k));
+		a1 = vmlaq_f32 (a1, vld1q_f32 (h + k + 4), vld1q_f32 (x + k + 4));
+	}
+	a0 = vaddq_f32 (a0, a1);
+	s = vadd_f32 (vget_low_f32 (a0), vget_high_f32 (a0));
+	return vget_lane_f32 (vpadd_f32 (s, s), 0);
+#else
+	float sum = 0.0f;
+	int k;
+
+	for (k = 0; k < JACK_DOMAIN_TAPS; k++) {
+		sum += h[k] * x[k];
+	}
+	return sum;
+#endif
+}
+
+static double
+jack_domain_clamp (double ratio)
+{
+	if (ratio < 1.0 - JACK_DOMAIN_MAX_DRIFT) {
+		return 1.0 - JACK_DOMAIN_MAX_DRIFT;
+	}
+	if (ratio > 1.0 + JACK_DOMAIN_MAX_DRIFT) {
+		return 1.0 + JACK_DOMAIN_MAX_DRIFT;
+	}
+	return ratio;
+}
+
+/* the most jack_domain_need() ever asks for */
+static jack_nframes_t
+jack_domain_max_need (jack_nframes_t out_frames)
+{
+	return (jack_nframes_t)ceil (out_frames * (1.0 + JACK_DOMAIN_MAX_DRIFT)) + 4;
+}
+
+static int
+jack_domain_drift_init (jack_domain_drift_t *d, int channels,
+			jack_nframes_t out_frames)
+{
+	d->channels = channels;
+	d->out_frames = out_frames;
+	d->hist_stride = 2 * JACK_DOMAIN_TAPS + jack_domain_max_need (out_frames);
+	d->filter = malloc (sizeof(float) * (JACK_DOMAIN_PHASES + 1)
+			    * JACK_DOMAIN_TAPS);
+	d->hist = calloc (channels * d->hist_stride, sizeof(float));
+	d->out = calloc (channels * out_frames, sizeof(float));
+
+	if (!d->filter || !d->hist || !d->out) {
+		return -1;
+	}
+
+	jack_domain_design (d->filter);
+
+	/* start on a window of silence */
+	d->hist_fill = JACK_DOMAIN_TAPS - 1;
+	return 0;
+}
+
+static void
+jack_domain_drift_free (jack_domain_drift_t *d)
+{
+	free (d->filter);
+	free (d->hist);
+	free (d->out);
+}
+
+/* How many input frames the next period takes at `ratio' of input
+ * frames per output frame; they go after hist_fill before
+ * jack_domain_process() is called with the same ratio.
+ */
+static jack_nframes_t
+jack_domain_need (jack_domain_drift_t *d, double ratio)
+{
+	double last = d->pos + (d->out_frames - 1) * jack_domain_clamp (ratio);
+	long end = (long)last + JACK_DOMAIN_TAPS;
+
+	d->pending = end > (long)d->hist_fill ? end - d->hist_fill : 0;
+	return d->pending;
+}
+
+static void
+jack_domain_process (jack_domain_drift_t *d, double ratio)
+{
+	jack_nframes_t j, drop;
+	int chn;
+
+	ratio = jack_domain_clamp (ratio);
+	d->hist_fill += d->pending;
+	d->pending = 0;
+
+	for (j = 0; j < d->out_frames; j++) {
+		double p = d->pos + j * ratio;
+		int first = (int)p;
+		double f = (p - first) * JACK_DOMAIN_PHASES;
+		int row = (int)f;
+		float a = (float)(f - row);
+		const float *h0 = d->filter + row * JACK_DOMAIN_TAPS;
+		const float *h1 = h0 + JACK_DOMAIN_TAPS;
+		const float *x = d->hist + first;
+		float *out = d->out + j;
+
+		for (chn = 0; chn < d->channels; chn++) {
+			float y0 = jack_domain_dot (h0, x);
+			float y1 = jack_domain_dot (h1, x);
+
+			*out = y0 + a * (y1 - y0);
+			x += d->hist_stride;
+			out += d->out_frames;
+		}
+	}
+
+	d->pos += d->out_frames * ratio;
+	drop = (jack_nframes_t)d->pos;
+	if (drop > d->hist_fill) {
+		drop = d->hist_fill;
+	}
+	d->pos -= drop;
+	d->hist_fill -= drop;
+
+	for (chn = 0; chn < d->channels; chn++) {
+		float *row = d->hist + chn * d->hist_stride;
+		memmove (row, row + drop, sizeof(float) * d->hist_fill);
+	}
+}
+
+static void
+jack_domain_stream_free (jack_domain_stream_t *s)
+{
+	if (s->rb) {
+		jack_ringbuffer_free (s->rb);
+	}
+	jack_domain_drift_free (&s->drift);
+	free (s->buf);
+	free (s->ports);
+}
+
+static int
+jack_domain_stream_init (jack_domain_stream_t *s, jack_nframes_t period,
+			 jack_nframes_t draw)
+{
+	jack_nframes_t frames;
+
+	s->period = period;
+	s->draw = draw;
+	s->target = (size_t)(JACK_DOMAIN_TARGET_PERIODS * period) + draw;
+
+	if (s->channels == 0) {
+		return 0;
+	}
+
+	if (jack_domain_drift_init (&s->drift, s->channels, draw)) {
+		return -1;
+	}
+
+	frames = JACK_DOMAIN_RING_PERIODS * period + 2 * draw;
+	s->rb = jack_ringbuffer_create (frames * s->channels * sizeof(float));
+
+	frames = jack_domain_max_need (draw);
+	if (frames < period) {
+		frames = period;
+	}
+	s->buf = malloc (frames * s->channels * sizeof(float));
+
+	if (!s->rb || !s->buf) {
+		return -1;
+	}
+	return 0;
+}
+
+/* Run the controller on the fill of a ring, in frames.  Returns the
+ * correction to the ratio of the reading side.
+ */
+static double
+jack_domain_adjust (jack_domain_stream_t *s, size_t fill)
+{
+	double err = ((double)fill - s->target) / s->period;
+	double c;
+
+	s->err += JACK_DOMAIN_SMOOTH * (err - s->err);
+
+	s->integral += JACK_DOMAIN_KI * s->err;
+	if (s->integral > JACK_DOMAIN_MAX_CORRECTION) {
+		s->integral = JACK_DOMAIN_MAX_CORRECTION;
+	} else if (s->integral < -JACK_DOMAIN_MAX_CORRECTION) {
+		s->integral = -JACK_DOMAIN_MAX_CORRECTION;
+	}
+
+	c = JACK_DOMAIN_KP * s->err + s->integral;
+	if (c > JACK_DOMAIN_MAX_CORRECTION) {
+		c = JACK_DOMAIN_MAX_CORRECTION;
+	} else if (c < -JACK_DOMAIN_MAX_CORRECTION) {
+		c = -JACK_DOMAIN_MAX_CORRECTION;
+	}
+	return c;
+}
+
+/* Resample the next period out of a ring, at `ratio' of its writer's
+ * frames to ours.  Returns 0, and leaves the ring alone, until it has
+ * filled up to the target the first time, or again after running dry.
+ * A ring that has got far past the target, as it does while the graph
+ * freewheels, starts over from the target.
+ */
+static int
+jack_domain_pull (jack_domain_stream_t *s, double ratio)
+{
+	size_t frame_bytes = s->channels * sizeof(float);
+	size_t fill = jack_ringbuffer_read_space (s->rb) / frame_bytes;
+	jack_nframes_t need, got, i;
+	int chn;
+
+	if (!s->primed || fill > 2 * s->target) {
+		if (fill < s->target) {
+			return 0;
+		}
+		/* start the controller at rest */
+		jack_ringbuffer_read_advance (s->rb,
+					      (fill - s->target) * frame_bytes);
+		fill = s->target;
+		s->err = 0.0;
+		s->primed = 1;
+	}
+
+	ratio *= 1.0 + jack_domain_adjust (s, fill);
+
+	need = jack_domain_need (&s->drift, ratio);
+	got = need < fill ? need : fill;
+	jack_ringbuffer_read (s->rb, (char*)s->buf, got * frame_bytes);
+
+	if (got < need) {
+		/* ran dry: fill up again before going on */
+		memset (s->buf + got * s->channels, 0,
+			(need - got) * frame_bytes);
+		s->dropouts++;
+		s->primed = 0;
+	}
+
+	for (chn = 0; chn < s->channels; chn++) {
+		float *in = s->drift.hist + chn * s->drift.hist_stride
+			    + s->drift.hist_fill;
+
+		for (i = 0; i < need; i++) {
+			in[i] = s->buf[i * s->channels + chn];
+		}
+	}
+	jack_domain_process (&s->drift, ratio);
+
+	return 1;
+}
+
+/* Interleave a period of the ports' buffers, as `get' returns them,
+ * into the ring. */
+static void
+jack_domain_push (jack_domain_stream_t *s,
+		  void *(*get)(jack_port_t *, jack_nframes_t))
+{
+	size_t bytes = s->period * s->channels * sizeof(float);
+	jack_nframes_t i;
+	int chn;
+
+	if (jack_ringbuffer_write_space (s->rb) < bytes) {
+		s->dropouts++;
+		return;
+	}
+
+	for (chn = 0; chn < s->channels; chn++) {
+		const float *buf = get (s->ports[chn], s->period);
+
+		for (i = 0; i < s->period; i++) {
+			s->buf[i * s->channels + chn] = buf[i];
+		}
+	}
+	jack_ringbuffer_write (s->rb, (char*)s->buf, bytes);
+}
+
+/* Copy what the last pull resampled, or silence, into the ports'
+ * buffers, as `get' returns them. */
+static void
+jack_domain_deliver (jack_domain_stream_t *s, int have,
+		     void *(*get)(jack_port_t *, jack_nframes_t))
+{
+	size_t bytes = s->draw * sizeof(float);
+	int chn;
+
+	for (chn = 0; chn < s->channels; chn++) {
+		float *buf = get (s->ports[chn], s->draw);
+
+		if (have) {
+			memcpy (buf, s->drift.out + chn * s->draw, bytes);
+		} else {
+			memset (buf, 0, bytes);
+		}
+	}
+}
+
+static void *
+jack_domain_buffer (jack_port_t *port, jack_nframes_t nframes)
+{
+	return port->domain_buffer;
+}
+
+static void *
+jack_domain_graph_buffer (jack_port_t *port, jack_nframes_t nframes)
+{
+	return jack_output_port_buffer (port);
+}
+
+static void
+jack_domain_empty (jack_clock_domain_t *cd)
+{
+	int i;
+
+	for (i = 0; i < cd->nother; i++) {
+		jack_port_t *port = cd->other[i];
+		port->fptr.buffer_init (port->domain_buffer, cd->other_size[i],
+					cd->nframes);
+	}
+}
+
+jack_clock_domain_t *
+jack_clock_domain_new (jack_engine_t *engine, jack_driver_t *driver,
+		       jack_nframes_t nframes, jack_nframes_t graph_nframes,
+		       jack_nframes_t rate)
+{
+	jack_clock_domain_t *cd;
+	jack_port_t *port;
+	JSList *ports, *node;
+	jack_nframes_t frames;
+	double omega;
+	size_t size;
+	int n;
+
+	if ((cd = calloc (1, sizeof(jack_clock_domain_t))) == NULL) {
+		return NULL;
+	}
+	cd->engine = engine;
+	cd->driver = driver;
+	cd->nframes = nframes;
+	cd->graph_nframes = graph_nframes;
+
+	ports = driver->internal_client->private_client->ports;
+	n = jack_slist_length (ports);
+	cd->capture.ports = calloc (n + 1, sizeof(jack_port_t *));
+	cd->playback.ports = calloc (n + 1, sizeof(jack_port_t *));
+	cd->other = calloc (n + 1, sizeof(jack_port_t *));
+	cd->other_size = calloc (n + 1, sizeof(size_t));
+	if (!cd->capture.ports || !cd->playback.ports
+	    || !cd->other || !cd->other_size) {
+		goto fail;
+	}
+
+	/* the driver may still ask for a period of the graph's size, as
+	   it does when it zeroes a port it has no data for */
+	frames = nframes > graph_nframes ? nframes : graph_nframes;
+
+	for (node = ports; node; node = jack_slist_next (node)) {
+		port = (jack_port_t*)node->data;
+		size = jack_port_type_buffer_size (port->type_info, frames);
+
+		if (posix_memalign (&port->domain_buffer,
+				    JACK_PORT_BUFFER_ALIGN, size)) {
+			port->domain_buffer = NULL;
+			goto fail;
+		}
+		memset (port->domain_buffer, 0, size);
+
+		if (strcmp (port->type_info->type_name,
+			    JACK_DEFAULT_AUDIO_TYPE)) {
+			cd->other_size[cd->nother] = size;
+			cd->other[cd->nother++] = port;
+		} else if (port->shared->flags & JackPortIsOutput) {
+			cd->capture.ports[cd->capture.channels++] = port;
+		} else {
+			cd->playback.ports[cd->playback.channels++] = port;
+		}
+	}
+
+	if (jack_domain_stream_init (&cd->capture, nframes, graph_nframes)
+	    || jack_domain_stream_init (&cd->playback, graph_nframes, nframes)) {
+		goto fail;
+	}
+	jack_domain_empty (cd);
+
+	cd->dll_nominal = (double)nframes * 1000000.0 / rate;
+	cd->dll_period = cd->dll_nominal;
+	omega = 2.0 * M_PI * JACK_DOMAIN_DLL_BANDWIDTH * cd->dll_nominal / 1000000.0;
+	cd->dll_b = sqrt (2.0) * omega;
+	cd->dll_c = omega * omega;
+	cd->domain_frame_usecs = 1000000.0f / rate;
+	cd->graph_frame_usecs = 1000000.0f / rate;
+
+	return cd;
+
+fail:
+	jack_error ("cannot set up the clock domain of %s",
+		    driver->internal_client->control->name);
+	jack_clock_domain_free (cd);
+	return NULL;
+}
+
+void
+jack_clock_domain_free (jack_clock_domain_t *cd)
+{
+	JSList *node;
+
+	if (cd->capture.dropouts || cd->playback.dropouts || cd->skipped) {
+		jack_info ("clock domain %s: dropouts: capture %lu, playback"
+			   " %lu; %lu cycles skipped",
+			   cd->driver->internal_client->control->name,
+			   cd->capture.dropouts, cd->playback.dropouts,
+			   cd->skipped);
+	}
+
+	for (node = cd->driver->internal_client->private_client->ports;
+	     node; node = jack_slist_next (node)) {
+		jack_port_t *port = (jack_port_t*)node->data;
+		free (port->domain_buffer);
+		port->domain_buffer = NULL;
+	}
+
+	jack_domain_stream_free (&cd->capture);
+	jack_domain_stream_free (&cd->playback);
+	free (cd->other);
+	free (cd->other_size);
+	free (cd);
+}
+
+jack_driver_t *
+jack_clock_domain_driver (jack_clock_domain_t *cd)
+{
+	return cd->driver;
+}
+
+int
+jack_clock_domain_owns (jack_clock_domain_t *cd, pthread_t self, int bind)
+{
+	if (cd->thread) {
+		return pthread_equal (self, cd->thread);
+	}
+	if (bind) {
+		cd->thread = self;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+static void
+jack_domain_dll (jack_clock_domain_t *cd, jack_time_t wakeup)
+{
+	double e;
+
+	if (cd->dll_valid) {
+		e = (double)wakeup - cd->dll_next;
+
+		cd->dll_next += cd->dll_b * e + cd->dll_period;
+		cd->dll_period += cd->dll_c * e;
+
+		if (cd->dll_period < cd->dll_nominal * (1.0 - JACK_DOMAIN_MAX_DRIFT)) {
+			cd->dll_period = cd->dll_nominal * (1.0 - JACK_DOMAIN_MAX_DRIFT);
+		} else if (cd->dll_period > cd->dll_nominal * (1.0 + JACK_DOMAIN_MAX_DRIFT)) {
+			cd->dll_period = cd->dll_nominal * (1.0 + JACK_DOMAIN_MAX_DRIFT);
+		}
+	} else {
+		/* (re)start from here, with the period we had */
+		cd->dll_next = (double)wakeup + cd->dll_period;
+		cd->dll_valid = 1;
+	}
+
+	cd->domain_frame_usecs = cd->dll_period / cd->nframes;
+}
+
+int
+jack_clock_domain_run (jack_clock_domain_t *cd, jack_nframes_t nframes)
+{
+	jack_driver_t *driver = cd->driver;
+	int have;
+
+	if (nframes != cd->nframes) {
+		/* a late wakeup: the DLL starts over, and the rings see
+		   a period go missing */
+		cd->dll_valid = 0;
+		cd->skipped++;
+		return driver->null_cycle (driver, nframes);
+	}
+
+	jack_domain_dll (cd, driver->last_wait_ust);
+	jack_domain_empty (cd);
+
+	if (driver->read (driver, nframes)) {
+		return -1;
+	}
+
+	if (cd->capture.channels) {
+		jack_domain_push (&cd->capture, jack_domain_buffer);
+	}
+
+	if (cd->playback.channels) {
+		have = jack_domain_pull (&cd->playback,
+					 cd->domain_frame_usecs
+					 / cd->graph_frame_usecs);
+		jack_domain_deliver (&cd->playback, have, jack_domain_buffer);
+	}
+
+	return driver->write (driver, nframes);
+}
+
+void
+jack_clock_domain_failed (jack_clock_domain_t *cd)
+{
+	cd->failed = 1;
+}
+
+int
+jack_clock_domain_stopped (jack_clock_domain_t *cd)
+{
+	return cd->failed != 0;
+}
+
+void
+jack_clock_domain_read (jack_clock_domain_t *cd, jack_nframes_t nframes)
+{
+	jack_frame_timer_t *timer = &cd->engine->control->frame_timer;
+	int have = 0;
+
+	if (cd->capture.channels == 0 || cd->failed == 2) {
+		return;
+	}
+	if (cd->failed) {
+		/* once more, and the buffers stay silent */
+		jack_domain_deliver (&cd->capture, 0, jack_domain_graph_buffer);
+		cd->failed = 2;
+		return;
+	}
+
+	if (timer->period_usecs > 0.0f) {
+		cd->graph_frame_usecs = timer->period_usecs / nframes;
+	}
+
+	if (nframes == cd->graph_nframes) {
+		have = jack_domain_pull (&cd->capture,
+					 cd->graph_frame_usecs
+					 / cd->domain_frame_usecs);
+	}
+	jack_domain_deliver (&cd->capture, have, jack_domain_graph_buffer);
+}
+
+void
+jack_clock_domain_write (jack_clock_domain_t *cd, jack_nframes_t nframes)
+{
+	if (cd->playback.channels == 0 || cd->failed
+	    || nframes != cd->graph_nframes) {
+		return;
+	}
+	jack_domain_push (&cd->playback, jack_port_get_graph_buffer);
+}
@@ -0,0 +1,46 @@
+/*
+ *  Clock domains: drivers on clocks of their own next to the master.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+typedef struct _jack_clock_domain jack_clock_domain_t;
+
+/* for an attached driver running nframes periods, bridged into the
+   engine's graph of graph_nframes periods at the same nominal rate */
+jack_clock_domain_t *jack_clock_domain_new(jack_engine_t *engine,
+					   jack_driver_t *driver,
+					   jack_nframes_t nframes,
+					   jack_nframes_t graph_nframes,
+					   jack_nframes_t rate);
+void    jack_clock_domain_free(jack_clock_domain_t *cd);
+jack_driver_t *jack_clock_domain_driver(jack_clock_domain_t *cd);
+
+/* TRUE if `self' runs the cycles of the domain; with `bind', a domain
+   that has not run yet takes it */
+int     jack_clock_domain_owns(jack_clock_domain_t *cd, pthread_t self,
+			       int bind);
+
+/* on the domain's thread: one cycle of its driver */
+int     jack_clock_domain_run(jack_clock_domain_t *cd, jack_nframes_t nframes);
+/* once its driver has failed, or stopped; its ports go silent */
+void    jack_clock_domain_failed(jack_clock_domain_t *cd);
+int     jack_clock_domain_stopped(jack_clock_domain_t *cd);
+
+/* in the graph's cycle: the domain's capture ports, and then its
+   playback ports */
+void    jack_clock_domain_read(jack_clock_domain_t *cd, jack_nframes_t nframes);
+void    jack_clock_domain_write(jack_clock_domain_t *cd, jack_nframes_t nframes);
@@ -42,6 +42,9 @@
 #include "driver.h"
 #include "engine.h"
 #include "clientengine.h"
+#include "libjack/local.h"
+#include "drivercache.h"
+#include "metrics.h"
 
 //#include "JackError.h"
 //#include "JackServer.h"
@@ -105,6 +108,10 @@ struct jackctl_server {
 	union jackctl_parameter_value do_mlock;
 	union jackctl_parameter_value default_do_mlock;
 
+	/* bool, lock only what the process cycle touches */
+	union jackctl_parameter_value selective_mlock;
+	union jackctl_parameter_value default_selective_mlock;
+
 	/* bool, munlock gui libraries */
 	union jackctl_parameter_value do_unlock;
 	union jackctl_parameter_value default_do_unlock;
@@ -116,6 +123,86 @@ struct jackctl_server {
 	/* int, timeout thres... */
 	union jackctl_parameter_value timothres;
 	union jackctl_parameter_value default_timothres;
+
+	/* uint32_t, DAG worker threads; if zero, run the graph serially */
+	union jackctl_parameter_value parallel;
+	union jackctl_parameter_value default_parallel;
+
+	/* string, how process() handoffs are signalled: fifo or futex */
+	union jackctl_parameter_value wakeup;
+	union jackctl_parameter_value default_wakeup;
+
+	/* uint32_t, largest period the port segments are laid out for */
+	union jackctl_parameter_value max_buffer_size;
+	union jackctl_parameter_value default_max_buffer_size;
+
+	/* string, frame timer DLL bandwidth in Hz */
+	union jackctl_parameter_value dll_bandwidth;
+	union jackctl_parameter_value default_dll_bandwidth;
+
+	/* uint32_t, number of cycle trace records */
+	union jackctl_parameter_value cycle_trace;
+	union jackctl_parameter_value default_cycle_trace;
+
+	/* uint32_t, port meter interval in msecs */
+	union jackctl_parameter_value port_meters;
+	union jackctl_parameter_value default_port_meters;
+
+	/* string, [host:]port of the metrics service; empty for none */
+	union jackctl_parameter_value metrics;
+	union jackctl_parameter_value default_metrics;
+
+	/* string, directory for xrun dumps; empty for none */
+	union jackctl_parameter_value xrun_dump;
+	union jackctl_parameter_value default_xrun_dump;
+
+	/* string, file to record the capture to; empty for none */
+	union jackctl_parameter_value record;
+	union jackctl_parameter_value default_record;
+
+	/* string, MIN:MAX frames for the buffer size governor; empty for none */
+	union jackctl_parameter_value buffer_governor;
+	union jackctl_parameter_value default_buffer_governor;
+
+	/* string, CPU lists; empty for no placement */
+	union jackctl_parameter_value rt_cpus;
+	union jackctl_parameter_value default_rt_cpus;
+	union jackctl_parameter_value server_cpus;
+	union jackctl_parameter_value default_server_cpus;
+	union jackctl_parameter_value client_cpus;
+	union jackctl_parameter_value default_client_cpus;
+
+	/* char[], "interleave" or a NUMA node for the port segments */
+	union jackctl_parameter_value numa;
+	union jackctl_parameter_value default_numa;
+
+	/* bool, keep each client's output buffers together */
+	union jackctl_parameter_value group_buffers;
+	union jackctl_parameter_value default_group_buffers;
+
+	/* bool, try SCHED_DEADLINE for the driver and process threads */
+	union jackctl_parameter_value deadline;
+	union jackctl_parameter_value default_deadline;
+
+	/* bool, read hardware counters around process callbacks */
+	union jackctl_parameter_value perf_counters;
+	union jackctl_parameter_value default_perf_counters;
+
+	/* bool, null cycles while the graph has nothing to do */
+	union jackctl_parameter_value idle;
+	union jackctl_parameter_value default_idle;
+
+	/* uint, percentage of the period admitted on the critical path */
+	union jackctl_parameter_value admission;
+	union jackctl_parameter_value default_admission;
+
+	/* uint, most periods the decimated async stage may batch */
+	union jackctl_parameter_value async_history;
+	union jackctl_parameter_value default_async_history;
+
+	/* uint, events per MIDI port buffer; 0 for the built-in size */
+	union jackctl_parameter_value midi_bufsize;
+	union jackctl_parameter_value default_midi_bufsize;
 };
 
 struct jackctl_driver {
@@ -293,30 +380,16 @@ fail:
 }
 
 static jack_driver_desc_t *
-jack_drivers_get_descriptor (JSList * drivers, const char * sofile)
+jack_drivers_open_descriptor (const char * filename)
 {
-	jack_driver_desc_t * descriptor, * other_descriptor;
+	jack_driver_desc_t * descriptor;
 	JackDriverDescFunction so_get_descriptor;
-	JSList * node;
 	void * dlhandle;
-	char * filename;
 	const char * dlerr;
 	int err;
-	char* driver_dir;
-
-	if ((driver_dir = getenv ("JACK_DRIVER_DIR")) == 0) {
-		driver_dir = ADDON_DIR;
-	}
-	filename = malloc (strlen (driver_dir) + 1 + strlen (sofile) + 1);
-	sprintf (filename, "%s/%s", driver_dir, sofile);
-
-//	if (verbose) {
-//		jack_info ("getting driver descriptor from %s", filename);
-//	}
 
 	if ((dlhandle = dlopen (filename, RTLD_NOW | RTLD_GLOBAL)) == NULL) {
 		jack_error ("could not open driver .so '%s': %s\n", filename, dlerror ());
-		free (filename);
 		return NULL;
 	}
 
@@ -326,14 +399,12 @@ jack_drivers_get_descriptor (JSList * drivers, const char * sofile)
 	if ((dlerr = dlerror ()) != NULL) {
 		jack_error ("%s", dlerr);
 		dlclose (dlhandle);
-		free (filename);
 		return NULL;
 	}
 
 	if ((descriptor = so_get_descriptor ()) == NULL) {
 		jack_error ("driver from '%s' returned NULL descriptor\n", filename);
 		dlclose (dlhandle);
-		free (filename);
 		return NULL;
 	}
 
@@ -341,6 +412,35 @@ jack_drivers_get_descriptor (JSList * drivers, const char * sofile)
 		jack_error ("error closing driver .so '%s': %s\n", filename, dlerror ());
 	}
 
+	return descriptor;
+}
+
+static jack_driver_desc_t *
+jack_drivers_get_descriptor (JSList * drivers, jack_driver_cache_t * cache, const char * sofile)
+{
+	jack_driver_desc_t * descriptor, * other_descriptor;
+	JSList * node;
+	char * filename;
+	char* driver_dir;
+
+	if ((driver_dir = getenv ("JACK_DRIVER_DIR")) == 0) {
+		driver_dir = ADDON_DIR;
+	}
+	filename = malloc (strlen (driver_dir) + 1 + strlen (sofile) + 1);
+	sprintf (filename, "%s/%s", driver_dir, sofile);
+
+//	if (verbose) {
+//		jack_info ("getting driver descriptor from %s", filename);
+//	}
+
+	if ((descriptor = jack_driver_cache_get (cache, filename)) == NULL) {
+		if ((descriptor = jack_drivers_open_descriptor (filename)) == NULL) {
+			free (filename);
+			return NULL;
+		}
+		jack_driver_cache_put (cache, filename, descriptor);
+	}
+
 	/* check it doesn't exist already */
 	for (node = drivers; node; node = jack_slist_next (node)) {
 		other_descriptor = (jack_driver_desc_t*)node->data;
@@ -369,6 +469,7 @@ jack_drivers_load ()
 	int err;
 	JSList * driver_list = NULL;
 	jack_driver_desc_t * desc;
+	jack_driver_cache_t * cache;
 	char* driver_dir;
 
 	if ((driver_dir = getenv ("JACK_DRIVER_DIR")) == 0) {
@@ -384,6 +485,8 @@ jack_drivers_load ()
 		return NULL;
 	}
 
+	cache = jack_driver_cache_open ();
+
 	while ( (dir_entry = readdir (dir_stream)) ) {
 		/* check the filename is of the right format */
 		if (strncmp ("jack_", dir_entry->d_name, 5) != 0) {
@@ -399,12 +502,14 @@ jack_drivers_load ()
 			continue;
 		}
 
-		desc = jack_drivers_get_descriptor (drivers, dir_entry->d_name);
+		desc = jack_drivers_get_descriptor (drivers, cache, dir_entry->d_name);
 		if (desc) {
 			driver_list = jack_slist_append (driver_list, desc);
 		}
 	}
 
+	jack_driver_cache_close (cache);
+
 	err = closedir (dir_stream);
 	if (err) {
 		jack_error ("error closing driver directory %s: %s\n",
@@ -1021,6 +1126,20 @@ jackctl_server_t * jackctl_server_create (
 		goto fail_free_parameters;
 	}
 
+	value.b = false;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    'f',
+		    "selective-mlock",
+		    "Lock only the memory the process cycle touches.",
+		    "Instead of mlockall(), lock the shared memory segments, the stacks of realtime threads and the RT pools, and in clients whatever code they register with jack_lock_code_region().",
+		    JackParamBool,
+		    &server_ptr->selective_mlock,
+		    &server_ptr->default_selective_mlock,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
 	value.b = false;
 	if (jackctl_add_parameter (
 		    &server_ptr->parameters,
@@ -1049,6 +1168,297 @@ jackctl_server_t * jackctl_server_create (
 		goto fail_free_parameters;
 	}
 
+	value.ui = 0;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    'j',
+		    "parallel",
+		    "Number of worker threads for parallel graph execution.",
+		    "Run independent parts of the process graph at the same time on this many realtime worker threads, in addition to the engine thread. Zero runs the graph as a single serial chain.",
+		    JackParamUInt,
+		    &server_ptr->parallel,
+		    &server_ptr->default_parallel,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	strcpy (value.str, "fifo");
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    'w',
+		    "wakeup",
+		    "How clients are woken up: fifo | futex.",
+		    "Pass control along the process graph through named FIFOs, or through futexes in the engine's shared memory, which needs fewer system calls per client and cycle. Futexes are only available on Linux; FIFOs are used if they cannot be.",
+		    JackParamString,
+		    &server_ptr->wakeup,
+		    &server_ptr->default_wakeup,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.ui = 0;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    'b',
+		    "max-buffer-size",
+		    "Largest period, in frames, to lay out port buffers for.",
+		    "Size the port buffer segments for periods up to this many frames when the server starts, so that changing the buffer size within that range only reinitialises the buffers, without reallocating the segments or making clients map them again. Zero sizes them for the current period only.",
+		    JackParamUInt,
+		    &server_ptr->max_buffer_size,
+		    &server_ptr->default_max_buffer_size,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	strcpy (value.str, "0.125");
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    'B',
+		    "dll-bandwidth",
+		    "Bandwidth in Hz of the frame timer DLL.",
+		    "Set the bandwidth of the delay-locked loop that filters driver wakeup times into the frame time that clients convert with. Narrower gives steadier conversions but settles more slowly after an xrun.",
+		    JackParamString,
+		    &server_ptr->dll_bandwidth,
+		    &server_ptr->default_dll_bandwidth,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.ui = 0;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    'y',
+		    "cycle-trace",
+		    "Number of per-cycle timing records to keep in shared memory.",
+		    "Record the driver wait, the reported delay and each client's signal, wakeup and finish times for every process cycle in a ring of this many records, which other processes can read through jack_cycle_trace_attach(). Zero disables tracing.",
+		    JackParamUInt,
+		    &server_ptr->cycle_trace,
+		    &server_ptr->default_cycle_trace,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.ui = 0;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    'o',
+		    "port-meters",
+		    "Interval in msecs at which the server publishes the level of every audio output port.",
+		    "Measure the peak and RMS level of every audio output port after each cycle and publish them in shared memory once per interval, for meters to read through jack_port_meter_read() without connecting to anything. Zero disables metering.",
+		    JackParamUInt,
+		    &server_ptr->port_meters,
+		    &server_ptr->default_port_meters,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.str[0] = '\0';
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    'H',
+		    "metrics",
+		    "Serve OpenMetrics on this [host:]port.",
+		    "Answer HTTP requests on this address, 127.0.0.1 unless a host is given, with the DSP load, cycle time quantiles, the process time of each client, xruns by cause, server request latency and driver statistics in the OpenMetrics text format. Turns on a cycle trace ring if cycle-trace is zero.",
+		    JackParamString,
+		    &server_ptr->metrics,
+		    &server_ptr->default_metrics,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.str[0] = '\0';
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    'D',
+		    "xrun-dump",
+		    "Directory to write a report of each xrun to.",
+		    "On every xrun, write a file to this directory with the cycle trace records of the cycles before it, the graph order and the recent graph changes, from a thread of its own. Turns on a cycle trace ring if cycle-trace is zero.",
+		    JackParamString,
+		    &server_ptr->xrun_dump,
+		    &server_ptr->default_xrun_dump,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.str[0] = '\0';
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    'Q',
+		    "record",
+		    "File to record the driver's capture to, for the replay driver.",
+		    "Write what the master driver captures every cycle, with the transport state and the connections whenever they change, to this file, from a thread of its own. The replay driver plays it back.",
+		    JackParamString,
+		    &server_ptr->record,
+		    &server_ptr->default_record,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.str[0] = '\0';
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    'U',
+		    "buffer-governor",
+		    "Adapt the buffer size to the load, between MIN:MAX frames.",
+		    "Double the buffer size, up to MAX, when xruns happen two seconds in a row, and halve it, down to MIN, after thirty seconds without xruns while the cycle uses less than a quarter of the period. Both must be powers of 2. Clients get their buffer size callbacks as usual.",
+		    JackParamString,
+		    &server_ptr->buffer_governor,
+		    &server_ptr->default_buffer_governor,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.str[0] = '\0';
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    'a',
+		    "rt-cpus",
+		    "CPUs for the engine's realtime threads, such as 2,3 or 2-5.",
+		    "Place the driver thread and the realtime threads of backends on these CPUs. Parallel graph workers each get one of them, starting with the second. If not given, the workers are placed on the isolated CPUs, if there are any.",
+		    JackParamString,
+		    &server_ptr->rt_cpus,
+		    &server_ptr->default_rt_cpus,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    'e',
+		    "server-cpus",
+		    "CPUs for the server's request handling threads.",
+		    "Place the thread that handles client requests and connections, and the threads answering queries, on these CPUs.",
+		    JackParamString,
+		    &server_ptr->server_cpus,
+		    &server_ptr->default_server_cpus,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    'k',
+		    "client-cpus",
+		    "CPUs for the process threads of clients.",
+		    "Place the realtime process thread of each client on these CPUs, unless the client chooses otherwise with jack_set_process_thread_cpus() or $JACK_PROCESS_CPUS.",
+		    JackParamString,
+		    &server_ptr->client_cpus,
+		    &server_ptr->default_client_cpus,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    'O',
+		    "numa",
+		    "NUMA node for the port buffers, or \"interleave\".",
+		    "Bind the port buffer segments to this NUMA node, and unless rt-cpus or client-cpus are given, run the engine's realtime threads and the process threads of clients on its CPUs. With \"interleave\", spread the segments page by page over all nodes. Where the pages ended up is logged whenever a segment is resized.",
+		    JackParamString,
+		    &server_ptr->numa,
+		    &server_ptr->default_numa,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.b = false;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    'g',
+		    "group-buffers",
+		    "Keep each client's output port buffers together.",
+		    "Place each new output port buffer just after the last one its client already has, where that is free, so that a client's buffers share cache lines and pages rather than being spread across the segment.",
+		    JackParamBool,
+		    &server_ptr->group_buffers,
+		    &server_ptr->default_group_buffers,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.b = false;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    'E',
+		    "deadline",
+		    "Use SCHED_DEADLINE for the driver and process threads.",
+		    "In realtime mode, move the driver thread and the process thread of each client to SCHED_DEADLINE (Linux 3.14 or later), with the period of the driver and a budget derived from how long each of them took recently. Threads stay on SCHED_FIFO if the kernel refuses, which it does for threads restricted to some CPUs.",
+		    JackParamBool,
+		    &server_ptr->deadline,
+		    &server_ptr->default_deadline,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.b = false;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    'x',
+		    "perf-counters",
+		    "Count CPU cycles, instructions and cache misses per client.",
+		    "Read perf_event hardware counters and the thread's page faults and involuntary context switches around every process callback (Linux only) and keep them in each client's load window, beside its execution times. Costs four system calls per callback.",
+		    JackParamBool,
+		    &server_ptr->perf_counters,
+		    &server_ptr->default_perf_counters,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.b = false;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    'z',
+		    "idle",
+		    "Run null cycles while no client needs the graph.",
+		    "While no active client has a process, thread, sync or timebase callback and no backend port is connected, run only the backend's null cycle each period, and let backends that can (dummy) wake up less often. Full cycles resume when a client activates or a backend port is connected.",
+		    JackParamBool,
+		    &server_ptr->idle,
+		    &server_ptr->default_idle,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.ui = 0;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    'G',
+		    "admission",
+		    "Refuse changes predicted to load the cycle past this percentage of the period (0 = off).",
+		    "Before activating a client or connecting two, predict the critical path of the cycle from the 99th percentile of each client's recent execution times, and refuse the request with EBUSY if it would take more than this percentage of the period and longer than it does now.",
+		    JackParamUInt,
+		    &server_ptr->admission,
+		    &server_ptr->default_admission,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.ui = 0;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    'q',
+		    "async-history",
+		    "Most periods a client in the async stage may ask to process at once (0 = off).",
+		    "Keep a history of this many periods of every audio output read by the async stage in shared memory, so that async clients that call jack_set_process_decimation() run only once every few cycles and read the periods since their last run with jack_port_get_history().",
+		    JackParamUInt,
+		    &server_ptr->async_history,
+		    &server_ptr->default_async_history,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
+	value.ui = 0;
+	if (jackctl_add_parameter (
+		    &server_ptr->parameters,
+		    'M',
+		    "midi-bufsize",
+		    "MIDI events per MIDI port buffer (0 = 2048 bytes).",
+		    "Size the buffers of MIDI ports for this many events per period, independently of the audio period, which MIDI buffers do not depend on. MIDI buffers have a port segment of their own, so small ones save shared memory and cache traffic on graphs with many MIDI ports.",
+		    JackParamUInt,
+		    &server_ptr->midi_bufsize,
+		    &server_ptr->default_midi_bufsize,
+		    value, NULL) == NULL) {
+		goto fail_free_parameters;
+	}
+
 	//TODO: need
 	//JackServerGlobals::on_device_acquire = on_device_acquire;
 	//JackServerGlobals::on_device_release = on_device_release;
@@ -1107,11 +1517,55 @@ bool jackctl_server_stop (jackctl_server_t *server_ptr)
 	return true;
 }
 
+jack_client_t * jackctl_server_open_client (
+	jackctl_server_t *server_ptr,
+	const char *client_name,
+	jack_options_t options,
+	jack_status_t *status_ptr)
+{
+	jack_client_internal_t *client;
+	jack_status_t status = 0;
+
+	if (server_ptr->engine == NULL) {
+		jack_error ("cannot open client %s, server is not running", client_name);
+		if (status_ptr) {
+			*status_ptr = JackFailure | JackServerFailed;
+		}
+		return NULL;
+	}
+
+	client = jack_create_embedded_client (server_ptr->engine, client_name,
+					      options, &status);
+	if (status_ptr) {
+		*status_ptr = status;
+	}
+
+	return client ? client->private_client : NULL;
+}
+
+int jackctl_server_close_client (jackctl_server_t *server_ptr, jack_client_t *client)
+{
+	if (server_ptr->engine == NULL) {
+		return -1;
+	}
+
+	return jack_remove_embedded_client (server_ptr->engine, client->control->uuid);
+}
+
 const JSList * jackctl_server_get_parameters (jackctl_server_t *server_ptr)
 {
 	return server_ptr->parameters;
 }
 
+jack_server_stats_t * jackctl_server_get_stats (jackctl_server_t *server_ptr)
+{
+	if (server_ptr->engine == NULL) {
+		return NULL;
+	}
+
+	return jack_server_stats_collect (server_ptr->engine);
+}
+
 bool
 jackctl_server_start (
 	jackctl_server_t *server_ptr,
@@ -1150,8 +1604,50 @@ jackctl_server_start (
 	}
 	oldsignals = jackctl_block_signals ();
 
+	dag_threads = server_ptr->parallel.ui;
+	cycle_trace_records = server_ptr->cycle_trace.ui;
+	port_meter_msecs = server_ptr->port_meters.ui;
+	metrics_address = server_ptr->metrics.str[0] ? server_ptr->metrics.str : NULL;
+	xrun_dump_dir = server_ptr->xrun_dump.str[0] ? server_ptr->xrun_dump.str : NULL;
+	record_path = server_ptr->record.str[0] ? server_ptr->record.str : NULL;
+	buffer_governor = server_ptr->buffer_governor.str[0] ? server_ptr->buffer_governor.str : NULL;
+	rt_cpus = server_ptr->rt_cpus.str;
+	server_cpus = server_ptr->server_cpus.str;
+	client_cpus = server_ptr->client_cpus.str;
+	numa_policy = server_ptr->numa.str;
+	use_deadline = server_ptr->deadline.b;
+	use_perf_counters = server_ptr->perf_counters.b;
+	idle_cycles = server_ptr->idle.b;
+	admission_percent = server_ptr->admission.ui;
+	async_history = server_ptr->async_history.ui;
+	group_port_buffers = server_ptr->group_buffers.b;
+	max_buffer_size = server_ptr->max_buffer_size.ui;
+
+	if (server_ptr->midi_bufsize.ui) {
+		jack_port_type_info_t *port_type = &jack_builtin_port_types[JACK_MIDI_PORT_TYPE];
+		port_type->buffer_size = server_ptr->midi_bufsize.ui * jack_midi_internal_event_size ();
+		port_type->buffer_scale_factor = -1;
+	}
+
+	dll_bandwidth = strtod (server_ptr->dll_bandwidth.str, NULL);
+	if (!(dll_bandwidth > 0.0f)) {
+		jack_error ("invalid DLL bandwidth \"%s\", using %g Hz",
+			    server_ptr->dll_bandwidth.str,
+			    (double)JACK_DLL_DEFAULT_BANDWIDTH);
+		dll_bandwidth = JACK_DLL_DEFAULT_BANDWIDTH;
+	}
+
+	if (strcmp (server_ptr->wakeup.str, "futex") == 0) {
+		wakeup_method = JACK_WAKEUP_FUTEX;
+	} else {
+		wakeup_method = JACK_WAKEUP_FIFO;
+	}
+
 	if ((server_ptr->engine = jack_engine_new (server_ptr->realtime.b, server_ptr->realtime_priority.i,
-						   server_ptr->do_mlock.b, server_ptr->do_unlock.b, server_ptr->name.str,
+						   !server_ptr->do_mlock.b ? JACK_MLOCK_NONE
+						   : server_ptr->selective_mlock.b ? JACK_MLOCK_SELECTIVE
+						   : JACK_MLOCK_ALL,
+						   server_ptr->do_unlock.b, server_ptr->name.str,
 						   server_ptr->temporary.b, server_ptr->verbose.b, server_ptr->client_timeout.i,
 						   server_ptr->port_max.i, getpid (), frame_time_offset,
 						   server_ptr->nozombies.b, server_ptr->timothres.ui, drivers)) == 0) {
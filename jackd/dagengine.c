@@ -0,0 +1,709 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    Parallel (DAG) execution of the process graph -- runs in the
+    server process.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ */
+
+/*
+ * In the default (serial) mode the engine runs the sorted client list
+ * as a chain of external subgraphs, broken only by internal clients.
+ * In DAG mode, jack_rechain_graph() instead gives every external
+ * client a FIFO pair of its own, and this file turns the sortfeeds
+ * relation into a compiled dependency graph. Each cycle, every node's
+ * activation counter is loaded with the number of nodes feeding it;
+ * a node whose counter reaches zero is ready, and is picked up by the
+ * engine thread or by one of a pool of RT worker threads. The cycle
+ * is over once every node has completed.
+ *
+ * Drivers always run on the engine thread. Other clients are run by
+ * whichever thread is free: for an external client the work done by
+ * the server is just the FIFO handoff, the DSP happens in the client's
+ * own process thread; an internal client's DSP runs on the worker
+ * itself, so that many of them spread over the pool instead of
+ * queueing up on the engine thread, and one internal client feeds the
+ * next with no FIFO in between.
+ *
+ * While freewheeling, clients that have called jack_set_process_pipelined()
+ * may lag a cycle behind: jack_dag_process() returns as soon as every
+ * other node is done, and the workers finish the pipelined ones while
+ * the next cycle starts. Port buffers are not double buffered, so in
+ * that next cycle a node waits until it has itself finished the
+ * previous one, and until every node reading its output has too.
+ * Node state is kept per cycle parity, and at most two cycles are in
+ * flight.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <jack/thread.h>
+
+#include "internal.h"
+#include "engine.h"
+#include "messagebuffer.h"
+#include "clientengine.h"
+#include "dagengine.h"
+
+typedef struct _jack_dag_node {
+	jack_client_internal_t *client;
+	unsigned int refcount;          /* number of upstream nodes */
+	unsigned int pending[2];        /* activation counter, by cycle parity */
+	unsigned int *succ;             /* downstream nodes */
+	unsigned int nsucc;
+	unsigned int *pred;             /* upstream nodes */
+	unsigned int npred;
+	unsigned int blocked;           /* previous-cycle runs it waits for */
+	unsigned int done;              /* last cycle it completed */
+	int pipelined;                  /* may finish after jack_dag_process() */
+	int local;                      /* runs on the engine thread */
+} jack_dag_node_t;
+
+typedef struct _jack_dag_item {
+	jack_dag_node_t *node;
+	unsigned int cycle;
+} jack_dag_item_t;
+
+typedef struct _jack_dag_queue {
+	jack_dag_item_t *slot;
+	unsigned int size;
+	unsigned int head;
+	unsigned int tail;
+} jack_dag_queue_t;
+
+struct _jack_dag {
+	unsigned int nthreads;
+	pthread_t *threads;
+
+	/* the compiled graph, protected by engine->client_lock */
+	jack_dag_node_t *nodes;
+	unsigned int nnodes;
+	unsigned int *edges;
+	unsigned int *preds;            /* edges, reversed */
+
+	/* per-cycle state, protected by `lock' */
+	pthread_mutex_t lock;
+	pthread_cond_t work;            /* workers wait here */
+	pthread_cond_t ready;           /* engine thread waits here */
+	jack_dag_queue_t shared;        /* for any thread */
+	jack_dag_queue_t local;         /* for the engine thread only */
+	unsigned int cycle;             /* the one jack_dag_process() runs */
+	unsigned int remaining[2];      /* nodes left, by cycle parity */
+	unsigned int critical;          /* unpipelined nodes left this cycle */
+	jack_nframes_t nframes;
+	int abort;
+	unsigned int late;              /* timed out nodes, not yet counted */
+	int stop;
+	unsigned int started;           /* workers placed on a CPU so far */
+};
+
+static inline int
+jack_dag_client_runnable (jack_client_internal_t *client)
+{
+	jack_client_control_t *ctl = client->control;
+
+	return ctl->active && !ctl->dead && !client->skipped &&
+	       (ctl->process_cbset || ctl->thread_cb_cbset);
+}
+
+static inline void
+jack_dag_push (jack_dag_queue_t *queue, jack_dag_node_t *node,
+	       unsigned int cycle)
+{
+	/* each node is queued at most once per cycle, and there are
+	   never more than two cycles in flight, so the queue cannot
+	   overflow. */
+	jack_dag_item_t *item = &queue->slot[queue->tail++ % queue->size];
+
+	item->node = node;
+	item->cycle = cycle;
+}
+
+static inline int
+jack_dag_pop (jack_dag_queue_t *queue, jack_dag_item_t *item)
+{
+	if (queue->head == queue->tail) {
+		return 0;
+	}
+	*item = queue->slot[queue->head++ % queue->size];
+	return 1;
+}
+
+static void jack_dag_complete_node(jack_dag_t *dag, jack_dag_node_t *node,
+				   unsigned int cycle, int status);
+
+static void
+jack_dag_ready_node (jack_dag_t *dag, jack_dag_node_t *node,
+		     unsigned int cycle)
+{
+	/* precondition: caller holds dag->lock */
+
+	if (dag->abort || !jack_dag_client_runnable (node->client)) {
+		/* nothing to run, but its dependents still need to
+		   be released */
+		jack_dag_complete_node (dag, node, cycle, 0);
+		return;
+	}
+
+	if (node->local) {
+		jack_dag_push (&dag->local, node, cycle);
+	} else {
+		jack_dag_push (&dag->shared, node, cycle);
+		pthread_cond_signal (&dag->work);
+	}
+
+	/* the engine thread will also pick up shared work
+	   if it has nothing else to do */
+	pthread_cond_signal (&dag->ready);
+}
+
+static inline void
+jack_dag_reset_client (jack_client_internal_t *client)
+{
+	jack_client_control_t *ctl = client->control;
+
+	ctl->state = NotTriggered;
+	ctl->timed_out = 0;
+	ctl->awake_at = 0;
+	ctl->finished_at = 0;
+}
+
+/* `node' no longer waits for one more previous-cycle run */
+static void
+jack_dag_unblock_node (jack_dag_t *dag, jack_dag_node_t *node)
+{
+	/* precondition: caller holds dag->lock */
+
+	if (--node->blocked == 0 && node->pending[dag->cycle & 1] == 0) {
+		jack_dag_ready_node (dag, node, dag->cycle);
+	}
+}
+
+static void
+jack_dag_complete_node (jack_dag_t *dag, jack_dag_node_t *node,
+			unsigned int cycle, int status)
+{
+	/* precondition: caller holds dag->lock */
+	unsigned int i;
+
+	if (status) {
+		/* don't start anything else this cycle */
+		dag->abort = 1;
+	}
+
+	if (status > 0) {
+		/* left to the engine thread, see jack_dag_process() */
+		dag->late++;
+	}
+
+	node->done = cycle;
+
+	for (i = 0; i < node->nsucc; ++i) {
+		jack_dag_node_t *next = &dag->nodes[node->succ[i]];
+		if (--next->pending[cycle & 1] == 0 &&
+		    (cycle != dag->cycle || next->blocked == 0)) {
+			jack_dag_ready_node (dag, next, cycle);
+		}
+	}
+
+	if (cycle != dag->cycle) {
+		/* a pipelined node caught up: it, and the nodes whose
+		   output it was still reading, may now run this cycle */
+		jack_dag_reset_client (node->client);
+		jack_dag_unblock_node (dag, node);
+		for (i = 0; i < node->npred; ++i) {
+			jack_dag_unblock_node (dag, &dag->nodes[node->pred[i]]);
+		}
+	} else if (!node->pipelined && --dag->critical == 0) {
+		pthread_cond_broadcast (&dag->ready);
+	}
+
+	if (--dag->remaining[cycle & 1] == 0) {
+		pthread_cond_broadcast (&dag->ready);
+	}
+}
+
+static int
+jack_dag_run_node (jack_engine_t *engine, jack_dag_node_t *node)
+{
+	jack_client_internal_t *client = node->client;
+
+	DEBUG ("DAG: running client %s", client->control->name);
+
+	if (jack_client_is_internal (client)) {
+		return jack_run_internal_client (engine, client,
+						 engine->dag->nframes);
+	}
+
+	return jack_run_external_subgraph (engine, client);
+}
+
+/* Give each worker a CPU of its own: from --rt-cpus, after the first
+ * one, which is left to the engine thread, or otherwise from the CPUs
+ * of the --numa node, or from the isolated CPUs, if there are any.
+ */
+static void
+jack_dag_place_worker (jack_engine_t *engine, jack_dag_t *dag)
+{
+	unsigned int n = __sync_fetch_and_add (&dag->started, 1);
+	const char *cpus;
+	char cpu[16];
+	int c;
+
+	if (rt_cpus && *rt_cpus) {
+		cpus = rt_cpus;
+		n++;
+	} else if (engine->numa_cpus[0]) {
+		cpus = engine->numa_cpus;
+	} else if ((cpus = jack_isolated_cpus ()) == NULL) {
+		return;
+	}
+
+	if ((c = jack_cpu_list_nth (cpus, n)) < 0) {
+		return;
+	}
+
+	snprintf (cpu, sizeof(cpu), "%d", c);
+
+	if (jack_thread_set_cpus (pthread_self (), cpu) == 0) {
+		VERBOSE (engine, "DAG worker thread on CPU %d", c);
+	}
+}
+
+static void *
+jack_dag_worker_thread (void *arg)
+{
+	jack_engine_t *engine = (jack_engine_t*)arg;
+	jack_dag_t *dag = engine->dag;
+	jack_dag_item_t item;
+	int status;
+
+	jack_dag_place_worker (engine, dag);
+
+	pthread_mutex_lock (&dag->lock);
+
+	while (!dag->stop) {
+
+		if (!jack_dag_pop (&dag->shared, &item)) {
+			pthread_cond_wait (&dag->work, &dag->lock);
+			continue;
+		}
+
+		pthread_mutex_unlock (&dag->lock);
+		JACK_WORKGROUP_UPDATE (engine->control);
+		status = jack_dag_run_node (engine, item.node);
+		pthread_mutex_lock (&dag->lock);
+
+		jack_dag_complete_node (dag, item.node, item.cycle, status);
+	}
+
+	pthread_mutex_unlock (&dag->lock);
+
+	return NULL;
+}
+
+/* Used if the graph could not be compiled: every external client
+ * still has a FIFO pair of its own, so just run them one after the
+ * other, in graph order.
+ */
+static int
+jack_dag_process_serial (jack_engine_t *engine, jack_nframes_t nframes)
+{
+	JSList *node;
+	int status;
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_dag_reset_client ((jack_client_internal_t*)node->data);
+	}
+
+	for (node = engine->clients; engine->process_errors == 0 && node;
+	     node = jack_slist_next (node)) {
+
+		jack_client_internal_t *client =
+			(jack_client_internal_t*)node->data;
+
+		if (!jack_dag_client_runnable (client)) {
+			continue;
+		}
+
+		if (jack_client_is_internal (client)) {
+			jack_run_internal_client (engine, client, nframes);
+			continue;
+		}
+
+		status = jack_run_external_subgraph (engine, client);
+		if (status > 0) {
+			jack_external_subgraph_late (engine);
+		}
+		if (status) {
+			break;
+		}
+		engine->timeout_count = 0;
+	}
+
+	return engine->process_errors > 0;
+}
+
+int
+jack_dag_process (jack_engine_t *engine, jack_nframes_t nframes)
+{
+	/* precondition: caller has graph_lock */
+	jack_dag_t *dag = engine->dag;
+	jack_dag_node_t *dnode;
+	jack_dag_item_t item;
+	unsigned int i, j, cycle, late;
+	int status, pipeline;
+
+	if (dag->nodes == NULL) {
+		return jack_dag_process_serial (engine, nframes);
+	}
+
+	/* pipelined nodes are finished by the workers */
+	pipeline = engine->freewheeling && dag->nthreads > 0;
+
+	pthread_mutex_lock (&dag->lock);
+
+	cycle = dag->cycle + 1;
+
+	/* the cycle before the last must be over, and unless this one
+	   may be pipelined, the last one too */
+	while (dag->remaining[cycle & 1] ||
+	       (!pipeline && dag->remaining[(cycle - 1) & 1])) {
+		pthread_cond_wait (&dag->ready, &dag->lock);
+	}
+
+	dag->cycle = cycle;
+	dag->nframes = nframes;
+	dag->abort = 0;
+	dag->remaining[cycle & 1] = dag->nnodes;
+	dag->critical = 0;
+
+	for (i = 0; i < dag->nnodes; ++i) {
+		dnode = &dag->nodes[i];
+		dnode->pending[cycle & 1] = dnode->refcount;
+		dnode->blocked = 0;
+		dnode->pipelined = pipeline &&
+				   dnode->client->control->pipelined &&
+				   !dnode->local;
+		if (!dnode->pipelined) {
+			dag->critical++;
+		}
+	}
+
+	/* a node still running the last cycle holds back its own next
+	   run and those of the nodes feeding it */
+
+	for (i = 0; i < dag->nnodes; ++i) {
+		dnode = &dag->nodes[i];
+		if (dnode->done == cycle - 1) {
+			jack_dag_reset_client (dnode->client);
+			continue;
+		}
+		dnode->blocked++;
+		for (j = 0; j < dnode->npred; ++j) {
+			dag->nodes[dnode->pred[j]].blocked++;
+		}
+	}
+
+	for (i = 0; i < dag->nnodes; ++i) {
+		dnode = &dag->nodes[i];
+		if (dnode->refcount == 0 && dnode->blocked == 0) {
+			jack_dag_ready_node (dag, dnode, cycle);
+		}
+	}
+
+	while (dag->critical ||
+	       (!pipeline && dag->remaining[cycle & 1])) {
+
+		if (!jack_dag_pop (&dag->local, &item) &&
+		    !jack_dag_pop (&dag->shared, &item)) {
+			pthread_cond_wait (&dag->ready, &dag->lock);
+			continue;
+		}
+
+		pthread_mutex_unlock (&dag->lock);
+		status = jack_dag_run_node (engine, item.node);
+		pthread_mutex_lock (&dag->lock);
+
+		jack_dag_complete_node (dag, item.node, item.cycle, status);
+	}
+
+	/* pipelined nodes may still time out, after this; they are
+	   counted with the next cycle */
+	late = dag->late;
+	dag->late = 0;
+
+	pthread_mutex_unlock (&dag->lock);
+
+	/* the workers leave the engine's counters to this thread */
+	if (late) {
+		jack_external_subgraph_late (engine);
+	} else {
+		engine->timeout_count = 0;
+	}
+
+	return engine->process_errors > 0;
+}
+
+/* Wait for any pipelined nodes still running to finish. Called with
+   the graph write lock held, before the graph or the clients in it
+   change. */
+
+void
+jack_dag_quiesce (jack_engine_t *engine)
+{
+	jack_dag_t *dag = engine->dag;
+
+	if (dag == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock (&dag->lock);
+	while (dag->remaining[0] || dag->remaining[1]) {
+		pthread_cond_wait (&dag->ready, &dag->lock);
+	}
+	pthread_mutex_unlock (&dag->lock);
+}
+
+static int
+jack_dag_node_index (jack_dag_t *dag, jack_client_internal_t *client)
+{
+	unsigned int i;
+
+	for (i = 0; i < dag->nnodes; ++i) {
+		if (dag->nodes[i].client == client) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void
+jack_dag_free_graph (jack_dag_t *dag)
+{
+	free (dag->nodes);
+	free (dag->edges);
+	free (dag->preds);
+	free (dag->shared.slot);
+	free (dag->local.slot);
+	dag->nodes = NULL;
+	dag->edges = NULL;
+	dag->preds = NULL;
+	dag->shared.slot = NULL;
+	dag->local.slot = NULL;
+	dag->nnodes = 0;
+}
+
+int
+jack_dag_compile (jack_engine_t *engine)
+{
+	/* precondition: caller holds the graph write lock, and has
+	   just sorted and rechained the graph */
+	jack_dag_t *dag = engine->dag;
+	JSList *node, *fnode;
+	unsigned int n, nedges, e, i, p;
+
+	jack_dag_quiesce (engine);
+	jack_dag_free_graph (dag);
+
+	for (n = 0, nedges = 0, node = engine->clients; node;
+	     node = jack_slist_next (node)) {
+		jack_client_internal_t *client =
+			(jack_client_internal_t*)node->data;
+		if (client->control->active) {
+			n++;
+			nedges += jack_slist_length (client->sortfeeds);
+		}
+	}
+
+	if (n == 0) {
+		return 0;
+	}
+
+	dag->nodes = (jack_dag_node_t*)calloc (n, sizeof(jack_dag_node_t));
+	dag->edges = (unsigned int*)malloc ((nedges + 1) * sizeof(unsigned int));
+	dag->preds = (unsigned int*)malloc ((nedges + 1) * sizeof(unsigned int));
+	dag->shared.slot = (jack_dag_item_t*)malloc (2 * n * sizeof(jack_dag_item_t));
+	dag->local.slot = (jack_dag_item_t*)malloc (2 * n * sizeof(jack_dag_item_t));
+	dag->shared.size = dag->local.size = 2 * n;
+	dag->shared.head = dag->shared.tail = 0;
+	dag->local.head = dag->local.tail = 0;
+
+	if (!dag->nodes || !dag->edges || !dag->preds ||
+	    !dag->shared.slot || !dag->local.slot) {
+		jack_error ("cannot allocate DAG for %u clients, running "
+			    "the graph serially", n);
+		jack_dag_free_graph (dag);
+		return -1;
+	}
+
+	/* nodes are kept in graph order, so that ties between ready
+	   nodes are broken the same way as in serial mode */
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client =
+			(jack_client_internal_t*)node->data;
+		if (client->control->active) {
+			jack_dag_node_t *dnode = &dag->nodes[dag->nnodes++];
+			dnode->client = client;
+			dnode->local = (client->control->type == ClientDriver);
+		}
+	}
+
+	/* sortfeeds has feedback connections reversed, so it is
+	   acyclic and can be used directly as the dependency
+	   relation. */
+
+	for (i = 0, e = 0; i < dag->nnodes; ++i) {
+
+		jack_dag_node_t *dnode = &dag->nodes[i];
+
+		dnode->succ = &dag->edges[e];
+
+		for (fnode = dnode->client->sortfeeds; fnode;
+		     fnode = jack_slist_next (fnode)) {
+
+			int j = jack_dag_node_index (
+				dag, (jack_client_internal_t*)fnode->data);
+			unsigned int k;
+
+			if (j < 0 || j == i) {
+				continue;
+			}
+
+			for (k = 0; k < dnode->nsucc; ++k) {
+				if (dnode->succ[k] == j) {
+					break;
+				}
+			}
+
+			if (k == dnode->nsucc) {
+				dnode->succ[dnode->nsucc++] = j;
+				dag->nodes[j].refcount++;
+				e++;
+			}
+		}
+	}
+
+	/* and the same edges the other way round, for releasing the
+	   nodes that feed a pipelined node when it catches up */
+
+	for (i = 0, e = 0; i < dag->nnodes; ++i) {
+		unsigned int k;
+
+		dag->nodes[i].pred = &dag->preds[e];
+		dag->nodes[i].done = dag->cycle;
+		for (p = 0; p < dag->nnodes; ++p) {
+			for (k = 0; k < dag->nodes[p].nsucc; ++k) {
+				if (dag->nodes[p].succ[k] == i) {
+					dag->nodes[i].pred[dag->nodes[i].npred++] = p;
+					e++;
+				}
+			}
+		}
+	}
+
+	VERBOSE (engine, "DAG: %u nodes, %u edges", dag->nnodes, e);
+
+	return 0;
+}
+
+int
+jack_dag_init (jack_engine_t *engine, unsigned int nthreads)
+{
+	jack_dag_t *dag;
+	unsigned int i;
+
+#ifdef JACK_USE_MACH_THREADS
+	jack_error ("parallel graph execution is not supported with "
+		    "Mach threads, running the graph serially");
+	return -1;
+#endif
+
+	if ((dag = (jack_dag_t*)calloc (1, sizeof(jack_dag_t))) == NULL) {
+		return -1;
+	}
+
+	if ((dag->threads = (pthread_t*)calloc (nthreads, sizeof(pthread_t)))
+	    == NULL) {
+		free (dag);
+		return -1;
+	}
+
+	pthread_mutex_init (&dag->lock, NULL);
+	pthread_cond_init (&dag->work, NULL);
+	pthread_cond_init (&dag->ready, NULL);
+
+	engine->dag = dag;
+
+	/* the workers stand in for the engine thread, so they run
+	   at its priority */
+
+	for (i = 0; i < nthreads; ++i) {
+		if (jack_client_create_thread (NULL, &dag->threads[i],
+					       engine->rtpriority,
+					       engine->control->real_time,
+					       jack_dag_worker_thread,
+					       engine)) {
+			jack_error ("cannot create DAG worker thread %u", i);
+			break;
+		}
+	}
+
+	dag->nthreads = i;
+
+	VERBOSE (engine, "DAG: parallel graph execution with %u "
+		 "worker threads", dag->nthreads);
+
+	return 0;
+}
+
+void
+jack_dag_cleanup (jack_engine_t *engine)
+{
+	jack_dag_t *dag = engine->dag;
+	unsigned int i;
+
+	if (dag == NULL) {
+		return;
+	}
+
+	VERBOSE (engine, "stopping DAG worker threads");
+
+	pthread_mutex_lock (&dag->lock);
+	dag->stop = 1;
+	pthread_cond_broadcast (&dag->work);
+	pthread_mutex_unlock (&dag->lock);
+
+	for (i = 0; i < dag->nthreads; ++i) {
+		pthread_join (dag->threads[i], NULL);
+	}
+
+	jack_dag_free_graph (dag);
+	pthread_cond_destroy (&dag->ready);
+	pthread_cond_destroy (&dag->work);
+	pthread_mutex_destroy (&dag->lock);
+	free (dag->threads);
+	free (dag);
+
+	engine->dag = NULL;
+}
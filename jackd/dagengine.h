@@ -0,0 +1,23 @@
+/*
+ *  Parallel (DAG) process graph execution for the JACK engine.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+int     jack_dag_init(jack_engine_t *engine, unsigned int nthreads);
+void    jack_dag_cleanup(jack_engine_t *engine);
+int     jack_dag_compile(jack_engine_t *engine);
+int     jack_dag_process(jack_engine_t *engine, jack_nframes_t nframes);
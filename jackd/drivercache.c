@@ -0,0 +1,420 @@
+/*
+ *  Cache of driver descriptors.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/*
+ * Asking a driver for its parameters means dlopen()ing it, and that
+ * drags in ALSA, FFADO or whatever else it links against, for every
+ * driver in the directory.  The descriptors hardly ever change, so
+ * they are kept in a file, each under the path, mtime and size of its
+ * .so.  A driver is only loaded here when one of those has changed;
+ * otherwise not before the engine starts it.
+ *
+ * The file is $JACK_DRIVER_CACHE, or jack/drivers in $XDG_CACHE_HOME
+ * or ~/.cache; JACK_DRIVER_CACHE=none turns the cache off.  Drivers
+ * with parameter constraints are not cached, since those may list
+ * devices found at load time.  A file that does not look right is
+ * ignored, and replaced on the next write.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "internal.h"
+#include "driver_interface.h"
+#include "drivercache.h"
+
+#define JACK_DRIVER_CACHE_MAGIC 0x4a444331      /* "JDC1" */
+#define JACK_DRIVER_CACHE_MAX_ENTRIES 256
+#define JACK_DRIVER_CACHE_MAX_PARAMS 256
+
+/* The file is a header, then a record for each driver, each followed
+ * by its nparams parameter descriptors.  The sizes in the header tie
+ * it to the layout of the descriptors. */
+typedef struct {
+	uint32_t magic;
+	uint32_t desc_size;
+	uint32_t param_size;
+	uint32_t count;
+} jack_driver_cache_header_t;
+
+typedef struct {
+	int64_t mtime;
+	int64_t size;
+	jack_driver_desc_t desc;        /* desc.file is the key */
+} jack_driver_cache_record_t;
+
+typedef struct {
+	int64_t mtime;
+	int64_t size;
+	jack_driver_desc_t *desc;
+} jack_driver_cache_entry_t;
+
+struct _jack_driver_cache {
+	char *path;
+	jack_driver_cache_entry_t *entries;
+	uint32_t count;
+	int dirty;
+};
+
+static char *
+jack_driver_cache_path (void)
+{
+	const char *env = getenv ("JACK_DRIVER_CACHE");
+	const char *base;
+	char *path;
+
+	if (env) {
+		if (*env == '\0' || strcmp (env, "none") == 0) {
+			return NULL;
+		}
+		return strdup (env);
+	}
+
+	if ((base = getenv ("XDG_CACHE_HOME")) != NULL && *base) {
+		path = malloc (strlen (base) + sizeof("/jack/drivers"));
+		if (path) {
+			sprintf (path, "%s/jack/drivers", base);
+		}
+	} else if ((base = getenv ("HOME")) != NULL && *base) {
+		path = malloc (strlen (base) + sizeof("/.cache/jack/drivers"));
+		if (path) {
+			sprintf (path, "%s/.cache/jack/drivers", base);
+		}
+	} else {
+		path = NULL;
+	}
+
+	return path;
+}
+
+static jack_driver_desc_t *
+jack_driver_desc_copy (const jack_driver_desc_t *desc)
+{
+	jack_driver_desc_t *copy;
+
+	if ((copy = malloc (sizeof(jack_driver_desc_t))) == NULL) {
+		return NULL;
+	}
+	memcpy (copy, desc, sizeof(jack_driver_desc_t));
+
+	copy->params = calloc (desc->nparams ? desc->nparams : 1,
+			       sizeof(jack_driver_param_desc_t));
+	if (copy->params == NULL) {
+		free (copy);
+		return NULL;
+	}
+	memcpy (copy->params, desc->params,
+		desc->nparams * sizeof(jack_driver_param_desc_t));
+
+	return copy;
+}
+
+static void
+jack_driver_desc_free (jack_driver_desc_t *desc)
+{
+	if (desc) {
+		free (desc->params);
+		free (desc);
+	}
+}
+
+static void
+jack_driver_cache_read (jack_driver_cache_t *cache)
+{
+	jack_driver_cache_header_t header;
+	jack_driver_cache_record_t record;
+	jack_driver_desc_t *desc;
+	FILE *file;
+	uint32_t i, j;
+
+	if ((file = fopen (cache->path, "r")) == NULL) {
+		return;
+	}
+
+	if (fread (&header, sizeof(header), 1, file) != 1
+	    || header.magic != JACK_DRIVER_CACHE_MAGIC
+	    || header.desc_size != sizeof(jack_driver_desc_t)
+	    || header.param_size != sizeof(jack_driver_param_desc_t)
+	    || header.count > JACK_DRIVER_CACHE_MAX_ENTRIES) {
+		goto out;
+	}
+
+	cache->entries = calloc (header.count ? header.count : 1,
+				 sizeof(jack_driver_cache_entry_t));
+	if (cache->entries == NULL) {
+		goto out;
+	}
+
+	for (i = 0; i < header.count; i++) {
+		if (fread (&record, sizeof(record), 1, file) != 1
+		    || record.desc.nparams > JACK_DRIVER_CACHE_MAX_PARAMS) {
+			break;
+		}
+		record.desc.file[sizeof(record.desc.file) - 1] = '\0';
+		record.desc.name[sizeof(record.desc.name) - 1] = '\0';
+
+		if ((desc = malloc (sizeof(jack_driver_desc_t))) == NULL) {
+			break;
+		}
+		*desc = record.desc;
+		desc->params = calloc (desc->nparams ? desc->nparams : 1,
+				       sizeof(jack_driver_param_desc_t));
+		if (desc->params == NULL
+		    || fread (desc->params, sizeof(jack_driver_param_desc_t),
+			      desc->nparams, file) != desc->nparams) {
+			jack_driver_desc_free (desc);
+			break;
+		}
+		for (j = 0; j < desc->nparams; j++)
+			desc->params[j].constraint = NULL;
+
+		cache->entries[i].mtime = record.mtime;
+		cache->entries[i].size = record.size;
+		cache->entries[i].desc = desc;
+		cache->count++;
+	}
+
+	if (i < header.count) {
+		/* truncated or garbled, start over */
+		cache->dirty = 1;
+	}
+
+out:
+	fclose (file);
+}
+
+/* create the directories leading to path */
+static void
+jack_driver_cache_mkdirs (const char *path)
+{
+	char *dir = strdup (path);
+	char *slash;
+
+	if (dir == NULL) {
+		return;
+	}
+
+	for (slash = strchr (dir + 1, '/'); slash; slash = strchr (slash + 1, '/')) {
+		*slash = '\0';
+		if (mkdir (dir, 0700) < 0 && errno != EEXIST) {
+			break;
+		}
+		*slash = '/';
+	}
+
+	free (dir);
+}
+
+static void
+jack_driver_cache_write (jack_driver_cache_t *cache)
+{
+	jack_driver_cache_header_t header;
+	jack_driver_cache_record_t record;
+	char *tmp;
+	FILE *file;
+	uint32_t i;
+	int fd, ok = 1;
+
+	jack_driver_cache_mkdirs (cache->path);
+
+	if ((tmp = malloc (strlen (cache->path) + sizeof(".XXXXXX"))) == NULL) {
+		return;
+	}
+	sprintf (tmp, "%s.XXXXXX", cache->path);
+
+	/* write it aside and rename it into place, so that nobody
+	 * reads half a cache */
+	if ((fd = mkstemp (tmp)) < 0) {
+		free (tmp);
+		return;
+	}
+	if ((file = fdopen (fd, "w")) == NULL) {
+		close (fd);
+		unlink (tmp);
+		free (tmp);
+		return;
+	}
+
+	header.magic = JACK_DRIVER_CACHE_MAGIC;
+	header.desc_size = sizeof(jack_driver_desc_t);
+	header.param_size = sizeof(jack_driver_param_desc_t);
+	header.count = cache->count;
+	ok = fwrite (&header, sizeof(header), 1, file) == 1;
+
+	for (i = 0; ok && i < cache->count; i++) {
+		jack_driver_desc_t *desc = cache->entries[i].desc;
+
+		memset (&record, 0, sizeof(record));
+		record.mtime = cache->entries[i].mtime;
+		record.size = cache->entries[i].size;
+		record.desc = *desc;
+		record.desc.params = NULL;
+
+		ok = fwrite (&record, sizeof(record), 1, file) == 1
+		     && fwrite (desc->params, sizeof(jack_driver_param_desc_t),
+				desc->nparams, file) == desc->nparams;
+	}
+
+	if (fclose (file) != 0) {
+		ok = 0;
+	}
+
+	if (!ok || rename (tmp, cache->path) < 0) {
+		unlink (tmp);
+	}
+	free (tmp);
+}
+
+jack_driver_cache_t *
+jack_driver_cache_open (void)
+{
+	jack_driver_cache_t *cache;
+
+	if ((cache = calloc (1, sizeof(jack_driver_cache_t))) == NULL) {
+		return NULL;
+	}
+
+	if ((cache->path = jack_driver_cache_path ()) == NULL) {
+		free (cache);
+		return NULL;
+	}
+
+	jack_driver_cache_read (cache);
+
+	return cache;
+}
+
+void
+jack_driver_cache_close (jack_driver_cache_t *cache)
+{
+	struct stat st;
+	uint32_t i, n;
+
+	if (cache == NULL) {
+		return;
+	}
+
+	/* forget drivers that are gone */
+	for (i = 0, n = 0; i < cache->count; i++) {
+		if (stat (cache->entries[i].desc->file, &st) < 0) {
+			jack_driver_desc_free (cache->entries[i].desc);
+			cache->dirty = 1;
+		} else {
+			cache->entries[n++] = cache->entries[i];
+		}
+	}
+	cache->count = n;
+
+	if (cache->dirty) {
+		jack_driver_cache_write (cache);
+	}
+
+	for (i = 0; i < cache->count; i++)
+		jack_driver_desc_free (cache->entries[i].desc);
+	free (cache->entries);
+	free (cache->path);
+	free (cache);
+}
+
+/* a copy of the cached descriptor of the driver in filename, or NULL
+ * if it has to be loaded */
+jack_driver_desc_t *
+jack_driver_cache_get (jack_driver_cache_t *cache, const char *filename)
+{
+	struct stat st;
+	uint32_t i;
+
+	if (cache == NULL || stat (filename, &st) < 0) {
+		return NULL;
+	}
+
+	for (i = 0; i < cache->count; i++) {
+		jack_driver_cache_entry_t *entry = &cache->entries[i];
+
+		if (strcmp (entry->desc->file, filename) != 0) {
+			continue;
+		}
+		if (entry->mtime == (int64_t)st.st_mtime
+		    && entry->size == (int64_t)st.st_size) {
+			return jack_driver_desc_copy (entry->desc);
+		}
+		break;
+	}
+
+	return NULL;
+}
+
+void
+jack_driver_cache_put (jack_driver_cache_t *cache, const char *filename,
+		       const jack_driver_desc_t *desc)
+{
+	jack_driver_cache_entry_t *entry = NULL;
+	jack_driver_desc_t *copy;
+	struct stat st;
+	uint32_t i;
+
+	if (cache == NULL || stat (filename, &st) < 0) {
+		return;
+	}
+
+	for (i = 0; i < desc->nparams; i++) {
+		if (desc->params[i].constraint) {
+			return;
+		}
+	}
+
+	if ((copy = jack_driver_desc_copy (desc)) == NULL) {
+		return;
+	}
+	snprintf (copy->file, sizeof(copy->file), "%s", filename);
+
+	for (i = 0; i < cache->count; i++) {
+		if (strcmp (cache->entries[i].desc->file, filename) == 0) {
+			entry = &cache->entries[i];
+			jack_driver_desc_free (entry->desc);
+			break;
+		}
+	}
+
+	if (entry == NULL) {
+		jack_driver_cache_entry_t *entries;
+
+		if (cache->count >= JACK_DRIVER_CACHE_MAX_ENTRIES
+		    || (entries = realloc (cache->entries,
+					   (cache->count + 1) * sizeof(jack_driver_cache_entry_t))) == NULL) {
+			jack_driver_desc_free (copy);
+			return;
+		}
+		cache->entries = entries;
+		entry = &cache->entries[cache->count++];
+	}
+
+	entry->mtime = st.st_mtime;
+	entry->size = st.st_size;
+	entry->desc = copy;
+	cache->dirty = 1;
+}
@@ -0,0 +1,30 @@
+/*
+ *  Cache of driver descriptors, so listing the drivers does not mean
+ *  loading all of them.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+typedef struct _jack_driver_cache jack_driver_cache_t;
+
+jack_driver_cache_t *jack_driver_cache_open(void);
+void    jack_driver_cache_close(jack_driver_cache_t *cache);
+
+jack_driver_desc_t *jack_driver_cache_get(jack_driver_cache_t *cache,
+					  const char *filename);
+void    jack_driver_cache_put(jack_driver_cache_t *cache,
+			      const char *filename,
+			      const jack_driver_desc_t *desc);
@@ -19,6 +19,9 @@
 
  */
 
+/* for ppoll() */
+#define _GNU_SOURCE
+
 #include <config.h>
 
 #include <math.h>
@@ -48,6 +51,10 @@
 #include "messagebuffer.h"
 #include "driver.h"
 #include "shm.h"
+#include "unlock.h"
+#include "pool.h"
+#include "propertystore.h"
+#include "probes.h"
 
 #include <sysdeps/poll.h>
 #include <sysdeps/ipc.h>
@@ -56,6 +63,19 @@
 #include <sys/mman.h>
 #endif /* USE_MLOCK */
 
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE1)
+#include <sys/epoll.h>
+#define JACK_USE_EPOLL 1
+#endif
+
+#ifdef HAVE_LINUX_MEMPOLICY_H
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#if defined(SYS_mbind) && defined(SYS_move_pages)
+#define JACK_USE_NUMA 1
+#endif
+#endif
+
 #ifdef USE_CAPABILITIES
 /* capgetp and capsetp are linux only extensions, not posix */
 #undef _POSIX_SOURCE
@@ -64,6 +84,11 @@
 
 #include "clientengine.h"
 #include "transengine.h"
+#include "dagengine.h"
+#include "metrics.h"
+#include "xrundump.h"
+#include "capture.h"
+#include "clockdomain.h"
 
 #include "libjack/local.h"
 
@@ -74,6 +99,7 @@ typedef struct {
 	signed int dir; /* -1 = feedback, 0 = self, 1 = forward */
 	jack_client_internal_t *srcclient;
 	jack_client_internal_t *dstclient;
+	float gain;     /* see jack_set_connection_gain() */
 } jack_connection_internal_t;
 
 typedef struct _jack_driver_info {
@@ -84,8 +110,32 @@ typedef struct _jack_driver_info {
 } jack_driver_info_t;
 
 jack_timer_type_t clock_source = JACK_TIMER_SYSTEM_CLOCK;
+unsigned int dag_threads = 0;
+jack_wakeup_method_t wakeup_method = JACK_WAKEUP_FIFO;
+unsigned int cycle_trace_records = 0;
+unsigned int port_meter_msecs = 0;
+unsigned int async_history = 0;
+const char *metrics_address = NULL;
+const char *xrun_dump_dir = NULL;
+const char *record_path = NULL;
+const char *buffer_governor = NULL;
+const char *rt_cpus = NULL;
+const char *server_cpus = NULL;
+const char *client_cpus = NULL;
+const char *numa_policy = NULL;
+int use_deadline = 0;
+int use_perf_counters = 0;
+int idle_cycles = 0;
+float dll_bandwidth = JACK_DLL_DEFAULT_BANDWIDTH;
+int group_port_buffers = 0;
+jack_nframes_t max_buffer_size = 0;
+unsigned int late_mute_percent = 0;
+unsigned int admission_percent = 0;
+int skip_dead_clients = 0;
+void (*standby_start)(jack_engine_t *engine) = NULL;
 
 static int      jack_port_assign_buffer(jack_engine_t *,
+					jack_client_internal_t *,
 					jack_port_internal_t *);
 static jack_port_internal_t *jack_get_port_by_name(jack_engine_t *,
 						   const char *name);
@@ -97,6 +147,10 @@ static int  jack_port_do_connect(jack_engine_t *engine,
 static int  jack_port_do_disconnect(jack_engine_t *engine,
 				    const char *source_port,
 				    const char *destination_port);
+static int  jack_port_do_set_gain(jack_engine_t *engine,
+				  const char *source_port,
+				  const char *destination_port,
+				  float gain);
 static int  jack_port_do_disconnect_all(jack_engine_t *engine,
 					jack_port_id_t);
 static int  jack_port_do_unregister(jack_engine_t *engine, jack_request_t *);
@@ -125,24 +179,79 @@ static int   jack_run_one_cycle(jack_engine_t *engine, jack_nframes_t nframes,
 				float delayed_usecs);
 static void jack_engine_delay(jack_engine_t *engine,
 			      float delayed_usecs);
+static void jack_engine_xrun(jack_engine_t *engine,
+			     float delayed_usecs, jack_xrun_cause_t cause);
 static void jack_engine_driver_exit(jack_engine_t* engine);
+static int  jack_backup_cycle(jack_engine_t *engine, jack_nframes_t nframes);
+static int  jack_backup_driver_exit(jack_engine_t *engine);
+static int  jack_domain_cycle(jack_engine_t *engine, jack_nframes_t nframes,
+			      int *ret);
+static int  jack_domain_driver_exit(jack_engine_t *engine);
+static void jack_driver_retire_failed(jack_engine_t *engine);
 static int  jack_start_freewheeling(jack_engine_t* engine, jack_uuid_t);
-static int jack_client_feeds_transitive(jack_client_internal_t *source,
+static int jack_client_feeds_transitive(jack_engine_t *engine,
+					jack_client_internal_t *source,
 					jack_client_internal_t *dest);
-static int jack_client_sort(jack_client_internal_t *a,
-			    jack_client_internal_t *b);
+static void jack_reach_add_edge(jack_engine_t *engine,
+				jack_client_internal_t *source,
+				jack_client_internal_t *dest);
+static void jack_reach_rebuild(jack_engine_t *engine);
+static void jack_mark_live_clients(jack_engine_t *engine);
+static void jack_sort_clients(jack_engine_t *engine);
 static void jack_check_acyclic(jack_engine_t* engine);
 static void jack_compute_all_port_total_latencies(jack_engine_t *engine);
 static void jack_compute_port_total_latency(jack_engine_t *engine, jack_port_shared_t*);
+static int jack_check_client(jack_engine_t* engine,
+			     jack_client_internal_t *client);
 static int jack_check_client_status(jack_engine_t* engine);
+static void jack_supervisor_poke(jack_engine_t* engine);
 static int jack_do_session_notify(jack_engine_t *engine, jack_request_t *req, int reply_fd );
 static void jack_port_rename_notify(jack_engine_t *engine, const char* old_name, const char* new_name);
+static void jack_port_hash_insert(jack_engine_t *engine, jack_port_id_t id);
+static void jack_port_hash_remove(jack_engine_t *engine, jack_port_id_t id);
+static void jack_port_columns_set(jack_engine_t *engine, jack_port_id_t id);
+static void jack_port_connection_map_set(jack_engine_t *engine, jack_port_id_t a, jack_port_id_t b, int connected);
 static void jack_do_get_client_by_uuid(jack_engine_t *engine, jack_request_t *req);
+static int  jack_request_is_query(RequestType type);
+static void jack_do_query_request(jack_engine_t *engine, jack_request_t *req, int *reply_fd);
+static int  write_reply(int reply_fd, jack_request_t *req);
+static int  jack_query_pool_init(jack_engine_t *engine, unsigned int nthreads);
+static void jack_query_pool_cleanup(jack_engine_t *engine);
+static int  jack_query_pool_queue(jack_engine_t *engine, jack_client_internal_t *client, jack_request_t *req);
+static int  jack_shm_requests_init(jack_engine_t *engine);
+static void jack_shm_requests_cleanup(jack_engine_t *engine);
+static void jack_graph_snapshot_publish(jack_engine_t *engine);
+static jack_graph_snapshot_t *jack_graph_snapshot_acquire(jack_engine_t *engine);
+static void jack_graph_snapshot_release(jack_engine_t *engine);
+static void jack_cycle_unlock_graph(jack_engine_t *engine, jack_graph_snapshot_t *snapshot);
+static void jack_engine_set_idle(jack_engine_t *engine, int idle);
 static void jack_do_get_uuid_by_client_name(jack_engine_t *engine, jack_request_t *req);
 static void jack_do_reserve_name(jack_engine_t *engine, jack_request_t *req);
 static void jack_do_session_reply(jack_engine_t *engine, jack_request_t *req );
+static void *jack_supervisor_thread(void *arg);
+static int  jack_buffer_governor_init(jack_engine_t *engine, const char *spec);
+static void jack_check_session_deadlines(jack_engine_t *engine);
 static void jack_compute_new_latency(jack_engine_t *engine);
+static void jack_latency_mark_dirty(jack_engine_t *engine,
+				    jack_client_internal_t *client);
+static int  jack_graph_batch(jack_engine_t *engine, jack_uuid_t client_id,
+			     int begin);
+static void jack_sort_graph_or_defer(jack_engine_t *engine);
 static int jack_do_has_session_cb(jack_engine_t *engine, jack_request_t *req);
+static void jack_port_do_connect_batch(jack_engine_t *engine, jack_request_t *req);
+static int jack_port_connect_internal(jack_engine_t *engine,
+				      jack_port_internal_t *srcport,
+				      jack_port_internal_t *dstport);
+static void jack_port_do_batch(jack_engine_t *engine, jack_request_t *req, int internal);
+static void jack_port_unregister_locked(jack_engine_t *engine, jack_client_internal_t *client, jack_port_id_t port_id);
+static void jack_event_batch_begin(jack_engine_t *engine);
+static void jack_event_batch_end(jack_engine_t *engine);
+static char jack_wait_event_reply(jack_engine_t *engine, jack_client_internal_t *client,
+				  const jack_event_t *event);
+static void jack_do_set_property(jack_engine_t *engine, jack_request_t *req);
+static void jack_do_remove_property(jack_engine_t *engine, jack_request_t *req);
+static void jack_do_remove_all_properties(jack_engine_t *engine, jack_request_t *req);
+static void jack_do_property_batch(jack_engine_t *engine, jack_request_t *req);
 
 static inline int
 jack_rolling_interval (jack_time_t period_usecs)
@@ -260,6 +369,72 @@ make_socket_subdirectories (const char *server_name)
 	return 0;
 }
 
+/* Whether a service manager started us with our listening sockets
+ * already bound (systemd's LISTEN_FDS protocol).  The answer is
+ * kept, since make_sockets() clears the environment once it has
+ * taken the sockets.
+ */
+int
+jack_socket_activated (void)
+{
+	static int activated = -1;
+	const char *pid, *nfds;
+
+	if (activated < 0) {
+		pid = getenv ("LISTEN_PID");
+		nfds = getenv ("LISTEN_FDS");
+		activated = pid && nfds && atoi (pid) == getpid ()
+			    && atoi (nfds) > 0;
+	}
+	return activated;
+}
+
+/* Take the server and ACK sockets from those passed in by the
+ * service manager, which start at descriptor 3, by the paths they
+ * are bound to.
+ */
+static int
+inherit_sockets (const char *server_name, int fd[2])
+{
+	struct sockaddr_un addr;
+	socklen_t addrlen;
+	char server_dir[PATH_MAX + 1] = "";
+	char path[2][PATH_MAX + 16];
+	int i, sock, nfds;
+
+	nfds = atoi (getenv ("LISTEN_FDS"));
+	unsetenv ("LISTEN_PID");
+	unsetenv ("LISTEN_FDS");
+	unsetenv ("LISTEN_FDNAMES");
+
+	jack_server_dir (server_name, server_dir);
+	snprintf (path[0], sizeof(path[0]), "%s/jack_0", server_dir);
+	snprintf (path[1], sizeof(path[1]), "%s/jack_ack_0", server_dir);
+	fd[0] = fd[1] = -1;
+
+	for (sock = 3; sock < 3 + nfds; sock++) {
+		addrlen = sizeof(addr);
+		if (getsockname (sock, (struct sockaddr*)&addr, &addrlen) < 0
+		    || addr.sun_family != AF_UNIX) {
+			continue;
+		}
+		for (i = 0; i < 2; i++) {
+			if (fd[i] < 0 && strcmp (addr.sun_path, path[i]) == 0) {
+				fd[i] = sock;
+				fcntl (sock, F_SETFD, FD_CLOEXEC);
+			}
+		}
+	}
+
+	if (fd[0] < 0 || fd[1] < 0) {
+		jack_error ("socket activation: expected sockets %s and %s",
+			    path[0], path[1]);
+		return -1;
+	}
+
+	return 0;
+}
+
 static int
 make_sockets (const char *server_name, int fd[2])
 {
@@ -267,6 +442,10 @@ make_sockets (const char *server_name, int fd[2])
 	int i;
 	char server_dir[PATH_MAX + 1] = "";
 
+	if (jack_socket_activated ()) {
+		return inherit_sockets (server_name, fd);
+	}
+
 	if (make_socket_subdirectories (server_name) < 0) {
 		return -1;
 	}
@@ -352,10 +531,60 @@ make_sockets (const char *server_name, int fd[2])
 	return 0;
 }
 
+/* The distance between port buffers of `one_buffer' bytes. */
+
+static inline jack_shmsize_t
+jack_port_buffer_stride (jack_shmsize_t one_buffer)
+{
+	return (one_buffer + JACK_PORT_BUFFER_ALIGN - 1)
+	       & ~(jack_shmsize_t)(JACK_PORT_BUFFER_ALIGN - 1);
+}
+
+/* Buffer free map helpers; the caller holds the buffer list lock. */
+
+#define JACK_FREE_MAP_WORDS(n) (((n) + 63) / 64)
+
+static inline void
+jack_port_buffer_set_free (jack_port_buffer_list_t *pti, uint32_t n)
+{
+	pti->free_map[n >> 6] |= (uint64_t)1 << (n & 63);
+}
+
+/* Take the first free buffer at or after `hint', wrapping around to
+   the start of the segment. Returns -1 if there is none. */
+
+static int
+jack_port_buffer_take (jack_port_buffer_list_t *pti, uint32_t hint)
+{
+	uint32_t words = JACK_FREE_MAP_WORDS (pti->nbuffers);
+	uint32_t w, n, i;
+	uint64_t bits;
+
+	if (hint >= pti->nbuffers) {
+		hint = 0;
+	}
+
+	w = hint >> 6;
+	bits = pti->free_map[w] & (~(uint64_t)0 << (hint & 63));
+
+	for (i = 0; i <= words; ++i) {
+		if (bits) {
+			n = (w << 6) + __builtin_ctzll (bits);
+			pti->free_map[w] &= ~((uint64_t)1 << (n & 63));
+			return n;
+		}
+		w = (w + 1) % words;
+		bits = pti->free_map[w];
+	}
+
+	return -1;
+}
+
 void
 jack_engine_place_port_buffers (jack_engine_t* engine,
 				jack_port_type_id_t ptid,
 				jack_shmsize_t one_buffer,
+				jack_shmsize_t stride,
 				jack_shmsize_t size,
 				unsigned long nports,
 				jack_nframes_t nframes)
@@ -365,6 +594,11 @@ jack_engine_place_port_buffers (jack_engine_t* engine,
 	jack_port_buffer_list_t* pti = &engine->port_buffers[ptid];
 	jack_port_functions_t *pfuncs = jack_get_port_functions (ptid);
 
+	if (pfuncs == NULL) {
+		/* a type registered at run time */
+		pfuncs = &jack_builtin_NULL_functions;
+	}
+
 	pthread_mutex_lock (&pti->lock);
 	offset = 0;
 
@@ -373,27 +607,37 @@ jack_engine_place_port_buffers (jack_engine_t* engine,
 		/* Buffer info array already allocated for this port
 		 * type.  This must be a resize operation, so
 		 * recompute the buffer offsets, but leave the free
-		 * list alone.
+		 * map alone.
 		 */
-		int i;
+		uint32_t i, high = engine->control->port_high;
+		uint32_t *flags = jack_port_flags_column (engine->control);
+		jack_port_type_id_t *types = jack_port_type_column (engine->control);
 
 		bi = pti->info;
 		while (offset < size) {
 			bi->offset = offset;
-			offset += one_buffer;
+			offset += stride;
 			++bi;
 		}
 
 		/* update any existing output port offsets */
-		for (i = 0; i < engine->port_max; i++) {
+		for (i = jack_port_next_in_use (engine->control, 0, high); i < high;
+		     i = jack_port_next_in_use (engine->control, i + 1, high)) {
 			jack_port_shared_t *port = &engine->control->ports[i];
-			if (port->in_use &&
-			    (port->flags & JackPortIsOutput) &&
-			    port->ptype_id == ptid) {
+			if ((flags[i] & JackPortIsOutput) && types[i] == ptid) {
 				bi = engine->internal_ports[i].buffer_info;
 				if (bi) {
 					port->offset = bi->offset;
 				}
+				bi = engine->internal_ports[i].delayed_info;
+				if (bi) {
+					port->delayed_offset = bi->offset;
+				}
+			} else if (types[i] == ptid) {
+				bi = engine->internal_ports[i].sum_info;
+				if (bi) {
+					port->sum_offset = bi->offset;
+				}
 			}
 		}
 
@@ -401,17 +645,19 @@ jack_engine_place_port_buffers (jack_engine_t* engine,
 		jack_port_type_info_t* port_type = &engine->control->port_types[ptid];
 
 		/* Allocate an array of buffer info structures for all
-		 * the buffers in the segment.  Chain them to the free
-		 * list in memory address order, offset zero must come
-		 * first.
+		 * the buffers in the segment, in memory address order,
+		 * and mark them all free.
 		 */
 		bi = pti->info = (jack_port_buffer_info_t*)
 				 malloc (nports * sizeof(jack_port_buffer_info_t));
+		pti->free_map = (uint64_t*)
+				calloc (JACK_FREE_MAP_WORDS (nports), sizeof(uint64_t));
+		pti->nbuffers = nports;
 
 		while (offset < size) {
 			bi->offset = offset;
-			pti->freelist = jack_slist_append (pti->freelist, bi);
-			offset += one_buffer;
+			jack_port_buffer_set_free (pti, bi - pti->info);
+			offset += stride;
 			++bi;
 		}
 
@@ -419,9 +665,7 @@ jack_engine_place_port_buffers (jack_engine_t* engine,
 		 * for an empy buffer area.
 		 * NOTE: audio buffer is zeroed in its buffer_init function.
 		 */
-		bi = (jack_port_buffer_info_t*)pti->freelist->data;
-		pti->freelist = jack_slist_remove_link (pti->freelist,
-							pti->freelist);
+		bi = &pti->info[jack_port_buffer_take (pti, 0)];
 		port_type->zero_buffer_offset = bi->offset;
 		if (ptid == JACK_AUDIO_PORT_TYPE) {
 			engine->silent_buffer = bi;
@@ -441,6 +685,228 @@ jack_engine_place_port_buffers (jack_engine_t* engine,
 	pthread_mutex_unlock (&pti->lock);
 }
 
+/* NUMA placement, with --numa. Bound to a node, the port segments get
+ * their pages from it, and the driver thread, the DAG workers and the
+ * process threads of clients run on its CPUs unless --rt-cpus or
+ * --client-cpus say otherwise. Interleaved, the pages are spread over
+ * all nodes instead, for graphs whose clients are all over the machine.
+ */
+
+#ifdef JACK_USE_NUMA
+
+#define JACK_NUMA_MAX_NODES (sizeof(unsigned long) * 8)
+
+/* the online nodes, as a mask */
+static unsigned long
+jack_numa_online_nodes (void)
+{
+	FILE *f;
+	char buf[128];
+	char *p, *end;
+	long first, last;
+	unsigned long mask = 0;
+
+	if ((f = fopen ("/sys/devices/system/node/online", "r")) == NULL) {
+		return 0;
+	}
+
+	if (fgets (buf, sizeof(buf), f) == NULL) {
+		buf[0] = '\0';
+	}
+
+	fclose (f);
+
+	for (p = buf; *p && *p != '\n'; ) {
+		first = strtol (p, &end, 10);
+		if (end == p) {
+			break;
+		}
+		last = first;
+		p = end;
+		if (*p == '-') {
+			last = strtol (p + 1, &end, 10);
+			p = end;
+		}
+		for (; first <= last && first < (long)JACK_NUMA_MAX_NODES; first++)
+			mask |= 1UL << first;
+		if (*p == ',') {
+			p++;
+		}
+	}
+
+	return mask;
+}
+
+static void
+jack_engine_numa_init (jack_engine_t *engine)
+{
+	char path[PATH_MAX];
+	char *end;
+	long node;
+	FILE *f;
+
+	engine->numa_node = JACK_NUMA_NONE;
+	engine->numa_cpus[0] = '\0';
+
+	if (numa_policy == NULL || *numa_policy == '\0') {
+		return;
+	}
+
+	if (strcmp (numa_policy, "interleave") == 0) {
+		engine->numa_node = JACK_NUMA_INTERLEAVE;
+		jack_info ("port segments are interleaved over NUMA nodes");
+		return;
+	}
+
+	node = strtol (numa_policy, &end, 10);
+	if (end == numa_policy || *end || node < 0
+	    || node >= (long)JACK_NUMA_MAX_NODES
+	    || !(jack_numa_online_nodes () & (1UL << node))) {
+		jack_error ("no NUMA node \"%s\", port segments are not placed",
+			    numa_policy);
+		return;
+	}
+
+	engine->numa_node = node;
+
+	snprintf (path, sizeof(path),
+		  "/sys/devices/system/node/node%ld/cpulist", node);
+	if ((f = fopen (path, "r")) != NULL) {
+		if (fgets (engine->numa_cpus, sizeof(engine->numa_cpus), f) == NULL) {
+			engine->numa_cpus[0] = '\0';
+		}
+		fclose (f);
+		engine->numa_cpus[strcspn (engine->numa_cpus, "\n")] = '\0';
+	}
+
+	jack_info ("port segments are placed on NUMA node %ld (CPUs %s)",
+		   node, engine->numa_cpus);
+}
+
+static void
+jack_engine_numa_place (jack_engine_t *engine, void *addr, size_t size)
+{
+	unsigned long nodes;
+	int mode;
+
+	if (engine->numa_node == JACK_NUMA_INTERLEAVE) {
+		mode = MPOL_INTERLEAVE;
+		nodes = jack_numa_online_nodes ();
+	} else if (engine->numa_node >= 0) {
+		mode = MPOL_PREFERRED;
+		nodes = 1UL << engine->numa_node;
+	} else {
+		return;
+	}
+
+	/* pages that are already there move to match */
+	if (syscall (SYS_mbind, addr, size, mode, &nodes,
+		     JACK_NUMA_MAX_NODES + 1, MPOL_MF_MOVE) != 0) {
+		jack_error ("cannot set the NUMA policy of a port segment (%s)",
+			    strerror (errno));
+	}
+}
+
+/* Where the pages of a port segment actually are: a hit is a page on
+ * the node the segment is bound to, a miss one anywhere else. When
+ * interleaving, count the pages on each node.
+ */
+static void
+jack_engine_numa_report (jack_engine_t *engine, jack_port_type_id_t ptid,
+			 void *addr, size_t size)
+{
+	long page = sysconf (_SC_PAGESIZE);
+	unsigned long npages = (size + page - 1) / page;
+	unsigned long per_node[JACK_NUMA_MAX_NODES];
+	unsigned long hits = 0, misses = 0, absent = 0;
+	char spread[256];
+	size_t len = 0;
+	void **pages;
+	int *status;
+	unsigned long i;
+
+	if (engine->numa_node == JACK_NUMA_NONE || npages == 0) {
+		return;
+	}
+
+	pages = (void**)malloc (npages * sizeof(void*));
+	status = (int*)malloc (npages * sizeof(int));
+	if (pages == NULL || status == NULL) {
+		goto out;
+	}
+
+	for (i = 0; i < npages; i++)
+		pages[i] = (char*)addr + i * page;
+
+	if (syscall (SYS_move_pages, 0, npages, pages, NULL, status, 0) != 0) {
+		jack_error ("cannot find the NUMA nodes of a port segment (%s)",
+			    strerror (errno));
+		goto out;
+	}
+
+	memset (per_node, 0, sizeof(per_node));
+
+	for (i = 0; i < npages; i++) {
+		if (status[i] < 0 || status[i] >= (int)JACK_NUMA_MAX_NODES) {
+			absent++;
+		} else if (status[i] == engine->numa_node) {
+			hits++;
+		} else {
+			misses++;
+		}
+		if (status[i] >= 0 && status[i] < (int)JACK_NUMA_MAX_NODES) {
+			per_node[status[i]]++;
+		}
+	}
+
+	if (engine->numa_node >= 0) {
+		jack_info ("port segment for type %d: %lu pages, %lu on NUMA "
+			   "node %d (hits), %lu elsewhere (misses), %lu not "
+			   "present", ptid, npages, hits, engine->numa_node,
+			   misses, absent);
+	} else {
+		spread[0] = '\0';
+		for (i = 0; i < JACK_NUMA_MAX_NODES && len < sizeof(spread); i++) {
+			if (per_node[i]) {
+				len += snprintf (spread + len, sizeof(spread) - len,
+						 " %lu:%lu", i, per_node[i]);
+			}
+		}
+		jack_info ("port segment for type %d: %lu pages, per NUMA "
+			   "node%s, %lu not present", ptid, npages, spread,
+			   absent);
+	}
+
+out:
+	free (pages);
+	free (status);
+}
+
+#else /* !JACK_USE_NUMA */
+
+static void
+jack_engine_numa_init (jack_engine_t *engine)
+{
+	engine->numa_node = JACK_NUMA_NONE;
+	engine->numa_cpus[0] = '\0';
+
+	if (numa_policy && *numa_policy) {
+		jack_error ("NUMA placement is not supported on this platform");
+	}
+}
+
+static void
+jack_engine_numa_place (jack_engine_t *engine, void *addr, size_t size)
+{
+}
+
+static void
+jack_engine_numa_report (jack_engine_t *engine, jack_port_type_id_t ptid,
+			 void *addr, size_t size)
+{
+}
+
+#endif /* JACK_USE_NUMA */
 
 static int
 jack_resize_port_segment (jack_engine_t *engine,
@@ -449,14 +915,37 @@ jack_resize_port_segment (jack_engine_t *engine,
 {
 	jack_event_t event;
 	jack_shmsize_t one_buffer;      /* size of one buffer */
+	jack_shmsize_t stride;          /* distance between buffers */
 	jack_shmsize_t size;            /* segment size */
 	jack_port_type_info_t* port_type = &engine->control->port_types[ptid];
 	jack_shm_info_t* shm_info = &engine->port_segment[ptid];
 
+	if (port_type->nbuffers) {
+		nports = port_type->nbuffers;
+	}
+
 	one_buffer = jack_port_type_buffer_size (port_type, engine->control->buffer_size);
-	VERBOSE (engine, "resizing port buffer segment for type %d, one buffer = %u bytes", ptid, one_buffer);
 
-	size = nports * one_buffer;
+	/* With --max-buffer-size the segment is laid out for the largest
+	 * period from the start. Smaller periods then use the front of
+	 * each slot, and changing between them leaves every offset, and
+	 * every client's mapping, as it was.
+	 */
+	if (max_buffer_size > engine->control->buffer_size) {
+		stride = jack_port_buffer_stride (
+			jack_port_type_buffer_size (port_type, max_buffer_size));
+	} else {
+		stride = jack_port_buffer_stride (one_buffer);
+	}
+	size = nports * stride;
+
+	if (shm_info->attached_at && size == engine->port_segment_size[ptid]) {
+		VERBOSE (engine, "reusing port buffer segment for type %d, one buffer = %u bytes", ptid, one_buffer);
+		jack_engine_place_port_buffers (engine, ptid, one_buffer, stride, size, nports, engine->control->buffer_size);
+		return 0;
+	}
+
+	VERBOSE (engine, "resizing port buffer segment for type %d, one buffer = %u bytes", ptid, one_buffer);
 
 	if (shm_info->attached_at == 0) {
 
@@ -488,7 +977,9 @@ jack_resize_port_segment (jack_engine_t *engine,
 		}
 	}
 
-	jack_engine_place_port_buffers (engine, ptid, one_buffer, size, nports, engine->control->buffer_size);
+	engine->port_segment_size[ptid] = size;
+	jack_engine_numa_place (engine, jack_shm_addr (shm_info), size);
+	jack_engine_place_port_buffers (engine, ptid, one_buffer, stride, size, nports, engine->control->buffer_size);
 
 #ifdef USE_MLOCK
 	if (engine->control->real_time) {
@@ -499,7 +990,8 @@ jack_resize_port_segment (jack_engine_t *engine,
 		 * that any new pages are present before restarting
 		 * the process cycle.  Since memory locks do not
 		 * stack, they can still be unlocked with a single
-		 * munlockall().
+		 * munlockall().  With selective locking this is the
+		 * only lock the port buffers get.
 		 */
 
 		int rc = mlock (jack_shm_addr (shm_info), size);
@@ -507,9 +999,16 @@ jack_resize_port_segment (jack_engine_t *engine,
 			jack_error ("JACK: unable to mlock() port buffers: "
 				    "%s", strerror (errno));
 		}
+
+		if (jack_mlock_mode == JACK_MLOCK_SELECTIVE) {
+			VERBOSE (engine, "%lu kB of jackd locked in memory",
+				 (unsigned long)(jack_mlock_footprint () / 1024));
+		}
 	}
 #endif  /* USE_MLOCK */
 
+	jack_engine_numa_report (engine, ptid, jack_shm_addr (shm_info), size);
+
 	/* Tell everybody about this segment. */
 	event.type = AttachPortSegment;
 	event.y.ptid = ptid;
@@ -520,6 +1019,118 @@ jack_resize_port_segment (jack_engine_t *engine,
 	return 0;
 }
 
+/* Set up the engine's side of port type ptid, whose info is in place
+ * in engine->control. Its segment is allocated by
+ * jack_resize_port_segment().
+ */
+static void
+jack_port_type_init (jack_engine_t *engine, jack_port_type_id_t ptid)
+{
+	/* the port type id is index into port_types array */
+	engine->control->port_types[ptid].ptype_id = ptid;
+
+	/* be sure to initialize mutex correctly */
+	pthread_mutex_init (&engine->port_buffers[ptid].lock, NULL);
+
+	/* set buffer list info correctly */
+	engine->port_buffers[ptid].free_map = NULL;
+	engine->port_buffers[ptid].nbuffers = 0;
+	engine->port_buffers[ptid].info = NULL;
+
+	/* mark each port segment as not allocated */
+	engine->port_segment[ptid].index = -1;
+	engine->port_segment[ptid].attached_at = 0;
+	engine->port_segment_size[ptid] = 0;
+}
+
+/* Handle a PortTypeRegister request, see jack_port_type_register().
+ * A type that is already there is found again if it was registered
+ * the same way. Returns the type's id, or -1.
+ */
+static int
+jack_port_type_register_request (jack_engine_t *engine, jack_request_t *req)
+{
+	/* precondition: caller holds the request_lock */
+	jack_port_type_info_t *port_type;
+	jack_port_type_id_t ptid;
+	const char *name = req->x.port_type.type;
+	jack_shmsize_t buffer_size = req->x.port_type.buffer_size;
+	uint32_t nbuffers = req->x.port_type.nbuffers;
+	uint32_t flags = JACK_PORT_TYPE_RUNTIME
+			 | (req->x.port_type.flags & JACK_PORT_TYPE_NO_MIXDOWN);
+
+	req->x.port_type.type[sizeof(req->x.port_type.type) - 1] = '\0';
+
+	if (name[0] == '\0' || buffer_size <= 0) {
+		jack_error ("cannot register port type \"%s\" with buffers of"
+			    " %d bytes", name, buffer_size);
+		return -1;
+	}
+
+	/* the output ports, and the empty buffer for inputs that are
+	   not connected */
+	if (nbuffers == 0) {
+		nbuffers = engine->control->port_max;
+	} else {
+		nbuffers++;
+	}
+
+	for (ptid = 0; ptid < engine->control->n_port_types; ++ptid) {
+		port_type = &engine->control->port_types[ptid];
+		if (strcmp (name, port_type->type_name)) {
+			continue;
+		}
+		if (port_type->flags == flags
+		    && port_type->buffer_size == buffer_size
+		    && port_type->nbuffers == nbuffers) {
+			return ptid;
+		}
+		jack_error ("port type \"%s\" is registered differently"
+			    " already", name);
+		return -1;
+	}
+
+	if (ptid == JACK_MAX_PORT_TYPES) {
+		jack_error ("cannot register port type \"%s\", there are"
+			    " %d already", name, JACK_MAX_PORT_TYPES);
+		return -1;
+	}
+
+	/* segments are limited to MAX_INT32, see JACK_SHM_MAX */
+	if ((uint64_t)nbuffers * (buffer_size + JACK_PORT_BUFFER_ALIGN)
+	    > INT32_MAX) {
+		jack_error ("cannot register port type \"%s\", %" PRIu32
+			    " buffers of %d bytes do not fit in one segment",
+			    name, nbuffers, buffer_size);
+		return -1;
+	}
+
+	port_type = &engine->control->port_types[ptid];
+	memset (port_type, 0, sizeof(*port_type));
+	snprintf ((char*)port_type->type_name, sizeof(port_type->type_name),
+		  "%s", name);
+	port_type->buffer_scale_factor = -1;
+	port_type->buffer_size = buffer_size;
+	port_type->nbuffers = nbuffers;
+	port_type->flags = flags;
+	jack_port_type_init (engine, ptid);
+
+	/* announced to the clients from here, before they can see it
+	   in n_port_types */
+	if (jack_resize_port_segment (engine, ptid, nbuffers)) {
+		return -1;
+	}
+
+	__atomic_store_n (&engine->control->n_port_types, ptid + 1,
+			  __ATOMIC_RELEASE);
+
+	VERBOSE (engine, "registered port type %s, %" PRIu32 " buffers of"
+		 " %d bytes%s", name, nbuffers, buffer_size,
+		 (flags & JACK_PORT_TYPE_NO_MIXDOWN) ? ", no mixdown" : "");
+
+	return ptid;
+}
+
 /* The driver invokes this callback both initially and whenever its
  * buffer size changes.
  */
@@ -529,6 +1140,19 @@ jack_driver_buffer_size (jack_engine_t *engine, jack_nframes_t nframes)
 	int i;
 	jack_event_t event;
 
+	if (engine->backup_attach) {
+		/* a backup driver must not resize anything */
+		if (nframes != engine->control->buffer_size) {
+			engine->backup_attach = -1;
+		}
+		return 0;
+	}
+	if (engine->domain_attach) {
+		/* a clock domain runs at a period of its own */
+		engine->domain_nframes = nframes;
+		return 0;
+	}
+
 	VERBOSE (engine, "new buffer size %" PRIu32, nframes);
 
 	engine->control->buffer_size = nframes;
@@ -562,6 +1186,11 @@ jack_set_buffer_size_request (jack_engine_t *engine, jack_nframes_t nframes)
 		return ENXIO;           /* no such device */
 
 	}
+	if (engine->backup_driver || engine->clock_domains) {
+		jack_error ("cannot change the buffer size while a backup"
+			    " driver or a clock domain is loaded");
+		return EBUSY;
+	}
 	if (!jack_power_of_two (nframes)) {
 		jack_error ("buffer size %" PRIu32 " not a power of 2",
 			    nframes);
@@ -577,43 +1206,153 @@ jack_set_buffer_size_request (jack_engine_t *engine, jack_nframes_t nframes)
 	return rc;
 }
 
-
-static JSList *
-jack_process_internal (jack_engine_t *engine, JSList *node,
-		       jack_nframes_t nframes)
+/* change the buffer size and recompute latencies; caller holds the
+   request_lock */
+static int
+jack_buffer_size_change (jack_engine_t *engine, jack_nframes_t nframes)
 {
-	jack_client_internal_t *client;
-	jack_client_control_t *ctl;
-
-	client = (jack_client_internal_t*)node->data;
-	ctl = client->control;
+	int rc;
 
-	/* internal client */
+	rc = jack_set_buffer_size_request (engine, nframes);
+	jack_lock_graph (engine);
+	jack_latency_mark_dirty (engine, NULL);
+	jack_compute_new_latency (engine);
+	jack_unlock_graph (engine);
 
-	DEBUG ("invoking an internal client's (%s) callbacks", ctl->name);
-	ctl->state = Running;
-	engine->current_client = client;
+	return rc;
+}
 
-	/* XXX how to time out an internal client? */
+/* handle client SetSampleRate request: the driver reconfigures its
+   device in place, between a stop and a start, so clients, ports and
+   connections all stay; caller holds the request_lock */
+static int
+jack_sample_rate_change (jack_engine_t *engine, jack_nframes_t rate)
+{
+	jack_driver_t* driver = engine->driver;
+	jack_event_t event;
+	int rc;
 
-	if (ctl->sync_cb_cbset) {
-		jack_call_sync_client (client->private_client);
+	if (driver == NULL) {
+		return ENXIO;           /* no such device */
 	}
-
-	if (ctl->process_cbset) {
-		if (client->private_client->process (nframes, client->private_client->process_arg)) {
-			jack_error ("internal client %s failed", ctl->name);
-			engine->process_errors++;
-		}
+	if (engine->backup_driver || engine->slave_drivers
+	    || engine->clock_domains) {
+		jack_error ("cannot change the sample rate while a backup"
+			    " or slave driver or a clock domain is loaded");
+		return EBUSY;
+	}
+	if (driver->samplerate == NULL) {
+		jack_error ("driver cannot change its sample rate");
+		return ENOSYS;
+	}
+	if (rate == 0) {
+		return EINVAL;
+	}
+	if (rate == engine->control->current_time.frame_rate) {
+		return 0;
 	}
 
-	if (ctl->timebase_cb_cbset) {
-		jack_call_timebase_master (client->private_client);
+	if ((rc = driver->samplerate (driver, rate)) != 0) {
+		jack_error ("driver does not support a sample rate of %"
+			    PRIu32, rate);
+		return rc;
 	}
 
-	ctl->state = Finished;
+	VERBOSE (engine, "new sample rate %" PRIu32, rate);
 
-	if (engine->process_errors) {
+	engine->set_sample_rate (engine, rate);
+
+	/* the period is now another length of time */
+	engine->rolling_interval = jack_rolling_interval (driver->period_usecs);
+	jack_engine_reset_rolling_usecs (engine);
+	engine->control->frame_timer.reset_pending = 1;
+
+	event.type = SampleRateChange;
+	event.x.n = rate;
+	jack_deliver_event_to_all (engine, &event);
+
+	jack_lock_graph (engine);
+	jack_latency_mark_dirty (engine, NULL);
+	jack_compute_new_latency (engine);
+	jack_unlock_graph (engine);
+
+	return 0;
+}
+
+
+/* hardware counters of the engine and graph worker threads, for the
+   internal clients they run, see jack_perf_counters_t */
+static __thread jack_perf_counters_t internal_perf = {
+	{ -1, -1, -1 }, { 0, 0, 0 }, 0, { 0, 0, 0 }
+};
+
+/* Also called from the DAG worker threads, for any internal client but
+   a driver. */
+int
+jack_run_internal_client (jack_engine_t *engine,
+			  jack_client_internal_t *client,
+			  jack_nframes_t nframes)
+{
+	jack_client_control_t *ctl = client->control;
+	int status = 0;
+
+	/* internal client */
+
+	DEBUG ("invoking an internal client's (%s) callbacks", ctl->name);
+	ctl->state = Running;
+	ctl->signalled_at = ctl->awake_at = jack_get_microseconds ();
+	if (engine->dag == NULL) {
+		/* the DAG runs several at once */
+		engine->current_client = client;
+	}
+	JACK_PROBE2 (client_signal, ctl->uuid, ctl->signalled_at);
+
+	if (engine->control->perf_counters) {
+		/* opened by the first internal client each thread runs */
+		if (internal_perf.fd[0] < 0) {
+			jack_perf_counters_open (&internal_perf);
+		}
+		jack_perf_counters_start (&internal_perf);
+	}
+
+	/* XXX how to time out an internal client? */
+
+	if (ctl->sync_cb_cbset) {
+		jack_call_sync_client (client->private_client);
+	}
+
+	if (ctl->process_cbset) {
+		if (client->private_client->process (nframes, client->private_client->process_arg)) {
+			jack_error ("internal client %s failed", ctl->name);
+			__sync_add_and_fetch (&engine->process_errors, 1);
+			status = -1;
+		}
+	}
+
+	if (ctl->timebase_cb_cbset) {
+		jack_call_timebase_master (client->private_client);
+	}
+
+	if (engine->control->perf_counters) {
+		jack_perf_counters_stop (&internal_perf, ctl);
+	}
+
+	ctl->finished_at = jack_get_microseconds ();
+	ctl->state = Finished;
+	JACK_PROBE3 (client_finish, ctl->uuid, 0, ctl->finished_at);
+
+	return status;
+}
+
+static JSList *
+jack_process_internal (jack_engine_t *engine, JSList *node,
+		       jack_nframes_t nframes)
+{
+	jack_run_internal_client (engine,
+				  (jack_client_internal_t*)node->data,
+				  nframes);
+
+	if (engine->process_errors) {
 		return NULL;            /* will stop the loop */
 	} else {
 		return jack_slist_next (node);
@@ -656,14 +1395,87 @@ linux_poll_bug_encountered (jack_engine_t* engine, jack_time_t then, jack_time_t
 }
 #endif
 
+/* A subgraph timed out.  Flag the clients that woke up but did not
+ * finish, and leave it to the supervisor thread to decide once they
+ * have had some more time; the engine thread can't wait for them.
+ * Returns the number of clients flagged.
+ */
+static int
+jack_flag_late_clients (jack_engine_t *engine)
+{
+	JSList *node;
+	int late = 0;
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client = (jack_client_internal_t*)node->data;
+
+		/* we can only consider the timeout a client error if
+		 * it actually woke up.  its possible that the kernel
+		 * scheduler screwed us up and never woke up the
+		 * client in time. sigh.
+		 */
+		if (client->control->awake_at > 0
+		    && client->control->finished_at == 0) {
+			if (__sync_bool_compare_and_swap (&client->late, 0, 1)) {
+				__sync_add_and_fetch (&engine->late_clients, 1);
+			}
+			late++;
+		}
+	}
+
+	engine->fifos_dirty = 1;
+
+	jack_supervisor_poke (engine);
+
+	return late;
+}
+
+/* Lift the muting of jack_mute_late_client() from the clients that
+ * are no longer late; they have caught up with the graph again.
+ */
+static void
+jack_unmute_clients (jack_engine_t *engine)
+{
+	JSList *node, *pnode;
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client = (jack_client_internal_t*)node->data;
+
+		if (!client->muted || client->late) {
+			continue;
+		}
+
+		for (pnode = client->ports; pnode; pnode = jack_slist_next (pnode)) {
+			((jack_port_internal_t*)pnode->data)->shared->muted = 0;
+		}
+		client->muted = 0;
+		engine->muted_clients--;
+	}
+}
+
+/* An external subgraph failed or timed out: count the xrun and flag
+ * the clients holding it up.  Engine thread only.
+ */
+void
+jack_external_subgraph_late (jack_engine_t *engine)
+{
+	engine->xruns[JACK_XRUN_CLIENT]++;
+	if (engine->xrun_dump) {
+		jack_xrun_dump_trigger (engine, JACK_XRUN_CLIENT, 0.0f);
+	}
+
+	if (jack_flag_late_clients (engine)) {
+		engine->process_errors++;
+	}
+}
+
 #ifdef JACK_USE_MACH_THREADS
-static JSList *
-jack_process_external (jack_engine_t *engine, JSList *node)
+int
+jack_run_external_subgraph (jack_engine_t *engine,
+			    jack_client_internal_t *client)
 {
-	jack_client_internal_t * client = (jack_client_internal_t*)node->data;
 	jack_client_control_t *ctl;
 
-	client = (jack_client_internal_t*)node->data;
 	ctl = client->control;
 
 	engine->current_client = client;
@@ -677,24 +1489,154 @@ jack_process_external (jack_engine_t *engine, JSList *node)
 		ctl->state = Finished;
 	}
 
-	return jack_slist_next (node);
+	return 0;
 }
-#else /* !JACK_USE_MACH_THREADS */
+
 static JSList *
 jack_process_external (jack_engine_t *engine, JSList *node)
+{
+	jack_run_external_subgraph (engine,
+				    (jack_client_internal_t*)node->data);
+
+	return jack_slist_next (node);
+}
+#else /* !JACK_USE_MACH_THREADS */
+
+/* covers the wakeups of a subgraph, which its p99 does not */
+#define JACK_SUBGRAPH_TIMEOUT_SLOP 200  /* usecs */
+
+/* How long to wait for the subgraph headed by `client', started at
+ * `then': until the end of the period, less what the clients after it
+ * usually take (p99), so that they and the driver still make it in
+ * this cycle, but at least twice what the subgraph itself usually
+ * takes.  Never more than a period, nor less without any history.
+ */
+static jack_time_t
+jack_subgraph_timeout (jack_engine_t *engine, jack_client_internal_t *client,
+		       jack_time_t then)
+{
+	jack_time_t period = engine->driver->period_usecs;
+	jack_time_t deadline = engine->control->current_time.usecs + period;
+	jack_time_t least, timeout;
+
+	if (client->subgraph_p99_usecs == 0) {
+		return period;
+	}
+
+	least = 2 * client->subgraph_p99_usecs + JACK_SUBGRAPH_TIMEOUT_SLOP;
+
+	if (deadline > then + client->after_p99_usecs + least) {
+		timeout = deadline - then - client->after_p99_usecs;
+	} else {
+		timeout = least;
+	}
+
+	return timeout < period ? timeout : period;
+}
+
+/* --late-mute: the subgraph headed by `head' has not finished at the
+ * mute point.  If the member holding it up has woken up, the readers
+ * of its output ports get silence for the rest of the cycle and the
+ * engine hands its turn on to the next member itself.  The client is
+ * flagged late, and stays muted until it no longer is.  Returns the
+ * client muted, or NULL.
+ */
+static jack_client_internal_t *
+jack_mute_late_client (jack_engine_t *engine, jack_client_internal_t *head)
+{
+	jack_client_internal_t *client;
+	unsigned int next;
+	JSList *node;
+	char c = 0;
+
+	for (client = head; client; client = client->next_client) {
+		if (client != head && jack_client_is_internal (client)) {
+			return NULL;
+		}
+		if (client->control->finished_at == 0 && !client->muted) {
+			break;
+		}
+	}
+
+	if (client == NULL || client->control->awake_at == 0) {
+		/* not woken up yet: the scheduler's fault, not the client's */
+		return NULL;
+	}
+
+	next = client->execution_order + 1;
+
+	if (engine->control->wakeup_method == JACK_WAKEUP_FUTEX
+	    ? client->wake_next < 0
+	    : (next >= engine->fifo_size || engine->fifo[next] < 0)) {
+		return NULL;
+	}
+
+	for (node = client->ports; node; node = jack_slist_next (node)) {
+		jack_port_shared_t *shared = ((jack_port_internal_t*)node->data)->shared;
+		if (shared->flags & JackPortIsOutput) {
+			shared->muted = 1;
+		}
+	}
+
+	client->muted = 1;
+	engine->muted_clients++;
+	engine->fifos_dirty = 1;
+	if (__sync_bool_compare_and_swap (&client->late, 0, 1)) {
+		__sync_add_and_fetch (&engine->late_clients, 1);
+	}
+
+	/* the ports must read as muted before the next client runs */
+	__sync_synchronize ();
+
+	if (engine->control->wakeup_method == JACK_WAKEUP_FUTEX) {
+		jack_wakeup_post (&engine->control->graph_wakeup[client->wake_next],
+				  JACK_WAKEUP_PROCESS);
+	} else if (write (engine->fifo[next], &c, sizeof(c)) != sizeof(c)) {
+		jack_error ("cannot pass on the turn of late client %s (%s)",
+			    client->control->name, strerror (errno));
+	}
+
+	jack_supervisor_poke (engine);
+
+	return client;
+}
+
+/* poll() for the subgraph until the mute point, which is usually well
+ * under a millisecond away */
+static int
+jack_subgraph_poll_until (struct pollfd *pfd, jack_time_t usecs)
+{
+#ifdef __linux
+	struct timespec ts;
+
+	ts.tv_sec = usecs / 1000000;
+	ts.tv_nsec = (usecs % 1000000) * 1000;
+	return ppoll (pfd, 1, &ts, NULL);
+#else
+	return poll (pfd, 1, (usecs + 999) / 1000);
+#endif
+}
+
+/* Start the external subgraph headed by `client' and wait for its
+ * last member to hand control back to the server. Returns non-zero
+ * if processing of the graph should stop for this cycle.  On a DAG
+ * worker it leaves the engine's counters alone, and returns 1 where
+ * the caller is to call jack_external_subgraph_late().
+ */
+int
+jack_run_external_subgraph (jack_engine_t *engine,
+			    jack_client_internal_t *client)
 {
 	int status = 0;
 	char c = 0;
 	struct pollfd pfd[1];
 	int poll_timeout;
 	jack_time_t poll_timeout_usecs;
-	jack_client_internal_t *client;
 	jack_client_control_t *ctl;
 	jack_time_t now, then;
+	jack_time_t mute_at = 0, wait_usecs;
 	int pollret;
 
-	client = (jack_client_internal_t*)node->data;
-
 	ctl = client->control;
 
 	/* external subgraph */
@@ -704,38 +1646,69 @@ jack_process_external (jack_engine_t *engine, JSList *node)
 
 	ctl->signalled_at = jack_get_microseconds ();
 
-	engine->current_client = client;
+	if (engine->dag == NULL) {
+		engine->current_client = client;
+	}
+
+	JACK_PROBE2 (client_signal, ctl->uuid, ctl->signalled_at);
 
 	DEBUG ("calling process() on an external subgraph, fd==%d",
 	       client->subgraph_start_fd);
 
-	if (write (client->subgraph_start_fd, &c, sizeof(c)) != sizeof(c)) {
+	if (engine->control->wakeup_method == JACK_WAKEUP_FUTEX) {
+		jack_wakeup_post (&engine->control->graph_wakeup[client->wake_word],
+				  JACK_WAKEUP_PROCESS);
+	} else if (write (client->subgraph_start_fd, &c, sizeof(c)) != sizeof(c)) {
 		jack_error ("cannot initiate graph processing (%s)",
 			    strerror (errno));
-		engine->process_errors++;
+		__sync_add_and_fetch (&engine->process_errors, 1);
 		jack_engine_signal_problems (engine);
-		return NULL; /* will stop the loop */
+		return -1; /* will stop the loop */
 	}
 
 	then = jack_get_microseconds ();
 
 	if (engine->freewheeling) {
 		poll_timeout_usecs = 250000; /* 0.25 seconds */
+	} else if (engine->client_timeout_msecs > 0) {
+		poll_timeout_usecs = engine->client_timeout_msecs * 1000;
 	} else {
-		poll_timeout_usecs = (engine->client_timeout_msecs > 0 ?
-				      engine->client_timeout_msecs * 1000 :
-				      engine->driver->period_usecs);
+		poll_timeout_usecs = jack_subgraph_timeout (engine, client, then);
+	}
+
+	if (late_mute_percent && !engine->freewheeling && !engine->dag) {
+		mute_at = engine->control->current_time.usecs +
+			  engine->driver->period_usecs * late_mute_percent / 100;
+		if (mute_at <= then || mute_at >= then + poll_timeout_usecs) {
+			mute_at = 0;
+		}
 	}
 
 again:
-	poll_timeout = 1 + poll_timeout_usecs / 1000;
+	wait_usecs = poll_timeout_usecs;
+	if (mute_at) {
+		now = jack_get_microseconds ();
+		wait_usecs = mute_at > now ? mute_at - now : 0;
+	}
+	poll_timeout = 1 + wait_usecs / 1000;
 	pfd[0].fd = client->subgraph_wait_fd;
 	pfd[0].events = POLLERR | POLLIN | POLLHUP | POLLNVAL;
 
 	DEBUG ("waiting on fd==%d for process() subgraph to finish (timeout = %d, period_usecs = %d)",
 	       client->subgraph_wait_fd, poll_timeout, engine->driver->period_usecs);
 
-	if ((pollret = poll (pfd, 1, poll_timeout)) < 0) {
+	if (engine->control->wakeup_method == JACK_WAKEUP_FUTEX) {
+		pfd[0].revents = 0;
+		if ((pollret = jack_wakeup_wait (&engine->control->graph_wakeup[client->subgraph_wait_slot],
+						 wait_usecs)) < 0) {
+			jack_error ("wait on subgraph processing failed (%s)",
+				    strerror (errno));
+			status = -1;
+		} else if (pollret & JACK_WAKEUP_PROCESS) {
+			pfd[0].revents = POLLIN;
+		}
+	} else if ((pollret = (mute_at ? jack_subgraph_poll_until (pfd, wait_usecs)
+			       : poll (pfd, 1, poll_timeout))) < 0) {
 		jack_error ("poll on subgraph processing failed (%s)",
 			    strerror (errno));
 		status = -1;
@@ -760,8 +1733,10 @@ again:
 		 */
 
 		if (engine->freewheeling) {
-			if (jack_check_client_status (engine)) {
-				return NULL;
+			/* a DAG worker may only look at its own client */
+			if (engine->dag ? jack_check_client (engine, client)
+			    : jack_check_client_status (engine)) {
+				return -1;
 			} else {
 				/* all clients are fine - we're just not done yet. since
 				   we're freewheeling, that is fine.
@@ -770,6 +1745,22 @@ again:
 			}
 		}
 
+		if (mute_at) {
+			now = jack_get_microseconds ();
+			if (now < mute_at) {
+				goto again;
+			}
+
+			/* mute point: silence the client holding things
+			   up, then wait out the rest of the timeout */
+			mute_at = 0;
+			jack_mute_late_client (engine, client);
+			poll_timeout_usecs = (then + poll_timeout_usecs > now ?
+					      then + poll_timeout_usecs - now : 0);
+			then = now;
+			goto again;
+		}
+
 #ifdef __linux
 		if (linux_poll_bug_encountered (engine, then, &poll_timeout_usecs)) {
 			goto again;
@@ -794,6 +1785,8 @@ again:
 
 	now = jack_get_microseconds ();
 
+	JACK_PROBE3 (client_finish, ctl->uuid, status, now);
+
 	if (status != 0) {
 		VERBOSE (engine, "at %" PRIu64
 			 " waiting on %d for %" PRIu64
@@ -810,16 +1803,23 @@ again:
 			 ctl->finished_at ? (ctl->finished_at -
 					     ctl->signalled_at) : 0);
 
-		if (jack_check_clients (engine, 1)) {
-
-			engine->process_errors++;
-			return NULL;            /* will stop the loop */
+		if (engine->dag) {
+			/* jack_dag_process() accounts for it once the
+			   workers are done */
+			return 1;
 		}
-	} else {
+		jack_external_subgraph_late (engine);
+		return -1;              /* will stop the loop */
+	} else if (engine->dag == NULL) {
 		engine->timeout_count = 0;
 	}
 
 
+	if (engine->control->wakeup_method == JACK_WAKEUP_FUTEX) {
+		/* the handoff was consumed by the wait itself */
+		return (pfd[0].revents & POLLIN) ? 0 : -1;
+	}
+
 	DEBUG ("reading byte from subgraph_wait_fd==%d",
 	       client->subgraph_wait_fd);
 
@@ -832,6 +1832,17 @@ again:
 				    strerror (errno));
 			client->error++;
 		}
+		return -1;      /* will stop the loop */
+	}
+
+	return 0;
+}
+
+static JSList *
+jack_process_external (jack_engine_t *engine, JSList *node)
+{
+	if (jack_run_external_subgraph (engine,
+					(jack_client_internal_t*)node->data)) {
 		return NULL;    /* will stop the loop */
 	}
 
@@ -849,2761 +1860,7022 @@ again:
 
 #endif /* JACK_USE_MACH_THREADS */
 
-static int
-jack_engine_process (jack_engine_t *engine, jack_nframes_t nframes)
+/* The async stage.
+ *
+ * Clients that called jack_set_process_async() are chained on their
+ * own, after the synchronous chain, and are marked delayed.  The engine
+ * starts that chain right after the synchronous one, and collects it
+ * just before the next cycle begins, so that it runs alongside the
+ * rest of the graph rather than on its critical path.  An output port
+ * read from across the stage gets a second, delayed buffer, refreshed
+ * between cycles by jack_async_copy(): its readers see what it held at
+ * the end of the last cycle while its owner writes the next one.
+ */
+
+static void
+jack_async_copy (jack_engine_t *engine, int delayed)
 {
-	/* precondition: caller has graph_lock */
-	jack_client_internal_t *client;
+	/* precondition: caller holds the graph lock */
+	uint32_t seq = engine->control->cycle_seq;
 	JSList *node;
 
-	engine->process_errors = 0;
+	for (node = engine->delayed_ports; node; node = jack_slist_next (node)) {
+		jack_port_shared_t *shared = ((jack_port_internal_t*)node->data)->shared;
+		jack_port_type_info_t *type = &engine->control->port_types[shared->ptype_id];
+		char *base;
 
-	for (node = engine->clients; node; node = jack_slist_next (node)) {
-		jack_client_control_t *ctl =
-			((jack_client_internal_t*)node->data)->control;
-		ctl->state = NotTriggered;
-		ctl->timed_out = 0;
-		ctl->awake_at = 0;
-		ctl->finished_at = 0;
+		if (shared->delayed != delayed) {
+			continue;
+		}
+
+		base = (char*)jack_shm_addr (&engine->port_segment[shared->ptype_id]);
+		memcpy (base + shared->delayed_offset,
+			base + ((shared->muted || shared->silent_cycle == seq) ?
+				type->zero_buffer_offset :
+				shared->forward_cycle == seq ?
+				shared->forward_offset : shared->offset),
+			jack_port_type_buffer_size (type, engine->control->buffer_size));
 	}
+}
 
-	for (node = engine->clients; engine->process_errors == 0 && node; ) {
+/* Decimated async stage.
+ *
+ * With --async-history, clients in the async stage can ask to run only
+ * once every few cycles (jack_set_process_decimation()).  The stage
+ * then starts once every `async_decimation' cycles, and must be done
+ * by the time it is started again.  Meanwhile, at the end of every
+ * cycle, the engine appends what each audio output read by the stage
+ * held to a per-port history in shared memory, so that the stage gets
+ * all of it at once, see jack_port_get_history().
+ *
+ * The history segment has JACK_HISTORY_SLOTS slots, one per such port.
+ * A slot holds two blocks of history_periods periods of up to
+ * history_frames frames each: the stage reads history_block while the
+ * engine fills the other, and they swap when the stage is collected.
+ */
 
-		client = (jack_client_internal_t*)node->data;
+#define JACK_HISTORY_SLOTS 64
+#define JACK_HISTORY_FRAMES 1024        /* without -b */
 
-		DEBUG ("considering client %s for processing",
-		       client->control->name);
+static void
+jack_async_history_init (jack_engine_t *engine)
+{
+	jack_control_t *control = engine->control;
+	size_t size;
+
+	engine->history = NULL;
+	engine->history_phase = 0;
+	engine->async_due = 0;
+	control->history_shm_index = -1;
+	control->history_periods = 0;
+	control->history_frames = 0;
+	control->async_decimation = 1;
+	control->history_block = 0;
+
+	if (async_history < 2) {
+		return;
+	}
 
-		if (!client->control->active ||
-		    (!client->control->process_cbset && !client->control->thread_cb_cbset) ||
-		    client->control->dead) {
-			node = jack_slist_next (node);
-		} else if (jack_client_is_internal (client)) {
-			node = jack_process_internal (engine, node, nframes);
-		} else {
-			node = jack_process_external (engine, node);
-		}
+	control->history_periods = async_history;
+	control->history_frames = max_buffer_size ? max_buffer_size
+				  : JACK_HISTORY_FRAMES;
+	size = (size_t)JACK_HISTORY_SLOTS * 2 * control->history_periods
+	       * control->history_frames * sizeof(float);
+
+	if (jack_shmalloc (size, &engine->history_shm)) {
+		jack_error ("cannot create port history shared memory "
+			    "segment (%s)", strerror (errno));
+		return;
 	}
 
-	return engine->process_errors > 0;
+	if (jack_attach_shm (&engine->history_shm)) {
+		jack_error ("cannot attach to port history shared memory "
+			    "(%s)", strerror (errno));
+		jack_destroy_shm (&engine->history_shm);
+		return;
+	}
+
+	engine->history = (float*)jack_shm_addr (&engine->history_shm);
+	jack_mlock_rt_shm (&engine->history_shm, "port history memory");
+
+	/* also faults in the pages, away from the RT thread */
+	memset (engine->history, 0, size);
+
+	control->history_shm_index = engine->history_shm.index;
+
+	VERBOSE (engine, "async history: up to %u periods of %" PRIu32
+		 " frames (%lu bytes)", control->history_periods,
+		 control->history_frames, (unsigned long)size);
 }
 
+/* Called from jack_mark_async_clients(): how often the stage runs, and
+ * which outputs it reads get a history slot.
+ */
 static void
-jack_calc_cpu_load (jack_engine_t *engine)
+jack_async_plan_history (jack_engine_t *engine)
 {
-	jack_time_t cycle_end = jack_get_microseconds ();
-
-	/* store the execution time for later averaging */
+	jack_control_t *control = engine->control;
+	JSList *node;
+	uint32_t decimation = 0;
+	uint32_t n, i, high;
+	int32_t slot = 0;
 
-	engine->rolling_client_usecs[engine->rolling_client_usecs_index++] =
-		cycle_end - engine->control->current_time.usecs;
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_control_t *ctl =
+			((jack_client_internal_t*)node->data)->control;
+		if (ctl->delayed) {
+			n = ctl->decimation ? ctl->decimation : 1;
+			if (decimation == 0 || n < decimation) {
+				decimation = n;
+			}
+		}
+	}
 
-	//jack_info ("cycle_end - engine->control->current_time.usecs %ld",
-	//	(long) (cycle_end - engine->control->current_time.usecs));
+	if (decimation == 0 || engine->history == NULL) {
+		decimation = 1;
+	} else if (decimation > control->history_periods) {
+		decimation = control->history_periods;
+	}
 
-	if (engine->rolling_client_usecs_index >= JACK_ENGINE_ROLLING_COUNT) {
-		engine->rolling_client_usecs_index = 0;
+	high = control->port_high;
+	for (i = jack_port_next_in_use (control, 0, high); i < high;
+	     i = jack_port_next_in_use (control, i + 1, high)) {
+		control->ports[i].history_slot = -1;
 	}
 
-	/* every so often, recompute the current maximum use over the
-	   last JACK_ENGINE_ROLLING_COUNT client iterations.
-	 */
-
-	if (++engine->rolling_client_usecs_cnt
-	    % engine->rolling_interval == 0) {
-		float max_usecs = 0.0f;
-		int i;
-
-		for (i = 0; i < JACK_ENGINE_ROLLING_COUNT; i++) {
-			if (engine->rolling_client_usecs[i] > max_usecs) {
-				max_usecs = engine->rolling_client_usecs[i];
+	if (decimation > 1) {
+		for (node = engine->delayed_ports; node; node = jack_slist_next (node)) {
+			jack_port_shared_t *shared =
+				((jack_port_internal_t*)node->data)->shared;
+			if (shared->delayed || shared->ptype_id != 0) {
+				continue;
+			}
+			if (slot == JACK_HISTORY_SLOTS) {
+				VERBOSE (engine, "no history slot left for %s",
+					 shared->name);
+				continue;
 			}
+			shared->history_slot = slot++;
 		}
+		VERBOSE (engine, "async stage runs every %u cycles, "
+			 "%d port(s) with history", decimation, slot);
+	}
 
-		if (max_usecs > engine->max_usecs) {
-			engine->max_usecs = max_usecs;
-		}
+	control->async_decimation = decimation;
+	engine->history_phase = 0;
+	engine->async_due = 0;
+}
 
-		if (max_usecs < engine->driver->period_usecs) {
-			engine->spare_usecs =
-				engine->driver->period_usecs - max_usecs;
-		} else {
-			engine->spare_usecs = 0;
+/* At the end of a cycle, append the history of the outputs read by
+ * the decimated async stage.
+ */
+static void
+jack_async_history_write (jack_engine_t *engine)
+{
+	jack_control_t *control = engine->control;
+	jack_nframes_t nframes = control->buffer_size;
+	uint32_t seq = control->cycle_seq;
+	uint32_t fill = control->history_block ^ 1;
+	JSList *node;
+
+	if (nframes > control->history_frames) {
+		return;
+	}
+
+	for (node = engine->delayed_ports; node; node = jack_slist_next (node)) {
+		jack_port_shared_t *shared = ((jack_port_internal_t*)node->data)->shared;
+		jack_port_type_info_t *type = &control->port_types[shared->ptype_id];
+		float *dst;
+		char *base;
+
+		if (shared->history_slot < 0) {
+			continue;
 		}
 
-		engine->control->cpu_load =
-			(1.0f - (engine->spare_usecs /
-				 engine->driver->period_usecs)) * 50.0f
-			+ (engine->control->cpu_load * 0.5f);
+		dst = engine->history
+		      + ((size_t)shared->history_slot * 2 + fill)
+		      * control->history_periods * control->history_frames
+		      + engine->history_phase * nframes;
+		base = (char*)jack_shm_addr (&engine->port_segment[shared->ptype_id]);
+		memcpy (dst,
+			base + ((shared->muted || shared->silent_cycle == seq) ?
+				type->zero_buffer_offset :
+				shared->forward_cycle == seq ?
+				shared->forward_offset : shared->offset),
+			nframes * sizeof(float));
+	}
+}
 
-		VERBOSE (engine, "load = %.4f max usecs: %.3f, "
-			 "spare = %.3f", engine->control->cpu_load,
-			 max_usecs, engine->spare_usecs);
+/* Collect the async stage started in the last cycle, waiting up to
+ * `usecs' for it, and publish its outputs. Returns zero if it may be
+ * started again.
+ */
+static int
+jack_async_collect (jack_engine_t *engine, jack_time_t usecs)
+{
+	jack_client_internal_t *head = engine->async_head;
+	struct pollfd pfd[1];
+	char c;
+	int done;
+
+	if (engine->async_running <= 0) {
+		return engine->async_running;
+	}
+
+	if (engine->control->wakeup_method == JACK_WAKEUP_FUTEX) {
+		done = jack_wakeup_wait (&engine->control->graph_wakeup[head->subgraph_wait_slot],
+					 usecs);
+		done = done > 0 && (done & JACK_WAKEUP_PROCESS);
+	} else {
+		pfd[0].fd = head->subgraph_wait_fd;
+		pfd[0].events = POLLIN;
+		done = poll (pfd, 1, (usecs + 999) / 1000) == 1
+		       && (pfd[0].revents & POLLIN)
+		       && read (head->subgraph_wait_fd, &c, sizeof(c)) == sizeof(c);
+	}
+
+	if (!done) {
+		VERBOSE (engine, "async stage starting at %s did not finish "
+			 "within a cycle", head->control->name);
+		jack_flag_late_clients (engine);
+		engine->async_running = -1;
+		return -1;
 	}
 
+	engine->async_running = 0;
+	jack_async_copy (engine, 1);
+	return 0;
 }
 
+/* Between cycles, before the drivers read: collect the async stage,
+ * and keep what the rest of the graph left for it.  A late stage may
+ * still be reading the delayed buffers, so they are left alone, and
+ * the stage sits out the next cycle.
+ */
 static void
-jack_engine_post_process (jack_engine_t *engine)
+jack_async_end_cycle (jack_engine_t *engine)
 {
-	/* precondition: caller holds the graph lock. */
+	uint32_t decimation = engine->control->async_decimation;
 
-	jack_transport_cycle_end (engine);
-	jack_calc_cpu_load (engine);
-	jack_check_clients (engine, 0);
-}
+	if (decimation > 1) {
+		jack_async_history_write (engine);
+		if (++engine->history_phase < decimation) {
+			return;
+		}
+		engine->history_phase = 0;
+	}
 
+	if (jack_async_collect (engine, 0) == 0) {
+		jack_async_copy (engine, 0);
+		if (decimation > 1) {
+			engine->control->history_block ^= 1;
+			engine->async_due = 1;
+		}
+	}
+}
 
-static jack_driver_info_t *
-jack_load_driver (jack_engine_t *engine, jack_driver_desc_t * driver_desc)
+static void
+jack_async_start (jack_engine_t *engine)
 {
-	const char *errstr;
-	jack_driver_info_t *info;
-
-	info = (jack_driver_info_t*)calloc (1, sizeof(*info));
+	jack_client_internal_t *head = engine->async_head;
+	jack_client_control_t *ctl = head->control;
+	char c = 0;
 
-	info->handle = dlopen (driver_desc->file, RTLD_NOW | RTLD_GLOBAL);
+	if (engine->async_running < 0) {
+		engine->async_running = 0;
+		return;
+	}
 
-	if (info->handle == NULL) {
-		if ((errstr = dlerror ()) != 0) {
-			jack_error ("can't load \"%s\": %s", driver_desc->file,
-				    errstr);
-		} else {
-			jack_error ("bizarre error loading driver shared "
-				    "object %s", driver_desc->file);
+	if (engine->control->async_decimation > 1) {
+		if (!engine->async_due) {
+			return;
 		}
-		goto fail;
+		engine->async_due = 0;
 	}
 
-	info->initialize = dlsym (info->handle, "driver_initialize");
+	ctl->state = Triggered;
+	ctl->signalled_at = jack_get_microseconds ();
 
-	if ((errstr = dlerror ()) != 0) {
-		jack_error ("no initialize function in shared object %s\n",
-			    driver_desc->file);
-		goto fail;
+	if (engine->control->wakeup_method == JACK_WAKEUP_FUTEX) {
+		jack_wakeup_post (&engine->control->graph_wakeup[head->wake_word],
+				  JACK_WAKEUP_PROCESS);
+	} else if (write (head->subgraph_start_fd, &c, sizeof(c)) != sizeof(c)) {
+		jack_error ("cannot start the async stage (%s)", strerror (errno));
+		return;
 	}
 
-	info->finish = dlsym (info->handle, "driver_finish");
+	engine->async_running = 1;
+}
 
-	if ((errstr = dlerror ()) != 0) {
-		jack_error ("no finish function in in shared driver object %s",
-			    driver_desc->file);
-		goto fail;
-	}
+/* Summing nodes.
+ *
+ * Input ports fed by the same JACK_SUM_MIN_FANIN or more outputs would
+ * each mix the same sum.  On every graph sort such ports are grouped
+ * into a summing node, which gets one buffer in the port segment, held
+ * by its first member, the leader.  The first member to be read in a
+ * cycle mixes into that buffer and stamps the leader's sum_ready; the
+ * others then get the buffer as they would a single connection's, see
+ * jack_port_get_buffer().  A member whose connections change before
+ * the next sort leaves its node and mixes for itself again.
+ *
+ * Ports in the async stage are read across the cycle boundary, so
+ * they are left out.
+ */
 
-	info->client_name = (char*)dlsym (info->handle, "driver_client_name");
+#define JACK_SUM_MIN_FANIN 4
 
-	if ((errstr = dlerror ()) != 0) {
-		jack_error ("no client name in in shared driver object %s",
-			    driver_desc->file);
-		goto fail;
-	}
+static int
+jack_sum_same_sources (jack_port_internal_t *a, jack_port_internal_t *b)
+{
+	JSList *an, *bn;
+	jack_port_internal_t *source;
 
-	return info;
+	if (jack_slist_length (a->connections) != jack_slist_length (b->connections)) {
+		return FALSE;
+	}
 
-fail:
-	if (info->handle) {
-		dlclose (info->handle);
+	for (an = a->connections; an; an = jack_slist_next (an)) {
+		source = ((jack_connection_internal_t*)an->data)->source;
+		for (bn = b->connections; bn; bn = jack_slist_next (bn)) {
+			if (((jack_connection_internal_t*)bn->data)->source == source) {
+				break;
+			}
+		}
+		if (bn == NULL) {
+			return FALSE;
+		}
 	}
-	free (info);
-	return NULL;
 
+	return TRUE;
 }
 
-void
-jack_driver_unload (jack_driver_t *driver)
+/* whether any connection into port is scaled, which its owner then
+   mixes for itself */
+static int
+jack_port_has_gain (jack_port_internal_t *port)
 {
-	void* handle = driver->handle;
+	JSList *node;
 
-	driver->finish (driver);
-	dlclose (handle);
+	for (node = port->connections; node; node = jack_slist_next (node)) {
+		if (((jack_connection_internal_t*)node->data)->gain != 1.0f) {
+			return TRUE;
+		}
+	}
+
+	return FALSE;
 }
 
-int
-jack_engine_load_driver (jack_engine_t *engine,
-			 jack_driver_desc_t * driver_desc,
-			 JSList * driver_params)
+static void
+jack_plan_sums (jack_engine_t *engine)
 {
-	jack_client_internal_t *client;
-	jack_driver_t *driver;
-	jack_driver_info_t *info;
+	/* caller must hold client_lock and the graph write lock */
+	JSList *candidates = NULL;
+	JSList *node, *mnode;
+	jack_port_internal_t *lead, *port;
+	jack_port_buffer_list_t *blist;
+	uint32_t i, high;
+	uint32_t stale = engine->control->cycle_seq + 0x80000000;
+	int members, n;
+
+	high = engine->control->port_high;
+
+	/* start over: give back every node's buffer */
+	for (i = jack_port_next_in_use (engine->control, 0, high); i < high;
+	     i = jack_port_next_in_use (engine->control, i + 1, high)) {
+		port = &engine->internal_ports[i];
+
+		if (!(jack_port_flags_column (engine->control)[i] & JackPortIsInput)) {
+			continue;
+		}
 
-	if ((info = jack_load_driver (engine, driver_desc)) == NULL) {
-		return -1;
+		port->shared->sum_port = JACK_NO_SUM;
+
+		if (port->sum_info) {
+			blist = jack_port_buffer_list (engine, port);
+			port->shared->sum_offset = 0;
+			pthread_mutex_lock (&blist->lock);
+			jack_port_buffer_set_free (blist, port->sum_info - blist->info);
+			pthread_mutex_unlock (&blist->lock);
+			port->sum_info = NULL;
+		}
+
+		if (port->shared->has_mixdown && !port->shared->delayed &&
+		    jack_slist_length (port->connections) >= JACK_SUM_MIN_FANIN &&
+		    !jack_port_has_gain (port)) {
+			candidates = jack_slist_append (candidates, port);
+		}
 	}
 
-	if ((client = jack_create_driver_client (engine, info->client_name)
-	     ) == NULL) {
-		return -1;
+	while (candidates) {
+		lead = (jack_port_internal_t*)candidates->data;
+		candidates = jack_slist_remove_link (candidates, candidates);
+		members = 0;
+
+		for (node = candidates; node; node = mnode) {
+			mnode = jack_slist_next (node);
+			port = (jack_port_internal_t*)node->data;
+			if (port->shared->ptype_id == lead->shared->ptype_id &&
+			    jack_sum_same_sources (lead, port)) {
+				port->shared->sum_port = lead->shared->id;
+				candidates = jack_slist_remove (candidates, port);
+				members++;
+			}
+		}
+
+		if (members == 0) {
+			continue;
+		}
+
+		blist = jack_port_buffer_list (engine, lead);
+		pthread_mutex_lock (&blist->lock);
+		n = jack_port_buffer_take (blist, 0);
+		pthread_mutex_unlock (&blist->lock);
+
+		if (n < 0) {
+			VERBOSE (engine, "no buffer left for a summing node at %s",
+				 lead->shared->name);
+			for (i = jack_port_next_in_use (engine->control, 0, high); i < high;
+			     i = jack_port_next_in_use (engine->control, i + 1, high)) {
+				if (engine->control->ports[i].sum_port == lead->shared->id) {
+					engine->control->ports[i].sum_port = JACK_NO_SUM;
+				}
+			}
+			continue;
+		}
+
+		lead->sum_info = &blist->info[n];
+		lead->shared->sum_claimed = stale;
+		lead->shared->sum_ready = stale;
+		lead->shared->sum_offset = lead->sum_info->offset;
+		lead->shared->sum_port = lead->shared->id;
+
+		VERBOSE (engine, "%s and %d other port(s) share one sum of %d inputs",
+			 lead->shared->name, members,
+			 jack_slist_length (lead->connections));
 	}
+}
 
-	if ((driver = info->initialize (client->private_client,
-					driver_params)) == NULL) {
-		free (info);
-		return -1;
+/* Called on every graph sort, before latencies are computed: decides
+ * which clients run in the async stage, and which output ports need a
+ * delayed buffer.
+ */
+static void
+jack_mark_async_clients (jack_engine_t *engine)
+{
+	/* caller must hold client_lock and the graph write lock */
+	JSList *node, *cnode;
+	uint32_t i, high;
+
+	/* a stage still running would miss its handoff when the FIFOs
+	   are rechained */
+	if (engine->async_head) {
+		jack_async_collect (engine, engine->driver ? engine->driver->period_usecs : 0);
 	}
+	engine->async_running = 0;
 
-	driver->handle = info->handle;
-	driver->finish = info->finish;
-	driver->internal_client = client;
-	free (info);
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client = (jack_client_internal_t*)node->data;
+		jack_client_control_t *ctl = client->control;
 
-	if (jack_use_driver (engine, driver) < 0) {
-		jack_remove_client (engine, client);
-		return -1;
+#ifdef JACK_USE_MACH_THREADS
+		ctl->delayed = FALSE;
+#else
+		ctl->delayed = ctl->async && ctl->active && !engine->dag &&
+			       !jack_client_is_internal (client) &&
+			       (ctl->process_cbset || ctl->thread_cb_cbset);
+#endif
+
+		for (cnode = client->ports; cnode; cnode = jack_slist_next (cnode)) {
+			((jack_port_internal_t*)cnode->data)->shared->delayed = ctl->delayed;
+		}
 	}
 
-	engine->driver_desc   = driver_desc;
-	engine->driver_params = driver_params;
+	jack_slist_free (engine->delayed_ports);
+	engine->delayed_ports = NULL;
 
-	return 0;
+	high = engine->control->port_high;
+
+	for (i = jack_port_next_in_use (engine->control, 0, high); i < high;
+	     i = jack_port_next_in_use (engine->control, i + 1, high)) {
+		jack_port_internal_t *port = &engine->internal_ports[i];
+		jack_port_buffer_list_t *blist;
+		int across = 0;
+		int n;
+
+		if (!(jack_port_flags_column (engine->control)[i] & JackPortIsOutput)) {
+			continue;
+		}
+
+		for (cnode = port->connections; cnode; cnode = jack_slist_next (cnode)) {
+			jack_connection_internal_t *c = (jack_connection_internal_t*)cnode->data;
+			if (c->destination->shared->delayed != port->shared->delayed) {
+				across = 1;
+				break;
+			}
+		}
+
+		blist = jack_port_buffer_list (engine, port);
+
+		if (across && port->delayed_info == NULL) {
+			pthread_mutex_lock (&blist->lock);
+			if ((n = jack_port_buffer_take (blist, 0)) >= 0) {
+				port->delayed_info = &blist->info[n];
+				port->shared->delayed_offset = port->delayed_info->offset;
+			}
+			pthread_mutex_unlock (&blist->lock);
+			if (n < 0) {
+				jack_error ("no buffer left to delay port %s "
+					    "for the async stage", port->shared->name);
+			}
+		} else if (!across && port->delayed_info) {
+			port->shared->delayed_offset = 0;
+			pthread_mutex_lock (&blist->lock);
+			jack_port_buffer_set_free (blist, port->delayed_info - blist->info);
+			pthread_mutex_unlock (&blist->lock);
+			port->delayed_info = NULL;
+		}
+
+		if (port->delayed_info) {
+			engine->delayed_ports = jack_slist_prepend (engine->delayed_ports, port);
+		}
+	}
+
+	jack_async_plan_history (engine);
 }
 
-int
-jack_engine_load_slave_driver (jack_engine_t *engine,
-			       jack_driver_desc_t * driver_desc,
-			       JSList * driver_params)
+/* Run the clients in the order given by the snapshot, or by
+ * engine->clients if there is none.
+ */
+static int
+jack_engine_process (jack_engine_t *engine, jack_graph_snapshot_t *snapshot,
+		     jack_nframes_t nframes)
 {
+	/* precondition: caller has graph_lock, or the snapshot */
+	jack_graph_snapshot_t *schedule;
+	jack_schedule_step_t *step, *end;
 	jack_client_internal_t *client;
-	jack_driver_t *driver;
-	jack_driver_info_t *info;
+	JSList *node;
+	unsigned int i;
 
-	if ((info = jack_load_driver (engine, driver_desc)) == NULL) {
-		jack_info ("Loading slave failed\n");
-		return -1;
+	engine->process_errors = 0;
+
+	if (engine->dag) {
+		/* resets the clients itself, as pipelined ones may
+		   still be running the last cycle */
+		return jack_dag_process (engine, nframes);
 	}
 
-	if ((client = jack_create_driver_client (engine, info->client_name)
-	     ) == NULL) {
-		jack_info ("Creating slave failed\n");
-		return -1;
+	if (engine->late_clients || engine->fifos_dirty) {
+		/* a late client may yet finish the cycle we gave up
+		   on, and its wakeup would end the next one early */
+		jack_clear_fifos (engine);
+		engine->fifos_dirty = 0;
 	}
 
-	if ((driver = info->initialize (client->private_client,
-					driver_params)) == NULL) {
-		free (info);
-		jack_info ("Initializing slave failed\n");
-		return -1;
+	if (engine->muted_clients) {
+		jack_unmute_clients (engine);
 	}
 
-	driver->handle = info->handle;
-	driver->finish = info->finish;
-	driver->internal_client = client;
-	free (info);
+	/* with the graph lock, the published snapshot is that of
+	   the graph as it is; it is missing only if it could not be
+	   allocated */
+	schedule = snapshot ? snapshot : engine->graph_snapshot;
 
-	if (jack_add_slave_driver (engine, driver) < 0) {
-		jack_info ("Adding slave failed\n");
-		jack_client_delete (engine, client);
-		return -1;
+	if (schedule) {
+		for (i = 0; i < schedule->nclients; i++) {
+			jack_client_control_t *ctl = schedule->controls[i];
+			ctl->state = NotTriggered;
+			ctl->timed_out = 0;
+			ctl->awake_at = 0;
+			ctl->finished_at = 0;
+		}
+	} else {
+		for (node = engine->clients; node; node = jack_slist_next (node)) {
+			jack_client_control_t *ctl =
+				((jack_client_internal_t*)node->data)->control;
+			ctl->state = NotTriggered;
+			ctl->timed_out = 0;
+			ctl->awake_at = 0;
+			ctl->finished_at = 0;
+		}
 	}
 
-	//engine->driver_desc   = driver_desc;
-	//engine->driver_params = driver_params;
-
-	return 0;
-}
+	if (engine->async_head && snapshot == NULL) {
+		jack_async_start (engine);
+	}
 
-#ifdef USE_CAPABILITIES
+	if (schedule) {
+		end = schedule->steps + schedule->nsteps;
 
-static int check_capabilities (jack_engine_t *engine)
-{
-	cap_t caps = cap_init ();
-	cap_flag_value_t cap;
-	pid_t pid;
-	int have_all_caps = 1;
+		for (step = schedule->steps; engine->process_errors == 0 && step < end; step++) {
+			if (step->control->dead) {
+				continue;
+			}
+			if (step->internal) {
+				jack_run_internal_client (engine, step->client, nframes);
+			} else if (jack_run_external_subgraph (engine, step->client)) {
+				break;
+			}
+		}
 
-	if (caps == NULL) {
-		VERBOSE (engine, "check: could not allocate capability"
-			 " working storage");
-		return 0;
-	}
-	pid = getpid ();
-	cap_clear (caps);
-	if (capgetp (pid, caps)) {
-		VERBOSE (engine, "check: could not get capabilities "
-			 "for process %d", pid);
-		return 0;
-	}
-	/* check that we are able to give capabilites to other processes */
-	cap_get_flag (caps, CAP_SETPCAP, CAP_EFFECTIVE, &cap);
-	if (cap == CAP_CLEAR) {
-		have_all_caps = 0;
-		goto done;
-	}
-	/* check that we have the capabilities we want to transfer */
-	cap_get_flag (caps, CAP_SYS_NICE, CAP_EFFECTIVE, &cap);
-	if (cap == CAP_CLEAR) {
-		have_all_caps = 0;
-		goto done;
+		return engine->process_errors > 0;
 	}
-	cap_get_flag (caps, CAP_SYS_RESOURCE, CAP_EFFECTIVE, &cap);
-	if (cap == CAP_CLEAR) {
-		have_all_caps = 0;
-		goto done;
-	}
-	cap_get_flag (caps, CAP_IPC_LOCK, CAP_EFFECTIVE, &cap);
-	if (cap == CAP_CLEAR) {
-		have_all_caps = 0;
-		goto done;
-	}
-done:
-	cap_free (caps);
-	return have_all_caps;
-}
 
+	for (node = engine->clients; engine->process_errors == 0 && node; ) {
 
-static int give_capabilities (jack_engine_t *engine, pid_t pid)
-{
-	cap_t caps = cap_init ();
-	const unsigned caps_size = 3;
-	cap_value_t cap_list[] = { CAP_SYS_NICE, CAP_SYS_RESOURCE, CAP_IPC_LOCK };
+		client = (jack_client_internal_t*)node->data;
 
-	if (caps == NULL) {
-		VERBOSE (engine, "give: could not allocate capability"
-			 " working storage");
-		return -1;
-	}
-	cap_clear (caps);
-	if (capgetp (pid, caps)) {
-		VERBOSE (engine, "give: could not get current "
-			 "capabilities for process %d", pid);
-		cap_clear (caps);
-	}
-	cap_set_flag (caps, CAP_EFFECTIVE, caps_size, cap_list, CAP_SET);
-	cap_set_flag (caps, CAP_INHERITABLE, caps_size, cap_list, CAP_SET);
-	cap_set_flag (caps, CAP_PERMITTED, caps_size, cap_list, CAP_SET);
-	if (capsetp (pid, caps)) {
-		cap_free (caps);
-		return -1;
+		DEBUG ("considering client %s for processing",
+		       client->control->name);
+
+		if (!client->control->active ||
+		    (!client->control->process_cbset && !client->control->thread_cb_cbset) ||
+		    client->control->dead || client->skipped ||
+		    client->control->delayed) {
+			node = jack_slist_next (node);
+		} else if (jack_client_is_internal (client)) {
+			node = jack_process_internal (engine, node, nframes);
+		} else {
+			node = jack_process_external (engine, node);
+		}
 	}
-	cap_free (caps);
-	return 0;
+
+	return engine->process_errors > 0;
 }
 
-static int
-jack_set_client_capabilities (jack_engine_t *engine, pid_t cap_pid)
+static void
+jack_calc_cpu_load (jack_engine_t *engine)
 {
-	int ret = -1;
+	jack_time_t cycle_end = jack_get_microseconds ();
 
-	/* before sending this request the client has
-	   already checked that the engine has
-	   realtime capabilities, that it is running
-	   realtime and that the pid is defined
-	 */
+	/* store the execution time for later averaging */
 
-	if ((ret = give_capabilities (engine, cap_pid)) != 0) {
-		jack_error ("could not give capabilities to "
-			    "process %d",
-			    cap_pid);
-	} else {
-		VERBOSE (engine, "gave capabilities to"
-			 " process %d",
-			 cap_pid);
+	engine->rolling_client_usecs[engine->rolling_client_usecs_index++] =
+		cycle_end - engine->control->current_time.usecs;
+
+	/* the driver thread runs this; the freewheel thread must not
+	   end up under SCHED_DEADLINE */
+	if (engine->control->deadline && !engine->freewheeling) {
+		jack_deadline_sample (&engine->deadline,
+				      cycle_end - engine->control->current_time.usecs,
+				      engine->driver->period_usecs);
 	}
 
-	return ret;
-}
+	//jack_info ("cycle_end - engine->control->current_time.usecs %ld",
+	//	(long) (cycle_end - engine->control->current_time.usecs));
 
-#endif /* USE_CAPABILITIES */
+	if (engine->rolling_client_usecs_index >= JACK_ENGINE_ROLLING_COUNT) {
+		engine->rolling_client_usecs_index = 0;
+	}
 
-/* perform internal or external client request
- *
- * reply_fd is NULL for internal requests
- */
-static void
-do_request (jack_engine_t *engine, jack_request_t *req, int *reply_fd)
-{
-	/* The request_lock serializes internal requests (from any
-	 * thread in the server) with external requests (always from "the"
-	 * server thread).
+	/* every so often, recompute the current maximum use over the
+	   last JACK_ENGINE_ROLLING_COUNT client iterations.
 	 */
-	pthread_mutex_lock (&engine->request_lock);
 
-	DEBUG ("got a request of type %d (%s)", req->type, jack_event_type_name (req->type));
+	if (++engine->rolling_client_usecs_cnt
+	    % engine->rolling_interval == 0) {
+		float max_usecs = 0.0f;
+		int i;
 
-	switch (req->type) {
-	case RegisterPort:
-		req->status = jack_port_do_register (engine, req, reply_fd ? FALSE : TRUE);
-		break;
+		for (i = 0; i < JACK_ENGINE_ROLLING_COUNT; i++) {
+			if (engine->rolling_client_usecs[i] > max_usecs) {
+				max_usecs = engine->rolling_client_usecs[i];
+			}
+		}
 
-	case UnRegisterPort:
-		req->status = jack_port_do_unregister (engine, req);
-		break;
+		if (max_usecs > engine->max_usecs) {
+			engine->max_usecs = max_usecs;
+		}
 
-	case ConnectPorts:
-		req->status = jack_port_do_connect
-				      (engine, req->x.connect.source_port,
-				      req->x.connect.destination_port);
-		break;
+		if (max_usecs < engine->driver->period_usecs) {
+			engine->spare_usecs =
+				engine->driver->period_usecs - max_usecs;
+		} else {
+			engine->spare_usecs = 0;
+		}
 
-	case DisconnectPort:
-		req->status = jack_port_do_disconnect_all
-				      (engine, req->x.port_info.port_id);
-		break;
+		engine->control->cpu_load =
+			(1.0f - (engine->spare_usecs /
+				 engine->driver->period_usecs)) * 50.0f
+			+ (engine->control->cpu_load * 0.5f);
 
-	case DisconnectPorts:
-		req->status = jack_port_do_disconnect
-				      (engine, req->x.connect.source_port,
-				      req->x.connect.destination_port);
-		break;
+		VERBOSE (engine, "load = %.4f max usecs: %.3f, "
+			 "spare = %.3f", engine->control->cpu_load,
+			 max_usecs, engine->spare_usecs);
+	}
 
-	case ActivateClient:
-		req->status = jack_client_activate (engine, req->x.client_id);
-		break;
+}
 
-	case DeactivateClient:
-		req->status = jack_client_deactivate (engine, req->x.client_id);
-		break;
+static void
+jack_cycle_trace_init (jack_engine_t *engine)
+{
+	jack_cycle_trace_t *trace;
+	size_t size;
 
-	case SetTimeBaseClient:
-		req->status = jack_timebase_set (engine,
-						 req->x.timebase.client_id,
-						 req->x.timebase.conditional);
-		break;
+	engine->trace = NULL;
+	engine->trace_last_end = 0;
+	engine->trace_xrun = 0;
+	engine->trace_recovery_usecs = 0.0f;
+	engine->control->trace_shm_index = -1;
 
-	case ResetTimeBaseClient:
-		req->status = jack_timebase_reset (engine, req->x.client_id);
-		break;
+	if (cycle_trace_records == 0 && (metrics_address || xrun_dump_dir)) {
+		/* the cycle time quantiles and xrun dumps come from
+		 * the ring */
+		cycle_trace_records = JACK_CYCLE_TRACE_DEFAULT_RECORDS;
+	}
+	if (cycle_trace_records == 0) {
+		return;
+	}
 
-	case SetSyncClient:
-		req->status =
-			jack_transport_client_set_sync (engine,
-							req->x.client_id);
-		break;
+	size = sizeof(jack_cycle_trace_t)
+	       + cycle_trace_records * sizeof(jack_cycle_trace_record_t);
 
-	case ResetSyncClient:
-		req->status =
-			jack_transport_client_reset_sync (engine,
-							  req->x.client_id);
-		break;
+	if (jack_shmalloc (size, &engine->trace_shm)) {
+		jack_error ("cannot create cycle trace shared memory "
+			    "segment (%s)", strerror (errno));
+		return;
+	}
 
-	case SetSyncTimeout:
-		req->status = jack_transport_set_sync_timeout (engine,
-							       req->x.timeout);
-		break;
+	if (jack_attach_shm (&engine->trace_shm)) {
+		jack_error ("cannot attach to cycle trace shared memory "
+			    "(%s)", strerror (errno));
+		jack_destroy_shm (&engine->trace_shm);
+		return;
+	}
+	jack_mlock_rt_shm (&engine->trace_shm, "cycle trace memory");
 
-#ifdef USE_CAPABILITIES
-	case SetClientCapabilities:
-		req->status = jack_set_client_capabilities (engine,
-							    req->x.cap_pid);
-		break;
-#endif          /* USE_CAPABILITIES */
+	trace = (jack_cycle_trace_t*)jack_shm_addr (&engine->trace_shm);
 
-	case GetPortConnections:
-	case GetPortNConnections:
-		//JOQ bug: reply_fd may be NULL if internal request
-		if ((req->status =
-			     jack_do_get_port_connections (engine, req, *reply_fd))
-		    == 0) {
-			/* we have already replied, don't do it again */
-			*reply_fd = -1;
-		}
-		break;
+	/* also faults in the pages, away from the RT thread */
+	memset (trace, 0, size);
 
-	case FreeWheel:
-		req->status = jack_start_freewheeling (engine, req->x.client_id);
-		break;
+	trace->version = JACK_CYCLE_TRACE_VERSION;
+	trace->nrecords = cycle_trace_records;
+	trace->record_size = sizeof(jack_cycle_trace_record_t);
+	trace->max_clients = JACK_CYCLE_TRACE_MAX_CLIENTS;
+	trace->write_count = 0;
 
-	case StopFreeWheel:
-		req->status = jack_stop_freewheeling (engine, 0);
-		break;
+	engine->trace = trace;
+	engine->control->trace_shm_index = engine->trace_shm.index;
 
-	case SetBufferSize:
-		req->status = jack_set_buffer_size_request (engine, req->x.nframes);
-		jack_lock_graph (engine);
-		jack_compute_new_latency (engine);
-		jack_unlock_graph (engine);
-		break;
+	VERBOSE (engine, "cycle trace: %u records (%lu bytes)",
+		 cycle_trace_records, (unsigned long)size);
+}
 
-	case IntClientHandle:
-		jack_intclient_handle_request (engine, req);
-		break;
+static inline uint32_t
+jack_cycle_trace_offset (jack_time_t t, jack_time_t start)
+{
+	return (t && t >= start) ? (uint32_t)(t - start) : JACK_CYCLE_TRACE_NONE;
+}
 
-	case IntClientLoad:
-		jack_intclient_load_request (engine, req);
-		break;
+static void
+jack_cycle_trace_write (jack_engine_t *engine, jack_nframes_t nframes,
+			float delayed_usecs)
+{
+	/* precondition: caller holds the graph lock. */
+
+	jack_cycle_trace_t *trace = engine->trace;
+	jack_cycle_trace_record_t *rec;
+	jack_time_t start = engine->control->current_time.usecs;
+	JSList *node;
+	uint32_t n = 0;
+
+	rec = &trace->records[trace->write_count % trace->nrecords];
+
+	rec->seq++;
+	__sync_synchronize ();
+
+	rec->flags = 0;
+	if (engine->trace_xrun) {
+		rec->flags |= JACK_CYCLE_TRACE_XRUN;
+	}
+	if (engine->process_errors) {
+		rec->flags |= JACK_CYCLE_TRACE_FAILED;
+	}
+	rec->cycle = trace->write_count;
+	rec->cycle_start = start;
+	rec->cycle_end = jack_get_microseconds ();
+	rec->driver_wait_usecs = (engine->trace_last_end && start > engine->trace_last_end) ?
+				 (float)(start - engine->trace_last_end) : 0.0f;
+	rec->delayed_usecs = delayed_usecs;
+	rec->recovery_usecs = engine->trace_recovery_usecs;
+	rec->nframes = nframes;
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client = (jack_client_internal_t*)node->data;
+		jack_client_control_t *ctl = client->control;
+		jack_cycle_trace_client_t *c;
+
+		if (!ctl->active || ctl->dead) {
+			continue;
+		}
+		if (n == JACK_CYCLE_TRACE_MAX_CLIENTS) {
+			rec->flags |= JACK_CYCLE_TRACE_TRUNCATED;
+			break;
+		}
+		if (ctl->timed_out) {
+			rec->flags |= JACK_CYCLE_TRACE_FAILED;
+		}
+
+		c = &rec->clients[n++];
+		jack_uuid_copy (&c->uuid, ctl->uuid);
+		c->signalled = jack_cycle_trace_offset (ctl->signalled_at, start);
+		c->awake = jack_cycle_trace_offset (ctl->awake_at, start);
+		c->finished = jack_cycle_trace_offset (ctl->finished_at, start);
+
+		if (ctl->fault_counts && c->finished != JACK_CYCLE_TRACE_NONE) {
+			c->minor_faults = ctl->minor_faults > UINT16_MAX ?
+					  UINT16_MAX : ctl->minor_faults;
+			c->major_faults = ctl->major_faults > UINT8_MAX ?
+					  UINT8_MAX : ctl->major_faults;
+			c->involuntary_switches = ctl->involuntary_switches > UINT8_MAX ?
+						  UINT8_MAX : ctl->involuntary_switches;
+		} else {
+			c->minor_faults = 0;
+			c->major_faults = 0;
+			c->involuntary_switches = 0;
+		}
+	}
+	rec->nclients = n;
+
+	__sync_synchronize ();
+	rec->seq++;
+	trace->write_count++;
+
+	engine->trace_last_end = rec->cycle_end;
+	engine->trace_xrun = 0;
+	engine->trace_recovery_usecs = 0.0f;
+}
+
+static void
+jack_port_meters_init (jack_engine_t *engine)
+{
+	jack_port_meters_t *meters;
+	size_t size;
+
+	engine->meters = NULL;
+	engine->meter_frames = 0;
+	engine->control->meter_shm_index = -1;
+
+	if (port_meter_msecs == 0) {
+		return;
+	}
+
+	size = sizeof(jack_port_meters_t)
+	       + engine->port_max * sizeof(jack_port_meter_t);
+
+	engine->meter_peak = (float*)calloc (engine->port_max, sizeof(float));
+	engine->meter_sumsq = (float*)calloc (engine->port_max, sizeof(float));
+	engine->meter_overs = (uint32_t*)calloc (engine->port_max, sizeof(uint32_t));
+	if (engine->meter_peak == NULL || engine->meter_sumsq == NULL
+	    || engine->meter_overs == NULL) {
+		jack_error ("cannot allocate port meters");
+		goto fail;
+	}
+
+	if (jack_shmalloc (size, &engine->meter_shm)) {
+		jack_error ("cannot create port meter shared memory "
+			    "segment (%s)", strerror (errno));
+		goto fail;
+	}
+
+	if (jack_attach_shm (&engine->meter_shm)) {
+		jack_error ("cannot attach to port meter shared memory "
+			    "(%s)", strerror (errno));
+		jack_destroy_shm (&engine->meter_shm);
+		goto fail;
+	}
+
+	meters = (jack_port_meters_t*)jack_shm_addr (&engine->meter_shm);
+	jack_mlock_rt_shm (&engine->meter_shm, "port meter memory");
+
+	/* also faults in the pages, away from the RT thread */
+	memset (meters, 0, size);
+
+	meters->version = JACK_PORT_METER_VERSION;
+	meters->nports = engine->port_max;
+	meters->interval_msecs = port_meter_msecs;
+
+	engine->meters = meters;
+	engine->control->meter_shm_index = engine->meter_shm.index;
+
+	VERBOSE (engine, "port meters: every %u msecs (%lu bytes)",
+		 port_meter_msecs, (unsigned long)size);
+	return;
+
+fail:
+	free (engine->meter_peak);
+	free (engine->meter_sumsq);
+	free (engine->meter_overs);
+	engine->meter_peak = NULL;
+	engine->meter_sumsq = NULL;
+	engine->meter_overs = NULL;
+}
+
+/* Levels a driver measured while converting a port's buffer, for
+ * ports the engine does not measure itself: hardware playback ports
+ * are inputs.
+ */
+void
+jack_port_meter_driver (jack_engine_t *engine, jack_port_id_t id,
+			float peak, float sumsq, uint32_t overs)
+{
+	/* precondition: called from the driver's write, with the graph
+	   lock held. */
+
+	if (engine->meters == NULL || id >= engine->port_max) {
+		return;
+	}
+	if (peak > engine->meter_peak[id]) {
+		engine->meter_peak[id] = peak;
+	}
+	engine->meter_sumsq[id] += sumsq;
+	engine->meter_overs[id] += overs;
+}
+
+/* Measure every audio output port once the clients are done with
+ * this cycle, and publish the levels once per interval.
+ */
+static void
+jack_port_meters_update (jack_engine_t *engine, jack_nframes_t nframes)
+{
+	/* precondition: caller holds the graph lock. */
+
+	jack_control_t *control = engine->control;
+	jack_port_meters_t *meters = engine->meters;
+	uint32_t seq = control->cycle_seq;
+	uint32_t high = control->port_high;
+	jack_nframes_t interval;
+	char *base;
+	uint32_t i;
+
+	base = (char*)jack_shm_addr (&engine->port_segment[JACK_AUDIO_PORT_TYPE]);
+
+	for (i = 0; i < high && i < engine->port_max; i++) {
+		jack_port_shared_t *shared = &control->ports[i];
+		float peak, sumsq;
+
+		if (!shared->in_use || shared->ptype_id != JACK_AUDIO_PORT_TYPE
+		    || !(shared->flags & JackPortIsOutput)
+		    || shared->muted || shared->silent_cycle == seq) {
+			continue;
+		}
+
+		jack_port_meter_buffer ((float*)(base + (shared->delayed ?
+							  shared->delayed_offset :
+							  shared->forward_cycle == seq ?
+							  shared->forward_offset :
+							  shared->offset)),
+					nframes, &peak, &sumsq);
+
+		if (peak > engine->meter_peak[i]) {
+			engine->meter_peak[i] = peak;
+		}
+		engine->meter_sumsq[i] += sumsq;
+	}
+
+	engine->meter_frames += nframes;
+
+	interval = (jack_nframes_t)((uint64_t)port_meter_msecs
+				    * control->current_time.frame_rate / 1000);
+	if (engine->meter_frames < interval) {
+		return;
+	}
+
+	meters->seq++;
+	__sync_synchronize ();
+
+	for (i = 0; i < high && i < engine->port_max; i++) {
+		meters->ports[i].peak = engine->meter_peak[i];
+		meters->ports[i].rms = sqrtf (engine->meter_sumsq[i]
+					      / engine->meter_frames);
+		meters->ports[i].overs = engine->meter_overs[i];
+		engine->meter_peak[i] = 0.0f;
+		engine->meter_sumsq[i] = 0.0f;
+		engine->meter_overs[i] = 0;
+	}
+	meters->intervals++;
+
+	__sync_synchronize ();
+	meters->seq++;
+
+	engine->meter_frames = 0;
+}
+
+static void
+jack_engine_post_process (jack_engine_t *engine)
+{
+	/* precondition: caller holds the graph lock. */
+	JSList *node;
+
+	jack_transport_cycle_end (engine);
+	jack_calc_cpu_load (engine);
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client = (jack_client_internal_t*)node->data;
+
+		jack_client_load_sample (client);
+
+		if (client->late && client->control->finished_at
+		    && jack_client_clear_late (engine, client)) {
+			/* the client recovered. if this is a single
+			 * occurence, thats probably fine.  however, we
+			 * increase the continuous_stream flag.
+			 */
+			engine->timeout_count += 1;
+		}
+	}
+
+	/* errors are picked up by jack_supervisor_thread() */
+}
+
+
+static jack_driver_info_t *
+jack_load_driver (jack_engine_t *engine, jack_driver_desc_t * driver_desc)
+{
+	const char *errstr;
+	jack_driver_info_t *info;
+
+	info = (jack_driver_info_t*)calloc (1, sizeof(*info));
+
+	info->handle = dlopen (driver_desc->file, RTLD_NOW | RTLD_GLOBAL);
+
+	if (info->handle == NULL) {
+		if ((errstr = dlerror ()) != 0) {
+			jack_error ("can't load \"%s\": %s", driver_desc->file,
+				    errstr);
+		} else {
+			jack_error ("bizarre error loading driver shared "
+				    "object %s", driver_desc->file);
+		}
+		goto fail;
+	}
+
+	info->initialize = dlsym (info->handle, "driver_initialize");
+
+	if ((errstr = dlerror ()) != 0) {
+		jack_error ("no initialize function in shared object %s\n",
+			    driver_desc->file);
+		goto fail;
+	}
+
+	info->finish = dlsym (info->handle, "driver_finish");
+
+	if ((errstr = dlerror ()) != 0) {
+		jack_error ("no finish function in in shared driver object %s",
+			    driver_desc->file);
+		goto fail;
+	}
+
+	info->client_name = (char*)dlsym (info->handle, "driver_client_name");
+
+	if ((errstr = dlerror ()) != 0) {
+		jack_error ("no client name in in shared driver object %s",
+			    driver_desc->file);
+		goto fail;
+	}
+
+	return info;
+
+fail:
+	if (info->handle) {
+		dlclose (info->handle);
+	}
+	free (info);
+	return NULL;
+
+}
+
+void
+jack_driver_unload (jack_driver_t *driver)
+{
+	void* handle = driver->handle;
+
+	driver->finish (driver);
+	dlclose (handle);
+}
+
+int
+jack_engine_load_driver (jack_engine_t *engine,
+			 jack_driver_desc_t * driver_desc,
+			 JSList * driver_params)
+{
+	jack_client_internal_t *client;
+	jack_driver_t *driver;
+	jack_driver_info_t *info;
+
+	if ((info = jack_load_driver (engine, driver_desc)) == NULL) {
+		return -1;
+	}
+
+	if ((client = jack_create_driver_client (engine, info->client_name)
+	     ) == NULL) {
+		return -1;
+	}
+
+	if ((driver = info->initialize (client->private_client,
+					driver_params)) == NULL) {
+		free (info);
+		return -1;
+	}
+
+	driver->handle = info->handle;
+	driver->finish = info->finish;
+	driver->internal_client = client;
+	free (info);
+
+	if (jack_use_driver (engine, driver) < 0) {
+		jack_remove_client (engine, client);
+		return -1;
+	}
+
+	engine->driver_desc   = driver_desc;
+	engine->driver_params = driver_params;
+
+	return 0;
+}
+
+int
+jack_engine_load_slave_driver (jack_engine_t *engine,
+			       jack_driver_desc_t * driver_desc,
+			       JSList * driver_params)
+{
+	jack_client_internal_t *client;
+	jack_driver_t *driver;
+	jack_driver_info_t *info;
+
+	if ((info = jack_load_driver (engine, driver_desc)) == NULL) {
+		jack_info ("Loading slave failed\n");
+		return -1;
+	}
+
+	if ((client = jack_create_driver_client (engine, info->client_name)
+	     ) == NULL) {
+		jack_info ("Creating slave failed\n");
+		return -1;
+	}
+
+	if ((driver = info->initialize (client->private_client,
+					driver_params)) == NULL) {
+		free (info);
+		jack_info ("Initializing slave failed\n");
+		return -1;
+	}
+
+	driver->handle = info->handle;
+	driver->finish = info->finish;
+	driver->internal_client = client;
+	free (info);
+
+	if (jack_add_slave_driver (engine, driver) < 0) {
+		jack_info ("Adding slave failed\n");
+		jack_client_delete (engine, client);
+		return -1;
+	}
+
+	//engine->driver_desc   = driver_desc;
+	//engine->driver_params = driver_params;
+
+	return 0;
+}
+
+/* Load a driver to stand in for the master driver.  It opens its
+ * device and runs on its own clock from now on, but only null cycles
+ * until jack_engine_switch_to_backup(), or the master driver failing,
+ * hands it the graph.  It must run at the buffer size and sample rate
+ * of the master, so that nothing is resized when it takes over.
+ */
+int
+jack_engine_load_backup_driver (jack_engine_t *engine,
+				jack_driver_desc_t * driver_desc,
+				JSList * driver_params)
+{
+	jack_client_internal_t *client;
+	jack_driver_t *driver;
+	jack_driver_info_t *info;
+	int i;
+
+	if (engine->driver == NULL || engine->backup_driver) {
+		jack_error ("a backup driver needs a master driver, and"
+			    " there can only be one");
+		return -1;
+	}
+	if (engine->clock_domains) {
+		jack_error ("a backup driver cannot take over the graph"
+			    " from clock domains");
+		return -1;
+	}
+
+	/* the backup's cycles are told apart by its thread, so the
+	   master's must be known first */
+	for (i = 0; engine->master_thread == 0; i++) {
+		if (i == 1000 || engine->freewheeling) {
+			jack_error ("master driver is not running, cannot"
+				    " add a backup");
+			return -1;
+		}
+		usleep (1000);
+	}
+
+	if ((info = jack_load_driver (engine, driver_desc)) == NULL) {
+		return -1;
+	}
+
+	if ((client = jack_create_driver_client (engine, "backup")) == NULL) {
+		free (info);
+		return -1;
+	}
+
+	if ((driver = info->initialize (client->private_client,
+					driver_params)) == NULL) {
+		free (info);
+		jack_client_delete (engine, client);
+		return -1;
+	}
+
+	driver->handle = info->handle;
+	driver->finish = info->finish;
+	driver->internal_client = client;
+	free (info);
+
+	engine->backup_attach = 1;
+	i = driver->attach (driver, engine);
+	if (i == 0 && engine->backup_attach < 0) {
+		jack_error ("backup driver %s does not run at the buffer size"
+			    " and sample rate of the master", driver_desc->name);
+		driver->detach (driver, engine);
+		i = -1;
+	}
+	engine->backup_attach = 0;
+
+	if (i) {
+		jack_client_delete (engine, client);
+		jack_driver_unload (driver);
+		return -1;
+	}
+
+	engine->backup_thread = 0;
+	engine->backup_state = JACK_BACKUP_IDLE;
+	__atomic_store_n (&engine->backup_driver, driver, __ATOMIC_RELEASE);
+
+	if (driver->start (driver)) {
+		jack_error ("cannot start backup driver %s", driver_desc->name);
+		pthread_mutex_lock (&engine->backup_lock);
+		engine->backup_driver = NULL;
+		pthread_mutex_unlock (&engine->backup_lock);
+		driver->detach (driver, engine);
+		jack_client_delete (engine, client);
+		jack_driver_unload (driver);
+		return -1;
+	}
+
+	VERBOSE (engine, "backup driver %s running", driver_desc->name);
+
+	return 0;
+}
+
+/* Load a driver into a clock domain of its own.  It runs its device
+ * on its own clock, at a period of its own, and its ports are bridged
+ * into the graph through resampling rings, see clockdomain.c.  Its
+ * nominal sample rate has to be the master's.
+ */
+int
+jack_engine_load_clock_domain (jack_engine_t *engine,
+			       jack_driver_desc_t * driver_desc,
+			       JSList * driver_params)
+{
+	char name[JACK_CLIENT_NAME_SIZE];
+	jack_client_internal_t *client;
+	jack_clock_domain_t *cd;
+	jack_driver_t *driver;
+	jack_driver_info_t *info;
+	int i;
+
+	if (engine->driver == NULL || engine->backup_driver) {
+		jack_error ("a clock domain needs a master driver, and no"
+			    " backup driver");
+		return -1;
+	}
+
+	/* the domain's cycles are told apart by its thread, so the
+	   master's must be known first */
+	for (i = 0; engine->master_thread == 0; i++) {
+		if (i == 1000 || engine->freewheeling) {
+			jack_error ("master driver is not running, cannot"
+				    " add a clock domain");
+			return -1;
+		}
+		usleep (1000);
+	}
+
+	if ((info = jack_load_driver (engine, driver_desc)) == NULL) {
+		return -1;
+	}
+
+	snprintf (name, sizeof(name), "domain%d",
+		  jack_slist_length (engine->clock_domains) + 1);
+	if ((client = jack_create_driver_client (engine, name)) == NULL) {
+		free (info);
+		return -1;
+	}
+
+	if ((driver = info->initialize (client->private_client,
+					driver_params)) == NULL) {
+		free (info);
+		jack_client_delete (engine, client);
+		return -1;
+	}
+
+	driver->handle = info->handle;
+	driver->finish = info->finish;
+	driver->internal_client = client;
+	free (info);
+
+	engine->domain_nframes = 0;
+	engine->domain_rate = 0;
+	engine->domain_attach = 1;
+	i = driver->attach (driver, engine);
+	engine->domain_attach = 0;
+
+	if (i == 0 && (engine->domain_nframes == 0
+		       || engine->domain_rate
+		       != engine->control->current_time.frame_rate)) {
+		jack_error ("clock domain %s does not run at the sample"
+			    " rate of the master", driver_desc->name);
+		driver->detach (driver, engine);
+		i = -1;
+	}
+
+	if (i == 0 && (cd = jack_clock_domain_new (
+			       engine, driver, engine->domain_nframes,
+			       engine->control->buffer_size,
+			       engine->domain_rate)) == NULL) {
+		driver->detach (driver, engine);
+		i = -1;
+	}
+
+	if (i) {
+		jack_client_delete (engine, client);
+		jack_driver_unload (driver);
+		return -1;
+	}
+
+	/* the graph's cycle may see it from now on; it is not taken
+	   out again until the engine goes */
+	engine->domain_starting = cd;
+	__atomic_store_n (&engine->clock_domains,
+			  jack_slist_prepend (engine->clock_domains, cd),
+			  __ATOMIC_RELEASE);
+
+	if (driver->start (driver)) {
+		jack_error ("cannot start clock domain %s", driver_desc->name);
+		engine->domain_starting = NULL;
+		jack_clock_domain_failed (cd);
+		return -1;
+	}
+
+	for (i = 0; engine->domain_starting; i++) {
+		if (i == 1000) {
+			jack_error ("clock domain %s does not run",
+				    driver_desc->name);
+			driver->stop (driver);
+			engine->domain_starting = NULL;
+			jack_clock_domain_failed (cd);
+			return -1;
+		}
+		usleep (1000);
+	}
+
+	VERBOSE (engine, "clock domain %s running as %s, %" PRIu32
+		 " frames a period", driver_desc->name, name,
+		 engine->domain_nframes);
+
+	return 0;
+}
+
+#ifdef USE_CAPABILITIES
+
+static int check_capabilities (jack_engine_t *engine)
+{
+	cap_t caps = cap_init ();
+	cap_flag_value_t cap;
+	pid_t pid;
+	int have_all_caps = 1;
+
+	if (caps == NULL) {
+		VERBOSE (engine, "check: could not allocate capability"
+			 " working storage");
+		return 0;
+	}
+	pid = getpid ();
+	cap_clear (caps);
+	if (capgetp (pid, caps)) {
+		VERBOSE (engine, "check: could not get capabilities "
+			 "for process %d", pid);
+		return 0;
+	}
+	/* check that we are able to give capabilites to other processes */
+	cap_get_flag (caps, CAP_SETPCAP, CAP_EFFECTIVE, &cap);
+	if (cap == CAP_CLEAR) {
+		have_all_caps = 0;
+		goto done;
+	}
+	/* check that we have the capabilities we want to transfer */
+	cap_get_flag (caps, CAP_SYS_NICE, CAP_EFFECTIVE, &cap);
+	if (cap == CAP_CLEAR) {
+		have_all_caps = 0;
+		goto done;
+	}
+	cap_get_flag (caps, CAP_SYS_RESOURCE, CAP_EFFECTIVE, &cap);
+	if (cap == CAP_CLEAR) {
+		have_all_caps = 0;
+		goto done;
+	}
+	cap_get_flag (caps, CAP_IPC_LOCK, CAP_EFFECTIVE, &cap);
+	if (cap == CAP_CLEAR) {
+		have_all_caps = 0;
+		goto done;
+	}
+done:
+	cap_free (caps);
+	return have_all_caps;
+}
+
+
+static int give_capabilities (jack_engine_t *engine, pid_t pid)
+{
+	cap_t caps = cap_init ();
+	const unsigned caps_size = 3;
+	cap_value_t cap_list[] = { CAP_SYS_NICE, CAP_SYS_RESOURCE, CAP_IPC_LOCK };
+
+	if (caps == NULL) {
+		VERBOSE (engine, "give: could not allocate capability"
+			 " working storage");
+		return -1;
+	}
+	cap_clear (caps);
+	if (capgetp (pid, caps)) {
+		VERBOSE (engine, "give: could not get current "
+			 "capabilities for process %d", pid);
+		cap_clear (caps);
+	}
+	cap_set_flag (caps, CAP_EFFECTIVE, caps_size, cap_list, CAP_SET);
+	cap_set_flag (caps, CAP_INHERITABLE, caps_size, cap_list, CAP_SET);
+	cap_set_flag (caps, CAP_PERMITTED, caps_size, cap_list, CAP_SET);
+	if (capsetp (pid, caps)) {
+		cap_free (caps);
+		return -1;
+	}
+	cap_free (caps);
+	return 0;
+}
+
+static int
+jack_set_client_capabilities (jack_engine_t *engine, pid_t cap_pid)
+{
+	int ret = -1;
+
+	/* before sending this request the client has
+	   already checked that the engine has
+	   realtime capabilities, that it is running
+	   realtime and that the pid is defined
+	 */
+
+	if ((ret = give_capabilities (engine, cap_pid)) != 0) {
+		jack_error ("could not give capabilities to "
+			    "process %d",
+			    cap_pid);
+	} else {
+		VERBOSE (engine, "gave capabilities to"
+			 " process %d",
+			 cap_pid);
+	}
+
+	return ret;
+}
+
+#endif /* USE_CAPABILITIES */
+
+/* perform internal or external client request
+ *
+ * reply_fd is NULL for internal requests
+ */
+static void
+do_request (jack_engine_t *engine, jack_request_t *req, int *reply_fd)
+{
+	jack_time_t start = jack_get_microseconds ();
+
+	/* Queries only look at the graph, under its read lock, so they
+	 * need not wait behind requests that change it; see
+	 * jack_request_is_query().
+	 */
+	if (jack_request_is_query (req->type)) {
+		jack_rdlock_graph (engine);
+		jack_do_query_request (engine, req, reply_fd);
+		jack_unlock_graph (engine);
+		jack_metrics_request_done (engine, jack_get_microseconds () - start);
+		return;
+	}
+
+	/* The request_lock serializes internal requests (from any
+	 * thread in the server) with external requests (always from "the"
+	 * server thread).
+	 */
+	pthread_mutex_lock (&engine->request_lock);
+	jack_event_batch_begin (engine);
+
+	DEBUG ("got a request of type %d (%s)", req->type, jack_event_type_name (req->type));
+
+	switch (req->type) {
+	case RegisterPort:
+		req->status = jack_port_do_register (engine, req, reply_fd ? FALSE : TRUE);
+		break;
+
+	case UnRegisterPort:
+		req->status = jack_port_do_unregister (engine, req);
+		break;
+
+	case ConnectPorts:
+		req->status = jack_port_do_connect
+				      (engine, req->x.connect.source_port,
+				      req->x.connect.destination_port);
+		break;
+
+	case DisconnectPort:
+		req->status = jack_port_do_disconnect_all
+				      (engine, req->x.port_info.port_id);
+		break;
+
+	case DisconnectPorts:
+		req->status = jack_port_do_disconnect
+				      (engine, req->x.connect.source_port,
+				      req->x.connect.destination_port);
+		break;
+
+	case SetConnectionGain:
+		req->status = jack_port_do_set_gain
+				      (engine, req->x.connection_gain.source_port,
+				      req->x.connection_gain.destination_port,
+				      req->x.connection_gain.gain);
+		break;
+
+	case ConnectBatch:
+		jack_port_do_connect_batch (engine, req);
+		break;
+
+	case PortBatch:
+		jack_port_do_batch (engine, req, reply_fd ? FALSE : TRUE);
+		break;
+
+	case ActivateClient:
+		req->status = jack_client_activate (engine, req->x.client_id);
+		break;
+
+	case DeactivateClient:
+		req->status = jack_client_deactivate (engine, req->x.client_id);
+		break;
+
+	case SetTimeBaseClient:
+		req->status = jack_timebase_set (engine,
+						 req->x.timebase.client_id,
+						 req->x.timebase.conditional);
+		break;
+
+	case ResetTimeBaseClient:
+		req->status = jack_timebase_reset (engine, req->x.client_id);
+		break;
+
+	case SetSyncClient:
+		req->status =
+			jack_transport_client_set_sync (engine,
+							req->x.client_id);
+		break;
+
+	case ResetSyncClient:
+		req->status =
+			jack_transport_client_reset_sync (engine,
+							  req->x.client_id);
+		break;
+
+	case SetSyncTimeout:
+		req->status = jack_transport_set_sync_timeout (engine,
+							       req->x.timeout);
+		break;
+
+	case SetTempoMap:
+		req->status = jack_tempo_map_set (engine, &req->x.tempo_map);
+		break;
+
+#ifdef USE_CAPABILITIES
+	case SetClientCapabilities:
+		req->status = jack_set_client_capabilities (engine,
+							    req->x.cap_pid);
+		break;
+#endif          /* USE_CAPABILITIES */
+
+	case FreeWheel:
+		req->status = jack_start_freewheeling (engine, req->x.client_id);
+		break;
+
+	case StopFreeWheel:
+		req->status = jack_stop_freewheeling (engine, 0);
+		break;
+
+	case FreeWheelRange:
+		if (engine->freewheeling
+		    || req->x.freewheel_range.start >= req->x.freewheel_range.end) {
+			req->status = -1;
+			break;
+		}
+		engine->freewheel_start = req->x.freewheel_range.start;
+		engine->freewheel_end = req->x.freewheel_range.end;
+		engine->freewheel_in_range = 0;
+		engine->freewheel_done = 0;
+		engine->freewheel_bounded = 1;
+		req->status = jack_start_freewheeling (engine, req->x.freewheel_range.client_id);
+		if (req->status) {
+			engine->freewheel_bounded = 0;
+		}
+		break;
+
+	case SetBufferSize:
+		req->status = jack_buffer_size_change (engine, req->x.nframes);
+		break;
+
+	case SetFreeWheelBufferSize:
+		if (req->x.nframes
+		    && (!jack_power_of_two (req->x.nframes)
+			|| req->x.nframes > JACK_FREEWHEEL_MAX_BUFFER_SIZE)) {
+			jack_error ("freewheel buffer size %" PRIu32 " is not a"
+				    " power of 2 up to %d", req->x.nframes,
+				    JACK_FREEWHEEL_MAX_BUFFER_SIZE);
+			req->status = EINVAL;
+			break;
+		}
+		engine->freewheel_nframes = req->x.nframes;
+		req->status = 0;
+		break;
+
+	case PortTypeRegister:
+		req->status = jack_port_type_register_request (engine, req);
+		break;
+
+	case SetSampleRate:
+		req->status = jack_sample_rate_change (engine, req->x.nframes);
+		break;
+
+	case IntClientHandle:
+		jack_intclient_handle_request (engine, req);
+		break;
+
+	case IntClientLoad:
+		jack_intclient_load_request (engine, req);
+		break;
 
 	case IntClientName:
 		jack_intclient_name_request (engine, req);
 		break;
 
-	case IntClientUnload:
-		jack_intclient_unload_request (engine, req);
-		break;
+	case IntClientUnload:
+		jack_intclient_unload_request (engine, req);
+		break;
+
+	case RecomputeTotalLatencies:
+		jack_lock_graph (engine);
+		jack_compute_all_port_total_latencies (engine);
+		/* older clients do not say who they are: tell everyone */
+		jack_latency_mark_dirty (engine, jack_client_internal_by_id
+						 (engine, req->x.client_id));
+		jack_compute_new_latency (engine);
+		jack_unlock_graph (engine);
+		req->status = 0;
+		break;
+
+	case RecomputeTotalLatency:
+		jack_lock_graph (engine);
+		jack_compute_port_total_latency (engine, &engine->control->ports[req->x.port_info.port_id]);
+		jack_unlock_graph (engine);
+		req->status = 0;
+		break;
+
+	case ReserveName:
+		jack_rdlock_graph (engine);
+		jack_do_reserve_name (engine, req);
+		jack_unlock_graph (engine);
+		break;
+	case SessionReply:
+		jack_rdlock_graph (engine);
+		jack_do_session_reply (engine, req);
+		jack_unlock_graph (engine);
+		break;
+	case SessionNotify:
+		jack_rdlock_graph (engine);
+		if ((req->status =
+			     jack_do_session_notify (engine, req, *reply_fd))
+		    >= 0) {
+			/* we have already replied, don't do it again */
+			*reply_fd = -1;
+		}
+		jack_unlock_graph (engine);
+		break;
+	case PropertyChangeNotify:
+		jack_property_change_notify (engine, req->x.property.change, req->x.property.uuid, req->x.property.key);
+		break;
+	case PropertySet:
+		jack_do_set_property (engine, req);
+		break;
+	case PropertyRemove:
+		jack_do_remove_property (engine, req);
+		break;
+	case PropertyRemoveAll:
+		jack_do_remove_all_properties (engine, req);
+		break;
+	case PropertyBatch:
+		jack_do_property_batch (engine, req);
+		break;
+
+	case PortNameChanged:
+		jack_rdlock_graph (engine);
+		jack_port_rename_notify (engine, req->x.connect.source_port, req->x.connect.destination_port);
+		jack_unlock_graph (engine);
+		break;
+
+	case GraphBatchBegin:
+		jack_lock_graph (engine);
+		req->status = jack_graph_batch (engine, req->x.client_id, TRUE);
+		jack_unlock_graph (engine);
+		break;
+
+	case GraphBatchEnd:
+		jack_lock_graph (engine);
+		req->status = jack_graph_batch (engine, req->x.client_id, FALSE);
+		jack_unlock_graph (engine);
+		break;
+
+	default:
+		/* some requests are handled entirely on the client
+		 * side, by adjusting the shared memory area(s) */
+		break;
+	}
+
+	jack_event_batch_end (engine);
+	jack_metrics_request_done (engine, jack_get_microseconds () - start);
+	pthread_mutex_unlock (&engine->request_lock);
+
+	DEBUG ("status of request: %d", req->status);
+}
+
+/* Requests that only look at the graph. They are answered by
+ * jack_do_query_request() with just the graph read lock held, so for
+ * external clients they can be handed to the query pool instead of
+ * holding up the server thread and the request_lock.
+ */
+static int
+jack_request_is_query (RequestType type)
+{
+	switch (type) {
+	case GetPortConnections:
+	case GetPortNConnections:
+	case GetClientByUUID:
+	case GetUUIDByClientName:
+	case SessionHasCallback:
+	case GetClientLoad:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+static void
+jack_do_query_request (jack_engine_t *engine, jack_request_t *req, int *reply_fd)
+{
+	/* caller must hold the graph lock */
+
+	switch (req->type) {
+	case GetPortConnections:
+	case GetPortNConnections:
+		//JOQ bug: reply_fd may be NULL if internal request
+		if ((req->status =
+			     jack_do_get_port_connections (engine, req, *reply_fd))
+		    == 0) {
+			/* we have already replied, don't do it again */
+			*reply_fd = -1;
+		}
+		break;
+	case GetClientByUUID:
+		jack_do_get_client_by_uuid (engine, req);
+		break;
+	case GetUUIDByClientName:
+		jack_do_get_uuid_by_client_name (engine, req);
+		break;
+	case SessionHasCallback:
+		req->status = jack_do_has_session_cb (engine, req);
+		break;
+	case GetClientLoad:
+		jack_client_load_request (engine, req);
+		break;
+	default:
+		break;
+	}
+}
+
+/* The query pool: a few plain threads that answer query requests from
+ * external clients. A client waits for the reply to each request
+ * before it sends the next one, so requests from one client are still
+ * answered in order.
+ */
+
+#define JACK_QUERY_THREADS 2
+
+typedef struct {
+	jack_request_t req;
+	jack_uuid_t client_id;
+	int reply_fd;
+} jack_query_t;
+
+struct _jack_query_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	JSList *queue;
+	int stop;
+	unsigned int nthreads;
+	pthread_t *threads;
+};
+
+static void
+jack_query_serve (jack_engine_t *engine, jack_query_t *query)
+{
+	jack_client_internal_t *client;
+	int reply_fd = query->reply_fd;
+
+	jack_rdlock_graph (engine);
+
+	/* the client may have gone away, and its socket been reused,
+	   while the request was queued */
+
+	client = jack_client_internal_by_id (engine, query->client_id);
+
+	if (client == NULL
+	    || client->request_fd != query->reply_fd
+	    || client->error >= JACK_ERROR_WITH_SOCKETS) {
+		VERBOSE (engine, "dropping query from departed client");
+		jack_unlock_graph (engine);
+		return;
+	}
+
+	jack_do_query_request (engine, &query->req, &reply_fd);
+
+	if (reply_fd >= 0) {
+		if (write_reply (reply_fd, &query->req)) {
+			jack_unlock_graph (engine);
+			jack_engine_signal_problems (engine);
+			return;
+		}
+	}
+
+	jack_unlock_graph (engine);
+}
+
+static void *
+jack_query_thread (void *arg)
+{
+	jack_engine_t *engine = (jack_engine_t*)arg;
+	jack_query_pool_t *pool = engine->query_pool;
+	jack_query_t *query;
+
+	jack_thread_set_cpus (pthread_self (), server_cpus);
+
+	pthread_mutex_lock (&pool->lock);
+
+	while (!pool->stop) {
+
+		if (pool->queue == NULL) {
+			pthread_cond_wait (&pool->work, &pool->lock);
+			continue;
+		}
+
+		query = (jack_query_t*)pool->queue->data;
+		pool->queue = jack_slist_remove_link (pool->queue, pool->queue);
+
+		pthread_mutex_unlock (&pool->lock);
+		jack_query_serve (engine, query);
+		free (query);
+		pthread_mutex_lock (&pool->lock);
+	}
+
+	pthread_mutex_unlock (&pool->lock);
+
+	return NULL;
+}
+
+static int
+jack_query_pool_init (jack_engine_t *engine, unsigned int nthreads)
+{
+	jack_query_pool_t *pool;
+	unsigned int i;
+
+	if ((pool = (jack_query_pool_t*)calloc (1, sizeof(jack_query_pool_t)))
+	    == NULL) {
+		return -1;
+	}
+
+	if ((pool->threads = (pthread_t*)calloc (nthreads, sizeof(pthread_t)))
+	    == NULL) {
+		free (pool);
+		return -1;
+	}
+
+	pthread_mutex_init (&pool->lock, NULL);
+	pthread_cond_init (&pool->work, NULL);
+
+	engine->query_pool = pool;
+
+	for (i = 0; i < nthreads; ++i) {
+		if (jack_client_create_thread (NULL, &pool->threads[i], 0, FALSE,
+					       jack_query_thread, engine)) {
+			jack_error ("cannot create query thread %u", i);
+			break;
+		}
+	}
+
+	pool->nthreads = i;
+
+	if (pool->nthreads == 0) {
+		jack_query_pool_cleanup (engine);
+		return -1;
+	}
+
+	VERBOSE (engine, "%u query threads", pool->nthreads);
+
+	return 0;
+}
+
+static void
+jack_query_pool_cleanup (jack_engine_t *engine)
+{
+	jack_query_pool_t *pool = engine->query_pool;
+	unsigned int i;
+
+	if (pool == NULL) {
+		return;
+	}
+
+	VERBOSE (engine, "stopping query threads");
+
+	pthread_mutex_lock (&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast (&pool->work);
+	pthread_mutex_unlock (&pool->lock);
+
+	for (i = 0; i < pool->nthreads; ++i) {
+		pthread_join (pool->threads[i], NULL);
+	}
+
+	while (pool->queue) {
+		free (pool->queue->data);
+		pool->queue = jack_slist_remove_link (pool->queue, pool->queue);
+	}
+
+	pthread_cond_destroy (&pool->work);
+	pthread_mutex_destroy (&pool->lock);
+	free (pool->threads);
+	free (pool);
+
+	engine->query_pool = NULL;
+}
+
+static int
+jack_query_pool_queue (jack_engine_t *engine, jack_client_internal_t *client,
+		       jack_request_t *req)
+{
+	jack_query_pool_t *pool = engine->query_pool;
+	jack_query_t *query;
+
+	if ((query = (jack_query_t*)malloc (sizeof(jack_query_t))) == NULL) {
+		jack_error ("cannot allocate query request");
+		return -1;
+	}
+
+	memcpy (&query->req, req, sizeof(query->req));
+	jack_uuid_copy (&query->client_id, client->control->uuid);
+	query->reply_fd = client->request_fd;
+
+	pthread_mutex_lock (&pool->lock);
+	pool->queue = jack_slist_append (pool->queue, query);
+	pthread_cond_signal (&pool->work);
+	pthread_mutex_unlock (&pool->lock);
+
+	return 0;
+}
+
+/* The shared memory request channel: an external client that asks for
+ * it (see jack_set_shm_requests()) puts a request after its control
+ * block and posts engine->control->request_wakeup. One thread waits on
+ * that and answers whatever requests it finds in all the clients' slots
+ * before it sleeps again, without a socket in the way.
+ */
+
+#define JACK_SHM_REQUEST_IDLE 1000000   /* usecs */
+
+/* Answer one waiting request, if there is one. */
+static int
+jack_shm_request_serve (jack_engine_t *engine)
+{
+	jack_client_internal_t *client = NULL;
+	jack_client_control_t *control;
+	jack_request_t req;
+	jack_uuid_t client_id;
+	uint32_t seq = 0;
+	int reply_fd;
+	JSList *node;
+
+	jack_rdlock_graph (engine);
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t*)node->data;
+		control = client->control;
+		if (!jack_client_is_internal (client)
+		    && control->shm_requests
+		    && control->request_seq != control->reply_seq
+		    && client->error < JACK_ERROR_WITH_SOCKETS) {
+			seq = control->request_seq;
+			__atomic_thread_fence (__ATOMIC_ACQUIRE);
+			jack_request_copy (&req, (jack_request_t*)
+					   jack_client_shm_request (control));
+			jack_uuid_copy (&client_id, control->uuid);
+			break;
+		}
+	}
+
+	jack_unlock_graph (engine);
+
+	if (node == NULL) {
+		return FALSE;
+	}
+
+	if (jack_request_shm_ok (req.type)) {
+		reply_fd = -1;
+		do_request (engine, &req, &reply_fd);
+	} else {
+		jack_error ("request type %" PRIu32 " cannot be sent through"
+			    " shared memory", req.type);
+		req.status = -1;
+	}
+
+	jack_rdlock_graph (engine);
+
+	/* the client may have gone away meanwhile */
+
+	if ((client = jack_client_internal_by_id (engine, client_id)) != NULL) {
+		control = client->control;
+		jack_request_copy ((jack_request_t*)
+				   jack_client_shm_request (control), &req);
+		__atomic_thread_fence (__ATOMIC_RELEASE);
+		control->reply_seq = seq;
+		jack_wakeup_post (&control->request_done, JACK_WAKEUP_EVENT);
+	}
+
+	jack_unlock_graph (engine);
+
+	return TRUE;
+}
+
+static void *
+jack_shm_request_thread (void *arg)
+{
+	jack_engine_t *engine = (jack_engine_t*)arg;
+
+	jack_thread_set_cpus (pthread_self (), server_cpus);
+
+	while (!engine->shm_request_stop) {
+		if (jack_wakeup_wait (&engine->control->request_wakeup,
+				      JACK_SHM_REQUEST_IDLE) < 0) {
+			jack_error ("cannot wait for shared memory requests"
+				    " (%s)", strerror (errno));
+			break;
+		}
+
+		/* one wakeup may stand for several clients' requests */
+		while (!engine->shm_request_stop
+		       && jack_shm_request_serve (engine)) {
+		}
+	}
+
+	engine->control->shm_requests = FALSE;
+
+	return NULL;
+}
+
+static int
+jack_shm_requests_init (jack_engine_t *engine)
+{
+	engine->control->request_wakeup = 0;
+	engine->control->shm_requests = FALSE;
+	engine->shm_request_stop = 0;
+	engine->shm_request_running = 0;
+
+	if (!jack_wakeup_supported ()) {
+		return 0;
+	}
+
+	if (jack_client_create_thread (NULL, &engine->shm_request_thread, 0,
+				       FALSE, jack_shm_request_thread, engine)) {
+		return -1;
+	}
+
+	engine->shm_request_running = 1;
+	engine->control->shm_requests = TRUE;
+
+	return 0;
+}
+
+static void
+jack_shm_requests_cleanup (jack_engine_t *engine)
+{
+	if (!engine->shm_request_running) {
+		return;
+	}
+
+	VERBOSE (engine, "stopping shared memory request thread");
+
+	engine->control->shm_requests = FALSE;
+	engine->shm_request_stop = 1;
+	jack_wakeup_post (&engine->control->request_wakeup, JACK_WAKEUP_EVENT);
+	pthread_join (engine->shm_request_thread, NULL);
+	engine->shm_request_running = 0;
+}
+
+int
+internal_client_request (void* ptr, jack_request_t *request)
+{
+	do_request ((jack_engine_t*)ptr, request, NULL);
+	return request->status;
+}
+
+static int
+read_client_data (jack_client_internal_t *client, void *buf, size_t len)
+{
+	size_t done;
+	ssize_t r;
+
+	for (done = 0; done < len; done += r) {
+		if ((r = read (client->request_fd, (char*)buf + done, len - done)) <= 0) {
+			jack_error ("cannot read request data from client (%s)",
+				    strerror (errno));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+read_property_data (jack_client_internal_t *client, size_t len, const char **data)
+{
+	char *buf;
+
+	*data = NULL;
+
+	if (len == 0) {
+		return 0;
+	}
+
+	if (len > JACK_PROPERTY_STORE_SIZE) {
+		jack_error ("property data of length %lu from client %s is too long",
+			    (unsigned long)len, client->control->name);
+		return -1;
+	}
+
+	buf = (char*)malloc (len);
+
+	if (read_client_data (client, buf, len)) {
+		free (buf);
+		return -1;
+	}
+
+	buf[len - 1] = '\0';
+	*data = buf;
+
+	return 0;
+}
+
+/* property and connection batch requests are followed by their data,
+   see oop_client_deliver_request()
+ */
+static int
+read_request_data (jack_client_internal_t *client, jack_request_t *req)
+{
+	size_t len;
+
+	switch (req->type) {
+	case PropertyChangeNotify:
+	case PropertyRemove:
+		return read_property_data (client, req->x.property.keylen,
+					   &req->x.property.key);
+	case PropertySet:
+		req->x.property_set.key = NULL;
+		req->x.property_set.value = NULL;
+		req->x.property_set.type = NULL;
+		if (read_property_data (client, req->x.property_set.keylen,
+					&req->x.property_set.key)
+		    || read_property_data (client, req->x.property_set.valuelen,
+					   &req->x.property_set.value)
+		    || read_property_data (client, req->x.property_set.typelen,
+					   &req->x.property_set.type)) {
+			free ((char*)req->x.property_set.key);
+			free ((char*)req->x.property_set.value);
+			return -1;
+		}
+		return 0;
+	case ConnectBatch:
+		req->x.connect_batch.ops = NULL;
+		if (req->x.connect_batch.count == 0) {
+			return 0;
+		}
+		if (req->x.connect_batch.count > JACK_CONNECT_BATCH_MAX) {
+			jack_error ("connection batch of %" PRIu32 " changes from "
+				    "client %s is too large",
+				    req->x.connect_batch.count,
+				    client->control->name);
+			return -1;
+		}
+		len = req->x.connect_batch.count * sizeof(jack_connection_op_t);
+		req->x.connect_batch.ops = (jack_connection_op_t*)malloc (len);
+		if (read_client_data (client, req->x.connect_batch.ops, len)) {
+			free (req->x.connect_batch.ops);
+			return -1;
+		}
+		return 0;
+	case PropertyBatch:
+		req->x.property_batch.data = NULL;
+		if (req->x.property_batch.size == 0) {
+			return 0;
+		}
+		if (req->x.property_batch.size > JACK_PROPERTY_BATCH_MAX_SIZE) {
+			jack_error ("metadata batch of %" PRIu32 " bytes from "
+				    "client %s is too large",
+				    req->x.property_batch.size,
+				    client->control->name);
+			return -1;
+		}
+		req->x.property_batch.data = (char*)malloc (req->x.property_batch.size);
+		if (read_client_data (client, (char*)req->x.property_batch.data,
+				      req->x.property_batch.size)) {
+			free ((char*)req->x.property_batch.data);
+			return -1;
+		}
+		return 0;
+	case PortBatch:
+		req->x.port_batch.ops = NULL;
+		if (req->x.port_batch.count == 0) {
+			return 0;
+		}
+		if (req->x.port_batch.count > JACK_PORT_BATCH_MAX) {
+			jack_error ("port batch of %" PRIu32 " changes from "
+				    "client %s is too large",
+				    req->x.port_batch.count,
+				    client->control->name);
+			return -1;
+		}
+		len = req->x.port_batch.count * sizeof(jack_port_op_t);
+		req->x.port_batch.ops = (jack_port_op_t*)malloc (len);
+		if (read_client_data (client, req->x.port_batch.ops, len)) {
+			free (req->x.port_batch.ops);
+			return -1;
+		}
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+/* reply to a request; the result of each change in a connection or
+   port batch goes out with it
+ */
+static int
+write_reply (int reply_fd, jack_request_t *req)
+{
+	int32_t status[JACK_CONNECT_BATCH_MAX];
+	jack_port_id_t ids[JACK_PORT_BATCH_MAX];
+	struct iovec extra[2];
+	int nextra = 0;
+	uint32_t n;
+
+	if (req->type == PortBatch && req->x.port_batch.count) {
+		for (n = 0; n < req->x.port_batch.count; ++n) {
+			status[n] = req->x.port_batch.ops[n].status;
+			ids[n] = req->x.port_batch.ops[n].port_id;
+		}
+		extra[nextra].iov_base = status;
+		extra[nextra++].iov_len = req->x.port_batch.count * sizeof(int32_t);
+		extra[nextra].iov_base = ids;
+		extra[nextra++].iov_len = req->x.port_batch.count * sizeof(jack_port_id_t);
+	} else if (req->type == ConnectBatch && req->x.connect_batch.count) {
+		for (n = 0; n < req->x.connect_batch.count; ++n) {
+			status[n] = req->x.connect_batch.ops[n].status;
+		}
+		extra[nextra].iov_base = status;
+		extra[nextra++].iov_len = req->x.connect_batch.count * sizeof(int32_t);
+	}
+
+	if (jack_request_send (reply_fd, req, extra, nextra)) {
+		jack_error ("cannot write request result to client");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+free_request_data (jack_request_t *req)
+{
+	switch (req->type) {
+	case PropertyChangeNotify:
+	case PropertyRemove:
+		free ((char*)req->x.property.key);
+		break;
+	case PropertySet:
+		free ((char*)req->x.property_set.key);
+		free ((char*)req->x.property_set.value);
+		free ((char*)req->x.property_set.type);
+		break;
+	case ConnectBatch:
+		free (req->x.connect_batch.ops);
+		break;
+	case PortBatch:
+		free (req->x.port_batch.ops);
+		break;
+	case PropertyBatch:
+		free ((char*)req->x.property_batch.data);
+		break;
+	default:
+		break;
+	}
+}
+
+static int
+handle_external_client_request (jack_engine_t *engine, int fd)
+{
+	/* CALLER holds read lock on graph */
+
+	jack_request_t req;
+	jack_client_internal_t *client = 0;
+	int reply_fd;
+	JSList *node;
+	ssize_t r;
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		if (((jack_client_internal_t*)node->data)->request_fd == fd) {
+			client = (jack_client_internal_t*)node->data;
+			break;
+		}
+	}
+
+	if (client == NULL) {
+		jack_error ("client input on unknown fd %d!", fd);
+		return -1;
+	}
+
+	if ((r = jack_request_recv (client->request_fd, &req)) <= 0) {
+		if (r == 0) {
+#ifdef JACK_USE_MACH_THREADS
+			/* poll is implemented using
+			   select (see the macosx/fakepoll
+			   code). When the socket is closed
+			   select does not return any error,
+			   POLLIN is true and the next read
+			   will return 0 bytes. This
+			   behaviour is diffrent from the
+			   Linux poll behaviour. Thus we use
+			   this condition as a socket error
+			   and remove the client.
+			 */
+			jack_mark_client_socket_error (engine, fd);
+#endif                  /* JACK_USE_MACH_THREADS */
+			return 1;
+		} else {
+			jack_error ("cannot read request from client (%s)",
+				    strerror (errno));
+			// XXX: shouldnt we mark this client as error now ?
+
+			return -1;
+		}
+	}
+
+	if (read_request_data (client, &req)) {
+		return -1;
+	}
+
+	if (engine->query_pool && jack_request_is_query (req.type)) {
+		return jack_query_pool_queue (engine, client, &req);
+	}
+
+	reply_fd = client->request_fd;
+
+	jack_unlock_graph (engine);
+	do_request (engine, &req, &reply_fd);
+	jack_lock_graph (engine);
+
+	if (reply_fd >= 0) {
+		DEBUG ("replying to client");
+		if (write_reply (reply_fd, &req)) {
+			free_request_data (&req);
+			return -1;
+		}
+	} else {
+		DEBUG ("*not* replying to client");
+	}
+
+	free_request_data (&req);
+
+	return 0;
+}
+
+static int
+handle_client_ack_connection (jack_engine_t *engine, int client_fd)
+{
+	jack_client_internal_t *client;
+	jack_client_connect_ack_request_t req;
+	jack_client_connect_ack_result_t res;
+
+	if (read (client_fd, &req, sizeof(req)) != sizeof(req)) {
+		jack_error ("cannot read ACK connection request from client");
+		return -1;
+	}
+
+	if ((client = jack_client_internal_by_id (engine, req.client_id))
+	    == NULL) {
+		jack_error ("unknown client ID in ACK connection request");
+		return -1;
+	}
+
+	client->event_fd = client_fd;
+	VERBOSE (engine, "new client %s using %d for events", client->control->name,
+		 client->event_fd);
+
+	res.status = 0;
+
+	if (write (client->event_fd, &res, sizeof(res)) != sizeof(res)) {
+		jack_error ("cannot write ACK connection response to client");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* Fills in engine->pfd with the server sockets and the cleanup FIFO
+ * in its first fixed_fd_cnt entries, followed by the client request
+ * sockets, and waits for any of them.
+ */
+static int
+jack_server_poll_wait (jack_engine_t *engine, int fixed_fd_cnt)
+{
+	JSList* node;
+	int clients;
+
+	jack_rdlock_graph (engine);
+
+	clients = jack_slist_length (engine->clients);
+
+	if (engine->pfd_size < fixed_fd_cnt + clients) {
+		if (engine->pfd) {
+			free (engine->pfd);
+		}
+
+		engine->pfd = (struct pollfd*)malloc (sizeof(struct pollfd) *
+						      (fixed_fd_cnt + clients));
+
+		if (engine->pfd == NULL) {
+			/*
+			 * this can happen if limits.conf was changed
+			 * but the user hasn't logged out and back in yet
+			 */
+			if (errno == EAGAIN) {
+				jack_error ("malloc failed (%s) - make"
+					    "sure you log out and back"
+					    "in after changing limits"
+					    ".conf!", strerror (errno));
+			} else {
+				jack_error ("malloc failed (%s)", strerror (errno));
+			}
+
+			engine->pfd_size = 0;
+			engine->pfd_max = 0;
+			jack_unlock_graph (engine);
+			errno = ENOMEM;
+			return -1;
+		}
+
+		engine->pfd_size = fixed_fd_cnt + clients;
+	}
+
+	engine->pfd[0].fd = engine->fds[0];
+	engine->pfd[0].events = POLLIN | POLLERR;
+	engine->pfd[1].fd = engine->fds[1];
+	engine->pfd[1].events = POLLIN | POLLERR;
+	engine->pfd[2].fd = engine->cleanup_fifo[0];
+	engine->pfd[2].events = POLLIN | POLLERR;
+	engine->pfd_max = fixed_fd_cnt;
+
+	for (node = engine->clients; node; node = node->next) {
+
+		jack_client_internal_t* client = (jack_client_internal_t*)(node->data);
+
+		if (client->request_fd < 0 || client->error >= JACK_ERROR_WITH_SOCKETS) {
+			continue;
+		}
+		if ( client->control->dead ) {
+			engine->pfd[engine->pfd_max].fd = client->request_fd;
+			engine->pfd[engine->pfd_max].events = POLLHUP | POLLNVAL;
+			engine->pfd_max++;
+			continue;
+		}
+		engine->pfd[engine->pfd_max].fd = client->request_fd;
+		engine->pfd[engine->pfd_max].events = POLLIN | POLLPRI | POLLERR | POLLHUP | POLLNVAL;
+		engine->pfd_max++;
+	}
+
+	jack_unlock_graph (engine);
+
+	VERBOSE (engine, "start poll on %d fd's", engine->pfd_max);
+
+	if (poll (engine->pfd, engine->pfd_max, -1) < 0) {
+		if (errno != EINTR) {
+			jack_error ("poll failed (%s)", strerror (errno));
+		}
+		return -1;
+	}
+
+	return 0;
+}
+
+#ifdef JACK_USE_EPOLL
+
+/* With epoll, client request sockets are registered once, when the
+ * client connects, and closing them takes them out of the set again.
+ * Each wakeup then only costs as much as the number of sockets that
+ * are actually ready, instead of the number of clients.
+ */
+
+#define JACK_SERVER_EPOLL_EVENTS 64
+
+static int
+jack_server_epoll_add (jack_engine_t *engine, int fd, uint32_t events)
+{
+	struct epoll_event ev;
+
+	memset (&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.fd = fd;
+
+	if (epoll_ctl (engine->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		jack_error ("cannot add fd %d to the server's epoll set (%s)",
+			    fd, strerror (errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+jack_server_epoll_init (jack_engine_t *engine)
+{
+	JSList *node;
+
+	if ((engine->epoll_fd = epoll_create1 (EPOLL_CLOEXEC)) < 0) {
+		jack_error ("cannot create epoll set (%s), using poll",
+			    strerror (errno));
+		return;
+	}
+
+	if (jack_server_epoll_add (engine, engine->fds[0], EPOLLIN)
+	    || jack_server_epoll_add (engine, engine->fds[1], EPOLLIN)
+	    || jack_server_epoll_add (engine, engine->cleanup_fifo[0], EPOLLIN)) {
+		close (engine->epoll_fd);
+		engine->epoll_fd = -1;
+		return;
+	}
+
+	jack_rdlock_graph (engine);
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_engine_watch_client (engine, (jack_client_internal_t*)node->data);
+	}
+	jack_unlock_graph (engine);
+
+	VERBOSE (engine, "server thread uses epoll");
+}
+
+static short
+jack_epoll_revents (uint32_t events)
+{
+	short revents = 0;
+
+	if (events & EPOLLIN) {
+		revents |= POLLIN;
+	}
+	if (events & EPOLLPRI) {
+		revents |= POLLPRI;
+	}
+	if (events & EPOLLERR) {
+		revents |= POLLERR;
+	}
+	if (events & EPOLLHUP) {
+		revents |= POLLHUP;
+	}
+
+	return revents;
+}
+
+/* Same contract as jack_server_poll_wait(), except that only client
+ * sockets with something to report are put in engine->pfd.
+ */
+static int
+jack_server_epoll_wait (jack_engine_t *engine, int fixed_fd_cnt)
+{
+	struct epoll_event ev[JACK_SERVER_EPOLL_EVENTS];
+	jack_client_internal_t *client;
+	JSList *node;
+	short revents;
+	int n, i, fd;
+
+	if (engine->pfd_size < fixed_fd_cnt + JACK_SERVER_EPOLL_EVENTS) {
+		free (engine->pfd);
+		engine->pfd_size = fixed_fd_cnt + JACK_SERVER_EPOLL_EVENTS;
+		engine->pfd = (struct pollfd*)calloc (engine->pfd_size, sizeof(struct pollfd));
+		if (engine->pfd == NULL) {
+			jack_error ("malloc failed (%s)", strerror (errno));
+			engine->pfd_size = 0;
+			engine->pfd_max = 0;
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+
+	engine->pfd[0].fd = engine->fds[0];
+	engine->pfd[1].fd = engine->fds[1];
+	engine->pfd[2].fd = engine->cleanup_fifo[0];
+	for (i = 0; i < fixed_fd_cnt; ++i) {
+		engine->pfd[i].revents = 0;
+	}
+	engine->pfd_max = fixed_fd_cnt;
+
+	if ((n = epoll_wait (engine->epoll_fd, ev, JACK_SERVER_EPOLL_EVENTS, -1)) < 0) {
+		if (errno != EINTR) {
+			jack_error ("epoll_wait failed (%s)", strerror (errno));
+		}
+		return -1;
+	}
+
+	jack_rdlock_graph (engine);
+
+	for (i = 0; i < n; ++i) {
+
+		fd = ev[i].data.fd;
+		revents = jack_epoll_revents (ev[i].events);
+
+		if (fd == engine->fds[0]) {
+			engine->pfd[0].revents = revents;
+			continue;
+		} else if (fd == engine->fds[1]) {
+			engine->pfd[1].revents = revents;
+			continue;
+		} else if (fd == engine->cleanup_fifo[0]) {
+			engine->pfd[2].revents = revents;
+			continue;
+		}
+
+		client = NULL;
+		for (node = engine->clients; node; node = jack_slist_next (node)) {
+			if (((jack_client_internal_t*)node->data)->request_fd == fd) {
+				client = (jack_client_internal_t*)node->data;
+				break;
+			}
+		}
+
+		/* stop listening to clients that went away or that
+		   we gave up on, as the poll loop does */
+
+		if (client == NULL || client->error >= JACK_ERROR_WITH_SOCKETS) {
+			epoll_ctl (engine->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+			continue;
+		}
+
+		/* and only listen for hangups from dead ones */
+
+		if (client->control->dead && !(revents & ~POLLIN)) {
+			struct epoll_event hup;
+			memset (&hup, 0, sizeof(hup));
+			hup.data.fd = fd;
+			epoll_ctl (engine->epoll_fd, EPOLL_CTL_MOD, fd, &hup);
+			continue;
+		}
+
+		engine->pfd[engine->pfd_max].fd = fd;
+		engine->pfd[engine->pfd_max].revents = revents;
+		engine->pfd_max++;
+	}
+
+	jack_unlock_graph (engine);
+
+	return 0;
+}
+
+#endif /* JACK_USE_EPOLL */
+
+void
+jack_engine_watch_client (jack_engine_t *engine, jack_client_internal_t *client)
+{
+#ifdef JACK_USE_EPOLL
+	if (engine->epoll_fd >= 0 && client->request_fd >= 0) {
+		jack_server_epoll_add (engine, client->request_fd, EPOLLIN | EPOLLPRI);
+	}
+#endif
+}
+
+static int
+jack_server_wait (jack_engine_t *engine, int fixed_fd_cnt)
+{
+#ifdef JACK_USE_EPOLL
+	if (engine->epoll_fd >= 0) {
+		return jack_server_epoll_wait (engine, fixed_fd_cnt);
+	}
+#endif
+	return jack_server_poll_wait (engine, fixed_fd_cnt);
+}
+
+/* --standby: the first client to connect has jackd start the driver,
+ * while the server thread carries on with its connection; the
+ * result is only sent once the driver is running.
+ */
+static void
+jack_engine_standby_wake (jack_engine_t *engine)
+{
+	pthread_mutex_lock (&engine->standby_lock);
+	if (engine->standby_state == JACK_STANDBY_WAITING) {
+		engine->standby_state = JACK_STANDBY_STARTING;
+		pthread_mutex_unlock (&engine->standby_lock);
+		VERBOSE (engine, "first client, starting the driver");
+		standby_start (engine);
+		return;
+	}
+	pthread_mutex_unlock (&engine->standby_lock);
+}
+
+void
+jack_engine_standby_wait (jack_engine_t *engine)
+{
+	pthread_mutex_lock (&engine->standby_lock);
+	while (engine->standby_state == JACK_STANDBY_STARTING) {
+		pthread_cond_wait (&engine->standby_cond, &engine->standby_lock);
+	}
+	pthread_mutex_unlock (&engine->standby_lock);
+}
+
+/* Called by standby_start's thread once the driver is running, or
+ * has failed to start and the server is going down. */
+void
+jack_engine_standby_done (jack_engine_t *engine)
+{
+	pthread_mutex_lock (&engine->standby_lock);
+	engine->standby_state = JACK_STANDBY_OFF;
+	pthread_cond_broadcast (&engine->standby_cond);
+	pthread_mutex_unlock (&engine->standby_lock);
+}
+
+static void *
+jack_server_thread (void *arg)
+
+{
+	jack_engine_t *engine = (jack_engine_t*)arg;
+	struct sockaddr_un client_addr;
+	socklen_t client_addrlen;
+	int problemsProblemsPROBLEMS = 0;
+	int client_socket;
+	int done = 0;
+	int i, ret;
+	const int fixed_fd_cnt = 3;
+	int stop_freewheeling;
+	jack_time_t connect_start;
+
+	jack_thread_set_cpus (pthread_self (), server_cpus);
+
+#ifdef JACK_USE_EPOLL
+	jack_server_epoll_init (engine);
+#endif
+
+	while (!done) {
+
+		/* go to sleep for a long, long time, or until a request
+		   arrives, or until a communication channel is broken
+		 */
+
+		if (jack_server_wait (engine, fixed_fd_cnt) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+
+		VERBOSE (engine, "server thread back from poll");
+
+		/* Stephane Letz: letz@grame.fr : has to be added
+		 * otherwise pthread_cancel() does not work on MacOSX */
+		pthread_testcancel ();
+
+
+		/* empty cleanup FIFO if necessary */
+
+		if (engine->pfd[2].revents & ~POLLIN) {
+			/* time to die */
+			break;
+		}
+
+		if (engine->pfd[2].revents & POLLIN) {
+			char c;
+			while (read (engine->cleanup_fifo[0], &c, 1) == 1) ;
+		}
+
+		/* check each client socket before handling other request*/
+
+		jack_rdlock_graph (engine);
+
+		for (i = fixed_fd_cnt; i < engine->pfd_max; i++) {
+
+			if (engine->pfd[i].fd < 0) {
+				continue;
+			}
+
+			if (engine->pfd[i].revents & ~POLLIN) {
+
+				jack_mark_client_socket_error (engine, engine->pfd[i].fd);
+				jack_engine_signal_problems (engine);
+				VERBOSE (engine, "non-POLLIN events on fd %d", engine->pfd[i].fd);
+			} else if (engine->pfd[i].revents & POLLIN) {
+
+				if (handle_external_client_request (engine, engine->pfd[i].fd)) {
+					jack_error ("could not handle external"
+						    " client request");
+					jack_engine_signal_problems (engine);
+				}
+			}
+		}
+
+		jack_transport_sync_prepare (engine);
+
+		problemsProblemsPROBLEMS = engine->problems;
+
+		jack_unlock_graph (engine);
+
+		/* need to take write lock since we may/will rip out some clients,
+		   and reset engine->problems
+		 */
+
+		stop_freewheeling = 0;
+
+		while (problemsProblemsPROBLEMS) {
+
+			VERBOSE (engine, "trying to lock graph to remove %d problems", problemsProblemsPROBLEMS);
+			jack_lock_graph (engine);
+			VERBOSE (engine, "we have problem clients (problems = %d", problemsProblemsPROBLEMS);
+			jack_remove_clients (engine, &stop_freewheeling);
+			if (stop_freewheeling) {
+				VERBOSE (engine, "need to stop freewheeling once problems are cleared");
+			}
+			jack_unlock_graph (engine);
+
+			jack_lock_problems (engine);
+			engine->problems -= problemsProblemsPROBLEMS;
+			problemsProblemsPROBLEMS = engine->problems;
+			jack_unlock_problems (engine);
+
+			VERBOSE (engine, "after removing clients, problems = %d", problemsProblemsPROBLEMS);
+		}
+
+		if (engine->freewheeling && (stop_freewheeling || engine->freewheel_done)) {
+			/* it may resize the port segments */
+			pthread_mutex_lock (&engine->request_lock);
+			jack_stop_freewheeling (engine, 0);
+			pthread_mutex_unlock (&engine->request_lock);
+		}
+
+		if (engine->failed_driver) {
+			jack_driver_retire_failed (engine);
+		}
+
+		/* check the master server socket */
+
+		if (engine->pfd[0].revents & POLLERR) {
+			jack_error ("error on server socket");
+			break;
+		}
+
+		if (engine->control->engine_ok && engine->pfd[0].revents & POLLIN) {
+			DEBUG ("pfd[0].revents & POLLIN");
+
+			memset (&client_addr, 0, sizeof(client_addr));
+			client_addrlen = sizeof(client_addr);
+
+			jack_engine_standby_wake (engine);
+			connect_start = jack_get_microseconds ();
+
+			if ((client_socket =
+				     accept (engine->fds[0],
+					     (struct sockaddr*)&client_addr,
+					     &client_addrlen)) < 0) {
+				jack_error ("cannot accept new connection (%s)",
+					    strerror (errno));
+			} else if (!engine->new_clients_allowed
+				   || (ret = jack_client_create (engine, client_socket)) < 0) {
+				jack_error ("cannot complete client "
+					    "connection process");
+				close (client_socket);
+			} else if (ret == 0) {
+				engine->client_connects++;
+				engine->client_connect_usecs += jack_get_microseconds () - connect_start;
+			}
+		}
+
+		/* check the ACK server socket */
+
+		if (engine->pfd[1].revents & POLLERR) {
+			jack_error ("error on server ACK socket");
+			break;
+		}
+
+		if (engine->control->engine_ok && engine->pfd[1].revents & POLLIN) {
+			DEBUG ("pfd[1].revents & POLLIN");
+
+			memset (&client_addr, 0, sizeof(client_addr));
+			client_addrlen = sizeof(client_addr);
+
+			if ((client_socket =
+				     accept (engine->fds[1],
+					     (struct sockaddr*)&client_addr,
+					     &client_addrlen)) < 0) {
+				jack_error ("cannot accept new ACK connection"
+					    " (%s)", strerror (errno));
+			} else if (handle_client_ack_connection
+					   (engine, client_socket)) {
+				jack_error ("cannot complete client ACK "
+					    "connection process");
+				close (client_socket);
+			}
+		}
+	}
+
+	return 0;
+}
+
+jack_engine_t *
+jack_engine_new (int realtime, int rtpriority, int do_mlock, int do_unlock,
+		 const char *server_name, int temporary, int verbose,
+		 int client_timeout, unsigned int port_max, pid_t wait_pid,
+		 jack_nframes_t frame_time_offset, int nozombies, int timeout_count_threshold, JSList *drivers)
+{
+	jack_engine_t *engine;
+	unsigned int i;
+	uint32_t port_hash_size;
+	char server_dir[PATH_MAX + 1] = "";
+
+#ifdef USE_CAPABILITIES
+	uid_t uid = getuid ();
+	uid_t euid = geteuid ();
+#endif  /* USE_CAPABILITIES */
+
+	/* before we start allocating resources, make sure that if realtime was requested that we can
+	   actually do it.
+	 */
+
+	if (realtime) {
+		if (jack_acquire_real_time_scheduling (pthread_self (), 10) != 0) {
+			/* can't run realtime - time to bomb */
+			return NULL;
+		}
+
+		jack_drop_real_time_scheduling (pthread_self ());
+
+#ifdef USE_MLOCK
+
+		if (do_mlock == JACK_MLOCK_SELECTIVE) {
+			jack_mlock_mode = JACK_MLOCK_SELECTIVE;
+		} else if (do_mlock && (mlockall (MCL_CURRENT | MCL_FUTURE) != 0)) {
+			jack_error ("cannot lock down memory for jackd (%s)",
+				    strerror (errno));
+#ifdef ENSURE_MLOCK
+			return NULL;
+#endif  /* ENSURE_MLOCK */
+		}
+#endif  /* USE_MLOCK */
+	}
+
+	/* start a thread to display messages from realtime threads */
+	jack_messagebuffer_init ();
+
+	jack_init_time ();
+
+	/* allocate the engine, zero the structure to ease debugging */
+	engine = (jack_engine_t*)calloc (1, sizeof(jack_engine_t));
+
+	engine->drivers = drivers;
+	engine->driver = NULL;
+	engine->driver_desc = NULL;
+	engine->driver_params = NULL;
+
+	engine->slave_drivers = NULL;
+	engine->backup_driver = NULL;
+	engine->retired_drivers = NULL;
+	engine->failed_driver = NULL;
+	engine->clock_domains = NULL;
+	engine->domain_starting = NULL;
+	engine->domain_attach = 0;
+	pthread_mutex_init (&engine->backup_lock, 0);
+	engine->metrics_fd = -1;
+
+	engine->set_sample_rate = jack_set_sample_rate;
+	engine->set_buffer_size = jack_driver_buffer_size;
+	engine->run_cycle = jack_run_cycle;
+	engine->delay = jack_engine_delay;
+	engine->driver_exit = jack_engine_driver_exit;
+	engine->transport_cycle_start = jack_transport_cycle_start;
+	engine->client_timeout_msecs = client_timeout;
+	engine->timeout_count = 0;
+	engine->problems = 0;
+
+	engine->port_max = port_max;
+	engine->server_thread = 0;
+	engine->rtpriority = rtpriority;
+	engine->silent_buffer = 0;
+	engine->verbose = verbose;
+	engine->server_name = server_name;
+	engine->temporary = temporary;
+	engine->freewheeling = 0;
+	engine->stop_freewheeling = 0;
+	engine->freewheel_bounded = 0;
+	engine->freewheel_done = 0;
+	engine->freewheel_nframes = 0;
+	engine->freewheel_saved_nframes = 0;
+	jack_uuid_clear (&engine->fwclient);
+	engine->feedbackcount = 0;
+	engine->graph_batch = 0;
+	engine->graph_sort_pending = 0;
+	engine->event_batch = 0;
+	engine->reach = NULL;
+	engine->reach_size = 0;
+	engine->reach_valid = FALSE;
+	engine->latency_all_dirty = TRUE;
+	engine->wait_pid = wait_pid;
+	engine->nozombies = nozombies;
+	engine->timeout_count_threshold = timeout_count_threshold;
+	engine->removing_clients = 0;
+	engine->new_clients_allowed = 1;
+
+	engine->session_reply_fd = -1;
+	engine->session_pending_replies = 0;
+
+	engine->audio_out_cnt = 0;
+	engine->audio_in_cnt = 0;
+	engine->midi_out_cnt = 0;
+	engine->midi_in_cnt = 0;
+
+	jack_engine_reset_rolling_usecs (engine);
+	engine->max_usecs = 0.0f;
+
+	pthread_rwlock_init (&engine->client_lock, 0);
+	pthread_mutex_init (&engine->port_lock, 0);
+	pthread_mutex_init (&engine->request_lock, 0);
+	pthread_mutex_init (&engine->standby_lock, 0);
+	pthread_cond_init (&engine->standby_cond, 0);
+	engine->standby_state = standby_start ? JACK_STANDBY_WAITING
+				: JACK_STANDBY_OFF;
+	pthread_mutex_init (&engine->problem_lock, 0);
+
+	engine->clients = 0;
+	engine->reserved_client_names = 0;
+	memset (engine->client_by_name, 0, sizeof(engine->client_by_name));
+	memset (engine->client_by_uuid, 0, sizeof(engine->client_by_uuid));
+	memset (engine->reserved_by_name, 0, sizeof(engine->reserved_by_name));
+
+	engine->pfd_size = 0;
+	engine->pfd_max = 0;
+	engine->pfd = 0;
+	engine->epoll_fd = -1;
+	engine->client_connects = 0;
+	engine->client_connect_usecs = 0;
+	engine->client_removals = 0;
+	engine->client_removal_usecs = 0;
+
+	engine->fifo_size = 16;
+	engine->fifo = (int*)malloc (sizeof(int) * engine->fifo_size);
+	for (i = 0; i < engine->fifo_size; i++)
+		engine->fifo[i] = -1;
+
+	if (pipe (engine->cleanup_fifo)) {
+		jack_error ("cannot create cleanup FIFOs (%s)", strerror (errno));
+		return NULL;
+	}
+
+	if (fcntl (engine->cleanup_fifo[0], F_SETFL, O_NONBLOCK)) {
+		jack_error ("cannot set O_NONBLOCK on cleanup read FIFO (%s)", strerror (errno));
+		return NULL;
+	}
+
+	if (fcntl (engine->cleanup_fifo[1], F_SETFL, O_NONBLOCK)) {
+		jack_error ("cannot set O_NONBLOCK on cleanup write FIFO (%s)", strerror (errno));
+		return NULL;
+	}
+
+	if (pipe (engine->supervisor_fifo)) {
+		jack_error ("cannot create supervisor FIFOs (%s)", strerror (errno));
+		return NULL;
+	}
+
+	if (fcntl (engine->supervisor_fifo[0], F_SETFL, O_NONBLOCK)
+	    || fcntl (engine->supervisor_fifo[1], F_SETFL, O_NONBLOCK)) {
+		jack_error ("cannot set O_NONBLOCK on supervisor FIFOs (%s)", strerror (errno));
+		return NULL;
+	}
+
+	engine->external_client_cnt = 0;
+
+	srandom (time ((time_t*)0));
+
+	/* keep the name index at most half full */
+	for (port_hash_size = 16; port_hash_size < 2 * engine->port_max;
+	     port_hash_size <<= 1) ;
+
+	if (jack_shmalloc (sizeof(jack_control_t)
+			   + ((sizeof(jack_port_shared_t) * engine->port_max))
+			   + ((sizeof(jack_port_id_t) * port_hash_size))
+			   + ((sizeof(jack_port_id_t) * engine->port_max))
+			   + jack_port_columns_size (engine->port_max)
+			   + jack_port_connections_size (engine->port_max),
+			   &engine->control_shm)) {
+		jack_error ("cannot create engine control shared memory "
+			    "segment (%s)", strerror (errno));
+		return NULL;
+	}
+
+	if (jack_attach_shm (&engine->control_shm)) {
+		jack_error ("cannot attach to engine control shared memory"
+			    " (%s)", strerror (errno));
+		jack_destroy_shm (&engine->control_shm);
+		return NULL;
+	}
+
+	engine->control = (jack_control_t*)
+			  jack_shm_addr (&engine->control_shm);
+	jack_mlock_rt_shm (&engine->control_shm, "engine control memory");
+
+	/* Setup port type information from builtins. buffer space is
+	 * allocated when the driver calls jack_driver_buffer_size().
+	 */
+	for (i = 0; jack_builtin_port_types[i].type_name[0]; ++i) {
+
+		memcpy (&engine->control->port_types[i],
+			&jack_builtin_port_types[i],
+			sizeof(jack_port_type_info_t));
+
+		VERBOSE (engine, "registered builtin port type %s",
+			 engine->control->port_types[i].type_name);
+
+		jack_port_type_init (engine, i);
+	}
+
+	engine->control->n_port_types = i;
+
+	/* No port has been used yet. Entries are set up as
+	 * jack_get_free_port() first hands them out, so the pages of a
+	 * large port table that are never needed are never touched.
+	 */
+
+	engine->control->port_high = 0;
+	engine->port_free = (jack_port_id_t*)
+			    malloc (sizeof(jack_port_id_t) * engine->port_max);
+	engine->port_free_cnt = 0;
+
+	/* allocate internal port structures so that we can keep track
+	 * of port connections.
+	 */
+	engine->internal_ports = (jack_port_internal_t*)
+				 calloc (engine->port_max, sizeof(jack_port_internal_t));
+
+	engine->control->port_max = engine->port_max;
+	engine->control->port_hash_size = port_hash_size;
+	memset (jack_port_hash_table (engine->control), 0xff,
+		sizeof(jack_port_id_t) * port_hash_size);
+	engine->port_hash_used = 0;
+	engine->control->port_sorted_cnt = 0;
+	engine->control->port_sorted_seq = 0;
+	memset (jack_port_in_use_map (engine->control), 0,
+		sizeof(uint64_t) * JACK_PORT_MAP_WORDS (engine->port_max));
+	memset (jack_port_connection_map (engine->control, 0), 0,
+		sizeof(uint64_t) * JACK_PORT_MAP_WORDS (engine->port_max)
+		* engine->port_max);
+	engine->port_hash_slot = (int*)malloc (sizeof(int) * engine->port_max);
+
+	for (i = 0; i < engine->port_max; i++)
+		engine->port_hash_slot[i] = -1;
+
+	if (make_sockets (engine->server_name, engine->fds) < 0) {
+		jack_error ("cannot create server sockets");
+		return NULL;
+	}
+
+	engine->control->real_time = realtime;
+
+	/* leave some headroom for other client threads to run
+	   with priority higher than the regular client threads
+	   but less than the server. see thread.h for
+	   jack_client_real_time_priority() and jack_client_max_real_time_priority()
+	   which are affected by this.
+	 */
+
+	engine->control->client_priority = (realtime
+					    ? engine->rtpriority - 5
+					    : 0);
+	engine->control->max_client_priority = (realtime
+						? engine->rtpriority - 1
+						: 0);
+	engine->control->do_mlock = do_mlock;
+	engine->control->do_munlock = do_unlock;
+	engine->control->cpu_load = 0;
+	engine->control->xrun_delayed_usecs = 0;
+	engine->control->max_delayed_usecs = 0;
+
+	if (clock_source == JACK_TIMER_CYCLE_COUNTER
+	    && jack_cycles_calibrate (&engine->control->cycles_calibration)) {
+		jack_error ("cannot use the cycle counter as a clock, "
+			    "using the system clock instead");
+		clock_source = JACK_TIMER_SYSTEM_CLOCK;
+	}
+	jack_set_cycles_calibration (&engine->control->cycles_calibration);
+	jack_set_clock_source (clock_source);
+	engine->control->clock_source = clock_source;
+	engine->get_microseconds = jack_get_microseconds_pointer ();
+
+	VERBOSE (engine, "clock source = %s", jack_clock_source_name (clock_source));
+
+	if (wakeup_method == JACK_WAKEUP_FUTEX && !jack_wakeup_supported ()) {
+		jack_error ("futex wakeups are not supported on this "
+			    "platform, using FIFOs");
+		wakeup_method = JACK_WAKEUP_FIFO;
+	}
+	engine->control->wakeup_method = wakeup_method;
+	for (i = 0; i < JACK_GRAPH_WAKEUPS; ++i) {
+		engine->control->graph_wakeup[i] = 0;
+	}
+
+	VERBOSE (engine, "graph wakeups = %s", jack_wakeup_method_name (wakeup_method));
+
+	jack_cycle_trace_init (engine);
+	jack_port_meters_init (engine);
+	jack_async_history_init (engine);
+
+	if (metrics_address && jack_metrics_start (engine, metrics_address)) {
+		jack_error ("cannot start the metrics service, continuing without");
+	}
+	if (xrun_dump_dir && jack_xrun_dump_init (engine, xrun_dump_dir)) {
+		jack_error ("cannot record xruns, continuing without");
+	}
+	if (record_path && jack_capture_init (engine, record_path)) {
+		jack_error ("cannot record the capture, continuing without");
+	}
+	if (buffer_governor && jack_buffer_governor_init (engine, buffer_governor)) {
+		jack_error ("cannot govern the buffer size, continuing without");
+	}
+
+	if (jack_property_store_new (engine->server_name,
+				     &engine->control->property_shm_index)) {
+		jack_error ("cannot create the metadata store, clients "
+			    "will use the metadata DB");
+	}
+
+	engine->control->frame_timer.frames = frame_time_offset;
+	engine->control->frame_timer.reset_pending = 0;
+	engine->control->frame_timer.current_wakeup = 0;
+	engine->control->frame_timer.next_wakeup = 0;
+	engine->control->frame_timer.initialized = 0;
+	engine->control->frame_timer.filter_omega = 0;  /* Initialised later */
+	engine->control->frame_timer.period_usecs = 0;  /* Initialised later */
+
+	engine->first_wakeup = 1;
+
+	engine->control->buffer_size = 0;
+	engine->control->max_buffer_size = max_buffer_size;
+	jack_transport_init (engine);
+	jack_set_sample_rate (engine, 0);
+	engine->control->internal = 0;
+
+	engine->control->has_capabilities = 0;
+
+	/* realtime threads started in the server, for the driver and
+	   backends, go on rt_cpus, or else near the port segments */
+	jack_engine_numa_init (engine);
+	jack_set_realtime_cpus ((rt_cpus && *rt_cpus) ? rt_cpus : engine->numa_cpus);
+	snprintf (engine->control->client_cpus,
+		  sizeof(engine->control->client_cpus), "%s",
+		  (client_cpus && *client_cpus) ? client_cpus : engine->numa_cpus);
+	engine->control->deadline = realtime && use_deadline;
+	engine->control->perf_counters = use_perf_counters;
+	memset (&engine->deadline, 0, sizeof(engine->deadline));
+
+#ifdef JACK_USE_MACH_THREADS
+	/* specific resources for server/client real-time thread
+	 * communication */
+	engine->servertask = mach_task_self ();
+	if (task_get_bootstrap_port (engine->servertask, &engine->bp)) {
+		jack_error ("Jackd: Can't find bootstrap mach port");
+		return NULL;
+	}
+	engine->portnum = 0;
+#endif  /* JACK_USE_MACH_THREADS */
+
+
+#ifdef USE_CAPABILITIES
+	if (uid == 0 || euid == 0) {
+		VERBOSE (engine, "running with uid=%d and euid=%d, "
+			 "will not try to use capabilites",
+			 uid, euid);
+	} else {
+		/* only try to use capabilities if not running as root */
+		engine->control->has_capabilities = check_capabilities (engine);
+		if (engine->control->has_capabilities == 0) {
+			VERBOSE (engine, "required capabilities not "
+				 "available");
+		}
+		if (engine->verbose) {
+			size_t size;
+			cap_t cap = cap_init ();
+			capgetp (0, cap);
+			VERBOSE (engine, "capabilities: %s",
+				 cap_to_text (cap, &size));
+		}
+	}
+#endif  /* USE_CAPABILITIES */
+
+	engine->control->engine_ok = 1;
+
+	snprintf (engine->fifo_prefix, sizeof(engine->fifo_prefix),
+		  "%s/jack-ack-fifo-%d",
+		  jack_server_dir (engine->server_name, server_dir), getpid ());
+
+	(void)jack_get_fifo_fd (engine, 0);
+
+	if (dag_threads > 0) {
+		if (jack_dag_init (engine, dag_threads)) {
+			jack_error ("cannot start parallel graph execution");
+		}
+	}
+
+	if (jack_query_pool_init (engine, JACK_QUERY_THREADS)) {
+		jack_error ("cannot start query threads, the server thread "
+			    "will answer queries itself");
+	}
+
+	if (jack_shm_requests_init (engine)) {
+		jack_error ("cannot start shared memory request thread, "
+			    "clients will use their sockets");
+	}
+
+	jack_graph_snapshot_publish (engine);
+
+	jack_client_create_thread (NULL, &engine->server_thread, 0, FALSE,
+				   &jack_server_thread, engine);
+	jack_client_create_thread (NULL, &engine->supervisor_thread, 0, FALSE,
+				   &jack_supervisor_thread, engine);
+
+	return engine;
+}
+
+static void
+jack_engine_delay (jack_engine_t *engine, float delayed_usecs)
+{
+	jack_engine_xrun (engine, delayed_usecs, JACK_XRUN_DRIVER);
+}
+
+static void
+jack_engine_xrun (jack_engine_t *engine, float delayed_usecs,
+		  jack_xrun_cause_t cause)
+{
+	jack_event_t event;
+
+	engine->xruns[cause]++;
+	if (engine->xrun_dump) {
+		jack_xrun_dump_trigger (engine, cause, delayed_usecs);
+	}
+	engine->control->frame_timer.reset_pending = 1;
+
+	engine->control->xrun_delayed_usecs = delayed_usecs;
+	engine->trace_xrun = 1;
+
+	JACK_PROBE1 (xrun, (int64_t)delayed_usecs);
+
+	if (delayed_usecs > engine->control->max_delayed_usecs) {
+		engine->control->max_delayed_usecs = delayed_usecs;
+	}
+
+	event.type = XRun;
+
+	jack_deliver_event_to_all (engine, &event);
+}
+
+/* Whether a bounded freewheel has got to its end. The transport has to
+ * have been seen rolling inside the range first: the locate to its
+ * start takes a cycle or more.
+ */
+static int
+jack_freewheel_range_done (jack_engine_t *engine)
+{
+	jack_control_t *ectl = engine->control;
+	jack_nframes_t frame = ectl->current_time.frame;
+
+	if (ectl->transport_state != JackTransportRolling) {
+		return 0;
+	}
+
+	if (frame >= engine->freewheel_start && frame < engine->freewheel_end) {
+		engine->freewheel_in_range = 1;
+		return 0;
+	}
+
+	if (engine->freewheel_in_range && frame >= engine->freewheel_end) {
+		ectl->transport_cmd = TransportCommandStop;
+		return 1;
+	}
+
+	return 0;
+}
+
+static void*
+jack_engine_freewheel (void *arg)
+{
+	jack_engine_t* engine = (jack_engine_t*)arg;
+	jack_client_internal_t* client;
+
+	VERBOSE (engine, "freewheel thread starting ...");
+
+	/* we should not be running SCHED_FIFO, so we don't
+	   have to do anything about scheduling.
+	 */
+
+	client = jack_client_internal_by_id (engine, engine->fwclient);
+
+	while (!engine->stop_freewheeling) {
+
+		jack_run_one_cycle (engine, engine->control->buffer_size, 0.0f);
+
+		if (client && client->error) {
+			/* run one cycle() will already have told the server thread
+			   about issues, and the server thread will clean up.
+			   however, its time for us to depart this world ...
+			 */
+			break;
+		}
+
+		if (engine->freewheel_bounded && jack_freewheel_range_done (engine)) {
+			/* the server thread does the rest, as for a
+			   jack_set_freewheel (client, 0) */
+			VERBOSE (engine, "freewheel got to frame %" PRIu32,
+				 engine->freewheel_end);
+			engine->freewheel_done = 1;
+			jack_wake_server_thread (engine);
+			break;
+		}
+	}
+
+	VERBOSE (engine, "freewheel came to an end, naturally");
+	return 0;
+}
+
+/* Slave drivers that set parallel_io each get an I/O thread, which
+ * runs the driver's read or write while the engine thread runs those
+ * of the master and of the other slaves.  The engine thread waits for
+ * all of the reads before the clients run, and for all of the writes
+ * before the cycle ends.
+ */
+
+#define JACK_SLAVE_IO_READ  0
+#define JACK_SLAVE_IO_WRITE 1
+
+typedef struct _jack_slave_io_worker {
+	struct _jack_slave_io *io;
+	jack_driver_t *driver;
+	pthread_t thread;
+	unsigned int generation;        /* of the last phase it ran */
+} jack_slave_io_worker_t;
+
+struct _jack_slave_io {
+	pthread_mutex_t lock;
+	pthread_cond_t work;            /* workers wait here */
+	pthread_cond_t done;            /* the engine thread waits here */
+	unsigned int generation;        /* bumped for each phase */
+	int phase;                      /* JACK_SLAVE_IO_* */
+	jack_nframes_t nframes;
+	unsigned int pending;           /* workers yet to finish the phase */
+	int stop;
+	unsigned int nworkers;
+	jack_slave_io_worker_t *workers;
+};
+
+static void *
+jack_slave_io_thread (void *arg)
+{
+	jack_slave_io_worker_t *worker = (jack_slave_io_worker_t*)arg;
+	struct _jack_slave_io *io = worker->io;
+	jack_driver_t *driver = worker->driver;
+	jack_nframes_t nframes;
+	int phase;
+
+	pthread_mutex_lock (&io->lock);
+
+	while (!io->stop) {
+
+		if (worker->generation == io->generation) {
+			pthread_cond_wait (&io->work, &io->lock);
+			continue;
+		}
+
+		worker->generation = io->generation;
+		phase = io->phase;
+		nframes = io->nframes;
+		pthread_mutex_unlock (&io->lock);
+
+		JACK_WORKGROUP_UPDATE (driver->engine->control);
+
+		if (phase == JACK_SLAVE_IO_READ) {
+			driver->read (driver, nframes);
+		} else {
+			driver->write (driver, nframes);
+		}
+
+		pthread_mutex_lock (&io->lock);
+		if (--io->pending == 0) {
+			pthread_cond_signal (&io->done);
+		}
+	}
+
+	pthread_mutex_unlock (&io->lock);
+
+	return NULL;
+}
+
+static void
+jack_slave_io_stop (jack_engine_t *engine)
+{
+	struct _jack_slave_io *io = engine->slave_io;
+	unsigned int i;
+
+	if (io == NULL) {
+		return;
+	}
+
+	engine->slave_io = NULL;
+
+	pthread_mutex_lock (&io->lock);
+	io->stop = 1;
+	pthread_cond_broadcast (&io->work);
+	pthread_mutex_unlock (&io->lock);
+
+	for (i = 0; i < io->nworkers; ++i) {
+		pthread_join (io->workers[i].thread, NULL);
+	}
+
+	pthread_cond_destroy (&io->done);
+	pthread_cond_destroy (&io->work);
+	pthread_mutex_destroy (&io->lock);
+	free (io->workers);
+	free (io);
+}
+
+static void
+jack_slave_io_start (jack_engine_t *engine)
+{
+	struct _jack_slave_io *io;
+	jack_slave_io_worker_t *worker;
+	JSList *node;
+	unsigned int n = 0;
+
+	for (node = engine->slave_drivers; node; node = jack_slist_next (node)) {
+		if (((jack_driver_t*)node->data)->parallel_io) {
+			n++;
+		}
+	}
+
+	if (n == 0 || engine->slave_io) {
+		return;
+	}
+
+	if ((io = (struct _jack_slave_io*)calloc (1, sizeof(*io))) == NULL
+	    || (io->workers = (jack_slave_io_worker_t*)
+				 calloc (n, sizeof(jack_slave_io_worker_t))) == NULL) {
+		free (io);
+		return;
+	}
+
+	pthread_mutex_init (&io->lock, NULL);
+	pthread_cond_init (&io->work, NULL);
+	pthread_cond_init (&io->done, NULL);
+
+	/* the I/O threads stand in for the driver thread, so they run
+	   at its priority */
+
+	for (node = engine->slave_drivers; node; node = jack_slist_next (node)) {
+		jack_driver_t *sdriver = node->data;
+
+		if (!sdriver->parallel_io) {
+			continue;
+		}
+
+		worker = &io->workers[io->nworkers];
+		worker->io = io;
+		worker->driver = sdriver;
+
+		if (jack_client_create_thread (NULL, &worker->thread,
+					       engine->rtpriority,
+					       engine->control->real_time,
+					       jack_slave_io_thread, worker)) {
+			jack_error ("cannot create I/O thread for slave driver"
+				    " %s, running it serially",
+				    sdriver->internal_client->control->name);
+			sdriver->parallel_io = 0;
+			continue;
+		}
+
+		io->nworkers++;
+	}
+
+	VERBOSE (engine, "%u slave drivers with I/O threads", io->nworkers);
+
+	engine->slave_io = io;
+}
+
+static inline void
+jack_slave_io_begin (struct _jack_slave_io *io, int phase,
+		     jack_nframes_t nframes)
+{
+	pthread_mutex_lock (&io->lock);
+	io->phase = phase;
+	io->nframes = nframes;
+	io->pending = io->nworkers;
+	io->generation++;
+	pthread_cond_broadcast (&io->work);
+	pthread_mutex_unlock (&io->lock);
+}
+
+static inline void
+jack_slave_io_join (struct _jack_slave_io *io)
+{
+	pthread_mutex_lock (&io->lock);
+	while (io->pending) {
+		pthread_cond_wait (&io->done, &io->lock);
+	}
+	pthread_mutex_unlock (&io->lock);
+}
+
+static void
+jack_slave_driver_remove (jack_engine_t *engine, jack_driver_t *sdriver)
+{
+	sdriver->detach (sdriver, engine);
+	engine->slave_drivers = jack_slist_remove (engine->slave_drivers, sdriver);
+
+	jack_driver_unload (sdriver);
+}
+int
+jack_drivers_start (jack_engine_t *engine)
+{
+	JSList *node;
+	JSList *failed_drivers = NULL;
+
+	/* first start the slave drivers */
+	for (node = engine->slave_drivers; node; node = jack_slist_next (node)) {
+		jack_driver_t *sdriver = node->data;
+		if (sdriver->start (sdriver)) {
+			failed_drivers = jack_slist_append (failed_drivers, sdriver);
+		}
+	}
+
+	// Clean up drivers which failed to start.
+	for (node = failed_drivers; node; node = jack_slist_next (node)) {
+		jack_driver_t *sdriver = node->data;
+		jack_error ( "slave driver %s failed to start, removing it", sdriver->internal_client->control->name );
+		jack_slave_driver_remove (engine, sdriver);
+	}
+
+	jack_slave_io_start (engine);
+
+	/* now the master driver is started */
+	return engine->driver->start (engine->driver);
+}
+
+static int
+jack_drivers_stop (jack_engine_t *engine)
+{
+	JSList *node;
+	/* first stop the master driver */
+	int retval = engine->driver->stop (engine->driver);
+
+	/* now the slave drivers are stopped */
+	jack_slave_io_stop (engine);
+	for (node = engine->slave_drivers; node; node = jack_slist_next (node)) {
+		jack_driver_t *sdriver = node->data;
+		sdriver->stop ( sdriver );
+	}
+
+	return retval;
+}
+
+static int
+jack_drivers_read (jack_engine_t *engine, jack_nframes_t nframes)
+{
+	struct _jack_slave_io *io = engine->slave_io;
+	JSList *node;
+	int ret;
+
+	if (io) {
+		jack_slave_io_begin (io, JACK_SLAVE_IO_READ, nframes);
+	}
+
+	/* first read the slave drivers */
+	for (node = engine->slave_drivers; node; node = jack_slist_next (node)) {
+		jack_driver_t *sdriver = node->data;
+		if (!(io && sdriver->parallel_io)) {
+			sdriver->read (sdriver, nframes);
+		}
+	}
+
+	/* now the master driver is read */
+	ret = engine->driver->read (engine->driver, nframes);
+
+	if (io) {
+		jack_slave_io_join (io);
+	}
+
+	for (node = engine->clock_domains; node; node = jack_slist_next (node)) {
+		jack_clock_domain_read (node->data, nframes);
+	}
+
+	return ret;
+}
+
+static int
+jack_drivers_write (jack_engine_t *engine, jack_nframes_t nframes)
+{
+	struct _jack_slave_io *io = engine->slave_io;
+	JSList *node;
+	int ret;
+
+	if (io) {
+		jack_slave_io_begin (io, JACK_SLAVE_IO_WRITE, nframes);
+	}
+
+	for (node = engine->clock_domains; node; node = jack_slist_next (node)) {
+		jack_clock_domain_write (node->data, nframes);
+	}
+
+	/* first start the slave drivers */
+	for (node = engine->slave_drivers; node; node = jack_slist_next (node)) {
+		jack_driver_t *sdriver = node->data;
+		if (!(io && sdriver->parallel_io)) {
+			sdriver->write (sdriver, nframes);
+		}
+	}
+
+	/* now the master driver is written */
+	ret = engine->driver->write (engine->driver, nframes);
+
+	if (io) {
+		jack_slave_io_join (io);
+	}
+
+	return ret;
+}
+/* Switch the graph to the freewheel period with the driver stopped,
+   or back before it starts again. The clients hear of it as of any
+   other change of the buffer size. */
+static void
+jack_freewheel_period (jack_engine_t* engine, int start)
+{
+	jack_nframes_t nframes;
+
+	if (start) {
+		nframes = engine->freewheel_nframes;
+		if (nframes == 0 || nframes == engine->control->buffer_size) {
+			return;
+		}
+		if (engine->backup_driver || engine->clock_domains) {
+			VERBOSE (engine, "freewheeling at the driver's period:"
+				 " a backup driver or clock domain is loaded");
+			return;
+		}
+		engine->freewheel_saved_nframes = engine->control->buffer_size;
+	} else {
+		if ((nframes = engine->freewheel_saved_nframes) == 0) {
+			return;
+		}
+		engine->freewheel_saved_nframes = 0;
+	}
+
+	VERBOSE (engine, "%s freewheel period of %" PRIu32 " frames",
+		 start ? "switching to a" : "leaving the", nframes);
+
+	if (jack_driver_buffer_size (engine, nframes)) {
+		jack_error ("cannot change to a buffer size of %" PRIu32
+			    " frames for freewheeling", nframes);
+		if (start) {
+			nframes = engine->freewheel_saved_nframes;
+			engine->freewheel_saved_nframes = 0;
+			jack_driver_buffer_size (engine, nframes);
+		}
+	}
+
+	jack_lock_graph (engine);
+	jack_latency_mark_dirty (engine, NULL);
+	jack_compute_new_latency (engine);
+	jack_unlock_graph (engine);
+}
+
+static int
+jack_start_freewheeling (jack_engine_t* engine, jack_uuid_t client_id)
+{
+	jack_event_t event;
+	jack_client_internal_t *client;
+
+	if (engine->freewheeling) {
+		return 0;
+	}
+
+	if (engine->driver == NULL) {
+		jack_error ("cannot start freewheeling without a driver!");
+		return -1;
+	}
+
+	/* stop driver before telling anyone about it so
+	   there are no more process() calls being handled.
+	 */
+
+	if (jack_drivers_stop (engine)) {
+		jack_error ("could not stop driver for freewheeling");
+		return -1;
+	}
+
+	client = jack_client_internal_by_id (engine, client_id);
+
+	if (client->control->process_cbset || client->control->thread_cb_cbset) {
+		jack_uuid_copy (&engine->fwclient, client_id);
+	}
+
+	/* before anyone runs a freewheel cycle */
+	jack_freewheel_period (engine, TRUE);
+
+	engine->freewheeling = 1;
+	engine->stop_freewheeling = 0;
+
+	event.type = StartFreewheel;
+	jack_deliver_event_to_all (engine, &event);
+
+	if (jack_client_create_thread (NULL, &engine->freewheel_thread, 0, FALSE,
+				       jack_engine_freewheel, engine)) {
+		jack_error ("could not start create freewheel thread");
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+jack_stop_freewheeling (jack_engine_t* engine, int engine_exiting)
+{
+	jack_event_t event;
+	void *ftstatus;
+
+	if (!engine->freewheeling) {
+		return 0;
+	}
+
+	if (engine->driver == NULL) {
+		jack_error ("cannot start freewheeling without a driver!");
+		return -1;
+	}
+
+	if (!engine->freewheeling) {
+		VERBOSE (engine, "stop freewheel when not freewheeling");
+		return 0;
+	}
+
+	/* tell the freewheel thread to stop, and wait for it
+	   to exit.
+	 */
+
+	engine->stop_freewheeling = 1;
+
+	VERBOSE (engine, "freewheeling stopped, waiting for thread");
+	pthread_join (engine->freewheel_thread, &ftstatus);
+	VERBOSE (engine, "freewheel thread has returned");
+
+	jack_uuid_clear (&engine->fwclient);
+	engine->freewheeling = 0;
+	engine->freewheel_bounded = 0;
+	engine->freewheel_done = 0;
+	engine->control->frame_timer.reset_pending = 1;
+
+	if (!engine_exiting) {
+		/* tell everyone we've stopped */
+
+		event.type = StopFreewheel;
+		jack_deliver_event_to_all (engine, &event);
+
+		jack_freewheel_period (engine, FALSE);
+
+		/* restart the driver */
+
+		if (jack_drivers_start (engine)) {
+			jack_error ("could not restart driver after freewheeling");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+jack_check_client (jack_engine_t* engine, jack_client_internal_t *client)
+{
+	int err = 0;
+
+	if (client->control->type == ClientExternal) {
+		if (kill (client->control->pid, 0)) {
+			VERBOSE (engine,
+				 "client %s has died/exited",
+				 client->control->name);
+			client->error++;
+			err++;
+		}
+		if (client->control->last_status != 0) {
+			VERBOSE (engine,
+				 "client %s has nonzero process callback status (%d)\n",
+				 client->control->name, client->control->last_status);
+			client->error++;
+			err++;
+		}
+	}
+
+	DEBUG ("client %s errors = %d", client->control->name,
+	       client->error);
+
+	return err;
+}
+
+static int
+jack_check_client_status (jack_engine_t* engine)
+{
+	JSList *node;
+	int err = 0;
+
+	/* we are already late, or something else went wrong,
+	   so it can't hurt to check the existence of all
+	   clients.
+	 */
+
+	for (node = engine->clients; node;
+	     node = jack_slist_next (node)) {
+		err += jack_check_client (engine,
+					  (jack_client_internal_t*)node->data);
+	}
+
+	return err;
+}
 
-	case RecomputeTotalLatencies:
-		jack_lock_graph (engine);
-		jack_compute_all_port_total_latencies (engine);
-		jack_compute_new_latency (engine);
-		jack_unlock_graph (engine);
-		req->status = 0;
-		break;
+#define JACK_SUPERVISOR_INTERVAL_MSECS 250
 
-	case RecomputeTotalLatency:
-		jack_lock_graph (engine);
-		jack_compute_port_total_latency (engine, &engine->control->ports[req->x.port_info.port_id]);
-		jack_unlock_graph (engine);
-		req->status = 0;
-		break;
+/* Buffer size governor, see --buffer-governor.  Once a second the
+ * supervisor looks at the xruns and the spare time per cycle.  Xruns
+ * in JACK_GOVERNOR_STRIKES looks in a row double the buffer size;
+ * JACK_GOVERNOR_CALM looks without any, while the cycle takes less
+ * than a quarter of the period, halve it.  After a change the governor
+ * waits JACK_GOVERNOR_HOLD looks for the load figures to settle.  The
+ * change goes through the same path as jack_set_buffer_size(), so
+ * clients get their buffer size callback as usual.
+ */
+#define JACK_GOVERNOR_LOOK_USECS 1000000
+#define JACK_GOVERNOR_STRIKES 2
+#define JACK_GOVERNOR_CALM 30
+#define JACK_GOVERNOR_HOLD 5
 
-	case GetClientByUUID:
-		jack_rdlock_graph (engine);
-		jack_do_get_client_by_uuid (engine, req);
-		jack_unlock_graph (engine);
-		break;
-	case GetUUIDByClientName:
-		jack_rdlock_graph (engine);
-		jack_do_get_uuid_by_client_name (engine, req);
-		jack_unlock_graph (engine);
-		break;
-	case ReserveName:
-		jack_rdlock_graph (engine);
-		jack_do_reserve_name (engine, req);
-		jack_unlock_graph (engine);
-		break;
-	case SessionReply:
-		jack_rdlock_graph (engine);
-		jack_do_session_reply (engine, req);
-		jack_unlock_graph (engine);
-		break;
-	case SessionNotify:
-		jack_rdlock_graph (engine);
-		if ((req->status =
-			     jack_do_session_notify (engine, req, *reply_fd))
-		    >= 0) {
-			/* we have already replied, don't do it again */
-			*reply_fd = -1;
+static int
+jack_buffer_governor_init (jack_engine_t *engine, const char *spec)
+{
+	unsigned int min, max;
+	char c;
+
+	engine->governor_min = 0;
+	engine->governor_max = 0;
+
+	if (sscanf (spec, "%u:%u%c", &min, &max, &c) != 2
+	    || !jack_power_of_two (min) || !jack_power_of_two (max)
+	    || min == 0 || min > max) {
+		jack_error ("buffer governor range \"%s\" is not MIN:MAX "
+			    "with both powers of 2", spec);
+		return -1;
+	}
+
+	engine->governor_min = min;
+	engine->governor_max = max;
+	engine->governor_xruns = 0;
+	engine->governor_strikes = 0;
+	engine->governor_calm = 0;
+	engine->governor_hold = JACK_GOVERNOR_HOLD;
+	engine->governor_last = 0;
+
+	VERBOSE (engine, "buffer governor between %u and %u frames", min, max);
+	return 0;
+}
+
+static void
+jack_buffer_governor (jack_engine_t *engine)
+{
+	jack_driver_t *driver = engine->driver;
+	jack_time_t now = jack_get_microseconds ();
+	jack_nframes_t nframes, target;
+	uint64_t xruns = 0;
+	float used;
+	const char *why;
+	int i;
+
+	if (engine->governor_min == 0
+	    || now - engine->governor_last < JACK_GOVERNOR_LOOK_USECS) {
+		return;
+	}
+	engine->governor_last = now;
+
+	for (i = 0; i < JACK_XRUN_CAUSES; i++) {
+		xruns += engine->xruns[i];
+	}
+	if (engine->governor_hold > 0) {
+		/* a change usually costs an xrun of its own */
+		engine->governor_xruns = xruns;
+		engine->governor_hold--;
+		return;
+	}
+	if (xruns != engine->governor_xruns) {
+		engine->governor_xruns = xruns;
+		engine->governor_strikes++;
+		engine->governor_calm = 0;
+	} else {
+		engine->governor_strikes = 0;
+		engine->governor_calm++;
+	}
+	if (driver == NULL || driver->period_usecs == 0
+	    || engine->freewheeling || engine->backup_driver) {
+		return;
+	}
+
+	nframes = engine->control->buffer_size;
+	used = driver->period_usecs - engine->spare_usecs;
+
+	if (engine->governor_strikes >= JACK_GOVERNOR_STRIKES
+	    && nframes < engine->governor_max) {
+		target = nframes * 2;
+		why = "xruns";
+	} else if (engine->governor_calm >= JACK_GOVERNOR_CALM
+		   && used < driver->period_usecs / 4.0f
+		   && nframes > engine->governor_min) {
+		target = nframes / 2;
+		why = "light load";
+	} else {
+		return;
+	}
+
+	engine->governor_strikes = 0;
+	engine->governor_calm = 0;
+	engine->governor_hold = JACK_GOVERNOR_HOLD;
+
+	pthread_mutex_lock (&engine->request_lock);
+	if (jack_buffer_size_change (engine, target) == 0) {
+		jack_info ("buffer governor: %" PRIu32 " -> %" PRIu32
+			   " frames (%s)", nframes, target, why);
+		jack_xrun_dump_graph_event (engine, "buffer size %" PRIu32
+					    " -> %" PRIu32 " (%s)", nframes,
+					    target, why);
+	}
+	pthread_mutex_unlock (&engine->request_lock);
+}
+
+static void
+jack_supervisor_poke (jack_engine_t* engine)
+{
+	char c = 0;
+
+	/* we don't actually care if this fails: a poke is pending */
+	write (engine->supervisor_fifo[1], &c, 1);
+}
+
+/* Client health checks, kept off the engine thread.  The engine
+ * thread only flags late clients and pokes us; we give them a couple
+ * of periods to finish, check that the external clients still exist,
+ * and hand clients with errors to the server thread.  We also look
+ * regularly for errors nobody poked us about.
+ */
+static void *
+jack_supervisor_thread (void *arg)
+{
+	jack_engine_t *engine = (jack_engine_t*)arg;
+	struct pollfd pfd;
+	char buf[16];
+	int n;
+
+	pfd.fd = engine->supervisor_fifo[0];
+	pfd.events = POLLIN;
+
+	while (1) {
+
+		if ((n = poll (&pfd, 1, JACK_SUPERVISOR_INTERVAL_MSECS)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			jack_error ("supervisor poll failed (%s)", strerror (errno));
+			break;
 		}
-		jack_unlock_graph (engine);
-		break;
-	case SessionHasCallback:
-		jack_rdlock_graph (engine);
-		req->status = jack_do_has_session_cb (engine, req);
-		jack_unlock_graph (engine);
-		break;
-	case PropertyChangeNotify:
-		jack_property_change_notify (engine, req->x.property.change, req->x.property.uuid, req->x.property.key);
-		break;
 
-	case PortNameChanged:
-		jack_rdlock_graph (engine);
-		jack_port_rename_notify (engine, req->x.connect.source_port, req->x.connect.destination_port);
-		jack_unlock_graph (engine);
-		break;
+		if (n > 0) {
+			jack_driver_t *driver;
+			int errs;
 
-	default:
-		/* some requests are handled entirely on the client
-		 * side, by adjusting the shared memory area(s) */
-		break;
+			if ((n = read (pfd.fd, buf, sizeof(buf))) == 0) {
+				break;  /* the engine is going away */
+			}
+
+			if ((driver = engine->driver) != NULL) {
+				usleep (2 * driver->period_usecs);
+			}
+
+			jack_rdlock_graph (engine);
+			errs = jack_check_client_status (engine);
+			jack_unlock_graph (engine);
+
+			if (errs) {
+				jack_engine_signal_problems (engine);
+			}
+		}
+
+		jack_check_clients (engine);
+		jack_client_update_budgets (engine);
+		jack_buffer_governor (engine);
+		jack_check_session_deadlines (engine);
+	}
+
+	return NULL;
+}
+
+static int
+jack_run_one_cycle (jack_engine_t *engine, jack_nframes_t nframes,
+		    float delayed_usecs)
+{
+	jack_driver_t* driver = engine->driver;
+	jack_graph_snapshot_t *snapshot = NULL;
+	int ret = -1;
+	static int consecutive_excessive_delays = 0;
+
+#define WORK_SCALE 1.0f
+
+	if (!engine->freewheeling &&
+	    engine->control->real_time &&
+	    engine->spare_usecs &&
+	    ((WORK_SCALE * engine->spare_usecs) <= delayed_usecs)) {
+
+		MESSAGE ("delay of %.3f usecs exceeds estimated spare"
+			 " time of %.3f; restart ...\n",
+			 delayed_usecs, WORK_SCALE * engine->spare_usecs);
+
+		if (++consecutive_excessive_delays > 10) {
+			jack_error ("too many consecutive interrupt delays "
+				    "... engine pausing");
+			return -1;      /* will exit the thread loop */
+		}
+
+		jack_engine_xrun (engine, delayed_usecs, JACK_XRUN_WAKEUP);
+
+		return 0;
+
+	} else {
+		consecutive_excessive_delays = 0;
+	}
+
+	DEBUG ("trying to acquire read lock (FW = %d)", engine->freewheeling);
+	if (jack_try_rdlock_graph (engine)) {
+		if ((snapshot = jack_graph_snapshot_acquire (engine)) == NULL) {
+			VERBOSE (engine, "lock-driven null cycle");
+			if (!engine->freewheeling) {
+				driver->null_cycle (driver, nframes);
+			} else {
+				/* don't return too fast */
+				usleep (1000);
+			}
+			return 0;
+		}
+		DEBUG ("running from graph snapshot %lu", snapshot->generation);
+	}
+
+	if (jack_trylock_problems (engine)) {
+		VERBOSE (engine, "problem-lock-driven null cycle");
+		jack_cycle_unlock_graph (engine, snapshot);
+		if (!engine->freewheeling) {
+			driver->null_cycle (driver, nframes);
+		} else {
+			/* don't return too fast */
+			usleep (1000);
+		}
+		return 0;
+	}
+
+	if (engine->problems || (engine->timeout_count_threshold && (engine->timeout_count > (1 + engine->timeout_count_threshold * 1000 / engine->driver->period_usecs) ))) {
+		VERBOSE (engine, "problem-driven null cycle problems=%d", engine->problems);
+		jack_unlock_problems (engine);
+		jack_cycle_unlock_graph (engine, snapshot);
+		if (!engine->freewheeling) {
+			driver->null_cycle (driver, nframes);
+		} else {
+			/* don't return too fast */
+			usleep (1000);
+		}
+		return 0;
+	}
+
+	jack_unlock_problems (engine);
+
+	if (engine->graph_idle != engine->driver_idle && !engine->freewheeling) {
+		jack_engine_set_idle (engine, engine->graph_idle);
+	}
+	if (engine->driver_idle && !engine->freewheeling) {
+		driver->null_cycle (driver, nframes);
+		jack_transport_cycle_end (engine);
+		jack_cycle_unlock_graph (engine, snapshot);
+		return 0;
+	}
+
+	if (engine->async_head && snapshot == NULL) {
+		jack_async_end_cycle (engine);
+	}
+
+	/* ends the silence of ports marked in the last cycle */
+	if (++engine->control->cycle_seq == 0) {
+		engine->control->cycle_seq = 1;
+	}
+
+	JACK_PROBE4 (cycle_start, engine->control->cycle_seq, nframes,
+		     driver->last_wait_ust, (int64_t)delayed_usecs);
+
+	if (!engine->freewheeling) {
+		DEBUG ("waiting for driver read\n");
+		if (jack_drivers_read (engine, nframes)) {
+			goto unlock;
+		}
+		if (engine->capture) {
+			jack_capture_cycle (engine, nframes);
+		}
+	}
+
+	DEBUG ("run process\n");
+
+	if (jack_engine_process (engine, snapshot, nframes) != 0) {
+		DEBUG ("engine process cycle failed");
+		jack_supervisor_poke (engine);
+	}
+
+	if (!engine->freewheeling) {
+		if (jack_drivers_write (engine, nframes)) {
+			goto unlock;
+		}
+	}
+
+	jack_engine_post_process (engine);
+
+	if (engine->trace) {
+		jack_cycle_trace_write (engine, nframes, delayed_usecs);
+	}
+
+	/* a cycle run from a snapshot might see the port segment
+	   change under it; those simply go unmetered */
+	if (engine->meters && snapshot == NULL) {
+		jack_port_meters_update (engine, nframes);
+	}
+
+	if (delayed_usecs > engine->control->max_delayed_usecs) {
+		engine->control->max_delayed_usecs = delayed_usecs;
+	}
+
+	ret = 0;
+
+unlock:
+	jack_cycle_unlock_graph (engine, snapshot);
+	JACK_PROBE2 (cycle_end, engine->control->cycle_seq, ret);
+	DEBUG ("cycle finished, status = %d", ret);
+
+	return ret;
+}
+
+static void
+jack_engine_driver_exit (jack_engine_t* engine)
+{
+	jack_driver_t* driver = engine->driver;
+
+	if (engine->clock_domains && jack_domain_driver_exit (engine) == 0) {
+		return;
 	}
+	if (engine->backup_driver && jack_backup_driver_exit (engine) == 0) {
+		return;
+	}
+
+	VERBOSE (engine, "stopping driver");
+	driver->stop (driver);
+	VERBOSE (engine, "detaching driver");
+	driver->detach (driver, engine);
 
-	pthread_mutex_unlock (&engine->request_lock);
+	/* tell anyone waiting that the driver exited. */
+	kill (engine->wait_pid, SIGUSR2);
 
-	DEBUG ("status of request: %d", req->status);
+	engine->driver = NULL;
 }
 
-int
-internal_client_request (void* ptr, jack_request_t *request)
+/* The loop gain of the frame timer DLL for a period of `p_usecs': 2 pi
+   times the bandwidth times the period. Past about half a radian per
+   period the second-order loop stops damping jitter and starts adding
+   to it, so larger bandwidths are held there. */
+
+static float
+jack_dll_omega (jack_time_t p_usecs)
 {
-	do_request ((jack_engine_t*)ptr, request, NULL);
-	return request->status;
+	float omega = 6.2831853f * dll_bandwidth * (float)p_usecs * 1e-6f;
+
+	if (omega > JACK_DLL_MAX_OMEGA) {
+		omega = JACK_DLL_MAX_OMEGA;
+	}
+	return omega;
 }
 
 static int
-handle_external_client_request (jack_engine_t *engine, int fd)
+jack_run_cycle (jack_engine_t *engine, jack_nframes_t nframes,
+		float delayed_usecs)
 {
-	/* CALLER holds read lock on graph */
+	jack_time_t now = engine->driver->last_wait_ust;
+	jack_time_t dus = 0;
+	jack_time_t p_usecs = engine->driver->period_usecs;
+	jack_nframes_t b_size = engine->control->buffer_size;
+	jack_nframes_t left;
+	jack_frame_timer_t* timer = &engine->control->frame_timer;
+	int ret;
 
-	jack_request_t req;
-	jack_client_internal_t *client = 0;
-	int reply_fd;
-	JSList *node;
-	ssize_t r;
+	if (engine->clock_domains && jack_domain_cycle (engine, nframes, &ret)) {
+		return ret;
+	}
 
-	for (node = engine->clients; node; node = jack_slist_next (node)) {
-		if (((jack_client_internal_t*)node->data)->request_fd == fd) {
-			client = (jack_client_internal_t*)node->data;
-			break;
+	if (engine->backup_driver) {
+		if (jack_backup_cycle (engine, nframes)) {
+			return 0;
 		}
+	} else {
+		engine->master_thread = pthread_self ();
 	}
 
-	if (client == NULL) {
-		jack_error ("client input on unknown fd %d!", fd);
-		return -1;
+	if (engine->verbose) {
+		if (nframes != b_size) {
+			VERBOSE (engine,
+				 "late driver wakeup: nframes to process = %"
+				 PRIu32 ".", nframes);
+		}
 	}
 
-	if ((r = read (client->request_fd, &req, sizeof(req)))
-	    < (ssize_t)sizeof(req)) {
-		if (r == 0) {
-#ifdef JACK_USE_MACH_THREADS
-			/* poll is implemented using
-			   select (see the macosx/fakepoll
-			   code). When the socket is closed
-			   select does not return any error,
-			   POLLIN is true and the next read
-			   will return 0 bytes. This
-			   behaviour is diffrent from the
-			   Linux poll behaviour. Thus we use
-			   this condition as a socket error
-			   and remove the client.
-			 */
-			jack_mark_client_socket_error (engine, fd);
-#endif                  /* JACK_USE_MACH_THREADS */
-			return 1;
-		} else {
-			jack_error ("cannot read request from client (%d/%d/%s)",
-				    r, sizeof(req), strerror (errno));
-			// XXX: shouldnt we mark this client as error now ?
+	/* Run as many cycles as it takes to consume nframes */
 
-			return -1;
+	for (left = nframes; left >= b_size; left -= b_size) {
+		/* Change: the DLL code is now inside this loop which ensures
+		   that more than one period is run if more than a buffer size
+		   of frames is available. This is a very unlikely event, but
+		   it is possible and now handled correctly.
+		   FA 25/06/2014
+		 */
+		/* Change: 'first_wakeup' now means only the very first wakeup
+		   after the engine was created. In that case frame time is not
+		   modified, it stays at the initialised value.
+		   OTOH 'reset_pending' is  used after freewheeling or an xrun.
+		   In those cases frame time is adjusted by using the difference
+		   in usecs time between the end of the previous period and the
+		   start of the current one. This way, a client monitoring the
+		   frame time for the start of each period will have a correct
+		   idea of the number of frames that were skipped.
+		   FA 25/06/2014
+		 */
+		/* Change: in contrast to previous versions, the DLL is *not*
+		   run if any of the two conditions above is true, it is just
+		   initialised correctly for the current period. Previously it
+		   was initialised and then run, which meant that the requred
+		   initialisation was rather counter-intiutive.
+		   FA 25/06/2014
+		 */
+		/* Added initialisation of timer->period_usecs, required
+		   due to the modified implementation of the DLL itself.
+		   OTOH, this should maybe not be repeated after e.g.
+		   freewheeling or an xrun, as the current value would be
+		   more accurate than the nominal one. But it doesn't really
+		   harm either.
+		   FA 13/02/2012
+		 */
+		/* Added initialisation of timer->filter_omega. This makes
+		   the DLL bandwidth independent of the actual period time.
+		   The bandwidth is now 1/8 Hz in all cases. The value of
+		   timer->filter_omega is 2 * pi * BW * Tperiod.
+		   FA 13/02/2012
+		 */
+		/* The bandwidth is now set with --dll-bandwidth, still 1/8 Hz
+		   by default; see jack_dll_omega().
+		 */
+
+		/* guard1 opens the update and guard2 closes it, and the
+		   fences keep the fields in between from being seen outside
+		   that window; see jack_read_frame_time(). */
+		timer->guard1++;
+		__atomic_thread_fence (__ATOMIC_RELEASE);
+
+		if (timer->reset_pending) {
+			// Adjust frame time after a discontinuity.
+			// The frames of the previous period.
+			timer->frames += b_size;
+			// The frames that were skipped.
+			dus = now - timer->next_wakeup;
+			timer->frames += (dus * b_size) / p_usecs;
 		}
-	}
+		if (engine->first_wakeup || timer->reset_pending) {
+			// First wakeup or after discontinuity.
+			// Initialiase the DLL.
+			timer->current_wakeup = now;
+			timer->next_wakeup = now + p_usecs;
+			timer->period_usecs = (float)p_usecs;
+			timer->filter_omega = jack_dll_omega (p_usecs);
+			timer->initialized = 1;
 
-	if (req.type == PropertyChangeNotify) {
-		if (req.x.property.keylen) {
-			req.x.property.key = (char*)malloc (req.x.property.keylen);
-			if ((r = read (client->request_fd, (char*)req.x.property.key, req.x.property.keylen)) != req.x.property.keylen) {
-				jack_error ("cannot read property key from client (%d/%d/%s)",
-					    r, sizeof(req), strerror (errno));
-				return -1;
-			}
+			// Reset both conditions.
+			engine->first_wakeup = 0;
+			timer->reset_pending = 0;
 		} else {
-			req.x.property.key = 0;
+			// Normal cycle. This code was originally in
+			// jack_inc_frame_time() but only used here.
+			// Moving it here means that now all code
+			// related to timekeeping is close together
+			// and easy to understand.
+			float delta = (float)((int64_t)now - (int64_t)timer->next_wakeup);
+			delta *= timer->filter_omega;
+			timer->current_wakeup = timer->next_wakeup;
+			timer->frames += b_size;
+			timer->period_usecs += timer->filter_omega * delta;
+			timer->next_wakeup += (int64_t)floorf (timer->period_usecs + 1.41f * delta + 0.5f);
 		}
-	}
-
-	reply_fd = client->request_fd;
-
-	jack_unlock_graph (engine);
-	do_request (engine, &req, &reply_fd);
-	jack_lock_graph (engine);
 
-	if (req.type == PropertyChangeNotify && req.x.property.key) {
-		free ((char*)req.x.property.key);
-	}
+		__atomic_thread_fence (__ATOMIC_RELEASE);
+		timer->guard2++;
 
-	if (reply_fd >= 0) {
-		DEBUG ("replying to client");
-		if (write (reply_fd, &req, sizeof(req))
-		    < (ssize_t)sizeof(req)) {
-			jack_error ("cannot write request result to client");
-			return -1;
+		if (jack_run_one_cycle (engine, b_size, delayed_usecs)) {
+			jack_error ("cycle execution failure, exiting");
+			return EIO;
 		}
-	} else {
-		DEBUG ("*not* replying to client");
 	}
 
 	return 0;
 }
 
-static int
-handle_client_ack_connection (jack_engine_t *engine, int client_fd)
+void
+jack_engine_delete (jack_engine_t *engine)
 {
-	jack_client_internal_t *client;
-	jack_client_connect_ack_request_t req;
-	jack_client_connect_ack_result_t res;
-
-	if (read (client_fd, &req, sizeof(req)) != sizeof(req)) {
-		jack_error ("cannot read ACK connection request from client");
-		return -1;
-	}
-
-	if ((client = jack_client_internal_by_id (engine, req.client_id))
-	    == NULL) {
-		jack_error ("unknown client ID in ACK connection request");
-		return -1;
-	}
-
-	client->event_fd = client_fd;
-	VERBOSE (engine, "new client %s using %d for events", client->control->name,
-		 client->event_fd);
-
-	res.status = 0;
+	JSList *node;
+	int i;
 
-	if (write (client->event_fd, &res, sizeof(res)) != sizeof(res)) {
-		jack_error ("cannot write ACK connection response to client");
-		return -1;
+	if (engine == NULL) {
+		return;
 	}
 
-	return 0;
-}
-
-
-static void *
-jack_server_thread (void *arg)
+	VERBOSE (engine, "starting server engine shutdown");
 
-{
-	jack_engine_t *engine = (jack_engine_t*)arg;
-	struct sockaddr_un client_addr;
-	socklen_t client_addrlen;
-	int problemsProblemsPROBLEMS = 0;
-	int client_socket;
-	int done = 0;
-	int i;
-	const int fixed_fd_cnt = 3;
-	int stop_freewheeling;
+	jack_metrics_stop (engine);
+	jack_xrun_dump_close (engine);
+	jack_stop_freewheeling (engine, 1);
 
-	while (!done) {
-		JSList* node;
-		int clients;
+	engine->control->engine_ok = 0; /* tell clients we're going away */
 
-		jack_rdlock_graph (engine);
+	/* the supervisor may still signal problems; stop it first */
 
-		clients = jack_slist_length (engine->clients);
+	close (engine->supervisor_fifo[1]);
+	pthread_join (engine->supervisor_thread, NULL);
+	close (engine->supervisor_fifo[0]);
 
-		if (engine->pfd_size < fixed_fd_cnt + clients) {
-			if (engine->pfd) {
-				free (engine->pfd);
-			}
+	/* this will wake the server thread and cause it to exit */
 
-			engine->pfd = (struct pollfd*)malloc (sizeof(struct pollfd) *
-							      (fixed_fd_cnt + clients));
+	close (engine->cleanup_fifo[0]);
+	close (engine->cleanup_fifo[1]);
 
-			if (engine->pfd == NULL) {
-				/*
-				 * this can happen if limits.conf was changed
-				 * but the user hasn't logged out and back in yet
-				 */
-				if (errno == EAGAIN) {
-					jack_error ("malloc failed (%s) - make"
-						    "sure you log out and back"
-						    "in after changing limits"
-						    ".conf!", strerror (errno));
-				} else {
-					jack_error ("malloc failed (%s)", strerror (errno));
-				}
+	if (jack_socket_activated ()) {
 
-				break;
-			}
-		}
+		/* the service manager keeps listening on its copies
+		   of the sockets, and starts us again for the next
+		   client; shutdown() would break them for it too.
+		 */
+		close (engine->fds[0]);
+		close (engine->fds[1]);
+	} else {
 
-		engine->pfd[0].fd = engine->fds[0];
-		engine->pfd[0].events = POLLIN | POLLERR;
-		engine->pfd[1].fd = engine->fds[1];
-		engine->pfd[1].events = POLLIN | POLLERR;
-		engine->pfd[2].fd = engine->cleanup_fifo[0];
-		engine->pfd[2].events = POLLIN | POLLERR;
-		engine->pfd_max = fixed_fd_cnt;
+		/* shutdown master socket to prevent new clients arriving */
+		shutdown (engine->fds[0], SHUT_RDWR);
+		// close (engine->fds[0]);
 
-		for (node = engine->clients; node; node = node->next) {
+		/* now really tell them we're going away */
 
-			jack_client_internal_t* client = (jack_client_internal_t*)(node->data);
+		shutdown (engine->fds[1], SHUT_RDWR);
+	}
 
-			if (client->request_fd < 0 || client->error >= JACK_ERROR_WITH_SOCKETS) {
-				continue;
-			}
-			if ( client->control->dead ) {
-				engine->pfd[engine->pfd_max].fd = client->request_fd;
-				engine->pfd[engine->pfd_max].events = POLLHUP | POLLNVAL;
-				engine->pfd_max++;
-				continue;
-			}
-			engine->pfd[engine->pfd_max].fd = client->request_fd;
-			engine->pfd[engine->pfd_max].events = POLLIN | POLLPRI | POLLERR | POLLHUP | POLLNVAL;
-			engine->pfd_max++;
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client = (jack_client_internal_t*)node->data;
+		if (client->request_fd >= 0) {
+			shutdown (client->request_fd, SHUT_RDWR);
 		}
+	}
 
-		jack_unlock_graph (engine);
-
-		VERBOSE (engine, "start poll on %d fd's", engine->pfd_max);
+	jack_slave_io_stop (engine);
 
-		/* go to sleep for a long, long time, or until a request
-		   arrives, or until a communication channel is broken
-		 */
+	if (engine->backup_driver) {
+		jack_driver_t* driver = engine->backup_driver;
 
-		if (poll (engine->pfd, engine->pfd_max, -1) < 0) {
-			if (errno == EINTR) {
-				continue;
-			}
-			jack_error ("poll failed (%s)", strerror (errno));
-			break;
-		}
+		VERBOSE (engine, "stopping backup driver");
+		driver->stop (driver);
+		engine->backup_driver = NULL;
+		jack_driver_unload (driver);
+	}
 
-		VERBOSE (engine, "server thread back from poll");
+	if (engine->driver) {
+		jack_driver_t* driver = engine->driver;
 
-		/* Stephane Letz: letz@grame.fr : has to be added
-		 * otherwise pthread_cancel() does not work on MacOSX */
-		pthread_testcancel ();
+		VERBOSE (engine, "stopping driver");
+		driver->stop (driver);
+		// VERBOSE (engine, "detaching driver");
+		// driver->detach (driver, engine);
+		VERBOSE (engine, "unloading driver");
+		jack_driver_unload (driver);
+		engine->driver = NULL;
+	}
 
+	/* no more cycles to record */
+	jack_capture_close (engine);
 
-		/* empty cleanup FIFO if necessary */
+	/* with the graph's cycles over, nothing else reads the rings */
+	for (node = engine->clock_domains; node; node = jack_slist_next (node)) {
+		jack_driver_t* driver = jack_clock_domain_driver (node->data);
 
-		if (engine->pfd[2].revents & ~POLLIN) {
-			/* time to die */
-			break;
+		VERBOSE (engine, "stopping clock domain %s",
+			 driver->internal_client->control->name);
+		if (!jack_clock_domain_stopped (node->data)) {
+			driver->stop (driver);
 		}
+		jack_clock_domain_free (node->data);
+		jack_driver_unload (driver);
+	}
+	jack_slist_free (engine->clock_domains);
+	engine->clock_domains = NULL;
 
-		if (engine->pfd[2].revents & POLLIN) {
-			char c;
-			while (read (engine->cleanup_fifo[0], &c, 1) == 1) ;
-		}
+	for (node = engine->retired_drivers; node; node = jack_slist_next (node)) {
+		jack_driver_unload ((jack_driver_t*)node->data);
+	}
+	jack_slist_free (engine->retired_drivers);
+	engine->retired_drivers = NULL;
 
-		/* check each client socket before handling other request*/
+	VERBOSE (engine, "freeing shared port segments");
+	for (i = 0; i < engine->control->n_port_types; ++i) {
+		jack_release_shm (&engine->port_segment[i]);
+		jack_destroy_shm (&engine->port_segment[i]);
+	}
 
-		jack_rdlock_graph (engine);
+	/* stop the other engine threads */
+	VERBOSE (engine, "stopping server thread");
 
-		for (i = fixed_fd_cnt; i < engine->pfd_max; i++) {
+#if JACK_USE_MACH_THREADS
+	// MacOSX pthread_cancel still not implemented correctly in Darwin
+	mach_port_t machThread = pthread_mach_thread_np (engine->server_thread);
+	thread_terminate (machThread);
+#else
+	pthread_cancel (engine->server_thread);
+	pthread_join (engine->server_thread, NULL);
+#endif
 
-			if (engine->pfd[i].fd < 0) {
-				continue;
-			}
+	jack_query_pool_cleanup (engine);
+	jack_shm_requests_cleanup (engine);
 
-			if (engine->pfd[i].revents & ~POLLIN) {
+	free (engine->graph_snapshot);
+	engine->graph_snapshot = NULL;
 
-				jack_mark_client_socket_error (engine, engine->pfd[i].fd);
-				jack_engine_signal_problems (engine);
-				VERBOSE (engine, "non-POLLIN events on fd %d", engine->pfd[i].fd);
-			} else if (engine->pfd[i].revents & POLLIN) {
+	jack_dag_cleanup (engine);
 
-				if (handle_external_client_request (engine, engine->pfd[i].fd)) {
-					jack_error ("could not handle external"
-						    " client request");
-					jack_engine_signal_problems (engine);
-				}
-			}
-		}
+	for (i = 0; i < engine->reach_size; i++) {
+		bitset_destroy (&engine->reach[i]);
+	}
+	free (engine->reach);
 
-		problemsProblemsPROBLEMS = engine->problems;
+	VERBOSE (engine, "last xrun delay: %.3f usecs",
+		 engine->control->xrun_delayed_usecs);
+	VERBOSE (engine, "max delay reported by backend: %.3f usecs",
+		 engine->control->max_delayed_usecs);
 
-		jack_unlock_graph (engine);
+	if (engine->client_connects) {
+		VERBOSE (engine, "%lu client connections, %.1f usecs each",
+			 engine->client_connects,
+			 (double)engine->client_connect_usecs / engine->client_connects);
+	}
+	if (engine->client_removals) {
+		VERBOSE (engine, "%lu client removals, %.1f usecs each",
+			 engine->client_removals,
+			 (double)engine->client_removal_usecs / engine->client_removals);
+	}
 
-		/* need to take write lock since we may/will rip out some clients,
-		   and reset engine->problems
-		 */
+	if (engine->epoll_fd >= 0) {
+		close (engine->epoll_fd);
+		engine->epoll_fd = -1;
+	}
 
-		stop_freewheeling = 0;
+	if (engine->trace) {
+		VERBOSE (engine, "freeing cycle trace");
+		engine->trace = NULL;
+		jack_release_shm (&engine->trace_shm);
+		jack_destroy_shm (&engine->trace_shm);
+	}
 
-		while (problemsProblemsPROBLEMS) {
+	if (engine->meters) {
+		VERBOSE (engine, "freeing port meters");
+		engine->meters = NULL;
+		jack_release_shm (&engine->meter_shm);
+		jack_destroy_shm (&engine->meter_shm);
+		free (engine->meter_peak);
+		free (engine->meter_sumsq);
+		free (engine->meter_overs);
+	}
 
-			VERBOSE (engine, "trying to lock graph to remove %d problems", problemsProblemsPROBLEMS);
-			jack_lock_graph (engine);
-			VERBOSE (engine, "we have problem clients (problems = %d", problemsProblemsPROBLEMS);
-			jack_remove_clients (engine, &stop_freewheeling);
-			if (stop_freewheeling) {
-				VERBOSE (engine, "need to stop freewheeling once problems are cleared");
-			}
-			jack_unlock_graph (engine);
+	if (engine->history) {
+		VERBOSE (engine, "freeing async history");
+		engine->history = NULL;
+		jack_release_shm (&engine->history_shm);
+		jack_destroy_shm (&engine->history_shm);
+	}
 
-			jack_lock_problems (engine);
-			engine->problems -= problemsProblemsPROBLEMS;
-			problemsProblemsPROBLEMS = engine->problems;
-			jack_unlock_problems (engine);
+	VERBOSE (engine, "freeing metadata store");
+	jack_property_store_delete ();
 
-			VERBOSE (engine, "after removing clients, problems = %d", problemsProblemsPROBLEMS);
-		}
+	/* free engine control shm segment */
+	engine->control = NULL;
+	VERBOSE (engine, "freeing engine shared memory");
+	jack_release_shm (&engine->control_shm);
+	jack_destroy_shm (&engine->control_shm);
 
-		if (engine->freewheeling && stop_freewheeling) {
-			jack_stop_freewheeling (engine, 0);
-		}
+	VERBOSE (engine, "max usecs: %.3f, engine deleted", engine->max_usecs);
 
-		/* check the master server socket */
+	free (engine);
 
-		if (engine->pfd[0].revents & POLLERR) {
-			jack_error ("error on server socket");
-			break;
-		}
+	jack_messagebuffer_exit ();
+}
 
-		if (engine->control->engine_ok && engine->pfd[0].revents & POLLIN) {
-			DEBUG ("pfd[0].revents & POLLIN");
+void
+jack_port_clear_connections (jack_engine_t *engine,
+			     jack_port_internal_t *port)
+{
+	JSList *node, *next;
 
-			memset (&client_addr, 0, sizeof(client_addr));
-			client_addrlen = sizeof(client_addr);
+	for (node = port->connections; node; ) {
+		next = jack_slist_next (node);
+		jack_port_disconnect_internal (
+			engine, ((jack_connection_internal_t*)
+				 node->data)->source,
+			((jack_connection_internal_t*)
+			 node->data)->destination);
+		node = next;
+	}
 
-			if ((client_socket =
-				     accept (engine->fds[0],
-					     (struct sockaddr*)&client_addr,
-					     &client_addrlen)) < 0) {
-				jack_error ("cannot accept new connection (%s)",
-					    strerror (errno));
-			} else if (!engine->new_clients_allowed || jack_client_create (engine, client_socket) < 0) {
-				jack_error ("cannot complete client "
-					    "connection process");
-				close (client_socket);
-			}
-		}
+	jack_pool_slist_free (port->connections);
+	port->connections = 0;
+}
 
-		/* check the ACK server socket */
+static void
+jack_deliver_event_to_all (jack_engine_t *engine, jack_event_t *event)
+{
+	JSList *node;
 
-		if (engine->pfd[1].revents & POLLERR) {
-			jack_error ("error on server ACK socket");
-			break;
+	jack_rdlock_graph (engine);
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_deliver_event (engine,
+				    (jack_client_internal_t*)node->data,
+				    event);
+	}
+	jack_unlock_graph (engine);
+}
+
+static void jack_do_get_client_by_uuid (jack_engine_t *engine, jack_request_t *req)
+{
+	JSList *node;
+
+	req->status = -1;
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
+		if (jack_uuid_compare (client->control->uuid, req->x.client_id) == 0) {
+			snprintf ( req->x.port_info.name, sizeof(req->x.port_info.name), "%s", client->control->name );
+			req->status = 0;
+			return;
 		}
+	}
+}
 
-		if (engine->control->engine_ok && engine->pfd[1].revents & POLLIN) {
-			DEBUG ("pfd[1].revents & POLLIN");
+static void jack_do_get_uuid_by_client_name (jack_engine_t *engine, jack_request_t *req)
+{
+	JSList *node;
 
-			memset (&client_addr, 0, sizeof(client_addr));
-			client_addrlen = sizeof(client_addr);
+	req->status = -1;
 
-			if ((client_socket =
-				     accept (engine->fds[1],
-					     (struct sockaddr*)&client_addr,
-					     &client_addrlen)) < 0) {
-				jack_error ("cannot accept new ACK connection"
-					    " (%s)", strerror (errno));
-			} else if (handle_client_ack_connection
-					   (engine, client_socket)) {
-				jack_error ("cannot complete client ACK "
-					    "connection process");
-				close (client_socket);
-			}
+	if (strcmp (req->x.name, "system") == 0) {
+		/* request concerns the driver */
+		if (engine->driver) {
+			jack_uuid_copy (&req->x.client_id, engine->driver->internal_client->control->uuid);
+			req->status = 0;
 		}
+		return;
 	}
 
-	return 0;
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
+		if (strcmp (client->control->name, req->x.name) == 0) {
+			jack_uuid_copy (&req->x.client_id, client->control->uuid);
+			req->status = 0;
+			return;
+		}
+	}
 }
 
-jack_engine_t *
-jack_engine_new (int realtime, int rtpriority, int do_mlock, int do_unlock,
-		 const char *server_name, int temporary, int verbose,
-		 int client_timeout, unsigned int port_max, pid_t wait_pid,
-		 jack_nframes_t frame_time_offset, int nozombies, int timeout_count_threshold, JSList *drivers)
+static void jack_do_reserve_name (jack_engine_t *engine, jack_request_t *req)
 {
-	jack_engine_t *engine;
-	unsigned int i;
-	char server_dir[PATH_MAX + 1] = "";
-
-#ifdef USE_CAPABILITIES
-	uid_t uid = getuid ();
-	uid_t euid = geteuid ();
-#endif  /* USE_CAPABILITIES */
+	jack_reserved_name_t *reservation;
 
-	/* before we start allocating resources, make sure that if realtime was requested that we can
-	   actually do it.
-	 */
+	// check is name is free...
+	if (jack_client_by_name_locked (engine, req->x.reservename.name)) {
+		req->status = -1;
+		return;
+	}
 
-	if (realtime) {
-		if (jack_acquire_real_time_scheduling (pthread_self (), 10) != 0) {
-			/* can't run realtime - time to bomb */
-			return NULL;
-		}
+	reservation = malloc (sizeof(jack_reserved_name_t));
+	if (reservation == NULL) {
+		req->status = -1;
+		return;
+	}
 
-		jack_drop_real_time_scheduling (pthread_self ());
+	snprintf (reservation->name, sizeof(reservation->name), "%s", req->x.reservename.name);
+	jack_uuid_copy (&reservation->uuid, req->x.reservename.uuid);
+	jack_reserved_name_add (engine, reservation);
 
-#ifdef USE_MLOCK
+	req->status = 0;
+}
 
-		if (do_mlock && (mlockall (MCL_CURRENT | MCL_FUTURE) != 0)) {
-			jack_error ("cannot lock down memory for jackd (%s)",
-				    strerror (errno));
-#ifdef ENSURE_MLOCK
-			return NULL;
-#endif  /* ENSURE_MLOCK */
-		}
-#endif  /* USE_MLOCK */
+static int jack_send_session_reply ( jack_engine_t *engine, jack_client_internal_t *client )
+{
+	if (write (engine->session_reply_fd, (const void*)&client->control->uuid, sizeof(client->control->uuid))
+	    < (ssize_t)sizeof(client->control->uuid)) {
+		jack_error ("cannot write SessionNotify result "
+			    "to client via fd = %d (%s)",
+			    engine->session_reply_fd, strerror (errno));
+		return -1;
+	}
+	if (write (engine->session_reply_fd, (const void*)client->control->name, sizeof(client->control->name))
+	    < (ssize_t)sizeof(client->control->name)) {
+		jack_error ("cannot write SessionNotify result "
+			    "to client via fd = %d (%s)",
+			    engine->session_reply_fd, strerror (errno));
+		return -1;
+	}
+	if (write (engine->session_reply_fd, (const void*)client->control->session_command,
+		   sizeof(client->control->session_command))
+	    < (ssize_t)sizeof(client->control->session_command)) {
+		jack_error ("cannot write SessionNotify result "
+			    "to client via fd = %d (%s)",
+			    engine->session_reply_fd, strerror (errno));
+		return -1;
+	}
+	if (write (engine->session_reply_fd, (const void*)( &client->control->session_flags ),
+		   sizeof(client->control->session_flags))
+	    < (ssize_t)sizeof(client->control->session_flags)) {
+		jack_error ("cannot write SessionNotify result "
+			    "to client via fd = %d (%s)",
+			    engine->session_reply_fd, strerror (errno));
+		return -1;
 	}
 
-	/* start a thread to display messages from realtime threads */
-	jack_messagebuffer_init ();
-
-	jack_init_time ();
-
-	/* allocate the engine, zero the structure to ease debugging */
-	engine = (jack_engine_t*)calloc (1, sizeof(jack_engine_t));
+	return 0;
+}
 
-	engine->drivers = drivers;
-	engine->driver = NULL;
-	engine->driver_desc = NULL;
-	engine->driver_params = NULL;
+static int
+jack_do_session_notify (jack_engine_t *engine, jack_request_t *req, int reply_fd )
+{
+	JSList *node;
+	jack_event_t event;
 
-	engine->slave_drivers = NULL;
+	jack_uuid_t finalizer;
+	struct stat sbuf;
 
-	engine->set_sample_rate = jack_set_sample_rate;
-	engine->set_buffer_size = jack_driver_buffer_size;
-	engine->run_cycle = jack_run_cycle;
-	engine->delay = jack_engine_delay;
-	engine->driver_exit = jack_engine_driver_exit;
-	engine->transport_cycle_start = jack_transport_cycle_start;
-	engine->client_timeout_msecs = client_timeout;
-	engine->timeout_count = 0;
-	engine->problems = 0;
+	jack_uuid_clear (&finalizer);
 
-	engine->port_max = port_max;
-	engine->server_thread = 0;
-	engine->rtpriority = rtpriority;
-	engine->silent_buffer = 0;
-	engine->verbose = verbose;
-	engine->server_name = server_name;
-	engine->temporary = temporary;
-	engine->freewheeling = 0;
-	engine->stop_freewheeling = 0;
-	jack_uuid_clear (&engine->fwclient);
-	engine->feedbackcount = 0;
-	engine->wait_pid = wait_pid;
-	engine->nozombies = nozombies;
-	engine->timeout_count_threshold = timeout_count_threshold;
-	engine->removing_clients = 0;
-	engine->new_clients_allowed = 1;
+	if (engine->session_reply_fd != -1) {
+		// we should have a notion of busy or somthing.
+		// just sending empty reply now.
+		goto send_final;
+	}
 
-	engine->session_reply_fd = -1;
+	engine->session_reply_fd = reply_fd;
 	engine->session_pending_replies = 0;
 
-	engine->audio_out_cnt = 0;
-	engine->audio_in_cnt = 0;
-	engine->midi_out_cnt = 0;
-	engine->midi_in_cnt = 0;
+	event.type = SaveSession;
+	event.y.n = req->x.session.type;
 
-	jack_engine_reset_rolling_usecs (engine);
-	engine->max_usecs = 0.0f;
+	/* GRAPH MUST BE LOCKED : see callers of jack_send_connection_notification()
+	 */
 
-	pthread_rwlock_init (&engine->client_lock, 0);
-	pthread_mutex_init (&engine->port_lock, 0);
-	pthread_mutex_init (&engine->request_lock, 0);
-	pthread_mutex_init (&engine->problem_lock, 0);
+	if (stat (req->x.session.path, &sbuf) != 0 || !S_ISDIR (sbuf.st_mode)) {
+		jack_error ("session parent directory (%s) does not exist", req->x.session.path);
+		goto send_final;
+	}
 
-	engine->clients = 0;
-	engine->reserved_client_names = 0;
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
+		if (client->control->session_cbset) {
 
-	engine->pfd_size = 0;
-	engine->pfd_max = 0;
-	engine->pfd = 0;
+			// in case we only want to send to a special client.
+			// uuid assign is still complete. not sure if thats necessary.
+			if ( (req->x.session.target[0] != 0) && strcmp (req->x.session.target, (char*)client->control->name) ) {
+				continue;
+			}
 
-	engine->fifo_size = 16;
-	engine->fifo = (int*)malloc (sizeof(int) * engine->fifo_size);
-	for (i = 0; i < engine->fifo_size; i++)
-		engine->fifo[i] = -1;
+			/* the caller of jack_session_notify() is required to have created the session dir
+			 */
 
-	if (pipe (engine->cleanup_fifo)) {
-		jack_error ("cannot create cleanup FIFOs (%s)", strerror (errno));
-		return NULL;
+			if (req->x.session.path[strlen (req->x.session.path) - 1] == '/') {
+				snprintf (event.x.name, sizeof(event.x.name), "%s%s/", req->x.session.path, client->control->name );
+			} else {
+				snprintf (event.x.name, sizeof(event.x.name), "%s/%s/", req->x.session.path, client->control->name );
+			}
+			if (mkdir (event.x.name, 0777) != 0) {
+				jack_error ("cannot create session directory (%s) for client %s: %s",
+					    event.x.name, client->control->name, strerror (errno));
+				break;
+			}
+
+			/* the event goes out without waiting for the
+			   client to save; it answers with a SessionReply
+			   request, or misses its deadline, see
+			   jack_check_session_deadlines() */
+			if (jack_deliver_event (engine, client, &event) == 0 &&
+			    !client->error && client->control->active) {
+				engine->session_pending_replies += 1;
+				client->session_reply_pending = TRUE;
+				client->session_deadline = jack_get_microseconds ()
+							   + JACKD_SESSION_SAVE_TIMEOUT * 1000;
+			}
+		}
 	}
 
-	if (fcntl (engine->cleanup_fifo[0], F_SETFL, O_NONBLOCK)) {
-		jack_error ("cannot set O_NONBLOCK on cleanup read FIFO (%s)", strerror (errno));
-		return NULL;
+	if (engine->session_pending_replies != 0) {
+		return 0;
 	}
 
-	if (fcntl (engine->cleanup_fifo[1], F_SETFL, O_NONBLOCK)) {
-		jack_error ("cannot set O_NONBLOCK on cleanup write FIFO (%s)", strerror (errno));
-		return NULL;
+send_final:
+	if (write (reply_fd, &finalizer, sizeof(finalizer))
+	    < (ssize_t)sizeof(finalizer)) {
+		jack_error ("cannot write SessionNotify result "
+			    "to client via fd = %d (%s)",
+			    reply_fd, strerror (errno));
+		goto error_out;
 	}
 
-	engine->external_client_cnt = 0;
+	engine->session_reply_fd = -1;
+	return 0;
+error_out:
+	return -3;
+}
 
-	srandom (time ((time_t*)0));
+/* Called by the supervisor: a client that has not answered a session
+ * save within JACKD_SESSION_SAVE_TIMEOUT is left out of the result,
+ * so that one hung client cannot hold up the rest of the save.
+ */
+static void
+jack_check_session_deadlines (jack_engine_t *engine)
+{
+	jack_uuid_t finalizer = JACK_UUID_EMPTY_INITIALIZER;
+	jack_time_t now;
+	JSList *node;
 
-	if (jack_shmalloc (sizeof(jack_control_t)
-			   + ((sizeof(jack_port_shared_t) * engine->port_max)),
-			   &engine->control_shm)) {
-		jack_error ("cannot create engine control shared memory "
-			    "segment (%s)", strerror (errno));
-		return NULL;
+	if (engine->session_reply_fd == -1) {
+		return;
 	}
 
-	if (jack_attach_shm (&engine->control_shm)) {
-		jack_error ("cannot attach to engine control shared memory"
-			    " (%s)", strerror (errno));
-		jack_destroy_shm (&engine->control_shm);
-		return NULL;
+	pthread_mutex_lock (&engine->request_lock);
+	jack_rdlock_graph (engine);
+
+	now = jack_get_microseconds ();
+
+	for (node = engine->clients; node && engine->session_reply_fd != -1;
+	     node = jack_slist_next (node)) {
+		jack_client_internal_t *client = (jack_client_internal_t*)node->data;
+
+		if (!client->session_reply_pending || now < client->session_deadline) {
+			continue;
+		}
+
+		jack_error ("client %s did not save its session in time, "
+			    "leaving it out", client->control->name);
+		client->session_reply_pending = FALSE;
+		engine->session_pending_replies -= 1;
+
+		if (engine->session_pending_replies == 0) {
+			if (write (engine->session_reply_fd, &finalizer, sizeof(finalizer))
+			    < (ssize_t)sizeof(finalizer)) {
+				jack_error ("cannot write SessionNotify result "
+					    "to client via fd = %d (%s)",
+					    engine->session_reply_fd, strerror (errno));
+			}
+			engine->session_reply_fd = -1;
+		}
 	}
 
-	engine->control = (jack_control_t*)
-			  jack_shm_addr (&engine->control_shm);
+	jack_unlock_graph (engine);
+	pthread_mutex_unlock (&engine->request_lock);
+}
 
-	/* Setup port type information from builtins. buffer space is
-	 * allocated when the driver calls jack_driver_buffer_size().
-	 */
-	for (i = 0; jack_builtin_port_types[i].type_name[0]; ++i) {
+static int
+jack_do_has_session_cb (jack_engine_t *engine, jack_request_t *req)
+{
+	jack_client_internal_t *client;
+	int retval = -1;
 
-		memcpy (&engine->control->port_types[i],
-			&jack_builtin_port_types[i],
-			sizeof(jack_port_type_info_t));
+	client = jack_client_by_name (engine, req->x.name);
+	if (client == NULL) {
+		goto out;
+	}
 
-		VERBOSE (engine, "registered builtin port type %s",
-			 engine->control->port_types[i].type_name);
+	retval = client->control->session_cbset ? 1 : 0;
+out:
+	return retval;
+}
 
-		/* the port type id is index into port_types array */
-		engine->control->port_types[i].ptype_id = i;
+static void jack_do_session_reply (jack_engine_t *engine, jack_request_t *req )
+{
+	jack_uuid_t client_id;
+	jack_client_internal_t *client;
+	jack_uuid_t finalizer = JACK_UUID_EMPTY_INITIALIZER;
 
-		/* be sure to initialize mutex correctly */
-		pthread_mutex_init (&engine->port_buffers[i].lock, NULL);
+	jack_uuid_copy (&client_id, req->x.client_id);
+	client = jack_client_internal_by_id (engine, client_id);
+	jack_uuid_clear (&finalizer);
 
-		/* set buffer list info correctly */
-		engine->port_buffers[i].freelist = NULL;
-		engine->port_buffers[i].info = NULL;
+	req->status = 0;
 
-		/* mark each port segment as not allocated */
-		engine->port_segment[i].index = -1;
-		engine->port_segment[i].attached_at = 0;
+	if (client == NULL || !client->session_reply_pending) {
+		/* late, after its deadline */
+		jack_error ("spurious Session Reply");
+		return;
 	}
 
-	engine->control->n_port_types = i;
-
-	/* Mark all ports as available */
+	client->session_reply_pending = 0;
 
-	for (i = 0; i < engine->port_max; i++) {
-		engine->control->ports[i].in_use = 0;
-		engine->control->ports[i].id = i;
-		engine->control->ports[i].alias1[0] = '\0';
-		engine->control->ports[i].alias2[0] = '\0';
+	if (engine->session_reply_fd == -1) {
+		jack_error ("spurious Session Reply");
+		return;
 	}
 
-	/* allocate internal port structures so that we can keep track
-	 * of port connections.
-	 */
-	engine->internal_ports = (jack_port_internal_t*)
-				 malloc (sizeof(jack_port_internal_t) * engine->port_max);
+	engine->session_pending_replies -= 1;
 
-	for (i = 0; i < engine->port_max; i++)
-		engine->internal_ports[i].connections = 0;
+	if (jack_send_session_reply (engine, client)) {
+		// maybe need to fix all client pendings.
+		// but we will just get a set of spurious replies now.
+		engine->session_reply_fd = -1;
+		return;
+	}
 
-	if (make_sockets (engine->server_name, engine->fds) < 0) {
-		jack_error ("cannot create server sockets");
-		return NULL;
+	if (engine->session_pending_replies == 0) {
+		if (write (engine->session_reply_fd, &finalizer, sizeof(finalizer))
+		    < (ssize_t)sizeof(finalizer)) {
+			jack_error ("cannot write SessionNotify result "
+				    "to client via fd = %d (%s)",
+				    engine->session_reply_fd, strerror (errno));
+			req->status = -1;
+		}
+		engine->session_reply_fd = -1;
 	}
+}
 
-	engine->control->port_max = engine->port_max;
-	engine->control->real_time = realtime;
+static void
+jack_notify_all_port_interested_clients (jack_engine_t *engine, jack_uuid_t src, jack_uuid_t dst, jack_port_id_t a, jack_port_id_t b, int connected)
+{
+	JSList *node;
+	jack_event_t event;
 
-	/* leave some headroom for other client threads to run
-	   with priority higher than the regular client threads
-	   but less than the server. see thread.h for
-	   jack_client_real_time_priority() and jack_client_max_real_time_priority()
-	   which are affected by this.
+	event.type = (connected ? PortConnected : PortDisconnected);
+	event.x.self_id = a;
+	event.y.other_id = b;
+
+	/* GRAPH MUST BE LOCKED : see callers of jack_send_connection_notification()
 	 */
 
-	engine->control->client_priority = (realtime
-					    ? engine->rtpriority - 5
-					    : 0);
-	engine->control->max_client_priority = (realtime
-						? engine->rtpriority - 1
-						: 0);
-	engine->control->do_mlock = do_mlock;
-	engine->control->do_munlock = do_unlock;
-	engine->control->cpu_load = 0;
-	engine->control->xrun_delayed_usecs = 0;
-	engine->control->max_delayed_usecs = 0;
-
-	jack_set_clock_source (clock_source);
-	engine->control->clock_source = clock_source;
-	engine->get_microseconds = jack_get_microseconds_pointer ();
+	jack_xrun_dump_graph_event (engine, "%s %s -> %s",
+				    connected ? "connect" : "disconnect",
+				    engine->control->ports[a].name,
+				    engine->control->ports[b].name);
 
-	VERBOSE (engine, "clock source = %s", jack_clock_source_name (clock_source));
+	jack_client_internal_t* src_client = jack_client_internal_by_id (engine, src);
+	jack_client_internal_t* dst_client = jack_client_internal_by_id (engine, dst);
 
-	engine->control->frame_timer.frames = frame_time_offset;
-	engine->control->frame_timer.reset_pending = 0;
-	engine->control->frame_timer.current_wakeup = 0;
-	engine->control->frame_timer.next_wakeup = 0;
-	engine->control->frame_timer.initialized = 0;
-	engine->control->frame_timer.filter_omega = 0;  /* Initialised later */
-	engine->control->frame_timer.period_usecs = 0;  /* Initialised later */
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
+		if (src_client != client &&  dst_client  != client &&
+		    (client->control->port_connect_cbset || client->control->graph_mirror)) {
 
-	engine->first_wakeup = 1;
+			/* it has a port connect callback, or mirrors the graph */
+			jack_deliver_event (engine, client, &event);
+		}
+	}
+}
 
-	engine->control->buffer_size = 0;
-	jack_transport_init (engine);
-	jack_set_sample_rate (engine, 0);
-	engine->control->internal = 0;
+/* While a request is being handled, events that only inform a client
+ * of something are queued per client instead of being sent and
+ * acknowledged one by one. The queue goes out with a single write and
+ * a single wakeup when the request is done (or ahead of the next event
+ * that is delivered normally), and only its last event asks for a
+ * reply; not even that one does for clients that asked for
+ * asynchronous notifications.
+ */
+static int
+jack_event_is_informational (JackEventType type)
+{
+	switch (type) {
+	case PortRegistered:
+	case PortUnregistered:
+	case ClientRegistered:
+	case ClientUnregistered:
+	case GraphReordered:
+	case PropertyChange:
+	case PortRename:
+		return 1;
+	default:
+		return 0;
+	}
+}
 
-	engine->control->has_capabilities = 0;
+static int
+jack_event_batch_queue (jack_engine_t *engine, jack_client_internal_t *client,
+			const jack_event_t *event, const char *key, size_t keylen)
+{
+	jack_event_t *ev;
+	size_t need;
 
-#ifdef JACK_USE_MACH_THREADS
-	/* specific resources for server/client real-time thread
-	 * communication */
-	engine->servertask = mach_task_self ();
-	if (task_get_bootstrap_port (engine->servertask, &engine->bp)) {
-		jack_error ("Jackd: Can't find bootstrap mach port");
-		return NULL;
+	if (engine->event_batch == 0
+	    || !pthread_equal (engine->event_batch_thread, pthread_self ())
+	    || !jack_event_is_informational (event->type)) {
+		return 0;
 	}
-	engine->portnum = 0;
-#endif  /* JACK_USE_MACH_THREADS */
 
+	need = client->event_queue_len + sizeof(jack_event_t) + keylen;
 
-#ifdef USE_CAPABILITIES
-	if (uid == 0 || euid == 0) {
-		VERBOSE (engine, "running with uid=%d and euid=%d, "
-			 "will not try to use capabilites",
-			 uid, euid);
-	} else {
-		/* only try to use capabilities if not running as root */
-		engine->control->has_capabilities = check_capabilities (engine);
-		if (engine->control->has_capabilities == 0) {
-			VERBOSE (engine, "required capabilities not "
-				 "available");
+	if (need > client->event_queue_size) {
+		size_t size = client->event_queue_size ? client->event_queue_size : 16 * sizeof(jack_event_t);
+		char *queue;
+		while (size < need) {
+			size *= 2;
 		}
-		if (engine->verbose) {
-			size_t size;
-			cap_t cap = cap_init ();
-			capgetp (0, cap);
-			VERBOSE (engine, "capabilities: %s",
-				 cap_to_text (cap, &size));
+		if ((queue = (char*)realloc (client->event_queue, size)) == NULL) {
+			return 0;
 		}
+		client->event_queue = queue;
+		client->event_queue_size = size;
 	}
-#endif  /* USE_CAPABILITIES */
-
-	engine->control->engine_ok = 1;
-
-	snprintf (engine->fifo_prefix, sizeof(engine->fifo_prefix),
-		  "%s/jack-ack-fifo-%d",
-		  jack_server_dir (engine->server_name, server_dir), getpid ());
 
-	(void)jack_get_fifo_fd (engine, 0);
+	client->event_queue_last = client->event_queue_len;
+	ev = (jack_event_t*)(client->event_queue + client->event_queue_len);
+	*ev = *event;
+	ev->flags = JACK_EVENT_NO_REPLY;
+	client->event_queue_len += sizeof(jack_event_t);
 
-	jack_client_create_thread (NULL, &engine->server_thread, 0, FALSE,
-				   &jack_server_thread, engine);
+	if (keylen) {
+		memcpy (client->event_queue + client->event_queue_len, key, keylen);
+		client->event_queue_len += keylen;
+	}
 
-	return engine;
+	return 1;
 }
 
-static void
-jack_engine_delay (jack_engine_t *engine, float delayed_usecs)
+/* Writes out whatever is queued for the client. Returns non-zero if
+ * the last queued event asks for a reply.
+ */
+static int
+jack_event_batch_send (jack_engine_t *engine, jack_client_internal_t *client)
 {
-	jack_event_t event;
+	ssize_t len = client->event_queue_len;
+	int reply;
 
-	engine->control->frame_timer.reset_pending = 1;
+	if (len == 0) {
+		return 0;
+	}
 
-	engine->control->xrun_delayed_usecs = delayed_usecs;
+	client->event_queue_len = 0;
+	reply = !(((jack_event_t*)(client->event_queue + client->event_queue_last))->flags
+		  & JACK_EVENT_NO_REPLY);
 
-	if (delayed_usecs > engine->control->max_delayed_usecs) {
-		engine->control->max_delayed_usecs = delayed_usecs;
+	if (client->error >= JACK_ERROR_WITH_SOCKETS) {
+		return 0;
 	}
 
-	event.type = XRun;
+	if (write (client->event_fd, client->event_queue, len) != len) {
+		jack_error ("cannot send events to client [%s] (%s)",
+			    client->control->name,
+			    strerror (errno));
+		client->error += JACK_ERROR_WITH_SOCKETS;
+		jack_engine_signal_problems (engine);
+		return 0;
+	}
 
-	jack_deliver_event_to_all (engine, &event);
+	return reply;
 }
 
-static void*
-jack_engine_freewheel (void *arg)
+static void
+jack_event_batch_begin (jack_engine_t *engine)
 {
-	jack_engine_t* engine = (jack_engine_t*)arg;
-	jack_client_internal_t* client;
+	/* caller must hold engine->request_lock */
 
-	VERBOSE (engine, "freewheel thread starting ...");
+	if (engine->event_batch++ == 0) {
+		engine->event_batch_thread = pthread_self ();
+	}
+}
 
-	/* we should not be running SCHED_FIFO, so we don't
-	   have to do anything about scheduling.
-	 */
+static void
+jack_event_batch_end (jack_engine_t *engine)
+{
+	/* caller must hold engine->request_lock */
+	jack_client_internal_t *client;
+	jack_event_t last;
+	JSList *node;
+	int reply;
 
-	client = jack_client_internal_by_id (engine, engine->fwclient);
+	if (--engine->event_batch > 0) {
+		return;
+	}
 
-	while (!engine->stop_freewheeling) {
+	jack_rdlock_graph (engine);
 
-		jack_run_one_cycle (engine, engine->control->buffer_size, 0.0f);
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
 
-		if (client && client->error) {
-			/* run one cycle() will already have told the server thread
-			   about issues, and the server thread will clean up.
-			   however, its time for us to depart this world ...
-			 */
-			break;
+		client = (jack_client_internal_t*)node->data;
+
+		if (client->event_queue_len == 0) {
+			continue;
+		}
+
+		if (!client->control->async_events) {
+			((jack_event_t*)(client->event_queue + client->event_queue_last))->flags = 0;
+		}
+		last = *(jack_event_t*)(client->event_queue + client->event_queue_last);
+
+		reply = jack_event_batch_send (engine, client);
+
+		if (!client->error && client->wake_word >= 0 &&
+		    engine->control->wakeup_method == JACK_WAKEUP_FUTEX) {
+			jack_wakeup_post (&engine->control->graph_wakeup[client->wake_word],
+					  JACK_WAKEUP_EVENT);
+		}
+
+		if (reply) {
+			jack_wait_event_reply (engine, client, &last);
 		}
 	}
 
-	VERBOSE (engine, "freewheel came to an end, naturally");
-	return 0;
+	jack_unlock_graph (engine);
 }
 
-static void
-jack_slave_driver_remove (jack_engine_t *engine, jack_driver_t *sdriver)
+/* Waits for the client to acknowledge the event it was last sent
+ * that needed a reply.
+ */
+static char
+jack_wait_event_reply (jack_engine_t *engine, jack_client_internal_t *client,
+		       const jack_event_t *event)
 {
-	sdriver->detach (sdriver, engine);
-	engine->slave_drivers = jack_slist_remove (engine->slave_drivers, sdriver);
+	char status = 0;
 
-	jack_driver_unload (sdriver);
-}
-int
-jack_drivers_start (jack_engine_t *engine)
-{
-	JSList *node;
-	JSList *failed_drivers = NULL;
+	if (client->error) {
+		status = -1;
+	} else {
+		// then we check whether there really is an error.... :)
+
+		struct pollfd pfd[1];
+		pfd[0].fd = client->event_fd;
+		pfd[0].events = POLLERR | POLLIN | POLLHUP | POLLNVAL;
+		jack_time_t poll_timeout = JACKD_CLIENT_EVENT_TIMEOUT;
+		int poll_ret;
+		jack_time_t then = jack_get_microseconds ();
+		jack_time_t now;
+
+		/* if we're not running realtime and there is a client timeout set
+		   that exceeds the default client event timeout (which is not
+		   bound by RT limits, then use the larger timeout.
+		 */
 
-	/* first start the slave drivers */
-	for (node = engine->slave_drivers; node; node = jack_slist_next (node)) {
-		jack_driver_t *sdriver = node->data;
-		if (sdriver->start (sdriver)) {
-			failed_drivers = jack_slist_append (failed_drivers, sdriver);
+		if (!engine->control->real_time && (engine->client_timeout_msecs > poll_timeout)) {
+			poll_timeout = engine->client_timeout_msecs;
 		}
-	}
 
-	// Clean up drivers which failed to start.
-	for (node = failed_drivers; node; node = jack_slist_next (node)) {
-		jack_driver_t *sdriver = node->data;
-		jack_error ( "slave driver %s failed to start, removing it", sdriver->internal_client->control->name );
-		jack_slave_driver_remove (engine, sdriver);
-	}
+#ifdef __linux
+again:
+#endif
+		VERBOSE (engine, "client event poll on %d for %s starts at %lld",
+			 client->event_fd, client->control->name, then);
+		if ((poll_ret = poll (pfd, 1, poll_timeout)) < 0) {
+			DEBUG ("client event poll not ok! (-1) poll returned an error");
+			jack_error ("poll on subgraph processing failed (%s)", strerror (errno));
+			status = -1;
+		} else {
 
-	/* now the master driver is started */
-	return engine->driver->start (engine->driver);
-}
+			DEBUG ("\n\n\n\n\n back from client event poll, revents = 0x%x\n\n\n", pfd[0].revents);
+			now = jack_get_microseconds ();
+			VERBOSE (engine, "back from client event poll after %lld usecs", now - then);
 
-static int
-jack_drivers_stop (jack_engine_t *engine)
-{
-	JSList *node;
-	/* first stop the master driver */
-	int retval = engine->driver->stop (engine->driver);
+			if (pfd[0].revents & ~POLLIN) {
 
-	/* now the slave drivers are stopped */
-	for (node = engine->slave_drivers; node; node = jack_slist_next (node)) {
-		jack_driver_t *sdriver = node->data;
-		sdriver->stop ( sdriver );
-	}
+				/* some kind of OOB socket event */
 
-	return retval;
-}
+				DEBUG ("client event poll not ok! (-2), revents = %d\n", pfd[0].revents);
+				jack_error ("subgraph starting at %s lost client", client->control->name);
+				status = -2;
 
-static int
-jack_drivers_read (jack_engine_t *engine, jack_nframes_t nframes)
-{
-	JSList *node;
+			} else if (pfd[0].revents & POLLIN) {
 
-	/* first read the slave drivers */
-	for (node = engine->slave_drivers; node; node = jack_slist_next (node)) {
-		jack_driver_t *sdriver = node->data;
-		sdriver->read (sdriver, nframes);
+				/* client responded normally */
+
+				DEBUG ("client event poll ok!");
+				status = 0;
+
+			} else if (poll_ret == 0) {
+
+				/* no events, no errors, we woke up because poll()
+				   decided that time was up ...
+				 */
+
+#ifdef __linux
+				if (linux_poll_bug_encountered (engine, then, &poll_timeout)) {
+					goto again;
+				}
+
+				if (poll_timeout < 200) {
+					VERBOSE (engine, "FALSE WAKEUP skipped, remaining = %lld usec", poll_timeout);
+					status = 0;
+				} else {
+#endif
+				DEBUG ("client event poll not ok! (1 = poll timed out, revents = 0x%04x, poll_ret = %d)", pfd[0].revents, poll_ret);
+				VERBOSE (engine, "client %s did not respond to event type %d in time"
+					 "(fd=%d, revents = 0x%04x, timeout was %lld)",
+					 client->control->name, event->type,
+					 client->event_fd,
+					 pfd[0].revents,
+					 poll_timeout);
+				status = -2;
+#ifdef __linux
+			}
+#endif
+			}
+		}
 	}
 
-	/* now the master driver is read */
-	return engine->driver->read (engine->driver, nframes);
-}
+	if (status == 0) {
+		if (read (client->event_fd, &status, sizeof(status)) != sizeof(status)) {
+			jack_error ("cannot read event response from client [%s] (%s)",
+				    client->control->name,
+				    strerror (errno));
+			status = -1;
+		}
 
-static int
-jack_drivers_write (jack_engine_t *engine, jack_nframes_t nframes)
-{
-	JSList *node;
+	} else {
+		switch (status) {
+		case -1:
+			jack_error ("internal poll failure reading response from client %s to a %s event",
+				    client->control->name,
+				    jack_event_type_name (event->type));
+			break;
+		case -2:
+			jack_error ("timeout waiting for client %s to handle a %s event",
+				    client->control->name,
+				    jack_event_type_name (event->type));
+			break;
+		default:
+			jack_error ("bad status (%d) from client %s while handling a %s event",
+				    (int)status,
+				    client->control->name,
+				    jack_event_type_name (event->type));
+		}
+	}
 
-	/* first start the slave drivers */
-	for (node = engine->slave_drivers; node; node = jack_slist_next (node)) {
-		jack_driver_t *sdriver = node->data;
-		sdriver->write (sdriver, nframes);
+	if (status < 0) {
+		client->error += JACK_ERROR_WITH_SOCKETS;
+		jack_engine_signal_problems (engine);
 	}
 
-	/* now the master driver is written */
-	return engine->driver->write (engine->driver, nframes);
+	return status;
 }
-static int
-jack_start_freewheeling (jack_engine_t* engine, jack_uuid_t client_id)
+
+int
+jack_deliver_event (jack_engine_t *engine, jack_client_internal_t *client,
+		    const jack_event_t *event, ...)
 {
-	jack_event_t event;
-	jack_client_internal_t *client;
+	va_list ap;
+	char status = 0;
+	char* key = 0;
+	size_t keylen = 0;
 
-	if (engine->freewheeling) {
-		return 0;
-	}
+	va_start (ap, event);
+
+	/* caller must hold the graph lock */
 
-	if (engine->driver == NULL) {
-		jack_error ("cannot start freewheeling without a driver!");
-		return -1;
-	}
+	DEBUG ("delivering event (type %s)", jack_event_type_name (event->type));
 
-	/* stop driver before telling anyone about it so
-	   there are no more process() calls being handled.
+	/* we are not RT-constrained here, so use kill(2) to beef up
+	   our check on a client's continued well-being
 	 */
 
-	if (jack_drivers_stop (engine)) {
-		jack_error ("could not stop driver for freewheeling");
-		return -1;
+	if (client->control->dead || client->error >= JACK_ERROR_WITH_SOCKETS
+	    || (client->control->type == ClientExternal && kill (client->control->pid, 0))) {
+		DEBUG ("client %s is dead - no event sent",
+		       client->control->name);
+		va_end (ap);
+		return 0;
 	}
 
-	client = jack_client_internal_by_id (engine, client_id);
+	DEBUG ("client %s is still alive", client->control->name);
 
-	if (client->control->process_cbset || client->control->thread_cb_cbset) {
-		jack_uuid_copy (&engine->fwclient, client_id);
-	}
+	/* Check property change events for matching key_size and keys */
 
-	engine->freewheeling = 1;
-	engine->stop_freewheeling = 0;
+	if (event->type == PropertyChange) {
+		key = va_arg (ap, char*);
+		if (key && key[0] != '\0') {
+			keylen = strlen (key) + 1;
+			if (event->y.key_size != keylen) {
+				jack_error ("property change key %s sent with wrong length (%d vs %d)", key, event->y.key_size, keylen);
+				va_end (ap);
+				return -1;
+			}
+		}
+	}
 
-	event.type = StartFreewheel;
-	jack_deliver_event_to_all (engine, &event);
+	va_end (ap);
 
-	if (jack_client_create_thread (NULL, &engine->freewheel_thread, 0, FALSE,
-				       jack_engine_freewheel, engine)) {
-		jack_error ("could not start create freewheel thread");
-		return -1;
-	}
+	if (jack_client_is_internal (client)) {
 
-	return 0;
-}
+		switch (event->type) {
+		case PortConnected:
+		case PortDisconnected:
+			jack_client_handle_port_connection
+				(client->private_client, event);
+			break;
 
-int
-jack_stop_freewheeling (jack_engine_t* engine, int engine_exiting)
-{
-	jack_event_t event;
-	void *ftstatus;
+		case PortGainChanged:
+			jack_client_handle_port_gain (client->private_client, event);
+			break;
 
-	if (!engine->freewheeling) {
-		return 0;
-	}
+		case PortRegistered:
+		case PortUnregistered:
+			jack_graph_mirror_event (client->private_client, event);
+			break;
 
-	if (engine->driver == NULL) {
-		jack_error ("cannot start freewheeling without a driver!");
-		return -1;
-	}
+		case BufferSizeChange:
+			jack_client_fix_port_buffers (client->private_client);
 
-	if (!engine->freewheeling) {
-		VERBOSE (engine, "stop freewheel when not freewheeling");
-		return 0;
-	}
+			if (client->control->bufsize_cbset) {
+				if (event->x.n < 16) {
+					abort ();
+				}
+				client->private_client->bufsize
+					(event->x.n, client->private_client->bufsize_arg);
+			}
+			break;
 
-	/* tell the freewheel thread to stop, and wait for it
-	   to exit.
-	 */
+		case SampleRateChange:
+			if (client->control->srate_cbset) {
+				client->private_client->srate
+					(event->x.n,
+					client->private_client->srate_arg);
+			}
+			break;
 
-	engine->stop_freewheeling = 1;
+		case GraphReordered:
+			if (client->control->graph_order_cbset) {
+				client->private_client->graph_order
+					(client->private_client->graph_order_arg);
+			}
+			break;
 
-	VERBOSE (engine, "freewheeling stopped, waiting for thread");
-	pthread_join (engine->freewheel_thread, &ftstatus);
-	VERBOSE (engine, "freewheel thread has returned");
+		case XRun:
+			if (client->control->xrun_cbset) {
+				client->private_client->xrun
+					(client->private_client->xrun_arg);
+			}
+			break;
 
-	jack_uuid_clear (&engine->fwclient);
-	engine->freewheeling = 0;
-	engine->control->frame_timer.reset_pending = 1;
+		case PropertyChange:
+			if (client->control->property_cbset) {
+				client->private_client->property_cb
+					(event->x.uuid, key, event->z.property_change, client->private_client->property_cb_arg);
+			}
+			break;
 
-	if (!engine_exiting) {
-		/* tell everyone we've stopped */
+		case LatencyCallback:
+			jack_client_handle_latency_callback (client->private_client, event, (client->control->type == ClientDriver));
+			break;
 
-		event.type = StopFreewheel;
-		jack_deliver_event_to_all (engine, &event);
+		case SyncPrepare:
+			jack_call_sync_prepare (client->private_client, event);
+			break;
 
-		/* restart the driver */
+		case ProcessSkipped:
+			if (client->control->skip_cbset) {
+				client->private_client->skip_cb
+					(event->x.n, client->private_client->skip_arg);
+			}
+			break;
 
-		if (jack_drivers_start (engine)) {
-			jack_error ("could not restart driver after freewheeling");
-			return -1;
+		default:
+			/* internal clients don't need to know */
+			break;
 		}
-	}
 
-	return 0;
-}
+	} else {
 
-static int
-jack_check_client_status (jack_engine_t* engine)
-{
-	JSList *node;
-	int err = 0;
+		if (client->control->active) {
 
-	/* we are already late, or something else went wrong,
-	   so it can't hurt to check the existence of all
-	   clients.
-	 */
+			jack_event_t ev;
 
-	for (node = engine->clients; node;
-	     node = jack_slist_next (node)) {
-		jack_client_internal_t *client =
-			(jack_client_internal_t*)node->data;
+			/* there's a thread waiting for events, so
+			 * it's worth telling the client */
 
-		if (client->control->type == ClientExternal) {
-			if (kill (client->control->pid, 0)) {
-				VERBOSE (engine,
-					 "client %s has died/exited",
-					 client->control->name);
-				client->error++;
-				err++;
-			}
-			if (client->control->last_status != 0) {
-				VERBOSE (engine,
-					 "client %s has nonzero process callback status (%d)\n",
-					 client->control->name, client->control->last_status);
-				client->error++;
-				err++;
+			if (jack_event_batch_queue (engine, client, event, key, keylen)) {
+				return 0;
 			}
-		}
 
-		DEBUG ("client %s errors = %d", client->control->name,
-		       client->error);
-	}
+			/* anything queued for the client goes first, and is
+			   acknowledged along with this event */
 
-	return err;
-}
+			jack_event_batch_send (engine, client);
 
-static int
-jack_run_one_cycle (jack_engine_t *engine, jack_nframes_t nframes,
-		    float delayed_usecs)
-{
-	jack_driver_t* driver = engine->driver;
-	int ret = -1;
-	static int consecutive_excessive_delays = 0;
+			DEBUG ("engine writing on event fd");
 
-#define WORK_SCALE 1.0f
+			/* a sync prepare hint, or a session save, goes to
+			   every client at once, so nobody waits for
+			   anybody's answer; a save is answered with a
+			   SessionReply request */
 
-	if (!engine->freewheeling &&
-	    engine->control->real_time &&
-	    engine->spare_usecs &&
-	    ((WORK_SCALE * engine->spare_usecs) <= delayed_usecs)) {
+			ev = *event;
+			ev.flags = (event->type == SyncPrepare ||
+				    event->type == SaveSession) ? JACK_EVENT_NO_REPLY : 0;
 
-		MESSAGE ("delay of %.3f usecs exceeds estimated spare"
-			 " time of %.3f; restart ...\n",
-			 delayed_usecs, WORK_SCALE * engine->spare_usecs);
+			if (write (client->event_fd, &ev, sizeof(ev)) != sizeof(ev)) {
+				jack_error ("cannot send event to client [%s] (%s)",
+					    client->control->name,
+					    strerror (errno));
+				client->error += JACK_ERROR_WITH_SOCKETS;
+				jack_engine_signal_problems (engine);
+			}
 
-		if (++consecutive_excessive_delays > 10) {
-			jack_error ("too many consecutive interrupt delays "
-				    "... engine pausing");
-			return -1;      /* will exit the thread loop */
-		}
+			/* for property changes, deliver the extra data representing
+			   the variable length "key" that has changed in some way.
+			 */
 
-		jack_engine_delay (engine, delayed_usecs);
+			if (event->type == PropertyChange) {
+				if (keylen) {
+					if (write (client->event_fd, key, keylen) != keylen) {
+						jack_error ("cannot send property change key to client [%s] (%s)",
+							    client->control->name,
+							    strerror (errno));
+						client->error += JACK_ERROR_WITH_SOCKETS;
+						jack_engine_signal_problems (engine);
+					}
+				}
+			}
 
-		return 0;
+			/* a client sleeping on its wakeup word cannot see
+			   the event socket, so wake it up */
 
-	} else {
-		consecutive_excessive_delays = 0;
-	}
+			if (!client->error && client->wake_word >= 0 &&
+			    engine->control->wakeup_method == JACK_WAKEUP_FUTEX) {
+				jack_wakeup_post (&engine->control->graph_wakeup[client->wake_word],
+						  JACK_WAKEUP_EVENT);
+			}
 
-	DEBUG ("trying to acquire read lock (FW = %d)", engine->freewheeling);
-	if (jack_try_rdlock_graph (engine)) {
-		VERBOSE (engine, "lock-driven null cycle");
-		if (!engine->freewheeling) {
-			driver->null_cycle (driver, nframes);
-		} else {
-			/* don't return too fast */
-			usleep (1000);
+			if (!(ev.flags & JACK_EVENT_NO_REPLY)) {
+				status = jack_wait_event_reply (engine, client, event);
+			}
 		}
-		return 0;
 	}
+	DEBUG ("event delivered");
 
-	if (jack_trylock_problems (engine)) {
-		VERBOSE (engine, "problem-lock-driven null cycle");
-		jack_unlock_graph (engine);
-		if (!engine->freewheeling) {
-			driver->null_cycle (driver, nframes);
-		} else {
-			/* don't return too fast */
-			usleep (1000);
-		}
-		return 0;
-	}
+	return status;
+}
 
-	if (engine->problems || (engine->timeout_count_threshold && (engine->timeout_count > (1 + engine->timeout_count_threshold * 1000 / engine->driver->period_usecs) ))) {
-		VERBOSE (engine, "problem-driven null cycle problems=%d", engine->problems);
-		jack_unlock_problems (engine);
-		jack_unlock_graph (engine);
-		if (!engine->freewheeling) {
-			driver->null_cycle (driver, nframes);
-		} else {
-			/* don't return too fast */
-			usleep (1000);
-		}
-		return 0;
+/* The engine control block only has room for JACK_GRAPH_WAKEUPS
+ * wakeup words. If the graph could outgrow them, go back to FIFOs for
+ * good, making sure nobody is left asleep on a word first.
+ */
+static void
+jack_check_wakeup_slots (jack_engine_t *engine)
+{
+	/* caller must hold client_lock */
+	JSList *node;
+	unsigned long nclients;
+
+	if (engine->control->wakeup_method != JACK_WAKEUP_FUTEX) {
+		return;
 	}
 
-	jack_unlock_problems (engine);
+	nclients = jack_slist_length (engine->clients);
 
-	if (!engine->freewheeling) {
-		DEBUG ("waiting for driver read\n");
-		if (jack_drivers_read (engine, nframes)) {
-			goto unlock;
-		}
+	/* DAG mode numbers two words per client, the chain fewer, and
+	   every client has one of its own above those */
+	if (2 * nclients + 1 < JACK_GRAPH_WAKEUPS - JACK_CLIENT_WAKEUPS
+	    && nclients <= JACK_CLIENT_WAKEUPS) {
+		return;
 	}
 
-	DEBUG ("run process\n");
+	jack_error ("too many clients (%lu) for futex wakeups, "
+		    "falling back to FIFOs", nclients);
 
-	if (jack_engine_process (engine, nframes) != 0) {
-		DEBUG ("engine process cycle failed");
-		jack_check_client_status (engine);
-	}
+	engine->control->wakeup_method = JACK_WAKEUP_FIFO;
 
-	if (!engine->freewheeling) {
-		if (jack_drivers_write (engine, nframes)) {
-			goto unlock;
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
+		if (client->wake_word >= 0) {
+			jack_wakeup_post (&engine->control->graph_wakeup[client->wake_word],
+					  JACK_WAKEUP_EVENT);
 		}
 	}
+}
 
-	jack_engine_post_process (engine);
+/* The wakeup word an external client sleeps on, which it keeps for
+ * as long as it lives; see wakeup.h.
+ */
+static int
+jack_client_wake_word (jack_engine_t *engine, jack_client_internal_t *client)
+{
+	/* caller must hold client_lock */
+	JSList *node;
+	int word;
 
-	if (delayed_usecs > engine->control->max_delayed_usecs) {
-		engine->control->max_delayed_usecs = delayed_usecs;
+	if (client->wake_word >= 0) {
+		return client->wake_word;
 	}
 
-	ret = 0;
+	/* jack_check_wakeup_slots() makes sure there is one free */
 
-unlock:
-	jack_unlock_graph (engine);
-	DEBUG ("cycle finished, status = %d", ret);
+	for (word = JACK_GRAPH_WAKEUPS - JACK_CLIENT_WAKEUPS;
+	     word < JACK_GRAPH_WAKEUPS; ++word) {
+		for (node = engine->clients; node; node = jack_slist_next (node)) {
+			if (((jack_client_internal_t*)node->data)->wake_word == word) {
+				break;
+			}
+		}
+		if (node == NULL) {
+			break;
+		}
+	}
 
-	return ret;
+	engine->control->graph_wakeup[word] = 0;
+	client->wake_word = word;
+	return word;
 }
 
+/* Tell an external client where it now sits in the graph, and that
+ * it hands the cycle on to wakeup word `next' (see wakeup.h). One
+ * whose FIFOs and words are the same as last time has nothing to
+ * reopen, so we leave it alone unless it asked to hear about every
+ * graph order change.
+ */
 static void
-jack_engine_driver_exit (jack_engine_t* engine)
+jack_deliver_reorder (jack_engine_t *engine, jack_client_internal_t *client,
+		      jack_event_t *event, int next)
 {
-	jack_driver_t* driver = engine->driver;
+	/* caller must hold client_lock */
 
-	VERBOSE (engine, "stopping driver");
-	driver->stop (driver);
-	VERBOSE (engine, "detaching driver");
-	driver->detach (driver, engine);
+	event->z.wakeup.word = jack_client_wake_word (engine, client);
+	event->z.wakeup.next = next;
 
-	/* tell anyone waiting that the driver exited. */
-	kill (engine->wait_pid, SIGUSR2);
+	if (client->wait_slot == (int)event->x.n &&
+	    client->wait_upstream == (int)event->y.n &&
+	    client->wake_next == next &&
+	    !client->control->graph_order_cbset) {
+		VERBOSE (engine, "client %s: graph position unchanged",
+			 client->control->name);
+		return;
+	}
 
-	engine->driver = NULL;
+	jack_deliver_event (engine, client, event);
+	client->wait_slot = event->x.n;
+	client->wait_upstream = event->y.n;
+	client->wake_next = next;
 }
 
+/* In DAG mode there is no chain: each external client is a subgraph
+ * of its own, started by the server writing to FIFO 2n and handing
+ * control back through FIFO 2n+1, so that any number of them can run
+ * at the same time. Ordering comes from the graph compiled by
+ * jack_dag_compile().
+ */
 static int
-jack_run_cycle (jack_engine_t *engine, jack_nframes_t nframes,
-		float delayed_usecs)
+jack_rechain_graph_parallel (jack_engine_t *engine)
 {
-	jack_time_t now = engine->driver->last_wait_ust;
-	jack_time_t dus = 0;
-	jack_time_t p_usecs = engine->driver->period_usecs;
-	jack_nframes_t b_size = engine->control->buffer_size;
-	jack_nframes_t left;
-	jack_frame_timer_t* timer = &engine->control->frame_timer;
+	JSList *node;
+	unsigned long n, fifo;
+	jack_event_t event;
 
-	if (engine->verbose) {
-		if (nframes != b_size) {
-			VERBOSE (engine,
-				 "late driver wakeup: nframes to process = %"
-				 PRIu32 ".", nframes);
-		}
-	}
+	VALGRIND_MEMSET (&event, 0, sizeof(event));
 
-	/* Run as many cycles as it takes to consume nframes */
+	jack_clear_fifos (engine);
 
-	for (left = nframes; left >= b_size; left -= b_size) {
-		/* Change: the DLL code is now inside this loop which ensures
-		   that more than one period is run if more than a buffer size
-		   of frames is available. This is a very unlikely event, but
-		   it is possible and now handled correctly.
-		   FA 25/06/2014
-		 */
-		/* Change: 'first_wakeup' now means only the very first wakeup
-		   after the engine was created. In that case frame time is not
-		   modified, it stays at the initialised value.
-		   OTOH 'reset_pending' is  used after freewheeling or an xrun.
-		   In those cases frame time is adjusted by using the difference
-		   in usecs time between the end of the previous period and the
-		   start of the current one. This way, a client monitoring the
-		   frame time for the start of each period will have a correct
-		   idea of the number of frames that were skipped.
-		   FA 25/06/2014
-		 */
-		/* Change: in contrast to previous versions, the DLL is *not*
-		   run if any of the two conditions above is true, it is just
-		   initialised correctly for the current period. Previously it
-		   was initialised and then run, which meant that the requred
-		   initialisation was rather counter-intiutive.
-		   FA 25/06/2014
-		 */
-		/* Added initialisation of timer->period_usecs, required
-		   due to the modified implementation of the DLL itself.
-		   OTOH, this should maybe not be repeated after e.g.
-		   freewheeling or an xrun, as the current value would be
-		   more accurate than the nominal one. But it doesn't really
-		   harm either.
-		   FA 13/02/2012
-		 */
-		/* Added initialisation of timer->filter_omega. This makes
-		   the DLL bandwidth independent of the actual period time.
-		   The bandwidth is now 1/8 Hz in all cases. The value of
-		   timer->filter_omega is 2 * pi * BW * Tperiod.
-		   FA 13/02/2012
-		 */
+	VERBOSE (engine, "++ jack_rechain_graph_parallel():");
 
-		// maybe need a memory barrier here
-		timer->guard1++;
+	event.type = GraphReordered;
 
-		if (timer->reset_pending) {
-			// Adjust frame time after a discontinuity.
-			// The frames of the previous period.
-			timer->frames += b_size;
-			// The frames that were skipped.
-			dus = now - timer->next_wakeup;
-			timer->frames += (dus * b_size) / p_usecs;
-		}
-		if (engine->first_wakeup || timer->reset_pending) {
-			// First wakeup or after discontinuity.
-			// Initialiase the DLL.
-			timer->current_wakeup = now;
-			timer->next_wakeup = now + p_usecs;
-			timer->period_usecs = (float)p_usecs;
-			timer->filter_omega = timer->period_usecs * 7.854e-7f;
-			timer->initialized = 1;
+	for (n = 0, fifo = 0, node = engine->clients; node;
+	     node = jack_slist_next (node)) {
 
-			// Reset both conditions.
-			engine->first_wakeup = 0;
-			timer->reset_pending = 0;
-		} else {
-			// Normal cycle. This code was originally in
-			// jack_inc_frame_time() but only used here.
-			// Moving it here means that now all code
-			// related to timekeeping is close together
-			// and easy to understand.
-			float delta = (float)((int64_t)now - (int64_t)timer->next_wakeup);
-			delta *= timer->filter_omega;
-			timer->current_wakeup = timer->next_wakeup;
-			timer->frames += b_size;
-			timer->period_usecs += timer->filter_omega * delta;
-			timer->next_wakeup += (int64_t)floorf (timer->period_usecs + 1.41f * delta + 0.5f);
+		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
+
+		if (!client->control->active || client->skipped ||
+		    (!client->control->process_cbset && !client->control->thread_cb_cbset)) {
+			continue;
 		}
 
-		// maybe need a memory barrier here
-		timer->guard2++;
+		client->execution_order = n++;
+		client->next_client = NULL;
 
-		if (jack_run_one_cycle (engine, b_size, delayed_usecs)) {
-			jack_error ("cycle execution failure, exiting");
-			return EIO;
+		if (jack_client_is_internal (client)) {
+			VERBOSE (engine, "client %s: internal client, "
+				 "execution_order=%lu.",
+				 client->control->name,
+				 client->execution_order);
+			jack_deliver_event (engine, client, &event);
+			continue;
 		}
+
+		client->subgraph_start_fd = jack_get_fifo_fd (engine, fifo);
+		client->subgraph_wait_fd = jack_get_fifo_fd (engine, fifo + 1);
+		client->subgraph_start_slot = fifo;
+		client->subgraph_wait_slot = fifo + 1;
+
+		VERBOSE (engine, "client %s: start_fd=%d, wait_fd=%d, "
+			 "execution_order=%lu.",
+			 client->control->name,
+			 client->subgraph_start_fd,
+			 client->subgraph_wait_fd,
+			 client->execution_order);
+
+		event.x.n = fifo;
+		event.y.n = 1;          /* upstream is always jackd */
+		jack_deliver_reorder (engine, client, &event, fifo + 1);
+
+		fifo += 2;
 	}
 
-	return 0;
+	VERBOSE (engine, "-- jack_rechain_graph_parallel()");
+
+	return jack_dag_compile (engine);
 }
 
-void
-jack_engine_delete (jack_engine_t *engine)
+int
+jack_rechain_graph (jack_engine_t *engine)
 {
-	int i;
+	JSList *node, *next;
+	unsigned long n;
+	int err = 0;
+	jack_client_internal_t *subgraph_client, *next_client;
+	jack_event_t event;
+	int upstream_is_jackd;
 
-	if (engine == NULL) {
-		return;
+	jack_check_wakeup_slots (engine);
+
+	engine->async_head = NULL;
+
+	if (engine->dag) {
+		return jack_rechain_graph_parallel (engine);
 	}
 
-	VERBOSE (engine, "starting server engine shutdown");
+	VALGRIND_MEMSET (&event, 0, sizeof(event));
 
-	jack_stop_freewheeling (engine, 1);
+	jack_clear_fifos (engine);
 
-	engine->control->engine_ok = 0; /* tell clients we're going away */
+	subgraph_client = 0;
 
-	/* this will wake the server thread and cause it to exit */
+	VERBOSE (engine, "++ jack_rechain_graph():");
 
-	close (engine->cleanup_fifo[0]);
-	close (engine->cleanup_fifo[1]);
+	event.type = GraphReordered;
 
-	/* shutdown master socket to prevent new clients arriving */
-	shutdown (engine->fds[0], SHUT_RDWR);
-	// close (engine->fds[0]);
+	for (n = 0, node = engine->clients, next = NULL; node; node = next) {
 
-	/* now really tell them we're going away */
+		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
 
-	for (i = 0; i < engine->pfd_max; ++i)
-		shutdown (engine->pfd[i].fd, SHUT_RDWR);
+		next = jack_slist_next (node);
 
-	if (engine->driver) {
-		jack_driver_t* driver = engine->driver;
+		if ((!client->control->process_cbset && !client->control->thread_cb_cbset)
+		    || client->skipped || client->control->delayed) {
+			continue;
+		}
 
-		VERBOSE (engine, "stopping driver");
-		driver->stop (driver);
-		// VERBOSE (engine, "detaching driver");
-		// driver->detach (driver, engine);
-		VERBOSE (engine, "unloading driver");
-		jack_driver_unload (driver);
-		engine->driver = NULL;
-	}
+		VERBOSE (engine, "+++ client is now %s active ? %d",
+			 client->control->name, client->control->active);
 
-	VERBOSE (engine, "freeing shared port segments");
-	for (i = 0; i < engine->control->n_port_types; ++i) {
-		jack_release_shm (&engine->port_segment[i]);
-		jack_destroy_shm (&engine->port_segment[i]);
-	}
+		if (client->control->active) {
 
-	/* stop the other engine threads */
-	VERBOSE (engine, "stopping server thread");
+			/* find the next active client. its ok for
+			 * this to be NULL */
 
-#if JACK_USE_MACH_THREADS
-	// MacOSX pthread_cancel still not implemented correctly in Darwin
-	mach_port_t machThread = pthread_mach_thread_np (engine->server_thread);
-	thread_terminate (machThread);
-#else
-	pthread_cancel (engine->server_thread);
-	pthread_join (engine->server_thread, NULL);
-#endif
+			while (next) {
+				jack_client_control_t *nctl =
+					((jack_client_internal_t*)next->data)->control;
+				if (nctl->active && !((jack_client_internal_t*)next->data)->skipped
+				    && !nctl->delayed
+				    && (nctl->process_cbset || nctl->thread_cb_cbset)) {
+					break;
+				}
+				next = jack_slist_next (next);
+			}
 
+			if (next == NULL) {
+				next_client = NULL;
+			} else {
+				next_client = (jack_client_internal_t*)
+					      next->data;
+			}
 
-	VERBOSE (engine, "last xrun delay: %.3f usecs",
-		 engine->control->xrun_delayed_usecs);
-	VERBOSE (engine, "max delay reported by backend: %.3f usecs",
-		 engine->control->max_delayed_usecs);
+			client->execution_order = n;
+			client->next_client = next_client;
+
+			if (jack_client_is_internal (client)) {
+
+				/* break the chain for the current
+				 * subgraph. the server will wait for
+				 * chain on the nth FIFO, and will
+				 * then execute this internal
+				 * client. */
+
+				if (subgraph_client) {
+					subgraph_client->subgraph_wait_fd =
+						jack_get_fifo_fd (engine, n);
+					subgraph_client->subgraph_wait_slot = n;
+					VERBOSE (engine, "client %s: wait_fd="
+						 "%d, execution_order="
+						 "%lu.",
+						 subgraph_client->
+						 control->name,
+						 subgraph_client->
+						 subgraph_wait_fd, n);
+					n++;
+				}
+
+				VERBOSE (engine, "client %s: internal "
+					 "client, execution_order="
+					 "%lu.",
+					 client->control->name, n);
+
+				/* this does the right thing for
+				 * internal clients too
+				 */
+
+				jack_deliver_event (engine, client, &event);
 
-	/* free engine control shm segment */
-	engine->control = NULL;
-	VERBOSE (engine, "freeing engine shared memory");
-	jack_release_shm (&engine->control_shm);
-	jack_destroy_shm (&engine->control_shm);
+				subgraph_client = 0;
 
-	VERBOSE (engine, "max usecs: %.3f, engine deleted", engine->max_usecs);
+			} else {
 
-	free (engine);
+				if (subgraph_client == NULL) {
 
-	jack_messagebuffer_exit ();
-}
+					/* start a new subgraph. the
+					 * engine will start the chain
+					 * by writing to the nth
+					 * FIFO.
+					 */
 
-void
-jack_port_clear_connections (jack_engine_t *engine,
-			     jack_port_internal_t *port)
-{
-	JSList *node, *next;
+					subgraph_client = client;
+					subgraph_client->subgraph_start_fd =
+						jack_get_fifo_fd (engine, n);
+					subgraph_client->subgraph_start_slot = n;
+					VERBOSE (engine, "client %s: "
+						 "start_fd=%d, execution"
+						 "_order=%lu.",
+						 subgraph_client->
+						 control->name,
+						 subgraph_client->
+						 subgraph_start_fd, n);
 
-	for (node = port->connections; node; ) {
-		next = jack_slist_next (node);
-		jack_port_disconnect_internal (
-			engine, ((jack_connection_internal_t*)
-				 node->data)->source,
-			((jack_connection_internal_t*)
-			 node->data)->destination);
-		node = next;
-	}
+					/* this external client after
+					   this will have jackd as its
+					   upstream connection.
+					 */
 
-	jack_slist_free (port->connections);
-	port->connections = 0;
-}
+					upstream_is_jackd = 1;
 
-static void
-jack_deliver_event_to_all (jack_engine_t *engine, jack_event_t *event)
-{
-	JSList *node;
+				} else {
+					VERBOSE (engine, "client %s: in"
+						 " subgraph after %s, "
+						 "execution_order="
+						 "%lu.",
+						 client->control->name,
+						 subgraph_client->
+						 control->name, n);
+					subgraph_client->subgraph_wait_fd = -1;
+					subgraph_client->subgraph_wait_slot = -1;
 
-	jack_rdlock_graph (engine);
-	for (node = engine->clients; node; node = jack_slist_next (node)) {
-		jack_deliver_event (engine,
-				    (jack_client_internal_t*)node->data,
-				    event);
-	}
-	jack_unlock_graph (engine);
-}
+					/* this external client after
+					   this will have another
+					   client as its upstream
+					   connection.
+					 */
 
-static void jack_do_get_client_by_uuid (jack_engine_t *engine, jack_request_t *req)
-{
-	JSList *node;
+					upstream_is_jackd = 0;
+				}
 
-	req->status = -1;
-	for (node = engine->clients; node; node = jack_slist_next (node)) {
-		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
-		if (jack_uuid_compare (client->control->uuid, req->x.client_id) == 0) {
-			snprintf ( req->x.port_info.name, sizeof(req->x.port_info.name), "%s", client->control->name );
-			req->status = 0;
-			return;
+				/* make sure fifo for 'n + 1' exists
+				 * before issuing client reorder
+				 */
+				(void)jack_get_fifo_fd (
+					engine, client->execution_order + 1);
+				event.x.n = client->execution_order;
+				event.y.n = upstream_is_jackd;
+				/* the next external client in this subgraph,
+				   or the server, which waits on word n + 1 */
+				jack_deliver_reorder (engine, client, &event,
+						      next_client && !jack_client_is_internal (next_client) ?
+						      jack_client_wake_word (engine, next_client) :
+						      (int)client->execution_order + 1);
+				n++;
+			}
 		}
 	}
-}
 
-static void jack_do_get_uuid_by_client_name (jack_engine_t *engine, jack_request_t *req)
-{
-	JSList *node;
+	if (subgraph_client) {
+		subgraph_client->subgraph_wait_fd =
+			jack_get_fifo_fd (engine, n);
+		subgraph_client->subgraph_wait_slot = n;
+		VERBOSE (engine, "client %s: wait_fd=%d, "
+			 "execution_order=%lu (last client).",
+			 subgraph_client->control->name,
+			 subgraph_client->subgraph_wait_fd, n);
+		n++;
+	}
 
-	req->status = -1;
+	/* the async stage is one more subgraph, after everything else */
 
-	if (strcmp (req->x.name, "system") == 0) {
-		/* request concerns the driver */
-		if (engine->driver) {
-			jack_uuid_copy (&req->x.client_id, engine->driver->internal_client->control->uuid);
-			req->status = 0;
-		}
-		return;
-	}
+	subgraph_client = NULL;
 
 	for (node = engine->clients; node; node = jack_slist_next (node)) {
+
 		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
-		if (strcmp (client->control->name, req->x.name) == 0) {
-			jack_uuid_copy (&req->x.client_id, client->control->uuid);
-			req->status = 0;
-			return;
+
+		if (!client->control->delayed || client->skipped) {
+			continue;
 		}
-	}
-}
 
-static void jack_do_reserve_name (jack_engine_t *engine, jack_request_t *req)
-{
-	jack_reserved_name_t *reservation;
-	JSList *node;
+		client->execution_order = n;
+		client->next_client = NULL;
 
-	// check is name is free...
-	for (node = engine->clients; node; node = jack_slist_next (node)) {
-		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
-		if ( !strcmp ( (char*)client->control->name, req->x.reservename.name )) {
-			req->status = -1;
-			return;
+		if (subgraph_client == NULL) {
+			engine->async_head = client;
+			client->subgraph_start_fd = jack_get_fifo_fd (engine, n);
+			client->subgraph_start_slot = n;
+		} else {
+			subgraph_client->next_client = client;
 		}
-	}
 
-	reservation = malloc (sizeof(jack_reserved_name_t));
-	if (reservation == NULL) {
-		req->status = -1;
-		return;
-	}
+		VERBOSE (engine, "client %s: async, execution_order=%lu.",
+			 client->control->name, n);
 
-	snprintf (reservation->name, sizeof(reservation->name), "%s", req->x.reservename.name);
-	jack_uuid_copy (&reservation->uuid, req->x.reservename.uuid);
-	engine->reserved_client_names = jack_slist_append (engine->reserved_client_names, reservation);
+		for (next = jack_slist_next (node); next; next = jack_slist_next (next)) {
+			next_client = (jack_client_internal_t*)next->data;
+			if (next_client->control->delayed && !next_client->skipped) {
+				break;
+			}
+		}
 
-	req->status = 0;
-}
+		(void)jack_get_fifo_fd (engine, n + 1);
+		event.x.n = n;
+		event.y.n = (subgraph_client == NULL);
+		jack_deliver_reorder (engine, client, &event,
+				      next ? jack_client_wake_word (engine, next_client) :
+				      (int)n + 1);
 
-static int jack_send_session_reply ( jack_engine_t *engine, jack_client_internal_t *client )
-{
-	if (write (engine->session_reply_fd, (const void*)&client->control->uuid, sizeof(client->control->uuid))
-	    < (ssize_t)sizeof(client->control->uuid)) {
-		jack_error ("cannot write SessionNotify result "
-			    "to client via fd = %d (%s)",
-			    engine->session_reply_fd, strerror (errno));
-		return -1;
-	}
-	if (write (engine->session_reply_fd, (const void*)client->control->name, sizeof(client->control->name))
-	    < (ssize_t)sizeof(client->control->name)) {
-		jack_error ("cannot write SessionNotify result "
-			    "to client via fd = %d (%s)",
-			    engine->session_reply_fd, strerror (errno));
-		return -1;
-	}
-	if (write (engine->session_reply_fd, (const void*)client->control->session_command,
-		   sizeof(client->control->session_command))
-	    < (ssize_t)sizeof(client->control->session_command)) {
-		jack_error ("cannot write SessionNotify result "
-			    "to client via fd = %d (%s)",
-			    engine->session_reply_fd, strerror (errno));
-		return -1;
+		subgraph_client = client;
+		n++;
 	}
-	if (write (engine->session_reply_fd, (const void*)( &client->control->session_flags ),
-		   sizeof(client->control->session_flags))
-	    < (ssize_t)sizeof(client->control->session_flags)) {
-		jack_error ("cannot write SessionNotify result "
-			    "to client via fd = %d (%s)",
-			    engine->session_reply_fd, strerror (errno));
-		return -1;
+
+	if (engine->async_head) {
+		engine->async_head->subgraph_wait_fd = jack_get_fifo_fd (engine, n);
+		engine->async_head->subgraph_wait_slot = n;
 	}
 
-	return 0;
+	VERBOSE (engine, "-- jack_rechain_graph()");
+
+	return err;
 }
 
-static int
-jack_do_session_notify (jack_engine_t *engine, jack_request_t *req, int reply_fd )
+static jack_nframes_t
+jack_get_port_total_latency (jack_engine_t *engine,
+			     jack_port_internal_t *port, int hop_count,
+			     int toward_port)
 {
 	JSList *node;
-	jack_event_t event;
+	jack_nframes_t latency;
+	jack_nframes_t max_latency = 0;
 
-	int reply;
-	jack_uuid_t finalizer;
-	struct stat sbuf;
+#ifdef DEBUG_TOTAL_LATENCY_COMPUTATION
+	char prefix[32];
+	int i;
 
-	jack_uuid_clear (&finalizer);
+	for (i = 0; i < hop_count; ++i)
+		prefix[i] = '\t';
 
-	if (engine->session_reply_fd != -1) {
-		// we should have a notion of busy or somthing.
-		// just sending empty reply now.
-		goto send_final;
-	}
+	prefix[i] = '\0';
+#endif
 
-	engine->session_reply_fd = reply_fd;
-	engine->session_pending_replies = 0;
+	/* call tree must hold engine->client_lock. */
 
-	event.type = SaveSession;
-	event.y.n = req->x.session.type;
+	latency = port->shared->latency;
 
-	/* GRAPH MUST BE LOCKED : see callers of jack_send_connection_notification()
+	/* we don't prevent cyclic graphs, so we have to do something
+	   to bottom out in the event that they are created.
 	 */
 
-	if (stat (req->x.session.path, &sbuf) != 0 || !S_ISDIR (sbuf.st_mode)) {
-		jack_error ("session parent directory (%s) does not exist", req->x.session.path);
-		goto send_final;
+	if (hop_count > 8) {
+		return latency;
 	}
 
-	for (node = engine->clients; node; node = jack_slist_next (node)) {
-		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
-		if (client->control->session_cbset) {
+#ifdef DEBUG_TOTAL_LATENCY_COMPUTATION
+	jack_info ("%sFor port %s (%s)", prefix, port->shared->name, (toward_port ? "toward" : "away"));
+#endif
+
+	for (node = port->connections; node; node = jack_slist_next (node)) {
+
+		jack_nframes_t this_latency;
+		jack_connection_internal_t *connection;
+
+		connection = (jack_connection_internal_t*)node->data;
+
+
+		if ((toward_port &&
+		     (connection->source->shared == port->shared)) ||
+		    (!toward_port &&
+		     (connection->destination->shared == port->shared))) {
+
+#ifdef DEBUG_TOTAL_LATENCY_COMPUTATION
+			jack_info ("%s\tskip connection %s->%s",
+				   prefix,
+				   connection->source->shared->name,
+				   connection->destination->shared->name);
+#endif
+
+			continue;
+		}
+
+#ifdef DEBUG_TOTAL_LATENCY_COMPUTATION
+		jack_info ("%s\tconnection %s->%s ... ",
+			   prefix,
+			   connection->source->shared->name,
+			   connection->destination->shared->name);
+#endif
+		/* if we're a destination in the connection, recurse
+		   on the source to get its total latency
+		 */
+
+		if (connection->destination == port) {
 
-			// in case we only want to send to a special client.
-			// uuid assign is still complete. not sure if thats necessary.
-			if ( (req->x.session.target[0] != 0) && strcmp (req->x.session.target, (char*)client->control->name) ) {
-				continue;
+			if (connection->source->shared->flags
+			    & JackPortIsTerminal) {
+				this_latency = connection->source->
+					       shared->latency;
+			} else {
+				this_latency =
+					jack_get_port_total_latency (
+						engine, connection->source,
+						hop_count + 1,
+						toward_port);
 			}
 
-			/* the caller of jack_session_notify() is required to have created the session dir
-			 */
+		} else {
 
-			if (req->x.session.path[strlen (req->x.session.path) - 1] == '/') {
-				snprintf (event.x.name, sizeof(event.x.name), "%s%s/", req->x.session.path, client->control->name );
+			/* "port" is the source, so get the latency of
+			 * the destination */
+			if (connection->destination->shared->flags
+			    & JackPortIsTerminal) {
+				this_latency = connection->destination->
+					       shared->latency;
 			} else {
-				snprintf (event.x.name, sizeof(event.x.name), "%s/%s/", req->x.session.path, client->control->name );
-			}
-			if (mkdir (event.x.name, 0777) != 0) {
-				jack_error ("cannot create session directory (%s) for client %s: %s",
-					    event.x.name, client->control->name, strerror (errno));
-				break;
+				this_latency =
+					jack_get_port_total_latency (
+						engine,
+						connection->destination,
+						hop_count + 1,
+						toward_port);
 			}
+		}
 
-			reply = jack_deliver_event (engine, client, &event);
-			if (reply == 1) {
-				// delayed reply
-				engine->session_pending_replies += 1;
-				client->session_reply_pending = TRUE;
-			} else if (reply == 2) {
-				// immediate reply
-				if (jack_send_session_reply (engine, client)) {
-					goto error_out;
-				}
-			}
+		if (this_latency > max_latency) {
+			max_latency = this_latency;
 		}
 	}
 
-	if (engine->session_pending_replies != 0) {
-		return 0;
-	}
+#ifdef DEBUG_TOTAL_LATENCY_COMPUTATION
+	jack_info ("%s\treturn %lu + %lu = %lu", prefix, latency, max_latency, latency + max_latency);
+#endif
 
-send_final:
-	if (write (reply_fd, &finalizer, sizeof(finalizer))
-	    < (ssize_t)sizeof(finalizer)) {
-		jack_error ("cannot write SessionNotify result "
-			    "to client via fd = %d (%s)",
-			    reply_fd, strerror (errno));
-		goto error_out;
-	}
+	return latency + max_latency;
+}
 
-	engine->session_reply_fd = -1;
-	return 0;
-error_out:
-	return -3;
+static void
+jack_compute_port_total_latency (jack_engine_t* engine, jack_port_shared_t* port)
+{
+	if (port->in_use) {
+		port->total_latency =
+			jack_get_port_total_latency (
+				engine, &engine->internal_ports[port->id],
+				0, !(port->flags & JackPortIsOutput));
+	}
 }
 
-static int
-jack_do_has_session_cb (jack_engine_t *engine, jack_request_t *req)
+static void
+jack_compute_all_port_total_latencies (jack_engine_t *engine)
 {
-	jack_client_internal_t *client;
-	int retval = -1;
+	jack_port_shared_t *shared = engine->control->ports;
+	uint32_t high = engine->control->port_high;
+	unsigned int i;
+	int toward_port;
 
-	client = jack_client_by_name (engine, req->x.name);
-	if (client == NULL) {
-		goto out;
+	for (i = jack_port_next_in_use (engine->control, 0, high); i < high;
+	     i = jack_port_next_in_use (engine->control, i + 1, high)) {
+
+		if (shared[i].flags & JackPortIsOutput) {
+			toward_port = FALSE;
+		} else {
+			toward_port = TRUE;
+		}
+
+		shared[i].total_latency =
+			jack_get_port_total_latency (
+				engine, &engine->internal_ports[i],
+				0, toward_port);
 	}
+}
 
-	retval = client->control->session_cbset ? 1 : 0;
-out:
-	return retval;
+/* Latency changes are tracked per client: a connection marks the
+ * clients at both ends, a jack_recompute_total_latencies() the client
+ * that asked. The next wave then only goes to the clients a change can
+ * affect -- capture latency flows downstream of the dirty clients and
+ * playback latency upstream -- using engine->reach. Anything that
+ * cannot be pinned on a client (a new buffer size, a request from an
+ * older libjack) marks everything.
+ */
+static void
+jack_latency_mark_dirty (jack_engine_t *engine, jack_client_internal_t *client)
+{
+	/* caller must hold engine->client_lock */
+
+	if (client) {
+		client->latency_dirty = 1;
+	} else {
+		engine->latency_all_dirty = 1;
+	}
 }
 
-static void jack_do_session_reply (jack_engine_t *engine, jack_request_t *req )
+/* Fill `down' with the dirty clients and everything they feed, `up'
+ * with the dirty clients and everything that feeds them. Returns 0 if
+ * every client has to be told instead; feedback connections are not
+ * in the reach sets the way latency flows, so they count as that too.
+ */
+static int
+jack_latency_affected (jack_engine_t *engine, bitset_t *down, bitset_t *up)
 {
-	jack_uuid_t client_id;
+	/* caller must hold engine->client_lock */
 	jack_client_internal_t *client;
-	jack_uuid_t finalizer = JACK_UUID_EMPTY_INITIALIZER;
-
-	jack_uuid_copy (&client_id, req->x.client_id);
-	client = jack_client_internal_by_id (engine, client_id);
-	jack_uuid_clear (&finalizer);
+	JSList *node;
+	int dirty = 0;
 
-	req->status = 0;
+	if (engine->latency_all_dirty || engine->feedbackcount) {
+		return 0;
+	}
 
-	client->session_reply_pending = 0;
+	if (!engine->reach_valid) {
+		jack_reach_rebuild (engine);
+	}
 
-	if (engine->session_reply_fd == -1) {
-		jack_error ("spurious Session Reply");
-		return;
+	if (!engine->reach_valid || engine->reach_size == 0) {
+		return 0;
 	}
 
-	engine->session_pending_replies -= 1;
+	bitset_create (down, engine->reach_size);
+	bitset_create (up, engine->reach_size);
 
-	if (jack_send_session_reply (engine, client)) {
-		// maybe need to fix all client pendings.
-		// but we will just get a set of spurious replies now.
-		engine->session_reply_fd = -1;
-		return;
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t*)node->data;
+		if (client->latency_dirty) {
+			bitset_add (*down, client->sort_index);
+			bitset_union (*down, engine->reach[client->sort_index]);
+			bitset_add (*up, client->sort_index);
+			dirty++;
+		}
 	}
 
-	if (engine->session_pending_replies == 0) {
-		if (write (engine->session_reply_fd, &finalizer, sizeof(finalizer))
-		    < (ssize_t)sizeof(finalizer)) {
-			jack_error ("cannot write SessionNotify result "
-				    "to client via fd = %d (%s)",
-				    engine->session_reply_fd, strerror (errno));
-			req->status = -1;
+	if (dirty == 0) {
+		bitset_destroy (down);
+		bitset_destroy (up);
+		return 0;
+	}
+
+	/* reach is transitive, so growing `up' as we go is harmless */
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t*)node->data;
+		if (bitset_intersects (engine->reach[client->sort_index], *up)) {
+			bitset_add (*up, client->sort_index);
 		}
-		engine->session_reply_fd = -1;
 	}
+
+	return 1;
 }
 
 static void
-jack_notify_all_port_interested_clients (jack_engine_t *engine, jack_uuid_t src, jack_uuid_t dst, jack_port_id_t a, jack_port_id_t b, int connected)
+jack_latency_range_merge (jack_latency_range_t *range,
+			  jack_port_shared_t *port,
+			  jack_latency_callback_mode_t mode)
 {
-	JSList *node;
-	jack_event_t event;
-
-	event.type = (connected ? PortConnected : PortDisconnected);
-	event.x.self_id = a;
-	event.y.other_id = b;
+	jack_latency_range_t other = (mode == JackCaptureLatency) ?
+				     port->capture_latency :
+				     port->playback_latency;
 
-	/* GRAPH MUST BE LOCKED : see callers of jack_send_connection_notification()
-	 */
+	if (other.max > range->max) {
+		range->max = other.max;
+	}
+	if (other.min < range->min) {
+		range->min = other.min;
+	}
+}
 
-	jack_client_internal_t* src_client = jack_client_internal_by_id (engine, src);
-	jack_client_internal_t* dst_client = jack_client_internal_by_id (engine, dst);
+/* as jack_port_set_latency_range() */
+static void
+jack_port_shared_set_latency_range (jack_port_shared_t *port,
+				    jack_latency_callback_mode_t mode,
+				    jack_latency_range_t *range)
+{
+	unsigned long backend = (mode == JackCaptureLatency) ?
+				JackPortIsOutput : JackPortIsInput;
 
-	for (node = engine->clients; node; node = jack_slist_next (node)) {
-		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
-		if (src_client != client &&  dst_client  != client && client->control->port_connect_cbset != FALSE) {
+	if (mode == JackCaptureLatency) {
+		port->capture_latency = *range;
+	} else {
+		port->playback_latency = *range;
+	}
 
-			/* one of the ports belong to this client or it has a port connect callback */
-			jack_deliver_event (engine, client, &event);
-		}
+	if ((port->flags & backend) && (port->flags & JackPortIsPhysical)) {
+		port->latency = (range->min + range->max) / 2;
 	}
 }
 
-int
-jack_deliver_event (jack_engine_t *engine, jack_client_internal_t *client,
-		    const jack_event_t *event, ...)
+/* What jack_client_handle_latency_callback() does for a client that
+ * has no latency callback, or has published its latency, done here so
+ * that an external client is not woken up for it.
+ */
+static void
+jack_client_latency_default (jack_engine_t *engine,
+			     jack_client_internal_t *client,
+			     jack_latency_callback_mode_t mode)
 {
-	va_list ap;
-	char status = 0;
-	char* key = 0;
-	size_t keylen = 0;
-
-	va_start (ap, event);
-
-	/* caller must hold the graph lock */
+	/* caller must hold engine->client_lock */
+	jack_latency_range_t through = { UINT32_MAX, 0 };
+	jack_latency_range_t range;
+	jack_connection_internal_t *connection;
+	jack_port_internal_t *port, *other;
+	unsigned long edge;
+	JSList *node, *cnode;
 
-	DEBUG ("delivering event (type %s)", jack_event_type_name (event->type));
+	/* the ports facing the rest of the graph in this mode follow
+	   their connections; the others get the largest of those */
+	edge = (mode == JackCaptureLatency) ? JackPortIsInput : JackPortIsOutput;
 
-	/* we are not RT-constrained here, so use kill(2) to beef up
-	   our check on a client's continued well-being
-	 */
+	for (node = client->ports; node; node = jack_slist_next (node)) {
+		port = (jack_port_internal_t*)node->data;
 
-	if (client->control->dead || client->error >= JACK_ERROR_WITH_SOCKETS
-	    || (client->control->type == ClientExternal && kill (client->control->pid, 0))) {
-		DEBUG ("client %s is dead - no event sent",
-		       client->control->name);
-		va_end (ap);
-		return 0;
-	}
+		if (!(port->shared->flags & edge)) {
+			continue;
+		}
 
-	DEBUG ("client %s is still alive", client->control->name);
+		range.min = UINT32_MAX;
+		range.max = 0;
 
-	/* Check property change events for matching key_size and keys */
+		for (cnode = port->connections; cnode;
+		     cnode = jack_slist_next (cnode)) {
+			connection = (jack_connection_internal_t*)cnode->data;
+			other = (connection->source == port) ?
+				connection->destination : connection->source;
+			jack_latency_range_merge (&range, other->shared, mode);
+		}
 
-	if (event->type == PropertyChange) {
-		key = va_arg (ap, char*);
-		if (key && key[0] != '\0') {
-			keylen = strlen (key) + 1;
-			if (event->y.key_size != keylen) {
-				jack_error ("property change key %s sent with wrong length (%d vs %d)", key, event->y.key_size, keylen);
-				va_end (ap);
-				return -1;
-			}
+		if (range.min == UINT32_MAX) {
+			range.min = 0;
 		}
+
+		jack_port_shared_set_latency_range (port->shared, mode, &range);
+		jack_latency_range_merge (&through, port->shared, mode);
 	}
 
-	va_end (ap);
+	if (through.min == UINT32_MAX) {
+		through.min = 0;
+	}
 
-	if (jack_client_is_internal (client)) {
+	if (client->control->latency_published & (1 << mode)) {
+		through.min += client->control->latency_added[mode].min;
+		through.max += client->control->latency_added[mode].max;
+	}
 
-		switch (event->type) {
-		case PortConnected:
-		case PortDisconnected:
-			jack_client_handle_port_connection
-				(client->private_client, event);
-			break;
+	for (node = client->ports; node; node = jack_slist_next (node)) {
+		port = (jack_port_internal_t*)node->data;
 
-		case BufferSizeChange:
-			jack_client_fix_port_buffers (client->private_client);
+		if (!(port->shared->flags & edge)) {
+			jack_port_shared_set_latency_range (port->shared, mode,
+							    &through);
+		}
+	}
+}
 
-			if (client->control->bufsize_cbset) {
-				if (event->x.n < 16) {
-					abort ();
-				}
-				client->private_client->bufsize
-					(event->x.n, client->private_client->bufsize_arg);
-			}
-			break;
+static void
+jack_deliver_latency (jack_engine_t *engine, jack_client_internal_t *client,
+		      jack_event_t *event)
+{
+	jack_latency_callback_mode_t mode = event->x.n ?
+					    JackPlaybackLatency :
+					    JackCaptureLatency;
+
+	if (client->control->type == ClientExternal &&
+	    (!client->control->latency_cbset ||
+	     (client->control->latency_published & (1 << mode)))) {
+		if (client->control->active && !client->control->dead) {
+			jack_client_latency_default (engine, client, mode);
+		}
+		return;
+	}
 
-		case SampleRateChange:
-			if (client->control->srate_cbset) {
-				client->private_client->srate
-					(event->x.n,
-					client->private_client->srate_arg);
-			}
-			break;
+	jack_deliver_event (engine, client, event);
+}
 
-		case GraphReordered:
-			if (client->control->graph_order_cbset) {
-				client->private_client->graph_order
-					(client->private_client->graph_order_arg);
-			}
-			break;
+static void
+jack_compute_new_latency (jack_engine_t *engine)
+{
+	JSList *node;
+	JSList *reverse_list = NULL;
+	jack_event_t event;
+	bitset_t down = NULL;
+	bitset_t up = NULL;
+	int partial;
+	unsigned int told = 0, count = 0;
 
-		case XRun:
-			if (client->control->xrun_cbset) {
-				client->private_client->xrun
-					(client->private_client->xrun_arg);
-			}
-			break;
+	VALGRIND_MEMSET (&event, 0, sizeof(event));
 
-		case PropertyChange:
-			if (client->control->property_cbset) {
-				client->private_client->property_cb
-					(event->x.uuid, key, event->z.property_change, client->private_client->property_cb_arg);
-			}
-			break;
+	partial = jack_latency_affected (engine, &down, &up);
 
-		case LatencyCallback:
-			jack_client_handle_latency_callback (client->private_client, event, (client->control->type == ClientDriver));
-			break;
+	event.type = LatencyCallback;
+	event.x.n  = 0;
 
-		default:
-			/* internal clients don't need to know */
-			break;
+	/* iterate over all clients in graph order, and emit
+	 * capture latency callback.
+	 * also builds up list in reverse graph order.
+	 */
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+
+		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
+		reverse_list = jack_pool_slist_prepend (reverse_list, client);
+		count++;
+		if (!partial || client->control->type == ClientDriver ||
+		    bitset_contains (down, client->sort_index)) {
+			jack_deliver_latency (engine, client, &event);
+			told++;
 		}
+	}
 
-	} else {
+	if (engine->driver) {
+		jack_deliver_event (engine, engine->driver->internal_client, &event);
+	}
 
-		if (client->control->active) {
+	/* now issue playback latency callbacks in reverse graphorder
+	 */
+	event.x.n  = 1;
+	for (node = reverse_list; node; node = jack_slist_next (node)) {
+		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
+		client->latency_dirty = 0;
+		if (!partial || client->control->type == ClientDriver ||
+		    bitset_contains (up, client->sort_index)) {
+			jack_deliver_latency (engine, client, &event);
+			told++;
+		}
+	}
 
-			/* there's a thread waiting for events, so
-			 * it's worth telling the client */
+	if (engine->driver) {
+		jack_deliver_event (engine, engine->driver->internal_client, &event);
+	}
 
-			DEBUG ("engine writing on event fd");
+	jack_pool_slist_free (reverse_list);
 
-			if (write (client->event_fd, event, sizeof(*event)) != sizeof(*event)) {
-				jack_error ("cannot send event to client [%s] (%s)",
-					    client->control->name,
-					    strerror (errno));
-				client->error += JACK_ERROR_WITH_SOCKETS;
-				jack_engine_signal_problems (engine);
-			}
+	if (partial) {
+		VERBOSE (engine, "latency waves made %u of %u client visits",
+			 told, 2 * count);
+		bitset_destroy (&down);
+		bitset_destroy (&up);
+	}
 
-			/* for property changes, deliver the extra data representing
-			   the variable length "key" that has changed in some way.
-			 */
+	engine->latency_all_dirty = 0;
+}
 
-			if (event->type == PropertyChange) {
-				if (keylen) {
-					if (write (client->event_fd, key, keylen) != keylen) {
-						jack_error ("cannot send property change key to client [%s] (%s)",
-							    client->control->name,
-							    strerror (errno));
-						client->error += JACK_ERROR_WITH_SOCKETS;
-						jack_engine_signal_problems (engine);
-					}
-				}
-			}
 
-			if (client->error) {
-				status = -1;
-			} else {
-				// then we check whether there really is an error.... :)
-
-				struct pollfd pfd[1];
-				pfd[0].fd = client->event_fd;
-				pfd[0].events = POLLERR | POLLIN | POLLHUP | POLLNVAL;
-				jack_time_t poll_timeout = JACKD_CLIENT_EVENT_TIMEOUT;
-				int poll_ret;
-				jack_time_t then = jack_get_microseconds ();
-				jack_time_t now;
-
-				/* if we're not running realtime and there is a client timeout set
-				   that exceeds the default client event timeout (which is not
-				   bound by RT limits, then use the larger timeout.
-				 */
+/* Hand every connection to the recorder, as "source\tdestination"
+ * lines; the caller holds the graph lock. */
+static void
+jack_capture_connections (jack_engine_t *engine)
+{
+	jack_port_shared_t *shared = engine->control->ports;
+	uint32_t high = engine->control->port_high;
+	char *text = NULL, *t;
+	size_t len = 0, size = 0, need;
+	uint32_t i;
+	JSList *node;
 
-				if (!engine->control->real_time && (engine->client_timeout_msecs > poll_timeout)) {
-					poll_timeout = engine->client_timeout_msecs;
-				}
+	for (i = jack_port_next_in_use (engine->control, 0, high); i < high;
+	     i = jack_port_next_in_use (engine->control, i + 1, high)) {
+		jack_port_internal_t *port = &engine->internal_ports[i];
 
-#ifdef __linux
-again:
-#endif
-				VERBOSE (engine, "client event poll on %d for %s starts at %lld",
-					 client->event_fd, client->control->name, then);
-				if ((poll_ret = poll (pfd, 1, poll_timeout)) < 0) {
-					DEBUG ("client event poll not ok! (-1) poll returned an error");
-					jack_error ("poll on subgraph processing failed (%s)", strerror (errno));
-					status = -1;
-				} else {
+		if (!(shared[i].flags & JackPortIsOutput)) {
+			continue;
+		}
 
-					DEBUG ("\n\n\n\n\n back from client event poll, revents = 0x%x\n\n\n", pfd[0].revents);
-					now = jack_get_microseconds ();
-					VERBOSE (engine, "back from client event poll after %lld usecs", now - then);
+		for (node = port->connections; node; node = jack_slist_next (node)) {
+			jack_connection_internal_t *c =
+				(jack_connection_internal_t*)node->data;
 
-					if (pfd[0].revents & ~POLLIN) {
+			if (c->source != port) {
+				continue;
+			}
 
-						/* some kind of OOB socket event */
+			need = strlen (c->source->shared->name)
+			       + strlen (c->destination->shared->name) + 3;
+			if (len + need > size) {
+				size = (len + need) * 2;
+				if ((t = realloc (text, size)) == NULL) {
+					free (text);
+					return;
+				}
+				text = t;
+			}
+			len += snprintf (text + len, size - len, "%s\t%s\n",
+					 c->source->shared->name,
+					 c->destination->shared->name);
+		}
+	}
 
-						DEBUG ("client event poll not ok! (-2), revents = %d\n", pfd[0].revents);
-						jack_error ("subgraph starting at %s lost client", client->control->name);
-						status = -2;
+	jack_capture_graph (engine, text, len);
+}
 
-					} else if (pfd[0].revents & POLLIN) {
+/* How the sort works:
+ *
+ * Each client has a "sortfeeds" list of clients indicating which clients
+ * it should be considered as feeding for the purposes of sorting the
+ * graph. This list differs from the clients it /actually/ feeds in the
+ * following ways:
+ *
+ * 1. Connections from a client to itself are disregarded
+ *
+ * 2. Connections to a driver client are disregarded
+ *
+ * 3. If a connection from A to B is a feedback connection (ie there was
+ *    already a path from B to A when the connection was made) then instead
+ *    of B appearing on A's sortfeeds list, A will appear on B's sortfeeds
+ *    list.
+ *
+ * If client A is on client B's sortfeeds list, client A must come after
+ * client B in the execution order. The above 3 rules ensure that the
+ * sortfeeds relation is always acyclic so that all ordering constraints
+ * can actually be met.
+ *
+ * Each client also has a "truefeeds" list which is the same as sortfeeds
+ * except that feedback connections appear normally instead of reversed.
+ * This is used to detect whether the graph has become acyclic.
+ *
+ * The sort itself is a topological sort of the sortfeeds relation, see
+ * jack_graph_topo_order(). Deciding whether a new connection is a
+ * feedback connection means asking whether its destination already
+ * reaches its source, which engine->reach answers without a walk.
+ *
+ */
 
-						/* client responded normally */
+void
+jack_sort_graph (jack_engine_t *engine)
+{
+	/* called, obviously, must hold engine->client_lock */
 
-						DEBUG ("client event poll ok!");
-						status = 0;
+	VERBOSE (engine, "++ jack_sort_graph");
+	jack_graph_change_begin (engine);
+	engine->graph_sort_pending = 0;
+	jack_sort_clients (engine);
+	jack_mark_async_clients (engine);
+	jack_plan_sums (engine);
+	jack_compute_all_port_total_latencies (engine);
+	jack_compute_new_latency (engine);
+	jack_mark_live_clients (engine);
+	jack_rechain_graph (engine);
+	engine->timeout_count = 0;
+	jack_graph_change_end (engine);
+	JACK_PROBE1 (graph_reorder, engine->graph_generation);
+	jack_xrun_dump_graph_event (engine, "graph sorted");
+	if (engine->capture) {
+		jack_capture_connections (engine);
+	}
+	VERBOSE (engine, "-- jack_sort_graph");
+}
 
-					} else if (poll_ret == 0) {
+/* Graph snapshots.
+ *
+ * A cycle that finds the graph lock taken by the server thread used to
+ * be a null cycle, even when whoever held the lock was not changing
+ * anything the cycle looks at. Instead, the cycle now runs from the
+ * published snapshot of the execution order, without the lock.
+ *
+ * Everything that changes what a cycle looks at -- the client list and
+ * its order, the FIFO chain, activation and port connections -- is
+ * done between jack_graph_change_begin() and jack_graph_change_end(),
+ * with the graph write lock held. The first takes the snapshot down
+ * and waits for a cycle still running from it to finish; the second
+ * publishes a new one. So as long as a snapshot is published, the
+ * clients it points to, and engine->clients, stay as they were when
+ * it was taken, and the rest of the cycle may still walk them. A
+ * cycle that arrives while a change is under way finds no snapshot
+ * and runs a null cycle as before.
+ */
 
-						/* no events, no errors, we woke up because poll()
-						   decided that time was up ...
-						 */
+/* With --idle, the engine runs the driver's null cycle instead of a
+ * full one as long as the graph would do nothing: no active client has
+ * a callback in the cycle and no driver port is connected.  Drivers
+ * that can are also asked to wake up less often, see
+ * JackDriverIdleFunction.  Caller holds the graph write lock.
+ */
+static int
+jack_graph_idle (jack_engine_t *engine)
+{
+	JSList *node, *pnode;
 
-#ifdef __linux
-						if (linux_poll_bug_encountered (engine, then, &poll_timeout)) {
-							goto again;
-						}
-
-						if (poll_timeout < 200) {
-							VERBOSE (engine, "FALSE WAKEUP skipped, remaining = %lld usec", poll_timeout);
-							status = 0;
-						} else {
-#endif
-						DEBUG ("client event poll not ok! (1 = poll timed out, revents = 0x%04x, poll_ret = %d)", pfd[0].revents, poll_ret);
-						VERBOSE (engine, "client %s did not respond to event type %d in time"
-							 "(fd=%d, revents = 0x%04x, timeout was %lld)",
-							 client->control->name, event->type,
-							 client->event_fd,
-							 pfd[0].revents,
-							 poll_timeout);
-						status = -2;
-#ifdef __linux
-					}
-#endif
-					}
-				}
-			}
+	if (engine->slave_drivers) {
+		return FALSE;   /* they have nothing like a null cycle */
+	}
 
-			if (status == 0) {
-				if (read (client->event_fd, &status, sizeof(status)) != sizeof(status)) {
-					jack_error ("cannot read event response from client [%s] (%s)",
-						    client->control->name,
-						    strerror (errno));
-					status = -1;
-				}
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client = (jack_client_internal_t*)node->data;
+		jack_client_control_t *ctl = client->control;
 
-			} else {
-				switch (status) {
-				case -1:
-					jack_error ("internal poll failure reading response from client %s to a %s event",
-						    client->control->name,
-						    jack_event_type_name (event->type));
-					break;
-				case -2:
-					jack_error ("timeout waiting for client %s to handle a %s event",
-						    client->control->name,
-						    jack_event_type_name (event->type));
-					break;
-				default:
-					jack_error ("bad status (%d) from client %s while handling a %s event",
-						    (int)status,
-						    client->control->name,
-						    jack_event_type_name (event->type));
+		if (ctl->type == ClientDriver) {
+			for (pnode = client->ports; pnode; pnode = jack_slist_next (pnode)) {
+				if (((jack_port_internal_t*)pnode->data)->connections) {
+					return FALSE;
 				}
 			}
-
-			if (status < 0) {
-				client->error += JACK_ERROR_WITH_SOCKETS;
-				jack_engine_signal_problems (engine);
-			}
+		} else if (ctl->active
+			   && (ctl->process_cbset || ctl->thread_cb_cbset
+			       || ctl->sync_cb_cbset || ctl->timebase_cb_cbset)) {
+			return FALSE;
 		}
 	}
-	DEBUG ("event delivered");
 
-	return status;
+	return TRUE;
 }
 
-int
-jack_rechain_graph (jack_engine_t *engine)
-{
-	JSList *node, *next;
-	unsigned long n;
-	int err = 0;
-	jack_client_internal_t *subgraph_client, *next_client;
-	jack_event_t event;
-	int upstream_is_jackd;
+#define JACK_IDLE_WAKEUP_USECS 20000
 
-	VALGRIND_MEMSET (&event, 0, sizeof(event));
+/* called by the engine thread when the graph goes idle or busy */
+static void
+jack_engine_set_idle (jack_engine_t *engine, int idle)
+{
+	jack_driver_t *driver = engine->driver;
+	unsigned int periods = 0;
 
-	jack_clear_fifos (engine);
+	engine->driver_idle = idle;
 
-	subgraph_client = 0;
+	if (idle) {
+		if (driver->period_usecs) {
+			periods = JACK_IDLE_WAKEUP_USECS / driver->period_usecs;
+		}
+		engine->control->cpu_load = 0.0f;
+	} else {
+		/* the samples from before are no guide */
+		jack_engine_reset_rolling_usecs (engine);
+	}
 
-	VERBOSE (engine, "++ jack_rechain_graph():");
+	if (driver->idle) {
+		driver->idle (driver, periods > 1 ? periods : 0);
+	}
 
-	event.type = GraphReordered;
+	VERBOSE (engine, idle ? "graph idle, running null cycles"
+		 : "graph busy, running full cycles");
+}
 
-	for (n = 0, node = engine->clients, next = NULL; node; node = next) {
+/* Compile the steps a serial cycle takes, so that the engine thread
+ * walks an array rather than the client list, and decides once per
+ * graph change, not once per cycle, which clients it leaves out.
+ * Activation, callbacks, delay (the async stage) and skipping only
+ * change with the graph; a client found dead is still passed over
+ * when the step comes up.
+ */
+static void
+jack_schedule_compile (jack_engine_t *engine, jack_graph_snapshot_t *snapshot)
+{
+	jack_schedule_step_t *step = snapshot->steps;
+	jack_client_internal_t *client;
+	jack_client_control_t *ctl;
+	unsigned int i;
 
-		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
+	for (i = 0; i < snapshot->nclients; ) {
 
-		next = jack_slist_next (node);
+		client = snapshot->clients[i];
+		ctl = client->control;
 
-		if (!client->control->process_cbset && !client->control->thread_cb_cbset) {
+		if (!ctl->active ||
+		    (!ctl->process_cbset && !ctl->thread_cb_cbset) ||
+		    client->skipped || ctl->delayed) {
+			i++;
 			continue;
 		}
 
-		VERBOSE (engine, "+++ client is now %s active ? %d",
-			 client->control->name, client->control->active);
-
-		if (client->control->active) {
+		step->client = client;
+		step->control = ctl;
+		step->internal = jack_client_is_internal (client);
+		step++;
 
-			/* find the next active client. its ok for
-			 * this to be NULL */
+#ifdef JACK_USE_MACH_THREADS
+		i++;
+#else
+		if (jack_client_is_internal (client)) {
+			i++;
+		} else {
+			/* the subgraph runs up to the next internal client */
+			while (++i < snapshot->nclients
+			       && !jack_client_is_internal (snapshot->clients[i])) ;
+		}
+#endif
+	}
 
-			while (next) {
-				if (client->control->active && (client->control->process_cbset || client->control->thread_cb_cbset)) {
-					break;
-				}
-				next = jack_slist_next (next);
-			}
-			;
+	snapshot->nsteps = step - snapshot->steps;
+}
 
-			if (next == NULL) {
-				next_client = NULL;
-			} else {
-				next_client = (jack_client_internal_t*)
-					      next->data;
-			}
+static void
+jack_graph_snapshot_publish (jack_engine_t *engine)
+{
+	jack_graph_snapshot_t *snapshot;
+	unsigned int n;
+	JSList *node;
 
-			client->execution_order = n;
-			client->next_client = next_client;
+	n = jack_slist_length (engine->clients);
 
-			if (jack_client_is_internal (client)) {
+	if ((snapshot = (jack_graph_snapshot_t*)
+		     malloc (sizeof(jack_graph_snapshot_t)
+			     + n * sizeof(jack_client_internal_t*)
+			     + n * sizeof(jack_client_control_t*)
+			     + n * sizeof(jack_schedule_step_t))) == NULL) {
+		/* cycles will just have to wait for the lock */
+		jack_error ("cannot allocate graph snapshot");
+		return;
+	}
 
-				/* break the chain for the current
-				 * subgraph. the server will wait for
-				 * chain on the nth FIFO, and will
-				 * then execute this internal
-				 * client. */
+	snapshot->generation = ++engine->graph_generation;
+	snapshot->nclients = n;
+	snapshot->controls = (jack_client_control_t**)(snapshot->clients + n);
+	snapshot->steps = (jack_schedule_step_t*)(snapshot->controls + n);
 
-				if (subgraph_client) {
-					subgraph_client->subgraph_wait_fd =
-						jack_get_fifo_fd (engine, n);
-					VERBOSE (engine, "client %s: wait_fd="
-						 "%d, execution_order="
-						 "%lu.",
-						 subgraph_client->
-						 control->name,
-						 subgraph_client->
-						 subgraph_wait_fd, n);
-					n++;
-				}
+	for (n = 0, node = engine->clients; node; node = jack_slist_next (node)) {
+		snapshot->clients[n] = (jack_client_internal_t*)node->data;
+		snapshot->controls[n] = snapshot->clients[n]->control;
+		n++;
+	}
 
-				VERBOSE (engine, "client %s: internal "
-					 "client, execution_order="
-					 "%lu.",
-					 client->control->name, n);
+	jack_schedule_compile (engine, snapshot);
 
-				/* this does the right thing for
-				 * internal clients too
-				 */
+	__sync_synchronize ();
+	engine->graph_snapshot = snapshot;
+}
 
-				jack_deliver_event (engine, client, &event);
+void
+jack_graph_change_begin (jack_engine_t *engine)
+{
+	/* caller must hold the graph write lock */
+	jack_graph_snapshot_t *old;
 
-				subgraph_client = 0;
+	if (engine->graph_changes++) {
+		return;
+	}
 
-			} else {
+	if ((old = engine->graph_snapshot) == NULL) {
+		return;
+	}
 
-				if (subgraph_client == NULL) {
+	engine->graph_snapshot = NULL;
+	__sync_synchronize ();
 
-					/* start a new subgraph. the
-					 * engine will start the chain
-					 * by writing to the nth
-					 * FIFO.
-					 */
+	/* at most one cycle, and the graph lock keeps the next one
+	   from starting with this snapshot */
 
-					subgraph_client = client;
-					subgraph_client->subgraph_start_fd =
-						jack_get_fifo_fd (engine, n);
-					VERBOSE (engine, "client %s: "
-						 "start_fd=%d, execution"
-						 "_order=%lu.",
-						 subgraph_client->
-						 control->name,
-						 subgraph_client->
-						 subgraph_start_fd, n);
+	while (engine->cycle_snapshot == old) {
+		usleep (100);
+	}
 
-					/* this external client after
-					   this will have jackd as its
-					   upstream connection.
-					 */
+	free (old);
+}
 
-					upstream_is_jackd = 1;
+void
+jack_graph_change_end (jack_engine_t *engine)
+{
+	/* caller must hold the graph write lock */
 
-				} else {
-					VERBOSE (engine, "client %s: in"
-						 " subgraph after %s, "
-						 "execution_order="
-						 "%lu.",
-						 client->control->name,
-						 subgraph_client->
-						 control->name, n);
-					subgraph_client->subgraph_wait_fd = -1;
+	if (--engine->graph_changes) {
+		return;
+	}
 
-					/* this external client after
-					   this will have another
-					   client as its upstream
-					   connection.
-					 */
+	if (idle_cycles) {
+		engine->graph_idle = jack_graph_idle (engine);
+	}
+	jack_graph_snapshot_publish (engine);
+}
 
-					upstream_is_jackd = 0;
-				}
+/* called by the engine thread when it cannot take the graph lock */
+static jack_graph_snapshot_t *
+jack_graph_snapshot_acquire (jack_engine_t *engine)
+{
+	jack_graph_snapshot_t *snapshot;
 
-				/* make sure fifo for 'n + 1' exists
-				 * before issuing client reorder
-				 */
-				(void)jack_get_fifo_fd (
-					engine, client->execution_order + 1);
-				event.x.n = client->execution_order;
-				event.y.n = upstream_is_jackd;
-				jack_deliver_event (engine, client, &event);
-				n++;
-			}
-		}
+	if ((snapshot = engine->graph_snapshot) == NULL) {
+		return NULL;
 	}
 
-	if (subgraph_client) {
-		subgraph_client->subgraph_wait_fd =
-			jack_get_fifo_fd (engine, n);
-		VERBOSE (engine, "client %s: wait_fd=%d, "
-			 "execution_order=%lu (last client).",
-			 subgraph_client->control->name,
-			 subgraph_client->subgraph_wait_fd, n);
-	}
+	engine->cycle_snapshot = snapshot;
+	__sync_synchronize ();
 
-	VERBOSE (engine, "-- jack_rechain_graph()");
+	/* a change may have begun before it could see us */
 
-	return err;
+	if (engine->graph_snapshot != snapshot) {
+		engine->cycle_snapshot = NULL;
+		return NULL;
+	}
+
+	return snapshot;
 }
 
-static jack_nframes_t
-jack_get_port_total_latency (jack_engine_t *engine,
-			     jack_port_internal_t *port, int hop_count,
-			     int toward_port)
+static void
+jack_graph_snapshot_release (jack_engine_t *engine)
 {
-	JSList *node;
-	jack_nframes_t latency;
-	jack_nframes_t max_latency = 0;
-
-#ifdef DEBUG_TOTAL_LATENCY_COMPUTATION
-	char prefix[32];
-	int i;
+	__sync_synchronize ();
+	engine->cycle_snapshot = NULL;
+}
 
-	for (i = 0; i < hop_count; ++i)
-		prefix[i] = '\t';
+static void
+jack_cycle_unlock_graph (jack_engine_t *engine, jack_graph_snapshot_t *snapshot)
+{
+	if (snapshot) {
+		jack_graph_snapshot_release (engine);
+	} else {
+		jack_unlock_graph (engine);
+	}
+}
 
-	prefix[i] = '\0';
-#endif
+/* Connection changes go through here rather than straight to
+ * jack_sort_graph(), so that a client can apply a whole set of them
+ * with one re-sort. Anything that adds or removes clients from the
+ * graph still has to sort right away.
+ */
+static void
+jack_sort_graph_or_defer (jack_engine_t *engine)
+{
+	/* caller must hold engine->client_lock */
 
-	/* call tree must hold engine->client_lock. */
+	if (engine->graph_batch > 0) {
+		engine->graph_sort_pending = 1;
+		return;
+	}
 
-	latency = port->shared->latency;
+	jack_sort_graph (engine);
+}
 
-	/* we don't prevent cyclic graphs, so we have to do something
-	   to bottom out in the event that they are created.
-	 */
+static int
+jack_graph_batch (jack_engine_t *engine, jack_uuid_t client_id, int begin)
+{
+	/* caller must hold engine->client_lock */
+	jack_client_internal_t *client;
 
-	if (hop_count > 8) {
-		return latency;
+	if ((client = jack_client_internal_by_id (engine, client_id)) == NULL) {
+		jack_error ("unknown client id in graph batch request");
+		return -1;
 	}
 
-#ifdef DEBUG_TOTAL_LATENCY_COMPUTATION
-	jack_info ("%sFor port %s (%s)", prefix, port->shared->name, (toward_port ? "toward" : "away"));
-#endif
+	if (begin) {
+		client->graph_batch++;
+		engine->graph_batch++;
+		return 0;
+	}
 
-	for (node = port->connections; node; node = jack_slist_next (node)) {
+	if (client->graph_batch == 0) {
+		jack_error ("client %s ended a graph batch it never began",
+			    client->control->name);
+		return -1;
+	}
 
-		jack_nframes_t this_latency;
-		jack_connection_internal_t *connection;
+	client->graph_batch--;
+	engine->graph_batch--;
 
-		connection = (jack_connection_internal_t*)node->data;
+	if (engine->graph_batch == 0 && engine->graph_sort_pending) {
+		VERBOSE (engine, "applying deferred graph sort");
+		jack_sort_graph (engine);
+	}
 
+	return 0;
+}
 
-		if ((toward_port &&
-		     (connection->source->shared == port->shared)) ||
-		    (!toward_port &&
-		     (connection->destination->shared == port->shared))) {
+/* Kahn's algorithm over the sortfeeds lists. `order' must have room
+ * for every client; it is filled with a valid execution order and the
+ * number of clients that could actually be sorted is returned. Anything
+ * left over (which would mean sortfeeds has gone cyclic) is put at the
+ * end in list order.
+ */
+static unsigned int
+jack_graph_topo_order (jack_engine_t *engine, jack_client_internal_t **order,
+		       unsigned int n)
+{
+	/* caller must hold engine->client_lock */
+	JSList *node, *fnode;
+	jack_client_internal_t *client, *fed;
+	unsigned int head, tail, sorted;
 
-#ifdef DEBUG_TOTAL_LATENCY_COMPUTATION
-			jack_info ("%s\tskip connection %s->%s",
-				   prefix,
-				   connection->source->shared->name,
-				   connection->destination->shared->name);
-#endif
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		((jack_client_internal_t*)node->data)->sort_pending = 0;
+	}
 
-			continue;
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t*)node->data;
+		for (fnode = client->sortfeeds; fnode;
+		     fnode = jack_slist_next (fnode)) {
+			((jack_client_internal_t*)fnode->data)->sort_pending++;
 		}
+	}
 
-#ifdef DEBUG_TOTAL_LATENCY_COMPUTATION
-		jack_info ("%s\tconnection %s->%s ... ",
-			   prefix,
-			   connection->source->shared->name,
-			   connection->destination->shared->name);
-#endif
-		/* if we're a destination in the connection, recurse
-		   on the source to get its total latency
-		 */
+	/* drivers are forced to the front, ie considered as sources
+	   rather than sinks for purposes of the sort. nothing ever
+	   feeds them as far as sortfeeds is concerned. */
 
-		if (connection->destination == port) {
+	tail = 0;
 
-			if (connection->source->shared->flags
-			    & JackPortIsTerminal) {
-				this_latency = connection->source->
-					       shared->latency;
-			} else {
-				this_latency =
-					jack_get_port_total_latency (
-						engine, connection->source,
-						hop_count + 1,
-						toward_port);
-			}
+	for (node = engine->clients; node && tail < n;
+	     node = jack_slist_next (node)) {
+		client = (jack_client_internal_t*)node->data;
+		if (client->sort_pending == 0 &&
+		    client->control->type == ClientDriver) {
+			order[tail++] = client;
+		}
+	}
 
-		} else {
+	for (node = engine->clients; node && tail < n;
+	     node = jack_slist_next (node)) {
+		client = (jack_client_internal_t*)node->data;
+		if (client->sort_pending == 0 &&
+		    client->control->type != ClientDriver) {
+			order[tail++] = client;
+		}
+	}
 
-			/* "port" is the source, so get the latency of
-			 * the destination */
-			if (connection->destination->shared->flags
-			    & JackPortIsTerminal) {
-				this_latency = connection->destination->
-					       shared->latency;
-			} else {
-				this_latency =
-					jack_get_port_total_latency (
-						engine,
-						connection->destination,
-						hop_count + 1,
-						toward_port);
+	for (head = 0; head < tail; head++) {
+		for (fnode = order[head]->sortfeeds; fnode;
+		     fnode = jack_slist_next (fnode)) {
+			fed = (jack_client_internal_t*)fnode->data;
+			if (--fed->sort_pending == 0 && tail < n) {
+				order[tail++] = fed;
 			}
 		}
+	}
 
-		if (this_latency > max_latency) {
-			max_latency = this_latency;
+	sorted = tail;
+
+	for (node = engine->clients; node && tail < n;
+	     node = jack_slist_next (node)) {
+		client = (jack_client_internal_t*)node->data;
+		if (client->sort_pending > 0) {
+			order[tail++] = client;
 		}
 	}
 
-#ifdef DEBUG_TOTAL_LATENCY_COMPUTATION
-	jack_info ("%s\treturn %lu + %lu = %lu", prefix, latency, max_latency, latency + max_latency);
-#endif
-
-	return latency + max_latency;
+	return sorted;
 }
 
 static void
-jack_compute_port_total_latency (jack_engine_t* engine, jack_port_shared_t* port)
+jack_sort_clients (jack_engine_t *engine)
 {
-	if (port->in_use) {
-		port->total_latency =
-			jack_get_port_total_latency (
-				engine, &engine->internal_ports[port->id],
-				0, !(port->flags & JackPortIsOutput));
+	/* caller must hold engine->client_lock */
+	jack_client_internal_t **order;
+	unsigned int i, n, sorted;
+	JSList *node;
+
+	if ((n = jack_slist_length (engine->clients)) == 0) {
+		return;
+	}
+
+	if ((order = (jack_client_internal_t**)
+		     malloc (sizeof(jack_client_internal_t*) * n)) == NULL) {
+		jack_error ("cannot allocate memory to sort the graph");
+		return;
+	}
+
+	if ((sorted = jack_graph_topo_order (engine, order, n)) != n) {
+		jack_error ("graph sort: %u of %u clients are in a cycle",
+			    n - sorted, n);
 	}
+
+	/* reuse the list nodes, only their order changes */
+	for (i = 0, node = engine->clients; node;
+	     node = jack_slist_next (node), ++i) {
+		node->data = order[i];
+	}
+
+	free (order);
 }
 
+/* --skip-dead: a client is live if it is a driver, has a terminal
+ * input port, has no ports at all (we can't tell what it does), is the
+ * timebase master, or feeds a live client through its connections.
+ * The others are skipped by the process cycle, and told so.
+ */
 static void
-jack_compute_all_port_total_latencies (jack_engine_t *engine)
+jack_mark_live_clients (jack_engine_t *engine)
 {
-	jack_port_shared_t *shared = engine->control->ports;
-	unsigned int i;
-	int toward_port;
+	/* caller must hold engine->client_lock */
+	jack_client_internal_t **queue;
+	jack_client_internal_t *client;
+	jack_port_internal_t *port;
+	jack_connection_internal_t *connection;
+	jack_event_t event;
+	unsigned int n, head, tail;
+	JSList *node, *pnode, *cnode;
+	int skipped;
+
+	n = jack_slist_length (engine->clients);
+
+	if (!skip_dead_clients || n == 0) {
+		return;
+	}
+
+	if ((queue = (jack_client_internal_t**)
+		     malloc (sizeof(jack_client_internal_t*) * n)) == NULL) {
+		jack_error ("cannot allocate memory to find dead clients");
+		return;
+	}
+
+	tail = 0;
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t*)node->data;
+		client->live = (client->control->type == ClientDriver
+				|| client->ports == NULL
+				|| client == engine->timebase_client);
+
+		for (pnode = client->ports; pnode && !client->live;
+		     pnode = jack_slist_next (pnode)) {
+			port = (jack_port_internal_t*)pnode->data;
+			if ((port->shared->flags & JackPortIsInput)
+			    && (port->shared->flags & JackPortIsTerminal)) {
+				client->live = 1;
+			}
+		}
+
+		if (client->live) {
+			queue[tail++] = client;
+		}
+	}
+
+	for (head = 0; head < tail; head++) {
+		for (pnode = queue[head]->ports; pnode;
+		     pnode = jack_slist_next (pnode)) {
+			port = (jack_port_internal_t*)pnode->data;
+			if (!(port->shared->flags & JackPortIsInput)) {
+				continue;
+			}
+			for (cnode = port->connections; cnode;
+			     cnode = jack_slist_next (cnode)) {
+				connection = (jack_connection_internal_t*)cnode->data;
+				client = connection->srcclient;
+				if (!client->live) {
+					client->live = 1;
+					queue[tail++] = client;
+				}
+			}
+		}
+	}
+
+	free (queue);
+
+	VALGRIND_MEMSET (&event, 0, sizeof(event));
+	event.type = ProcessSkipped;
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t*)node->data;
+		skipped = !client->live;
 
-	for (i = 0; i < engine->control->port_max; i++) {
-		if (shared[i].in_use) {
+		if (skipped == client->skipped) {
+			continue;
+		}
 
-			if (shared[i].flags & JackPortIsOutput) {
-				toward_port = FALSE;
-			} else {
-				toward_port = TRUE;
-			}
+		VERBOSE (engine, "client %s is %s", client->control->name,
+			 skipped ? "dead, skipping it" : "live again");
+		client->skipped = skipped;
 
-			shared[i].total_latency =
-				jack_get_port_total_latency (
-					engine, &engine->internal_ports[i],
-					0, toward_port);
+		if (client->control->skip_cbset) {
+			event.x.n = skipped;
+			jack_deliver_event (engine, client, &event);
 		}
 	}
 }
 
+/* Rebuild engine->reach from scratch, walking the clients in reverse
+ * execution order so that everything a client feeds has been done by
+ * the time we get to it.
+ */
 static void
-jack_compute_new_latency (jack_engine_t *engine)
+jack_reach_rebuild (jack_engine_t *engine)
 {
-	JSList *node;
-	JSList *reverse_list = NULL;
-	jack_event_t event;
-
-	VALGRIND_MEMSET (&event, 0, sizeof(event));
-
-	event.type = LatencyCallback;
-	event.x.n  = 0;
-
-	/* iterate over all clients in graph order, and emit
-	 * capture latency callback.
-	 * also builds up list in reverse graph order.
-	 */
-	for (node = engine->clients; node; node = jack_slist_next (node)) {
+	/* caller must hold engine->client_lock */
+	jack_client_internal_t **order;
+	jack_client_internal_t *client, *fed;
+	unsigned int i, n;
+	JSList *node, *fnode;
+	bitset_t set;
+
+	n = jack_slist_length (engine->clients);
+
+	if (n != engine->reach_size) {
+		for (i = 0; i < engine->reach_size; i++) {
+			bitset_destroy (&engine->reach[i]);
+		}
+		free (engine->reach);
+		engine->reach = NULL;
+		engine->reach_size = 0;
 
-		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
-		reverse_list = jack_slist_prepend (reverse_list, client);
-		jack_deliver_event (engine, client, &event);
+		if (n && (engine->reach = (bitset_t*)
+			  calloc (n, sizeof(bitset_t))) == NULL) {
+			jack_error ("cannot allocate graph reachability sets");
+			return;
+		}
+		for (i = 0; i < n; i++) {
+			bitset_create (&engine->reach[i], n);
+		}
+		engine->reach_size = n;
+	} else {
+		for (i = 0; i < n; i++) {
+			bitset_clear (engine->reach[i]);
+		}
 	}
 
-	if (engine->driver) {
-		jack_deliver_event (engine, engine->driver->internal_client, &event);
+	if (n == 0) {
+		engine->reach_valid = TRUE;
+		return;
 	}
 
-	/* now issue playback latency callbacks in reverse graphorder
-	 */
-	event.x.n  = 1;
-	for (node = reverse_list; node; node = jack_slist_next (node)) {
-		jack_client_internal_t* client = (jack_client_internal_t*)node->data;
-		jack_deliver_event (engine, client, &event);
+	if ((order = (jack_client_internal_t**)
+		     malloc (sizeof(jack_client_internal_t*) * n)) == NULL) {
+		jack_error ("cannot allocate graph reachability sets");
+		return;
 	}
 
-	if (engine->driver) {
-		jack_deliver_event (engine, engine->driver->internal_client, &event);
+	for (i = 0, node = engine->clients; node;
+	     node = jack_slist_next (node), ++i) {
+		((jack_client_internal_t*)node->data)->sort_index = i;
 	}
 
-	jack_slist_free (reverse_list);
-}
-
-
-/* How the sort works:
- *
- * Each client has a "sortfeeds" list of clients indicating which clients
- * it should be considered as feeding for the purposes of sorting the
- * graph. This list differs from the clients it /actually/ feeds in the
- * following ways:
- *
- * 1. Connections from a client to itself are disregarded
- *
- * 2. Connections to a driver client are disregarded
- *
- * 3. If a connection from A to B is a feedback connection (ie there was
- *    already a path from B to A when the connection was made) then instead
- *    of B appearing on A's sortfeeds list, A will appear on B's sortfeeds
- *    list.
- *
- * If client A is on client B's sortfeeds list, client A must come after
- * client B in the execution order. The above 3 rules ensure that the
- * sortfeeds relation is always acyclic so that all ordering constraints
- * can actually be met.
- *
- * Each client also has a "truefeeds" list which is the same as sortfeeds
- * except that feedback connections appear normally instead of reversed.
- * This is used to detect whether the graph has become acyclic.
- *
- */
-
-void
-jack_sort_graph (jack_engine_t *engine)
-{
-	/* called, obviously, must hold engine->client_lock */
+	jack_graph_topo_order (engine, order, n);
 
-	VERBOSE (engine, "++ jack_sort_graph");
-	engine->clients = jack_slist_sort (engine->clients,
-					   (JCompareFunc)jack_client_sort);
-	jack_compute_all_port_total_latencies (engine);
-	jack_compute_new_latency (engine);
-	jack_rechain_graph (engine);
-	engine->timeout_count = 0;
-	VERBOSE (engine, "-- jack_sort_graph");
-}
+	for (i = n; i > 0; i--) {
+		client = order[i - 1];
+		set = engine->reach[client->sort_index];
+		for (fnode = client->sortfeeds; fnode;
+		     fnode = jack_slist_next (fnode)) {
+			fed = (jack_client_internal_t*)fnode->data;
+			bitset_add (set, fed->sort_index);
+			bitset_union (set, engine->reach[fed->sort_index]);
+		}
+	}
 
-static int
-jack_client_sort (jack_client_internal_t *a, jack_client_internal_t *b)
-{
-	/* drivers are forced to the front, ie considered as sources
-	   rather than sinks for purposes of the sort */
+	free (order);
 
-	if (jack_client_feeds_transitive (a, b) ||
-	    (a->control->type == ClientDriver &&
-	     b->control->type != ClientDriver)) {
-		return -1;
-	} else if (jack_client_feeds_transitive (b, a) ||
-		   (b->control->type == ClientDriver &&
-		    a->control->type != ClientDriver)) {
-		return 1;
-	} else {
-		return 0;
-	}
+	engine->reach_valid = TRUE;
 }
 
-/* transitive closure of the relation expressed by the sortfeeds lists. */
+/* the slow way, for when the reachability sets could not be built */
 static int
-jack_client_feeds_transitive (jack_client_internal_t *source,
-			      jack_client_internal_t *dest )
+jack_client_feeds_walk (jack_client_internal_t *source,
+			jack_client_internal_t *dest)
 {
 	jack_client_internal_t *med;
 	JSList *node;
@@ -3616,7 +8888,7 @@ jack_client_feeds_transitive (jack_client_internal_t *source,
 
 		med = (jack_client_internal_t*)node->data;
 
-		if (jack_client_feeds_transitive (med, dest)) {
+		if (jack_client_feeds_walk (med, dest)) {
 			return 1;
 		}
 	}
@@ -3624,6 +8896,52 @@ jack_client_feeds_transitive (jack_client_internal_t *source,
 	return 0;
 }
 
+/* Record a new sortfeeds edge in engine->reach: everything that could
+ * reach `source' can now also reach `dest' and whatever it feeds.
+ */
+static void
+jack_reach_add_edge (jack_engine_t *engine, jack_client_internal_t *source,
+		     jack_client_internal_t *dest)
+{
+	/* caller must hold engine->client_lock */
+	bitset_t to;
+	unsigned int i;
+
+	if (!engine->reach_valid) {
+		return;
+	}
+
+	for (i = 0; i < engine->reach_size; i++) {
+		to = engine->reach[i];
+		if (i == source->sort_index ||
+		    bitset_contains (to, source->sort_index)) {
+			bitset_add (to, dest->sort_index);
+			bitset_union (to, engine->reach[dest->sort_index]);
+		}
+	}
+}
+
+/* transitive closure of the relation expressed by the sortfeeds lists. */
+static int
+jack_client_feeds_transitive (jack_engine_t *engine,
+			      jack_client_internal_t *source,
+			      jack_client_internal_t *dest)
+{
+	/* caller must hold engine->client_lock */
+
+	if (!engine->reach_valid) {
+		jack_reach_rebuild (engine);
+	}
+
+	if (engine->reach_valid) {
+		return bitset_contains (engine->reach[source->sort_index],
+					dest->sort_index);
+	}
+
+	/* out of memory: ask the lists themselves */
+	return jack_client_feeds_walk (source, dest);
+}
+
 /**
  * Checks whether the graph has become acyclic and if so modifies client
  * sortfeeds lists to turn leftover feedback connections into normal ones.
@@ -3636,48 +8954,51 @@ jack_check_acyclic (jack_engine_t *engine)
 	jack_client_internal_t *src, *dst;
 	jack_port_internal_t *port;
 	jack_connection_internal_t *conn;
+	jack_client_internal_t **queue;
+	unsigned int n, head, tail;
 	int stuck;
-	int unsortedclients = 0;
 
 	VERBOSE (engine, "checking for graph become acyclic");
 
+	if ((n = jack_slist_length (engine->clients)) == 0) {
+		return;
+	}
+
+	if ((queue = (jack_client_internal_t**)
+		     malloc (sizeof(jack_client_internal_t*) * n)) == NULL) {
+		jack_error ("cannot allocate memory to check the graph");
+		return;
+	}
+
+	tail = 0;
+
 	for (srcnode = engine->clients; srcnode;
 	     srcnode = jack_slist_next (srcnode)) {
 
 		src = (jack_client_internal_t*)srcnode->data;
 		src->tfedcount = src->fedcount;
-		unsortedclients++;
+		if (!src->tfedcount) {
+			queue[tail++] = src;
+		}
 	}
 
-	stuck = FALSE;
-
 	/* find out whether a normal sort would have been possible */
-	while (unsortedclients && !stuck) {
-
-		stuck = TRUE;
-
-		for (srcnode = engine->clients; srcnode;
-		     srcnode = jack_slist_next (srcnode)) {
-
-			src = (jack_client_internal_t*)srcnode->data;
-
-			if (!src->tfedcount) {
+	for (head = 0; head < tail; head++) {
 
-				stuck = FALSE;
-				unsortedclients--;
-				src->tfedcount = -1;
+		for (dstnode = queue[head]->truefeeds; dstnode;
+		     dstnode = jack_slist_next (dstnode)) {
 
-				for (dstnode = src->truefeeds; dstnode;
-				     dstnode = jack_slist_next (dstnode)) {
-
-					dst = (jack_client_internal_t*)
-					      dstnode->data;
-					dst->tfedcount--;
-				}
+			dst = (jack_client_internal_t*)dstnode->data;
+			if (--dst->tfedcount == 0 && tail < n) {
+				queue[tail++] = dst;
 			}
 		}
 	}
 
+	free (queue);
+
+	stuck = (tail < n);
+
 	if (stuck) {
 
 		VERBOSE (engine, "graph is still cyclic" );
@@ -3713,12 +9034,12 @@ jack_check_acyclic (jack_engine_t *engine)
 							 conn->dstclient->control->name);
 						conn->dir = 1;
 						conn->dstclient->sortfeeds =
-							jack_slist_remove
+							jack_pool_slist_remove
 								(conn->dstclient->sortfeeds,
 								conn->srcclient);
 
 						conn->srcclient->sortfeeds =
-							jack_slist_prepend
+							jack_pool_slist_prepend
 								(conn->srcclient->sortfeeds,
 								conn->dstclient );
 					}
@@ -3726,6 +9047,7 @@ jack_check_acyclic (jack_engine_t *engine)
 			}
 		}
 		engine->feedbackcount = 0;
+		engine->reach_valid = FALSE;
 	}
 }
 
@@ -3762,6 +9084,29 @@ void jack_dump_configuration (jack_engine_t *engine, int take_lock)
 			   client->subgraph_start_fd,
 			   client->subgraph_wait_fd);
 
+		if (client->load_count) {
+			jack_client_load_t load;
+			jack_client_load_stats (client, &load);
+			jack_info ("\t process time over %" PRIu32 " cycles: "
+				   "p50 %.0f p99 %.0f max %.0f usecs",
+				   load.cycles, load.p50_usecs,
+				   load.p99_usecs, load.max_usecs);
+			if (load.perf_cycles) {
+				jack_info ("\t instructions per cycle p50 %.2f p1 %.2f, "
+					   "LLC misses p50 %.0f p99 %.0f",
+					   load.p50_ipc, load.p1_ipc,
+					   load.p50_llc_misses, load.p99_llc_misses);
+			}
+			if (load.fault_cycles) {
+				jack_info ("\t minor faults p99 %.0f max %.0f, "
+					   "major faults %" PRIu32 ", preempted in %"
+					   PRIu32 " of %" PRIu32 " cycles",
+					   load.p99_minor_faults, load.max_minor_faults,
+					   load.major_faults, load.preempted_cycles,
+					   load.fault_cycles);
+			}
+		}
+
 		for (m = 0, portnode = client->ports; portnode;
 		     portnode = jack_slist_next (portnode)) {
 			port = (jack_port_internal_t*)portnode->data;
@@ -3795,15 +9140,12 @@ void jack_dump_configuration (jack_engine_t *engine, int take_lock)
 }
 
 static int
-jack_port_do_connect (jack_engine_t *engine,
-		      const char *source_port,
-		      const char *destination_port)
+jack_port_connect_locked (jack_engine_t *engine,
+			  const char *source_port,
+			  const char *destination_port)
 {
-	jack_connection_internal_t *connection;
+	/* caller must hold engine->client_lock */
 	jack_port_internal_t *srcport, *dstport;
-	jack_port_id_t src_id, dst_id;
-	jack_client_internal_t *srcclient, *dstclient;
-	JSList *it;
 
 	if ((srcport = jack_get_port_by_name (engine, source_port)) == NULL) {
 		jack_error ("unknown source port in attempted connection [%s]",
@@ -3818,17 +9160,31 @@ jack_port_do_connect (jack_engine_t *engine,
 		return -1;
 	}
 
+	return jack_port_connect_internal (engine, srcport, dstport);
+}
+
+static int
+jack_port_connect_internal (jack_engine_t *engine,
+			    jack_port_internal_t *srcport,
+			    jack_port_internal_t *dstport)
+{
+	/* caller must hold engine->client_lock */
+	jack_connection_internal_t *connection;
+	jack_port_id_t src_id, dst_id;
+	jack_client_internal_t *srcclient, *dstclient;
+	JSList *it;
+
 	if ((dstport->shared->flags & JackPortIsInput) == 0) {
 		jack_error ("destination port in attempted connection of"
 			    " %s and %s is not an input port",
-			    source_port, destination_port);
+			    srcport->shared->name, dstport->shared->name);
 		return -1;
 	}
 
 	if ((srcport->shared->flags & JackPortIsOutput) == 0) {
 		jack_error ("source port in attempted connection of %s and"
 			    " %s is not an output port",
-			    source_port, destination_port);
+			    srcport->shared->name, dstport->shared->name);
 		return -1;
 	}
 
@@ -3873,6 +9229,23 @@ jack_port_do_connect (jack_engine_t *engine,
 		}
 	}
 
+	if (srcclient != dstclient
+	    && dstclient->control->type != ClientDriver
+	    && srcclient->control->type != ClientDriver) {
+		/* the dependency this connection would add, in the
+		   direction the sort below would give it */
+		int refused;
+
+		if (jack_client_feeds_transitive (engine, dstclient, srcclient)) {
+			refused = jack_admission_check (engine, NULL, dstclient, srcclient);
+		} else {
+			refused = jack_admission_check (engine, NULL, srcclient, dstclient);
+		}
+		if (refused) {
+			return EBUSY;
+		}
+	}
+
 	connection = (jack_connection_internal_t*)
 		     malloc (sizeof(jack_connection_internal_t));
 
@@ -3880,19 +9253,17 @@ jack_port_do_connect (jack_engine_t *engine,
 	connection->destination = dstport;
 	connection->srcclient = srcclient;
 	connection->dstclient = dstclient;
+	connection->gain = 1.0f;
 
 	src_id = srcport->shared->id;
 	dst_id = dstport->shared->id;
 
-	jack_lock_graph (engine);
-
 	if (dstport->connections && !dstport->shared->has_mixdown) {
 		jack_port_type_info_t *port_type =
 			jack_port_type_info (engine, dstport);
 		jack_error ("cannot make multiple connections to a port of"
 			    " type [%s]", port_type->type_name);
 		free (connection);
-		jack_unlock_graph (engine);
 		return -1;
 	} else {
 
@@ -3912,12 +9283,12 @@ jack_port_do_connect (jack_engine_t *engine,
 
 		} else if (srcclient != dstclient) {
 
-			srcclient->truefeeds = jack_slist_prepend
+			srcclient->truefeeds = jack_pool_slist_prepend
 						       (srcclient->truefeeds, dstclient);
 
 			dstclient->fedcount++;
 
-			if (jack_client_feeds_transitive (dstclient,
+			if (jack_client_feeds_transitive (engine, dstclient,
 							  srcclient ) ||
 			    (dstclient->control->type == ClientDriver &&
 			     srcclient->control->type != ClientDriver)) {
@@ -3930,8 +9301,9 @@ jack_port_do_connect (jack_engine_t *engine,
 					 srcport->shared->name,
 					 dstport->shared->name);
 
-				dstclient->sortfeeds = jack_slist_prepend
+				dstclient->sortfeeds = jack_pool_slist_prepend
 							       (dstclient->sortfeeds, srcclient);
+				jack_reach_add_edge (engine, dstclient, srcclient);
 
 				connection->dir = -1;
 				engine->feedbackcount++;
@@ -3948,8 +9320,9 @@ jack_port_do_connect (jack_engine_t *engine,
 					 srcport->shared->name,
 					 dstport->shared->name);
 
-				srcclient->sortfeeds = jack_slist_prepend
+				srcclient->sortfeeds = jack_pool_slist_prepend
 							       (srcclient->sortfeeds, dstclient);
+				jack_reach_add_edge (engine, srcclient, dstclient);
 
 				connection->dir = 1;
 			}
@@ -3964,10 +9337,13 @@ jack_port_do_connect (jack_engine_t *engine,
 			connection->dir = 0;
 		}
 
+		/* its sources are no longer those of its summing node */
+		dstport->shared->sum_port = JACK_NO_SUM;
 		dstport->connections =
-			jack_slist_prepend (dstport->connections, connection);
+			jack_pool_slist_prepend (dstport->connections, connection);
 		srcport->connections =
-			jack_slist_prepend (srcport->connections, connection);
+			jack_pool_slist_prepend (srcport->connections, connection);
+		jack_port_connection_map_set (engine, src_id, dst_id, TRUE);
 
 		DEBUG ("actually sorted the graph...");
 
@@ -3984,12 +9360,28 @@ jack_port_do_connect (jack_engine_t *engine,
 
 		jack_notify_all_port_interested_clients (engine, srcport->shared->client_id, dstport->shared->client_id, src_id, dst_id, 1);
 
-		jack_sort_graph (engine);
+		jack_latency_mark_dirty (engine, srcclient);
+		jack_latency_mark_dirty (engine, dstclient);
+		jack_sort_graph_or_defer (engine);
 	}
 
+	return 0;
+}
+
+static int
+jack_port_do_connect (jack_engine_t *engine,
+		      const char *source_port,
+		      const char *destination_port)
+{
+	int ret;
+
+	jack_lock_graph (engine);
+	jack_graph_change_begin (engine);
+	ret = jack_port_connect_locked (engine, source_port, destination_port);
+	jack_graph_change_end (engine);
 	jack_unlock_graph (engine);
 
-	return 0;
+	return ret;
 }
 
 int
@@ -4017,16 +9409,19 @@ jack_port_disconnect_internal (jack_engine_t *engine,
 				 srcport->shared->name,
 				 dstport->shared->name);
 
+			dstport->shared->sum_port = JACK_NO_SUM;
 			srcport->connections =
-				jack_slist_remove (srcport->connections,
-						   connect);
+				jack_pool_slist_remove (srcport->connections,
+							connect);
 			dstport->connections =
-				jack_slist_remove (dstport->connections,
-						   connect);
+				jack_pool_slist_remove (dstport->connections,
+							connect);
 
 			src_id = srcport->shared->id;
 			dst_id = dstport->shared->id;
 
+			jack_port_connection_map_set (engine, src_id, dst_id, FALSE);
+
 			/* this is a bit harsh, but it basically says
 			   that if we actually do a disconnect, and
 			   its the last one, then make sure that any
@@ -4050,6 +9445,9 @@ jack_port_disconnect_internal (jack_engine_t *engine,
 
 			jack_notify_all_port_interested_clients (engine, srcport->shared->client_id, dstport->shared->client_id, src_id, dst_id, 0);
 
+			jack_latency_mark_dirty (engine, connect->srcclient);
+			jack_latency_mark_dirty (engine, connect->dstclient);
+
 			if (connect->dir) {
 
 				jack_client_internal_t *src;
@@ -4061,7 +9459,8 @@ jack_port_disconnect_internal (jack_engine_t *engine,
 				dst =  jack_client_internal_by_id
 					      (engine, dstport->shared->client_id);
 
-				src->truefeeds = jack_slist_remove
+
+				src->truefeeds = jack_pool_slist_remove
 							 (src->truefeeds, dst);
 
 				dst->fedcount--;
@@ -4069,12 +9468,12 @@ jack_port_disconnect_internal (jack_engine_t *engine,
 				if (connect->dir == 1) {
 					/* normal connection: remove dest from
 					   source's sortfeeds list */
-					src->sortfeeds = jack_slist_remove
+					src->sortfeeds = jack_pool_slist_remove
 								 (src->sortfeeds, dst);
 				} else {
 					/* feedback connection: remove source
 					   from dest's sortfeeds list */
-					dst->sortfeeds = jack_slist_remove
+					dst->sortfeeds = jack_pool_slist_remove
 								 (dst->sortfeeds, src);
 					engine->feedbackcount--;
 					VERBOSE (engine,
@@ -4082,6 +9481,8 @@ jack_port_disconnect_internal (jack_engine_t *engine,
 						 engine->feedbackcount);
 
 				}
+
+				engine->reach_valid = FALSE;
 			} /* else self-connection: do nothing */
 
 			free (connect);
@@ -4094,7 +9495,7 @@ jack_port_disconnect_internal (jack_engine_t *engine,
 		jack_check_acyclic (engine);
 	}
 
-	jack_sort_graph (engine);
+	jack_sort_graph_or_defer (engine);
 
 	return ret;
 }
@@ -4113,41 +9514,194 @@ jack_port_do_disconnect_all (jack_engine_t *engine,
 		 engine->internal_ports[port_id].shared->name);
 
 	jack_lock_graph (engine);
+	jack_graph_change_begin (engine);
 	jack_port_clear_connections (engine, &engine->internal_ports[port_id]);
-	jack_sort_graph (engine);
+	jack_sort_graph_or_defer (engine);
+	jack_graph_change_end (engine);
+	jack_unlock_graph (engine);
+
+	return 0;
+}
+
+static int
+jack_port_disconnect_locked (jack_engine_t *engine,
+			     const char *source_port,
+			     const char *destination_port)
+{
+	/* caller must hold engine->client_lock */
+	jack_port_internal_t *srcport, *dstport;
+
+	if ((srcport = jack_get_port_by_name (engine, source_port)) == NULL) {
+		jack_error ("unknown source port in attempted disconnection"
+			    " [%s]", source_port);
+		return -1;
+	}
+
+	if ((dstport = jack_get_port_by_name (engine, destination_port))
+	    == NULL) {
+		jack_error ("unknown destination port in attempted"
+			    " disconnection [%s]", destination_port);
+		return -1;
+	}
+
+	return jack_port_disconnect_internal (engine, srcport, dstport);
+}
+
+static int
+jack_port_do_disconnect (jack_engine_t *engine,
+			 const char *source_port,
+			 const char *destination_port)
+{
+	int ret;
+
+	jack_lock_graph (engine);
+	jack_graph_change_begin (engine);
+	ret = jack_port_disconnect_locked (engine, source_port, destination_port);
+	jack_graph_change_end (engine);
 	jack_unlock_graph (engine);
 
-	return 0;
+	return ret;
+}
+
+/* Store the gain of a connection, and tell the owner of its
+ * destination, which applies it in its mixdown.  A port with a gain
+ * mixes for itself, so a change to or from unity re-plans the shared
+ * sums.
+ */
+static int
+jack_port_do_set_gain (jack_engine_t *engine,
+		       const char *source_port,
+		       const char *destination_port,
+		       float gain)
+{
+	jack_port_internal_t *srcport, *dstport;
+	jack_connection_internal_t *connection = NULL;
+	jack_client_internal_t *client;
+	jack_event_t event;
+	JSList *node;
+	int had_gain;
+	int ret = -1;
+
+	jack_lock_graph (engine);
+
+	if ((srcport = jack_get_port_by_name (engine, source_port)) == NULL ||
+	    (dstport = jack_get_port_by_name (engine, destination_port)) == NULL) {
+		jack_error ("unknown port in attempt to set the gain of"
+			    " %s -> %s", source_port, destination_port);
+		goto out;
+	}
+
+	if (dstport->shared->ptype_id != JACK_AUDIO_PORT_TYPE) {
+		jack_error ("cannot set a gain on %s, which is not an audio"
+			    " port", dstport->shared->name);
+		goto out;
+	}
+
+	for (node = dstport->connections; node; node = jack_slist_next (node)) {
+		if (((jack_connection_internal_t*)node->data)->source == srcport) {
+			connection = (jack_connection_internal_t*)node->data;
+			break;
+		}
+	}
+
+	if (connection == NULL) {
+		jack_error ("%s is not connected to %s, cannot set a gain",
+			    source_port, destination_port);
+		goto out;
+	}
+
+	ret = 0;
+
+	if (connection->gain == gain) {
+		goto out;
+	}
+
+	VERBOSE (engine, "gain of %s -> %s is %f", srcport->shared->name,
+		 dstport->shared->name, gain);
+
+	had_gain = jack_port_has_gain (dstport);
+	connection->gain = gain;
+
+	client = jack_client_internal_by_id (engine, dstport->shared->client_id);
+	if (client && client->control->active) {
+		VALGRIND_MEMSET (&event, 0, sizeof(event));
+		event.type = PortGainChanged;
+		event.x.self_id = dstport->shared->id;
+		event.y.other_id = srcport->shared->id;
+		event.z.gain = gain;
+		if (jack_deliver_event (engine, client, &event)) {
+			jack_error ("cannot send connection gain to client %s",
+				    client->control->name);
+		}
+	}
+
+	if (had_gain != jack_port_has_gain (dstport)) {
+		jack_sort_graph_or_defer (engine);
+	}
+
+out:
+	jack_unlock_graph (engine);
+	return ret;
 }
 
-static int
-jack_port_do_disconnect (jack_engine_t *engine,
-			 const char *source_port,
-			 const char *destination_port)
+/* Applies a whole ConnectBatch request under one acquisition of the
+ * graph lock, with the re-sort deferred until the last change.
+ */
+static jack_port_internal_t *
+jack_port_internal_by_id (jack_engine_t *engine, jack_port_id_t id)
 {
-	jack_port_internal_t *srcport, *dstport;
-	int ret = -1;
-
-	if ((srcport = jack_get_port_by_name (engine, source_port)) == NULL) {
-		jack_error ("unknown source port in attempted disconnection"
-			    " [%s]", source_port);
-		return -1;
+	if (id >= engine->port_max || !engine->control->ports[id].in_use) {
+		return NULL;
 	}
+	return &engine->internal_ports[id];
+}
 
-	if ((dstport = jack_get_port_by_name (engine, destination_port))
-	    == NULL) {
-		jack_error ("unknown destination port in attempted"
-			    " disconnection [%s]", destination_port);
-		return -1;
-	}
+static void
+jack_port_do_connect_batch (jack_engine_t *engine, jack_request_t *req)
+{
+	jack_connection_op_t *op;
+	uint32_t n;
 
 	jack_lock_graph (engine);
+	jack_graph_change_begin (engine);
+	engine->graph_batch++;
+
+	for (n = 0; n < req->x.connect_batch.count; ++n) {
+		op = &req->x.connect_batch.ops[n];
+		op->source_port[JACK_PORT_NAME_SIZE - 1] = '\0';
+		op->destination_port[JACK_PORT_NAME_SIZE - 1] = '\0';
+		if (op->source_port[0] == '\0') {
+			jack_port_internal_t *srcport, *dstport;
+			if ((srcport = jack_port_internal_by_id (engine, op->source_id)) == NULL
+			    || (dstport = jack_port_internal_by_id (engine, op->destination_id)) == NULL) {
+				jack_error ("unknown port id in connection batch");
+				op->status = -1;
+			} else if (op->connect) {
+				op->status = jack_port_connect_internal (engine, srcport, dstport);
+			} else {
+				op->status = jack_port_disconnect_internal (engine, srcport, dstport);
+			}
+		} else if (op->connect) {
+			op->status = jack_port_connect_locked
+					     (engine, op->source_port, op->destination_port);
+		} else {
+			op->status = jack_port_disconnect_locked
+					     (engine, op->source_port, op->destination_port);
+		}
+	}
 
-	ret = jack_port_disconnect_internal (engine, srcport, dstport);
+	engine->graph_batch--;
 
+	if (engine->graph_batch == 0 && engine->graph_sort_pending) {
+		VERBOSE (engine, "applying graph sort after %" PRIu32
+			 " connection changes", req->x.connect_batch.count);
+		jack_sort_graph (engine);
+	}
+
+	jack_graph_change_end (engine);
 	jack_unlock_graph (engine);
 
-	return ret;
+	req->status = 0;
 }
 
 int
@@ -4220,73 +9774,606 @@ jack_clear_fifos (jack_engine_t *engine)
 	/* this just drains the existing FIFO's of any data left in
 	   them by aborted clients, etc. there is only ever going to
 	   be 0, 1 or 2 bytes in them, but we'll allow for up to 16.
+	   clients that still owe a read are told not to make it.
 	 */
+	__atomic_add_fetch (&engine->control->fifo_generation, 1,
+			    __ATOMIC_RELEASE);
+
 	for (i = 0; i < engine->fifo_size; i++) {
 		if (engine->fifo[i] >= 0) {
 			int nread = read (engine->fifo[i], buf, sizeof(buf));
 
-			if (nread < 0 && errno != EAGAIN) {
-				jack_error ("clear fifo[%d] error: %s",
-					    i, strerror (errno));
-			}
-		}
-	}
+			if (nread < 0 && errno != EAGAIN) {
+				jack_error ("clear fifo[%d] error: %s",
+					    i, strerror (errno));
+			}
+		}
+	}
+
+	if (engine->control->wakeup_method == JACK_WAKEUP_FUTEX) {
+		for (i = 0; i < JACK_GRAPH_WAKEUPS; i++) {
+			jack_wakeup_clear (&engine->control->graph_wakeup[i]);
+		}
+	}
+}
+
+int
+jack_use_driver (jack_engine_t *engine, jack_driver_t *driver)
+{
+	if (engine->driver) {
+		engine->driver->detach (engine->driver, engine);
+		engine->driver = 0;
+	}
+
+	if (driver) {
+		engine->driver = driver;
+
+		if (driver->attach (driver, engine)) {
+			engine->driver = 0;
+			return -1;
+		}
+
+		engine->rolling_interval =
+			jack_rolling_interval (driver->period_usecs);
+	}
+
+	return 0;
+}
+
+int
+jack_add_slave_driver (jack_engine_t *engine, jack_driver_t *driver)
+{
+	if (driver) {
+		if (driver->attach (driver, engine)) {
+			jack_info ("could not attach slave %s\n", driver->internal_client->control->name);
+			return -1;
+		}
+
+		engine->slave_drivers = jack_slist_append (engine->slave_drivers, driver);
+	}
+
+	return 0;
+}
+
+/* BACKUP DRIVER
+
+   With a backup driver loaded, two driver threads call run_cycle.
+   Those of the backup's thread become null cycles of the backup.  To
+   switch, the master's thread swaps the two drivers at the start of
+   one of its cycles, so that no cycle of the graph runs on either
+   side of the swap; the old master's thread then runs null cycles
+   until it is stopped.  backup_lock keeps a null cycle from picking
+   up the driver being swapped.
+ */
+
+static inline int
+jack_is_backup_thread (jack_engine_t *engine, pthread_t self)
+{
+	if (engine->backup_thread) {
+		return pthread_equal (self, engine->backup_thread);
+	}
+	return !pthread_equal (self, engine->master_thread);
+}
+
+static void
+jack_backup_took_over (jack_engine_t *engine)
+{
+	/* the backup has a clock of its own */
+	engine->control->frame_timer.reset_pending = 1;
+	engine->rolling_interval =
+		jack_rolling_interval (engine->driver->period_usecs);
+	__atomic_store_n (&engine->backup_state, JACK_BACKUP_ACTIVE,
+			  __ATOMIC_RELEASE);
+}
+
+/* Returns TRUE if the cycle was dealt with here. */
+static int
+jack_backup_cycle (jack_engine_t *engine, jack_nframes_t nframes)
+{
+	pthread_t self = pthread_self ();
+	jack_driver_t *other;
+
+	if (jack_is_backup_thread (engine, self)) {
+		pthread_mutex_lock (&engine->backup_lock);
+		engine->backup_thread = self;
+		if ((other = engine->backup_driver)) {
+			other->null_cycle (other, nframes);
+		}
+		pthread_mutex_unlock (&engine->backup_lock);
+		return TRUE;
+	}
+
+	if (engine->backup_state != JACK_BACKUP_PROMOTE
+	    || engine->backup_thread == 0
+	    || pthread_mutex_trylock (&engine->backup_lock)) {
+		return FALSE;
+	}
+
+	other = engine->driver;
+	engine->driver = engine->backup_driver;
+	engine->backup_driver = other;
+	engine->master_thread = engine->backup_thread;
+	engine->backup_thread = self;
+	jack_backup_took_over (engine);
+	pthread_mutex_unlock (&engine->backup_lock);
+
+	other->null_cycle (other, nframes);
+	return TRUE;
+}
+
+/* Give the ports of `to' the connections of the ports of the same
+ * short name of `from': those of its capture ports if `outputs',
+ * else those of its playback ports.
+ */
+static void
+jack_driver_copy_connections (jack_engine_t *engine,
+			      jack_client_internal_t *from,
+			      jack_client_internal_t *to, int outputs)
+{
+	char name[JACK_PORT_NAME_SIZE];
+	jack_port_internal_t *port, *peer;
+	jack_connection_internal_t *connection;
+	JSList *pnode, *cnode;
+	const char *shortname;
+
+	jack_lock_graph (engine);
+	jack_graph_change_begin (engine);
+
+	for (pnode = from->ports; pnode; pnode = jack_slist_next (pnode)) {
+		port = (jack_port_internal_t*)pnode->data;
+
+		if (((port->shared->flags & JackPortIsOutput) != 0) != outputs
+		    || (shortname = strchr (port->shared->name, ':')) == NULL) {
+			continue;
+		}
+
+		snprintf (name, sizeof(name), "%s%s",
+			  to->control->name, shortname);
+		if ((peer = jack_get_port_by_name (engine, name)) == NULL) {
+			continue;
+		}
+
+		for (cnode = port->connections; cnode;
+		     cnode = jack_slist_next (cnode)) {
+			connection = (jack_connection_internal_t*)cnode->data;
+			if (outputs) {
+				jack_port_connect_locked (
+					engine, peer->shared->name,
+					connection->destination->shared->name);
+			} else {
+				jack_port_connect_locked (
+					engine, connection->source->shared->name,
+					peer->shared->name);
+			}
+		}
+	}
+
+	jack_graph_change_end (engine);
+	jack_unlock_graph (engine);
+}
+
+/* Drop a stopped driver and its client.  A driver whose thread may
+ * still be on its way out is only unloaded at exit. */
+static void
+jack_driver_retire (jack_engine_t *engine, jack_driver_t *driver,
+		    int unload)
+{
+	driver->detach (driver, engine);
+
+	pthread_mutex_lock (&engine->request_lock);
+	jack_lock_graph (engine);
+	jack_remove_client (engine, driver->internal_client);
+	jack_unlock_graph (engine);
+	pthread_mutex_unlock (&engine->request_lock);
+
+	if (unload) {
+		jack_driver_unload (driver);
+	} else {
+		engine->retired_drivers =
+			jack_slist_prepend (engine->retired_drivers, driver);
+	}
+}
+
+/* Hand the graph to the backup driver at the start of the master's
+ * next cycle, and drop the master.  The backup's playback ports take
+ * their connections before the swap and its capture ports after it,
+ * once the backup is reading them.
+ */
+int
+jack_engine_switch_to_backup (jack_engine_t *engine)
+{
+	jack_driver_t *old = engine->driver;
+	jack_driver_t *backup = engine->backup_driver;
+	int i;
+
+	if (old == NULL || backup == NULL) {
+		jack_error ("there is no backup driver to switch to");
+		return -1;
+	}
+
+	VERBOSE (engine, "switching to backup driver");
+
+	jack_driver_copy_connections (engine, old->internal_client,
+				      backup->internal_client, FALSE);
+
+	__atomic_store_n (&engine->backup_state, JACK_BACKUP_PROMOTE,
+			  __ATOMIC_RELEASE);
+
+	for (i = 0; engine->backup_state == JACK_BACKUP_PROMOTE; i++) {
+		if (i == 1000 && __sync_bool_compare_and_swap (
+			    &engine->backup_state, JACK_BACKUP_PROMOTE,
+			    JACK_BACKUP_IDLE)) {
+			jack_error ("master driver did not hand over to"
+				    " the backup");
+			return -1;
+		}
+		usleep (1000);
+	}
+
+	jack_driver_copy_connections (engine, old->internal_client,
+				      backup->internal_client, TRUE);
+
+	/* the old master is now the one running null cycles */
+	old->stop (old);
+	pthread_mutex_lock (&engine->backup_lock);
+	engine->backup_driver = NULL;
+	pthread_mutex_unlock (&engine->backup_lock);
+
+	jack_driver_retire (engine, old, TRUE);
+
+	return 0;
+}
+
+/* driver_exit with a backup loaded, on the thread of the driver that
+ * failed.  If that is the master, the backup takes over at once, as
+ * the master is not going to run another cycle.  Returns 0 unless
+ * the server has to go down.
+ */
+static int
+jack_backup_driver_exit (jack_engine_t *engine)
+{
+	pthread_t self = pthread_self ();
+	jack_driver_t *failed;
+
+	pthread_mutex_lock (&engine->backup_lock);
+
+	if (jack_is_backup_thread (engine, self)) {
+		failed = engine->backup_driver;
+		engine->backup_driver = NULL;
+		pthread_mutex_unlock (&engine->backup_lock);
+		jack_error ("backup driver failed");
+	} else if (engine->backup_thread == 0) {
+		/* the backup has yet to run: it cannot take over */
+		pthread_mutex_unlock (&engine->backup_lock);
+		return -1;
+	} else {
+		failed = engine->driver;
+		engine->driver = engine->backup_driver;
+		engine->backup_driver = NULL;
+		engine->master_thread = engine->backup_thread;
+		jack_backup_took_over (engine);
+		pthread_mutex_unlock (&engine->backup_lock);
+		jack_error ("master driver failed, the backup driver"
+			    " takes over");
+	}
+
+	failed->stop (failed);
+
+	/* the server thread does the rest */
+	engine->failed_driver = failed;
+	jack_wake_server_thread (engine);
+
+	return 0;
+}
+
+/* CLOCK DOMAINS
+
+   The driver of a clock domain calls run_cycle from a thread of its
+   own, at its own period; those cycles are the domain's, see
+   clockdomain.c.  A domain's thread is bound to it by the first cycle
+   that is not the master's after it starts.
+ */
+
+/* Returns TRUE, and the result of the cycle in *ret, if the cycle was
+ * a domain's. */
+static int
+jack_domain_cycle (jack_engine_t *engine, jack_nframes_t nframes, int *ret)
+{
+	pthread_t self = pthread_self ();
+	jack_clock_domain_t *cd;
+	JSList *node;
+
+	for (node = engine->clock_domains; node; node = jack_slist_next (node)) {
+		if (jack_clock_domain_owns (node->data, self, FALSE)) {
+			*ret = jack_clock_domain_run (node->data, nframes);
+			return TRUE;
+		}
+	}
+
+	if ((cd = engine->domain_starting) == NULL
+	    || pthread_equal (self, engine->master_thread)) {
+		return FALSE;
+	}
+
+	jack_clock_domain_owns (cd, self, TRUE);
+	engine->domain_starting = NULL;
+	*ret = jack_clock_domain_run (cd, nframes);
+	return TRUE;
+}
+
+/* driver_exit with clock domains loaded.  A domain that fails goes
+ * silent, and stays loaded until the engine goes.  Returns -1 if it
+ * was not a domain that failed. */
+static int
+jack_domain_driver_exit (jack_engine_t *engine)
+{
+	pthread_t self = pthread_self ();
+	jack_clock_domain_t *cd;
+	jack_driver_t *driver;
+	JSList *node;
+
+	for (node = engine->clock_domains; node; node = jack_slist_next (node)) {
+		cd = node->data;
+		if (jack_clock_domain_owns (cd, self, FALSE)) {
+			driver = jack_clock_domain_driver (cd);
+			jack_error ("clock domain %s failed, its ports go"
+				    " silent",
+				    driver->internal_client->control->name);
+			jack_clock_domain_failed (cd);
+			driver->stop (driver);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static void
+jack_driver_retire_failed (jack_engine_t *engine)
+{
+	jack_driver_t *failed = engine->failed_driver;
+
+	engine->failed_driver = NULL;
+
+	if (engine->driver) {
+		jack_driver_copy_connections (
+			engine, failed->internal_client,
+			engine->driver->internal_client, FALSE);
+		jack_driver_copy_connections (
+			engine, failed->internal_client,
+			engine->driver->internal_client, TRUE);
+	}
+
+	jack_driver_retire (engine, failed, FALSE);
+}
+
+/* PORT RELATED FUNCTIONS */
+
+
+/* The port name indexes. All of these must be called with port_lock
+ * held. Deleted entries are left as tombstones so that lookups running
+ * concurrently in clients never see a probe sequence broken; once they
+ * make up too much of the table it is rebuilt from scratch.
+ */
+
+static void
+jack_port_hash_place (jack_engine_t *engine, jack_port_id_t id)
+{
+	jack_port_id_t *table = jack_port_hash_table (engine->control);
+	uint32_t mask = engine->control->port_hash_size - 1;
+	uint32_t slot;
+
+	jack_port_hash_column (engine->control)[id] =
+		jack_port_name_hash (engine->control->ports[id].name);
+	slot = jack_port_hash_column (engine->control)[id] & mask;
+
+	while (table[slot] != JACK_PORT_HASH_EMPTY &&
+	       table[slot] != JACK_PORT_HASH_DELETED) {
+		slot = (slot + 1) & mask;
+	}
+
+	if (table[slot] == JACK_PORT_HASH_EMPTY) {
+		engine->port_hash_used++;
+	}
+
+	table[slot] = id;
+	engine->port_hash_slot[id] = slot;
+}
+
+/* Publish a registered port in the scan columns; see
+ * jack_port_in_use_map(). Caller holds port_lock.
+ */
+static void
+jack_port_columns_set (jack_engine_t *engine, jack_port_id_t id)
+{
+	jack_control_t *control = engine->control;
+	jack_port_shared_t *shared = &control->ports[id];
+
+	jack_uuid_copy (&jack_port_client_column (control)[id], shared->client_id);
+	jack_port_flags_column (control)[id] = shared->flags;
+	jack_port_type_column (control)[id] = shared->ptype_id;
+
+	__atomic_or_fetch (&jack_port_in_use_map (control)[id >> 6],
+			   (uint64_t)1 << (id & 63), __ATOMIC_RELEASE);
+}
+
+static void
+jack_port_hash_rebuild (jack_engine_t *engine)
+{
+	jack_port_id_t id;
+
+	memset (jack_port_hash_table (engine->control), 0xff,
+		sizeof(jack_port_id_t) * engine->control->port_hash_size);
+	engine->port_hash_used = 0;
+
+	for (id = 0; id < engine->control->port_high; id++) {
+		if (engine->port_hash_slot[id] >= 0) {
+			jack_port_hash_place (engine, id);
+		}
+	}
+}
+
+/* The sorted name index. Ports are usually registered in name order,
+ * so most insertions land at or near the end and the memmove() is
+ * short.
+ */
+
+static uint32_t
+jack_port_sorted_lower_bound (jack_engine_t *engine, const char *name)
+{
+	jack_port_id_t *sorted = jack_port_sorted_table (engine->control);
+	jack_port_shared_t *ports = engine->control->ports;
+	uint32_t lo = 0;
+	uint32_t hi = engine->control->port_sorted_cnt;
+	uint32_t mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strcmp (ports[sorted[mid]].name, name) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+static void
+jack_port_sorted_begin (jack_engine_t *engine)
+{
+	__atomic_add_fetch (&engine->control->port_sorted_seq, 1,
+			    __ATOMIC_ACQ_REL);
+}
+
+static void
+jack_port_sorted_end (jack_engine_t *engine)
+{
+	__atomic_add_fetch (&engine->control->port_sorted_seq, 1,
+			    __ATOMIC_RELEASE);
 }
 
-int
-jack_use_driver (jack_engine_t *engine, jack_driver_t *driver)
+static void
+jack_port_sorted_insert (jack_engine_t *engine, jack_port_id_t id)
 {
-	if (engine->driver) {
-		engine->driver->detach (engine->driver, engine);
-		engine->driver = 0;
-	}
+	jack_port_id_t *sorted = jack_port_sorted_table (engine->control);
+	uint32_t cnt = engine->control->port_sorted_cnt;
+	uint32_t pos;
+
+	pos = jack_port_sorted_lower_bound (engine,
+					    engine->control->ports[id].name);
+
+	jack_port_sorted_begin (engine);
+	memmove (&sorted[pos + 1], &sorted[pos],
+		 sizeof(jack_port_id_t) * (cnt - pos));
+	sorted[pos] = id;
+	engine->control->port_sorted_cnt = cnt + 1;
+	jack_port_sorted_end (engine);
+}
 
-	if (driver) {
-		engine->driver = driver;
+static void
+jack_port_sorted_remove (jack_engine_t *engine, jack_port_id_t id)
+{
+	jack_port_id_t *sorted = jack_port_sorted_table (engine->control);
+	uint32_t cnt = engine->control->port_sorted_cnt;
+	uint32_t pos;
 
-		if (driver->attach (driver, engine)) {
-			engine->driver = 0;
-			return -1;
-		}
+	pos = jack_port_sorted_lower_bound (engine,
+					    engine->control->ports[id].name);
 
-		engine->rolling_interval =
-			jack_rolling_interval (driver->period_usecs);
+	if (pos >= cnt || sorted[pos] != id) {
+		/* the name has changed since it was indexed */
+		for (pos = 0; pos < cnt && sorted[pos] != id; pos++) ;
+		if (pos == cnt) {
+			return;
+		}
 	}
 
-	return 0;
+	jack_port_sorted_begin (engine);
+	memmove (&sorted[pos], &sorted[pos + 1],
+		 sizeof(jack_port_id_t) * (cnt - pos - 1));
+	engine->control->port_sorted_cnt = cnt - 1;
+	jack_port_sorted_end (engine);
 }
 
-int
-jack_add_slave_driver (jack_engine_t *engine, jack_driver_t *driver)
+static void
+jack_port_hash_insert (jack_engine_t *engine, jack_port_id_t id)
 {
-	if (driver) {
-		if (driver->attach (driver, engine)) {
-			jack_info ("could not attach slave %s\n", driver->internal_client->control->name);
-			return -1;
-		}
-
-		engine->slave_drivers = jack_slist_append (engine->slave_drivers, driver);
+	if ((engine->port_hash_used + 1) * 4 >
+	    engine->control->port_hash_size * 3) {
+		jack_port_hash_rebuild (engine);
 	}
 
-	return 0;
+	jack_port_hash_place (engine, id);
+	jack_port_sorted_insert (engine, id);
 }
 
-/* PORT RELATED FUNCTIONS */
+static void
+jack_port_hash_remove (jack_engine_t *engine, jack_port_id_t id)
+{
+	int slot = engine->port_hash_slot[id];
+
+	if (slot >= 0) {
+		jack_port_hash_table (engine->control)[slot] =
+			JACK_PORT_HASH_DELETED;
+		engine->port_hash_slot[id] = -1;
+		jack_port_sorted_remove (engine, id);
+	}
+}
 
+/* Record a connection, or its end, in both ports' rows of
+ * jack_port_connection_map().
+ */
+static void
+jack_port_connection_map_set (jack_engine_t *engine, jack_port_id_t a,
+			      jack_port_id_t b, int connected)
+{
+	uint64_t *row_a = jack_port_connection_map (engine->control, a);
+	uint64_t *row_b = jack_port_connection_map (engine->control, b);
+	uint64_t bit_a = (uint64_t)1 << (a & 63);
+	uint64_t bit_b = (uint64_t)1 << (b & 63);
+
+	if (connected) {
+		__atomic_or_fetch (&row_a[b >> 6], bit_b, __ATOMIC_RELEASE);
+		__atomic_or_fetch (&row_b[a >> 6], bit_a, __ATOMIC_RELEASE);
+	} else {
+		__atomic_and_fetch (&row_a[b >> 6], ~bit_b, __ATOMIC_RELEASE);
+		__atomic_and_fetch (&row_b[a >> 6], ~bit_a, __ATOMIC_RELEASE);
+	}
+}
 
 static jack_port_id_t
 jack_get_free_port (jack_engine_t *engine)
 
 {
 	jack_port_id_t i;
+	jack_port_shared_t *shared;
 
 	pthread_mutex_lock (&engine->port_lock);
 
-	for (i = 0; i < engine->port_max; i++) {
-		if (engine->control->ports[i].in_use == 0) {
-			engine->control->ports[i].in_use = 1;
-			break;
-		}
+	if (engine->port_free_cnt) {
+		i = engine->port_free[--engine->port_free_cnt];
+		engine->control->ports[i].in_use = 1;
+	} else if (engine->control->port_high < engine->port_max) {
+		i = engine->control->port_high;
+		shared = &engine->control->ports[i];
+		shared->id = i;
+		shared->alias1[0] = '\0';
+		shared->alias2[0] = '\0';
+		shared->in_use = 1;
+		shared->muted = 0;
+		shared->silent_cycle = 0;
+		shared->forward_cycle = 0;
+		shared->delayed = 0;
+		shared->delayed_offset = 0;
+		shared->sum_port = JACK_NO_SUM;
+		shared->sum_offset = 0;
+		shared->history_slot = -1;
+		engine->internal_ports[i].connections = 0;
+		/* clients scan up to port_high without the lock */
+		__atomic_store_n (&engine->control->port_high, i + 1,
+				  __ATOMIC_RELEASE);
+	} else {
+		i = engine->port_max;
 	}
 
 	pthread_mutex_unlock (&engine->port_lock);
@@ -4313,7 +10400,16 @@ jack_port_release (jack_engine_t *engine, jack_port_internal_t *port)
 
 
 	pthread_mutex_lock (&engine->port_lock);
+	__atomic_and_fetch (&jack_port_in_use_map (engine->control)[port->shared->id >> 6],
+			    ~((uint64_t)1 << (port->shared->id & 63)), __ATOMIC_RELEASE);
+	jack_port_hash_remove (engine, port->shared->id);
+	if (port->shared->in_use) {
+		engine->port_free[engine->port_free_cnt++] = port->shared->id;
+	}
 	port->shared->in_use = 0;
+	port->shared->muted = 0;
+	port->shared->silent_cycle = 0;
+	port->shared->forward_cycle = 0;
 	port->shared->alias1[0] = '\0';
 	port->shared->alias2[0] = '\0';
 
@@ -4321,12 +10417,32 @@ jack_port_release (jack_engine_t *engine, jack_port_internal_t *port)
 		jack_port_buffer_list_t *blist =
 			jack_port_buffer_list (engine, port);
 		pthread_mutex_lock (&blist->lock);
-		blist->freelist =
-			jack_slist_prepend (blist->freelist,
-					    port->buffer_info);
+		jack_port_buffer_set_free (blist,
+					   port->buffer_info - blist->info);
 		port->buffer_info = NULL;
+		if (port->delayed_info) {
+			jack_port_buffer_set_free (blist,
+						   port->delayed_info - blist->info);
+			port->delayed_info = NULL;
+			engine->delayed_ports =
+				jack_slist_remove (engine->delayed_ports, port);
+		}
+		pthread_mutex_unlock (&blist->lock);
+	}
+	if (port->sum_info) {
+		jack_port_buffer_list_t *blist =
+			jack_port_buffer_list (engine, port);
+		port->shared->sum_offset = 0;
+		pthread_mutex_lock (&blist->lock);
+		jack_port_buffer_set_free (blist,
+					   port->sum_info - blist->info);
 		pthread_mutex_unlock (&blist->lock);
+		port->sum_info = NULL;
 	}
+	port->shared->delayed = 0;
+	port->shared->delayed_offset = 0;
+	port->shared->sum_port = JACK_NO_SUM;
+	port->shared->history_slot = -1;
 	pthread_mutex_unlock (&engine->port_lock);
 }
 
@@ -4335,16 +10451,22 @@ jack_get_port_internal_by_name (jack_engine_t *engine, const char *name)
 {
 	jack_port_id_t id;
 
-	pthread_mutex_lock (&engine->port_lock);
+	/* the name index is made to be read without port_lock, as
+	   clients do; a miss falls back to a scan */
 
-	for (id = 0; id < engine->port_max; id++) {
-		if (jack_port_name_equals (&engine->control->ports[id], name)) {
-			break;
+	if ((id = jack_port_hash_lookup (engine->control, name))
+	    == (jack_port_id_t)-1) {
+		for (id = 0; id < engine->control->port_high; id++) {
+			if (engine->control->ports[id].in_use &&
+			    jack_port_name_equals (&engine->control->ports[id], name)) {
+				break;
+			}
+		}
+		if (id == engine->control->port_high) {
+			id = engine->port_max;
 		}
 	}
 
-	pthread_mutex_unlock (&engine->port_lock);
-
 	if (id != engine->port_max) {
 		return &engine->internal_ports[id];
 	} else {
@@ -4352,19 +10474,24 @@ jack_get_port_internal_by_name (jack_engine_t *engine, const char *name)
 	}
 }
 
-int
-jack_port_do_register (jack_engine_t *engine, jack_request_t *req, int internal)
+/* Registers one port of client, for jack_port_do_register() and
+ * jack_port_do_batch(). The caller holds the graph lock.
+ */
+static jack_port_id_t
+jack_port_register_locked (jack_engine_t *engine,
+			   jack_client_internal_t *client,
+			   const char *name, const char *type_name,
+			   uint32_t flags, int internal)
 {
 	jack_port_id_t port_id;
 	jack_port_shared_t *shared;
 	jack_port_internal_t *port;
-	jack_client_internal_t *client;
 	unsigned long i;
 	char *backend_client_name;
 	size_t len;
 
 	for (i = 0; i < engine->control->n_port_types; ++i) {
-		if (strcmp (req->x.port_info.type,
+		if (strcmp (type_name,
 			    engine->control->port_types[i].type_name) == 0) {
 			break;
 		}
@@ -4372,29 +10499,18 @@ jack_port_do_register (jack_engine_t *engine, jack_request_t *req, int internal)
 
 	if (i == engine->control->n_port_types) {
 		jack_error ("cannot register a port of type \"%s\"",
-			    req->x.port_info.type);
-		return -1;
-	}
-
-	jack_lock_graph (engine);
-	if ((client = jack_client_internal_by_id (engine,
-						  req->x.port_info.client_id))
-	    == NULL) {
-		jack_error ("unknown client id in port registration request");
-		jack_unlock_graph (engine);
-		return -1;
+			    type_name);
+		return (jack_port_id_t)-1;
 	}
 
-	if ((port = jack_get_port_by_name (engine, req->x.port_info.name)) != NULL) {
-		jack_error ("duplicate port name (%s) in port registration request", req->x.port_info.name);
-		jack_unlock_graph (engine);
-		return -1;
+	if ((port = jack_get_port_by_name (engine, name)) != NULL) {
+		jack_error ("duplicate port name (%s) in port registration request", name);
+		return (jack_port_id_t)-1;
 	}
 
 	if ((port_id = jack_get_free_port (engine)) == (jack_port_id_t)-1) {
 		jack_error ("no ports available!");
-		jack_unlock_graph (engine);
-		return -1;
+		return (jack_port_id_t)-1;
 	}
 
 	shared = &engine->control->ports[port_id];
@@ -4409,47 +10525,47 @@ jack_port_do_register (jack_engine_t *engine, jack_request_t *req, int internal)
 	backend_client_name = (char*)engine->driver->internal_client->control->name;
 	len = strlen (backend_client_name);
 
-	if (strncmp (req->x.port_info.name, backend_client_name, len) != 0) {
+	if (strncmp (name, backend_client_name, len) != 0) {
 		goto fallback;
 	}
 
 	/* use backend's original as an alias, use predefined names */
 
-	if (strcmp (req->x.port_info.type, JACK_DEFAULT_AUDIO_TYPE) == 0) {
-		if ((req->x.port_info.flags & (JackPortIsPhysical | JackPortIsInput)) == (JackPortIsPhysical | JackPortIsInput)) {
+	if (strcmp (type_name, JACK_DEFAULT_AUDIO_TYPE) == 0) {
+		if ((flags & (JackPortIsPhysical | JackPortIsInput)) == (JackPortIsPhysical | JackPortIsInput)) {
 			snprintf (shared->name, sizeof(shared->name), JACK_BACKEND_ALIAS ":playback_%d", ++engine->audio_out_cnt);
-			strcpy (shared->alias1, req->x.port_info.name);
+			strcpy (shared->alias1, name);
 			goto next;
-		} else if ((req->x.port_info.flags & (JackPortIsPhysical | JackPortIsOutput)) == (JackPortIsPhysical | JackPortIsOutput)) {
+		} else if ((flags & (JackPortIsPhysical | JackPortIsOutput)) == (JackPortIsPhysical | JackPortIsOutput)) {
 			snprintf (shared->name, sizeof(shared->name), JACK_BACKEND_ALIAS ":capture_%d", ++engine->audio_in_cnt);
-			strcpy (shared->alias1, req->x.port_info.name);
+			strcpy (shared->alias1, name);
 			goto next;
 		}
 	}
 
 #if 0   // do not do this for MIDI
 
-	else if (strcmp (req->x.port_info.type, JACK_DEFAULT_MIDI_TYPE) == 0) {
-		if ((req->x.port_info.flags & (JackPortIsPhysical | JackPortIsInput)) == (JackPortIsPhysical | JackPortIsInput)) {
+	else if (strcmp (type_name, JACK_DEFAULT_MIDI_TYPE) == 0) {
+		if ((flags & (JackPortIsPhysical | JackPortIsInput)) == (JackPortIsPhysical | JackPortIsInput)) {
 			snprintf (shared->name, sizeof(shared->name), JACK_BACKEND_ALIAS ":midi_playback_%d", ++engine->midi_out_cnt);
-			strcpy (shared->alias1, req->x.port_info.name);
+			strcpy (shared->alias1, name);
 			goto next;
-		} else if ((req->x.port_info.flags & (JackPortIsPhysical | JackPortIsOutput)) == (JackPortIsPhysical | JackPortIsOutput)) {
+		} else if ((flags & (JackPortIsPhysical | JackPortIsOutput)) == (JackPortIsPhysical | JackPortIsOutput)) {
 			snprintf (shared->name, sizeof(shared->name), JACK_BACKEND_ALIAS ":midi_capture_%d", ++engine->midi_in_cnt);
-			strcpy (shared->alias1, req->x.port_info.name);
+			strcpy (shared->alias1, name);
 			goto next;
 		}
 	}
 #endif
 
 fallback:
-	strcpy (shared->name, req->x.port_info.name);
+	strcpy (shared->name, name);
 
 next:
 	shared->ptype_id = engine->control->port_types[i].ptype_id;
-	jack_uuid_copy (&shared->client_id, req->x.port_info.client_id);
+	jack_uuid_copy (&shared->client_id, client->control->uuid);
 	shared->uuid = jack_port_uuid_generate (port_id);
-	shared->flags = req->x.port_info.flags;
+	shared->flags = flags;
 	shared->latency = 0;
 	shared->capture_latency.min = shared->capture_latency.max = 0;
 	shared->playback_latency.min = shared->playback_latency.max = 0;
@@ -4460,34 +10576,89 @@ next:
 	port->shared = shared;
 	port->connections = 0;
 	port->buffer_info = NULL;
+	port->delayed_info = NULL;
+	port->sum_info = NULL;
+	shared->sum_port = JACK_NO_SUM;
+	shared->sum_offset = 0;
+	shared->history_slot = -1;
 
-	if (jack_port_assign_buffer (engine, port)) {
+	if (jack_port_assign_buffer (engine, client, port)) {
 		jack_error ("cannot assign buffer for port");
 		jack_port_release (engine, &engine->internal_ports[port_id]);
-		jack_unlock_graph (engine);
-		return -1;
+		return (jack_port_id_t)-1;
 	}
 
+	pthread_mutex_lock (&engine->port_lock);
+	jack_port_hash_insert (engine, port_id);
+	jack_port_columns_set (engine, port_id);
+	pthread_mutex_unlock (&engine->port_lock);
+
 	client->ports = jack_slist_prepend (client->ports, port);
 	if ( client->control->active ) {
 		jack_port_registration_notify (engine, port_id, TRUE);
 	}
-	jack_unlock_graph (engine);
 
 	VERBOSE (engine, "registered port %s, offset = %u",
 		 shared->name, (unsigned int)shared->offset);
 
+	return port_id;
+}
+
+int
+jack_port_do_register (jack_engine_t *engine, jack_request_t *req, int internal)
+{
+	jack_client_internal_t *client;
+	jack_port_id_t port_id;
+
+	jack_lock_graph (engine);
+	if ((client = jack_client_internal_by_id (engine,
+						  req->x.port_info.client_id))
+	    == NULL) {
+		jack_error ("unknown client id in port registration request");
+		jack_unlock_graph (engine);
+		return -1;
+	}
+
+	port_id = jack_port_register_locked (engine, client,
+					     req->x.port_info.name,
+					     req->x.port_info.type,
+					     req->x.port_info.flags,
+					     internal);
+	jack_unlock_graph (engine);
+
+	if (port_id == (jack_port_id_t)-1) {
+		return -1;
+	}
+
 	req->x.port_info.port_id = port_id;
 
 	return 0;
 }
 
+/* Removes one port of client, for jack_port_do_unregister() and
+ * jack_port_do_batch(). The caller holds the graph lock.
+ */
+static void
+jack_port_unregister_locked (jack_engine_t *engine,
+			     jack_client_internal_t *client,
+			     jack_port_id_t port_id)
+{
+	jack_port_internal_t *port = &engine->internal_ports[port_id];
+
+	jack_graph_change_begin (engine);
+	jack_port_clear_connections (engine, port);
+	jack_port_release (engine, port);
+	jack_graph_change_end (engine);
+
+	client->ports = jack_slist_remove (client->ports, port);
+	jack_port_registration_notify (engine, port_id, FALSE);
+}
+
 int
 jack_port_do_unregister (jack_engine_t *engine, jack_request_t *req)
 {
 	jack_client_internal_t *client;
 	jack_port_shared_t *shared;
-	jack_port_internal_t *port;
 	jack_uuid_t uuid;
 
 	if (req->x.port_info.port_id < 0 ||
@@ -4518,17 +10689,87 @@ jack_port_do_unregister (jack_engine_t *engine, jack_request_t *req)
 		return -1;
 	}
 
-	port = &engine->internal_ports[req->x.port_info.port_id];
+	jack_port_unregister_locked (engine, client, req->x.port_info.port_id);
+	jack_unlock_graph (engine);
 
-	jack_port_clear_connections (engine, port);
-	jack_port_release (engine, &engine->internal_ports[req->x.port_info.port_id]);
+	return 0;
+}
 
-	client->ports = jack_slist_remove (client->ports, port);
-	jack_port_registration_notify (engine, req->x.port_info.port_id,
-				       FALSE);
+/* Applies a whole PortBatch request under one acquisition of the graph
+ * lock, with any re-sort deferred until the last change. Clients hear
+ * of the new or removed ports in one batch of events when the request
+ * is done, see jack_event_batch_queue().
+ */
+static void
+jack_port_do_batch (jack_engine_t *engine, jack_request_t *req, int internal)
+{
+	jack_client_internal_t *client;
+	jack_port_shared_t *shared;
+	jack_port_op_t *op;
+	uint32_t n;
+
+	jack_lock_graph (engine);
+
+	if ((client = jack_client_internal_by_id (engine,
+						  req->x.port_batch.client_id))
+	    == NULL) {
+		jack_error ("unknown client id in port batch request");
+		jack_unlock_graph (engine);
+		req->status = -1;
+		return;
+	}
+
+	jack_graph_change_begin (engine);
+	engine->graph_batch++;
+
+	for (n = 0; n < req->x.port_batch.count; ++n) {
+		op = &req->x.port_batch.ops[n];
+		op->status = -1;
+
+		if (op->reg) {
+			op->name[JACK_PORT_NAME_SIZE - 1] = '\0';
+			op->type[JACK_PORT_TYPE_SIZE - 1] = '\0';
+			op->port_id = jack_port_register_locked
+					      (engine, client, op->name, op->type,
+					      op->flags, internal);
+			if (op->port_id != (jack_port_id_t)-1) {
+				op->status = 0;
+			}
+			continue;
+		}
+
+		if (op->port_id >= engine->port_max) {
+			jack_error ("invalid port ID %" PRIu32
+				    " in unregister request", op->port_id);
+			continue;
+		}
+
+		shared = &engine->control->ports[op->port_id];
+
+		if (!shared->in_use ||
+		    jack_uuid_compare (shared->client_id,
+				       client->control->uuid) != 0) {
+			jack_error ("Client %s is not allowed to remove port %s",
+				    client->control->name, shared->name);
+			continue;
+		}
+
+		jack_port_unregister_locked (engine, client, op->port_id);
+		op->status = 0;
+	}
+
+	engine->graph_batch--;
+
+	if (engine->graph_batch == 0 && engine->graph_sort_pending) {
+		VERBOSE (engine, "applying graph sort after %" PRIu32
+			 " port changes", req->x.port_batch.count);
+		jack_sort_graph (engine);
+	}
+
+	jack_graph_change_end (engine);
 	jack_unlock_graph (engine);
 
-	return 0;
+	req->status = 0;
 }
 
 int
@@ -4540,8 +10781,10 @@ jack_do_get_port_connections (jack_engine_t *engine, jack_request_t *req,
 	unsigned int i;
 	int ret = -1;
 	int internal = FALSE;
+	jack_port_id_t *ids = NULL;
+	struct iovec extra;
 
-	jack_rdlock_graph (engine);
+	/* caller must hold the graph lock */
 
 	port = &engine->internal_ports[req->x.port_info.port_id];
 
@@ -4563,11 +10806,14 @@ jack_do_get_port_connections (jack_engine_t *engine, jack_request_t *req,
 	}
 
 	if (!internal) {
-		if (write (reply_fd, req, sizeof(*req))
-		    < (ssize_t)sizeof(req)) {
-			jack_error ("cannot write GetPortConnections result "
-				    "to client via fd = %d (%s)",
-				    reply_fd, strerror (errno));
+		/* external clients get the reply and the IDs of the
+		 * connected ports in one write, see below
+		 */
+		if (req->type == GetPortConnections
+		    && req->x.port_connections.nports
+		    && (ids = (jack_port_id_t*)
+			      malloc (sizeof(jack_port_id_t)
+				      * req->x.port_connections.nports)) == NULL) {
 			goto out;
 		}
 	} else {
@@ -4605,25 +10851,30 @@ jack_do_get_port_connections (jack_engine_t *engine, jack_request_t *req,
 			} else {
 
 				/* external client asking for
-				 * names. we write the port id's to
-				 * the reply fd.
+				 * names. we send it the port id's.
 				 */
-				if (write (reply_fd, &port_id,
-					   sizeof(port_id))
-				    < (ssize_t)sizeof(port_id)) {
-					jack_error ("cannot write port id "
-						    "to client");
-					goto out;
-				}
+				ids[i] = port_id;
 			}
 		}
 	}
 
+	if (!internal) {
+		extra.iov_base = ids;
+		extra.iov_len = ids ? sizeof(jack_port_id_t)
+			        * req->x.port_connections.nports : 0;
+		if (jack_request_send (reply_fd, req, &extra, 1)) {
+			jack_error ("cannot write GetPortConnections result "
+				    "to client via fd = %d (%s)",
+				    reply_fd, strerror (errno));
+			goto out;
+		}
+	}
+
 	ret = 0;
 
 out:
+	free (ids);
 	req->status = ret;
-	jack_unlock_graph (engine);
 	return ret;
 }
 
@@ -4646,7 +10897,8 @@ jack_port_registration_notify (jack_engine_t *engine,
 			continue;
 		}
 
-		if (client->control->port_register_cbset) {
+		if (client->control->port_register_cbset ||
+		    client->control->graph_mirror) {
 			if (jack_deliver_event (engine, client, &event)) {
 				jack_error ("cannot send port registration"
 					    " notification to %s (%s)",
@@ -4674,6 +10926,11 @@ jack_port_rename_notify (jack_engine_t *engine,
 		return;
 	}
 
+	pthread_mutex_lock (&engine->port_lock);
+	jack_port_hash_remove (engine, port->shared->id);
+	jack_port_hash_insert (engine, port->shared->id);
+	pthread_mutex_unlock (&engine->port_lock);
+
 	event.type = PortRename;
 	event.y.other_id = port->shared->id;
 	snprintf (event.x.name, JACK_PORT_NAME_SIZE - 1, "%s", old_name);
@@ -4771,12 +11028,134 @@ jack_property_change_notify (jack_engine_t *engine,
 	}
 }
 
+static void
+jack_do_set_property (jack_engine_t *engine, jack_request_t *req)
+{
+	jack_property_change_t change;
+
+	if (req->x.property_set.key == NULL || req->x.property_set.value == NULL) {
+		req->status = -1;
+		return;
+	}
+
+	req->status = jack_property_store_set (req->x.property_set.uuid,
+					       req->x.property_set.key,
+					       req->x.property_set.value,
+					       req->x.property_set.type,
+					       &change);
+	if (req->status == 0) {
+		jack_property_change_notify (engine, change, req->x.property_set.uuid,
+					     req->x.property_set.key);
+	}
+}
+
+/* one key, or all of a subject's properties if there is no key */
+static void
+jack_do_remove_property (jack_engine_t *engine, jack_request_t *req)
+{
+	int cnt;
+
+	cnt = jack_property_store_remove (req->x.property.uuid, req->x.property.key);
+
+	if (cnt > 0) {
+		jack_property_change_notify (engine, PropertyDeleted, req->x.property.uuid,
+					     req->x.property.key);
+	}
+
+	if (req->x.property.key) {
+		req->status = (cnt > 0) ? 0 : -1;
+	} else {
+		req->status = cnt;
+	}
+}
+
+/* all the changes, then one notification for the lot */
+static void
+jack_do_property_batch (jack_engine_t *engine, jack_request_t *req)
+{
+	jack_uuid_t empty_uuid = JACK_UUID_EMPTY_INITIALIZER;
+	jack_property_op_t *ops;
+	jack_property_change_t change;
+	uint32_t count = req->x.property_batch.count;
+
+	req->status = -1;
+
+	if (count == 0 || count > JACK_PROPERTY_BATCH_MAX) {
+		req->status = (count == 0) ? 0 : -1;
+		return;
+	}
+
+	if ((ops = (jack_property_op_t*)malloc (count * sizeof(*ops))) == NULL) {
+		return;
+	}
+
+	if (jack_property_batch_unpack (req->x.property_batch.data,
+					req->x.property_batch.size,
+					count, ops)) {
+		jack_error ("malformed metadata batch of %" PRIu32 " changes",
+			    count);
+	} else if ((req->status = jack_property_store_apply (ops, count, &change)) == 0) {
+		if (count == 1) {
+			jack_property_change_notify (engine, change, ops[0].subject,
+						     ops[0].key);
+		} else {
+			jack_property_change_notify (engine, PropertyChanged,
+						     empty_uuid, NULL);
+		}
+	}
+
+	free (ops);
+}
+
+static void
+jack_do_remove_all_properties (jack_engine_t *engine, jack_request_t *req)
+{
+	jack_uuid_t empty_uuid = JACK_UUID_EMPTY_INITIALIZER;
+
+	req->status = jack_property_store_clear ();
+
+	if (req->status == 0) {
+		jack_property_change_notify (engine, PropertyDeleted, empty_uuid, NULL);
+	}
+}
+
+/* With --group-buffers, a client's output buffers of one type are
+   kept together: the search for a free one starts just past the last
+   one it already has. Otherwise the lowest free buffer is used. */
+
+static uint32_t
+jack_port_buffer_hint (jack_client_internal_t *client,
+		       jack_port_buffer_list_t *blist,
+		       jack_port_type_id_t ptid)
+{
+	JSList *node;
+	uint32_t hint = 0, n;
+
+	if (!group_port_buffers || client == NULL) {
+		return 0;
+	}
+
+	for (node = client->ports; node; node = jack_slist_next (node)) {
+		jack_port_internal_t *other = (jack_port_internal_t*)node->data;
+		if (other->buffer_info && other->shared->ptype_id == ptid) {
+			n = other->buffer_info - blist->info + 1;
+			if (n > hint) {
+				hint = n;
+			}
+		}
+	}
+
+	return hint;
+}
+
 int
-jack_port_assign_buffer (jack_engine_t *engine, jack_port_internal_t *port)
+jack_port_assign_buffer (jack_engine_t *engine, jack_client_internal_t *client,
+			 jack_port_internal_t *port)
 {
 	jack_port_buffer_list_t *blist =
 		jack_port_buffer_list (engine, port);
 	jack_port_buffer_info_t *bi;
+	int n;
 
 	if (port->shared->flags & JackPortIsInput) {
 		port->shared->offset = 0;
@@ -4785,7 +11164,8 @@ jack_port_assign_buffer (jack_engine_t *engine, jack_port_internal_t *port)
 
 	pthread_mutex_lock (&blist->lock);
 
-	if (blist->freelist == NULL) {
+	n = jack_port_buffer_take (blist, jack_port_buffer_hint (client, blist, port->shared->ptype_id));
+	if (n < 0) {
 		jack_port_type_info_t *port_type =
 			jack_port_type_info (engine, port);
 		jack_error ("all %s port buffers in use!",
@@ -4794,8 +11174,7 @@ jack_port_assign_buffer (jack_engine_t *engine, jack_port_internal_t *port)
 		return -1;
 	}
 
-	bi = (jack_port_buffer_info_t*)blist->freelist->data;
-	blist->freelist = jack_slist_remove (blist->freelist, bi);
+	bi = &blist->info[n];
 
 	port->shared->offset = bi->offset;
 	port->buffer_info = bi;
@@ -4809,11 +11188,16 @@ jack_get_port_by_name (jack_engine_t *engine, const char *name)
 {
 	jack_port_id_t id;
 
+	if ((id = jack_port_hash_lookup (engine->control, name))
+	    != (jack_port_id_t)-1) {
+		return &engine->internal_ports[id];
+	}
+
 	/* Note the potential race on "in_use". Other design
 	   elements prevent this from being a problem.
 	 */
 
-	for (id = 0; id < engine->port_max; id++) {
+	for (id = 0; id < engine->control->port_high; id++) {
 		if (engine->control->ports[id].in_use &&
 		    jack_port_name_equals (&engine->control->ports[id], name)) {
 			return &engine->internal_ports[id];
@@ -4857,7 +11241,7 @@ jack_send_connection_notification (jack_engine_t *engine,
 	return 0;
 }
 
-static void
+void
 jack_wake_server_thread (jack_engine_t* engine)
 {
 	char c = 0;
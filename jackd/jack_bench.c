@@ -0,0 +1,527 @@
+/* -*- mode: c; c-file-style: "linux"; -*- */
+/*
+    Microbenchmarks for the sample converters in memops.c and the
+    copy, mix and mixdown kernels in libjack/simd.c.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ */
+
+/* Each case runs over every combination of channel count and period
+ * size. Converters work on interleaved device buffers, one call per
+ * channel as the drivers make them; for the kernels the channel count
+ * is the number of buffers summed into one, as in a port mixdown.
+ * Every case is repeated until it has run for --time milliseconds,
+ * and the best of --runs such rounds is reported.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "memops.h"
+#include "cpufeatures.h"
+#include "intsimd.h"
+
+/* inputs summed per pass, as jack_audio_port_mixdown() does */
+#define BENCH_MIXDOWN_BATCH 32
+
+#define BENCH_MAX_LIST 16
+
+typedef struct {
+	const char *name;
+	MemopsWriteFunction func;
+	unsigned int sample_bytes;
+	const char *dither;
+} bench_write_t;
+
+typedef struct {
+	const char *name;
+	MemopsReadFunction func;
+	unsigned int sample_bytes;
+} bench_read_t;
+
+typedef struct {
+	const char *name;
+	void (*copy)(float *, const float *, int);
+	void (*add)(float *, const float *, int);
+	void (*mixn)(float *, const float * const *, int, int);
+} bench_kernel_t;
+
+static const bench_write_t write_functions[] = {
+	{ "d32u24_sS", sample_move_d32u24_sS, 4, "none" },
+	{ "d32u24_sSs", sample_move_d32u24_sSs, 4, "none" },
+	{ "d32l24_sS", sample_move_d32l24_sS, 4, "none" },
+	{ "d32l24_sSs", sample_move_d32l24_sSs, 4, "none" },
+	{ "d24_sS", sample_move_d24_sS, 3, "none" },
+	{ "d24_sSs", sample_move_d24_sSs, 3, "none" },
+	{ "d16_sS", sample_move_d16_sS, 2, "none" },
+	{ "d16_sSs", sample_move_d16_sSs, 2, "none" },
+	{ "dS_floatLE", sample_move_dS_floatLE, 4, "none" },
+	{ "ddouble_sS", sample_move_ddouble_sS, 8, "none" },
+	{ "dither_rect_d16_sS", sample_move_dither_rect_d16_sS, 2, "rectangular" },
+	{ "dither_tri_d16_sS", sample_move_dither_tri_d16_sS, 2, "triangular" },
+	{ "dither_shaped_d16_sS", sample_move_dither_shaped_d16_sS, 2, "shaped" },
+	{ NULL }
+};
+
+static const bench_read_t read_functions[] = {
+	{ "dS_s32u24", sample_move_dS_s32u24, 4 },
+	{ "dS_s32u24s", sample_move_dS_s32u24s, 4 },
+	{ "dS_s32l24", sample_move_dS_s32l24, 4 },
+	{ "dS_s32l24s", sample_move_dS_s32l24s, 4 },
+	{ "dS_s24", sample_move_dS_s24, 3 },
+	{ "dS_s24s", sample_move_dS_s24s, 3 },
+	{ "dS_s16", sample_move_dS_s16, 2 },
+	{ "dS_s16s", sample_move_dS_s16s, 2 },
+	{ "floatLE_sSs", sample_move_floatLE_sSs, 4 },
+	{ "dS_sdouble", sample_move_dS_sdouble, 8 },
+	{ NULL }
+};
+
+static unsigned int channel_list[BENCH_MAX_LIST] = { 1, 2, 8, 32 };
+static unsigned int nchannel_list = 4;
+static unsigned int period_list[BENCH_MAX_LIST] = { 32, 64, 256, 1024 };
+static unsigned int nperiod_list = 4;
+static double min_time = 0.02;  /* seconds per round */
+static unsigned int runs = 5;
+static int json = 0;
+static const char *only = NULL;
+
+static double
+bench_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+bench_report (const char *group, const char *name, const char *variant,
+	      const char *dither, unsigned int channels, unsigned int period,
+	      double seconds, unsigned long samples, double bytes)
+{
+	double ns = seconds * 1e9 / samples;
+	double gbs = bytes / seconds / 1e9;
+
+	if (json) {
+		printf ("{\"group\":\"%s\",\"name\":\"%s\",\"variant\":\"%s\","
+			"\"dither\":\"%s\",\"channels\":%u,\"period\":%u,"
+			"\"ns_per_sample\":%.4f,\"gb_per_s\":%.4f}\n",
+			group, name, variant, dither, channels, period,
+			ns, gbs);
+	} else {
+		printf ("%-8s %-24s %-8s %-12s %4u %5u %10.4f %9.3f\n",
+			group, name, variant, dither, channels, period,
+			ns, gbs);
+	}
+}
+
+static int
+bench_selected (const char *name)
+{
+	return only == NULL || strstr (name, only) != NULL;
+}
+
+/* Run `body' until a round has taken min_time, `runs' times, and
+   leave the time of the fastest round per iteration in `best'. */
+#define BENCH_LOOP(best, body)						\
+	do {								\
+		unsigned long _iters = 1, _i;				\
+		unsigned int _r;					\
+		double _t;						\
+		(best) = 1e30;						\
+		for (;;) {						\
+			_t = bench_now ();				\
+			for (_i = 0; _i < _iters; _i++) { body; }	\
+			_t = bench_now () - _t;				\
+			if (_t >= min_time) break;			\
+			_iters *= 2;					\
+		}							\
+		for (_r = 0; _r < runs; _r++) {				\
+			_t = bench_now ();				\
+			for (_i = 0; _i < _iters; _i++) { body; }	\
+			_t = (bench_now () - _t) / _iters;		\
+			if (_t < (best)) (best) = _t;			\
+		}							\
+	} while (0)
+
+static void
+bench_fill (float *buf, unsigned long n)
+{
+	unsigned long i;
+
+	/* full scale, with some values out of range for the clippers */
+	for (i = 0; i < n; i++)
+		buf[i] = (float)((int)(i * 2654435761u % 2201) - 1100) / 1000.0f;
+}
+
+static void
+bench_converters (float *floats, char *device, dither_state_t *dither)
+{
+	const bench_write_t *w;
+	const bench_read_t *r;
+	unsigned int c, p, ch, channels, period;
+	MemopsWriteFunction wf;
+	MemopsReadFunction rf;
+	double best;
+	int simd;
+
+	for (w = write_functions; w->name; w++) {
+		if (!bench_selected (w->name)) {
+			continue;
+		}
+		for (simd = 0; simd < 2; simd++) {
+			wf = simd ? memops_simd_write_function (w->func) : w->func;
+			if (simd && wf == w->func) {
+				break;
+			}
+			for (c = 0; c < nchannel_list; c++) {
+				channels = channel_list[c];
+				for (p = 0; p < nperiod_list; p++) {
+					period = period_list[p];
+					memset (dither, 0, channels * sizeof(*dither));
+					BENCH_LOOP (best,
+						for (ch = 0; ch < channels; ch++)
+							wf (device + ch * w->sample_bytes,
+							    floats + ch * period, period,
+							    channels * w->sample_bytes,
+							    dither + ch));
+					bench_report ("write", w->name,
+						      simd ? memops_simd_name () : "scalar",
+						      w->dither, channels, period, best,
+						      (unsigned long)channels * period,
+						      (double)channels * period *
+						      (sizeof(float) + w->sample_bytes));
+				}
+			}
+		}
+	}
+
+	for (r = read_functions; r->name; r++) {
+		if (!bench_selected (r->name)) {
+			continue;
+		}
+		for (simd = 0; simd < 2; simd++) {
+			rf = simd ? memops_simd_read_function (r->func) : r->func;
+			if (simd && rf == r->func) {
+				break;
+			}
+			for (c = 0; c < nchannel_list; c++) {
+				channels = channel_list[c];
+				for (p = 0; p < nperiod_list; p++) {
+					period = period_list[p];
+					BENCH_LOOP (best,
+						for (ch = 0; ch < channels; ch++)
+							rf (floats + ch * period,
+							    device + ch * r->sample_bytes,
+							    period,
+							    channels * r->sample_bytes));
+					bench_report ("read", r->name,
+						      simd ? memops_simd_name () : "scalar",
+						      "none", channels, period, best,
+						      (unsigned long)channels * period,
+						      (double)channels * period *
+						      (sizeof(float) + r->sample_bytes));
+				}
+			}
+		}
+	}
+}
+
+static void
+gen_copyf (float *dest, const float *src, int length)
+{
+	memcpy (dest, src, length * sizeof(float));
+}
+
+static void
+gen_mixf (float *dest, const float *src, int length)
+{
+	while (length--)
+		*dest++ += *src++;
+}
+
+static void
+gen_mixnf (float *dest, const float * const *src, int nsrc, int length)
+{
+	int i, j;
+	float sum;
+
+	for (i = 0; i < length; i++) {
+		sum = src[0][i];
+		for (j = 1; j < nsrc; j++)
+			sum += src[j][i];
+		dest[i] = sum;
+	}
+}
+
+/* the kernels this CPU can run, generic C first */
+static unsigned int
+bench_kernels (bench_kernel_t *k)
+{
+	unsigned int n = 0;
+
+	k[n].name = "generic";
+	k[n].copy = gen_copyf;
+	k[n].add = gen_mixf;
+	k[n++].mixn = gen_mixnf;
+
+#ifdef ARCH_X86
+	if (jack_cpu_has (JACK_CPU_SSE2)) {
+		k[n].name = "sse";
+		k[n].copy = x86_sse_copyf;
+		k[n].add = x86_sse_add2f;
+		k[n++].mixn = x86_sse_mixnf;
+	}
+	if (jack_cpu_has (JACK_CPU_AVX)) {
+		k[n].name = "avx";
+		k[n].copy = x86_avx_copyf;
+		k[n].add = x86_avx_add2f;
+		k[n++].mixn = x86_avx_mixnf;
+	}
+	if (jack_cpu_has (JACK_CPU_AVX512F)) {
+		k[n].name = "avx512";
+		k[n].copy = x86_avx512_copyf;
+		k[n].add = x86_avx512_add2f;
+		k[n++].mixn = x86_avx512_mixnf;
+	}
+#endif
+#ifdef ARCH_ARM
+	if (jack_cpu_has (JACK_CPU_NEON)) {
+		k[n].name = "neon";
+		k[n].copy = arm_neon_copyf;
+		k[n].add = arm_neon_add2f;
+		k[n++].mixn = arm_neon_mixnf;
+	}
+#endif
+
+	return n;
+}
+
+/* sum `nsrc' buffers into `dest' the way jack_audio_port_mixdown()
+   does, in batches carried over through `dest' */
+static void
+bench_mixdown (const bench_kernel_t *k, float *dest, float **src,
+	       unsigned int nsrc, unsigned int period)
+{
+	const float *batch[BENCH_MIXDOWN_BATCH];
+	unsigned int i, n = 0;
+
+	for (i = 0; i < nsrc; i++) {
+		batch[n++] = src[i];
+		if (n == BENCH_MIXDOWN_BATCH) {
+			k->mixn (dest, batch, n, period);
+			batch[0] = dest;
+			n = 1;
+		}
+	}
+
+	if (n > 1 || (n == 1 && batch[0] != dest)) {
+		k->mixn (dest, batch, n, period);
+	}
+}
+
+static void
+bench_simd (float *floats, float *dest, float **src)
+{
+	bench_kernel_t kernels[8];
+	unsigned int nkernels, k, c, p, i, channels, period;
+	double best;
+
+	nkernels = bench_kernels (kernels);
+
+	for (k = 0; k < nkernels; k++) {
+		for (c = 0; c < nchannel_list; c++) {
+			channels = channel_list[c];
+			for (p = 0; p < nperiod_list; p++) {
+				period = period_list[p];
+				for (i = 0; i < channels; i++)
+					src[i] = floats + i * period;
+
+				if (bench_selected ("copyf")) {
+					BENCH_LOOP (best, kernels[k].copy (dest, src[0], period));
+					bench_report ("kernel", "copyf", kernels[k].name, "none",
+						      channels, period, best, period,
+						      2.0 * period * sizeof(float));
+				}
+
+				if (bench_selected ("add2f")) {
+					BENCH_LOOP (best,
+						kernels[k].copy (dest, src[0], period);
+						for (i = 1; i < channels; i++)
+							kernels[k].add (dest, src[i], period));
+					bench_report ("kernel", "add2f", kernels[k].name, "none",
+						      channels, period, best,
+						      (unsigned long)channels * period,
+						      (2.0 * channels - 1) * period * sizeof(float));
+				}
+
+				if (bench_selected ("mixdown")) {
+					BENCH_LOOP (best, bench_mixdown (&kernels[k], dest, src, channels, period));
+					bench_report ("kernel", "mixdown", kernels[k].name, "none",
+						      channels, period, best,
+						      (unsigned long)channels * period,
+						      (channels + 1.0) * period * sizeof(float));
+				}
+			}
+		}
+	}
+}
+
+static int
+bench_parse_list (const char *arg, unsigned int *list, unsigned int *n)
+{
+	char *end;
+	unsigned long v;
+
+	*n = 0;
+
+	while (*arg) {
+		v = strtoul (arg, &end, 10);
+		if (end == arg || v == 0 || *n == BENCH_MAX_LIST) {
+			return -1;
+		}
+		list[(*n)++] = v;
+		arg = end;
+		if (*arg == ',') {
+			arg++;
+		} else if (*arg) {
+			return -1;
+		}
+	}
+
+	return *n ? 0 : -1;
+}
+
+static void
+usage (FILE *file)
+{
+	fprintf (file,
+		 "usage: jack_bench [ -c channels ] [ -p periods ] [ -t msecs ] [ -r runs ]\n"
+		 "                  [ -o name ] [ -j ]\n"
+		 "   -c, --channels   comma separated channel counts (1,2,8,32)\n"
+		 "   -p, --periods    comma separated period sizes (32,64,256,1024)\n"
+		 "   -t, --time       shortest round, in milliseconds (20)\n"
+		 "   -r, --runs       rounds per case, the best is reported (5)\n"
+		 "   -o, --only       run only the cases whose name contains this\n"
+		 "   -j, --json       one JSON object per case, for tracking over time\n");
+}
+
+int
+main (int argc, char *argv[])
+{
+	struct option long_options[] = {
+		{ "channels", 1, 0, 'c' },
+		{ "help", 0, 0, 'h' },
+		{ "json", 0, 0, 'j' },
+		{ "only", 1, 0, 'o' },
+		{ "periods", 1, 0, 'p' },
+		{ "runs", 1, 0, 'r' },
+		{ "time", 1, 0, 't' },
+		{ 0, 0, 0, 0 }
+	};
+	unsigned int max_channels = 0, max_period = 0, i;
+	dither_state_t *dither;
+	float *floats, *dest;
+	float **src;
+	char *device;
+	int opt;
+
+	while ((opt = getopt_long (argc, argv, "c:hjo:p:r:t:", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'c':
+			if (bench_parse_list (optarg, channel_list, &nchannel_list)) {
+				usage (stderr);
+				return 1;
+			}
+			break;
+		case 'p':
+			if (bench_parse_list (optarg, period_list, &nperiod_list)) {
+				usage (stderr);
+				return 1;
+			}
+			break;
+		case 't':
+			min_time = atof (optarg) / 1000.0;
+			break;
+		case 'r':
+			runs = atoi (optarg);
+			if (runs == 0) {
+				runs = 1;
+			}
+			break;
+		case 'o':
+			only = optarg;
+			break;
+		case 'j':
+			json = 1;
+			break;
+		case 'h':
+			usage (stdout);
+			return 0;
+		default:
+			usage (stderr);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < nchannel_list; i++)
+		if (channel_list[i] > max_channels) {
+			max_channels = channel_list[i];
+		}
+	for (i = 0; i < nperiod_list; i++)
+		if (period_list[i] > max_period) {
+			max_period = period_list[i];
+		}
+
+	if (posix_memalign ((void**)&floats, 64, (size_t)max_channels * max_period * sizeof(float))
+	    || posix_memalign ((void**)&dest, 64, (size_t)max_period * sizeof(float))
+	    || posix_memalign ((void**)&device, 64, (size_t)max_channels * max_period * sizeof(double))) {
+		fprintf (stderr, "jack_bench: out of memory\n");
+		return 1;
+	}
+	src = (float**)calloc (max_channels, sizeof(float*));
+	dither = (dither_state_t*)calloc (max_channels, sizeof(dither_state_t));
+	if (src == NULL || dither == NULL) {
+		fprintf (stderr, "jack_bench: out of memory\n");
+		return 1;
+	}
+
+	bench_fill (floats, (unsigned long)max_channels * max_period);
+	memset (device, 0, (size_t)max_channels * max_period * sizeof(double));
+
+	if (!json) {
+		printf ("%-8s %-24s %-8s %-12s %4s %5s %10s %9s\n",
+			"group", "name", "variant", "dither", "chan", "frames",
+			"ns/sample", "GB/s");
+	}
+
+	bench_converters (floats, device, dither);
+	bench_simd (floats, dest, src);
+
+	free (dither);
+	free (src);
+	free (device);
+	free (dest);
+	free (floats);
+
+	return 0;
+}
@@ -0,0 +1,516 @@
+/* -*- mode: c; c-file-style: "linux"; -*- */
+/*
+    Control-plane benchmark: times port registration, connection,
+    connection queries, disconnection and unregistration at scale,
+    with other clients listening to the events they cause.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ */
+
+/* For each port count P, one client registers P/2 output and P/2 input
+ * ports, connects them in pairs, asks the server for the connections
+ * of every port (jack_port_get_all_connections() always goes to the
+ * server), disconnects the pairs and unregisters all ports. Every call
+ * is timed on its own; each phase reports operations per second and
+ * the mean, p50, p99 and largest latency.
+ *
+ * Before that, C clients are opened and closed again one at a time,
+ * timing jack_client_open() and jack_client_close() the same way: how
+ * long a client takes to come up is a number to watch in its own
+ * right when many start at once.
+ *
+ * Meanwhile M listening clients, each a process of its own, count the
+ * port registration, connection and graph order callbacks they get,
+ * so that the cost of delivering every event to every client is part
+ * of what is measured. Their counts are reported at the end of each
+ * run, as a check that the events arrived.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <jack/jack.h>
+
+#define BENCH_MAX_LIST 16
+
+typedef struct {
+	double mean;
+	double p50;
+	double p99;
+	double max;
+	double ops_per_sec;
+} bench_stats_t;
+
+static const char *server_name = NULL;
+static unsigned int port_list[BENCH_MAX_LIST] = { 1000, 10000, 50000 };
+static unsigned int nport_list = 3;
+static unsigned int nlisteners = 4;
+static unsigned int nopen = 32;
+static int start_dummy = 0;
+static int json = 0;
+
+static pid_t server_pid = 0;
+
+static double
+bench_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static jack_client_t *
+bench_open (const char *name)
+{
+	jack_status_t status;
+
+	return jack_client_open (name, JackNoStartServer | JackUseExactName
+				 | (server_name ? JackServerName : 0),
+				 &status, server_name);
+}
+
+/* == the listeners ====================================================== */
+
+static volatile unsigned long events;
+
+static void
+bench_registration (jack_port_id_t port, int reg, void *arg)
+{
+	__sync_fetch_and_add (&events, 1);
+}
+
+static void
+bench_connection (jack_port_id_t a, jack_port_id_t b, int connect, void *arg)
+{
+	__sync_fetch_and_add (&events, 1);
+}
+
+static int
+bench_graph_order (void *arg)
+{
+	__sync_fetch_and_add (&events, 1);
+	return 0;
+}
+
+/* runs in the child: listen until the parent closes `quit', then
+   report the number of events seen on `ready' */
+static int
+bench_listener_main (int index, int ready, int quit)
+{
+	jack_client_t *client;
+	unsigned long n;
+	char name[64];
+	char c;
+
+	snprintf (name, sizeof(name), "cbench-listen-%d", index);
+
+	if ((client = bench_open (name)) == NULL) {
+		fprintf (stderr, "jack_control_bench: cannot open client %s\n", name);
+		return 1;
+	}
+
+	jack_set_port_registration_callback (client, bench_registration, NULL);
+	jack_set_port_connect_callback (client, bench_connection, NULL);
+	jack_set_graph_order_callback (client, bench_graph_order, NULL);
+
+	if (jack_activate (client)) {
+		fprintf (stderr, "jack_control_bench: cannot activate %s\n", name);
+		return 1;
+	}
+
+	n = 0;
+	if (write (ready, &n, sizeof(n)) != sizeof(n)) {
+		return 1;
+	}
+
+	while (read (quit, &c, 1) < 0 && errno == EINTR)
+		;
+
+	/* let the last events drain */
+	usleep (200000);
+	n = events;
+	jack_client_close (client);
+
+	return write (ready, &n, sizeof(n)) == sizeof(n) ? 0 : 1;
+}
+
+/* == statistics ========================================================= */
+
+static int
+bench_compare (const void *a, const void *b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+static void
+bench_stats (double *v, unsigned long n, double total, bench_stats_t *s)
+{
+	unsigned long i;
+	double sum = 0.0;
+
+	memset (s, 0, sizeof(*s));
+
+	if (n == 0) {
+		return;
+	}
+
+	for (i = 0; i < n; i++)
+		sum += v[i];
+
+	qsort (v, n, sizeof(double), bench_compare);
+
+	s->mean = sum / n * 1e6;
+	s->p50 = v[n / 2] * 1e6;
+	s->p99 = v[(n * 99) / 100] * 1e6;
+	s->max = v[n - 1] * 1e6;
+	s->ops_per_sec = total > 0.0 ? n / total : 0.0;
+}
+
+static void
+bench_report (const char *op, unsigned int nports, unsigned long n,
+	      double *lat, double total)
+{
+	bench_stats_t s;
+
+	bench_stats (lat, n, total, &s);
+
+	if (json) {
+		printf ("{\"op\":\"%s\",\"ports\":%u,\"listeners\":%u,\"count\":%lu,"
+			"\"ops_per_sec\":%.1f,\"usecs\":{\"mean\":%.2f,\"p50\":%.2f,"
+			"\"p99\":%.2f,\"max\":%.2f}}\n",
+			op, nports, nlisteners, n, s.ops_per_sec,
+			s.mean, s.p50, s.p99, s.max);
+	} else {
+		printf ("%-10s %6u %4u %7lu %10.1f %9.1f %9.1f %9.1f %10.1f\n",
+			op, nports, nlisteners, n, s.ops_per_sec,
+			s.mean, s.p50, s.p99, s.max);
+	}
+	fflush (stdout);
+}
+
+/* == one run ============================================================ */
+
+/* time `call' for each i below n, leaving the latencies in `lat' and
+   the number of calls that succeeded in `ok' */
+#define BENCH_TIMED(n, ok, total, call)					\
+	do {								\
+		double _t0 = bench_now (), _t;				\
+		for (i = 0, (ok) = 0; i < (n); i++) {			\
+			_t = bench_now ();				\
+			if (call) {					\
+				lat[(ok)++] = bench_now () - _t;	\
+			}						\
+		}							\
+		(total) = bench_now () - _t0;				\
+	} while (0)
+
+static int
+bench_run (unsigned int nports)
+{
+	int ready[2], quit[2];
+	pid_t *pids;
+	jack_client_t *client;
+	jack_client_t **opened;
+	jack_port_t **ports;
+	double *lat, total;
+	char name[64], src[128], dst[128];
+	const char *cname;
+	const char **conns;
+	unsigned long ok, n, received = 0;
+	unsigned int i, pairs = nports / 2, got = 0;
+	int status = 0;
+
+	if (pipe (ready) || pipe (quit)) {
+		perror ("jack_control_bench: pipe");
+		return -1;
+	}
+
+	pids = (pid_t*)calloc (nlisteners + 1, sizeof(pid_t));
+
+	for (i = 0; i < nlisteners; i++) {
+		if ((pids[i] = fork ()) == 0) {
+			close (ready[0]);
+			close (quit[1]);
+			_exit (bench_listener_main (i, ready[1], quit[0]));
+		}
+	}
+	close (ready[1]);
+	close (quit[0]);
+
+	while (got < nlisteners && read (ready[0], &n, sizeof(n)) == sizeof(n))
+		got++;
+
+	if (got < nlisteners || (client = bench_open ("cbench")) == NULL) {
+		fprintf (stderr, "jack_control_bench: cannot start the clients\n");
+		status = -1;
+		goto stop;
+	}
+
+	jack_activate (client);
+	cname = jack_get_client_name (client);
+
+	ports = (jack_port_t**)calloc (2 * pairs, sizeof(jack_port_t*));
+	opened = (jack_client_t**)calloc (nopen, sizeof(jack_client_t*));
+	lat = (double*)malloc ((2 * pairs > nopen ? 2 * pairs : nopen)
+			       * sizeof(double));
+
+	BENCH_TIMED (nopen, ok, total,
+		     (snprintf (name, sizeof(name), "cbench-open-%u", i),
+		      (opened[i] = bench_open (name)) != NULL));
+	bench_report ("open", nports, ok, lat, total);
+
+	BENCH_TIMED (nopen, ok, total,
+		     opened[i] && jack_client_close (opened[i]) == 0);
+	bench_report ("close", nports, ok, lat, total);
+
+	/* ports [0, pairs) are outputs, [pairs, 2 * pairs) inputs */
+	BENCH_TIMED (2 * pairs, ok, total,
+		     (snprintf (name, sizeof(name), "%s-%u", i < pairs ? "out" : "in", i),
+		      (ports[i] = jack_port_register (client, name, JACK_DEFAULT_AUDIO_TYPE,
+						      i < pairs ? JackPortIsOutput : JackPortIsInput,
+						      0)) != NULL));
+	bench_report ("register", nports, ok, lat, total);
+
+	BENCH_TIMED (pairs, ok, total,
+		     (snprintf (src, sizeof(src), "%s:out-%u", cname, i),
+		      snprintf (dst, sizeof(dst), "%s:in-%u", cname, pairs + i),
+		      jack_connect (client, src, dst) == 0));
+	bench_report ("connect", nports, ok, lat, total);
+
+	BENCH_TIMED (2 * pairs, ok, total,
+		     ports[i] && ((conns = jack_port_get_all_connections (client, ports[i])) != NULL)
+		     && (jack_free (conns), 1));
+	bench_report ("query", nports, ok, lat, total);
+
+	BENCH_TIMED (pairs, ok, total,
+		     (snprintf (src, sizeof(src), "%s:out-%u", cname, i),
+		      snprintf (dst, sizeof(dst), "%s:in-%u", cname, pairs + i),
+		      jack_disconnect (client, src, dst) == 0));
+	bench_report ("disconnect", nports, ok, lat, total);
+
+	BENCH_TIMED (2 * pairs, ok, total,
+		     ports[i] && jack_port_unregister (client, ports[i]) == 0);
+	bench_report ("unregister", nports, ok, lat, total);
+
+	free (lat);
+	free (opened);
+	free (ports);
+	jack_client_close (client);
+
+stop:
+	close (quit[1]);
+
+	while (read (ready[0], &n, sizeof(n)) == sizeof(n))
+		received += n;
+	close (ready[0]);
+
+	for (i = 0; i < nlisteners; i++)
+		if (pids[i] > 0) {
+			waitpid (pids[i], NULL, 0);
+		}
+	free (pids);
+
+	if (status == 0) {
+		if (json) {
+			printf ("{\"op\":\"events\",\"ports\":%u,\"listeners\":%u,"
+				"\"received\":%lu}\n", nports, nlisteners, received);
+		} else {
+			printf ("%-10s %6u %4u %7lu callbacks received by the listeners\n",
+				"events", nports, nlisteners, received);
+		}
+	}
+
+	return status;
+}
+
+/* == the server ========================================================= */
+
+static int
+bench_start_server (unsigned int port_max)
+{
+	char ports[16];
+	const char *jackd = getenv ("JACKD");
+
+	snprintf (ports, sizeof(ports), "%u", port_max);
+
+	if ((server_pid = fork ()) == 0) {
+		execlp (jackd ? jackd : "jackd", "jackd", "-n", server_name,
+			"-p", ports, "-d", "dummy", (char*)NULL);
+		perror ("jack_control_bench: cannot run jackd");
+		_exit (1);
+	}
+
+	return server_pid > 0 ? 0 : -1;
+}
+
+static void
+bench_stop_server (void)
+{
+	if (server_pid > 0) {
+		kill (server_pid, SIGTERM);
+		waitpid (server_pid, NULL, 0);
+		server_pid = 0;
+	}
+}
+
+static int
+bench_parse_list (const char *arg, unsigned int *list, unsigned int *n)
+{
+	char *end;
+	unsigned long v;
+
+	*n = 0;
+
+	while (*arg) {
+		v = strtoul (arg, &end, 10);
+		if (end == arg || v < 2 || *n == BENCH_MAX_LIST) {
+			return -1;
+		}
+		list[(*n)++] = v;
+		arg = end;
+		if (*arg == ',') {
+			arg++;
+		} else if (*arg) {
+			return -1;
+		}
+	}
+
+	return *n ? 0 : -1;
+}
+
+static void
+usage (FILE *file)
+{
+	fprintf (file,
+		 "usage: jack_control_bench [ -p ports ] [ -m listeners ] [ -c clients ] [ -d ] [ -N server ] [ -j ]\n"
+		 "   -p, --ports      comma separated port counts (1000,10000,50000)\n"
+		 "   -m, --listeners  clients listening to the events (4)\n"
+		 "   -c, --clients    clients opened and closed to time that (32)\n"
+		 "   -d, --dummy      start a private jackd on the dummy driver, with\n"
+		 "                    room for the ports ($JACKD names the binary)\n"
+		 "   -N, --server     server name\n"
+		 "   -j, --json       one JSON object per phase, for tracking over time\n");
+}
+
+int
+main (int argc, char *argv[])
+{
+	struct option long_options[] = {
+		{ "clients", 1, 0, 'c' },
+		{ "dummy", 0, 0, 'd' },
+		{ "help", 0, 0, 'h' },
+		{ "json", 0, 0, 'j' },
+		{ "listeners", 1, 0, 'm' },
+		{ "server", 1, 0, 'N' },
+		{ "ports", 1, 0, 'p' },
+		{ 0, 0, 0, 0 }
+	};
+	char private_name[64];
+	jack_client_t *probe = NULL;
+	unsigned int i, max_ports = 0, tries;
+	int opt, rc = 0;
+
+	while ((opt = getopt_long (argc, argv, "c:dhjm:N:p:", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'c':
+			nopen = atoi (optarg);
+			break;
+		case 'd':
+			start_dummy = 1;
+			break;
+		case 'j':
+			json = 1;
+			break;
+		case 'm':
+			nlisteners = atoi (optarg);
+			break;
+		case 'N':
+			server_name = optarg;
+			break;
+		case 'p':
+			if (bench_parse_list (optarg, port_list, &nport_list)) {
+				usage (stderr);
+				return 1;
+			}
+			break;
+		case 'h':
+			usage (stdout);
+			return 0;
+		default:
+			usage (stderr);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < nport_list; i++)
+		if (port_list[i] > max_ports) {
+			max_ports = port_list[i];
+		}
+
+	if (start_dummy) {
+		if (server_name == NULL) {
+			snprintf (private_name, sizeof(private_name),
+				  "cbench-%d", (int)getpid ());
+			server_name = private_name;
+		}
+		/* the dummy driver's own ports and some to spare */
+		if (bench_start_server (max_ports + 256)) {
+			return 1;
+		}
+		for (tries = 0; tries < 50; tries++) {
+			if ((probe = bench_open ("cbench-probe")) != NULL) {
+				break;
+			}
+			usleep (100000);
+		}
+		if (probe == NULL) {
+			fprintf (stderr, "jack_control_bench: the server did not start\n");
+			bench_stop_server ();
+			return 1;
+		}
+		jack_client_close (probe);
+	}
+
+	if (!json) {
+		printf ("%-10s %6s %4s %7s %10s %9s %9s %9s %10s\n",
+			"op", "ports", "lstn", "count", "ops/s",
+			"mean-us", "p50-us", "p99-us", "max-us");
+	}
+
+	for (i = 0; i < nport_list; i++) {
+		if (bench_run (port_list[i])) {
+			rc = 1;
+			break;
+		}
+	}
+
+	bench_stop_server ();
+
+	return rc;
+}
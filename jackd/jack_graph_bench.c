@@ -0,0 +1,675 @@
+/* -*- mode: c; c-file-style: "linux"; -*- */
+/*
+    End-to-end graph benchmark: runs N external clients in a chosen
+    topology and measures the engine's cycle time, the wakeup latency
+    of every client and where xruns start as N grows.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ */
+
+/* Every client is a separate process with one input and one output
+ * port, whose process callback copies its input to its output and then
+ * spins for --load microseconds. The clients are connected as
+ *
+ *   chain    0 -> 1 -> ... -> N-1
+ *   fanout   0 -> each of 1 ... N-1
+ *   fanin    each of 0 ... N-2 -> N-1
+ *   diamond  0 -> each of 1 ... N-2 -> N-1
+ *
+ * The timings come from the server's cycle trace (jackd --cycle-trace),
+ * so the measuring process takes no part in the graph. For each cycle
+ * the wall time is cycle_end - cycle_start; for each client the
+ * wakeup latency is awake - signalled, the cost of one FIFO or futex
+ * hop into that client. With --sweep, N doubles from 1 up to the
+ * given count and the first N that saw an xrun, or a cycle longer
+ * than the period, is reported as the xrun threshold.
+ *
+ * With --dummy, a private jackd is started on the dummy driver with
+ * tracing on, so that runs are reproducible from one machine to the
+ * next; otherwise the running server is used.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <jack/jack.h>
+#include <jack/session.h>
+#include <jack/uuid.h>
+
+#include "cycletrace.h"
+
+typedef enum {
+	TopologyChain,
+	TopologyFanout,
+	TopologyFanin,
+	TopologyDiamond
+} bench_topology_t;
+
+static const char *topology_names[] = { "chain", "fanout", "fanin", "diamond" };
+
+typedef struct {
+	int index;
+	char uuid[JACK_UUID_STRING_SIZE];
+} bench_ready_t;
+
+typedef struct {
+	double mean;
+	double p50;
+	double p99;
+	double max;
+	unsigned long count;
+} bench_stats_t;
+
+static const char *server_name = NULL;
+static bench_topology_t topology = TopologyChain;
+static unsigned int nclients = 8;
+static int sweep = 0;
+static double seconds = 5.0;
+static unsigned int load_usecs = 0;
+static jack_nframes_t dummy_period = 0;
+static int json = 0;
+static int verbose = 0;
+
+static pid_t server_pid = 0;
+
+/* == the clients ======================================================== */
+
+typedef struct {
+	jack_port_t *in;
+	jack_port_t *out;
+} bench_client_t;
+
+static int
+bench_process (jack_nframes_t nframes, void *arg)
+{
+	bench_client_t *bc = (bench_client_t*)arg;
+	jack_time_t until;
+
+	memcpy (jack_port_get_buffer (bc->out, nframes),
+		jack_port_get_buffer (bc->in, nframes),
+		nframes * sizeof(jack_default_audio_sample_t));
+
+	if (load_usecs) {
+		until = jack_get_time () + load_usecs;
+		while (jack_get_time () < until)
+			;
+	}
+
+	return 0;
+}
+
+/* runs in the child: serve until the parent closes `quit' */
+static int
+bench_client_main (int index, int ready, int quit)
+{
+	char name[64];
+	bench_client_t bc;
+	bench_ready_t msg;
+	jack_client_t *client;
+	jack_status_t status;
+	char *uuid;
+	char c;
+
+	snprintf (name, sizeof(name), "gbench-%d", index);
+
+	client = jack_client_open (name, JackNoStartServer | JackUseExactName
+				   | (server_name ? JackServerName : 0),
+				   &status, server_name);
+	if (client == NULL) {
+		fprintf (stderr, "jack_graph_bench: cannot open client %s "
+			 "(status 0x%x)\n", name, status);
+		return 1;
+	}
+
+	bc.in = jack_port_register (client, "in", JACK_DEFAULT_AUDIO_TYPE,
+				    JackPortIsInput, 0);
+	bc.out = jack_port_register (client, "out", JACK_DEFAULT_AUDIO_TYPE,
+				     JackPortIsOutput, 0);
+	if (bc.in == NULL || bc.out == NULL) {
+		fprintf (stderr, "jack_graph_bench: cannot register ports for %s\n", name);
+		return 1;
+	}
+
+	jack_set_process_callback (client, bench_process, &bc);
+
+	if (jack_activate (client)) {
+		fprintf (stderr, "jack_graph_bench: cannot activate %s\n", name);
+		return 1;
+	}
+
+	memset (&msg, 0, sizeof(msg));
+	msg.index = index;
+	if ((uuid = jack_client_get_uuid (client)) != NULL) {
+		snprintf (msg.uuid, sizeof(msg.uuid), "%s", uuid);
+		jack_free (uuid);
+	}
+	if (write (ready, &msg, sizeof(msg)) != sizeof(msg)) {
+		return 1;
+	}
+
+	while (read (quit, &c, 1) < 0 && errno == EINTR)
+		;
+
+	jack_client_close (client);
+	return 0;
+}
+
+/* == the graph ========================================================== */
+
+static void
+bench_connect (jack_client_t *ctl, unsigned int from, unsigned int to)
+{
+	char src[64], dst[64];
+
+	snprintf (src, sizeof(src), "gbench-%u:out", from);
+	snprintf (dst, sizeof(dst), "gbench-%u:in", to);
+
+	if (jack_connect (ctl, src, dst)) {
+		fprintf (stderr, "jack_graph_bench: cannot connect %s to %s\n",
+			 src, dst);
+	}
+}
+
+static void
+bench_wire (jack_client_t *ctl, unsigned int n)
+{
+	unsigned int i;
+
+	switch (topology) {
+	case TopologyChain:
+		for (i = 0; i + 1 < n; i++)
+			bench_connect (ctl, i, i + 1);
+		break;
+	case TopologyFanout:
+		for (i = 1; i < n; i++)
+			bench_connect (ctl, 0, i);
+		break;
+	case TopologyFanin:
+		for (i = 0; i + 1 < n; i++)
+			bench_connect (ctl, i, n - 1);
+		break;
+	case TopologyDiamond:
+		if (n < 3) {
+			for (i = 0; i + 1 < n; i++)
+				bench_connect (ctl, i, i + 1);
+			break;
+		}
+		for (i = 1; i + 1 < n; i++) {
+			bench_connect (ctl, 0, i);
+			bench_connect (ctl, i, n - 1);
+		}
+		break;
+	}
+}
+
+/* == statistics ========================================================= */
+
+static int
+bench_compare (const void *a, const void *b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+static void
+bench_stats (double *v, unsigned long n, bench_stats_t *s)
+{
+	unsigned long i;
+	double sum = 0.0;
+
+	memset (s, 0, sizeof(*s));
+	s->count = n;
+
+	if (n == 0) {
+		return;
+	}
+
+	qsort (v, n, sizeof(double), bench_compare);
+
+	for (i = 0; i < n; i++)
+		sum += v[i];
+
+	s->mean = sum / n;
+	s->p50 = v[n / 2];
+	s->p99 = v[(n * 99) / 100 < n ? (n * 99) / 100 : n - 1];
+	s->max = v[n - 1];
+}
+
+/* Copy the records written since `from' out of the ring, skipping any
+   the engine was writing at the time, or has overwritten since. */
+static unsigned long
+bench_collect (const jack_cycle_trace_t *trace, uint64_t from,
+	       jack_cycle_trace_record_t *out, unsigned long max)
+{
+	uint64_t to = trace->write_count;
+	unsigned long n = 0;
+	uint32_t seq;
+	uint64_t i;
+
+	if (to - from > trace->nrecords) {
+		from = to - trace->nrecords;
+	}
+
+	for (i = from; i < to && n < max; i++) {
+		const jack_cycle_trace_record_t *rec =
+			&trace->records[i % trace->nrecords];
+		seq = rec->seq;
+		__sync_synchronize ();
+		if (seq & 1) {
+			continue;
+		}
+		memcpy (&out[n], (const void*)rec, sizeof(*rec));
+		__sync_synchronize ();
+		if (rec->seq != seq || out[n].cycle != i) {
+			continue;
+		}
+		n++;
+	}
+
+	return n;
+}
+
+/* == one run ============================================================ */
+
+static int
+bench_run (jack_client_t *ctl, const jack_cycle_trace_t *trace,
+	   unsigned int n, int *xrun_seen)
+{
+	int ready[2], quit[2];
+	pid_t *pids;
+	jack_uuid_t *uuids;
+	bench_ready_t msg;
+	jack_cycle_trace_record_t *recs;
+	unsigned long nrecs, r, ncycles, xruns = 0, failed = 0, over = 0;
+	double *cycle_usecs, *hop_usecs, *client_usecs;
+	bench_stats_t cycle, hop, cs;
+	double period_usecs;
+	uint64_t start;
+	unsigned int i, k, got = 0;
+	int status = 0;
+
+	period_usecs = 1e6 * jack_get_buffer_size (ctl) / jack_get_sample_rate (ctl);
+
+	if (pipe (ready) || pipe (quit)) {
+		perror ("jack_graph_bench: pipe");
+		return -1;
+	}
+
+	pids = (pid_t*)calloc (n, sizeof(pid_t));
+	uuids = (jack_uuid_t*)calloc (n, sizeof(jack_uuid_t));
+
+	for (i = 0; i < n; i++) {
+		if ((pids[i] = fork ()) == 0) {
+			close (ready[0]);
+			close (quit[1]);
+			_exit (bench_client_main (i, ready[1], quit[0]));
+		}
+		if (pids[i] < 0) {
+			perror ("jack_graph_bench: fork");
+			n = i;
+			break;
+		}
+	}
+
+	close (ready[1]);
+	close (quit[0]);
+
+	while (got < n && read (ready[0], &msg, sizeof(msg)) == sizeof(msg)) {
+		if (msg.index >= 0 && (unsigned int)msg.index < n) {
+			jack_uuid_parse (msg.uuid, &uuids[msg.index]);
+		}
+		got++;
+	}
+	close (ready[0]);
+
+	if (got < n) {
+		fprintf (stderr, "jack_graph_bench: only %u of %u clients started\n",
+			 got, n);
+		status = -1;
+		goto stop;
+	}
+
+	bench_wire (ctl, n);
+
+	/* let the graph settle, then measure */
+	usleep (200000);
+	start = trace->write_count;
+	usleep ((useconds_t)(seconds * 1e6));
+
+	nrecs = trace->nrecords;
+	recs = (jack_cycle_trace_record_t*)malloc (nrecs * sizeof(*recs));
+	cycle_usecs = (double*)malloc (nrecs * sizeof(double));
+	hop_usecs = (double*)malloc (nrecs * n * sizeof(double));
+	client_usecs = (double*)malloc (nrecs * sizeof(double));
+
+	ncycles = bench_collect (trace, start, recs, nrecs);
+
+	for (r = 0; r < ncycles; r++) {
+		cycle_usecs[r] = (double)(recs[r].cycle_end - recs[r].cycle_start);
+		if (recs[r].flags & JACK_CYCLE_TRACE_XRUN) {
+			xruns++;
+		}
+		if (recs[r].flags & JACK_CYCLE_TRACE_FAILED) {
+			failed++;
+		}
+		if (cycle_usecs[r] > period_usecs) {
+			over++;
+		}
+	}
+	bench_stats (cycle_usecs, ncycles, &cycle);
+
+	/* all hops together, then each client on its own */
+	{
+		unsigned long nhops = 0;
+
+		for (r = 0; r < ncycles; r++) {
+			for (k = 0; k < recs[r].nclients; k++) {
+				const jack_cycle_trace_client_t *c = &recs[r].clients[k];
+				for (i = 0; i < n; i++) {
+					if (jack_uuid_compare (c->uuid, uuids[i]) == 0) {
+						break;
+					}
+				}
+				if (i == n || c->signalled == JACK_CYCLE_TRACE_NONE
+				    || c->awake == JACK_CYCLE_TRACE_NONE
+				    || c->awake < c->signalled) {
+					continue;
+				}
+				hop_usecs[nhops++] = c->awake - c->signalled;
+			}
+		}
+		bench_stats (hop_usecs, nhops, &hop);
+	}
+
+	if (json) {
+		printf ("{\"topology\":\"%s\",\"clients\":%u,\"load_usecs\":%u,"
+			"\"period_usecs\":%.1f,\"cycles\":%lu,\"xruns\":%lu,"
+			"\"failed\":%lu,\"over_period\":%lu,"
+			"\"cycle_usecs\":{\"mean\":%.2f,\"p50\":%.2f,\"p99\":%.2f,\"max\":%.2f},"
+			"\"wakeup_usecs\":{\"mean\":%.2f,\"p50\":%.2f,\"p99\":%.2f,\"max\":%.2f}",
+			topology_names[topology], n, load_usecs, period_usecs,
+			ncycles, xruns, failed, over,
+			cycle.mean, cycle.p50, cycle.p99, cycle.max,
+			hop.mean, hop.p50, hop.p99, hop.max);
+	} else {
+		printf ("%-8s %4u %7lu %5lu %5lu %9.1f %9.1f %9.1f %8.1f %8.1f %8.1f\n",
+			topology_names[topology], n, ncycles, xruns, over,
+			cycle.mean, cycle.p99, cycle.max,
+			hop.mean, hop.p99, hop.max);
+	}
+
+	if (verbose || json) {
+		if (json) {
+			printf (",\"per_client\":[");
+		}
+		for (i = 0; i < n; i++) {
+			unsigned long m = 0;
+			for (r = 0; r < ncycles; r++) {
+				for (k = 0; k < recs[r].nclients; k++) {
+					const jack_cycle_trace_client_t *c = &recs[r].clients[k];
+					if (jack_uuid_compare (c->uuid, uuids[i]) == 0
+					    && c->signalled != JACK_CYCLE_TRACE_NONE
+					    && c->awake != JACK_CYCLE_TRACE_NONE
+					    && c->awake >= c->signalled) {
+						client_usecs[m++] = c->awake - c->signalled;
+					}
+				}
+			}
+			bench_stats (client_usecs, m, &cs);
+			if (json) {
+				printf ("%s{\"client\":%u,\"mean\":%.2f,\"p99\":%.2f,\"max\":%.2f}",
+					i ? "," : "", i, cs.mean, cs.p99, cs.max);
+			} else {
+				printf ("    gbench-%-3u wakeup mean %8.1f p99 %8.1f max %8.1f usecs\n",
+					i, cs.mean, cs.p99, cs.max);
+			}
+		}
+		if (json) {
+			printf ("]");
+		}
+	}
+
+	if (json) {
+		printf ("}\n");
+	}
+	fflush (stdout);
+
+	*xrun_seen = (xruns > 0 || failed > 0 || over > 0);
+
+	free (client_usecs);
+	free (hop_usecs);
+	free (cycle_usecs);
+	free (recs);
+
+stop:
+	close (quit[1]);
+	for (i = 0; i < n; i++)
+		waitpid (pids[i], NULL, 0);
+	free (uuids);
+	free (pids);
+
+	return status;
+}
+
+/* == the server ========================================================= */
+
+static int
+bench_start_server (void)
+{
+	char period[16], records[16];
+	const char *jackd = getenv ("JACKD");
+
+	snprintf (period, sizeof(period), "%u", dummy_period);
+	/* enough for the longest run at 16 frames and 96 kHz */
+	snprintf (records, sizeof(records), "%u", 65536);
+
+	if ((server_pid = fork ()) == 0) {
+		execlp (jackd ? jackd : "jackd", "jackd",
+			"-n", server_name, "--cycle-trace", records,
+			"-d", "dummy", "-p", period, (char*)NULL);
+		perror ("jack_graph_bench: cannot run jackd");
+		_exit (1);
+	}
+
+	return server_pid > 0 ? 0 : -1;
+}
+
+static void
+bench_stop_server (void)
+{
+	if (server_pid > 0) {
+		kill (server_pid, SIGTERM);
+		waitpid (server_pid, NULL, 0);
+		server_pid = 0;
+	}
+}
+
+static void
+usage (FILE *file)
+{
+	fprintf (file,
+		 "usage: jack_graph_bench [ -n clients ] [ -t topology ] [ -s seconds ]\n"
+		 "                        [ -l usecs ] [ -S ] [ -d period ] [ -N server ] [ -j ] [ -v ]\n"
+		 "   -n, --clients    number of clients, at most %d (8)\n"
+		 "   -t, --topology   chain, fanout, fanin or diamond (chain)\n"
+		 "   -s, --seconds    time measured per run (5)\n"
+		 "   -l, --load       busy time in each process callback, in usecs (0)\n"
+		 "   -S, --sweep      run with 1, 2, 4 ... clients, up to --clients\n"
+		 "   -d, --dummy      start a private jackd on the dummy driver with\n"
+		 "                    this period ($JACKD names the binary)\n"
+		 "   -N, --server     server name\n"
+		 "   -j, --json       one JSON object per run, for tracking over time\n"
+		 "   -v, --verbose    wakeup latency of every client\n",
+		 JACK_CYCLE_TRACE_MAX_CLIENTS - 1);
+}
+
+int
+main (int argc, char *argv[])
+{
+	struct option long_options[] = {
+		{ "clients", 1, 0, 'n' },
+		{ "dummy", 1, 0, 'd' },
+		{ "help", 0, 0, 'h' },
+		{ "json", 0, 0, 'j' },
+		{ "load", 1, 0, 'l' },
+		{ "server", 1, 0, 'N' },
+		{ "seconds", 1, 0, 's' },
+		{ "sweep", 0, 0, 'S' },
+		{ "topology", 1, 0, 't' },
+		{ "verbose", 0, 0, 'v' },
+		{ 0, 0, 0, 0 }
+	};
+	const jack_cycle_trace_t *trace;
+	jack_client_t *ctl = NULL;
+	jack_status_t status;
+	char private_name[64];
+	unsigned int n, threshold = 0, tries;
+	int opt, xrun_seen, rc = 0;
+
+	while ((opt = getopt_long (argc, argv, "d:hjl:n:N:s:St:v", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'd':
+			dummy_period = atoi (optarg);
+			break;
+		case 'j':
+			json = 1;
+			break;
+		case 'l':
+			load_usecs = atoi (optarg);
+			break;
+		case 'n':
+			nclients = atoi (optarg);
+			break;
+		case 'N':
+			server_name = optarg;
+			break;
+		case 's':
+			seconds = atof (optarg);
+			break;
+		case 'S':
+			sweep = 1;
+			break;
+		case 't':
+			for (n = 0; n < sizeof(topology_names) / sizeof(topology_names[0]); n++)
+				if (strcmp (optarg, topology_names[n]) == 0) {
+					break;
+				}
+			if (n == sizeof(topology_names) / sizeof(topology_names[0])) {
+				usage (stderr);
+				return 1;
+			}
+			topology = (bench_topology_t)n;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'h':
+			usage (stdout);
+			return 0;
+		default:
+			usage (stderr);
+			return 1;
+		}
+	}
+
+	/* the measuring client is not in the trace, but leave it room */
+	if (nclients == 0 || nclients >= JACK_CYCLE_TRACE_MAX_CLIENTS) {
+		usage (stderr);
+		return 1;
+	}
+
+	if (dummy_period) {
+		if (server_name == NULL) {
+			snprintf (private_name, sizeof(private_name),
+				  "gbench-%d", (int)getpid ());
+			server_name = private_name;
+		}
+		if (bench_start_server ()) {
+			return 1;
+		}
+	}
+
+	/* a server we started may take a moment to come up */
+	for (tries = 0; tries < 50; tries++) {
+		ctl = jack_client_open ("gbench-ctl", JackNoStartServer
+					| (server_name ? JackServerName : 0),
+					&status, server_name);
+		if (ctl || !dummy_period) {
+			break;
+		}
+		usleep (100000);
+	}
+
+	if (ctl == NULL) {
+		fprintf (stderr, "jack_graph_bench: cannot connect to the server\n");
+		bench_stop_server ();
+		return 1;
+	}
+
+	if ((trace = jack_cycle_trace_attach (ctl)) == NULL) {
+		fprintf (stderr, "jack_graph_bench: the server does not keep a "
+			 "cycle trace; start it with --cycle-trace\n");
+		jack_client_close (ctl);
+		bench_stop_server ();
+		return 1;
+	}
+
+	if (!json) {
+		printf ("%-8s %4s %7s %5s %5s %9s %9s %9s %8s %8s %8s\n",
+			"topology", "N", "cycles", "xrun", "over",
+			"cyc-mean", "cyc-p99", "cyc-max",
+			"wak-mean", "wak-p99", "wak-max");
+	}
+
+	for (n = sweep ? 1 : nclients; n <= nclients; n = (n < nclients && n * 2 > nclients) ? nclients : n * 2) {
+		if (bench_run (ctl, trace, n, &xrun_seen)) {
+			rc = 1;
+			break;
+		}
+		if (xrun_seen && threshold == 0) {
+			threshold = n;
+		}
+		if (!sweep) {
+			break;
+		}
+	}
+
+	if (sweep && !json) {
+		if (threshold) {
+			printf ("xrun threshold: %u clients\n", threshold);
+		} else {
+			printf ("xrun threshold: not reached with %u clients\n", nclients);
+		}
+	} else if (sweep) {
+		printf ("{\"topology\":\"%s\",\"xrun_threshold\":%u}\n",
+			topology_names[topology], threshold);
+	}
+
+	jack_client_close (ctl);
+	bench_stop_server ();
+
+	return rc;
+}
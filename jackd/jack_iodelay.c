@@ -0,0 +1,329 @@
+/* -*- mode: c; c-file-style: "linux"; -*- */
+/*
+    Round trip latency measurement: plays a test pulse on one port,
+    finds it again on another and compares the delay with the latency
+    the graph reports for the same path.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ */
+
+/* Every half second, the output port plays a short Hann windowed
+ * chirp, and is silent otherwise.  The process callback records the
+ * input over the same half second, sample for sample with the output,
+ * so that the position of the pulse in what it recorded is the round
+ * trip delay.  The main thread cross-correlates the recording with
+ * the pulse and refines the peak to a fraction of a sample with a
+ * parabola through its neighbours.
+ *
+ * The JACK latency model says the delay from writing a sample to an
+ * output port to reading it back on an input port is the playback
+ * latency downstream of the one plus the capture latency upstream of
+ * the other, so that is what the measurement is compared with.  The
+ * difference is latency the backend does not know about: converters,
+ * or a wrong -I/-O.  It is printed split in half, the way those
+ * options are usually set; the backend has to be restarted with them
+ * for it to take effect.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <jack/jack.h>
+
+#define IODELAY_PULSE_LEN 256
+
+static jack_client_t *client;
+static jack_port_t *in_port;
+static jack_port_t *out_port;
+
+static float pulse[IODELAY_PULSE_LEN];
+static float pulse_q[IODELAY_PULSE_LEN];        /* in quadrature */
+static float pulse_energy;
+
+/* the recording is double buffered: the process thread fills
+   rec[fill] and hands it over by setting ready */
+static jack_nframes_t interval;
+static float *rec[2];
+static int fill;
+static volatile int ready;
+static jack_nframes_t phase;            /* within the interval */
+static int primed;                      /* rec[fill] starts at phase 0 */
+
+static volatile int quit;
+
+static void
+iodelay_make_pulse (void)
+{
+	double t, w, a;
+	int i;
+
+	/* a chirp from a tenth of the sample rate to nearly half of it
+	   correlates to a narrow peak */
+	pulse_energy = 0.0f;
+	for (i = 0; i < IODELAY_PULSE_LEN; i++) {
+		t = (double)i / IODELAY_PULSE_LEN;
+		w = 0.5 - 0.5 * cos (2.0 * M_PI * t);
+		a = M_PI * IODELAY_PULSE_LEN * (0.1 * t + 0.35 * t * t);
+		pulse[i] = (float)(0.5 * w * sin (a));
+		pulse_q[i] = (float)(0.5 * w * cos (a));
+		pulse_energy += pulse[i] * pulse[i];
+	}
+}
+
+static int
+iodelay_process (jack_nframes_t nframes, void *arg)
+{
+	const float *in = (const float*)jack_port_get_buffer (in_port, nframes);
+	float *out = (float*)jack_port_get_buffer (out_port, nframes);
+	jack_nframes_t i;
+
+	for (i = 0; i < nframes; i++) {
+		out[i] = phase < IODELAY_PULSE_LEN ? pulse[phase] : 0.0f;
+
+		if (phase == 0) {
+			primed = 1;
+		}
+		if (primed) {
+			rec[fill][phase] = in[i];
+		}
+
+		if (++phase == interval) {
+			phase = 0;
+			if (primed && !ready) {
+				fill ^= 1;
+				__sync_synchronize ();
+				ready = 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* The position of the pulse in buf, to a fraction of a sample, or -1
+ * if nothing there looks like it.  The correlation itself rings at
+ * the frequencies of the chirp, so the peak is looked for in its
+ * envelope, from the correlation with the pulse and with the pulse in
+ * quadrature; that is smooth enough near the top for a parabola.
+ */
+static double
+iodelay_find (const float *buf)
+{
+	jack_nframes_t lag, best = 0;
+	double c, q, y0, y1, y2, d, peak = 0.0, *corr;
+	int k;
+
+	if ((corr = (double*)malloc (interval * sizeof(double))) == NULL) {
+		return -1.0;
+	}
+
+	for (lag = 0; lag < interval; lag++) {
+		c = q = 0.0;
+		for (k = 0; k < IODELAY_PULSE_LEN; k++) {
+			c += buf[(lag + k) % interval] * pulse[k];
+			q += buf[(lag + k) % interval] * pulse_q[k];
+		}
+		corr[lag] = sqrt (c * c + q * q);
+		if (corr[lag] > peak) {
+			peak = corr[lag];
+			best = lag;
+		}
+	}
+
+	/* a tenth of the pulse's amplitude, -20 dB */
+	if (peak < 0.1 * pulse_energy) {
+		free (corr);
+		return -1.0;
+	}
+
+	y0 = corr[(best + interval - 1) % interval];
+	y1 = corr[best];
+	y2 = corr[(best + 1) % interval];
+	d = y0 - 2.0 * y1 + y2;
+	free (corr);
+
+	return best + (d != 0.0 ? 0.5 * (y0 - y2) / d : 0.0);
+}
+
+/* What the graph says the path from out_port to in_port takes. */
+static jack_nframes_t
+iodelay_reported (void)
+{
+	jack_latency_range_t playback, capture;
+
+	jack_port_get_latency_range (out_port, JackPlaybackLatency, &playback);
+	jack_port_get_latency_range (in_port, JackCaptureLatency, &capture);
+
+	return playback.max + capture.max;
+}
+
+static void
+iodelay_signal (int sig)
+{
+	quit = 1;
+}
+
+static void
+usage (FILE *file)
+{
+	fprintf (file,
+		 "usage: jack_iodelay [ -p port ] [ -c port ] [ -n count ] [ -N server ]\n"
+		 "   -p, --playback  connect the output to this port\n"
+		 "   -c, --capture   connect this port to the input\n"
+		 "   -n, --count     stop after this many measurements\n"
+		 "   -N, --server    server name\n");
+}
+
+int
+main (int argc, char *argv[])
+{
+	struct option long_options[] = {
+		{ "capture", 1, 0, 'c' },
+		{ "count", 1, 0, 'n' },
+		{ "help", 0, 0, 'h' },
+		{ "playback", 1, 0, 'p' },
+		{ "server", 1, 0, 'N' },
+		{ 0, 0, 0, 0 }
+	};
+	const char *server_name = NULL;
+	const char *playback = NULL;
+	const char *capture = NULL;
+	jack_status_t status;
+	jack_nframes_t rate, reported;
+	int count = 0, done = 0, quiet = 0;
+	double delay, extra;
+	int opt;
+
+	while ((opt = getopt_long (argc, argv, "c:hn:N:p:", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'c':
+			capture = optarg;
+			break;
+		case 'n':
+			count = atoi (optarg);
+			break;
+		case 'N':
+			server_name = optarg;
+			break;
+		case 'p':
+			playback = optarg;
+			break;
+		case 'h':
+			usage (stdout);
+			return 0;
+		default:
+			usage (stderr);
+			return 1;
+		}
+	}
+
+	client = jack_client_open ("jack_iodelay", JackNoStartServer
+				   | (server_name ? JackServerName : 0),
+				   &status, server_name);
+	if (client == NULL) {
+		fprintf (stderr, "jack_iodelay: cannot connect to the server\n");
+		return 1;
+	}
+
+	rate = jack_get_sample_rate (client);
+	interval = rate / 2;
+	if (interval < 2 * IODELAY_PULSE_LEN) {
+		interval = 2 * IODELAY_PULSE_LEN;
+	}
+
+	rec[0] = (float*)calloc (interval, sizeof(float));
+	rec[1] = (float*)calloc (interval, sizeof(float));
+	if (rec[0] == NULL || rec[1] == NULL) {
+		fprintf (stderr, "jack_iodelay: out of memory\n");
+		jack_client_close (client);
+		return 1;
+	}
+
+	iodelay_make_pulse ();
+
+	in_port = jack_port_register (client, "in", JACK_DEFAULT_AUDIO_TYPE,
+				      JackPortIsInput, 0);
+	out_port = jack_port_register (client, "out", JACK_DEFAULT_AUDIO_TYPE,
+				       JackPortIsOutput, 0);
+	if (in_port == NULL || out_port == NULL) {
+		fprintf (stderr, "jack_iodelay: cannot register ports\n");
+		jack_client_close (client);
+		return 1;
+	}
+
+	jack_set_process_callback (client, iodelay_process, NULL);
+
+	if (jack_activate (client)) {
+		fprintf (stderr, "jack_iodelay: cannot activate\n");
+		jack_client_close (client);
+		return 1;
+	}
+
+	if (playback && jack_connect (client, jack_port_name (out_port), playback)) {
+		fprintf (stderr, "jack_iodelay: cannot connect to %s\n", playback);
+	}
+	if (capture && jack_connect (client, capture, jack_port_name (in_port))) {
+		fprintf (stderr, "jack_iodelay: cannot connect from %s\n", capture);
+	}
+
+	signal (SIGINT, iodelay_signal);
+	signal (SIGTERM, iodelay_signal);
+
+	while (!quit && (count == 0 || done < count)) {
+
+		if (!ready) {
+			usleep (50000);
+			continue;
+		}
+
+		__sync_synchronize ();
+		delay = iodelay_find (rec[fill ^ 1]);
+		ready = 0;
+
+		if (delay < 0.0) {
+			/* one message a second */
+			if (quiet++ & 1) {
+				printf ("Signal below threshold...\n");
+			}
+			continue;
+		}
+		quiet = 0;
+
+		reported = iodelay_reported ();
+		extra = delay - reported;
+
+		printf ("%10.3f frames %10.3f ms total roundtrip latency\n"
+			"\treported %u frames, extra %.3f frames %.3f ms"
+			" (%.1f each for -I and -O)\n",
+			delay, delay * 1000.0 / rate,
+			reported, extra, extra * 1000.0 / rate, extra / 2.0);
+		fflush (stdout);
+		done++;
+	}
+
+	jack_client_close (client);
+	free (rec[0]);
+	free (rec[1]);
+
+	return 0;
+}
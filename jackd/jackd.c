@@ -39,11 +39,13 @@
 
 #include "engine.h"
 #include "internal.h"
+#include "cpufeatures.h"
 #include "driver.h"
 #include "shm.h"
 #include "driver_parse.h"
 #include "messagebuffer.h"
 #include "clientengine.h"
+#include "drivercache.h"
 
 #ifdef USE_CAPABILITIES
 
@@ -72,6 +74,21 @@ static int do_unlock = 0;
 static jack_nframes_t frame_time_offset = 0;
 static int nozombies = 0;
 static int timeout_count_threshold = 0;
+static int standby = 0;
+static char *backup_driver = NULL;
+static jack_driver_desc_t *backup_desc;
+static JSList *backup_params;
+
+/* of --clock-domain, in the same order */
+static JSList *domain_drivers;
+static JSList *domain_descs;
+static JSList *domain_params;
+
+/* what the standby thread starts, see --standby */
+static jack_driver_desc_t *standby_desc;
+static JSList *standby_params;
+static JSList *standby_slaves;
+static JSList *standby_loads;
 
 extern int sanitycheck(int, int);
 
@@ -237,6 +254,88 @@ jack_load_internal_clients (JSList* load_list)
 	}
 }
 
+static int
+jack_start_drivers (jack_driver_desc_t * driver_desc, JSList * driver_params, JSList * slave_names, JSList * load_list)
+{
+	JSList * node, * pnode;
+
+	jack_info ("loading driver ..");
+
+	if (jack_engine_load_driver (engine, driver_desc, driver_params)) {
+		jack_error ("cannot load driver module %s",
+			    driver_desc->name);
+		return -1;
+	}
+
+	for (node = slave_names; node; node = jack_slist_next (node)) {
+		char *sl_name = node->data;
+		jack_driver_desc_t *sl_desc = jack_find_driver_descriptor (sl_name);
+		if (sl_desc) {
+			jack_engine_load_slave_driver (engine, sl_desc, NULL);
+		}
+	}
+
+
+	if (jack_drivers_start (engine) != 0) {
+		jack_error ("cannot start driver");
+		return -1;
+	}
+
+	if (backup_desc
+	    && jack_engine_load_backup_driver (engine, backup_desc, backup_params)) {
+		jack_error ("cannot load backup driver %s, running without",
+			    backup_desc->name);
+	}
+
+	for (node = domain_descs, pnode = domain_params; node;
+	     node = jack_slist_next (node), pnode = jack_slist_next (pnode)) {
+		jack_driver_desc_t *ddesc = (jack_driver_desc_t*)node->data;
+		if (jack_engine_load_clock_domain (engine, ddesc, pnode->data)) {
+			jack_error ("cannot load clock domain %s, running"
+				    " without", ddesc->name);
+		}
+	}
+
+	jack_load_internal_clients (load_list);
+
+	return 0;
+}
+
+static void *
+jack_standby_thread (void *arg)
+{
+	/* a client can arrive before jack_engine_new() has returned */
+	engine = (jack_engine_t*)arg;
+
+	if (jack_start_drivers (standby_desc, standby_params,
+				standby_slaves, standby_loads)) {
+		/* the main thread takes it from here */
+		kill (getpid (), SIGTERM);
+	}
+	jack_engine_standby_done (engine);
+	return NULL;
+}
+
+/* Called by the server thread when the first client connects: the
+ * driver opens its device in a thread of its own, while the server
+ * thread sets the client up.
+ */
+static void
+jack_standby_start (jack_engine_t *e)
+{
+	pthread_t thread;
+	int rc;
+
+	if ((rc = pthread_create (&thread, NULL, jack_standby_thread, e))) {
+		jack_error ("cannot create thread to start the driver (%s)",
+			    strerror (rc));
+		kill (getpid (), SIGTERM);
+		jack_engine_standby_done (e);
+		return;
+	}
+	pthread_detach (thread);
+}
+
 static int
 jack_main (jack_driver_desc_t * driver_desc, JSList * driver_params, JSList * slave_names, JSList * load_list)
 {
@@ -245,7 +344,6 @@ jack_main (jack_driver_desc_t * driver_desc, JSList * driver_params, JSList * sl
 	sigset_t allsignals;
 	struct sigaction action;
 	int waiting;
-	JSList * node;
 
 	/* ensure that we are in our own process group so that
 	   kill (SIG, -pgrp) does the right thing.
@@ -302,6 +400,14 @@ jack_main (jack_driver_desc_t * driver_desc, JSList * driver_params, JSList * sl
 	}
 	/* get the engine/driver started */
 
+	if (standby) {
+		standby_desc = driver_desc;
+		standby_params = driver_params;
+		standby_slaves = slave_names;
+		standby_loads = load_list;
+		standby_start = jack_standby_start;
+	}
+
 	if ((engine = jack_engine_new (realtime, realtime_priority,
 				       do_mlock, do_unlock, server_name,
 				       temporary, verbose, client_timeout,
@@ -311,30 +417,22 @@ jack_main (jack_driver_desc_t * driver_desc, JSList * driver_params, JSList * sl
 		return -1;
 	}
 
-	jack_info ("loading driver ..");
-
-	if (jack_engine_load_driver (engine, driver_desc, driver_params)) {
-		jack_error ("cannot load driver module %s",
-			    driver_desc->name);
-		goto error;
-	}
-
-	for (node = slave_names; node; node = jack_slist_next (node)) {
-		char *sl_name = node->data;
-		jack_driver_desc_t *sl_desc = jack_find_driver_descriptor (sl_name);
-		if (sl_desc) {
-			jack_engine_load_slave_driver (engine, sl_desc, NULL);
-		}
+	if (verbose) {
+		static const char *modes[] = {
+			"left alone", "FTZ", "DAZ", "FTZ and DAZ"
+		};
+		jack_info ("CPU features: %s; denormals: %s",
+			   jack_cpu_features_name (),
+			   modes[jack_get_denormal_policy () & 3]);
 	}
 
-
-	if (jack_drivers_start (engine) != 0) {
-		jack_error ("cannot start driver");
+	if (standby) {
+		jack_info ("standing by for the first client");
+	} else if (jack_start_drivers (driver_desc, driver_params,
+				       slave_names, load_list)) {
 		goto error;
 	}
 
-	jack_load_internal_clients (load_list);
-
 	/* install a do-nothing handler because otherwise pthreads
 	   behaviour is undefined when we enter sigwait.
 	 */
@@ -384,6 +482,9 @@ jack_main (jack_driver_desc_t * driver_desc, JSList * driver_params, JSList * sl
 		sigprocmask (SIG_UNBLOCK, &signals, 0);
 	}
 
+	/* let a driver that is still starting finish first */
+	jack_engine_standby_wait (engine);
+
 	jack_engine_delete (engine);
 	return 1;
 
@@ -393,30 +494,16 @@ error:
 }
 
 static jack_driver_desc_t *
-jack_drivers_get_descriptor (JSList * drivers, const char * sofile)
+jack_drivers_open_descriptor (const char * filename)
 {
-	jack_driver_desc_t * descriptor, * other_descriptor;
+	jack_driver_desc_t * descriptor;
 	JackDriverDescFunction so_get_descriptor;
-	JSList * node;
 	void * dlhandle;
-	char * filename;
 	const char * dlerr;
 	int err;
-	char* driver_dir;
-
-	if ((driver_dir = getenv ("JACK_DRIVER_DIR")) == 0) {
-		driver_dir = ADDON_DIR;
-	}
-	filename = malloc (strlen (driver_dir) + 1 + strlen (sofile) + 1);
-	sprintf (filename, "%s/%s", driver_dir, sofile);
-
-	if (verbose) {
-		jack_info ("getting driver descriptor from %s", filename);
-	}
 
 	if ((dlhandle = dlopen (filename, RTLD_NOW | RTLD_GLOBAL)) == NULL) {
 		jack_error ("could not open driver .so '%s': %s\n", filename, dlerror ());
-		free (filename);
 		return NULL;
 	}
 
@@ -426,14 +513,12 @@ jack_drivers_get_descriptor (JSList * drivers, const char * sofile)
 	if ((dlerr = dlerror ()) != NULL) {
 		jack_error ("%s", dlerr);
 		dlclose (dlhandle);
-		free (filename);
 		return NULL;
 	}
 
 	if ((descriptor = so_get_descriptor ()) == NULL) {
 		jack_error ("driver from '%s' returned NULL descriptor\n", filename);
 		dlclose (dlhandle);
-		free (filename);
 		return NULL;
 	}
 
@@ -441,6 +526,35 @@ jack_drivers_get_descriptor (JSList * drivers, const char * sofile)
 		jack_error ("error closing driver .so '%s': %s\n", filename, dlerror ());
 	}
 
+	return descriptor;
+}
+
+static jack_driver_desc_t *
+jack_drivers_get_descriptor (JSList * drivers, jack_driver_cache_t * cache, const char * sofile)
+{
+	jack_driver_desc_t * descriptor, * other_descriptor;
+	JSList * node;
+	char * filename;
+	char* driver_dir;
+
+	if ((driver_dir = getenv ("JACK_DRIVER_DIR")) == 0) {
+		driver_dir = ADDON_DIR;
+	}
+	filename = malloc (strlen (driver_dir) + 1 + strlen (sofile) + 1);
+	sprintf (filename, "%s/%s", driver_dir, sofile);
+
+	if (verbose) {
+		jack_info ("getting driver descriptor from %s", filename);
+	}
+
+	if ((descriptor = jack_driver_cache_get (cache, filename)) == NULL) {
+		if ((descriptor = jack_drivers_open_descriptor (filename)) == NULL) {
+			free (filename);
+			return NULL;
+		}
+		jack_driver_cache_put (cache, filename, descriptor);
+	}
+
 	/* check it doesn't exist already */
 	for (node = drivers; node; node = jack_slist_next (node)) {
 		other_descriptor = (jack_driver_desc_t*)node->data;
@@ -469,6 +583,7 @@ jack_drivers_load ()
 	int err;
 	JSList * driver_list = NULL;
 	jack_driver_desc_t * desc;
+	jack_driver_cache_t * cache;
 	char* driver_dir;
 
 	if ((driver_dir = getenv ("JACK_DRIVER_DIR")) == 0) {
@@ -484,6 +599,8 @@ jack_drivers_load ()
 		return NULL;
 	}
 
+	cache = jack_driver_cache_open ();
+
 	while ( (dir_entry = readdir (dir_stream)) ) {
 		/* check the filename is of the right format */
 		if (strncmp ("jack_", dir_entry->d_name, 5) != 0) {
@@ -499,12 +616,14 @@ jack_drivers_load ()
 			continue;
 		}
 
-		desc = jack_drivers_get_descriptor (drivers, dir_entry->d_name);
+		desc = jack_drivers_get_descriptor (drivers, cache, dir_entry->d_name);
 		if (desc) {
 			driver_list = jack_slist_append (driver_list, desc);
 		}
 	}
 
+	jack_driver_cache_close (cache);
+
 	err = closedir (dir_stream);
 	if (err) {
 		jack_error ("error closing driver directory %s: %s\n",
@@ -535,9 +654,9 @@ static void usage (FILE *file)
 		 "usage: jackd [ server options ] -d backend [ ... backend options ... ]\n"
 		 "             (see the manual page for jackd for a complete list of options)\n\n"
 #ifdef __APPLE__
-		 "             Available backends may include: coreaudio, dummy, net, portaudio.\n\n"
+		 "             Available backends may include: coreaudio, dummy, file, net, portaudio, replay.\n\n"
 #else
-		 "             Available backends may include: alsa, dummy, freebob, firewire, net, oss, sun, or portaudio.\n\n"
+		 "             Available backends may include: alsa, dummy, file, freebob, firewire, net, oss, sun, portaudio, or replay.\n\n"
 #endif
 		 "       jackd -d backend --help\n"
 		 "             to display options for each backend\n\n");
@@ -562,6 +681,34 @@ jack_find_driver_descriptor (const char * name)
 	return desc;
 }
 
+/* "name [ backend options ]", split at spaces, as --backup-driver and
+   --clock-domain take it */
+static void
+jack_parse_driver_spec (char *spec, const char *what,
+			jack_driver_desc_t **desc, JSList **params)
+{
+	char **args = NULL;
+	int nargs = 0;
+	char *arg;
+
+	for (arg = strtok (spec, " \t"); arg; arg = strtok (NULL, " \t")) {
+		args = realloc (args, sizeof(char *) * (nargs + 1));
+		args[nargs++] = arg;
+	}
+
+	if (nargs == 0
+	    || (*desc = jack_find_driver_descriptor (args[0])) == NULL) {
+		fprintf (stderr, "jackd: unknown %s '%s'\n", what,
+			 nargs ? args[0] : "");
+		exit (1);
+	}
+
+	if (jack_parse_driver_params (*desc, nargs, args, params)) {
+		exit (0);
+	}
+	free (args);
+}
+
 static void
 jack_cleanup_files (const char *server_name)
 {
@@ -602,6 +749,14 @@ jack_cleanup_files (const char *server_name)
 			continue;
 		}
 
+		/* sockets handed to us by a service manager stay
+		 * bound for it to start the next server on */
+		if (jack_socket_activated ()
+		    && ((strcmp (dirent->d_name, "jack_0") == 0)
+			|| (strcmp (dirent->d_name, "jack_ack_0") == 0))) {
+			continue;
+		}
+
 		snprintf (fullpath, sizeof(fullpath), "%s/%s",
 			  dir_name, dirent->d_name);
 
@@ -613,6 +768,10 @@ jack_cleanup_files (const char *server_name)
 
 	closedir (dir);
 
+	if (jack_socket_activated ()) {
+		return;
+	}
+
 	/* now, delete the per-server subdirectory, itself */
 	if (rmdir (dir_name)) {
 		jack_error ("cannot remove `%s' (%s)", dir_name,
@@ -676,9 +835,9 @@ main (int argc, char *argv[])
 	int show_version = 0;
 
 #ifdef HAVE_ZITA_BRIDGE_DEPS
-	const char *options = "A:d:P:uvshVrRZTFlI:t:mM:n:Np:c:X:C:";
+	const char *options = "A:a:b:B:d:Ee:gP:uvshVrRZTFlL:I:j:k:Kt:mM:n:NO:p:c:w:WX:Y:D:y:o:H:J:Q:xG:U:zq:C:fi:";
 #else
-	const char *options = "d:P:uvshVrRZTFlI:t:mM:n:Np:c:X:C:";
+	const char *options = "a:b:B:d:Ee:gP:uvshVrRZTFlL:I:j:k:Kt:mM:n:NO:p:c:w:WX:Y:D:y:o:H:J:Q:xG:U:zq:C:fi:";
 #endif
 	struct option long_options[] =
 	{
@@ -687,28 +846,54 @@ main (int argc, char *argv[])
 #ifdef HAVE_ZITA_BRIDGE_DEPS
 		{ "alsa-add",	       1, 0,		     'A' },
 #endif
+		{ "rt-cpus",	       1, 0,		     'a' },
+		{ "max-buffer-size",   1, 0,		     'b' },
+		{ "dll-bandwidth",     1, 0,		     'B' },
 		{ "clock-source",      1, 0,		     'c' },
+		{ "cycle-trace",       1, 0,		     'y' },
 		{ "driver",	       1, 0,		     'd' },
+		{ "xrun-dump",	       1, 0,		     'J' },
+		{ "deadline",	       0, 0,		     'E' },
+		{ "perf-counters",     0, 0,		     'x' },
+		{ "server-cpus",       1, 0,		     'e' },
+		{ "group-buffers",     0, 0,		     'g' },
+		{ "admission",	       1, 0,		     'G' },
 		{ "help",	       0, 0,		     'h' },
 		{ "tmpdir-location",   0, 0,		     'l' },
+		{ "late-mute",	       1, 0,		     'L' },
 		{ "internal-client",   0, 0,		     'I' },
+		{ "parallel",	       1, 0,		     'j' },
+		{ "client-cpus",       1, 0,		     'k' },
+		{ "skip-dead",	       0, 0,		     'K' },
 		{ "no-mlock",	       0, 0,		     'm' },
+		{ "selective-mlock",   0, 0,		     'f' },
+		{ "metrics",	       1, 0,		     'H' },
 		{ "midi-bufsize",      1, 0,		     'M' },
 		{ "name",	       1, 0,		     'n' },
 		{ "no-sanity-checks",  0, 0,		     'N' },
+		{ "numa",	       1, 0,		     'O' },
+		{ "port-meters",       1, 0,		     'o' },
 		{ "port-max",	       1, 0,		     'p' },
 		{ "realtime-priority", 1, 0,		     'P' },
 		{ "no-realtime",       0, 0,		     'r' },
 		{ "realtime",	       0, 0,		     'R' },
+		{ "record",	       1, 0,		     'Q' },
 		{ "replace-registry",  0, &replace_registry, 0	 },
 		{ "silent",	       0, 0,		     's' },
 		{ "sync",	       0, 0,		     'S' },
 		{ "timeout",	       1, 0,		     't' },
 		{ "temporary",	       0, 0,		     'T' },
+		{ "buffer-governor",   1, 0,		     'U' },
+		{ "idle",	       0, 0,		     'z' },
+		{ "async-history",     1, 0,		     'q' },
 		{ "unlock",	       0, 0,		     'u' },
 		{ "version",	       0, 0,		     'V' },
 		{ "verbose",	       0, 0,		     'v' },
+		{ "wakeup",	       1, 0,		     'w' },
+		{ "standby",	       0, 0,		     'W' },
 		{ "slave-driver",      1, 0,		     'X' },
+		{ "backup-driver",     1, 0,		     'Y' },
+		{ "clock-domain",      1, 0,		     'i' },
 		{ "nozombies",	       0, 0,		     'Z' },
 		{ "timeout-thres",     2, 0,		     'C' },
 		{ 0,		       0, 0,		     0	 }
@@ -721,6 +906,7 @@ main (int argc, char *argv[])
 	JSList * driver_params;
 	JSList * slave_drivers = NULL;
 	JSList * load_list = NULL;
+	JSList * node;
 	size_t midi_buffer_size = 0;
 	int driver_nargs = 1;
 	int i;
@@ -779,12 +965,11 @@ main (int argc, char *argv[])
 			if (tolower (optarg[0]) == 'h') {
 				clock_source = JACK_TIMER_HPET;
 			} else if (tolower (optarg[0]) == 'c') {
-				/* For backwards compatibility with scripts,
-				 * allow the user to request the cycle clock
-				 * on the command line, but use the system
-				 * clock instead
+				/* the calibrated cycle counter; the server
+				 * falls back to the system clock where it
+				 * is not invariant
 				 */
-				clock_source = JACK_TIMER_SYSTEM_CLOCK;
+				clock_source = JACK_TIMER_CYCLE_COUNTER;
 			} else if (tolower (optarg[0]) == 's') {
 				clock_source = JACK_TIMER_SYSTEM_CLOCK;
 			} else {
@@ -793,6 +978,20 @@ main (int argc, char *argv[])
 			}
 			break;
 
+		case 'b':
+			max_buffer_size = (jack_nframes_t)atol (optarg);
+			break;
+
+		case 'B':
+			dll_bandwidth = strtod (optarg, NULL);
+			if (!(dll_bandwidth > 0.0f)) {
+				fprintf (stderr, "jackd: DLL bandwidth must be "
+					 "a positive number of Hz\n");
+				usage (stderr);
+				return -1;
+			}
+			break;
+
 		case 'C':
 			if (optarg) {
 				timeout_count_threshold = atoi (optarg);
@@ -801,11 +1000,35 @@ main (int argc, char *argv[])
 			}
 			break;
 
+		case 'a':
+			rt_cpus = optarg;
+			break;
+
 		case 'd':
 			seen_driver = optind + 1;
 			driver_name = optarg;
 			break;
 
+		case 'E':
+			use_deadline = 1;
+			break;
+
+		case 'x':
+			use_perf_counters = 1;
+			break;
+
+		case 'e':
+			server_cpus = optarg;
+			break;
+
+		case 'g':
+			group_port_buffers = 1;
+			break;
+
+		case 'G':
+			admission_percent = (unsigned int)atol (optarg);
+			break;
+
 		case 'D':
 			frame_time_offset = JACK_MAX_FRAMES - atoi (optarg);
 			break;
@@ -820,8 +1043,34 @@ main (int argc, char *argv[])
 			load_list = jack_slist_append (load_list, optarg);
 			break;
 
+		case 'j':
+			dag_threads = (unsigned int)atol (optarg);
+			break;
+
+		case 'k':
+			client_cpus = optarg;
+			break;
+
+		case 'K':
+			skip_dead_clients = 1;
+			break;
+
+		case 'L':
+			late_mute_percent = (unsigned int)atol (optarg);
+			if (late_mute_percent >= 100) {
+				fprintf (stderr, "jackd: late mute point must be "
+					 "a percentage of the period below 100\n");
+				usage (stderr);
+				return -1;
+			}
+			break;
+
 		case 'm':
-			do_mlock = 0;
+			do_mlock = JACK_MLOCK_NONE;
+			break;
+
+		case 'f':
+			do_mlock = JACK_MLOCK_SELECTIVE;
 			break;
 
 		case 'M':
@@ -836,6 +1085,10 @@ main (int argc, char *argv[])
 			do_sanity_checks = 0;
 			break;
 
+		case 'O':
+			numa_policy = optarg;
+			break;
+
 		case 'p':
 			port_max = (unsigned int)atol (optarg);
 			break;
@@ -877,13 +1130,68 @@ main (int argc, char *argv[])
 			verbose = 1;
 			break;
 
+		case 'w':
+			if (strcmp (optarg, "futex") == 0) {
+				wakeup_method = JACK_WAKEUP_FUTEX;
+			} else if (strcmp (optarg, "fifo") == 0) {
+				wakeup_method = JACK_WAKEUP_FIFO;
+			} else {
+				usage (stderr);
+				return -1;
+			}
+			break;
+
+		case 'W':
+			standby = 1;
+			break;
+
 		case 'V':
 			show_version = 1;
 			break;
 
+		case 'y':
+			cycle_trace_records = atoi (optarg);
+			break;
+
+		case 'o':
+			port_meter_msecs = atoi (optarg);
+			break;
+
+		case 'H':
+			metrics_address = optarg;
+			break;
+
+		case 'J':
+			xrun_dump_dir = optarg;
+			break;
+
+		case 'Q':
+			record_path = optarg;
+			break;
+
+		case 'U':
+			buffer_governor = optarg;
+			break;
+
+		case 'z':
+			idle_cycles = 1;
+			break;
+
+		case 'q':
+			async_history = (unsigned int)atol (optarg);
+			break;
+
 		case 'X':
 			slave_drivers = jack_slist_append (slave_drivers, optarg);
 			break;
+
+		case 'i':
+			domain_drivers = jack_slist_append (domain_drivers, optarg);
+			break;
+
+		case 'Y':
+			backup_driver = optarg;
+			break;
 		case 'Z':
 			nozombies = 1;
 			break;
@@ -983,6 +1291,21 @@ main (int argc, char *argv[])
 		exit (0);
 	}
 
+	if (backup_driver) {
+		jack_parse_driver_spec (backup_driver, "backup driver",
+					&backup_desc, &backup_params);
+	}
+
+	for (node = domain_drivers; node; node = jack_slist_next (node)) {
+		jack_driver_desc_t *ddesc;
+		JSList *dparams = NULL;
+
+		jack_parse_driver_spec (node->data, "clock domain driver",
+					&ddesc, &dparams);
+		domain_descs = jack_slist_append (domain_descs, ddesc);
+		domain_params = jack_slist_append (domain_params, dparams);
+	}
+
 	if (server_name == NULL) {
 		server_name = jack_default_server_name ();
 	}
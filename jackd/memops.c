@@ -0,0 +1,1622 @@
+/*
+    Copyright (C) 2000 Paul Davis
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ */
+
+#define _ISOC9X_SOURCE  1
+#define _ISOC99_SOURCE  1
+
+#define __USE_ISOC9X    1
+#define __USE_ISOC99    1
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+
+#if defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) || defined(__DragonFly__)
+#include <sys/endian.h>
+#define __BYTE_ORDER    _BYTE_ORDER
+#define __LITTLE_ENDIAN _LITTLE_ENDIAN
+#define __BIG_ENDIAN    _BIG_ENDIAN
+#elif defined(__sun__) || defined(sun)
+#include <sys/isa_defs.h>
+#define __LITTLE_ENDIAN 1234
+#define __BIG_ENDIAN    4321
+#ifdef _BIG_ENDIAN
+#define __BYTE_ORDER    __BIG_ENDIAN
+#else
+#define __BYTE_ORDER    __LITTLE_ENDIAN
+#endif
+#elif defined(__APPLE__)
+#include <machine/endian.h>
+#define __BYTE_ORDER    BYTE_ORDER
+#define __LITTLE_ENDIAN LITTLE_ENDIAN
+#define __BIG_ENDIAN    BIG_ENDIAN
+#else
+#include <endian.h>
+#include <byteswap.h>
+#endif
+
+#ifndef bswap_16
+#define bswap_16(x)     __builtin_bswap16 (x)
+#define bswap_32(x)     __builtin_bswap32 (x)
+#endif
+
+#include "memops.h"
+#include "cpufeatures.h"
+
+/* Notes about these *_SCALING values.
+
+   the MAX_<N>BIT values are floating point. when multiplied by
+   a full-scale normalized floating point sample value (-1.0..+1.0)
+   they should give the maxium value representable with an integer
+   sample type of N bits. Note that this is asymmetric. Sample ranges
+   for signed integer, 2's complement values are -(2^(N-1) to +(2^(N-1)-1)
+
+   Complications
+   -------------
+   If we use +2^(N-1) for the scaling factors, we run into a problem:
+
+   if we start with a normalized float value of -1.0, scaling
+   to 24 bits would give -8388608 (-2^23), which is ideal.
+   But with +1.0, we get +8388608, which is technically out of range.
+
+   We never multiply a full range normalized value by this constant,
+   but we could multiply it by a positive value that is close enough to +1.0
+   to produce a value > +(2^(N-1)-1.
+
+   There is no way around this paradox without wasting CPU cycles to determine
+   which scaling factor to use (i.e. determine if its negative or not,
+   use the right factor).
+
+   So, for now (October 2008) we use 2^(N-1)-1 as the scaling factor.
+ */
+
+#define SAMPLE_24BIT_SCALING  8388607.0f
+#define SAMPLE_16BIT_SCALING  32767.0f
+
+/* these are just values to use if the floating point value was out of range
+
+   advice from Fons Adriaensen: make the limits symmetrical
+ */
+
+#define SAMPLE_24BIT_MAX  8388607
+#define SAMPLE_24BIT_MIN  -8388607
+#define SAMPLE_24BIT_MAX_F  8388607.0f
+#define SAMPLE_24BIT_MIN_F  -8388607.0f
+
+#define SAMPLE_16BIT_MAX  32767
+#define SAMPLE_16BIT_MIN  -32767
+#define SAMPLE_16BIT_MAX_F  32767.0f
+#define SAMPLE_16BIT_MIN_F  -32767.0f
+
+/* these mark the outer edges of the range considered "within" range
+   for a floating point sample value. values outside (and on the boundaries)
+   of this range will be clipped before conversion; values within this
+   range will be scaled to appropriate values for the target sample
+   type.
+ */
+
+#define NORMALIZED_FLOAT_MIN -1.0f
+#define NORMALIZED_FLOAT_MAX  1.0f
+
+/* define this in case we end up on a platform that is missing
+   the real lrintf functions
+ */
+
+#define f_round(f) lrintf (f)
+
+#define float_16(s, d) \
+	if ((s) <= NORMALIZED_FLOAT_MIN) { \
+		(d) = SAMPLE_16BIT_MIN;	\
+	} else if ((s) >= NORMALIZED_FLOAT_MAX) { \
+		(d) = SAMPLE_16BIT_MAX;	\
+	} else { \
+		(d) = f_round ((s) * SAMPLE_16BIT_SCALING); \
+	}
+
+/* call this when "s" has already been scaled (e.g. when dithering)
+ */
+
+#define float_16_scaled(s, d) \
+	if ((s) <= SAMPLE_16BIT_MIN_F) { \
+		(d) = SAMPLE_16BIT_MIN_F; \
+	} else if ((s) >= SAMPLE_16BIT_MAX_F) {	\
+		(d) = SAMPLE_16BIT_MAX;	\
+	} else { \
+		(d) = f_round ((s)); \
+	}
+
+#define float_24u32(s, d) \
+	if ((s) <= NORMALIZED_FLOAT_MIN) { \
+		(d) = SAMPLE_24BIT_MIN << 8; \
+	} else if ((s) >= NORMALIZED_FLOAT_MAX) { \
+		(d) = SAMPLE_24BIT_MAX << 8; \
+	} else { \
+		(d) = f_round ((s) * SAMPLE_24BIT_SCALING) << 8; \
+	}
+
+/* call this when "s" has already been scaled (e.g. when dithering)
+ */
+
+#define float_24u32_scaled(s, d) \
+	if ((s) <= SAMPLE_24BIT_MIN_F) { \
+		(d) = SAMPLE_24BIT_MIN << 8; \
+	} else if ((s) >= SAMPLE_24BIT_MAX_F) {	\
+		(d) = SAMPLE_24BIT_MAX << 8;		\
+	} else { \
+		(d) = f_round ((s)) << 8; \
+	}
+
+#define float_24(s, d) \
+	if ((s) <= NORMALIZED_FLOAT_MIN) { \
+		(d) = SAMPLE_24BIT_MIN;	\
+	} else if ((s) >= NORMALIZED_FLOAT_MAX) { \
+		(d) = SAMPLE_24BIT_MAX;	\
+	} else { \
+		(d) = f_round ((s) * SAMPLE_24BIT_SCALING); \
+	}
+
+/* call this when "s" has already been scaled (e.g. when dithering)
+ */
+
+#define float_24_scaled(s, d) \
+	if ((s) <= SAMPLE_24BIT_MIN_F) { \
+		(d) = SAMPLE_24BIT_MIN;	\
+	} else if ((s) >= SAMPLE_24BIT_MAX_F) {	\
+		(d) = SAMPLE_24BIT_MAX;		\
+	} else { \
+		(d) = f_round ((s)); \
+	}
+
+
+void memops_meter (dither_state_t *state, const jack_default_audio_sample_t *src, unsigned long nsamples)
+{
+	float peak = state->peak;
+	float sumsq = state->sumsq;
+	float a;
+
+	while (nsamples--) {
+		a = fabsf (*src++);
+		if (a > peak) {
+			peak = a;
+		}
+		sumsq += a * a;
+		if (a > NORMALIZED_FLOAT_MAX) {
+			state->overs++;
+		}
+	}
+	state->peak = peak;
+	state->sumsq = sumsq;
+}
+
+
+/* Linear Congruential noise generator. From the music-dsp list
+ * less random than rand(), but good enough and 10x faster
+ */
+
+static inline unsigned int fast_rand ()
+{
+	static unsigned int seed = 22222;
+
+	seed = (seed * 96314165) + 907633515;
+
+	return seed;
+}
+
+
+/* functions for native float sample data */
+
+void sample_move_floatLE_sSs (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip)
+{
+	if (src_skip == sizeof(float)) {
+		/* non-interleaved */
+		memcpy (dst, src, nsamples * sizeof(float));
+		return;
+	}
+
+	while (nsamples--) {
+		*dst = *((float*)src);
+		dst++;
+		src += src_skip;
+	}
+}
+
+void sample_move_dS_floatLE (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	if (dst_skip == sizeof(float)) {
+		/* non-interleaved */
+		memcpy (dst, src, nsamples * sizeof(float));
+		return;
+	}
+
+	while (nsamples--) {
+		*((float*)dst) = *src;
+		dst += dst_skip;
+		src++;
+	}
+}
+
+/* functions for native double sample data */
+
+void sample_move_dS_sdouble (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip)
+{
+	while (nsamples--) {
+		*dst = (jack_default_audio_sample_t)*((double*)src);
+		dst++;
+		src += src_skip;
+	}
+}
+
+void sample_move_ddouble_sS (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	while (nsamples--) {
+		*((double*)dst) = *src;
+		dst += dst_skip;
+		src++;
+	}
+}
+
+/* NOTES on function naming:
+
+   foo_bar_d<TYPE>_s<TYPE>
+
+   the "d<TYPE>" component defines the destination type for the operation
+   the "s<TYPE>" component defines the source type for the operation
+
+   TYPE can be one of:
+
+   S      - sample is a jack_default_audio_sample_t, currently (October 2008) a 32 bit floating point value
+   Ss     - like S but reverse endian from the host CPU
+   32u24  - sample is an signed 32 bit integer value, but data is in upper 24 bits only
+   32u24s - like 32u24 but reverse endian from the host CPU
+   32l24  - sample is an signed 32 bit integer value, but data is in lower 24 bits only
+   32l24s - like 32l24 but reverse endian from the host CPU
+   double - sample is a native 64 bit floating point value
+   24     - sample is an signed 24 bit integer value
+   24s    - like 24 but reverse endian from the host CPU
+   16     - sample is an signed 16 bit integer value
+   16s    - like 16 but reverse endian from the host CPU
+
+   For obvious reasons, the reverse endian versions only show as source types.
+
+   This covers all known sample formats at 16 bits or larger.
+ */
+
+/* functions for native integer sample data */
+
+void sample_move_d32u24_sSs (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	int32_t z;
+
+	while (nsamples--) {
+
+		float_24u32 (*src, z);
+
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		dst[0] = (char)(z >> 24);
+		dst[1] = (char)(z >> 16);
+		dst[2] = (char)(z >> 8);
+		dst[3] = (char)(z);
+#elif __BYTE_ORDER == __BIG_ENDIAN
+		dst[0] = (char)(z);
+		dst[1] = (char)(z >> 8);
+		dst[2] = (char)(z >> 16);
+		dst[3] = (char)(z >> 24);
+#endif
+		dst += dst_skip;
+		src++;
+	}
+}
+
+void sample_move_d32u24_sS (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	while (nsamples--) {
+		float_24u32 (*src, *((int32_t*)dst));
+		dst += dst_skip;
+		src++;
+	}
+}
+
+void sample_move_dS_s32u24s (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip)
+{
+	/* ALERT: signed sign-extension portability !!! */
+
+	while (nsamples--) {
+		int x;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		x = (unsigned char)(src[0]);
+		x <<= 8;
+		x |= (unsigned char)(src[1]);
+		x <<= 8;
+		x |= (unsigned char)(src[2]);
+		x <<= 8;
+		x |= (unsigned char)(src[3]);
+#elif __BYTE_ORDER == __BIG_ENDIAN
+		x = (unsigned char)(src[3]);
+		x <<= 8;
+		x |= (unsigned char)(src[2]);
+		x <<= 8;
+		x |= (unsigned char)(src[1]);
+		x <<= 8;
+		x |= (unsigned char)(src[0]);
+#endif
+		*dst = (x >> 8) / SAMPLE_24BIT_SCALING;
+		dst++;
+		src += src_skip;
+	}
+}
+
+void sample_move_dS_s32u24 (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip)
+{
+	/* ALERT: signed sign-extension portability !!! */
+
+	while (nsamples--) {
+		*dst = (*((int*)src) >> 8) / SAMPLE_24BIT_SCALING;
+		dst++;
+		src += src_skip;
+	}
+}
+
+void sample_move_d32l24_sSs (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	int32_t z;
+
+	while (nsamples--) {
+		float_24 (*src, z);
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		dst[0] = (char)(z >> 24);
+		dst[1] = (char)(z >> 16);
+		dst[2] = (char)(z >> 8);
+		dst[3] = (char)(z);
+#elif __BYTE_ORDER == __BIG_ENDIAN
+		dst[0] = (char)(z);
+		dst[1] = (char)(z >> 8);
+		dst[2] = (char)(z >> 16);
+		dst[3] = (char)(z >> 24);
+#endif
+		dst += dst_skip;
+		src++;
+	}
+}
+
+void sample_move_d32l24_sS (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	while (nsamples--) {
+		float_24 (*src, *((int32_t*)dst));
+		dst += dst_skip;
+		src++;
+	}
+}
+
+void sample_move_dS_s32l24s (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip)
+{
+	while (nsamples--) {
+		int32_t x;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		x = (unsigned char)(src[0]);
+		x <<= 8;
+		x |= (unsigned char)(src[1]);
+		x <<= 8;
+		x |= (unsigned char)(src[2]);
+		x <<= 8;
+		x |= (unsigned char)(src[3]);
+#elif __BYTE_ORDER == __BIG_ENDIAN
+		x = (unsigned char)(src[3]);
+		x <<= 8;
+		x |= (unsigned char)(src[2]);
+		x <<= 8;
+		x |= (unsigned char)(src[1]);
+		x <<= 8;
+		x |= (unsigned char)(src[0]);
+#endif
+		*dst = x / SAMPLE_24BIT_SCALING;
+		dst++;
+		src += src_skip;
+	}
+}
+
+void sample_move_dS_s32l24 (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip)
+{
+	while (nsamples--) {
+		*dst = *((int32_t*)src) / SAMPLE_24BIT_SCALING;
+		dst++;
+		src += src_skip;
+	}
+}
+
+void sample_move_d24_sSs (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	int32_t z;
+
+	while (nsamples--) {
+		float_24 (*src, z);
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		dst[0] = (char)(z >> 16);
+		dst[1] = (char)(z >> 8);
+		dst[2] = (char)(z);
+#elif __BYTE_ORDER == __BIG_ENDIAN
+		dst[0] = (char)(z);
+		dst[1] = (char)(z >> 8);
+		dst[2] = (char)(z >> 16);
+#endif
+		dst += dst_skip;
+		src++;
+	}
+}
+
+void sample_move_d24_sS (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	int32_t z;
+
+	while (nsamples--) {
+		float_24 (*src, z);
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		memcpy (dst, &z, 3);
+#elif __BYTE_ORDER == __BIG_ENDIAN
+		memcpy (dst, (char*)&z + 1, 3);
+#endif
+		dst += dst_skip;
+		src++;
+	}
+}
+
+void sample_move_dS_s24s (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip)
+{
+	/* ALERT: signed sign-extension portability !!! */
+
+	while (nsamples--) {
+		int x;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		x = (unsigned char)(src[0]);
+		x <<= 8;
+		x |= (unsigned char)(src[1]);
+		x <<= 8;
+		x |= (unsigned char)(src[2]);
+		/* correct sign bit and the rest of the top byte */
+		if (src[0] & 0x80) {
+			x |= 0xff << 24;
+		}
+#elif __BYTE_ORDER == __BIG_ENDIAN
+		x = (unsigned char)(src[2]);
+		x <<= 8;
+		x |= (unsigned char)(src[1]);
+		x <<= 8;
+		x |= (unsigned char)(src[0]);
+		/* correct sign bit and the rest of the top byte */
+		if (src[2] & 0x80) {
+			x |= 0xff << 24;
+		}
+#endif
+		*dst = x / SAMPLE_24BIT_SCALING;
+		dst++;
+		src += src_skip;
+	}
+}
+
+void sample_move_dS_s24 (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip)
+{
+	/* ALERT: signed sign-extension portability !!! */
+
+	while (nsamples--) {
+		int x;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		memcpy ((char*)&x + 1, src, 3);
+#elif __BYTE_ORDER == __BIG_ENDIAN
+		memcpy (&x, src, 3);
+#endif
+		x >>= 8;
+		*dst = x / SAMPLE_24BIT_SCALING;
+		dst++;
+		src += src_skip;
+	}
+}
+
+
+void sample_move_d16_sSs (char *dst,  jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	int16_t tmp;
+
+	while (nsamples--) {
+		// float_16 (*src, tmp);
+
+		if (*src <= NORMALIZED_FLOAT_MIN) {
+			tmp = SAMPLE_16BIT_MIN;
+		} else if (*src >= NORMALIZED_FLOAT_MAX) {
+			tmp = SAMPLE_16BIT_MAX;
+		} else {
+			tmp = (int16_t)f_round (*src * SAMPLE_16BIT_SCALING);
+		}
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		dst[0] = (char)(tmp >> 8);
+		dst[1] = (char)(tmp);
+#elif __BYTE_ORDER == __BIG_ENDIAN
+		dst[0] = (char)(tmp);
+		dst[1] = (char)(tmp >> 8);
+#endif
+		dst += dst_skip;
+		src++;
+	}
+}
+
+void sample_move_d16_sS (char *dst,  jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	while (nsamples--) {
+		float_16 (*src, *((int16_t*)dst));
+		dst += dst_skip;
+		src++;
+	}
+}
+
+void sample_move_dither_rect_d16_sSs (char *dst,  jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	jack_default_audio_sample_t val;
+	int16_t tmp;
+
+	while (nsamples--) {
+		val = (*src * SAMPLE_16BIT_SCALING) + fast_rand () / (float)UINT_MAX - 0.5f;
+		float_16_scaled (val, tmp);
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		dst[0] = (char)(tmp >> 8);
+		dst[1] = (char)(tmp);
+#elif __BYTE_ORDER == __BIG_ENDIAN
+		dst[0] = (char)(tmp);
+		dst[1] = (char)(tmp >> 8);
+#endif
+		dst += dst_skip;
+		src++;
+	}
+}
+
+void sample_move_dither_rect_d16_sS (char *dst,  jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	jack_default_audio_sample_t val;
+
+	while (nsamples--) {
+		val = (*src * SAMPLE_16BIT_SCALING) + fast_rand () / (float)UINT_MAX - 0.5f;
+		float_16_scaled (val, *((int16_t*)dst));
+		dst += dst_skip;
+		src++;
+	}
+}
+
+void sample_move_dither_tri_d16_sSs (char *dst,  jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	jack_default_audio_sample_t val;
+	int16_t tmp;
+
+	while (nsamples--) {
+		val = (*src * SAMPLE_16BIT_SCALING) + ((float)fast_rand () + (float)fast_rand ()) / (float)UINT_MAX - 1.0f;
+		float_16_scaled (val, tmp);
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		dst[0] = (char)(tmp >> 8);
+		dst[1] = (char)(tmp);
+#elif __BYTE_ORDER == __BIG_ENDIAN
+		dst[0] = (char)(tmp);
+		dst[1] = (char)(tmp >> 8);
+#endif
+		dst += dst_skip;
+		src++;
+	}
+}
+
+void sample_move_dither_tri_d16_sS (char *dst,  jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	jack_default_audio_sample_t val;
+
+	while (nsamples--) {
+		val = (*src * SAMPLE_16BIT_SCALING) + ((float)fast_rand () + (float)fast_rand ()) / (float)UINT_MAX - 1.0f;
+		float_16_scaled (val, *((int16_t*)dst));
+		dst += dst_skip;
+		src++;
+	}
+}
+
+void sample_move_dither_shaped_d16_sSs (char *dst,  jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	jack_default_audio_sample_t x;
+	jack_default_audio_sample_t xe;         /* the innput sample - filtered error */
+	jack_default_audio_sample_t xp;         /* x' */
+	float r;
+	float rm1 = state->rm1;
+	unsigned int idx = state->idx;
+	int16_t tmp;
+
+	while (nsamples--) {
+		x = *src * SAMPLE_16BIT_SCALING;
+		r = ((float)fast_rand () + (float)fast_rand ())  / (float)UINT_MAX - 1.0f;
+		/* Filter the error with Lipshitz's minimally audible FIR:
+		   [2.033 -2.165 1.959 -1.590 0.6149] */
+		xe = x
+		     - state->e[idx] * 2.033f
+		     + state->e[(idx - 1) & DITHER_BUF_MASK] * 2.165f
+		     - state->e[(idx - 2) & DITHER_BUF_MASK] * 1.959f
+		     + state->e[(idx - 3) & DITHER_BUF_MASK] * 1.590f
+		     - state->e[(idx - 4) & DITHER_BUF_MASK] * 0.6149f;
+		xp = xe + r - rm1;
+		rm1 = r;
+
+		float_16_scaled (xp, tmp);
+
+		/* Intrinsic z^-1 delay */
+		idx = (idx + 1) & DITHER_BUF_MASK;
+		state->e[idx] = xp - xe;
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		dst[0] = (char)(tmp >> 8);
+		dst[1] = (char)(tmp);
+#elif __BYTE_ORDER == __BIG_ENDIAN
+		dst[0] = (char)(tmp);
+		dst[1] = (char)(tmp >> 8);
+#endif
+		dst += dst_skip;
+		src++;
+	}
+	state->rm1 = rm1;
+	state->idx = idx;
+}
+
+void sample_move_dither_shaped_d16_sS (char *dst,  jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state)
+{
+	jack_default_audio_sample_t x;
+	jack_default_audio_sample_t xe;         /* the innput sample - filtered error */
+	jack_default_audio_sample_t xp;         /* x' */
+	float r;
+	float rm1 = state->rm1;
+	unsigned int idx = state->idx;
+
+	while (nsamples--) {
+		x = *src * SAMPLE_16BIT_SCALING;
+		r = ((float)fast_rand () + (float)fast_rand ()) / (float)UINT_MAX - 1.0f;
+		/* Filter the error with Lipshitz's minimally audible FIR:
+		   [2.033 -2.165 1.959 -1.590 0.6149] */
+		xe = x
+		     - state->e[idx] * 2.033f
+		     + state->e[(idx - 1) & DITHER_BUF_MASK] * 2.165f
+		     - state->e[(idx - 2) & DITHER_BUF_MASK] * 1.959f
+		     + state->e[(idx - 3) & DITHER_BUF_MASK] * 1.590f
+		     - state->e[(idx - 4) & DITHER_BUF_MASK] * 0.6149f;
+		xp = xe + r - rm1;
+		rm1 = r;
+
+		float_16_scaled (xp, *((int16_t*)dst));
+
+		/* Intrinsic z^-1 delay */
+		idx = (idx + 1) & DITHER_BUF_MASK;
+		state->e[idx] = *((int16_t*)dst) - xe;
+
+		dst += dst_skip;
+		src++;
+	}
+	state->rm1 = rm1;
+	state->idx = idx;
+}
+
+void sample_move_dS_s16s (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip)
+{
+	short z;
+
+	/* ALERT: signed sign-extension portability !!! */
+	while (nsamples--) {
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		z = (unsigned char)(src[0]);
+		z <<= 8;
+		z |= (unsigned char)(src[1]);
+#elif __BYTE_ORDER == __BIG_ENDIAN
+		z = (unsigned char)(src[1]);
+		z <<= 8;
+		z |= (unsigned char)(src[0]);
+#endif
+		*dst = z / SAMPLE_16BIT_SCALING;
+		dst++;
+		src += src_skip;
+	}
+}
+
+void sample_move_dS_s16 (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip)
+
+{
+	/* ALERT: signed sign-extension portability !!! */
+	while (nsamples--) {
+		*dst = (*((short*)src)) / SAMPLE_16BIT_SCALING;
+		dst++;
+		src += src_skip;
+	}
+}
+
+void memset_interleave (char *dst, char val, unsigned long bytes,
+			unsigned long unit_bytes,
+			unsigned long skip_bytes)
+{
+	switch (unit_bytes) {
+	case 1:
+		while (bytes--) {
+			*dst = val;
+			dst += skip_bytes;
+		}
+		break;
+	case 2:
+		while (bytes) {
+			*((short*)dst) = (short)val;
+			dst += skip_bytes;
+			bytes -= 2;
+		}
+		break;
+	case 4:
+		while (bytes) {
+			*((int*)dst) = (int)val;
+			dst += skip_bytes;
+			bytes -= 4;
+		}
+		break;
+	default:
+		while (bytes) {
+			memset (dst, val, unit_bytes);
+			dst += skip_bytes;
+			bytes -= unit_bytes;
+		}
+		break;
+	}
+}
+
+/* COPY FUNCTIONS: used to move data from an input channel to an
+   output channel. Note that we assume that the skip distance
+   is the same for both channels. This is completely fine
+   unless the input and output were on different audio interfaces that
+   were interleaved differently. We don't try to handle that.
+ */
+
+void
+memcpy_fake (char *dst, char *src, unsigned long src_bytes, unsigned long foo, unsigned long bar)
+{
+	memcpy (dst, src, src_bytes);
+}
+
+void
+memcpy_interleave_d16_s16 (char *dst, char *src, unsigned long src_bytes,
+			   unsigned long dst_skip_bytes, unsigned long src_skip_bytes)
+{
+	while (src_bytes) {
+		*((short*)dst) = *((short*)src);
+		dst += dst_skip_bytes;
+		src += src_skip_bytes;
+		src_bytes -= 2;
+	}
+}
+
+void
+memcpy_interleave_d24_s24 (char *dst, char *src, unsigned long src_bytes,
+			   unsigned long dst_skip_bytes, unsigned long src_skip_bytes)
+
+{
+	while (src_bytes) {
+		memcpy (dst, src, 3);
+		dst += dst_skip_bytes;
+		src += src_skip_bytes;
+		src_bytes -= 3;
+	}
+}
+
+void
+memcpy_interleave_d32_s32 (char *dst, char *src, unsigned long src_bytes,
+			   unsigned long dst_skip_bytes, unsigned long src_skip_bytes)
+
+{
+	while (src_bytes) {
+		*((int*)dst) = *((int*)src);
+		dst += dst_skip_bytes;
+		src += src_skip_bytes;
+		src_bytes -= 4;
+	}
+}
+
+
+/* Vectorized versions of the plain (non-dithering) converters.
+
+   The float<->int scaling and clipping is done 8 samples at a time;
+   the strided loads and stores, and the byte swapping for the "s"
+   variants, stay per-sample because the hardware buffer is usually
+   interleaved. Results are bit-identical to the scalar code: the
+   vector clamps saturate exactly where float_16()/float_24() do, the
+   vector round-to-int uses the current rounding mode like lrintf(),
+   and the read side divides rather than multiplying by a reciprocal.
+   Anything left over at the end of a block goes through the scalar
+   function.
+
+   The 16 bit dithering converters draw their noise 8 lanes at a time
+   from a vector xorshift generator, whose state is kept per channel in
+   dither_state_t, instead of calling fast_rand() once or twice per
+   sample. The noise is not the scalar sequence, so these results are
+   not bit-identical, only statistically the same. Rectangular and
+   triangular dither then go through the vector scaling and clipping
+   too; the noise shaping filter feeds back every sample, so it stays
+   scalar, with its noise taken from the vector generator.
+
+   While state->meter is set, all of them also take the peak, the sum
+   of squares and the number of samples beyond full scale (the ones
+   the conversion clips) of what they convert, in per-lane
+   accumulators that are folded into the state once per call.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#if defined(__SSE2__)
+#define MEMOPS_HAVE_SSE2
+#endif
+#if (__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) || defined(__clang__)
+#define MEMOPS_HAVE_AVX2
+#endif
+#endif
+
+#if defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_NEON)
+#define MEMOPS_HAVE_NEON
+#endif
+
+#if defined(MEMOPS_HAVE_SSE2) || defined(MEMOPS_HAVE_AVX2) || defined(MEMOPS_HAVE_NEON)
+
+#if defined(MEMOPS_HAVE_SSE2) || defined(MEMOPS_HAVE_AVX2)
+#include <immintrin.h>
+#endif
+#ifdef MEMOPS_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+#define MEMOPS_SIMD_BLOCK 8
+
+typedef void (*memops_f2i_t)(int32_t *dst, const float *src, float scale);
+typedef void (*memops_i2f_t)(float *dst, const int32_t *src, float scale);
+
+/* Fill noise[0..MEMOPS_SIMD_BLOCK) with the sum of `draws' signed
+   32 bit random numbers per lane, times scale. */
+typedef void (*memops_noise_t)(uint32_t *rng, float *noise, float scale, int draws);
+
+/* per-lane level accumulators, see memops_meter() */
+typedef struct {
+	float peak[MEMOPS_SIMD_BLOCK];
+	float sumsq[MEMOPS_SIMD_BLOCK];
+	int32_t overs[MEMOPS_SIMD_BLOCK];
+} memops_meter_acc_t;
+
+typedef void (*memops_meter_t)(const float *src, memops_meter_acc_t *acc);
+
+/* 2^-32: a signed 32 bit random number times this is in [-0.5, 0.5) */
+#define MEMOPS_NOISE_SCALE (1.0f / 4294967296.0f)
+
+#ifdef MEMOPS_HAVE_SSE2
+static inline void
+memops_f2i_sse2 (int32_t *dst, const float *src, float scale)
+{
+	const __m128 lo = _mm_set1_ps (NORMALIZED_FLOAT_MIN);
+	const __m128 hi = _mm_set1_ps (NORMALIZED_FLOAT_MAX);
+	const __m128 sc = _mm_set1_ps (scale);
+	__m128 a = _mm_loadu_ps (src);
+	__m128 b = _mm_loadu_ps (src + 4);
+
+	a = _mm_mul_ps (_mm_min_ps (_mm_max_ps (a, lo), hi), sc);
+	b = _mm_mul_ps (_mm_min_ps (_mm_max_ps (b, lo), hi), sc);
+	_mm_storeu_si128 ((__m128i*)dst, _mm_cvtps_epi32 (a));
+	_mm_storeu_si128 ((__m128i*)(dst + 4), _mm_cvtps_epi32 (b));
+}
+
+static inline void
+memops_i2f_sse2 (float *dst, const int32_t *src, float scale)
+{
+	const __m128 sc = _mm_set1_ps (scale);
+	__m128i a = _mm_loadu_si128 ((const __m128i*)src);
+	__m128i b = _mm_loadu_si128 ((const __m128i*)(src + 4));
+
+	_mm_storeu_ps (dst, _mm_div_ps (_mm_cvtepi32_ps (a), sc));
+	_mm_storeu_ps (dst + 4, _mm_div_ps (_mm_cvtepi32_ps (b), sc));
+}
+
+static inline __m128i
+memops_xorshift_sse2 (__m128i x)
+{
+	x = _mm_xor_si128 (x, _mm_slli_epi32 (x, 13));
+	x = _mm_xor_si128 (x, _mm_srli_epi32 (x, 17));
+	return _mm_xor_si128 (x, _mm_slli_epi32 (x, 5));
+}
+
+static inline void
+memops_meter_sse2 (const float *src, memops_meter_acc_t *acc)
+{
+	const __m128 abs = _mm_castsi128_ps (_mm_set1_epi32 (0x7fffffff));
+	const __m128 hi = _mm_set1_ps (NORMALIZED_FLOAT_MAX);
+	__m128 a = _mm_and_ps (_mm_loadu_ps (src), abs);
+	__m128 b = _mm_and_ps (_mm_loadu_ps (src + 4), abs);
+
+	_mm_storeu_ps (acc->peak, _mm_max_ps (_mm_loadu_ps (acc->peak), a));
+	_mm_storeu_ps (acc->peak + 4, _mm_max_ps (_mm_loadu_ps (acc->peak + 4), b));
+	_mm_storeu_ps (acc->sumsq, _mm_add_ps (_mm_loadu_ps (acc->sumsq), _mm_mul_ps (a, a)));
+	_mm_storeu_ps (acc->sumsq + 4, _mm_add_ps (_mm_loadu_ps (acc->sumsq + 4), _mm_mul_ps (b, b)));
+	/* a true comparison is -1 */
+	_mm_storeu_si128 ((__m128i*)acc->overs,
+			  _mm_sub_epi32 (_mm_loadu_si128 ((const __m128i*)acc->overs),
+					 _mm_castps_si128 (_mm_cmpgt_ps (a, hi))));
+	_mm_storeu_si128 ((__m128i*)(acc->overs + 4),
+			  _mm_sub_epi32 (_mm_loadu_si128 ((const __m128i*)(acc->overs + 4)),
+					 _mm_castps_si128 (_mm_cmpgt_ps (b, hi))));
+}
+
+static inline void
+memops_noise_sse2 (uint32_t *rng, float *noise, float scale, int draws)
+{
+	__m128i a = _mm_loadu_si128 ((const __m128i*)rng);
+	__m128i b = _mm_loadu_si128 ((const __m128i*)(rng + 4));
+	__m128 na = _mm_setzero_ps ();
+	__m128 nb = _mm_setzero_ps ();
+
+	while (draws--) {
+		a = memops_xorshift_sse2 (a);
+		b = memops_xorshift_sse2 (b);
+		na = _mm_add_ps (na, _mm_cvtepi32_ps (a));
+		nb = _mm_add_ps (nb, _mm_cvtepi32_ps (b));
+	}
+	_mm_storeu_si128 ((__m128i*)rng, a);
+	_mm_storeu_si128 ((__m128i*)(rng + 4), b);
+	_mm_storeu_ps (noise, _mm_mul_ps (na, _mm_set1_ps (scale)));
+	_mm_storeu_ps (noise + 4, _mm_mul_ps (nb, _mm_set1_ps (scale)));
+}
+#endif /* MEMOPS_HAVE_SSE2 */
+
+#ifdef MEMOPS_HAVE_AVX2
+static inline __attribute__ ((target ("avx2"), always_inline)) void
+memops_f2i_avx2 (int32_t *dst, const float *src, float scale)
+{
+	const __m256 lo = _mm256_set1_ps (NORMALIZED_FLOAT_MIN);
+	const __m256 hi = _mm256_set1_ps (NORMALIZED_FLOAT_MAX);
+	__m256 a = _mm256_loadu_ps (src);
+
+	a = _mm256_mul_ps (_mm256_min_ps (_mm256_max_ps (a, lo), hi),
+			   _mm256_set1_ps (scale));
+	_mm256_storeu_si256 ((__m256i*)dst, _mm256_cvtps_epi32 (a));
+}
+
+static inline __attribute__ ((target ("avx2"), always_inline)) void
+memops_i2f_avx2 (float *dst, const int32_t *src, float scale)
+{
+	__m256i a = _mm256_loadu_si256 ((const __m256i*)src);
+
+	_mm256_storeu_ps (dst, _mm256_div_ps (_mm256_cvtepi32_ps (a),
+					      _mm256_set1_ps (scale)));
+}
+
+static inline __attribute__ ((target ("avx2"), always_inline)) void
+memops_meter_avx2 (const float *src, memops_meter_acc_t *acc)
+{
+	__m256 a = _mm256_and_ps (_mm256_loadu_ps (src),
+				  _mm256_castsi256_ps (_mm256_set1_epi32 (0x7fffffff)));
+	__m256 over = _mm256_cmp_ps (a, _mm256_set1_ps (NORMALIZED_FLOAT_MAX), _CMP_GT_OQ);
+
+	_mm256_storeu_ps (acc->peak, _mm256_max_ps (_mm256_loadu_ps (acc->peak), a));
+	_mm256_storeu_ps (acc->sumsq, _mm256_add_ps (_mm256_loadu_ps (acc->sumsq),
+						     _mm256_mul_ps (a, a)));
+	_mm256_storeu_si256 ((__m256i*)acc->overs,
+			     _mm256_sub_epi32 (_mm256_loadu_si256 ((const __m256i*)acc->overs),
+					       _mm256_castps_si256 (over)));
+}
+
+static inline __attribute__ ((target ("avx2"), always_inline)) void
+memops_noise_avx2 (uint32_t *rng, float *noise, float scale, int draws)
+{
+	__m256i x = _mm256_loadu_si256 ((const __m256i*)rng);
+	__m256 n = _mm256_setzero_ps ();
+
+	while (draws--) {
+		x = _mm256_xor_si256 (x, _mm256_slli_epi32 (x, 13));
+		x = _mm256_xor_si256 (x, _mm256_srli_epi32 (x, 17));
+		x = _mm256_xor_si256 (x, _mm256_slli_epi32 (x, 5));
+		n = _mm256_add_ps (n, _mm256_cvtepi32_ps (x));
+	}
+	_mm256_storeu_si256 ((__m256i*)rng, x);
+	_mm256_storeu_ps (noise, _mm256_mul_ps (n, _mm256_set1_ps (scale)));
+}
+#endif /* MEMOPS_HAVE_AVX2 */
+
+#ifdef MEMOPS_HAVE_NEON
+static inline void
+memops_f2i_neon (int32_t *dst, const float *src, float scale)
+{
+	const float32x4_t lo = vdupq_n_f32 (NORMALIZED_FLOAT_MIN);
+	const float32x4_t hi = vdupq_n_f32 (NORMALIZED_FLOAT_MAX);
+	float32x4_t a = vld1q_f32 (src);
+	float32x4_t b = vld1q_f32 (src + 4);
+
+	/* vcvtnq rounds to nearest-even, the default lrintf() mode */
+	a = vmulq_n_f32 (vminq_f32 (vmaxq_f32 (a, lo), hi), scale);
+	b = vmulq_n_f32 (vminq_f32 (vmaxq_f32 (b, lo), hi), scale);
+	vst1q_s32 (dst, vcvtnq_s32_f32 (a));
+	vst1q_s32 (dst + 4, vcvtnq_s32_f32 (b));
+}
+
+static inline void
+memops_i2f_neon (float *dst, const int32_t *src, float scale)
+{
+	const float32x4_t sc = vdupq_n_f32 (scale);
+
+	vst1q_f32 (dst, vdivq_f32 (vcvtq_f32_s32 (vld1q_s32 (src)), sc));
+	vst1q_f32 (dst + 4, vdivq_f32 (vcvtq_f32_s32 (vld1q_s32 (src + 4)), sc));
+}
+
+static inline uint32x4_t
+memops_xorshift_neon (uint32x4_t x)
+{
+	x = veorq_u32 (x, vshlq_n_u32 (x, 13));
+	x = veorq_u32 (x, vshrq_n_u32 (x, 17));
+	return veorq_u32 (x, vshlq_n_u32 (x, 5));
+}
+
+static inline void
+memops_meter_neon (const float *src, memops_meter_acc_t *acc)
+{
+	const float32x4_t hi = vdupq_n_f32 (NORMALIZED_FLOAT_MAX);
+	float32x4_t a = vabsq_f32 (vld1q_f32 (src));
+	float32x4_t b = vabsq_f32 (vld1q_f32 (src + 4));
+
+	vst1q_f32 (acc->peak, vmaxq_f32 (vld1q_f32 (acc->peak), a));
+	vst1q_f32 (acc->peak + 4, vmaxq_f32 (vld1q_f32 (acc->peak + 4), b));
+	vst1q_f32 (acc->sumsq, vmlaq_f32 (vld1q_f32 (acc->sumsq), a, a));
+	vst1q_f32 (acc->sumsq + 4, vmlaq_f32 (vld1q_f32 (acc->sumsq + 4), b, b));
+	/* a true comparison is all ones, -1 */
+	vst1q_s32 (acc->overs, vsubq_s32 (vld1q_s32 (acc->overs),
+					  vreinterpretq_s32_u32 (vcgtq_f32 (a, hi))));
+	vst1q_s32 (acc->overs + 4, vsubq_s32 (vld1q_s32 (acc->overs + 4),
+					      vreinterpretq_s32_u32 (vcgtq_f32 (b, hi))));
+}
+
+static inline void
+memops_noise_neon (uint32_t *rng, float *noise, float scale, int draws)
+{
+	uint32x4_t a = vld1q_u32 (rng);
+	uint32x4_t b = vld1q_u32 (rng + 4);
+	float32x4_t na = vdupq_n_f32 (0.0f);
+	float32x4_t nb = vdupq_n_f32 (0.0f);
+
+	while (draws--) {
+		a = memops_xorshift_neon (a);
+		b = memops_xorshift_neon (b);
+		na = vaddq_f32 (na, vcvtq_f32_s32 (vreinterpretq_s32_u32 (a)));
+		nb = vaddq_f32 (nb, vcvtq_f32_s32 (vreinterpretq_s32_u32 (b)));
+	}
+	vst1q_u32 (rng, a);
+	vst1q_u32 (rng + 4, b);
+	vst1q_f32 (noise, vmulq_n_f32 (na, scale));
+	vst1q_f32 (noise + 4, vmulq_n_f32 (nb, scale));
+}
+#endif /* MEMOPS_HAVE_NEON */
+
+/* "swap" selects the byte order of the sSs/sNs variants: the
+   opposite of the host's.
+ */
+
+static inline __attribute__ ((always_inline)) int
+memops_big_endian (int swap)
+{
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	return swap;
+#else
+	return !swap;
+#endif
+}
+
+static inline __attribute__ ((always_inline)) int
+memops_meter_begin (dither_state_t *state, memops_meter_acc_t *acc)
+{
+	if (state == NULL || !state->meter) {
+		return 0;
+	}
+	memset (acc, 0, sizeof(*acc));
+	return 1;
+}
+
+/* fold the lanes into state, and take the scalar tail */
+static inline void
+memops_meter_end (dither_state_t *state, memops_meter_acc_t *acc,
+		  const jack_default_audio_sample_t *src, unsigned long nsamples)
+{
+	int i;
+
+	for (i = 0; i < MEMOPS_SIMD_BLOCK; i++) {
+		if (acc->peak[i] > state->peak) {
+			state->peak = acc->peak[i];
+		}
+		state->sumsq += acc->sumsq[i];
+		state->overs += (uint32_t)acc->overs[i];
+	}
+	memops_meter (state, src, nsamples);
+}
+
+static inline __attribute__ ((always_inline)) void
+memops_simd_d32u24 (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples,
+		    unsigned long dst_skip, dither_state_t *state, int swap,
+		    memops_f2i_t f2i, memops_meter_t meter)
+{
+	memops_meter_acc_t acc;
+	int metering = memops_meter_begin (state, &acc);
+	int32_t z[MEMOPS_SIMD_BLOCK];
+	int i;
+
+	while (nsamples >= MEMOPS_SIMD_BLOCK) {
+		if (metering) {
+			meter (src, &acc);
+		}
+		f2i (z, src, SAMPLE_24BIT_SCALING);
+		for (i = 0; i < MEMOPS_SIMD_BLOCK; i++) {
+			uint32_t x = (uint32_t)z[i] << 8;
+			if (swap) {
+				x = bswap_32 (x);
+			}
+			memcpy (dst, &x, 4);
+			dst += dst_skip;
+		}
+		src += MEMOPS_SIMD_BLOCK;
+		nsamples -= MEMOPS_SIMD_BLOCK;
+	}
+
+	if (metering) {
+		memops_meter_end (state, &acc, src, nsamples);
+	}
+
+	if (swap) {
+		sample_move_d32u24_sSs (dst, src, nsamples, dst_skip, NULL);
+	} else {
+		sample_move_d32u24_sS (dst, src, nsamples, dst_skip, NULL);
+	}
+}
+
+static inline __attribute__ ((always_inline)) void
+memops_simd_d24 (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples,
+		 unsigned long dst_skip, dither_state_t *state, int swap,
+		 memops_f2i_t f2i, memops_meter_t meter)
+{
+	memops_meter_acc_t acc;
+	int metering = memops_meter_begin (state, &acc);
+	int32_t z[MEMOPS_SIMD_BLOCK];
+	int big = memops_big_endian (swap);
+	int i;
+
+	while (nsamples >= MEMOPS_SIMD_BLOCK) {
+		if (metering) {
+			meter (src, &acc);
+		}
+		f2i (z, src, SAMPLE_24BIT_SCALING);
+		for (i = 0; i < MEMOPS_SIMD_BLOCK; i++) {
+			if (big) {
+				dst[0] = (char)(z[i] >> 16);
+				dst[1] = (char)(z[i] >> 8);
+				dst[2] = (char)(z[i]);
+			} else {
+				dst[0] = (char)(z[i]);
+				dst[1] = (char)(z[i] >> 8);
+				dst[2] = (char)(z[i] >> 16);
+			}
+			dst += dst_skip;
+		}
+		src += MEMOPS_SIMD_BLOCK;
+		nsamples -= MEMOPS_SIMD_BLOCK;
+	}
+
+	if (metering) {
+		memops_meter_end (state, &acc, src, nsamples);
+	}
+
+	if (swap) {
+		sample_move_d24_sSs (dst, src, nsamples, dst_skip, NULL);
+	} else {
+		sample_move_d24_sS (dst, src, nsamples, dst_skip, NULL);
+	}
+}
+
+static inline __attribute__ ((always_inline)) void
+memops_simd_d16 (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples,
+		 unsigned long dst_skip, dither_state_t *state, int swap,
+		 memops_f2i_t f2i, memops_meter_t meter)
+{
+	memops_meter_acc_t acc;
+	int metering = memops_meter_begin (state, &acc);
+	int32_t z[MEMOPS_SIMD_BLOCK];
+	int i;
+
+	while (nsamples >= MEMOPS_SIMD_BLOCK) {
+		if (metering) {
+			meter (src, &acc);
+		}
+		f2i (z, src, SAMPLE_16BIT_SCALING);
+		for (i = 0; i < MEMOPS_SIMD_BLOCK; i++) {
+			uint16_t x = (uint16_t)z[i];
+			if (swap) {
+				x = bswap_16 (x);
+			}
+			memcpy (dst, &x, 2);
+			dst += dst_skip;
+		}
+		src += MEMOPS_SIMD_BLOCK;
+		nsamples -= MEMOPS_SIMD_BLOCK;
+	}
+
+	if (metering) {
+		memops_meter_end (state, &acc, src, nsamples);
+	}
+
+	if (swap) {
+		sample_move_d16_sSs (dst, src, nsamples, dst_skip, NULL);
+	} else {
+		sample_move_d16_sS (dst, src, nsamples, dst_skip, NULL);
+	}
+}
+
+static inline __attribute__ ((always_inline)) void
+memops_simd_dS_s32u24 (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples,
+		       unsigned long src_skip, int swap, memops_i2f_t i2f)
+{
+	int32_t z[MEMOPS_SIMD_BLOCK];
+	int i;
+
+	while (nsamples >= MEMOPS_SIMD_BLOCK) {
+		for (i = 0; i < MEMOPS_SIMD_BLOCK; i++) {
+			uint32_t x;
+			memcpy (&x, src, 4);
+			if (swap) {
+				x = bswap_32 (x);
+			}
+			z[i] = (int32_t)x >> 8;
+			src += src_skip;
+		}
+		i2f (dst, z, SAMPLE_24BIT_SCALING);
+		dst += MEMOPS_SIMD_BLOCK;
+		nsamples -= MEMOPS_SIMD_BLOCK;
+	}
+
+	if (swap) {
+		sample_move_dS_s32u24s (dst, src, nsamples, src_skip);
+	} else {
+		sample_move_dS_s32u24 (dst, src, nsamples, src_skip);
+	}
+}
+
+static inline __attribute__ ((always_inline)) void
+memops_simd_dS_s24 (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples,
+		    unsigned long src_skip, int swap, memops_i2f_t i2f)
+{
+	int32_t z[MEMOPS_SIMD_BLOCK];
+	int big = memops_big_endian (swap);
+	int i;
+
+	while (nsamples >= MEMOPS_SIMD_BLOCK) {
+		for (i = 0; i < MEMOPS_SIMD_BLOCK; i++) {
+			const unsigned char *s = (const unsigned char*)src;
+			uint32_t x;
+			if (big) {
+				x = ((uint32_t)s[0] << 24) | (s[1] << 16) | (s[2] << 8);
+			} else {
+				x = ((uint32_t)s[2] << 24) | (s[1] << 16) | (s[0] << 8);
+			}
+			z[i] = (int32_t)x >> 8;
+			src += src_skip;
+		}
+		i2f (dst, z, SAMPLE_24BIT_SCALING);
+		dst += MEMOPS_SIMD_BLOCK;
+		nsamples -= MEMOPS_SIMD_BLOCK;
+	}
+
+	if (swap) {
+		sample_move_dS_s24s (dst, src, nsamples, src_skip);
+	} else {
+		sample_move_dS_s24 (dst, src, nsamples, src_skip);
+	}
+}
+
+static inline __attribute__ ((always_inline)) void
+memops_simd_dS_s16 (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples,
+		    unsigned long src_skip, int swap, memops_i2f_t i2f)
+{
+	int32_t z[MEMOPS_SIMD_BLOCK];
+	int i;
+
+	while (nsamples >= MEMOPS_SIMD_BLOCK) {
+		for (i = 0; i < MEMOPS_SIMD_BLOCK; i++) {
+			uint16_t x;
+			memcpy (&x, src, 2);
+			if (swap) {
+				x = bswap_16 (x);
+			}
+			z[i] = (int16_t)x;
+			src += src_skip;
+		}
+		i2f (dst, z, SAMPLE_16BIT_SCALING);
+		dst += MEMOPS_SIMD_BLOCK;
+		nsamples -= MEMOPS_SIMD_BLOCK;
+	}
+
+	if (swap) {
+		sample_move_dS_s16s (dst, src, nsamples, src_skip);
+	} else {
+		sample_move_dS_s16 (dst, src, nsamples, src_skip);
+	}
+}
+
+static inline void
+memops_rng_init (dither_state_t *state)
+{
+	uint32_t seed;
+	int i;
+
+	if (state->rng[0]) {
+		return;
+	}
+
+	/* different for every channel, and never 0, where xorshift
+	   would stay */
+	seed = 22222 + (uint32_t)(uintptr_t)state;
+	for (i = 0; i < DITHER_RNG_LANES; i++) {
+		seed = (seed * 96314165) + 907633515;
+		state->rng[i] = seed ? seed : 1;
+	}
+}
+
+static inline __attribute__ ((always_inline)) void
+memops_store_d16 (char *dst, int16_t x, int swap)
+{
+	uint16_t u = (uint16_t)x;
+
+	if (swap) {
+		u = bswap_16 (u);
+	}
+	memcpy (dst, &u, 2);
+}
+
+/* rectangular (draws == 1) or triangular (draws == 2) dither */
+static inline __attribute__ ((always_inline)) void
+memops_simd_dither_d16 (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples,
+			unsigned long dst_skip, dither_state_t *state, int swap, int draws,
+			memops_f2i_t f2i, memops_noise_t noise, memops_meter_t meter)
+{
+	memops_meter_acc_t acc;
+	int metering = memops_meter_begin (state, &acc);
+	float x[MEMOPS_SIMD_BLOCK];
+	int32_t z[MEMOPS_SIMD_BLOCK];
+	int i;
+
+	memops_rng_init (state);
+
+	while (nsamples >= MEMOPS_SIMD_BLOCK) {
+		/* in units of the normalized sample, so that f2i clips
+		   after the noise is added, like float_16_scaled() */
+		if (metering) {
+			meter (src, &acc);
+		}
+		noise (state->rng, x, MEMOPS_NOISE_SCALE / SAMPLE_16BIT_SCALING, draws);
+		for (i = 0; i < MEMOPS_SIMD_BLOCK; i++) {
+			x[i] += src[i];
+		}
+		f2i (z, x, SAMPLE_16BIT_SCALING);
+		for (i = 0; i < MEMOPS_SIMD_BLOCK; i++) {
+			memops_store_d16 (dst, (int16_t)z[i], swap);
+			dst += dst_skip;
+		}
+		src += MEMOPS_SIMD_BLOCK;
+		nsamples -= MEMOPS_SIMD_BLOCK;
+	}
+
+	if (metering) {
+		memops_meter_end (state, &acc, src, nsamples);
+	}
+
+	if (draws == 1) {
+		if (swap) {
+			sample_move_dither_rect_d16_sSs (dst, src, nsamples, dst_skip, state);
+		} else {
+			sample_move_dither_rect_d16_sS (dst, src, nsamples, dst_skip, state);
+		}
+	} else {
+		if (swap) {
+			sample_move_dither_tri_d16_sSs (dst, src, nsamples, dst_skip, state);
+		} else {
+			sample_move_dither_tri_d16_sS (dst, src, nsamples, dst_skip, state);
+		}
+	}
+}
+
+static inline __attribute__ ((always_inline)) void
+memops_simd_dither_shaped_d16 (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples,
+			       unsigned long dst_skip, dither_state_t *state, int swap,
+			       memops_noise_t noise, memops_meter_t meter)
+{
+	memops_meter_acc_t acc;
+	int metering = memops_meter_begin (state, &acc);
+	float r[MEMOPS_SIMD_BLOCK];
+	float rm1 = state->rm1;
+	unsigned int idx = state->idx;
+	jack_default_audio_sample_t x, xe, xp;
+	int16_t tmp;
+	int i;
+
+	memops_rng_init (state);
+
+	while (nsamples >= MEMOPS_SIMD_BLOCK) {
+		if (metering) {
+			meter (src, &acc);
+		}
+		noise (state->rng, r, MEMOPS_NOISE_SCALE, 2);
+		for (i = 0; i < MEMOPS_SIMD_BLOCK; i++) {
+			x = src[i] * SAMPLE_16BIT_SCALING;
+			/* as in sample_move_dither_shaped_d16_sS() */
+			xe = x
+			     - state->e[idx] * 2.033f
+			     + state->e[(idx - 1) & DITHER_BUF_MASK] * 2.165f
+			     - state->e[(idx - 2) & DITHER_BUF_MASK] * 1.959f
+			     + state->e[(idx - 3) & DITHER_BUF_MASK] * 1.590f
+			     - state->e[(idx - 4) & DITHER_BUF_MASK] * 0.6149f;
+			xp = xe + r[i] - rm1;
+			rm1 = r[i];
+
+			float_16_scaled (xp, tmp);
+
+			idx = (idx + 1) & DITHER_BUF_MASK;
+			state->e[idx] = tmp - xe;
+
+			memops_store_d16 (dst, tmp, swap);
+			dst += dst_skip;
+		}
+		src += MEMOPS_SIMD_BLOCK;
+		nsamples -= MEMOPS_SIMD_BLOCK;
+	}
+
+	state->rm1 = rm1;
+	state->idx = idx;
+
+	if (metering) {
+		memops_meter_end (state, &acc, src, nsamples);
+	}
+
+	if (swap) {
+		sample_move_dither_shaped_d16_sSs (dst, src, nsamples, dst_skip, state);
+	} else {
+		sample_move_dither_shaped_d16_sS (dst, src, nsamples, dst_skip, state);
+	}
+}
+
+/* one set of entry points per instruction set */
+
+#define MEMOPS_SIMD_FUNCS(isa, attr) \
+static attr void sample_move_d32u24_sSs_##isa (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state) \
+{ memops_simd_d32u24 (dst, src, nsamples, dst_skip, state, 1, memops_f2i_##isa, memops_meter_##isa); } \
+static attr void sample_move_d32u24_sS_##isa (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state) \
+{ memops_simd_d32u24 (dst, src, nsamples, dst_skip, state, 0, memops_f2i_##isa, memops_meter_##isa); } \
+static attr void sample_move_d24_sSs_##isa (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state) \
+{ memops_simd_d24 (dst, src, nsamples, dst_skip, state, 1, memops_f2i_##isa, memops_meter_##isa); } \
+static attr void sample_move_d24_sS_##isa (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state) \
+{ memops_simd_d24 (dst, src, nsamples, dst_skip, state, 0, memops_f2i_##isa, memops_meter_##isa); } \
+static attr void sample_move_d16_sSs_##isa (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state) \
+{ memops_simd_d16 (dst, src, nsamples, dst_skip, state, 1, memops_f2i_##isa, memops_meter_##isa); } \
+static attr void sample_move_d16_sS_##isa (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state) \
+{ memops_simd_d16 (dst, src, nsamples, dst_skip, state, 0, memops_f2i_##isa, memops_meter_##isa); } \
+static attr void sample_move_dither_rect_d16_sSs_##isa (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state) \
+{ memops_simd_dither_d16 (dst, src, nsamples, dst_skip, state, 1, 1, memops_f2i_##isa, memops_noise_##isa, memops_meter_##isa); } \
+static attr void sample_move_dither_rect_d16_sS_##isa (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state) \
+{ memops_simd_dither_d16 (dst, src, nsamples, dst_skip, state, 0, 1, memops_f2i_##isa, memops_noise_##isa, memops_meter_##isa); } \
+static attr void sample_move_dither_tri_d16_sSs_##isa (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state) \
+{ memops_simd_dither_d16 (dst, src, nsamples, dst_skip, state, 1, 2, memops_f2i_##isa, memops_noise_##isa, memops_meter_##isa); } \
+static attr void sample_move_dither_tri_d16_sS_##isa (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state) \
+{ memops_simd_dither_d16 (dst, src, nsamples, dst_skip, state, 0, 2, memops_f2i_##isa, memops_noise_##isa, memops_meter_##isa); } \
+static attr void sample_move_dither_shaped_d16_sSs_##isa (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state) \
+{ memops_simd_dither_shaped_d16 (dst, src, nsamples, dst_skip, state, 1, memops_noise_##isa, memops_meter_##isa); } \
+static attr void sample_move_dither_shaped_d16_sS_##isa (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state) \
+{ memops_simd_dither_shaped_d16 (dst, src, nsamples, dst_skip, state, 0, memops_noise_##isa, memops_meter_##isa); } \
+static attr void sample_move_dS_s32u24s_##isa (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip) \
+{ memops_simd_dS_s32u24 (dst, src, nsamples, src_skip, 1, memops_i2f_##isa); } \
+static attr void sample_move_dS_s32u24_##isa (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip) \
+{ memops_simd_dS_s32u24 (dst, src, nsamples, src_skip, 0, memops_i2f_##isa); } \
+static attr void sample_move_dS_s24s_##isa (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip) \
+{ memops_simd_dS_s24 (dst, src, nsamples, src_skip, 1, memops_i2f_##isa); } \
+static attr void sample_move_dS_s24_##isa (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip) \
+{ memops_simd_dS_s24 (dst, src, nsamples, src_skip, 0, memops_i2f_##isa); } \
+static attr void sample_move_dS_s16s_##isa (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip) \
+{ memops_simd_dS_s16 (dst, src, nsamples, src_skip, 1, memops_i2f_##isa); } \
+static attr void sample_move_dS_s16_##isa (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip) \
+{ memops_simd_dS_s16 (dst, src, nsamples, src_skip, 0, memops_i2f_##isa); }
+
+#define MEMOPS_PICK_WRITE(isa) \
+	if (func == sample_move_d32u24_sSs) return sample_move_d32u24_sSs_##isa; \
+	if (func == sample_move_d32u24_sS) return sample_move_d32u24_sS_##isa; \
+	if (func == sample_move_d24_sSs) return sample_move_d24_sSs_##isa; \
+	if (func == sample_move_d24_sS) return sample_move_d24_sS_##isa; \
+	if (func == sample_move_d16_sSs) return sample_move_d16_sSs_##isa; \
+	if (func == sample_move_d16_sS) return sample_move_d16_sS_##isa; \
+	if (func == sample_move_dither_rect_d16_sSs) return sample_move_dither_rect_d16_sSs_##isa; \
+	if (func == sample_move_dither_rect_d16_sS) return sample_move_dither_rect_d16_sS_##isa; \
+	if (func == sample_move_dither_tri_d16_sSs) return sample_move_dither_tri_d16_sSs_##isa; \
+	if (func == sample_move_dither_tri_d16_sS) return sample_move_dither_tri_d16_sS_##isa; \
+	if (func == sample_move_dither_shaped_d16_sSs) return sample_move_dither_shaped_d16_sSs_##isa; \
+	if (func == sample_move_dither_shaped_d16_sS) return sample_move_dither_shaped_d16_sS_##isa;
+
+#define MEMOPS_PICK_READ(isa) \
+	if (func == sample_move_dS_s32u24s) return sample_move_dS_s32u24s_##isa; \
+	if (func == sample_move_dS_s32u24) return sample_move_dS_s32u24_##isa; \
+	if (func == sample_move_dS_s24s) return sample_move_dS_s24s_##isa; \
+	if (func == sample_move_dS_s24) return sample_move_dS_s24_##isa; \
+	if (func == sample_move_dS_s16s) return sample_move_dS_s16s_##isa; \
+	if (func == sample_move_dS_s16) return sample_move_dS_s16_##isa;
+
+#ifdef MEMOPS_HAVE_AVX2
+MEMOPS_SIMD_FUNCS (avx2, __attribute__ ((target ("avx2"))))
+#endif
+#ifdef MEMOPS_HAVE_SSE2
+MEMOPS_SIMD_FUNCS (sse2, )
+#endif
+#ifdef MEMOPS_HAVE_NEON
+MEMOPS_SIMD_FUNCS (neon, )
+#endif
+
+#endif /* MEMOPS_HAVE_SSE2 || MEMOPS_HAVE_AVX2 || MEMOPS_HAVE_NEON */
+
+const char *
+memops_simd_name ()
+{
+#ifdef MEMOPS_HAVE_AVX2
+	if (jack_cpu_has (JACK_CPU_AVX2)) {
+		return "AVX2";
+	}
+#endif
+#if defined(MEMOPS_HAVE_SSE2)
+	return "SSE2";
+#elif defined(MEMOPS_HAVE_NEON)
+	return "NEON";
+#else
+	return NULL;
+#endif
+}
+
+MemopsWriteFunction
+memops_simd_write_function (MemopsWriteFunction func)
+{
+#ifdef MEMOPS_HAVE_AVX2
+	if (jack_cpu_has (JACK_CPU_AVX2)) {
+		MEMOPS_PICK_WRITE (avx2)
+	}
+#endif
+#ifdef MEMOPS_HAVE_SSE2
+	MEMOPS_PICK_WRITE (sse2)
+#endif
+#ifdef MEMOPS_HAVE_NEON
+	MEMOPS_PICK_WRITE (neon)
+#endif
+	return func;
+}
+
+MemopsReadFunction
+memops_simd_read_function (MemopsReadFunction func)
+{
+#ifdef MEMOPS_HAVE_AVX2
+	if (jack_cpu_has (JACK_CPU_AVX2)) {
+		MEMOPS_PICK_READ (avx2)
+	}
+#endif
+#ifdef MEMOPS_HAVE_SSE2
+	MEMOPS_PICK_READ (sse2)
+#endif
+#ifdef MEMOPS_HAVE_NEON
+	MEMOPS_PICK_READ (neon)
+#endif
+	return func;
+}
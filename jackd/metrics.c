@@ -0,0 +1,731 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    OpenMetrics service -- runs in the server process.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ */
+
+/*
+ * With --metrics [host:]port, a thread of its own (not realtime)
+ * answers HTTP GETs on that address with the server's state in the
+ * OpenMetrics text format, for Prometheus and friends to scrape:
+ *
+ *   - the DSP load, buffer size and sample rate;
+ *   - quantiles of the cycle time, from the cycle trace ring, which
+ *     --metrics turns on if --cycle-trace did not;
+ *   - quantiles of each client's process time, over the window the
+ *     engine keeps for its timeouts;
+ *   - xruns by cause: reported by the driver, an engine wakeup too
+ *     late to run the cycle, or a subgraph that timed out;
+ *   - a histogram of the time taken by server requests;
+ *   - the list nodes the control path holds and keeps pooled;
+ *   - whatever the driver adds through its metrics function (netjack
+ *     loss and jitter, for instance).
+ *
+ * Nothing here runs on the realtime threads; they only bump counters.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "internal.h"
+#include "engine.h"
+#include "driver.h"
+#include "clientengine.h"
+#include "metrics.h"
+#include "pool.h"
+
+#define JACK_METRICS_DEFAULT_HOST "127.0.0.1"
+#define JACK_METRICS_REQUEST_MAX 4096   /* bytes of an HTTP request */
+
+/* upper bounds of the request histogram buckets */
+static const jack_time_t jack_request_bucket_usecs[JACK_REQUEST_HIST_BUCKETS] = {
+	50, 100, 250, 500, 1000, 2500, 10000, 50000
+};
+
+static const char *jack_xrun_cause_names[JACK_XRUN_CAUSES] = {
+	"driver", "wakeup", "client"
+};
+
+typedef struct {
+	char *buf;
+	size_t len;
+	size_t size;
+	int failed;
+} jack_metrics_out_t;
+
+static void
+jack_metrics_printf (jack_metrics_out_t *out, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	while (!out->failed) {
+		va_start (ap, fmt);
+		n = vsnprintf (out->buf + out->len, out->size - out->len, fmt, ap);
+		va_end (ap);
+
+		if (n < 0) {
+			out->failed = 1;
+		} else if ((size_t)n < out->size - out->len) {
+			out->len += n;
+			return;
+		} else {
+			size_t size = out->size * 2 + n + 1;
+			char *buf = realloc (out->buf, size);
+
+			if (buf == NULL) {
+				out->failed = 1;
+			} else {
+				out->buf = buf;
+				out->size = size;
+			}
+		}
+	}
+}
+
+/* a label value, with \, " and newlines escaped */
+static void
+jack_metrics_label (jack_metrics_out_t *out, const char *s)
+{
+	for (; *s; s++) {
+		switch (*s) {
+		case '\\':
+			jack_metrics_printf (out, "\\\\");
+			break;
+		case '"':
+			jack_metrics_printf (out, "\\\"");
+			break;
+		case '\n':
+			jack_metrics_printf (out, "\\n");
+			break;
+		default:
+			jack_metrics_printf (out, "%c", *s);
+			break;
+		}
+	}
+}
+
+static int
+jack_metrics_compare (const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+
+	return (x > y) - (x < y);
+}
+
+/* the cycle times (driver wakeup to the end of the driver write) in
+ * the trace ring, skipping records being written */
+static uint32_t
+jack_metrics_cycle_times (jack_engine_t *engine, uint32_t *usecs)
+{
+	const jack_cycle_trace_t *trace = engine->trace;
+	uint64_t count = trace->write_count;
+	uint64_t k, n = count < trace->nrecords ? count : trace->nrecords;
+	uint32_t got = 0;
+
+	for (k = 0; k < n; k++) {
+		const jack_cycle_trace_record_t *rec =
+			&trace->records[(count - 1 - k) % trace->nrecords];
+		jack_time_t start, end;
+		uint32_t seq;
+
+		if ((seq = rec->seq) & 1) {
+			continue;
+		}
+		__sync_synchronize ();
+		start = rec->cycle_start;
+		end = rec->cycle_end;
+		__sync_synchronize ();
+
+		if (rec->seq == seq && end >= start) {
+			usecs[got++] = (uint32_t)(end - start);
+		}
+	}
+
+	return got;
+}
+
+static void
+jack_metrics_cycles (jack_engine_t *engine, jack_metrics_out_t *out)
+{
+	static const int quantiles[] = { 50, 90, 99, 100 };
+	uint32_t *usecs, n;
+	unsigned int q;
+
+	if (engine->trace == NULL) {
+		return;
+	}
+
+	if ((usecs = malloc (engine->trace->nrecords * sizeof(uint32_t))) == NULL) {
+		return;
+	}
+
+	if ((n = jack_metrics_cycle_times (engine, usecs)) > 0) {
+		qsort (usecs, n, sizeof(uint32_t), jack_metrics_compare);
+
+		jack_metrics_printf (out,
+				     "# TYPE jack_cycle_seconds summary\n"
+				     "# UNIT jack_cycle_seconds seconds\n"
+				     "# HELP jack_cycle_seconds Driver wakeup to the end of the driver write, over the last %u cycles.\n",
+				     n);
+		for (q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+			jack_metrics_printf (out, "jack_cycle_seconds{quantile=\"%g\"} %g\n",
+					     quantiles[q] / 100.0,
+					     usecs[(n - 1) * quantiles[q] / 100] * 1e-6);
+		}
+	}
+
+	free (usecs);
+}
+
+/* one sample of a per-client summary */
+static void
+jack_metrics_client_quantile (jack_metrics_out_t *out, const char *metric,
+			      const char *client, const char *quantile,
+			      double value)
+{
+	jack_metrics_printf (out, "%s{client=\"", metric);
+	jack_metrics_label (out, client);
+	jack_metrics_printf (out, "\",quantile=\"%s\"} %g\n", quantile, value);
+}
+
+static void
+jack_metrics_append (jack_metrics_out_t *out, jack_metrics_out_t *more)
+{
+	if (more->failed) {
+		out->failed = 1;
+	} else if (more->len) {
+		jack_metrics_printf (out, "%s", more->buf);
+	}
+	free (more->buf);
+}
+
+static void
+jack_metrics_clients (jack_engine_t *engine, jack_metrics_out_t *out)
+{
+	JSList *node;
+	jack_client_load_t load;
+	unsigned int active = 0;
+	/* the counter families come after, each in one piece */
+	jack_metrics_out_t ipc = { NULL, 0, 0, 0 };
+	jack_metrics_out_t llc = { NULL, 0, 0, 0 };
+	jack_metrics_out_t faults = { NULL, 0, 0, 0 };
+	jack_metrics_out_t majflt = { NULL, 0, 0, 0 };
+	jack_metrics_out_t preempted = { NULL, 0, 0, 0 };
+
+	jack_metrics_printf (out,
+			     "# TYPE jack_client_process_seconds summary\n"
+			     "# UNIT jack_client_process_seconds seconds\n"
+			     "# HELP jack_client_process_seconds Process callback time of each client over its recent cycles.\n");
+	jack_metrics_printf (&ipc,
+			     "# TYPE jack_client_instructions_per_cycle summary\n"
+			     "# HELP jack_client_instructions_per_cycle Instructions per CPU cycle in the process callback, with --perf-counters.\n");
+	jack_metrics_printf (&llc,
+			     "# TYPE jack_client_llc_misses summary\n"
+			     "# HELP jack_client_llc_misses Last level cache misses per process callback, with --perf-counters.\n");
+	jack_metrics_printf (&faults,
+			     "# TYPE jack_client_minor_faults summary\n"
+			     "# HELP jack_client_minor_faults Minor page faults per process callback, with --perf-counters.\n");
+	jack_metrics_printf (&majflt,
+			     "# TYPE jack_client_major_faults gauge\n"
+			     "# HELP jack_client_major_faults Major page faults in the process callback over its recent cycles, with --perf-counters.\n");
+	jack_metrics_printf (&preempted,
+			     "# TYPE jack_client_preempted_cycles gauge\n"
+			     "# HELP jack_client_preempted_cycles Recent cycles with an involuntary context switch in the process callback, with --perf-counters.\n");
+
+	jack_rdlock_graph (engine);
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client = (jack_client_internal_t*)node->data;
+		const char *name = (const char*)client->control->name;
+
+		if (!client->control->active) {
+			continue;
+		}
+		active++;
+
+		if (client->load_count == 0) {
+			continue;
+		}
+		jack_client_load_stats (client, &load);
+
+		jack_metrics_client_quantile (out, "jack_client_process_seconds",
+					      name, "0.5", load.p50_usecs * 1e-6);
+		jack_metrics_client_quantile (out, "jack_client_process_seconds",
+					      name, "0.99", load.p99_usecs * 1e-6);
+		jack_metrics_client_quantile (out, "jack_client_process_seconds",
+					      name, "1", load.max_usecs * 1e-6);
+
+		if (load.perf_cycles) {
+			jack_metrics_client_quantile (&ipc, "jack_client_instructions_per_cycle",
+						      name, "0.01", load.p1_ipc);
+			jack_metrics_client_quantile (&ipc, "jack_client_instructions_per_cycle",
+						      name, "0.5", load.p50_ipc);
+			jack_metrics_client_quantile (&llc, "jack_client_llc_misses",
+						      name, "0.5", load.p50_llc_misses);
+			jack_metrics_client_quantile (&llc, "jack_client_llc_misses",
+						      name, "0.99", load.p99_llc_misses);
+		}
+
+		if (load.fault_cycles) {
+			jack_metrics_client_quantile (&faults, "jack_client_minor_faults",
+						      name, "0.99", load.p99_minor_faults);
+			jack_metrics_client_quantile (&faults, "jack_client_minor_faults",
+						      name, "1", load.max_minor_faults);
+			jack_metrics_printf (&majflt, "jack_client_major_faults{client=\"");
+			jack_metrics_label (&majflt, name);
+			jack_metrics_printf (&majflt, "\"} %" PRIu32 "\n", load.major_faults);
+			jack_metrics_printf (&preempted, "jack_client_preempted_cycles{client=\"");
+			jack_metrics_label (&preempted, name);
+			jack_metrics_printf (&preempted, "\"} %" PRIu32 "\n", load.preempted_cycles);
+		}
+	}
+
+	if (engine->control->perf_counters) {
+		jack_metrics_append (out, &ipc);
+		jack_metrics_append (out, &llc);
+		jack_metrics_append (out, &faults);
+		jack_metrics_append (out, &majflt);
+		jack_metrics_append (out, &preempted);
+	} else {
+		free (ipc.buf);
+		free (llc.buf);
+		free (faults.buf);
+		free (majflt.buf);
+		free (preempted.buf);
+	}
+
+	jack_metrics_printf (out,
+			     "# TYPE jack_clients gauge\n"
+			     "# HELP jack_clients Active clients, the drivers included.\n"
+			     "jack_clients %u\n", active);
+
+	if (engine->driver && engine->driver->metrics) {
+		char buf[4096];
+		int n = engine->driver->metrics (engine->driver, buf, sizeof(buf));
+
+		if (n > 0 && (size_t)n < sizeof(buf)) {
+			jack_metrics_printf (out, "%s", buf);
+		}
+	}
+
+	jack_unlock_graph (engine);
+}
+
+static void
+jack_metrics_requests (jack_engine_t *engine, jack_metrics_out_t *out)
+{
+	uint64_t total = 0;
+	int i;
+
+	jack_metrics_printf (out,
+			     "# TYPE jack_request_duration_seconds histogram\n"
+			     "# UNIT jack_request_duration_seconds seconds\n"
+			     "# HELP jack_request_duration_seconds Time the server took to handle a client request.\n");
+
+	for (i = 0; i < JACK_REQUEST_HIST_BUCKETS; i++) {
+		total += engine->request_hist[i];
+		jack_metrics_printf (out, "jack_request_duration_seconds_bucket{le=\"%g\"} %" PRIu64 "\n",
+				     jack_request_bucket_usecs[i] * 1e-6, total);
+	}
+	total += engine->request_hist[JACK_REQUEST_HIST_BUCKETS];
+	jack_metrics_printf (out,
+			     "jack_request_duration_seconds_bucket{le=\"+Inf\"} %" PRIu64 "\n"
+			     "jack_request_duration_seconds_count %" PRIu64 "\n"
+			     "jack_request_duration_seconds_sum %g\n",
+			     total, total, engine->request_usecs * 1e-6);
+}
+
+static void
+jack_metrics_render (jack_engine_t *engine, jack_metrics_out_t *out)
+{
+	jack_control_t *control = engine->control;
+	jack_slist_pool_stats_t nodes;
+	int i;
+
+	jack_metrics_printf (out,
+			     "# TYPE jack_dsp_load_ratio gauge\n"
+			     "# HELP jack_dsp_load_ratio Share of the period spent processing, smoothed.\n"
+			     "jack_dsp_load_ratio %g\n"
+			     "# TYPE jack_max_delayed_seconds gauge\n"
+			     "# UNIT jack_max_delayed_seconds seconds\n"
+			     "# HELP jack_max_delayed_seconds Longest driver wakeup delay seen.\n"
+			     "jack_max_delayed_seconds %g\n"
+			     "# TYPE jack_buffer_size_frames gauge\n"
+			     "jack_buffer_size_frames %" PRIu32 "\n"
+			     "# TYPE jack_sample_rate_hertz gauge\n"
+			     "jack_sample_rate_hertz %" PRIu32 "\n",
+			     control->cpu_load / 100.0f,
+			     control->max_delayed_usecs * 1e-6,
+			     control->buffer_size,
+			     control->current_time.frame_rate);
+
+	jack_metrics_printf (out,
+			     "# TYPE jack_xruns counter\n"
+			     "# HELP jack_xruns Cycles gone wrong, by cause.\n");
+	for (i = 0; i < JACK_XRUN_CAUSES; i++) {
+		jack_metrics_printf (out, "jack_xruns_total{cause=\"%s\"} %" PRIu64 "\n",
+				     jack_xrun_cause_names[i], engine->xruns[i]);
+	}
+
+	jack_metrics_cycles (engine, out);
+	jack_metrics_clients (engine, out);
+	jack_metrics_requests (engine, out);
+
+	jack_pool_slist_stats (&nodes);
+	jack_metrics_printf (out,
+			     "# TYPE jack_list_nodes gauge\n"
+			     "# HELP jack_list_nodes Control path list nodes, on lists or pooled.\n"
+			     "jack_list_nodes{state=\"in_use\"} %lu\n"
+			     "jack_list_nodes{state=\"pooled\"} %lu\n"
+			     "# TYPE jack_list_node_chunks counter\n"
+			     "# HELP jack_list_node_chunks Times the list node pool grew.\n"
+			     "jack_list_node_chunks_total %lu\n",
+			     nodes.in_use, nodes.pooled, nodes.chunks);
+
+	jack_metrics_printf (out, "# EOF\n");
+}
+
+static int
+jack_metrics_write_all (int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = write (fd, buf, len)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static void
+jack_metrics_serve (jack_engine_t *engine, int fd)
+{
+	struct timeval tv = { 1, 0 };
+	char req[JACK_METRICS_REQUEST_MAX + 1];
+	jack_metrics_out_t out = { NULL, 0, 0, 0 };
+	size_t len = 0;
+	ssize_t n;
+	char head[256];
+
+	setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	/* the request line and headers; the path does not matter */
+	while (len < JACK_METRICS_REQUEST_MAX) {
+		if ((n = read (fd, req + len, JACK_METRICS_REQUEST_MAX - len)) <= 0) {
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		len += n;
+		req[len] = '\0';
+		if (strstr (req, "\r\n\r\n") || strstr (req, "\n\n")) {
+			break;
+		}
+	}
+	req[len] = '\0';
+
+	if (strncmp (req, "GET ", 4) != 0) {
+		static const char bad[] = "HTTP/1.0 405 Method Not Allowed\r\n"
+					  "Allow: GET\r\nContent-Length: 0\r\n"
+					  "Connection: close\r\n\r\n";
+		jack_metrics_write_all (fd, bad, sizeof(bad) - 1);
+		return;
+	}
+
+	out.size = 8192;
+	if ((out.buf = malloc (out.size)) == NULL) {
+		return;
+	}
+	jack_metrics_render (engine, &out);
+
+	if (!out.failed) {
+		snprintf (head, sizeof(head),
+			  "HTTP/1.0 200 OK\r\n"
+			  "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+			  "Content-Length: %lu\r\n"
+			  "Connection: close\r\n\r\n",
+			  (unsigned long)out.len);
+		if (jack_metrics_write_all (fd, head, strlen (head)) == 0) {
+			jack_metrics_write_all (fd, out.buf, out.len);
+		}
+	}
+
+	free (out.buf);
+}
+
+static void *
+jack_metrics_thread (void *arg)
+{
+	jack_engine_t *engine = (jack_engine_t*)arg;
+	struct pollfd pfd;
+	int fd;
+
+	while (engine->metrics_run) {
+		pfd.fd = engine->metrics_fd;
+		pfd.events = POLLIN;
+
+		/* wakes up now and then to see if it should stop */
+		if (poll (&pfd, 1, 500) <= 0) {
+			continue;
+		}
+		if ((fd = accept (engine->metrics_fd, NULL, NULL)) < 0) {
+			continue;
+		}
+		jack_metrics_serve (engine, fd);
+		close (fd);
+	}
+
+	return NULL;
+}
+
+/* Listen on `address', "port" or "host:port" ("[v6 address]:port"
+ * works too); the host defaults to the loopback address.
+ */
+int
+jack_metrics_start (jack_engine_t *engine, const char *address)
+{
+	struct addrinfo hints, *res, *ai;
+	char *host, *port, *colon;
+	int fd = -1, on = 1, err;
+
+	engine->metrics_fd = -1;
+
+	if ((host = strdup (address)) == NULL) {
+		return -1;
+	}
+	if ((colon = strrchr (host, ':')) != NULL) {
+		*colon = '\0';
+		port = colon + 1;
+		if (host[0] == '[' && colon > host + 1 && colon[-1] == ']') {
+			colon[-1] = '\0';
+			memmove (host, host + 1, strlen (host));
+		}
+	} else {
+		port = host;
+	}
+
+	memset (&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	if ((err = getaddrinfo (colon ? host : JACK_METRICS_DEFAULT_HOST,
+				port, &hints, &res)) != 0) {
+		jack_error ("metrics: cannot resolve %s (%s)", address,
+			    gai_strerror (err));
+		free (host);
+		return -1;
+	}
+	free (host);
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		if ((fd = socket (ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0) {
+			continue;
+		}
+		setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (bind (fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen (fd, 8) == 0) {
+			break;
+		}
+		close (fd);
+		fd = -1;
+	}
+	freeaddrinfo (res);
+
+	if (fd < 0) {
+		jack_error ("metrics: cannot listen on %s (%s)", address,
+			    strerror (errno));
+		return -1;
+	}
+	fcntl (fd, F_SETFD, FD_CLOEXEC);
+
+	engine->metrics_fd = fd;
+	engine->metrics_run = 1;
+
+	if ((err = pthread_create (&engine->metrics_thread, NULL,
+				   jack_metrics_thread, engine)) != 0) {
+		jack_error ("metrics: cannot start thread (%s)", strerror (err));
+		engine->metrics_run = 0;
+		close (fd);
+		engine->metrics_fd = -1;
+		return -1;
+	}
+
+	VERBOSE (engine, "metrics: serving on %s", address);
+	return 0;
+}
+
+void
+jack_metrics_stop (jack_engine_t *engine)
+{
+	if (engine->metrics_fd < 0) {
+		return;
+	}
+
+	engine->metrics_run = 0;
+	pthread_join (engine->metrics_thread, NULL);
+	close (engine->metrics_fd);
+	engine->metrics_fd = -1;
+}
+
+/* Called for every request the server handles, off the RT threads,
+ * from more than one thread at a time since queries do not take the
+ * request_lock.
+ */
+void
+jack_metrics_request_done (jack_engine_t *engine, jack_time_t usecs)
+{
+	int i;
+
+	for (i = 0; i < JACK_REQUEST_HIST_BUCKETS; i++) {
+		if (usecs <= jack_request_bucket_usecs[i]) {
+			break;
+		}
+	}
+	__atomic_add_fetch (&engine->request_hist[i], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch (&engine->request_usecs, usecs, __ATOMIC_RELAXED);
+}
+
+/* The same numbers as binary, for jackctl_server_get_stats() and
+ * jack_server_stats_query(); see jack_server_stats_t.  Called off the
+ * RT threads.
+ */
+jack_server_stats_t *
+jack_server_stats_collect (jack_engine_t *engine)
+{
+	jack_control_t *control = engine->control;
+	jack_server_stats_t *stats;
+	jack_server_client_stats_t *c;
+	JSList *node;
+	uint32_t *usecs, n = 0;
+	size_t size;
+	char text[4096];
+	int len = 0;
+	int i;
+
+	jack_rdlock_graph (engine);
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		if (((jack_client_internal_t*)node->data)->control->active) {
+			n++;
+		}
+	}
+
+	if (engine->driver && engine->driver->metrics) {
+		len = engine->driver->metrics (engine->driver, text, sizeof(text));
+		if (len < 0 || (size_t)len >= sizeof(text)) {
+			len = 0;
+		}
+	}
+
+	size = sizeof(*stats) + n * sizeof(*c) + (len ? len + 1 : 0);
+	if ((stats = (jack_server_stats_t*)calloc (1, size)) == NULL) {
+		jack_unlock_graph (engine);
+		return NULL;
+	}
+
+	stats->version = JACK_SERVER_STATS_VERSION;
+	stats->size = size;
+	stats->cpu_load = control->cpu_load;
+	stats->max_delayed_usecs = control->max_delayed_usecs;
+	stats->buffer_size = control->buffer_size;
+	stats->sample_rate = control->current_time.frame_rate;
+	for (i = 0; i < JACK_XRUN_CAUSES && i < JACK_SERVER_STATS_XRUN_CAUSES; i++) {
+		stats->xruns[i] = engine->xruns[i];
+	}
+
+	if (engine->trace
+	    && (usecs = malloc (engine->trace->nrecords * sizeof(uint32_t))) != NULL) {
+		uint32_t got = jack_metrics_cycle_times (engine, usecs);
+
+		if (got) {
+			qsort (usecs, got, sizeof(uint32_t), jack_metrics_compare);
+			stats->cycles = got;
+			stats->p50_cycle_usecs = usecs[(got - 1) * 50 / 100];
+			stats->p90_cycle_usecs = usecs[(got - 1) * 90 / 100];
+			stats->p99_cycle_usecs = usecs[(got - 1) * 99 / 100];
+			stats->max_cycle_usecs = usecs[got - 1];
+		}
+		free (usecs);
+	}
+
+	c = stats->clients;
+	for (node = engine->clients; node && stats->nclients < n;
+	     node = jack_slist_next (node)) {
+		jack_client_internal_t *client = (jack_client_internal_t*)node->data;
+
+		if (!client->control->active) {
+			continue;
+		}
+		snprintf (c->name, sizeof(c->name), "%s",
+			  (const char*)client->control->name);
+		jack_client_load_stats (client, &c->load);
+		c++;
+		stats->nclients++;
+	}
+
+	if (len) {
+		stats->driver_metrics = (char*)c - (char*)stats;
+		memcpy (c, text, len);
+	}
+
+	jack_unlock_graph (engine);
+
+	return stats;
+}
+
+/* Answer a JACK_CONNECT_STATS connection on the server socket. */
+int
+jack_server_stats_send (jack_engine_t *engine, int fd)
+{
+	jack_server_stats_t *stats;
+	struct timeval timeout = { 1, 0 };
+	int ret;
+
+	if ((stats = jack_server_stats_collect (engine)) == NULL) {
+		return -1;
+	}
+
+	/* the server thread answers; a reader that does not read must
+	   not hold it up */
+	setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	ret = jack_metrics_write_all (fd, (const char*)stats, stats->size);
+	free (stats);
+
+	return ret;
+}
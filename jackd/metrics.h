@@ -0,0 +1,25 @@
+/*
+ *  OpenMetrics service for the JACK engine.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+int     jack_metrics_start(jack_engine_t *engine, const char *address);
+void    jack_metrics_stop(jack_engine_t *engine);
+void    jack_metrics_request_done(jack_engine_t *engine, jack_time_t usecs);
+
+jack_server_stats_t *jack_server_stats_collect(jack_engine_t *engine);
+int     jack_server_stats_send(jack_engine_t *engine, int fd);
@@ -111,19 +111,29 @@ jack_sync_poll_start (jack_engine_t *engine)
 {
 	JSList *node;
 	long sync_count = 0;            /* count slow-sync clients */
+	long poll_count = 0;            /* count those not yet ready */
+	jack_unique_t prepared = engine->control->current_time.unique_1;
 
 	for (node = engine->clients; node; node = jack_slist_next (node)) {
 		jack_client_internal_t *client =
 			(jack_client_internal_t*)node->data;
 		if (client->control->active_slowsync) {
-			client->control->sync_poll = 1;
 			sync_count++;
+			/* ready already, from its sync prepare callback? */
+			if (prepared &&
+			    client->control->sync_prepared == prepared) {
+				VERBOSE (engine, "sync client %s already prepared",
+					 client->control->name);
+				continue;
+			}
+			client->control->sync_poll = 1;
+			poll_count++;
 		}
 	}
 
 	//JOQ: check invariant for debugging...
 	assert (sync_count == engine->control->sync_clients);
-	engine->control->sync_remain = sync_count;
+	engine->control->sync_remain = poll_count;
 	engine->control->sync_time_left = engine->control->sync_timeout;
 	VERBOSE (engine, "transport Starting, sync poll of %" PRIu32
 		 " clients for %8.6f secs", engine->control->sync_remain,
@@ -147,11 +157,76 @@ jack_sync_timeout (jack_engine_t *engine)
 
 	/* timed out */
 	VERBOSE (engine, "transport sync timeout");
+	if (engine->verbose) {
+		JSList *node;
+		for (node = engine->clients; node; node = jack_slist_next (node)) {
+			jack_client_internal_t *client =
+				(jack_client_internal_t*)node->data;
+			if (client->control->active_slowsync &&
+			    client->control->sync_poll) {
+				VERBOSE (engine, "sync client %s was not ready",
+					 client->control->name);
+			}
+		}
+	}
 	ectl->sync_time_left = 0;
 	return TRUE;
 }
 
 
+/* Publish current_time for jack_transport_query().
+ *
+ * The snapshot is double-buffered: we fill the slot readers are not
+ * being pointed at, then move snapshot_seq to it with a release store.
+ * A reader copies the slot snapshot_seq selects and only retries if
+ * the sequence moved during its copy, so it never has to wait for us
+ * to finish writing, and we publish at most twice a cycle.
+ *
+ * precondition: only called from the process cycle, or before there
+ * is one, so there is a single writer.
+ */
+static void
+jack_transport_publish (jack_control_t *ectl)
+{
+	uint32_t seq = ectl->snapshot_seq + 1;
+	jack_transport_snapshot_t *snap = &ectl->snapshot[seq & 1];
+
+	/* the last publish must be seen before we touch this slot, which
+	 * readers of the previous-but-one sequence may still be copying */
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+
+	snap->position = ectl->current_time;
+	snap->state = ectl->transport_state;
+
+	__atomic_store_n (&ectl->snapshot_seq, seq, __ATOMIC_RELEASE);
+}
+
+/* Fill in the BBT fields of the next cycle's position from the tempo
+ * map, when there is one and no timebase master to do it.  This is
+ * where jack_call_timebase_master() would have its callback do it,
+ * only a cycle earlier and without waiting for a client.
+ *
+ * precondition: caller holds the graph lock.
+ */
+static void
+jack_tempo_map_cycle (jack_engine_t *engine)
+{
+	jack_control_t *ectl = engine->control;
+	jack_tempo_map_t *map = &ectl->tempo_map[ectl->tempo_map_seq & 1];
+
+	if (map->count == 0 || engine->timebase_client) {
+		return;
+	}
+
+	ectl->pending_time.bbt_offset = 0;
+	ectl->pending_time.valid &= ~JackBBTFrameOffset;
+	if (jack_tempo_map_to_bbt (map, ectl->pending_time.frame_rate,
+				   ectl->pending_time.frame,
+				   &ectl->pending_time)) {
+		ectl->pending_time.valid &= ~JackPositionBBT;
+	}
+}
+
 /**************** subroutines used by engine.c ****************/
 
 /* driver callback */
@@ -160,8 +235,22 @@ jack_set_sample_rate (jack_engine_t *engine, jack_nframes_t nframes)
 {
 	jack_control_t *ectl = engine->control;
 
+	if (engine->backup_attach) {
+		/* a backup driver must run at the master's rate */
+		if (nframes != ectl->current_time.frame_rate) {
+			engine->backup_attach = -1;
+		}
+		return 0;
+	}
+	if (engine->domain_attach) {
+		/* checked against the master's once it is attached */
+		engine->domain_rate = nframes;
+		return 0;
+	}
+
 	ectl->current_time.frame_rate = nframes;
 	ectl->pending_time.frame_rate = nframes;
+	jack_transport_publish (ectl);
 	return 0;
 }
 
@@ -276,6 +365,9 @@ jack_transport_init (jack_engine_t *engine)
 	memset (&ectl->current_time, 0, sizeof(ectl->current_time));
 	memset (&ectl->pending_time, 0, sizeof(ectl->pending_time));
 	memset (&ectl->request_time, 0, sizeof(ectl->request_time));
+	memset (ectl->snapshot, 0, sizeof(ectl->snapshot));
+	ectl->snapshot[0].state = JackTransportStopped;
+	ectl->snapshot_seq = 0;
 	ectl->prev_request = 0;
 	ectl->seq_number = 1;           /* can't start at 0 */
 	ectl->new_pos = 0;
@@ -285,6 +377,8 @@ jack_transport_init (jack_engine_t *engine)
 	ectl->sync_remain = 0;
 	ectl->sync_timeout = 2000000;   /* 2 second default */
 	ectl->sync_time_left = 0;
+	memset (ectl->tempo_map, 0, sizeof(ectl->tempo_map));
+	ectl->tempo_map_seq = 0;
 }
 
 /* when any client exits the graph (either dead or not active)
@@ -523,17 +617,117 @@ jack_transport_cycle_end (jack_engine_t *engine)
 			 ectl->pending_time.unique_1);
 		ectl->prev_request = ectl->pending_time.unique_1;
 		ectl->pending_pos = 1;
+
+		/* let the server thread tell clients where we are going
+		 * before the next cycle gets there */
+		engine->sync_prepare_pending = 1;
+		jack_wake_server_thread (engine);
 	}
 
 	/* clients can't set pending frame number, so save it here */
 	ectl->pending_frame = ectl->pending_time.frame;
+
+	jack_tempo_map_cycle (engine);
+
+	jack_transport_publish (ectl);
 }
 
 /* driver callback at start of cycle */
 void
 jack_transport_cycle_start (jack_engine_t *engine, jack_time_t time)
 {
+	/* the cycles of a clock domain are not the graph's */
+	if (engine->clock_domains
+	    && !pthread_equal (pthread_self (), engine->master_thread)) {
+		return;
+	}
 	engine->control->current_time.usecs = time;
+	jack_transport_publish (engine->control);
+}
+
+/* Deliver a SyncPrepare event for the latest relocation request to
+ * every client with a sync prepare callback, without waiting for
+ * replies, so that all of them can start seeking at once. Called by
+ * the server thread after jack_transport_cycle_end() wakes it up.
+ *
+ * precondition: caller holds the graph lock.
+ */
+void
+jack_transport_sync_prepare (jack_engine_t *engine)
+{
+	jack_event_t event;
+	JSList *node;
+
+	if (!__atomic_exchange_n (&engine->sync_prepare_pending, 0,
+				  __ATOMIC_ACQ_REL)) {
+		return;
+	}
+
+	memset (&event, 0, sizeof(event));
+	event.type = SyncPrepare;
+
+	/* the newest request wins, as in jack_transport_cycle_end() */
+	jack_transport_copy_position (&engine->control->request_time,
+				      &event.z.position);
+
+	VERBOSE (engine, "sync prepare for frame %" PRIu32 ", id=0x%" PRIx64,
+		 event.z.position.frame, event.z.position.unique_1);
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client =
+			(jack_client_internal_t*)node->data;
+		if (client->control->active &&
+		    client->control->sync_prepare_cbset) {
+			jack_deliver_event (engine, client, &event);
+		}
+	}
+}
+
+/* on SetTempoMap request */
+int
+jack_tempo_map_set (jack_engine_t *engine, const jack_tempo_map_t *map)
+{
+	jack_control_t *ectl = engine->control;
+	const jack_tempo_segment_t *seg;
+	uint32_t i, seq;
+
+	if (map->count > JACK_TEMPO_MAP_MAX
+	    || (map->count && map->segment[0].frame != 0)) {
+		return EINVAL;
+	}
+	for (i = 0; i < map->count; ++i) {
+		seg = &map->segment[i];
+		if (!(seg->beats_per_bar > 0.0f && seg->beats_per_bar < 1e6f)
+		    || !(seg->beat_type > 0.0f && seg->beat_type < 1e6f)
+		    || !(seg->ticks_per_beat > 0.0 && seg->ticks_per_beat < 1e9)
+		    || !(seg->beats_per_minute > 0.0 && seg->beats_per_minute < 1e6)
+		    || (i && seg->frame <= map->segment[i - 1].frame)) {
+			return EINVAL;
+		}
+	}
+
+	/* the cycle reads the map under this lock; clients, which do
+	 * not take it, read the slot tempo_map_seq selects */
+	jack_lock_graph (engine);
+
+	seq = ectl->tempo_map_seq + 1;
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	ectl->tempo_map[seq & 1].count = map->count;
+	memcpy (ectl->tempo_map[seq & 1].segment, map->segment,
+		map->count * sizeof(map->segment[0]));
+	__atomic_store_n (&ectl->tempo_map_seq, seq, __ATOMIC_RELEASE);
+
+	if (map->count) {
+		jack_tempo_map_cycle (engine);
+	} else if (engine->timebase_client == NULL) {
+		ectl->pending_time.valid &= ~JackPositionBBT;
+	}
+
+	jack_unlock_graph (engine);
+
+	VERBOSE (engine, "new tempo map of %" PRIu32 " segments",
+		 map->count);
+	return 0;
 }
 
 /* on SetSyncTimeout request */
@@ -35,5 +35,8 @@ int     jack_transport_client_set_sync(jack_engine_t *engine,
 				       jack_uuid_t client_id);
 void    jack_transport_cycle_end(jack_engine_t *engine);
 void    jack_transport_cycle_start(jack_engine_t *engine, jack_time_t time);
+void    jack_transport_sync_prepare(jack_engine_t *engine);
 int     jack_transport_set_sync_timeout(jack_engine_t *engine,
 					jack_time_t usecs);
+int     jack_tempo_map_set(jack_engine_t *engine,
+			   const jack_tempo_map_t *map);
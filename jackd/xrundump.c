@@ -0,0 +1,482 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    Xrun flight recorder -- runs in the server process.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+ */
+
+/*
+ * With --xrun-dump dir, every xrun leaves a text file in dir with what
+ * led up to it: the cycle trace records of the last cycles before it
+ * and of the one it hit, the graph order, and the recent graph changes.
+ *
+ * The realtime thread that sees the xrun only notes the trace position
+ * and posts a semaphore.  A thread of our own waits for the cycle to
+ * be recorded, copies the records out of the ring before they are
+ * overwritten (the ring holds thousands of cycles, so there is time),
+ * and writes the file.  Xruns that happen while a dump is under way
+ * are counted in it, not dumped again.
+ *
+ * Graph changes are logged as they happen, by the server thread with
+ * the graph lock held, into a small ring that the dump copies under
+ * the read lock.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "internal.h"
+#include "engine.h"
+#include "driver.h"
+#include "xrundump.h"
+
+#define JACK_XRUN_DUMP_CYCLES 64        /* records before the xrun */
+#define JACK_XRUN_DUMP_AFTER 2          /* records from the xrun on */
+#define JACK_XRUN_DUMP_WAIT_USECS 1000000
+#define JACK_XRUN_DUMP_EVENTS 32
+#define JACK_XRUN_DUMP_EVENT_SIZE 160
+
+typedef struct {
+	jack_time_t when;
+	unsigned long generation;
+	char text[JACK_XRUN_DUMP_EVENT_SIZE];
+} jack_xrun_dump_event_t;
+
+typedef struct {
+	jack_uuid_t uuid;
+	char name[JACK_CLIENT_NAME_SIZE];
+	ClientType type;
+	int active;
+	uint32_t p99_usecs;
+} jack_xrun_dump_client_t;
+
+struct _jack_xrun_dump {
+	char *dir;
+	pthread_t thread;
+	sem_t sem;
+	volatile int run;
+
+	/* w: RT thread while !pending, r: dump thread while pending */
+	volatile int pending;
+	uint64_t trigger_count;         /* trace write_count at the xrun */
+	jack_time_t trigger_time;
+	jack_xrun_cause_t cause;
+	float delayed_usecs;
+	volatile uint32_t missed;       /* xruns during the dump */
+	unsigned int dumps;
+
+	/* w: server thread, graph write lock held */
+	jack_xrun_dump_event_t events[JACK_XRUN_DUMP_EVENTS];
+	unsigned int nevents;           /* ever logged */
+
+	/* dump thread scratch */
+	jack_cycle_trace_record_t *records;
+	jack_xrun_dump_event_t snap_events[JACK_XRUN_DUMP_EVENTS];
+	jack_xrun_dump_client_t *clients;
+	unsigned int nclients;
+	unsigned int clients_size;
+	unsigned long generation;
+};
+
+static const char *jack_xrun_dump_cause_names[JACK_XRUN_CAUSES] = {
+	"driver", "wakeup", "client"
+};
+
+/* copy the record of cycle `cycle' out of the ring, if it is still
+ * there and not being written */
+static int
+jack_xrun_dump_copy_record (const jack_cycle_trace_t *trace, uint64_t cycle,
+			    jack_cycle_trace_record_t *dst)
+{
+	const jack_cycle_trace_record_t *rec = &trace->records[cycle % trace->nrecords];
+	uint32_t seq;
+
+	if ((seq = rec->seq) & 1) {
+		return -1;
+	}
+	__sync_synchronize ();
+	memcpy (dst, (const void*)rec, sizeof(jack_cycle_trace_record_t));
+	__sync_synchronize ();
+
+	if (rec->seq != seq || dst->cycle != cycle) {
+		return -1;
+	}
+	return 0;
+}
+
+static const char *
+jack_xrun_dump_client_name (jack_xrun_dump_t *dump, jack_uuid_t uuid)
+{
+	unsigned int i;
+
+	for (i = 0; i < dump->nclients; i++) {
+		if (jack_uuid_compare (dump->clients[i].uuid, uuid) == 0) {
+			return dump->clients[i].name;
+		}
+	}
+	return "(gone)";
+}
+
+static void
+jack_xrun_dump_snapshot_graph (jack_engine_t *engine, jack_xrun_dump_t *dump,
+			       unsigned int *nevents)
+{
+	JSList *node;
+	unsigned int n = 0;
+
+	jack_rdlock_graph (engine);
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		n++;
+	}
+	if (n > dump->clients_size) {
+		jack_xrun_dump_client_t *clients =
+			realloc (dump->clients, n * sizeof(jack_xrun_dump_client_t));
+		if (clients) {
+			dump->clients = clients;
+			dump->clients_size = n;
+		}
+	}
+
+	n = 0;
+	for (node = engine->clients; node && n < dump->clients_size;
+	     node = jack_slist_next (node)) {
+		jack_client_internal_t *client = (jack_client_internal_t*)node->data;
+		jack_xrun_dump_client_t *c = &dump->clients[n++];
+
+		jack_uuid_copy (&c->uuid, client->control->uuid);
+		snprintf (c->name, sizeof(c->name), "%s", client->control->name);
+		c->type = client->control->type;
+		c->active = client->control->active;
+		c->p99_usecs = client->p99_usecs;
+	}
+	dump->nclients = n;
+
+	memcpy (dump->snap_events, dump->events, sizeof(dump->events));
+	*nevents = dump->nevents;
+	dump->generation = engine->graph_generation;
+
+	jack_unlock_graph (engine);
+}
+
+static void
+jack_xrun_dump_print_offset (FILE *file, uint32_t usecs)
+{
+	if (usecs == JACK_CYCLE_TRACE_NONE) {
+		fprintf (file, " %8s", "-");
+	} else {
+		fprintf (file, " %8" PRIu32, usecs);
+	}
+}
+
+static void
+jack_xrun_dump_write (jack_engine_t *engine, jack_xrun_dump_t *dump,
+		      uint64_t first, uint64_t last, const char *got,
+		      unsigned int nevents, uint32_t missed)
+{
+	jack_control_t *control = engine->control;
+	char path[PATH_MAX + 1];
+	char stamp[32];
+	char uuid[JACK_UUID_STRING_SIZE];
+	struct tm tm;
+	time_t now = time (NULL);
+	FILE *file;
+	uint64_t cycle;
+	unsigned int i, k;
+
+	localtime_r (&now, &tm);
+	strftime (stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+	snprintf (path, sizeof(path), "%s/xrun-%s-%s-%u.txt", dump->dir,
+		  engine->server_name, stamp, ++dump->dumps);
+
+	if ((file = fopen (path, "w")) == NULL) {
+		jack_error ("cannot write xrun dump %s (%s)", path,
+			    strerror (errno));
+		return;
+	}
+
+	strftime (stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+	fprintf (file, "xrun at %s (usecs %" PRIu64 "), cause %s, delayed %.3f usecs\n",
+		 stamp, dump->trigger_time, jack_xrun_dump_cause_names[dump->cause],
+		 dump->delayed_usecs);
+	fprintf (file, "buffer size %" PRIu32 ", rate %" PRIu32 ", period %" PRIu64
+		 " usecs, dsp load %.2f%%, max delay %.3f usecs\n",
+		 control->buffer_size, control->current_time.frame_rate,
+		 engine->driver ? engine->driver->period_usecs : 0,
+		 control->cpu_load, control->max_delayed_usecs);
+	if (missed) {
+		fprintf (file, "%" PRIu32 " more xrun(s) while this was written\n", missed);
+	}
+
+	fprintf (file, "\ngraph order (generation %lu):\n", dump->generation);
+	for (i = 0; i < dump->nclients; i++) {
+		jack_xrun_dump_client_t *c = &dump->clients[i];
+
+		jack_uuid_unparse (c->uuid, uuid);
+		fprintf (file, "  %2u %-32s %s %-8s %s p99 %" PRIu32 " usecs\n",
+			 i, c->name, uuid,
+			 c->type == ClientExternal ? "external" :
+			 c->type == ClientDriver ? "driver" : "internal",
+			 c->active ? "active" : "inactive", c->p99_usecs);
+	}
+
+	fprintf (file, "\nrecent graph changes:\n");
+	k = nevents < JACK_XRUN_DUMP_EVENTS ? nevents : JACK_XRUN_DUMP_EVENTS;
+	for (i = nevents - k; i < nevents; i++) {
+		jack_xrun_dump_event_t *ev = &dump->snap_events[i % JACK_XRUN_DUMP_EVENTS];
+
+		fprintf (file, "  %+12.3f ms  gen %-6lu %s\n",
+			 ((double)ev->when - (double)dump->trigger_time) / 1000.0,
+			 ev->generation, ev->text);
+	}
+
+	fprintf (file, "\ncycles (times in usecs; client times from cycle start):\n");
+	fprintf (file, "    %-32s %8s %8s %8s %8s %8s %8s\n", "client", "signal",
+		 "awake", "finish", "minflt", "majflt", "nivcsw");
+	for (cycle = first; cycle <= last; cycle++) {
+		jack_cycle_trace_record_t *rec = &dump->records[cycle - first];
+
+		if (!got[cycle - first]) {
+			fprintf (file, "  cycle %" PRIu64 ": not recorded\n", cycle);
+			continue;
+		}
+
+		fprintf (file, "  cycle %" PRIu64 "%s%s%s: start %+.3f ms, length %" PRIu64
+			 ", driver wait %.0f, delayed %.3f, recovery %.0f, nframes %" PRIu32 "\n",
+			 rec->cycle,
+			 (rec->flags & JACK_CYCLE_TRACE_XRUN) ? " XRUN" : "",
+			 (rec->flags & JACK_CYCLE_TRACE_FAILED) ? " FAILED" : "",
+			 (rec->flags & JACK_CYCLE_TRACE_TRUNCATED) ? " TRUNCATED" : "",
+			 ((double)rec->cycle_start - (double)dump->trigger_time) / 1000.0,
+			 rec->cycle_end - rec->cycle_start,
+			 rec->driver_wait_usecs, rec->delayed_usecs,
+			 rec->recovery_usecs, rec->nframes);
+
+		for (k = 0; k < rec->nclients && k < JACK_CYCLE_TRACE_MAX_CLIENTS; k++) {
+			jack_cycle_trace_client_t *c = &rec->clients[k];
+
+			fprintf (file, "    %-32s", jack_xrun_dump_client_name (dump, c->uuid));
+			jack_xrun_dump_print_offset (file, c->signalled);
+			jack_xrun_dump_print_offset (file, c->awake);
+			jack_xrun_dump_print_offset (file, c->finished);
+			fprintf (file, " %8u %8u %8u\n", (unsigned int)c->minor_faults,
+				 (unsigned int)c->major_faults,
+				 (unsigned int)c->involuntary_switches);
+		}
+	}
+
+	if (fclose (file) != 0) {
+		jack_error ("cannot write xrun dump %s (%s)", path,
+			    strerror (errno));
+		return;
+	}
+
+	jack_info ("xrun: wrote %s", path);
+}
+
+static void
+jack_xrun_dump_take (jack_engine_t *engine, jack_xrun_dump_t *dump)
+{
+	const jack_cycle_trace_t *trace = engine->trace;
+	uint64_t last = dump->trigger_count + JACK_XRUN_DUMP_AFTER - 1;
+	uint64_t first, cycle;
+	jack_time_t deadline = jack_get_microseconds () + JACK_XRUN_DUMP_WAIT_USECS;
+	unsigned int nevents;
+	char got[JACK_XRUN_DUMP_CYCLES + JACK_XRUN_DUMP_AFTER];
+	uint32_t missed;
+
+	/* let the cycle that saw the xrun, and the next, be recorded;
+	 * the engine may have stopped, so not for ever */
+	while (trace->write_count <= last && dump->run
+	       && jack_get_microseconds () < deadline) {
+		usleep (1000);
+	}
+	if (trace->write_count <= last) {
+		last = trace->write_count ? trace->write_count - 1 : 0;
+	}
+
+	first = last + 1 > JACK_XRUN_DUMP_CYCLES + JACK_XRUN_DUMP_AFTER ?
+		last + 1 - (JACK_XRUN_DUMP_CYCLES + JACK_XRUN_DUMP_AFTER) : 0;
+
+	for (cycle = first; cycle <= last; cycle++) {
+		got[cycle - first] = jack_xrun_dump_copy_record (
+			trace, cycle, &dump->records[cycle - first]) == 0;
+	}
+
+	jack_xrun_dump_snapshot_graph (engine, dump, &nevents);
+
+	missed = dump->missed;
+	dump->missed = 0;
+
+	if (trace->write_count == 0) {
+		first = 1;      /* nothing recorded yet */
+		last = 0;
+	}
+	jack_xrun_dump_write (engine, dump, first, last, got, nevents, missed);
+}
+
+static void *
+jack_xrun_dump_thread (void *arg)
+{
+	jack_engine_t *engine = (jack_engine_t*)arg;
+	jack_xrun_dump_t *dump = engine->xrun_dump;
+
+	while (1) {
+		if (sem_wait (&dump->sem) < 0) {
+			continue;
+		}
+		if (!dump->run) {
+			break;
+		}
+		if (!dump->pending) {
+			continue;
+		}
+
+		__sync_synchronize ();
+		jack_xrun_dump_take (engine, dump);
+		__sync_synchronize ();
+		dump->pending = 0;
+	}
+
+	return NULL;
+}
+
+int
+jack_xrun_dump_init (jack_engine_t *engine, const char *dir)
+{
+	jack_xrun_dump_t *dump;
+	int err;
+
+	engine->xrun_dump = NULL;
+
+	if (engine->trace == NULL) {
+		jack_error ("xrun dumps need the cycle trace");
+		return -1;
+	}
+	if (access (dir, W_OK) < 0) {
+		jack_error ("cannot write xrun dumps to %s (%s)", dir,
+			    strerror (errno));
+		return -1;
+	}
+
+	if ((dump = calloc (1, sizeof(jack_xrun_dump_t))) == NULL) {
+		return -1;
+	}
+	dump->dir = strdup (dir);
+	dump->records = calloc (JACK_XRUN_DUMP_CYCLES + JACK_XRUN_DUMP_AFTER,
+				sizeof(jack_cycle_trace_record_t));
+	if (dump->dir == NULL || dump->records == NULL) {
+		goto fail;
+	}
+	if (sem_init (&dump->sem, 0, 0) < 0) {
+		goto fail;
+	}
+
+	dump->run = 1;
+	engine->xrun_dump = dump;
+
+	if ((err = pthread_create (&dump->thread, NULL, jack_xrun_dump_thread,
+				   engine)) != 0) {
+		jack_error ("cannot start xrun dump thread (%s)", strerror (err));
+		engine->xrun_dump = NULL;
+		sem_destroy (&dump->sem);
+		goto fail;
+	}
+
+	VERBOSE (engine, "xrun dumps go to %s", dir);
+	return 0;
+
+fail:
+	free (dump->records);
+	free (dump->dir);
+	free (dump);
+	return -1;
+}
+
+void
+jack_xrun_dump_close (jack_engine_t *engine)
+{
+	jack_xrun_dump_t *dump = engine->xrun_dump;
+
+	if (dump == NULL) {
+		return;
+	}
+
+	dump->run = 0;
+	sem_post (&dump->sem);
+	pthread_join (dump->thread, NULL);
+	sem_destroy (&dump->sem);
+
+	engine->xrun_dump = NULL;
+	free (dump->clients);
+	free (dump->records);
+	free (dump->dir);
+	free (dump);
+}
+
+/* Called on the thread that noticed the xrun, realtime or not;
+ * sem_post() does not block. */
+void
+jack_xrun_dump_trigger (jack_engine_t *engine, jack_xrun_cause_t cause,
+			float delayed_usecs)
+{
+	jack_xrun_dump_t *dump = engine->xrun_dump;
+
+	if (dump->pending) {
+		dump->missed++;
+		return;
+	}
+
+	dump->trigger_count = engine->trace->write_count;
+	dump->trigger_time = jack_get_microseconds ();
+	dump->cause = cause;
+	dump->delayed_usecs = delayed_usecs;
+	__sync_synchronize ();
+	dump->pending = 1;
+
+	sem_post (&dump->sem);
+}
+
+/* Log a change to the graph; the caller holds the graph write lock. */
+void
+jack_xrun_dump_graph_event (jack_engine_t *engine, const char *fmt, ...)
+{
+	jack_xrun_dump_t *dump = engine->xrun_dump;
+	jack_xrun_dump_event_t *ev;
+	va_list ap;
+
+	if (dump == NULL) {
+		return;
+	}
+
+	ev = &dump->events[dump->nevents % JACK_XRUN_DUMP_EVENTS];
+	ev->when = jack_get_microseconds ();
+	ev->generation = engine->graph_generation;
+	va_start (ap, fmt);
+	vsnprintf (ev->text, sizeof(ev->text), fmt, ap);
+	va_end (ap);
+	dump->nevents++;
+}
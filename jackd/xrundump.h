@@ -0,0 +1,24 @@
+/*
+ *  Xrun flight recorder.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+int     jack_xrun_dump_init(jack_engine_t *engine, const char *dir);
+void    jack_xrun_dump_close(jack_engine_t *engine);
+void    jack_xrun_dump_trigger(jack_engine_t *engine, jack_xrun_cause_t cause,
+			       float delayed_usecs);
+void    jack_xrun_dump_graph_event(jack_engine_t *engine, const char *fmt, ...);
@@ -27,11 +27,13 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <limits.h>
+#include <math.h>
 #ifdef HAVE_STDINT_H
 #include <stdint.h>
 #endif
 #include <regex.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -45,14 +47,17 @@
 #include <jack/uuid.h>
 
 #include "internal.h"
-#include "engine.h"
 #include "pool.h"
+#include "engine.h"
 #include "version.h"
 #include "shm.h"
 #include "unlock.h"
 #include "varargs.h"
+#include "cpufeatures.h"
 #include "intsimd.h"
 #include "messagebuffer.h"
+#include "propertystore.h"
+#include "probes.h"
 
 #include <sysdeps/time.h>
 
@@ -83,42 +88,6 @@ typedef struct {
 	const char *client_name;
 } client_info;
 
-#ifdef USE_DYNSIMD
-
-#ifdef ARCH_X86
-
-int cpu_type = 0;
-
-static void
-init_cpu ()
-{
-	cpu_type = ((have_3dnow () << 8) | have_sse ());
-#if 0
-	if (ARCH_X86_HAVE_3DNOW (cpu_type)) {
-		jack_debug ("Enhanced3DNow! detected");
-	}
-	if (ARCH_X86_HAVE_SSE2 (cpu_type)) {
-		jack_debug ("SSE2 detected");
-	}
-	if ((!ARCH_X86_HAVE_3DNOW (cpu_type)) && (!ARCH_X86_HAVE_SSE2 (cpu_type))) {
-		jack_debug ("No supported SIMD instruction sets detected");
-	}
-#endif
-	jack_port_set_funcs ();
-}
-
-#else /* ARCH_X86 */
-
-static void
-init_cpu ()
-{
-	jack_port_set_funcs ();
-}
-
-#endif  /* ARCH_X86 */
-
-#endif  /* USE_DYNSIMD */
-
 const char *
 jack_get_tmpdir ()
 {
@@ -246,31 +215,403 @@ jack_info (const char *fmt, ...)
 	va_end (ap);
 }
 
+#define JACK_REQUEST_MEMBER_SIZE(m) sizeof(((jack_request_t*)0)->x.m)
+
+/* How much of the x union a request of this type, and its reply,
+ * carry on the request socket: the larger of the members they use.
+ * Types not listed here send all of it.
+ */
+size_t
+jack_request_size (uint32_t type)
+{
+	switch (type) {
+	case RegisterPort:
+	case UnRegisterPort:
+	case DisconnectPort:
+	case GetPortConnections:
+	case GetPortNConnections:
+	case GetClientByUUID:
+	case RecomputeTotalLatency:
+		return JACK_REQUEST_MEMBER_SIZE (port_info);
+	case ConnectPorts:
+	case DisconnectPorts:
+	case PortNameChanged:
+		return JACK_REQUEST_MEMBER_SIZE (connect);
+	case SetConnectionGain:
+		return JACK_REQUEST_MEMBER_SIZE (connection_gain);
+	case ConnectBatch:
+		return JACK_REQUEST_MEMBER_SIZE (connect_batch);
+	case PortBatch:
+		return JACK_REQUEST_MEMBER_SIZE (port_batch);
+	case PropertyBatch:
+		return JACK_REQUEST_MEMBER_SIZE (property_batch);
+	case SetTimeBaseClient:
+		return JACK_REQUEST_MEMBER_SIZE (timebase);
+	case ActivateClient:
+	case DeactivateClient:
+	case ResetTimeBaseClient:
+	case SetSyncClient:
+	case ResetSyncClient:
+	case FreeWheel:
+	case StopFreeWheel:
+	case RecomputeTotalLatencies:
+	case SessionReply:
+	case GraphBatchBegin:
+	case GraphBatchEnd:
+		return JACK_REQUEST_MEMBER_SIZE (client_id);
+	case GetUUIDByClientName:       /* the reply is a client_id */
+	case SessionHasCallback:
+		return JACK_REQUEST_MEMBER_SIZE (name);
+	case SetSyncTimeout:
+		return JACK_REQUEST_MEMBER_SIZE (timeout);
+	case SetTempoMap:
+		return JACK_REQUEST_MEMBER_SIZE (tempo_map);
+	case SetClientCapabilities:
+		return JACK_REQUEST_MEMBER_SIZE (cap_pid);
+	case SetBufferSize:
+	case SetSampleRate:
+	case SetFreeWheelBufferSize:
+		return JACK_REQUEST_MEMBER_SIZE (nframes);
+	case FreeWheelRange:
+		return JACK_REQUEST_MEMBER_SIZE (freewheel_range);
+	case PortTypeRegister:
+		return JACK_REQUEST_MEMBER_SIZE (port_type);
+	case SessionNotify:
+		return JACK_REQUEST_MEMBER_SIZE (session);
+	case ReserveName:
+		return JACK_REQUEST_MEMBER_SIZE (reservename);
+	case GetClientLoad:
+		return JACK_REQUEST_MEMBER_SIZE (client_load);
+	case PropertyChangeNotify:
+	case PropertyRemove:
+		return JACK_REQUEST_MEMBER_SIZE (property);
+	case PropertySet:
+		return JACK_REQUEST_MEMBER_SIZE (property_set);
+	case PropertyRemoveAll:
+		return 0;
+	default:
+		return sizeof(((jack_request_t*)0)->x);
+	}
+}
+
+/* Move everything `iov' describes over `fd', in as few calls as the
+ * socket allows; `iov' is used up on the way. Returns 1 when it is all
+ * done, 0 if the peer had closed before anything moved, else -1.
+ */
+static int
+jack_request_transfer (int fd, struct iovec *iov, int iovcnt, int out)
+{
+	size_t moved = 0;
+	ssize_t n;
+
+	while (iovcnt > 0) {
+		if (iov->iov_len == 0) {
+			++iov;
+			--iovcnt;
+			continue;
+		}
+		n = out ? writev (fd, iov, iovcnt) : readv (fd, iov, iovcnt);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return (n == 0 && moved == 0) ? 0 : -1;
+		}
+		moved += n;
+		while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			++iov;
+			--iovcnt;
+		}
+		if (n > 0) {
+			iov->iov_base = (char*)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	return 1;
+}
+
+int
+jack_request_readv (int fd, struct iovec *iov, int iovcnt)
+{
+	return jack_request_transfer (fd, iov, iovcnt, FALSE);
+}
+
+int
+jack_request_writev (int fd, struct iovec *iov, int iovcnt)
+{
+	return jack_request_transfer (fd, iov, iovcnt, TRUE);
+}
+
+/* Frame a request or a reply (see jack_request_header_t), and write
+ * it and up to JACK_REQUEST_IOV_MAX pieces of out of line data with
+ * one writev() when the socket takes it all.
+ */
+int
+jack_request_send (int fd, jack_request_t *req, const struct iovec *extra, int nextra)
+{
+	jack_request_header_t hdr;
+	struct iovec iov[2 + JACK_REQUEST_IOV_MAX];
+	int n;
+
+	hdr.type = req->type;
+	hdr.size = jack_request_size (req->type);
+	hdr.status = req->status;
+
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = &req->x;
+	iov[1].iov_len = hdr.size;
+
+	for (n = 0; n < nextra && n < JACK_REQUEST_IOV_MAX; ++n) {
+		iov[2 + n] = extra[n];
+	}
+
+	return jack_request_writev (fd, iov, 2 + n) == 1 ? 0 : -1;
+}
+
+/* Read one framed request. Returns 1 when it has one, 0 if the peer
+ * has closed the socket, else -1. Whatever of the type's part of x
+ * the sender left out reads as zeroes.
+ */
+int
+jack_request_recv (int fd, jack_request_t *req)
+{
+	jack_request_header_t hdr;
+	struct iovec iov;
+	size_t want;
+	int r;
+
+	iov.iov_base = &hdr;
+	iov.iov_len = sizeof(hdr);
+
+	if ((r = jack_request_readv (fd, &iov, 1)) <= 0) {
+		return r;
+	}
+
+	if (hdr.size > sizeof(req->x)) {
+		jack_error ("request of type %" PRIu32 " claims %" PRIu32
+			    " bytes", hdr.type, hdr.size);
+		errno = EPROTO;
+		return -1;
+	}
+
+	req->type = hdr.type;
+	req->status = hdr.status;
+
+	iov.iov_base = &req->x;
+	iov.iov_len = hdr.size;
+
+	if (jack_request_readv (fd, &iov, 1) != 1) {
+		return -1;
+	}
+
+	want = jack_request_size (hdr.type);
+	if (hdr.size < want) {
+		memset ((char*)&req->x + hdr.size, 0, want - hdr.size);
+	}
+
+	return 1;
+}
+
+/* Whether a request of this type may use the shared memory request
+ * channel: not if it carries data out of line, or if its reply does
+ * not fit in the request.
+ */
+int
+jack_request_shm_ok (uint32_t type)
+{
+	switch (type) {
+	case ConnectBatch:
+	case PortBatch:
+	case PropertyBatch:
+	case PropertyChangeNotify:
+	case PropertySet:
+	case PropertyRemove:
+	case GetPortConnections:
+	case GetPortNConnections:
+	case SessionNotify:
+		return FALSE;
+	default:
+		return TRUE;
+	}
+}
+
+/* Copy a request into or out of a shared memory request slot, only as
+ * much of it as its type uses.
+ */
+void
+jack_request_copy (jack_request_t *dst, const jack_request_t *src)
+{
+	uint32_t type = src->type;      /* the other side may change it */
+
+	dst->type = type;
+	dst->status = src->status;
+	memcpy (&dst->x, (const void*)&src->x, jack_request_size (type));
+}
+
+/* how long the client waits for a reply before it checks the server is
+   still there */
+#define JACK_SHM_REQUEST_POLL 100000    /* usecs */
+
+static int
+oop_client_server_gone (jack_client_t *client)
+{
+	struct pollfd pfd;
+
+	if (client->engine->engine_ok == 0) {
+		return TRUE;
+	}
+
+	/* nothing arrives on the request socket unasked, so anything
+	   there means the server closed it */
+	pfd.fd = client->request_fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	return poll (&pfd, 1, 0) > 0;
+}
+
+static int
+oop_client_deliver_shm_request (jack_client_t *client, jack_request_t *req)
+{
+	jack_client_control_t *control = client->control;
+	uint32_t seq;
+
+	pthread_mutex_lock (&client->shm_request_lock);
+
+	jack_request_copy ((jack_request_t*)jack_client_shm_request (control), req);
+	seq = control->request_seq + 1;
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+	control->request_seq = seq;
+	jack_wakeup_post (&client->engine->request_wakeup, JACK_WAKEUP_EVENT);
+
+	while (control->reply_seq != seq) {
+		if (jack_wakeup_wait (&control->request_done, JACK_SHM_REQUEST_POLL) < 0
+		    || oop_client_server_gone (client)) {
+			pthread_mutex_unlock (&client->shm_request_lock);
+			if (client->engine->engine_ok) {
+				jack_error ("no reply to request type %d from"
+					    " server", req->type);
+			}
+			req->status = -1;
+			return req->status;
+		}
+	}
+
+	__atomic_thread_fence (__ATOMIC_ACQUIRE);
+	jack_request_copy (req, (jack_request_t*)jack_client_shm_request (control));
+
+	pthread_mutex_unlock (&client->shm_request_lock);
+
+	return req->status;
+}
+
 static int
 oop_client_deliver_request (void *ptr, jack_request_t *req)
 {
 	int wok, rok;
 	jack_client_t *client = (jack_client_t*)ptr;
+	jack_connection_op_t *ops = NULL;
+	jack_port_op_t *port_ops = NULL;
+	uint32_t nops = 0;
+	uint32_t n;
+	int32_t status[JACK_CONNECT_BATCH_MAX];
+	jack_port_id_t ids[JACK_PORT_BATCH_MAX];
+	struct iovec extra[JACK_REQUEST_IOV_MAX];
+	int nextra = 0;
+	jack_request_header_t hdr;
+	struct iovec iov[4];
+	int niov;
+
+	if (client->control->shm_requests && jack_request_shm_ok (req->type)) {
+		return oop_client_deliver_shm_request (client, req);
+	}
+
+	/* variable length key (and value) data goes out with a property
+	   request, and the changes with a connection or port batch
+	 */
+
+	switch (req->type) {
+	case PropertyChangeNotify:
+	case PropertyRemove:
+		extra[nextra].iov_base = (void*)req->x.property.key;
+		extra[nextra++].iov_len = req->x.property.keylen;
+		break;
+	case PropertySet:
+		extra[nextra].iov_base = (void*)req->x.property_set.key;
+		extra[nextra++].iov_len = req->x.property_set.keylen;
+		extra[nextra].iov_base = (void*)req->x.property_set.value;
+		extra[nextra++].iov_len = req->x.property_set.valuelen;
+		extra[nextra].iov_base = (void*)req->x.property_set.type;
+		extra[nextra++].iov_len = req->x.property_set.typelen;
+		break;
+	case ConnectBatch:
+		ops = req->x.connect_batch.ops;
+		nops = req->x.connect_batch.count;
+		extra[nextra].iov_base = ops;
+		extra[nextra++].iov_len = nops * sizeof(*ops);
+		break;
+	case PropertyBatch:
+		extra[nextra].iov_base = (void*)req->x.property_batch.data;
+		extra[nextra++].iov_len = req->x.property_batch.size;
+		break;
+	case PortBatch:
+		port_ops = req->x.port_batch.ops;
+		nops = req->x.port_batch.count;
+		extra[nextra].iov_base = port_ops;
+		extra[nextra++].iov_len = nops * sizeof(*port_ops);
+		break;
+	default:
+		break;
+	}
 
-	wok = (write (client->request_fd, req, sizeof(*req))
-	       == sizeof(*req));
+	wok = (jack_request_send (client->request_fd, req, extra, nextra) == 0);
 
-	/* if necessary, add variable length key data after a PropertyChange request
+	/* the server follows a connection batch reply with one status per
+	   change, and a port batch reply with those and then one port ID
+	   per change; read the lot at once
 	 */
 
-	if (req->type == PropertyChangeNotify) {
-		if (req->x.property.keylen) {
-			if (write (client->request_fd, req->x.property.key, req->x.property.keylen) != req->x.property.keylen) {
-				jack_error ("cannot send property key of length %d to server",
-					    req->x.property.keylen);
-				req->status = -1;
-				return req->status;
-			}
+	hdr.size = 0;
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = &req->x;
+	iov[1].iov_len = jack_request_size (req->type);
+	niov = 2;
+
+	if ((ops || port_ops) && nops) {
+		iov[niov].iov_base = status;
+		iov[niov++].iov_len = nops * sizeof(int32_t);
+	}
+	if (port_ops && nops) {
+		iov[niov].iov_base = ids;
+		iov[niov++].iov_len = nops * sizeof(jack_port_id_t);
+	}
+
+	rok = wok
+	      && (jack_request_readv (client->request_fd, iov, niov) == 1)
+	      && (hdr.size == jack_request_size (req->type));
+
+	if (rok) {
+		req->status = hdr.status;
+	}
+
+	if (ops) {
+		for (n = 0; rok && n < nops; ++n) {
+			ops[n].status = status[n];
 		}
+		req->x.connect_batch.ops = ops;
 	}
 
-	rok = (read (client->request_fd, req, sizeof(*req))
-	       == sizeof(*req));
+	if (port_ops) {
+		for (n = 0; rok && n < nops; ++n) {
+			port_ops[n].status = status[n];
+			port_ops[n].port_id = ids[n];
+		}
+		req->x.port_batch.ops = port_ops;
+	}
 
 	if (wok && rok) {               /* everything OK? */
 		return req->status;
@@ -287,8 +628,7 @@ oop_client_deliver_request (void *ptr, jack_request_t *req)
 	if (!wok) {
 		jack_error ("cannot send request type %d to server",
 			    req->type);
-	}
-	if (!rok) {
+	} else if (!rok) {
 		jack_error ("cannot read result for request type %d from"
 			    " server (%s)", req->type, strerror (errno));
 	}
@@ -306,6 +646,18 @@ jack_client_deliver_request (const jack_client_t *client, jack_request_t *req)
 	return client->deliver_request (client->deliver_arg, req);
 }
 
+static int
+jack_warmup_default_cycles (void)
+{
+	const char *str = getenv ("JACK_WARMUP_CYCLES");
+	int cycles = str ? atoi (str) : 0;
+
+	if (cycles < 0) {
+		return 0;
+	}
+	return cycles < JACK_WARMUP_MAX ? cycles : JACK_WARMUP_MAX;
+}
+
 #if JACK_USE_MACH_THREADS
 
 jack_client_t *
@@ -327,6 +679,9 @@ jack_client_alloc ()
 	client->event_fd = -1;
 	client->upstream_is_jackd = 0;
 	client->graph_next_fd = -1;
+	client->graph_wait_slot = -1;
+	client->graph_next_slot = -1;
+	client->graph_wait_pending = 0;
 	client->ports = NULL;
 	client->ports_ext = NULL;
 	client->engine = NULL;
@@ -338,10 +693,27 @@ jack_client_alloc ()
 	client->on_info_shutdown = NULL;
 	client->n_port_types = 0;
 	client->port_segment = NULL;
-
-#ifdef USE_DYNSIMD
-	init_cpu ();
-#endif  /* USE_DYNSIMD */
+	client->port_segment_pending = 0;
+	client->rt_pool = NULL;
+	client->rt_pool_size = jack_rt_pool_default_size ();
+	client->warmup_cycles = jack_warmup_default_cycles ();
+	client->warming_up = FALSE;
+	client->warmed_up = FALSE;
+	client->process_cpus[0] = '\0';
+	memset (&client->deadline, 0, sizeof(client->deadline));
+	jack_perf_counters_init (&client->perf);
+	client->freewheeling = 0;
+	pthread_mutex_init (&client->shm_request_lock, NULL);
+	pthread_mutex_init (&client->regex_lock, NULL);
+	client->regex_cache = NULL;
+	client->regex_clock = 0;
+	pthread_mutex_init (&client->mix_lock, NULL);
+	client->mix_chunks = NULL;
+	client->mix_slot_size = 0;
+	client->mix_slots = 0;
+	client->mix_reserved = 0;
+
+	jack_cpu_dispatch_init ();
 
 	return client;
 }
@@ -367,6 +739,11 @@ jack_client_alloc ()
 	client->upstream_is_jackd = 0;
 	client->graph_wait_fd = -1;
 	client->graph_next_fd = -1;
+	client->graph_wait_slot = -1;
+	client->graph_next_slot = -1;
+	client->graph_wait_pending = 0;
+	client->fifo_fds = NULL;
+	client->fifo_size = 0;
 	client->ports = NULL;
 	client->ports_ext = NULL;
 	client->engine = NULL;
@@ -377,10 +754,27 @@ jack_client_alloc ()
 	client->on_info_shutdown = NULL;
 	client->n_port_types = 0;
 	client->port_segment = NULL;
-
-#ifdef USE_DYNSIMD
-	init_cpu ();
-#endif  /* USE_DYNSIMD */
+	client->port_segment_pending = 0;
+	client->rt_pool = NULL;
+	client->rt_pool_size = jack_rt_pool_default_size ();
+	client->warmup_cycles = jack_warmup_default_cycles ();
+	client->warming_up = FALSE;
+	client->warmed_up = FALSE;
+	client->process_cpus[0] = '\0';
+	memset (&client->deadline, 0, sizeof(client->deadline));
+	jack_perf_counters_init (&client->perf);
+	client->freewheeling = 0;
+	pthread_mutex_init (&client->shm_request_lock, NULL);
+	pthread_mutex_init (&client->regex_lock, NULL);
+	client->regex_cache = NULL;
+	client->regex_clock = 0;
+	pthread_mutex_init (&client->mix_lock, NULL);
+	client->mix_chunks = NULL;
+	client->mix_slot_size = 0;
+	client->mix_slots = 0;
+	client->mix_reserved = 0;
+
+	jack_cpu_dispatch_init ();
 
 	return client;
 }
@@ -402,121 +796,394 @@ jack_client_alloc_internal (jack_client_control_t *cc, jack_engine_t* engine)
 
 	client->n_port_types = client->engine->n_port_types;
 	client->port_segment = &engine->port_segment[0];
+	jack_port_set_period (client->engine->buffer_size);
 
 	return client;
 }
 
-static void
-jack_client_free (jack_client_t *client)
+
+/* Mixdown arena.  An input port with more than one connection mixes
+ * into a buffer of its own.  Those buffers are slots of a few
+ * contiguous chunks per client, each slot big enough for any port type
+ * at the largest period the server allows.  A slot is reserved when an
+ * input port is registered, so that connection events only hand out
+ * slots that already exist.
+ */
+
+#define JACK_MIX_CHUNK_SLOTS 16
+
+typedef struct _jack_mix_chunk {
+	struct _jack_mix_chunk *next;
+	char *base;
+	uint32_t used;                  /* one bit per slot handed out */
+} jack_mix_chunk_t;
+
+static size_t
+jack_mix_slot_size (jack_client_t *client)
 {
-	if (client->pollfd) {
-		free (client->pollfd);
+	jack_control_t *engine = client->engine;
+	jack_nframes_t nframes = engine->buffer_size;
+	jack_port_type_id_t ptid;
+	size_t size = 0;
+	size_t s;
+
+	if (engine->max_buffer_size > nframes) {
+		nframes = engine->max_buffer_size;
 	}
 
-	free (client);
+	for (ptid = 0; ptid < engine->n_port_types; ++ptid) {
+		if (engine->port_types[ptid].flags & JACK_PORT_TYPE_RUNTIME) {
+			/* see jack_port_mix_take() */
+			continue;
+		}
+		s = jack_port_type_buffer_size (&engine->port_types[ptid],
+						nframes);
+		if (s > size) {
+			size = s;
+		}
+	}
+
+	return (size + JACK_CACHE_LINE - 1) & ~((size_t)JACK_CACHE_LINE - 1);
 }
 
-void
-jack_client_fix_port_buffers (jack_client_t *client)
+/* call with client->mix_lock held */
+static int
+jack_mix_chunk_add (jack_client_t *client)
 {
-	JSList *node;
-	jack_port_t *port;
+	jack_mix_chunk_t *chunk;
+	void *base;
 
-	/* This releases all local memory owned by input ports
-	   and sets the buffer pointer to NULL. This will cause
-	   jack_port_get_buffer() to reallocate space for the
-	   buffer on the next call (if there is one).
-	 */
+	if ((chunk = (jack_mix_chunk_t*)malloc (sizeof(*chunk))) == NULL) {
+		return -1;
+	}
+	if (posix_memalign (&base, JACK_CACHE_LINE,
+			    JACK_MIX_CHUNK_SLOTS * client->mix_slot_size)) {
+		free (chunk);
+		return -1;
+	}
 
-	for (node = client->ports; node; node = jack_slist_next (node)) {
-		port = (jack_port_t*)node->data;
+	/* stays locked after it is freed, since the pages at either end
+	   may be shared with another chunk */
+	jack_mlock_rt_region (base, JACK_MIX_CHUNK_SLOTS * client->mix_slot_size,
+			      "mixdown memory");
 
-		if (port->shared->flags & JackPortIsInput) {
-			if (port->mix_buffer) {
-				size_t buffer_size =
-					jack_port_type_buffer_size ( port->type_info,
-								     client->engine->buffer_size );
-				jack_pool_release (port->mix_buffer);
-				port->mix_buffer = NULL;
-				pthread_mutex_lock (&port->connection_lock);
-				if (jack_slist_length (port->connections) > 1) {
-					port->mix_buffer = jack_pool_alloc (buffer_size);
-					port->fptr.buffer_init (port->mix_buffer,
-								buffer_size,
-								client->engine->buffer_size);
-				}
-				pthread_mutex_unlock (&port->connection_lock);
-			}
+	chunk->base = (char*)base;
+	chunk->used = 0;
+	chunk->next = client->mix_chunks;
+	client->mix_chunks = chunk;
+	client->mix_slots += JACK_MIX_CHUNK_SLOTS;
+
+	return 0;
+}
+
+/* call with client->mix_lock held */
+static void *
+jack_mix_slot_take (jack_client_t *client)
+{
+	jack_mix_chunk_t *chunk;
+	int slot;
+
+	for (chunk = client->mix_chunks; chunk; chunk = chunk->next) {
+		if (chunk->used != (uint32_t)((1ULL << JACK_MIX_CHUNK_SLOTS) - 1)) {
+			slot = ffs (~chunk->used) - 1;
+			chunk->used |= 1U << slot;
+			return chunk->base + slot * client->mix_slot_size;
 		}
 	}
+
+	/* only if a reservation failed at registration */
+	jack_error ("mixdown arena exhausted, growing it");
+	if (client->mix_slot_size == 0) {
+		client->mix_slot_size = jack_mix_slot_size (client);
+	}
+	if (jack_mix_chunk_add (client)) {
+		return NULL;
+	}
+	client->mix_chunks->used = 1;
+	return client->mix_chunks->base;
 }
 
-int
-jack_client_handle_port_connection (jack_client_t *client, jack_event_t *event)
+/* call with client->mix_lock held */
+static void
+jack_mix_slot_give (jack_client_t *client, void *buffer)
 {
-	jack_port_t *control_port;
-	jack_port_t *other = 0;
-	JSList *node;
-	int need_free = FALSE;
+	jack_mix_chunk_t *chunk;
+	size_t offset;
+
+	for (chunk = client->mix_chunks; chunk; chunk = chunk->next) {
+		if ((char*)buffer >= chunk->base) {
+			offset = (char*)buffer - chunk->base;
+			if (offset < JACK_MIX_CHUNK_SLOTS * client->mix_slot_size) {
+				chunk->used &= ~(1U << (offset / client->mix_slot_size));
+				return;
+			}
+		}
+	}
+}
 
-	if (jack_uuid_compare (client->engine->ports[event->x.self_id].client_id, client->control->uuid) == 0 ||
-	    jack_uuid_compare (client->engine->ports[event->y.other_id].client_id, client->control->uuid) == 0) {
+/* call with client->mix_lock held */
+static void
+jack_mix_chunks_free (jack_client_t *client)
+{
+	jack_mix_chunk_t *chunk;
 
-		/* its one of ours */
+	while ((chunk = client->mix_chunks) != NULL) {
+		client->mix_chunks = chunk->next;
+		free (chunk->base);
+		free (chunk);
+	}
+	client->mix_slots = 0;
+}
 
-		switch (event->type) {
-		case PortConnected:
-			other = jack_port_new (client, event->y.other_id,
-					       client->engine);
-			/* jack_port_by_id_int() always returns an internal
-			 * port that does not need to be deallocated
-			 */
-			control_port = jack_port_by_id_int (client, event->x.self_id,
-							    &need_free);
-			pthread_mutex_lock (&control_port->connection_lock);
+/* Types registered at run time may have buffers of megabytes, too big
+ * for the arena, where every input port reserves a slot the size of the
+ * largest. Their input ports get a mixdown buffer of their own instead,
+ * while they have several connections. Call with client->mix_lock held.
+ */
+static void *
+jack_port_mix_take (jack_client_t *client, jack_port_t *port)
+{
+	size_t size = port->type_info->buffer_size;
+	void *buffer;
 
-			if ((control_port->shared->flags & JackPortIsInput)
-			    && (control_port->connections != NULL)
-			    && (control_port->mix_buffer == NULL)  ) {
-				size_t buffer_size =
-					jack_port_type_buffer_size ( control_port->type_info,
-								     client->engine->buffer_size );
-				control_port->mix_buffer = jack_pool_alloc (buffer_size);
-				control_port->fptr.buffer_init (control_port->mix_buffer,
-								buffer_size,
-								client->engine->buffer_size);
-			}
+	if (!(port->type_info->flags & JACK_PORT_TYPE_RUNTIME)) {
+		return jack_mix_slot_take (client);
+	}
 
-			control_port->connections =
-				jack_slist_prepend (control_port->connections,
-						    (void*)other);
-			pthread_mutex_unlock (&control_port->connection_lock);
-			break;
+	if (posix_memalign (&buffer, JACK_CACHE_LINE, size)) {
+		jack_error ("cannot allocate a mixdown buffer of %zu bytes",
+			    size);
+		return NULL;
+	}
+	jack_mlock_rt_region (buffer, size, "mixdown memory");
 
-		case PortDisconnected:
-			/* jack_port_by_id_int() always returns an internal
-			 * port that does not need to be deallocated
-			 */
-			control_port = jack_port_by_id_int (client, event->x.self_id,
-							    &need_free);
-			pthread_mutex_lock (&control_port->connection_lock);
+	return buffer;
+}
 
-			for (node = control_port->connections; node;
-			     node = jack_slist_next (node)) {
+/* call with client->mix_lock held */
+static void
+jack_port_mix_give (jack_client_t *client, jack_port_t *port)
+{
+	if (port->type_info->flags & JACK_PORT_TYPE_RUNTIME) {
+		free (port->mix_buffer);
+	} else {
+		jack_mix_slot_give (client, port->mix_buffer);
+	}
+	port->mix_buffer = NULL;
+}
 
-				other = (jack_port_t*)node->data;
+/* free the mix buffers of runtime type ports, which are not in the
+ * arena */
+static void
+jack_mix_runtime_free (jack_client_t *client)
+{
+	JSList *node;
+	jack_port_t *port;
+
+	for (node = client->ports; node; node = jack_slist_next (node)) {
+		port = (jack_port_t*)node->data;
+		if (port->mix_buffer
+		    && (port->type_info->flags & JACK_PORT_TYPE_RUNTIME)) {
+			free (port->mix_buffer);
+			port->mix_buffer = NULL;
+		}
+	}
+}
+
+static void
+jack_mix_arena_free (jack_client_t *client)
+{
+	jack_mix_chunks_free (client);
+	client->mix_reserved = 0;
+}
+
+int
+jack_client_mix_reserve (jack_client_t *client)
+{
+	int ret = 0;
+
+	pthread_mutex_lock (&client->mix_lock);
+
+	if (client->mix_slot_size == 0) {
+		client->mix_slot_size = jack_mix_slot_size (client);
+	}
+	if (client->mix_reserved == client->mix_slots) {
+		ret = jack_mix_chunk_add (client);
+	}
+	if (ret == 0) {
+		client->mix_reserved++;
+	}
+
+	pthread_mutex_unlock (&client->mix_lock);
+
+	return ret;
+}
+
+static void
+jack_client_free (jack_client_t *client)
+{
+	if (client->pollfd) {
+		free (client->pollfd);
+	}
+
+	if (client->rt_pool) {
+		jack_rt_pool_destroy (client->rt_pool);
+	}
+
+	pthread_mutex_destroy (&client->shm_request_lock);
+	jack_client_regex_free (client);
+	pthread_mutex_destroy (&client->regex_lock);
+
+	jack_mix_arena_free (client);
+	pthread_mutex_destroy (&client->mix_lock);
+
+	free (client);
+}
+
+void
+jack_client_fix_port_buffers (jack_client_t *client)
+{
+	JSList *node;
+	jack_port_t *port;
+	size_t slot_size;
+	size_t buffer_size;
+
+	/* Input ports keep their mixdown slot across a period change
+	   as long as it is big enough for the new period.  Otherwise
+	   the arena is rebuilt, with room for every reservation, and
+	   the ports that mix are handed new slots.  Ports that are
+	   down to one connection give theirs back.
+	 */
+
+	pthread_mutex_lock (&client->mix_lock);
+
+	if (client->mix_chunks) {
+		slot_size = jack_mix_slot_size (client);
+		if (slot_size > client->mix_slot_size) {
+			for (node = client->ports; node; node = jack_slist_next (node)) {
+				port = (jack_port_t*)node->data;
+				if (!(port->type_info->flags & JACK_PORT_TYPE_RUNTIME)) {
+					port->mix_buffer = NULL;
+				}
+			}
+			jack_mix_chunks_free (client);
+			client->mix_slot_size = slot_size;
+			while (client->mix_slots < client->mix_reserved) {
+				if (jack_mix_chunk_add (client)) {
+					jack_error ("cannot rebuild mixdown arena");
+					break;
+				}
+			}
+		}
+	}
+
+	for (node = client->ports; node; node = jack_slist_next (node)) {
+		port = (jack_port_t*)node->data;
+
+		if (!(port->shared->flags & JackPortIsInput)) {
+			continue;
+		}
+
+		pthread_mutex_lock (&port->connection_lock);
+		if (jack_slist_length (port->connections) > 1 || port->gained) {
+			if (port->mix_buffer == NULL) {
+				port->mix_buffer = jack_port_mix_take (client, port);
+			}
+			if (port->mix_buffer) {
+				buffer_size = jack_port_type_buffer_size (
+					port->type_info, client->engine->buffer_size);
+				port->fptr.buffer_init (port->mix_buffer,
+							buffer_size,
+							client->engine->buffer_size);
+			}
+		} else if (port->mix_buffer) {
+			jack_port_mix_give (client, port);
+		}
+		jack_port_buffer_invalidate (port);
+		pthread_mutex_unlock (&port->connection_lock);
+	}
+
+	pthread_mutex_unlock (&client->mix_lock);
+}
+
+int
+jack_client_handle_port_connection (jack_client_t *client, jack_event_t *event)
+{
+	jack_port_t *control_port;
+	jack_port_t *other = 0;
+	JSList *node;
+	int need_free = FALSE;
+
+	jack_graph_mirror_event (client, event);
+
+	if (jack_uuid_compare (client->engine->ports[event->x.self_id].client_id, client->control->uuid) == 0 ||
+	    jack_uuid_compare (client->engine->ports[event->y.other_id].client_id, client->control->uuid) == 0) {
+
+		/* its one of ours */
+
+		switch (event->type) {
+		case PortConnected:
+			other = jack_port_new (client, event->y.other_id,
+					       client->engine);
+			/* jack_port_by_id_int() always returns an internal
+			 * port that does not need to be deallocated
+			 */
+			control_port = jack_port_by_id_int (client, event->x.self_id,
+							    &need_free);
+			pthread_mutex_lock (&control_port->connection_lock);
+
+			if ((control_port->shared->flags & JackPortIsInput)
+			    && (control_port->connections != NULL)
+			    && (control_port->mix_buffer == NULL)  ) {
+				size_t buffer_size =
+					jack_port_type_buffer_size ( control_port->type_info,
+								     client->engine->buffer_size );
+				pthread_mutex_lock (&client->mix_lock);
+				control_port->mix_buffer =
+					jack_port_mix_take (client, control_port);
+				pthread_mutex_unlock (&client->mix_lock);
+				if (control_port->mix_buffer) {
+					control_port->fptr.buffer_init (control_port->mix_buffer,
+									buffer_size,
+									client->engine->buffer_size);
+				}
+			}
+
+			control_port->connections =
+				jack_pool_slist_prepend (control_port->connections,
+							 (void*)other);
+			jack_port_buffer_invalidate (control_port);
+			pthread_mutex_unlock (&control_port->connection_lock);
+			break;
+
+		case PortDisconnected:
+			/* jack_port_by_id_int() always returns an internal
+			 * port that does not need to be deallocated
+			 */
+			control_port = jack_port_by_id_int (client, event->x.self_id,
+							    &need_free);
+			pthread_mutex_lock (&control_port->connection_lock);
+
+			for (node = control_port->connections; node;
+			     node = jack_slist_next (node)) {
+
+				other = (jack_port_t*)node->data;
 
 				if (other->shared->id == event->y.other_id) {
 					control_port->connections =
 						jack_slist_remove_link (
 							control_port->connections,
 							node);
-					jack_slist_free_1 (node);
+					jack_pool_slist_free_1 (node);
+					if (!jack_port_gain_unity (other)) {
+						control_port->gained--;
+					}
 					free (other);
 					break;
 				}
 			}
 
+			jack_port_buffer_invalidate (control_port);
 			pthread_mutex_unlock (&control_port->connection_lock);
 			break;
 
@@ -535,6 +1202,68 @@ jack_client_handle_port_connection (jack_client_t *client, jack_event_t *event)
 	return 0;
 }
 
+/* The gain of the connection from y.other_id into our input x.self_id
+ * changed: mixdown ramps to it from the next cycle, in the port's own
+ * mix buffer even if it is the only connection.
+ */
+int
+jack_client_handle_port_gain (jack_client_t *client, const jack_event_t *event)
+{
+	jack_port_t *control_port;
+	jack_port_t *other;
+	JSList *node;
+	int need_free = FALSE;
+	int unity;
+
+	if (jack_uuid_compare (client->engine->ports[event->x.self_id].client_id, client->control->uuid) != 0) {
+		return 0;
+	}
+
+	control_port = jack_port_by_id_int (client, event->x.self_id, &need_free);
+	pthread_mutex_lock (&control_port->connection_lock);
+
+	for (node = control_port->connections; node;
+	     node = jack_slist_next (node)) {
+
+		other = (jack_port_t*)node->data;
+
+		if (other->shared->id != event->y.other_id) {
+			continue;
+		}
+
+		if (control_port->mix_buffer == NULL) {
+			pthread_mutex_lock (&client->mix_lock);
+			control_port->mix_buffer =
+				jack_port_mix_take (client, control_port);
+			pthread_mutex_unlock (&client->mix_lock);
+			if (control_port->mix_buffer == NULL) {
+				jack_error ("no mixdown buffer for the gain of %s",
+					    control_port->shared->name);
+				break;
+			}
+			control_port->fptr.buffer_init (
+				control_port->mix_buffer,
+				jack_port_type_buffer_size (control_port->type_info,
+							    client->engine->buffer_size),
+				client->engine->buffer_size);
+		}
+
+		unity = jack_port_gain_unity (other);
+		other->gain_target = event->z.gain;
+		if (unity && !jack_port_gain_unity (other)) {
+			control_port->gained++;
+		} else if (!unity && jack_port_gain_unity (other)) {
+			control_port->gained--;
+		}
+		jack_port_buffer_invalidate (control_port);
+		break;
+	}
+
+	pthread_mutex_unlock (&control_port->connection_lock);
+
+	return 0;
+}
+
 int
 jack_client_handle_session_callback (jack_client_t *client, jack_event_t *event)
 {
@@ -558,13 +1287,24 @@ jack_client_handle_session_callback (jack_client_t *client, jack_event_t *event)
 	client->session_cb (s_event, client->session_cb_arg);
 
 	if (client->session_cb_immediate_reply) {
+		if (event->flags & JACK_EVENT_NO_REPLY) {
+			/* the server sent the save to everybody without
+			   waiting, so answer the way a deferred reply does */
+			jack_request_t request;
+			VALGRIND_MEMSET (&request, 0, sizeof(request));
+
+			request.type = SessionReply;
+			jack_uuid_copy (&request.x.client_id, client->control->uuid);
+			jack_client_deliver_request (client, &request);
+		}
 		return 2;
 	}
 	return 1;
 }
 
 static void
-jack_port_recalculate_latency (jack_port_t *port, jack_latency_callback_mode_t mode)
+jack_port_recalculate_latency (jack_client_t *client, jack_port_t *port,
+			       jack_latency_callback_mode_t mode)
 {
 	jack_latency_range_t latency = { UINT32_MAX, 0 };
 	JSList *node;
@@ -576,6 +1316,12 @@ jack_port_recalculate_latency (jack_port_t *port, jack_latency_callback_mode_t m
 
 		jack_port_get_latency_range (other, mode, &other_latency);
 
+		/* a connection across the async stage adds a period */
+		if (other->shared->delayed != port->shared->delayed) {
+			other_latency.min += client->engine->buffer_size;
+			other_latency.max += client->engine->buffer_size;
+		}
+
 		if (other_latency.max > latency.max) {
 			latency.max = other_latency.max;
 		}
@@ -599,6 +1345,7 @@ jack_client_handle_latency_callback (jack_client_t *client, jack_event_t *event,
 	jack_latency_callback_mode_t mode = (event->x.n == 0) ? JackCaptureLatency : JackPlaybackLatency;
 	JSList *node;
 	jack_latency_range_t latency = { UINT32_MAX, 0 };
+	int published = client->control->latency_published & (1 << mode);
 
 	/* first setup all latency values of the ports.
 	 * this is based on the connections of the ports.
@@ -607,24 +1354,25 @@ jack_client_handle_latency_callback (jack_client_t *client, jack_event_t *event,
 		jack_port_t *port = node->data;
 
 		if ((jack_port_flags (port) & JackPortIsOutput) && (mode == JackPlaybackLatency)) {
-			jack_port_recalculate_latency (port, mode);
+			jack_port_recalculate_latency (client, port, mode);
 		}
 		if ((jack_port_flags (port) & JackPortIsInput) && (mode == JackCaptureLatency)) {
-			jack_port_recalculate_latency (port, mode);
+			jack_port_recalculate_latency (client, port, mode);
 		}
 	}
 
 	/* for a driver invocation without its own latency callback, this is enough.
 	 * input and output ports do not depend on each other.
 	 */
-	if (is_driver && !client->control->latency_cbset) {
+	if (is_driver && !client->control->latency_cbset && !published) {
 		return 0;
 	}
 
-	if (!client->control->latency_cbset) {
+	if (!client->control->latency_cbset || published) {
 		/*
 		 * default action is to assume all ports depend on each other.
-		 * then always take the maximum latency.
+		 * then always take the maximum latency, plus whatever the
+		 * client published with jack_publish_latency().
 		 */
 
 		if (mode == JackPlaybackLatency) {
@@ -649,6 +1397,10 @@ jack_client_handle_latency_callback (jack_client_t *client, jack_event_t *event,
 			if (latency.min == UINT32_MAX) {
 				latency.min = 0;
 			}
+			if (published) {
+				latency.min += client->control->latency_added[mode].min;
+				latency.max += client->control->latency_added[mode].max;
+			}
 
 			/* now set the found latency on all input ports
 			 */
@@ -682,6 +1434,10 @@ jack_client_handle_latency_callback (jack_client_t *client, jack_event_t *event,
 			if (latency.min == UINT32_MAX) {
 				latency.min = 0;
 			}
+			if (published) {
+				latency.min += client->control->latency_added[mode].min;
+				latency.max += client->control->latency_added[mode].max;
+			}
 
 			/* now set the found latency on all output ports
 			 */
@@ -723,47 +1479,95 @@ jack_handle_reorder (jack_client_t *client, jack_event_t *event)
 
 #else
 
+/* A FIFO is opened the first time the client is put at its place in
+ * the chain and stays open, so a reorder that moves the client between
+ * places it has been before only swaps descriptors. The server holds
+ * every FIFO open itself, so keeping our ends open changes nothing
+ * about who sees them close.
+ */
 static int
-jack_handle_reorder (jack_client_t *client, jack_event_t *event)
+jack_client_fifo_fd (jack_client_t *client, uint32_t which_fifo, int for_write)
 {
 	char path[PATH_MAX + 1];
+	unsigned int i = 2 * which_fifo + (for_write ? 1 : 0);
+	unsigned int n;
+	int *fds;
+
+	if (i >= client->fifo_size) {
+		n = (i + 32) & ~31u;
+		if ((fds = (int*)realloc (client->fifo_fds, sizeof(int) * n)) == NULL) {
+			jack_error ("cannot allocate FIFO table (%s)",
+				    strerror (errno));
+			return -1;
+		}
+		for (; client->fifo_size < n; client->fifo_size++) {
+			fds[client->fifo_size] = -1;
+		}
+		client->fifo_fds = fds;
+	}
 
-	DEBUG ("graph reorder\n");
-
-	if (client->graph_wait_fd >= 0) {
-		DEBUG ("closing graph_wait_fd==%d", client->graph_wait_fd);
-		close (client->graph_wait_fd);
-		client->graph_wait_fd = -1;
+	if (client->fifo_fds[i] < 0) {
+		snprintf (path, sizeof(path), "%s-%" PRIu32, client->fifo_prefix,
+			  which_fifo);
+		if ((client->fifo_fds[i] =
+			     open (path, (for_write ? O_WRONLY : O_RDONLY)
+				   | O_NONBLOCK)) < 0) {
+			jack_error ("cannot open specified fifo [%s] for %s (%s)",
+				    path, for_write ? "writing" : "reading",
+				    strerror (errno));
+			return -1;
+		}
+		DEBUG ("opened fifo %s for %s as %d", path,
+		       for_write ? "writing" : "reading", client->fifo_fds[i]);
 	}
 
-	if (client->graph_next_fd >= 0) {
-		DEBUG ("closing graph_next_fd==%d", client->graph_next_fd);
-		close (client->graph_next_fd);
-		client->graph_next_fd = -1;
+	return client->fifo_fds[i];
+}
+
+/* graph_wait_fd and graph_next_fd are among these */
+static void
+jack_client_close_fifos (jack_client_t *client)
+{
+	unsigned int i;
+
+	for (i = 0; i < client->fifo_size; i++) {
+		if (client->fifo_fds[i] >= 0) {
+			close (client->fifo_fds[i]);
+		}
 	}
+	free (client->fifo_fds);
+	client->fifo_fds = NULL;
+	client->fifo_size = 0;
+	client->graph_wait_fd = -1;
+	client->graph_next_fd = -1;
+}
+
+static int
+jack_handle_reorder (jack_client_t *client, jack_event_t *event)
+{
+	DEBUG ("graph reorder\n");
 
-	sprintf (path, "%s-%" PRIu32, client->fifo_prefix, event->x.n);
+	client->graph_wait_pending = 0;
 
-	if ((client->graph_wait_fd = open (path, O_RDONLY | O_NONBLOCK)) < 0) {
-		jack_error ("cannot open specified fifo [%s] for reading (%s)",
-			    path, strerror (errno));
+	if ((client->graph_wait_fd =
+		     jack_client_fifo_fd (client, event->x.n, 0)) < 0) {
+		client->graph_next_fd = -1;
 		return -1;
 	}
-	DEBUG ("opened new graph_wait_fd %d (%s)", client->graph_wait_fd, path);
-
-	sprintf (path, "%s-%" PRIu32, client->fifo_prefix, event->x.n + 1);
 
-	if ((client->graph_next_fd = open (path, O_WRONLY | O_NONBLOCK)) < 0) {
-		jack_error ("cannot open specified fifo [%s] for writing (%s)",
-			    path, strerror (errno));
+	if ((client->graph_next_fd =
+		     jack_client_fifo_fd (client, event->x.n + 1, 1)) < 0) {
 		return -1;
 	}
 
+	/* our wakeup word never changes, see wakeup.h */
+	client->graph_wait_slot = event->z.wakeup.word;
+	client->graph_next_slot = event->z.wakeup.next;
 	client->upstream_is_jackd = event->y.n;
 	client->pollmax = 2;
 
-	DEBUG ("opened new graph_next_fd %d (%s) (upstream is jackd? %d)",
-	       client->graph_next_fd, path,
+	DEBUG ("graph_wait_fd %d, graph_next_fd %d (upstream is jackd? %d)",
+	       client->graph_wait_fd, client->graph_next_fd,
 	       client->upstream_is_jackd);
 
 	/* If the client registered its own callback for graph order events,
@@ -809,13 +1613,17 @@ server_connect (const char *server_name)
 	return fd;
 }
 
+/* The event connection is made in two halves, so that the client can
+ * get on with setting itself up while the server deals with the
+ * request: server_event_connect() sends it, server_event_connect_finish()
+ * collects the answer.
+ */
 static int
 server_event_connect (jack_client_t *client, const char *server_name)
 {
 	int fd;
 	struct sockaddr_un addr;
 	jack_client_connect_ack_request_t req;
-	jack_client_connect_ack_result_t res;
 
 	char server_dir[PATH_MAX + 1] = "";
 
@@ -845,21 +1653,27 @@ server_event_connect (jack_client_t *client, const char *server_name)
 		return -1;
 	}
 
+	return fd;
+}
+
+static int
+server_event_connect_finish (int fd)
+{
+	jack_client_connect_ack_result_t res;
+
 	if (read (fd, &res, sizeof(res)) != sizeof(res)) {
 		jack_error ("cannot read event connect result from server (%s)",
 			    strerror (errno));
-		close (fd);
 		return -1;
 	}
 
 	if (res.status != 0) {
 		jack_error ("cannot connect to server for event stream (%s)",
 			    strerror (errno));
-		close (fd);
 		return -1;
 	}
 
-	return fd;
+	return 0;
 }
 
 /* Exec the JACK server in this process.  Does not return. */
@@ -1074,18 +1888,27 @@ jack_request_client (ClientType type,
 	}
 
 	if ((*req_fd = server_connect (va->server_name)) < 0) {
-		int trys;
+		useconds_t delay = 10000;
+		useconds_t waited = 0;
 		if (start_server (va->server_name, options)) {
 			*status |= (JackFailure | JackServerFailed);
 			goto fail;
 		}
-		trys = 5;
+
+		/* the server's socket usually appears within a few
+		   milliseconds (at once, if it is socket-activated or
+		   standing by), so poll quickly at first, backing off
+		   to give a slow server the same 6 seconds as ever */
 		do {
-			sleep (1);
-			if (--trys < 0) {
+			if (waited >= 6000000) {
 				*status |= (JackFailure | JackServerFailed);
 				goto fail;
 			}
+			usleep (delay);
+			waited += delay;
+			if (delay < 500000) {
+				delay *= 2;
+			}
 		} while ((*req_fd = server_connect (va->server_name)) < 0);
 		*status |= JackServerStarted;
 	}
@@ -1191,15 +2014,8 @@ jack_attach_port_segment (jack_client_t *client, jack_port_type_id_t ptid)
 
 	if (ptid >= client->n_port_types) {
 
-		client->port_segment = (jack_shm_info_t*)
-				       realloc (client->port_segment,
-						sizeof(jack_shm_info_t) * (ptid + 1));
-
-		memset (&client->port_segment[client->n_port_types],
-			0,
-			sizeof(jack_shm_info_t) *
-			(ptid - client->n_port_types));
-
+		/* there is room for every type, since ports hold
+		   pointers into the array */
 		client->n_port_types = ptid + 1;
 
 	} else {
@@ -1208,6 +2024,8 @@ jack_attach_port_segment (jack_client_t *client, jack_port_type_id_t ptid)
 		jack_release_shm (&client->port_segment[ptid]);
 	}
 
+	client->port_segment_pending &= ~(1 << ptid);
+
 	/* get the index into the shm registry */
 
 	client->port_segment[ptid].index =
@@ -1220,10 +2038,52 @@ jack_attach_port_segment (jack_client_t *client, jack_port_type_id_t ptid)
 			    " (%s)", strerror (errno));
 		return -1;
 	}
+	jack_mlock_rt_shm (&client->port_segment[ptid], "port buffer memory");
 
 	return 0;
 }
 
+static int
+jack_client_has_port_type (jack_client_t *client, jack_port_type_id_t ptid)
+{
+	JSList *node;
+
+	for (node = client->ports; node; node = jack_slist_next (node)) {
+		if (((jack_port_t*)node->data)->shared->ptype_id == ptid) {
+			return 1;
+		}
+	}
+
+	for (node = client->ports_ext; node; node = jack_slist_next (node)) {
+		if (((jack_port_t*)node->data)->shared->ptype_id == ptid) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Most clients only ever use some of the port types, so a segment the
+ * client has no ports of is not attached when the server announces it,
+ * only once jack_port_new() first hands out a port of that type.
+ */
+static void
+jack_port_segment_announced (jack_client_t *client, jack_port_type_id_t ptid)
+{
+	if (ptid >= client->n_port_types) {
+		/* a type registered since this client was opened */
+		client->n_port_types = ptid + 1;
+	}
+
+	if (client->port_segment[ptid].attached_at == MAP_FAILED &&
+	    !jack_client_has_port_type (client, ptid)) {
+		client->port_segment_pending |= (1 << ptid);
+		return;
+	}
+
+	jack_attach_port_segment (client, ptid);
+}
+
 jack_client_t *
 jack_client_open_aux (const char *client_name,
 		      jack_options_t options,
@@ -1238,6 +2098,7 @@ jack_client_open_aux (const char *client_name,
 	jack_client_t *client;
 	jack_port_type_id_t ptid;
 	jack_status_t my_status;
+	const char *str;
 
 	jack_messagebuffer_init ();
 
@@ -1305,10 +2166,18 @@ jack_client_open_aux (const char *client_name,
 	}
 
 	client->engine = (jack_control_t*)jack_shm_addr (&client->engine_shm);
+	jack_port_set_period (client->engine->buffer_size);
 
 	/* initialize clock source as early as possible */
+	jack_set_cycles_calibration (&client->engine->cycles_calibration);
 	jack_set_clock_source (client->engine->clock_source);
 
+	/* so that what is set up from here on locks itself */
+	if (client->engine->real_time
+	    && client->engine->do_mlock == JACK_MLOCK_SELECTIVE) {
+		jack_mlock_mode = JACK_MLOCK_SELECTIVE;
+	}
+
 	/* now attach the client control block */
 	client->control_shm.index = res.client_shm_index;
 	if (jack_attach_shm (&client->control_shm)) {
@@ -1320,20 +2189,26 @@ jack_client_open_aux (const char *client_name,
 	client->control = (jack_client_control_t*)
 			  jack_shm_addr (&client->control_shm);
 
+	/* the rest can happen while the server sets up our events */
+	if ((ev_fd = server_event_connect (client, va.server_name)) < 0) {
+		goto fail;
+	}
+
 	/* Nobody else needs to access this shared memory any more, so
 	 * destroy it.  Because we have it attached, it won't vanish
 	 * till we exit (and release it).
 	 */
 	jack_destroy_shm (&client->control_shm);
 
+	/* room for types registered later, see jack_attach_port_segment() */
 	client->n_port_types = client->engine->n_port_types;
-	if ((client->port_segment = (jack_shm_info_t*)malloc (sizeof(jack_shm_info_t) * client->n_port_types)) == NULL) {
+	if ((client->port_segment = (jack_shm_info_t*)malloc (sizeof(jack_shm_info_t) * JACK_MAX_PORT_TYPES)) == NULL) {
 		goto fail;
 	}
 
-	for (ptid = 0; ptid < client->n_port_types; ++ptid) {
-		client->port_segment[ptid].index =
-			client->engine->port_types[ptid].shm_registry_index;
+	for (ptid = 0; ptid < JACK_MAX_PORT_TYPES; ++ptid) {
+		client->port_segment[ptid].index = ptid < client->n_port_types ?
+			client->engine->port_types[ptid].shm_registry_index : -1;
 		client->port_segment[ptid].attached_at = MAP_FAILED;
 
 		/* the server will send attach events during jack_activate
@@ -1346,216 +2221,581 @@ jack_client_open_aux (const char *client_name,
 	client->deliver_request = oop_client_deliver_request;
 	client->deliver_arg = client;
 
-	if ((ev_fd = server_event_connect (client, va.server_name)) < 0) {
-		goto fail;
+	if ((str = getenv ("JACK_SHM_REQUESTS")) != NULL && atoi (str) > 0) {
+		(void)jack_set_shm_requests (client, TRUE);
 	}
 
-	client->event_fd = ev_fd;
-
 #ifdef JACK_USE_MACH_THREADS
 	/* specific resources for server/client real-time thread
 	 * communication */
 	client->clienttask = mach_task_self ();
 
-	if (task_get_bootstrap_port (client->clienttask, &client->bp)) {
-		jack_error ("Can't find bootstrap port");
-		goto fail;
+	if (task_get_bootstrap_port (client->clienttask, &client->bp)) {
+		jack_error ("Can't find bootstrap port");
+		goto fail;
+	}
+
+	if (allocate_mach_clientport (client, res.portnum) < 0) {
+		jack_error ("Can't allocate mach port");
+		goto fail;
+	}
+	;
+#endif  /* JACK_USE_MACH_THREADS */
+
+	/* metadata lookups read the server's store directly */
+	jack_property_store_attach (client->engine->property_shm_index);
+
+	if (server_event_connect_finish (ev_fd)) {
+		goto fail;
+	}
+
+	client->event_fd = ev_fd;
+
+	return client;
+
+fail:
+	jack_messagebuffer_exit ();
+
+	if (client->engine) {
+		jack_release_shm (&client->engine_shm);
+		client->engine = 0;
+	}
+	if (client->control) {
+		jack_release_shm (&client->control_shm);
+		client->control = 0;
+	}
+	if (req_fd >= 0) {
+		close (req_fd);
+	}
+	if (ev_fd >= 0) {
+		close (ev_fd);
+	}
+	free (client);
+
+	return NULL;
+}
+
+jack_client_t* jack_client_open (const char* ext_client_name, jack_options_t options, jack_status_t* status, ...)
+{
+	va_list ap;
+
+	va_start (ap, status);
+	jack_client_t* res = jack_client_open_aux (ext_client_name, options, status, ap);
+	va_end (ap);
+	return res;
+}
+
+jack_client_t *
+jack_client_new (const char *client_name)
+{
+	jack_options_t options = JackUseExactName;
+
+	if (getenv ("JACK_START_SERVER") == NULL) {
+		options |= JackNoStartServer;
+	}
+	return jack_client_open (client_name, options, NULL);
+}
+
+char *
+jack_get_client_name (jack_client_t *client)
+{
+	return client->name;
+}
+
+int
+jack_internal_client_new (const char *client_name,
+			  const char *so_name, const char *so_data)
+{
+	jack_client_connect_result_t res;
+	int req_fd;
+	jack_varargs_t va;
+	jack_status_t status;
+	jack_options_t options = JackUseExactName;
+
+	if (getenv ("JACK_START_SERVER") == NULL) {
+		options |= JackNoStartServer;
+	}
+
+	jack_varargs_init (&va);
+	va.load_name = (char*)so_name;
+	va.load_init = (char*)so_data;
+
+	return jack_request_client (ClientInternal, client_name,
+				    options, &status, &va, &res, &req_fd);
+}
+
+char *
+jack_default_server_name (void)
+{
+	char *server_name;
+
+	if ((server_name = getenv ("JACK_DEFAULT_SERVER")) == NULL) {
+		server_name = "default";
+	}
+	return server_name;
+}
+
+/* returns the name of the per-user subdirectory of jack_tmpdir */
+char *
+jack_user_dir (void)
+{
+	static char user_dir[PATH_MAX + 1] = "";
+	const char *tmpdir;
+
+	/* format the path name on the first call */
+	if (user_dir[0] == '\0') {
+		tmpdir = jack_get_tmpdir ();
+
+		/* previous behavior of jack_tmpdir, should be changed later */
+		if (tmpdir == NULL) {
+			jack_error ("Unable to get tmpdir in user dir");
+			tmpdir = DEFAULT_TMP_DIR;
+		}
+
+		if (getenv ("JACK_PROMISCUOUS_SERVER")) {
+			snprintf (user_dir, sizeof(user_dir), "%s/jack",
+				  tmpdir);
+		} else {
+			snprintf (user_dir, sizeof(user_dir), "%s/jack-%d",
+				  tmpdir, getuid ());
+		}
+	}
+
+	return user_dir;
+}
+
+/* returns the name of the per-server subdirectory of jack_user_dir() */
+char *
+jack_server_dir (const char *server_name, char *server_dir)
+{
+	/* format the path name into the suppled server_dir char array,
+	 * assuming that server_dir is at least as large as PATH_MAX+1 */
+
+	if (server_name == NULL || server_name[0] == '\0') {
+		snprintf (server_dir, PATH_MAX + 1, "%s/%s",
+			  jack_user_dir (), jack_default_server_name ());
+	} else {
+		snprintf (server_dir, PATH_MAX + 1, "%s/%s",
+			  jack_user_dir (), server_name);
+	}
+
+	return server_dir;
+}
+
+void
+jack_internal_client_close (const char *client_name)
+{
+	jack_client_connect_request_t req;
+	int fd;
+	char *server_name = jack_default_server_name ();
+
+	req.load = FALSE;
+	snprintf (req.name, sizeof(req.name), "%s", client_name);
+
+	if ((fd = server_connect (server_name)) < 0) {
+		return;
+	}
+
+	if (write (fd, &req, sizeof(req)) != sizeof(req)) {
+		jack_error ("cannot deliver ClientUnload request to JACK "
+			    "server.");
+	}
+
+	/* no response to this request */
+
+	close (fd);
+	return;
+}
+
+static int
+jack_read_all (int fd, void *buf, size_t len)
+{
+	char *p = (char*)buf;
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = read (fd, p, len)) <= 0) {
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+jack_server_stats_t *
+jack_server_stats_query (const char *server_name)
+{
+	jack_client_connect_request_t req;
+	jack_server_stats_t head, *stats;
+	int fd;
+
+	if (server_name == NULL) {
+		server_name = jack_default_server_name ();
+	}
+
+	VALGRIND_MEMSET (&req, 0, sizeof(req));
+
+	req.protocol_v = jack_protocol_version;
+	req.load = JACK_CONNECT_STATS;
+
+	if ((fd = server_connect (server_name)) < 0) {
+		return NULL;
+	}
+
+	if (write (fd, &req, sizeof(req)) != sizeof(req)) {
+		jack_error ("cannot send statistics request to JACK server");
+		close (fd);
+		return NULL;
+	}
+
+	if (jack_read_all (fd, &head, sizeof(head))
+	    || head.version != JACK_SERVER_STATS_VERSION
+	    || head.size < sizeof(head) || head.size > JACK_SERVER_STATS_MAX
+	    || (stats = (jack_server_stats_t*)malloc (head.size + 1)) == NULL) {
+		jack_error ("cannot read statistics from JACK server");
+		close (fd);
+		return NULL;
+	}
+
+	memcpy (stats, &head, sizeof(head));
+	if (jack_read_all (fd, (char*)stats + sizeof(head), head.size - sizeof(head))) {
+		jack_error ("cannot read statistics from JACK server");
+		free (stats);
+		close (fd);
+		return NULL;
+	}
+	close (fd);
+
+	/* what follows the fixed part has to fit in it */
+	((char*)stats)[head.size] = '\0';
+	if ((uint64_t)stats->nclients * sizeof(stats->clients[0])
+	    > head.size - sizeof(head)
+	    || (stats->driver_metrics
+		&& (stats->driver_metrics < sizeof(head)
+		    + stats->nclients * sizeof(stats->clients[0])
+		    || stats->driver_metrics >= head.size))) {
+		jack_error ("bad statistics from JACK server");
+		free (stats);
+		return NULL;
+	}
+
+	return stats;
+}
+
+int
+jack_recompute_total_latencies (jack_client_t* client)
+{
+	jack_request_t request;
+
+	VALGRIND_MEMSET (&request, 0, sizeof(request));
+
+	request.type = RecomputeTotalLatencies;
+	jack_uuid_copy (&request.x.client_id, client->control->uuid);
+	return jack_client_deliver_request (client, &request);
+}
+
+int
+jack_publish_latency (jack_client_t* client,
+		      jack_latency_callback_mode_t mode,
+		      const jack_latency_range_t *range)
+{
+	if (mode != JackCaptureLatency && mode != JackPlaybackLatency) {
+		return -1;
+	}
+
+	if (range) {
+		client->control->latency_added[mode] = *range;
+		client->control->latency_published |= (1 << mode);
+	} else {
+		client->control->latency_published &= ~(1 << mode);
+	}
+
+	if (!client->control->active) {
+		/* picked up by the wave that activation causes */
+		return 0;
+	}
+
+	return jack_recompute_total_latencies (client);
+}
+
+int
+jack_graph_batch_begin (jack_client_t* client)
+{
+	jack_request_t request;
+
+	VALGRIND_MEMSET (&request, 0, sizeof(request));
+
+	request.type = GraphBatchBegin;
+	jack_uuid_copy (&request.x.client_id, client->control->uuid);
+	return jack_client_deliver_request (client, &request);
+}
+
+int
+jack_graph_batch_end (jack_client_t* client)
+{
+	jack_request_t request;
+
+	VALGRIND_MEMSET (&request, 0, sizeof(request));
+
+	request.type = GraphBatchEnd;
+	jack_uuid_copy (&request.x.client_id, client->control->uuid);
+	return jack_client_deliver_request (client, &request);
+}
+
+const jack_cycle_trace_t *
+jack_cycle_trace_attach (jack_client_t* client)
+{
+	if (client->trace_shm.attached_at) {
+		return (const jack_cycle_trace_t*)jack_shm_addr (&client->trace_shm);
 	}
 
-	if (allocate_mach_clientport (client, res.portnum) < 0) {
-		jack_error ("Can't allocate mach port");
-		goto fail;
+	if (client->engine->trace_shm_index < 0) {
+		return NULL;
 	}
-	;
-#endif  /* JACK_USE_MACH_THREADS */
-	return client;
 
-fail:
-	jack_messagebuffer_exit ();
+	client->trace_shm.index = client->engine->trace_shm_index;
 
-	if (client->engine) {
-		jack_release_shm (&client->engine_shm);
-		client->engine = 0;
+	if (jack_attach_shm (&client->trace_shm)) {
+		jack_error ("cannot attach to the cycle trace (%s)",
+			    strerror (errno));
+		client->trace_shm.attached_at = NULL;
+		return NULL;
 	}
-	if (client->control) {
-		jack_release_shm (&client->control_shm);
-		client->control = 0;
+
+	return (const jack_cycle_trace_t*)jack_shm_addr (&client->trace_shm);
+}
+
+const jack_port_meters_t *
+jack_port_meters_attach (jack_client_t* client)
+{
+	if (client->meter_shm.attached_at) {
+		return (const jack_port_meters_t*)jack_shm_addr (&client->meter_shm);
 	}
-	if (req_fd >= 0) {
-		close (req_fd);
+
+	if (client->engine->meter_shm_index < 0) {
+		return NULL;
 	}
-	if (ev_fd >= 0) {
-		close (ev_fd);
+
+	client->meter_shm.index = client->engine->meter_shm_index;
+
+	if (jack_attach_shm (&client->meter_shm)) {
+		jack_error ("cannot attach to the port meters (%s)",
+			    strerror (errno));
+		client->meter_shm.attached_at = NULL;
+		return NULL;
 	}
-	free (client);
 
-	return NULL;
+	return (const jack_port_meters_t*)jack_shm_addr (&client->meter_shm);
 }
 
-jack_client_t* jack_client_open (const char* ext_client_name, jack_options_t options, jack_status_t* status, ...)
+static int
+jack_port_meter_get (jack_client_t* client, const jack_port_t *port,
+		     jack_port_meter_t *level)
 {
-	va_list ap;
+	const jack_port_meters_t *meters;
+	jack_port_id_t id = port->shared->id;
+	uint32_t seq;
 
-	va_start (ap, status);
-	jack_client_t* res = jack_client_open_aux (ext_client_name, options, status, ap);
-	va_end (ap);
-	return res;
+	if ((meters = jack_port_meters_attach (client)) == NULL
+	    || id >= meters->nports) {
+		return -1;
+	}
+
+	do {
+		while ((seq = meters->seq) & 1) {
+			sched_yield ();
+		}
+		__sync_synchronize ();
+		*level = meters->ports[id];
+		__sync_synchronize ();
+	} while (meters->seq != seq);
+
+	return 0;
 }
 
-jack_client_t *
-jack_client_new (const char *client_name)
+int
+jack_port_meter_read (jack_client_t* client, const jack_port_t *port,
+		      float *peak, float *rms)
 {
-	jack_options_t options = JackUseExactName;
+	jack_port_meter_t level;
 
-	if (getenv ("JACK_START_SERVER") == NULL) {
-		options |= JackNoStartServer;
+	if (jack_port_meter_get (client, port, &level)) {
+		return -1;
 	}
-	return jack_client_open (client_name, options, NULL);
+	*peak = level.peak;
+	*rms = level.rms;
+	return 0;
 }
 
-char *
-jack_get_client_name (jack_client_t *client)
+int
+jack_port_meter_read_overs (jack_client_t* client, const jack_port_t *port,
+			    uint32_t *overs)
 {
-	return client->name;
+	jack_port_meter_t level;
+
+	if (jack_port_meter_get (client, port, &level)) {
+		return -1;
+	}
+	*overs = level.overs;
+	return 0;
 }
 
 int
-jack_internal_client_new (const char *client_name,
-			  const char *so_name, const char *so_data)
+jack_rt_pool_set_size (jack_client_t* client, size_t bytes)
 {
-	jack_client_connect_result_t res;
-	int req_fd;
-	jack_varargs_t va;
-	jack_status_t status;
-	jack_options_t options = JackUseExactName;
-
-	if (getenv ("JACK_START_SERVER") == NULL) {
-		options |= JackNoStartServer;
+	if (client->rt_pool) {
+		/* blocks may already be in use */
+		jack_error ("the RT pool of %s cannot be resized once the "
+			    "client has been activated", client->name);
+		return -1;
 	}
-
-	jack_varargs_init (&va);
-	va.load_name = (char*)so_name;
-	va.load_init = (char*)so_data;
-
-	return jack_request_client (ClientInternal, client_name,
-				    options, &status, &va, &res, &req_fd);
+	client->rt_pool_size = bytes;
+	return 0;
 }
 
-char *
-jack_default_server_name (void)
+int
+jack_set_warmup_cycles (jack_client_t* client, int cycles)
 {
-	char *server_name;
-
-	if ((server_name = getenv ("JACK_DEFAULT_SERVER")) == NULL) {
-		server_name = "default";
+	if (!client->first_active) {
+		jack_error ("warm-up cycles of %s can only be set before "
+			    "it is first activated", client->name);
+		return -1;
 	}
-	return server_name;
+	if (cycles < 0 || cycles > JACK_WARMUP_MAX) {
+		jack_error ("%d warm-up cycles requested, allowed are 0 to %d",
+			    cycles, JACK_WARMUP_MAX);
+		return -1;
+	}
+	client->warmup_cycles = cycles;
+	return 0;
 }
 
-/* returns the name of the per-user subdirectory of jack_tmpdir */
-char *
-jack_user_dir (void)
+int
+jack_is_warming_up (const jack_client_t* client)
 {
-	static char user_dir[PATH_MAX + 1] = "";
-	const char *tmpdir;
-
-	/* format the path name on the first call */
-	if (user_dir[0] == '\0') {
-		tmpdir = jack_get_tmpdir ();
+	return client->warming_up;
+}
 
-		/* previous behavior of jack_tmpdir, should be changed later */
-		if (tmpdir == NULL) {
-			jack_error ("Unable to get tmpdir in user dir");
-			tmpdir = DEFAULT_TMP_DIR;
-		}
+/* Run process() a few times before the client is in the graph, so
+   that its code, data and port buffers are faulted in and the PLT
+   entries bound before its first live cycle. Nothing is connected to
+   the ports yet: inputs read silence and outputs go nowhere. */
+static void
+jack_client_warm_up (jack_client_t* client)
+{
+	jack_nframes_t nframes = client->engine->buffer_size;
+	int n;
 
-		if (getenv ("JACK_PROMISCUOUS_SERVER")) {
-			snprintf (user_dir, sizeof(user_dir), "%s/jack",
-				  tmpdir);
-		} else {
-			snprintf (user_dir, sizeof(user_dir), "%s/jack-%d",
-				  tmpdir, getuid ());
+	client->warming_up = TRUE;
+	for (n = 0; n < client->warmup_cycles; ++n) {
+		if (client->process (nframes, client->process_arg)) {
+			break;
 		}
 	}
+	client->warming_up = FALSE;
+}
 
-	return user_dir;
+/* TRUE if the process thread warms up before jack_activate() goes on */
+static int
+jack_client_warms_up (jack_client_t* client)
+{
+	return client->warmup_cycles > 0
+	       && client->control->process_cbset
+	       && !client->control->thread_cb_cbset;
 }
 
-/* returns the name of the per-server subdirectory of jack_user_dir() */
-char *
-jack_server_dir (const char *server_name, char *server_dir)
+int
+jack_lock_code_region (jack_client_t* client, const void *start, size_t len)
 {
-	/* format the path name into the suppled server_dir char array,
-	 * assuming that server_dir is at least as large as PATH_MAX+1 */
+	return jack_mlock_rt_region (start, len, "client code");
+}
 
-	if (server_name == NULL || server_name[0] == '\0') {
-		snprintf (server_dir, PATH_MAX + 1, "%s/%s",
-			  jack_user_dir (), jack_default_server_name ());
-	} else {
-		snprintf (server_dir, PATH_MAX + 1, "%s/%s",
-			  jack_user_dir (), server_name);
-	}
+size_t
+jack_get_locked_footprint (jack_client_t* client)
+{
+	return jack_mlock_footprint ();
+}
 
-	return server_dir;
+void *
+jack_rt_alloc (jack_client_t* client, size_t bytes)
+{
+	if (client->rt_pool == NULL) {
+		return NULL;
+	}
+	return jack_rt_pool_alloc (client->rt_pool, bytes);
 }
 
 void
-jack_internal_client_close (const char *client_name)
+jack_rt_free (jack_client_t* client, void *ptr)
 {
-	jack_client_connect_request_t req;
-	int fd;
-	char *server_name = jack_default_server_name ();
-
-	req.load = FALSE;
-	snprintf (req.name, sizeof(req.name), "%s", client_name);
-
-	if ((fd = server_connect (server_name)) < 0) {
-		return;
+	if (client->rt_pool) {
+		jack_rt_pool_free (client->rt_pool, ptr);
 	}
+}
 
-	if (write (fd, &req, sizeof(req)) != sizeof(req)) {
-		jack_error ("cannot deliver ClientUnload request to JACK "
-			    "server.");
-	}
+int
+jack_recompute_total_latency (jack_client_t* client, jack_port_t* port)
+{
+	jack_request_t request;
 
-	/* no response to this request */
+	VALGRIND_MEMSET (&request, 0, sizeof(request));
 
-	close (fd);
-	return;
+	request.type = RecomputeTotalLatency;
+	request.x.port_info.port_id = port->shared->id;
+	return jack_client_deliver_request (client, &request);
 }
 
 int
-jack_recompute_total_latencies (jack_client_t* client)
+jack_set_freewheel (jack_client_t* client, int onoff)
 {
 	jack_request_t request;
 
 	VALGRIND_MEMSET (&request, 0, sizeof(request));
 
-	request.type = RecomputeTotalLatencies;
+	request.type = onoff ? FreeWheel : StopFreeWheel;
+	jack_uuid_copy (&request.x.client_id, client->control->uuid);
 	return jack_client_deliver_request (client, &request);
 }
 
 int
-jack_recompute_total_latency (jack_client_t* client, jack_port_t* port)
+jack_set_freewheel_range (jack_client_t* client, jack_nframes_t start,
+			  jack_nframes_t end)
 {
 	jack_request_t request;
 
+	if (start >= end) {
+		return -1;
+	}
+
+	/* the engine only stops once it has seen the transport roll
+	   inside the range */
+	if (jack_transport_locate (client, start)) {
+		return -1;
+	}
+	jack_transport_start (client);
+
 	VALGRIND_MEMSET (&request, 0, sizeof(request));
 
-	request.type = RecomputeTotalLatency;
-	request.x.port_info.port_id = port->shared->id;
+	request.type = FreeWheelRange;
+	jack_uuid_copy (&request.x.freewheel_range.client_id, client->control->uuid);
+	request.x.freewheel_range.start = start;
+	request.x.freewheel_range.end = end;
 	return jack_client_deliver_request (client, &request);
 }
 
 int
-jack_set_freewheel (jack_client_t* client, int onoff)
+jack_set_freewheel_buffer_size (jack_client_t* client, jack_nframes_t nframes)
 {
 	jack_request_t request;
 
 	VALGRIND_MEMSET (&request, 0, sizeof(request));
 
-	request.type = onoff ? FreeWheel : StopFreeWheel;
-	jack_uuid_copy (&request.x.client_id, client->control->uuid);
+	request.type = SetFreeWheelBufferSize;
+	request.x.nframes = nframes;
 	return jack_client_deliver_request (client, &request);
 }
 
@@ -1649,8 +2889,9 @@ jack_session_notify (jack_client_t* client, const char *target, jack_session_eve
 
 	request.x.session.type = code;
 
-	if ( (write (client->request_fd, &request, sizeof(request))
-	      != sizeof(request)) ) {
+	/* the replies come back as a stream of their own, not framed */
+
+	if (jack_request_send (client->request_fd, &request, NULL, 0)) {
 		jack_error ("cannot send request type %d to server",
 			    request.type);
 		goto out;
@@ -1734,6 +2975,8 @@ jack_start_freewheel (jack_client_t* client)
 {
 	jack_client_control_t *control = client->control;
 
+	client->freewheeling = 1;
+
 	if (client->engine->real_time) {
 #if JACK_USE_MACH_THREADS
 		jack_drop_real_time_scheduling (client->process_thread);
@@ -1762,6 +3005,14 @@ jack_stop_freewheel (jack_client_t* client)
 #endif
 	}
 
+	/* back on FIFO; SCHED_DEADLINE is set up again from scratch,
+	   unless the kernel refused it before */
+	client->deadline.period = 0;
+	client->deadline.runtime = 0;
+	client->deadline.max_usecs = 0;
+	client->deadline.cycles = 0;
+	client->freewheeling = 0;
+
 	if (control->freewheel_cb_cbset) {
 		client->freewheel_cb (0, client->freewheel_arg);
 	}
@@ -1792,6 +3043,55 @@ jack_client_thread_suicide (jack_client_t* client, const char* reason)
 	/*NOTREACHED*/
 }
 
+static int
+jack_client_event_pending (jack_client_t* client)
+{
+	struct pollfd pfd;
+
+	pfd.fd = client->event_fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	return poll (&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+}
+
+/* Copy the next len bytes of the event stream to dst, reading
+ * whatever the socket has, up to the buffer size, when the buffer has
+ * run dry.
+ */
+static int
+jack_client_read_event (jack_client_t* client, void *dst, size_t len)
+{
+	char *d = (char*)dst;
+	ssize_t got;
+	size_t n;
+
+	while (len) {
+		if (client->event_buf_pos == client->event_buf_len) {
+			client->event_buf_pos = 0;
+			client->event_buf_len = 0;
+			if ((got = read (client->event_fd, client->event_buf,
+					 sizeof(client->event_buf))) <= 0) {
+				if (got < 0 && errno == EINTR) {
+					continue;
+				}
+				return -1;
+			}
+			client->event_buf_len = got;
+		}
+		n = client->event_buf_len - client->event_buf_pos;
+		if (n > len) {
+			n = len;
+		}
+		memcpy (d, client->event_buf + client->event_buf_pos, n);
+		client->event_buf_pos += n;
+		d += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
 static int
 jack_client_process_events (jack_client_t* client)
 {
@@ -1804,16 +3104,27 @@ jack_client_process_events (jack_client_t* client)
 
 	DEBUG ("process events");
 
-	if (client->pollfd[EVENT_POLL_INDEX].revents & POLLIN) {
+	if (!(client->pollfd[EVENT_POLL_INDEX].revents & POLLIN)) {
+		return 0;
+	}
+
+	/* the server may have sent a whole batch of events at once:
+	   read it all in one go, and keep going as long as there is more.
+	   Only the last event of a batch asks for a reply. Nothing is
+	   left in the buffer on return, as the caller only comes back
+	   when the socket polls readable. */
+
+	do {
 
 		DEBUG ("client receives an event, "
 		       "now reading on event fd");
 
 		/* server has sent us an event. process the
-		 * event and reply */
+		 * event and reply if it asks for that */
 
-		if (read (client->event_fd, &event, sizeof(event))
-		    != sizeof(event)) {
+		key = 0;
+
+		if (jack_client_read_event (client, &event, sizeof(event))) {
 			jack_error ("cannot read server event (%s)",
 				    strerror (errno));
 			return -1;
@@ -1822,10 +3133,11 @@ jack_client_process_events (jack_client_t* client)
 		if (event.type == PropertyChange) {
 			if (event.y.key_size) {
 				key = (char*)malloc (event.y.key_size);
-				if (read (client->event_fd, key, event.y.key_size) !=
-				    event.y.key_size) {
+				if (key == NULL
+				    || jack_client_read_event (client, key, event.y.key_size)) {
 					jack_error ("cannot read property change key (%s)",
 						    strerror (errno));
+					free (key);
 					return -1;
 				}
 			}
@@ -1841,6 +3153,7 @@ jack_client_process_events (jack_client_t* client)
 					port->type_info = &client->engine->port_types[port->shared->ptype_id];
 				}
 			}
+			jack_graph_mirror_event (client, &event);
 			if (control->port_register_cbset) {
 				client->port_register
 					(event.x.port_id, TRUE,
@@ -1849,6 +3162,7 @@ jack_client_process_events (jack_client_t* client)
 			break;
 
 		case PortUnregistered:
+			jack_graph_mirror_event (client, &event);
 			if (control->port_register_cbset) {
 				client->port_register
 					(event.x.port_id, FALSE,
@@ -1882,7 +3196,12 @@ jack_client_process_events (jack_client_t* client)
 					 (client, &event);
 			break;
 
+		case PortGainChanged:
+			status = jack_client_handle_port_gain (client, &event);
+			break;
+
 		case BufferSizeChange:
+			jack_port_set_period (client->engine->buffer_size);
 			jack_client_fix_port_buffers (client);
 			if (control->bufsize_cbset) {
 				status = client->bufsize
@@ -1907,7 +3226,7 @@ jack_client_process_events (jack_client_t* client)
 			break;
 
 		case AttachPortSegment:
-			jack_attach_port_segment (client, event.y.ptid);
+			jack_port_segment_announced (client, event.y.ptid);
 			break;
 
 		case StartFreewheel:
@@ -1936,31 +3255,100 @@ jack_client_process_events (jack_client_t* client)
 				client->port_rename_cb (event.y.other_id, event.x.name, event.z.other_name, client->port_rename_arg);
 			}
 			break;
+		case SyncPrepare:
+			jack_call_sync_prepare (client, &event);
+			break;
+		case ProcessSkipped:
+			if (control->skip_cbset) {
+				status = client->skip_cb (event.x.n, client->skip_arg);
+			}
+			break;
+		}
+
+		if (event.flags & JACK_EVENT_NO_REPLY) {
+			continue;
+		}
+
+		DEBUG ("client has dealt with the event, writing "
+		       "response on event fd");
+
+		if (write (client->event_fd, &status, sizeof(status))
+		    != sizeof(status)) {
+			jack_error ("cannot send event response to "
+				    "engine (%s)", strerror (errno));
+			return -1;
 		}
 
-		DEBUG ("client has dealt with the event, writing "
-		       "response on event fd");
+	} while (client->event_buf_pos < client->event_buf_len
+		 || jack_client_event_pending (client));
+
+	return 0;
+}
+
+
+#ifndef JACK_USE_MACH_THREADS
+
+/* With futex wakeups the process thread sleeps on its wakeup word
+ * instead of in poll(2), and the server nudges the word whenever it
+ * sends an event. The pollfd revents are filled in the way poll(2)
+ * would have, so the rest of the wait logic stays the same.
+ */
+static inline int
+jack_client_uses_wakeup_word (jack_client_t* client)
+{
+	return client->engine->wakeup_method == JACK_WAKEUP_FUTEX &&
+	       client->control->active &&
+	       client->graph_wait_slot >= 0;
+}
+
+static int
+jack_client_wakeup_wait (jack_client_t* client, jack_time_t usecs)
+{
+	int got;
+
+	client->pollfd[EVENT_POLL_INDEX].revents = 0;
+	client->pollfd[WAIT_POLL_INDEX].revents = 0;
+
+	got = jack_wakeup_wait (&client->engine->graph_wakeup[client->graph_wait_slot],
+				usecs);
+
+	if (got < 0) {
+		return -1;
+	}
+
+	/* on a timeout, look at the socket anyway: that is how we
+	   notice that the server has gone away */
 
-		if (write (client->event_fd, &status, sizeof(status))
-		    != sizeof(status)) {
-			jack_error ("cannot send event response to "
-				    "engine (%s)", strerror (errno));
+	if (got == 0 || (got & JACK_WAKEUP_EVENT)) {
+		if (poll (&client->pollfd[EVENT_POLL_INDEX], 1, 0) < 0) {
 			return -1;
 		}
 	}
 
+	if (got & JACK_WAKEUP_PROCESS) {
+		client->pollfd[WAIT_POLL_INDEX].revents = POLLIN;
+	}
+
 	return 0;
 }
 
+#endif /* !JACK_USE_MACH_THREADS */
 
 static int
 jack_wake_next_client (jack_client_t* client)
 {
 #ifndef JACK_USE_MACH_THREADS
-	struct pollfd pfds[1];
-	int pret = 0;
 	char c = 0;
 
+	if (client->engine->wakeup_method == JACK_WAKEUP_FUTEX &&
+	    client->graph_next_slot >= 0) {
+		/* our own handoff was consumed when we woke up, so
+		   there is nothing to clean up */
+		jack_wakeup_post (&client->engine->graph_wakeup[client->graph_next_slot],
+				  JACK_WAKEUP_PROCESS);
+		return 0;
+	}
+
 	if (write (client->graph_next_fd, &c, sizeof(c))
 	    != sizeof(c)) {
 		DEBUG ("cannot write byte to fd %d", client->graph_next_fd);
@@ -1973,32 +3361,7 @@ jack_wake_next_client (jack_client_t* client)
 	DEBUG ("client sent message to next stage by %" PRIu64 "",
 	       jack_get_microseconds ());
 
-	DEBUG ("reading cleanup byte from pipe %d\n", client->graph_wait_fd);
-
-	/* "upstream client went away?  readability is checked in
-	 * jack_client_core_wait(), but that's almost a whole cycle
-	 * before we get here.
-	 */
-
-	if (client->graph_wait_fd >= 0) {
-		pfds[0].fd = client->graph_wait_fd;
-		pfds[0].events = POLLIN;
-
-		/* 0 timeout, don't actually wait */
-		pret = poll (pfds, 1, 0);
-	}
-
-	if (pret > 0 && (pfds[0].revents & POLLIN)) {
-		if (read (client->graph_wait_fd, &c, sizeof(c))
-		    != sizeof(c)) {
-			jack_error ("cannot complete execution of the "
-				    "processing graph (%s)", strerror (errno));
-			return -1;
-		}
-	} else {
-		DEBUG ("cleanup byte from pipe %d not available?\n",
-		       client->graph_wait_fd);
-	}
+	/* the byte that woke us is read back in jack_client_core_wait() */
 #endif
 	return 0;
 }
@@ -2065,11 +3428,44 @@ jack_osx_event_thread_work (void* arg)
 
 #else /* !JACK_USE_MACH_THREADS */
 
+/* The byte that woke us for the last cycle is only read back as we go
+ * back to waiting, not between waking the next client and returning
+ * from jack_cycle_signal(), so that the rest of the chain is not kept
+ * waiting for it. If the server cleared the FIFOs in the meantime, the
+ * byte is gone already and anything there now is the next cycle's.
+ */
+static int
+jack_client_drain_wait_fd (jack_client_t* client)
+{
+	char c;
+
+	client->graph_wait_pending = 0;
+
+	if (client->graph_wait_fd < 0 ||
+	    __atomic_load_n (&client->engine->fifo_generation, __ATOMIC_ACQUIRE)
+	    != client->graph_wait_generation) {
+		return 0;
+	}
+
+	if (read (client->graph_wait_fd, &c, sizeof(c)) != sizeof(c)
+	    && errno != EAGAIN) {
+		jack_error ("cannot complete execution of the "
+			    "processing graph (%s)", strerror (errno));
+		return -1;
+	}
+
+	return 0;
+}
+
 static int
 jack_client_core_wait (jack_client_t* client)
 {
 	jack_client_control_t *control = client->control;
 
+	if (client->graph_wait_pending && jack_client_drain_wait_fd (client)) {
+		return -1;
+	}
+
 	/* this is not OS X - we're waiting on events & process wakeups */
 
 	DEBUG ("client polling on %s", client->pollmax == 2 ?
@@ -2077,7 +3473,16 @@ jack_client_core_wait (jack_client_t* client)
 	       "event_fd only");
 
 	while (1) {
-		if (poll (client->pollfd, client->pollmax, 1000) < 0) {
+		if (jack_client_uses_wakeup_word (client)) {
+			if (jack_client_wakeup_wait (client, 1000000) < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				jack_error ("wait failed in client (%s)",
+					    strerror (errno));
+				return -1;
+			}
+		} else if (poll (client->pollfd, client->pollmax, 1000) < 0) {
 			if (errno == EINTR) {
 				continue;
 			}
@@ -2130,6 +3535,7 @@ jack_client_core_wait (jack_client_t* client)
 				 */
 
 				client->graph_wait_fd = -1;
+				client->graph_wait_pending = 0;
 				client->pollmax = 1;
 			}
 		}
@@ -2142,6 +3548,11 @@ jack_client_core_wait (jack_client_t* client)
 		if (client->graph_wait_fd >= 0 &&
 		    (client->pollfd[WAIT_POLL_INDEX].revents & POLLIN)) {
 			DEBUG ("time to run process()\n");
+			if (!jack_client_uses_wakeup_word (client)) {
+				client->graph_wait_pending = 1;
+				client->graph_wait_generation = __atomic_load_n
+					(&client->engine->fifo_generation, __ATOMIC_ACQUIRE);
+			}
 			break;
 		}
 	}
@@ -2184,6 +3595,13 @@ jack_process_thread_work (void* arg)
 	client->rt_thread_ok = TRUE;
 #endif
 
+	/* counters follow the thread that opens them */
+	if (client->engine->perf_counters) {
+		jack_perf_counters_open (&client->perf);
+	}
+
+	CHECK_RT_SAFETY_INIT ();
+
 	if (control->thread_cb_cbset) {
 
 		/* client provided a thread function to run,
@@ -2199,6 +3617,14 @@ jack_process_thread_work (void* arg)
 			client->thread_init (client->thread_init_arg);
 		}
 
+		if (jack_client_warms_up (client)) {
+			jack_client_warm_up (client);
+			pthread_mutex_lock (&client_lock);
+			client->warmed_up = TRUE;
+			pthread_cond_signal (&client_ready);
+			pthread_mutex_unlock (&client_lock);
+		}
+
 		while (1) {
 			int status;
 
@@ -2269,11 +3695,19 @@ jack_nframes_t jack_cycle_wait (jack_client_t* client)
 
 	/* Time to do data processing */
 
+	JACK_WORKGROUP_UPDATE (client->engine);
+
 	control->awake_at = jack_get_microseconds ();
 	client->control->state = Running;
+	JACK_PROBE2 (client_wake, control->uuid, control->awake_at);
+
+	if (client->engine->perf_counters) {
+		jack_perf_counters_start (&client->perf);
+	}
 
 	/* begin preemption checking */
 	CHECK_PREEMPTION (client->engine, TRUE);
+	CHECK_RT_SAFETY (client, TRUE);
 
 	if (client->control->sync_cb_cbset) {
 		jack_call_sync_client (client);
@@ -2295,10 +3729,27 @@ void jack_cycle_signal (jack_client_t* client, int status)
 	}
 
 	/* end preemption checking */
+	CHECK_RT_SAFETY (client, FALSE);
 	CHECK_PREEMPTION (client->engine, FALSE);
 
+	if (client->engine->perf_counters) {
+		jack_perf_counters_stop (&client->perf, client->control);
+	}
+
 	client->control->finished_at = jack_get_microseconds ();
 	client->control->state = Finished;
+	JACK_PROBE3 (client_done, client->control->uuid,
+		     client->control->finished_at, status);
+
+	if (client->engine->deadline && !client->freewheeling
+	    && client->engine->current_time.frame_rate) {
+		jack_deadline_sample (&client->deadline,
+				      client->control->finished_at
+				      - client->control->awake_at,
+				      (jack_time_t)client->engine->buffer_size
+				      * 1000000
+				      / client->engine->current_time.frame_rate);
+	}
 
 	/* wake the next client in the chain (could be the server),
 	   and check if we were killed during the process
@@ -2332,13 +3783,30 @@ jack_start_thread (jack_client_t *client)
 {
 #ifdef USE_MLOCK
 	if (client->engine->real_time) {
-		if (client->engine->do_mlock
-		    && (mlockall (MCL_CURRENT | MCL_FUTURE) != 0)) {
+		if (client->engine->do_mlock == JACK_MLOCK_SELECTIVE) {
+			jack_port_type_id_t ptid;
+
+			/* the process thread locks its own stack */
+			jack_mlock_rt_shm (&client->engine_shm,
+					   "engine control memory");
+			jack_mlock_rt_shm (&client->control_shm,
+					   "client control memory");
+			for (ptid = 0; ptid < client->n_port_types; ++ptid) {
+				/* not yet attached if MAP_FAILED */
+				if (client->port_segment[ptid].attached_at
+				    && client->port_segment[ptid].attached_at != MAP_FAILED) {
+					jack_mlock_rt_shm (&client->port_segment[ptid],
+							   "port buffer memory");
+				}
+			}
+		} else if (client->engine->do_mlock
+			   && (mlockall (MCL_CURRENT | MCL_FUTURE) != 0)) {
 			jack_error ("cannot lock down memory for RT thread "
 				    "(%s)", strerror (errno));
 		}
 
-		if (client->engine->do_munlock) {
+		if (client->engine->do_mlock == JACK_MLOCK_ALL
+		    && client->engine->do_munlock) {
 			cleanup_mlock ();
 		}
 	}
@@ -2394,11 +3862,22 @@ int
 jack_activate (jack_client_t *client)
 {
 	jack_request_t req;
+	int rc;
 
 	VALGRIND_MEMSET (&req, 0, sizeof(req));
 
+	if (client->rt_pool == NULL && client->rt_pool_size) {
+		client->rt_pool = jack_rt_pool_new (client->rt_pool_size);
+	}
+
 	if (client->control->type == ClientInternal ||
 	    client->control->type == ClientDriver) {
+		if (client->control->type == ClientInternal
+		    && client->first_active && jack_client_warms_up (client)) {
+			/* the engine runs it, so this thread will do */
+			jack_client_warm_up (client);
+			client->first_active = FALSE;
+		}
 		goto startit;
 	}
 
@@ -2451,6 +3930,13 @@ jack_activate (jack_client_t *client)
 		}
 
 		pthread_cond_wait (&client_ready, &client_lock);
+
+		/* and, if it warms up first, for that to be done */
+		if (client->thread_ok && jack_client_warms_up (client)) {
+			while (!client->warmed_up) {
+				pthread_cond_wait (&client_ready, &client_lock);
+			}
+		}
 		pthread_mutex_unlock (&client_lock);
 
 		if (!client->thread_ok) {
@@ -2466,7 +3952,19 @@ startit:
 	req.type = ActivateClient;
 	jack_uuid_copy (&req.x.client_id, client->control->uuid);
 
-	return jack_client_deliver_request (client, &req);
+	if ((rc = jack_client_deliver_request (client, &req)) != 0) {
+		if (rc == EBUSY) {
+			jack_error ("server refused to activate: the cycle "
+				    "would be too heavily loaded");
+		}
+		return rc;
+	}
+
+	/* the mirror missed whatever happened while we were not
+	   being told */
+	jack_graph_mirror_sync (client);
+
+	return 0;
 }
 
 static int
@@ -2505,6 +4003,9 @@ jack_client_close_aux (jack_client_t *client)
 		return rc;
 	}
 
+	/* while the port type table is still attached */
+	jack_mix_runtime_free (client);
+
 	if (client->control->type == ClientExternal) {
 
 #if JACK_USE_MACH_THREADS
@@ -2526,6 +4027,8 @@ jack_client_close_aux (jack_client_t *client)
 			pthread_join (client->thread, &status);
 		}
 
+		jack_perf_counters_close (&client->perf);
+
 		if (client->control) {
 			jack_release_shm (&client->control_shm);
 			client->control = NULL;
@@ -2535,6 +4038,8 @@ jack_client_close_aux (jack_client_t *client)
 			client->engine = NULL;
 		}
 
+		jack_property_store_detach ();
+
 		if (client->port_segment) {
 			jack_port_type_id_t ptid;
 			for (ptid = 0; ptid < client->n_port_types; ++ptid)
@@ -2544,13 +4049,7 @@ jack_client_close_aux (jack_client_t *client)
 		}
 
 #ifndef JACK_USE_MACH_THREADS
-		if (client->graph_wait_fd >= 0) {
-			close (client->graph_wait_fd);
-		}
-
-		if (client->graph_next_fd >= 0) {
-			close (client->graph_next_fd);
-		}
+		jack_client_close_fifos (client);
 #endif
 
 		close (client->event_fd);
@@ -2563,12 +4062,26 @@ jack_client_close_aux (jack_client_t *client)
 
 	}
 
+	if (client->trace_shm.attached_at) {
+		jack_release_shm (&client->trace_shm);
+	}
+
+	if (client->meter_shm.attached_at) {
+		jack_release_shm (&client->meter_shm);
+	}
+
+	if (client->history_shm.attached_at) {
+		jack_release_shm (&client->history_shm);
+	}
+
 	for (node = client->ports; node; node = jack_slist_next (node))
 		free (node->data);
 	jack_slist_free (client->ports);
+	client->ports = NULL;
 	for (node = client->ports_ext; node; node = jack_slist_next (node))
 		free (node->data);
 	jack_slist_free (client->ports_ext);
+	jack_graph_mirror_free (client);
 	jack_client_free (client);
 	jack_messagebuffer_exit ();
 
@@ -2594,85 +4107,338 @@ jack_get_buffer_size (jack_client_t *client)
 }
 
 int
-jack_set_buffer_size (jack_client_t *client, jack_nframes_t nframes)
+jack_set_buffer_size (jack_client_t *client, jack_nframes_t nframes)
+{
+#ifdef DO_BUFFER_RESIZE
+	jack_request_t req;
+
+	VALGRIND_MEMSET (&req, 0, sizeof(req));
+
+	if (nframes < 1 || nframes > 16384) {
+		return ERANGE;
+	}
+
+	req.type = SetBufferSize;
+	req.x.nframes = nframes;
+
+	return jack_client_deliver_request (client, &req);
+#else
+	return ENOSYS;
+
+#endif  /* DO_BUFFER_RESIZE */
+}
+
+int
+jack_change_sample_rate (jack_client_t *client, jack_nframes_t rate)
+{
+	jack_request_t req;
+
+	VALGRIND_MEMSET (&req, 0, sizeof(req));
+
+	if (rate == 0) {
+		return EINVAL;
+	}
+
+	req.type = SetSampleRate;
+	req.x.nframes = rate;
+
+	return jack_client_deliver_request (client, &req);
+}
+
+int
+jack_connect (jack_client_t *client, const char *source_port,
+	      const char *destination_port)
+{
+	jack_request_t req;
+
+	VALGRIND_MEMSET (&req, 0, sizeof(req));
+
+	req.type = ConnectPorts;
+
+	snprintf (req.x.connect.source_port,
+		  sizeof(req.x.connect.source_port), "%s", source_port);
+	snprintf (req.x.connect.destination_port,
+		  sizeof(req.x.connect.destination_port),
+		  "%s", destination_port);
+
+	return jack_client_deliver_request (client, &req);
+}
+
+int
+jack_port_disconnect (jack_client_t *client, jack_port_t *port)
+{
+	jack_request_t req;
+
+	pthread_mutex_lock (&port->connection_lock);
+
+	if (port->connections == NULL) {
+		pthread_mutex_unlock (&port->connection_lock);
+		return 0;
+	}
+
+	pthread_mutex_unlock (&port->connection_lock);
+
+	VALGRIND_MEMSET (&req, 0, sizeof(req));
+
+	req.type = DisconnectPort;
+	req.x.port_info.port_id = port->shared->id;
+
+	return jack_client_deliver_request (client, &req);
+}
+
+int
+jack_disconnect (jack_client_t *client, const char *source_port,
+		 const char *destination_port)
+{
+	jack_request_t req;
+
+	VALGRIND_MEMSET (&req, 0, sizeof(req));
+
+	req.type = DisconnectPorts;
+
+	snprintf (req.x.connect.source_port,
+		  sizeof(req.x.connect.source_port), "%s", source_port);
+	snprintf (req.x.connect.destination_port,
+		  sizeof(req.x.connect.destination_port),
+		  "%s", destination_port);
+
+	return jack_client_deliver_request (client, &req);
+}
+
+int
+jack_set_connection_gain (jack_client_t *client, const char *source_port,
+			  const char *destination_port, float gain)
+{
+	jack_request_t req;
+
+	if (!isfinite (gain)) {
+		jack_error ("connection gain must be finite");
+		return -1;
+	}
+
+	VALGRIND_MEMSET (&req, 0, sizeof(req));
+
+	req.type = SetConnectionGain;
+
+	snprintf (req.x.connection_gain.source_port,
+		  sizeof(req.x.connection_gain.source_port), "%s", source_port);
+	snprintf (req.x.connection_gain.destination_port,
+		  sizeof(req.x.connection_gain.destination_port),
+		  "%s", destination_port);
+	req.x.connection_gain.gain = gain;
+
+	return jack_client_deliver_request (client, &req);
+}
+
+int
+jack_set_async_notifications (jack_client_t *client, int onoff)
+{
+	client->control->async_events = (onoff != 0);
+	return 0;
+}
+
+int
+jack_set_process_pipelined (jack_client_t *client, int onoff)
+{
+	client->control->pipelined = (onoff != 0);
+	return 0;
+}
+
+int
+jack_set_process_async (jack_client_t *client, int onoff)
+{
+	if (client->control->active) {
+		jack_error ("jack_set_process_async() called on an active client");
+		return -1;
+	}
+
+	client->control->async = (onoff != 0);
+	return 0;
+}
+
+int
+jack_set_process_decimation (jack_client_t *client, unsigned int periods)
+{
+	if (client->control->active) {
+		jack_error ("jack_set_process_decimation() called on an active client");
+		return -1;
+	}
+
+	if (periods > 1 && !client->history_shm.attached_at) {
+		if (client->engine->history_shm_index < 0) {
+			jack_error ("the server keeps no port history "
+				    "(see jackd --async-history)");
+			return -1;
+		}
+		client->history_shm.index = client->engine->history_shm_index;
+		if (jack_attach_shm (&client->history_shm)) {
+			jack_error ("cannot attach to the port history (%s)",
+				    strerror (errno));
+			client->history_shm.attached_at = NULL;
+			return -1;
+		}
+		jack_mlock_rt_shm (&client->history_shm, "port history memory");
+	}
+
+	if (periods > client->engine->history_periods) {
+		periods = client->engine->history_periods;
+	}
+	client->control->decimation = periods;
+	if (periods > 1) {
+		client->control->async = TRUE;
+	}
+	return 0;
+}
+
+const jack_default_audio_sample_t *
+jack_port_get_history (jack_client_t *client, jack_port_t *port,
+		       jack_nframes_t *nframes)
+{
+	jack_control_t *engine = client->engine;
+	jack_port_t *source;
+	int32_t slot;
+	const float *history;
+
+	*nframes = 0;
+
+	if (!client->history_shm.attached_at || !client->control->delayed
+	    || engine->async_decimation < 2
+	    || !(port->shared->flags & JackPortIsInput)
+	    || port->connections == NULL
+	    || jack_slist_next (port->connections) != NULL) {
+		return NULL;
+	}
+
+	source = (jack_port_t*)port->connections->data;
+	if ((slot = source->shared->history_slot) < 0) {
+		return NULL;
+	}
+
+	history = (const float*)jack_shm_addr (&client->history_shm);
+	*nframes = engine->async_decimation * engine->buffer_size;
+
+	return history + ((size_t)slot * 2 + engine->history_block)
+	       * engine->history_periods * engine->history_frames;
+}
+
+int
+jack_set_graph_mirror (jack_client_t *client, int onoff)
+{
+	if (client->control->active) {
+		jack_error ("jack_set_graph_mirror() called on an active client");
+		return -1;
+	}
+
+	if (onoff && client->mirror == NULL) {
+		if (jack_graph_mirror_new (client)) {
+			jack_error ("cannot allocate graph mirror");
+			return -1;
+		}
+	} else if (!onoff) {
+		jack_graph_mirror_free (client);
+	}
+
+	client->control->graph_mirror = (onoff != 0);
+	return 0;
+}
+
+int
+jack_set_shm_requests (jack_client_t *client, int onoff)
 {
-#ifdef DO_BUFFER_RESIZE
-	jack_request_t req;
-
-	VALGRIND_MEMSET (&req, 0, sizeof(req));
-
-	if (nframes < 1 || nframes > 16384) {
-		return ERANGE;
+	if (client->request_fd < 0) {
+		/* internal clients call the engine directly anyway */
+		return 0;
 	}
 
-	req.type = SetBufferSize;
-	req.x.nframes = nframes;
+	if (onoff && !client->engine->shm_requests) {
+		jack_error ("the server does not take requests through"
+			    " shared memory");
+		return -1;
+	}
 
-	return jack_client_deliver_request (client, &req);
-#else
-	return ENOSYS;
+	pthread_mutex_lock (&client->shm_request_lock);
+	client->control->shm_requests = (onoff != 0);
+	pthread_mutex_unlock (&client->shm_request_lock);
 
-#endif  /* DO_BUFFER_RESIZE */
+	return 0;
 }
 
 int
-jack_connect (jack_client_t *client, const char *source_port,
-	      const char *destination_port)
+jack_set_process_thread_cpus (jack_client_t *client, const char *cpus)
 {
-	jack_request_t req;
+	if (cpus == NULL) {
+		cpus = "";
+	}
 
-	VALGRIND_MEMSET (&req, 0, sizeof(req));
+	if (strlen (cpus) >= sizeof(client->process_cpus)) {
+		jack_error ("CPU list \"%s\" is too long", cpus);
+		return -1;
+	}
 
-	req.type = ConnectPorts;
+	strcpy (client->process_cpus, cpus);
 
-	snprintf (req.x.connect.source_port,
-		  sizeof(req.x.connect.source_port), "%s", source_port);
-	snprintf (req.x.connect.destination_port,
-		  sizeof(req.x.connect.destination_port),
-		  "%s", destination_port);
+	if (client->thread_ok) {
+		return jack_thread_set_cpus (client->thread_id, cpus);
+	}
 
-	return jack_client_deliver_request (client, &req);
+	return 0;
 }
 
 int
-jack_port_disconnect (jack_client_t *client, jack_port_t *port)
+jack_change_connections (jack_client_t *client,
+			 jack_connection_change_t *changes,
+			 uint32_t count)
 {
 	jack_request_t req;
+	jack_connection_op_t *ops;
+	uint32_t done, n, chunk;
+	int ret = 0;
 
-	pthread_mutex_lock (&port->connection_lock);
-
-	if (port->connections == NULL) {
-		pthread_mutex_unlock (&port->connection_lock);
+	if (count == 0) {
 		return 0;
 	}
 
-	pthread_mutex_unlock (&port->connection_lock);
+	chunk = count < JACK_CONNECT_BATCH_MAX ? count : JACK_CONNECT_BATCH_MAX;
 
-	VALGRIND_MEMSET (&req, 0, sizeof(req));
+	if ((ops = (jack_connection_op_t*)malloc (chunk * sizeof(*ops))) == NULL) {
+		return -1;
+	}
 
-	req.type = DisconnectPort;
-	req.x.port_info.port_id = port->shared->id;
+	for (done = 0; done < count && ret == 0; done += chunk) {
 
-	return jack_client_deliver_request (client, &req);
-}
+		if (count - done < chunk) {
+			chunk = count - done;
+		}
 
-int
-jack_disconnect (jack_client_t *client, const char *source_port,
-		 const char *destination_port)
-{
-	jack_request_t req;
+		for (n = 0; n < chunk; ++n) {
+			snprintf (ops[n].source_port, sizeof(ops[n].source_port),
+				  "%s", changes[done + n].source_port);
+			snprintf (ops[n].destination_port, sizeof(ops[n].destination_port),
+				  "%s", changes[done + n].destination_port);
+			ops[n].connect = changes[done + n].connect;
+			ops[n].status = -1;
+		}
 
-	VALGRIND_MEMSET (&req, 0, sizeof(req));
+		VALGRIND_MEMSET (&req, 0, sizeof(req));
 
-	req.type = DisconnectPorts;
+		req.type = ConnectBatch;
+		req.x.connect_batch.count = chunk;
+		req.x.connect_batch.ops = ops;
 
-	snprintf (req.x.connect.source_port,
-		  sizeof(req.x.connect.source_port), "%s", source_port);
-	snprintf (req.x.connect.destination_port,
-		  sizeof(req.x.connect.destination_port),
-		  "%s", destination_port);
+		ret = jack_client_deliver_request (client, &req);
 
-	return jack_client_deliver_request (client, &req);
+		for (n = 0; n < chunk; ++n) {
+			changes[done + n].status = ret ? -1 : ops[n].status;
+		}
+	}
+
+	for (; done < count; ++done) {
+		changes[done].status = -1;
+	}
+
+	free (ops);
+
+	return ret;
 }
 
 void
@@ -2809,6 +4575,21 @@ jack_set_port_rename_callback (jack_client_t *client,
 	return 0;
 }
 
+int
+jack_set_process_skip_callback (jack_client_t *client,
+				JackProcessSkipCallback callback,
+				void *arg)
+{
+	if (client->control->active) {
+		jack_error ("You cannot set callbacks on an active client.");
+		return -1;
+	}
+	client->skip_arg = arg;
+	client->skip_cb = callback;
+	client->control->skip_cbset = (callback != NULL);
+	return 0;
+}
+
 int
 jack_set_port_registration_callback (jack_client_t *client,
 				     JackPortRegistrationCallback callback,
@@ -2950,6 +4731,30 @@ jack_get_uuid_for_client_name (jack_client_t *client, const char *client_name)
 	return strdup (buf);
 }
 
+int
+jack_get_client_load (jack_client_t *client, const char *client_name,
+		      jack_client_load_t *load)
+{
+	jack_request_t request;
+	size_t len = strlen (client_name) + 1;
+
+	if (len > sizeof(request.x.client_load.name)) {
+		return -1;
+	}
+
+	VALGRIND_MEMSET (&request, 0, sizeof(request));
+
+	request.type = GetClientLoad;
+	memcpy (request.x.client_load.name, client_name, len);
+
+	if (jack_client_deliver_request (client, &request)) {
+		return -1;
+	}
+
+	*load = request.x.client_load.load;
+	return 0;
+}
+
 char *
 jack_client_get_uuid (jack_client_t *client)
 {
@@ -2975,6 +4780,286 @@ jack_reserve_client_name (jack_client_t *client, const char *name, const char *u
 	return jack_client_deliver_request (client, &request);
 }
 
+/* A jack_get_ports() pattern that is a literal string, optionally
+ * anchored with '^' and/or '$' or followed by ".*", matches the same
+ * names as the regex would without compiling one.
+ */
+typedef struct {
+	char literal[JACK_PORT_NAME_SIZE];
+	size_t len;
+	int anchored;
+	int end_anchored;
+} jack_port_pattern_t;
+
+typedef struct {
+	unsigned long flags;
+	jack_port_pattern_t *name_literal;
+	regex_t *name_regex;
+	jack_port_pattern_t *type_literal;
+	regex_t *type_regex;
+} jack_port_filter_t;
+
+#define JACK_REGEX_CACHE_SIZE 8
+
+struct _jack_regex_entry {
+	char *pattern;
+	regex_t regex;
+	unsigned long used;
+};
+
+static int
+jack_port_pattern_parse (jack_port_pattern_t *pat, const char *pattern)
+{
+	const char *p = pattern;
+	size_t len = 0;
+
+	pat->anchored = (*p == '^');
+	pat->end_anchored = 0;
+
+	if (pat->anchored) {
+		p++;
+	}
+
+	while (*p) {
+		if (p[0] == '.' && p[1] == '*' &&
+		    (p[2] == '\0' || (p[2] == '$' && p[3] == '\0'))) {
+			break;
+		}
+		if (p[0] == '$' && p[1] == '\0') {
+			pat->end_anchored = 1;
+			break;
+		}
+		if (*p == '\\') {
+			/* only escaped metacharacters: \< and friends
+			   are GNU operators */
+			if (p[1] == '\0' || strchr (".[]()|*+?{}^$\\", p[1]) == NULL) {
+				return -1;
+			}
+			p++;
+		} else if (strchr (".[]()|*+?{}^$", *p)) {
+			return -1;
+		}
+		if (len + 1 >= sizeof(pat->literal)) {
+			return -1;
+		}
+		pat->literal[len++] = *p++;
+	}
+
+	pat->literal[len] = '\0';
+	pat->len = len;
+
+	return 0;
+}
+
+static int
+jack_port_pattern_match (const jack_port_pattern_t *pat, const char *str)
+{
+	size_t len;
+
+	if (pat->anchored && pat->end_anchored) {
+		return strcmp (str, pat->literal) == 0;
+	}
+	if (pat->anchored) {
+		return strncmp (str, pat->literal, pat->len) == 0;
+	}
+	if (pat->end_anchored) {
+		len = strlen (str);
+		return len >= pat->len &&
+		       strcmp (str + len - pat->len, pat->literal) == 0;
+	}
+
+	return strstr (str, pat->literal) != NULL;
+}
+
+/* call with client->regex_lock held; the result stays valid until the
+   lock is released */
+static regex_t *
+jack_regex_get (jack_client_t *client, const char *pattern)
+{
+	struct _jack_regex_entry *entry, *victim;
+	int i;
+
+	if (client->regex_cache == NULL) {
+		client->regex_cache = (struct _jack_regex_entry*)
+				      calloc (JACK_REGEX_CACHE_SIZE, sizeof(*entry));
+		if (client->regex_cache == NULL) {
+			return NULL;
+		}
+	}
+
+	victim = &client->regex_cache[0];
+
+	for (i = 0; i < JACK_REGEX_CACHE_SIZE; i++) {
+		entry = &client->regex_cache[i];
+		if (entry->pattern && strcmp (entry->pattern, pattern) == 0) {
+			entry->used = ++client->regex_clock;
+			return &entry->regex;
+		}
+		if (victim->pattern &&
+		    (entry->pattern == NULL || entry->used < victim->used)) {
+			victim = entry;
+		}
+	}
+
+	if (victim->pattern) {
+		regfree (&victim->regex);
+		free (victim->pattern);
+		victim->pattern = NULL;
+	}
+
+	if (regcomp (&victim->regex, pattern, REG_EXTENDED | REG_NOSUB)) {
+		return NULL;
+	}
+
+	if ((victim->pattern = strdup (pattern)) == NULL) {
+		regfree (&victim->regex);
+		return NULL;
+	}
+
+	victim->used = ++client->regex_clock;
+
+	return &victim->regex;
+}
+
+void
+jack_client_regex_free (jack_client_t *client)
+{
+	int i;
+
+	if (client->regex_cache == NULL) {
+		return;
+	}
+
+	for (i = 0; i < JACK_REGEX_CACHE_SIZE; i++) {
+		if (client->regex_cache[i].pattern) {
+			regfree (&client->regex_cache[i].regex);
+			free (client->regex_cache[i].pattern);
+		}
+	}
+
+	free (client->regex_cache);
+	client->regex_cache = NULL;
+}
+
+static int
+jack_port_filter_matches (jack_control_t *engine, jack_port_shared_t *psp,
+			  const jack_port_filter_t *filter)
+{
+	const char *type_name;
+
+	if (!psp->in_use) {
+		return 0;
+	}
+
+	if (filter->flags && (psp->flags & filter->flags) != filter->flags) {
+		return 0;
+	}
+
+	if (filter->name_literal &&
+	    !jack_port_pattern_match (filter->name_literal, psp->name)) {
+		return 0;
+	}
+
+	if (filter->name_regex &&
+	    regexec (filter->name_regex, psp->name, 0, NULL, 0)) {
+		return 0;
+	}
+
+	if (filter->type_literal || filter->type_regex) {
+		type_name = engine->port_types[psp->ptype_id].type_name;
+
+		if (filter->type_literal &&
+		    !jack_port_pattern_match (filter->type_literal, type_name)) {
+			return 0;
+		}
+		if (filter->type_regex &&
+		    regexec (filter->type_regex, type_name, 0, NULL, 0)) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int
+jack_port_name_address_cmp (const void *a, const void *b)
+{
+	const char *x = *(const char* const*)a;
+	const char *y = *(const char* const*)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Find the ports whose names start with an anchored literal through
+ * the server's sorted index. Returns -1 if the index changed under us
+ * (or looks inconsistent), in which case the caller must scan.
+ */
+static long
+jack_get_ports_sorted (jack_control_t *engine, const jack_port_filter_t *filter,
+		       const char **matching_ports, unsigned long size)
+{
+	jack_port_id_t *sorted = jack_port_sorted_table (engine);
+	const char *prefix = filter->name_literal->literal;
+	size_t len = filter->name_literal->len;
+	jack_port_shared_t *psp;
+	jack_port_id_t id;
+	uint32_t seq, cnt, lo, hi, mid;
+	unsigned long match_cnt = 0;
+
+	seq = __atomic_load_n (&engine->port_sorted_seq, __ATOMIC_ACQUIRE);
+	if (seq & 1) {
+		return -1;
+	}
+
+	cnt = engine->port_sorted_cnt;
+	if (cnt > engine->port_max) {
+		return -1;
+	}
+
+	lo = 0;
+	hi = cnt;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if ((id = sorted[mid]) >= engine->port_max) {
+			return -1;
+		}
+		if (strcmp (engine->ports[id].name, prefix) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	for (; lo < cnt; lo++) {
+		if ((id = sorted[lo]) >= engine->port_max) {
+			return -1;
+		}
+		psp = &engine->ports[id];
+		if (strncmp (psp->name, prefix, len) != 0) {
+			break;
+		}
+		if (jack_port_filter_matches (engine, psp, filter)) {
+			if (match_cnt == size) {
+				return -1;
+			}
+			matching_ports[match_cnt++] = psp->name;
+		}
+	}
+
+	__atomic_thread_fence (__ATOMIC_ACQUIRE);
+	if (__atomic_load_n (&engine->port_sorted_seq, __ATOMIC_RELAXED) != seq) {
+		return -1;
+	}
+
+	/* callers expect port ID order, as a scan returns them; names
+	   live in ports[], so that is address order */
+	qsort (matching_ports, match_cnt, sizeof(const char*),
+	       jack_port_name_address_cmp);
+
+	return match_cnt;
+}
+
 const char **
 jack_get_ports (jack_client_t *client,
 		const char *port_name_pattern,
@@ -2983,68 +5068,83 @@ jack_get_ports (jack_client_t *client,
 {
 	jack_control_t *engine;
 	const char **matching_ports;
-	unsigned long match_cnt;
+	long match_cnt;
 	jack_port_shared_t *psp;
-	unsigned long i;
-	regex_t port_regex;
-	regex_t type_regex;
-	int matching;
+	unsigned long i, limit;
+	jack_port_pattern_t name_literal;
+	jack_port_pattern_t type_literal;
+	jack_port_filter_t filter;
+	int by_name, by_type;
+	int locked = 0;
 
 	engine = client->engine;
+	matching_ports = NULL;
+	match_cnt = 0;
+
+	memset (&filter, 0, sizeof(filter));
+	filter.flags = flags;
+
+	by_name = port_name_pattern && port_name_pattern[0];
+	by_type = type_name_pattern && type_name_pattern[0];
 
-	if (port_name_pattern && port_name_pattern[0]) {
-		regcomp (&port_regex, port_name_pattern,
-			 REG_EXTENDED | REG_NOSUB);
+	if (by_name && jack_port_pattern_parse (&name_literal, port_name_pattern) == 0) {
+		filter.name_literal = &name_literal;
 	}
-	if (type_name_pattern && type_name_pattern[0]) {
-		regcomp (&type_regex, type_name_pattern,
-			 REG_EXTENDED | REG_NOSUB);
+	if (by_type && jack_port_pattern_parse (&type_literal, type_name_pattern) == 0) {
+		filter.type_literal = &type_literal;
+	}
+
+	if ((by_name && !filter.name_literal) || (by_type && !filter.type_literal)) {
+		pthread_mutex_lock (&client->regex_lock);
+		locked = 1;
+
+		if (by_name && !filter.name_literal &&
+		    (filter.name_regex = jack_regex_get (client, port_name_pattern)) == NULL) {
+			goto out;
+		}
+		if (by_type && !filter.type_literal &&
+		    (filter.type_regex = jack_regex_get (client, type_name_pattern)) == NULL) {
+			goto out;
+		}
 	}
 
 	psp = engine->ports;
-	match_cnt = 0;
 
-	if ((matching_ports = (const char**)malloc (sizeof(char *) * (engine->port_max + 1))) == NULL) {
-		return NULL;
+	/* entries past port_high have never been used */
+	limit = __atomic_load_n (&engine->port_high, __ATOMIC_ACQUIRE);
+
+	if ((matching_ports = (const char**)malloc (sizeof(char *) * (limit + 1))) == NULL) {
+		goto out;
 	}
 
-	for (i = 0; i < engine->port_max; i++) {
-		matching = 1;
+	match_cnt = -1;
 
-		if (!psp[i].in_use) {
-			continue;
-		}
+	if (filter.name_literal && filter.name_literal->anchored &&
+	    filter.name_literal->len) {
+		match_cnt = jack_get_ports_sorted (engine, &filter,
+						   matching_ports, limit);
+	}
 
-		if (flags) {
-			if ((psp[i].flags & flags) != flags) {
-				matching = 0;
-			}
-		}
+	if (match_cnt < 0) {
+		uint32_t *port_flags = jack_port_flags_column (engine);
 
-		if (matching && port_name_pattern && port_name_pattern[0]) {
-			if (regexec (&port_regex, psp[i].name, 0, NULL, 0)) {
-				matching = 0;
+		match_cnt = 0;
+		for (i = jack_port_next_in_use (engine, 0, limit); i < limit;
+		     i = jack_port_next_in_use (engine, i + 1, limit)) {
+			/* the flags column rules most ports out without
+			   touching ports[] */
+			if (flags && (port_flags[i] & flags) != flags) {
+				continue;
 			}
-		}
-
-		if (matching && type_name_pattern && type_name_pattern[0]) {
-			jack_port_type_id_t ptid = psp[i].ptype_id;
-			if (regexec (&type_regex,
-				     engine->port_types[ptid].type_name,
-				     0, NULL, 0)) {
-				matching = 0;
+			if (jack_port_filter_matches (engine, &psp[i], &filter)) {
+				matching_ports[match_cnt++] = psp[i].name;
 			}
 		}
-
-		if (matching) {
-			matching_ports[match_cnt++] = psp[i].name;
-		}
-	}
-	if (port_name_pattern && port_name_pattern[0]) {
-		regfree (&port_regex);
 	}
-	if (type_name_pattern && type_name_pattern[0]) {
-		regfree (&type_regex);
+
+out:
+	if (locked) {
+		pthread_mutex_unlock (&client->regex_lock);
 	}
 
 	if (match_cnt == 0) {
@@ -3154,6 +5254,12 @@ jack_event_type_name (JackEventType type)
 		return "property change callback";
 	case PortRename:
 		return "port rename";
+	case SyncPrepare:
+		return "transport sync prepare";
+	case ProcessSkipped:
+		return "process skipped";
+	case PortGainChanged:
+		return "connection gain changed";
 	default:
 		break;
 	}
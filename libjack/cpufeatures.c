@@ -0,0 +1,340 @@
+/*
+   Runtime CPU feature detection, for choosing between the versions of
+   the mixing, conversion and packing kernels, and the denormal policy
+   of the threads libjack creates.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+   The features are found once, on first use, and kept: the port mixdown
+   functions in port.c, the sample converters in memops.c and the
+   netjack packers all choose their versions from the same answer.
+   $JACK_CPU_MASK, a number, masks out features, to try the plainer
+   versions on a machine that has the newer ones.
+
+   Denormal floats are slow on most CPUs: a decaying reverb tail can
+   run a process callback ten times over its usual time. Threads made
+   by jack_client_create_thread() set the flush-to-zero and
+   denormals-are-zero modes of the policy before they run any client
+   code; see jack_set_denormal_policy().
+ */
+
+#include <config.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+#include "cpufeatures.h"
+#include "intsimd.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#elif defined(__linux__) && (defined(__arm__) || defined(__aarch64__))
+#include <sys/auxv.h>
+#endif
+
+#define JACK_CPU_DETECTED (1U << 31)
+
+static unsigned int cpu_features;
+
+#if defined(__i386__) || defined(__x86_64__)
+
+static unsigned int
+jack_cpu_detect (void)
+{
+	unsigned int eax, ebx, ecx, edx;
+	unsigned int xcr0 = 0;
+	unsigned int f = 0;
+
+	if (__get_cpuid (0x80000000, &eax, &ebx, &ecx, &edx)
+	    && eax >= 0x80000001
+	    && __get_cpuid (0x80000001, &eax, &ebx, &ecx, &edx)
+	    && (edx & (1U << 31))) {
+		f |= JACK_CPU_3DNOW;
+	}
+
+	if (!__get_cpuid (1, &eax, &ebx, &ecx, &edx)) {
+		return f;
+	}
+
+	if (edx & (1 << 25)) {
+		f |= JACK_CPU_SSE;
+	}
+	if (edx & (1 << 26)) {
+		f |= JACK_CPU_SSE2;
+	}
+	if (ecx & (1 << 0)) {
+		f |= JACK_CPU_SSE3;
+	}
+	if (ecx & (1 << 9)) {
+		f |= JACK_CPU_SSSE3;
+	}
+
+	/* DAZ is in the MXCSR mask fxsave reports; an empty mask means
+	   the default one, which does not have it */
+	if ((edx & (1 << 24)) && (f & JACK_CPU_SSE)) {
+		uint8_t area[512] __attribute__((aligned(16)));
+		uint32_t mask;
+
+		memset (area, 0, sizeof(area));
+		asm volatile ("fxsave %0" : "=m" (area));
+		memcpy (&mask, area + 28, sizeof(mask));
+		if (mask & 0x40) {
+			f |= JACK_CPU_DAZ;
+		}
+	}
+
+	/* AVX needs the OS to save the YMM state as well */
+	if ((ecx & (1 << 27)) && (ecx & (1 << 28))) {
+		asm volatile ("xgetbv" : "=a" (xcr0), "=d" (edx) : "c" (0));
+		if ((xcr0 & 0x6) == 0x6) {
+			f |= JACK_CPU_AVX;
+			if (ecx & (1 << 12)) {
+				f |= JACK_CPU_FMA;
+			}
+		}
+	}
+
+	if ((f & JACK_CPU_AVX) && __get_cpuid_max (0, NULL) >= 7) {
+		__cpuid_count (7, 0, eax, ebx, ecx, edx);
+		if (ebx & (1 << 5)) {
+			f |= JACK_CPU_AVX2;
+		}
+		/* and opmask and ZMM state for AVX-512 */
+		if ((ebx & (1 << 16)) && (xcr0 & 0xe6) == 0xe6) {
+			f |= JACK_CPU_AVX512F;
+		}
+	}
+
+	return f;
+}
+
+#elif defined(__aarch64__)
+
+static unsigned int
+jack_cpu_detect (void)
+{
+	/* NEON is part of the base architecture */
+	unsigned int f = JACK_CPU_NEON;
+
+#if defined(__linux__) && defined(HWCAP_SVE)
+	if (getauxval (AT_HWCAP) & HWCAP_SVE) {
+		f |= JACK_CPU_SVE;
+	}
+#endif
+	return f;
+}
+
+#elif defined(__arm__)
+
+static unsigned int
+jack_cpu_detect (void)
+{
+#if defined(__linux__) && defined(HWCAP_ARM_NEON)
+	if (getauxval (AT_HWCAP) & HWCAP_ARM_NEON) {
+		return JACK_CPU_NEON;
+	}
+#endif
+	return 0;
+}
+
+#else
+
+static unsigned int
+jack_cpu_detect (void)
+{
+	return 0;
+}
+
+#endif
+
+unsigned int
+jack_cpu_features (void)
+{
+	unsigned int f = __atomic_load_n (&cpu_features, __ATOMIC_RELAXED);
+
+	if (!(f & JACK_CPU_DETECTED)) {
+		const char *str = getenv ("JACK_CPU_MASK");
+
+		/* racing callers all find the same thing */
+		f = jack_cpu_detect ();
+		if (str) {
+			f &= strtoul (str, NULL, 0);
+		}
+		f |= JACK_CPU_DETECTED;
+		__atomic_store_n (&cpu_features, f, __ATOMIC_RELAXED);
+	}
+
+	return f & ~JACK_CPU_DETECTED;
+}
+
+const char *
+jack_cpu_features_name (void)
+{
+	static const struct {
+		unsigned int feature;
+		const char *name;
+	} names[] = {
+		{ JACK_CPU_SSE, " SSE" },
+		{ JACK_CPU_SSE2, " SSE2" },
+		{ JACK_CPU_SSE3, " SSE3" },
+		{ JACK_CPU_SSSE3, " SSSE3" },
+		{ JACK_CPU_AVX, " AVX" },
+		{ JACK_CPU_AVX2, " AVX2" },
+		{ JACK_CPU_AVX512F, " AVX-512F" },
+		{ JACK_CPU_FMA, " FMA" },
+		{ JACK_CPU_3DNOW, " 3DNow!" },
+		{ JACK_CPU_DAZ, " DAZ" },
+		{ JACK_CPU_NEON, " NEON" },
+		{ JACK_CPU_SVE, " SVE" },
+	};
+	static char buf[128];
+	unsigned int f = jack_cpu_features ();
+	size_t i;
+
+	if (buf[0] == '\0') {
+		char tmp[sizeof(buf)] = "";
+
+		for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+			if (f & names[i].feature) {
+				strcat (tmp, names[i].name);
+			}
+		}
+		strcpy (buf, tmp[0] ? tmp + 1 : "none");
+	}
+
+	return buf;
+}
+
+/* the old encoding, which port.c's ARCH_* macros read */
+
+#ifdef USE_DYNSIMD
+
+#if defined(ARCH_X86) || defined(ARCH_ARM)
+int cpu_type = 0;
+#endif
+
+void
+jack_cpu_dispatch_init (void)
+{
+#if defined(ARCH_X86)
+	unsigned int f = jack_cpu_features ();
+	int sse = (f & JACK_CPU_SSE3) ? 3 : (f & JACK_CPU_SSE2) ? 2
+		  : (f & JACK_CPU_SSE) ? 1 : 0;
+	int avx = (f & JACK_CPU_AVX512F) ? 2 : (f & JACK_CPU_AVX) ? 1 : 0;
+	int tdnow = (f & JACK_CPU_3DNOW) ? 1 : 0;
+	int fma = (f & JACK_CPU_FMA) ? 1 : 0;
+
+	cpu_type = (fma << 24) | (avx << 16) | (tdnow << 8) | sse;
+#elif defined(ARCH_ARM)
+	cpu_type = jack_cpu_has (JACK_CPU_NEON);
+#endif
+	jack_port_set_funcs ();
+}
+
+#else   /* USE_DYNSIMD */
+
+void
+jack_cpu_dispatch_init (void)
+{
+}
+
+#endif  /* USE_DYNSIMD */
+
+/* denormals */
+
+static int denormal_policy = -1;
+
+static int
+jack_denormal_default_policy (void)
+{
+	const char *str = getenv ("JACK_DENORMALS");
+	int policy = 0;
+
+	if (str == NULL) {
+		return JACK_DENORMALS_FTZ | JACK_DENORMALS_DAZ;
+	}
+	if (strstr (str, "ftz")) {
+		policy |= JACK_DENORMALS_FTZ;
+	}
+	if (strstr (str, "daz")) {
+		policy |= JACK_DENORMALS_DAZ;
+	}
+	return policy;
+}
+
+int
+jack_get_denormal_policy (void)
+{
+	int policy = __atomic_load_n (&denormal_policy, __ATOMIC_RELAXED);
+
+	if (policy < 0) {
+		policy = jack_denormal_default_policy ();
+		__atomic_store_n (&denormal_policy, policy, __ATOMIC_RELAXED);
+	}
+	return policy;
+}
+
+int
+jack_set_denormal_policy (int policy)
+{
+	if (policy & ~(JACK_DENORMALS_FTZ | JACK_DENORMALS_DAZ)) {
+		jack_error ("unknown denormal policy 0x%x", policy);
+		return -1;
+	}
+	__atomic_store_n (&denormal_policy, policy, __ATOMIC_RELAXED);
+	return 0;
+}
+
+void
+jack_denormals_apply (void)
+{
+	int policy = jack_get_denormal_policy ();
+
+	if (policy == 0) {
+		return;
+	}
+
+#if defined(__i386__) || defined(__x86_64__)
+	if (jack_cpu_has (JACK_CPU_SSE)) {
+		uint32_t csr;
+
+		asm volatile ("stmxcsr %0" : "=m" (csr));
+		if (policy & JACK_DENORMALS_FTZ) {
+			csr |= 0x8000;
+		}
+		if ((policy & JACK_DENORMALS_DAZ) && jack_cpu_has (JACK_CPU_DAZ)) {
+			csr |= 0x0040;
+		}
+		asm volatile ("ldmxcsr %0" : : "m" (csr));
+	}
+#elif defined(__aarch64__)
+	{
+		/* FZ flushes inputs and results alike */
+		uint64_t fpcr;
+
+		asm volatile ("mrs %0, fpcr" : "=r" (fpcr));
+		asm volatile ("msr fpcr, %0" : : "r" (fpcr | (1 << 24)));
+	}
+#elif defined(__arm__) && defined(__ARM_FP)
+	{
+		uint32_t fpscr;
+
+		asm volatile ("vmrs %0, fpscr" : "=r" (fpscr));
+		asm volatile ("vmsr fpscr, %0" : : "r" (fpscr | (1 << 24)));
+	}
+#endif
+}
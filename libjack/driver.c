@@ -265,6 +265,35 @@ jack_driver_nt_bufsize (jack_driver_nt_t * driver, jack_nframes_t nframes)
 	return ret;
 }
 
+static int
+jack_driver_nt_samplerate (jack_driver_nt_t * driver, jack_nframes_t rate)
+{
+	int err;
+	int ret;
+
+	if (driver->nt_samplerate == NULL) {
+		return ENOSYS;
+	}
+
+	err = jack_driver_nt_do_stop (driver, DRIVER_NT_PAUSE);
+	if (err) {
+		jack_error ("DRIVER NT: could not stop driver to change sample rate");
+		driver->engine->driver_exit (driver->engine);
+		return err;
+	}
+
+	ret = driver->nt_samplerate (driver, rate);
+
+	err = jack_driver_nt_start (driver);
+	if (err) {
+		jack_error ("DRIVER NT: could not restart driver during sample rate change");
+		driver->engine->driver_exit (driver->engine);
+		return err;
+	}
+
+	return ret;
+}
+
 void
 jack_driver_nt_init (jack_driver_nt_t * driver)
 {
@@ -275,6 +304,7 @@ jack_driver_nt_init (jack_driver_nt_t * driver)
 	driver->attach       = (JackDriverAttachFunction)jack_driver_nt_attach;
 	driver->detach       = (JackDriverDetachFunction)jack_driver_nt_detach;
 	driver->bufsize      = (JackDriverBufSizeFunction)jack_driver_nt_bufsize;
+	driver->samplerate   = (JackDriverSampleRateFunction)jack_driver_nt_samplerate;
 	driver->stop         = (JackDriverStopFunction)jack_driver_nt_stop;
 	driver->start        = (JackDriverStartFunction)jack_driver_nt_start;
 
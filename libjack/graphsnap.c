@@ -0,0 +1,561 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    Binary snapshots of the port graph.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jack/jack.h>
+#include <jack/metadata.h>
+#include <jack/uuid.h>
+
+#include "internal.h"
+#include "graphsnap.h"
+#include "local.h"
+
+#define JACK_SNAPSHOT_NONE ((uint32_t)-1)
+
+/* The graph is read straight from the server's shared memory: the port
+ * table, and the connection map that jack_port_get_connection_ids()
+ * reads, and the metadata from the property store or database.
+ * Nothing is asked of the server but the client names and the
+ * metadata changes, on restore.
+ */
+
+static size_t
+jack_graph_snapshot_property_size (const jack_property_t *prop)
+{
+	return sizeof(jack_graph_snapshot_property_t)
+	       + strlen (prop->key) + 1 + strlen (prop->data) + 1
+	       + (prop->type ? strlen (prop->type) + 1 : 0);
+}
+
+/* Append the properties in descs[0 .. ndescs) at p; returns the end. */
+static char *
+jack_graph_snapshot_put_properties (char *p, const jack_description_t *descs,
+				    uint32_t ndescs, uint32_t *nprops)
+{
+	jack_graph_snapshot_property_t rec;
+	const jack_property_t *prop;
+	uint32_t d, k;
+
+	for (d = 0; d < ndescs; ++d) {
+		for (k = 0; k < descs[d].property_cnt; ++k) {
+			prop = &descs[d].properties[k];
+			rec.subject = d;
+			rec.key_size = strlen (prop->key) + 1;
+			rec.value_size = strlen (prop->data) + 1;
+			rec.type_size = prop->type ? strlen (prop->type) + 1 : 0;
+			memcpy (p, &rec, sizeof(rec));
+			p += sizeof(rec);
+			memcpy (p, prop->key, rec.key_size);
+			p += rec.key_size;
+			memcpy (p, prop->data, rec.value_size);
+			p += rec.value_size;
+			if (rec.type_size) {
+				memcpy (p, prop->type, rec.type_size);
+				p += rec.type_size;
+			}
+			(*nprops)++;
+		}
+	}
+
+	return p;
+}
+
+int
+jack_graph_snapshot_save (jack_client_t *client, void **data, size_t *size)
+{
+	jack_control_t *control = client->engine;
+	jack_graph_snapshot_header_t *header;
+	jack_graph_snapshot_client_t *clients = NULL;
+	jack_graph_snapshot_port_t *ports;
+	jack_graph_snapshot_connection_t *conns;
+	jack_port_id_t *ids = NULL;
+	jack_uuid_t *subjects = NULL;
+	jack_description_t *descs = NULL;
+	uint32_t *index = NULL;
+	uint32_t nclients = 0, nports = 0, nconns = 0, ndescs = 0, nprops = 0;
+	uint32_t i, c, high;
+	size_t props_size = 0;
+	int n, k;
+	char *blob, *end;
+	const char *colon;
+	int ret = -1;
+
+	*data = NULL;
+	*size = 0;
+
+	high = __atomic_load_n (&control->port_high, __ATOMIC_ACQUIRE);
+
+	index = (uint32_t*)malloc ((high ? high : 1) * sizeof(*index));
+	ids = (jack_port_id_t*)malloc (control->port_max * sizeof(*ids));
+	clients = (jack_graph_snapshot_client_t*)
+		  calloc (high ? high : 1, sizeof(*clients));
+	if (index == NULL || ids == NULL || clients == NULL) {
+		goto out;
+	}
+
+	/* the ports with connections, and their clients */
+
+	for (i = 0; i < high; ++i) {
+		index[i] = JACK_SNAPSHOT_NONE;
+	}
+
+	for (i = jack_port_next_in_use (control, 0, high); i < high;
+	     i = jack_port_next_in_use (control, i + 1, high)) {
+		jack_port_shared_t *shared = &control->ports[i];
+
+		if ((n = jack_port_get_connection_ids (client, i, NULL, 0)) <= 0) {
+			continue;
+		}
+		if (shared->flags & JackPortIsOutput) {
+			nconns += n;
+		}
+
+		for (c = 0; c < nclients; ++c) {
+			if (jack_uuid_compare (clients[c].uuid, shared->client_id) == 0) {
+				break;
+			}
+		}
+		if (c == nclients) {
+			jack_uuid_copy (&clients[c].uuid, shared->client_id);
+			colon = strchr (shared->name, ':');
+			snprintf (clients[c].name, sizeof(clients[c].name), "%.*s",
+				  colon ? (int)(colon - shared->name) : 0, shared->name);
+			nclients++;
+		}
+
+		index[i] = nports++;
+	}
+
+	/* the metadata of those clients and ports, which are its subjects
+	   in the order of their records */
+
+	if (nclients + nports) {
+		subjects = (jack_uuid_t*)malloc ((nclients + nports) * sizeof(*subjects));
+		descs = (jack_description_t*)
+			calloc (nclients + nports, sizeof(*descs));
+		if (subjects == NULL || descs == NULL) {
+			goto out;
+		}
+		for (c = 0; c < nclients; ++c) {
+			jack_uuid_copy (&subjects[c], clients[c].uuid);
+		}
+		for (i = 0; i < high; ++i) {
+			if (index[i] != JACK_SNAPSHOT_NONE) {
+				jack_uuid_copy (&subjects[nclients + index[i]],
+						control->ports[i].uuid);
+			}
+		}
+		if (jack_get_properties_bulk (subjects, nclients + nports, descs) < 0) {
+			jack_error ("cannot read the metadata of the graph");
+			goto out;
+		}
+		ndescs = nclients + nports;
+		for (c = 0; c < ndescs; ++c) {
+			for (k = 0; k < (int)descs[c].property_cnt; ++k) {
+				props_size += jack_graph_snapshot_property_size (
+					&descs[c].properties[k]);
+			}
+		}
+	}
+
+	*size = sizeof(*header) + nclients * sizeof(*clients)
+		+ nports * sizeof(*ports) + nconns * sizeof(*conns) + props_size;
+
+	if ((blob = (char*)calloc (1, *size)) == NULL) {
+		*size = 0;
+		goto out;
+	}
+
+	header = (jack_graph_snapshot_header_t*)blob;
+	header->magic = JACK_GRAPH_SNAPSHOT_MAGIC;
+	header->version = JACK_GRAPH_SNAPSHOT_VERSION;
+	header->nclients = nclients;
+	header->nports = nports;
+
+	memcpy (header + 1, clients, nclients * sizeof(*clients));
+	ports = (jack_graph_snapshot_port_t*)
+		((jack_graph_snapshot_client_t*)(header + 1) + nclients);
+	conns = (jack_graph_snapshot_connection_t*)(ports + nports);
+
+	for (i = 0; i < high; ++i) {
+		jack_port_shared_t *shared = &control->ports[i];
+		jack_graph_snapshot_port_t *port;
+
+		if (index[i] == JACK_SNAPSHOT_NONE) {
+			continue;
+		}
+
+		port = &ports[index[i]];
+		for (c = 0; c < nclients; ++c) {
+			if (jack_uuid_compare (clients[c].uuid, shared->client_id) == 0) {
+				break;
+			}
+		}
+		port->client = c;
+		port->flags = shared->flags;
+		snprintf (port->type, sizeof(port->type), "%s",
+			  control->port_types[shared->ptype_id].type_name);
+		colon = strchr (shared->name, ':');
+		snprintf (port->name, sizeof(port->name), "%s",
+			  colon ? colon + 1 : shared->name);
+
+		if (!(shared->flags & JackPortIsOutput)) {
+			continue;
+		}
+
+		/* the graph may have changed since the first pass */
+		n = jack_port_get_connection_ids (client, i, ids, control->port_max);
+		for (k = 0; k < n && header->nconnections < nconns; ++k) {
+			if (ids[k] < high && index[ids[k]] != JACK_SNAPSHOT_NONE) {
+				conns[header->nconnections].source = index[i];
+				conns[header->nconnections].destination = index[ids[k]];
+				header->nconnections++;
+			}
+		}
+	}
+
+	end = jack_graph_snapshot_put_properties (
+		(char*)(conns + header->nconnections), descs, ndescs, &nprops);
+	header->nproperties = nprops;
+
+	*size = end - blob;
+	*data = blob;
+	ret = 0;
+
+out:
+	for (c = 0; c < ndescs; ++c) {
+		jack_free_description (&descs[c], 0);
+	}
+	free (descs);
+	free (subjects);
+	free (index);
+	free (ids);
+	free (clients);
+	return ret;
+}
+
+/* The id a snapshot port has now, or JACK_SNAPSHOT_NONE. */
+static uint32_t
+jack_graph_snapshot_find (jack_client_t *client, const char *client_name,
+			  const jack_graph_snapshot_port_t *sport)
+{
+	jack_control_t *control = client->engine;
+	char name[JACK_CLIENT_NAME_SIZE + JACK_PORT_NAME_SIZE + 1];
+	jack_port_id_t id;
+	jack_port_t *port;
+
+	snprintf (name, sizeof(name), "%s:%.*s", client_name,
+		  (int)sizeof(sport->name), sport->name);
+
+	if ((id = jack_port_hash_lookup (control, name)) == (jack_port_id_t)-1) {
+		if ((port = jack_port_by_name (client, name)) == NULL) {
+			return JACK_SNAPSHOT_NONE;
+		}
+		id = port->shared->id;
+	}
+
+	if (strncmp (control->port_types[control->ports[id].ptype_id].type_name,
+		     sport->type, sizeof(sport->type)) != 0) {
+		jack_error ("port %s is no longer of type %.*s", name,
+			    (int)sizeof(sport->type), sport->type);
+		return JACK_SNAPSHOT_NONE;
+	}
+
+	return id;
+}
+
+/* Whether the nprops property records at p fill the left bytes exactly,
+ * and are all about one of the nsubjects clients and ports. */
+static int
+jack_graph_snapshot_check_properties (const char *p, size_t left,
+				      uint32_t nprops, uint32_t nsubjects)
+{
+	jack_graph_snapshot_property_t rec;
+	uint64_t need;
+	uint32_t i;
+
+	for (i = 0; i < nprops; ++i) {
+		if (left < sizeof(rec)) {
+			return -1;
+		}
+		memcpy (&rec, p, sizeof(rec));
+		p += sizeof(rec);
+		left -= sizeof(rec);
+
+		need = (uint64_t)rec.key_size + rec.value_size + rec.type_size;
+		if (rec.subject >= nsubjects || rec.key_size == 0
+		    || rec.value_size == 0 || need > left
+		    || p[rec.key_size - 1] != '\0'
+		    || p[rec.key_size + rec.value_size - 1] != '\0'
+		    || (rec.type_size && p[need - 1] != '\0')) {
+			return -1;
+		}
+		p += need;
+		left -= need;
+	}
+
+	return left == 0 ? 0 : -1;
+}
+
+static int
+jack_graph_snapshot_set_batch (jack_client_t *client,
+			       const jack_property_op_t *ops, uint32_t n)
+{
+	return (n && jack_set_properties_bulk (client, ops, n)) ? (int)n : 0;
+}
+
+/* Set the properties at p again on the clients and ports that they
+ * were saved for, which now have the port ids in ids[], in as few
+ * requests as jack_set_properties_bulk() needs.  Returns how many
+ * could not be set.
+ */
+static int
+jack_graph_snapshot_set_properties (jack_client_t *client,
+				    const jack_graph_snapshot_header_t *header,
+				    const jack_graph_snapshot_port_t *ports,
+				    const uint32_t *ids, const char *p)
+{
+	jack_control_t *control = client->engine;
+	jack_graph_snapshot_property_t rec;
+	jack_property_op_t *ops;
+	jack_uuid_t *subjects;
+	uint32_t nprops = header->nproperties;
+	uint32_t i, n, chunk;
+	size_t bytes, need;
+	int failed = 0;
+
+	if (nprops == 0) {
+		return 0;
+	}
+
+	chunk = nprops < JACK_PROPERTY_BATCH_MAX ? nprops : JACK_PROPERTY_BATCH_MAX;
+	subjects = (jack_uuid_t*)calloc (header->nclients + header->nports,
+					 sizeof(*subjects));
+	ops = (jack_property_op_t*)malloc (chunk * sizeof(*ops));
+	if (subjects == NULL || ops == NULL) {
+		free (subjects);
+		free (ops);
+		return nprops;
+	}
+
+	/* a client is found again through any of its ports that was */
+
+	for (i = 0; i < header->nports; ++i) {
+		if (ids[i] != JACK_SNAPSHOT_NONE) {
+			jack_uuid_copy (&subjects[ports[i].client],
+					control->ports[ids[i]].client_id);
+			jack_uuid_copy (&subjects[header->nclients + i],
+					control->ports[ids[i]].uuid);
+		}
+	}
+
+	for (i = n = 0, bytes = 0; i < nprops; ++i) {
+		memcpy (&rec, p, sizeof(rec));
+		p += sizeof(rec);
+		need = rec.key_size + rec.value_size + rec.type_size;
+
+		if (jack_uuid_empty (subjects[rec.subject])) {
+			failed++;
+			p += need;
+			continue;
+		}
+
+		if (n == chunk || (n && bytes + need > JACK_PROPERTY_BATCH_MAX_SIZE)) {
+			failed += jack_graph_snapshot_set_batch (client, ops, n);
+			n = 0;
+			bytes = 0;
+		}
+
+		jack_uuid_copy (&ops[n].subject, subjects[rec.subject]);
+		ops[n].key = p;
+		ops[n].value = p + rec.key_size;
+		ops[n].type = rec.type_size ? p + rec.key_size + rec.value_size : NULL;
+		n++;
+		bytes += need;
+		p += need;
+	}
+
+	failed += jack_graph_snapshot_set_batch (client, ops, n);
+
+	free (subjects);
+	free (ops);
+	return failed;
+}
+
+int
+jack_graph_snapshot_restore (jack_client_t *client, const void *data,
+			     size_t size)
+{
+	const jack_graph_snapshot_header_t *header =
+		(const jack_graph_snapshot_header_t*)data;
+	const jack_graph_snapshot_client_t *clients;
+	const jack_graph_snapshot_port_t *ports;
+	const jack_graph_snapshot_connection_t *conns;
+	jack_connection_op_t *ops = NULL;
+	jack_request_t req;
+	char **names = NULL;
+	uint32_t *ids = NULL;
+	char uuid[JACK_UUID_STRING_SIZE];
+	uint64_t fixed;
+	uint32_t i, n, done, chunk;
+	int failed = 0;
+
+	if (size < sizeof(*header)) {
+		jack_error ("not a graph snapshot, or a damaged one");
+		return -1;
+	}
+
+	fixed = sizeof(*header)
+		+ (uint64_t)header->nclients * sizeof(*clients)
+		+ (uint64_t)header->nports * sizeof(*ports)
+		+ (uint64_t)header->nconnections * sizeof(*conns);
+
+	if (header->magic != JACK_GRAPH_SNAPSHOT_MAGIC
+	    || header->version != JACK_GRAPH_SNAPSHOT_VERSION
+	    || size < fixed
+	    || jack_graph_snapshot_check_properties (
+		    (const char*)data + fixed, size - fixed, header->nproperties,
+		    header->nclients + header->nports)) {
+		jack_error ("not a graph snapshot, or a damaged one");
+		return -1;
+	}
+
+	clients = (const jack_graph_snapshot_client_t*)(header + 1);
+	ports = (const jack_graph_snapshot_port_t*)(clients + header->nclients);
+	conns = (const jack_graph_snapshot_connection_t*)(ports + header->nports);
+
+	for (i = 0; i < header->nports; ++i) {
+		if (ports[i].client >= header->nclients) {
+			jack_error ("graph snapshot port %" PRIu32
+				    " has no client", i);
+			return -1;
+		}
+	}
+	for (i = 0; i < header->nconnections; ++i) {
+		if (conns[i].source >= header->nports
+		    || conns[i].destination >= header->nports) {
+			jack_error ("graph snapshot connection %" PRIu32
+				    " has no ports", i);
+			return -1;
+		}
+	}
+
+	names = (char**)calloc (header->nclients + 1, sizeof(*names));
+	ids = (uint32_t*)malloc ((header->nports + 1) * sizeof(*ids));
+	if (names == NULL || ids == NULL) {
+		failed = -1;
+		goto out;
+	}
+
+	/* clients keep their UUID across a session restore, and may get
+	   another name */
+
+	for (i = 0; i < header->nclients; ++i) {
+		if (!jack_uuid_empty (clients[i].uuid)) {
+			jack_uuid_unparse (clients[i].uuid, uuid);
+			names[i] = jack_get_client_name_by_uuid (client, uuid);
+		}
+		if (names[i] == NULL || names[i][0] == '\0') {
+			free (names[i]);
+			names[i] = strndup (clients[i].name, sizeof(clients[i].name));
+		}
+		if (names[i] == NULL) {
+			failed = -1;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < header->nports; ++i) {
+		ids[i] = jack_graph_snapshot_find (client, names[ports[i].client],
+						   &ports[i]);
+	}
+
+	chunk = header->nconnections < JACK_CONNECT_BATCH_MAX ?
+		header->nconnections : JACK_CONNECT_BATCH_MAX;
+	if (chunk && (ops = (jack_connection_op_t*)calloc (chunk, sizeof(*ops))) == NULL) {
+		failed = -1;
+		goto out;
+	}
+
+	jack_graph_batch_begin (client);
+
+	for (done = 0; done < header->nconnections; ) {
+
+		for (n = 0; n < chunk && done < header->nconnections; ++done) {
+			uint32_t src = ids[conns[done].source];
+			uint32_t dst = ids[conns[done].destination];
+			if (src == JACK_SNAPSHOT_NONE || dst == JACK_SNAPSHOT_NONE) {
+				failed++;
+				continue;
+			}
+			ops[n].source_port[0] = '\0';
+			ops[n].destination_port[0] = '\0';
+			ops[n].source_id = src;
+			ops[n].destination_id = dst;
+			ops[n].connect = 1;
+			ops[n].status = -1;
+			n++;
+		}
+
+		if (n == 0) {
+			continue;
+		}
+
+		VALGRIND_MEMSET (&req, 0, sizeof(req));
+
+		req.type = ConnectBatch;
+		req.x.connect_batch.count = n;
+		req.x.connect_batch.ops = ops;
+
+		if (jack_client_deliver_request (client, &req)) {
+			failed += n;
+			continue;
+		}
+
+		for (i = 0; i < n; ++i) {
+			if (ops[i].status != 0 && ops[i].status != EEXIST) {
+				failed++;
+			}
+		}
+	}
+
+	jack_graph_batch_end (client);
+
+	failed += jack_graph_snapshot_set_properties (
+		client, header, ports, ids,
+		(const char*)(conns + header->nconnections));
+
+out:
+	if (names) {
+		for (i = 0; i < header->nclients; ++i) {
+			free (names[i]);
+		}
+	}
+	free (names);
+	free (ids);
+	free (ops);
+	return failed;
+}
@@ -1,6 +1,24 @@
 #ifndef __jack_libjack_local_h__
 #define __jack_libjack_local_h__
 
+/* A client's copy of the port graph, see jack_set_graph_mirror(). */
+typedef struct {
+	jack_port_id_t *ids;
+	uint32_t n;
+	uint32_t size;
+} jack_mirror_peers_t;
+
+typedef struct {
+	pthread_mutex_t lock;
+	uint32_t port_max;
+	jack_port_t **ports;            /* other clients' ports, by ID */
+	jack_mirror_peers_t *peers;     /* connected port IDs, by ID */
+} jack_graph_mirror_t;
+
+/* How much of the event socket jack_client_process_events() reads at
+ * once; the server writes a batch of events in one go. */
+#define JACK_EVENT_READ_SIZE (32 * sizeof(jack_event_t))
+
 /* Client data structure, in the client address space. */
 struct _jack_client {
 
@@ -12,18 +30,34 @@ struct _jack_client {
 	struct pollfd*  pollfd;
 	int pollmax;
 	int graph_next_fd;
+	int graph_wait_slot;    /* wakeup words, same numbers as the FIFOs */
+	int graph_next_slot;
+	int graph_wait_pending; /* wake byte not read back yet, see */
+	uint32_t graph_wait_generation; /* jack_client_core_wait() */
+	int *fifo_fds;          /* FIFOs opened so far, kept across reorders: */
+	unsigned int fifo_size; /* read end of n at 2n, write end at 2n+1 */
 	int request_fd;
 	int upstream_is_jackd;
 
+	/* read from the event socket, not yet dispatched */
+	char event_buf[JACK_EVENT_READ_SIZE];
+	size_t event_buf_len;
+	size_t event_buf_pos;
+
 	/* these two are copied from the engine when the
 	 * client is created.
 	 */
 
 	jack_port_type_id_t n_port_types;
 	jack_shm_info_t*    port_segment;
+	uint32_t port_segment_pending;  /* announced, attached on first use */
+
+	/* for the types this client has jack_port_type_register()ed */
+	jack_port_functions_t port_type_functions[JACK_MAX_PORT_TYPES];
 
 	JSList *ports;
 	JSList *ports_ext;
+	jack_graph_mirror_t *mirror;
 
 	pthread_t thread;
 	char fifo_prefix[PATH_MAX + 1];
@@ -37,6 +71,53 @@ struct _jack_client {
 	char name[JACK_CLIENT_NAME_SIZE];
 	int session_cb_immediate_reply;
 
+	/* RT-safe allocator behind jack_rt_alloc(), created on activation */
+	struct _jack_rt_pool *rt_pool;
+	size_t rt_pool_size;
+
+	/* process() calls made on scratch buffers before the client
+	   first goes live, see jack_set_warmup_cycles() */
+	int warmup_cycles;
+	int warming_up;
+	int warmed_up;
+
+	/* from jack_set_process_thread_cpus(), empty if not set */
+	char process_cpus[JACK_CPU_LIST_SIZE];
+
+	/* SCHED_DEADLINE budget of the process thread, if the server
+	   asks for it; not used while freewheeling */
+	jack_deadline_t deadline;
+	int freewheeling;
+
+	/* counters of the process thread, if the server asks for them */
+	jack_perf_counters_t perf;
+
+	/* the server's cycle trace, once jack_cycle_trace_attach()ed */
+	jack_shm_info_t trace_shm;
+
+	/* the server's port meters, once jack_port_meters_attach()ed */
+	jack_shm_info_t meter_shm;
+
+	/* the server's port history, see jack_set_process_decimation() */
+	jack_shm_info_t history_shm;
+
+	/* one request at a time in the shared memory request slot,
+	   see jack_set_shm_requests() */
+	pthread_mutex_t shm_request_lock;
+
+	/* regexes compiled by jack_get_ports(), reused across calls */
+	pthread_mutex_t regex_lock;
+	struct _jack_regex_entry *regex_cache;
+	unsigned long regex_clock;
+
+	/* mixdown slots of multi-connected input ports, reserved one
+	   per input port at registration, see jack_client_mix_reserve() */
+	pthread_mutex_t mix_lock;
+	struct _jack_mix_chunk *mix_chunks;
+	size_t mix_slot_size;
+	uint32_t mix_slots;
+	uint32_t mix_reserved;
+
 #ifdef JACK_USE_MACH_THREADS
 	/* specific ressources for server/client real-time thread communication */
 	mach_port_t clienttask, bp, serverport, replyport;
@@ -65,6 +146,8 @@ struct _jack_client {
 	void *xrun_arg;
 	JackSyncCallback sync_cb;
 	void *sync_arg;
+	JackSyncPrepareCallback sync_prepare_cb;
+	void *sync_prepare_arg;
 	JackTimebaseCallback timebase_cb;
 	void *timebase_arg;
 	JackFreewheelCallback freewheel_cb;
@@ -81,6 +164,8 @@ struct _jack_client {
 	void *property_cb_arg;
 	JackPortRenameCallback port_rename_cb;
 	void *port_rename_arg;
+	JackProcessSkipCallback skip_cb;
+	void *skip_arg;
 
 	/* external clients: set by libjack
 	 * internal clients: set by engine */
@@ -94,6 +179,12 @@ extern int jack_client_deliver_request(const jack_client_t *client,
 extern jack_port_t *jack_port_new(const jack_client_t *client,
 				  jack_port_id_t port_id,
 				  jack_control_t *control);
+extern int jack_attach_port_segment(jack_client_t *client,
+				    jack_port_type_id_t ptid);
+extern int jack_graph_mirror_new(jack_client_t *client);
+extern int jack_client_mix_reserve(jack_client_t *client);
+extern void jack_graph_mirror_sync(jack_client_t *client);
+extern void jack_graph_mirror_free(jack_client_t *client);
 
 extern void *jack_zero_filled_buffer;
 
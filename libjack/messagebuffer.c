@@ -27,7 +27,12 @@
 
 #include <unistd.h>
 #include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
 
@@ -35,79 +40,426 @@
 #include "atomicity.h"
 #include "internal.h"
 
-/* MB_NEXT() relies on the fact that MB_BUFFERS is a power of two */
-#define MB_BUFFERS      128
-#define MB_NEXT(index) ((index + 1) & (MB_BUFFERS - 1))
-#define MB_BUFFERSIZE   256             /* message length limit */
+/* Messages go through a bounded multi-producer, single-consumer ring
+ * (one sequence number per slot, in the style of Vyukov's queue). A
+ * writer claims a slot with a compare-and-swap on mb_head, stores the
+ * format pointer and its raw arguments, then publishes the slot by
+ * bumping its sequence number; no lock is taken and nothing is
+ * formatted on the caller's thread. String arguments are copied into
+ * the slot, since they rarely outlive the call. mb_thread_func()
+ * formats and prints the messages in order. Only a full ring drops a
+ * message, which is counted in mb_overruns.
+ *
+ * Formats the writer cannot capture (too many arguments, wide
+ * characters, %n, ...) are formatted into the slot right away, as
+ * before.
+ *
+ * The ring holds MB_DEFAULT_SLOTS messages unless
+ * $JACK_MESSAGEBUFFER_SIZE asks for another count, which is rounded
+ * up to a power of two.
+ */
 
-static char mb_buffers[MB_BUFFERS][MB_BUFFERSIZE];
+#define MB_DEFAULT_SLOTS 128
+#define MB_BUFFERSIZE   256             /* message length limit */
+#define MB_MAX_ARGS     16
+
+typedef enum {
+	MB_ARG_INT,
+	MB_ARG_LONG,
+	MB_ARG_LLONG,
+	MB_ARG_INTMAX,
+	MB_ARG_SIZE,
+	MB_ARG_PTRDIFF,
+	MB_ARG_DOUBLE,
+	MB_ARG_LDOUBLE,
+	MB_ARG_PTR,
+	MB_ARG_STR
+} mb_arg_type_t;
+
+typedef struct {
+	mb_arg_type_t type;
+	union {
+		int i;
+		long l;
+		long long ll;
+		intmax_t j;
+		size_t z;
+		ptrdiff_t t;
+		double d;
+		long double ld;
+		const void *p;
+		unsigned int str;       /* offset into the slot's text */
+	} v;
+} mb_arg_t;
+
+typedef struct {
+	volatile unsigned int seq;
+	const char *fmt;                /* NULL: text is already formatted */
+	unsigned int nargs;
+	mb_arg_t args[MB_MAX_ARGS];
+	char text[MB_BUFFERSIZE];
+} mb_slot_t;
+
+static mb_slot_t *mb_slots = NULL;
+static unsigned int mb_mask = 0;
+static volatile unsigned int mb_head = 0;       /* next slot to claim */
+static unsigned int mb_tail = 0;                /* next slot to print */
 static volatile unsigned int mb_initialized = 0;
-static volatile unsigned int mb_inbuffer = 0;
-static volatile unsigned int mb_outbuffer = 0;
 static volatile _Atomic_word mb_overruns = 0;
 static pthread_t mb_writer_thread;
 static pthread_mutex_t mb_write_lock;
 static pthread_cond_t mb_ready_cond;
-static void (*mb_thread_init_callback)(void*) = 0;
+static sem_t mb_ready_sem;
+static void (*volatile mb_thread_init_callback)(void*) = 0;
 static void* mb_thread_init_callback_arg = 0;
 
+/* Parse the conversion starting at fmt (just past the '%') into a
+ * type, returning the position after it or NULL if it cannot be
+ * captured. Each '*' in the spec adds an int argument to *stars.
+ */
+static const char *
+mb_parse_conversion (const char *fmt, mb_arg_type_t *type, int *stars)
+{
+	int longs = 0;
+	char mod = 0;
+
+	*stars = 0;
+
+	while (*fmt && strchr ("-+ #0", *fmt)) {
+		fmt++;
+	}
+	while ((*fmt >= '0' && *fmt <= '9') || *fmt == '*' || *fmt == '.') {
+		if (*fmt == '*') {
+			(*stars)++;
+		}
+		fmt++;
+	}
+
+	for (;; fmt++) {
+		if (*fmt == 'h') {
+			continue;
+		} else if (*fmt == 'l') {
+			longs++;
+		} else if (*fmt == 'q') {
+			longs = 2;
+		} else if (*fmt == 'j' || *fmt == 'z' || *fmt == 't' || *fmt == 'L') {
+			mod = *fmt;
+		} else {
+			break;
+		}
+	}
+
+	switch (*fmt) {
+	case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+		if (mod == 'j') {
+			*type = MB_ARG_INTMAX;
+		} else if (mod == 'z') {
+			*type = MB_ARG_SIZE;
+		} else if (mod == 't') {
+			*type = MB_ARG_PTRDIFF;
+		} else if (longs >= 2 || mod == 'L') {
+			*type = MB_ARG_LLONG;
+		} else if (longs == 1) {
+			*type = MB_ARG_LONG;
+		} else {
+			*type = MB_ARG_INT;
+		}
+		break;
+	case 'c':
+		if (longs) {
+			return NULL;
+		}
+		*type = MB_ARG_INT;
+		break;
+	case 'e': case 'E': case 'f': case 'F':
+	case 'g': case 'G': case 'a': case 'A':
+		*type = (mod == 'L') ? MB_ARG_LDOUBLE : MB_ARG_DOUBLE;
+		break;
+	case 'p':
+		*type = MB_ARG_PTR;
+		break;
+	case 's':
+		if (longs) {
+			return NULL;
+		}
+		*type = MB_ARG_STR;
+		break;
+	default:                        /* %n, %m, %C, %S, positional... */
+		return NULL;
+	}
+
+	return fmt + 1;
+}
+
+/* Store the arguments for fmt in the slot; 0 if they cannot be captured */
+static int
+mb_capture (mb_slot_t *slot, const char *fmt, va_list ap)
+{
+	unsigned int text = 0;
+	mb_arg_type_t type;
+	int stars;
+
+	slot->nargs = 0;
+
+	while ((fmt = strchr (fmt, '%')) != NULL) {
+		mb_arg_t *arg;
+
+		if (*++fmt == '%') {
+			fmt++;
+			continue;
+		}
+		if ((fmt = mb_parse_conversion (fmt, &type, &stars)) == NULL
+		    || slot->nargs + stars + 1 > MB_MAX_ARGS) {
+			return 0;
+		}
+
+		while (stars--) {
+			arg = &slot->args[slot->nargs++];
+			arg->type = MB_ARG_INT;
+			arg->v.i = va_arg (ap, int);
+		}
+
+		arg = &slot->args[slot->nargs++];
+		arg->type = type;
+
+		switch (type) {
+		case MB_ARG_INT:
+			arg->v.i = va_arg (ap, int);
+			break;
+		case MB_ARG_LONG:
+			arg->v.l = va_arg (ap, long);
+			break;
+		case MB_ARG_LLONG:
+			arg->v.ll = va_arg (ap, long long);
+			break;
+		case MB_ARG_INTMAX:
+			arg->v.j = va_arg (ap, intmax_t);
+			break;
+		case MB_ARG_SIZE:
+			arg->v.z = va_arg (ap, size_t);
+			break;
+		case MB_ARG_PTRDIFF:
+			arg->v.t = va_arg (ap, ptrdiff_t);
+			break;
+		case MB_ARG_DOUBLE:
+			arg->v.d = va_arg (ap, double);
+			break;
+		case MB_ARG_LDOUBLE:
+			arg->v.ld = va_arg (ap, long double);
+			break;
+		case MB_ARG_PTR:
+			arg->v.p = va_arg (ap, void *);
+			break;
+		case MB_ARG_STR: {
+			const char *str = va_arg (ap, const char *);
+			size_t len;
+			if (str == NULL) {
+				str = "(null)";
+			}
+			len = strlen (str);
+			if (text + len + 1 > MB_BUFFERSIZE) {
+				return 0;
+			}
+			memcpy (slot->text + text, str, len + 1);
+			arg->v.str = text;
+			text += len + 1;
+			break;
+		}
+		}
+	}
+
+	return 1;
+}
+
+/* Format a captured slot into out */
+static void
+mb_format (mb_slot_t *slot, char *out, size_t size)
+{
+	const char *fmt = slot->fmt;
+	unsigned int n = 0;
+	size_t len = 0;
+
+	while (*fmt && len < size - 1) {
+		char spec[64];
+		const char *end;
+		mb_arg_type_t type;
+		mb_arg_t *arg;
+		int stars;
+		size_t k, speclen;
+		int w;
+
+		if (*fmt != '%') {
+			out[len++] = *fmt++;
+			continue;
+		}
+		if (fmt[1] == '%') {
+			out[len++] = '%';
+			fmt += 2;
+			continue;
+		}
+
+		end = mb_parse_conversion (fmt + 1, &type, &stars);
+		speclen = end - fmt;
+
+		/* rebuild the spec with any '*' replaced by its value */
+		for (k = 0, w = 0; k < speclen && w < (int)sizeof(spec) - 12; k++) {
+			if (fmt[k] == '*') {
+				w += sprintf (spec + w, "%d", slot->args[n++].v.i);
+			} else {
+				spec[w++] = fmt[k];
+			}
+		}
+		spec[w] = '\0';
+		fmt = end;
+
+		arg = &slot->args[n++];
+
+		switch (arg->type) {
+		case MB_ARG_INT:
+			w = snprintf (out + len, size - len, spec, arg->v.i);
+			break;
+		case MB_ARG_LONG:
+			w = snprintf (out + len, size - len, spec, arg->v.l);
+			break;
+		case MB_ARG_LLONG:
+			w = snprintf (out + len, size - len, spec, arg->v.ll);
+			break;
+		case MB_ARG_INTMAX:
+			w = snprintf (out + len, size - len, spec, arg->v.j);
+			break;
+		case MB_ARG_SIZE:
+			w = snprintf (out + len, size - len, spec, arg->v.z);
+			break;
+		case MB_ARG_PTRDIFF:
+			w = snprintf (out + len, size - len, spec, arg->v.t);
+			break;
+		case MB_ARG_DOUBLE:
+			w = snprintf (out + len, size - len, spec, arg->v.d);
+			break;
+		case MB_ARG_LDOUBLE:
+			w = snprintf (out + len, size - len, spec, arg->v.ld);
+			break;
+		case MB_ARG_PTR:
+			w = snprintf (out + len, size - len, spec, arg->v.p);
+			break;
+		case MB_ARG_STR:
+			w = snprintf (out + len, size - len, spec,
+				      slot->text + arg->v.str);
+			break;
+		default:
+			w = 0;
+		}
+
+		if (w < 0) {
+			break;
+		}
+		len += w;
+		if (len >= size) {
+			len = size - 1;
+		}
+	}
+
+	out[len] = '\0';
+}
+
 static void
 mb_flush ()
 {
-	/* called WITHOUT the mb_write_lock */
-	while (mb_outbuffer != mb_inbuffer) {
-		jack_info (mb_buffers[mb_outbuffer]);
-		mb_outbuffer = MB_NEXT (mb_outbuffer);
+	char msg[MB_BUFFERSIZE];
+
+	/* single consumer: only the writer thread, or exit after it
+	 * has been joined */
+	for (;;) {
+		mb_slot_t *slot = &mb_slots[mb_tail & mb_mask];
+
+		if (slot->seq != mb_tail + 1) {
+			break;
+		}
+		__sync_synchronize ();
+
+		if (slot->fmt) {
+			mb_format (slot, msg, sizeof(msg));
+			jack_info ("%s", msg);
+		} else {
+			jack_info ("%s", slot->text);
+		}
+
+		__sync_synchronize ();
+		slot->seq = mb_tail + mb_mask + 1;
+		mb_tail++;
 	}
 }
 
 static void *
 mb_thread_func (void *arg)
 {
-	/* The mutex is only to eliminate collisions between multiple
-	 * writer threads and protect the condition variable. */
-	pthread_mutex_lock (&mb_write_lock);
-
 	while (mb_initialized) {
-		pthread_cond_wait (&mb_ready_cond, &mb_write_lock);
+
+		while (sem_wait (&mb_ready_sem) != 0 && errno == EINTR) {
+			;
+		}
 
 		if (mb_thread_init_callback) {
 			/* the client asked for all threads to run a thread
 			   initialization callback, which includes us.
 			 */
+			pthread_mutex_lock (&mb_write_lock);
 			mb_thread_init_callback (mb_thread_init_callback_arg);
 			mb_thread_init_callback = 0;
 
 			/* note that we've done it */
 			pthread_cond_signal (&mb_ready_cond);
+			pthread_mutex_unlock (&mb_write_lock);
 		}
 
-		/* releasing the mutex reduces contention */
-		pthread_mutex_unlock (&mb_write_lock);
 		mb_flush ();
-		pthread_mutex_lock (&mb_write_lock);
 	}
 
-	pthread_mutex_unlock (&mb_write_lock);
-
 	return NULL;
 }
 
 void
 jack_messagebuffer_init ()
 {
+	const char *str;
+	unsigned int nslots = MB_DEFAULT_SLOTS;
+	unsigned int i;
+
 	if (mb_initialized) {
 		return;
 	}
 
+	if ((str = getenv ("JACK_MESSAGEBUFFER_SIZE")) != NULL) {
+		unsigned long want = strtoul (str, NULL, 0);
+		if (want > 1 && want <= 65536) {
+			for (nslots = 2; nslots < want; nslots <<= 1) {
+				;
+			}
+		}
+	}
+
+	if ((mb_slots = (mb_slot_t*)calloc (nslots, sizeof(mb_slot_t))) == NULL) {
+		return;
+	}
+	for (i = 0; i < nslots; i++) {
+		mb_slots[i].seq = i;
+	}
+	mb_mask = nslots - 1;
+	mb_head = 0;
+	mb_tail = 0;
+
 	pthread_mutex_init (&mb_write_lock, NULL);
 	pthread_cond_init (&mb_ready_cond, NULL);
+	sem_init (&mb_ready_sem, 0, 0);
 
 	mb_overruns = 0;
 	mb_initialized = 1;
 
 	if (jack_thread_creator (&mb_writer_thread, NULL, &mb_thread_func, NULL) != 0) {
 		mb_initialized = 0;
+		sem_destroy (&mb_ready_sem);
+		free (mb_slots);
+		mb_slots = NULL;
 	}
 }
 
@@ -118,10 +470,8 @@ jack_messagebuffer_exit ()
 		return;
 	}
 
-	pthread_mutex_lock (&mb_write_lock);
 	mb_initialized = 0;
-	pthread_cond_signal (&mb_ready_cond);
-	pthread_mutex_unlock (&mb_write_lock);
+	sem_post (&mb_ready_sem);
 
 	pthread_join (mb_writer_thread, NULL);
 	mb_flush ();
@@ -133,36 +483,63 @@ jack_messagebuffer_exit ()
 
 	pthread_mutex_destroy (&mb_write_lock);
 	pthread_cond_destroy (&mb_ready_cond);
+	sem_destroy (&mb_ready_sem);
+	free (mb_slots);
+	mb_slots = NULL;
 }
 
 
 void
 jack_messagebuffer_add (const char *fmt, ...)
 {
-	char msg[MB_BUFFERSIZE];
+	mb_slot_t *slot;
+	unsigned int pos;
 	va_list ap;
 
-	/* format the message first, to reduce lock contention */
-	va_start (ap, fmt);
-	vsnprintf (msg, MB_BUFFERSIZE, fmt, ap);
-	va_end (ap);
-
 	if (!mb_initialized) {
+		char msg[MB_BUFFERSIZE];
+
 		/* Unable to print message with realtime safety.
 		 * Complain and print it anyway. */
+		va_start (ap, fmt);
+		vsnprintf (msg, MB_BUFFERSIZE, fmt, ap);
+		va_end (ap);
 		fprintf (stderr, "ERROR: messagebuffer not initialized: %s",
 			 msg);
 		return;
 	}
 
-	if (pthread_mutex_trylock (&mb_write_lock) == 0) {
-		strncpy (mb_buffers[mb_inbuffer], msg, MB_BUFFERSIZE);
-		mb_inbuffer = MB_NEXT (mb_inbuffer);
-		pthread_cond_signal (&mb_ready_cond);
-		pthread_mutex_unlock (&mb_write_lock);
-	} else {                        /* lock collision */
-		atomic_add (&mb_overruns, 1);
+	/* claim a slot */
+	for (;;) {
+		pos = mb_head;
+		slot = &mb_slots[pos & mb_mask];
+		if ((int)(slot->seq - pos) < 0) {
+			/* ring full */
+			atomic_add (&mb_overruns, 1);
+			return;
+		}
+		if (slot->seq == pos
+		    && __sync_bool_compare_and_swap (&mb_head, pos, pos + 1)) {
+			break;
+		}
+	}
+
+	va_start (ap, fmt);
+	if (mb_capture (slot, fmt, ap)) {
+		slot->fmt = fmt;
+	} else {
+		va_end (ap);
+		va_start (ap, fmt);
+		vsnprintf (slot->text, MB_BUFFERSIZE, fmt, ap);
+		slot->fmt = NULL;
 	}
+	va_end (ap);
+
+	/* publish it */
+	__sync_synchronize ();
+	slot->seq = pos + 1;
+
+	sem_post (&mb_ready_sem);
 }
 
 void
@@ -175,10 +552,12 @@ jack_messagebuffer_thread_init (void (*cb)(void*), void* arg)
 	mb_thread_init_callback = cb;
 
 	/* wake msg buffer thread */
-	pthread_cond_signal (&mb_ready_cond);
+	sem_post (&mb_ready_sem);
 
 	/* wait for it to be done */
-	pthread_cond_wait (&mb_ready_cond, &mb_write_lock);
+	while (mb_thread_init_callback) {
+		pthread_cond_wait (&mb_ready_cond, &mb_write_lock);
+	}
 
 	/* and we're done */
 	pthread_mutex_unlock (&mb_write_lock);
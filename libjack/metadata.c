@@ -17,6 +17,11 @@
  */
 
 #include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
 #include <db.h>
 #include <limits.h>
 
@@ -25,6 +30,7 @@
 
 #include "internal.h"
 #include "local.h"
+#include "propertystore.h"
 
 const char* JACK_METADATA_PRETTY_NAME = "http://jackaudio.org/metadata/pretty-name";
 const char* JACK_METADATA_HARDWARE    = "http://jackaudio.org/metadata/hardware";
@@ -36,6 +42,17 @@ const char* JACK_METADATA_ICON_LARGE  = "http://jackaudio.org/metadata/icon-larg
 static DB* db = NULL;
 static DB_ENV* db_env = NULL;
 
+/* see propertystore.h. In the server the store is created (and owned)
+   here, in clients it is attached while at least one client is open.
+ */
+
+static jack_shm_info_t store_shm;
+static jack_property_store_t* store = NULL;
+static int store_owner = 0;
+static int store_db = 0;                /* server writes through to the DB */
+static int store_refs = 0;
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static int
 jack_property_init (const char* server_name)
 {
@@ -46,7 +63,7 @@ jack_property_init (const char* server_name)
 	/* idempotent */
 
 	if (db_env) {
-		return 0;
+		return db ? 0 : -1;
 	}
 
 	if ((ret = db_env_create (&db_env, 0)) != 0) {
@@ -111,26 +128,6 @@ jack_free_description (jack_description_t* desc, int free_actual_description_too
 	}
 }
 
-static int
-jack_property_change_notify (jack_client_t* client, jack_uuid_t uuid, const char* key, jack_property_change_t change)
-{
-	jack_request_t req;
-
-	/* the engine passes in a NULL client when it removes metadata during port or client removal
-	 */
-
-	if (client == NULL) {
-		return 0;
-	}
-
-	req.type = PropertyChangeNotify;
-	req.x.property.change = change;
-	jack_uuid_copy (&req.x.property.uuid, uuid);
-	req.x.property.keylen = key ? strlen (key) + 1 : 0;
-	req.x.property.key = key;
-	return jack_client_deliver_request (client, &req);
-}
-
 static void
 make_key_dbt (DBT* dbt, jack_uuid_t subject, const char* key)
 {
@@ -149,12 +146,12 @@ make_key_dbt (DBT* dbt, jack_uuid_t subject, const char* key)
 }
 
 
-int
-jack_set_property (jack_client_t* client,
-		   jack_uuid_t subject,
-		   const char* key,
-		   const char* value,
-		   const char* type)
+static int
+jack_db_set_property (jack_uuid_t subject,
+		      const char* key,
+		      const char* value,
+		      const char* type,
+		      jack_property_change_t* changep)
 {
 	DBT d_key;
 	DBT data;
@@ -162,16 +159,6 @@ jack_set_property (jack_client_t* client,
 	size_t len1, len2;
 	jack_property_change_t change;
 
-	if (!key || key[0] == '\0') {
-		jack_error ("empty key string for metadata not allowed");
-		return -1;
-	}
-
-	if (!value || value[0] == '\0') {
-		jack_error ("empty value string for metadata not allowed");
-		return -1;
-	}
-
 	if (jack_property_init (NULL)) {
 		return -1;
 	}
@@ -218,7 +205,9 @@ jack_set_property (jack_client_t* client,
 		return -1;
 	}
 
-	jack_property_change_notify (client, subject, key, change);
+	if (changep) {
+		*changep = change;
+	}
 
 	if (d_key.size > 0) {
 		free (d_key.data);
@@ -230,21 +219,17 @@ jack_set_property (jack_client_t* client,
 	return 0;
 }
 
-int
-jack_get_property (jack_uuid_t subject,
-		   const char* key,
-		   char**      value,
-		   char**      type)
+static int
+jack_db_get_property (jack_uuid_t subject,
+		      const char* key,
+		      char**      value,
+		      char**      type)
 {
 	DBT d_key;
 	DBT data;
 	int ret;
 	size_t len1, len2;
 
-	if (key == NULL || key[0] == '\0') {
-		return -1;
-	}
-
 	if (jack_property_init (NULL)) {
 		return -1;
 	}
@@ -310,9 +295,9 @@ jack_get_property (jack_uuid_t subject,
 	return 0;
 }
 
-int
-jack_get_properties (jack_uuid_t subject,
-		     jack_description_t* desc)
+static int
+jack_db_get_properties (jack_uuid_t subject,
+			jack_description_t* desc)
 {
 	DBT key;
 	DBT data;
@@ -434,8 +419,8 @@ jack_get_properties (jack_uuid_t subject,
 	return cnt;
 }
 
-int
-jack_get_all_properties (jack_description_t** descriptions)
+static int
+jack_db_get_all_properties (jack_description_t** descriptions)
 {
 	DBT key;
 	DBT data;
@@ -595,8 +580,8 @@ jack_set_property_change_callback (jack_client_t *client,
 	return 0;
 }
 
-int
-jack_remove_property (jack_client_t* client, jack_uuid_t subject, const char* key)
+static int
+jack_db_remove_property (jack_uuid_t subject, const char* key)
 {
 	DBT d_key;
 	int ret;
@@ -614,8 +599,6 @@ jack_remove_property (jack_client_t* client, jack_uuid_t subject, const char* ke
 		return -1;
 	}
 
-	jack_property_change_notify (client, subject, key, PropertyDeleted);
-
 	if (d_key.size > 0) {
 		free (d_key.data);
 	}
@@ -623,8 +606,8 @@ jack_remove_property (jack_client_t* client, jack_uuid_t subject, const char* ke
 	return 0;
 }
 
-int
-jack_remove_properties (jack_client_t* client, jack_uuid_t subject)
+static int
+jack_db_remove_properties (jack_uuid_t subject)
 {
 	DBT key;
 	DBT data;
@@ -690,10 +673,6 @@ jack_remove_properties (jack_client_t* client, jack_uuid_t subject)
 
 	cursor->close (cursor);
 
-	if (cnt) {
-		jack_property_change_notify (client, subject, NULL, PropertyDeleted);
-	}
-
 	if (retval) {
 		return -1;
 	}
@@ -701,11 +680,10 @@ jack_remove_properties (jack_client_t* client, jack_uuid_t subject)
 	return cnt;
 }
 
-int
-jack_remove_all_properties (jack_client_t* client)
+static int
+jack_db_remove_all_properties (void)
 {
 	int ret;
-	jack_uuid_t empty_uuid = JACK_UUID_EMPTY_INITIALIZER;
 
 	if (jack_property_init (NULL)) {
 		return -1;
@@ -716,7 +694,1039 @@ jack_remove_all_properties (jack_client_t* client)
 		return -1;
 	}
 
-	jack_property_change_notify (client, empty_uuid, NULL, PropertyDeleted);
+	return 0;
+}
+
+/* Property store, readers */
+
+static inline uint32_t
+store_bucket (jack_uuid_t subject)
+{
+	uint64_t h = (uint64_t)subject * 0x9e3779b97f4a7c15ULL;
+
+	return (uint32_t)(h >> 32) & (JACK_PROPERTY_STORE_BUCKETS - 1);
+}
+
+static inline uint32_t
+store_read_begin (const jack_property_store_t* s)
+{
+	uint32_t seq;
+
+	while ((seq = s->seq) & 1) {
+		sched_yield ();
+	}
+	__sync_synchronize ();
+	return seq;
+}
+
+static inline int
+store_read_retry (const jack_property_store_t* s, uint32_t seq)
+{
+	__sync_synchronize ();
+	return s->seq != seq;
+}
+
+/* Returns the entry at arena offset off, or NULL if off or the entry
+   itself does not make sense. Readers can race with the server, so
+   nothing found in the arena is trusted.
+ */
+static jack_property_entry_t*
+store_entry (jack_property_store_t* s, uint32_t off)
+{
+	jack_property_entry_t* e;
+
+	if ((off & 7) || off >= s->arena_size
+	    || s->arena_size - off < sizeof(jack_property_entry_t)) {
+		return NULL;
+	}
+
+	e = (jack_property_entry_t*)(s->arena + off);
+
+	if (e->size < sizeof(jack_property_entry_t)
+	    || e->size > s->arena_size - off
+	    || e->key_len == 0 || e->value_len == 0
+	    || (uint64_t)e->key_len + e->value_len + e->type_len
+	    > e->size - sizeof(jack_property_entry_t)) {
+		return NULL;
+	}
+
+	return e;
+}
+
+/* Finds subject/key. If link is not NULL it is set to the chain link
+   pointing at the entry (used by the server to unlink it).
+ */
+static jack_property_entry_t*
+store_lookup (jack_property_store_t* s, jack_uuid_t subject,
+	      const char* key, uint32_t** link)
+{
+	uint32_t* l = &s->buckets[store_bucket (subject)];
+	size_t steps = s->arena_size / sizeof(jack_property_entry_t);
+	size_t klen = strlen (key) + 1;
+	jack_property_entry_t* e;
+
+	while (steps-- && (e = store_entry (s, *l)) != NULL) {
+		if (jack_uuid_compare (e->subject, subject) == 0
+		    && e->key_len == klen
+		    && memcmp (e->data, key, klen) == 0) {
+			if (link) {
+				*link = l;
+			}
+			return e;
+		}
+		l = &e->next;
+	}
+
+	return NULL;
+}
+
+static char*
+store_strdup (const char* src, uint32_t len)
+{
+	char* str = (char*)malloc (len);
+
+	memcpy (str, src, len);
+	str[len - 1] = '\0';
+	return str;
+}
+
+static void
+store_copy_property (const jack_property_entry_t* e, jack_property_t* prop)
+{
+	prop->key = store_strdup (e->data, e->key_len);
+	prop->data = store_strdup (e->data + e->key_len, e->value_len);
+	if (e->type_len) {
+		prop->type = store_strdup (e->data + e->key_len + e->value_len, e->type_len);
+	} else {
+		prop->type = NULL;
+	}
+}
+
+static void
+store_free_property (jack_property_t* prop)
+{
+	free ((char*)prop->key);
+	free ((char*)prop->data);
+	if (prop->type) {
+		free ((char*)prop->type);
+	}
+}
+
+static void
+store_add_property (jack_description_t* desc, const jack_property_entry_t* e)
+{
+	if (desc->property_cnt == desc->property_size) {
+		desc->property_size = desc->property_size ? desc->property_size * 2 : 8;
+		desc->properties = (jack_property_t*)realloc (desc->properties, sizeof(jack_property_t) * desc->property_size);
+	}
+	store_copy_property (e, &desc->properties[desc->property_cnt++]);
+}
+
+static int
+store_get_property (jack_uuid_t subject,
+		    const char* key,
+		    char**      value,
+		    char**      type)
+{
+	jack_property_entry_t* e;
+	jack_property_t prop;
+	uint32_t seq;
+
+	for (;;) {
+		seq = store_read_begin (store);
+		if ((e = store_lookup (store, subject, key, NULL)) != NULL) {
+			store_copy_property (e, &prop);
+		}
+		if (!store_read_retry (store, seq)) {
+			break;
+		}
+		if (e) {
+			store_free_property (&prop);
+		}
+	}
+
+	if (e == NULL) {
+		return -1;
+	}
+
+	free ((char*)prop.key);
+	*value = (char*)prop.data;
+	*type = (char*)prop.type;
 
 	return 0;
 }
+
+/* Collects the properties of all nsubjects subjects from one consistent
+   state of the store.
+ */
+static int
+store_get_properties (const jack_uuid_t* subjects, uint32_t nsubjects,
+		      jack_description_t* descs)
+{
+	jack_property_entry_t* e;
+	uint32_t seq, n;
+	size_t steps;
+	uint32_t* l;
+	int cnt;
+
+	for (;;) {
+		seq = store_read_begin (store);
+		cnt = 0;
+
+		for (n = 0; n < nsubjects; ++n) {
+
+			jack_uuid_copy (&descs[n].subject, subjects[n]);
+			descs[n].properties = NULL;
+			descs[n].property_cnt = 0;
+			descs[n].property_size = 0;
+
+			l = &store->buckets[store_bucket (subjects[n])];
+			steps = store->arena_size / sizeof(jack_property_entry_t);
+
+			while (steps-- && (e = store_entry (store, *l)) != NULL) {
+				if (jack_uuid_compare (e->subject, subjects[n]) == 0) {
+					store_add_property (&descs[n], e);
+				}
+				l = &e->next;
+			}
+
+			cnt += descs[n].property_cnt;
+		}
+
+		if (!store_read_retry (store, seq)) {
+			return cnt;
+		}
+
+		for (n = 0; n < nsubjects; ++n) {
+			jack_free_description (&descs[n], 0);
+		}
+	}
+}
+
+static int
+store_get_all_properties (jack_description_t** descriptions)
+{
+	jack_property_entry_t* e;
+	jack_description_t* desc;
+	uint32_t seq, off, used;
+	size_t dcnt, dsize, n;
+
+	for (;;) {
+		seq = store_read_begin (store);
+
+		dsize = 8;
+		dcnt = 0;
+		desc = (jack_description_t*)malloc (dsize * sizeof(jack_description_t));
+
+		used = store->used;
+		off = 0;
+
+		while (off < used && (e = store_entry (store, off)) != NULL) {
+
+			if (e->live) {
+				for (n = 0; n < dcnt; ++n) {
+					if (jack_uuid_compare (e->subject, desc[n].subject) == 0) {
+						break;
+					}
+				}
+
+				if (n == dcnt) {
+					if (dcnt == dsize) {
+						dsize *= 2;
+						desc = (jack_description_t*)realloc (desc, sizeof(jack_description_t) * dsize);
+					}
+					jack_uuid_copy (&desc[n].subject, e->subject);
+					desc[n].properties = NULL;
+					desc[n].property_cnt = 0;
+					desc[n].property_size = 0;
+					dcnt++;
+				}
+
+				store_add_property (&desc[n], e);
+			}
+
+			off += e->size;
+		}
+
+		if (!store_read_retry (store, seq)) {
+			break;
+		}
+
+		for (n = 0; n < dcnt; ++n) {
+			jack_free_description (&desc[n], 0);
+		}
+		free (desc);
+	}
+
+	*descriptions = desc;
+
+	return dcnt;
+}
+
+/* Property store, server side. Callers hold store_lock. Writes nest,
+   so that a batch of them is seen by readers all at once.
+ */
+
+static int store_writing = 0;
+
+static inline void
+store_write_begin (jack_property_store_t* s)
+{
+	if (store_writing++ == 0) {
+		s->seq++;
+		__sync_synchronize ();
+	}
+}
+
+static inline void
+store_write_end (jack_property_store_t* s)
+{
+	if (--store_writing == 0) {
+		__sync_synchronize ();
+		s->seq++;
+	}
+}
+
+static void
+store_unlink (jack_property_store_t* s, uint32_t* link, jack_property_entry_t* e)
+{
+	*link = e->next;
+	e->live = 0;
+	s->dead += e->size;
+	s->count--;
+}
+
+static void
+store_link (jack_property_store_t* s, uint32_t off)
+{
+	jack_property_entry_t* e = (jack_property_entry_t*)(s->arena + off);
+	uint32_t b = store_bucket (e->subject);
+
+	e->next = s->buckets[b];
+	s->buckets[b] = off;
+}
+
+/* moves all live entries to the start of the arena and rebuilds the
+   chains
+ */
+static void
+store_compact (jack_property_store_t* s)
+{
+	jack_property_entry_t* e;
+	uint32_t off, to, size;
+
+	memset (s->buckets, 0xff, sizeof(s->buckets));
+
+	for (off = 0, to = 0; off < s->used; off += size) {
+		e = (jack_property_entry_t*)(s->arena + off);
+		size = e->size;
+		if (e->live) {
+			if (to != off) {
+				memmove (s->arena + to, e, size);
+			}
+			store_link (s, to);
+			to += size;
+		}
+	}
+
+	s->used = to;
+	s->dead = 0;
+}
+
+static inline size_t
+store_entry_size (size_t klen, size_t vlen, size_t tlen)
+{
+	return (sizeof(jack_property_entry_t) + klen + vlen + tlen + 7) & ~7;
+}
+
+static int
+store_put (jack_property_store_t* s, jack_uuid_t subject, const char* key,
+	   const char* value, const char* type, jack_property_change_t* change)
+{
+	jack_property_entry_t* e;
+	jack_property_entry_t* old;
+	uint32_t* link = NULL;
+	size_t klen, vlen, tlen, need, avail;
+	uint32_t off;
+
+	klen = strlen (key) + 1;
+	vlen = strlen (value) + 1;
+	tlen = (type && type[0] != '\0') ? strlen (type) + 1 : 0;
+	need = store_entry_size (klen, vlen, tlen);
+
+	old = store_lookup (s, subject, key, &link);
+	avail = s->arena_size - s->used + s->dead + (old ? old->size : 0);
+
+	if (need > avail) {
+		jack_error ("metadata store is full, cannot set %s", key);
+		return -1;
+	}
+
+	store_write_begin (s);
+
+	if (old) {
+		store_unlink (s, link, old);
+	}
+
+	if (s->arena_size - s->used < need) {
+		store_compact (s);
+	}
+
+	off = s->used;
+	e = (jack_property_entry_t*)(s->arena + off);
+	e->size = need;
+	e->live = 1;
+	e->key_len = klen;
+	e->value_len = vlen;
+	e->type_len = tlen;
+	jack_uuid_copy (&e->subject, subject);
+	memcpy (e->data, key, klen);
+	memcpy (e->data + klen, value, vlen);
+	if (tlen) {
+		memcpy (e->data + klen + vlen, type, tlen);
+	}
+	store_link (s, off);
+	s->used += need;
+	s->count++;
+
+	store_write_end (s);
+
+	if (change) {
+		*change = old ? PropertyChanged : PropertyCreated;
+	}
+
+	return 0;
+}
+
+/* removes subject/key, or all properties of subject if key is NULL */
+static int
+store_remove (jack_property_store_t* s, jack_uuid_t subject, const char* key)
+{
+	jack_property_entry_t* e;
+	uint32_t* link;
+	int cnt = 0;
+
+	store_write_begin (s);
+
+	if (key) {
+		if ((e = store_lookup (s, subject, key, &link)) != NULL) {
+			store_unlink (s, link, e);
+			cnt = 1;
+		}
+	} else {
+		link = &s->buckets[store_bucket (subject)];
+		while (*link != JACK_PROPERTY_STORE_NIL) {
+			e = (jack_property_entry_t*)(s->arena + *link);
+			if (jack_uuid_compare (e->subject, subject) == 0) {
+				store_unlink (s, link, e);
+				cnt++;
+			} else {
+				link = &e->next;
+			}
+		}
+	}
+
+	store_write_end (s);
+
+	return cnt;
+}
+
+int
+jack_property_store_new (const char* server_name,
+			 jack_shm_registry_index_t* index)
+{
+	jack_description_t* descs;
+	const char* env;
+	uint32_t i;
+	int n, d;
+
+	*index = -1;
+
+	if (jack_shmalloc (JACK_PROPERTY_STORE_SIZE, &store_shm)) {
+		jack_error ("cannot create metadata shared memory segment (%s)",
+			    strerror (errno));
+		return -1;
+	}
+
+	if (jack_attach_shm (&store_shm)) {
+		jack_error ("cannot attach to metadata shared memory (%s)",
+			    strerror (errno));
+		jack_destroy_shm (&store_shm);
+		return -1;
+	}
+
+	store = (jack_property_store_t*)jack_shm_addr (&store_shm);
+
+	/* also faults in the pages */
+	memset (store, 0, JACK_PROPERTY_STORE_SIZE);
+
+	store->version = JACK_PROPERTY_STORE_VERSION;
+	store->nbuckets = JACK_PROPERTY_STORE_BUCKETS;
+	store->arena_size = JACK_PROPERTY_STORE_SIZE - sizeof(jack_property_store_t);
+	memset (store->buckets, 0xff, sizeof(store->buckets));
+	store_owner = 1;
+
+	/* reload whatever the previous server left in the DB */
+
+	if ((env = getenv ("JACK_METADATA_DB")) != NULL && atoi (env) == 0) {
+		store_db = 0;
+	} else if (jack_property_init (server_name)) {
+		jack_error ("metadata will not be kept across server restarts");
+		store_db = 0;
+	} else {
+		store_db = 1;
+		if ((n = jack_db_get_all_properties (&descs)) > 0) {
+			for (d = 0; d < n; ++d) {
+				for (i = 0; i < descs[d].property_cnt; ++i) {
+					store_put (store, descs[d].subject,
+						   descs[d].properties[i].key,
+						   descs[d].properties[i].data,
+						   descs[d].properties[i].type, NULL);
+				}
+				jack_free_description (&descs[d], 0);
+			}
+		}
+		if (n >= 0) {
+			free (descs);
+		}
+	}
+
+	*index = store_shm.index;
+
+	return 0;
+}
+
+void
+jack_property_store_delete (void)
+{
+	pthread_mutex_lock (&store_lock);
+	if (store_owner) {
+		store = NULL;
+		store_owner = 0;
+		jack_release_shm (&store_shm);
+		jack_destroy_shm (&store_shm);
+	}
+	pthread_mutex_unlock (&store_lock);
+}
+
+/* The following are called by the engine on behalf of clients. Without
+   a store (if jack_property_store_new() failed), they go straight to
+   the DB, where clients will look too.
+ */
+
+int
+jack_property_store_set (jack_uuid_t subject, const char* key,
+			 const char* value, const char* type,
+			 jack_property_change_t* change)
+{
+	int ret;
+
+	pthread_mutex_lock (&store_lock);
+	if (store == NULL) {
+		ret = jack_db_set_property (subject, key, value, type, change);
+	} else if ((ret = store_put (store, subject, key, value, type, change)) == 0
+		   && store_db) {
+		jack_db_set_property (subject, key, value, type, NULL);
+	}
+	pthread_mutex_unlock (&store_lock);
+
+	return ret;
+}
+
+int
+jack_property_store_remove (jack_uuid_t subject, const char* key)
+{
+	int cnt;
+
+	pthread_mutex_lock (&store_lock);
+	if (store == NULL) {
+		if (key) {
+			cnt = jack_db_remove_property (subject, key) ? 0 : 1;
+		} else {
+			cnt = jack_db_remove_properties (subject);
+		}
+	} else if ((cnt = store_remove (store, subject, key)) > 0 && store_db) {
+		if (key) {
+			jack_db_remove_property (subject, key);
+		} else {
+			jack_db_remove_properties (subject);
+		}
+	}
+	pthread_mutex_unlock (&store_lock);
+
+	return cnt;
+}
+
+int
+jack_property_store_clear (void)
+{
+	int ret = 0;
+
+	pthread_mutex_lock (&store_lock);
+	if (store) {
+		store_write_begin (store);
+		memset (store->buckets, 0xff, sizeof(store->buckets));
+		store->used = 0;
+		store->dead = 0;
+		store->count = 0;
+		store_write_end (store);
+	}
+	if (store == NULL || store_db) {
+		ret = jack_db_remove_all_properties ();
+	}
+	pthread_mutex_unlock (&store_lock);
+
+	return ret;
+}
+
+/* One batch of changes, under one hold of store_lock and, for readers
+   of the store, one write. There must be room for all the values set
+   before any is; old values they replace are not counted, so this
+   may refuse a batch that would just fit. Without a store the DB is
+   changed one key at a time, as it is for single changes. *change is
+   what happened to ops[0].
+ */
+int
+jack_property_store_apply (const jack_property_op_t* ops, uint32_t nops,
+			   jack_property_change_t* change)
+{
+	jack_property_change_t first = PropertyDeleted;
+	jack_property_change_t ch;
+	const jack_property_op_t* op;
+	size_t need = 0;
+	uint32_t n;
+	int ret = 0;
+
+	pthread_mutex_lock (&store_lock);
+
+	if (store) {
+		for (n = 0; n < nops; ++n) {
+			op = &ops[n];
+			if (op->value) {
+				need += store_entry_size (
+					strlen (op->key) + 1, strlen (op->value) + 1,
+					(op->type && op->type[0] != '\0') ? strlen (op->type) + 1 : 0);
+			}
+		}
+		if (need > store->arena_size - store->used + store->dead) {
+			jack_error ("metadata store is full, cannot make %" PRIu32
+				    " changes", nops);
+			pthread_mutex_unlock (&store_lock);
+			return -1;
+		}
+		store_write_begin (store);
+	}
+
+	for (n = 0; n < nops && ret == 0; ++n) {
+		op = &ops[n];
+		ch = PropertyDeleted;
+
+		if (store == NULL) {
+			if (op->value) {
+				ret = jack_db_set_property (op->subject, op->key, op->value, op->type, &ch);
+			} else if (op->key) {
+				jack_db_remove_property (op->subject, op->key);
+			} else {
+				ret = jack_db_remove_properties (op->subject) < 0 ? -1 : 0;
+			}
+		} else if (op->value) {
+			if ((ret = store_put (store, op->subject, op->key, op->value, op->type, &ch)) == 0
+			    && store_db) {
+				jack_db_set_property (op->subject, op->key, op->value, op->type, NULL);
+			}
+		} else if (store_remove (store, op->subject, op->key) > 0 && store_db) {
+			if (op->key) {
+				jack_db_remove_property (op->subject, op->key);
+			} else {
+				jack_db_remove_properties (op->subject);
+			}
+		}
+
+		if (n == 0) {
+			first = ch;
+		}
+	}
+
+	if (store) {
+		store_write_end (store);
+	}
+
+	pthread_mutex_unlock (&store_lock);
+
+	if (change) {
+		*change = first;
+	}
+
+	return ret;
+}
+
+/* see jack_property_record_t */
+
+static inline size_t
+batch_record_size (size_t klen, size_t vlen, size_t tlen)
+{
+	return (sizeof(jack_property_record_t) + klen + vlen + tlen + 7) & ~7;
+}
+
+static const char*
+batch_string (const char* p, uint32_t len)
+{
+	if (len == 0) {
+		return NULL;
+	}
+	return p[len - 1] == '\0' && strlen (p) == len - 1 ? p : (const char*)-1;
+}
+
+/* Point ops into the records of a batch, checking that each is whole
+   and well formed; -1 if one is not.
+ */
+int
+jack_property_batch_unpack (const char* data, uint32_t size,
+			    uint32_t count, jack_property_op_t* ops)
+{
+	const jack_property_record_t* rec;
+	const char* p;
+	size_t off = 0, len;
+	uint32_t n;
+
+	for (n = 0; n < count; ++n) {
+		if (size - off < sizeof(*rec)) {
+			return -1;
+		}
+		rec = (const jack_property_record_t*)(data + off);
+		len = batch_record_size (rec->key_len, rec->value_len, rec->type_len);
+		if (rec->key_len > size || rec->value_len > size
+		    || rec->type_len > size || len > size - off) {
+			return -1;
+		}
+		p = (const char*)(rec + 1);
+
+		jack_uuid_copy (&ops[n].subject, rec->subject);
+		ops[n].key = batch_string (p, rec->key_len);
+		ops[n].value = batch_string (p + rec->key_len, rec->value_len);
+		ops[n].type = batch_string (p + rec->key_len + rec->value_len, rec->type_len);
+
+		if (ops[n].key == (const char*)-1 || ops[n].value == (const char*)-1
+		    || ops[n].type == (const char*)-1
+		    || (ops[n].value && (ops[n].key == NULL || ops[n].value[0] == '\0'))
+		    || (ops[n].key && ops[n].key[0] == '\0')) {
+			return -1;
+		}
+
+		off += len;
+	}
+
+	return off == size ? 0 : -1;
+}
+
+/* Property store, clients */
+
+void
+jack_property_store_attach (jack_shm_registry_index_t index)
+{
+	jack_property_store_t* s;
+
+	pthread_mutex_lock (&store_lock);
+
+	if (store_refs++ || store_owner || index < 0) {
+		pthread_mutex_unlock (&store_lock);
+		return;
+	}
+
+	store_shm.index = index;
+
+	if (jack_attach_shm (&store_shm)) {
+		jack_error ("cannot attach to metadata shared memory, "
+			    "using the metadata DB");
+		pthread_mutex_unlock (&store_lock);
+		return;
+	}
+
+	s = (jack_property_store_t*)jack_shm_addr (&store_shm);
+
+	if (s->version != JACK_PROPERTY_STORE_VERSION
+	    || s->nbuckets != JACK_PROPERTY_STORE_BUCKETS) {
+		jack_error ("metadata shared memory has an unknown layout, "
+			    "using the metadata DB");
+		jack_release_shm (&store_shm);
+	} else {
+		store = s;
+	}
+
+	pthread_mutex_unlock (&store_lock);
+}
+
+void
+jack_property_store_detach (void)
+{
+	pthread_mutex_lock (&store_lock);
+	if (store_refs > 0 && --store_refs == 0 && store && !store_owner) {
+		store = NULL;
+		jack_release_shm (&store_shm);
+	}
+	pthread_mutex_unlock (&store_lock);
+}
+
+/* Public API. Changes go through the server, which also notifies
+   clients; lookups read the store when there is one.
+ */
+
+int
+jack_set_property (jack_client_t* client,
+		   jack_uuid_t subject,
+		   const char* key,
+		   const char* value,
+		   const char* type)
+{
+	jack_request_t req;
+
+	if (!key || key[0] == '\0') {
+		jack_error ("empty key string for metadata not allowed");
+		return -1;
+	}
+
+	if (!value || value[0] == '\0') {
+		jack_error ("empty value string for metadata not allowed");
+		return -1;
+	}
+
+	/* the engine passes in a NULL client
+	 */
+
+	if (client == NULL) {
+		if (store_owner) {
+			return jack_property_store_set (subject, key, value, type, NULL);
+		}
+		return jack_db_set_property (subject, key, value, type, NULL);
+	}
+
+	if (type && type[0] == '\0') {
+		type = NULL;
+	}
+
+	req.type = PropertySet;
+	jack_uuid_copy (&req.x.property_set.uuid, subject);
+	req.x.property_set.keylen = strlen (key) + 1;
+	req.x.property_set.valuelen = strlen (value) + 1;
+	req.x.property_set.typelen = type ? strlen (type) + 1 : 0;
+	req.x.property_set.key = key;
+	req.x.property_set.value = value;
+	req.x.property_set.type = type;
+
+	return jack_client_deliver_request (client, &req);
+}
+
+int
+jack_set_properties_bulk (jack_client_t* client,
+			  const jack_property_op_t* ops,
+			  uint32_t nops)
+{
+	jack_request_t req;
+	jack_property_record_t* rec;
+	size_t size = 0, klen, vlen, tlen;
+	char* data;
+	char* p;
+	uint32_t n;
+	int ret;
+
+	if (nops > JACK_PROPERTY_BATCH_MAX) {
+		jack_error ("cannot make more than %d metadata changes at once",
+			    JACK_PROPERTY_BATCH_MAX);
+		return -1;
+	}
+
+	for (n = 0; n < nops; ++n) {
+		if (ops[n].key && ops[n].key[0] == '\0') {
+			jack_error ("empty key string for metadata not allowed");
+			return -1;
+		}
+		if (ops[n].value && (ops[n].value[0] == '\0' || ops[n].key == NULL)) {
+			jack_error ("metadata value set without a key, or empty");
+			return -1;
+		}
+		klen = ops[n].key ? strlen (ops[n].key) + 1 : 0;
+		vlen = ops[n].value ? strlen (ops[n].value) + 1 : 0;
+		tlen = (ops[n].value && ops[n].type && ops[n].type[0] != '\0')
+		       ? strlen (ops[n].type) + 1 : 0;
+		size += batch_record_size (klen, vlen, tlen);
+	}
+
+	if (nops == 0) {
+		return 0;
+	}
+
+	/* the engine passes in a NULL client */
+
+	if (client == NULL) {
+		return jack_property_store_apply (ops, nops, NULL);
+	}
+
+	if (size > JACK_PROPERTY_BATCH_MAX_SIZE) {
+		jack_error ("%zu bytes of metadata changes is more than %d",
+			    size, JACK_PROPERTY_BATCH_MAX_SIZE);
+		return -1;
+	}
+
+	if ((data = (char*)calloc (1, size)) == NULL) {
+		return -1;
+	}
+
+	for (n = 0, p = data; n < nops; ++n) {
+		rec = (jack_property_record_t*)p;
+		klen = ops[n].key ? strlen (ops[n].key) + 1 : 0;
+		vlen = ops[n].value ? strlen (ops[n].value) + 1 : 0;
+		tlen = (ops[n].value && ops[n].type && ops[n].type[0] != '\0')
+		       ? strlen (ops[n].type) + 1 : 0;
+		jack_uuid_copy (&rec->subject, ops[n].subject);
+		rec->key_len = klen;
+		rec->value_len = vlen;
+		rec->type_len = tlen;
+		p = (char*)(rec + 1);
+		if (klen) {
+			memcpy (p, ops[n].key, klen);
+		}
+		if (vlen) {
+			memcpy (p + klen, ops[n].value, vlen);
+		}
+		if (tlen) {
+			memcpy (p + klen + vlen, ops[n].type, tlen);
+		}
+		p = (char*)rec + batch_record_size (klen, vlen, tlen);
+	}
+
+	VALGRIND_MEMSET (&req, 0, sizeof(req));
+
+	req.type = PropertyBatch;
+	req.x.property_batch.count = nops;
+	req.x.property_batch.size = size;
+	req.x.property_batch.data = data;
+
+	ret = jack_client_deliver_request (client, &req);
+	free (data);
+
+	return ret;
+}
+
+int
+jack_get_property (jack_uuid_t subject,
+		   const char* key,
+		   char**      value,
+		   char**      type)
+{
+	if (key == NULL || key[0] == '\0') {
+		return -1;
+	}
+
+	if (store) {
+		return store_get_property (subject, key, value, type);
+	}
+
+	return jack_db_get_property (subject, key, value, type);
+}
+
+int
+jack_get_properties (jack_uuid_t subject,
+		     jack_description_t* desc)
+{
+	if (store) {
+		return store_get_properties (&subject, 1, desc);
+	}
+
+	return jack_db_get_properties (subject, desc);
+}
+
+int
+jack_get_properties_bulk (const jack_uuid_t* subjects,
+			  uint32_t nsubjects,
+			  jack_description_t* descs)
+{
+	uint32_t n;
+	int cnt = 0;
+	int ret;
+
+	if (store) {
+		return store_get_properties (subjects, nsubjects, descs);
+	}
+
+	for (n = 0; n < nsubjects; ++n) {
+		if ((ret = jack_db_get_properties (subjects[n], &descs[n])) < 0) {
+			while (n--) {
+				jack_free_description (&descs[n], 0);
+			}
+			return -1;
+		}
+		jack_uuid_copy (&descs[n].subject, subjects[n]);
+		cnt += ret;
+	}
+
+	return cnt;
+}
+
+int
+jack_get_all_properties (jack_description_t** descriptions)
+{
+	if (store) {
+		return store_get_all_properties (descriptions);
+	}
+
+	return jack_db_get_all_properties (descriptions);
+}
+
+static int
+jack_property_remove_request (jack_client_t* client, jack_uuid_t subject, const char* key)
+{
+	jack_request_t req;
+
+	req.type = PropertyRemove;
+	req.x.property.change = PropertyDeleted;
+	jack_uuid_copy (&req.x.property.uuid, subject);
+	req.x.property.keylen = key ? strlen (key) + 1 : 0;
+	req.x.property.key = key;
+
+	return jack_client_deliver_request (client, &req);
+}
+
+int
+jack_remove_property (jack_client_t* client, jack_uuid_t subject, const char* key)
+{
+	if (client) {
+		return jack_property_remove_request (client, subject, key);
+	}
+
+	if (store_owner) {
+		return jack_property_store_remove (subject, key) > 0 ? 0 : -1;
+	}
+
+	return jack_db_remove_property (subject, key);
+}
+
+int
+jack_remove_properties (jack_client_t* client, jack_uuid_t subject)
+{
+	if (client) {
+		return jack_property_remove_request (client, subject, NULL);
+	}
+
+	if (store_owner) {
+		return jack_property_store_remove (subject, NULL);
+	}
+
+	return jack_db_remove_properties (subject);
+}
+
+int
+jack_remove_all_properties (jack_client_t* client)
+{
+	jack_request_t req;
+
+	if (client) {
+		req.type = PropertyRemoveAll;
+		return jack_client_deliver_request (client, &req);
+	}
+
+	if (store_owner) {
+		return jack_property_store_clear ();
+	}
+
+	return jack_db_remove_all_properties ();
+}
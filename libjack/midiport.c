@@ -18,6 +18,7 @@
  */
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
@@ -210,6 +211,125 @@ jack_midi_event_write (void                   *port_buffer,
 }
 
 
+/* Events of a batch are sorted and merged this many at a time, so
+ * that the scratch space fits on the stack of a process thread.
+ */
+#define JACK_MIDI_BATCH_CHUNK 256
+
+/* Stable LSD radix sort of events[0..n) on their 16 bit times, one
+ * byte per pass, leaving the events converted in `sorted'. Payloads
+ * too big to be inline are copied to the end of the buffer as
+ * jack_midi_event_reserve() would, in whatever order.
+ */
+static void
+jack_midi_batch_sort (void *port_buffer, const jack_midi_event_t *events,
+		      uint32_t n, jack_midi_port_internal_event_t *sorted)
+{
+	jack_midi_port_info_private_t *info =
+		(jack_midi_port_info_private_t*)port_buffer;
+	jack_midi_data_t *data = (jack_midi_data_t*)port_buffer;
+	uint16_t order[JACK_MIDI_BATCH_CHUNK];
+	uint32_t lo[257], hi[257];
+	jack_midi_port_internal_event_t *event;
+	uint32_t i, b;
+
+	memset (lo, 0, sizeof(lo));
+	memset (hi, 0, sizeof(hi));
+	for (i = 0; i < n; ++i) {
+		lo[(events[i].time & 0xff) + 1]++;
+		hi[((events[i].time >> 8) & 0xff) + 1]++;
+	}
+	for (b = 1; b < 257; ++b) {
+		lo[b] += lo[b - 1];
+		hi[b] += hi[b - 1];
+	}
+
+	for (i = 0; i < n; ++i) {
+		order[lo[events[i].time & 0xff]++] = i;
+	}
+
+	for (i = 0; i < n; ++i) {
+		const jack_midi_event_t *src = &events[order[i]];
+
+		event = &sorted[hi[(src->time >> 8) & 0xff]++];
+		event->time = src->time;
+		event->size = src->size;
+		if (src->size <= MIDI_INLINE_MAX) {
+			memcpy (event->inline_data, src->buffer, src->size);
+		} else {
+			info->last_write_loc += src->size;
+			event->byte_offset =
+				info->buffer_size - 1 - info->last_write_loc;
+			memcpy (&data[event->byte_offset], src->buffer,
+				src->size);
+		}
+	}
+}
+
+int
+jack_midi_event_write_batch (void                    *port_buffer,
+			     const jack_midi_event_t *events,
+			     uint32_t count)
+{
+	jack_midi_port_info_private_t *info =
+		(jack_midi_port_info_private_t*)port_buffer;
+	jack_midi_port_internal_event_t *event_buffer =
+		(jack_midi_port_internal_event_t*)(info + 1);
+	jack_midi_port_internal_event_t sorted[JACK_MIDI_BATCH_CHUNK];
+	size_t used_size;
+	uint32_t i, n, done;
+	int32_t e, s, w;
+
+	/* the one check for the whole batch */
+	used_size = sizeof(jack_midi_port_info_private_t)
+		    + info->last_write_loc
+		    + ((size_t)info->event_count + count)
+		    * sizeof(jack_midi_port_internal_event_t);
+
+	for (i = 0; i < count; ++i) {
+		if (events[i].time >= info->nframes
+		    || events[i].size == 0 || events[i].size > UINT16_MAX) {
+			info->events_lost += count;
+			return EINVAL;
+		}
+		if (events[i].size > MIDI_INLINE_MAX) {
+			used_size += events[i].size;
+		}
+	}
+
+	if (used_size > info->buffer_size) {
+		info->events_lost += count;
+		return ENOBUFS;
+	}
+
+	for (done = 0; done < count; done += n) {
+
+		n = count - done;
+		if (n > JACK_MIDI_BATCH_CHUNK) {
+			n = JACK_MIDI_BATCH_CHUNK;
+		}
+
+		jack_midi_batch_sort (port_buffer, events + done, n, sorted);
+
+		/* merge from the back; on equal times what was in the
+		 * buffer first stays first */
+		e = (int32_t)info->event_count - 1;
+		s = (int32_t)n - 1;
+		w = e + (int32_t)n;
+		while (s >= 0) {
+			if (e >= 0 && event_buffer[e].time > sorted[s].time) {
+				event_buffer[w--] = event_buffer[e--];
+			} else {
+				event_buffer[w--] = sorted[s--];
+			}
+		}
+		info->event_count += n;
+	}
+
+	return 0;
+}
+
+
 /* Can't check to make sure this port is an output anymore.  If this gets
  * called on an input port, all clients after the client that calls it
  * will think there are no events in the buffer as the event count has
@@ -221,11 +341,85 @@ jack_midi_clear_buffer (void           *port_buffer)
 	jack_midi_port_info_private_t *info =
 		(jack_midi_port_info_private_t*)port_buffer;
 
-	info->event_count = 0;
-	info->last_write_loc = 0;
-	info->events_lost = 0;
+	/* Most MIDI buffers are empty most cycles: leave the header
+	 * alone then, so that the cache line stays shared with the
+	 * clients reading it rather than bouncing back to us. */
+	if (info->event_count | info->last_write_loc | info->events_lost) {
+		info->event_count = 0;
+		info->last_write_loc = 0;
+		info->events_lost = 0;
+	}
+}
+
+
+/* An input taking part in a mixdown. Events are merged in time order
+ * and, for equal times, in the order of port->connections, which is
+ * what `order' is for.
+ */
+typedef struct {
+	jack_midi_port_info_private_t *info;
+	unsigned int order;
+} jack_midi_mix_source_t;
+
+/* inputs we merge with a heap; beyond this we fall back to scanning */
+#define JACK_MIDI_MIX_HEAP_MAX 128
+
+static inline jack_nframes_t
+jack_midi_mix_next_time (const jack_midi_mix_source_t *src)
+{
+	const jack_midi_port_internal_event_t *events =
+		(const jack_midi_port_internal_event_t*)(src->info + 1);
+
+	return events[src->info->last_write_loc].time;
 }
 
+static inline int
+jack_midi_mix_before (const jack_midi_mix_source_t *a,
+		      const jack_midi_mix_source_t *b)
+{
+	jack_nframes_t ta = jack_midi_mix_next_time (a);
+	jack_nframes_t tb = jack_midi_mix_next_time (b);
+
+	return ta < tb || (ta == tb && a->order < b->order);
+}
+
+static void
+jack_midi_mix_sift_down (jack_midi_mix_source_t *heap, unsigned int n,
+			 unsigned int k)
+{
+	jack_midi_mix_source_t tmp;
+	unsigned int child;
+
+	while ((child = 2 * k + 1) < n) {
+		if (child + 1 < n &&
+		    jack_midi_mix_before (&heap[child + 1], &heap[child])) {
+			child++;
+		}
+		if (!jack_midi_mix_before (&heap[child], &heap[k])) {
+			break;
+		}
+		tmp = heap[k];
+		heap[k] = heap[child];
+		heap[child] = tmp;
+		k = child;
+	}
+}
+
+/* Copy the next unread event of `info' to the output and mark it read */
+static inline int
+jack_midi_mix_write (jack_port_t *port, jack_midi_port_info_private_t *info)
+{
+	jack_midi_port_internal_event_t *event =
+		(jack_midi_port_internal_event_t*)(info + 1) + info->last_write_loc;
+	int err;
+
+	err = jack_midi_event_write (jack_port_buffer (port),
+				     event->time,
+				     jack_midi_event_data (info, event),
+				     event->size);
+	info->last_write_loc++;
+	return err;
+}
 
 /* jack_midi_port_functions.mixdown */
 static void
@@ -235,16 +429,15 @@ jack_midi_port_mixdown (jack_port_t    *port, jack_nframes_t nframes)
 	jack_port_t    *input;
 	jack_nframes_t num_events = 0;
 	jack_nframes_t i          = 0;
-	int err        = 0;
 	jack_nframes_t lost_events = 0;
+	unsigned int order        = 0;
+	unsigned int nsrc         = 0;
 
-	/* The next (single) event to mix in to the buffer */
-	jack_midi_port_info_private_t   *earliest_info;
-	jack_midi_port_internal_event_t *earliest_event;
-	jack_midi_data_t                *earliest_buffer;
+	/* Inputs with events this cycle, as a min-heap on their next event */
+	jack_midi_mix_source_t heap[JACK_MIDI_MIX_HEAP_MAX];
+	jack_midi_mix_source_t *next;
 
 	jack_midi_port_info_private_t   *in_info;       /* For finding next event */
-	jack_midi_port_internal_event_t *in_events;     /* Corresponds to in_info */
 	jack_midi_port_info_private_t   *out_info;      /* Output 'buffer' */
 
 	jack_midi_clear_buffer (port->mix_buffer);
@@ -262,53 +455,85 @@ jack_midi_port_mixdown (jack_port_t    *port, jack_nframes_t nframes)
 	for (node = port->connections; node; node = jack_slist_next (node)) {
 		input = (jack_port_t*)node->data;
 		in_info =
-			(jack_midi_port_info_private_t*)jack_output_port_buffer (input);
+			(jack_midi_port_info_private_t*)jack_output_port_source (input);
 		num_events += in_info->event_count;
 		lost_events += in_info->events_lost;
-		in_info->last_write_loc = 0;
+
+		/* an empty input is only read, see jack_midi_clear_buffer() */
+		if (in_info->event_count > 0) {
+			in_info->last_write_loc = 0;
+			if (nsrc < JACK_MIDI_MIX_HEAP_MAX) {
+				heap[nsrc].info = in_info;
+				heap[nsrc].order = order;
+			}
+			nsrc++;
+		}
+		order++;
 	}
 
-	/* Write the events in the order of their timestamps */
-	for (i = 0; i < num_events; ++i) {
-		earliest_info = NULL;
-		earliest_event = NULL;
-		earliest_buffer = NULL;
-
-		/* Find the earliest unread event, to mix next
-		 * (search for an event earlier than earliest_event) */
-		for (node = port->connections; node; node = jack_slist_next (node)) {
-			in_info = (jack_midi_port_info_private_t*)
-				  jack_output_port_buffer (((jack_port_t*)node->data));
-			in_events = (jack_midi_port_internal_event_t*)(in_info + 1);
-
-			/* If there are unread events left in this port.. */
-			if (in_info->event_count > in_info->last_write_loc) {
-				/* .. and this event is the new earliest .. */
-				/* NOTE: that's why we compare time with <, not <= */
-				if (earliest_info == NULL
-				    || in_events[in_info->last_write_loc].time
-				    < earliest_event->time) {
-					/* .. then set this event as the next earliest */
-					earliest_info = in_info;
-					earliest_event = (jack_midi_port_internal_event_t*)
-							 (&in_events[in_info->last_write_loc]);
-				}
+	if (nsrc == 0) {
+
+		/* nothing to merge, and the output was cleared above */
+		if (lost_events) {
+			out_info->events_lost = lost_events;
+		}
+		return;
+
+	} else if (nsrc == 1) {
+
+		/* only one input has anything to say: no merging needed */
+		for (i = 0; i < num_events; ++i) {
+			if (jack_midi_mix_write (port, heap[0].info)) {
+				out_info->events_lost = num_events - i;
+				break;
 			}
 		}
 
-		if (earliest_info && earliest_event) {
-			earliest_buffer = (jack_midi_data_t*)earliest_info;
+	} else if (nsrc <= JACK_MIDI_MIX_HEAP_MAX) {
 
-			/* Write event to output */
-			err = jack_midi_event_write (
-				jack_port_buffer (port),
-				earliest_event->time,
-				jack_midi_event_data (earliest_buffer, earliest_event),
-				earliest_event->size);
+		for (i = nsrc / 2; i > 0; --i) {
+			jack_midi_mix_sift_down (heap, nsrc, i - 1);
+		}
 
-			earliest_info->last_write_loc++;
+		/* Write the events in the order of their timestamps */
+		for (i = 0; i < num_events; ++i) {
+			if (jack_midi_mix_write (port, heap[0].info)) {
+				out_info->events_lost = num_events - i;
+				break;
+			}
+			if (heap[0].info->last_write_loc == heap[0].info->event_count) {
+				heap[0] = heap[--nsrc];
+			}
+			jack_midi_mix_sift_down (heap, nsrc, 0);
+		}
+
+	} else {
+
+		/* Too many inputs to keep on the stack: find the earliest
+		 * unread event by looking at every one of them each time */
+		jack_midi_mix_source_t cur, best;
+
+		for (i = 0; i < num_events; ++i) {
+			next = NULL;
+			for (order = 0, node = port->connections; node;
+			     node = jack_slist_next (node), ++order) {
+				cur.info = (jack_midi_port_info_private_t*)
+					   jack_output_port_source (((jack_port_t*)node->data));
+				cur.order = order;
+
+				/* If there are unread events left in this port,
+				 * and this one is the new earliest. Ties go to
+				 * the port we saw first. */
+				if (cur.info->event_count > cur.info->last_write_loc
+				    && (next == NULL
+					|| jack_midi_mix_next_time (&cur)
+					< jack_midi_mix_next_time (next))) {
+					best = cur;
+					next = &best;
+				}
+			}
 
-			if (err) {
+			if (next && jack_midi_mix_write (port, next->info)) {
 				out_info->events_lost = num_events - i;
 				break;
 			}
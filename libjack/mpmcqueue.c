@@ -0,0 +1,255 @@
+/*
+   A bounded lock-free queue of fixed-size elements for any number of
+   producer and consumer threads.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+   This is Dmitry Vyukov's bounded MPMC queue. Every slot carries a
+   sequence number. A slot at position pos is free for the producer
+   that claims pos when its sequence is pos, and holds an element for
+   the consumer that claims pos when its sequence is pos + 1. Claiming
+   is a compare-and-swap on the shared enqueue or dequeue position;
+   handing a slot over is a release store of its sequence, so neither
+   side ever waits for the other while holding anything.
+
+   A thread that is the only one pushing, or the only one popping, can
+   use the _single calls instead. They own their position outright and
+   need no compare-and-swap, so they finish in a bounded number of
+   steps whatever the other threads do: they are wait-free, and are
+   what a realtime thread should call. The catch is that a producer
+   that has claimed a slot but not yet filled it hides the elements
+   behind it until it does; the consumer sees an empty queue rather
+   than waiting.
+ */
+
+#include <config.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef USE_MLOCK
+#include <sys/mman.h>
+#endif /* USE_MLOCK */
+
+#include "internal.h"
+
+#define JACK_CACHE_LINE 64
+
+struct _jack_mpmc_queue {
+	/* set at creation, then only read */
+	char *cells;
+	size_t stride;          /* sequence number and element, rounded up */
+	size_t elem_size;
+	size_t mask;
+	size_t cells_size;
+	int mlocked;
+
+	size_t enqueue_pos __attribute__((aligned(JACK_CACHE_LINE)));
+	size_t dequeue_pos __attribute__((aligned(JACK_CACHE_LINE)));
+};
+
+static inline size_t *
+jack_mpmc_seq (jack_mpmc_queue_t *q, size_t pos)
+{
+	return (size_t*)(q->cells + (pos & q->mask) * q->stride);
+}
+
+static inline void *
+jack_mpmc_data (size_t *seq)
+{
+	return seq + 1;
+}
+
+/* Create a queue for at least `count' elements of `elem_size' bytes
+   each. The count is rounded up to the next power of two. */
+
+jack_mpmc_queue_t *
+jack_mpmc_queue_create (size_t elem_size, size_t count)
+{
+	jack_mpmc_queue_t *q;
+	size_t n, i;
+	void *p;
+
+	if (elem_size == 0) {
+		return NULL;
+	}
+
+#ifdef HAVE_POSIX_MEMALIGN
+	if (posix_memalign (&p, JACK_CACHE_LINE, sizeof(jack_mpmc_queue_t))) {
+		return NULL;
+	}
+#else
+	if ((p = malloc (sizeof(jack_mpmc_queue_t))) == NULL) {
+		return NULL;
+	}
+#endif
+	q = (jack_mpmc_queue_t*)p;
+	memset (q, 0, sizeof(*q));
+
+	for (n = 2; n < count; n <<= 1) ;
+
+	q->elem_size = elem_size;
+	q->stride = (sizeof(size_t) + elem_size + sizeof(size_t) - 1)
+		    & ~(sizeof(size_t) - 1);
+	q->mask = n - 1;
+	q->cells_size = n * q->stride;
+
+	if ((q->cells = malloc (q->cells_size)) == NULL) {
+		free (q);
+		return NULL;
+	}
+
+	for (i = 0; i < n; ++i) {
+		*jack_mpmc_seq (q, i) = i;
+	}
+
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+
+	return q;
+}
+
+void
+jack_mpmc_queue_free (jack_mpmc_queue_t *q)
+{
+#ifdef USE_MLOCK
+	if (q->mlocked) {
+		munlock (q->cells, q->cells_size);
+	}
+#endif  /* USE_MLOCK */
+	free (q->cells);
+	free (q);
+}
+
+/* Lock the slots into memory, as jack_ringbuffer_mlock() does. */
+
+int
+jack_mpmc_queue_mlock (jack_mpmc_queue_t *q)
+{
+#ifdef USE_MLOCK
+	if (mlock (q->cells, q->cells_size)) {
+		return -1;
+	}
+#endif  /* USE_MLOCK */
+	q->mlocked = 1;
+	return 0;
+}
+
+/* Copy the element at `elem' into the queue. Returns 0, or -1 if the
+   queue is full. Lock-free. */
+
+int
+jack_mpmc_queue_push (jack_mpmc_queue_t *q, const void *elem)
+{
+	size_t pos = __atomic_load_n (&q->enqueue_pos, __ATOMIC_RELAXED);
+	size_t *seq;
+	intptr_t dif;
+
+	for (;;) {
+		seq = jack_mpmc_seq (q, pos);
+		dif = (intptr_t)__atomic_load_n (seq, __ATOMIC_ACQUIRE) - (intptr_t)pos;
+
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n (&q->enqueue_pos, &pos, pos + 1,
+							 1, __ATOMIC_RELAXED,
+							 __ATOMIC_RELAXED)) {
+				break;
+			}
+			/* pos now holds the current position */
+		} else if (dif < 0) {
+			return -1;              /* full */
+		} else {
+			pos = __atomic_load_n (&q->enqueue_pos, __ATOMIC_RELAXED);
+		}
+	}
+
+	memcpy (jack_mpmc_data (seq), elem, q->elem_size);
+	__atomic_store_n (seq, pos + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/* Copy the oldest element into `elem' and remove it. Returns 0, or -1
+   if the queue is empty. Lock-free. */
+
+int
+jack_mpmc_queue_pop (jack_mpmc_queue_t *q, void *elem)
+{
+	size_t pos = __atomic_load_n (&q->dequeue_pos, __ATOMIC_RELAXED);
+	size_t *seq;
+	intptr_t dif;
+
+	for (;;) {
+		seq = jack_mpmc_seq (q, pos);
+		dif = (intptr_t)__atomic_load_n (seq, __ATOMIC_ACQUIRE) - (intptr_t)(pos + 1);
+
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n (&q->dequeue_pos, &pos, pos + 1,
+							 1, __ATOMIC_RELAXED,
+							 __ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if (dif < 0) {
+			return -1;              /* empty */
+		} else {
+			pos = __atomic_load_n (&q->dequeue_pos, __ATOMIC_RELAXED);
+		}
+	}
+
+	memcpy (elem, jack_mpmc_data (seq), q->elem_size);
+	__atomic_store_n (seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/* jack_mpmc_queue_push() for a queue that only this thread pushes to.
+   Wait-free. */
+
+int
+jack_mpmc_queue_push_single (jack_mpmc_queue_t *q, const void *elem)
+{
+	size_t pos = q->enqueue_pos;
+	size_t *seq = jack_mpmc_seq (q, pos);
+
+	if (__atomic_load_n (seq, __ATOMIC_ACQUIRE) != pos) {
+		return -1;                      /* full */
+	}
+
+	q->enqueue_pos = pos + 1;
+	memcpy (jack_mpmc_data (seq), elem, q->elem_size);
+	__atomic_store_n (seq, pos + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/* jack_mpmc_queue_pop() for a queue that only this thread pops from,
+   such as one that worker threads feed to the process thread.
+   Wait-free. */
+
+int
+jack_mpmc_queue_pop_single (jack_mpmc_queue_t *q, void *elem)
+{
+	size_t pos = q->dequeue_pos;
+	size_t *seq = jack_mpmc_seq (q, pos);
+
+	if (__atomic_load_n (seq, __ATOMIC_ACQUIRE) != pos + 1) {
+		return -1;                      /* empty, or not filled in yet */
+	}
+
+	q->dequeue_pos = pos + 1;
+	memcpy (elem, jack_mpmc_data (seq), q->elem_size);
+	__atomic_store_n (seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
@@ -22,12 +22,18 @@
 #ifdef HAVE_POSIX_MEMALIGN
 #define _XOPEN_SOURCE 600
 #endif
+/* _XOPEN_SOURCE alone hides MAP_ANONYMOUS */
+#define _DEFAULT_SOURCE
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <config.h>
 
+#include "internal.h"
 #include "pool.h"
 
-/* XXX need RT-pool based allocator here */
 void *
 jack_pool_alloc (size_t bytes)
 {
@@ -45,3 +51,369 @@ jack_pool_release (void *ptr)
 {
 	free (ptr);
 }
+
+/* RT-safe pool
+ *
+ * One mmap'ed arena, touched and mlock'ed when the pool is created,
+ * is carved into fixed-size blocks for each size class. Every class
+ * keeps its free blocks on a lock-free stack. The stack head packs
+ * (index + 1) of the top block into its low 16 bits and a generation
+ * count into the high 16 bits; the count is bumped on every push so a
+ * pop that raced with a pop/push pair fails its compare-and-swap
+ * instead of installing a stale next pointer. jack_rt_pool_alloc() and
+ * jack_rt_pool_free() never block, never call into the system and may
+ * be used from any thread.
+ */
+
+#define JACK_RT_POOL_MIN_SHIFT  5       /* smallest class: 32 bytes */
+#define JACK_RT_POOL_CLASSES    8       /* largest class: 4096 bytes */
+#define JACK_RT_POOL_MAX_BLOCKS 0xffff
+#define JACK_RT_POOL_MAGIC      0x6a52
+
+/* keeps the payload 16-byte aligned */
+typedef union {
+	struct {
+		uint32_t next;          /* index + 1 of next free block */
+		uint16_t cls;
+		uint16_t magic;
+	} h;
+	char pad[16];
+} jack_rt_block_t;
+
+typedef struct {
+	volatile uint32_t head;
+	size_t block_size;              /* header included */
+	uint32_t nblocks;
+	char *base;
+} jack_rt_class_t;
+
+struct _jack_rt_pool {
+	char *arena;
+	size_t arena_size;
+	int locked;
+	jack_rt_class_t classes[JACK_RT_POOL_CLASSES];
+};
+
+static inline jack_rt_block_t *
+jack_rt_block (jack_rt_class_t *c, uint32_t n)
+{
+	return (jack_rt_block_t*)(c->base + (size_t)(n - 1) * c->block_size);
+}
+
+static void
+jack_rt_push (jack_rt_class_t *c, uint32_t n)
+{
+	jack_rt_block_t *b = jack_rt_block (c, n);
+	uint32_t old, new;
+
+	do {
+		old = c->head;
+		b->h.next = old & 0xffff;
+		new = ((old + 0x10000) & 0xffff0000) | n;
+	} while (!__sync_bool_compare_and_swap (&c->head, old, new));
+}
+
+static uint32_t
+jack_rt_pop (jack_rt_class_t *c)
+{
+	uint32_t old, new, n;
+
+	do {
+		old = c->head;
+		if ((n = old & 0xffff) == 0) {
+			return 0;
+		}
+		new = (old & 0xffff0000) | jack_rt_block (c, n)->h.next;
+	} while (!__sync_bool_compare_and_swap (&c->head, old, new));
+
+	return n;
+}
+
+size_t
+jack_rt_pool_default_size ()
+{
+	const char *str = getenv ("JACK_RT_POOL_SIZE");
+
+	if (str) {
+		return strtoul (str, NULL, 0);
+	}
+	return JACK_RT_POOL_DEFAULT_SIZE;
+}
+
+jack_rt_pool_t *
+jack_rt_pool_new (size_t bytes)
+{
+	jack_rt_pool_t *pool;
+	size_t per_class, offset;
+	uint32_t n;
+	int i;
+
+	if ((pool = (jack_rt_pool_t*)calloc (1, sizeof(jack_rt_pool_t))) == NULL) {
+		return NULL;
+	}
+
+	/* split the pool evenly (by bytes) between the classes */
+
+	per_class = bytes / JACK_RT_POOL_CLASSES;
+	offset = 0;
+
+	for (i = 0; i < JACK_RT_POOL_CLASSES; i++) {
+		jack_rt_class_t *c = &pool->classes[i];
+		c->block_size = sizeof(jack_rt_block_t)
+				+ ((size_t)1 << (JACK_RT_POOL_MIN_SHIFT + i));
+		c->nblocks = per_class / c->block_size;
+		if (c->nblocks < 4) {
+			c->nblocks = 4;
+		} else if (c->nblocks > JACK_RT_POOL_MAX_BLOCKS) {
+			c->nblocks = JACK_RT_POOL_MAX_BLOCKS;
+		}
+		offset += c->nblocks * c->block_size;
+	}
+
+	pool->arena_size = offset;
+	pool->arena = mmap (NULL, pool->arena_size, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (pool->arena == MAP_FAILED) {
+		jack_error ("cannot map %lu bytes for the RT pool",
+			    (unsigned long)pool->arena_size);
+		free (pool);
+		return NULL;
+	}
+
+	/* fault every page in now rather than in the process thread */
+
+	memset (pool->arena, 0, pool->arena_size);
+
+	if (mlock (pool->arena, pool->arena_size) == 0) {
+		pool->locked = 1;
+	} else {
+		jack_error ("cannot lock down RT pool memory (%lu bytes)",
+			    (unsigned long)pool->arena_size);
+	}
+
+	offset = 0;
+
+	for (i = 0; i < JACK_RT_POOL_CLASSES; i++) {
+		jack_rt_class_t *c = &pool->classes[i];
+		c->base = pool->arena + offset;
+		c->head = 0;
+		offset += c->nblocks * c->block_size;
+		for (n = c->nblocks; n > 0; n--) {
+			jack_rt_block_t *b = jack_rt_block (c, n);
+			b->h.cls = i;
+			b->h.magic = JACK_RT_POOL_MAGIC;
+			jack_rt_push (c, n);
+		}
+	}
+
+	return pool;
+}
+
+void
+jack_rt_pool_destroy (jack_rt_pool_t *pool)
+{
+	if (pool->locked) {
+		munlock (pool->arena, pool->arena_size);
+	}
+	munmap (pool->arena, pool->arena_size);
+	free (pool);
+}
+
+void *
+jack_rt_pool_alloc (jack_rt_pool_t *pool, size_t bytes)
+{
+	int i;
+	uint32_t n;
+
+	for (i = 0; i < JACK_RT_POOL_CLASSES; i++) {
+		if (bytes <= ((size_t)1 << (JACK_RT_POOL_MIN_SHIFT + i))) {
+			break;
+		}
+	}
+
+	/* a class that has run dry falls through to the next larger one */
+
+	for (; i < JACK_RT_POOL_CLASSES; i++) {
+		jack_rt_class_t *c = &pool->classes[i];
+		if ((n = jack_rt_pop (c)) != 0) {
+			return jack_rt_block (c, n) + 1;
+		}
+	}
+
+	return NULL;
+}
+
+void
+jack_rt_pool_free (jack_rt_pool_t *pool, void *ptr)
+{
+	jack_rt_block_t *b;
+	jack_rt_class_t *c;
+
+	if (ptr == NULL) {
+		return;
+	}
+
+	b = (jack_rt_block_t*)ptr - 1;
+
+	if ((char*)b < pool->arena
+	    || (char*)b >= pool->arena + pool->arena_size
+	    || b->h.magic != JACK_RT_POOL_MAGIC
+	    || b->h.cls >= JACK_RT_POOL_CLASSES) {
+		/* not ours; nothing RT-safe to do but leak it */
+		return;
+	}
+
+	c = &pool->classes[b->h.cls];
+	jack_rt_push (c, ((char*)b - c->base) / c->block_size + 1);
+}
+
+/* JSList node pool
+
+   jack_slist_prepend() and friends malloc and free a node each time,
+   and connection changes make and drop several lists' worth of them
+   on the server thread.  These take nodes from a free list instead,
+   which grows by a chunk at a time and never gives memory back, so
+   that a long-running server neither churns nor fragments its heap
+   for them.  Only control-path threads use this, so a mutex does.
+*/
+
+#define JACK_SLIST_POOL_CHUNK 256
+
+static pthread_mutex_t jack_slist_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static JSList *jack_slist_pool_free_nodes = NULL;
+static jack_slist_pool_stats_t jack_slist_pool = { 0, 0, 0 };
+
+static JSList *
+jack_pool_slist_node (void *data)
+{
+	JSList *node;
+	JSList *chunk;
+	int i;
+
+	pthread_mutex_lock (&jack_slist_pool_lock);
+
+	if (jack_slist_pool_free_nodes == NULL) {
+		if ((chunk = (JSList*)malloc (JACK_SLIST_POOL_CHUNK
+					      * sizeof(JSList))) == NULL) {
+			pthread_mutex_unlock (&jack_slist_pool_lock);
+			return NULL;
+		}
+		for (i = 0; i < JACK_SLIST_POOL_CHUNK; i++) {
+			chunk[i].next = jack_slist_pool_free_nodes;
+			jack_slist_pool_free_nodes = &chunk[i];
+		}
+		jack_slist_pool.pooled += JACK_SLIST_POOL_CHUNK;
+		jack_slist_pool.chunks++;
+	}
+
+	node = jack_slist_pool_free_nodes;
+	jack_slist_pool_free_nodes = node->next;
+	jack_slist_pool.pooled--;
+	jack_slist_pool.in_use++;
+
+	pthread_mutex_unlock (&jack_slist_pool_lock);
+
+	node->data = data;
+	node->next = NULL;
+
+	return node;
+}
+
+JSList *
+jack_pool_slist_prepend (JSList *list, void *data)
+{
+	JSList *node;
+
+	if ((node = jack_pool_slist_node (data)) == NULL) {
+		jack_error ("cannot allocate list node");
+		return list;
+	}
+
+	node->next = list;
+	return node;
+}
+
+JSList *
+jack_pool_slist_append (JSList *list, void *data)
+{
+	JSList *node;
+	JSList *last;
+
+	if ((node = jack_pool_slist_node (data)) == NULL) {
+		jack_error ("cannot allocate list node");
+		return list;
+	}
+
+	if (list == NULL) {
+		return node;
+	}
+
+	for (last = list; last->next; last = last->next) {
+	}
+	last->next = node;
+
+	return list;
+}
+
+JSList *
+jack_pool_slist_remove (JSList *list, void *data)
+{
+	JSList *node;
+	JSList *prev = NULL;
+
+	for (node = list; node; prev = node, node = node->next) {
+		if (node->data == data) {
+			if (prev) {
+				prev->next = node->next;
+			} else {
+				list = node->next;
+			}
+			jack_pool_slist_free_1 (node);
+			break;
+		}
+	}
+
+	return list;
+}
+
+void
+jack_pool_slist_free (JSList *list)
+{
+	JSList *last;
+	unsigned long n = 1;
+
+	if (list == NULL) {
+		return;
+	}
+
+	for (last = list; last->next; last = last->next) {
+		n++;
+	}
+
+	pthread_mutex_lock (&jack_slist_pool_lock);
+	last->next = jack_slist_pool_free_nodes;
+	jack_slist_pool_free_nodes = list;
+	jack_slist_pool.pooled += n;
+	jack_slist_pool.in_use -= n;
+	pthread_mutex_unlock (&jack_slist_pool_lock);
+}
+
+void
+jack_pool_slist_free_1 (JSList *node)
+{
+	if (node == NULL) {
+		return;
+	}
+
+	node->next = NULL;
+	jack_pool_slist_free (node);
+}
+
+void
+jack_pool_slist_stats (jack_slist_pool_stats_t *stats)
+{
+	pthread_mutex_lock (&jack_slist_pool_lock);
+	*stats = jack_slist_pool;
+	pthread_mutex_unlock (&jack_slist_pool_lock);
+}
@@ -37,6 +37,7 @@
 #include "pool.h"
 #include "port.h"
 #include "intsimd.h"
+#include "probes.h"
 
 #include "local.h"
 
@@ -47,6 +48,9 @@ static void    jack_generic_buffer_init(void *port_buffer,
 static void    jack_audio_port_mixdown(jack_port_t *port,
 				       jack_nframes_t nframes);
 
+static void    jack_type_port_mixdown(jack_port_t *port,
+				      jack_nframes_t nframes);
+
 /* These function pointers are local to each address space.  For
  * internal clients they reside within jackd; for external clients in
  * the application process. */
@@ -74,10 +78,107 @@ jack_port_type_info_t jack_builtin_port_types[] = {
 
 /* these functions have been taken from libDSP X86.c  -jl */
 
+static void
+gen_mixnf (float *dest, const float * const *src, int nsrc, int length)
+{
+	int i, j;
+	float sum;
+
+	for (i = 0; i < length; i++) {
+		sum = src[0][i];
+		for (j = 1; j < nsrc; j++)
+			sum += src[j][i];
+		dest[i] = sum;
+	}
+}
+
+/* gen_mixnf for the common period sizes: with the trip count known
+   and the sum kept in a local array, which nothing else can alias, the
+   compiler unrolls and vectorizes the loops.  The sum is formed in the
+   same order, so the result is the same as gen_mixnf's. */
+#define GEN_MIXNF_SIZED(N) \
+static void \
+gen_mixnf_##N (float *dest, const float * const *src, int nsrc, int length) \
+{ \
+	float sum[N]; \
+	int i, j; \
+ \
+	if (length != N) { \
+		gen_mixnf (dest, src, nsrc, length); \
+		return; \
+	} \
+	for (i = 0; i < N; i++) \
+		sum[i] = src[0][i]; \
+	for (j = 1; j < nsrc; j++) \
+		for (i = 0; i < N; i++) \
+			sum[i] += src[j][i]; \
+	for (i = 0; i < N; i++) \
+		dest[i] = sum[i]; \
+}
+
+GEN_MIXNF_SIZED (64)
+GEN_MIXNF_SIZED (128)
+GEN_MIXNF_SIZED (256)
+
+typedef void (*jack_mixn_function_t)(float *, const float * const *, int, int);
+
+static jack_mixn_function_t
+gen_mixnf_for (jack_nframes_t nframes)
+{
+	switch (nframes) {
+	case 64:
+		return gen_mixnf_64;
+	case 128:
+		return gen_mixnf_128;
+	case 256:
+		return gen_mixnf_256;
+	}
+	return gen_mixnf;
+}
+
+/* dest[i] = sum of src[j][i] * (gain[j] + step[j] * (i + 1)): each
+   input ramps linearly from its old gain to gain + step * length over
+   the period.  As with the mixnf functions dest may be src[0]. */
+static void
+gen_mixgainf (float *dest, const float * const *src, const float *gain,
+	      const float *step, int nsrc, int length)
+{
+	int i, j;
+	float sum;
+
+	for (i = 0; i < length; i++) {
+		sum = 0.0f;
+		for (j = 0; j < nsrc; j++)
+			sum += src[j][i] * (gain[j] + step[j] * (i + 1));
+		dest[i] = sum;
+	}
+}
+
+static void
+gen_meterf (const float *src, int length, float *peak, float *sumsq)
+{
+	int i;
+	float a, p = 0.0f, s = 0.0f;
+
+	for (i = 0; i < length; i++) {
+		a = fabsf (src[i]);
+		if (a > p)
+			p = a;
+		s += src[i] * src[i];
+	}
+	*peak = p;
+	*sumsq = s;
+}
+
 #ifdef USE_DYNSIMD
 
 static void (*opt_copy)(float *, const float *, int);
 static void (*opt_mix)(float *, const float *, int);
+static void (*opt_mixn)(float *, const float * const *, int, int);
+static void (*opt_meter)(const float *, int, float *, float *);
+static void (*opt_mixgain)(float *, const float * const *, const float *,
+			   const float *, int, int);
+static int opt_mixn_generic;    /* no SIMD version; see jack_port_set_period() */
 
 static void
 gen_copyf (float *dest, const float *src, int length)
@@ -97,19 +198,80 @@ gen_mixf (float *dest, const float *src, int length)
 	        fpDest[iSample] += fpSrc[iSample];*/
 }
 
+/* for instruction sets we only have copy and add for: one pass per
+   input, as mixdown always used to do */
+static void
+multipass_mixnf (float *dest, const float * const *src, int nsrc, int length)
+{
+	int j;
+
+	if (dest != src[0])
+		opt_copy (dest, src[0], length);
+	for (j = 1; j < nsrc; j++)
+		opt_mix (dest, src[j], length);
+}
+
 #ifdef ARCH_X86
 
 void jack_port_set_funcs ()
 {
-	if (ARCH_X86_HAVE_SSE2 (cpu_type)) {
+	if (ARCH_X86_HAVE_AVX512 (cpu_type)) {
+		opt_copy = x86_avx512_copyf;
+		opt_mix = x86_avx512_add2f;
+		opt_mixn = x86_avx512_mixnf;
+		opt_mixn_generic = 0;
+		opt_meter = x86_avx_meterf;
+	} else if (ARCH_X86_HAVE_AVX (cpu_type)) {
+		opt_copy = x86_avx_copyf;
+		opt_mix = x86_avx_add2f;
+		opt_mixn = x86_avx_mixnf;
+		opt_mixn_generic = 0;
+		opt_meter = x86_avx_meterf;
+	} else if (ARCH_X86_HAVE_SSE2 (cpu_type)) {
 		opt_copy = x86_sse_copyf;
 		opt_mix = x86_sse_add2f;
+		opt_mixn = x86_sse_mixnf;
+		opt_mixn_generic = 0;
+		opt_meter = x86_sse_meterf;
 	} else if (ARCH_X86_HAVE_3DNOW (cpu_type)) {
 		opt_copy = x86_3dnow_copyf;
 		opt_mix = x86_3dnow_add2f;
+		opt_mixn = multipass_mixnf;
+		opt_mixn_generic = 0;
+		opt_meter = gen_meterf;
+	} else {
+		opt_copy = gen_copyf;
+		opt_mix = gen_mixf;
+		opt_mixn = gen_mixnf;
+		opt_mixn_generic = 1;
+		opt_meter = gen_meterf;
+	}
+
+	if (ARCH_X86_HAVE_FMA (cpu_type)) {
+		opt_mixgain = x86_fma_mixgainf;
+	} else {
+		opt_mixgain = gen_mixgainf;
+	}
+}
+
+#elif defined(ARCH_ARM)
+
+void jack_port_set_funcs ()
+{
+	if (ARCH_ARM_HAVE_NEON (cpu_type)) {
+		opt_copy = arm_neon_copyf;
+		opt_mix = arm_neon_add2f;
+		opt_mixn = arm_neon_mixnf;
+		opt_mixn_generic = 0;
+		opt_meter = arm_neon_meterf;
+		opt_mixgain = arm_neon_mixgainf;
 	} else {
 		opt_copy = gen_copyf;
 		opt_mix = gen_mixf;
+		opt_mixn = gen_mixnf;
+		opt_mixn_generic = 1;
+		opt_meter = gen_meterf;
+		opt_mixgain = gen_mixgainf;
 	}
 }
 
@@ -119,12 +281,37 @@ void jack_port_set_funcs ()
 {
 	opt_copy = gen_copyf;
 	opt_mix = gen_mixf;
+	opt_mixn = gen_mixnf;
+	opt_mixn_generic = 1;
+	opt_meter = gen_meterf;
+	opt_mixgain = gen_mixgainf;
 }
 
 #endif  /* ARCH_X86 */
 
+#else   /* USE_DYNSIMD */
+
+static void (*opt_mixn)(float *, const float * const *, int, int) = gen_mixnf;
+static const int opt_mixn_generic = 1;
+#define opt_meter gen_meterf
+#define opt_mixgain gen_mixgainf
+
 #endif  /* USE_DYNSIMD */
 
+/* Called with the server's buffer size when a client opens and
+   whenever it changes.  The SIMD kernels handle any length well
+   enough; the plain C one is swapped for a version with the length
+   built in, if there is one.  All clients of a process share it, and
+   each checks the length it gets, so clients of servers with other
+   buffer sizes still get the right result. */
+void
+jack_port_set_period (jack_nframes_t nframes)
+{
+	if (opt_mixn_generic) {
+		opt_mixn = gen_mixnf_for (nframes);
+	}
+}
+
 int
 jack_port_name_equals (jack_port_shared_t* port, const char* target)
 {
@@ -147,6 +334,53 @@ jack_port_name_equals (jack_port_shared_t* port, const char* target)
 	       strcmp (port->alias2, target) == 0;
 }
 
+uint32_t
+jack_port_name_hash (const char *name)
+{
+	/* FNV-1a */
+	uint32_t h = 2166136261u;
+
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+jack_port_id_t
+jack_port_hash_lookup (jack_control_t *control, const char *name)
+{
+	jack_port_id_t *table = jack_port_hash_table (control);
+	uint32_t *hashes = jack_port_hash_column (control);
+	uint32_t mask = control->port_hash_size - 1;
+	uint32_t hash, slot, n;
+	jack_port_id_t id;
+
+	if (control->port_hash_size == 0) {
+		return (jack_port_id_t)-1;
+	}
+
+	hash = jack_port_name_hash (name);
+	slot = hash & mask;
+
+	for (n = 0; n < control->port_hash_size; n++) {
+		id = table[slot];
+		if (id == JACK_PORT_HASH_EMPTY) {
+			break;
+		}
+		if (id < control->port_max &&
+		    hashes[id] == hash &&
+		    control->ports[id].in_use &&
+		    strcmp (control->ports[id].name, name) == 0) {
+			return id;
+		}
+		slot = (slot + 1) & mask;
+	}
+
+	return (jack_port_id_t)-1;
+}
+
 jack_port_functions_t *
 jack_get_port_functions (jack_port_type_id_t ptid)
 {
@@ -190,6 +424,14 @@ jack_port_new (const jack_client_t *client, jack_port_id_t port_id,
 	pthread_mutex_init (&port->connection_lock, NULL);
 	port->connections = 0;
 	port->tied = NULL;
+	port->domain_buffer = NULL;
+	port->cached_buffer = NULL;
+	port->gain = 1.0f;
+	port->gain_target = 1.0f;
+	port->gained = 0;
+	port->cycle = &control->cycle_seq;
+	port->engine = control;
+	port->delayed = &client->control->delayed;
 
 	if (jack_uuid_compare (client->control->uuid, port->shared->client_id) == 0) {
 
@@ -198,6 +440,12 @@ jack_port_new (const jack_client_t *client, jack_port_id_t port_id,
 		 * definitions can be overridden by the client.
 		 */
 		jack_port_functions_t *port_functions = jack_get_port_functions (ptid);
+		if (port_functions == NULL
+		    && client->port_type_functions[ptid].buffer_init) {
+			/* see jack_port_type_register() */
+			port_functions = (jack_port_functions_t*)
+					 &client->port_type_functions[ptid];
+		}
 		if (port_functions == NULL) {
 			port_functions = &jack_builtin_NULL_functions;
 		}
@@ -212,6 +460,10 @@ jack_port_new (const jack_client_t *client, jack_port_id_t port_id,
 	   are changed.
 	 */
 
+	if (client->port_segment_pending & (1 << ptid)) {
+		jack_attach_port_segment ((jack_client_t*)client, ptid);
+	}
+
 	port->client_segment_base =
 		(void**)&client->port_segment[ptid].attached_at;
 
@@ -235,6 +487,48 @@ jack_port_type_get_buffer_size (jack_client_t *client, const char *port_type)
 	return jack_port_type_buffer_size (&(client->engine->port_types[i]), client->engine->buffer_size);
 }
 
+int
+jack_port_type_register (jack_client_t *client, const char *port_type,
+			 size_t buffer_size, uint32_t nports,
+			 JackPortTypeMixdownCallback mixdown, void *arg)
+{
+	jack_request_t req;
+	jack_port_functions_t *functions;
+	jack_port_type_id_t ptid;
+
+	if (buffer_size == 0 || buffer_size > INT32_MAX) {
+		jack_error ("cannot register port type %s with buffers of"
+			    " %zu bytes", port_type, buffer_size);
+		return -1;
+	}
+
+	VALGRIND_MEMSET (&req, 0, sizeof(req));
+
+	req.type = PortTypeRegister;
+	snprintf (req.x.port_type.type, sizeof(req.x.port_type.type),
+		  "%s", port_type);
+	req.x.port_type.buffer_size = buffer_size;
+	req.x.port_type.nbuffers = nports;
+	req.x.port_type.flags = mixdown ? 0 : JACK_PORT_TYPE_NO_MIXDOWN;
+
+	/* the status is the type's id */
+	if (jack_client_deliver_request (client, &req) < 0) {
+		jack_error ("cannot register port type %s", port_type);
+		return -1;
+	}
+	ptid = req.status;
+
+	/* only this client's own ports of the type use these, so they
+	   are set before it has any */
+	functions = &client->port_type_functions[ptid];
+	functions->buffer_init = jack_generic_buffer_init;
+	functions->mixdown = mixdown ? jack_type_port_mixdown : NULL;
+	functions->type_mixdown = mixdown;
+	functions->type_mixdown_arg = arg;
+
+	return 0;
+}
+
 jack_port_t *
 jack_port_register (jack_client_t *client,
 		    const char *port_name,
@@ -285,6 +579,13 @@ jack_port_register (jack_client_t *client,
 
 	client->ports = jack_slist_prepend (client->ports, port);
 
+	if ((flags & JackPortIsInput)
+	    && !(port->type_info->flags & JACK_PORT_TYPE_RUNTIME)
+	    && jack_client_mix_reserve (client)) {
+		jack_error ("cannot reserve a mixdown buffer for port %s",
+			    port_name);
+	}
+
 	return port;
 }
 
@@ -303,6 +604,157 @@ jack_port_unregister (jack_client_t *client, jack_port_t *port)
 	return jack_client_deliver_request (client, &req);
 }
 
+int
+jack_port_register_many (jack_client_t *client,
+			 jack_port_registration_t *ports,
+			 uint32_t count)
+{
+	jack_request_t req;
+	jack_port_op_t *ops;
+	jack_port_t *port;
+	uint32_t *which;
+	uint32_t done, n, nops;
+	int ret = 0;
+
+	for (n = 0; n < count; ++n) {
+		ports[n].port = NULL;
+	}
+
+	if (count == 0) {
+		return 0;
+	}
+
+	nops = count < JACK_PORT_BATCH_MAX ? count : JACK_PORT_BATCH_MAX;
+	ops = (jack_port_op_t*)malloc (nops * sizeof(*ops));
+	which = (uint32_t*)malloc (nops * sizeof(*which));
+
+	if (ops == NULL || which == NULL) {
+		free (ops);
+		free (which);
+		return -1;
+	}
+
+	for (done = 0; done < count && ret == 0; ) {
+
+		for (nops = 0; nops < JACK_PORT_BATCH_MAX && done < count; ++done) {
+			jack_port_op_t *op = &ops[nops];
+
+			if (snprintf (op->name, sizeof(op->name), "%s:%s",
+				      client->control->name, ports[done].port_name)
+			    >= (int)sizeof(op->name)) {
+				jack_error ("\"%s:%s\" is too long to be used as a JACK port name.\n"
+					    "Please use %lu characters or less.",
+					    client->control->name,
+					    ports[done].port_name,
+					    sizeof(op->name) - 1);
+				continue;
+			}
+			snprintf (op->type, sizeof(op->type), "%s",
+				  ports[done].port_type);
+			op->flags = ports[done].flags;
+			op->port_id = 0;
+			op->reg = 1;
+			op->status = -1;
+			which[nops++] = done;
+		}
+
+		if (nops == 0) {
+			break;
+		}
+
+		VALGRIND_MEMSET (&req, 0, sizeof(req));
+
+		req.type = PortBatch;
+		req.x.port_batch.count = nops;
+		jack_uuid_copy (&req.x.port_batch.client_id, client->control->uuid);
+		req.x.port_batch.ops = ops;
+
+		if ((ret = jack_client_deliver_request (client, &req)) != 0) {
+			jack_error ("cannot deliver port registration request");
+			break;
+		}
+
+		for (n = 0; n < nops; ++n) {
+			if (ops[n].status) {
+				continue;
+			}
+			if ((port = jack_port_new (client, ops[n].port_id,
+						   client->engine)) == NULL) {
+				jack_error ("cannot allocate client side port structure");
+				continue;
+			}
+			client->ports = jack_slist_prepend (client->ports, port);
+			ports[which[n]].port = port;
+			if ((port->shared->flags & JackPortIsInput)
+			    && !(port->type_info->flags & JACK_PORT_TYPE_RUNTIME)
+			    && jack_client_mix_reserve (client)) {
+				jack_error ("cannot reserve a mixdown buffer for port %s",
+					    port->shared->name);
+			}
+		}
+	}
+
+	free (ops);
+	free (which);
+
+	return ret;
+}
+
+int
+jack_port_unregister_many (jack_client_t *client, jack_port_t **ports,
+			   uint32_t count)
+{
+	jack_request_t req;
+	jack_port_op_t *ops;
+	uint32_t done, n, chunk;
+	int ret = 0;
+
+	if (count == 0) {
+		return 0;
+	}
+
+	chunk = count < JACK_PORT_BATCH_MAX ? count : JACK_PORT_BATCH_MAX;
+
+	if ((ops = (jack_port_op_t*)calloc (chunk, sizeof(*ops))) == NULL) {
+		return -1;
+	}
+
+	for (done = 0; done < count; done += chunk) {
+
+		if (count - done < chunk) {
+			chunk = count - done;
+		}
+
+		for (n = 0; n < chunk; ++n) {
+			ops[n].port_id = ports[done + n]->shared->id;
+			ops[n].reg = 0;
+			ops[n].status = -1;
+		}
+
+		VALGRIND_MEMSET (&req, 0, sizeof(req));
+
+		req.type = PortBatch;
+		req.x.port_batch.count = chunk;
+		jack_uuid_copy (&req.x.port_batch.client_id, client->control->uuid);
+		req.x.port_batch.ops = ops;
+
+		if (jack_client_deliver_request (client, &req)) {
+			ret = -1;
+			break;
+		}
+
+		for (n = 0; n < chunk; ++n) {
+			if (ops[n].status) {
+				ret = -1;
+			}
+		}
+	}
+
+	free (ops);
+
+	return ret;
+}
+
 /* LOCAL (in-client) connection querying only */
 
 int
@@ -311,11 +763,74 @@ jack_port_connected (const jack_port_t *port)
 	return jack_slist_length (port->connections);
 }
 
+static inline int
+jack_port_ids_connected_int (jack_control_t *control,
+			     jack_port_id_t a, jack_port_id_t b)
+{
+	return (__atomic_load_n (&jack_port_connection_map (control, a)[b >> 6],
+				 __ATOMIC_ACQUIRE) >> (b & 63)) & 1;
+}
+
+int
+jack_port_ids_connected (jack_client_t *client,
+			 jack_port_id_t a, jack_port_id_t b)
+{
+	jack_control_t *control = client->engine;
+
+	if (a >= control->port_max || b >= control->port_max) {
+		return FALSE;
+	}
+
+	return jack_port_ids_connected_int (control, a, b);
+}
+
+int
+jack_port_get_connection_ids (jack_client_t *client, jack_port_id_t port_id,
+			      jack_port_id_t *ids, int max)
+{
+	jack_control_t *control = client->engine;
+	uint64_t *row;
+	uint64_t word;
+	uint32_t w;
+	int n = 0;
+
+	if (port_id >= control->port_max) {
+		return -1;
+	}
+
+	row = jack_port_connection_map (control, port_id);
+
+	for (w = 0; w < JACK_PORT_MAP_WORDS (control->port_max); w++) {
+		word = __atomic_load_n (&row[w], __ATOMIC_ACQUIRE);
+		while (word) {
+			if (n < max) {
+				ids[n] = (w << 6) + __builtin_ctzll (word);
+			}
+			n++;
+			word &= word - 1;
+		}
+	}
+
+	return n;
+}
+
 int
 jack_port_connected_to (const jack_port_t *port, const char *portname)
 {
 	JSList *node;
 	int ret = FALSE;
+	jack_port_id_t id;
+
+	/* a full port name is answered from the connection map; an
+	   alias is not in the name hash, so fall back to the walk
+	   below for those.
+	 */
+
+	id = jack_port_hash_lookup ((jack_control_t*)port->engine, portname);
+	if (id != (jack_port_id_t)-1) {
+		return jack_port_ids_connected_int ((jack_control_t*)port->engine,
+						    port->shared->id, id);
+	}
 
 	/* XXX this really requires a cross-process lock
 	   so that ports/connections cannot go away
@@ -377,6 +892,262 @@ jack_port_get_connections (const jack_port_t *port)
 	return ret;
 }
 
+/* CLIENT-LOCAL graph mirror, see jack_set_graph_mirror() */
+
+int
+jack_graph_mirror_new (jack_client_t *client)
+{
+	jack_graph_mirror_t *mirror;
+	uint32_t port_max = client->engine->port_max;
+
+	if ((mirror = (jack_graph_mirror_t*)malloc (sizeof(*mirror))) == NULL) {
+		return -1;
+	}
+
+	mirror->port_max = port_max;
+	mirror->ports = (jack_port_t**)calloc (port_max, sizeof(jack_port_t*));
+	mirror->peers = (jack_mirror_peers_t*)calloc (port_max,
+						      sizeof(jack_mirror_peers_t));
+
+	if (mirror->ports == NULL || mirror->peers == NULL) {
+		free (mirror->ports);
+		free (mirror->peers);
+		free (mirror);
+		return -1;
+	}
+
+	pthread_mutex_init (&mirror->lock, NULL);
+	client->mirror = mirror;
+	jack_graph_mirror_sync (client);
+
+	return 0;
+}
+
+void
+jack_graph_mirror_free (jack_client_t *client)
+{
+	jack_graph_mirror_t *mirror = client->mirror;
+	uint32_t i;
+
+	if (mirror == NULL) {
+		return;
+	}
+
+	client->mirror = NULL;
+
+	for (i = 0; i < mirror->port_max; i++) {
+		free (mirror->ports[i]);
+		free (mirror->peers[i].ids);
+	}
+
+	pthread_mutex_destroy (&mirror->lock);
+	free (mirror->ports);
+	free (mirror->peers);
+	free (mirror);
+}
+
+static inline int
+jack_port_id_is_mine (const jack_client_t *client, jack_port_id_t id)
+{
+	return jack_uuid_compare (client->engine->ports[id].client_id,
+				  client->control->uuid) == 0;
+}
+
+/* the handle of another client's port, made once per port ID and
+   kept until the client closes, as jack_port_by_id() promises. Our
+   own ports are on client->ports. Call with the mirror locked.
+ */
+static void
+jack_graph_mirror_port (jack_client_t *client, jack_port_id_t id)
+{
+	jack_graph_mirror_t *mirror = client->mirror;
+	jack_port_t *port = mirror->ports[id];
+
+	if (jack_port_id_is_mine (client, id)) {
+		return;
+	}
+
+	if (port == NULL) {
+		mirror->ports[id] = jack_port_new (client, id, client->engine);
+	} else {
+		/* the ID may have been reused for another type */
+		port->type_info =
+			&client->engine->port_types[port->shared->ptype_id];
+	}
+}
+
+static void
+jack_graph_mirror_link (jack_graph_mirror_t *mirror,
+			jack_port_id_t a, jack_port_id_t b)
+{
+	jack_mirror_peers_t *peers = &mirror->peers[a];
+	jack_port_id_t *ids;
+	uint32_t i;
+
+	for (i = 0; i < peers->n; i++) {
+		if (peers->ids[i] == b) {
+			return;
+		}
+	}
+
+	if (peers->n == peers->size) {
+		uint32_t size = peers->size ? peers->size * 2 : 4;
+		ids = (jack_port_id_t*)realloc (peers->ids,
+						sizeof(jack_port_id_t) * size);
+		if (ids == NULL) {
+			jack_error ("cannot grow connection list of port %u",
+				    (unsigned int)a);
+			return;
+		}
+		peers->ids = ids;
+		peers->size = size;
+	}
+
+	peers->ids[peers->n++] = b;
+}
+
+static void
+jack_graph_mirror_unlink (jack_graph_mirror_t *mirror,
+			  jack_port_id_t a, jack_port_id_t b)
+{
+	jack_mirror_peers_t *peers = &mirror->peers[a];
+	uint32_t i;
+
+	for (i = 0; i < peers->n; i++) {
+		if (peers->ids[i] == b) {
+			peers->ids[i] = peers->ids[--peers->n];
+			return;
+		}
+	}
+}
+
+/* (Re)build the mirror from shared memory. Events that arrive while
+   this runs wait for the lock and are applied on top, which they can
+   be in any order.
+ */
+void
+jack_graph_mirror_sync (jack_client_t *client)
+{
+	jack_graph_mirror_t *mirror = client->mirror;
+	jack_control_t *control = client->engine;
+	jack_port_id_t ids[64];
+	uint32_t i, limit;
+	int n, k;
+
+	if (mirror == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock (&mirror->lock);
+
+	for (i = 0; i < mirror->port_max; i++) {
+		mirror->peers[i].n = 0;
+	}
+
+	limit = __atomic_load_n (&control->port_high, __ATOMIC_ACQUIRE);
+
+	for (i = jack_port_next_in_use (control, 0, limit); i < limit;
+	     i = jack_port_next_in_use (control, i + 1, limit)) {
+		jack_graph_mirror_port (client, i);
+		n = jack_port_get_connection_ids (client, i, ids, 64);
+		if (n > 64) {
+			jack_port_id_t *all = (jack_port_id_t*)
+				malloc (sizeof(jack_port_id_t) * n);
+			if (all == NULL) {
+				continue;
+			}
+			n = jack_port_get_connection_ids (client, i, all, n);
+			for (k = 0; k < n; k++) {
+				jack_graph_mirror_link (mirror, i, all[k]);
+			}
+			free (all);
+			continue;
+		}
+		for (k = 0; k < n; k++) {
+			jack_graph_mirror_link (mirror, i, ids[k]);
+		}
+	}
+
+	pthread_mutex_unlock (&mirror->lock);
+}
+
+void
+jack_graph_mirror_event (jack_client_t *client, const jack_event_t *event)
+{
+	jack_graph_mirror_t *mirror = client->mirror;
+	jack_mirror_peers_t *peers;
+	jack_port_id_t a, b;
+
+	if (mirror == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock (&mirror->lock);
+
+	switch (event->type) {
+	case PortRegistered:
+		if (event->x.port_id < mirror->port_max) {
+			jack_graph_mirror_port (client, event->x.port_id);
+		}
+		break;
+
+	case PortUnregistered:
+		a = event->x.port_id;
+		if (a >= mirror->port_max) {
+			break;
+		}
+		peers = &mirror->peers[a];
+		while (peers->n) {
+			b = peers->ids[--peers->n];
+			jack_graph_mirror_unlink (mirror, b, a);
+		}
+		break;
+
+	case PortConnected:
+	case PortDisconnected:
+		a = event->x.self_id;
+		b = event->y.other_id;
+		if (a >= mirror->port_max || b >= mirror->port_max) {
+			break;
+		}
+		if (event->type == PortConnected) {
+			jack_graph_mirror_link (mirror, a, b);
+			jack_graph_mirror_link (mirror, b, a);
+		} else {
+			jack_graph_mirror_unlink (mirror, a, b);
+			jack_graph_mirror_unlink (mirror, b, a);
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	pthread_mutex_unlock (&mirror->lock);
+}
+
+static const char **
+jack_graph_mirror_connections (jack_client_t *client, jack_port_id_t id)
+{
+	jack_graph_mirror_t *mirror = client->mirror;
+	jack_mirror_peers_t *peers = &mirror->peers[id];
+	const char **ret = NULL;
+	uint32_t i;
+
+	pthread_mutex_lock (&mirror->lock);
+
+	if (peers->n &&
+	    (ret = (const char**)malloc (sizeof(char*) * (peers->n + 1))) != NULL) {
+		for (i = 0; i < peers->n; i++) {
+			ret[i] = client->engine->ports[peers->ids[i]].name;
+		}
+		ret[i] = NULL;
+	}
+
+	pthread_mutex_unlock (&mirror->lock);
+	return ret;
+}
+
 /* SERVER-SIDE (all) connection querying */
 
 const char **
@@ -386,6 +1157,8 @@ jack_port_get_all_connections (const jack_client_t *client,
 	const char **ret;
 	jack_request_t req;
 	jack_port_t *tmp;
+	jack_port_id_t *ids;
+	struct iovec iov;
 	unsigned int i;
 	int need_free = FALSE;
 
@@ -393,6 +1166,11 @@ jack_port_get_all_connections (const jack_client_t *client,
 		return NULL;
 	}
 
+	if (client->mirror && port->shared->id < client->mirror->port_max) {
+		return jack_graph_mirror_connections ((jack_client_t*)client,
+						      port->shared->id);
+	}
+
 	VALGRIND_MEMSET (&req, 0, sizeof(req));
 
 	req.type = GetPortConnections;
@@ -419,15 +1197,25 @@ jack_port_get_all_connections (const jack_client_t *client,
 		return NULL;
 	}
 
-	for (i = 0; i < req.x.port_connections.nports; ++i ) {
-		jack_port_id_t port_id;
+	/* the server sends the ids of all the connected ports at once */
 
-		if (read (client->request_fd, &port_id, sizeof(port_id))
-		    != sizeof(port_id)) {
-			jack_error ("cannot read port id from server");
-			return 0;
-		}
-		tmp = jack_port_by_id_int (client, port_id, &need_free);
+	if ((ids = (jack_port_id_t*)malloc (sizeof(jack_port_id_t) * req.x.port_connections.nports)) == NULL) {
+		free (ret);
+		return NULL;
+	}
+
+	iov.iov_base = ids;
+	iov.iov_len = sizeof(jack_port_id_t) * req.x.port_connections.nports;
+
+	if (jack_request_readv (client->request_fd, &iov, 1) != 1) {
+		jack_error ("cannot read port ids from server");
+		free (ids);
+		free (ret);
+		return NULL;
+	}
+
+	for (i = 0; i < req.x.port_connections.nports; ++i ) {
+		tmp = jack_port_by_id_int (client, ids[i], &need_free);
 		ret[i] = tmp->shared->name;
 		if (need_free) {
 			free (tmp);
@@ -436,6 +1224,7 @@ jack_port_get_all_connections (const jack_client_t *client,
 	}
 
 	ret[i] = NULL;
+	free (ids);
 
 	return ret;
 }
@@ -471,6 +1260,16 @@ jack_port_by_id (jack_client_t *client, jack_port_id_t id)
 	jack_port_t* port;
 	int need_free = FALSE;
 
+	if (client->mirror && id < client->mirror->port_max &&
+	    client->engine->ports[id].in_use && !jack_port_id_is_mine (client, id)) {
+		pthread_mutex_lock (&client->mirror->lock);
+		port = client->mirror->ports[id];
+		pthread_mutex_unlock (&client->mirror->lock);
+		if (port) {
+			return port;
+		}
+	}
+
 	for (node = client->ports_ext; node; node = jack_slist_next (node)) {
 		port = node->data;
 		if (port->shared->id == id) { // Found port, return the cached structure
@@ -498,13 +1297,23 @@ jack_port_by_name_int (jack_client_t *client, const char *port_name, int* free)
 		}
 	}
 
-	unsigned long i, limit;
+	uint32_t i, limit;
 	jack_port_shared_t *port;
+	jack_port_id_t id;
+
+	if ((id = jack_port_hash_lookup (client->engine, port_name))
+	    != (jack_port_id_t)-1) {
+		*free = TRUE;
+		return jack_port_new (client, id, client->engine);
+	}
 
-	limit = client->engine->port_max;
+	/* not indexed: an alias, or a name we know nothing about */
+
+	limit = __atomic_load_n (&client->engine->port_high, __ATOMIC_ACQUIRE);
 	port = &client->engine->ports[0];
 
-	for (i = 0; i < limit; i++) {
+	for (i = jack_port_next_in_use (client->engine, 0, limit); i < limit;
+	     i = jack_port_next_in_use (client->engine, i + 1, limit)) {
 		if (port[i].in_use && jack_port_name_equals (&port[i], port_name)) {
 			*free = TRUE;
 			return jack_port_new (client, port[i].id,
@@ -521,6 +1330,18 @@ jack_port_by_name (jack_client_t *client,  const char *port_name)
 	JSList *node;
 	jack_port_t* port;
 	int need_free = FALSE;
+	jack_port_id_t id;
+
+	if (client->mirror &&
+	    (id = jack_port_hash_lookup (client->engine, port_name))
+	    != (jack_port_id_t)-1 && !jack_port_id_is_mine (client, id)) {
+		pthread_mutex_lock (&client->mirror->lock);
+		port = client->mirror->ports[id];
+		pthread_mutex_unlock (&client->mirror->lock);
+		if (port) {
+			return port;
+		}
+	}
 
 	for (node = client->ports_ext; node; node = jack_slist_next (node)) {
 		port = node->data;
@@ -570,17 +1391,106 @@ jack_port_set_latency (jack_port_t *port, jack_nframes_t nframes)
 	}
 }
 
+/* The sum of a port that the engine put in a summing node with others
+ * fed by the same outputs, see jack_plan_sums().  The first of them to
+ * get here in a cycle mixes into the node's buffer; the rest just read
+ * it.  NULL if another reader is still mixing it, the caller then
+ * mixes for itself.
+ */
+static void *
+jack_port_shared_sum (jack_port_t *port, jack_nframes_t nframes)
+{
+	jack_control_t *engine = (jack_control_t*)port->engine;
+	jack_port_shared_t *lead = &engine->ports[port->shared->sum_port];
+	uint32_t seq = *port->cycle;
+	uint32_t claimed;
+	void *own;
+	char *sum;
+
+	if (lead->sum_offset == 0) {
+		return NULL;
+	}
+	sum = (char*)*port->client_segment_base + lead->sum_offset;
+
+	if (lead->sum_ready == seq) {
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+		return sum;
+	}
+
+	claimed = lead->sum_claimed;
+	if (claimed == seq ||
+	    !__atomic_compare_exchange_n (&lead->sum_claimed, &claimed, seq, 0,
+					  __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+		return NULL;
+	}
+
+	JACK_PROBE3 (mixdown, port->shared->id, port->shared->client_id, nframes);
+	own = port->mix_buffer;
+	port->mix_buffer = sum;
+	port->fptr.mixdown (port, nframes);
+	port->mix_buffer = own;
+	__atomic_store_n (&lead->sum_ready, seq, __ATOMIC_RELEASE);
+
+	return sum;
+}
+
+/* A port resolves to the same buffer all through a cycle, as nothing
+ * it depends on changes during one, so only the first call of a cycle
+ * follows ties and connections and mixes; the rest of them return
+ * what it did.  The engine's cycle_seq tells the cycles apart.  The
+ * cycle is stored last, so that another thread of the client asking
+ * for the same port meanwhile resolves it for itself.
+ */
+static inline void *
+jack_port_cached_buffer (jack_port_t *port, jack_nframes_t nframes)
+{
+	if (__atomic_load_n (&port->cached_cycle, __ATOMIC_ACQUIRE) == *port->cycle
+	    && port->cached_buffer
+	    && port->cached_nframes == nframes
+	    && port->cached_base == *port->client_segment_base) {
+		return port->cached_buffer;
+	}
+	return NULL;
+}
+
 void *
 jack_port_get_buffer (jack_port_t *port, jack_nframes_t nframes)
+{
+	uint32_t cycle;
+	void *buf;
+
+	if (port->domain_buffer) {
+		return port->domain_buffer;
+	}
+
+	cycle = *port->cycle;
+	if ((buf = jack_port_cached_buffer (port, nframes)) != NULL) {
+		return buf;
+	}
+
+	buf = jack_port_get_graph_buffer (port, nframes);
+
+	if (buf && port->client_segment_base) {
+		port->cached_buffer = buf;
+		port->cached_base = *port->client_segment_base;
+		port->cached_nframes = nframes;
+		__atomic_store_n (&port->cached_cycle, cycle, __ATOMIC_RELEASE);
+	}
+	return buf;
+}
+
+void *
+jack_port_get_graph_buffer (jack_port_t *port, jack_nframes_t nframes)
 {
 	JSList *node, *next;
+	void *sum;
 
 	/* Output port.  The buffer was assigned by the engine
 	   when the port was registered.
 	 */
 	if (port->shared->flags & JackPortIsOutput) {
 		if (port->tied) {
-			return jack_port_get_buffer (port->tied, nframes);
+			return jack_port_get_graph_buffer (port->tied, nframes);
 		}
 
 		if (port->client_segment_base == NULL || *port->client_segment_base == MAP_FAILED) {
@@ -605,28 +1515,171 @@ jack_port_get_buffer (jack_port_t *port, jack_nframes_t nframes)
 		return (void*)(*(port->client_segment_base) + port->type_info->zero_buffer_offset);
 	}
 
-	if ((next = jack_slist_next (node)) == NULL) {
+	if ((next = jack_slist_next (node)) == NULL && !port->gained) {
 
 		/* one connection: use zero-copy mode - just pass
 		   the buffer of the connected (output) port.
 		 */
-		return jack_port_get_buffer (((jack_port_t*)node->data),
-					     nframes);
+		jack_port_t *source = (jack_port_t*)node->data;
+
+		if (jack_output_port_silent (source) ||
+		    jack_output_port_delayed (source) ||
+		    jack_output_port_forwarded (source)) {
+			return jack_output_port_source (source);
+		}
+		return jack_port_get_graph_buffer (source, nframes);
 	}
 
-	/* Multiple connections.  Use a local buffer and mix the
-	   incoming data into that buffer.  We have already
-	   established the existence of a mixdown function during the
-	   connection process.
+	/* Multiple connections, or gains to apply.  Use a local
+	   buffer and mix the incoming data into that buffer.  We have
+	   already established the existence of a mixdown function
+	   during the connection process.
 	 */
 	if (port->mix_buffer == NULL) {
 		jack_error ( "internal jack error: mix_buffer not allocated" );
 		return NULL;
 	}
+
+	/* the gain mixdown runs even for silence, to finish its ramps */
+	if (port->gained) {
+		JACK_PROBE3 (mixdown, port->shared->id, port->shared->client_id, nframes);
+		port->fptr.mixdown (port, nframes);
+		return (void*)port->mix_buffer;
+	}
+
+	/* nothing to mix if every input is silent */
+	for (; node; node = jack_slist_next (node)) {
+		if (!jack_output_port_silent ((jack_port_t*)node->data)) {
+			break;
+		}
+	}
+	if (node == NULL) {
+		return (void*)(*(port->client_segment_base) + port->type_info->zero_buffer_offset);
+	}
+
+	if (port->shared->sum_port != JACK_NO_SUM &&
+	    (sum = jack_port_shared_sum (port, nframes)) != NULL) {
+		return sum;
+	}
+
+	JACK_PROBE3 (mixdown, port->shared->id, port->shared->client_id, nframes);
 	port->fptr.mixdown (port, nframes);
 	return (void*)port->mix_buffer;
 }
 
+/* Two passes: the first hands out what is cached or needs no mixing,
+ * the second does the mixdowns of all the rest back to back.
+ */
+int
+jack_port_get_buffers (jack_port_t * const *ports, void **buffers,
+		       unsigned int nports, jack_nframes_t nframes)
+{
+	jack_port_t *port;
+	unsigned int i, mixes = 0;
+	int ret = 0;
+
+	for (i = 0; i < nports; i++) {
+		port = ports[i];
+
+		if (port->domain_buffer) {
+			buffers[i] = port->domain_buffer;
+		} else if ((buffers[i] = jack_port_cached_buffer (port, nframes))) {
+			/* resolved earlier in this cycle */
+		} else if (!(port->shared->flags & JackPortIsOutput)
+			   && port->connections
+			   && (jack_slist_next (port->connections) || port->gained)) {
+			mixes++;
+		} else {
+			buffers[i] = jack_port_get_buffer (port, nframes);
+			ret |= (buffers[i] == NULL);
+		}
+	}
+
+	for (i = 0; mixes && i < nports; i++) {
+		if (buffers[i] == NULL
+		    && !(ports[i]->shared->flags & JackPortIsOutput)) {
+			buffers[i] = jack_port_get_buffer (ports[i], nframes);
+			ret |= (buffers[i] == NULL);
+		}
+	}
+
+	return ret ? -1 : 0;
+}
+
+void
+jack_port_mark_silent (jack_port_t *port)
+{
+	if (port->shared->flags & JackPortIsOutput) {
+		port->shared->silent_cycle = *port->cycle;
+	}
+}
+
+int
+jack_port_forward (jack_port_t *output, jack_port_t *input)
+{
+	jack_nframes_t nframes = ((jack_control_t*)output->engine)->buffer_size;
+	JSList *node;
+	jack_port_t *source;
+	void *buf;
+
+	if (!(output->shared->flags & JackPortIsOutput)
+	    || !(input->shared->flags & JackPortIsInput)
+	    || jack_uuid_compare (output->shared->client_id, input->shared->client_id) != 0
+	    || output->shared->ptype_id != input->shared->ptype_id) {
+		jack_error ("cannot forward \"%s\" to \"%s\"",
+			    input->shared->name, output->shared->name);
+		return -1;
+	}
+
+	/* see jack_port_get_buffer() about the connection lock */
+	if ((node = input->connections) == NULL) {
+		jack_port_mark_silent (output);
+		return 0;
+	}
+
+	if (jack_slist_next (node) == NULL && !input->gained) {
+		source = (jack_port_t*)node->data;
+		if (source->tied == NULL) {
+			if (jack_output_port_silent (source)) {
+				jack_port_mark_silent (output);
+			} else {
+				output->shared->forward_offset =
+					jack_output_port_source_offset (source);
+				__sync_synchronize ();
+				output->shared->forward_cycle = *output->cycle;
+			}
+			return 0;
+		}
+	}
+
+	/* a mix, or a tie, only this client can see */
+	if ((buf = jack_port_get_buffer (input, nframes)) == NULL) {
+		return -1;
+	}
+	memcpy (jack_output_port_buffer (output), buf,
+		jack_port_type_buffer_size (output->type_info, nframes));
+	return 0;
+}
+
+int
+jack_port_is_silent (jack_port_t *port)
+{
+	JSList *node;
+
+	if (port->shared->flags & JackPortIsOutput) {
+		return jack_output_port_silent (port);
+	}
+
+	/* see jack_port_get_buffer() about the connection lock */
+	for (node = port->connections; node; node = jack_slist_next (node)) {
+		if (!jack_output_port_silent ((jack_port_t*)node->data)) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
 size_t
 jack_port_type_buffer_size (jack_port_type_info_t* port_type_info, jack_nframes_t nframes)
 {
@@ -639,6 +1692,13 @@ jack_port_type_buffer_size (jack_port_type_info_t* port_type_info, jack_nframes_
 	       * nframes;
 }
 
+void
+jack_port_meter_buffer (const float *buf, jack_nframes_t nframes,
+			float *peak, float *sumsq)
+{
+	opt_meter (buf, nframes, peak, sumsq);
+}
+
 int
 jack_port_tie (jack_port_t *src, jack_port_t *dst)
 
@@ -654,6 +1714,7 @@ jack_port_tie (jack_port_t *src, jack_port_t *dst)
 	}
 
 	dst->tied = src;
+	jack_port_buffer_invalidate (dst);
 	return 0;
 }
 
@@ -665,6 +1726,7 @@ jack_port_untie (jack_port_t *port)
 		return -1;
 	}
 	port->tied = NULL;
+	jack_port_buffer_invalidate (port);
 	return 0;
 }
 
@@ -712,14 +1774,18 @@ jack_port_request_monitor_by_name (jack_client_t *client,
 
 {
 	jack_port_t *port;
-	unsigned long i, limit;
+	uint32_t i, limit, hash;
+	uint32_t *hashes;
 	jack_port_shared_t *ports;
 
-	limit = client->engine->port_max;
+	limit = __atomic_load_n (&client->engine->port_high, __ATOMIC_ACQUIRE);
 	ports = &client->engine->ports[0];
+	hashes = jack_port_hash_column (client->engine);
+	hash = jack_port_name_hash (port_name);
 
-	for (i = 0; i < limit; i++) {
-		if (ports[i].in_use &&
+	for (i = jack_port_next_in_use (client->engine, 0, limit); i < limit;
+	     i = jack_port_next_in_use (client->engine, i + 1, limit)) {
+		if (hashes[i] == hash && ports[i].in_use &&
 		    strcmp (ports[i].name, port_name) == 0) {
 			port = jack_port_new (client, ports[i].id,
 					      client->engine);
@@ -930,21 +1996,24 @@ static inline float f_max (float x, float a)
 	return x;
 }
 
+/* inputs summed per pass over the mix buffer */
+#define JACK_MIXDOWN_BATCH 32
+
+static void jack_audio_port_mixdown_gain (jack_port_t *port, jack_nframes_t nframes);
+
 static void
 jack_audio_port_mixdown (jack_port_t *port, jack_nframes_t nframes)
 {
 	JSList *node;
 	jack_port_t *input;
-
-#ifndef ARCH_X86
-	jack_nframes_t n;
-	jack_default_audio_sample_t *dst, *src;
-#endif
+	const jack_default_audio_sample_t *src[JACK_MIXDOWN_BATCH];
 	jack_default_audio_sample_t *buffer;
+	int nsrc;
 
 	/* by the time we've called this, we've already established
 	   the existence of more than one connection to this input
-	   port and allocated a mix_buffer.
+	   port, that not all of them are silent, and allocated a
+	   mix_buffer.
 	 */
 
 	/* no need to take connection lock, since this is called
@@ -953,32 +2022,132 @@ jack_audio_port_mixdown (jack_port_t *port, jack_nframes_t nframes)
 	   during this time.
 	 */
 
-	node = port->connections;
-	input = (jack_port_t*)node->data;
+	if (port->gained) {
+		jack_audio_port_mixdown_gain (port, nframes);
+		return;
+	}
+
 	buffer = port->mix_buffer;
+	nsrc = 0;
 
-#ifndef USE_DYNSIMD
-	memcpy (buffer, jack_output_port_buffer (input),
-		sizeof(jack_default_audio_sample_t) * nframes);
-#else   /* USE_DYNSIMD */
-	opt_copy (buffer, jack_output_port_buffer (input), nframes);
-#endif /* USE_DYNSIMD */
+	for (node = port->connections; node; node = jack_slist_next (node)) {
+
+		input = (jack_port_t*)node->data;
+		if (jack_output_port_silent (input)) {
+			continue;
+		}
+		src[nsrc++] = jack_output_port_source (input);
+
+		if (nsrc == JACK_MIXDOWN_BATCH) {
+			opt_mixn (buffer, src, nsrc, nframes);
+			/* carry the sum so far into the next batch */
+			src[0] = buffer;
+			nsrc = 1;
+		}
+	}
+
+	if (nsrc > 1 || (nsrc == 1 && src[0] != buffer)) {
+		opt_mixn (buffer, src, nsrc, nframes);
+	}
+}
+
+/* jack_audio_port_mixdown() for an input with connections not at unity
+ * gain, which takes one cycle to ramp each of them to its target.
+ */
+static void
+jack_audio_port_mixdown_gain (jack_port_t *port, jack_nframes_t nframes)
+{
+	JSList *node;
+	jack_port_t *input;
+	const jack_default_audio_sample_t *src[JACK_MIXDOWN_BATCH];
+	float gain[JACK_MIXDOWN_BATCH];
+	float step[JACK_MIXDOWN_BATCH];
+	jack_default_audio_sample_t *buffer = port->mix_buffer;
+	int nsrc = 0;
+	int unity;
 
-	for (node = jack_slist_next (node); node;
-	     node = jack_slist_next (node)) {
+	for (node = port->connections; node; node = jack_slist_next (node)) {
 
 		input = (jack_port_t*)node->data;
+		unity = jack_port_gain_unity (input);
+
+		if (!jack_output_port_silent (input)
+		    && (input->gain != 0.0f || input->gain_target != 0.0f)) {
+			src[nsrc] = jack_output_port_source (input);
+			gain[nsrc] = input->gain;
+			step[nsrc] = (input->gain_target - input->gain) / nframes;
+			nsrc++;
+
+			if (nsrc == JACK_MIXDOWN_BATCH) {
+				opt_mixgain (buffer, src, gain, step, nsrc, nframes);
+				src[0] = buffer;
+				gain[0] = 1.0f;
+				step[0] = 0.0f;
+				nsrc = 1;
+			}
+		}
+
+		/* the ramp is done by the end of this cycle */
+		input->gain = input->gain_target;
+		if (!unity && jack_port_gain_unity (input)) {
+			port->gained--;
+		}
+	}
+
+	if (nsrc == 0) {
+		memset (buffer, 0, nframes * sizeof(jack_default_audio_sample_t));
+	} else if (nsrc > 1 || src[0] != buffer) {
+		opt_mixgain (buffer, src, gain, step, nsrc, nframes);
+	}
+}
+
+float
+jack_port_get_connection_gain (const jack_port_t *port,
+			       const jack_port_t *source)
+{
+	JSList *node;
+	jack_port_t *other;
+
+	for (node = port->connections; node; node = jack_slist_next (node)) {
+		other = (jack_port_t*)node->data;
+		if (other->shared->id == source->shared->id) {
+			return other->gain_target;
+		}
+	}
+	return 1.0f;
+}
+
+/* The mixdown of a type registered at run time: batched the same way,
+ * by the callback the client registered the type with.
+ */
+static void
+jack_type_port_mixdown (jack_port_t *port, jack_nframes_t nframes)
+{
+	JSList *node;
+	jack_port_t *input;
+	const void *src[JACK_MIXDOWN_BATCH];
+	size_t size = jack_port_type_buffer_size (port->type_info, nframes);
+	void *buffer = port->mix_buffer;
+	int nsrc = 0;
 
-#ifndef USE_DYNSIMD
-		n = nframes;
-		dst = buffer;
-		src = jack_output_port_buffer (input);
+	for (node = port->connections; node; node = jack_slist_next (node)) {
 
-		while (n--)
-			*dst++ += *src++;
+		input = (jack_port_t*)node->data;
+		if (jack_output_port_silent (input)) {
+			continue;
+		}
+		src[nsrc++] = jack_output_port_source (input);
+
+		if (nsrc == JACK_MIXDOWN_BATCH) {
+			port->fptr.type_mixdown (buffer, src, nsrc, size,
+						 port->fptr.type_mixdown_arg);
+			src[0] = buffer;
+			nsrc = 1;
+		}
+	}
 
-#else           /* USE_DYNSIMD */
-		opt_mix (buffer, jack_output_port_buffer (input), nframes);
-#endif /* USE_DYNSIMD */
+	if (nsrc > 1 || (nsrc == 1 && src[0] != buffer)) {
+		port->fptr.type_mixdown (buffer, src, nsrc, size,
+					 port->fptr.type_mixdown_arg);
 	}
 }
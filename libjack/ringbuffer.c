@@ -20,15 +20,21 @@
    This is safe for the case of one read thread and one write thread.
  */
 
+/* for memfd_create() */
+#define _GNU_SOURCE
+
 #include <config.h>
 
 #include <stdlib.h>
 #include <string.h>
-#ifdef USE_MLOCK
+#include <unistd.h>
 #include <sys/mman.h>
-#endif /* USE_MLOCK */
 #include <jack/ringbuffer.h>
 
+/* mlocked is 1 after jack_ringbuffer_mlock(); a mirrored buffer has
+   this bit set as well */
+#define JACK_RINGBUFFER_MIRRORED 0x2
+
 /* Create a new ringbuffer to hold at least `sz' bytes of data. The
    actual buffer size is rounded up to the next power of two.  */
 
@@ -58,17 +64,91 @@ jack_ringbuffer_create (size_t sz)
 	return rb;
 }
 
+/* Create a ringbuffer like jack_ringbuffer_create(), but with the
+   data pages mapped twice, back to back, so that buf[size + n] is
+   buf[n]. The first segment from jack_ringbuffer_get_read_vector()
+   or jack_ringbuffer_get_write_vector() then covers everything there
+   is to read or write, as one contiguous span, and the second is
+   always empty. The size is at least one page. Returns NULL if the
+   system cannot do this; callers wanting a ringbuffer anyway should
+   fall back to jack_ringbuffer_create(). */
+
+jack_ringbuffer_t *
+jack_ringbuffer_create_mirrored (size_t sz)
+{
+#if defined(HAVE_MEMFD_CREATE)
+	jack_ringbuffer_t *rb;
+	size_t size = sysconf (_SC_PAGESIZE);
+	char *addr;
+	int fd;
+
+	while (size < sz) {
+		size <<= 1;
+	}
+
+	if ((fd = memfd_create ("jack-ringbuffer", MFD_CLOEXEC)) < 0) {
+		return NULL;
+	}
+
+	if (ftruncate (fd, size)) {
+		close (fd);
+		return NULL;
+	}
+
+	/* reserve room for both views, then put the pages in it twice */
+
+	addr = mmap (NULL, 2 * size, PROT_NONE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED) {
+		close (fd);
+		return NULL;
+	}
+
+	if (mmap (addr, size, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+	    || mmap (addr + size, size, PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap (addr, 2 * size);
+		close (fd);
+		return NULL;
+	}
+
+	/* the mappings keep the pages */
+	close (fd);
+
+	if ((rb = malloc (sizeof(jack_ringbuffer_t))) == NULL) {
+		munmap (addr, 2 * size);
+		return NULL;
+	}
+
+	rb->buf = addr;
+	rb->size = size;
+	rb->size_mask = size - 1;
+	rb->write_ptr = 0;
+	rb->read_ptr = 0;
+	rb->mlocked = JACK_RINGBUFFER_MIRRORED;
+
+	return rb;
+#else
+	return NULL;
+#endif
+}
+
 /* Free all data associated with the ringbuffer `rb'. */
 
 void
 jack_ringbuffer_free (jack_ringbuffer_t * rb)
 {
 #ifdef USE_MLOCK
-	if (rb->mlocked) {
+	if (rb->mlocked & 1) {
 		munlock (rb->buf, rb->size);
 	}
 #endif  /* USE_MLOCK */
-	free (rb->buf);
+	if (rb->mlocked & JACK_RINGBUFFER_MIRRORED) {
+		munmap (rb->buf, 2 * rb->size);
+	} else {
+		free (rb->buf);
+	}
 	free (rb);
 }
 
@@ -82,7 +162,7 @@ jack_ringbuffer_mlock (jack_ringbuffer_t * rb)
 		return -1;
 	}
 #endif  /* USE_MLOCK */
-	rb->mlocked = 1;
+	rb->mlocked |= 1;
 	return 0;
 }
 
@@ -298,7 +378,7 @@ jack_ringbuffer_get_read_vector (const jack_ringbuffer_t * rb,
 
 	cnt2 = r + free_cnt;
 
-	if (cnt2 > rb->size) {
+	if (cnt2 > rb->size && !(rb->mlocked & JACK_RINGBUFFER_MIRRORED)) {
 
 		/* Two part vector: the rest of the buffer after the current write
 		   ptr, plus some from the start of the buffer. */
@@ -344,7 +424,7 @@ jack_ringbuffer_get_write_vector (const jack_ringbuffer_t * rb,
 
 	cnt2 = w + free_cnt;
 
-	if (cnt2 > rb->size) {
+	if (cnt2 > rb->size && !(rb->mlocked & JACK_RINGBUFFER_MIRRORED)) {
 
 		/* Two part vector: the rest of the buffer after the current write
 		   ptr, plus some from the start of the buffer. */
@@ -0,0 +1,361 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    Catching calls that are not realtime safe in process callbacks.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+ */
+
+/* Built with --enable-rt-check, libjack defines the allocator, mutex,
+ * sleep and plain I/O calls itself, ahead of the C library, and
+ * passes them straight on.  With JACK_RT_CHECK set in the environment,
+ * a process thread marks itself while it runs a cycle, from waking in
+ * jack_cycle_wait() to jack_cycle_signal(), which covers the process,
+ * sync and timebase callbacks and whatever they call.  A marked thread
+ * that makes one of those calls records it with a backtrace in a
+ * lock-free queue, and a thread of its own reports them through
+ * jack_error(): the whole backtrace the first time a call site is
+ * seen, and how often it was seen again after that.
+ *
+ * Nothing is changed about what the calls do, so a client that works
+ * keeps working, only more slowly.  This is for finding offenders in
+ * testing, not for production.  glibc only, for __libc_malloc() and
+ * friends, which are the allocator without going through dlsym(),
+ * which itself allocates.
+ */
+
+/* for RTLD_NEXT */
+#define _GNU_SOURCE
+
+#include <config.h>
+
+#include <dlfcn.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <jack/jack.h>
+
+#include "internal.h"
+#include "local.h"
+
+#if defined(JACK_RT_CHECK) && defined(__GLIBC__)
+
+#include <execinfo.h>
+
+#define JACK_RT_CHECK_FRAMES    16
+#define JACK_RT_CHECK_QUEUE     256
+#define JACK_RT_CHECK_SITES     256
+#define JACK_RT_CHECK_INTERVAL  250000  /* usecs between reports */
+
+typedef struct {
+	const char *call;
+	char client[JACK_CLIENT_NAME_SIZE];
+	int nframes;
+	void *frames[JACK_RT_CHECK_FRAMES];
+} jack_rt_violation_t;
+
+typedef struct {
+	uint32_t hash;                  /* 0 if unused */
+	const char *call;
+	char client[JACK_CLIENT_NAME_SIZE];
+	uint32_t count;
+	uint32_t reported;
+} jack_rt_site_t;
+
+static int rt_check_enabled;
+static pthread_once_t rt_check_once = PTHREAD_ONCE_INIT;
+static jack_mpmc_queue_t *rt_check_queue;
+static uint32_t rt_check_dropped;
+static jack_rt_site_t rt_check_sites[JACK_RT_CHECK_SITES];
+
+/* set while this thread runs a cycle, and while it records a call */
+static __thread jack_client_t *rt_check_client;
+static __thread int rt_check_busy;
+
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void  __libc_free(void *);
+
+static int (*real_pthread_mutex_lock)(pthread_mutex_t *);
+static int (*real_pthread_cond_wait)(pthread_cond_t *, pthread_mutex_t *);
+static ssize_t (*real_read)(int, void *, size_t);
+static ssize_t (*real_write)(int, const void *, size_t);
+static int (*real_usleep)(useconds_t);
+static int (*real_nanosleep)(const struct timespec *, struct timespec *);
+
+/* anything may call these before jack_rt_check_init() */
+#define JACK_RT_CHECK_RESOLVE(name) \
+	if (real_##name == NULL) { \
+		real_##name = (__typeof__(real_##name))dlsym (RTLD_NEXT, #name); \
+	}
+
+/* not inlined, so that the backtrace starts here, then the call */
+static void __attribute__((noinline))
+jack_rt_check_record (const char *call)
+{
+	jack_rt_violation_t v;
+
+	rt_check_busy = 1;
+
+	v.call = call;
+	snprintf (v.client, sizeof(v.client), "%s", rt_check_client->name);
+	v.nframes = backtrace (v.frames, JACK_RT_CHECK_FRAMES);
+
+	if (jack_mpmc_queue_push (rt_check_queue, &v)) {
+		__atomic_add_fetch (&rt_check_dropped, 1, __ATOMIC_RELAXED);
+	}
+
+	rt_check_busy = 0;
+}
+
+#define JACK_RT_CHECK_CALL(name) \
+	if (rt_check_client && !rt_check_busy) { \
+		jack_rt_check_record (name); \
+	}
+
+void *
+malloc (size_t size)
+{
+	JACK_RT_CHECK_CALL ("malloc");
+	return __libc_malloc (size);
+}
+
+void *
+calloc (size_t nmemb, size_t size)
+{
+	JACK_RT_CHECK_CALL ("calloc");
+	return __libc_calloc (nmemb, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+	JACK_RT_CHECK_CALL ("realloc");
+	return __libc_realloc (ptr, size);
+}
+
+void
+free (void *ptr)
+{
+	if (ptr) {
+		JACK_RT_CHECK_CALL ("free");
+	}
+	__libc_free (ptr);
+}
+
+int
+pthread_mutex_lock (pthread_mutex_t *mutex)
+{
+	JACK_RT_CHECK_CALL ("pthread_mutex_lock");
+	JACK_RT_CHECK_RESOLVE (pthread_mutex_lock);
+	return real_pthread_mutex_lock (mutex);
+}
+
+int
+pthread_cond_wait (pthread_cond_t *cond, pthread_mutex_t *mutex)
+{
+	JACK_RT_CHECK_CALL ("pthread_cond_wait");
+	JACK_RT_CHECK_RESOLVE (pthread_cond_wait);
+	return real_pthread_cond_wait (cond, mutex);
+}
+
+ssize_t
+read (int fd, void *buf, size_t count)
+{
+	JACK_RT_CHECK_CALL ("read");
+	JACK_RT_CHECK_RESOLVE (read);
+	return real_read (fd, buf, count);
+}
+
+ssize_t
+write (int fd, const void *buf, size_t count)
+{
+	JACK_RT_CHECK_CALL ("write");
+	JACK_RT_CHECK_RESOLVE (write);
+	return real_write (fd, buf, count);
+}
+
+int
+usleep (useconds_t usec)
+{
+	JACK_RT_CHECK_CALL ("usleep");
+	JACK_RT_CHECK_RESOLVE (usleep);
+	return real_usleep (usec);
+}
+
+int
+nanosleep (const struct timespec *req, struct timespec *rem)
+{
+	JACK_RT_CHECK_CALL ("nanosleep");
+	JACK_RT_CHECK_RESOLVE (nanosleep);
+	return real_nanosleep (req, rem);
+}
+
+static jack_rt_site_t *
+jack_rt_check_site (const jack_rt_violation_t *v, int *is_new)
+{
+	uint32_t hash = 2166136261u;
+	uintptr_t word;
+	unsigned int i, n;
+	int f;
+
+	/* FNV-1a over the call and the return addresses */
+	for (f = -1; f < v->nframes; ++f) {
+		word = f < 0 ? (uintptr_t)v->call : (uintptr_t)v->frames[f];
+		for (i = 0; i < sizeof(word); ++i) {
+			hash = (hash ^ ((word >> (i * 8)) & 0xff)) * 16777619u;
+		}
+	}
+	if (hash == 0) {
+		hash = 1;
+	}
+
+	for (n = 0, i = hash % JACK_RT_CHECK_SITES; n < JACK_RT_CHECK_SITES;
+	     ++n, i = (i + 1) % JACK_RT_CHECK_SITES) {
+		jack_rt_site_t *site = &rt_check_sites[i];
+		if (site->hash == hash) {
+			*is_new = 0;
+			return site;
+		}
+		if (site->hash == 0) {
+			site->hash = hash;
+			site->call = v->call;
+			memcpy (site->client, v->client, sizeof(site->client));
+			*is_new = 1;
+			return site;
+		}
+	}
+
+	/* full: report everything as new */
+	*is_new = 1;
+	return NULL;
+}
+
+static void *
+jack_rt_check_reporter (void *arg)
+{
+	jack_rt_violation_t v;
+	jack_rt_site_t *site;
+	char **symbols;
+	uint32_t dropped;
+	int is_new, i;
+
+	while (1) {
+		while (jack_mpmc_queue_pop_single (rt_check_queue, &v) == 0) {
+
+			site = jack_rt_check_site (&v, &is_new);
+			if (site) {
+				site->count++;
+			}
+			if (!is_new) {
+				continue;
+			}
+			if (site) {
+				site->reported = site->count;
+			}
+
+			jack_error ("rt-check: %s called from the process thread of %s",
+				    v.call, v.client);
+			if ((symbols = backtrace_symbols (v.frames, v.nframes))) {
+				for (i = 2; i < v.nframes; ++i) {
+					jack_error ("rt-check:     %s", symbols[i]);
+				}
+				free (symbols);
+			}
+		}
+
+		for (i = 0; i < JACK_RT_CHECK_SITES; ++i) {
+			site = &rt_check_sites[i];
+			if (site->hash && site->count != site->reported) {
+				jack_error ("rt-check: %s from the process thread of %s"
+					    " %" PRIu32 " more times",
+					    site->call, site->client,
+					    site->count - site->reported);
+				site->reported = site->count;
+			}
+		}
+
+		if ((dropped = __atomic_exchange_n (&rt_check_dropped, 0,
+						    __ATOMIC_RELAXED))) {
+			jack_error ("rt-check: %" PRIu32 " calls not recorded,"
+				    " the queue was full", dropped);
+		}
+
+		usleep (JACK_RT_CHECK_INTERVAL);
+	}
+
+	return NULL;
+}
+
+static void
+jack_rt_check_setup (void)
+{
+	const char *env = getenv ("JACK_RT_CHECK");
+	void *frame;
+	pthread_t reporter;
+
+	if (env == NULL || *env == '\0' || strcmp (env, "0") == 0) {
+		return;
+	}
+
+	/* the first backtrace() loads the unwinder, which allocates */
+	backtrace (&frame, 1);
+
+	if ((rt_check_queue = jack_mpmc_queue_create
+		     (sizeof(jack_rt_violation_t), JACK_RT_CHECK_QUEUE)) == NULL) {
+		jack_error ("rt-check: cannot allocate the queue");
+		return;
+	}
+	jack_mpmc_queue_mlock (rt_check_queue);
+
+	if (pthread_create (&reporter, NULL, jack_rt_check_reporter, NULL)) {
+		jack_error ("rt-check: cannot start the reporting thread");
+		return;
+	}
+	pthread_detach (reporter);
+
+	jack_info ("rt-check: reporting calls that are not realtime safe"
+		   " from process threads");
+	rt_check_enabled = 1;
+}
+
+void
+jack_rt_check_init (void)
+{
+	pthread_once (&rt_check_once, jack_rt_check_setup);
+}
+
+void
+jack_rt_check_enter (jack_client_t *client)
+{
+	if (rt_check_enabled) {
+		rt_check_client = client;
+	}
+}
+
+void
+jack_rt_check_leave (jack_client_t *client)
+{
+	rt_check_client = NULL;
+}
+
+#endif /* JACK_RT_CHECK && __GLIBC__ */
@@ -34,6 +34,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <signal.h>
 #include <limits.h>
@@ -46,6 +47,9 @@
 #include <sys/shm.h>
 #include <sys/sem.h>
 #include <sysdeps/ipc.h>
+#ifdef USE_ROBUST_SHM_LOCK
+#include <pthread.h>
+#endif
 
 #include "shm.h"
 #include "internal.h"
@@ -61,6 +65,9 @@ static jack_shmtype_t jack_shmtype = shm_SYSV;
 static int      jack_access_registry(jack_shm_info_t *ri);
 static int      jack_create_registry(jack_shm_info_t *ri);
 static void     jack_remove_shm(jack_shm_id_t *id);
+static int      jack_shmalloc_segment(jack_shmsize_t size, jack_shm_info_t *si);
+static int      jack_attach_segment(jack_shm_info_t *si);
+static void     jack_release_segment(jack_shm_info_t *si);
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
 * common interface-independent section
@@ -85,6 +92,31 @@ static jack_shm_header_t   *jack_shm_header = NULL;
 static jack_shm_registry_t *jack_shm_registry = NULL;
 static char jack_shm_server_prefix[JACK_SERVER_NAME_SIZE] = "";
 
+/* Small segments.
+ *
+ * A server creates lots of small segments, like a control block for
+ * every client that comes and goes.  Rather than a shm object each,
+ * they get blocks of one pool segment: their registry entry names the
+ * pool as its parent and where in it they are.  Only the server that
+ * made a pool allocates from it, so the map of used blocks is private
+ * to that process.  Every process maps a pool on the first attach of
+ * a segment in it, and keeps it mapped.
+ */
+#define JACK_SHM_POOL_BLOCKS (JACK_SHM_POOL_SIZE / JACK_SHM_POOL_BLOCK)
+
+static int shm_pool_enabled = 0;
+static jack_shm_registry_index_t shm_pool_index = JACK_SHM_NULL_INDEX;
+static uint32_t shm_pool_used[JACK_SHM_POOL_BLOCKS / 32];
+
+/* pools mapped by this process, free if allocator is 0 */
+static struct {
+	jack_shm_info_t info;
+	pid_t allocator;
+} shm_pool_maps[MAX_SERVERS];
+
+static void jack_shm_pool_free(jack_shm_registry_index_t index);
+static void jack_shm_pool_forget(jack_shm_registry_index_t index);
+
 /* jack_shm_lock_registry() serializes updates to the shared memory
  * segment JACK uses to keep track of the SHM segements allocated to
  * all its processes, including multiple servers.
@@ -98,6 +130,13 @@ static char jack_shm_server_prefix[JACK_SERVER_NAME_SIZE] = "";
  * if the owning process terminates abnormally.  Otherwise, a segfault
  * or kill -9 at the wrong moment could prevent JACK from ever running
  * again on that machine until after a reboot.
+ *
+ * With USE_ROBUST_SHM_LOCK, the lock is a robust, process-shared
+ * mutex in the registry header.  Taking it uncontended is a single
+ * atomic operation, and if its owner dies, the next process to take
+ * it is told so and carries on.  A System V semaphore still guards
+ * finding, creating and validating the registry, because the mutex
+ * cannot be used before the registry is there.
  */
 
 #ifndef USE_POSIX_SHM
@@ -161,9 +200,70 @@ semaphore_add (int value)
 	}
 }
 
+#ifdef USE_ROBUST_SHM_LOCK
+#define JACK_SHM_LOCK_LEN sizeof(pthread_mutex_t)
+
+/* the mutex has to fit the lock area of the registry header */
+typedef char jack_shm_lock_fits[(sizeof(pthread_mutex_t) <= JACK_SHM_LOCK_SIZE) ? 1 : -1];
+
+/* set once this process has a valid registry to lock */
+static int registry_mutex_ready = 0;
+
+/* all mutex errors are fatal too */
+static void
+registry_mutex_error (char *msg, int rc)
+{
+	jack_error ("Fatal JACK registry lock error: %s (%s)",
+		    msg, strerror (rc));
+	abort ();
+}
+
+static inline pthread_mutex_t *
+registry_mutex (void)
+{
+	return (pthread_mutex_t*)jack_shm_header->lock;
+}
+
+static void
+registry_mutex_init (void)
+{
+	pthread_mutexattr_t attr;
+	int rc;
+
+	pthread_mutexattr_init (&attr);
+	pthread_mutexattr_setpshared (&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust (&attr, PTHREAD_MUTEX_ROBUST);
+	if ((rc = pthread_mutex_init (registry_mutex (), &attr)) != 0) {
+		registry_mutex_error ("pthread_mutex_init", rc);
+	}
+	pthread_mutexattr_destroy (&attr);
+}
+#else
+#define JACK_SHM_LOCK_LEN 0
+#endif
+
 static void
 jack_shm_lock_registry (void)
 {
+#ifdef USE_ROBUST_SHM_LOCK
+	if (registry_mutex_ready) {
+		int rc = pthread_mutex_lock (registry_mutex ());
+
+		if (rc == EOWNERDEAD) {
+			/* The owner died holding the lock.  Registry
+			 * updates are single stores, and whatever the
+			 * dead process left allocated is reclaimed by
+			 * jack_cleanup_shm(), so just carry on. */
+			jack_error ("JACK shm registry lock owner died, recovering");
+			rc = pthread_mutex_consistent (registry_mutex ());
+		}
+		if (rc != 0) {
+			registry_mutex_error ("pthread_mutex_lock", rc);
+		}
+		return;
+	}
+#endif
+
 	if (semid == -1) {
 		semaphore_init ();
 	}
@@ -174,6 +274,13 @@ jack_shm_lock_registry (void)
 static void
 jack_shm_unlock_registry (void)
 {
+#ifdef USE_ROBUST_SHM_LOCK
+	if (registry_mutex_ready) {
+		pthread_mutex_unlock (registry_mutex ());
+		return;
+	}
+#endif
+
 	semaphore_add (1);
 }
 
@@ -181,9 +288,9 @@ static void
 jack_shm_init_registry ()
 {
 	/* registry must be locked */
-	int i;
 
-	memset (jack_shm_header, 0, JACK_SHM_REGISTRY_SIZE);
+	/* the entries are set up as they come into use */
+	memset (jack_shm_header, 0, sizeof(jack_shm_header_t));
 
 	jack_shm_header->magic = JACK_SHM_MAGIC;
 	jack_shm_header->protocol = jack_protocol_version;
@@ -191,9 +298,13 @@ jack_shm_init_registry ()
 	jack_shm_header->size = JACK_SHM_REGISTRY_SIZE;
 	jack_shm_header->hdr_len = sizeof(jack_shm_header_t);
 	jack_shm_header->entry_len = sizeof(jack_shm_registry_t);
+	jack_shm_header->lock_len = JACK_SHM_LOCK_LEN;
+	jack_shm_header->free_head = JACK_SHM_NULL_INDEX;
+	jack_shm_header->high_water = 0;
 
-	for (i = 0; i < MAX_SHM_ID; ++i)
-		jack_shm_registry[i].index = i;
+#ifdef USE_ROBUST_SHM_LOCK
+	registry_mutex_init ();
+#endif
 }
 
 static int
@@ -206,7 +317,8 @@ jack_shm_validate_registry ()
 	    && (jack_shm_header->type == jack_shmtype)
 	    && (jack_shm_header->size == JACK_SHM_REGISTRY_SIZE)
 	    && (jack_shm_header->hdr_len == sizeof(jack_shm_header_t))
-	    && (jack_shm_header->entry_len == sizeof(jack_shm_registry_t))) {
+	    && (jack_shm_header->entry_len == sizeof(jack_shm_registry_t))
+	    && (jack_shm_header->lock_len == JACK_SHM_LOCK_LEN)) {
 
 		return 0;               /* registry OK */
 	}
@@ -287,6 +399,11 @@ jack_server_initialize_shm (int new_registry)
 	}
 
 	jack_shm_unlock_registry ();
+
+#ifdef USE_ROBUST_SHM_LOCK
+	/* from now on, the registry locks itself */
+	registry_mutex_ready = (rc == 0);
+#endif
 	return rc;
 }
 
@@ -318,6 +435,10 @@ jack_initialize_shm (const char *server_name)
 	}
 	jack_shm_unlock_registry ();
 
+#ifdef USE_ROBUST_SHM_LOCK
+	registry_mutex_ready = (rc == 0);
+#endif
+
 	return rc;
 }
 
@@ -329,26 +450,37 @@ jack_destroy_shm (jack_shm_info_t* si)
 		return;                 /* segment not allocated */
 
 	}
-	jack_remove_shm (&jack_shm_registry[si->index].id);
+	if (jack_shm_registry[si->index].parent == JACK_SHM_NULL_INDEX) {
+		jack_remove_shm (&jack_shm_registry[si->index].id);
+	} else {
+		jack_shm_pool_free (si->index);
+	}
 	jack_release_shm_info (si->index);
 }
 
+/* take an entry off the free list, or the first one never used; the
+ * caller either fills it in or gives it back with
+ * jack_release_shm_entry() before unlocking the registry */
 jack_shm_registry_t *
 jack_get_free_shm_info ()
 {
 	/* registry must be locked */
-	jack_shm_registry_t* si = NULL;
-	int i;
-
-	for (i = 0; i < MAX_SHM_ID; ++i) {
-		if (jack_shm_registry[i].size == 0) {
-			break;
-		}
+	jack_shm_registry_t* si;
+
+	if (jack_shm_header->free_head != JACK_SHM_NULL_INDEX) {
+		si = &jack_shm_registry[jack_shm_header->free_head];
+		jack_shm_header->free_head = si->next_free;
+	} else if (jack_shm_header->high_water < MAX_SHM_ID) {
+		si = &jack_shm_registry[jack_shm_header->high_water];
+		memset (si, 0, sizeof(jack_shm_registry_t));
+		si->index = jack_shm_header->high_water++;
+	} else {
+		return NULL;
 	}
 
-	if (i < MAX_SHM_ID) {
-		si = &jack_shm_registry[i];
-	}
+	si->next_free = JACK_SHM_NULL_INDEX;
+	si->parent = JACK_SHM_NULL_INDEX;
+	si->offset = 0;
 
 	return si;
 }
@@ -359,8 +491,12 @@ jack_release_shm_entry (jack_shm_registry_index_t index)
 	/* the registry must be locked */
 	jack_shm_registry[index].size = 0;
 	jack_shm_registry[index].allocator = 0;
+	jack_shm_registry[index].parent = JACK_SHM_NULL_INDEX;
 	memset (&jack_shm_registry[index].id, 0,
 		sizeof(jack_shm_registry[index].id));
+
+	jack_shm_registry[index].next_free = jack_shm_header->free_head;
+	jack_shm_header->free_head = index;
 }
 
 void
@@ -374,6 +510,165 @@ jack_release_shm_info (jack_shm_registry_index_t index)
 	}
 }
 
+/* the registry entry may belong to another segment by now, so
+ * this does not go through jack_release_segment() */
+static void
+jack_shm_pool_unmap (int i)
+{
+#ifdef USE_POSIX_SHM
+	munmap (shm_pool_maps[i].info.attached_at, JACK_SHM_POOL_SIZE);
+#else
+	shmdt (shm_pool_maps[i].info.attached_at);
+#endif
+	shm_pool_maps[i].allocator = 0;
+}
+
+/* map the pool at index, or find where we mapped it before */
+static char *
+jack_shm_pool_attach (jack_shm_registry_index_t index)
+{
+	pid_t allocator = jack_shm_registry[index].allocator;
+	int i, slot = -1;
+
+	for (i = 0; i < MAX_SERVERS; i++) {
+		if (shm_pool_maps[i].allocator != 0
+		    && shm_pool_maps[i].info.index == index) {
+			if (shm_pool_maps[i].allocator == allocator) {
+				return shm_pool_maps[i].info.attached_at;
+			}
+			/* the pool of a server that has gone since */
+			jack_shm_pool_unmap (i);
+		}
+		if (shm_pool_maps[i].allocator == 0 && slot < 0) {
+			slot = i;
+		}
+	}
+
+	if (slot < 0) {
+		jack_error ("too many shm pools attached");
+		return NULL;
+	}
+
+	shm_pool_maps[slot].info.index = index;
+	if (jack_attach_segment (&shm_pool_maps[slot].info)) {
+		return NULL;
+	}
+	shm_pool_maps[slot].allocator = allocator;
+
+	return shm_pool_maps[slot].info.attached_at;
+}
+
+static void
+jack_shm_pool_forget (jack_shm_registry_index_t index)
+{
+	int i;
+
+	for (i = 0; i < MAX_SERVERS; i++) {
+		if (shm_pool_maps[i].allocator != 0
+		    && shm_pool_maps[i].info.index == index) {
+			jack_shm_pool_unmap (i);
+		}
+	}
+}
+
+static int
+jack_shm_pool_contains (void *addr)
+{
+	int i;
+
+	for (i = 0; i < MAX_SERVERS; i++) {
+		char *base = shm_pool_maps[i].info.attached_at;
+
+		if (shm_pool_maps[i].allocator != 0
+		    && (char*)addr >= base && (char*)addr < base + JACK_SHM_POOL_SIZE) {
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+static int
+jack_shm_pool_alloc (jack_shmsize_t size, jack_shm_info_t* si)
+{
+	/* must NOT have the registry locked */
+	int blocks = (size + JACK_SHM_POOL_BLOCK - 1) / JACK_SHM_POOL_BLOCK;
+	jack_shm_registry_t *registry;
+	jack_shmsize_t offset;
+	char *pool;
+	int b, run, first = -1;
+
+	if (shm_pool_index == JACK_SHM_NULL_INDEX) {
+		jack_shm_info_t info;
+
+		if (jack_shmalloc_segment (JACK_SHM_POOL_SIZE, &info)) {
+			shm_pool_enabled = 0;
+			return -1;
+		}
+		shm_pool_index = info.index;
+	}
+
+	if ((pool = jack_shm_pool_attach (shm_pool_index)) == NULL) {
+		shm_pool_enabled = 0;
+		return -1;
+	}
+
+	for (b = 0, run = 0; b < JACK_SHM_POOL_BLOCKS; b++) {
+		if (shm_pool_used[b >> 5] & (1U << (b & 31))) {
+			run = 0;
+		} else if (++run == blocks) {
+			first = b - blocks + 1;
+			break;
+		}
+	}
+
+	if (first < 0) {
+		return -1;              /* full, needs a segment of its own */
+	}
+	offset = first * JACK_SHM_POOL_BLOCK;
+
+	jack_shm_lock_registry ();
+
+	if ((registry = jack_get_free_shm_info ()) == NULL) {
+		jack_shm_unlock_registry ();
+		return -1;
+	}
+
+	registry->size = size;
+	registry->parent = shm_pool_index;
+	registry->offset = offset;
+	registry->allocator = getpid ();
+	si->index = registry->index;
+	si->attached_at = MAP_FAILED;   /* not attached */
+
+	jack_shm_unlock_registry ();
+
+	for (b = first; b < first + blocks; b++)
+		shm_pool_used[b >> 5] |= 1U << (b & 31);
+
+	/* blocks get reused, but segments start out zeroed */
+	memset (pool + offset, 0, blocks * JACK_SHM_POOL_BLOCK);
+
+	return 0;
+}
+
+static void
+jack_shm_pool_free (jack_shm_registry_index_t index)
+{
+	/* must NOT have the registry locked */
+	jack_shm_registry_t *r = &jack_shm_registry[index];
+	int b, first, blocks;
+
+	if (r->allocator != getpid () || r->parent != shm_pool_index) {
+		return;
+	}
+
+	first = r->offset / JACK_SHM_POOL_BLOCK;
+	blocks = (r->size + JACK_SHM_POOL_BLOCK - 1) / JACK_SHM_POOL_BLOCK;
+	for (b = first; b < first + blocks; b++)
+		shm_pool_used[b >> 5] &= ~(1U << (b & 31));
+}
+
 /* Claim server_name for this process.
  *
  * returns 0 if successful
@@ -410,6 +705,7 @@ jack_register_server (const char *server_name, int new_registry)
 		}
 		if (jack_shm_header->server[i].pid == my_pid) {
 			jack_shm_unlock_registry ();
+			shm_pool_enabled = 1;
 			return 0;       /* it's me */
 		}
 
@@ -443,6 +739,9 @@ jack_register_server (const char *server_name, int new_registry)
 
 	jack_shm_unlock_registry ();
 
+	/* servers allocate for many clients, so they pool */
+	shm_pool_enabled = 1;
+
 	return 0;
 }
 
@@ -476,7 +775,7 @@ jack_cleanup_shm ()
 
 	jack_shm_lock_registry ();
 
-	for (i = 0; i < MAX_SHM_ID; i++) {
+	for (i = 0; i < jack_shm_header->high_water; i++) {
 		jack_shm_registry_t* r;
 
 		r = &jack_shm_registry[i];
@@ -493,7 +792,14 @@ jack_cleanup_shm ()
 
 			/* allocated by this process, so unattach
 			   and destroy. */
-			jack_release_shm (&copy);
+			if (r->parent == JACK_SHM_NULL_INDEX) {
+				jack_release_shm (&copy);
+			}
+			if (i == shm_pool_index) {
+				jack_shm_pool_forget (i);
+				shm_pool_index = JACK_SHM_NULL_INDEX;
+				memset (shm_pool_used, 0, sizeof(shm_pool_used));
+			}
 			destroy = TRUE;
 
 		} else {
@@ -513,7 +819,9 @@ jack_cleanup_shm ()
 			int index = copy.index;
 
 			if ((index >= 0)  && (index < MAX_SHM_ID)) {
-				jack_remove_shm (&jack_shm_registry[index].id);
+				if (r->parent == JACK_SHM_NULL_INDEX) {
+					jack_remove_shm (&jack_shm_registry[index].id);
+				}
 				jack_release_shm_entry (index);
 			}
 			r->size = 0;
@@ -521,11 +829,70 @@ jack_cleanup_shm ()
 		}
 	}
 
+	/* rebuild the free list, in case a process died while
+	 * changing it */
+	jack_shm_header->free_head = JACK_SHM_NULL_INDEX;
+	for (i = jack_shm_header->high_water - 1; i >= 0; i--) {
+		if (jack_shm_registry[i].allocator == 0) {
+			jack_shm_registry[i].next_free = jack_shm_header->free_head;
+			jack_shm_header->free_head = i;
+		}
+	}
+
 	jack_shm_unlock_registry ();
 
 	return TRUE;
 }
 
+int
+jack_shmalloc (jack_shmsize_t size, jack_shm_info_t* si)
+{
+	if (shm_pool_enabled && size <= JACK_SHM_POOL_MAX
+	    && jack_shm_pool_alloc (size, si) == 0) {
+		return 0;
+	}
+
+	return jack_shmalloc_segment (size, si);
+}
+
+int
+jack_attach_shm (jack_shm_info_t* si)
+{
+	jack_shm_registry_t *registry = &jack_shm_registry[si->index];
+	char *pool;
+
+	if (registry->parent == JACK_SHM_NULL_INDEX) {
+		return jack_attach_segment (si);
+	}
+
+	if ((pool = jack_shm_pool_attach (registry->parent)) == NULL) {
+		return -1;
+	}
+	si->attached_at = pool + registry->offset;
+
+	return 0;
+}
+
+jack_shmsize_t
+jack_shm_size (jack_shm_info_t* si)
+{
+	return jack_shm_registry[si->index].size;
+}
+
+void
+jack_release_shm (jack_shm_info_t* si)
+{
+	/* registry may or may not be locked */
+
+	/* segments in a pool stay mapped with it */
+	if (si->attached_at != MAP_FAILED
+	    && jack_shm_pool_contains (si->attached_at)) {
+		return;
+	}
+
+	jack_release_segment (si);
+}
+
 /* resize a shared memory segment
  *
  * There is no way to resize a System V shm segment.  Resizing is
@@ -556,6 +923,56 @@ jack_resize_shm (jack_shm_info_t* si, jack_shmsize_t size)
 	return jack_attach_shm (si);
 }
 
+/* Segments at least this large are worth backing with transparent
+ * huge pages.  Port buffer segments grow to several MB with many
+ * ports, and every client walks them in its process cycle.
+ */
+#define JACK_SHM_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+/* huge page advice can be turned off with JACK_SHM_HUGEPAGES=0 */
+static int
+jack_shm_use_hugepages (jack_shmsize_t size)
+{
+	static int enabled = -1;
+
+	if (enabled < 0) {
+		const char *env = getenv ("JACK_SHM_HUGEPAGES");
+		enabled = (env == NULL || atoi (env) != 0);
+	}
+
+	return enabled && size >= JACK_SHM_HUGEPAGE_SIZE;
+}
+
+/* Called on every fresh attachment: ask for huge pages where it
+ * pays, then fault the whole segment in so that the first process
+ * cycles don't take page faults in the realtime thread.
+ */
+static void
+jack_shm_prepare (void *addr, jack_shmsize_t size)
+{
+	long pagesize = sysconf (_SC_PAGESIZE);
+	volatile char *p = (volatile char*)addr;
+	jack_shmsize_t off;
+
+#ifdef MADV_HUGEPAGE
+	if (jack_shm_use_hugepages (size)) {
+		madvise (addr, size, MADV_HUGEPAGE);
+	}
+#endif
+
+#ifdef MADV_POPULATE_WRITE
+	if (madvise (addr, size, MADV_POPULATE_WRITE) == 0) {
+		return;
+	}
+#endif
+
+	/* Other processes may already be writing to the segment, so
+	   touch it by reading only. */
+	for (off = 0; off < size; off += pagesize) {
+		(void)p[off];
+	}
+}
+
 #ifdef USE_POSIX_SHM
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
@@ -672,8 +1089,8 @@ jack_remove_shm (jack_shm_id_t *id)
 	shm_unlink ((char*)id);
 }
 
-void
-jack_release_shm (jack_shm_info_t* si)
+static void
+jack_release_segment (jack_shm_info_t* si)
 {
 	/* registry may or may not be locked */
 	if (si->attached_at != MAP_FAILED) {
@@ -681,9 +1098,46 @@ jack_release_shm (jack_shm_info_t* si)
 	}
 }
 
+/* Map a segment.  Huge pages can only back 2MB aligned ranges, so
+ * for segments that qualify we carve an aligned window out of a
+ * larger anonymous reservation and map the segment over it.
+ */
+static void *
+jack_shm_map (jack_shmsize_t size, int shm_fd)
+{
+#if defined(MADV_HUGEPAGE) && defined(MAP_ANONYMOUS)
+	if (jack_shm_use_hugepages (size)) {
+		size_t span = size + JACK_SHM_HUGEPAGE_SIZE;
+		long pagesize = sysconf (_SC_PAGESIZE);
+		size_t mapped = (size + pagesize - 1) & ~((size_t)pagesize - 1);
+		char *reserve, *aligned;
+
+		reserve = mmap (0, span, PROT_NONE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (reserve != MAP_FAILED) {
+			aligned = (char*)(((unsigned long)reserve + JACK_SHM_HUGEPAGE_SIZE - 1)
+					  & ~((unsigned long)JACK_SHM_HUGEPAGE_SIZE - 1));
+			if (mmap (aligned, size, PROT_READ | PROT_WRITE,
+				  MAP_SHARED | MAP_FIXED, shm_fd, 0) != MAP_FAILED) {
+				if (aligned > reserve) {
+					munmap (reserve, aligned - reserve);
+				}
+				if (aligned + mapped < reserve + span) {
+					munmap (aligned + mapped, reserve + span - (aligned + mapped));
+				}
+				return aligned;
+			}
+			munmap (reserve, span);
+		}
+	}
+#endif
+
+	return mmap (0, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+}
+
 /* allocate a POSIX shared memory segment */
-int
-jack_shmalloc (jack_shmsize_t size, jack_shm_info_t* si)
+static int
+jack_shmalloc_segment (jack_shmsize_t size, jack_shm_info_t* si)
 {
 	jack_shm_registry_t* registry;
 	int shm_fd;
@@ -708,13 +1162,13 @@ jack_shmalloc (jack_shmsize_t size, jack_shm_info_t* si)
 
 	if (strlen (name) >= sizeof(registry->id)) {
 		jack_error ("shm segment name too long %s", name);
-		goto unlock;
+		goto release;
 	}
 
 	if ((shm_fd = shm_open (name, O_RDWR | O_CREAT, 0666)) < 0) {
 		jack_error ("cannot create shm segment %s (%s)",
 			    name, strerror (errno));
-		goto unlock;
+		goto release;
 	}
 
 	if (ftruncate (shm_fd, size) < 0) {
@@ -722,7 +1176,7 @@ jack_shmalloc (jack_shmsize_t size, jack_shm_info_t* si)
 			    "registry 0 (%s)",
 			    strerror (errno));
 		close (shm_fd);
-		goto unlock;
+		goto release;
 	}
 
 	close (shm_fd);
@@ -732,14 +1186,17 @@ jack_shmalloc (jack_shmsize_t size, jack_shm_info_t* si)
 	si->index = registry->index;
 	si->attached_at = MAP_FAILED;   /* not attached */
 	rc = 0;                         /* success */
+	goto unlock;
 
+release:
+	jack_release_shm_entry (registry->index);
 unlock:
 	jack_shm_unlock_registry ();
 	return rc;
 }
 
-int
-jack_attach_shm (jack_shm_info_t* si)
+static int
+jack_attach_segment (jack_shm_info_t* si)
 {
 	int shm_fd;
 	jack_shm_registry_t *registry = &jack_shm_registry[si->index];
@@ -751,8 +1208,7 @@ jack_attach_shm (jack_shm_info_t* si)
 		return -1;
 	}
 
-	if ((si->attached_at = mmap (0, registry->size, PROT_READ | PROT_WRITE,
-				     MAP_SHARED, shm_fd, 0)) == MAP_FAILED) {
+	if ((si->attached_at = jack_shm_map (registry->size, shm_fd)) == MAP_FAILED) {
 		jack_error ("cannot mmap shm segment %s (%s)",
 			    registry->id,
 			    strerror (errno));
@@ -762,6 +1218,8 @@ jack_attach_shm (jack_shm_info_t* si)
 
 	close (shm_fd);
 
+	jack_shm_prepare (si->attached_at, registry->size);
+
 	return 0;
 }
 
@@ -868,8 +1326,8 @@ jack_remove_shm (jack_shm_id_t *id)
 	shmctl (*id, IPC_RMID, NULL);
 }
 
-void
-jack_release_shm (jack_shm_info_t* si)
+static void
+jack_release_segment (jack_shm_info_t* si)
 {
 	/* registry may or may not be locked */
 	if (si->attached_at != MAP_FAILED) {
@@ -877,8 +1335,8 @@ jack_release_shm (jack_shm_info_t* si)
 	}
 }
 
-int
-jack_shmalloc (jack_shmsize_t size, jack_shm_info_t* si)
+static int
+jack_shmalloc_segment (jack_shmsize_t size, jack_shm_info_t* si)
 {
 	int shmflags;
 	int shmid;
@@ -903,7 +1361,10 @@ jack_shmalloc (jack_shmsize_t size, jack_shm_info_t* si)
 		} else {
 			jack_error ("cannot create shm segment (%s)",
 				    strerror (errno));
+			jack_release_shm_entry (registry->index);
 		}
+	} else {
+		jack_error ("shm registry full");
 	}
 
 	jack_shm_unlock_registry ();
@@ -911,8 +1372,8 @@ jack_shmalloc (jack_shmsize_t size, jack_shm_info_t* si)
 	return rc;
 }
 
-int
-jack_attach_shm (jack_shm_info_t* si)
+static int
+jack_attach_segment (jack_shm_info_t* si)
 {
 	if ((si->attached_at = shmat (jack_shm_registry[si->index].id,
 				      0, 0)) < 0) {
@@ -921,6 +1382,9 @@ jack_attach_shm (jack_shm_info_t* si)
 		jack_release_shm_info (si->index);
 		return -1;
 	}
+
+	jack_shm_prepare (si->attached_at, jack_shm_registry[si->index].size);
+
 	return 0;
 }
 
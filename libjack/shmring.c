@@ -0,0 +1,403 @@
+/*
+   A ringbuffer between two processes, for one writer and one reader.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+   The buffer and both positions live in a shared memory file, which
+   the creator hands to the other process as a file descriptor: over a
+   unix socket (SCM_RIGHTS), or across fork(). The file is a memfd
+   where there is memfd_create(), else a POSIX shm object unlinked as
+   soon as it is made, so nothing is left behind either way.
+
+   The first page of the file holds the positions, each on a cache
+   line of its own as in jack_spsc_ringbuffer_t; the data follows. Each
+   process maps the data twice, back to back, as
+   jack_ringbuffer_create_mirrored() does, so that anything there is to
+   read or room to write is one contiguous span, and a disk streamer
+   can read() a file straight into the buffer. Positions are 32 bits
+   running freely, the same in 32 and 64 bit processes, and the whole
+   buffer can be filled.
+ */
+
+/* for memfd_create() */
+#define _GNU_SOURCE
+
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "internal.h"
+
+#define JACK_SHM_RING_MAGIC 0x4a524e47  /* "JRNG" */
+#define JACK_SHM_RING_MAX   (1U << 30)
+
+struct _jack_shm_ring_header {
+	uint32_t magic;
+	uint32_t size;
+
+	uint32_t write_ptr __attribute__((aligned(64)));
+	uint32_t read_ptr __attribute__((aligned(64)));
+};
+
+struct _jack_shm_ringbuffer {
+	struct _jack_shm_ring_header *hdr;
+	char *buf;              /* size bytes, and the same again */
+	size_t size;
+	size_t size_mask;
+	size_t page;
+	int fd;
+	int mlocked;
+
+	/* this process's copies of the other side's position */
+	uint32_t read_cache;
+	uint32_t write_cache;
+};
+
+static int
+jack_shm_ring_file (void)
+{
+#if defined(HAVE_MEMFD_CREATE)
+	return memfd_create ("jack-shm-ringbuffer", MFD_CLOEXEC);
+#else
+	static uint32_t serial;
+	char name[64];
+	int fd;
+
+	snprintf (name, sizeof(name), "/jack-ring-%d-%u", (int)getpid (),
+		  __atomic_add_fetch (&serial, 1, __ATOMIC_RELAXED));
+	if ((fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0600)) >= 0) {
+		shm_unlink (name);
+		fcntl (fd, F_SETFD, FD_CLOEXEC);
+	}
+	return fd;
+#endif
+}
+
+/* Map the header page of `fd' and its data twice after it. */
+static jack_shm_ringbuffer_t *
+jack_shm_ring_map (int fd, size_t page, size_t size)
+{
+	jack_shm_ringbuffer_t *rb;
+	char *addr;
+
+	/* reserve room for all three views, then put the pages in it */
+	addr = mmap (NULL, page + 2 * size, PROT_NONE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED) {
+		return NULL;
+	}
+
+	if (mmap (addr, page, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+	    || mmap (addr + page, size, PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_FIXED, fd, page) == MAP_FAILED
+	    || mmap (addr + page + size, size, PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_FIXED, fd, page) == MAP_FAILED) {
+		munmap (addr, page + 2 * size);
+		return NULL;
+	}
+
+	if ((rb = calloc (1, sizeof(jack_shm_ringbuffer_t))) == NULL) {
+		munmap (addr, page + 2 * size);
+		return NULL;
+	}
+
+	rb->hdr = (struct _jack_shm_ring_header*)addr;
+	rb->buf = addr + page;
+	rb->size = size;
+	rb->size_mask = size - 1;
+	rb->page = page;
+	rb->fd = fd;
+
+	return rb;
+}
+
+/* Create a ringbuffer to hold at least `sz' bytes, rounded up to a
+   power of two of at least a page. */
+
+jack_shm_ringbuffer_t *
+jack_shm_ringbuffer_create (size_t sz)
+{
+	jack_shm_ringbuffer_t *rb;
+	size_t page = sysconf (_SC_PAGESIZE);
+	size_t size = page;
+	int fd;
+
+	if (sz > JACK_SHM_RING_MAX) {
+		jack_error ("cannot make a shared ringbuffer of %zu bytes", sz);
+		return NULL;
+	}
+
+	while (size < sz) {
+		size <<= 1;
+	}
+
+	if ((fd = jack_shm_ring_file ()) < 0) {
+		jack_error ("cannot make a shared ringbuffer (%s)",
+			    strerror (errno));
+		return NULL;
+	}
+
+	if (ftruncate (fd, page + size)
+	    || (rb = jack_shm_ring_map (fd, page, size)) == NULL) {
+		jack_error ("cannot map a shared ringbuffer (%s)",
+			    strerror (errno));
+		close (fd);
+		return NULL;
+	}
+
+	rb->hdr->size = size;
+	rb->hdr->write_ptr = 0;
+	rb->hdr->read_ptr = 0;
+	__atomic_store_n (&rb->hdr->magic, JACK_SHM_RING_MAGIC,
+			  __ATOMIC_RELEASE);
+
+	return rb;
+}
+
+/* Attach to the ringbuffer another process made, from its descriptor;
+   the ringbuffer keeps `fd'. */
+
+jack_shm_ringbuffer_t *
+jack_shm_ringbuffer_attach (int fd)
+{
+	jack_shm_ringbuffer_t *rb;
+	struct _jack_shm_ring_header *hdr;
+	size_t page = sysconf (_SC_PAGESIZE);
+	struct stat st;
+	size_t size;
+
+	if (fstat (fd, &st) || (size_t)st.st_size <= page) {
+		jack_error ("not a shared ringbuffer");
+		return NULL;
+	}
+
+	hdr = mmap (NULL, page, PROT_READ, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED) {
+		jack_error ("cannot map a shared ringbuffer (%s)",
+			    strerror (errno));
+		return NULL;
+	}
+	size = hdr->size;
+	if (__atomic_load_n (&hdr->magic, __ATOMIC_ACQUIRE) != JACK_SHM_RING_MAGIC
+	    || size < page || size > JACK_SHM_RING_MAX || (size & (size - 1))
+	    || (size_t)st.st_size != page + size) {
+		munmap (hdr, page);
+		jack_error ("not a shared ringbuffer");
+		return NULL;
+	}
+	munmap (hdr, page);
+
+	if ((rb = jack_shm_ring_map (fd, page, size)) == NULL) {
+		jack_error ("cannot map a shared ringbuffer (%s)",
+			    strerror (errno));
+		return NULL;
+	}
+	rb->read_cache = rb->hdr->read_ptr;
+	rb->write_cache = rb->hdr->write_ptr;
+
+	return rb;
+}
+
+/* The descriptor to hand to the other process. */
+
+int
+jack_shm_ringbuffer_fd (const jack_shm_ringbuffer_t *rb)
+{
+	return rb->fd;
+}
+
+/* Unmap this process's view; the buffer goes when the last one does. */
+
+void
+jack_shm_ringbuffer_free (jack_shm_ringbuffer_t *rb)
+{
+#ifdef USE_MLOCK
+	if (rb->mlocked) {
+		munlock (rb->hdr, rb->page + rb->size);
+	}
+#endif  /* USE_MLOCK */
+	munmap (rb->hdr, rb->page + 2 * rb->size);
+	close (rb->fd);
+	free (rb);
+}
+
+/* Lock this process's view of the header and the data. */
+
+int
+jack_shm_ringbuffer_mlock (jack_shm_ringbuffer_t *rb)
+{
+#ifdef USE_MLOCK
+	if (mlock (rb->hdr, rb->page + rb->size)) {
+		return -1;
+	}
+#endif  /* USE_MLOCK */
+	rb->mlocked = 1;
+	return 0;
+}
+
+/* writer side */
+
+static inline size_t
+jack_shm_write_avail (jack_shm_ringbuffer_t *rb, size_t want)
+{
+	uint32_t w = rb->hdr->write_ptr;
+	size_t avail = rb->size - (uint32_t)(w - rb->read_cache);
+
+	if (avail < want) {
+		rb->read_cache = __atomic_load_n (&rb->hdr->read_ptr,
+						  __ATOMIC_ACQUIRE);
+		avail = rb->size - (uint32_t)(w - rb->read_cache);
+	}
+
+	return avail;
+}
+
+size_t
+jack_shm_ringbuffer_write_space (jack_shm_ringbuffer_t *rb)
+{
+	return jack_shm_write_avail (rb, rb->size);
+}
+
+size_t
+jack_shm_ringbuffer_write (jack_shm_ringbuffer_t *rb, const char *src,
+			   size_t cnt)
+{
+	size_t avail = jack_shm_write_avail (rb, cnt);
+	uint32_t w = rb->hdr->write_ptr;
+
+	if (cnt > avail) {
+		cnt = avail;
+	}
+
+	if (cnt) {
+		memcpy (rb->buf + (w & rb->size_mask), src, cnt);
+		__atomic_store_n (&rb->hdr->write_ptr, w + (uint32_t)cnt,
+				  __ATOMIC_RELEASE);
+	}
+
+	return cnt;
+}
+
+void
+jack_shm_ringbuffer_write_advance (jack_shm_ringbuffer_t *rb, size_t cnt)
+{
+	__atomic_store_n (&rb->hdr->write_ptr,
+			  rb->hdr->write_ptr + (uint32_t)cnt, __ATOMIC_RELEASE);
+}
+
+/* All the room there is, in vec[0]; vec[1] is always empty. */
+
+void
+jack_shm_ringbuffer_get_write_vector (jack_shm_ringbuffer_t *rb,
+				      jack_ringbuffer_data_t *vec)
+{
+	size_t avail = jack_shm_write_avail (rb, rb->size);
+
+	vec[0].buf = rb->buf + (rb->hdr->write_ptr & rb->size_mask);
+	vec[0].len = avail;
+	vec[1].buf = rb->buf;
+	vec[1].len = 0;
+}
+
+/* reader side */
+
+static inline size_t
+jack_shm_read_avail (jack_shm_ringbuffer_t *rb, size_t want)
+{
+	uint32_t r = rb->hdr->read_ptr;
+	size_t avail = (uint32_t)(rb->write_cache - r);
+
+	if (avail < want) {
+		rb->write_cache = __atomic_load_n (&rb->hdr->write_ptr,
+						   __ATOMIC_ACQUIRE);
+		avail = (uint32_t)(rb->write_cache - r);
+	}
+
+	return avail;
+}
+
+size_t
+jack_shm_ringbuffer_read_space (jack_shm_ringbuffer_t *rb)
+{
+	return jack_shm_read_avail (rb, rb->size);
+}
+
+size_t
+jack_shm_ringbuffer_read (jack_shm_ringbuffer_t *rb, char *dest, size_t cnt)
+{
+	size_t avail = jack_shm_read_avail (rb, cnt);
+	uint32_t r = rb->hdr->read_ptr;
+
+	if (cnt > avail) {
+		cnt = avail;
+	}
+
+	if (cnt) {
+		memcpy (dest, rb->buf + (r & rb->size_mask), cnt);
+		__atomic_store_n (&rb->hdr->read_ptr, r + (uint32_t)cnt,
+				  __ATOMIC_RELEASE);
+	}
+
+	return cnt;
+}
+
+/* Copy at most `cnt' bytes to `dest' without consuming them. */
+
+size_t
+jack_shm_ringbuffer_peek (jack_shm_ringbuffer_t *rb, char *dest, size_t cnt)
+{
+	size_t avail = jack_shm_read_avail (rb, cnt);
+
+	if (cnt > avail) {
+		cnt = avail;
+	}
+
+	if (cnt) {
+		memcpy (dest, rb->buf + (rb->hdr->read_ptr & rb->size_mask),
+			cnt);
+	}
+
+	return cnt;
+}
+
+void
+jack_shm_ringbuffer_read_advance (jack_shm_ringbuffer_t *rb, size_t cnt)
+{
+	__atomic_store_n (&rb->hdr->read_ptr,
+			  rb->hdr->read_ptr + (uint32_t)cnt, __ATOMIC_RELEASE);
+}
+
+/* All there is to read, in vec[0]; vec[1] is always empty. */
+
+void
+jack_shm_ringbuffer_get_read_vector (jack_shm_ringbuffer_t *rb,
+				     jack_ringbuffer_data_t *vec)
+{
+	size_t avail = jack_shm_read_avail (rb, rb->size);
+
+	vec[0].buf = rb->buf + (rb->hdr->read_ptr & rb->size_mask);
+	vec[0].len = avail;
+	vec[1].buf = rb->buf;
+	vec[1].len = 0;
+}
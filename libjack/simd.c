@@ -24,101 +24,58 @@
 
 #ifdef USE_DYNSIMD
 
-#ifdef ARCH_X86
-
-int
-have_3dnow ()
+/* shared by all the mixnf versions for whatever is left over */
+static inline void
+mixnf_tail (float *dest, const float * const *src, int nsrc,
+	    int from, int length)
 {
-	unsigned int res = 0;
+	int i, j;
+	float sum;
+
+	for (i = from; i < length; i++) {
+		sum = src[0][i];
+		for (j = 1; j < nsrc; j++)
+			sum += src[j][i];
+		dest[i] = sum;
+	}
+}
 
-#ifdef __x86_64__
-	asm volatile ("pushq %%rbx\n\t" : : : "memory");
-#else
-	asm volatile ("pushl %%ebx\n\t" : : : "memory");
-#endif
-	asm volatile (
-		"movl $0x80000000, %%eax\n\t" \
-		"cpuid\n\t" \
-		"cmpl $0x80000001, %%eax\n\t" \
-		"jl tdnow_prexit\n\t" \
-		\
-		"movl $0x80000001, %%eax\n\t" \
-		"cpuid\n\t" \
-		\
-		"xorl %%eax, %%eax\n\t"	\
-		\
-		"movl $1, %%ecx\n\t" \
-		"shll $31, %%ecx\n\t" \
-		"testl %%ecx, %%edx\n\t" \
-		"jz tdnow_testexit\n\t"	\
-		"movl $1, %%eax\n\t" \
-		\
-		"movl $1, %%ecx\n\t" \
-		"shll $30, %%ecx\n\t" \
-		"testl %%ecx, %%edx\n\t" \
-		"jz tdnow_testexit\n\t"	\
-		"movl $2, %%eax\n\t" \
-		"jmp tdnow_testexit\n\t" \
-		\
-		"tdnow_prexit:\n\t" \
-		"xorl %%eax, %%eax\n\t"	\
-		"tdnow_testexit:\n\t"
-		: "=a" (res)
-		:
-		: "ecx", "edx", "memory");
-#ifdef __x86_64__
-	asm volatile ("popq %%rbx\n\t" : : : "memory");
-#else
-	asm volatile ("popl %%ebx\n\t" : : : "memory");
-#endif
-	return res;
+/* and by the mixgainf versions */
+static inline void
+mixgainf_tail (float *dest, const float * const *src, const float *gain,
+	       const float *step, int nsrc, int from, int length)
+{
+	int i, j;
+	float sum;
+
+	for (i = from; i < length; i++) {
+		sum = 0.0f;
+		for (j = 0; j < nsrc; j++)
+			sum += src[j][i] * (gain[j] + step[j] * (i + 1));
+		dest[i] = sum;
+	}
 }
 
-int
-have_sse ()
+/* and by the meterf versions */
+static inline void
+meterf_tail (const float *src, int from, int length,
+	     float *peak, float *sumsq)
 {
-	unsigned int res = 0;
+	int i;
+	float a;
 
-#ifdef __x86_64__
-	asm volatile ("pushq %%rbx\n\t" : : : "memory");
-#else
-	asm volatile ("pushl %%ebx\n\t" : : : "memory");
-#endif
-	asm volatile (
-		"movl $1, %%eax\n\t" \
-		"cpuid\n\t" \
-		\
-		"xorl %%eax, %%eax\n\t"	\
-		\
-		"movl $1, %%ebx\n\t" \
-		"shll $25, %%ebx\n\t" \
-		"testl %%ebx, %%edx\n\t" \
-		"jz sse_testexit\n\t" \
-		"movl $1, %%eax\n\t" \
-		\
-		"movl $1, %%ebx\n\t" \
-		"shll $26, %%ebx\n\t" \
-		"testl %%ebx, %%edx\n\t" \
-		"jz sse_testexit\n\t" \
-		"movl $2, %%eax\n\t" \
-		\
-		"movl $1, %%ebx\n\t" \
-		"testl %%ebx, %%ecx\n\t" \
-		"jz sse_testexit\n\t" \
-		"movl $3, %%eax\n\t" \
-		\
-		"sse_testexit:\n\t"
-		: "=a" (res)
-		:
-		: "ecx", "edx", "memory");
-#ifdef __x86_64__
-	asm volatile ("popq %%rbx\n\t" : : : "memory");
-#else
-	asm volatile ("popl %%ebx\n\t" : : : "memory");
-#endif
-	return res;
+	for (i = from; i < length; i++) {
+		a = src[i] < 0.0f ? -src[i] : src[i];
+		if (a > *peak)
+			*peak = a;
+		*sumsq += src[i] * src[i];
+	}
 }
 
+#ifdef ARCH_X86
+
+#include <immintrin.h>
+
 void
 x86_3dnow_copyf (float *dest, const float *src, int length)
 {
@@ -410,7 +367,407 @@ sse_nonalign:
 	}
 }
 
+void
+x86_sse_mixnf (float *dest, const float * const *src, int nsrc, int length)
+{
+	int i, j, n;
+	__m128 a0, a1;
+
+	n = (length & ~0x7);
+	for (i = 0; i < n; i += 8) {
+		a0 = _mm_loadu_ps (src[0] + i);
+		a1 = _mm_loadu_ps (src[0] + i + 4);
+		for (j = 1; j < nsrc; j++) {
+			a0 = _mm_add_ps (a0, _mm_loadu_ps (src[j] + i));
+			a1 = _mm_add_ps (a1, _mm_loadu_ps (src[j] + i + 4));
+		}
+		_mm_storeu_ps (dest + i, a0);
+		_mm_storeu_ps (dest + i + 4, a1);
+	}
+	mixnf_tail (dest, src, nsrc, n, length);
+}
+
+/* the largest magnitude and the sum of squares of a buffer, for the
+   server's port meters */
+void
+x86_sse_meterf (const float *src, int length, float *peak, float *sumsq)
+{
+	const __m128 sign = _mm_set1_ps (-0.0f);
+	__m128 p0, p1, s0, s1;
+	float p[4], s[4];
+	int i, n;
+
+	p0 = p1 = s0 = s1 = _mm_setzero_ps ();
+	n = (length & ~0x7);
+	for (i = 0; i < n; i += 8) {
+		__m128 a0 = _mm_loadu_ps (src + i);
+		__m128 a1 = _mm_loadu_ps (src + i + 4);
+		p0 = _mm_max_ps (p0, _mm_andnot_ps (sign, a0));
+		p1 = _mm_max_ps (p1, _mm_andnot_ps (sign, a1));
+		s0 = _mm_add_ps (s0, _mm_mul_ps (a0, a0));
+		s1 = _mm_add_ps (s1, _mm_mul_ps (a1, a1));
+	}
+	_mm_storeu_ps (p, _mm_max_ps (p0, p1));
+	_mm_storeu_ps (s, _mm_add_ps (s0, s1));
+
+	*peak = p[0] > p[1] ? p[0] : p[1];
+	*peak = p[2] > *peak ? p[2] : *peak;
+	*peak = p[3] > *peak ? p[3] : *peak;
+	*sumsq = (s[0] + s[1]) + (s[2] + s[3]);
+	meterf_tail (src, n, length, peak, sumsq);
+}
+
+/* AVX is enough for single precision float arithmetic, AVX2 only adds
+   the integer side. Built with target attributes so that the rest of
+   this file does not get compiled for AVX. */
+
+__attribute__ ((target ("avx"))) void
+x86_avx_copyf (float *dest, const float *src, int length)
+{
+	int i, n;
+
+	n = (length & ~0x1f);
+	for (i = 0; i < n; i += 32) {
+		__m256 a0 = _mm256_loadu_ps (src + i);
+		__m256 a1 = _mm256_loadu_ps (src + i + 8);
+		__m256 a2 = _mm256_loadu_ps (src + i + 16);
+		__m256 a3 = _mm256_loadu_ps (src + i + 24);
+		_mm256_storeu_ps (dest + i, a0);
+		_mm256_storeu_ps (dest + i + 8, a1);
+		_mm256_storeu_ps (dest + i + 16, a2);
+		_mm256_storeu_ps (dest + i + 24, a3);
+	}
+	for (; i < length; i++)
+		dest[i] = src[i];
+}
+
+__attribute__ ((target ("avx"))) void
+x86_avx_add2f (float *dest, const float *src, int length)
+{
+	int i, n;
+
+	n = (length & ~0xf);
+	for (i = 0; i < n; i += 16) {
+		__m256 a0 = _mm256_add_ps (_mm256_loadu_ps (dest + i),
+					   _mm256_loadu_ps (src + i));
+		__m256 a1 = _mm256_add_ps (_mm256_loadu_ps (dest + i + 8),
+					   _mm256_loadu_ps (src + i + 8));
+		_mm256_storeu_ps (dest + i, a0);
+		_mm256_storeu_ps (dest + i + 8, a1);
+	}
+	for (; i < length; i++)
+		dest[i] += src[i];
+}
+
+__attribute__ ((target ("avx"))) void
+x86_avx_mixnf (float *dest, const float * const *src, int nsrc, int length)
+{
+	int i, j, n;
+	__m256 a0, a1, a2, a3;
+	const float *s;
+
+	n = (length & ~0x1f);
+	for (i = 0; i < n; i += 32) {
+		s = src[0] + i;
+		a0 = _mm256_loadu_ps (s);
+		a1 = _mm256_loadu_ps (s + 8);
+		a2 = _mm256_loadu_ps (s + 16);
+		a3 = _mm256_loadu_ps (s + 24);
+		for (j = 1; j < nsrc; j++) {
+			s = src[j] + i;
+			a0 = _mm256_add_ps (a0, _mm256_loadu_ps (s));
+			a1 = _mm256_add_ps (a1, _mm256_loadu_ps (s + 8));
+			a2 = _mm256_add_ps (a2, _mm256_loadu_ps (s + 16));
+			a3 = _mm256_add_ps (a3, _mm256_loadu_ps (s + 24));
+		}
+		_mm256_storeu_ps (dest + i, a0);
+		_mm256_storeu_ps (dest + i + 8, a1);
+		_mm256_storeu_ps (dest + i + 16, a2);
+		_mm256_storeu_ps (dest + i + 24, a3);
+	}
+	mixnf_tail (dest, src, nsrc, n, length);
+}
+
+__attribute__ ((target ("avx"))) void
+x86_avx_meterf (const float *src, int length, float *peak, float *sumsq)
+{
+	const __m256 sign = _mm256_set1_ps (-0.0f);
+	__m256 p0, p1, s0, s1;
+	__m128 p4, s4;
+	float p[4], s[4];
+	int i, n;
+
+	p0 = p1 = s0 = s1 = _mm256_setzero_ps ();
+	n = (length & ~0xf);
+	for (i = 0; i < n; i += 16) {
+		__m256 a0 = _mm256_loadu_ps (src + i);
+		__m256 a1 = _mm256_loadu_ps (src + i + 8);
+		p0 = _mm256_max_ps (p0, _mm256_andnot_ps (sign, a0));
+		p1 = _mm256_max_ps (p1, _mm256_andnot_ps (sign, a1));
+		s0 = _mm256_add_ps (s0, _mm256_mul_ps (a0, a0));
+		s1 = _mm256_add_ps (s1, _mm256_mul_ps (a1, a1));
+	}
+	p0 = _mm256_max_ps (p0, p1);
+	s0 = _mm256_add_ps (s0, s1);
+	p4 = _mm_max_ps (_mm256_castps256_ps128 (p0), _mm256_extractf128_ps (p0, 1));
+	s4 = _mm_add_ps (_mm256_castps256_ps128 (s0), _mm256_extractf128_ps (s0, 1));
+	_mm_storeu_ps (p, p4);
+	_mm_storeu_ps (s, s4);
+
+	*peak = p[0] > p[1] ? p[0] : p[1];
+	*peak = p[2] > *peak ? p[2] : *peak;
+	*peak = p[3] > *peak ? p[3] : *peak;
+	*sumsq = (s[0] + s[1]) + (s[2] + s[3]);
+	meterf_tail (src, n, length, peak, sumsq);
+}
+
+/* The gain of each input at each sample is worked out from where the
+   sample is, rather than stepped along, so that a long period does not
+   drift off the ramp: g = gain + step * (i + 1), then sum += s * g,
+   both fused. */
+
+__attribute__ ((target ("avx,fma"))) void
+x86_fma_mixgainf (float *dest, const float * const *src, const float *gain,
+		  const float *step, int nsrc, int length)
+{
+	const __m256 lane = _mm256_setr_ps (1, 2, 3, 4, 5, 6, 7, 8);
+	__m256 a0, a1, x0, x1, g, d;
+	const float *s;
+	int i, j, n;
+
+	n = (length & ~0xf);
+	for (i = 0; i < n; i += 16) {
+		x0 = _mm256_add_ps (_mm256_set1_ps ((float)i), lane);
+		x1 = _mm256_add_ps (x0, _mm256_set1_ps (8.0f));
+		a0 = a1 = _mm256_setzero_ps ();
+		for (j = 0; j < nsrc; j++) {
+			s = src[j] + i;
+			g = _mm256_set1_ps (gain[j]);
+			d = _mm256_set1_ps (step[j]);
+			a0 = _mm256_fmadd_ps (_mm256_loadu_ps (s),
+					      _mm256_fmadd_ps (d, x0, g), a0);
+			a1 = _mm256_fmadd_ps (_mm256_loadu_ps (s + 8),
+					      _mm256_fmadd_ps (d, x1, g), a1);
+		}
+		_mm256_storeu_ps (dest + i, a0);
+		_mm256_storeu_ps (dest + i + 8, a1);
+	}
+	mixgainf_tail (dest, src, gain, step, nsrc, n, length);
+}
+
+/* the AVX-512 versions finish off with masked loads and stores
+   instead of a scalar loop */
+
+__attribute__ ((target ("avx512f"))) void
+x86_avx512_copyf (float *dest, const float *src, int length)
+{
+	int i, n;
+	__mmask16 m;
+
+	n = (length & ~0x3f);
+	for (i = 0; i < n; i += 64) {
+		__m512 a0 = _mm512_loadu_ps (src + i);
+		__m512 a1 = _mm512_loadu_ps (src + i + 16);
+		__m512 a2 = _mm512_loadu_ps (src + i + 32);
+		__m512 a3 = _mm512_loadu_ps (src + i + 48);
+		_mm512_storeu_ps (dest + i, a0);
+		_mm512_storeu_ps (dest + i + 16, a1);
+		_mm512_storeu_ps (dest + i + 32, a2);
+		_mm512_storeu_ps (dest + i + 48, a3);
+	}
+	for (; i < length; i += 16) {
+		m = (length - i >= 16) ? 0xffff : ((1 << (length - i)) - 1);
+		_mm512_mask_storeu_ps (dest + i, m,
+				       _mm512_maskz_loadu_ps (m, src + i));
+	}
+}
+
+__attribute__ ((target ("avx512f"))) void
+x86_avx512_add2f (float *dest, const float *src, int length)
+{
+	int i;
+	__mmask16 m;
+
+	for (i = 0; i < length; i += 16) {
+		m = (length - i >= 16) ? 0xffff : ((1 << (length - i)) - 1);
+		_mm512_mask_storeu_ps (dest + i, m,
+				       _mm512_add_ps (_mm512_maskz_loadu_ps (m, dest + i),
+						      _mm512_maskz_loadu_ps (m, src + i)));
+	}
+}
+
+__attribute__ ((target ("avx512f"))) void
+x86_avx512_mixnf (float *dest, const float * const *src, int nsrc, int length)
+{
+	int i, j, n;
+	__m512 a0, a1, a2, a3;
+	__mmask16 m;
+	const float *s;
+
+	n = (length & ~0x3f);
+	for (i = 0; i < n; i += 64) {
+		s = src[0] + i;
+		a0 = _mm512_loadu_ps (s);
+		a1 = _mm512_loadu_ps (s + 16);
+		a2 = _mm512_loadu_ps (s + 32);
+		a3 = _mm512_loadu_ps (s + 48);
+		for (j = 1; j < nsrc; j++) {
+			s = src[j] + i;
+			a0 = _mm512_add_ps (a0, _mm512_loadu_ps (s));
+			a1 = _mm512_add_ps (a1, _mm512_loadu_ps (s + 16));
+			a2 = _mm512_add_ps (a2, _mm512_loadu_ps (s + 32));
+			a3 = _mm512_add_ps (a3, _mm512_loadu_ps (s + 48));
+		}
+		_mm512_storeu_ps (dest + i, a0);
+		_mm512_storeu_ps (dest + i + 16, a1);
+		_mm512_storeu_ps (dest + i + 32, a2);
+		_mm512_storeu_ps (dest + i + 48, a3);
+	}
+	for (; i < length; i += 16) {
+		m = (length - i >= 16) ? 0xffff : ((1 << (length - i)) - 1);
+		a0 = _mm512_maskz_loadu_ps (m, src[0] + i);
+		for (j = 1; j < nsrc; j++)
+			a0 = _mm512_add_ps (a0, _mm512_maskz_loadu_ps (m, src[j] + i));
+		_mm512_mask_storeu_ps (dest + i, m, a0);
+	}
+}
+
 #endif  /* ARCH_X86 */
 
+#ifdef ARCH_ARM
+
+#include <arm_neon.h>
+
+void
+arm_neon_copyf (float *dest, const float *src, int length)
+{
+	int i, n;
+
+	n = (length & ~0xf);
+	for (i = 0; i < n; i += 16) {
+		float32x4_t a0 = vld1q_f32 (src + i);
+		float32x4_t a1 = vld1q_f32 (src + i + 4);
+		float32x4_t a2 = vld1q_f32 (src + i + 8);
+		float32x4_t a3 = vld1q_f32 (src + i + 12);
+		vst1q_f32 (dest + i, a0);
+		vst1q_f32 (dest + i + 4, a1);
+		vst1q_f32 (dest + i + 8, a2);
+		vst1q_f32 (dest + i + 12, a3);
+	}
+	for (; i < length; i++)
+		dest[i] = src[i];
+}
+
+void
+arm_neon_add2f (float *dest, const float *src, int length)
+{
+	int i, n;
+
+	n = (length & ~0x7);
+	for (i = 0; i < n; i += 8) {
+		float32x4_t a0 = vaddq_f32 (vld1q_f32 (dest + i),
+					    vld1q_f32 (src + i));
+		float32x4_t a1 = vaddq_f32 (vld1q_f32 (dest + i + 4),
+					    vld1q_f32 (src + i + 4));
+		vst1q_f32 (dest + i, a0);
+		vst1q_f32 (dest + i + 4, a1);
+	}
+	for (; i < length; i++)
+		dest[i] += src[i];
+}
+
+void
+arm_neon_mixnf (float *dest, const float * const *src, int nsrc, int length)
+{
+	int i, j, n;
+	float32x4_t a0, a1, a2, a3;
+	const float *s;
+
+	n = (length & ~0xf);
+	for (i = 0; i < n; i += 16) {
+		s = src[0] + i;
+		a0 = vld1q_f32 (s);
+		a1 = vld1q_f32 (s + 4);
+		a2 = vld1q_f32 (s + 8);
+		a3 = vld1q_f32 (s + 12);
+		for (j = 1; j < nsrc; j++) {
+			s = src[j] + i;
+			a0 = vaddq_f32 (a0, vld1q_f32 (s));
+			a1 = vaddq_f32 (a1, vld1q_f32 (s + 4));
+			a2 = vaddq_f32 (a2, vld1q_f32 (s + 8));
+			a3 = vaddq_f32 (a3, vld1q_f32 (s + 12));
+		}
+		vst1q_f32 (dest + i, a0);
+		vst1q_f32 (dest + i + 4, a1);
+		vst1q_f32 (dest + i + 8, a2);
+		vst1q_f32 (dest + i + 12, a3);
+	}
+	mixnf_tail (dest, src, nsrc, n, length);
+}
+
+/* fused on AArch64 only */
+#ifdef __aarch64__
+#define neon_mla(a, b, c) vfmaq_f32 ((a), (b), (c))
+#else
+#define neon_mla(a, b, c) vmlaq_f32 ((a), (b), (c))
+#endif
+
+void
+arm_neon_mixgainf (float *dest, const float * const *src, const float *gain,
+		   const float *step, int nsrc, int length)
+{
+	static const float lanes[4] = { 1, 2, 3, 4 };
+	const float32x4_t lane = vld1q_f32 (lanes);
+	float32x4_t a0, a1, x0, x1, g, d;
+	const float *s;
+	int i, j, n;
+
+	n = (length & ~0x7);
+	for (i = 0; i < n; i += 8) {
+		x0 = vaddq_f32 (vdupq_n_f32 ((float)i), lane);
+		x1 = vaddq_f32 (x0, vdupq_n_f32 (4.0f));
+		a0 = a1 = vdupq_n_f32 (0.0f);
+		for (j = 0; j < nsrc; j++) {
+			s = src[j] + i;
+			g = vdupq_n_f32 (gain[j]);
+			d = vdupq_n_f32 (step[j]);
+			a0 = neon_mla (a0, vld1q_f32 (s), neon_mla (g, d, x0));
+			a1 = neon_mla (a1, vld1q_f32 (s + 4), neon_mla (g, d, x1));
+		}
+		vst1q_f32 (dest + i, a0);
+		vst1q_f32 (dest + i + 4, a1);
+	}
+	mixgainf_tail (dest, src, gain, step, nsrc, n, length);
+}
+
+void
+arm_neon_meterf (const float *src, int length, float *peak, float *sumsq)
+{
+	float32x4_t p0, p1, s0, s1;
+	float32x2_t p2, s2;
+	int i, n;
+
+	p0 = p1 = s0 = s1 = vdupq_n_f32 (0.0f);
+	n = (length & ~0x7);
+	for (i = 0; i < n; i += 8) {
+		float32x4_t a0 = vld1q_f32 (src + i);
+		float32x4_t a1 = vld1q_f32 (src + i + 4);
+		p0 = vmaxq_f32 (p0, vabsq_f32 (a0));
+		p1 = vmaxq_f32 (p1, vabsq_f32 (a1));
+		s0 = vmlaq_f32 (s0, a0, a0);
+		s1 = vmlaq_f32 (s1, a1, a1);
+	}
+	p0 = vmaxq_f32 (p0, p1);
+	s0 = vaddq_f32 (s0, s1);
+	p2 = vpmax_f32 (vget_low_f32 (p0), vget_high_f32 (p0));
+	s2 = vadd_f32 (vget_low_f32 (s0), vget_high_f32 (s0));
+
+	*peak = vget_lane_f32 (vpmax_f32 (p2, p2), 0);
+	*sumsq = vget_lane_f32 (vpadd_f32 (s2, s2), 0);
+	meterf_tail (src, n, length, peak, sumsq);
+}
+
+#endif  /* ARCH_ARM */
+
 #endif  /* USE_DYNSIMD */
 
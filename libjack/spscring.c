@@ -0,0 +1,372 @@
+/*
+   A ringbuffer for one writer thread and one reader thread on different
+   cores, for streams of many small records.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+   Unlike jack_ringbuffer_t, the write and read positions live on
+   separate cache lines, each next to its owner's copy of the other
+   side's position. The writer only looks at the reader's position
+   (and so only pulls in the reader's cache line) when its copy says
+   there is not enough room, and likewise for the reader. Positions
+   run freely and are masked on use, so the whole buffer can be
+   filled. Publishing a position is a release store and looking at
+   the other side's is an acquire load, so the data copied before a
+   position moves is visible to the other thread once it sees the new
+   position.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef USE_MLOCK
+#include <sys/mman.h>
+#endif /* USE_MLOCK */
+
+#include "internal.h"
+
+#define JACK_CACHE_LINE 64
+
+struct _jack_spsc_ringbuffer {
+	/* set at creation, then only read */
+	char *buf;
+	size_t size;
+	size_t size_mask;
+	int mlocked;
+
+	/* the writer's line */
+	size_t write_ptr __attribute__((aligned(JACK_CACHE_LINE)));
+	size_t read_cache;
+
+	/* the reader's line */
+	size_t read_ptr __attribute__((aligned(JACK_CACHE_LINE)));
+	size_t write_cache;
+};
+
+static void *
+jack_spsc_alloc (size_t size)
+{
+#ifdef HAVE_POSIX_MEMALIGN
+	void *p;
+
+	if (posix_memalign (&p, JACK_CACHE_LINE, size)) {
+		return NULL;
+	}
+	return p;
+#else
+	return malloc (size);
+#endif
+}
+
+/* Create a new ringbuffer to hold at least `sz' bytes of data. The
+   actual buffer size is rounded up to the next power of two.  */
+
+jack_spsc_ringbuffer_t *
+jack_spsc_ringbuffer_create (size_t sz)
+{
+	jack_spsc_ringbuffer_t *rb;
+	size_t size;
+
+	if ((rb = jack_spsc_alloc (sizeof(jack_spsc_ringbuffer_t))) == NULL) {
+		return NULL;
+	}
+
+	memset (rb, 0, sizeof(*rb));
+
+	for (size = 1; size < sz; size <<= 1) ;
+
+	rb->size = size;
+	rb->size_mask = size - 1;
+
+	if ((rb->buf = jack_spsc_alloc (size)) == NULL) {
+		free (rb);
+		return NULL;
+	}
+
+	return rb;
+}
+
+void
+jack_spsc_ringbuffer_free (jack_spsc_ringbuffer_t *rb)
+{
+#ifdef USE_MLOCK
+	if (rb->mlocked) {
+		munlock (rb->buf, rb->size);
+	}
+#endif  /* USE_MLOCK */
+	free (rb->buf);
+	free (rb);
+}
+
+int
+jack_spsc_ringbuffer_mlock (jack_spsc_ringbuffer_t *rb)
+{
+#ifdef USE_MLOCK
+	if (mlock (rb->buf, rb->size)) {
+		return -1;
+	}
+#endif  /* USE_MLOCK */
+	rb->mlocked = 1;
+	return 0;
+}
+
+/* Empty the ringbuffer. This is not thread safe. */
+
+void
+jack_spsc_ringbuffer_reset (jack_spsc_ringbuffer_t *rb)
+{
+	rb->write_ptr = rb->read_cache = 0;
+	rb->read_ptr = rb->write_cache = 0;
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+}
+
+/* writer side */
+
+/* bytes free, looking at the reader's position only if our copy of it
+   leaves less than `want' */
+static inline size_t
+jack_spsc_write_avail (jack_spsc_ringbuffer_t *rb, size_t want)
+{
+	size_t w = rb->write_ptr;
+	size_t avail = rb->size - (w - rb->read_cache);
+
+	if (avail < want) {
+		rb->read_cache = __atomic_load_n (&rb->read_ptr, __ATOMIC_ACQUIRE);
+		avail = rb->size - (w - rb->read_cache);
+	}
+
+	return avail;
+}
+
+static inline void
+jack_spsc_copy_in (jack_spsc_ringbuffer_t *rb, const char *src, size_t cnt)
+{
+	size_t w = rb->write_ptr & rb->size_mask;
+	size_t n1 = rb->size - w;
+
+	if (n1 >= cnt) {
+		memcpy (rb->buf + w, src, cnt);
+	} else {
+		memcpy (rb->buf + w, src, n1);
+		memcpy (rb->buf, src + n1, cnt - n1);
+	}
+}
+
+size_t
+jack_spsc_ringbuffer_write_space (jack_spsc_ringbuffer_t *rb)
+{
+	return jack_spsc_write_avail (rb, rb->size);
+}
+
+size_t
+jack_spsc_ringbuffer_write (jack_spsc_ringbuffer_t *rb, const char *src,
+			    size_t cnt)
+{
+	size_t avail = jack_spsc_write_avail (rb, cnt);
+
+	if (cnt > avail) {
+		cnt = avail;
+	}
+
+	if (cnt) {
+		jack_spsc_copy_in (rb, src, cnt);
+		__atomic_store_n (&rb->write_ptr, rb->write_ptr + cnt,
+				  __ATOMIC_RELEASE);
+	}
+
+	return cnt;
+}
+
+/* Write as many of the `n' records of `size' bytes at `src' as there
+   is room for, all at once. Returns the number of records written;
+   a record is never split between calls. */
+
+size_t
+jack_spsc_ringbuffer_write_records (jack_spsc_ringbuffer_t *rb,
+				    const void *src, size_t size, size_t n)
+{
+	size_t avail;
+
+	if (size == 0 || n == 0) {
+		return 0;
+	}
+
+	avail = jack_spsc_write_avail (rb, n * size) / size;
+
+	if (n > avail) {
+		n = avail;
+	}
+
+	if (n) {
+		jack_spsc_copy_in (rb, (const char*)src, n * size);
+		__atomic_store_n (&rb->write_ptr, rb->write_ptr + n * size,
+				  __ATOMIC_RELEASE);
+	}
+
+	return n;
+}
+
+void
+jack_spsc_ringbuffer_write_advance (jack_spsc_ringbuffer_t *rb, size_t cnt)
+{
+	__atomic_store_n (&rb->write_ptr, rb->write_ptr + cnt, __ATOMIC_RELEASE);
+}
+
+void
+jack_spsc_ringbuffer_get_write_vector (jack_spsc_ringbuffer_t *rb,
+				       jack_ringbuffer_data_t *vec)
+{
+	size_t avail = jack_spsc_write_avail (rb, rb->size);
+	size_t w = rb->write_ptr & rb->size_mask;
+	size_t n1 = rb->size - w;
+
+	vec[0].buf = rb->buf + w;
+	vec[1].buf = rb->buf;
+
+	if (avail > n1) {
+		vec[0].len = n1;
+		vec[1].len = avail - n1;
+	} else {
+		vec[0].len = avail;
+		vec[1].len = 0;
+	}
+}
+
+/* reader side */
+
+static inline size_t
+jack_spsc_read_avail (jack_spsc_ringbuffer_t *rb, size_t want)
+{
+	size_t r = rb->read_ptr;
+	size_t avail = rb->write_cache - r;
+
+	if (avail < want) {
+		rb->write_cache = __atomic_load_n (&rb->write_ptr, __ATOMIC_ACQUIRE);
+		avail = rb->write_cache - r;
+	}
+
+	return avail;
+}
+
+static inline void
+jack_spsc_copy_out (jack_spsc_ringbuffer_t *rb, char *dest, size_t cnt)
+{
+	size_t r = rb->read_ptr & rb->size_mask;
+	size_t n1 = rb->size - r;
+
+	if (n1 >= cnt) {
+		memcpy (dest, rb->buf + r, cnt);
+	} else {
+		memcpy (dest, rb->buf + r, n1);
+		memcpy (dest + n1, rb->buf, cnt - n1);
+	}
+}
+
+size_t
+jack_spsc_ringbuffer_read_space (jack_spsc_ringbuffer_t *rb)
+{
+	return jack_spsc_read_avail (rb, rb->size);
+}
+
+size_t
+jack_spsc_ringbuffer_read (jack_spsc_ringbuffer_t *rb, char *dest, size_t cnt)
+{
+	size_t avail = jack_spsc_read_avail (rb, cnt);
+
+	if (cnt > avail) {
+		cnt = avail;
+	}
+
+	if (cnt) {
+		jack_spsc_copy_out (rb, dest, cnt);
+		__atomic_store_n (&rb->read_ptr, rb->read_ptr + cnt,
+				  __ATOMIC_RELEASE);
+	}
+
+	return cnt;
+}
+
+/* Copy at most `cnt' bytes to `dest' without consuming them. */
+
+size_t
+jack_spsc_ringbuffer_peek (jack_spsc_ringbuffer_t *rb, char *dest, size_t cnt)
+{
+	size_t avail = jack_spsc_read_avail (rb, cnt);
+
+	if (cnt > avail) {
+		cnt = avail;
+	}
+
+	if (cnt) {
+		jack_spsc_copy_out (rb, dest, cnt);
+	}
+
+	return cnt;
+}
+
+/* Read as many of `n' records of `size' bytes into `dest' as are
+   complete in the buffer. Returns the number of records read. */
+
+size_t
+jack_spsc_ringbuffer_read_records (jack_spsc_ringbuffer_t *rb, void *dest,
+				   size_t size, size_t n)
+{
+	size_t avail;
+
+	if (size == 0 || n == 0) {
+		return 0;
+	}
+
+	avail = jack_spsc_read_avail (rb, n * size) / size;
+
+	if (n > avail) {
+		n = avail;
+	}
+
+	if (n) {
+		jack_spsc_copy_out (rb, (char*)dest, n * size);
+		__atomic_store_n (&rb->read_ptr, rb->read_ptr + n * size,
+				  __ATOMIC_RELEASE);
+	}
+
+	return n;
+}
+
+void
+jack_spsc_ringbuffer_read_advance (jack_spsc_ringbuffer_t *rb, size_t cnt)
+{
+	__atomic_store_n (&rb->read_ptr, rb->read_ptr + cnt, __ATOMIC_RELEASE);
+}
+
+void
+jack_spsc_ringbuffer_get_read_vector (jack_spsc_ringbuffer_t *rb,
+				      jack_ringbuffer_data_t *vec)
+{
+	size_t avail = jack_spsc_read_avail (rb, rb->size);
+	size_t r = rb->read_ptr & rb->size_mask;
+	size_t n1 = rb->size - r;
+
+	vec[0].buf = rb->buf + r;
+	vec[1].buf = rb->buf;
+
+	if (avail > n1) {
+		vec[0].len = n1;
+		vec[1].len = avail - n1;
+	} else {
+		vec[0].len = avail;
+		vec[1].len = 0;
+	}
+}
@@ -21,6 +21,9 @@
 
  */
 
+/* for pthread_setaffinity_np() and the CPU_* macros */
+#define _GNU_SOURCE
+
 #include <config.h>
 
 #include <jack/jack.h>
@@ -31,10 +34,23 @@
 #include <pthread.h>
 #include <sched.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#endif
 
 #include "local.h"
+#include "unlock.h"
+#include "cpufeatures.h"
 
 #ifdef JACK_USE_MACH_THREADS
 #include <sysdeps/pThreadUtilities.h>
@@ -101,6 +117,180 @@ maybe_get_capabilities (jack_client_t* client)
 #endif  /* USE_CAPABILITIES */
 }
 
+/* CPU affinity */
+
+static char jack_rt_cpus[JACK_CPU_LIST_SIZE];
+
+void
+jack_set_realtime_cpus (const char *cpus)
+{
+	if (cpus == NULL) {
+		jack_rt_cpus[0] = '\0';
+	} else {
+		snprintf (jack_rt_cpus, sizeof(jack_rt_cpus), "%s", cpus);
+	}
+}
+
+const char *
+jack_realtime_cpus (void)
+{
+	return jack_rt_cpus;
+}
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+
+static int
+jack_cpu_list_parse (const char *cpus, cpu_set_t *set)
+{
+	const char *p = cpus;
+	char *end;
+	long first, last;
+
+	CPU_ZERO (set);
+
+	while (*p && *p != '\n') {
+		first = strtol (p, &end, 10);
+		if (end == p || first < 0) {
+			return -1;
+		}
+		p = end;
+		last = first;
+		if (*p == '-') {
+			last = strtol (p + 1, &end, 10);
+			if (end == p + 1 || last < first) {
+				return -1;
+			}
+			p = end;
+		}
+		for (; first <= last && first < CPU_SETSIZE; ++first) {
+			CPU_SET (first, set);
+		}
+		if (*p == ',') {
+			p++;
+		} else if (*p && *p != '\n') {
+			return -1;
+		}
+	}
+
+	return CPU_COUNT (set) ? 0 : -1;
+}
+
+int
+jack_thread_set_cpus (pthread_t thread, const char *cpus)
+{
+	cpu_set_t set;
+	int x;
+
+	if (cpus == NULL || *cpus == '\0') {
+		return 0;
+	}
+
+	if (jack_cpu_list_parse (cpus, &set)) {
+		jack_error ("invalid CPU list \"%s\"", cpus);
+		return -1;
+	}
+
+	if ((x = pthread_setaffinity_np (thread, sizeof(set), &set)) != 0) {
+		jack_error ("cannot place thread on CPUs %s (%s)",
+			    cpus, strerror (x));
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+jack_cpu_list_nth (const char *cpus, unsigned int n)
+{
+	cpu_set_t set;
+	int cpu;
+
+	if (cpus == NULL || *cpus == '\0' || jack_cpu_list_parse (cpus, &set)) {
+		return -1;
+	}
+
+	n %= CPU_COUNT (&set);
+
+	for (cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+		if (CPU_ISSET (cpu, &set) && n-- == 0) {
+			return cpu;
+		}
+	}
+
+	return -1;
+}
+
+/* the CPUs taken out of general scheduling with isolcpus=, or NULL */
+const char *
+jack_isolated_cpus (void)
+{
+	static char cpus[JACK_CPU_LIST_SIZE];
+	FILE *f;
+
+	if ((f = fopen ("/sys/devices/system/cpu/isolated", "r")) == NULL) {
+		return NULL;
+	}
+
+	if (fgets (cpus, sizeof(cpus), f) == NULL) {
+		cpus[0] = '\0';
+	}
+
+	fclose (f);
+
+	cpus[strcspn (cpus, "\n")] = '\0';
+
+	return cpus[0] ? cpus : NULL;
+}
+
+#else /* !HAVE_PTHREAD_SETAFFINITY_NP */
+
+int
+jack_thread_set_cpus (pthread_t thread, const char *cpus)
+{
+	if (cpus == NULL || *cpus == '\0') {
+		return 0;
+	}
+
+	jack_error ("CPU affinity is not supported on this platform");
+	return -1;
+}
+
+int
+jack_cpu_list_nth (const char *cpus, unsigned int n)
+{
+	return -1;
+}
+
+const char *
+jack_isolated_cpus (void)
+{
+	return NULL;
+}
+
+#endif /* HAVE_PTHREAD_SETAFFINITY_NP */
+
+/* where a realtime thread created for client should run */
+static const char *
+jack_thread_cpus (jack_client_t *client)
+{
+	const char *cpus;
+
+	if (client == NULL || client->control == NULL
+	    || client->control->type != ClientExternal) {
+		return jack_rt_cpus;
+	}
+
+	if (client->process_cpus[0]) {
+		return client->process_cpus;
+	}
+
+	if ((cpus = getenv ("JACK_PROCESS_CPUS")) != NULL) {
+		return cpus;
+	}
+
+	return client->engine ? client->engine->client_cpus : NULL;
+}
+
 static void
 jack_thread_touch_stack ()
 {
@@ -124,11 +314,21 @@ jack_thread_proxy (void* varg)
 	void* warg;
 	jack_client_t* client = arg->client;
 
+	jack_denormals_apply ();
+
 	if (arg->realtime) {
 		ptr_jack_thread_touch_stack ();
+		jack_mlock_thread_stack ();
 		maybe_get_capabilities (client);
 		jack_acquire_real_time_scheduling (pthread_self (), arg->priority);
+		jack_thread_set_cpus (pthread_self (), jack_thread_cpus (client));
+	}
+
+#ifdef JACK_USE_OS_WORKGROUP
+	if (arg->workgroup) {
+		jack_workgroup_join (client);
 	}
+#endif
 
 	warg = arg->arg;
 	work = arg->work_function;
@@ -148,16 +348,38 @@ jack_client_create_thread (jack_client_t* client,
 {
 #ifndef JACK_USE_MACH_THREADS
 	pthread_attr_t attr;
-	jack_thread_arg_t* thread_args;
 #endif  /* !JACK_USE_MACH_THREADS */
+	jack_thread_arg_t* thread_args;
 
 	int result = 0;
 
 	if (!realtime) {
-		result = jack_thread_creator (thread, 0, start_routine, arg);
+		if (jack_get_denormal_policy () == 0) {
+			result = jack_thread_creator (thread, 0, start_routine, arg);
+			if (result) {
+				log_result ("creating thread with default parameters",
+					    result);
+			}
+			return result;
+		}
+
+		/* through the proxy only to set the denormal mode */
+		if ((thread_args = (jack_thread_arg_t*)malloc (sizeof(jack_thread_arg_t))) == NULL) {
+			return -1;
+		}
+
+		thread_args->client = client;
+		thread_args->work_function = start_routine;
+		thread_args->arg = arg;
+		thread_args->realtime = 0;
+		thread_args->priority = priority;
+		thread_args->workgroup = 0;
+
+		result = jack_thread_creator (thread, 0, jack_thread_proxy, thread_args);
 		if (result) {
 			log_result ("creating thread with default parameters",
 				    result);
+			free (thread_args);
 		}
 		return result;
 	}
@@ -205,6 +427,7 @@ jack_client_create_thread (jack_client_t* client,
 	thread_args->arg = arg;
 	thread_args->realtime = 1;
 	thread_args->priority = priority;
+	thread_args->workgroup = 0;
 
 	result = jack_thread_creator (thread, &attr, jack_thread_proxy, thread_args);
 	if (result) {
@@ -214,9 +437,23 @@ jack_client_create_thread (jack_client_t* client,
 
 #else   /* JACK_USE_MACH_THREADS */
 
-	result = jack_thread_creator (thread, 0, start_routine, arg);
+	/* through the proxy only to join the audio device's workgroup;
+	   the priority is set from here */
+	if ((thread_args = (jack_thread_arg_t*)malloc (sizeof(jack_thread_arg_t))) == NULL) {
+		return -1;
+	}
+
+	thread_args->client = client;
+	thread_args->work_function = start_routine;
+	thread_args->arg = arg;
+	thread_args->realtime = 0;
+	thread_args->priority = priority;
+	thread_args->workgroup = 1;
+
+	result = jack_thread_creator (thread, 0, jack_thread_proxy, thread_args);
 	if (result) {
 		log_result ("creating realtime thread", result);
+		free (thread_args);
 		return result;
 	}
 
@@ -307,3 +544,311 @@ jack_acquire_real_time_scheduling (pthread_t thread, int priority)
 
 #endif /* JACK_USE_MACH_THREADS */
 
+/* SCHED_DEADLINE (Linux 3.14 and later). glibc has no wrapper for
+ * sched_setattr(2), so the call is made directly. It can only be
+ * applied to the calling thread, since there is no portable way to
+ * get the kernel thread id of another pthread.
+ */
+
+#if defined(__linux__) && defined(SYS_sched_setattr)
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+#ifndef SCHED_FLAG_RESET_ON_FORK
+#define SCHED_FLAG_RESET_ON_FORK 0x01
+#endif
+
+struct jack_sched_attr {
+	uint32_t size;
+	uint32_t sched_policy;
+	uint64_t sched_flags;
+	int32_t sched_nice;
+	uint32_t sched_priority;
+	uint64_t sched_runtime;         /* all three in nsecs */
+	uint64_t sched_deadline;
+	uint64_t sched_period;
+};
+
+int
+jack_acquire_deadline_scheduling (jack_time_t runtime, jack_time_t period)
+{
+	struct jack_sched_attr attr;
+
+	memset (&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.sched_policy = SCHED_DEADLINE;
+	attr.sched_flags = SCHED_FLAG_RESET_ON_FORK;
+	attr.sched_runtime = runtime * 1000;
+	attr.sched_deadline = period * 1000;
+	attr.sched_period = period * 1000;
+
+	if (syscall (SYS_sched_setattr, 0, &attr, 0) != 0) {
+		return errno;
+	}
+
+	return 0;
+}
+
+#else /* no sched_setattr */
+
+int
+jack_acquire_deadline_scheduling (jack_time_t runtime, jack_time_t period)
+{
+	return ENOSYS;
+}
+
+#endif
+
+/* the budget for a thread whose longest recent cycle took max_usecs:
+   half as much again for safety, but never less than a tenth of the
+   period nor so much that other threads are shut out.
+ */
+static jack_time_t
+jack_deadline_runtime (jack_time_t max_usecs, jack_time_t period)
+{
+	jack_time_t runtime = max_usecs + max_usecs / 2;
+
+	if (runtime < period / 10) {
+		runtime = period / 10;
+	}
+	if (runtime > period - period / 20) {
+		runtime = period - period / 20;
+	}
+
+	return runtime;
+}
+
+void
+jack_deadline_sample (jack_deadline_t *dl, jack_time_t usecs,
+		      jack_time_t period)
+{
+	jack_time_t runtime;
+	int x;
+
+	if (dl->refused || period == 0) {
+		return;
+	}
+
+	if (usecs > dl->max_usecs) {
+		dl->max_usecs = usecs;
+	}
+
+	if (++dl->cycles < JACK_DEADLINE_WINDOW) {
+		return;
+	}
+
+	runtime = jack_deadline_runtime (dl->max_usecs, period);
+	dl->cycles = 0;
+	dl->max_usecs = 0;
+
+	/* leave the budget alone unless it is off by more than 1/8 */
+
+	if (dl->period == period
+	    && runtime < dl->runtime + dl->runtime / 8
+	    && runtime + runtime / 8 > dl->runtime) {
+		return;
+	}
+
+	if ((x = jack_acquire_deadline_scheduling (runtime, period)) != 0) {
+		/* EBUSY when admission control finds no room, EPERM when
+		   the thread is restricted to some CPUs or lacks the
+		   privilege, ENOSYS on kernels before 3.14
+		 */
+		if (dl->period == 0) {
+			jack_error ("cannot use SCHED_DEADLINE (runtime %"
+				    PRIu64 " period %" PRIu64 " usecs): %s; "
+				    "staying with SCHED_FIFO",
+				    runtime, period, strerror (x));
+			dl->refused = 1;
+		}
+		/* otherwise keep the budget we already have */
+		return;
+	}
+
+	dl->period = period;
+	dl->runtime = runtime;
+}
+
+void
+jack_perf_counters_init (jack_perf_counters_t *pc)
+{
+	int i;
+
+	for (i = 0; i < JACK_PERF_COUNTERS; i++)
+		pc->fd[i] = -1;
+	memset (pc->start, 0, sizeof(pc->start));
+	pc->refused = 0;
+	memset (pc->rusage_start, 0, sizeof(pc->rusage_start));
+}
+
+/* Faults and involuntary switches so far of the calling thread, in
+ * the order of jack_perf_counters_t.rusage_start[]; -1 if the system
+ * cannot tell them per thread.
+ */
+static int
+jack_perf_rusage_read (long *values)
+{
+#ifdef RUSAGE_THREAD
+	struct rusage ru;
+
+	if (getrusage (RUSAGE_THREAD, &ru) == 0) {
+		values[0] = ru.ru_minflt;
+		values[1] = ru.ru_majflt;
+		values[2] = ru.ru_nivcsw;
+		return 0;
+	}
+#endif
+	return -1;
+}
+
+static void
+jack_perf_rusage_start (jack_perf_counters_t *pc)
+{
+	jack_perf_rusage_read (pc->rusage_start);
+}
+
+static void
+jack_perf_rusage_stop (jack_perf_counters_t *pc, jack_client_control_t *ctl)
+{
+	long now[JACK_PERF_RUSAGE];
+
+	if (jack_perf_rusage_read (now)) {
+		return;
+	}
+
+	ctl->minor_faults = now[0] - pc->rusage_start[0];
+	ctl->major_faults = now[1] - pc->rusage_start[1];
+	ctl->involuntary_switches = now[2] - pc->rusage_start[2];
+	ctl->fault_counts = 1;
+}
+
+#if defined(HAVE_LINUX_PERF_EVENT_H) && defined(SYS_perf_event_open)
+
+/* the order of jack_perf_counters_t.fd[] and of the values read */
+static const uint64_t jack_perf_events[JACK_PERF_COUNTERS] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES,     /* last level, on most CPUs */
+};
+
+typedef struct {
+	uint64_t nr;
+	uint64_t values[JACK_PERF_COUNTERS];
+} jack_perf_group_read_t;
+
+/* Open the group for the calling thread. */
+int
+jack_perf_counters_open (jack_perf_counters_t *pc)
+{
+	struct perf_event_attr attr;
+	int i;
+
+	if (pc->refused) {
+		return -1;
+	}
+
+	for (i = 0; i < JACK_PERF_COUNTERS; i++) {
+		memset (&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = jack_perf_events[i];
+		attr.read_format = PERF_FORMAT_GROUP;
+		attr.disabled = (i == 0);
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+
+		pc->fd[i] = syscall (SYS_perf_event_open, &attr, 0, -1,
+				     i ? pc->fd[0] : -1, 0);
+		if (pc->fd[i] < 0) {
+			jack_error ("cannot use hardware performance counters"
+				    " (%s); going without", strerror (errno));
+			jack_perf_counters_close (pc);
+			pc->refused = 1;
+			return -1;
+		}
+		fcntl (pc->fd[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	ioctl (pc->fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+	return 0;
+}
+
+void
+jack_perf_counters_close (jack_perf_counters_t *pc)
+{
+	int i;
+
+	for (i = JACK_PERF_COUNTERS - 1; i >= 0; i--) {
+		if (pc->fd[i] >= 0) {
+			close (pc->fd[i]);
+			pc->fd[i] = -1;
+		}
+	}
+}
+
+/* One read(2) of the whole group, at the start of a callback and one
+ * at the end; the counters keep running in between.  Without a group,
+ * only the page faults and context switches.
+ */
+void
+jack_perf_counters_start (jack_perf_counters_t *pc)
+{
+	jack_perf_group_read_t r;
+
+	if (pc->fd[0] >= 0 && read (pc->fd[0], &r, sizeof(r)) == sizeof(r)) {
+		memcpy (pc->start, r.values, sizeof(pc->start));
+	}
+
+	jack_perf_rusage_start (pc);
+}
+
+void
+jack_perf_counters_stop (jack_perf_counters_t *pc, jack_client_control_t *ctl)
+{
+	jack_perf_group_read_t r;
+
+	jack_perf_rusage_stop (pc, ctl);
+
+	if (pc->fd[0] < 0 || read (pc->fd[0], &r, sizeof(r)) != sizeof(r)) {
+		ctl->perf_cycles = 0;
+		return;
+	}
+
+	ctl->perf_cycles = r.values[0] - pc->start[0];
+	ctl->perf_instructions = r.values[1] - pc->start[1];
+	ctl->perf_llc_misses = r.values[2] - pc->start[2];
+}
+
+#else /* no perf_event */
+
+int
+jack_perf_counters_open (jack_perf_counters_t *pc)
+{
+	if (!pc->refused) {
+		jack_error ("hardware performance counters are not "
+			    "supported on this system");
+		pc->refused = 1;
+	}
+	return -1;
+}
+
+void
+jack_perf_counters_close (jack_perf_counters_t *pc)
+{
+}
+
+void
+jack_perf_counters_start (jack_perf_counters_t *pc)
+{
+	jack_perf_rusage_start (pc);
+}
+
+void
+jack_perf_counters_stop (jack_perf_counters_t *pc, jack_client_control_t *ctl)
+{
+	jack_perf_rusage_stop (pc, ctl);
+}
+
+#endif /* HAVE_LINUX_PERF_EVENT_H */
@@ -47,6 +47,8 @@ jack_clock_source_name (jack_timer_type_t src)
 	switch (src) {
 	case JACK_TIMER_HPET:
 		return "hpet";
+	case JACK_TIMER_CYCLE_COUNTER:
+		return "cycle counter";
 	case JACK_TIMER_SYSTEM_CLOCK:
 #ifdef HAVE_CLOCK_GETTIME
 		return "system clock via clock_gettime";
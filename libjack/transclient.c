@@ -24,6 +24,7 @@
 #include <errno.h>
 #include <math.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <jack/uuid.h>
 
@@ -45,6 +46,8 @@ jack_generate_unique_id (jack_control_t *ectl)
 static inline void
 jack_read_frame_time (const jack_client_t *client, jack_frame_timer_t *copy)
 {
+	const jack_frame_timer_t *timer = &client->engine->frame_timer;
+	uint32_t guard;
 	int tries = 0;
 	long timeout = 1000;
 
@@ -71,11 +74,17 @@ jack_read_frame_time (const jack_client_t *client, jack_frame_timer_t *copy)
 			}
 		}
 
-		*copy = client->engine->frame_timer;
+		/* the engine bumps guard1, writes, then bumps guard2, so
+		   read them the other way round: a copy taken between the
+		   two reads saw no update if they are still equal */
+		guard = timer->guard2;
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+		*copy = *timer;
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
 
 		tries++;
 
-	} while (copy->guard1 != copy->guard2);
+	} while (timer->guard1 != guard);
 }
 
 /* copy a JACK transport position structure (thread-safe) */
@@ -106,6 +115,150 @@ jack_transport_copy_position (jack_position_t *from, jack_position_t *to)
 	} while (to->unique_1 != to->unique_2);
 }
 
+/* Read the transport snapshot the engine publishes each cycle (see
+ * jack_transport_publish() in transengine.c):
+ *
+ *	do {
+ *		seq = jack_transport_snapshot_begin (ectl, &snap);
+ *		... copy what is needed out of *snap ...
+ *	} while (jack_transport_snapshot_retry (ectl, seq));
+ *
+ * The engine only writes the slot that is not published, so a retry
+ * is needed only when it published a new position during the copy.
+ */
+static inline uint32_t
+jack_transport_snapshot_begin (jack_control_t *ectl,
+			       jack_transport_snapshot_t **snap)
+{
+	uint32_t seq = __atomic_load_n (&ectl->snapshot_seq, __ATOMIC_ACQUIRE);
+
+	*snap = &ectl->snapshot[seq & 1];
+	return seq;
+}
+
+static inline int
+jack_transport_snapshot_retry (jack_control_t *ectl, uint32_t seq)
+{
+	/* keep the copy from moving past the check */
+	__atomic_thread_fence (__ATOMIC_ACQUIRE);
+	return __atomic_load_n (&ectl->snapshot_seq, __ATOMIC_RELAXED) != seq;
+}
+
+/* Walk a tempo map up to the segment a frame, or a bar, is in.
+ *
+ * Every segment starts a new bar: the bar that the next segment cuts
+ * short, if any, still counts as a whole one. Starting on bar 1, tick
+ * 0, the segment's first bar and the ticks before it are added up
+ * from the segments before it, so the map stores nothing that depends
+ * on the sample rate.
+ *
+ * The map may be read while the engine rewrites it (the caller then
+ * tries again), so nothing here may trust its count.
+ */
+#define JACK_TEMPO_EPSILON 1e-9
+
+static const jack_tempo_segment_t *
+jack_tempo_map_find (const jack_tempo_map_t *map, jack_nframes_t frame_rate,
+		     jack_nframes_t frame, int32_t bar, int32_t *seg_bar,
+		     double *seg_tick, double *frames_per_beat)
+{
+	const jack_tempo_segment_t *seg = map->segment;
+	uint32_t count = map->count;
+	uint32_t i;
+	double bars;
+
+	if (count > JACK_TEMPO_MAP_MAX) {
+		count = JACK_TEMPO_MAP_MAX;
+	}
+	if (count == 0 || frame_rate == 0) {
+		return NULL;
+	}
+
+	*seg_bar = 1;
+	*seg_tick = 0.0;
+
+	for (i = 1; ; ++i, ++seg) {
+		*frames_per_beat = frame_rate * 60.0 / seg->beats_per_minute;
+		if (i == count || frame < seg[1].frame) {
+			break;
+		}
+		bars = ceil ((seg[1].frame - seg->frame) / *frames_per_beat
+			     / seg->beats_per_bar - JACK_TEMPO_EPSILON);
+		if (bar < *seg_bar + (int32_t)bars) {
+			break;
+		}
+		*seg_bar += (int32_t)bars;
+		*seg_tick += bars * seg->beats_per_bar * seg->ticks_per_beat;
+	}
+
+	return seg;
+}
+
+int
+jack_tempo_map_to_bbt (const jack_tempo_map_t *map, jack_nframes_t frame_rate,
+		       jack_nframes_t frame, jack_position_t *pos)
+{
+	const jack_tempo_segment_t *seg;
+	int32_t bar;
+	double tick, frames_per_beat, beats, bars;
+
+	if ((seg = jack_tempo_map_find (map, frame_rate, frame, INT32_MAX,
+					&bar, &tick, &frames_per_beat)) == NULL) {
+		return ENOENT;
+	}
+
+	beats = ((double)frame - seg->frame) / frames_per_beat;
+	if (beats < 0.0) {
+		beats = 0.0;
+	}
+	bars = floor (beats / seg->beats_per_bar);
+	beats -= bars * seg->beats_per_bar;
+	if (beats < 0.0) {
+		beats = 0.0;
+	}
+
+	pos->bar = bar + (int32_t)bars;
+	pos->beat = (int32_t)floor (beats) + 1;
+	pos->tick = (int32_t)((beats - floor (beats)) * seg->ticks_per_beat);
+	pos->bar_start_tick = tick + bars * seg->beats_per_bar
+			      * seg->ticks_per_beat;
+	pos->beats_per_bar = seg->beats_per_bar;
+	pos->beat_type = seg->beat_type;
+	pos->ticks_per_beat = seg->ticks_per_beat;
+	pos->beats_per_minute = seg->beats_per_minute;
+	pos->valid |= JackPositionBBT;
+
+	return 0;
+}
+
+int
+jack_tempo_map_to_frame (const jack_tempo_map_t *map,
+			 jack_nframes_t frame_rate,
+			 const jack_position_t *pos, jack_nframes_t *frame)
+{
+	const jack_tempo_segment_t *seg;
+	int32_t bar;
+	double tick, frames_per_beat, beats, f;
+
+	if ((seg = jack_tempo_map_find (map, frame_rate, UINT32_MAX, pos->bar,
+					&bar, &tick, &frames_per_beat)) == NULL) {
+		return ENOENT;
+	}
+	if (pos->bar < 1 || pos->beat < 1 || pos->tick < 0) {
+		return ERANGE;
+	}
+
+	beats = (double)(pos->bar - bar) * seg->beats_per_bar
+		+ (pos->beat - 1) + pos->tick / seg->ticks_per_beat;
+	f = floor (seg->frame + beats * frames_per_beat + 0.5);
+	if (f > (double)UINT32_MAX) {
+		return ERANGE;
+	}
+
+	*frame = (jack_nframes_t)f;
+	return 0;
+}
+
 static inline int
 jack_transport_request_new_pos (jack_client_t *client, jack_position_t *pos)
 {
@@ -151,6 +304,21 @@ jack_call_sync_client (jack_client_t *client)
 	}
 }
 
+/* on SyncPrepare event, in the client thread */
+void
+jack_call_sync_prepare (jack_client_t *client, const jack_event_t *event)
+{
+	jack_client_control_t *control = client->control;
+
+	if (control->sync_prepare_cbset &&
+	    client->sync_prepare_cb (&event->z.position,
+				     client->sync_prepare_arg)) {
+		/* the engine won't wait for us if the transport
+		 * starts at this position */
+		control->sync_prepared = event->z.position.unique_1;
+	}
+}
+
 void
 jack_call_timebase_master (jack_client_t *client)
 {
@@ -194,34 +362,43 @@ jack_call_timebase_master (jack_client_t *client)
 jack_nframes_t
 jack_get_current_transport_frame (const jack_client_t *client)
 {
-	jack_position_t position;
+	jack_control_t *ectl = client->engine;
+	jack_transport_snapshot_t *snap;
+	jack_nframes_t frame, frame_rate;
+	jack_time_t start_usecs;
+	jack_transport_state_t tstate;
+	uint32_t seq;
 	float usecs;
 	jack_nframes_t elapsed;
-	jack_transport_state_t tstate;
 
-	/* get the current transport position information.
-	   this is thread-safe and atomic with respect
-	   to the structure contents.
+	/* read just the fields we need from the published snapshot.
+	   this is thread-safe and atomic with respect to them.
 	 */
 
-	tstate = jack_transport_query (client, &position);
+	do {
+		seq = jack_transport_snapshot_begin (ectl, &snap);
+		frame = snap->position.frame;
+		frame_rate = snap->position.frame_rate;
+		start_usecs = snap->position.usecs;
+		tstate = snap->state;
+	} while (jack_transport_snapshot_retry (ectl, seq));
 
 	if (tstate != JackTransportRolling) {
-		return position.frame;
+		return frame;
 	}
 
 	/* compute the elapsed usecs then audio frames since
 	   the transport info was last updated
 	 */
 
-	usecs = jack_get_microseconds () - position.usecs;
-	elapsed = (jack_nframes_t)floor ((((float)position.frame_rate)
+	usecs = jack_get_microseconds () - start_usecs;
+	elapsed = (jack_nframes_t)floor ((((float)frame_rate)
 					  / 1000000.0f) * usecs);
 
 	/* return the estimated transport frame position
 	 */
 
-	return position.frame + elapsed;
+	return frame + elapsed;
 }
 
 jack_nframes_t
@@ -400,6 +577,21 @@ jack_set_sync_callback (jack_client_t *client,
 	return rc;
 }
 
+int
+jack_set_sync_prepare_callback (jack_client_t *client,
+				JackSyncPrepareCallback prepare_callback,
+				void *arg)
+{
+	if (client->control->active) {
+		jack_error ("You cannot set callbacks on an active client.");
+		return -1;
+	}
+	client->sync_prepare_cb = prepare_callback;
+	client->sync_prepare_arg = arg;
+	client->control->sync_prepare_cbset = (prepare_callback != NULL);
+	return 0;
+}
+
 int
 jack_set_sync_timeout (jack_client_t *client, jack_time_t usecs)
 {
@@ -450,15 +642,41 @@ jack_transport_state_t
 jack_transport_query (const jack_client_t *client, jack_position_t *pos)
 {
 	jack_control_t *ectl = client->engine;
+	jack_transport_snapshot_t *snap;
+	jack_transport_state_t tstate;
+	uint32_t seq;
 
-	if (pos) {
-		/* the guarded copy makes this function work in any
-		 * thread
-		 */
-		jack_transport_copy_position (&ectl->current_time, pos);
-	}
+	/* the snapshot makes this function work in any thread, and
+	 * the state always goes with the position
+	 */
+	do {
+		seq = jack_transport_snapshot_begin (ectl, &snap);
+		if (pos) {
+			*pos = snap->position;
+		}
+		tstate = snap->state;
+	} while (jack_transport_snapshot_retry (ectl, seq));
+
+	return tstate;
+}
+
+jack_transport_state_t
+jack_transport_query_frame (const jack_client_t *client, jack_nframes_t *frame)
+{
+	jack_control_t *ectl = client->engine;
+	jack_transport_snapshot_t *snap;
+	jack_transport_state_t tstate;
+	uint32_t seq;
 
-	return ectl->transport_state;
+	do {
+		seq = jack_transport_snapshot_begin (ectl, &snap);
+		if (frame) {
+			*frame = snap->position.frame;
+		}
+		tstate = snap->state;
+	} while (jack_transport_snapshot_retry (ectl, seq));
+
+	return tstate;
 }
 
 int
@@ -475,6 +693,71 @@ jack_transport_reposition (jack_client_t *client, const jack_position_t *pos)
 	return jack_transport_request_new_pos (client, &tmp);
 }
 
+int
+jack_transport_set_tempo_map (jack_client_t *client,
+			      const jack_tempo_segment_t *segments,
+			      uint32_t count)
+{
+	jack_request_t req;
+
+	if (count > JACK_TEMPO_MAP_MAX) {
+		return EINVAL;
+	}
+
+	VALGRIND_MEMSET (&req, 0, sizeof(req));
+
+	req.type = SetTempoMap;
+	req.x.tempo_map.count = count;
+	if (count) {
+		memcpy (req.x.tempo_map.segment, segments,
+			count * sizeof(*segments));
+	}
+
+	return jack_client_deliver_request (client, &req);
+}
+
+/* The engine publishes the map like the transport snapshot: it only
+ * rewrites the slot tempo_map_seq does not select, so a conversion
+ * has to be done again only if the map changed while it ran.
+ */
+int
+jack_transport_frame_to_bbt (const jack_client_t *client,
+			     jack_nframes_t frame, jack_position_t *pos)
+{
+	jack_control_t *ectl = client->engine;
+	uint32_t seq;
+	int ret;
+
+	do {
+		seq = __atomic_load_n (&ectl->tempo_map_seq, __ATOMIC_ACQUIRE);
+		ret = jack_tempo_map_to_bbt (&ectl->tempo_map[seq & 1],
+					     ectl->current_time.frame_rate,
+					     frame, pos);
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n (&ectl->tempo_map_seq, __ATOMIC_RELAXED) != seq);
+
+	return ret;
+}
+
+int
+jack_transport_bbt_to_frame (const jack_client_t *client,
+			     const jack_position_t *pos, jack_nframes_t *frame)
+{
+	jack_control_t *ectl = client->engine;
+	uint32_t seq;
+	int ret;
+
+	do {
+		seq = __atomic_load_n (&ectl->tempo_map_seq, __ATOMIC_ACQUIRE);
+		ret = jack_tempo_map_to_frame (&ectl->tempo_map[seq & 1],
+					       ectl->current_time.frame_rate,
+					       pos, frame);
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n (&ectl->tempo_map_seq, __ATOMIC_RELAXED) != seq);
+
+	return ret;
+}
+
 void
 jack_transport_start (jack_client_t *client)
 {
@@ -18,10 +18,16 @@
 
  */
 
+/* for pthread_getattr_np() */
+#define _GNU_SOURCE
+
 #include <stdio.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <limits.h>
+#include <pthread.h>
 #include <sys/mman.h>
 
 #include "unlock.h"
@@ -127,3 +133,96 @@ cleanup_mlock ()
 }
 
 
+
+/* Selective locking.
+ *
+ * With JACK_MLOCK_SELECTIVE nothing is locked wholesale; instead the
+ * pieces the process cycle is known to touch are locked as they come
+ * into being: shared memory segments, the stacks of realtime threads,
+ * the RT pool and mixdown arenas, and whatever code the client
+ * registers with jack_lock_code_region().  Everything else (GUI
+ * toolkits, caches, the rest of the heap) stays pageable.
+ */
+
+int jack_mlock_mode = JACK_MLOCK_NONE;
+
+int
+jack_mlock_rt_region (const void *addr, size_t len, const char *what)
+{
+	uintptr_t page = (uintptr_t)sysconf (_SC_PAGESIZE);
+	uintptr_t start, end;
+
+	if (jack_mlock_mode != JACK_MLOCK_SELECTIVE || addr == NULL || len == 0) {
+		return 0;
+	}
+
+	start = (uintptr_t)addr & ~(page - 1);
+	end = ((uintptr_t)addr + len + page - 1) & ~(page - 1);
+
+	if (mlock ((void*)start, end - start) != 0) {
+		jack_error ("cannot lock down %s (%lu bytes: %s)", what,
+			    (unsigned long)(end - start), strerror (errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+jack_mlock_rt_shm (jack_shm_info_t *si, const char *what)
+{
+	return jack_mlock_rt_region (jack_shm_addr (si), jack_shm_size (si), what);
+}
+
+/* call from the thread whose stack is to be locked */
+int
+jack_mlock_thread_stack (void)
+{
+#ifdef __linux__
+	pthread_attr_t attr;
+	void *stack;
+	size_t size;
+	int rc;
+
+	if (jack_mlock_mode != JACK_MLOCK_SELECTIVE) {
+		return 0;
+	}
+
+	if (pthread_getattr_np (pthread_self (), &attr) != 0) {
+		return -1;
+	}
+	rc = pthread_attr_getstack (&attr, &stack, &size);
+	pthread_attr_destroy (&attr);
+
+	if (rc != 0) {
+		return -1;
+	}
+
+	return jack_mlock_rt_region (stack, size, "thread stack");
+#else
+	return 0;
+#endif
+}
+
+/* bytes of this process that are locked in memory, as the kernel
+   counts them, or 0 if that can't be known */
+size_t
+jack_mlock_footprint (void)
+{
+	FILE* status;
+	char line[128];
+	unsigned long kb = 0;
+
+	if ((status = fopen ("/proc/self/status", "r")) == NULL) {
+		return 0;
+	}
+
+	while (fgets (line, sizeof(line), status)) {
+		if (sscanf (line, "VmLck: %lu kB", &kb) == 1) {
+			break;
+		}
+	}
+
+	fclose (status);
+	return (size_t)kb * 1024;
+}
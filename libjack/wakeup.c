@@ -0,0 +1,166 @@
+/*
+ * wakeup.c -- passing control along the process graph without FIFOs.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation; either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+#include "internal.h"
+#include "atomicity.h"
+
+/* The words live in shared memory and are waited on from several
+ * processes, so the futex operations must not be the _PRIVATE kind.
+ *
+ * A waiter announces itself by adding JACK_WAKEUP_WAITING before it
+ * sleeps, which lets jack_wakeup_post() skip the wake syscall when
+ * nobody is sleeping. Everything is done with atomic adds, so there
+ * is no need for compare-and-swap on any platform we support.
+ */
+
+int
+jack_wakeup_supported (void)
+{
+#ifdef __linux__
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+const char*
+jack_wakeup_method_name (jack_wakeup_method_t method)
+{
+	switch (method) {
+	case JACK_WAKEUP_FIFO:
+		return "fifo";
+	case JACK_WAKEUP_FUTEX:
+		return "futex";
+	}
+	return "unknown";
+}
+
+#ifdef __linux__
+
+static inline int
+jack_futex (jack_wakeup_word_t *word, int op, int val,
+	    const struct timespec *timeout)
+{
+	return syscall (SYS_futex, word, op, val, timeout, NULL, 0);
+}
+
+void
+jack_wakeup_post (jack_wakeup_word_t *word, int what)
+{
+	if (exchange_and_add (word, what) & JACK_WAKEUP_WAITING) {
+		jack_futex (word, FUTEX_WAKE, 1, NULL);
+	}
+}
+
+int
+jack_wakeup_wait (jack_wakeup_word_t *word, jack_time_t usecs)
+{
+	jack_time_t deadline = jack_get_microseconds () + usecs;
+	jack_time_t now;
+	struct timespec timeout;
+	_Atomic_word old;
+	int got;
+
+	while (1) {
+
+		got = 0;
+		old = *word;
+
+		/* we are the only consumer, so nothing can take these
+		   away between the test and the subtraction */
+
+		if (old & JACK_WAKEUP_PROCESS_MASK) {
+			atomic_add (word, -JACK_WAKEUP_PROCESS);
+			got |= JACK_WAKEUP_PROCESS;
+		}
+
+		if (old & JACK_WAKEUP_EVENT_MASK) {
+			atomic_add (word, -JACK_WAKEUP_EVENT);
+			got |= JACK_WAKEUP_EVENT;
+		}
+
+		if (got) {
+			return got;
+		}
+
+		now = jack_get_microseconds ();
+
+		if (now >= deadline) {
+			return 0;
+		}
+
+		timeout.tv_sec = (deadline - now) / 1000000;
+		timeout.tv_nsec = ((deadline - now) % 1000000) * 1000;
+
+		old = exchange_and_add (word, JACK_WAKEUP_WAITING);
+
+		if ((old & ~JACK_WAKEUP_WAITING) == 0) {
+			if (jack_futex (word, FUTEX_WAIT,
+					old + JACK_WAKEUP_WAITING,
+					&timeout) < 0 &&
+			    errno != EAGAIN && errno != EINTR &&
+			    errno != ETIMEDOUT) {
+				atomic_add (word, -JACK_WAKEUP_WAITING);
+				return -1;
+			}
+		}
+
+		atomic_add (word, -JACK_WAKEUP_WAITING);
+	}
+}
+
+#else /* !__linux__ */
+
+void
+jack_wakeup_post (jack_wakeup_word_t *word, int what)
+{
+}
+
+int
+jack_wakeup_wait (jack_wakeup_word_t *word, jack_time_t usecs)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+#endif /* __linux__ */
+
+void
+jack_wakeup_clear (jack_wakeup_word_t *word)
+{
+	/* drop process() handoffs left over by aborted cycles. pending
+	   events are kept, their clients are still waiting for them. */
+
+	_Atomic_word pending = *word & JACK_WAKEUP_PROCESS_MASK;
+
+	if (pending) {
+		atomic_add (word, -pending);
+	}
+}
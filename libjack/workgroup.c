@@ -0,0 +1,205 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    Joining realtime threads to the audio device's workgroup on macOS.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+ */
+
+/* On Apple Silicon the scheduler only knows what deadline a realtime
+ * thread works to if the thread is in the audio device's IO workgroup.
+ * Otherwise it may run the thread on an efficiency core, and the
+ * cycle is late.  The CoreAudio driver's own IO thread is in the
+ * workgroup; this puts everything else that works in the cycle there
+ * too.
+ *
+ * jack_workgroup_publish() registers a port for the driver's
+ * workgroup with the bootstrap server, under a name it puts in the
+ * engine control block, and bumps workgroup_seq there.  A thread
+ * calling jack_workgroup_update() with a workgroup_seq it has not seen
+ * leaves the workgroup it is in and joins the current one.  The server's
+ * threads join the driver's workgroup directly.  A client process
+ * looks the name up once and makes its own workgroup from the port.
+ * Every other call is a compare of workgroup_seq.  The lookup happens
+ * only when the driver starts or stops, on whichever thread sees the
+ * change first.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <jack/jack.h>
+
+#include "internal.h"
+#include "local.h"
+
+#ifdef JACK_USE_OS_WORKGROUP
+
+#include <mach/mach.h>
+#include <servers/bootstrap.h>
+
+#define JACK_WORKGROUP_NAME "org.jackaudio.jack.device"
+
+static pthread_mutex_t workgroup_lock = PTHREAD_MUTEX_INITIALIZER;
+static os_workgroup_t workgroup;        /* of workgroup_seq, retained */
+static uint32_t workgroup_seq;
+static jack_control_t *workgroup_control; /* set if we published it */
+
+/* the calling thread's membership */
+static __thread os_workgroup_t joined;
+static __thread uint32_t joined_seq;
+static __thread os_workgroup_join_token_s joined_token;
+
+void
+jack_workgroup_publish (jack_control_t *control, os_workgroup_t wg)
+{
+	char name[sizeof(control->workgroup_name)];
+	mach_port_t bootstrap, port;
+	uint32_t seq;
+
+	if (__builtin_available (macOS 11.0, *)) {
+
+		pthread_mutex_lock (&workgroup_lock);
+
+		seq = control->workgroup_seq + 1;
+		name[0] = '\0';
+
+		if (wg) {
+			snprintf (name, sizeof(name), "JackWorkgroup_%d_%" PRIu32,
+				  (int)getpid (), seq);
+			if (os_workgroup_copy_port (wg, &port)
+			    || task_get_bootstrap_port (mach_task_self (), &bootstrap)
+			    || bootstrap_register (bootstrap, name, port)) {
+				jack_error ("cannot make the audio device's workgroup"
+					    " known to clients");
+				name[0] = '\0';
+			}
+		}
+
+		if (workgroup) {
+			os_release (workgroup);
+		}
+		if ((workgroup = wg)) {
+			os_retain (workgroup);
+		}
+		workgroup_seq = seq;
+		workgroup_control = control;
+
+		memcpy (control->workgroup_name, name, sizeof(name));
+		__atomic_store_n (&control->workgroup_seq, seq, __ATOMIC_RELEASE);
+
+		pthread_mutex_unlock (&workgroup_lock);
+	}
+}
+
+/* Make workgroup the one of seq. Call with workgroup_lock held. */
+static void API_AVAILABLE (macos (11.0))
+jack_workgroup_find (jack_control_t *control, uint32_t seq)
+{
+	char name[sizeof(control->workgroup_name)];
+	mach_port_t bootstrap, port;
+
+	if (workgroup_seq == seq || workgroup_control == control) {
+		return;
+	}
+
+	if (workgroup) {
+		os_release (workgroup);
+		workgroup = NULL;
+	}
+	workgroup_seq = seq;
+
+	memcpy (name, control->workgroup_name, sizeof(name));
+	name[sizeof(name) - 1] = '\0';
+	if (name[0] == '\0') {
+		return;
+	}
+
+	if (task_get_bootstrap_port (mach_task_self (), &bootstrap)
+	    || bootstrap_look_up (bootstrap, name, &port)) {
+		jack_error ("cannot find the audio device's workgroup %s", name);
+		return;
+	}
+
+	workgroup = os_workgroup_create_with_port (JACK_WORKGROUP_NAME, port);
+	mach_port_deallocate (mach_task_self (), port);
+
+	if (workgroup == NULL) {
+		jack_error ("cannot use the audio device's workgroup %s", name);
+	}
+}
+
+void
+jack_workgroup_update (jack_control_t *control)
+{
+	uint32_t seq = __atomic_load_n (&control->workgroup_seq,
+					__ATOMIC_ACQUIRE);
+	int rc;
+
+	if (seq == joined_seq) {
+		return;
+	}
+
+	if (__builtin_available (macOS 11.0, *)) {
+
+		if (joined) {
+			os_workgroup_leave (joined, &joined_token);
+			os_release (joined);
+			joined = NULL;
+		}
+		joined_seq = seq;
+
+		pthread_mutex_lock (&workgroup_lock);
+		jack_workgroup_find (control, seq);
+		if ((joined = workgroup)) {
+			os_retain (joined);
+		}
+		pthread_mutex_unlock (&workgroup_lock);
+
+		if (joined && (rc = os_workgroup_join (joined, &joined_token))) {
+			jack_error ("cannot join the audio device's workgroup (%s)",
+				    strerror (rc));
+			os_release (joined);
+			joined = NULL;
+		}
+	}
+}
+
+void
+jack_workgroup_join (jack_client_t *client)
+{
+	jack_control_t *control;
+
+	if (client) {
+		control = client->engine;
+	} else {
+		/* one of the server's own threads */
+		pthread_mutex_lock (&workgroup_lock);
+		control = workgroup_control;
+		pthread_mutex_unlock (&workgroup_lock);
+	}
+
+	if (control) {
+		jack_workgroup_update (control);
+	}
+}
+
+#endif /* JACK_USE_OS_WORKGROUP */
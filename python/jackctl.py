@@ -54,6 +54,65 @@ class JSIter:
 
 	return cast( retval, self.typ )
 
+class jack_client_load_t( Structure ):
+    _pack_ = 1
+    _fields_ = [ ( "cycles", c_uint32 ),
+                 ( "p50_usecs", c_float ),
+                 ( "p99_usecs", c_float ),
+                 ( "max_usecs", c_float ),
+                 ( "perf_cycles", c_uint32 ),
+                 ( "p50_ipc", c_float ),
+                 ( "p1_ipc", c_float ),
+                 ( "p50_llc_misses", c_float ),
+                 ( "p99_llc_misses", c_float ),
+                 ( "fault_cycles", c_uint32 ),
+                 ( "p99_minor_faults", c_float ),
+                 ( "max_minor_faults", c_float ),
+                 ( "major_faults", c_uint32 ),
+                 ( "preempted_cycles", c_uint32 ) ]
+
+class jack_server_client_stats_t( Structure ):
+    _pack_ = 1
+    _fields_ = [ ( "name", c_char * 64 ),
+                 ( "load", jack_client_load_t ) ]
+
+class jack_server_stats_t( Structure ):
+    _pack_ = 1
+    _fields_ = [ ( "version", c_uint32 ),
+                 ( "size", c_uint32 ),
+                 ( "cpu_load", c_float ),
+                 ( "max_delayed_usecs", c_float ),
+                 ( "buffer_size", c_uint32 ),
+                 ( "sample_rate", c_uint32 ),
+                 ( "xruns", c_uint64 * 3 ),
+                 ( "cycles", c_uint32 ),
+                 ( "p50_cycle_usecs", c_float ),
+                 ( "p90_cycle_usecs", c_float ),
+                 ( "p99_cycle_usecs", c_float ),
+                 ( "max_cycle_usecs", c_float ),
+                 ( "driver_metrics", c_uint32 ),
+                 ( "nclients", c_uint32 ) ]
+
+def stats_to_dict( stats_ptr ):
+    stats = stats_ptr.contents
+    clients = cast( addressof(stats) + sizeof(jack_server_stats_t),
+                    POINTER(jack_server_client_stats_t) )
+    d = {}
+    for name, typ in jack_server_stats_t._fields_:
+	if name == "xruns":
+	    d[name] = dict( zip( ( "driver", "wakeup", "client" ), stats.xruns ) )
+	elif name not in ( "version", "size", "driver_metrics" ):
+	    d[name] = getattr( stats, name )
+    d["clients"] = {}
+    for i in range( stats.nclients ):
+	load = clients[i].load
+	d["clients"][clients[i].name] = dict( ( name, getattr( load, name ) )
+					      for name, typ in jack_client_load_t._fields_ )
+    if stats.driver_metrics:
+	d["driver_metrics"] = string_at( addressof(stats) + stats.driver_metrics )
+    libj.jack_free( stats_ptr )
+    return d
+
 DeviceAcquireFunc = CFUNCTYPE( c_int, c_char_p )
 DeviceReleaseFunc = CFUNCTYPE( None, c_char_p )
 
@@ -109,6 +168,21 @@ jackctl_parameter_get_id = libjs.jackctl_parameter_get_id
 jackctl_parameter_get_id.argtypes = [ POINTER(jackctl_parameter_t) ]
 jackctl_parameter_get_id.restype  = c_char
 
+jackctl_server_get_stats = libjs.jackctl_server_get_stats
+jackctl_server_get_stats.argtypes = [ POINTER(jackctl_server_t) ]
+jackctl_server_get_stats.restype  = POINTER(jack_server_stats_t)
+
+# for supervisors outside the server's process; None for the default server
+jack_server_stats_query = libj.jack_server_stats_query
+jack_server_stats_query.argtypes = [ c_char_p ]
+jack_server_stats_query.restype  = POINTER(jack_server_stats_t)
+
+def query_stats( server_name=None ):
+    stats_ptr = jack_server_stats_query( server_name )
+    if not stats_ptr:
+	return None
+    return stats_to_dict( stats_ptr )
+
 jackctl_server_switch_master = libjs.jackctl_server_switch_master
 jackctl_server_switch_master.argtypes = [ POINTER(jackctl_server_t), POINTER(jackctl_driver_t) ]
 jackctl_server_switch_master.restype  = c_bool
@@ -227,6 +301,12 @@ class Server(object):
     def stop( self ):
 	return jackctl_server_stop( self.srv_ptr )
 
+    def get_stats( self ):
+	stats_ptr = jackctl_server_get_stats( self.srv_ptr )
+	if not stats_ptr:
+	    return None
+	return stats_to_dict( stats_ptr )
+
 
     def acquire_card( self, cardname ):
 	if self.acquire_card_cb: